@@ -0,0 +1,69 @@
+// FILE: bench/convergence_sim.cpp
+// Description: Runs the OT and CRDT models through the discrete-event network simulator at scale
+//
+// Usage: convergence_sim [--model=ot|crdt|all] [--json] [simulation options]
+//
+// Simulation options are those of SimulationOptions::parse(), e.g.
+// --sites=64 --seconds=600 --edit-rate=2 --disconnect-rate=1 --partition-rate=0.5
+// --latency=40 --jitter=60 --strategy=lseq --seed=7. Times are in simulated
+// milliseconds, --seconds excepted. --model=all runs OT and every CRDT
+// strategy on the same options. Exits 1 if a model did not converge.
+
+#include "common/simulation/convergence_simulator.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace collab;
+using namespace collab::simulation;
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    std::string model = "all";
+    bool json = false;
+    for (const std::string& arg : args) {
+        if (arg.rfind("--model=", 0) == 0) {
+            model = arg.substr(8);
+        } else if (arg == "--json") {
+            json = true;
+        }
+    }
+
+    std::vector<SimulationReport> reports;
+    try {
+        SimulationOptions options = SimulationOptions::parse(args);
+        if (model == "ot" || model == "all") {
+            reports.push_back(OtSimulation(options).run());
+        }
+        if (model == "crdt") {
+            reports.push_back(CrdtSimulation(options).run());
+        } else if (model == "all") {
+            for (auto strategy : {crdt::PositionStrategy::LOGOOT, crdt::PositionStrategy::WOOT,
+                                  crdt::PositionStrategy::LSEQ}) {
+                options.strategy = strategy;
+                reports.push_back(CrdtSimulation(options).run());
+            }
+        }
+        if (reports.empty()) {
+            throw std::invalid_argument("Unknown --model " + model + "; use ot, crdt or all");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "convergence_sim: " << e.what() << std::endl;
+        return 2;
+    }
+
+    bool converged = true;
+    nlohmann::json all = nlohmann::json::array();
+    for (const SimulationReport& report : reports) {
+        converged = converged && report.converged;
+        if (json) {
+            all.push_back(report.toJson());
+        } else {
+            std::cout << report.toString();
+        }
+    }
+    if (json) {
+        std::cout << all.dump(2) << std::endl;
+    }
+    return converged ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// FILE: bench/crdt_identifier_bench.cpp
+// Description: Identifier length growth of the CRDT position strategies under editing traces
+
+#include <benchmark/benchmark.h>
+#include "common/crdt/crdt_document.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace collab::crdt;
+
+namespace {
+
+enum Trace {
+    APPEND,   // typing before a trailing newline, so runs cannot simply be extended
+    PREPEND,  // typing at the very start
+    RANDOM    // single characters at uniformly random indices
+};
+
+template <typename Document, typename Configure>
+void runTrace(benchmark::State& state, Configure configure, Trace trace) {
+    const auto edits = static_cast<size_t>(state.range(0));
+    double averageDepth = 0;
+    size_t maxDepth = 0;
+    
+    for (auto _ : state) {
+        Document document("bench");
+        configure(document);
+        document.localInsert('\n', 0);
+        std::mt19937 rng(1);
+        
+        for (size_t i = 0; i < edits; ++i) {
+            size_t index = 0;
+            if (trace == APPEND) {
+                index = document.size() - 1;
+            } else if (trace == RANDOM) {
+                index = std::uniform_int_distribution<size_t>(0, document.size())(rng);
+            }
+            document.localInsert('x', index);
+        }
+        
+        state.PauseTiming();
+        size_t totalDepth = 0;
+        maxDepth = 0;
+        for (size_t i = 0; i < document.size(); ++i) {
+            size_t depth = document.at(i).getPosition().size();
+            totalDepth += depth;
+            maxDepth = std::max(maxDepth, depth);
+        }
+        averageDepth = static_cast<double>(totalDepth) / static_cast<double>(document.size());
+        state.ResumeTiming();
+    }
+    
+    state.counters["avg_depth"] = averageDepth;
+    state.counters["max_depth"] = static_cast<double>(maxDepth);
+}
+
+void runTrace(benchmark::State& state, CrdtDocument::Strategy strategy, Trace trace) {
+    runTrace<CrdtDocument>(state, [strategy](CrdtDocument& document) { document.setStrategy(strategy); }, trace);
+}
+
+void BM_LogootAppend(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LOGOOT, APPEND); }
+void BM_LogootPrepend(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LOGOOT, PREPEND); }
+void BM_LogootRandom(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LOGOOT, RANDOM); }
+void BM_LseqAppend(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LSEQ, APPEND); }
+void BM_LseqPrepend(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LSEQ, PREPEND); }
+void BM_LseqRandom(benchmark::State& state) { runTrace(state, CrdtDocument::Strategy::LSEQ, RANDOM); }
+
+// The same trace with the policy fixed at compile time
+void BM_StaticLseqRandom(benchmark::State& state) {
+    runTrace<LseqCrdtDocument>(state, [](LseqCrdtDocument&) {}, RANDOM);
+}
+
+// Identifiers of the given depth that share all but their last digit, as neighbours in a dense region do
+std::vector<Identifier> siblings(size_t depth) {
+    const SiteId site = SiteRegistry::getInstance().intern("bench");
+    std::mt19937 rng(3);
+    std::vector<Identifier> ids;
+    for (uint32_t i = 0; i < 4096; ++i) {
+        Position position;
+        for (size_t level = 0; level < depth; ++level) {
+            position.push_back(level + 1 < depth ? 5 : static_cast<int32_t>(rng() % 64), site);
+        }
+        ids.push_back({position, i, site});
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void BM_IdentifierCompare(benchmark::State& state) {
+    const std::vector<Identifier> ids = siblings(static_cast<size_t>(state.range(0)));
+    size_t i = 0;
+    int sum = 0;
+    for (auto _ : state) {
+        sum += ids[i & 4095].compare(ids[(i * 7 + 1) & 4095]);
+        ++i;
+    }
+    benchmark::DoNotOptimize(sum);
+}
+
+// Binary search inside one run, as every remote insert landing next to the run does
+void BM_RunSearch(benchmark::State& state) {
+    const SiteId site = SiteRegistry::getInstance().intern("bench");
+    Position position;
+    for (int64_t level = 0; level < state.range(0); ++level) {
+        position.push_back(100, site);
+    }
+    const CrdtItem run({position, 1, site}, std::string(4096, 'x'));
+    std::vector<Identifier> targets;
+    for (uint32_t offset = 0; offset < 4096; offset += 37) {
+        targets.push_back(run.idAt(offset));
+    }
+    size_t i = 0;
+    size_t sum = 0;
+    for (auto _ : state) {
+        sum += run.countBefore(targets[i++ % targets.size()]);
+    }
+    benchmark::DoNotOptimize(sum);
+}
+
+} // namespace
+
+BENCHMARK(BM_LogootAppend)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_LogootPrepend)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_LogootRandom)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_LseqAppend)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_LseqPrepend)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_LseqRandom)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_StaticLseqRandom)->Arg(1000)->Arg(10000);
+// Depths 2 and 8: positions inline, and spilled past Position::INLINE_CAPACITY
+BENCHMARK(BM_IdentifierCompare)->Arg(2)->Arg(8);
+BENCHMARK(BM_RunSearch)->Arg(2)->Arg(8);
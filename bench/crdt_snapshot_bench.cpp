@@ -0,0 +1,55 @@
+// FILE: bench/crdt_snapshot_bench.cpp
+// Description: Encoding and cold-start loading of CRDT document snapshots
+
+#include <benchmark/benchmark.h>
+#include "common/crdt/crdt_document.h"
+#include <random>
+#include <string>
+
+using namespace collab::crdt;
+
+namespace {
+
+// Fill a document with edits at random places, so it is stored as many short runs
+void edit(CrdtDocument& document, size_t edits) {
+    document.setStrategy(CrdtDocument::Strategy::LSEQ);
+    std::mt19937 rng(1);
+    for (size_t i = 0; i < edits; ++i) {
+        size_t index = std::uniform_int_distribution<size_t>(0, document.size())(rng);
+        if (i % 5 == 4 && index < document.size()) {
+            document.localDelete(index, 2);
+        } else {
+            document.localInsert("word ", index);
+        }
+    }
+}
+
+void BM_SnapshotEncode(benchmark::State& state) {
+    CrdtDocument document("bench");
+    edit(document, static_cast<size_t>(state.range(0)));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::string snapshot = document.toSnapshot();
+        bytes = snapshot.size();
+        benchmark::DoNotOptimize(snapshot);
+    }
+    state.counters["bytes"] = static_cast<double>(bytes);
+    state.counters["runs"] = static_cast<double>(document.itemCount());
+}
+
+void BM_SnapshotLoad(benchmark::State& state) {
+    CrdtDocument source("bench");
+    edit(source, static_cast<size_t>(state.range(0)));
+    const std::string snapshot = source.toSnapshot();
+    for (auto _ : state) {
+        CrdtDocument document("server");
+        document.loadSnapshot(snapshot);
+        benchmark::DoNotOptimize(document.size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * snapshot.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_SnapshotEncode)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SnapshotLoad)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,35 @@
+// FILE: bench/document_buffer_bench.cpp
+// Description: Keystroke cost near the start of large documents, std::string vs Rope
+
+#include <benchmark/benchmark.h>
+#include "common/ot/rope.h"
+#include <string>
+
+using namespace collab::ot;
+
+namespace {
+
+void BM_StringInsertNearStart(benchmark::State& state) {
+    std::string document(static_cast<size_t>(state.range(0)), 'a');
+    
+    for (auto _ : state) {
+        document.insert(16, "x");
+        document.erase(16, 1);
+        benchmark::DoNotOptimize(document.data());
+    }
+}
+
+void BM_RopeInsertNearStart(benchmark::State& state) {
+    Rope document(std::string(static_cast<size_t>(state.range(0)), 'a'));
+    
+    for (auto _ : state) {
+        document.insert(16, "x");
+        document.erase(16, 1);
+        benchmark::DoNotOptimize(document);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_StringInsertNearStart)->Arg(64 << 10)->Arg(1 << 20)->Arg(8 << 20);
+BENCHMARK(BM_RopeInsertNearStart)->Arg(64 << 10)->Arg(1 << 20)->Arg(8 << 20);
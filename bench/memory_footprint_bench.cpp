@@ -0,0 +1,246 @@
+// FILE: bench/memory_footprint_bench.cpp
+// Description: Bytes of memory per visible character for each document representation
+//
+// Every benchmark loads the same generated corpus into one representation,
+// applies a seeded edit history of the given length and reports what the
+// representation holds at the end: live heap bytes, the allocations made,
+// resident set growth and live bytes per visible character. The timings
+// are incidental; the counters are the tracked numbers.
+
+#include <benchmark/benchmark.h>
+#include "client/editor/document.h"
+#include "client/editor/piece_table.h"
+#include "common/crdt/crdt_document.h"
+#include "common/document/document_controller.h"
+#include "common/ot/operation.h"
+#include "common/ot/rope.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+// Heap use of the whole process, counted by the replaced operator new and delete below
+struct HeapCounters {
+    std::atomic<int64_t> liveBytes{0};
+    std::atomic<uint64_t> allocations{0};
+};
+
+HeapCounters heap;
+
+// Room in front of every allocation for its size, keeping the rest aligned
+constexpr size_t HEADER = alignof(std::max_align_t);
+
+void* countedAllocate(size_t bytes) {
+    void* block = std::malloc(bytes + HEADER);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *static_cast<size_t*>(block) = bytes;
+    heap.liveBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    heap.allocations.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<char*>(block) + HEADER;
+}
+
+void countedFree(void* memory) noexcept {
+    if (!memory) {
+        return;
+    }
+    void* block = static_cast<char*>(memory) - HEADER;
+    heap.liveBytes.fetch_sub(static_cast<int64_t>(*static_cast<size_t*>(block)), std::memory_order_relaxed);
+    std::free(block);
+}
+
+} // namespace
+
+void* operator new(size_t bytes) {
+    return countedAllocate(bytes);
+}
+
+void* operator new[](size_t bytes) {
+    return countedAllocate(bytes);
+}
+
+void operator delete(void* memory) noexcept {
+    countedFree(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    countedFree(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    countedFree(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    countedFree(memory);
+}
+
+namespace {
+
+using namespace collab;
+
+int64_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    int64_t pages = 0;
+    int64_t resident = 0;
+    if (!(statm >> pages >> resident)) {
+        return 0;
+    }
+    return resident * static_cast<int64_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Prose-like text in lines of up to 80 characters, the same for every representation
+std::string corpus(size_t length) {
+    static const char* const words[] = {"the", "shared", "document", "is", "edited", "by", "several",
+                                        "people", "at", "once", "and", "every", "change", "converges"};
+    std::mt19937 rng(42);
+    std::string text;
+    text.reserve(length);
+    size_t column = 0;
+    while (text.size() < length) {
+        const std::string word = words[std::uniform_int_distribution<size_t>(0, std::size(words) - 1)(rng)];
+        if (column + word.size() + 1 > 80) {
+            text += '\n';
+            column = 0;
+        } else if (column > 0) {
+            text += ' ';
+            ++column;
+        }
+        text += word;
+        column += word.size();
+    }
+    text.resize(length);
+    return text;
+}
+
+// The representations, behind the three calls the benchmark needs
+
+struct StringText {
+    std::string text;
+    void load(const std::string& corpus) { text = corpus; }
+    void insert(size_t offset, const std::string& word) { text.insert(offset, word); }
+    void erase(size_t offset, size_t count) { text.erase(offset, count); }
+    size_t length() const { return text.size(); }
+};
+
+struct RopeText {
+    ot::Rope text;
+    void load(const std::string& corpus) { text = ot::Rope(corpus); }
+    void insert(size_t offset, const std::string& word) { text.insert(offset, word); }
+    void erase(size_t offset, size_t count) { text.erase(offset, count); }
+    size_t length() const { return text.length(); }
+};
+
+struct PieceTableText {
+    document::PieceTable text;
+    void load(const std::string& corpus) { text.assign(corpus); }
+    void insert(size_t offset, const std::string& word) { text.insert(offset, word); }
+    void erase(size_t offset, size_t count) { text.erase(offset, count); }
+    size_t length() const { return text.length(); }
+};
+
+// The server's controller, with its operation log and undo history
+struct ControllerText {
+    std::unique_ptr<DocumentController> controller;
+    size_t size = 0;
+    void load(const std::string& corpus) {
+        controller = std::make_unique<DocumentController>(corpus);
+        size = corpus.size();
+    }
+    void insert(size_t offset, const std::string& word) {
+        controller->applyOperation(std::make_shared<ot::InsertOperation>(offset, word), "bench");
+        size += word.size();
+    }
+    void erase(size_t offset, size_t count) {
+        controller->applyOperation(std::make_shared<ot::DeleteOperation>(offset, count), "bench");
+        size -= count;
+    }
+    size_t length() const { return size; }
+};
+
+// The client's line-addressed document, with its undo history, edited by a user with a UUID for an ID
+struct ClientText {
+    static inline const std::string USER = "6f1c0e2a-93b4-4d7e-8a5f-2c9d4b7e1a30";
+    document::Document text;
+    void load(const std::string& corpus) { text.setText(corpus, USER); }
+    void insert(size_t offset, const std::string& word) { text.insertText(text.linearToCursor(offset), word, USER); }
+    void erase(size_t offset, size_t count) { text.deleteText(text.linearToCursor(offset), count, USER); }
+    size_t length() const { return text.getTextLength(); }
+};
+
+// The CRDT, tombstones included
+struct CrdtText {
+    crdt::CrdtDocument text{"bench"};
+    void load(const std::string& corpus) {
+        text.seedPositions(1);
+        text.localInsert(corpus, 0);
+    }
+    void insert(size_t offset, const std::string& word) { text.localInsert(word, offset); }
+    void erase(size_t offset, size_t count) { text.localDelete(offset, count); }
+    size_t length() const { return text.size(); }
+};
+
+template <typename Text>
+void BM_Footprint(benchmark::State& state) {
+    const std::string text = corpus(static_cast<size_t>(state.range(0)));
+    const size_t edits = static_cast<size_t>(state.range(1));
+
+    for (auto _ : state) {
+        const int64_t liveBefore = heap.liveBytes.load();
+        const uint64_t allocationsBefore = heap.allocations.load();
+        const int64_t residentBefore = residentBytes();
+
+        auto document = std::make_unique<Text>();
+        document->load(text);
+        std::mt19937 rng(7);
+        for (size_t i = 0; i < edits; ++i) {
+            const size_t length = document->length();
+            const size_t offset = std::uniform_int_distribution<size_t>(0, length)(rng);
+            if (i % 3 == 2 && offset + 3 <= length) {
+                document->erase(offset, 3);
+            } else {
+                document->insert(offset, "word ");
+            }
+        }
+
+        const int64_t live = heap.liveBytes.load() - liveBefore;
+        state.counters["live_bytes"] = static_cast<double>(live);
+        state.counters["allocations"] = static_cast<double>(heap.allocations.load() - allocationsBefore);
+        state.counters["rss_bytes"] = static_cast<double>(residentBytes() - residentBefore);
+        state.counters["bytes_per_char"] =
+            static_cast<double>(live) / static_cast<double>(std::max<size_t>(document->length(), 1));
+        benchmark::DoNotOptimize(document->length());
+
+        state.PauseTiming();
+        document.reset();
+        state.ResumeTiming();
+    }
+}
+
+// Corpus size, in characters, and edit history length
+void footprintArgs(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t size : {64 << 10, 1 << 20}) {
+        for (int64_t edits : {0, 1000, 10000}) {
+            benchmark->Args({size, edits});
+        }
+    }
+    benchmark->Iterations(1)->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Footprint, StringText)->Apply(footprintArgs);
+BENCHMARK_TEMPLATE(BM_Footprint, RopeText)->Apply(footprintArgs);
+BENCHMARK_TEMPLATE(BM_Footprint, PieceTableText)->Apply(footprintArgs);
+BENCHMARK_TEMPLATE(BM_Footprint, ControllerText)->Apply(footprintArgs);
+BENCHMARK_TEMPLATE(BM_Footprint, ClientText)->Apply(footprintArgs);
+BENCHMARK_TEMPLATE(BM_Footprint, CrdtText)->Apply(footprintArgs);
@@ -0,0 +1,211 @@
+// FILE: bench/ot_bench.cpp
+// Description: Baseline costs of the OT core: apply, transform, inverse and the wire format
+
+#include <benchmark/benchmark.h>
+#include "common/ot/operation.h"
+#include "common/ot/rope.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace collab::ot;
+
+namespace {
+
+// Document sizes swept by the apply benchmarks, 1 KB to 100 MB
+void documentSizes(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t size : {int64_t{1} << 10, int64_t{10} << 10, int64_t{100} << 10, int64_t{1} << 20,
+                         int64_t{10} << 20, int64_t{100} << 20}) {
+        benchmark->Arg(size);
+    }
+}
+
+// History lengths swept by the transform benchmarks, 1 to 10k
+void historyLengths(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t length : {1, 10, 100, 1000, 10000}) {
+        benchmark->Arg(length);
+    }
+}
+
+// Iterations between putting the document back to its starting size, outside the timing
+constexpr int64_t RESTORE_EVERY = 1024;
+
+/**
+ * One keystroke applied mid-document, insert or delete, on a std::string or a Rope
+ *
+ * Every RESTORE_EVERY iterations the document is put back to its starting
+ * size with the timer paused, so the size measured stays the size swept.
+ */
+template <typename Document, bool Insert>
+void BM_Apply(benchmark::State& state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    Document document(std::string(size, 'a'));
+    const size_t position = size / 2;
+    const InsertOperation insert(position, "x");
+    const DeleteOperation erase(position, 1);
+
+    int64_t pending = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Insert ? insert.apply(document) : erase.apply(document));
+        if (++pending == RESTORE_EVERY) {
+            state.PauseTiming();
+            if (Insert) {
+                DeleteOperation(position, static_cast<size_t>(pending)).apply(document);
+            } else {
+                InsertOperation(position, std::string(static_cast<size_t>(pending), 'a')).apply(document);
+            }
+            pending = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// An operation of a kind, on the middle of a 1000-character document
+OperationPtr makeOperation(OperationKind kind, size_t position) {
+    switch (kind) {
+    case OperationKind::INSERT:
+        return std::make_shared<InsertOperation>(position, "abc");
+    case OperationKind::DELETE:
+        return std::make_shared<DeleteOperation>(position, 3, "abc");
+    case OperationKind::REPLACE:
+        return std::make_shared<ReplaceOperation>(position, 3, "xyz", "abc");
+    default: {
+        // The same replacement as a delete and an insert
+        auto composite = std::make_shared<CompositeOperation>();
+        composite->addOperation(std::make_shared<DeleteOperation>(position, 3, "abc"));
+        composite->addOperation(std::make_shared<InsertOperation>(position, "xyz"));
+        return composite;
+    }
+    }
+}
+
+const char* kindName(OperationKind kind) {
+    switch (kind) {
+    case OperationKind::INSERT:
+        return "insert";
+    case OperationKind::DELETE:
+        return "delete";
+    case OperationKind::REPLACE:
+        return "replace";
+    default:
+        return "composite";
+    }
+}
+
+// Every pair of kinds, as (operation, against)
+void kindPairs(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t op = 0; op < static_cast<int64_t>(OPERATION_KIND_COUNT); ++op) {
+        for (int64_t against = 0; against < static_cast<int64_t>(OPERATION_KIND_COUNT); ++against) {
+            benchmark->Args({op, against});
+        }
+    }
+}
+
+// One transform step, for each pair of kinds; the operations overlap so the full path is taken
+void BM_TransformPair(benchmark::State& state) {
+    const auto opKind = static_cast<OperationKind>(state.range(0));
+    const auto againstKind = static_cast<OperationKind>(state.range(1));
+    const OperationPtr op = makeOperation(opKind, 500);
+    const OperationPtr against = makeOperation(againstKind, 501);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op->transform(against));
+    }
+    state.SetLabel(std::string(kindName(opKind)) + "/" + kindName(againstKind));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Concurrent typing: a mix of one-character inserts and deletes spread over the document
+std::vector<OperationPtr> makeHistory(size_t count) {
+    std::vector<OperationPtr> history;
+    history.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 3 == 2) {
+            history.push_back(std::make_shared<DeleteOperation>(i % 997, 1, "x"));
+        } else {
+            history.push_back(std::make_shared<InsertOperation>(i % 991, "a"));
+        }
+    }
+    return history;
+}
+
+// An operation made on an old revision, brought up to head through the history since
+template <OperationKind Kind>
+void BM_TransformHistory(benchmark::State& state) {
+    const auto history = makeHistory(static_cast<size_t>(state.range(0)));
+    const OperationPtr incoming = makeOperation(Kind, 500);
+
+    for (auto _ : state) {
+        OperationPtr current = incoming;
+        for (const auto& op : history) {
+            current = current->transform(op);
+        }
+        benchmark::DoNotOptimize(current);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <OperationKind Kind>
+void BM_Inverse(benchmark::State& state) {
+    const OperationPtr op = makeOperation(Kind, 500);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op->inverse());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// An operation carrying a given number of characters
+OperationPtr makeSized(OperationKind kind, size_t characters) {
+    const std::string text(characters, 'a');
+    if (kind == OperationKind::INSERT) {
+        return std::make_shared<InsertOperation>(500, text);
+    }
+    return std::make_shared<DeleteOperation>(500, characters, text);
+}
+
+template <OperationKind Kind>
+void BM_Serialize(benchmark::State& state) {
+    const OperationPtr op = makeSized(Kind, static_cast<size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op->serialize());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(op->serialize().size()));
+}
+
+template <OperationKind Kind>
+void BM_Deserialize(benchmark::State& state) {
+    const std::string wire = makeSized(Kind, static_cast<size_t>(state.range(0)))->serialize();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(OperationFactory::deserialize(wire));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(wire.size()));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Apply, std::string, true)->Apply(documentSizes);
+BENCHMARK_TEMPLATE(BM_Apply, std::string, false)->Apply(documentSizes);
+BENCHMARK_TEMPLATE(BM_Apply, Rope, true)->Apply(documentSizes);
+BENCHMARK_TEMPLATE(BM_Apply, Rope, false)->Apply(documentSizes);
+
+BENCHMARK(BM_TransformPair)->Apply(kindPairs);
+BENCHMARK_TEMPLATE(BM_TransformHistory, OperationKind::INSERT)->Apply(historyLengths);
+BENCHMARK_TEMPLATE(BM_TransformHistory, OperationKind::DELETE)->Apply(historyLengths);
+BENCHMARK_TEMPLATE(BM_TransformHistory, OperationKind::REPLACE)->Apply(historyLengths);
+BENCHMARK_TEMPLATE(BM_TransformHistory, OperationKind::COMPOSITE)->Apply(historyLengths);
+
+BENCHMARK_TEMPLATE(BM_Inverse, OperationKind::INSERT);
+BENCHMARK_TEMPLATE(BM_Inverse, OperationKind::DELETE);
+BENCHMARK_TEMPLATE(BM_Inverse, OperationKind::REPLACE);
+BENCHMARK_TEMPLATE(BM_Inverse, OperationKind::COMPOSITE);
+
+BENCHMARK_TEMPLATE(BM_Serialize, OperationKind::INSERT)->RangeMultiplier(16)->Range(1, 4096);
+BENCHMARK_TEMPLATE(BM_Serialize, OperationKind::DELETE)->RangeMultiplier(16)->Range(1, 4096);
+BENCHMARK_TEMPLATE(BM_Deserialize, OperationKind::INSERT)->RangeMultiplier(16)->Range(1, 4096);
+BENCHMARK_TEMPLATE(BM_Deserialize, OperationKind::DELETE)->RangeMultiplier(16)->Range(1, 4096);
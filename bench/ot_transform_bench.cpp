@@ -0,0 +1,151 @@
+// FILE: bench/ot_transform_bench.cpp
+// Description: Compares transform dispatch paths and the composed bulk transform
+
+#include <benchmark/benchmark.h>
+#include "common/ot/operation.h"
+#include "common/ot/bulk_transform.h"
+#include "common/ot/operation_log.h"
+#include "common/ot/transform_arena.h"
+#include <memory>
+#include <vector>
+
+using namespace collab::ot;
+
+namespace {
+
+/**
+ * Reference implementation of the previous dispatch: one dynamic_pointer_cast
+ * per candidate type, each bumping the refcount of the other operation.
+ * Only the position arithmetic is kept so the cost measured is the dispatch.
+ */
+OperationPtr legacyTransform(const OperationPtr& op, const OperationPtr& other) {
+    if (auto insert = std::dynamic_pointer_cast<InsertOperation>(op)) {
+        if (auto otherInsert = std::dynamic_pointer_cast<InsertOperation>(other)) {
+            size_t position = insert->getPosition();
+            if (otherInsert->getPosition() <= position) {
+                position += otherInsert->getText().length();
+            }
+            return std::make_shared<InsertOperation>(position, insert->getText());
+        }
+        else if (auto otherDelete = std::dynamic_pointer_cast<DeleteOperation>(other)) {
+            size_t position = insert->getPosition();
+            if (otherDelete->getPosition() < position) {
+                size_t deleteEnd = otherDelete->getPosition() + otherDelete->getLength();
+                position = deleteEnd <= position ? position - otherDelete->getLength()
+                                                 : otherDelete->getPosition();
+            }
+            return std::make_shared<InsertOperation>(position, insert->getText());
+        }
+    }
+    else if (auto del = std::dynamic_pointer_cast<DeleteOperation>(op)) {
+        if (auto otherInsert = std::dynamic_pointer_cast<InsertOperation>(other)) {
+            size_t position = del->getPosition();
+            size_t length = del->getLength();
+            if (otherInsert->getPosition() <= position) {
+                position += otherInsert->getText().length();
+            } else if (otherInsert->getPosition() < position + length) {
+                length += otherInsert->getText().length();
+            }
+            return std::make_shared<DeleteOperation>(position, length, del->getDeletedText());
+        }
+        else if (auto otherDelete = std::dynamic_pointer_cast<DeleteOperation>(other)) {
+            if (otherDelete->getPosition() + otherDelete->getLength() <= del->getPosition()) {
+                return std::make_shared<DeleteOperation>(
+                    del->getPosition() - otherDelete->getLength(), del->getLength(), del->getDeletedText());
+            }
+        }
+    }
+    return op->clone();
+}
+
+// Mixed history of single-character inserts and deletes, like concurrent typing
+std::vector<OperationPtr> makeHistory(size_t count) {
+    std::vector<OperationPtr> history;
+    history.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 3 == 2) {
+            history.push_back(std::make_shared<DeleteOperation>(i % 97, 1, "x"));
+        } else {
+            history.push_back(std::make_shared<InsertOperation>(i % 89, "a"));
+        }
+    }
+    return history;
+}
+
+void BM_TransformTagged(benchmark::State& state) {
+    auto history = makeHistory(static_cast<size_t>(state.range(0)));
+    OperationPtr incoming = std::make_shared<InsertOperation>(1000, "z");
+    
+    for (auto _ : state) {
+        OperationPtr current = incoming;
+        for (const auto& op : history) {
+            current = current->transform(op);
+        }
+        benchmark::DoNotOptimize(current);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_TransformLegacy(benchmark::State& state) {
+    auto history = makeHistory(static_cast<size_t>(state.range(0)));
+    OperationPtr incoming = std::make_shared<InsertOperation>(1000, "z");
+    
+    for (auto _ : state) {
+        OperationPtr current = incoming;
+        for (const auto& op : history) {
+            current = legacyTransform(current, op);
+        }
+        benchmark::DoNotOptimize(current);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_TransformBulkCached(benchmark::State& state) {
+    // Every reconnecting client shares the cached composition of the suffix
+    auto history = makeHistory(static_cast<size_t>(state.range(0)));
+    HistoryComposer composer;
+    const TextOperation& composed = composer.compose(0, history, 2000);
+    InsertOperation incoming(1000, "z");
+    
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(transformAgainst(incoming, composed));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_TransformThroughLog(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    OperationLog log(count);
+    for (const auto& op : makeHistory(count)) {
+        log.append(op);
+    }
+    OperationPtr incoming = std::make_shared<InsertOperation>(1000, "z");
+    
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(transformThrough(incoming, log.since(0)));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_TransformSinceColumns(benchmark::State& state) {
+    // The same walk over the log's packed shape columns
+    const size_t count = static_cast<size_t>(state.range(0));
+    OperationLog log(count);
+    for (const auto& op : makeHistory(count)) {
+        log.append(op);
+    }
+    OperationPtr incoming = std::make_shared<InsertOperation>(1000, "z");
+    
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(log.transformSince(incoming, 0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK(BM_TransformTagged)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_TransformLegacy)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_TransformBulkCached)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_TransformThroughLog)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_TransformSinceColumns)->Arg(16)->Arg(256)->Arg(4096);
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""Performance regression gate: run the hot-path benchmarks and compare them to a stored baseline.
+
+Usage:
+    perf_check.py --bench-dir DIR [--server PATH] [--baseline FILE] [--cpu N]
+                  [--repetitions N] [--min-time SECONDS] [--threshold PERCENT] [--update]
+
+Each benchmark of the gate runs --repetitions times pinned to one CPU with
+taskset, and its median CPU time is compared to the baseline's. A benchmark
+regresses when it is slower by more than --threshold percent, or by more
+than NOISE_FACTOR times its coefficient of variation if that is larger, so
+a noisy benchmark does not fail the gate on noise alone. With --server, the
+server's --selftest adds the broadcast path, as time per delivered message.
+
+--update runs the gate and writes the results as the new baseline. Baselines
+only compare on the machine that recorded them; the gate warns when the host
+differs.
+
+Exit status: 0 if nothing regressed, 1 if something did, 2 on errors.
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+
+# The hot paths: transform, apply, decode and broadcast
+GATE = {
+    "ot_bench": "BM_Apply<.*>/(1024|102400|1048576)$|BM_TransformPair|BM_TransformHistory<.*>/1000$"
+                "|BM_Inverse|BM_Deserialize<.*>/(1|256)$",
+    "protocol_codec_bench": "BM_(Json|Binary)Decode/(edit_insert|presence_cursor|batch_edits|sync_state_large)$",
+}
+
+SELFTEST_ARGS = ["--selftest", "--json", "--documents=1", "--clients=8", "--document-size=16384",
+                 "--presence-ratio=0.5", "--seconds=3", "--seed=1"]
+
+NOISE_FACTOR = 3.0
+
+DEFAULT_BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "perf_baseline.json")
+
+
+def host():
+    """What the results were measured on."""
+    model = platform.processor() or "unknown"
+    try:
+        with open("/proc/cpuinfo") as cpuinfo:
+            for line in cpuinfo:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {"cpu": model, "cpus": os.cpu_count(), "system": platform.system()}
+
+
+def pinned(command, cpu):
+    if cpu is not None and shutil.which("taskset"):
+        return ["taskset", "-c", str(cpu)] + command
+    return command
+
+
+def run_benchmarks(binary, pattern, args):
+    """Median CPU nanoseconds and coefficient of variation of each benchmark matching the pattern."""
+    command = pinned([binary, "--benchmark_filter=" + pattern, "--benchmark_format=json",
+                      "--benchmark_repetitions=%d" % args.repetitions,
+                      "--benchmark_min_time=%g" % args.min_time,
+                      "--benchmark_report_aggregates_only=true"], args.cpu)
+    output = subprocess.run(command, check=True, capture_output=True, text=True).stdout
+    results = {}
+    for benchmark in json.loads(output)["benchmarks"]:
+        if benchmark.get("run_type") != "aggregate":
+            continue
+        name = benchmark["run_name"]
+        entry = results.setdefault(name, {})
+        scale = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}[benchmark.get("time_unit", "ns")]
+        if benchmark["aggregate_name"] == "median":
+            entry["ns"] = benchmark["cpu_time"] * scale
+        elif benchmark["aggregate_name"] == "cv":
+            entry["cv"] = benchmark["cpu_time"]
+    return results
+
+
+def run_selftest(server, args):
+    """Nanoseconds per applied edit and per delivered message through the server's own edit path."""
+    per_edit = []
+    per_delivery = []
+    for _ in range(args.repetitions):
+        output = subprocess.run(pinned([server] + SELFTEST_ARGS, args.cpu), check=True, capture_output=True,
+                                text=True).stdout
+        report = json.loads(output)
+        per_edit.append(1e9 / report["editsPerSecond"])
+        per_delivery.append(1e9 / report["deliveriesPerSecond"])
+    results = {}
+    for name, samples in (("selftest/edit", per_edit), ("selftest/broadcast_delivery", per_delivery)):
+        median = statistics.median(samples)
+        cv = statistics.stdev(samples) / statistics.mean(samples) if len(samples) > 1 else 0.0
+        results[name] = {"ns": median, "cv": cv}
+    return results
+
+
+def measure(args):
+    results = {}
+    for binary, pattern in GATE.items():
+        path = os.path.join(args.bench_dir, binary)
+        if not os.access(path, os.X_OK):
+            raise RuntimeError("Benchmark %s not found; build it with BUILD_BENCHMARKS=ON" % path)
+        results.update(run_benchmarks(path, pattern, args))
+    if args.server:
+        results.update(run_selftest(args.server, args))
+    return results
+
+
+def compare(baseline, results, threshold):
+    """Print a comparison table and return the names of the benchmarks that regressed."""
+    regressed = []
+    print("%-60s %12s %12s %8s %8s" % ("benchmark", "baseline ns", "current ns", "change", "allowed"))
+    for name in sorted(results):
+        current = results[name]
+        base = baseline.get(name)
+        if base is None:
+            print("%-60s %12s %12.1f %8s %8s" % (name, "-", current["ns"], "new", "-"))
+            continue
+        change = (current["ns"] - base["ns"]) / base["ns"] * 100
+        noise = NOISE_FACTOR * max(base.get("cv", 0.0), current.get("cv", 0.0)) * 100
+        allowed = max(threshold, noise)
+        failed = change > allowed
+        if failed:
+            regressed.append(name)
+        print("%-60s %12.1f %12.1f %+7.1f%% %7.1f%%%s" % (name, base["ns"], current["ns"], change, allowed,
+                                                          "  REGRESSED" if failed else ""))
+    for name in sorted(set(baseline) - set(results)):
+        print("%-60s missing from this run" % name)
+    return regressed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bench-dir", required=True, help="Directory the benchmark binaries were built in")
+    parser.add_argument("--server", help="Server binary, to gate the broadcast path with --selftest")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="Baseline JSON file")
+    parser.add_argument("--cpu", type=int, default=0, help="CPU to pin the benchmarks to")
+    parser.add_argument("--repetitions", type=int, default=5)
+    parser.add_argument("--min-time", type=float, default=0.2, help="Seconds each repetition runs at least")
+    parser.add_argument("--threshold", type=float, default=10.0, help="Percent slower that fails the gate")
+    parser.add_argument("--update", action="store_true", help="Write the results as the new baseline")
+    args = parser.parse_args()
+
+    try:
+        results = measure(args)
+    except (RuntimeError, OSError, subprocess.CalledProcessError, ValueError, KeyError) as error:
+        print("perf-check: %s" % error, file=sys.stderr)
+        return 2
+
+    if args.update:
+        with open(args.baseline, "w") as file:
+            json.dump({"host": host(), "benchmarks": results}, file, indent=2, sort_keys=True)
+            file.write("\n")
+        print("Wrote %d benchmarks to %s" % (len(results), args.baseline))
+        return 0
+
+    try:
+        with open(args.baseline) as file:
+            baseline = json.load(file)
+    except OSError as error:
+        print("perf-check: no baseline (%s); record one with --update" % error, file=sys.stderr)
+        return 2
+    if baseline.get("host") != host():
+        print("perf-check: warning: baseline was recorded on %s, this is %s" % (baseline.get("host"), host()))
+
+    regressed = compare(baseline["benchmarks"], results, args.threshold)
+    if regressed:
+        print("\n%d hot-path benchmarks regressed: %s" % (len(regressed), ", ".join(regressed)))
+        return 1
+    print("\nNo hot-path regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
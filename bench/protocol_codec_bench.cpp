@@ -0,0 +1,132 @@
+// FILE: bench/protocol_codec_bench.cpp
+// Description: Encode and decode costs of protocol messages, as JSON and as binary frames
+//
+// Measures every message of the shared corpus (fuzz/protocol_corpus.h), which
+// the protocol fuzzer starts from too, so a new codec is measured and fuzzed
+// over the same inputs.
+
+#include <benchmark/benchmark.h>
+#include "common/ot/rope.h"
+#include "common/protocol/parallel_chunks.h"
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "fuzz/protocol_corpus.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace collab::protocol;
+using collab::fuzz::CorpusEntry;
+
+namespace {
+
+// Message::toString, through the message's own writeFields
+void BM_JsonEncode(benchmark::State& state, const CorpusEntry& entry) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(entry.message->toString());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(entry.message->toString().size()));
+}
+
+void BM_JsonDecode(benchmark::State& state, const CorpusEntry& entry) {
+    const std::string frame = entry.message->toString();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Message::fromString(frame));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frame.size()));
+}
+
+// The negotiated binary format, with the string tables of a connection in steady state
+void BM_BinaryEncode(benchmark::State& state, const CorpusEntry& entry) {
+    WireCodec client;
+    WireCodec server;
+    collab::fuzz::negotiateBinary(client, server);
+    const size_t bytes = client.encode(*entry.message).size();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client.encode(*entry.message));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes));
+}
+
+void BM_BinaryDecode(benchmark::State& state, const CorpusEntry& entry) {
+    WireCodec client;
+    WireCodec server;
+    collab::fuzz::negotiateBinary(client, server);
+    const std::string frame = client.encode(*entry.message);
+    server.decode(frame);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.decode(frame));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frame.size()));
+}
+
+// 16 MB of text, as a chunked DOC_OPEN answers it
+std::string largeDocument() {
+    std::string text;
+    for (size_t line = 0; text.size() < (16u << 20); ++line) {
+        text += "line " + std::to_string(line) + " of a large document that is opened in chunks\n";
+    }
+    return text;
+}
+
+DocumentMessage chunkedOpen() {
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "large";
+    open.contentOffset = 0;
+    open.contentLength = 64 * 1024;
+    return open;
+}
+
+// Every response compressed, on one thread or with range(0) threads; 0 for one per core
+void BM_ChunkedOpenEncode(benchmark::State& state) {
+    const collab::ot::Rope text(largeDocument());
+    WireCodec client;
+    WireCodec server;
+    collab::fuzz::negotiateBinary(client, server);
+    for (auto _ : state) {
+        DocumentChunker<collab::ot::Rope> chunker(chunkedOpen(), text, 1);
+        size_t bytes = 0;
+        encodeChunks(chunker, server, [&](std::string frame) { bytes += frame.size(); },
+                     static_cast<size_t>(state.range(0)));
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.length()));
+}
+
+void BM_ChunkedOpenDecode(benchmark::State& state) {
+    const collab::ot::Rope text(largeDocument());
+    WireCodec client;
+    WireCodec server;
+    collab::fuzz::negotiateBinary(client, server);
+    DocumentChunker<collab::ot::Rope> chunker(chunkedOpen(), text, 1);
+    std::vector<std::string> frames;
+    encodeChunks(chunker, server, [&](std::string frame) { frames.push_back(std::move(frame)); });
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(decodeChunks(client, frames, static_cast<size_t>(state.range(0))));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.length()));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    static const auto corpus = collab::fuzz::protocolCorpus();
+    for (const CorpusEntry& entry : corpus) {
+        benchmark::RegisterBenchmark(("BM_JsonEncode/" + entry.name).c_str(), BM_JsonEncode, entry);
+        benchmark::RegisterBenchmark(("BM_JsonDecode/" + entry.name).c_str(), BM_JsonDecode, entry);
+        benchmark::RegisterBenchmark(("BM_BinaryEncode/" + entry.name).c_str(), BM_BinaryEncode, entry);
+        benchmark::RegisterBenchmark(("BM_BinaryDecode/" + entry.name).c_str(), BM_BinaryDecode, entry);
+    }
+    benchmark::RegisterBenchmark("BM_ChunkedOpenEncode", BM_ChunkedOpenEncode)
+        ->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+    benchmark::RegisterBenchmark("BM_ChunkedOpenDecode", BM_ChunkedOpenDecode)
+        ->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
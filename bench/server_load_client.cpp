@@ -0,0 +1,483 @@
+// FILE: bench/server_load_client.cpp
+// Description: Load-test client: N simulated editors over loopback against the WebSocket server
+//
+// Usage: server_load_client [--host=127.0.0.1] [--port=9002] [--connections=N] [--documents=N]
+//                           [--edit-rate=N] [--seconds=N] [--threads=N] [--sample-every=N]
+//                           [--server-pid=PID] [--acks] [--sweep [--max-connections=N] [--slo-ms=N]]
+//
+// Every connection logs in with AUTH_LOGIN, opens its document with
+// DOC_OPEN, then sends single-character inserts at --edit-rate a second on
+// a fixed schedule, and reads everything the server broadcasts. One edit in
+// --sample-every carries a trace ID and its origin time, which the server
+// passes on in the broadcast, so every receiver measures broadcast-receive
+// latency. With --acks (a server started with --ack-durable), each edit's
+// EDIT_APPLY is timed as edit-ack latency. With --server-pid, the server's
+// CPU time is read from /proc and divided by the edits sent. --sweep doubles
+// the connection count from --connections until the edit rate is no longer
+// met or p99 broadcast latency exceeds --slo-ms, and reports where it fell over.
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <unistd.h>
+#include "common/ot/operation.h"
+#include "common/protocol/edit_trace.h"
+#include "common/protocol/protocol.h"
+#include "common/util/metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 9002;
+    size_t connections = 64;
+    size_t documents = 1;           // Connections are spread over this many documents
+    double editsPerSecond = 2;      // Per connection
+    double seconds = 10;            // Measured, after every connection is up
+    size_t threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    uint64_t sampleEvery = 10;      // Edits per one that carries a trace
+    int serverPid = 0;
+    bool acks = false;
+    bool sweep = false;
+    size_t maxConnections = 16384;
+    double sloMillis = 50;
+};
+
+// What the connections of one run share; latencies are in microseconds
+struct Stats {
+    std::atomic<bool> measuring{false};
+    std::atomic<size_t> connected{0};
+    collab::util::Counter sent;
+    collab::util::Counter received;
+    collab::util::Counter errors;
+    collab::util::Histogram ackLatency;
+    collab::util::Histogram broadcastLatency;
+};
+
+// One simulated editor; everything it does runs on its own strand
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(net::io_context& ioc, const LoadOptions& options, Stats& stats, size_t index)
+        : ws_(net::make_strand(ioc)),
+          timer_(ws_.get_executor()),
+          options_(options),
+          stats_(stats),
+          index_(index),
+          documentId_("document-" + std::to_string(index % options.documents)),
+          interval_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.editsPerSecond))) {}
+
+    void start(const tcp::endpoint& endpoint) {
+        beast::get_lowest_layer(ws_).async_connect(endpoint, [self = shared_from_this()](beast::error_code ec) {
+            if (ec) {
+                return self->fail();
+            }
+            beast::get_lowest_layer(self->ws_).socket().set_option(tcp::no_delay(true));
+            self->ws_.async_handshake(self->options_.host, "/", [self](beast::error_code ec) {
+                if (ec) {
+                    return self->fail();
+                }
+                self->open();
+            });
+        });
+    }
+
+private:
+    void open() {
+        using collab::protocol::MessageType;
+        const std::string user = "load-" + std::to_string(index_);
+        collab::protocol::AuthMessage login(MessageType::AUTH_LOGIN);
+        login.clientId = user;
+        login.username = user;
+        login.password = "load";
+        send(login.toString());
+        collab::protocol::DocumentMessage openDocument(MessageType::DOC_OPEN);
+        openDocument.clientId = user;
+        openDocument.documentId = documentId_;
+        send(openDocument.toString());
+
+        ++stats_.connected;
+        read();
+
+        // Start at a random point of the interval so connections do not send in lockstep
+        std::mt19937_64 random(index_);
+        next_ = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                   interval_ * std::uniform_real_distribution<double>(0, 1)(random));
+        schedule();
+    }
+
+    void schedule() {
+        timer_.expires_at(next_);
+        timer_.async_wait([self = shared_from_this()](beast::error_code ec) {
+            if (ec) {
+                return;
+            }
+            self->edit();
+            // A fixed schedule: a late edit does not push the ones after it back
+            self->next_ += self->interval_;
+            self->schedule();
+        });
+    }
+
+    void edit() {
+        // Insert into the part of the document this client knows exists
+        const size_t position = known_ / 2;
+        auto json = nlohmann::json::parse(collab::ot::InsertOperation(position, "x").serialize());
+        json["documentId"] = documentId_;
+        if (++edits_ % options_.sampleEvery == 0) {
+            collab::protocol::EditTrace trace;
+            char id[33];
+            std::snprintf(id, sizeof(id), "%016zx%016llx", index_, static_cast<unsigned long long>(edits_));
+            trace.traceId = id;
+            trace.originTime = collab::protocol::traceNowMicros();
+            trace.writeTo(json);
+        }
+        ++known_;
+        if (options_.acks) {
+            pendingAcks_.push_back(Clock::now());
+        }
+        send(json.dump());
+        if (stats_.measuring) {
+            stats_.sent.add();
+        }
+    }
+
+    void read() {
+        ws_.async_read(buffer_, [self = shared_from_this()](beast::error_code ec, size_t) {
+            if (ec) {
+                return self->fail();
+            }
+            self->receive(beast::buffers_to_string(self->buffer_.data()));
+            self->buffer_.consume(self->buffer_.size());
+            self->read();
+        });
+    }
+
+    void receive(const std::string& message) {
+        // Broadcasts far outnumber everything else, so they are scanned rather than parsed
+        const auto type = fieldValue(message, "type");
+        if (type.empty()) {
+            return;
+        }
+        const bool measuring = stats_.measuring;
+        if (type.front() != '"') {
+            // A protocol message; an EDIT_APPLY answers this client's oldest edit not yet acknowledged
+            using collab::protocol::MessageType;
+            if (number(type) == static_cast<uint64_t>(MessageType::EDIT_APPLY) && !pendingAcks_.empty()) {
+                const auto latency = Clock::now() - pendingAcks_.front();
+                pendingAcks_.pop_front();
+                if (measuring) {
+                    stats_.ackLatency.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+                }
+            }
+            return;
+        }
+
+        // Someone else's edit
+        ++known_;
+        if (!measuring) {
+            return;
+        }
+        stats_.received.add();
+        const uint64_t origin = number(fieldValue(message, "originTime"));
+        const uint64_t now = collab::protocol::traceNowMicros();
+        if (origin != 0 && now >= origin) {
+            stats_.broadcastLatency.record(now - origin);
+        }
+    }
+
+    // Where the value of a top-level key of flat JSON starts, to its end; empty if the key is missing
+    static std::string_view fieldValue(std::string_view json, std::string_view key) {
+        const std::string quoted = "\"" + std::string(key) + "\":";
+        const size_t at = json.find(quoted);
+        if (at == std::string_view::npos) {
+            return {};
+        }
+        std::string_view value = json.substr(at + quoted.size());
+        value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+        return value;
+    }
+
+    // The unsigned number a value starts with, or 0
+    static uint64_t number(std::string_view value) {
+        uint64_t result = 0;
+        std::from_chars(value.data(), value.data() + value.size(), result);
+        return result;
+    }
+
+    void send(std::string message) {
+        outbox_.push_back(std::move(message));
+        if (!writing_) {
+            write();
+        }
+    }
+
+    void write() {
+        writing_ = true;
+        ws_.async_write(net::buffer(outbox_.front()), [self = shared_from_this()](beast::error_code ec, size_t) {
+            if (ec) {
+                return self->fail();
+            }
+            self->outbox_.pop_front();
+            if (self->outbox_.empty()) {
+                self->writing_ = false;
+            } else {
+                self->write();
+            }
+        });
+    }
+
+    void fail() {
+        if (!failed_) {
+            failed_ = true;
+            stats_.errors.add();
+            timer_.cancel();
+        }
+    }
+
+    websocket::stream<beast::tcp_stream> ws_;
+    net::steady_timer timer_;
+    beast::flat_buffer buffer_;
+    const LoadOptions& options_;
+    Stats& stats_;
+    const size_t index_;
+    const std::string documentId_;
+    const Clock::duration interval_;
+    Clock::time_point next_;
+    std::deque<std::string> outbox_;
+    bool writing_ = false;
+    std::deque<Clock::time_point> pendingAcks_;
+    uint64_t edits_ = 0;
+    size_t known_ = 0;  // Characters this client has inserted or seen inserted
+    bool failed_ = false;
+};
+
+// CPU seconds a process has used, from /proc; nullopt if it cannot be read
+std::optional<double> processCpuSeconds(int pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!pid || !std::getline(file, stat)) {
+        return std::nullopt;
+    }
+    // The command name may hold spaces; the fields after it are plain
+    std::istringstream fields(stat.substr(stat.rfind(')') + 2));
+    std::string field;
+    double ticks = 0;
+    for (int i = 3; i <= 15 && fields >> field; ++i) {
+        if (i >= 14) {
+            ticks += std::stod(field);  // utime, then stime
+        }
+    }
+    return ticks / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+struct RunResult {
+    size_t connections = 0;
+    size_t connected = 0;
+    double seconds = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t errors = 0;
+    collab::util::Histogram::Snapshot ackLatency;
+    collab::util::Histogram::Snapshot broadcastLatency;
+    std::optional<double> serverCpuSeconds;
+
+    double targetRate(const LoadOptions& options) const {
+        return options.editsPerSecond * static_cast<double>(connections);
+    }
+
+    double sentRate() const {
+        return seconds > 0 ? static_cast<double>(sent) / seconds : 0.0;
+    }
+
+    // Whether the server kept up: every connection up and error-free, the rate met, broadcasts within the SLO
+    bool sustained(const LoadOptions& options) const {
+        return connected == connections && errors == 0 && sentRate() >= 0.9 * targetRate(options) &&
+               static_cast<double>(broadcastLatency.valueAt(0.99)) <= options.sloMillis * 1000;
+    }
+};
+
+RunResult runLoad(const LoadOptions& options, size_t connections) {
+    net::io_context ioc(static_cast<int>(options.threads));
+    auto work = net::make_work_guard(ioc);
+    Stats stats;
+    const tcp::endpoint endpoint(net::ip::make_address(options.host), options.port);
+    std::vector<std::shared_ptr<Connection>> clients;
+    for (size_t i = 0; i < connections; ++i) {
+        clients.push_back(std::make_shared<Connection>(ioc, options, stats, i));
+        clients.back()->start(endpoint);
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.threads; ++i) {
+        threads.emplace_back([&ioc] { ioc.run(); });
+    }
+
+    // Measure only once every connection is up, or has failed to come up
+    const auto connectDeadline = Clock::now() + std::chrono::seconds(10);
+    while (stats.connected + stats.errors.value() < connections && Clock::now() < connectDeadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    RunResult result;
+    result.connections = connections;
+    result.connected = stats.connected;
+    const auto cpuBefore = processCpuSeconds(options.serverPid);
+    const auto start = Clock::now();
+    stats.measuring = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stats.measuring = false;
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const auto cpuAfter = processCpuSeconds(options.serverPid);
+    if (cpuBefore && cpuAfter) {
+        result.serverCpuSeconds = *cpuAfter - *cpuBefore;
+    }
+    result.sent = stats.sent.value();
+    result.received = stats.received.value();
+    result.errors = stats.errors.value();
+    result.ackLatency = stats.ackLatency.snapshot();
+    result.broadcastLatency = stats.broadcastLatency.snapshot();
+
+    work.reset();
+    ioc.stop();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+std::string millis(uint64_t micros) {
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed << static_cast<double>(micros) / 1000.0;
+    return out.str();
+}
+
+void print(const LoadOptions& options, const RunResult& result) {
+    std::cout << result.connections << " connections (" << result.connected << " up, " << result.errors
+              << " errors): " << result.sentRate() << " edits/s of " << result.targetRate(options) << " targeted, "
+              << static_cast<double>(result.received) / result.seconds << " broadcasts received/s\n"
+              << "  broadcast latency ms   p50 " << millis(result.broadcastLatency.valueAt(0.5)) << "  p99 "
+              << millis(result.broadcastLatency.valueAt(0.99)) << "  p99.9 "
+              << millis(result.broadcastLatency.valueAt(0.999)) << "  max " << millis(result.broadcastLatency.max)
+              << "\n";
+    if (options.acks) {
+        std::cout << "  edit-ack latency ms    p50 " << millis(result.ackLatency.valueAt(0.5)) << "  p99 "
+                  << millis(result.ackLatency.valueAt(0.99)) << "  p99.9 " << millis(result.ackLatency.valueAt(0.999))
+                  << "  max " << millis(result.ackLatency.max) << "\n";
+    }
+    if (result.serverCpuSeconds) {
+        std::cout << "  server CPU             " << 100.0 * *result.serverCpuSeconds / result.seconds << "% of a core, "
+                  << (result.sent ? *result.serverCpuSeconds * 1e6 / static_cast<double>(result.sent) : 0.0)
+                  << " us per edit\n";
+    }
+}
+
+template <typename T>
+T number(const std::string& name, const std::string& value) {
+    T result{};
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc() || end != value.data() + value.size()) {
+        throw std::invalid_argument("Invalid value for --" + name + ": " + value);
+    }
+    return result;
+}
+
+LoadOptions parseOptions(int argc, char* argv[]) {
+    LoadOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t equals = arg.find('=');
+        const std::string name = arg.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+        const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        if (arg.rfind("--", 0) != 0) {
+            throw std::invalid_argument("Unexpected argument: " + arg);
+        } else if (name == "host") {
+            options.host = value;
+        } else if (name == "port") {
+            options.port = number<uint16_t>(name, value);
+        } else if (name == "connections") {
+            options.connections = number<size_t>(name, value);
+        } else if (name == "documents") {
+            options.documents = number<size_t>(name, value);
+        } else if (name == "edit-rate") {
+            options.editsPerSecond = number<double>(name, value);
+        } else if (name == "seconds") {
+            options.seconds = number<double>(name, value);
+        } else if (name == "threads") {
+            options.threads = number<size_t>(name, value);
+        } else if (name == "sample-every") {
+            options.sampleEvery = number<uint64_t>(name, value);
+        } else if (name == "server-pid") {
+            options.serverPid = number<int>(name, value);
+        } else if (name == "acks") {
+            options.acks = true;
+        } else if (name == "sweep") {
+            options.sweep = true;
+        } else if (name == "max-connections") {
+            options.maxConnections = number<size_t>(name, value);
+        } else if (name == "slo-ms") {
+            options.sloMillis = number<double>(name, value);
+        } else {
+            throw std::invalid_argument("Unknown option: " + arg);
+        }
+    }
+    if (options.connections == 0 || options.documents == 0 || options.threads == 0 || options.sampleEvery == 0 ||
+        options.editsPerSecond <= 0 || options.seconds <= 0) {
+        throw std::invalid_argument("connections, documents, threads, sample-every, edit-rate and seconds must be positive");
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const LoadOptions options = parseOptions(argc, argv);
+        if (!options.sweep) {
+            const RunResult result = runLoad(options, options.connections);
+            print(options, result);
+            return result.connected == result.connections ? 0 : 1;
+        }
+
+        // Double the connections until the server stops keeping up
+        size_t sustained = 0;
+        for (size_t connections = options.connections; connections <= options.maxConnections; connections *= 2) {
+            const RunResult result = runLoad(options, connections);
+            print(options, result);
+            if (!result.sustained(options)) {
+                break;
+            }
+            sustained = connections;
+        }
+        std::cout << "Sustained " << sustained << " connections at " << options.editsPerSecond
+                  << " edits/s each (p99 broadcast within " << options.sloMillis << " ms)" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,259 @@
+// FILE: bench/startup_bench.cpp
+// Description: Time for a fresh node to become ready, and to answer its first document opens
+//
+// Process-ready is measured in its parts: the thread pool spin-up, the
+// acceptor bind and the whole Server construction. Document opens go the
+// full way a DOC_OPEN takes through a cold node: the frame is decoded, the
+// document is loaded into the DocumentCache from a snapshot on disk, and
+// its DOC_RESPONSE is cut and encoded.
+
+#include <benchmark/benchmark.h>
+#include "common/protocol/document_chunks.h"
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "common/util/mapped_snapshot.h"
+#include "server/server.h"
+#include "server/session/document_cache.h"
+#include "server/session/workspace_preloader.h"
+#include "server/thread_pool.h"
+#include <boost/asio.hpp>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <variant>
+#include <vector>
+
+using namespace collab;
+
+namespace {
+
+// Keeps the startup banners the server prints out of the benchmark's report
+class QuietStdout {
+public:
+    QuietStdout() : previous_(std::cout.rdbuf(&discard_)) {}
+    ~QuietStdout() { std::cout.rdbuf(previous_); }
+
+private:
+    struct Discard : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+
+    Discard discard_;
+    std::streambuf* previous_;
+};
+
+// Snapshots of documents of one size on disk, as a node finds them when it starts
+class SnapshotStore {
+public:
+    SnapshotStore(size_t documents, size_t length)
+        : directory_(std::filesystem::temp_directory_path() /
+                     ("collab_startup_bench_" + std::to_string(length) + "_" + std::to_string(documents))) {
+        std::filesystem::create_directories(directory_);
+        std::string text;
+        text.reserve(length);
+        while (text.size() < length) {
+            text += "Every node serves its first opens from disk.\n";
+        }
+        text.resize(length);
+        for (size_t i = 0; i < documents; ++i) {
+            util::MappedSnapshot::write(path(id(i)), text, 1);
+        }
+    }
+
+    ~SnapshotStore() {
+        std::error_code error;
+        std::filesystem::remove_all(directory_, error);
+    }
+
+    static std::string id(size_t document) {
+        return "doc-" + std::to_string(document);
+    }
+
+    std::filesystem::path path(const std::string& documentId) const {
+        return directory_ / (documentId + ".snapshot");
+    }
+
+    // A cache that loads from the snapshots, with room for all of them
+    std::unique_ptr<server::DocumentCache> cache() const {
+        return std::make_unique<server::DocumentCache>(
+            SIZE_MAX,
+            [this](const std::string& documentId) {
+                const auto snapshot = util::MappedSnapshot::open(path(documentId));
+                return std::make_shared<DocumentController>(std::string(snapshot->text()));
+            },
+            [](const std::string&, const DocumentController&) {});
+    }
+
+private:
+    std::filesystem::path directory_;
+};
+
+// The DOC_OPEN a client sends, as it arrives on the wire
+std::string openFrame(const std::string& documentId) {
+    protocol::DocumentMessage open(protocol::MessageType::DOC_OPEN);
+    open.documentId = documentId;
+    return protocol::WireCodec(protocol::WireFormat::JSON).encode(open);
+}
+
+// Decode a DOC_OPEN, load the document if it is cold and encode the response to it
+size_t serveOpen(protocol::WireCodec& codec, server::DocumentCache& cache, const std::string& frame) {
+    const auto decoded = codec.decode(frame);
+    const auto& open = std::get<protocol::DocumentMessage>(decoded);
+    const auto controller = cache.open(open.documentId);
+    auto snapshot = controller->getSnapshot();
+    protocol::DocumentChunker<ot::Rope> chunker(open, std::move(snapshot.content),
+                                                static_cast<uint64_t>(snapshot.revision));
+    size_t bytes = 0;
+    while (auto response = chunker.next()) {
+        bytes += codec.encode(*response).size();
+    }
+    return bytes;
+}
+
+void BM_ThreadPoolSpinUp(benchmark::State& state) {
+    const size_t threads = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        std::unique_ptr<server::ThreadPool> pool;
+        {
+            QuietStdout quiet;
+            pool = std::make_unique<server::ThreadPool>(threads);
+        }
+        // Ready once a worker has run something
+        pool->enqueue([] {}).get();
+        state.PauseTiming();
+        pool.reset();
+        state.ResumeTiming();
+    }
+}
+
+void BM_AcceptorBind(benchmark::State& state) {
+    boost::asio::io_context io;
+    for (auto _ : state) {
+        boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 0));
+        benchmark::DoNotOptimize(acceptor.local_endpoint().port());
+        state.PauseTiming();
+        acceptor.close();
+        state.ResumeTiming();
+    }
+}
+
+// Construction up to accepting: pool, acceptor, signal handling and timers
+void BM_ServerConstruction(benchmark::State& state) {
+    const size_t threads = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        boost::asio::io_context io;
+        std::unique_ptr<server::Server> server;
+        {
+            QuietStdout quiet;
+            server = std::make_unique<server::Server>(io, 0, threads);
+        }
+        benchmark::DoNotOptimize(server->getEndpoint().port());
+        state.PauseTiming();
+        {
+            QuietStdout quiet;
+            server.reset();
+        }
+        state.ResumeTiming();
+    }
+}
+
+// One cold open of a document of the given size
+void BM_DocumentOpenCold(benchmark::State& state) {
+    const SnapshotStore store(1, static_cast<size_t>(state.range(0)));
+    const std::string frame = openFrame(SnapshotStore::id(0));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = store.cache();
+        protocol::WireCodec codec(protocol::WireFormat::JSON);
+        state.ResumeTiming();
+        bytes = serveOpen(codec, *cache, frame);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    state.counters["response_bytes"] = static_cast<double>(bytes);
+}
+
+// The same open once the document is resident
+void BM_DocumentOpenWarm(benchmark::State& state) {
+    const SnapshotStore store(1, static_cast<size_t>(state.range(0)));
+    const std::string frame = openFrame(SnapshotStore::id(0));
+    auto cache = store.cache();
+    protocol::WireCodec codec(protocol::WireFormat::JSON);
+    serveOpen(codec, *cache, frame);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(serveOpen(codec, *cache, frame));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// The deploy target: a fresh node's first 1,000 opens, of distinct documents
+void BM_First1000Opens(benchmark::State& state) {
+    constexpr size_t OPENS = 1000;
+    const SnapshotStore store(OPENS, static_cast<size_t>(state.range(0)));
+    std::vector<std::string> frames;
+    for (size_t i = 0; i < OPENS; ++i) {
+        frames.push_back(openFrame(SnapshotStore::id(i)));
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = store.cache();
+        protocol::WireCodec codec(protocol::WireFormat::JSON);
+        state.ResumeTiming();
+        for (const std::string& frame : frames) {
+            benchmark::DoNotOptimize(serveOpen(codec, *cache, frame));
+        }
+        state.PauseTiming();
+        cache.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(OPENS));
+}
+
+// Warm start: every document of a workspace loaded into the cache, on 1 worker and on many
+void BM_WorkspacePreload(benchmark::State& state) {
+    constexpr size_t DOCUMENTS = 2000;
+    constexpr size_t PER_DIRECTORY = 100;
+    const SnapshotStore store(DOCUMENTS, 4 << 10);
+    auto root = std::make_shared<fs::Directory>("", "owner");
+    for (size_t i = 0; i < DOCUMENTS; ++i) {
+        std::shared_ptr<fs::Directory> directory;
+        const std::string name = "project" + std::to_string(i / PER_DIRECTORY);
+        if (auto node = root->getNode(name)) {
+            directory = node->asDirectory();
+        } else {
+            directory = root->createDirectory(name, "owner");
+        }
+        directory->createFile(SnapshotStore::id(i), "owner");
+    }
+    std::unique_ptr<server::ThreadPool> pool;
+    {
+        QuietStdout quiet;
+        pool = std::make_unique<server::ThreadPool>(static_cast<size_t>(state.range(0)));
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = store.cache();
+        state.ResumeTiming();
+        server::WorkspacePreloader preloader(*cache, *pool, [](const fs::File& file) { return file.getName(); });
+        preloader.start(root);
+        benchmark::DoNotOptimize(preloader.wait().loaded);
+        state.PauseTiming();
+        cache.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(DOCUMENTS));
+}
+
+} // namespace
+
+BENCHMARK(BM_ThreadPoolSpinUp)->Arg(1)->Arg(4)->Arg(16)->Arg(64)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_AcceptorBind)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ServerConstruction)->Arg(1)->Arg(8)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DocumentOpenCold)->Arg(1 << 10)->Arg(64 << 10)->Arg(1 << 20)->Arg(16 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DocumentOpenWarm)->Arg(1 << 10)->Arg(64 << 10)->Arg(1 << 20)->Arg(16 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_First1000Opens)->Arg(4 << 10)->Arg(64 << 10)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_WorkspacePreload)->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMillisecond)->UseRealTime();
@@ -0,0 +1,316 @@
+// FILE: bench/trace_replay_bench.cpp
+// Description: Replays recorded editing traces through the CRDT, the OT document and the client document
+//
+// Usage: trace_replay_bench [benchmark flags] [trace.json[.gz] ...]
+//
+// Traces are in the editing-traces format of the automerge-perf LaTeX paper
+// trace, {"startContent", "endContent", "txns": [{"patches": [[position,
+// deleted, "inserted"], ...]}]}, or the older {"edits": [[position, deleted,
+// "inserted"?], ...], "finalText"} form; either may be gzipped. Without
+// traces, a synthetic typing trace is replayed, so the numbers are never
+// empty, but only recorded traces show the growth patterns real editing hits.
+
+#include <benchmark/benchmark.h>
+#include <malloc.h>
+#include <zlib.h>
+#include "client/editor/document.h"
+#include "common/crdt/crdt_document.h"
+#include "common/document/document_controller.h"
+#include "common/ot/operation.h"
+#include "common/util/metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace {
+
+// One edit of a trace: delete `deleted` characters at position, then insert text there
+struct Edit {
+    size_t position;
+    size_t deleted;
+    std::string text;
+};
+
+struct Trace {
+    std::string name;
+    std::string startContent;
+    std::string endContent;
+    std::vector<Edit> edits;
+};
+
+// Read a whole file, inflating it if it is gzipped
+std::string readFile(const std::filesystem::path& path) {
+    gzFile file = gzopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Cannot open trace " + path.string());
+    }
+    std::string content;
+    char buffer[1 << 16];
+    int read = 0;
+    while ((read = gzread(file, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, static_cast<size_t>(read));
+    }
+    gzclose(file);
+    if (read < 0) {
+        throw std::runtime_error("Cannot read trace " + path.string());
+    }
+    return content;
+}
+
+void readPatch(const nlohmann::json& patch, Trace& trace) {
+    Edit edit{patch.at(0).get<size_t>(), patch.at(1).get<size_t>(), {}};
+    if (patch.size() > 2) {
+        edit.text = patch.at(2).get<std::string>();
+    }
+    trace.edits.push_back(std::move(edit));
+}
+
+Trace loadTrace(const std::filesystem::path& path) {
+    const auto json = nlohmann::json::parse(readFile(path));
+    Trace trace;
+    trace.name = path.filename().string();
+    trace.startContent = json.value("startContent", "");
+    if (json.contains("txns")) {
+        for (const auto& transaction : json.at("txns")) {
+            for (const auto& patch : transaction.at("patches")) {
+                readPatch(patch, trace);
+            }
+        }
+        trace.endContent = json.value("endContent", "");
+    } else {
+        for (const auto& patch : json.at("edits")) {
+            readPatch(patch, trace);
+        }
+        trace.endContent = json.value("finalText", "");
+    }
+    return trace;
+}
+
+/**
+ * A typist writing a document front to back: words with spaces, new
+ * paragraphs, backspaced typos, and now and then a jump back to revise
+ */
+Trace syntheticTrace(size_t edits) {
+    Trace trace;
+    trace.name = "synthetic-typing";
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    size_t length = 0;
+    size_t cursor = 0;
+    while (trace.edits.size() < edits) {
+        const int roll = percent(random);
+        if (roll < 3 && length > 0) {
+            cursor = std::uniform_int_distribution<size_t>(0, length)(random);
+        } else if (roll < 10 && cursor > 0) {
+            trace.edits.push_back({cursor - 1, 1, {}});
+            --cursor;
+            --length;
+        } else {
+            const char typed = roll < 25 ? ' ' : roll < 26 ? '\n' : static_cast<char>(letter(random));
+            trace.edits.push_back({cursor, 0, std::string(1, typed)});
+            ++cursor;
+            ++length;
+        }
+    }
+    return trace;
+}
+
+// The text a trace ends with, by applying it to a plain string
+std::string replayToString(const Trace& trace) {
+    std::string text = trace.startContent;
+    for (const Edit& edit : trace.edits) {
+        text.erase(edit.position, edit.deleted);
+        text.insert(edit.position, edit.text);
+    }
+    return text;
+}
+
+// Bytes the heap holds right now
+size_t heapInUse() {
+    const auto info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// How often the heap is sampled for its peak, in edits
+constexpr size_t HEAP_SAMPLE_EVERY = 256;
+
+/**
+ * Replay a trace through a document once per iteration, timing each edit
+ *
+ * Apply is called as apply(document, edit); Text reads the document's
+ * text, which must end as the trace does; Finish adds counters about the
+ * finished document, e.g. identifier sizes.
+ */
+template <typename Make, typename Apply, typename Text, typename Finish>
+void replay(benchmark::State& state, const Trace& trace, const std::string& expected, Make make, Apply apply,
+            Text text, Finish finish) {
+    collab::util::Histogram latency;
+    size_t peakHeap = 0;
+    for (auto _ : state) {
+        const size_t baseline = heapInUse();
+        auto document = make();
+        for (size_t i = 0; i < trace.edits.size(); ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            apply(*document, trace.edits[i]);
+            latency.record(static_cast<uint64_t>(
+                std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count()));
+            if (i % HEAP_SAMPLE_EVERY == 0) {
+                peakHeap = std::max(peakHeap, heapInUse() - std::min(baseline, heapInUse()));
+            }
+        }
+
+        state.PauseTiming();
+        peakHeap = std::max(peakHeap, heapInUse() - std::min(baseline, heapInUse()));
+        if (text(*document) != expected) {
+            state.SkipWithError("Replay did not end with the trace's final text");
+            break;
+        }
+        finish(state, *document);
+        state.ResumeTiming();
+    }
+
+    const auto snapshot = latency.snapshot();
+    state.counters["edits"] = static_cast<double>(trace.edits.size());
+    state.counters["peak_heap_MiB"] = static_cast<double>(peakHeap) / (1 << 20);
+    state.counters["p50_ns"] = static_cast<double>(snapshot.valueAt(0.5));
+    state.counters["p99_ns"] = static_cast<double>(snapshot.valueAt(0.99));
+    state.counters["p999_ns"] = static_cast<double>(snapshot.valueAt(0.999));
+    state.counters["max_ns"] = static_cast<double>(snapshot.max);
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(trace.edits.size()));
+}
+
+void replayCrdt(benchmark::State& state, const Trace& trace, const std::string& expected,
+                collab::crdt::PositionStrategy strategy) {
+    using collab::crdt::CrdtDocument;
+    replay(
+        state, trace, expected,
+        [&] {
+            auto document = std::make_unique<CrdtDocument>("trace");
+            document->setStrategy(strategy);
+            if (!trace.startContent.empty()) {
+                document->localInsert(trace.startContent, 0);
+            }
+            return document;
+        },
+        [](CrdtDocument& document, const Edit& edit) {
+            if (edit.deleted > 0) {
+                document.localDelete(edit.position, edit.deleted);
+            }
+            if (!edit.text.empty()) {
+                document.localInsert(edit.text, edit.position);
+            }
+        },
+        [](const CrdtDocument& document) { return document.getText(); },
+        [](benchmark::State& state, const CrdtDocument& document) {
+            // Identifier sizes of the final document, per character
+            size_t totalDepth = 0;
+            size_t maxDepth = 0;
+            for (size_t i = 0; i < document.size(); ++i) {
+                const size_t depth = document.at(i).getPosition().size();
+                totalDepth += depth;
+                maxDepth = std::max(maxDepth, depth);
+            }
+            state.counters["avg_depth"] = document.size() ? static_cast<double>(totalDepth) / document.size() : 0.0;
+            state.counters["max_depth"] = static_cast<double>(maxDepth);
+            state.counters["items"] = static_cast<double>(document.itemCount());
+        });
+}
+
+// The server's OT document, with the undo history and operation log it keeps
+void replayOt(benchmark::State& state, const Trace& trace, const std::string& expected) {
+    using collab::DocumentController;
+    using namespace collab::ot;
+    replay(
+        state, trace, expected, [&] { return std::make_unique<DocumentController>(trace.startContent); },
+        [](DocumentController& document, const Edit& edit) {
+            if (edit.deleted > 0) {
+                document.applyOperation(std::make_shared<DeleteOperation>(edit.position, edit.deleted), "trace");
+            }
+            if (!edit.text.empty()) {
+                document.applyOperation(std::make_shared<InsertOperation>(edit.position, edit.text), "trace");
+            }
+        },
+        [](const DocumentController& document) { return document.getDocument(); },
+        [](benchmark::State& state, const DocumentController& document) {
+            state.counters["history_MiB"] =
+                static_cast<double>(document.getLoadStats().memoryBytes) / (1 << 20);
+        });
+}
+
+// The client's document, addressed by line and column as the editor addresses it
+void replayClient(benchmark::State& state, const Trace& trace, const std::string& expected) {
+    using collab::document::Document;
+    replay(
+        state, trace, expected,
+        [&] {
+            auto document = std::make_unique<Document>("trace");
+            document->setText(trace.startContent);
+            return document;
+        },
+        [](Document& document, const Edit& edit) {
+            const auto position = document.linearToCursor(edit.position);
+            if (edit.deleted > 0) {
+                document.deleteText(position, edit.deleted, "trace");
+            }
+            if (!edit.text.empty()) {
+                document.insertText(position, edit.text, "trace");
+            }
+        },
+        [](const Document& document) { return document.getText(); },
+        [](benchmark::State&, const Document&) {});
+}
+
+void registerTrace(const std::shared_ptr<const Trace>& trace) {
+    using collab::crdt::PositionStrategy;
+    auto expected = std::make_shared<const std::string>(trace->endContent.empty() ? replayToString(*trace)
+                                                                                  : trace->endContent);
+    const std::pair<const char*, PositionStrategy> strategies[] = {
+        {"logoot", PositionStrategy::LOGOOT}, {"woot", PositionStrategy::WOOT}, {"lseq", PositionStrategy::LSEQ}};
+    for (const auto& [name, strategy] : strategies) {
+        benchmark::RegisterBenchmark(("BM_ReplayCrdt/" + std::string(name) + "/" + trace->name).c_str(),
+                                     [trace, expected, strategy = strategy](benchmark::State& state) {
+                                         replayCrdt(state, *trace, *expected, strategy);
+                                     })
+            ->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RegisterBenchmark(("BM_ReplayOt/" + trace->name).c_str(),
+                                 [trace, expected](benchmark::State& state) { replayOt(state, *trace, *expected); })
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_ReplayClient/" + trace->name).c_str(),
+                                 [trace, expected](benchmark::State& state) {
+                                     replayClient(state, *trace, *expected);
+                                 })
+        ->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+
+    // What the benchmark library did not take is a list of traces
+    try {
+        if (argc > 1) {
+            for (int i = 1; i < argc; ++i) {
+                registerTrace(std::make_shared<const Trace>(loadTrace(argv[i])));
+            }
+        } else {
+            registerTrace(std::make_shared<const Trace>(syntheticTrace(100000)));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot load traces: " << e.what() << std::endl;
+        return 1;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,402 @@
+// FILE: bench/transport_bench.cpp
+// Description: Throughput and latency of TcpConnection, TcpServer and MessageChannel over loopback
+//
+// The server and the clients run on io_contexts of their own, each on one
+// thread, as a node and its peers would. Throughput benchmarks have every
+// connection send a burst and wait until the server has read all of it;
+// latency benchmarks pace one connection at a fixed rate against an echo
+// server and time each round trip. Both framings are swept: newline
+// delimited text, which the reader scans for '\n', and length-prefixed
+// frames, whose size the reader knows up front. Writes are gathered either
+// way, so the gap is the framing's.
+//
+// syscalls_per_message counts the socket and reactor calls the transport
+// makes (sendmsg, recvmsg and epoll_wait, interposed below for this binary)
+// per message sent; ctx_switches_per_message comes from getrusage().
+
+#include <benchmark/benchmark.h>
+#include "common/network/tcp_connection.h"
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "common/util/logger.h"
+#include "common/util/metrics.h"
+#include "fuzz/protocol_corpus.h"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <dlfcn.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> transportCalls{0};
+
+template <typename Function>
+Function next(const char* name) {
+    return reinterpret_cast<Function>(::dlsym(RTLD_NEXT, name));
+}
+
+} // namespace
+
+// Asio calls these for every socket read, write and reactor wait
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* message, int flags) {
+    static const auto real = next<ssize_t (*)(int, const struct msghdr*, int)>("sendmsg");
+    transportCalls.fetch_add(1, std::memory_order_relaxed);
+    return real(fd, message, flags);
+}
+
+extern "C" ssize_t recvmsg(int fd, struct msghdr* message, int flags) {
+    static const auto real = next<ssize_t (*)(int, struct msghdr*, int)>("recvmsg");
+    transportCalls.fetch_add(1, std::memory_order_relaxed);
+    return real(fd, message, flags);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    static const auto real = next<int (*)(int, struct epoll_event*, int, int)>("epoll_wait");
+    transportCalls.fetch_add(1, std::memory_order_relaxed);
+    return real(epfd, events, maxevents, timeout);
+}
+
+namespace {
+
+using namespace collab;
+using network::TcpConnection;
+using Clock = std::chrono::steady_clock;
+
+// Keeps the banner TcpServer::start() prints out of the benchmark's report
+class QuietStdout {
+public:
+    QuietStdout() : previous_(std::cout.rdbuf(&discard_)) {}
+    ~QuietStdout() { std::cout.rdbuf(previous_); }
+
+private:
+    struct Discard : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+
+    Discard discard_;
+    std::streambuf* previous_;
+};
+
+// An io_context running on a thread of its own until destroyed
+class IoThread {
+public:
+    IoThread() : guard_(boost::asio::make_work_guard(io_)), thread_([this] { io_.run(); }) {}
+
+    ~IoThread() {
+        guard_.reset();
+        io_.stop();
+        thread_.join();
+    }
+
+    boost::asio::io_context& context() { return io_; }
+
+private:
+    boost::asio::io_context io_;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> guard_;
+    std::thread thread_;
+};
+
+// Counts down to zero and wakes whoever waits for it
+class Countdown {
+public:
+    void reset(uint64_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remaining_ = count;
+    }
+
+    void done() {
+        // Only the last one takes the lock, so counting costs no syscalls
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            zero_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        zero_.wait(lock, [this] { return remaining_.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    std::atomic<uint64_t> remaining_{0};
+    std::mutex mutex_;
+    std::condition_variable zero_;
+};
+
+/**
+ * A TcpServer and clients connected to it over loopback
+ *
+ * onServerConnection sets up each accepted connection; the clients are
+ * TcpConnections with the given frame mode, handed out by clients().
+ */
+class Loopback {
+public:
+    using Setup = std::function<void(TcpConnection::pointer)>;
+
+    Loopback(size_t connections, TcpConnection::frame_mode mode, Setup onServerConnection)
+        : server_(serverIo_.context(), 0) {
+        // Every connect and accept logs a line otherwise
+        util::getLogger().setLogLevel(util::LogLevel::WARNING);
+        server_.set_connection_handler([this, mode, onServerConnection](TcpConnection::pointer connection) {
+            connection->set_frame_mode(mode);
+            onServerConnection(connection);
+            server_.handshake_done(connection);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                accepted_.push_back(connection);
+            }
+            connected_.done();
+        });
+        {
+            QuietStdout quiet;
+            server_.start();
+        }
+
+        // Counts the clients and the server's side of each
+        connected_.reset(2 * connections);
+        const std::string port = std::to_string(server_.port());
+        for (size_t i = 0; i < connections; ++i) {
+            auto client = std::make_unique<network::TcpClient>(clientIo_.context());
+            client->set_connection_handler([this, mode](TcpConnection::pointer connection) {
+                connection->set_frame_mode(mode);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    clients_.push_back(connection);
+                }
+                connected_.done();
+            });
+            client->connect("127.0.0.1", port);
+            connectors_.push_back(std::move(client));
+        }
+        connected_.wait();
+    }
+
+    ~Loopback() {
+        QuietStdout quiet;
+        boost::asio::post(clientIo_.context(), [this] {
+            for (auto& client : clients_) {
+                client->close();
+            }
+        });
+        server_.stop();
+    }
+
+    const std::vector<TcpConnection::pointer>& clients() const { return clients_; }
+
+    IoThread& clientIo() { return clientIo_; }
+
+private:
+    IoThread serverIo_;
+    IoThread clientIo_;
+    network::TcpServer server_;
+    Countdown connected_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<network::TcpClient>> connectors_;
+    std::vector<TcpConnection::pointer> clients_;
+    std::vector<TcpConnection::pointer> accepted_;
+};
+
+// Syscall and context switch counts over a benchmark's measured part
+class SyscallMeter {
+public:
+    SyscallMeter() : calls_(transportCalls.load()), switches_(contextSwitches()) {}
+
+    void report(benchmark::State& state, uint64_t messages) const {
+        const double sent = static_cast<double>(std::max<uint64_t>(messages, 1));
+        state.counters["syscalls_per_message"] = static_cast<double>(transportCalls.load() - calls_) / sent;
+        state.counters["ctx_switches_per_message"] = static_cast<double>(contextSwitches() - switches_) / sent;
+    }
+
+private:
+    static uint64_t contextSwitches() {
+        rusage usage{};
+        ::getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+    }
+
+    uint64_t calls_;
+    uint64_t switches_;
+};
+
+constexpr size_t BURST = 256;  // Messages each connection sends per iteration
+
+template <TcpConnection::frame_mode Mode>
+void BM_TcpThroughput(benchmark::State& state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    const size_t connections = static_cast<size_t>(state.range(1));
+    Countdown received;
+    Loopback loopback(connections, Mode, [&received](TcpConnection::pointer connection) {
+        connection->set_message_handler([&received](TcpConnection::pointer, std::string_view) { received.done(); });
+    });
+    const auto payload = std::make_shared<const std::string>(size, 'x');
+
+    const SyscallMeter meter;
+    for (auto _ : state) {
+        received.reset(connections * BURST);
+        for (const auto& client : loopback.clients()) {
+            for (size_t i = 0; i < BURST; ++i) {
+                client->write_shared(payload);
+            }
+        }
+        received.wait();
+    }
+    const uint64_t messages = state.iterations() * connections * BURST;
+    state.SetItemsProcessed(static_cast<int64_t>(messages));
+    state.SetBytesProcessed(static_cast<int64_t>(messages * size));
+    meter.report(state, messages);
+}
+
+// Round trips of one connection sending at a fixed rate to an echo server
+template <TcpConnection::frame_mode Mode>
+void BM_TcpLatency(benchmark::State& state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    const auto interval = std::chrono::nanoseconds(1'000'000'000 / state.range(1));
+    constexpr size_t ROUND_TRIPS = 200;
+    Loopback loopback(1, Mode, [](TcpConnection::pointer connection) {
+        connection->set_message_handler([](TcpConnection::pointer self, std::string_view payload) {
+            self->write(std::string(payload));
+        });
+    });
+
+    util::Histogram roundTrips;
+    Countdown echoed;
+    const TcpConnection::pointer& client = loopback.clients().front();
+    boost::asio::post(loopback.clientIo().context(), [&] {
+        client->set_message_handler([&](TcpConnection::pointer, std::string_view payload) {
+            int64_t sent = 0;
+            std::from_chars(payload.data(), payload.data() + payload.size(), sent);
+            roundTrips.record(static_cast<uint64_t>(Clock::now().time_since_epoch().count() - sent));
+            echoed.done();
+        });
+    });
+    // Each payload starts with the time it was sent, in decimal so that neither framing sees a delimiter in it
+    constexpr size_t STAMP = 20;
+    std::string payload(std::max(size, STAMP + 1), 'x');
+
+    const SyscallMeter meter;
+    for (auto _ : state) {
+        echoed.reset(ROUND_TRIPS);
+        auto due = Clock::now();
+        for (size_t i = 0; i < ROUND_TRIPS; ++i) {
+            std::this_thread::sleep_until(due);
+            due += interval;
+            const int64_t now = Clock::now().time_since_epoch().count();
+            std::fill_n(payload.begin(), STAMP, ' ');
+            std::to_chars(payload.data(), payload.data() + STAMP, now);
+            client->write(payload);
+        }
+        echoed.wait();
+    }
+    const auto snapshot = roundTrips.snapshot();
+    state.counters["p50_us"] = static_cast<double>(snapshot.valueAt(0.5)) / 1e3;
+    state.counters["p99_us"] = static_cast<double>(snapshot.valueAt(0.99)) / 1e3;
+    state.counters["max_us"] = static_cast<double>(snapshot.max) / 1e3;
+    meter.report(state, state.iterations() * ROUND_TRIPS * 2);
+}
+
+// Text frames through TextCodec, or binary ones through the negotiated WireCodec
+template <typename Codec>
+void BM_ChannelThroughput(benchmark::State& state) {
+    using Channel = network::MessageChannel<protocol::Message, Codec>;
+    const size_t connections = static_cast<size_t>(state.range(0));
+    constexpr bool BINARY = std::is_same_v<Codec, protocol::WireCodec>;
+    constexpr auto MODE = BINARY ? TcpConnection::frame_mode::length_prefixed
+                                 : TcpConnection::frame_mode::newline_delimited;
+
+    Countdown received;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Channel>> serverChannels;
+    Loopback loopback(connections, MODE, [&](TcpConnection::pointer connection) {
+        auto channel = std::make_shared<Channel>(connection);
+        channel->set_message_handler([&received](typename Channel::pointer, const protocol::Message&) {
+            received.done();
+        });
+        std::lock_guard<std::mutex> lock(mutex);
+        serverChannels.push_back(std::move(channel));
+    });
+
+    std::vector<std::shared_ptr<Channel>> clientChannels;
+    for (const auto& client : loopback.clients()) {
+        clientChannels.push_back(std::make_shared<Channel>(client));
+    }
+    if constexpr (BINARY) {
+        // Every codec only needs to have seen the exchange; the peer codec is a stand-in
+        for (const auto& channel : clientChannels) {
+            protocol::WireCodec server;
+            fuzz::negotiateBinary(channel->codec(), server);
+        }
+        for (const auto& channel : serverChannels) {
+            protocol::WireCodec client;
+            fuzz::negotiateBinary(client, channel->codec());
+        }
+    }
+
+    protocol::EditMessage edit(protocol::MessageType::EDIT_INSERT);
+    edit.documentId = "bench-document";
+    edit.documentVersion = 42;
+    edit.operationId = "op";
+    edit.position = 1200;
+    edit.text = "x";
+
+    const SyscallMeter meter;
+    for (auto _ : state) {
+        received.reset(connections * BURST);
+        for (const auto& channel : clientChannels) {
+            for (size_t i = 0; i < BURST; ++i) {
+                channel->send_message(edit);
+            }
+        }
+        received.wait();
+    }
+    const uint64_t messages = state.iterations() * connections * BURST;
+    state.SetItemsProcessed(static_cast<int64_t>(messages));
+    meter.report(state, messages);
+}
+
+constexpr auto NEWLINE = TcpConnection::frame_mode::newline_delimited;
+constexpr auto LENGTH_PREFIXED = TcpConnection::frame_mode::length_prefixed;
+
+void throughputArgs(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t size : {64, 1024, 16384}) {
+        for (int64_t connections : {1, 8, 64}) {
+            benchmark->Args({size, connections});
+        }
+    }
+    benchmark->UseRealTime()->Unit(benchmark::kMicrosecond);
+}
+
+void latencyArgs(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t size : {64, 4096}) {
+        for (int64_t perSecond : {1000, 10000, 50000}) {
+            benchmark->Args({size, perSecond});
+        }
+    }
+    benchmark->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_TcpThroughput, NEWLINE)->Apply(throughputArgs);
+BENCHMARK_TEMPLATE(BM_TcpThroughput, LENGTH_PREFIXED)->Apply(throughputArgs);
+BENCHMARK_TEMPLATE(BM_TcpLatency, NEWLINE)->Apply(latencyArgs);
+BENCHMARK_TEMPLATE(BM_TcpLatency, LENGTH_PREFIXED)->Apply(latencyArgs);
+BENCHMARK_TEMPLATE(BM_ChannelThroughput, network::TextCodec<protocol::Message>)
+    ->Arg(1)->Arg(8)->Arg(64)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_ChannelThroughput, protocol::WireCodec)
+    ->Arg(1)->Arg(8)->Arg(64)->UseRealTime()->Unit(benchmark::kMicrosecond);
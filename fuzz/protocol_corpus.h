@@ -0,0 +1,198 @@
+#ifndef COLLABORATIVE_EDITOR_PROTOCOL_CORPUS_H
+#define COLLABORATIVE_EDITOR_PROTOCOL_CORPUS_H
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+
+namespace collab {
+namespace fuzz {
+
+// One message of the corpus, named for benchmark and file names
+struct CorpusEntry {
+    std::string name;
+    std::shared_ptr<const protocol::Message> message;
+};
+
+/**
+ * The protocol messages the codec benchmarks measure and the fuzzers start from
+ *
+ * One or more of every message struct, shaped like production traffic:
+ * keystroke edits and their acknowledgements, presence with and without
+ * metadata, document lists and contents, sync requests and a large
+ * SYNC_STATE, and a batch of edits. Deterministic, so runs compare.
+ *
+ * @param largeState Characters in the SYNC_STATE document
+ * @return The entries
+ */
+inline std::vector<CorpusEntry> protocolCorpus(size_t largeState = 1 << 20) {
+    using namespace protocol;
+    std::vector<CorpusEntry> corpus;
+    auto add = [&corpus](std::string name, auto message) {
+        message.clientId = "4f1c2a9e-8b7d-4e3f-9a21-0c5d6e7f8a9b";
+        message.sessionId = "b7e2d1c0-3f4a-4b5c-8d9e-1a2b3c4d5e6f";
+        message.sequenceNumber = 1000 + corpus.size();
+        message.timestamp = 1700000000000 + corpus.size();
+        corpus.push_back({std::move(name), std::make_shared<const decltype(message)>(std::move(message))});
+    };
+    const std::string documentId = "9c8b7a6f-5e4d-4c3b-2a19-0f8e7d6c5b4a";
+
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    login.password = "correct horse battery staple";
+    add("auth_login", login);
+
+    EditMessage insert(MessageType::EDIT_INSERT);
+    insert.documentId = documentId;
+    insert.documentVersion = 4211;
+    insert.operationId = "op-4211";
+    insert.position = 1742;
+    insert.text = "a";
+    add("edit_insert", insert);
+
+    EditMessage erase(MessageType::EDIT_DELETE);
+    erase.documentId = documentId;
+    erase.documentVersion = 4212;
+    erase.operationId = "op-4212";
+    erase.position = 1742;
+    erase.length = 1;
+    add("edit_delete", erase);
+
+    EditMessage paste(MessageType::EDIT_REPLACE);
+    paste.documentId = documentId;
+    paste.documentVersion = 4213;
+    paste.operationId = "op-4213";
+    paste.position = 96;
+    paste.length = 12;
+    paste.text = std::string(512, 'p');
+    paste.traceId = "0af7651916cd43dd8448eb211c80319c";
+    paste.originTime = 1700000000123456;
+    add("edit_replace_traced", paste);
+
+    EditMessage applied(MessageType::EDIT_APPLY);
+    applied.documentId = documentId;
+    applied.documentVersion = 4213;
+    applied.success = true;
+    add("edit_apply", applied);
+
+    PresenceMessage cursor(MessageType::PRESENCE_CURSOR);
+    cursor.documentId = documentId;
+    cursor.username = "alice";
+    cursor.cursorPosition = 1743;
+    add("presence_cursor", cursor);
+
+    PresenceMessage join(MessageType::PRESENCE_JOIN);
+    join.documentId = documentId;
+    join.username = "alice";
+    join.displayName = "Alice Liddell";
+    join.userColor = "#3b82f6";
+    join.selectionStart = 100;
+    join.selectionEnd = 180;
+    for (int i = 0; i < 16; ++i) {
+        join.metadata["key-" + std::to_string(i)] = "value of metadata entry " + std::to_string(i);
+    }
+    add("presence_metadata", join);
+
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = documentId;
+    add("doc_open", open);
+
+    DocumentMessage list(MessageType::DOC_RESPONSE);
+    list.documentId = documentId;
+    list.success = true;
+    for (int i = 0; i < 200; ++i) {
+        list.documentList.push_back("document-" + std::to_string(i) + ".md");
+    }
+    add("doc_list", list);
+
+    DocumentMessage content(MessageType::DOC_RESPONSE);
+    content.documentId = documentId;
+    content.documentName = "notes.md";
+    content.documentVersion = 4213;
+    content.documentContent = std::string(16 * 1024, 'c');
+    content.success = true;
+    add("doc_content", content);
+
+    SyncMessage request(MessageType::SYNC_REQUEST);
+    request.documentId = documentId;
+    request.fromVersion = 4100;
+    request.stateVector = std::string("\x02\x11\x90\x20\x05\x83\x01", 7);
+    add("sync_request", request);
+
+    SyncMessage response(MessageType::SYNC_RESPONSE);
+    response.documentId = documentId;
+    response.fromVersion = 4100;
+    response.toVersion = 4213;
+    for (int i = 0; i < 113; ++i) {
+        response.operations.push_back(R"({"type":"insert","position":)" + std::to_string(i) + R"(,"text":"a"})");
+    }
+    add("sync_response", response);
+
+    SyncMessage state(MessageType::SYNC_STATE);
+    state.documentId = documentId;
+    state.toVersion = 4213;
+    std::string text;
+    text.reserve(largeState);
+    while (text.size() < largeState) {
+        text += "The quick brown fox jumps over the lazy dog. ";
+    }
+    text.resize(largeState);
+    state.documentState = std::move(text);
+    add("sync_state_large", state);
+
+    BatchMessage batch(MessageType::BATCH);
+    for (int i = 0; i < 32; ++i) {
+        EditMessage keystroke = insert;
+        keystroke.position = *insert.position + i;
+        keystroke.documentVersion = insert.documentVersion + i;
+        batch.add(BatchMessage::share(keystroke));
+    }
+    add("batch_edits", batch);
+    return corpus;
+}
+
+// Run the AUTH_LOGIN / AUTH_SUCCESS exchange so both codecs encode binary frames
+inline void negotiateBinary(protocol::WireCodec& client, protocol::WireCodec& server) {
+    using namespace protocol;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    server.decode(client.encode(login));
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    success.username = "alice";
+    client.decode(server.encode(success));
+}
+
+/**
+ * Write the corpus as seed files, each message as a JSON frame and as a binary one
+ *
+ * @param directory Created if missing; files are named <entry>.json and <entry>.bin
+ * @throws std::runtime_error if a file cannot be written
+ */
+inline void writeCorpus(const std::filesystem::path& directory, size_t largeState = 1 << 20) {
+    std::filesystem::create_directories(directory);
+    protocol::WireCodec client;
+    protocol::WireCodec server;
+    negotiateBinary(client, server);
+    for (const CorpusEntry& entry : protocolCorpus(largeState)) {
+        const std::map<std::string, std::string> frames{{".json", entry.message->toString()},
+                                                        {".bin", client.encode(*entry.message)}};
+        for (const auto& [extension, frame] : frames) {
+            std::ofstream file(directory / (entry.name + extension), std::ios::binary);
+            if (!file.write(frame.data(), static_cast<std::streamsize>(frame.size()))) {
+                throw std::runtime_error("Cannot write " + (directory / (entry.name + extension)).string());
+            }
+        }
+    }
+}
+
+} // namespace fuzz
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_PROTOCOL_CORPUS_H
@@ -0,0 +1,23 @@
+// FILE: fuzz/protocol_corpus_main.cpp
+// Description: Writes the protocol corpus as seed files for the fuzzers
+//
+// Usage: protocol_corpus <directory>
+
+#include "fuzz/protocol_corpus.h"
+#include <exception>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <directory>" << std::endl;
+        return 2;
+    }
+    try {
+        // Seeds past libFuzzer's default length are cut, so the large state is kept moderate
+        collab::fuzz::writeCorpus(argv[1], 64 * 1024);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
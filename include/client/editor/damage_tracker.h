@@ -0,0 +1,113 @@
+#ifndef COLLABORATIVE_EDITOR_DAMAGE_TRACKER_H
+#define COLLABORATIVE_EDITOR_DAMAGE_TRACKER_H
+
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <optional>
+
+#include "document.h"
+
+namespace collab {
+namespace document {
+
+/**
+ * Lines of a document a view has to redraw, first to last inclusive
+ */
+struct DamagedLines {
+    static constexpr size_t TO_END = std::numeric_limits<size_t>::max();
+
+    size_t first = 0;
+    size_t last = TO_END;   // TO_END when every line from first on moved
+
+    bool contains(size_t line) const {
+        return line >= first && line <= last;
+    }
+};
+
+/**
+ * Collects the change summaries of a Document between two frames and
+ * turns them into the lines to redraw
+ *
+ * The summaries only carry character offsets, so they can be noted from
+ * a change listener, which runs under the document's lock; they are
+ * merged into one range and mapped to lines when the frame is drawn.
+ * When the frame's edits changed the number of lines, every line from
+ * the first damaged one on has moved and is damaged too.
+ */
+class DamageTracker {
+public:
+    /**
+     * Start tracking a document; the first frame redraws everything
+     *
+     * @param document The document; its summaries must be passed to noteChange()
+     */
+    explicit DamageTracker(const Document& document) : document_(document) {}
+
+    DamageTracker(const DamageTracker&) = delete;
+    DamageTracker& operator=(const DamageTracker&) = delete;
+
+    /**
+     * Note a change since the last frame; may be called from any thread
+     *
+     * @param summary The change, as given to a change summary listener
+     */
+    void noteChange(const ChangeSummary& summary) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.merge(summary);
+    }
+
+    /**
+     * Damage every line, e.g. after scrolling or a resize
+     */
+    void invalidateAll() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        invalidated_ = true;
+    }
+
+    /**
+     * Take the lines damaged since the last call
+     * Must not be called from a change listener
+     *
+     * @return The damaged lines, or std::nullopt if nothing changed
+     */
+    std::optional<DamagedLines> collect() {
+        ChangeSummary summary;
+        bool invalidated;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            summary = pending_;
+            invalidated = invalidated_;
+            pending_ = ChangeSummary{};
+            invalidated_ = false;
+        }
+
+        const size_t lineCount = document_.getLineCount();
+        const bool linesMoved = lineCount != lineCount_;
+        lineCount_ = lineCount;
+        if (invalidated) {
+            return DamagedLines{0, DamagedLines::TO_END};
+        }
+        if (summary.operations == 0) {
+            return std::nullopt;
+        }
+
+        DamagedLines damaged;
+        damaged.first = document_.linearToCursor(summary.start).line;
+        damaged.last = linesMoved ? DamagedLines::TO_END
+                                  : document_.linearToCursor(summary.start + summary.added).line;
+        return damaged;
+    }
+
+private:
+    const Document& document_;
+    std::mutex mutex_;                 // Guards pending_ and invalidated_
+    ChangeSummary pending_;            // Changes since the last frame, merged
+    bool invalidated_ = true;          // Everything needs drawing
+    size_t lineCount_ = 0;             // Lines as of the last frame
+};
+
+} // namespace document
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DAMAGE_TRACKER_H
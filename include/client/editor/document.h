@@ -1,8 +1,11 @@
 #ifndef COLLABORATIVE_EDITOR_DOCUMENT_H
 #define COLLABORATIVE_EDITOR_DOCUMENT_H
 
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <filesystem>
 #include <unordered_map>
 #include <memory>
 #include <chrono>
@@ -12,13 +15,21 @@
 #include <functional>
 #include <utility>
 
+#include "piece_table.h"
+#include "common/ot/cursor_transform.h"
+#include "common/ot/text_diff.h"
+#include "common/util/chunked_io.h"
+#include "common/util/interned_string.h"
+#include "common/util/mapped_snapshot.h"
+#include "common/util/small_text.h"
+
 namespace collab {
 namespace document {
 
 /**
  * Types of operations that can be performed on a document
  */
-enum class OperationType {
+enum class OperationType : uint8_t {
     INSERT,
     DELETE,
     REPLACE
@@ -106,22 +117,22 @@ public:
         size_t length = 0,
         const std::string& userId = "",
         uint64_t timestamp = 0
-    ) : type_(type),
-        position_(position),
-        text_(text),
+    ) : position_(position),
         length_(length),
-        userId_(userId),
         timestamp_(timestamp == 0 ? 
             std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::system_clock::now().time_since_epoch()
-            ).count() : timestamp) {}
+            ).count() : timestamp),
+        text_(text),
+        userId_(userId),
+        type_(type) {}
     
     // Getters
     OperationType getType() const { return type_; }
     const CursorPosition& getPosition() const { return position_; }
-    const std::string& getText() const { return text_; }
+    std::string_view getText() const { return text_.view(); }
     size_t getLength() const { return length_; }
-    const std::string& getUserId() const { return userId_; }
+    const std::string& getUserId() const { return userId_.str(); }
     uint64_t getTimestamp() const { return timestamp_; }
     
     // Create an inverse operation for undo
@@ -134,7 +145,7 @@ public:
                     position_,
                     "",
                     text_.length(),
-                    userId_,
+                    userId_.str(),
                     timestamp_
                 );
                 
@@ -145,7 +156,7 @@ public:
                     position_,
                     deletedText,
                     0,
-                    userId_,
+                    userId_.str(),
                     timestamp_
                 );
                 
@@ -156,7 +167,7 @@ public:
                     position_,
                     deletedText,
                     text_.length(),
-                    userId_,
+                    userId_.str(),
                     timestamp_
                 );
             
@@ -166,28 +177,100 @@ public:
     }
 
 private:
-    OperationType type_;     // Type of operation
-    CursorPosition position_; // Position where the operation is applied
-    std::string text_;       // Text for insert or replace operations
-    size_t length_;          // Length for delete operations
-    std::string userId_;     // User who performed the operation
-    uint64_t timestamp_;     // When the operation was performed
+    CursorPosition position_;   // Position where the operation is applied
+    size_t length_;             // Length for delete operations
+    uint64_t timestamp_;        // When the operation was performed
+    util::SmallText text_;      // Text for insert or replace operations, inline for keystrokes
+    util::InternedString userId_; // User who performed the operation
+    OperationType type_;        // Type of operation
+};
+
+// A keystroke's operation fits a cache line and allocates nothing
+static_assert(sizeof(DocumentOperation) <= 64, "DocumentOperation should fit a cache line");
+
+/**
+ * What a batch of edits changed, as one range of the document
+ * [start, start + added) of the text now replaced [start, start + removed)
+ * of the text before the batch
+ */
+struct ChangeSummary {
+    size_t start = 0;
+    size_t removed = 0;
+    size_t added = 0;
+    size_t operations = 0;   // Edits the batch made
+    
+    /**
+     * Grow the range to cover a change made after it
+     * 
+     * @param next The later change, in offsets of the text after this one
+     */
+    void merge(const ChangeSummary& next) {
+        if (operations == 0) {
+            *this = next;
+            return;
+        }
+        
+        // Text the later change reaches beyond the range was unchanged until now
+        const size_t end = start + added;
+        const size_t nextEnd = next.start + next.removed;
+        const size_t mergedStart = std::min(start, next.start);
+        removed += (next.start < start ? start - next.start : 0) +
+                   (nextEnd > end ? nextEnd - end : 0);
+        added = std::max(end, nextEnd) - next.removed + next.added - mergedStart;
+        start = mergedStart;
+        operations += next.operations;
+    }
 };
 
 /**
  * Main document class that stores text with line-by-line access,
  * cursor positions for multiple users, and operation history.
+ * 
+ * The text lives in a piece table; lines are a view over its newline
+ * index, so an edit anywhere costs O(log pieces) however long the
+ * document or the lines it touches.
+ * 
+ * Between beginBatch() and endBatch(), or for the life of a Batch,
+ * listeners are not called per edit: at the end of the batch, change
+ * listeners get the batch's operations and summary listeners one
+ * ChangeSummary covering them all, outside the document lock. An edit
+ * outside a batch is a batch of one, notified at once.
+ * 
+ * Users' cursors and selections are kept as offsets and move with every
+ * edit, in one sorted pass over all of them (see ot::CursorSet), so they
+ * stay on the text they were on without anyone setting them again.
  */
 class Document {
 public:
     // Callback type for document change notifications
     using ChangeCallback = std::function<void(const DocumentOperation&)>;
     
+    // Callback type for one summary per batch of changes, for minimal repaints
+    using ChangeSummaryCallback = std::function<void(const ChangeSummary&)>;
+    
+    /**
+     * Holds a batch open for its lifetime
+     */
+    class Batch {
+    public:
+        explicit Batch(Document& document) : document_(document) {
+            document_.beginBatch();
+        }
+        
+        ~Batch() {
+            document_.endBatch();
+        }
+        
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+        
+    private:
+        Document& document_;
+    };
+    
     // Constructor
     Document(const std::string& id = "", const std::string& name = "")
         : id_(id), name_(name), version_(0) {
-        // Initialize with an empty line
-        lines_.push_back("");
     }
     
     // Document metadata
@@ -204,44 +287,15 @@ public:
     // Get the entire document text
     std::string getText() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        
-        std::string result;
-        for (size_t i = 0; i < lines_.size(); ++i) {
-            result += lines_[i];
-            if (i < lines_.size() - 1) {
-                result += '\n';
-            }
-        }
-        return result;
+        return text_.text();
     }
     
     // Set the entire document text
     void setText(const std::string& text, const std::string& userId = "") {
         std::lock_guard<std::mutex> lock(mutex_);
         
-        // Parse text into lines
-        lines_.clear();
-        size_t start = 0;
-        size_t end = text.find('\n');
-        
-        while (end != std::string::npos) {
-            lines_.push_back(text.substr(start, end - start));
-            start = end + 1;
-            end = text.find('\n', start);
-        }
-        
-        // Add the last line
-        lines_.push_back(text.substr(start));
-        
-        // If the document ends with a newline, add an empty last line
-        if (!text.empty() && text.back() == '\n') {
-            lines_.push_back("");
-        }
-        
-        // If no lines were added, add an empty line
-        if (lines_.empty()) {
-            lines_.push_back("");
-        }
+        // The text becomes the original buffer; a trailing newline ends in an empty last line
+        text_.assign(text);
         
         // Record this as a replace operation
         recordOperation(DocumentOperation(
@@ -262,12 +316,228 @@ public:
         }
     }
     
+    /**
+     * Change the entire document text with the fewest edits
+     * Unlike setText(), the old and new text are diffed and only the spans
+     * that differ are replaced, one REPLACE operation each, so history,
+     * undo and listeners see an edit rather than a reload. Listeners are
+     * notified once, as for a batch.
+     * 
+     * @param text The new document text
+     * @param userId User making the change
+     * @return Number of spans replaced; 0 if the text was unchanged
+     */
+    size_t updateText(const std::string& text, const std::string& userId = "") {
+        Batch batch(*this);
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        const ot::TextOperation change = ot::diff(text_.text(), text);
+        
+        // Each insert and delete between two retains is one span
+        size_t offset = 0;
+        size_t replaced = 0;
+        std::string inserted;
+        size_t removed = 0;
+        auto replaceSpan = [&]() {
+            if (inserted.empty() && removed == 0) {
+                return;
+            }
+            replaceLocked(linearToCursorLocked(offset), offset, removed, inserted, userId);
+            offset += inserted.length();
+            inserted.clear();
+            removed = 0;
+            ++replaced;
+        };
+        for (const auto& component : change.getComponents()) {
+            switch (component.type) {
+                case ot::TextComponent::Type::RETAIN:
+                    replaceSpan();
+                    offset += component.count;
+                    break;
+                case ot::TextComponent::Type::INSERT:
+                    inserted = component.text;
+                    break;
+                case ot::TextComponent::Type::DELETE:
+                    removed = component.count;
+                    break;
+            }
+        }
+        replaceSpan();
+        return replaced;
+    }
+    
+    /**
+     * Open a file as the document text
+     * The file is streamed a chunk at a time into the piece table's original
+     * buffer and only its newlines are indexed, so memory stays at the text
+     * plus one chunk, and what has been read can be shown while the rest is
+     * a placeholder, as with beginChunkedLoad. Opening is not an edit: the
+     * history is cleared rather than recording the whole text.
+     * 
+     * @param path File to open
+     * @param progress Told the bytes read after each chunk, on this thread
+     * @return False if the file could not be opened, the document is unchanged then;
+     *         or if reading failed midway, the text not read stays unloaded then
+     */
+    bool loadFile(const std::filesystem::path& path, const util::IoProgress& progress = {}) {
+        std::optional<util::ChunkedFileReader> reader;
+        try {
+            reader.emplace(path);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        
+        // Taking the lock per chunk lets a view draw the part already read
+        beginChunkedLoad(static_cast<size_t>(reader->size()));
+        size_t offset = 0;
+        try {
+            reader->readAll([this, &offset](std::string_view chunk) {
+                loadChunk(offset, chunk);
+                offset += chunk.size();
+            }, progress);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return isFullyLoaded();
+    }
+    
+    /**
+     * Write the text to a file, which is replaced only once it is written whole
+     * The text goes out a chunk at a time rather than being copied out whole;
+     * edits wait until the last chunk is written.
+     * 
+     * @param path File to write
+     * @param progress Told the bytes written after each chunk; must not call into the document
+     * @return False if the file could not be written; it is unchanged then
+     */
+    bool saveFile(const std::filesystem::path& path, const util::IoProgress& progress = {}) const {
+        try {
+            util::ChunkedFileWriter writer(path);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const uint64_t total = text_.length();
+                std::string chunk;
+                chunk.reserve(util::DEFAULT_IO_CHUNK_SIZE);
+                const auto flush = [&] {
+                    writer.write(chunk);
+                    chunk.clear();
+                    if (progress) {
+                        progress(writer.written(), total);
+                    }
+                };
+                // Pieces can be a keystroke long; gather them into whole chunks
+                text_.visit(0, text_.length(), [&](std::string_view piece) {
+                    while (!piece.empty()) {
+                        const size_t take = std::min(piece.size(), util::DEFAULT_IO_CHUNK_SIZE - chunk.size());
+                        chunk.append(piece.substr(0, take));
+                        piece.remove_prefix(take);
+                        if (chunk.size() == util::DEFAULT_IO_CHUNK_SIZE) {
+                            flush();
+                        }
+                    }
+                });
+                if (!chunk.empty()) {
+                    flush();
+                }
+            }
+            writer.commit();
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+    
+    /**
+     * Open a snapshot file written by saveSnapshot() as the document text
+     * The file is mapped and its text and line index are used in place as
+     * the piece table's original buffer, so opening reads only the pages
+     * that are shown. Like loadFile, opening clears the history.
+     * 
+     * @param path Snapshot to open
+     * @return The snapshot's revision and metadata, or nullptr if it could not be mapped;
+     *         the document is unchanged then
+     */
+    std::shared_ptr<const util::MappedSnapshot> loadSnapshot(const std::filesystem::path& path) {
+        std::shared_ptr<const util::MappedSnapshot> snapshot;
+        try {
+            snapshot = util::MappedSnapshot::open(path);
+        } catch (const std::runtime_error&) {
+            return nullptr;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        text_.assignBase(snapshot->text(), snapshot->breaks(), snapshot);
+        startOverLocked();
+        return snapshot;
+    }
+    
+    /**
+     * Write the text to a snapshot file for loadSnapshot()
+     * 
+     * @param path Where the snapshot goes
+     * @param revision Revision to record with it
+     * @param metadata Extra state to keep with it, e.g. CRDT metadata
+     * @return False if the file could not be written
+     */
+    bool saveSnapshot(const std::filesystem::path& path, int64_t revision, std::string_view metadata = {}) const {
+        const std::string text = getText();
+        try {
+            util::MappedSnapshot::write(path, text, revision, metadata);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+    
+    /**
+     * Open a document whose text arrives in chunks, such as a chunked DOC_OPEN
+     * Until a range is loaded it is a placeholder: it counts towards the length
+     * but not the lines, and edits may be made around it. Like loadFile, opening
+     * clears the history.
+     * 
+     * @param length Length of the whole text as of the revision the chunks are taken from
+     */
+    void beginChunkedLoad(size_t length) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        text_.reserveOriginal(length);
+        startOverLocked();
+    }
+    
+    /**
+     * Fill in a chunk of a document opened with beginChunkedLoad
+     * The chunk lands wherever edits since have moved its range; it is not an edit
+     * 
+     * @param offset Where the chunk starts in the text as it was opened
+     * @param text The chunk
+     * @return False if the chunk lies outside the opened text
+     */
+    bool loadChunk(size_t offset, std::string_view text) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!text_.fillOriginal(offset, text)) {
+            return false;
+        }
+        version_++;
+        return true;
+    }
+    
+    // Whether every chunk of the opened text has arrived
+    bool isFullyLoaded() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return text_.fullyLoaded();
+    }
+    
+    // Whether a range holds only loaded text
+    bool isRangeLoaded(const CursorPosition& start, size_t length) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return isValidPosition(start) && text_.isLoaded(cursorToLinearLocked(start), length);
+    }
+    
     // Get a specific line
     std::string getLine(size_t lineIndex) const {
         std::lock_guard<std::mutex> lock(mutex_);
         
-        if (lineIndex < lines_.size()) {
-            return lines_[lineIndex];
+        if (lineIndex < text_.lineCount()) {
+            return text_.substr(text_.lineStart(lineIndex), text_.lineLength(lineIndex));
         }
         return "";
     }
@@ -275,7 +545,7 @@ public:
     // Get the number of lines
     size_t getLineCount() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        return lines_.size();
+        return text_.lineCount();
     }
     
     // Insert text at the given position
@@ -286,13 +556,8 @@ public:
             return false;
         }
         
-        // If text contains newlines, we need to split it and handle line insertions
-        if (text.find('\n') != std::string::npos) {
-            return insertMultilineText(position, text, userId);
-        }
-        
-        // Single line insertion
-        lines_[position.line].insert(position.column, text);
+        const size_t offset = cursorToLinearLocked(position);
+        text_.insert(offset, text);
         
         // Record the operation
         recordOperation(DocumentOperation(
@@ -310,7 +575,7 @@ public:
         modifiedTime_ = std::chrono::system_clock::now();
         
         // Notify listeners
-        notifyChangeListeners(DocumentOperation(
+        noteChange(offset, 0, text.length(), DocumentOperation(
             OperationType::INSERT,
             position,
             text,
@@ -329,89 +594,22 @@ public:
             return false;
         }
         
-        // If length extends beyond the current line, we need to handle multi-line deletion
-        const size_t lineLength = lines_[position.line].length();
-        
-        if (position.column + length <= lineLength) {
-            // Simple single-line deletion
-            std::string deletedText = lines_[position.line].substr(position.column, length);
-            lines_[position.line].erase(position.column, length);
-            
-            // Record the operation with the deleted text for potential undo
-            auto op = DocumentOperation(
-                OperationType::DELETE,
-                position,
-                "",
-                length,
-                userId
-            );
-            
-            // Store the actual deleted text for undo
-            deletedTexts_[op.getTimestamp()] = deletedText;
-            
-            recordOperation(op);
-            
-            // Increment version
-            version_++;
-            
-            // Update modified time
-            modifiedTime_ = std::chrono::system_clock::now();
-            
-            // Notify listeners
-            notifyChangeListeners(DocumentOperation(
-                OperationType::DELETE,
-                position,
-                "",
-                length,
-                userId
-            ));
-            
-            return true;
-        } else {
-            // Multi-line deletion
-            return deleteMultilineText(position, length, userId);
-        }
-    }
-    
-    // Replace text at the given position
-    bool replaceText(const CursorPosition& position, size_t length, const std::string& newText, const std::string& userId = "") {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        if (!isValidPosition(position)) {
-            return false;
-        }
-        
-        // Keep track of the text being replaced for undo
-        std::string replacedText;
+        // Text past the end of a line runs on into the next ones, up to the end of the document
+        const size_t offset = cursorToLinearLocked(position);
+        std::string deletedText = text_.substr(offset, length);
+        text_.erase(offset, length);
         
-        // Handle multi-line replace
-        if (length > lines_[position.line].length() - position.column || newText.find('\n') != std::string::npos) {
-            // Store the text being replaced
-            replacedText = getTextRange(position, length);
-            
-            // Implement as a delete followed by an insert
-            bool success = deleteText(position, length, userId);
-            if (success) {
-                success = insertText(position, newText, userId);
-            }
-            return success;
-        }
-        
-        // Single line replace
-        replacedText = lines_[position.line].substr(position.column, length);
-        lines_[position.line].replace(position.column, length, newText);
-        
-        // Record the operation
+        // Record the operation with the deleted text for potential undo
         auto op = DocumentOperation(
-            OperationType::REPLACE,
+            OperationType::DELETE,
             position,
-            newText,
+            "",
             length,
             userId
         );
         
-        // Store the replaced text for undo
-        deletedTexts_[op.getTimestamp()] = replacedText;
+        // Store the actual deleted text for undo
+        deletedTexts_[op.getTimestamp()] = deletedText;
         
         recordOperation(op);
         
@@ -422,10 +620,10 @@ public:
         modifiedTime_ = std::chrono::system_clock::now();
         
         // Notify listeners
-        notifyChangeListeners(DocumentOperation(
-            OperationType::REPLACE,
+        noteChange(offset, deletedText.length(), 0, DocumentOperation(
+            OperationType::DELETE,
             position,
-            newText,
+            "",
             length,
             userId
         ));
@@ -433,13 +631,25 @@ public:
         return true;
     }
     
+    // Replace text at the given position
+    bool replaceText(const CursorPosition& position, size_t length, const std::string& newText, const std::string& userId = "") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (!isValidPosition(position)) {
+            return false;
+        }
+        
+        replaceLocked(position, cursorToLinearLocked(position), length, newText, userId);
+        return true;
+    }
+    
     // Cursor and selection management
     
     // Set cursor position for a user
     void setCursorPosition(const std::string& userId, const CursorPosition& position) {
         std::lock_guard<std::mutex> lock(mutex_);
         if (isValidPosition(position)) {
-            userCursors_[userId] = position;
+            trackLocked(userCursors_, userId, cursorToLinearLocked(position));
         }
     }
     
@@ -448,7 +658,7 @@ public:
         std::lock_guard<std::mutex> lock(mutex_);
         auto it = userCursors_.find(userId);
         if (it != userCursors_.end()) {
-            return it->second;
+            return linearToCursorLocked(positions_.get(it->second));
         }
         return CursorPosition(); // Default to (0, 0)
     }
@@ -457,16 +667,18 @@ public:
     void setSelection(const std::string& userId, const Selection& selection) {
         std::lock_guard<std::mutex> lock(mutex_);
         if (isValidPosition(selection.start) && isValidPosition(selection.end)) {
-            userSelections_[userId] = selection;
+            trackLocked(selectionStarts_, userId, cursorToLinearLocked(selection.start));
+            trackLocked(selectionEnds_, userId, cursorToLinearLocked(selection.end));
         }
     }
     
     // Get selection for a user
     Selection getSelection(const std::string& userId) const {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto it = userSelections_.find(userId);
-        if (it != userSelections_.end()) {
-            return it->second;
+        auto it = selectionStarts_.find(userId);
+        if (it != selectionStarts_.end()) {
+            return Selection(linearToCursorLocked(positions_.get(it->second)),
+                             linearToCursorLocked(positions_.get(selectionEnds_.at(userId))));
         }
         return Selection(); // Default to empty selection at (0, 0)
     }
@@ -474,14 +686,24 @@ public:
     // Get all user cursors
     std::unordered_map<std::string, CursorPosition> getAllCursors() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        return userCursors_;
+        std::unordered_map<std::string, CursorPosition> cursors;
+        for (const auto& [userId, handle] : userCursors_) {
+            cursors.emplace(userId, linearToCursorLocked(positions_.get(handle)));
+        }
+        return cursors;
     }
     
     // Get all user selections
     std::unordered_map<std::string, Selection> getAllSelections() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        return userSelections_;
+        std::unordered_map<std::string, Selection> selections;
+        for (const auto& [userId, handle] : selectionStarts_) {
+            selections.emplace(userId, Selection(linearToCursorLocked(positions_.get(handle)),
+                                                 linearToCursorLocked(positions_.get(selectionEnds_.at(userId)))));
+        }
+        return selections;
     }
+
     
     // Operation history management
     
@@ -513,7 +735,7 @@ public:
         bool success = false;
         switch (inverseOp->getType()) {
             case OperationType::INSERT:
-                success = insertText(inverseOp->getPosition(), inverseOp->getText(), userId);
+                success = insertText(inverseOp->getPosition(), std::string(inverseOp->getText()), userId);
                 break;
                 
             case OperationType::DELETE:
@@ -521,7 +743,7 @@ public:
                 break;
                 
             case OperationType::REPLACE:
-                success = replaceText(inverseOp->getPosition(), inverseOp->getLength(), inverseOp->getText(), userId);
+                success = replaceText(inverseOp->getPosition(), inverseOp->getLength(), std::string(inverseOp->getText()), userId);
                 break;
         }
         
@@ -559,7 +781,7 @@ public:
         bool success = false;
         switch (lastUndoneOp.getType()) {
             case OperationType::INSERT:
-                success = insertText(lastUndoneOp.getPosition(), lastUndoneOp.getText(), userId);
+                success = insertText(lastUndoneOp.getPosition(), std::string(lastUndoneOp.getText()), userId);
                 break;
                 
             case OperationType::DELETE:
@@ -567,7 +789,7 @@ public:
                 break;
                 
             case OperationType::REPLACE:
-                success = replaceText(lastUndoneOp.getPosition(), lastUndoneOp.getLength(), lastUndoneOp.getText(), userId);
+                success = replaceText(lastUndoneOp.getPosition(), lastUndoneOp.getLength(), std::string(lastUndoneOp.getText()), userId);
                 break;
         }
         
@@ -607,99 +829,94 @@ public:
         changeCallbacks_.push_back(callback);
     }
     
+    void addChangeSummaryListener(const ChangeSummaryCallback& callback) {
+        std::lock_guard<std::mutex> lock(callbackMutex_);
+        summaryCallbacks_.push_back(callback);
+    }
+    
     void removeChangeListeners() {
         std::lock_guard<std::mutex> lock(callbackMutex_);
         changeCallbacks_.clear();
+        summaryCallbacks_.clear();
     }
     
-    // Position conversion utilities
-    
-    // Convert a linear position to a cursor position
-    CursorPosition linearToCursor(size_t position) const {
+    // Hold notifications back until the matching endBatch(); batches nest
+    void beginBatch() {
         std::lock_guard<std::mutex> lock(mutex_);
-        
-        size_t line = 0;
-        size_t column = 0;
-        size_t current = 0;
-        
-        for (const auto& lineText : lines_) {
-            if (current + lineText.length() >= position) {
-                column = position - current;
-                return CursorPosition(line, column);
+        ++batchDepth_;
+    }
+    
+    // Close a batch; the outermost one notifies listeners of everything it changed
+    void endBatch() {
+        std::vector<DocumentOperation> operations;
+        ChangeSummary summary;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (batchDepth_ == 0 || --batchDepth_ > 0) {
+                return;
             }
-            
-            current += lineText.length() + 1; // +1 for the newline
-            line++;
+            operations.swap(batchOperations_);
+            summary = batchSummary_;
+            batchSummary_ = ChangeSummary{};
         }
         
-        // If we get here, the position is beyond the end of the document
-        // Return the last valid position
-        if (lines_.empty()) {
-            return CursorPosition(0, 0);
-        } else {
-            return CursorPosition(lines_.size() - 1, lines_.back().length());
+        if (summary.operations > 0) {
+            notifyChangeListeners(operations, summary);
         }
     }
     
+    // Position conversion utilities
+    
+    // Convert a linear position to a cursor position
+    CursorPosition linearToCursor(size_t position) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return linearToCursorLocked(position);
+    }
+    
     // Convert a cursor position to a linear position
     size_t cursorToLinear(const CursorPosition& cursor) const {
         std::lock_guard<std::mutex> lock(mutex_);
-        
-        if (cursor.line >= lines_.size()) {
-            // Beyond the end of the document
-            return getTextLength();
-        }
-        
-        size_t position = 0;
-        
-        // Add all complete lines before the cursor
-        for (size_t i = 0; i < cursor.line; ++i) {
-            position += lines_[i].length() + 1; // +1 for the newline
-        }
-        
-        // Add the column within the line
-        position += std::min(cursor.column, lines_[cursor.line].length());
-        
-        return position;
+        return cursorToLinearLocked(cursor);
     }
     
     // Get the total length of the document text
     size_t getTextLength() const {
         std::lock_guard<std::mutex> lock(mutex_);
-        
-        size_t length = 0;
-        for (const auto& line : lines_) {
-            length += line.length() + 1; // +1 for newline
-        }
-        
-        // Don't count the final newline if it's the last line
-        if (!lines_.empty()) {
-            length--;
-        }
-        
-        return length;
+        return text_.length();
+    }
+    
+    // Convert a linear position to a UTF-16 offset, as Qt and JavaScript clients count them
+    size_t linearToUtf16(size_t position) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return text_.utf16OffsetOf(std::min(position, text_.length()));
+    }
+    
+    // Convert a UTF-16 offset to a linear position; one inside a surrogate pair gives the start of its character
+    size_t utf16ToLinear(size_t offset) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return text_.offsetOfUtf16(offset);
     }
     
-    // Get a range of text from the document
+    // Convert a linear position to a code point offset
+    size_t linearToCodePoint(size_t position) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return text_.codePointOffsetOf(std::min(position, text_.length()));
+    }
+    
+    // Convert a code point offset to a linear position
+    size_t codePointToLinear(size_t offset) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return text_.offsetOfCodePoint(offset);
+    }
+    
+    // Get a range of text from the document, copying only the pieces it touches
     std::string getTextRange(const CursorPosition& start, size_t length) const {
         std::lock_guard<std::mutex> lock(mutex_);
         
         if (!isValidPosition(start)) {
             return "";
         }
-        
-        // Get linear start position
-        size_t startPos = cursorToLinear(start);
-        
-        // Get the full text
-        std::string fullText = getText();
-        
-        // Extract the range
-        if (startPos + length > fullText.length()) {
-            return fullText.substr(startPos);
-        } else {
-            return fullText.substr(startPos, length);
-        }
+        return textRangeLocked(start, length);
     }
     
     // Get text between two cursor positions
@@ -710,27 +927,27 @@ public:
             return "";
         }
         
-        if (start > end) {
-            return getTextRange(end, start);
-        }
-        
-        // If they're on the same line
-        if (start.line == end.line) {
-            return lines_[start.line].substr(start.column, end.column - start.column);
-        }
-        
-        // They're on different lines
-        std::string result = lines_[start.line].substr(start.column) + "\n";
+        const CursorPosition& first = std::min(start, end);
+        const CursorPosition& last = std::max(start, end);
+        return textRangeLocked(first, cursorToLinearLocked(last) - cursorToLinearLocked(first));
+    }
+    
+    /**
+     * Visit a range of text as the pieces of the piece table it touches, without copying
+     * A piece may span lines; the views are only valid during the call,
+     * which runs with the document locked
+     * 
+     * @param start Where the range starts
+     * @param length Characters in the range, clamped to the end of the document
+     * @param visit Called with each std::string_view in order
+     */
+    template <typename Visitor>
+    void visitTextRange(const CursorPosition& start, size_t length, Visitor&& visit) const {
+        std::lock_guard<std::mutex> lock(mutex_);
         
-        // Add the complete lines in between
-        for (size_t line = start.line + 1; line < end.line; ++line) {
-            result += lines_[line] + "\n";
+        if (isValidPosition(start)) {
+            text_.visit(cursorToLinearLocked(start), length, visit);
         }
-        
-        // Add the end line
-        result += lines_[end.line].substr(0, end.column);
-        
-        return result;
     }
 
 private:
@@ -738,11 +955,35 @@ private:
     
     // Check if a position is valid within the document
     bool isValidPosition(const CursorPosition& position) const {
-        if (position.line >= lines_.size()) {
+        if (position.line >= text_.lineCount()) {
             return false;
         }
         
-        return position.column <= lines_[position.line].length();
+        return position.column <= text_.lineLength(position.line);
+    }
+    
+    // Conversions through the piece table's newline index; mutex_ must be held
+    CursorPosition linearToCursorLocked(size_t position) const {
+        if (position > text_.length()) {
+            // Beyond the end of the document: the last valid position
+            const size_t last = text_.lineCount() - 1;
+            return CursorPosition(last, text_.lineLength(last));
+        }
+        const size_t line = text_.lineAt(position);
+        return CursorPosition(line, position - text_.lineStart(line));
+    }
+    
+    size_t cursorToLinearLocked(const CursorPosition& cursor) const {
+        if (cursor.line >= text_.lineCount()) {
+            // Beyond the end of the document
+            return text_.length();
+        }
+        return text_.lineStart(cursor.line) + std::min(cursor.column, text_.lineLength(cursor.line));
+    }
+    
+    // Copy out a range (mutex_ must be held, start must be valid)
+    std::string textRangeLocked(const CursorPosition& start, size_t length) const {
+        return text_.substr(cursorToLinearLocked(start), length);
     }
     
     // Record an operation in the history
@@ -759,124 +1000,46 @@ private:
         redoStack_.clear();
     }
     
-    // Notify change listeners about an operation
-    void notifyChangeListeners(const DocumentOperation& operation) {
-        std::lock_guard<std::mutex> lock(callbackMutex_);
-        for (const auto& callback : changeCallbacks_) {
-            callback(operation);
-        }
-    }
-    
-    // Insert text that may contain newlines
-    bool insertMultilineText(const CursorPosition& position, const std::string& text, const std::string& userId) {
-        // Split the text by newlines
-        std::vector<std::string> newLines;
-        size_t start = 0;
-        size_t end = text.find('\n');
-        
-        while (end != std::string::npos) {
-            newLines.push_back(text.substr(start, end - start));
-            start = end + 1;
-            end = text.find('\n', start);
-        }
-        
-        // Add the last segment
-        newLines.push_back(text.substr(start));
-        
-        if (newLines.empty()) {
-            return false;
-        }
-        
-        // Get the text before and after the insertion point on the current line
-        std::string beforeText = lines_[position.line].substr(0, position.column);
-        std::string afterText = lines_[position.line].substr(position.column);
-        
-        // Update the current line with the first line of the inserted text
-        lines_[position.line] = beforeText + newLines[0];
-        
-        // Insert the middle lines
-        for (size_t i = 1; i < newLines.size() - 1; ++i) {
-            lines_.insert(lines_.begin() + position.line + i, newLines[i]);
-        }
-        
-        // Insert the last line combined with the rest of the original line
-        if (newLines.size() > 1) {
-            lines_.insert(lines_.begin() + position.line + newLines.size() - 1, 
-                newLines.back() + afterText);
-        } else {
-            // If there's only one line, we need to add the after text
-            lines_[position.line] += afterText;
-        }
-        
-        // Record the operation
-        recordOperation(DocumentOperation(
-            OperationType::INSERT,
-            position,
-            text,
-            0,
-            userId
-        ));
-        
-        // Increment version
+    // Forget the history of the text just replaced (mutex_ must be held)
+    void startOverLocked() {
+        operationHistory_.clear();
+        redoStack_.clear();
+        deletedTexts_.clear();
+        userCursors_.clear();
+        selectionStarts_.clear();
+        selectionEnds_.clear();
+        positions_.clear();
         version_++;
-        
-        // Update modified time
         modifiedTime_ = std::chrono::system_clock::now();
-        
-        // Notify listeners
-        notifyChangeListeners(DocumentOperation(
-            OperationType::INSERT,
-            position,
-            text,
-            0,
-            userId
-        ));
-        
-        return true;
+        if (createdTime_ == std::chrono::system_clock::time_point()) {
+            createdTime_ = modifiedTime_;
+        }
     }
     
-    // Delete text that spans multiple lines
-    bool deleteMultilineText(const CursorPosition& position, size_t length, const std::string& userId) {
-        // Calculate the end position
-        CursorPosition endPos = linearToCursor(cursorToLinear(position) + length);
-        
-        // Store the text being deleted for potential undo
-        std::string deletedText = getTextRange(position, length);
-        
-        // If the end position is invalid, adjust it
-        if (endPos.line >= lines_.size()) {
-            endPos.line = lines_.size() - 1;
-            endPos.column = lines_[endPos.line].length();
-        }
-        
-        // Handle the case where deletion is within the same line
-        if (position.line == endPos.line) {
-            lines_[position.line].erase(position.column, endPos.column - position.column);
-        } else {
-            // Get the text before the deletion on the first line
-            std::string beforeText = lines_[position.line].substr(0, position.column);
-            
-            // Get the text after the deletion on the last line
-            std::string afterText = lines_[endPos.line].substr(endPos.column);
-            
-            // Combine the remaining parts
-            lines_[position.line] = beforeText + afterText;
-            
-            // Remove the lines in between
-            lines_.erase(lines_.begin() + position.line + 1, lines_.begin() + endPos.line + 1);
+    // Replace length bytes at offset, where position is, and record it (mutex_ must be held)
+    void replaceLocked(const CursorPosition& position, size_t offset, size_t length, const std::string& newText,
+                       const std::string& userId) {
+        // Keep track of the text being replaced for undo; it may span lines
+        std::string replacedText = text_.substr(offset, length);
+        text_.erase(offset, length);
+        text_.insert(offset, newText);
+        
+        // Record the operation; replaced text for undo is keyed by timestamp, so it must not repeat
+        uint64_t timestamp = DocumentOperation(OperationType::REPLACE, position).getTimestamp();
+        if (!operationHistory_.empty()) {
+            timestamp = std::max(timestamp, operationHistory_.back().getTimestamp() + 1);
         }
-        
-        // Record the operation
         auto op = DocumentOperation(
-            OperationType::DELETE,
+            OperationType::REPLACE,
             position,
-            "",
+            newText,
             length,
-            userId
+            userId,
+            timestamp
         );
         
-        // Store the deleted text for undo
-        deletedTexts_[op.getTimestamp()] = deletedText;
+        // Store the replaced text for undo
+        deletedTexts_[op.getTimestamp()] = replacedText;
         
         recordOperation(op);
         
@@ -887,25 +1050,56 @@ private:
         modifiedTime_ = std::chrono::system_clock::now();
         
         // Notify listeners
-        notifyChangeListeners(DocumentOperation(
-            OperationType::DELETE,
-            position,
-            "",
-            length,
-            userId
-        ));
+        noteChange(offset, replacedText.length(), newText.length(), std::move(op));
+    }
+    
+    // Point a user's entry at an offset, tracking it from now on (mutex_ must be held)
+    void trackLocked(std::unordered_map<std::string, ot::CursorSet::Handle>& users, const std::string& userId,
+                     size_t offset) {
+        auto it = users.find(userId);
+        if (it != users.end()) {
+            positions_.set(it->second, offset);
+        } else {
+            users.emplace(userId, positions_.add(offset));
+        }
+    }
+    
+    // Account for an edit of [offset, offset + removed) into added characters (mutex_ must be held)
+    void noteChange(size_t offset, size_t removed, size_t added, DocumentOperation operation) {
+        positions_.transform(offset, removed, added);
         
-        return true;
+        if (batchDepth_ == 0) {
+            notifyChangeListeners({std::move(operation)}, ChangeSummary{offset, removed, added, 1});
+            return;
+        }
+        
+        batchSummary_.merge(ChangeSummary{offset, removed, added, 1});
+        batchOperations_.push_back(std::move(operation));
+    }
+    
+    // Notify listeners about a batch of operations
+    void notifyChangeListeners(const std::vector<DocumentOperation>& operations, const ChangeSummary& summary) {
+        std::lock_guard<std::mutex> lock(callbackMutex_);
+        for (const auto& operation : operations) {
+            for (const auto& callback : changeCallbacks_) {
+                callback(operation);
+            }
+        }
+        for (const auto& callback : summaryCallbacks_) {
+            callback(summary);
+        }
     }
 
 private:
     std::string id_;                                         // Document ID
     std::string name_;                                       // Document name
-    std::vector<std::string> lines_;                         // Document content as lines
+    PieceTable text_;                                        // Document content
     uint64_t version_;                                       // Document version
     
-    std::unordered_map<std::string, CursorPosition> userCursors_;  // Map of user IDs to cursor positions
-    std::unordered_map<std::string, Selection> userSelections_;    // Map of user IDs to selections
+    ot::CursorSet positions_;                                // Cursor and selection ends as offsets, moved by every edit
+    std::unordered_map<std::string, ot::CursorSet::Handle> userCursors_;     // Map of user IDs to cursor positions
+    std::unordered_map<std::string, ot::CursorSet::Handle> selectionStarts_; // Map of user IDs to where their selection starts
+    std::unordered_map<std::string, ot::CursorSet::Handle> selectionEnds_;   // Map of user IDs to where it ends
     
     std::deque<DocumentOperation> operationHistory_;         // History of operations for undo
     std::deque<DocumentOperation> redoStack_;                // Stack of operations for redo
@@ -915,6 +1109,11 @@ private:
     std::chrono::system_clock::time_point modifiedTime_;    // When the document was last modified
     
     std::vector<ChangeCallback> changeCallbacks_;           // Callbacks for document changes
+    std::vector<ChangeSummaryCallback> summaryCallbacks_;   // Callbacks for one summary per batch
+    
+    size_t batchDepth_ = 0;                                 // Open batches
+    std::vector<DocumentOperation> batchOperations_;        // Edits of the open batch, not yet notified
+    ChangeSummary batchSummary_;                            // Range the open batch changed so far
     
     mutable std::mutex mutex_;                              // Mutex for thread safety
     mutable std::mutex callbackMutex_;                      // Separate mutex for callbacks
@@ -0,0 +1,753 @@
+#ifndef COLLABORATIVE_EDITOR_PIECE_TABLE_H
+#define COLLABORATIVE_EDITOR_PIECE_TABLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common/util/text_scan.h"
+
+namespace collab {
+namespace document {
+
+/**
+ * Text stored as pieces of two buffers: the original text, never changed
+ * once loaded, and an append-only buffer for everything inserted since
+ *
+ * The pieces are the nodes of a treap ordered by position in the text;
+ * each node knows the length and newline count of its subtree, so finding
+ * an offset, a line start or the line an offset is on, and splicing in an
+ * insert or cutting out a delete, are O(log pieces). Each buffer keeps
+ * the offsets of its newlines in order, so counting the newlines in a
+ * piece is a binary search rather than a scan. Loading a file is one copy
+ * into the original buffer and one pass to index its newlines; nothing is
+ * split into lines.
+ *
+ * The original buffer can also arrive in chunks: reserveOriginal() sizes
+ * it up front, and until fillOriginal() copies a range in, that range is a
+ * placeholder that reads as NUL characters, holds no newlines and may be
+ * edited around like any other text.
+ *
+ * Or the original text can be kept elsewhere, e.g. in a mapped snapshot
+ * file: assignBase() takes a view of it and its newline offsets, which are
+ * used as they are, so opening a document copies and indexes nothing.
+ *
+ * Offsets are bytes of UTF-8. Clients that count in UTF-16 units or code
+ * points convert through a second index, built on the first conversion:
+ * each buffer keeps its units before every UNIT_CHUNK bytes and each node
+ * the units of its subtree, so a conversion is O(log pieces) plus a scan
+ * of at most one chunk, and edits keep the index up to date from then on.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+class PieceTable {
+public:
+    PieceTable() = default;
+
+    explicit PieceTable(std::string original) {
+        assign(std::move(original));
+    }
+
+    // Start over from a text, which becomes the original buffer
+    void assign(std::string original) {
+        base_ = {};
+        baseBreaks_ = {};
+        baseOwner_.reset();
+        buffers_[ORIGINAL].text = std::move(original);
+        buffers_[ADDED].text.clear();
+        indexBreaks(buffers_[ORIGINAL]);
+        buffers_[ADDED].breaks.clear();
+        buffers_[ORIGINAL].chunks.clear();
+        buffers_[ADDED].chunks.clear();
+        unitsIndexed_ = false;
+        unloaded_.clear();
+        root_.reset();
+        const size_t length = buffers_[ORIGINAL].text.length();
+        if (length > 0) {
+            root_ = makeNode(ORIGINAL, 0, length);
+        }
+    }
+
+    /**
+     * Start over from an original text held elsewhere, used in place
+     *
+     * @param text The original text
+     * @param breaks Offsets of the newlines in text, in order
+     * @param owner Keeps text and breaks alive for as long as the table uses them
+     */
+    void assignBase(std::string_view text, std::span<const uint64_t> breaks, std::shared_ptr<const void> owner) {
+        assign(std::string());
+        base_ = text;
+        baseBreaks_ = breaks;
+        baseOwner_ = std::move(owner);
+        if (!text.empty()) {
+            root_ = makeNode(ORIGINAL, 0, text.length());
+        }
+    }
+
+    /**
+     * Start over from an original text of a known length whose content arrives later
+     *
+     * @param length Length of the original text
+     */
+    void reserveOriginal(size_t length) {
+        assign(std::string(length, '\0'));
+        if (length > 0) {
+            unloaded_.emplace(0, length);
+        }
+    }
+
+    /**
+     * Copy a range of the original text in, replacing its placeholder
+     * Wherever the range has been moved to by edits since, its pieces read the new text
+     *
+     * @param offset Where the range starts in the original text
+     * @param text The range
+     * @return False if it does not fit in the original buffer
+     */
+    bool fillOriginal(size_t offset, std::string_view text) {
+        Buffer& original = buffers_[ORIGINAL];
+        if (baseOwner_ || offset > original.text.length() || text.length() > original.text.length() - offset) {
+            return false;
+        }
+        std::copy(text.begin(), text.end(), original.text.begin() + static_cast<std::ptrdiff_t>(offset));
+        markLoaded(offset, offset + text.length());
+
+        // Merge the range's newlines into the index, then recount the pieces that show them
+        std::vector<uint64_t> breaks;
+        util::findNewlines(text, offset, breaks);
+        auto from = std::lower_bound(original.breaks.begin(), original.breaks.end(), offset);
+        auto to = std::lower_bound(from, original.breaks.end(), offset + text.length());
+        from = original.breaks.erase(from, to);
+        original.breaks.insert(from, breaks.begin(), breaks.end());
+        if (unitsIndexed_) {
+            reindexChunks(ORIGINAL, offset, offset + text.length());
+        }
+        recount(root_.get(), offset, offset + text.length());
+        return true;
+    }
+
+    // Whether all of the original text has been filled in
+    bool fullyLoaded() const {
+        return unloaded_.empty();
+    }
+
+    /**
+     * Check whether a range of the text is free of placeholders
+     *
+     * @param offset Where the range starts
+     * @param count Characters in the range
+     * @return True if every character in it is real text
+     */
+    bool isLoaded(size_t offset, size_t count) const {
+        if (unloaded_.empty()) {
+            return true;
+        }
+        bool loaded = true;
+        walk(root_.get(), offset, count, [this, &loaded](const Node& node, size_t from, size_t take) {
+            if (node.buffer == ORIGINAL && !originalLoaded(node.start + from, node.start + from + take)) {
+                loaded = false;
+            }
+        });
+        return loaded;
+    }
+
+    // Characters in the text
+    size_t length() const {
+        return lengthOf(root_);
+    }
+
+    // Lines in the text; one more than its newlines
+    size_t lineCount() const {
+        return newlinesOf(root_) + 1;
+    }
+
+    // Offset of the first character of a line; the line must exist
+    size_t lineStart(size_t line) const {
+        return line == 0 ? 0 : findNewline(line) + 1;
+    }
+
+    // Characters in a line, not counting its newline; the line must exist
+    size_t lineLength(size_t line) const {
+        const size_t end = line + 1 < lineCount() ? findNewline(line + 1) : length();
+        return end - lineStart(line);
+    }
+
+    /**
+     * Find the line an offset is on
+     * An offset at a newline is on the line the newline ends
+     *
+     * @param offset Offset in the text, at most length()
+     * @return The line
+     */
+    size_t lineAt(size_t offset) const {
+        size_t newlines = 0;
+        const Node* node = root_.get();
+        while (node) {
+            const size_t leftLength = lengthOf(node->left);
+            if (offset < leftLength) {
+                node = node->left.get();
+                continue;
+            }
+            newlines += newlinesOf(node->left);
+            offset -= leftLength;
+            if (offset < node->length) {
+                return newlines + countBreaks(node->buffer, node->start, offset);
+            }
+            newlines += node->newlines;
+            offset -= node->length;
+            node = node->right.get();
+        }
+        return newlines;
+    }
+
+    // UTF-16 units in the text: one per code point, two above U+FFFF
+    size_t utf16Length() const {
+        indexUnits();
+        return unitsOf(root_).utf16;
+    }
+
+    // Code points in the text
+    size_t codePointCount() const {
+        indexUnits();
+        return unitsOf(root_).codePoints;
+    }
+
+    // UTF-16 units before an offset, which should start a character
+    size_t utf16OffsetOf(size_t offset) const {
+        return unitsAt(offset).utf16;
+    }
+
+    // Code points before an offset, which should start a character
+    size_t codePointOffsetOf(size_t offset) const {
+        return unitsAt(offset).codePoints;
+    }
+
+    /**
+     * Find the offset of a UTF-16 offset
+     * One inside a surrogate pair finds the start of its character
+     *
+     * @param units UTF-16 units from the start
+     * @return The offset; length() if units reaches past the end
+     */
+    size_t offsetOfUtf16(size_t units) const {
+        return offsetOf(units, &Units::utf16);
+    }
+
+    /**
+     * Find the offset of a code point offset
+     *
+     * @param codePoints Code points from the start
+     * @return The offset; length() if codePoints reaches past the end
+     */
+    size_t offsetOfCodePoint(size_t codePoints) const {
+        return offsetOf(codePoints, &Units::codePoints);
+    }
+
+    /**
+     * Insert text
+     *
+     * @param offset Where to insert, at most length()
+     * @param text The text
+     */
+    void insert(size_t offset, std::string_view text) {
+        if (text.empty()) {
+            return;
+        }
+        Buffer& added = buffers_[ADDED];
+        const size_t start = added.text.length();
+        added.text.append(text);
+        util::findNewlines(text, start, added.breaks);
+        if (unitsIndexed_) {
+            extendChunks(ADDED);
+        }
+
+        NodePtr left;
+        NodePtr right;
+        split(std::move(root_), offset, left, right);
+        // Typing appends where the last insert ended; grow that piece rather than add one
+        if (!extendLast(left.get(), start, text.length())) {
+            left = merge(std::move(left), makeNode(ADDED, start, text.length()));
+        }
+        root_ = merge(std::move(left), std::move(right));
+    }
+
+    /**
+     * Remove text
+     *
+     * @param offset Where the removed text starts
+     * @param count Characters to remove, clamped to the end of the text
+     */
+    void erase(size_t offset, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        NodePtr left;
+        NodePtr rest;
+        NodePtr removed;
+        NodePtr right;
+        split(std::move(root_), offset, left, rest);
+        split(std::move(rest), count, removed, right);
+        root_ = merge(std::move(left), std::move(right));
+    }
+
+    /**
+     * Visit a range as views into the buffers, in order, without copying
+     * The views are valid until the table is next changed
+     *
+     * @param offset Where the range starts
+     * @param count Characters in the range, clamped to the end of the text
+     * @param visit Called with each std::string_view
+     */
+    template <typename Visitor>
+    void visit(size_t offset, size_t count, Visitor&& visit) const {
+        walk(root_.get(), offset, count, [this, &visit](const Node& node, size_t from, size_t take) {
+            visit(textOf(node.buffer).substr(node.start + from, take));
+        });
+    }
+
+    // Copy out a range
+    std::string substr(size_t offset, size_t count) const {
+        std::string result;
+        result.reserve(std::min(count, length() - std::min(offset, length())));
+        visit(offset, count, [&result](std::string_view piece) { result.append(piece); });
+        return result;
+    }
+
+    // Copy out the whole text
+    std::string text() const {
+        return substr(0, length());
+    }
+
+    size_t pieceCount() const {
+        return countOf(root_);
+    }
+
+private:
+    static constexpr uint8_t ORIGINAL = 0;
+    static constexpr uint8_t ADDED = 1;
+    static constexpr size_t UNIT_CHUNK = 512;  // Bytes a conversion scans at most
+
+    // A stretch of text measured in the units other clients count in
+    struct Units {
+        size_t utf16 = 0;
+        size_t codePoints = 0;
+
+        friend Units operator+(Units a, Units b) {
+            return {a.utf16 + b.utf16, a.codePoints + b.codePoints};
+        }
+
+        friend Units operator-(Units a, Units b) {
+            return {a.utf16 - b.utf16, a.codePoints - b.codePoints};
+        }
+    };
+
+    struct Buffer {
+        std::string text;
+        std::vector<uint64_t> breaks;  // Offsets of the newlines in text, in order
+        // Units before each UNIT_CHUNK-byte boundary of text, once indexUnits() has run
+        mutable std::vector<Units> chunks;
+    };
+
+    struct Node;
+    using NodePtr = std::unique_ptr<Node>;
+
+    struct Node {
+        uint8_t buffer;
+        size_t start;     // Piece: [start, start + length) of buffers_[buffer]
+        size_t length;
+        size_t newlines;
+        Units units;      // Kept once indexUnits() has run
+        uint32_t priority;
+        // Totals over the subtree, this piece included
+        size_t totalLength;
+        size_t totalNewlines;
+        Units totalUnits;
+        size_t count;
+        NodePtr left;
+        NodePtr right;
+    };
+
+    static size_t lengthOf(const NodePtr& node) {
+        return node ? node->totalLength : 0;
+    }
+
+    static size_t newlinesOf(const NodePtr& node) {
+        return node ? node->totalNewlines : 0;
+    }
+
+    static size_t countOf(const NodePtr& node) {
+        return node ? node->count : 0;
+    }
+
+    static Units unitsOf(const NodePtr& node) {
+        return node ? node->totalUnits : Units{};
+    }
+
+    static void update(Node& node) {
+        node.totalLength = lengthOf(node.left) + node.length + lengthOf(node.right);
+        node.totalNewlines = newlinesOf(node.left) + node.newlines + newlinesOf(node.right);
+        node.totalUnits = unitsOf(node.left) + node.units + unitsOf(node.right);
+        node.count = countOf(node.left) + 1 + countOf(node.right);
+    }
+
+    static void indexBreaks(Buffer& buffer) {
+        buffer.breaks.clear();
+        util::findNewlines(buffer.text, 0, buffer.breaks);
+    }
+
+    // A buffer's text; the base, if there is one, stands in for the original buffer
+    std::string_view textOf(uint8_t buffer) const {
+        return buffer == ORIGINAL && baseOwner_ ? base_ : std::string_view(buffers_[buffer].text);
+    }
+
+    std::span<const uint64_t> breaksOf(uint8_t buffer) const {
+        return buffer == ORIGINAL && baseOwner_ ? baseBreaks_ : std::span<const uint64_t>(buffers_[buffer].breaks);
+    }
+
+    // Newlines in [start, start + length) of a buffer
+    size_t countBreaks(uint8_t buffer, size_t start, size_t length) const {
+        const std::span<const uint64_t> breaks = breaksOf(buffer);
+        return static_cast<size_t>(std::lower_bound(breaks.begin(), breaks.end(), start + length) -
+                                   std::lower_bound(breaks.begin(), breaks.end(), start));
+    }
+
+    static Units measure(std::string_view text) {
+        return {util::utf16Length(text), util::countCodePoints(text)};
+    }
+
+    // Build the unit index of both buffers and every piece, unless it is already kept
+    void indexUnits() const {
+        if (unitsIndexed_) {
+            return;
+        }
+        unitsIndexed_ = true;
+        extendChunks(ORIGINAL);
+        extendChunks(ADDED);
+        measureAll(root_.get());
+    }
+
+    void measureAll(Node* node) const {
+        if (!node) {
+            return;
+        }
+        measureAll(node->left.get());
+        measureAll(node->right.get());
+        node->units = unitsIn(node->buffer, node->start, node->length);
+        update(*node);
+    }
+
+    // Add the chunk boundaries text has reached since the last call
+    void extendChunks(uint8_t buffer) const {
+        const std::string_view text = textOf(buffer);
+        std::vector<Units>& chunks = buffers_[buffer].chunks;
+        if (chunks.empty()) {
+            chunks.emplace_back();
+        }
+        while (chunks.size() <= text.length() / UNIT_CHUNK) {
+            const size_t from = (chunks.size() - 1) * UNIT_CHUNK;
+            chunks.push_back(chunks.back() + measure(text.substr(from, UNIT_CHUNK)));
+        }
+    }
+
+    // Remeasure the chunks [begin, end) of a buffer overlaps and shift the boundaries after them
+    void reindexChunks(uint8_t buffer, size_t begin, size_t end) const {
+        const std::string_view text = textOf(buffer);
+        std::vector<Units>& chunks = buffers_[buffer].chunks;
+        const size_t first = begin / UNIT_CHUNK + 1;
+        const size_t last = std::min(chunks.size() - 1, (end + UNIT_CHUNK - 1) / UNIT_CHUNK);
+        if (first > last) {
+            return;
+        }
+        const Units before = chunks[last];
+        for (size_t k = first; k <= last; ++k) {
+            chunks[k] = chunks[k - 1] + measure(text.substr((k - 1) * UNIT_CHUNK, UNIT_CHUNK));
+        }
+        for (size_t k = last + 1; k < chunks.size(); ++k) {
+            chunks[k] = chunks[k] - before + chunks[last];
+        }
+    }
+
+    // Units in [0, offset) of a buffer
+    Units unitsBefore(uint8_t buffer, size_t offset) const {
+        const size_t chunk = offset / UNIT_CHUNK;
+        const std::string_view text = textOf(buffer).substr(chunk * UNIT_CHUNK, offset - chunk * UNIT_CHUNK);
+        return buffers_[buffer].chunks[chunk] + measure(text);
+    }
+
+    // Units in [start, start + length) of a buffer
+    Units unitsIn(uint8_t buffer, size_t start, size_t length) const {
+        return unitsBefore(buffer, start + length) - unitsBefore(buffer, start);
+    }
+
+    // Units before an offset in the text
+    Units unitsAt(size_t offset) const {
+        indexUnits();
+        Units units;
+        const Node* node = root_.get();
+        while (node) {
+            const size_t leftLength = lengthOf(node->left);
+            if (offset < leftLength) {
+                node = node->left.get();
+                continue;
+            }
+            units = units + unitsOf(node->left);
+            offset -= leftLength;
+            if (offset < node->length) {
+                return units + unitsIn(node->buffer, node->start, offset);
+            }
+            units = units + node->units;
+            offset -= node->length;
+            node = node->right.get();
+        }
+        return units;
+    }
+
+    // Offset in the text where a count of one kind of unit ends
+    size_t offsetOf(size_t target, size_t Units::*kind) const {
+        indexUnits();
+        size_t base = 0;
+        const Node* node = root_.get();
+        while (node) {
+            const size_t leftUnits = unitsOf(node->left).*kind;
+            if (target < leftUnits) {
+                node = node->left.get();
+                continue;
+            }
+            target -= leftUnits;
+            base += lengthOf(node->left);
+            if (target < node->units.*kind) {
+                return base + offsetInPiece(*node, target, kind);
+            }
+            target -= node->units.*kind;
+            base += node->length;
+            node = node->right.get();
+        }
+        return length();
+    }
+
+    // Offset in a piece where a count of units, fewer than it holds, ends
+    size_t offsetInPiece(const Node& node, size_t target, size_t Units::*kind) const {
+        // Start the scan at the last chunk boundary before the target, if that is inside the piece
+        const std::vector<Units>& chunks = buffers_[node.buffer].chunks;
+        const size_t wanted = unitsBefore(node.buffer, node.start).*kind + target;
+        const auto chunk = std::ranges::upper_bound(chunks, wanted, {}, kind) - chunks.begin() - 1;
+        const size_t from = std::max(node.start, static_cast<size_t>(chunk) * UNIT_CHUNK);
+        const std::string_view text = textOf(node.buffer).substr(from, node.start + node.length - from);
+        const size_t remaining = wanted - unitsBefore(node.buffer, from).*kind;
+        const size_t offset = kind == &Units::utf16 ? util::byteOffsetOfUtf16(text, remaining)
+                                                    : util::byteOffsetOfCodePoint(text, remaining);
+        return from + offset - node.start;
+    }
+
+    NodePtr makeNode(uint8_t buffer, size_t start, size_t length) {
+        // xorshift32: cheap, and good enough to keep the treap balanced
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        auto node = std::make_unique<Node>();
+        node->buffer = buffer;
+        node->start = start;
+        node->length = length;
+        node->newlines = countBreaks(buffer, start, length);
+        if (unitsIndexed_) {
+            node->units = unitsIn(buffer, start, length);
+        }
+        node->priority = seed_;
+        update(*node);
+        return node;
+    }
+
+    // Offset of the k-th newline in the text, counting from 1
+    size_t findNewline(size_t k) const {
+        size_t base = 0;
+        const Node* node = root_.get();
+        while (node) {
+            const size_t leftNewlines = newlinesOf(node->left);
+            if (k <= leftNewlines) {
+                node = node->left.get();
+                continue;
+            }
+            k -= leftNewlines;
+            base += lengthOf(node->left);
+            if (k <= node->newlines) {
+                const std::span<const uint64_t> breaks = breaksOf(node->buffer);
+                auto first = std::lower_bound(breaks.begin(), breaks.end(), node->start);
+                return base + static_cast<size_t>(*(first + static_cast<std::ptrdiff_t>(k - 1)) - node->start);
+            }
+            k -= node->newlines;
+            base += node->length;
+            node = node->right.get();
+        }
+        return length();
+    }
+
+    // Split into the first offset characters and the rest
+    void split(NodePtr node, size_t offset, NodePtr& left, NodePtr& right) {
+        if (!node) {
+            left.reset();
+            right.reset();
+            return;
+        }
+        const size_t leftLength = lengthOf(node->left);
+        if (offset <= leftLength) {
+            split(std::move(node->left), offset, left, node->left);
+            update(*node);
+            right = std::move(node);
+        } else if (offset >= leftLength + node->length) {
+            split(std::move(node->right), offset - leftLength - node->length, node->right, right);
+            update(*node);
+            left = std::move(node);
+        } else {
+            // The cut falls inside this piece: its tail becomes a piece of its own
+            const size_t cut = offset - leftLength;
+            NodePtr tail = makeNode(node->buffer, node->start + cut, node->length - cut);
+            node->length = cut;
+            node->newlines = countBreaks(node->buffer, node->start, cut);
+            if (unitsIndexed_) {
+                node->units = unitsIn(node->buffer, node->start, cut);
+            }
+            right = merge(std::move(tail), std::move(node->right));
+            update(*node);
+            left = std::move(node);
+        }
+    }
+
+    static NodePtr merge(NodePtr left, NodePtr right) {
+        if (!left) {
+            return right;
+        }
+        if (!right) {
+            return left;
+        }
+        if (left->priority > right->priority) {
+            left->right = merge(std::move(left->right), std::move(right));
+            update(*left);
+            return left;
+        }
+        right->left = merge(std::move(left), std::move(right->left));
+        update(*right);
+        return right;
+    }
+
+    // Grow the last piece of a subtree if it ends where added text starts
+    bool extendLast(Node* node, size_t addedStart, size_t length) {
+        if (!node) {
+            return false;
+        }
+        bool extended;
+        if (node->right) {
+            extended = extendLast(node->right.get(), addedStart, length);
+        } else if (node->buffer == ADDED && node->start + node->length == addedStart) {
+            node->length += length;
+            node->newlines = countBreaks(ADDED, node->start, node->length);
+            if (unitsIndexed_) {
+                node->units = unitsIn(ADDED, node->start, node->length);
+            }
+            extended = true;
+        } else {
+            extended = false;
+        }
+        if (extended) {
+            update(*node);
+        }
+        return extended;
+    }
+
+    // Call visit(node, from, take) for the part of each piece a range covers, in order
+    template <typename Visitor>
+    static void walk(const Node* node, size_t offset, size_t count, Visitor&& visit) {
+        walkNode(node, offset, count, visit);
+    }
+
+    template <typename Visitor>
+    static void walkNode(const Node* node, size_t offset, size_t& count, Visitor& visit) {
+        if (!node || count == 0) {
+            return;
+        }
+        const size_t leftLength = lengthOf(node->left);
+        if (offset < leftLength) {
+            walkNode(node->left.get(), offset, count, visit);
+        }
+        if (count == 0) {
+            return;
+        }
+        if (offset < leftLength + node->length) {
+            const size_t from = offset > leftLength ? offset - leftLength : 0;
+            const size_t take = std::min(count, node->length - from);
+            visit(*node, from, take);
+            count -= take;
+        }
+        const size_t rightOffset = leftLength + node->length;
+        walkNode(node->right.get(), offset > rightOffset ? offset - rightOffset : 0, count, visit);
+    }
+
+    // Recount the newlines and units of the original pieces overlapping [begin, end) of the original buffer
+    void recount(Node* node, size_t begin, size_t end) {
+        if (!node) {
+            return;
+        }
+        recount(node->left.get(), begin, end);
+        recount(node->right.get(), begin, end);
+        if (node->buffer == ORIGINAL && node->start < end && begin < node->start + node->length) {
+            node->newlines = countBreaks(ORIGINAL, node->start, node->length);
+            if (unitsIndexed_) {
+                node->units = unitsIn(ORIGINAL, node->start, node->length);
+            }
+        }
+        update(*node);
+    }
+
+    // Whether [begin, end) of the original buffer is clear of placeholders
+    bool originalLoaded(size_t begin, size_t end) const {
+        auto it = unloaded_.upper_bound(begin);
+        if (it != unloaded_.begin() && std::prev(it)->second > begin) {
+            return false;
+        }
+        return it == unloaded_.end() || it->first >= end;
+    }
+
+    // Take [begin, end) out of the placeholders
+    void markLoaded(size_t begin, size_t end) {
+        auto it = unloaded_.upper_bound(begin);
+        if (it != unloaded_.begin()) {
+            --it;
+        }
+        while (it != unloaded_.end() && it->first < end) {
+            const auto [first, last] = *it;
+            it = unloaded_.erase(it);
+            if (last <= begin) {
+                continue;
+            }
+            if (first < begin) {
+                unloaded_.emplace(first, begin);
+            }
+            if (last > end) {
+                unloaded_.emplace(end, last);
+            }
+        }
+    }
+
+    Buffer buffers_[2];
+    std::string_view base_;                 // Original text held by baseOwner_, if set
+    std::span<const uint64_t> baseBreaks_;
+    std::shared_ptr<const void> baseOwner_;
+    std::map<size_t, size_t> unloaded_;  // Placeholder ranges of the original buffer, start to end
+    mutable bool unitsIndexed_ = false;  // Whether the chunks and node units are kept
+    NodePtr root_;
+    uint32_t seed_ = 2463534242u;
+};
+
+} // namespace document
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_PIECE_TABLE_H
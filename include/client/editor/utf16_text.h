@@ -0,0 +1,178 @@
+#ifndef COLLABORATIVE_EDITOR_UTF16_TEXT_H
+#define COLLABORATIVE_EDITOR_UTF16_TEXT_H
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common/ot/operation.h"
+#include "common/ot/rope.h"
+#include "common/util/text_scan.h"
+
+namespace collab {
+namespace document {
+
+/**
+ * The text of a view that counts in UTF-16, such as a QTextDocument, kept as UTF-8
+ *
+ * Operations address bytes of UTF-8 (see util/text_scan.h) and Qt
+ * addresses UTF-16 units, so a view mirrors its text here to convert
+ * between the two: change() turns an edit the view reports into an
+ * operation and apply() turns an operation into edits of the view. The
+ * text is a Rope, so taking it from a DocumentController snapshot copies
+ * nothing, and a conversion scans the text up to the edit a chunk at a
+ * time with the vectorized counts of util::utf16Length.
+ *
+ * Not thread-safe; the view's thread owns it.
+ */
+class Utf16Text {
+public:
+    /**
+     * An edit of the view, in UTF-16 units
+     */
+    struct Edit {
+        size_t position = 0;
+        size_t removed = 0;     // Units replaced from position
+        std::string inserted;   // UTF-8, put in their place
+    };
+
+    Utf16Text() = default;
+
+    explicit Utf16Text(ot::Rope text) : text_(std::move(text)) {}
+
+    /**
+     * The operation for one change the view reports, applied here too
+     *
+     * @param position Where the change starts, in UTF-16 units
+     * @param removed Units removed there; what reaches past the end is ignored
+     * @param added Text added there, UTF-8
+     * @return An insert, a delete or, if both, a replace; nullptr if nothing changed
+     */
+    ot::OperationPtr change(size_t position, size_t removed, const std::string& added) {
+        const size_t start = byteOffset(position);
+        const size_t end = removed > 0 ? byteOffset(position + removed) : start;
+        // Nothing, or a change of format alone, which Qt reports as the text replaced by itself
+        if (end - start == added.size() && text_.substr(start, end - start) == added) {
+            return nullptr;
+        }
+        ot::OperationPtr op;
+        if (end > start && !added.empty()) {
+            op = std::make_shared<ot::ReplaceOperation>(start, end - start, added);
+        } else if (end > start) {
+            op = std::make_shared<ot::DeleteOperation>(start, end - start);
+        } else {
+            op = std::make_shared<ot::InsertOperation>(start, added);
+        }
+        op->apply(text_);
+        return op;
+    }
+
+    /**
+     * The edits of the view an operation makes, applied here too
+     *
+     * @param op An operation valid for the text
+     * @return The edits, in order; nullopt if op does not apply, which leaves the text as it was
+     */
+    std::optional<std::vector<Edit>> apply(const ot::Operation& op) {
+        std::vector<Edit> edits;
+        ot::Rope before = text_;
+        if (!applyPart(op, edits)) {
+            text_ = std::move(before);
+            return std::nullopt;
+        }
+        return edits;
+    }
+
+    /**
+     * Byte offset of a UTF-16 offset
+     * An offset inside a surrogate pair maps to the start of the character,
+     * as util::byteOffsetOfUtf16() does
+     *
+     * @param units UTF-16 units from the start
+     * @return The byte offset; the length of the text if units reaches past the end
+     */
+    size_t byteOffset(size_t units) const {
+        size_t offset = 0;
+        text_.forEachChunk(0, text_.length(), [&](std::string_view chunk) {
+            // A chunk may end inside a character; the counts go by byte, so that is harmless
+            const size_t weight = util::utf16Length(chunk);
+            if (weight < units) {
+                units -= weight;
+                offset += chunk.size();
+                return true;
+            }
+            const size_t end = util::byteOffsetOfUtf16(chunk, units);
+            offset += end;
+            units = 0;
+            // What ends the chunk may be the rest of the character the next one starts
+            return end == chunk.size();
+        });
+        return offset;
+    }
+
+    // UTF-16 units of a range of bytes, which should start and end on characters
+    size_t utf16Length(size_t position, size_t length) const {
+        size_t units = 0;
+        text_.forEachChunk(position, length, [&](std::string_view chunk) {
+            units += util::utf16Length(chunk);
+            return true;
+        });
+        return units;
+    }
+
+    const ot::Rope& text() const {
+        return text_;
+    }
+
+private:
+    bool applyPart(const ot::Operation& op, std::vector<Edit>& edits) {
+        switch (op.getKind()) {
+            case ot::OperationKind::INSERT: {
+                const auto& insert = static_cast<const ot::InsertOperation&>(op);
+                if (insert.getPosition() > text_.length()) {
+                    return false;
+                }
+                edits.push_back(Edit{utf16Length(0, insert.getPosition()), 0, insert.getText()});
+                break;
+            }
+            case ot::OperationKind::DELETE: {
+                const auto& erase = static_cast<const ot::DeleteOperation&>(op);
+                if (erase.getPosition() + erase.getLength() > text_.length()) {
+                    return false;
+                }
+                edits.push_back(Edit{utf16Length(0, erase.getPosition()),
+                                     utf16Length(erase.getPosition(), erase.getLength()), std::string()});
+                break;
+            }
+            case ot::OperationKind::REPLACE: {
+                const auto& replace = static_cast<const ot::ReplaceOperation&>(op);
+                if (replace.getPosition() + replace.getLength() > text_.length()) {
+                    return false;
+                }
+                edits.push_back(Edit{utf16Length(0, replace.getPosition()),
+                                     utf16Length(replace.getPosition(), replace.getLength()), replace.getText()});
+                break;
+            }
+            case ot::OperationKind::COMPOSITE:
+                // Each part applies to the text the one before it left
+                for (const auto& part : static_cast<const ot::CompositeOperation&>(op).getOperations()) {
+                    if (part && !applyPart(*part, edits)) {
+                        return false;
+                    }
+                }
+                return true;
+        }
+        return op.apply(text_);
+    }
+
+    ot::Rope text_;
+};
+
+} // namespace document
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_UTF16_TEXT_H
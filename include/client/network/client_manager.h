@@ -10,16 +10,54 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <random>
+#include <vector>
 
+#include "client/network/document_streams.h"
 #include "common/network/tcp_connection.h"
+#include "common/protocol/message_router.h"
 #include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "common/util/handoff_queue.h"
 
 namespace collab {
 namespace client {
 
+/**
+ * How ClientManager times out and retries connecting
+ */
+struct ConnectOptions {
+    std::chrono::milliseconds timeout{5000};          // Give up on one attempt after this long
+    bool reconnect = true;                            // Retry failed attempts and lost connections
+    std::chrono::milliseconds initialBackoff{200};    // Delay before the first retry
+    std::chrono::milliseconds maxBackoff{30000};      // The delay doubles up to this
+};
+
 /**
  * Client manager class to handle the network communication
  * with the server for the collaborative editor
+ * 
+ * Connecting is asynchronous: connectAsync() returns as soon as the first
+ * attempt is under way, and its future is ready the moment the connection
+ * is up, or the attempt failed or timed out. Failed attempts and lost
+ * connections are retried in the background with exponential backoff and
+ * jitter, and the connection status callback reports each change.
+ * 
+ * Handlers run on the network thread. A UI that should not share a lock
+ * with it sets a queued message callback instead: received messages then
+ * go through a lock-free ring to the UI thread, which takes them all in
+ * one drainMessages() per wakeup, and messages the UI sends go through a
+ * ring the other way, to be written on the network thread.
+ * 
+ * Every document open in the client shares the one connection as a
+ * stream of streams(): messages for an open document go to its stream's
+ * handler, on whichever thread would have called the message callback,
+ * and sendOnStream() writes each document's messages in turn with the
+ * others. One heartbeat every KEEPALIVE_INTERVAL of quiet keeps the
+ * connection up for all of them.
  */
 class ClientManager {
 public:
@@ -35,108 +73,148 @@ public:
     // Message callback
     using MessageCallback = std::function<void(const protocol::Message&)>;
 
-    // Connect to the server
-    bool connect(const std::string& host, int port) {
+    using ConnectOptions = client::ConnectOptions;
+    
+    // Messages each handoff ring holds before the rest wait on the sending side
+    static constexpr size_t HANDOFF_CAPACITY = 1024;
+    
+    // Quiet time on the connection before a heartbeat is sent
+    static constexpr std::chrono::seconds KEEPALIVE_INTERVAL{15};
+    
+    // Stream messages written per turn of the network thread, so receiving is not held up by a backlog
+    static constexpr size_t STREAM_FLUSH_BUDGET = 64;
+
+    /**
+     * Start connecting to the server
+     * 
+     * @param host Server host name or address
+     * @param port Server port
+     * @param options Timeout and retry policy
+     * @return Ready with true once connected, or with false once the attempt
+     *         under way fails or times out; retries go on in the background
+     */
+    std::future<bool> connectAsync(const std::string& host, int port, ConnectOptions options = {}) {
+        std::promise<bool> promise;
+        std::future<bool> result = promise.get_future();
         if (connected_) {
-            return true;
+            promise.set_value(true);
+            return result;
         }
-
+        
+        std::lock_guard<std::mutex> lock(connectMutex_);
+        waiters_.push_back(std::move(promise));
+        if (io_context_) {
+            // Already connecting; the waiter hears how the next attempt to finish ends
+            return result;
+        }
+        
         try {
-            // Create a new io_context
-            io_context_ = std::make_unique<boost::asio::io_context>();
+            host_ = host;
+            port_ = std::to_string(port);
+            options_ = options;
+            attempt_ = 0;
+            stopping_ = false;
             
-            // Create a TCP client
+            io_context_ = std::make_unique<boost::asio::io_context>();
+            work_ = std::make_unique<WorkGuard>(io_context_->get_executor());
+            connectTimer_ = std::make_unique<boost::asio::steady_timer>(*io_context_);
+            retryTimer_ = std::make_unique<boost::asio::steady_timer>(*io_context_);
+            keepaliveTimer_ = std::make_unique<boost::asio::steady_timer>(*io_context_);
             client_ = std::make_shared<network::TcpClient>(*io_context_);
             
-            // Set the connection handler
             client_->set_connection_handler([this](network::TcpConnection::pointer connection) {
-                // Create a message channel
-                channel_ = std::make_shared<network::MessageChannel<protocol::Message>>(connection);
-                
-                // Set the message handler
-                channel_->set_message_handler([this](auto, const protocol::Message& message) {
-                    handleMessage(message);
-                });
-                
-                // Set connected flag
-                connected_ = true;
-                
-                // Notify status change
-                if (connectionStatusCallback_) {
-                    connectionStatusCallback_(true);
-                }
-                
-                // Send any pending messages
-                sendPendingMessages();
+                onConnected(connection);
             });
-            
-            // Set the error handler
             client_->set_error_handler([this](const std::string& error) {
-                std::cerr << "Client error: " << error << std::endl;
-                
-                if (connected_) {
-                    connected_ = false;
-                    
-                    if (connectionStatusCallback_) {
-                        connectionStatusCallback_(false);
-                    }
-                }
+                onAttemptFailed(error);
             });
             
-            // Connect to the server
-            client_->connect(host, std::to_string(port));
-            
-            // Start the io_context in a separate thread
+            boost::asio::post(*io_context_, [this]() { startAttempt(); });
             io_thread_ = std::thread([this]() {
                 io_context_->run();
             });
-            
-            // Wait for connection or timeout
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-            
-            return connected_;
         } catch (const std::exception& e) {
             std::cerr << "Error connecting to server: " << e.what() << std::endl;
-            return false;
+            client_.reset();
+            keepaliveTimer_.reset();
+            retryTimer_.reset();
+            connectTimer_.reset();
+            work_.reset();
+            io_context_.reset();
+            resolveWaitersLocked(false);
         }
+        return result;
+    }
+    
+    // Connect to the server, waiting at most one attempt's timeout
+    bool connect(const std::string& host, int port, ConnectOptions options = {}) {
+        return connectAsync(host, port, options).get();
     }
     
-    // Disconnect from the server
+    // Disconnect from the server and stop retrying
     void disconnect() {
-        if (!connected_) {
-            return;
+        {
+            std::lock_guard<std::mutex> lock(connectMutex_);
+            if (!io_context_) {
+                return;
+            }
+            stopping_ = true;
         }
         
         // Close the channel
         if (channel_) {
             channel_->close();
-            channel_.reset();
         }
         
-        // Stop the io_context
-        if (io_context_) {
-            io_context_->stop();
-        }
-        
-        // Wait for the thread to finish
+        // Stop the io_context and wait for the thread to finish
+        io_context_->stop();
         if (io_thread_.joinable()) {
             io_thread_.join();
         }
         
-        // Reset client
+        std::lock_guard<std::mutex> lock(connectMutex_);
+        channel_.reset();
         client_.reset();
-        
-        // Set connected flag
-        connected_ = false;
+        keepaliveTimer_.reset();
+        retryTimer_.reset();
+        connectTimer_.reset();
+        work_.reset();
+        io_context_.reset();
+        resolveWaitersLocked(false);
         
         // Notify status change
-        if (connectionStatusCallback_) {
+        if (connected_.exchange(false) && connectionStatusCallback_) {
             connectionStatusCallback_(false);
         }
     }
     
+    /**
+     * Delay before a retry: exponential in the attempt, with jitter over its upper half
+     * so clients that lost the server together do not come back in lockstep
+     * 
+     * @param options The backoff bounds
+     * @param attempt Retries made so far since the last connection
+     * @param random Source of the jitter
+     * @return The delay
+     */
+    static std::chrono::milliseconds backoffDelay(const ConnectOptions& options, unsigned attempt, std::mt19937& random) {
+        const auto cap = std::max(options.maxBackoff, options.initialBackoff);
+        auto delay = options.initialBackoff;
+        for (unsigned i = 0; i < attempt && delay < cap; ++i) {
+            delay *= 2;
+        }
+        delay = std::min(delay, cap);
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(delay.count() / 2, delay.count());
+        return std::chrono::milliseconds(jitter(random));
+    }
+    
     // Send a message to the server
+    // With a queued message callback, a message sent from the UI thread is handed to the network thread to write
     bool sendMessage(const protocol::Message& message) {
+        if (fromUi_ && io_context_ && std::this_thread::get_id() != io_thread_.get_id()) {
+            fromUi_->push(copyOf(message));
+            return connected_;
+        }
         if (!connected_) {
             // Queue message for when we connect
             std::lock_guard<std::mutex> lock(pendingMessagesMutex_);
@@ -162,26 +240,278 @@ public:
         }
     }
     
-    // Register a message callback
+    // Register a callback for messages that have no typed handler on router()
     void setMessageCallback(MessageCallback callback) {
-        messageCallback_ = callback;
+        router_.otherwise([this, callback = std::move(callback)](const protocol::Message& message) {
+            if (!streams_.deliver(message) && callback) {
+                callback(message);
+            }
+        });
+    }
+    
+    /**
+     * Take messages that have no typed handler on another thread, e.g. the UI's, instead of the network thread
+     * 
+     * Replaces setMessageCallback(). Set up before connect(), and send from
+     * the thread that drains from then on. wake runs whenever messages are
+     * waiting and no wakeup is pending, on either thread; it should arrange
+     * a drainMessages() on the draining thread, e.g. with
+     * QMetaObject::invokeMethod() and Qt::QueuedConnection, so the messages
+     * of a burst are taken in one go on the next frame.
+     * 
+     * @param callback Called by drainMessages() with each message, in the order received
+     * @param wake Arranges a drainMessages()
+     */
+    void setQueuedMessageCallback(MessageCallback callback, std::function<void()> wake) {
+        queuedCallback_ = std::move(callback);
+        toUi_ = std::make_unique<util::HandoffQueue<MessagePtr>>(HANDOFF_CAPACITY, wake, [this]() {
+            postToNetwork([this]() { toUi_->retry(); });
+        });
+        fromUi_ = std::make_unique<util::HandoffQueue<MessagePtr>>(HANDOFF_CAPACITY, [this]() {
+            postToNetwork([this]() { sendHandedOff(); });
+        }, [this, wake]() {
+            retryFromUi_ = true;
+            wake();
+        });
+        router_.otherwise([this](const protocol::Message& message) {
+            toUi_->push(copyOf(message));
+        });
+    }
+    
+    /**
+     * Call the queued message callback with everything received since the last drain
+     * Call from the thread that sends, when wake asks to
+     * 
+     * @return The number of messages handled
+     */
+    size_t drainMessages() {
+        if (!toUi_) {
+            return 0;
+        }
+        if (retryFromUi_.exchange(false)) {
+            fromUi_->retry();
+        }
+        return toUi_->drain([this](MessagePtr message) {
+            if (!streams_.deliver(*message) && queuedCallback_) {
+                queuedCallback_(*message);
+            }
+        });
+    }
+    
+    // The documents open over this connection; open one with streams().open() before sending on it
+    DocumentStreams& streams() {
+        return streams_;
+    }
+    
+    /**
+     * Send a message on its document's stream, taking turns with the other open documents
+     * 
+     * @param documentId The document, open in streams()
+     * @param message The message
+     * @return False if the document has no stream
+     */
+    bool sendOnStream(const std::string& documentId, const protocol::Message& message) {
+        if (!streams_.send(documentId, copyOf(message))) {
+            return false;
+        }
+        if (!streamFlushPosted_.exchange(true)) {
+            postToNetwork([this]() { flushStreams(); });
+        }
+        return true;
+    }
+    
+    // Set the wire format to offer when logging in; JSON keeps traffic readable and uncompressed
+    void setWireFormat(protocol::WireFormat format) {
+        wireFormat_ = format;
+    }
+    
+    // Route messages to handlers by type, e.g. router().on<protocol::EditMessageView>(...); set up before connect()
+    using Router = protocol::MessageRouter<>;
+    Router& router() {
+        return router_;
     }
     
     // Check if connected
     bool isConnected() const {
         return connected_;
     }
+    
+    // Run a task on the network thread, if it is running
+    void postToNetwork(std::function<void()> task) {
+        if (io_context_) {
+            boost::asio::post(*io_context_, std::move(task));
+        }
+    }
 
 private:
+    using Channel = network::MessageChannel<protocol::Message, protocol::WireCodec>;
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+    using MessagePtr = std::shared_ptr<const protocol::Message>;
+    
     // Private constructor for singleton
     ClientManager()
-        : connected_(false) {}
+        : connected_(false) {
+        router_.otherwise([this](const protocol::Message& message) {
+            streams_.deliver(message);
+        });
+    }
+    
+    // Start one connect attempt, bounded by the timeout (on the io thread)
+    void startAttempt() {
+        attemptPending_ = true;
+        connectTimer_->expires_after(options_.timeout);
+        connectTimer_->async_wait([this](const boost::system::error_code& ec) {
+            if (!ec && attemptPending_) {
+                // Fails the attempt through the error handler
+                client_->cancel();
+            }
+        });
+        client_->connect(host_, port_);
+    }
+    
+    // The attempt under way connected (on the io thread)
+    void onConnected(network::TcpConnection::pointer connection) {
+        attemptPending_ = false;
+        connectTimer_->cancel();
+        attempt_ = 0;
+        
+        // Create a message channel
+        channel_ = std::make_shared<Channel>(connection);
+        channel_->codec().setPreferredFormat(wireFormat_);
+        if (wireFormat_ == protocol::WireFormat::JSON) {
+            // JSON mode keeps every frame readable
+            channel_->codec().setCompression(false);
+        } else {
+            // Length-prefixed frames need no delimiter scan
+            connection->set_frame_mode(network::TcpConnection::frame_mode::length_prefixed);
+        }
+        
+        // Set the message handler
+        channel_->set_frame_handler([this](auto, protocol::WireCodec& codec, std::string_view frame) {
+            handleMessage(codec, frame);
+        });
+        connection->set_close_handler([this](network::TcpConnection::pointer) {
+            onConnectionLost();
+        });
+        
+        // Set connected flag
+        connected_ = true;
+        {
+            std::lock_guard<std::mutex> lock(connectMutex_);
+            resolveWaitersLocked(true);
+        }
+        
+        // Notify status change
+        if (connectionStatusCallback_) {
+            connectionStatusCallback_(true);
+        }
+        
+        // Send any pending messages
+        sendPendingMessages();
+        flushStreams();
+        scheduleKeepalive();
+    }
+    
+    // The attempt under way failed or timed out (on the io thread)
+    void onAttemptFailed(const std::string& error) {
+        if (!attemptPending_) {
+            return;
+        }
+        attemptPending_ = false;
+        connectTimer_->cancel();
+        std::cerr << "Client error: " << error << std::endl;
+        
+        std::lock_guard<std::mutex> lock(connectMutex_);
+        resolveWaitersLocked(false);
+        scheduleRetryLocked();
+    }
+    
+    // The connection closed, by the server or the network or by disconnect()
+    void onConnectionLost() {
+        if (!connected_.exchange(false)) {
+            return;
+        }
+        if (connectionStatusCallback_) {
+            connectionStatusCallback_(false);
+        }
+        
+        std::lock_guard<std::mutex> lock(connectMutex_);
+        if (io_context_) {
+            boost::asio::post(*io_context_, [this]() {
+                std::lock_guard<std::mutex> lock(connectMutex_);
+                scheduleRetryLocked();
+            });
+        }
+    }
+    
+    // Back off, then attempt again, unless retrying is off (connectMutex_ held, on the io thread)
+    void scheduleRetryLocked() {
+        if (stopping_ || !options_.reconnect) {
+            return;
+        }
+        retryTimer_->expires_after(backoffDelay(options_, attempt_++, random_));
+        retryTimer_->async_wait([this](const boost::system::error_code& ec) {
+            if (!ec) {
+                startAttempt();
+            }
+        });
+    }
+    
+    // Tell everyone waiting on connectAsync() how the attempt ended (connectMutex_ held)
+    void resolveWaitersLocked(bool connected) {
+        for (auto& waiter : waiters_) {
+            waiter.set_value(connected);
+        }
+        waiters_.clear();
+    }
     
     // Handle an incoming message
-    void handleMessage(const protocol::Message& message) {
-        if (messageCallback_) {
-            messageCallback_(message);
+    void handleMessage(protocol::WireCodec& codec, std::string_view frame) {
+        router_.route(codec, frame);
+    }
+    
+    // A copy of a message as its full struct, to hand to another thread
+    static MessagePtr copyOf(const protocol::Message& message) {
+        if (const auto* auth = dynamic_cast<const protocol::AuthMessage*>(&message)) {
+            return std::make_shared<const protocol::AuthMessage>(*auth);
+        }
+        if (const auto* batch = dynamic_cast<const protocol::BatchMessage*>(&message)) {
+            return std::make_shared<const protocol::BatchMessage>(*batch);
         }
+        return protocol::BatchMessage::share(message);
+    }
+    
+    // Write what the UI thread handed over, or keep it for when the connection is up (on the io thread)
+    void sendHandedOff() {
+        fromUi_->drain([this](MessagePtr message) {
+            if (connected_ && channel_) {
+                channel_->send_message(*message);
+            } else {
+                std::lock_guard<std::mutex> lock(pendingMessagesMutex_);
+                pendingMessages_.push(*message);
+            }
+        });
+    }
+    
+    // Write a turn of the streams' messages, and post another turn while any wait (on the io thread)
+    void flushStreams() {
+        streamFlushPosted_ = false;
+        streams_.flush(STREAM_FLUSH_BUDGET);
+        if (streams_.pending() > 0 && !streamFlushPosted_.exchange(true)) {
+            postToNetwork([this]() { flushStreams(); });
+        }
+    }
+    
+    // Send a heartbeat for all the streams whenever the connection has been quiet (on the io thread)
+    void scheduleKeepalive() {
+        keepaliveTimer_->expires_after(KEEPALIVE_INTERVAL);
+        keepaliveTimer_->async_wait([this](const boost::system::error_code& ec) {
+            if (ec || !connected_) {
+                return;
+            }
+            streams_.keepalive(KEEPALIVE_INTERVAL);
+            scheduleKeepalive();
+        });
     }
     
     // Send any pending messages
@@ -197,13 +527,37 @@ private:
 private:
     std::unique_ptr<boost::asio::io_context> io_context_;
     std::shared_ptr<network::TcpClient> client_;
-    std::shared_ptr<network::MessageChannel<protocol::Message>> channel_;
+    std::shared_ptr<Channel> channel_;
+    std::unique_ptr<WorkGuard> work_;
+    std::unique_ptr<boost::asio::steady_timer> connectTimer_;
+    std::unique_ptr<boost::asio::steady_timer> retryTimer_;
+    std::unique_ptr<boost::asio::steady_timer> keepaliveTimer_;
     std::thread io_thread_;
     std::atomic<bool> connected_;
     
+    // Where to connect and how, and the state of the retries; io thread only, except under connectMutex_
+    std::mutex connectMutex_;
+    std::string host_;
+    std::string port_;
+    ConnectOptions options_;
+    unsigned attempt_ = 0;
+    bool attemptPending_ = false;
+    bool stopping_ = false;
+    std::mt19937 random_{std::random_device{}()};
+    std::vector<std::promise<bool>> waiters_;
+    std::atomic<protocol::WireFormat> wireFormat_{protocol::WireFormat::BINARY};
+    
     ConnectionStatusCallback connectionStatusCallback_;
-    MessageCallback messageCallback_;
+    Router router_;
+    
+    // Handoff to and from the thread that drains, if a queued message callback is set
+    MessageCallback queuedCallback_;
+    std::unique_ptr<util::HandoffQueue<MessagePtr>> toUi_;     // Filled on the io thread
+    std::unique_ptr<util::HandoffQueue<MessagePtr>> fromUi_;   // Drained on the io thread
+    std::atomic<bool> retryFromUi_{false};
     
+    DocumentStreams streams_{[this](const protocol::Message& message) { sendMessage(message); }};
+    std::atomic<bool> streamFlushPosted_{false};
     std::queue<protocol::Message> pendingMessages_;
     std::mutex pendingMessagesMutex_;
 };
@@ -0,0 +1,259 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_STREAMS_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_STREAMS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace client {
+
+/**
+ * Open documents as streams over one connection
+ *
+ * Each open document would otherwise have a connection of its own, with
+ * its own handshake and heartbeat. Here a document is a stream, named by
+ * its document ID, which every document message already carries and the
+ * binary codec puts in the frame header as an interned ID, so streams
+ * cost no bytes on the wire. Received messages go to the handler of the
+ * stream they name; sent ones wait on their stream and flush() writes
+ * them round-robin, up to quantum messages from each stream per turn, so
+ * a document catching up on a large backlog does not hold back a
+ * keystroke in another. keepalive() sends one SYS_HEARTBEAT for all the
+ * streams when nothing else was sent for an interval.
+ *
+ * Thread-safe; handlers and the send function are called without the
+ * lock held.
+ */
+class DocumentStreams {
+public:
+    using Clock = std::chrono::steady_clock;
+    using MessagePtr = std::shared_ptr<const protocol::Message>;
+    // Writes a message to the connection, or keeps it until the connection is back
+    using Send = std::function<void(const protocol::Message&)>;
+    using Handler = std::function<void(const protocol::Message&)>;
+
+    // Messages a stream writes per turn before the next stream has its go
+    static constexpr size_t DEFAULT_QUANTUM = 4;
+
+    /**
+     * @param send Writes to the shared connection
+     * @param quantum Messages per stream per turn of flush()
+     */
+    explicit DocumentStreams(Send send, size_t quantum = DEFAULT_QUANTUM)
+        : send_(std::move(send)), quantum_(std::max<size_t>(1, quantum)), lastSend_(Clock::now()) {}
+
+    DocumentStreams(const DocumentStreams&) = delete;
+    DocumentStreams& operator=(const DocumentStreams&) = delete;
+
+    /**
+     * Open a stream for a document
+     *
+     * @param documentId The document, which names the stream
+     * @param handler Called with each message received for it
+     * @return False if the document already has a stream
+     */
+    bool open(const std::string& documentId, Handler handler) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return streams_.try_emplace(documentId, Stream{std::move(handler), {}}).second;
+    }
+
+    // Close a document's stream, dropping what it has not written
+    void close(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = streams_.find(documentId);
+        if (it == streams_.end()) {
+            return;
+        }
+        pending_ -= it->second.outbox.size();
+        streams_.erase(it);
+    }
+
+    bool isOpen(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return streams_.count(documentId) > 0;
+    }
+
+    size_t streamCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return streams_.size();
+    }
+
+    // Messages waiting on any stream
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_;
+    }
+
+    /**
+     * Queue a message on a document's stream, for the next flush()
+     *
+     * @param documentId The stream
+     * @param message The message, which should name the document
+     * @return False if the document has no stream
+     */
+    bool send(const std::string& documentId, MessagePtr message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = streams_.find(documentId);
+        if (it == streams_.end()) {
+            return false;
+        }
+        it->second.outbox.push_back(std::move(message));
+        ++pending_;
+        return true;
+    }
+
+    /**
+     * Write waiting messages, taking turns between the streams
+     *
+     * Each turn takes up to quantum messages from every stream with any,
+     * starting after the stream the last flush stopped at.
+     *
+     * @param budget Messages written at most
+     * @return Messages written
+     */
+    size_t flush(size_t budget = std::numeric_limits<size_t>::max()) {
+        size_t written = 0;
+        while (written < budget) {
+            std::vector<MessagePtr> turn;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (pending_ == 0) {
+                    break;
+                }
+                takeTurnLocked(turn, budget - written);
+            }
+            for (const MessagePtr& message : turn) {
+                send_(*message);
+            }
+            written += turn.size();
+            std::lock_guard<std::mutex> lock(mutex_);
+            lastSend_ = Clock::now();
+        }
+        return written;
+    }
+
+    /**
+     * Hand a received message to the stream of the document it names
+     *
+     * @param message The message
+     * @return False if it names no open stream, for the caller to handle
+     */
+    bool deliver(const protocol::Message& message) {
+        const std::string* documentId = documentIdOf(message);
+        if (!documentId) {
+            return false;
+        }
+        Handler handler;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = streams_.find(*documentId);
+            if (it == streams_.end()) {
+                return false;
+            }
+            handler = it->second.handler;
+        }
+        if (handler) {
+            handler(message);
+        }
+        return true;
+    }
+
+    /**
+     * Send one heartbeat for every stream if the connection has been quiet
+     *
+     * @param interval How long nothing was sent before a heartbeat is due
+     * @param now The time
+     * @return True if a heartbeat was due and sent
+     */
+    bool keepalive(Clock::duration interval, Clock::time_point now = Clock::now()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (now - lastSend_ < interval) {
+                return false;
+            }
+            lastSend_ = now;
+        }
+        send_(protocol::Message(protocol::MessageType::SYS_HEARTBEAT));
+        return true;
+    }
+
+    /**
+     * The document a message is for
+     *
+     * @param message Any message
+     * @return Its documentId, or nullptr for a message not about one document, e.g. AUTH_SUCCESS
+     */
+    static const std::string* documentIdOf(const protocol::Message& message) {
+        if (const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message)) {
+            return &edit->documentId;
+        }
+        if (const auto* document = dynamic_cast<const protocol::DocumentMessage*>(&message)) {
+            return &document->documentId;
+        }
+        if (const auto* sync = dynamic_cast<const protocol::SyncMessage*>(&message)) {
+            return &sync->documentId;
+        }
+        if (const auto* presence = dynamic_cast<const protocol::PresenceMessage*>(&message)) {
+            return &presence->documentId;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Stream {
+        Handler handler;
+        std::deque<MessagePtr> outbox;
+    };
+
+    // Take one round-robin turn over the streams into turn, at most limit messages (mutex_ held)
+    void takeTurnLocked(std::vector<MessagePtr>& turn, size_t limit) {
+        auto it = streams_.lower_bound(next_);
+        // A stream cut short by the last flush's budget only has the rest of its quantum
+        size_t used = it != streams_.end() && it->first == next_ ? used_ : 0;
+        for (size_t visited = 0; visited < streams_.size() && turn.size() < limit; ++visited, ++it, used = 0) {
+            if (it == streams_.end()) {
+                it = streams_.begin();
+            }
+            std::deque<MessagePtr>& outbox = it->second.outbox;
+            for (; used < quantum_ && !outbox.empty() && turn.size() < limit; ++used) {
+                turn.push_back(std::move(outbox.front()));
+                outbox.pop_front();
+                --pending_;
+            }
+            if (turn.size() >= limit && used < quantum_ && !outbox.empty()) {
+                next_ = it->first;
+                used_ = used;
+                return;
+            }
+        }
+        next_ = it == streams_.end() ? std::string() : it->first;
+        used_ = 0;
+    }
+
+    const Send send_;
+    const size_t quantum_;
+    mutable std::mutex mutex_;
+    // By document ID; turns go in key order from next_
+    std::map<std::string, Stream> streams_;
+    std::string next_;
+    size_t used_ = 0;           // Of next_'s quantum, when a flush stopped partway through it
+    size_t pending_ = 0;
+    Clock::time_point lastSend_;
+};
+
+} // namespace client
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_STREAMS_H
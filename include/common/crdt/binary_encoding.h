@@ -0,0 +1,217 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_BINARY_ENCODING_H
+#define COLLABORATIVE_EDITOR_CRDT_BINARY_ENCODING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common/crdt/identifier.h"
+#include "common/util/binary_io.h"
+
+namespace collab {
+namespace crdt {
+
+// The varint buffer and cursor are shared with the protocol's binary wire format
+using util::BinaryReader;
+using util::BinaryWriter;
+
+/**
+ * Table of the authors an encoding refers to
+ *
+ * Site IDs are process-local, so encodings name each author once in a table
+ * written ahead of the body and refer to it by index everywhere else.
+ */
+class SiteTable {
+public:
+    /**
+     * Get the table index of a site, adding it on first use
+     *
+     * @param site The site to refer to
+     * @return Its index in the table
+     */
+    uint32_t indexOf(SiteId site) {
+        auto [it, inserted] = indices_.try_emplace(site, static_cast<uint32_t>(sites_.size()));
+        if (inserted) {
+            sites_.push_back(site);
+        }
+        return it->second;
+    }
+
+    /**
+     * Get the site stored at a table index
+     *
+     * @param index The table index read from an encoding
+     * @return The local site ID
+     */
+    SiteId siteAt(uint64_t index) const {
+        if (index >= sites_.size()) {
+            throw std::runtime_error("Unknown site index in CRDT encoding");
+        }
+        return sites_[index];
+    }
+
+    size_t size() const { return sites_.size(); }
+
+    void write(BinaryWriter& writer) const {
+        const SiteRegistry& registry = SiteRegistry::getInstance();
+        writer.writeVarint(sites_.size());
+        for (SiteId site : sites_) {
+            writer.writeString(registry.getAuthorId(site));
+        }
+    }
+
+    static SiteTable read(BinaryReader& reader) {
+        SiteRegistry& registry = SiteRegistry::getInstance();
+        SiteTable table;
+        const uint64_t count = reader.readVarint();
+        for (uint64_t i = 0; i < count; ++i) {
+            table.indexOf(registry.intern(std::string(reader.readString())));
+        }
+        return table;
+    }
+
+private:
+    std::vector<SiteId> sites_;
+    std::unordered_map<SiteId, uint32_t> indices_;
+};
+
+/**
+ * Write a position, referring to its sites through a table
+ *
+ * Unclaimed levels are written as site index 0 and claimed ones as their
+ * table index plus one.
+ *
+ * @param writer The buffer to write to
+ * @param sites The site table of the encoding
+ * @param position The position
+ */
+inline void writePosition(BinaryWriter& writer, SiteTable& sites, const Position& position) {
+    writer.writeVarint(position.size());
+    for (const PositionLevel& level : position) {
+        writer.writeSignedVarint(level.digit);
+        writer.writeVarint(level.site == NO_SITE ? 0 : uint64_t{sites.indexOf(level.site)} + 1);
+    }
+}
+
+/**
+ * Read a non-empty position written by writePosition()
+ *
+ * @param reader The buffer to read from
+ * @param sites The site table of the encoding
+ * @return The position, with sites mapped to local site IDs
+ */
+inline Position readPosition(BinaryReader& reader, const SiteTable& sites) {
+    Position position;
+    const auto levels = reader.readVarintAs<Position::size_type>();
+    if (levels == 0) {
+        throw std::runtime_error("Empty position in CRDT encoding");
+    }
+    if (levels > reader.remaining()) {
+        throw std::runtime_error("Truncated CRDT encoding");
+    }
+    position.reserve(levels);
+    for (Position::size_type i = 0; i < levels; ++i) {
+        const int64_t digit = reader.readSignedVarint();
+        if (digit < std::numeric_limits<int32_t>::min() || digit > std::numeric_limits<int32_t>::max()) {
+            throw std::runtime_error("Out of range digit in CRDT encoding");
+        }
+        const uint64_t site = reader.readVarint();
+        position.push_back(static_cast<int32_t>(digit), site == 0 ? NO_SITE : sites.siteAt(site - 1));
+    }
+    return position;
+}
+
+/**
+ * Write a position as the levels it does not share with the previous one
+ *
+ * Neighbouring positions in document order share long prefixes, so a
+ * sorted sequence of positions shrinks to a few bytes per position.
+ *
+ * @param writer The buffer to write to
+ * @param sites The site table of the encoding
+ * @param position The position
+ * @param previous The position written before it, empty for the first
+ */
+inline void writePositionAfter(BinaryWriter& writer, SiteTable& sites,
+                               const Position& position, const Position& previous) {
+    const auto limit = std::min(position.size(), previous.size());
+    Position::size_type shared = 0;
+    while (shared < limit && position.begin()[shared] == previous.begin()[shared]) {
+        ++shared;
+    }
+    writer.writeVarint(shared);
+    writer.writeVarint(position.size() - shared);
+    for (auto level = position.begin() + shared; level != position.end(); ++level) {
+        writer.writeSignedVarint(level->digit);
+        writer.writeVarint(level->site == NO_SITE ? 0 : uint64_t{sites.indexOf(level->site)} + 1);
+    }
+}
+
+/**
+ * Read a non-empty position written by writePositionAfter()
+ *
+ * @param reader The buffer to read from
+ * @param sites The site table of the encoding
+ * @param previous The position read before it, empty for the first
+ * @return The position, with sites mapped to local site IDs
+ */
+inline Position readPositionAfter(BinaryReader& reader, const SiteTable& sites, const Position& previous) {
+    const auto shared = reader.readVarintAs<Position::size_type>();
+    const auto levels = reader.readVarintAs<Position::size_type>();
+    if (shared > previous.size() || levels > reader.remaining() ||
+        levels > std::numeric_limits<Position::size_type>::max() - shared) {
+        throw std::runtime_error("Malformed position in CRDT encoding");
+    }
+    if (shared + levels == 0) {
+        throw std::runtime_error("Empty position in CRDT encoding");
+    }
+    Position position(previous.begin(), previous.begin() + shared);
+    position.reserve(shared + levels);
+    for (Position::size_type i = 0; i < levels; ++i) {
+        const int64_t digit = reader.readSignedVarint();
+        if (digit < std::numeric_limits<int32_t>::min() || digit > std::numeric_limits<int32_t>::max()) {
+            throw std::runtime_error("Out of range digit in CRDT encoding");
+        }
+        const uint64_t site = reader.readVarint();
+        position.push_back(static_cast<int32_t>(digit), site == 0 ? NO_SITE : sites.siteAt(site - 1));
+    }
+    return position;
+}
+
+/**
+ * Write an identifier, referring to its sites through a table
+ *
+ * @param writer The buffer to write to
+ * @param sites The site table of the encoding
+ * @param id The identifier
+ */
+inline void writeIdentifier(BinaryWriter& writer, SiteTable& sites, const Identifier& id) {
+    writePosition(writer, sites, id.position);
+    writer.writeVarint(id.clock);
+    writer.writeVarint(sites.indexOf(id.site));
+}
+
+/**
+ * Read an identifier written by writeIdentifier()
+ *
+ * @param reader The buffer to read from
+ * @param sites The site table of the encoding
+ * @return The identifier, with sites mapped to local site IDs
+ */
+inline Identifier readIdentifier(BinaryReader& reader, const SiteTable& sites) {
+    Identifier id;
+    id.position = readPosition(reader, sites);
+    id.clock = reader.readVarintAs<uint32_t>();
+    id.site = sites.siteAt(reader.readVarint());
+    return id;
+}
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_BINARY_ENCODING_H
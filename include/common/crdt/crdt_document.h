@@ -5,37 +5,57 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <atomic>
 #include <map>
-#include <random>
-#include <chrono>
 #include <mutex>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+#include "common/crdt/binary_encoding.h"
+#include "common/crdt/identifier.h"
+#include "common/crdt/order_statistic_tree.h"
+#include "common/crdt/position_strategy.h"
+#include "common/crdt/version_vector.h"
+#include "common/util/profiled_mutex.h"
 
 namespace collab {
 namespace crdt {
 
 // Forward declarations
 class CrdtChar;
-class CrdtDocument;
+class CrdtItem;
+template <PositionAllocator Allocator> class BasicCrdtDocument;
 
 /**
  * Class representing a character in a CRDT-based document
- * Each character has a unique position identifier
+ * Each character has a unique, packed identifier: an interned site ID, a
+ * Lamport clock and an inline dense position
  */
 class CrdtChar {
 public:
-    using Position = std::vector<int>;
+    using Position = crdt::Position;
+    
+    CrdtChar(char value, const std::string& authorId, const Position& position, uint32_t clock = 0)
+        : value_(value)
+        , id_{position, clock, SiteRegistry::getInstance().intern(authorId)} {}
     
-    CrdtChar(char value, const std::string& authorId, const Position& position)
+    CrdtChar(char value, Identifier id)
         : value_(value)
-        , authorId_(authorId)
-        , position_(position)
-        , timestamp_(std::chrono::system_clock::now().time_since_epoch().count()) {}
+        , id_(std::move(id)) {}
     
     // Getters
     char getValue() const { return value_; }
-    const std::string& getAuthorId() const { return authorId_; }
-    const Position& getPosition() const { return position_; }
-    int64_t getTimestamp() const { return timestamp_; }
+    const std::string& getAuthorId() const { return SiteRegistry::getInstance().getAuthorId(id_.site); }
+    SiteId getSiteId() const { return id_.site; }
+    const Position& getPosition() const { return id_.position; }
+    uint32_t getClock() const { return id_.clock; }
+    const Identifier& getId() const { return id_; }
     
     // Position comparison
     bool operator<(const CrdtChar& other) const {
@@ -43,283 +63,1274 @@ public:
     }
     
     bool operator==(const CrdtChar& other) const {
-        return compareTo(other) == 0;
+        return id_ == other.id_;
     }
     
     int compareTo(const CrdtChar& other) const {
-        // Compare positions element by element
-        const Position& otherPos = other.position_;
-        const size_t minSize = std::min(position_.size(), otherPos.size());
-        
-        for (size_t i = 0; i < minSize; ++i) {
-            if (position_[i] < otherPos[i]) return -1;
-            if (position_[i] > otherPos[i]) return 1;
-        }
-        
-        // If we get here, one position is a prefix of the other
-        if (position_.size() < otherPos.size()) return -1;
-        if (position_.size() > otherPos.size()) return 1;
-        
-        // Positions are equal, compare timestamps
-        if (timestamp_ < other.timestamp_) return -1;
-        if (timestamp_ > other.timestamp_) return 1;
-        
-        // Timestamps are equal, compare author IDs
-        return authorId_.compare(other.authorId_);
+        return id_.compare(other.id_);
     }
 
 private:
     char value_;
-    std::string authorId_;
-    Position position_;
-    int64_t timestamp_;
+    Identifier id_;
+};
+
+/**
+ * Run of characters inserted contiguously by one author
+ *
+ * Only the identifier of the first character is stored; character i of the
+ * run has id().advanced(i). Runs split when something is inserted or deleted
+ * inside them. A deleted run stays in the sequence as a tombstone, stamped
+ * with the document delete sequence it was removed at, until garbage
+ * collection proves every site has seen the delete.
+ */
+class CrdtItem {
+public:
+    CrdtItem(Identifier id, std::string text)
+        : id_(std::move(id))
+        , text_(std::move(text)) {}
+    
+    explicit CrdtItem(const CrdtChar& ch)
+        : id_(ch.getId())
+        , text_(1, ch.getValue()) {}
+    
+    // Getters
+    const Identifier& getId() const { return id_; }
+    const std::string& getText() const { return text_; }
+    size_t length() const { return text_.size(); }
+    bool empty() const { return text_.empty(); }
+    bool isDeleted() const { return deletedAt_ != 0; }
+    uint64_t getDeleteSequence() const { return deletedAt_; }
+    
+    // Characters this run contributes to the document text
+    size_t weight() const { return isDeleted() ? 0 : text_.size(); }
+    
+    void markDeleted(uint64_t sequence) {
+        deletedAt_ = sequence;
+    }
+    
+    Identifier idAt(size_t offset) const {
+        return id_.advanced(static_cast<uint32_t>(offset));
+    }
+    
+    CrdtChar charAt(size_t offset) const {
+        return CrdtChar(text_[offset], idAt(offset));
+    }
+    
+    // Clock of the last character in the run
+    uint32_t lastClock() const {
+        return id_.clock + static_cast<uint32_t>(text_.size()) - 1;
+    }
+    
+    /**
+     * Count the leading characters of this run whose identifiers sort before id
+     *
+     * @param id The identifier to compare against
+     * @return Number of characters in [0, length()) ordered before id
+     */
+    size_t countBefore(const Identifier& id) const {
+        size_t low = 0;
+        size_t high = text_.size();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (id_.compareAt(static_cast<uint32_t>(mid), id) < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+    
+    /**
+     * Check whether other carries on exactly where this run ends
+     *
+     * @param other The run that would follow this one
+     * @return True if both runs can be stored as a single item
+     */
+    bool isContinuedBy(const CrdtItem& other) const {
+        if (other.id_.site != id_.site || other.isDeleted() != isDeleted() ||
+            empty() || id_.position.empty()) {
+            return false;
+        }
+        return id_.advancesTo(static_cast<uint32_t>(text_.size()), other.id_);
+    }
+    
+    void append(const std::string& text) {
+        text_ += text;
+    }
+    
+    // Append a run for which isContinuedBy() holds
+    void absorb(const CrdtItem& other) {
+        text_ += other.text_;
+        deletedAt_ = std::max(deletedAt_, other.deletedAt_);
+    }
+    
+    // Split at offset, keeping the head in place and returning the tail
+    CrdtItem splitAt(size_t offset) {
+        CrdtItem tail(idAt(offset), text_.substr(offset));
+        tail.deletedAt_ = deletedAt_;
+        text_.resize(offset);
+        return tail;
+    }
+    
+    // Drop the first count characters
+    void eraseFront(size_t count) {
+        id_ = idAt(count);
+        text_.erase(0, count);
+    }
+
+private:
+    Identifier id_;
+    std::string text_;
+    uint64_t deletedAt_ = 0;  // Delete sequence of a tombstone, 0 while live
+};
+
+/**
+ * Characters start, start.advanced(1), ... of one run
+ */
+struct IdentifierRange {
+    Identifier start;
+    size_t length;
+};
+
+/**
+ * What a replica is missing relative to another one
+ *
+ * Items are the runs the peer has never seen, tombstones flagged deleted;
+ * deletes are ranges of characters the peer has seen but that were deleted
+ * since. Applying both brings the peer up to date.
+ */
+struct CrdtDelta {
+    std::vector<CrdtItem> items;
+    std::vector<IdentifierRange> deletes;
+};
+
+/**
+ * What applying remote changes did to the visible text, as index edits
+ *
+ * Each change is an insert or a delete at a position in the text the
+ * changes before it left, so replaying them in order on a plain copy of
+ * the text, or feeding them to an OT history, reproduces the document.
+ */
+struct TextChange {
+    size_t position = 0;
+    std::string inserted;   // The text inserted at position; empty for a delete
+    size_t deleted = 0;     // Characters deleted from position; 0 for an insert
+};
+
+/**
+ * Immutable view of a CRDT document at one point in time
+ *
+ * Documents publish a new view after every change; holding one keeps it
+ * valid and unchanged no matter what the document does next. The text is
+ * materialized on first use and then shared by every reader of the view.
+ */
+class CrdtSnapshot {
+public:
+    explicit CrdtSnapshot(OrderStatisticTree<CrdtItem> items)
+        : items_(std::move(items)) {}
+    
+    // Get the document text
+    const std::string& getText() const {
+        std::call_once(textOnce_, [this] {
+            text_.reserve(items_.weight());
+            items_.forEach([this](const CrdtItem& item) {
+                if (!item.isDeleted()) {
+                    text_ += item.getText();
+                }
+            });
+        });
+        return text_;
+    }
+    
+    // Get the size of the document
+    size_t size() const { return items_.weight(); }
+    
+    // Get the number of runs the document is stored as, tombstones included
+    size_t itemCount() const { return items_.size(); }
+    
+    // Get character at index
+    CrdtChar at(size_t index) const {
+        if (index >= items_.weight()) {
+            throw std::out_of_range("CrdtDocument::at index out of range");
+        }
+        auto location = items_.locate(index);
+        return items_.at(location.rank).charAt(location.offset);
+    }
+    
+private:
+    const OrderStatisticTree<CrdtItem> items_;
+    mutable std::once_flag textOnce_;
+    mutable std::string text_;
 };
 
 /**
  * CRDT document class that manages a set of characters
+ *
+ * Characters are stored as runs (CrdtItem) ordered by identifier, so a
+ * contiguous insert by one author costs a single item rather than one entry
+ * per character. Runs live in an order-statistic tree, which doubles as the
+ * identifier index: runs are sorted by identifier, so index-to-identifier,
+ * identifier-to-index and deletes are all O(log n).
+ *
+ * Deletes leave tombstones behind so that a delete overtaking its insert, or
+ * a later delta sync, still has something to compare against. Tombstones are
+ * pruned by collectGarbage() once every known site has acknowledged the
+ * delete sequence they were removed at.
+ *
+ * Positions for local inserts come from the Allocator policy, which is
+ * called directly on the insert path. CrdtDocument picks the policy at run
+ * time; LogootCrdtDocument, WootCrdtDocument and LseqCrdtDocument fix it at
+ * compile time. All of them share one identifier format, so replicas using
+ * different policies still interoperate.
+ *
+ * Readers never take the writer mutex: every change publishes a
+ * CrdtSnapshot, which shares structure with the live run tree so that
+ * publishing is O(1) and the next edit copies only the O(log n) nodes it
+ * touches. getText(), size(), itemCount() and at() read the latest one.
  */
-class CrdtDocument {
+template <PositionAllocator Allocator>
+class BasicCrdtDocument {
 public:
-    CrdtDocument(const std::string& authorId)
+    using Strategy = PositionStrategy;
+    
+    BasicCrdtDocument(const std::string& authorId)
         : authorId_(authorId)
-        , strategy_(Strategy::LOGOOT) {
-        // Initialize random engine with seed
-        std::random_device rd;
-        random_engine_.seed(rd());
-    }
+        , site_(SiteRegistry::getInstance().intern(authorId))
+        , snapshot_(std::make_shared<const CrdtSnapshot>(OrderStatisticTree<CrdtItem>())) {}
     
-    enum class Strategy {
-        LOGOOT,
-        WOOT,
-        LSEQ
-    };
+    // Choose the allocation policy, for documents whose policy is picked at run time
+    void setStrategy(Strategy strategy)
+        requires requires(Allocator& allocator, Strategy choice) { allocator.setStrategy(choice); } {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        allocator_.setStrategy(strategy);
+    }
     
-    void setStrategy(Strategy strategy) {
-        strategy_ = strategy;
+    /**
+     * Draw position digits from a seed, for simulations and tests that replay exactly
+     * Otherwise every document draws them from std::random_device
+     *
+     * @param value The seed
+     */
+    void seedPositions(uint32_t value)
+        requires requires(Allocator& allocator, uint32_t seed) { allocator.seed(seed); } {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        allocator_.seed(value);
     }
     
     // Insert a character at a specific index
     void localInsert(char value, size_t index) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        CrdtChar::Position position;
-        
-        if (chars_.empty() && index == 0) {
-            // First character
-            position = generatePositionBetween({}, {});
-        } else if (index == 0) {
-            // Insert at beginning
-            position = generatePositionBetween({}, chars_[0].getPosition());
-        } else if (index >= chars_.size()) {
-            // Insert at end
-            position = generatePositionBetween(chars_.back().getPosition(), {});
-        } else {
-            // Insert between two characters
-            position = generatePositionBetween(chars_[index - 1].getPosition(), chars_[index].getPosition());
-        }
-        
-        CrdtChar newChar(value, authorId_, position);
-        insertChar(newChar);
+        localInsert(std::string(1, value), index);
+    }
+    
+    /**
+     * Insert a run of text at a specific index
+     *
+     * Typing that continues at the end of this site's latest run extends that
+     * run in place instead of creating a new item.
+     *
+     * @param text The text to insert
+     * @param index The index to insert at; clamped to the document size
+     * @return The inserted run, to be broadcast to other replicas
+     */
+    CrdtItem localInsert(const std::string& text, size_t index) {
+        return mutate([&] { return localInsertLocked(text, index); });
     }
     
     // Remote insertion of a character
     void remoteInsert(const CrdtChar& ch) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        insertChar(ch);
+        remoteInsert(CrdtItem(ch));
+    }
+    
+    /**
+     * Remote insertion of a run
+     *
+     * Characters already present are skipped, and the run is split wherever
+     * existing characters sort between its members.
+     *
+     * @param item The run to integrate
+     */
+    void remoteInsert(const CrdtItem& item) {
+        mutate([&] { remoteInsertLocked(item); });
+    }
+    
+    /**
+     * Remote insertion of many characters under one lock
+     *
+     * The batch is sorted once and coalesced into runs, so a peer's paste
+     * sent character by character integrates as a handful of runs, followed
+     * by a single change notification.
+     *
+     * @param chars The characters to integrate, in any order
+     */
+    void remoteInsertBatch(std::span<const CrdtChar> chars) {
+        std::vector<const CrdtChar*> sorted;
+        sorted.reserve(chars.size());
+        for (const auto& ch : chars) {
+            sorted.push_back(&ch);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [](const CrdtChar* a, const CrdtChar* b) { return *a < *b; });
+        
+        std::vector<CrdtItem> runs;
+        for (const CrdtChar* ch : sorted) {
+            CrdtItem single(*ch);
+            if (!runs.empty() && runs.back().isContinuedBy(single)) {
+                runs.back().absorb(single);
+            } else {
+                runs.push_back(std::move(single));
+            }
+        }
+        remoteInsertBatch(std::span<const CrdtItem>(runs));
+    }
+    
+    /**
+     * Remote insertion of many runs under one lock
+     *
+     * @param items The runs to integrate
+     */
+    void remoteInsertBatch(std::span<const CrdtItem> items) {
+        mutate([&] {
+            for (const auto& item : items) {
+                remoteInsertLocked(item);
+            }
+        });
     }
     
     // Delete a character at a specific index
     void localDelete(size_t index) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (index < chars_.size()) {
-            chars_.erase(chars_.begin() + index);
-        }
+        localDelete(index, 1);
+    }
+    
+    /**
+     * Delete a range of characters
+     *
+     * @param index The index of the first character to delete
+     * @param length The number of characters to delete; clamped to the document end
+     */
+    void localDelete(size_t index, size_t length) {
+        mutate([&] {
+            if (index >= items_.weight()) {
+                return;
+            }
+            length = std::min(length, items_.weight() - index);
+            const uint64_t sequence = ++deleteSequence_;
+            while (length > 0) {
+                Location location = items_.locate(index);
+                size_t take = std::min(length, items_.at(location.rank).length() - location.offset);
+                markDeleted(location, take, sequence);
+                length -= take;
+            }
+        });
     }
     
     // Remote deletion of a character with a specific position
     void remoteDelete(const CrdtChar::Position& position) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = std::find_if(chars_.begin(), chars_.end(), 
-            [&position](const CrdtChar& ch) { return ch.getPosition() == position; });
+        mutate([&] { remoteDeleteLocked(position, ++deleteSequence_); });
+    }
+    
+    /**
+     * Remote deletion of many characters by position under one lock
+     *
+     * The whole batch shares one delete sequence and one change notification.
+     *
+     * @param positions The positions of the deleted characters
+     */
+    void remoteDeleteBatch(std::span<const CrdtChar::Position> positions) {
+        mutate([&] {
+            const uint64_t sequence = ++deleteSequence_;
+            for (const auto& position : positions) {
+                remoteDeleteLocked(position, sequence);
+            }
+        });
+    }
+    
+    /**
+     * Remote deletion of a character with a specific identifier
+     *
+     * A delete that overtakes its insert leaves a placeholder tombstone, so
+     * the insert is recognised and dropped when it arrives.
+     *
+     * @param id The identifier of the deleted character
+     */
+    void remoteDelete(const Identifier& id) {
+        mutate([&] { deleteRangeLocked(id, 1, ++deleteSequence_); });
+    }
+    
+    /**
+     * Remote deletion of many characters by identifier under one lock
+     *
+     * Identifiers are sorted once and consecutive members of a run are
+     * deleted as one range.
+     *
+     * @param ids The identifiers of the deleted characters, in any order
+     */
+    void remoteDeleteBatch(std::span<const Identifier> ids) {
+        std::vector<const Identifier*> sorted;
+        sorted.reserve(ids.size());
+        for (const auto& id : ids) {
+            sorted.push_back(&id);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [](const Identifier* a, const Identifier* b) { return *a < *b; });
+        
+        mutate([&] {
+            const uint64_t sequence = ++deleteSequence_;
+            size_t first = 0;
+            while (first < sorted.size()) {
+                size_t length = 1;
+                while (first + length < sorted.size() &&
+                       *sorted[first + length] == sorted[first]->advanced(static_cast<uint32_t>(length))) {
+                    ++length;
+                }
+                deleteRangeLocked(*sorted[first], length, sequence);
+                first += length;
+            }
+        });
+    }
+    
+    /**
+     * Register a callback invoked after every change to the document
+     *
+     * The callback runs after the document mutex is released, so it may read
+     * the document; batches notify once.
+     *
+     * @param callback The callback, or an empty function to clear it
+     */
+    void setChangeCallback(std::function<void()> callback) {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        changeCallback_ = std::move(callback);
+    }
+    
+    // Get the highest clock seen from every site
+    VersionVector getVersionVector() const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        return versionVector_;
+    }
+    
+    /**
+     * Collect every character a peer with the given version vector has not seen
+     *
+     * Tombstoned runs are included, flagged deleted, so the peer learns about
+     * characters that were inserted and deleted while it was away. Deletes of
+     * characters the peer already had are not versioned and travel separately.
+     *
+     * @param since The peer's version vector
+     * @return The missing runs in document order, ready for remoteInsertBatch()
+     */
+    std::vector<CrdtItem> getItemsSince(const VersionVector& since) const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        return deltaSinceLocked(since).items;
+    }
+    
+    /**
+     * Collect everything a peer with the given version vector is missing
+     *
+     * Unlike getItemsSince() this also lists the characters the peer already
+     * has that are tombstones here, so nothing deleted while the peer was
+     * away is lost. Both halves are taken under one lock.
+     *
+     * @param since The peer's version vector
+     * @return The missing runs and deletes, ready for applyDelta()
+     */
+    CrdtDelta getDeltaSince(const VersionVector& since) const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        CrdtDelta delta = deltaSinceLocked(since);
+        delta.deletes = deletesSeenByLocked(since);
+        return delta;
+    }
+    
+    /**
+     * Apply a delta produced by getDeltaSince() under one lock
+     *
+     * All deletes share one delete sequence, and observers are notified once.
+     *
+     * @param delta The delta to apply
+     */
+    void applyDelta(const CrdtDelta& delta) {
+        mutate([&] { applyDeltaLocked(delta); });
+    }
+    
+    /**
+     * Apply a delta and report what it did to the visible text
+     *
+     * For replicas that keep the text in another model as well, e.g. an OT
+     * history, and have to replay the merge there.
+     *
+     * @param delta The delta to apply
+     * @return The inserts and deletes of visible text, in the order they happened
+     */
+    std::vector<TextChange> applyDeltaWithChanges(const CrdtDelta& delta) {
+        std::vector<TextChange> changes;
+        mutate([&] {
+            changes_ = &changes;
+            applyDeltaLocked(delta);
+            changes_ = nullptr;
+        });
+        return changes;
+    }
+    
+    // Get the current delete sequence, for peers to acknowledge
+    uint64_t getDeleteSequence() const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        return deleteSequence_;
+    }
+    
+    /**
+     * Record that a site has seen every delete up to a sequence
+     *
+     * Sites become known when their first insert arrives or when they first
+     * acknowledge; tombstones are only pruned once all known sites caught up.
+     *
+     * @param authorId The acknowledging site
+     * @param sequence A value previously returned by getDeleteSequence()
+     */
+    void acknowledge(const std::string& authorId, uint64_t sequence) {
+        SiteId site = SiteRegistry::getInstance().intern(authorId);
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        if (site == site_) {
+            return;
+        }
+        uint64_t& acknowledged = acknowledged_[site];
+        acknowledged = std::max(acknowledged, sequence);
+    }
+    
+    // Stop waiting for a site that left the session
+    void removeSite(const std::string& authorId) {
+        SiteId site = SiteRegistry::getInstance().intern(authorId);
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        acknowledged_.erase(site);
+    }
+    
+    /**
+     * Prune tombstones that every known site has acknowledged
+     *
+     * Works oldest delete first and stops once the budget is spent, so one
+     * call never holds the document mutex much longer than budget; call it
+     * periodically to make steady progress.
+     *
+     * @param budget Maximum time to spend sweeping
+     * @return Number of tombstoned characters pruned
+     */
+    size_t collectGarbage(std::chrono::microseconds budget = std::chrono::milliseconds(1)) {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        const uint64_t stable = stableSequence();
         
-        if (it != chars_.end()) {
-            chars_.erase(it);
+        size_t pruned = 0;
+        while (!tombstones_.empty() && tombstones_.front().sequence <= stable) {
+            if (pruned > 0 && std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+            pruned += pruneTombstone(tombstones_.front());
+            tombstones_.pop_front();
         }
+        tombstoneCount_ -= pruned;
+        if (pruned > 0) {
+            publish();
+        }
+        return pruned;
+    }
+    
+    // Get the number of deleted characters still kept as tombstones
+    size_t tombstoneCount() const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        return tombstoneCount_;
+    }
+    
+    /**
+     * Get an immutable view of the latest state without taking the writer mutex
+     *
+     * Read several properties from one snapshot to see them consistently.
+     *
+     * @return The most recently published snapshot
+     */
+    std::shared_ptr<const CrdtSnapshot> snapshot() const {
+        return snapshot_.load(std::memory_order_acquire);
     }
     
     // Get the document text
     std::string getText() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::string text;
-        for (const auto& ch : chars_) {
-            text += ch.getValue();
-        }
-        return text;
+        return snapshot()->getText();
     }
     
     // Get the size of the document
     size_t size() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return chars_.size();
+        return snapshot()->size();
+    }
+    
+    // Get the number of runs the document is stored as, tombstones included
+    size_t itemCount() const {
+        return snapshot()->itemCount();
     }
     
     // Get character at index
-    const CrdtChar& at(size_t index) const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return chars_.at(index);
+    CrdtChar at(size_t index) const {
+        return snapshot()->at(index);
     }
-
-private:
-    // Insert a character in the correct sorted position
-    void insertChar(const CrdtChar& ch) {
-        auto it = std::lower_bound(chars_.begin(), chars_.end(), ch);
-        chars_.insert(it, ch);
+    
+    /**
+     * Encode the full replica state as a compact binary snapshot
+     *
+     * Covers every run, tombstones included, the clocks, the delete
+     * acknowledgements and the garbage collection queue. Authors are named
+     * once in a site table, run authors are stored as a run-length column,
+     * positions as the levels they do not share with the previous run and
+     * the visible text as one contiguous block; tombstone text is dropped.
+     *
+     * @return The snapshot bytes, for loadSnapshot()
+     */
+    std::string toSnapshot() const {
+        std::lock_guard<util::ProfiledMutex> lock(mutex_);
+        SiteTable sites;
+        BinaryWriter body;
+        body.writeVarint(clock_);
+        body.writeVarint(deleteSequence_);
+        body.writeVarint(versionVector_.size());
+        for (const auto& [site, clock] : versionVector_.entries()) {
+            body.writeVarint(sites.indexOf(site));
+            body.writeVarint(clock);
+        }
+        body.writeVarint(acknowledged_.size());
+        for (const auto& [site, sequence] : acknowledged_) {
+            body.writeVarint(sites.indexOf(site));
+            body.writeVarint(sequence);
+        }
+        
+        std::string text;
+        text.reserve(items_.weight());
+        std::vector<std::pair<uint32_t, uint64_t>> authorRuns;
+        BinaryWriter runs;
+        runs.writeVarint(items_.size());
+        const Position* previous = nullptr;
+        const Position none;
+        items_.forEach([&](const CrdtItem& item) {
+            const uint32_t author = sites.indexOf(item.getId().site);
+            if (!authorRuns.empty() && authorRuns.back().first == author) {
+                ++authorRuns.back().second;
+            } else {
+                authorRuns.emplace_back(author, 1);
+            }
+            writePositionAfter(runs, sites, item.getId().position, previous ? *previous : none);
+            previous = &item.getId().position;
+            runs.writeVarint(item.getId().clock);
+            runs.writeVarint(item.length());
+            runs.writeVarint(item.getDeleteSequence());
+            if (!item.isDeleted()) {
+                text += item.getText();
+            }
+        });
+        body.writeString(text);
+        body.writeVarint(authorRuns.size());
+        for (const auto& [author, count] : authorRuns) {
+            body.writeVarint(author);
+            body.writeVarint(count);
+        }
+        body.writeRaw(runs.data());
+        
+        body.writeVarint(tombstones_.size());
+        for (const auto& tombstone : tombstones_) {
+            writeIdentifier(body, sites, tombstone.start);
+            body.writeVarint(tombstone.length);
+            body.writeVarint(tombstone.sequence);
+        }
+        
+        BinaryWriter writer;
+        writer.writeRaw(SNAPSHOT_MAGIC);
+        writer.writeByte(SNAPSHOT_FORMAT_VERSION);
+        sites.write(writer);
+        writer.writeRaw(body.data());
+        return writer.take();
     }
     
-    // Generate a position between two positions
-    CrdtChar::Position generatePositionBetween(
-        const CrdtChar::Position& p1, 
-        const CrdtChar::Position& p2) {
+    /**
+     * Replace the replica state with a snapshot from toSnapshot()
+     *
+     * Decodes in a single pass straight into runs, which then become the run
+     * tree in linear time. The snapshot may come from a replica of another
+     * author; this document keeps its own identity and strategy.
+     *
+     * @param bytes The snapshot bytes
+     * @throws std::runtime_error if the snapshot is malformed; the document is left unchanged
+     */
+    void loadSnapshot(std::string_view bytes) {
+        BinaryReader reader(bytes);
+        if (reader.remaining() < SNAPSHOT_MAGIC.size() ||
+            reader.readRaw(SNAPSHOT_MAGIC.size()) != SNAPSHOT_MAGIC) {
+            throw std::runtime_error("Not a CRDT document snapshot");
+        }
+        if (reader.readByte() != SNAPSHOT_FORMAT_VERSION) {
+            throw std::runtime_error("Unsupported CRDT snapshot format version");
+        }
+        const SiteTable sites = SiteTable::read(reader);
+        const auto clock = reader.readVarintAs<uint32_t>();
+        const uint64_t deleteSequence = reader.readVarint();
         
-        switch (strategy_) {
-            case Strategy::LOGOOT:
-                return generateLogootPosition(p1, p2);
-            case Strategy::WOOT:
-                return generateWootPosition(p1, p2);
-            case Strategy::LSEQ:
-                return generateLseqPosition(p1, p2);
-            default:
-                return generateLogootPosition(p1, p2);
-        }
-    }
-    
-    // Logoot strategy for position generation
-    CrdtChar::Position generateLogootPosition(
-        const CrdtChar::Position& p1, 
-        const CrdtChar::Position& p2) {
+        VersionVector versionVector;
+        for (uint64_t i = 0, count = reader.readVarint(); i < count; ++i) {
+            const SiteId site = sites.siteAt(reader.readVarint());
+            versionVector.observe(site, reader.readVarintAs<uint32_t>());
+        }
+        std::unordered_map<SiteId, uint64_t> acknowledged;
+        for (uint64_t i = 0, count = reader.readVarint(); i < count; ++i) {
+            const SiteId site = sites.siteAt(reader.readVarint());
+            acknowledged[site] = reader.readVarint();
+        }
         
-        // Base case: if p1 is empty, generate a position before p2
-        if (p1.empty()) {
-            if (p2.empty()) {
-                // Both are empty, create a new position
-                return {randomInt(1, 100)};
+        const std::string_view text = reader.readString();
+        std::vector<std::pair<SiteId, uint64_t>> authorRuns;
+        uint64_t authoredItems = 0;
+        for (uint64_t i = 0, count = reader.readVarint(); i < count; ++i) {
+            const SiteId site = sites.siteAt(reader.readVarint());
+            const uint64_t items = reader.readVarint();
+            if (items == 0 || items > reader.remaining()) {
+                throw std::runtime_error("Malformed author runs in CRDT snapshot");
             }
-            // Before the first position
-            return {p2[0] / 2};
+            authorRuns.emplace_back(site, items);
+            authoredItems += items;
+        }
+        const uint64_t itemCount = reader.readVarint();
+        if (itemCount != authoredItems) {
+            throw std::runtime_error("Author runs do not cover the items of the CRDT snapshot");
         }
         
-        // Base case: if p2 is empty, generate a position after p1
-        if (p2.empty()) {
-            return {p1[0] + randomInt(1, 10)};
+        std::vector<CrdtItem> items;
+        items.reserve(std::min<uint64_t>(itemCount, reader.remaining()));
+        size_t textOffset = 0;
+        size_t tombstoneCount = 0;
+        size_t authorRun = 0;
+        uint64_t authorLeft = itemCount > 0 ? authorRuns[0].second : 0;
+        for (uint64_t i = 0; i < itemCount; ++i) {
+            if (authorLeft == 0) {
+                authorLeft = authorRuns[++authorRun].second;
+            }
+            --authorLeft;
+            Identifier id;
+            id.position = readPositionAfter(reader, sites, items.empty() ? Position() : items.back().getId().position);
+            id.clock = reader.readVarintAs<uint32_t>();
+            id.site = authorRuns[authorRun].first;
+            const auto length = reader.readVarintAs<size_t>();
+            const uint64_t deletedAt = reader.readVarint();
+            if (length == 0 || deletedAt > deleteSequence) {
+                throw std::runtime_error("Malformed run in CRDT snapshot");
+            }
+            if (deletedAt == 0) {
+                if (length > text.size() - textOffset) {
+                    throw std::runtime_error("Truncated text in CRDT snapshot");
+                }
+                items.emplace_back(std::move(id), std::string(text.substr(textOffset, length)));
+                textOffset += length;
+            } else {
+                items.emplace_back(std::move(id), std::string(length, '\0'));
+                items.back().markDeleted(deletedAt);
+                tombstoneCount += length;
+            }
+        }
+        if (textOffset != text.size()) {
+            throw std::runtime_error("Unused text in CRDT snapshot");
         }
         
-        // Find the common prefix
-        size_t commonPrefixLen = 0;
-        while (commonPrefixLen < p1.size() && 
-               commonPrefixLen < p2.size() && 
-               p1[commonPrefixLen] == p2[commonPrefixLen]) {
-            commonPrefixLen++;
+        std::deque<Tombstone> tombstones;
+        for (uint64_t i = 0, count = reader.readVarint(); i < count; ++i) {
+            Identifier start = readIdentifier(reader, sites);
+            const auto length = reader.readVarintAs<size_t>();
+            tombstones.push_back({std::move(start), length, reader.readVarint()});
+        }
+        if (!reader.atEnd()) {
+            throw std::runtime_error("Trailing bytes after CRDT snapshot");
         }
         
-        // Case 1: One position is a prefix of the other
-        if (commonPrefixLen == p1.size()) {
-            CrdtChar::Position newPos = p1;
-            newPos.push_back(p2[commonPrefixLen] / 2);
-            return newPos;
+        mutate([&] {
+            items_.assign(std::move(items));
+            clock_ = std::max(clock_, clock);
+            versionVector_ = std::move(versionVector);
+            deleteSequence_ = deleteSequence;
+            tombstones_ = std::move(tombstones);
+            tombstoneCount_ = tombstoneCount;
+            acknowledged_ = std::move(acknowledged);
+            acknowledged_.erase(site_);
+        });
+    }
+
+private:
+    using Location = OrderStatisticTree<CrdtItem>::Location;
+    
+    // Range of characters deleted at one delete sequence
+    struct Tombstone {
+        Identifier start;
+        size_t length;
+        uint64_t sequence;
+    };
+    
+    // Run a mutation under the document mutex and publish the result, then notify outside of it
+    template <typename Fn>
+    auto mutate(Fn&& fn) -> decltype(fn()) {
+        std::function<void()> callback;
+        if constexpr (std::is_void_v<decltype(fn())>) {
+            {
+                std::lock_guard<util::ProfiledMutex> lock(mutex_);
+                fn();
+                publish();
+                callback = changeCallback_;
+            }
+            if (callback) {
+                callback();
+            }
+        } else {
+            auto result = [&] {
+                std::lock_guard<util::ProfiledMutex> lock(mutex_);
+                callback = changeCallback_;
+                auto value = fn();
+                publish();
+                return value;
+            }();
+            if (callback) {
+                callback();
+            }
+            return result;
+        }
+    }
+    
+    // Share the current runs with readers; O(1), edits copy what they touch from now on
+    void publish() {
+        snapshot_.store(std::make_shared<const CrdtSnapshot>(items_), std::memory_order_release);
+    }
+    
+    CrdtItem localInsertLocked(const std::string& text, size_t index) {
+        Identifier start{{}, clock_ + 1, site_};
+        if (text.empty()) {
+            return CrdtItem(std::move(start), text);
         }
         
-        if (commonPrefixLen == p2.size()) {
-            CrdtChar::Position newPos = p2;
-            newPos.push_back(randomInt(1, 10));
-            return newPos;
+        index = std::min(index, items_.weight());
+        Location location = items_.locate(index);
+        const CrdtItem* left = nullptr;
+        Location leftLocation{0, 0};
+        if (index > 0) {
+            leftLocation = items_.locate(index - 1);
+            left = &items_.at(leftLocation.rank);
         }
+        const bool hasRight = location.rank < items_.size();
         
-        // Case 2: Positions differ at some point
-        if (p1[commonPrefixLen] + 1 < p2[commonPrefixLen]) {
-            // There's space between the two positions
-            CrdtChar::Position newPos(p1.begin(), p1.begin() + commonPrefixLen);
-            newPos.push_back(p1[commonPrefixLen] + randomInt(1, p2[commonPrefixLen] - p1[commonPrefixLen] - 1));
-            return newPos;
-        } else {
-            // No space, need to add a level
-            CrdtChar::Position newPos = p1;
-            newPos.push_back(randomInt(1, 10));
-            return newPos;
+        // Extend our own run when typing continues right at its end; runs
+        // are capped since a published snapshot makes the append copy the run
+        if (left != nullptr && leftLocation.offset + 1 == left->length() &&
+            left->length() < MAX_EXTENDED_RUN &&
+            left->getId().site == site_ && left->lastClock() == clock_ &&
+            !left->getId().position.empty()) {
+            Identifier last = left->idAt(left->length() + text.size() - 1);
+            const size_t nextRank = leftLocation.rank + 1;
+            if (nextRank == items_.size() || last < items_.at(nextRank).getId()) {
+                CrdtItem inserted(left->idAt(left->length()), text);
+                items_.modify(leftLocation.rank, [&text](CrdtItem& item) { item.append(text); });
+                clock_ += static_cast<uint32_t>(text.size());
+                versionVector_.observe(site_, clock_);
+                return inserted;
+            }
         }
+        
+        Position leftPosition = left != nullptr ? left->idAt(leftLocation.offset).position : Position();
+        Position rightPosition = hasRight ? items_.at(location.rank).idAt(location.offset).position : Position();
+        start.position = allocateRun(left != nullptr ? &leftPosition : nullptr,
+                                     hasRight ? &rightPosition : nullptr,
+                                     text.size());
+        CrdtItem inserted(std::move(start), text);
+        clock_ += static_cast<uint32_t>(text.size());
+        versionVector_.observe(site_, clock_);
+        
+        // Tombstones between the neighbours may sort inside the new run
+        integrateRun(inserted);
+        return inserted;
     }
     
-    // WOOT strategy for position generation (simplified)
-    CrdtChar::Position generateWootPosition(
-        const CrdtChar::Position& p1, 
-        const CrdtChar::Position& p2) {
+    void remoteInsertLocked(const CrdtItem& item) {
+        if (item.empty()) {
+            return;
+        }
+        clock_ = std::max(clock_, item.lastClock());
+        versionVector_.observe(item.getId().site, item.lastClock());
+        if (item.getId().site != site_) {
+            acknowledged_.try_emplace(item.getId().site, 0);
+        }
+        if (!item.isDeleted()) {
+            integrateRun(item);
+            return;
+        }
         
-        // For WOOT, we'll use a simpler approach
-        if (p1.empty() && p2.empty()) {
-            return {randomInt(1, 1000)};
-        } else if (p1.empty()) {
-            return {p2[0] - randomInt(1, 10)};
-        } else if (p2.empty()) {
-            return {p1[0] + randomInt(1, 10)};
-        } else {
-            // Need to ensure the new position is between p1 and p2
-            int minVal = p1[0] + 1;
-            int maxVal = p2[0] - 1;
+        // A tombstone from a peer's state: integrate the characters, then
+        // delete them under a local sequence
+        CrdtItem live(item.getId(), item.getText());
+        integrateRun(live);
+        deleteRangeLocked(item.getId(), item.length(), ++deleteSequence_);
+    }
+    
+    void applyDeltaLocked(const CrdtDelta& delta) {
+        for (const auto& item : delta.items) {
+            remoteInsertLocked(item);
+        }
+        if (delta.deletes.empty()) {
+            return;
+        }
+        const uint64_t sequence = ++deleteSequence_;
+        for (const auto& range : delta.deletes) {
+            deleteRangeLocked(range.start, range.length, sequence);
+        }
+    }
+    
+    CrdtDelta deltaSinceLocked(const VersionVector& since) const {
+        CrdtDelta delta;
+        items_.forEach([&since, &delta](const CrdtItem& item) {
+            const uint32_t seen = since.get(item.getId().site);
+            if (item.lastClock() <= seen) {
+                return;
+            }
+            if (item.getId().clock > seen) {
+                delta.items.push_back(item);
+                return;
+            }
+            CrdtItem suffix = item;
+            suffix.eraseFront(seen - item.getId().clock + 1);
+            delta.items.push_back(std::move(suffix));
+        });
+        return delta;
+    }
+    
+    // Tombstoned characters the peer has seen inserted, as ranges
+    std::vector<IdentifierRange> deletesSeenByLocked(const VersionVector& since) const {
+        std::vector<IdentifierRange> deletes;
+        items_.forEach([&since, &deletes](const CrdtItem& item) {
+            if (!item.isDeleted()) {
+                return;
+            }
+            const uint32_t seen = since.get(item.getId().site);
+            if (item.getId().clock > seen) {
+                return;
+            }
+            const size_t length = std::min<size_t>(item.length(), seen - item.getId().clock + 1);
+            deletes.push_back({item.getId(), length});
+        });
+        return deletes;
+    }
+    
+    void remoteDeleteLocked(const CrdtChar::Position& position, uint64_t sequence) {
+        Location location = lowerBound([&position](const Identifier& start, uint32_t offset) {
+            return start.position.compareAdvanced(static_cast<int32_t>(offset), position) < 0;
+        });
+        if (location.rank < items_.size() && !items_.at(location.rank).isDeleted() &&
+            items_.at(location.rank).getId().position.equalsAdvanced(static_cast<int32_t>(location.offset), position)) {
+            markDeleted(location, 1, sequence);
+        }
+    }
+    
+    /**
+     * Delete the characters id, id.advanced(1), ... of one run
+     *
+     * Characters not integrated yet get placeholder tombstones, so their
+     * insert is recognised and dropped when it arrives.
+     *
+     * @param id Identifier of the first character
+     * @param length Number of characters
+     * @param sequence Delete sequence to stamp the tombstones with
+     */
+    void deleteRangeLocked(Identifier id, size_t length, uint64_t sequence) {
+        while (length > 0) {
+            Location location = lowerBound(sortsBefore(id));
+            if (location.rank < items_.size() && isAt(location, id)) {
+                const CrdtItem& item = items_.at(location.rank);
+                size_t take = std::min(length, item.length() - location.offset);
+                if (!item.isDeleted()) {
+                    markDeleted(location, take, sequence);
+                }
+                id = id.advanced(static_cast<uint32_t>(take));
+                length -= take;
+                continue;
+            }
             
-            if (minVal <= maxVal) {
-                // There's space, use it
-                return {randomInt(minVal, maxVal)};
+            CrdtItem placeholder(id, std::string(1, '\0'));
+            placeholder.markDeleted(sequence);
+            integrate(location, placeholder);
+            tombstones_.push_back({id, 1, sequence});
+            tombstoneCount_ += 1;
+            id = id.advanced(1);
+            --length;
+        }
+    }
+    
+    
+    /**
+     * Find the first character for which before(start, offset) is false
+     * A character is passed as the identifier of its run's first character
+     * and its offset in the run, so probes inside a run copy nothing
+     *
+     * @param before Predicate over character identifiers, monotone in document order
+     * @return Location of that character, or the end
+     */
+    template <typename Before>
+    Location lowerBound(Before before) const {
+        const size_t end = items_.partitionPoint(
+            [&before](const CrdtItem& item) { return before(item.getId(), 0u); });
+        if (end == 0) {
+            return {0, 0};
+        }
+        const size_t index = end - 1;
+        const CrdtItem& item = items_.at(index);
+        size_t low = 1;
+        size_t high = item.length();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (before(item.getId(), static_cast<uint32_t>(mid))) {
+                low = mid + 1;
             } else {
-                // No space, create a new layer
-                CrdtChar::Position newPos = p1;
-                newPos.push_back(randomInt(1, 1000));
-                return newPos;
+                high = mid;
             }
         }
+        if (low == item.length()) {
+            return {index + 1, 0};
+        }
+        return {index, low};
     }
     
-    // LSEQ strategy for position generation (simplified)
-    CrdtChar::Position generateLseqPosition(
-        const CrdtChar::Position& p1, 
-        const CrdtChar::Position& p2) {
-        
-        // For LSEQ, we'll use a strategy that allocates more space for earlier positions
-        static const int BASE = 1000;
-        
-        if (p1.empty() && p2.empty()) {
-            return {BASE / 2};
-        } else if (p1.empty()) {
-            return {p2[0] / 2};
-        } else if (p2.empty()) {
-            return {p1[0] + randomInt(1, 10)};
-        } else {
-            int interval = p2[0] - p1[0];
+    // Predicate for lowerBound(): the character sorts before id
+    static auto sortsBefore(const Identifier& id) {
+        return [&id](const Identifier& start, uint32_t offset) { return start.compareAt(offset, id) < 0; };
+    }
+    
+    // Whether the character at location, which must exist, has identifier id
+    bool isAt(Location location, const Identifier& id) const {
+        return items_.at(location.rank).getId().advancesTo(static_cast<uint32_t>(location.offset), id);
+    }
+    
+    /**
+     * Integrate a run in identifier order
+     *
+     * Characters already present are skipped, and the run is split wherever
+     * existing characters sort between its members.
+     *
+     * @param item The run to integrate
+     */
+    void integrateRun(const CrdtItem& item) {
+        CrdtItem run = item;
+        while (!run.empty()) {
+            const Identifier& start = run.getId();
+            Location location = lowerBound(sortsBefore(start));
             
-            if (interval > 1) {
-                // There's space, use it
-                return {p1[0] + interval/2};
-            } else {
-                // No space, add a deeper level
-                CrdtChar::Position newPos = p1;
-                newPos.push_back(BASE / 2);
-                return newPos;
+            size_t take = run.length();
+            if (location.rank < items_.size()) {
+                Identifier next = items_.at(location.rank).idAt(location.offset);
+                if (next == start) {
+                    // Already integrated
+                    run.eraseFront(1);
+                    continue;
+                }
+                take = run.countBefore(next);
             }
+            
+            CrdtItem tail = take < run.length() ? run.splitAt(take) : CrdtItem(Identifier{}, "");
+            integrate(location, run);
+            run = std::move(tail);
         }
     }
     
-    // Generate a random integer within the range [min, max]
-    int randomInt(int min, int max) {
-        std::uniform_int_distribution<int> dist(min, max);
-        return dist(random_engine_);
+    // Insert a run at location, known to fit entirely before the character there
+    void integrate(Location location, const CrdtItem& run) {
+        if (changes_ && !run.isDeleted()) {
+            reportChange(visibleIndex(location), run.getText(), 0);
+        }
+        size_t insertAt = location.rank;
+        if (location.offset > 0) {
+            splitItem(location.rank, location.offset);
+            insertAt = location.rank + 1;
+        }
+        if (insertAt > 0 && items_.at(insertAt - 1).isContinuedBy(run)) {
+            items_.modify(insertAt - 1, [&run](CrdtItem& item) { item.absorb(run); });
+            return;
+        }
+        items_.insert(insertAt, run);
     }
-
+    
+    // Turn count live characters of one item into a tombstone
+    void markDeleted(Location location, size_t count, uint64_t sequence) {
+        if (changes_) {
+            reportChange(visibleIndex(location), {}, count);
+        }
+        size_t rank = location.rank;
+        if (location.offset > 0) {
+            splitItem(rank, location.offset);
+            ++rank;
+        }
+        if (count < items_.at(rank).length()) {
+            splitItem(rank, count);
+        }
+        tombstones_.push_back({items_.at(rank).getId(), count, sequence});
+        tombstoneCount_ += count;
+        items_.modify(rank, [sequence](CrdtItem& item) { item.markDeleted(sequence); });
+        
+        // Keep runs of deletes, e.g. repeated backspace, in a single tombstone
+        if (rank + 1 < items_.size() && items_.at(rank).isContinuedBy(items_.at(rank + 1))) {
+            absorbNext(rank);
+        }
+        if (rank > 0 && items_.at(rank - 1).isContinuedBy(items_.at(rank))) {
+            absorbNext(rank - 1);
+        }
+    }
+    
+    // Visible characters before a location
+    size_t visibleIndex(Location location) const {
+        const size_t before = items_.weightBefore(location.rank);
+        return location.rank < items_.size() && !items_.at(location.rank).isDeleted() ? before + location.offset : before;
+    }
+    
+    // Record a change for applyDeltaWithChanges(), continuing the last one where it can
+    void reportChange(size_t position, const std::string& inserted, size_t deleted) {
+        if (!changes_->empty()) {
+            TextChange& last = changes_->back();
+            if (!inserted.empty() && last.deleted == 0 && position == last.position + last.inserted.size()) {
+                last.inserted += inserted;
+                return;
+            }
+            if (deleted > 0 && last.inserted.empty() && position == last.position) {
+                last.deleted += deleted;
+                return;
+            }
+        }
+        changes_->push_back({position, inserted, deleted});
+    }
+    
+    void absorbNext(size_t rank) {
+        CrdtItem next = items_.at(rank + 1);
+        items_.erase(rank + 1);
+        items_.modify(rank, [&next](CrdtItem& item) { item.absorb(next); });
+    }
+    
+    // Smallest delete sequence acknowledged by every known site
+    uint64_t stableSequence() const {
+        uint64_t stable = deleteSequence_;
+        for (const auto& [site, acknowledged] : acknowledged_) {
+            stable = std::min(stable, acknowledged);
+        }
+        return stable;
+    }
+    
+    // Physically remove the characters of a tombstone range that are still present
+    size_t pruneTombstone(const Tombstone& tombstone) {
+        Identifier id = tombstone.start;
+        size_t remaining = tombstone.length;
+        size_t pruned = 0;
+        while (remaining > 0) {
+            Location location = lowerBound(sortsBefore(id));
+            if (location.rank >= items_.size() || !items_.at(location.rank).isDeleted() ||
+                !isAt(location, id)) {
+                id = id.advanced(1);
+                --remaining;
+                continue;
+            }
+            size_t take = std::min(remaining, items_.at(location.rank).length() - location.offset);
+            eraseFromItem(location, take);
+            id = id.advanced(static_cast<uint32_t>(take));
+            remaining -= take;
+            pruned += take;
+        }
+        return pruned;
+    }
+    
+    void splitItem(size_t index, size_t offset) {
+        CrdtItem tail(Identifier{}, "");
+        items_.modify(index, [&tail, offset](CrdtItem& item) { tail = item.splitAt(offset); });
+        items_.insert(index + 1, std::move(tail));
+    }
+    
+    // Erase count characters of a single item starting at location
+    void eraseFromItem(Location location, size_t count) {
+        const size_t length = items_.at(location.rank).length();
+        if (location.offset == 0 && count == length) {
+            items_.erase(location.rank);
+        } else if (location.offset == 0) {
+            items_.modify(location.rank, [count](CrdtItem& item) { item.eraseFront(count); });
+        } else if (location.offset + count == length) {
+            items_.modify(location.rank, [&location](CrdtItem& item) { item.splitAt(location.offset); });
+        } else {
+            CrdtItem tail(Identifier{}, "");
+            items_.modify(location.rank, [&tail, &location](CrdtItem& item) { tail = item.splitAt(location.offset); });
+            tail.eraseFront(count);
+            items_.insert(location.rank + 1, std::move(tail));
+        }
+    }
+    
+    /**
+     * Allocate the first position of a run of count characters between two neighbours
+     *
+     * The configured strategy gets the first try; if the run it proposes does
+     * not fit, the run is placed one level below the left neighbour, which
+     * always leaves room between two distinct positions.
+     *
+     * @param left Position of the left neighbour, or nullptr at the start
+     * @param right Position of the right neighbour, or nullptr at the end
+     * @param count Length of the run
+     * @return Position of the run's first character
+     */
+    Position allocateRun(const Position* left, const Position* right, size_t count) {
+        const auto span = static_cast<int32_t>(count);
+        Position position = allocator_.between(left ? *left : Position(), right ? *right : Position(), count);
+        position.stamp(site_);
+        if (!position.empty()) {
+            Position last = position;
+            last[last.size() - 1] += span - 1;
+            if ((left == nullptr || *left < position) && (right == nullptr || last < *right)) {
+                return position;
+            }
+        }
+        
+        Position fallback;
+        if (left == nullptr) {
+            fallback.push_back(right == nullptr ? 1 : (*right)[0] - span, site_);
+            return fallback;
+        }
+        if (right == nullptr) {
+            fallback.push_back((*left)[0] + 1, site_);
+            return fallback;
+        }
+        
+        fallback = *left;
+        if (right->size() > left->size() &&
+            std::equal(left->begin(), left->end(), right->begin())) {
+            // right lives below left: take the digits just before it
+            fallback.push_back((*right)[left->size()] - span, site_);
+        } else {
+            fallback.push_back(0, site_);
+        }
+        return fallback;
+    }
+    
 private:
+    static constexpr size_t MAX_EXTENDED_RUN = 4096;
+    static constexpr std::string_view SNAPSHOT_MAGIC = "CRDS";
+    static constexpr uint8_t SNAPSHOT_FORMAT_VERSION = 1;
+    
     std::string authorId_;
-    std::vector<CrdtChar> chars_;
-    std::mt19937 random_engine_;
-    Strategy strategy_;
-    mutable std::mutex mutex_;
+    SiteId site_;
+    uint32_t clock_ = 0;  // Lamport clock: ticks per inserted character, catches up on remote ones
+    VersionVector versionVector_;
+    OrderStatisticTree<CrdtItem> items_;
+    uint64_t deleteSequence_ = 0;
+    std::deque<Tombstone> tombstones_;  // In delete sequence order
+    size_t tombstoneCount_ = 0;
+    std::unordered_map<SiteId, uint64_t> acknowledged_;  // Delete sequence each known site has seen
+    Allocator allocator_;
+    std::function<void()> changeCallback_;
+    std::vector<TextChange>* changes_ = nullptr;  // Where applyDeltaWithChanges() collects, while it runs
+    std::atomic<std::shared_ptr<const CrdtSnapshot>> snapshot_;  // Latest published state, read without the mutex
+    mutable util::ProfiledMutex mutex_{"crdt_document"};
 };
 
+// Document whose allocation policy can be switched with setStrategy()
+using CrdtDocument = BasicCrdtDocument<DynamicStrategy>;
+
+// Documents with the allocation policy fixed at compile time
+using LogootCrdtDocument = BasicCrdtDocument<LogootStrategy>;
+using WootCrdtDocument = BasicCrdtDocument<WootStrategy>;
+using LseqCrdtDocument = BasicCrdtDocument<LseqStrategy>;
+
 } // namespace crdt
 } // namespace collab
 
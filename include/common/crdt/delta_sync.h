@@ -0,0 +1,176 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_DELTA_SYNC_H
+#define COLLABORATIVE_EDITOR_CRDT_DELTA_SYNC_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common/crdt/binary_encoding.h"
+#include "common/crdt/crdt_document.h"
+#include "common/crdt/version_vector.h"
+
+namespace collab {
+namespace crdt {
+
+/**
+ * Binary encodings for state-vector delta sync
+ *
+ * A reconnecting client sends its version vector (SYNC_REQUEST with
+ * stateVector set); the server answers with the delta the client is missing
+ * (SYNC_RESPONSE with delta set) instead of the full document state:
+ *
+ *     request.stateVector = encodeStateVector(client.getVersionVector());
+ *     response.delta = encodeDelta(server.getDeltaSince(decodeStateVector(*request.stateVector)));
+ *     client.applyDelta(decodeDelta(*response.delta));
+ *
+ * Both formats start with a format version byte. Deltas name every author
+ * once in a site table, and tombstones travel without their text.
+ */
+constexpr uint8_t DELTA_SYNC_FORMAT_VERSION = 1;
+
+// Longest tombstone run a delta may describe, so a tiny payload cannot claim gigabytes
+constexpr uint32_t DELTA_SYNC_MAX_TOMBSTONE_RUN = 1u << 24;
+
+namespace detail {
+
+inline void readFormatVersion(BinaryReader& reader) {
+    if (reader.readByte() != DELTA_SYNC_FORMAT_VERSION) {
+        throw std::runtime_error("Unsupported CRDT delta sync format version");
+    }
+}
+
+inline void expectEnd(const BinaryReader& reader) {
+    if (!reader.atEnd()) {
+        throw std::runtime_error("Trailing bytes after CRDT delta sync payload");
+    }
+}
+
+} // namespace detail
+
+/**
+ * Encode a version vector
+ *
+ * @param vector The version vector
+ * @return The encoded bytes; entries are sorted by author so equal vectors encode equally
+ */
+inline std::string encodeStateVector(const VersionVector& vector) {
+    const SiteRegistry& registry = SiteRegistry::getInstance();
+    std::vector<std::pair<std::string_view, uint32_t>> entries;
+    entries.reserve(vector.size());
+    for (const auto& [site, clock] : vector.entries()) {
+        entries.emplace_back(registry.getAuthorId(site), clock);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    BinaryWriter writer;
+    writer.writeByte(DELTA_SYNC_FORMAT_VERSION);
+    writer.writeVarint(entries.size());
+    for (const auto& [authorId, clock] : entries) {
+        writer.writeString(authorId);
+        writer.writeVarint(clock);
+    }
+    return writer.take();
+}
+
+/**
+ * Decode a version vector written by encodeStateVector()
+ *
+ * @param bytes The encoded bytes
+ * @return The version vector
+ */
+inline VersionVector decodeStateVector(std::string_view bytes) {
+    BinaryReader reader(bytes);
+    detail::readFormatVersion(reader);
+    VersionVector vector;
+    const uint64_t count = reader.readVarint();
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string authorId(reader.readString());
+        vector.observe(authorId, reader.readVarintAs<uint32_t>());
+    }
+    detail::expectEnd(reader);
+    return vector;
+}
+
+/**
+ * Encode a delta
+ *
+ * @param delta The delta, as returned by CrdtDocument::getDeltaSince()
+ * @return The encoded bytes
+ */
+inline std::string encodeDelta(const CrdtDelta& delta) {
+    // The site table goes first but is only complete once the body is written
+    SiteTable sites;
+    BinaryWriter body;
+    body.writeVarint(delta.items.size());
+    for (const auto& item : delta.items) {
+        writeIdentifier(body, sites, item.getId());
+        body.writeByte(item.isDeleted() ? 1 : 0);
+        if (item.isDeleted()) {
+            body.writeVarint(item.length());
+        } else {
+            body.writeString(item.getText());
+        }
+    }
+    body.writeVarint(delta.deletes.size());
+    for (const auto& range : delta.deletes) {
+        writeIdentifier(body, sites, range.start);
+        body.writeVarint(range.length);
+    }
+
+    BinaryWriter writer;
+    writer.writeByte(DELTA_SYNC_FORMAT_VERSION);
+    sites.write(writer);
+    writer.writeRaw(body.data());
+    return writer.take();
+}
+
+/**
+ * Decode a delta written by encodeDelta()
+ *
+ * @param bytes The encoded bytes
+ * @return The delta, ready for CrdtDocument::applyDelta()
+ */
+inline CrdtDelta decodeDelta(std::string_view bytes) {
+    BinaryReader reader(bytes);
+    detail::readFormatVersion(reader);
+    const SiteTable sites = SiteTable::read(reader);
+
+    CrdtDelta delta;
+    const uint64_t itemCount = reader.readVarint();
+    delta.items.reserve(std::min<uint64_t>(itemCount, reader.remaining()));
+    for (uint64_t i = 0; i < itemCount; ++i) {
+        Identifier id = readIdentifier(reader, sites);
+        const uint8_t flags = reader.readByte();
+        if (flags > 1) {
+            throw std::runtime_error("Unknown item flags in CRDT delta");
+        }
+        if (flags == 1) {
+            const auto length = reader.readVarintAs<uint32_t>();
+            if (length > DELTA_SYNC_MAX_TOMBSTONE_RUN) {
+                throw std::runtime_error("Tombstone run too long in CRDT delta");
+            }
+            CrdtItem item(std::move(id), std::string(length, '\0'));
+            item.markDeleted(1);
+            delta.items.push_back(std::move(item));
+        } else {
+            delta.items.emplace_back(std::move(id), std::string(reader.readString()));
+        }
+    }
+
+    const uint64_t deleteCount = reader.readVarint();
+    delta.deletes.reserve(std::min<uint64_t>(deleteCount, reader.remaining()));
+    for (uint64_t i = 0; i < deleteCount; ++i) {
+        Identifier start = readIdentifier(reader, sites);
+        delta.deletes.push_back({std::move(start), reader.readVarintAs<uint32_t>()});
+    }
+    detail::expectEnd(reader);
+    return delta;
+}
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_DELTA_SYNC_H
@@ -0,0 +1,469 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_IDENTIFIER_H
+#define COLLABORATIVE_EDITOR_CRDT_IDENTIFIER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace collab {
+namespace crdt {
+
+/**
+ * Small integer standing in for an author ID inside this process
+ */
+using SiteId = uint32_t;
+
+/**
+ * Process-wide table that interns author IDs to small integers
+ *
+ * Interned values are local to the process that created them and must never
+ * be sent to a peer: two replicas may intern the same author under different
+ * numbers. Ordering between sites therefore always falls back to the author
+ * strings, and only equality is decided by the integer alone.
+ */
+class SiteRegistry {
+public:
+    // Get a singleton instance
+    static SiteRegistry& getInstance() {
+        static SiteRegistry instance;
+        return instance;
+    }
+
+    /**
+     * Intern an author ID
+     *
+     * @param authorId The author ID to intern
+     * @return The site ID for the author, allocated on first use
+     */
+    SiteId intern(const std::string& authorId) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = ids_.find(authorId);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto [it, inserted] = ids_.try_emplace(authorId, static_cast<SiteId>(names_.size()));
+        if (inserted) {
+            names_.push_back(authorId);
+        }
+        return it->second;
+    }
+
+    /**
+     * Look up the author ID behind a site ID
+     *
+     * @param site The site ID
+     * @return The interned author ID; the reference stays valid for the process lifetime
+     */
+    const std::string& getAuthorId(SiteId site) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (site >= names_.size()) {
+            throw std::out_of_range("Unknown CRDT site ID");
+        }
+        return names_[site];
+    }
+
+    /**
+     * Order two sites consistently across replicas
+     *
+     * @param a The first site
+     * @param b The second site
+     * @return Negative, zero or positive as the author ID of a sorts before, equal to or after b's
+     */
+    int compare(SiteId a, SiteId b) const {
+        if (a == b) {
+            return 0;
+        }
+        return getAuthorId(a).compare(getAuthorId(b));
+    }
+
+private:
+    SiteRegistry() = default;
+    SiteRegistry(const SiteRegistry&) = delete;
+    SiteRegistry& operator=(const SiteRegistry&) = delete;
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, SiteId> ids_;
+    std::deque<std::string> names_;  // deque keeps references stable on growth
+};
+
+/**
+ * Sentinel for a position level that has not been claimed by a site yet
+ */
+constexpr SiteId NO_SITE = UINT32_MAX;
+
+/**
+ * One level of a dense position: a digit plus the site that allocated it
+ *
+ * The site keeps positions unique when two replicas concurrently pick the
+ * same digit between the same neighbours, so there is always room to
+ * allocate between any two distinct positions.
+ */
+struct PositionLevel {
+    int32_t digit = 0;
+    SiteId site = NO_SITE;
+
+    bool operator==(const PositionLevel& other) const {
+        return digit == other.digit && site == other.site;
+    }
+};
+
+/**
+ * Dense position identifier: a sequence of levels compared lexicographically
+ *
+ * Levels compare by digit first and allocating site second; a strict prefix
+ * sorts first. Positions up to INLINE_CAPACITY levels live inside the object,
+ * so the common case costs no allocation. Longer positions spill to the heap.
+ */
+class Position {
+public:
+    using value_type = PositionLevel;
+    using size_type = uint32_t;
+    using iterator = PositionLevel*;
+    using const_iterator = const PositionLevel*;
+
+    static constexpr size_type INLINE_CAPACITY = 4;
+
+    Position() noexcept {}
+
+    // Unclaimed levels; see stamp()
+    Position(std::initializer_list<int32_t> digits) {
+        assign(digits.begin(), digits.end());
+    }
+
+    template <typename InputIt,
+              typename = typename std::iterator_traits<InputIt>::iterator_category>
+    Position(InputIt first, InputIt last) {
+        assign(first, last);
+    }
+
+    explicit Position(const std::vector<int>& digits) {
+        assign(digits.begin(), digits.end());
+    }
+
+    Position(const Position& other) {
+        assign(other.begin(), other.end());
+    }
+
+    Position(Position&& other) noexcept {
+        steal(other);
+    }
+
+    Position& operator=(const Position& other) {
+        if (this != &other) {
+            size_ = 0;
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    Position& operator=(Position&& other) noexcept {
+        if (this != &other) {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    ~Position() {
+        release();
+    }
+
+    size_type size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool isInline() const { return capacity_ == INLINE_CAPACITY; }
+
+    PositionLevel* data() { return isInline() ? storage_.inline_ : storage_.heap_; }
+    const PositionLevel* data() const { return isInline() ? storage_.inline_ : storage_.heap_; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + size_; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size_; }
+
+    // Digit access, as used by the allocation strategies
+    int32_t& operator[](size_type index) { return data()[index].digit; }
+    int32_t operator[](size_type index) const { return data()[index].digit; }
+
+    SiteId siteAt(size_type index) const { return data()[index].site; }
+    int32_t back() const { return data()[size_ - 1].digit; }
+
+    void push_back(int32_t digit, SiteId site = NO_SITE) {
+        if (size_ == capacity_) {
+            reserve(capacity_ * 2);
+        }
+        data()[size_++] = PositionLevel{digit, site};
+    }
+
+    void reserve(size_type capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        auto* heap = new PositionLevel[capacity];
+        std::copy(begin(), end(), heap);
+        release();
+        storage_.heap_ = heap;
+        capacity_ = capacity;
+    }
+
+    /**
+     * Claim every unclaimed level for a site
+     *
+     * @param site The allocating site
+     */
+    void stamp(SiteId site) {
+        for (auto& level : *this) {
+            if (level.site == NO_SITE) {
+                level.site = site;
+            }
+        }
+    }
+
+    /**
+     * Compare two positions level by level; a strict prefix sorts first
+     *
+     * The levels both positions share are skipped as whole 64-bit words;
+     * digits and sites are only told apart at the first level that differs.
+     *
+     * @param other The position to compare against
+     * @return Negative, zero or positive
+     */
+    int compare(const Position& other) const {
+        const PositionLevel* a = data();
+        const PositionLevel* b = other.data();
+        const size_type minSize = std::min(size_, other.size_);
+        size_type i = 0;
+        while (i < minSize && bitsOf(a[i]) == bitsOf(b[i])) {
+            ++i;
+        }
+        if (i < minSize) {
+            return compareLevels(a[i].digit, a[i].site, b[i]);
+        }
+        if (size_ != other.size_) {
+            return size_ < other.size_ ? -1 : 1;
+        }
+        return 0;
+    }
+
+    /**
+     * Compare this position with its last digit advanced, as a run advances
+     * it, without building the advanced copy
+     *
+     * @param offset Added to the last digit of this position
+     * @param other The position to compare against
+     * @return Negative, zero or positive
+     */
+    int compareAdvanced(int32_t offset, const Position& other) const {
+        if (offset == 0 || empty()) {
+            return compare(other);
+        }
+        const PositionLevel* a = data();
+        const PositionLevel* b = other.data();
+        const size_type minSize = std::min(size_, other.size_);
+        // Only the last level is advanced; the ones before it compare bitwise
+        const size_type exact = std::min<size_type>(minSize, size_ - 1);
+        size_type i = 0;
+        while (i < exact && bitsOf(a[i]) == bitsOf(b[i])) {
+            ++i;
+        }
+        if (i < exact) {
+            return compareLevels(a[i].digit, a[i].site, b[i]);
+        }
+        if (exact < minSize) {
+            const int32_t digit = a[exact].digit + offset;
+            if (digit != b[exact].digit || a[exact].site != b[exact].site) {
+                return compareLevels(digit, a[exact].site, b[exact]);
+            }
+        }
+        if (size_ != other.size_) {
+            return size_ < other.size_ ? -1 : 1;
+        }
+        return 0;
+    }
+
+    /**
+     * Check whether this position, with its last digit advanced, equals another
+     *
+     * @param offset Added to the last digit of this position
+     * @param other The position to compare against
+     * @return True if they are equal, sites included
+     */
+    bool equalsAdvanced(int32_t offset, const Position& other) const {
+        if (size_ != other.size_) {
+            return false;
+        }
+        if (offset == 0 || empty()) {
+            return *this == other;
+        }
+        const PositionLevel& last = data()[size_ - 1];
+        const PositionLevel& otherLast = other.data()[size_ - 1];
+        return last.digit + offset == otherLast.digit && last.site == otherLast.site &&
+               std::equal(begin(), end() - 1, other.begin());
+    }
+
+    bool operator==(const Position& other) const {
+        return size_ == other.size_ && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const Position& other) const { return !(*this == other); }
+    bool operator<(const Position& other) const { return compare(other) < 0; }
+
+    std::vector<int> toVector() const {
+        std::vector<int> digits;
+        digits.reserve(size_);
+        for (const auto& level : *this) {
+            digits.push_back(level.digit);
+        }
+        return digits;
+    }
+
+private:
+    static uint64_t bitsOf(const PositionLevel& level) {
+        static_assert(sizeof(PositionLevel) == sizeof(uint64_t));
+        uint64_t bits;
+        std::memcpy(&bits, &level, sizeof(bits));
+        return bits;
+    }
+
+    // Order a level against one it differs from
+    static int compareLevels(int32_t digit, SiteId site, const PositionLevel& other) {
+        if (digit != other.digit) {
+            return digit < other.digit ? -1 : 1;
+        }
+        return compareSites(site, other.site);
+    }
+
+    static int compareSites(SiteId a, SiteId b) {
+        if (a == NO_SITE || b == NO_SITE) {
+            return a == NO_SITE ? -1 : 1;
+        }
+        return SiteRegistry::getInstance().compare(a, b);
+    }
+
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        const auto count = static_cast<size_type>(std::distance(first, last));
+        reserve(count);
+        PositionLevel* out = data();
+        for (; first != last; ++first, ++out) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(*first)>, PositionLevel>) {
+                *out = *first;
+            } else {
+                *out = PositionLevel{static_cast<int32_t>(*first), NO_SITE};
+            }
+        }
+        size_ = count;
+    }
+
+    void steal(Position& other) noexcept {
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        if (other.isInline()) {
+            std::copy(other.storage_.inline_, other.storage_.inline_ + other.size_, storage_.inline_);
+        } else {
+            storage_.heap_ = other.storage_.heap_;
+            other.capacity_ = INLINE_CAPACITY;
+        }
+        other.size_ = 0;
+    }
+
+    void release() noexcept {
+        if (!isInline()) {
+            delete[] storage_.heap_;
+            capacity_ = INLINE_CAPACITY;
+        }
+    }
+
+    union Storage {
+        Storage() {}
+        PositionLevel inline_[INLINE_CAPACITY];
+        PositionLevel* heap_;
+    } storage_;
+    size_type size_ = 0;
+    size_type capacity_ = INLINE_CAPACITY;
+};
+
+/**
+ * Globally unique, totally ordered identifier of a CRDT character
+ *
+ * Ordered by position first, then Lamport clock, then author. Comparisons are
+ * plain integer compares except where two different sites meet at the same
+ * digit, which is the only time author strings are consulted.
+ */
+struct Identifier {
+    Position position;
+    uint32_t clock = 0;
+    SiteId site = 0;
+
+    int compare(const Identifier& other) const {
+        return compareAt(0, other);
+    }
+
+    /**
+     * Compare advanced(offset) against another identifier without building it
+     * Binary searches inside a run probe this way, so a position deeper than
+     * the inline levels is not copied onto the heap per probe.
+     *
+     * @param offset Distance from this identifier within its run
+     * @param other The identifier to compare against
+     * @return Negative, zero or positive
+     */
+    int compareAt(uint32_t offset, const Identifier& other) const {
+        if (int cmp = position.compareAdvanced(static_cast<int32_t>(offset), other.position); cmp != 0) {
+            return cmp;
+        }
+        const uint32_t advancedClock = clock + offset;
+        if (advancedClock != other.clock) {
+            return advancedClock < other.clock ? -1 : 1;
+        }
+        return SiteRegistry::getInstance().compare(site, other.site);
+    }
+
+    // Whether advanced(offset) is other, without building it
+    bool advancesTo(uint32_t offset, const Identifier& other) const {
+        return site == other.site && clock + offset == other.clock &&
+               position.equalsAdvanced(static_cast<int32_t>(offset), other.position);
+    }
+
+    bool operator==(const Identifier& other) const {
+        return site == other.site && clock == other.clock && position == other.position;
+    }
+
+    bool operator<(const Identifier& other) const { return compare(other) < 0; }
+
+    /**
+     * Identifier of the character offset places further along the same run
+     *
+     * Runs advance the last position digit and the clock together, so every
+     * character of a run keeps a distinct identifier.
+     *
+     * @param offset Distance from this identifier within its run
+     * @return The advanced identifier
+     */
+    Identifier advanced(uint32_t offset) const {
+        Identifier result = *this;
+        if (offset != 0) {
+            result.position[result.position.size() - 1] += static_cast<int32_t>(offset);
+            result.clock += offset;
+        }
+        return result;
+    }
+};
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_IDENTIFIER_H
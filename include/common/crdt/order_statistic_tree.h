@@ -0,0 +1,356 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_ORDER_STATISTIC_TREE_H
+#define COLLABORATIVE_EDITOR_CRDT_ORDER_STATISTIC_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "common/util/memory_accounting.h"
+
+namespace collab {
+namespace crdt {
+
+/**
+ * Balanced sequence of items with logarithmic access by rank and by weight
+ *
+ * A treap ordered by position in the sequence. Every node caches the number
+ * of items and the total weight of its subtree, where an item's weight is
+ * whatever Item::weight() reports (for CRDT runs, the characters it
+ * contributes to the visible text). That turns "which item holds character
+ * i", "insert an item at rank r" and "search by a monotone predicate" into
+ * O(log n) operations instead of linear scans and tail shifts.
+ *
+ * Copies are O(1) and share structure: nodes and items are reference
+ * counted and cloned on first modification while shared, so a copy is an
+ * immutable snapshot that other threads can read while the original keeps
+ * changing at O(log n) extra cost per edit. Any single tree object still
+ * needs external synchronisation between a writer and its readers.
+ *
+ * Nodes and items are allocated through util::MemoryTag::CRDT.
+ */
+template <typename Item>
+class OrderStatisticTree {
+public:
+    // Item rank plus offset inside it; rank == size() means the end
+    struct Location {
+        size_t rank;
+        size_t offset;
+    };
+
+    OrderStatisticTree() = default;
+    OrderStatisticTree(const OrderStatisticTree&) = default;
+    OrderStatisticTree& operator=(const OrderStatisticTree&) = default;
+    OrderStatisticTree(OrderStatisticTree&&) noexcept = default;
+    OrderStatisticTree& operator=(OrderStatisticTree&&) noexcept = default;
+
+    // Get the number of items
+    size_t size() const { return countOf(root_); }
+
+    // Get the total weight of all items
+    size_t weight() const { return weightOf(root_); }
+
+    bool empty() const { return root_ == nullptr; }
+
+    void clear() { root_.reset(); }
+
+    /**
+     * Get the item at a rank
+     *
+     * @param rank The rank of the item
+     * @return The item
+     */
+    const Item& at(size_t rank) const {
+        const Node* node = root_.get();
+        while (node != nullptr) {
+            size_t leftCount = countOf(node->left);
+            if (rank < leftCount) {
+                node = node->left.get();
+            } else if (rank == leftCount) {
+                return *node->item;
+            } else {
+                rank -= leftCount + 1;
+                node = node->right.get();
+            }
+        }
+        throw std::out_of_range("OrderStatisticTree::at rank out of range");
+    }
+
+    /**
+     * Insert an item so that it ends up at a given rank
+     *
+     * @param rank The rank of the new item; at most size()
+     * @param item The item to insert
+     */
+    void insert(size_t rank, Item item) {
+        auto node = allocate<Node>(std::move(item), randomPriority());
+        update(node.get());
+        auto [left, right] = split(std::move(root_), rank);
+        root_ = merge(merge(std::move(left), std::move(node)), std::move(right));
+    }
+
+    /**
+     * Replace the contents with a sequence of items in linear time
+     *
+     * Builds the treap directly, keeping the nodes of the right spine on a
+     * stack, instead of paying O(log n) per insert; used to load snapshots.
+     *
+     * @param items The items in sequence order
+     */
+    void assign(std::vector<Item> items) {
+        std::vector<NodePtr> spine;
+        for (auto& item : items) {
+            auto node = allocate<Node>(std::move(item), randomPriority());
+            NodePtr last;
+            while (!spine.empty() && spine.back()->priority < node->priority) {
+                NodePtr top = std::move(spine.back());
+                spine.pop_back();
+                top->right = std::move(last);
+                update(top.get());
+                last = std::move(top);
+            }
+            node->left = std::move(last);
+            spine.push_back(std::move(node));
+        }
+        NodePtr last;
+        while (!spine.empty()) {
+            NodePtr top = std::move(spine.back());
+            spine.pop_back();
+            top->right = std::move(last);
+            update(top.get());
+            last = std::move(top);
+        }
+        root_ = std::move(last);
+    }
+
+    /**
+     * Erase the item at a rank
+     *
+     * @param rank The rank of the item to erase
+     */
+    void erase(size_t rank) {
+        auto [left, rest] = split(std::move(root_), rank);
+        auto [removed, right] = split(std::move(rest), 1);
+        root_ = merge(std::move(left), std::move(right));
+    }
+
+    /**
+     * Modify the item at a rank in place, refreshing cached weights
+     *
+     * @param rank The rank of the item
+     * @param fn Callable invoked with a mutable reference to the item
+     */
+    template <typename Fn>
+    void modify(size_t rank, Fn&& fn) {
+        if (rank >= size()) {
+            throw std::out_of_range("OrderStatisticTree::modify rank out of range");
+        }
+        modifyAt(root_, rank, fn);
+    }
+
+    /**
+     * Find the item holding a weighted index
+     *
+     * @param index Index into the concatenated weight of all items
+     * @return The rank of the holding item and the offset inside it, or {size(), 0} past the end
+     */
+    Location locate(size_t index) const {
+        const Node* node = root_.get();
+        size_t rank = 0;
+        while (node != nullptr) {
+            size_t leftWeight = weightOf(node->left);
+            if (index < leftWeight) {
+                node = node->left.get();
+                continue;
+            }
+            index -= leftWeight;
+            rank += countOf(node->left);
+            size_t itemWeight = node->item->weight();
+            if (index < itemWeight) {
+                return {rank, index};
+            }
+            index -= itemWeight;
+            rank += 1;
+            node = node->right.get();
+        }
+        return {size(), 0};
+    }
+
+    /**
+     * Get the total weight of the items ranked before rank
+     *
+     * @param rank The rank to measure up to
+     * @return Sum of weights of items [0, rank)
+     */
+    size_t weightBefore(size_t rank) const {
+        const Node* node = root_.get();
+        size_t total = 0;
+        while (node != nullptr) {
+            size_t leftCount = countOf(node->left);
+            if (rank <= leftCount) {
+                node = node->left.get();
+            } else {
+                total += weightOf(node->left) + node->item->weight();
+                rank -= leftCount + 1;
+                node = node->right.get();
+            }
+        }
+        return total;
+    }
+
+    /**
+     * Binary search by a predicate that holds for a prefix of the sequence
+     *
+     * @param pred Predicate over items, true for every item before the result
+     * @return Rank of the first item for which pred is false, or size()
+     */
+    template <typename Pred>
+    size_t partitionPoint(Pred&& pred) const {
+        const Node* node = root_.get();
+        size_t rank = 0;
+        while (node != nullptr) {
+            if (pred(*node->item)) {
+                rank += countOf(node->left) + 1;
+                node = node->right.get();
+            } else {
+                node = node->left.get();
+            }
+        }
+        return rank;
+    }
+
+    /**
+     * Visit every item in sequence order
+     *
+     * @param fn Callable invoked with a const reference to each item
+     */
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        std::vector<const Node*> stack;
+        const Node* node = root_.get();
+        while (node != nullptr || !stack.empty()) {
+            while (node != nullptr) {
+                stack.push_back(node);
+                node = node->left.get();
+            }
+            node = stack.back();
+            stack.pop_back();
+            fn(*node->item);
+            node = node->right.get();
+        }
+    }
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<Node>;
+
+    struct Node {
+        Node(Item value, uint32_t nodePriority)
+            : item(allocate<Item>(std::move(value)))
+            , priority(nodePriority) {}
+
+        std::shared_ptr<Item> item;  // Shared with snapshots until modified
+        uint32_t priority;  // Heap priority, parents always have higher priority
+        size_t count = 1;   // Items in the whole subtree
+        size_t weight = 0;  // Weight of the whole subtree
+        NodePtr left;
+        NodePtr right;
+    };
+
+    template <typename T, typename... Args>
+    static std::shared_ptr<T> allocate(Args&&... args) {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&util::memoryResource(util::MemoryTag::CRDT)),
+                                       std::forward<Args>(args)...);
+    }
+
+    // Make a node safe to modify, cloning it if a snapshot shares it
+    static void own(NodePtr& node) {
+        if (node.use_count() > 1) {
+            node = allocate<Node>(*node);
+        }
+    }
+
+    // Make a node's item safe to modify, cloning it if a snapshot shares it
+    static Item& ownItem(Node* node) {
+        if (node->item.use_count() > 1) {
+            node->item = allocate<Item>(*node->item);
+        }
+        return *node->item;
+    }
+
+    static uint32_t randomPriority() {
+        thread_local std::mt19937 rng(std::random_device{}());
+        return rng();
+    }
+
+    static size_t countOf(const NodePtr& node) { return node ? node->count : 0; }
+    static size_t weightOf(const NodePtr& node) { return node ? node->weight : 0; }
+
+    static void update(Node* node) {
+        node->count = countOf(node->left) + 1 + countOf(node->right);
+        node->weight = weightOf(node->left) + node->item->weight() + weightOf(node->right);
+    }
+
+    static NodePtr merge(NodePtr a, NodePtr b) {
+        if (!a) {
+            return b;
+        }
+        if (!b) {
+            return a;
+        }
+        if (a->priority > b->priority) {
+            own(a);
+            a->right = merge(std::move(a->right), std::move(b));
+            update(a.get());
+            return a;
+        }
+        own(b);
+        b->left = merge(std::move(a), std::move(b->left));
+        update(b.get());
+        return b;
+    }
+
+    // Split into the first rank items and the rest
+    static std::pair<NodePtr, NodePtr> split(NodePtr node, size_t rank) {
+        if (!node) {
+            return {nullptr, nullptr};
+        }
+        own(node);
+        size_t leftCount = countOf(node->left);
+        if (rank <= leftCount) {
+            auto [left, right] = split(std::move(node->left), rank);
+            node->left = std::move(right);
+            update(node.get());
+            return {std::move(left), std::move(node)};
+        }
+        auto [left, right] = split(std::move(node->right), rank - leftCount - 1);
+        node->right = std::move(left);
+        update(node.get());
+        return {std::move(node), std::move(right)};
+    }
+
+    template <typename Fn>
+    static void modifyAt(NodePtr& node, size_t rank, Fn& fn) {
+        own(node);
+        size_t leftCount = countOf(node->left);
+        if (rank < leftCount) {
+            modifyAt(node->left, rank, fn);
+        } else if (rank == leftCount) {
+            fn(ownItem(node.get()));
+        } else {
+            modifyAt(node->right, rank - leftCount - 1, fn);
+        }
+        update(node.get());
+    }
+
+    NodePtr root_;
+};
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_ORDER_STATISTIC_TREE_H
@@ -0,0 +1,284 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_POSITION_STRATEGY_H
+#define COLLABORATIVE_EDITOR_CRDT_POSITION_STRATEGY_H
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "common/crdt/identifier.h"
+
+namespace collab {
+namespace crdt {
+
+/**
+ * Allocation policy for dense positions
+ *
+ * between(p1, p2, count) proposes the position of the first character of a
+ * run of count characters between two neighbours, where an empty bound
+ * stands for the document start or end. The document validates the
+ * proposal, falls back if it does not fit and claims unclaimed levels for
+ * its site, so a policy only has to be good, not always right.
+ *
+ * Documents take the policy as a template parameter, so the insert path
+ * calls it directly; DynamicStrategy wraps the built-in policies for code
+ * that picks one at run time.
+ */
+template <typename T>
+concept PositionAllocator = requires(T& allocator, const Position& bound, size_t count) {
+    { allocator.between(bound, bound, count) } -> std::same_as<Position>;
+};
+
+namespace detail {
+
+// Random digits for the position policies; a small engine, as every document carries several
+class RandomDigits {
+public:
+    RandomDigits()
+        : engine_(std::random_device{}()) {}
+
+    // Restart the digits from a seed, so the positions proposed can be reproduced
+    void seed(uint32_t value) {
+        engine_.seed(value);
+    }
+
+    // Generate a random integer within the range [min, max]
+    int operator()(int min, int max) {
+        std::uniform_int_distribution<int> dist(min, max);
+        return dist(engine_);
+    }
+
+private:
+    std::minstd_rand engine_;
+};
+
+} // namespace detail
+
+/**
+ * Logoot: a random digit in the first gap between the neighbours
+ */
+class LogootStrategy {
+public:
+    Position between(const Position& p1, const Position& p2, size_t /*count*/) {
+        // Base case: if p1 is empty, generate a position before p2
+        if (p1.empty()) {
+            if (p2.empty()) {
+                // Both are empty, create a new position
+                return {randomInt(1, 100)};
+            }
+            // Before the first position
+            return {p2[0] / 2};
+        }
+
+        // Base case: if p2 is empty, generate a position after p1
+        if (p2.empty()) {
+            return {p1[0] + randomInt(1, 10)};
+        }
+
+        // Find the common prefix
+        size_t commonPrefixLen = 0;
+        while (commonPrefixLen < p1.size() &&
+               commonPrefixLen < p2.size() &&
+               p1[commonPrefixLen] == p2[commonPrefixLen]) {
+            commonPrefixLen++;
+        }
+
+        // Case 1: One position is a prefix of the other
+        if (commonPrefixLen == p1.size() && commonPrefixLen < p2.size()) {
+            Position newPos = p1;
+            newPos.push_back(p2[commonPrefixLen] / 2);
+            return newPos;
+        }
+
+        if (commonPrefixLen == p2.size()) {
+            Position newPos = p2;
+            newPos.push_back(randomInt(1, 10));
+            return newPos;
+        }
+
+        // Case 2: Positions differ at some point
+        if (p1[commonPrefixLen] + 1 < p2[commonPrefixLen]) {
+            // There's space between the two positions
+            Position newPos(p1.begin(), p1.begin() + commonPrefixLen);
+            newPos.push_back(p1[commonPrefixLen] + randomInt(1, p2[commonPrefixLen] - p1[commonPrefixLen] - 1));
+            return newPos;
+        } else {
+            // No space, need to add a level
+            Position newPos = p1;
+            newPos.push_back(randomInt(1, 10));
+            return newPos;
+        }
+    }
+
+    void seed(uint32_t value) { randomInt.seed(value); }
+
+private:
+    detail::RandomDigits randomInt;
+};
+
+/**
+ * WOOT-style allocation (simplified): one wide level, deeper only when full
+ */
+class WootStrategy {
+public:
+    Position between(const Position& p1, const Position& p2, size_t /*count*/) {
+        // For WOOT, we'll use a simpler approach
+        if (p1.empty() && p2.empty()) {
+            return {randomInt(1, 1000)};
+        } else if (p1.empty()) {
+            return {p2[0] - randomInt(1, 10)};
+        } else if (p2.empty()) {
+            return {p1[0] + randomInt(1, 10)};
+        } else {
+            // Need to ensure the new position is between p1 and p2
+            int minVal = p1[0] + 1;
+            int maxVal = p2[0] - 1;
+
+            if (minVal <= maxVal) {
+                // There's space, use it
+                return {randomInt(minVal, maxVal)};
+            } else {
+                // No space, create a new layer
+                Position newPos = p1;
+                newPos.push_back(randomInt(1, 1000));
+                return newPos;
+            }
+        }
+    }
+
+    void seed(uint32_t value) { randomInt.seed(value); }
+
+private:
+    detail::RandomDigits randomInt;
+};
+
+/**
+ * LSEQ: exponentially growing bases with a boundary strategy per depth
+ *
+ * Each depth doubles the base of the one above it, and each depth
+ * allocates either just after the left bound (boundary+) or just before
+ * the right bound (boundary-), chosen once per depth and at most BOUNDARY
+ * digits away. Whichever end editing concentrates on, one of the strategies
+ * leaves most of a level free for it, so positions stay logarithmic in the
+ * document size instead of growing with every insert.
+ */
+class LseqStrategy {
+public:
+    // The first level has 2^4 digits, each deeper level twice as many
+    static constexpr uint32_t INITIAL_BASE_BITS = 4;
+    static constexpr uint32_t MAX_BASE_BITS = 30;
+    static constexpr uint32_t MAX_DEPTH = 64;
+    static constexpr int64_t BOUNDARY = 10;
+
+    /**
+     * Propose a position between two bounds
+     *
+     * @param p1 The left bound, or empty for the document start
+     * @param p2 The right bound, or empty for the document end
+     * @param count Number of consecutive digits the run needs at its last level
+     * @return A position between p1 and p2; levels not copied from a bound are unclaimed
+     */
+    Position between(const Position& p1, const Position& p2, size_t count) {
+        const auto span = static_cast<int64_t>(count);
+        Position newPos;
+        bool followLeft = true;          // Levels so far equal p1's
+        bool followRight = !p2.empty();  // Levels so far equal p2's
+
+        for (uint32_t depth = 0; depth < MAX_DEPTH; ++depth) {
+            const int64_t base = int64_t(1) << std::min(INITIAL_BASE_BITS + depth, MAX_BASE_BITS);
+            const bool leftBounded = followLeft && depth < p1.size();
+            const int64_t low = leftBounded ? p1[depth] : 0;
+            const int64_t high = followRight && depth < p2.size() ? p2[depth] : std::max(base, low + 1);
+
+            // First digits that leave span consecutive digits strictly between low and high
+            const int64_t choices = high - low - span;
+            if (choices >= 1) {
+                const int64_t step = std::min<int64_t>(BOUNDARY, choices);
+                const int64_t offset = randomInt(1, static_cast<int>(step));
+                const int64_t digit = boundaryPlus(depth) ? low + offset : high - span + 1 - offset;
+                newPos.push_back(static_cast<int32_t>(digit));
+                return newPos;
+            }
+
+            // No room at this depth: follow the left bound down, or step just
+            // below the right one, which frees the next depth entirely
+            if (leftBounded) {
+                newPos.push_back(p1[depth], p1.siteAt(depth));
+                followRight = followRight && depth < p2.size() &&
+                              p2[depth] == p1[depth] && p2.siteAt(depth) == p1.siteAt(depth);
+            } else {
+                newPos.push_back(static_cast<int32_t>(high - 1));
+                followLeft = false;
+                followRight = false;
+            }
+        }
+        return newPos;
+    }
+
+    void seed(uint32_t value) { randomInt.seed(value); }
+
+private:
+    // Boundary+ or boundary- for a depth, drawn on first use
+    bool boundaryPlus(uint32_t depth) {
+        while (boundaryPlus_.size() <= depth) {
+            boundaryPlus_.push_back(randomInt(0, 1) == 1);
+        }
+        return boundaryPlus_[depth];
+    }
+
+    detail::RandomDigits randomInt;
+    std::vector<bool> boundaryPlus_;
+};
+
+/**
+ * Built-in policies selectable at run time
+ */
+enum class PositionStrategy {
+    LOGOOT,
+    WOOT,
+    LSEQ
+};
+
+/**
+ * Run-time choice between the built-in policies
+ *
+ * Keeps one instance of each, so switching back and forth keeps every
+ * policy's state, such as LSEQ's per-depth boundary choices.
+ */
+class DynamicStrategy {
+public:
+    void setStrategy(PositionStrategy strategy) { strategy_ = strategy; }
+    PositionStrategy getStrategy() const { return strategy_; }
+
+    // Seed every policy, each from its own value
+    void seed(uint32_t value) {
+        logoot_.seed(value);
+        woot_.seed(value + 1);
+        lseq_.seed(value + 2);
+    }
+
+    Position between(const Position& p1, const Position& p2, size_t count) {
+        switch (strategy_) {
+            case PositionStrategy::WOOT:
+                return woot_.between(p1, p2, count);
+            case PositionStrategy::LSEQ:
+                return lseq_.between(p1, p2, count);
+            case PositionStrategy::LOGOOT:
+            default:
+                return logoot_.between(p1, p2, count);
+        }
+    }
+
+private:
+    PositionStrategy strategy_ = PositionStrategy::LOGOOT;
+    LogootStrategy logoot_;
+    WootStrategy woot_;
+    LseqStrategy lseq_;
+};
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_POSITION_STRATEGY_H
@@ -0,0 +1,81 @@
+#ifndef COLLABORATIVE_EDITOR_CRDT_VERSION_VECTOR_H
+#define COLLABORATIVE_EDITOR_CRDT_VERSION_VECTOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "common/crdt/identifier.h"
+
+namespace collab {
+namespace crdt {
+
+/**
+ * Highest Lamport clock seen from each site
+ *
+ * Every character a site creates carries a larger clock than the ones before
+ * it, and a site's characters reach each replica in the order they were
+ * made, so "clock <= get(site)" tells whether a character has been seen.
+ * Two replicas can then exchange only what the other's vector does not
+ * include instead of their full state.
+ */
+class VersionVector {
+public:
+    using Entries = std::unordered_map<SiteId, uint32_t>;
+
+    uint32_t get(SiteId site) const {
+        auto it = entries_.find(site);
+        return it != entries_.end() ? it->second : 0;
+    }
+
+    uint32_t get(const std::string& authorId) const {
+        return get(SiteRegistry::getInstance().intern(authorId));
+    }
+
+    // Record that every clock up to clock has been seen from site
+    void observe(SiteId site, uint32_t clock) {
+        if (clock == 0) {
+            return;
+        }
+        uint32_t& current = entries_[site];
+        current = std::max(current, clock);
+    }
+
+    void observe(const std::string& authorId, uint32_t clock) {
+        observe(SiteRegistry::getInstance().intern(authorId), clock);
+    }
+
+    // Take the entry-wise maximum with another vector
+    void merge(const VersionVector& other) {
+        for (const auto& [site, clock] : other.entries_) {
+            observe(site, clock);
+        }
+    }
+
+    bool includes(SiteId site, uint32_t clock) const {
+        return clock <= get(site);
+    }
+
+    // Check whether this vector has seen everything other has
+    bool dominates(const VersionVector& other) const {
+        return std::all_of(other.entries_.begin(), other.entries_.end(),
+            [this](const auto& entry) { return get(entry.first) >= entry.second; });
+    }
+
+    const Entries& entries() const { return entries_; }
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    bool operator==(const VersionVector& other) const {
+        return entries_ == other.entries_;
+    }
+
+private:
+    Entries entries_;
+};
+
+} // namespace crdt
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CRDT_VERSION_VECTOR_H
@@ -0,0 +1,183 @@
+// FILE: include/common/document/change_feed.h
+// Description: Asynchronous feed of a document's applied operations
+
+#pragma once
+
+#include "common/ot/operation.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace collab {
+
+/**
+ * Hands a document's applied operations to subscribers on their own threads
+ *
+ * Change callbacks run inside the apply, with the document locked, so
+ * every listener's work adds to every edit's latency. A subscriber of the
+ * feed instead takes its events when it is ready, with take() or
+ * waitFor(); publishing an event only appends a pointer to each
+ * subscriber's queue, and no listener code runs on the publishing thread.
+ *
+ * Each event is an operation as applied, which is immutable and shared,
+ * with the revision it produced; nothing copies the document. Events are
+ * published in revision order.
+ *
+ * A subscriber that falls maxPending events behind has them coalesced into
+ * one gap: an event with no op, whose revision is the latest one it
+ * missed. Further events only move the gap's revision until the subscriber
+ * takes it. On a gap the subscriber reads the document whole, e.g. with
+ * DocumentController::getSnapshot(), and skips the events after it whose
+ * revision the snapshot already includes. A slow consumer thus costs the
+ * feed a bounded queue, never the publisher a wait.
+ *
+ * Thread-safe.
+ */
+class ChangeFeed {
+public:
+    /**
+     * Default number of events a subscriber may fall behind before they coalesce into a gap
+     */
+    static constexpr size_t DEFAULT_MAX_PENDING = 1024;
+
+    /**
+     * An applied operation
+     */
+    struct Event {
+        int64_t revision = 0;       // Revision it produced
+        ot::OperationPtr op;        // The operation as applied; null for a gap
+        std::string userId;         // Who it was applied for
+
+        bool isGap() const { return !op; }
+    };
+
+    /**
+     * One subscriber's queue; unsubscribes when the last reference goes
+     */
+    class Subscription {
+    public:
+        explicit Subscription(size_t maxPending)
+            : maxPending_(maxPending > 0 ? maxPending : 1) {}
+
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+        /**
+         * Take every event published since the last take, oldest first
+         *
+         * @return The events; empty if there are none
+         */
+        std::vector<Event> take() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return std::exchange(pending_, {});
+        }
+
+        /**
+         * Wait until an event is pending, then take them all
+         *
+         * @param timeout Longest to wait
+         * @return The events; empty on a timeout
+         */
+        template <typename Rep, typename Period>
+        std::vector<Event> waitFor(std::chrono::duration<Rep, Period> timeout) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait_for(lock, timeout, [this]() { return !pending_.empty(); });
+            return std::exchange(pending_, {});
+        }
+
+        // Number of gaps this subscriber has been sent, i.e. times it fell behind
+        uint64_t getGaps() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return gaps_;
+        }
+
+    private:
+        friend class ChangeFeed;
+
+        // Queue an event, coalescing into a gap once too many are pending
+        void push(const Event& event) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (pending_.size() == 1 && pending_.front().isGap()) {
+                    pending_.front().revision = event.revision;
+                    return;
+                }
+                if (pending_.size() >= maxPending_) {
+                    pending_.clear();
+                    pending_.push_back(Event{event.revision, nullptr, std::string()});
+                    ++gaps_;
+                } else {
+                    pending_.push_back(event);
+                }
+            }
+            ready_.notify_one();
+        }
+
+        const size_t maxPending_;
+        mutable std::mutex mutex_;
+        std::condition_variable ready_;
+        std::vector<Event> pending_;
+        uint64_t gaps_ = 0;
+    };
+
+    /**
+     * Subscribe to the events published from now on
+     *
+     * @param maxPending Events the subscriber may fall behind before they coalesce into a gap
+     * @return The subscription; dropping it unsubscribes
+     */
+    std::shared_ptr<Subscription> subscribe(size_t maxPending = DEFAULT_MAX_PENDING) {
+        auto subscription = std::make_shared<Subscription>(maxPending);
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers_.push_back(subscription);
+        subscriberCount_.store(subscribers_.size(), std::memory_order_relaxed);
+        return subscription;
+    }
+
+    /**
+     * Hand events to every subscriber; call in revision order
+     *
+     * @param events The events, oldest first
+     */
+    void publish(const std::vector<Event>& events) {
+        if (events.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t live = 0;
+        for (size_t i = 0; i < subscribers_.size(); ++i) {
+            std::shared_ptr<Subscription> subscriber = subscribers_[i].lock();
+            if (!subscriber) {
+                continue;
+            }
+            for (const auto& event : events) {
+                subscriber->push(event);
+            }
+            if (live != i) {
+                subscribers_[live] = std::move(subscribers_[i]);
+            }
+            ++live;
+        }
+        subscribers_.resize(live);
+        subscriberCount_.store(live, std::memory_order_relaxed);
+    }
+
+    // Whether anyone may be listening, without a lock; one that unsubscribed counts until the next publish
+    bool hasSubscribers() const {
+        return subscriberCount_.load(std::memory_order_relaxed) > 0;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::weak_ptr<Subscription>> subscribers_;
+    std::atomic<size_t> subscriberCount_{0};
+};
+
+} // namespace collab
@@ -4,7 +4,18 @@
 #pragma once
 
 #include "common/ot/operation.h"
+#include "common/ot/value_operation.h"
+#include "common/document/change_feed.h"
 #include "common/document/history_manager.h"
+#include "common/ot/annotation_store.h"
+#include "common/ot/checkpoint_store.h"
+#include "common/ot/content_hash.h"
+#include "common/ot/operation_log.h"
+#include "common/util/profiled_mutex.h"
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <span>
 #include <string>
 #include <memory>
 #include <mutex>
@@ -25,12 +36,83 @@ public:
      */
     using DocumentChangeCallback = std::function<void(const std::string&, int64_t)>;
     
+    /**
+     * Immutable view of the document at one revision
+     * Copying a snapshot is O(1) and later edits never change it
+     */
+    struct DocumentSnapshot {
+        ot::Rope content;
+        int64_t revision;
+    };
+    
+    /**
+     * Callback for document changes that receives a snapshot instead of a copy
+     */
+    using SnapshotCallback = std::function<void(const DocumentSnapshot&)>;
+    
+    /**
+     * Callback for each operation as it is applied
+     * OperationPtr: the operation as applied, valid for the document as it was just before it
+     * string: ID of the user it was applied for
+     * int64_t: revision it produced
+     */
+    using OperationCallback = std::function<void(const ot::OperationPtr&, const std::string&, int64_t)>;
+    
+    /**
+     * An edit received from a client, not yet transformed
+     */
+    struct Edit {
+        ot::OperationPtr op;
+        std::string userId;
+        int64_t baseRevision;
+    };
+    
+    /**
+     * Hashes of the document, for a copy of it to check it agrees (see ot::ContentHash)
+     */
+    struct ContentHashes {
+        uint64_t root = 0;          // Of the whole document
+        size_t length = 0;
+        int64_t revision = 0;
+        uint64_t prefix = 0;        // Of the prefix asked for
+        uint64_t suffix = 0;        // Of the suffix asked for
+    };
+    
+    /**
+     * The annotations of a viewport, with the revision their anchors are at
+     */
+    struct AnnotationView {
+        std::vector<ot::AnnotationStore::Annotation> annotations;
+        int64_t revision = 0;
+    };
+    
+    /**
+     * Load the document puts on the node, for finding hot documents
+     */
+    struct LoadStats {
+        uint64_t operationsApplied = 0;  // Edits, undos and redos applied
+        uint64_t transformNanos = 0;     // Time spent transforming edits against the log
+        size_t historyLength = 0;        // Operations retained in the log
+        size_t memoryBytes = 0;          // Estimate of the text and the log held
+    };
+    
     /**
      * Constructor
      * 
      * @param initialContent Initial content of the document
+     * @param logRetention Maximum number of operations kept for transforming late operations (default: 10000)
      */
-    explicit DocumentController(const std::string& initialContent = "");
+    explicit DocumentController(const std::string& initialContent = "", size_t logRetention = 10000);
+    
+    /**
+     * Constructor for a document that carries on from a revision, e.g. one moved from another node
+     * The log starts empty at the snapshot's revision, and operations
+     * applied from there take the revisions after it
+     * 
+     * @param snapshot Content and revision to start from
+     * @param logRetention Maximum number of operations kept for transforming late operations (default: 10000)
+     */
+    explicit DocumentController(const DocumentSnapshot& snapshot, size_t logRetention = 10000);
     
     /**
      * Apply an operation to the document
@@ -42,6 +124,28 @@ public:
      */
     bool applyOperation(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo = true);
     
+    /**
+     * Apply a value operation to the document
+     * 
+     * @param op Operation to apply
+     * @param userId ID of the user performing the operation
+     * @param recordForUndo Whether to record this operation for undo (default: true)
+     * @return true if successful, false otherwise
+     */
+    bool applyOperation(const ot::ValueOperation& op, const std::string& userId, bool recordForUndo = true);
+    
+    /**
+     * Transform and apply a batch of edits, in order, under one lock
+     * Each edit is transformed against everything before it, earlier edits of
+     * the batch included, and change callbacks run once for the whole batch
+     * 
+     * @param edits Edits to apply
+     * @param recordForUndo Whether to record the edits for undo (default: true)
+     * @return The applied operation for each edit, or nullptr where the edit
+     *         did not apply or its client must resync from a snapshot
+     */
+    std::vector<ot::OperationPtr> applyBatch(std::span<const Edit> edits, bool recordForUndo = true);
+    
     /**
      * Undo the last operation for a specific user
      * 
@@ -74,6 +178,17 @@ public:
      */
     bool canRedo(const std::string& userId) const;
     
+    /**
+     * Describe some rows of a user's history, e.g. for a history view
+     * See HistoryManager::entries(); holds the document lock, since it reads the log
+     * 
+     * @param userId ID of the user
+     * @param from First row
+     * @param count Rows wanted
+     * @return The counts and the rows that exist in that range
+     */
+    HistoryManager::HistoryPage historyEntries(const std::string& userId, size_t from, size_t count) const;
+    
     /**
      * Get the current document text
      * 
@@ -88,13 +203,190 @@ public:
      */
     int64_t getRevision() const;
     
+    /**
+     * Get the current document and revision as one consistent snapshot
+     * Holds the lock only for an O(1) copy, so readers do not stall writers
+     * 
+     * @return Snapshot of the current state
+     */
+    DocumentSnapshot getSnapshot() const;
+    
+    /**
+     * Get the document's hash, and those of a prefix and a suffix, at one revision
+     * The hash is kept current on every apply, so the root costs nothing
+     * and each end O(ot::ContentHash::CHUNK_SIZE + log n)
+     * 
+     * @param prefixLength Length of the prefix to hash, clamped to the document
+     * @param suffixLength Length of the suffix to hash, clamped to the document
+     * @return The hashes, with the length and revision they are of
+     */
+    ContentHashes getContentHashes(size_t prefixLength = 0, size_t suffixLength = 0) const;
+    
+    /**
+     * Anchor a comment or other annotation to a range of the document
+     * The anchors follow the text through every edit from here on, rebased
+     * in bulk when read (see ot::AnnotationStore)
+     * 
+     * @param start Where it starts
+     * @param end Where it ends, at or past start
+     * @param author Who made it
+     * @param text What it says
+     * @return Its ID
+     * @throws std::invalid_argument if the range does not fit the document
+     */
+    ot::AnnotationStore::Id addAnnotation(size_t start, size_t end, std::string author, std::string text);
+    
+    /**
+     * Drop an annotation
+     * 
+     * @param id Its ID
+     * @return false if there is no such annotation
+     */
+    bool removeAnnotation(ot::AnnotationStore::Id id);
+    
+    /**
+     * Get the annotations touching a viewport, e.g. to send a client only what it shows
+     * 
+     * @param from Where the viewport starts
+     * @param to Where it ends
+     * @return The annotations, sorted by start, and the revision they are anchored at
+     */
+    AnnotationView getAnnotations(size_t from, size_t to);
+    
+    /**
+     * Get the load counters
+     * 
+     * @return Counters since the document was created
+     */
+    LoadStats getLoadStats() const;
+    
+    /**
+     * Rebuild the document as it was at a past revision
+     * Starts from the nearest checkpoint and replays only the operations after it
+     * 
+     * @param revision The revision
+     * @return Snapshot at that revision, or std::nullopt if it can no longer be rebuilt
+     */
+    std::optional<DocumentSnapshot> materializeAt(int64_t revision) const;
+    
+    /**
+     * Get the oldest revision an edit may still be based on
+     * 
+     * @return First revision retained in the log
+     */
+    int64_t getOldestRevision() const;
+    
+    /**
+     * Get the operations applied since a revision, as they were applied
+     * 
+     * @param revision The revision to start from
+     * @return Operations [revision, getRevision()), oldest first, or std::nullopt
+     *         if the log no longer holds them all
+     */
+    std::optional<std::vector<ot::OperationPtr>> getOperationsSince(int64_t revision) const;
+    
+    /**
+     * Get a bounded run of the operations applied from a revision, e.g. to play history back
+     * Operations the log has spilled are paged back in
+     * 
+     * @param revision The revision to start from
+     * @param maxCount Most operations returned
+     * @return Operations [revision, min(revision + maxCount, getRevision())), oldest first,
+     *         or std::nullopt if they are neither logged nor spilled
+     */
+    std::optional<std::vector<ot::OperationPtr>> getOperationsFrom(int64_t revision, size_t maxCount) const;
+    
+    /**
+     * Bound the memory held for history
+     * Operations the log drops to stay in budget go to the spill file when one
+     * is given, and undo pages them back in, so deep undo still works
+     * 
+     * @param documentBytes Budget for the document's operation log; 0 for none
+     * @param userBytes Budget for each user's undo history; 0 for none
+     * @param spillPath File for operations dropped from memory; empty to discard them
+     * @throws std::runtime_error if the spill file cannot be created
+     */
+    void setHistoryBudget(size_t documentBytes, size_t userBytes, const std::filesystem::path& spillPath = {});
+    
+    /**
+     * Fold the operations below a revision into a checkpoint and release them
+     * Called with the low watermark once every client has acknowledged it;
+     * undo that reaches below it needs a spill (see setHistoryBudget)
+     * 
+     * @param revision First revision to keep in the log
+     */
+    void compactBefore(int64_t revision);
+    
+    /**
+     * Compress the document in memory while nobody edits it
+     * History is first compacted to the current revision, so the log and the
+     * checkpoints are released and only the compressed text stays resident.
+     * Reads decompress a copy and leave the document asleep; the next edit,
+     * undo or redo restores it. An edit based on an older revision must then
+     * resync, as after compactBefore()
+     * 
+     * @return false if the document was already compressed
+     */
+    bool hibernate();
+    
+    /**
+     * Compress the document if it has not been edited for a while, e.g. from a timer
+     * 
+     * @param idleFor How long since the last applied operation
+     * @return true if it was compressed now
+     */
+    bool hibernateIfIdle(std::chrono::steady_clock::duration idleFor);
+    
+    /**
+     * Check whether the document is held compressed
+     * 
+     * @return true between hibernate() and the next edit
+     */
+    bool isHibernating() const;
+    
+    /**
+     * Get the bytes the text takes in memory
+     * 
+     * @return The compressed size while hibernating, the text's length otherwise
+     */
+    size_t getTextBytes() const;
+    
+    /**
+     * Subscribe to every applied operation, undos and redos included, taken on the subscriber's own thread
+     * Events are handed over once the document is unlocked, so unlike the
+     * callbacks below, a listener never adds to the latency of an apply;
+     * one that falls behind is sent a gap instead (see ChangeFeed)
+     * 
+     * @param maxPending Events the subscriber may fall behind before they coalesce into a gap
+     * @return The subscription; dropping it unsubscribes
+     */
+    std::shared_ptr<ChangeFeed::Subscription> subscribeChanges(size_t maxPending = ChangeFeed::DEFAULT_MAX_PENDING);
+    
     /**
      * Register a callback for document changes
+     * Runs inside every apply with the document locked and copies the
+     * document each time; prefer subscribeChanges()
      * 
      * @param callback Function to call when document changes
      */
     void registerChangeCallback(DocumentChangeCallback callback);
     
+    /**
+     * Register a callback that receives a snapshot on every change
+     * Unlike registerChangeCallback, no copy of the document is made
+     * 
+     * @param callback Function to call when document changes
+     */
+    void registerSnapshotCallback(SnapshotCallback callback);
+    
+    /**
+     * Register a callback that receives every applied operation, undos and redos included
+     * Views that mirror the document apply these instead of reloading it on every change
+     * 
+     * @param callback Function to call with each operation
+     */
+    void registerOperationCallback(OperationCallback callback);
+    
     /**
      * Generate a unique operation ID
      * 
@@ -105,24 +397,83 @@ public:
     /**
      * Transform an operation against all operations in history
      * to make it applicable to the current document state
+     * Every client is transformed one log entry at a time, however far behind,
+     * so the result is the one its own client works out
      * 
      * @param op Operation to transform
      * @param baseRevision Revision on which the operation was created
-     * @return Transformed operation
+     * @return Transformed operation, or nullptr if the base revision has
+     *         left the log and the client must resync from a snapshot
      */
     ot::OperationPtr transformOperation(const ot::OperationPtr& op, int64_t baseRevision);
+    
+    /**
+     * Transform a value operation against all operations in history
+     * 
+     * @param op Operation to transform
+     * @param baseRevision Revision on which the operation was created
+     * @return Transformed operation, or std::nullopt if the client must resync or it is no
+     *         longer a single insert or delete; the OperationPtr overload takes it then
+     */
+    std::optional<ot::ValueOperation> transformOperation(const ot::ValueOperation& op, int64_t baseRevision);
 
 private:
-    std::string document_;
+    ot::Rope document_;
+    ot::OperationLog operationLog_;
     HistoryManager historyManager_;
-    std::vector<ot::OperationPtr> operationLog_;
-    std::mutex documentMutex_;
+    ot::CheckpointStore checkpoints_;
+    ot::ContentHash contentHash_;
+    ot::AnnotationStore annotations_;
+    mutable util::ProfiledMutex documentMutex_{"document_controller"};
     int64_t revision_;
     int64_t nextOperationId_;
+    uint64_t operationsApplied_ = 0;
+    uint64_t transformNanos_ = 0;
     DocumentChangeCallback changeCallback_;
+    SnapshotCallback snapshotCallback_;
+    OperationCallback operationCallback_;
+    ChangeFeed changeFeed_;
+    std::vector<ChangeFeed::Event> unpublished_;    // Applied under the lock, published after it
+    std::mutex publishMutex_;                       // Keeps publishing in revision order
+    std::chrono::steady_clock::time_point lastEdit_ = std::chrono::steady_clock::now();
+    
+    // The text while hibernating, deflated; document_ is empty meanwhile
+    struct Hibernated {
+        std::string compressed;
+        size_t length = 0;
+    };
+    std::optional<Hibernated> hibernated_;
+    
+    // Fold the log below a revision into a checkpoint (lock must be held)
+    void compactLocked(int64_t revision);
+    
+    // Compress the text and release the history (lock must be held)
+    bool hibernateLocked();
+    
+    // Restore a hibernating document before it changes (lock must be held)
+    void wakeLocked();
+    
+    // The content, decompressed into a copy if hibernating (lock must be held)
+    ot::Rope contentLocked() const;
+    
+    // Apply an operation that fits the current document (lock must be held)
+    bool applyLocked(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo);
+    
+    // Transform an operation against the log (lock must be held)
+    ot::OperationPtr transformLocked(const ot::OperationPtr& op, int64_t baseRevision);
+    
+    // Transform an undo or redo to the current revision and apply it (lock must be held)
+    // Returns the revision it was applied at, or -1 if it could not be applied
+    int64_t applyHistoryStep(const HistoryManager::Step& step, const std::string& userId);
+    
+    // Append an applied operation to the log and history (lock must be held)
+    void commitOperation(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo);
     
     // Notify about document changes
     void notifyDocumentChanged();
+    
+    // Unlock the document, then hand what was applied under the lock to the change feed's subscribers
+    void publishChanges(std::unique_lock<util::ProfiledMutex>& lock);
 };
 
 } // namespace collab
\ No newline at end of file
@@ -0,0 +1,120 @@
+// FILE: include/common/document/document_inbox.h
+// Description: Lock-free inbox of incoming edits for one document
+
+#pragma once
+
+#include "common/document/document_controller.h"
+#include "common/util/mpsc_queue.h"
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace collab {
+
+/**
+ * Inbox of incoming edits for one document
+ *
+ * I/O threads post decoded edits without taking a lock; one actor at a time
+ * drains them in batches, so a busy document is transformed and applied a
+ * batch per lock and broadcast once per batch instead of once per edit.
+ *
+ * post() tells the caller when the inbox went from idle to having work, and
+ * only then must the caller schedule drain() on its executor. A drain that
+ * leaves edits behind says so, and the caller schedules it again; until
+ * then later posts do not ask for another one.
+ */
+class DocumentInbox {
+public:
+    using Edit = DocumentController::Edit;
+
+    /**
+     * Default number of edits handed over per batch
+     */
+    static constexpr size_t DEFAULT_BATCH_SIZE = 256;
+
+    DocumentInbox() = default;
+    DocumentInbox(const DocumentInbox&) = delete;
+    DocumentInbox& operator=(const DocumentInbox&) = delete;
+
+    /**
+     * Queue an edit; may be called from any thread
+     *
+     * @param edit The edit
+     * @return true if the caller must schedule drain()
+     */
+    bool post(Edit edit) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        queue_.push(std::move(edit));
+        // Ordered after the push, as drain() orders its empty check after clearing the flag
+        return !scheduled_.exchange(true);
+    }
+
+    /**
+     * Take up to maxBatch queued edits and hand them over as one batch
+     * Only one drain may run at a time
+     *
+     * @param handleBatch Called with the edits, oldest first, unless there are none;
+     *        if it throws, the batch is lost and the caller must schedule drain() again
+     * @param maxBatch Most edits per batch
+     * @return true if edits remain and the caller must schedule drain() again
+     */
+    template <typename Fn>
+    bool drain(Fn&& handleBatch, size_t maxBatch = DEFAULT_BATCH_SIZE) {
+        batch_.clear();
+        while (batch_.size() < maxBatch) {
+            auto edit = queue_.tryPop();
+            if (!edit) {
+                break;
+            }
+            batch_.push_back(std::move(*edit));
+        }
+        pending_.fetch_sub(batch_.size(), std::memory_order_relaxed);
+        if (!batch_.empty()) {
+            handleBatch(std::span<Edit>(batch_));
+        }
+        if (batch_.size() == maxBatch) {
+            return true;
+        }
+        // A post after this either sees the flag cleared and schedules, or is already queued
+        scheduled_.store(false);
+        return !queue_.empty() && !scheduled_.exchange(true);
+    }
+
+    /**
+     * Drain a batch into a document: transform and apply it under one lock,
+     * then flush the results at once, e.g. as one broadcast
+     *
+     * @param document The document the edits are for
+     * @param flush Called with the batch and, for each edit, the applied operation or nullptr
+     * @param maxBatch Most edits per batch
+     * @return true if edits remain and the caller must schedule a drain again
+     */
+    template <typename Flush>
+    bool drainInto(DocumentController& document, Flush&& flush, size_t maxBatch = DEFAULT_BATCH_SIZE) {
+        return drain([&](std::span<Edit> edits) {
+            std::vector<ot::OperationPtr> applied = document.applyBatch(edits);
+            flush(std::span<const Edit>(edits), applied);
+        }, maxBatch);
+    }
+
+    /**
+     * Get the number of edits waiting, approximately while posts are under way
+     *
+     * @return Edits posted and not yet drained
+     */
+    size_t pending() const {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+private:
+    util::MpscQueue<Edit> queue_;
+    std::atomic<size_t> pending_{0};
+    // Set while a drain is scheduled or running
+    std::atomic<bool> scheduled_{false};
+    // Reused by each drain; only the draining actor touches it
+    std::vector<Edit> batch_;
+};
+
+} // namespace collab
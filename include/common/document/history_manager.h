@@ -4,52 +4,154 @@
 #pragma once
 
 #include "common/ot/operation.h"
+#include "common/ot/operation_log.h"
+#include "common/util/memory_accounting.h"
+#include <chrono>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <deque>
+#include <memory_resource>
 #include <mutex>
 #include <unordered_map>
 #include <string>
 
 namespace collab {
 
+/**
+ * Controls which consecutive edits of a user are undone together
+ */
+struct UndoGroupingPolicy {
+    std::chrono::milliseconds idleGap{500}; // A pause this long starts a new group; 0 disables grouping
+    bool breakAtWords = true;               // Typing or deleting into a new word starts a new group
+};
+
 /**
  * Manages operation history for undo/redo functionality
  * Thread-safe history management for collaborative editing
+ * 
+ * This is the one history engine: DocumentController runs it over the
+ * document's operation log for every user, and ot::UndoRedoManager over a
+ * log of its own for the local user. History holds no operations of its
+ * own: an entry is the range of revisions its operations were applied at
+ * in the log, and each user ID is interned once, so a user's history costs
+ * a few bytes per entry. An entry whose operations have left the log, and
+ * its spill if it has one, can no longer be undone; it is dropped when undo or redo reaches it and
+ * counted until then.
+ * 
+ * The stacks double as each user's index into the shared log: undo finds
+ * the user's operation without scanning, and what it returns is based on
+ * the revision right after that operation, so the caller transforms it
+ * against exactly the operations applied since.
+ * 
+ * Consecutive inserts typed one after another, and runs of backspaces or
+ * forward deletes, with nothing from anyone in between, extend the entry
+ * they continue, so a typed word is one entry and is undone at once.
+ * 
+ * Besides the entry count, a user's history can be held to a byte budget
+ * covering the text its entries insert or delete, so one user's large
+ * pastes cannot pin unbounded history. Operations the log has spilled to
+ * disk are paged back in when undo reaches that deep.
  */
 class HistoryManager {
 public:
+    using Clock = std::chrono::steady_clock;
+    
+    /**
+     * An undo or redo to apply once transformed to the current revision
+     * op is nullptr if there was nothing to undo or redo
+     */
+    struct Step {
+        ot::OperationPtr op;
+        int64_t baseRevision = 0;
+    };
+    
+    /**
+     * One entry of a user's history, as shown in a history view
+     */
+    struct EntryInfo {
+        int64_t first = 0;     // Revision of its first operation, or of its undo if undone
+        int64_t last = 0;      // Revision of its last operation, or of its undo if undone
+        size_t bytes = 0;      // Bytes it is accounted for; 0 if undone
+        bool undone = false;   // Whether it is waiting to be redone
+        ot::OperationPtr op;   // Its operations merged, or its undo; nullptr if they left the log's memory
+    };
+    
+    /**
+     * A window onto a user's history
+     * Rows run from the newest state down: the entries to redo, furthest
+     * first, then the entries to undo, the next undo first
+     */
+    struct HistoryPage {
+        size_t undoCount = 0;
+        size_t redoCount = 0;
+        std::vector<EntryInfo> entries;  // From the first row asked for, at most as many as asked
+    };
+    
     /**
      * Constructor
      * 
-     * @param maxHistorySize Maximum number of operations to keep in history (default: 1000)
+     * @param log The operation log the history refers to; must outlive the manager,
+     *        and its owner serializes access to it with calls into the manager
+     * @param maxHistorySize Maximum number of entries to keep in history per user (default: 1000)
+     * @param grouping Which consecutive operations share an entry
      */
-    explicit HistoryManager(size_t maxHistorySize = 1000);
+    explicit HistoryManager(const ot::OperationLog& log, size_t maxHistorySize = 1000, UndoGroupingPolicy grouping = {});
     
     /**
      * Record a new operation that was executed
+     * The logged operation of a delete must carry its deleted text, as returned by Operation::applyAndCapture
      * 
-     * @param op Operation to record
+     * @param revision Revision the operation was applied at in the operation log
      * @param userId ID of the user who performed the operation
-     * @param clearRedoHistory Whether to clear the redo stack (default: true)
+     * @param now Time the operation was made, for grouping
      */
-    void recordOperation(const ot::OperationPtr& op, const std::string& userId, bool clearRedoHistory = true);
+    void recordOperation(int64_t revision, const std::string& userId, Clock::time_point now = Clock::now());
     
     /**
      * Undo the last operation for a specific user
+     * Once applied, the undo must be recorded with recordUndo() to be redone
      * 
      * @param userId ID of the user performing the undo
-     * @return Inverse operation to apply, or nullptr if no operations to undo
+     * @return Inverse operation to apply and the revision it is based on
      */
-    ot::OperationPtr undo(const std::string& userId);
+    Step undo(const std::string& userId);
+    
+    /**
+     * Record an applied undo so it can be redone
+     * The logged operation must carry its deleted text, as returned by Operation::applyAndCapture
+     * 
+     * @param revision Revision the undo was applied at in the operation log
+     * @param userId ID of the user who performed the undo
+     */
+    void recordUndo(int64_t revision, const std::string& userId);
     
     /**
      * Redo a previously undone operation for a specific user
+     * Once applied, the redo must be recorded with recordRedo() to be undone again
      * 
      * @param userId ID of the user performing the redo
-     * @return Operation to apply for redo, or nullptr if no operations to redo
+     * @return Operation to apply for redo and the revision it is based on
      */
-    ot::OperationPtr redo(const std::string& userId);
+    Step redo(const std::string& userId);
+    
+    /**
+     * Record an applied redo so it can be undone again
+     * 
+     * @param revision Revision the redo was applied at in the operation log
+     * @param userId ID of the user who performed the redo
+     */
+    void recordRedo(int64_t revision, const std::string& userId);
+    
+    /**
+     * Transform a step against every operation logged after its base revision
+     * For owners without a faster transform of their own
+     * 
+     * @param step The step
+     * @return The step's operation, applicable to the log head, or nullptr if it
+     *         is no longer logged or does not transform
+     */
+    ot::OperationPtr rebase(const Step& step) const;
     
     /**
      * Check if undo is available for a specific user
@@ -68,21 +170,33 @@ public:
     bool canRedo(const std::string& userId) const;
     
     /**
-     * Get number of operations that can be undone for a specific user
+     * Get number of entries that can be undone for a specific user
      * 
      * @param userId ID of the user
-     * @return Count of undoable operations
+     * @return Count of undoable entries
      */
     size_t undoCount(const std::string& userId) const;
     
     /**
-     * Get number of operations that can be redone for a specific user
+     * Get number of entries that can be redone for a specific user
      * 
      * @param userId ID of the user
-     * @return Count of redoable operations
+     * @return Count of redoable entries
      */
     size_t redoCount(const std::string& userId) const;
     
+    /**
+     * Describe some rows of a user's history, e.g. those a view shows
+     * Costs the rows asked for, however long the history; operations are
+     * looked up in the log's memory only, never paged in from a spill
+     * 
+     * @param userId ID of the user
+     * @param from First row, 0 being the furthest redo or, without one, the next undo
+     * @param count Rows wanted
+     * @return The counts and the rows that exist in that range
+     */
+    HistoryPage entries(const std::string& userId, size_t from, size_t count) const;
+    
     /**
      * Clear history for a specific user
      * 
@@ -96,25 +210,87 @@ public:
     void clearAllHistory();
     
     /**
-     * Get the total number of operations in the history
+     * Get the total number of entries in the history
      * 
-     * @return Total operation count
+     * @return Total entry count
      */
     size_t totalOperationCount() const;
-
+    
+    /**
+     * Change how consecutive operations are grouped
+     * 
+     * @param grouping New grouping policy
+     */
+    void setGroupingPolicy(UndoGroupingPolicy grouping);
+    
+    /**
+     * Hold each user's undo history to a byte budget, dropping the oldest entries first
+     * The newest entry is kept even if it alone exceeds the budget
+     * 
+     * @param bytesPerUser Budget per user in bytes; 0 for none
+     */
+    void setByteBudget(size_t bytesPerUser);
+    
+    /**
+     * Get the bytes a user's undo history is accounted for
+     * 
+     * @param userId ID of the user
+     * @return Accounted bytes
+     */
+    size_t historyBytes(const std::string& userId) const;
+    
 private:
+    // Revisions of consecutive operations undone together, and the bytes they account for
+    struct Entry {
+        int64_t first;
+        int64_t last;
+        size_t bytes;
+    };
+    
+    // Undo and redo stacks of one user, as log revisions of their operations and of the undos that reverted them
+    // The stacks count towards util::MemoryTag::HISTORY
+    struct UserHistory {
+        std::pmr::deque<Entry> undoStack{&util::memoryResource(util::MemoryTag::HISTORY)};
+        std::pmr::deque<int64_t> redoStack{&util::memoryResource(util::MemoryTag::HISTORY)};
+        size_t bytes = 0;        // Sum over undoStack
+        // Whether the top undo entry may still be extended, and since when
+        bool groupOpen = false;
+        Clock::time_point lastRecorded;
+    };
+    
+    const ot::OperationLog& log_;
+    
     // Maximum history size per user
     const size_t maxHistorySize_;
+    UndoGroupingPolicy grouping_;
+    size_t byteBudget_ = 0;
     
-    // Maps users to their undo and redo stacks
-    std::unordered_map<std::string, std::deque<ot::OperationPtr>> userUndoStacks_;
-    std::unordered_map<std::string, std::deque<ot::OperationPtr>> userRedoStacks_;
+    // Interned user IDs, indexing users_
+    // A deque, since growing never copies the histories, which would take them off their resource
+    std::unordered_map<std::string, uint32_t> userIndices_;
+    std::deque<UserHistory> users_;
     
     // Mutex for thread safety
     mutable std::mutex historyMutex_;
     
-    // Trim history if it exceeds the maximum size
-    void trimUserHistory(const std::string& userId);
+    // Get a user's history, interning the ID on first use
+    UserHistory& historyOf(const std::string& userId);
+    
+    // Get a user's history, or nullptr if the user has none
+    UserHistory* findHistory(const std::string& userId);
+    const UserHistory* findHistory(const std::string& userId) const;
+    
+    // Whether an operation logged right after the top entry continues it
+    bool continuesGroup(const UserHistory& history, int64_t revision, Clock::time_point now) const;
+    
+    // Start a new entry on top of a user's undo stack
+    void pushEntry(UserHistory& history, int64_t revision);
+    
+    // The operations of an entry merged into one; nullptr if they left the log, or its memory unless pageIn
+    ot::OperationPtr merge(const Entry& entry, bool pageIn = true) const;
+    
+    // Trim history if it exceeds the maximum size or the byte budget
+    void trimUserHistory(UserHistory& history);
 };
 
-} // namespace collab
\ No newline at end of file
+} // namespace collab
@@ -4,6 +4,12 @@
 #pragma once
 
 #include "common/ot/operation.h"
+#include "common/ot/value_operation.h"
+#include "common/ot/operation_log.h"
+#include "common/ot/region_set.h"
+#include "common/util/profiled_mutex.h"
+#include <chrono>
+#include <optional>
 #include <string>
 #include <memory>
 #include <vector>
@@ -15,13 +21,46 @@ namespace collab {
 /**
  * Manages operations for collaborative editing
  * Handles operation sequencing, transformation, and conflict resolution
+ * 
+ * Every incoming operation is transformed one log entry at a time, however far
+ * behind its client is, so the result is the one that client works out.
+ * 
+ * Regions of the document may be marked read-only (see ot::RegionSet).
+ * They move with every recorded operation, and an incoming operation
+ * that would touch one is rejected once it is transformed, at the cost
+ * of a binary search.
  */
 class OperationManager {
 public:
+    /**
+     * Log and watermark metrics
+     */
+    struct WatermarkStats {
+        size_t logLength = 0;              // Operations retained in the log
+        int64_t currentRevision = 0;
+        int64_t lowWatermark = 0;
+        size_t trackedClients = 0;
+        std::string laggingClient;         // Client holding the watermark back; empty if nobody lags
+        uint64_t releasedOperations = 0;   // Operations released from the log so far
+    };
+    
+    /**
+     * Load counters, for finding hot documents
+     */
+    struct LoadStats {
+        uint64_t operationsProcessed = 0;    // Operations processed, whether or not they needed transforming
+        uint64_t operationsTransformed = 0;  // Of which were behind and were transformed
+        uint64_t transformNanos = 0;         // Time spent transforming them
+        uint64_t operationsLocked = 0;       // Rejected for touching a read-only region
+        size_t historyLength = 0;            // Operations retained in the log
+    };
+    
     /**
      * Constructor
+     * 
+     * @param logRetention Maximum number of operations kept for transforming late clients (default: 10000)
      */
-    OperationManager();
+    explicit OperationManager(size_t logRetention = 10000);
     
     /**
      * Process an incoming operation, transform it if necessary,
@@ -30,13 +69,73 @@ public:
      * @param op The incoming operation
      * @param clientId ID of the client that sent the operation
      * @param baseRevision The revision the operation was created on
-     * @return Transformed operation ready for application
+     * @return Transformed operation ready for application, or nullptr if the
+     *         base revision is no longer in the log and the client must resync
+     *         from a snapshot, or if it touches a read-only region
      */
     ot::OperationPtr processOperation(
         const ot::OperationPtr& op, 
         const std::string& clientId,
         int64_t baseRevision);
     
+    /**
+     * Process an incoming operation, rejecting it if it touches a read-only region
+     * 
+     * @param op The incoming operation
+     * @param clientId ID of the client that sent the operation
+     * @param baseRevision The revision the operation was created on
+     * @param lockedBy Set to the region it touched, if it was rejected for that
+     * @return Transformed operation ready for application, or nullptr if the
+     *         client must resync or the operation touched a read-only region
+     */
+    ot::OperationPtr processOperation(
+        const ot::OperationPtr& op, 
+        const std::string& clientId,
+        int64_t baseRevision,
+        std::optional<ot::RegionSet::Region>& lockedBy);
+    
+    /**
+     * Process an incoming value operation
+     * Transforms against the history in place without allocating per step
+     * 
+     * @param op The incoming operation
+     * @param clientId ID of the client that sent the operation
+     * @param baseRevision The revision the operation was created on
+     * @return Transformed operation ready for application, or std::nullopt if
+     *         the client must resync from a snapshot, it touches a read-only region,
+     *         or it became a delete split by an insert inside it, which only the
+     *         OperationPtr overload can return
+     */
+    std::optional<ot::ValueOperation> processOperation(
+        const ot::ValueOperation& op, 
+        const std::string& clientId,
+        int64_t baseRevision);
+    
+    // Process an incoming value operation, rejecting it if it touches a read-only region
+    std::optional<ot::ValueOperation> processOperation(
+        const ot::ValueOperation& op, 
+        const std::string& clientId,
+        int64_t baseRevision,
+        std::optional<ot::RegionSet::Region>& lockedBy);
+    
+    /**
+     * Annotate a range of the document as of the current revision
+     * 
+     * @param start Where it starts
+     * @param end Where it ends, past start
+     * @param attributes What it is, e.g. ot::RegionSet::READ_ONLY
+     * @param label A name for it, e.g. "template"
+     * @return Its ID
+     * @throws std::invalid_argument if the range is empty
+     */
+    ot::RegionSet::Id addRegion(size_t start, size_t end, ot::RegionSet::Attributes attributes, std::string label = {});
+    
+    // Drop a region; false if it is not there
+    bool removeRegion(ot::RegionSet::Id id);
+    
+    // The regions as of the current revision, sorted by start
+    std::vector<ot::RegionSet::Region> getRegions() const;
+    
     /**
      * Record an applied operation
      * 
@@ -44,18 +143,98 @@ public:
      */
     void recordOperation(const ot::OperationPtr& op);
     
+    /**
+     * Record an applied value operation
+     * 
+     * @param op The operation that was applied
+     */
+    void recordOperation(const ot::ValueOperation& op);
+    
     /**
      * Get current revision number
      * 
      * @return Current revision
      */
     int64_t getCurrentRevision() const;
+    
+    /**
+     * Record that a client has seen every operation up to a revision
+     * Also call this when a client joins from a snapshot, so the log keeps
+     * the operations it will need
+     * 
+     * A client's revision never moves back; acks that arrive out of order are ignored
+     * 
+     * @param clientId ID of the client
+     * @param revision Latest revision the client has applied
+     * @return The low watermark afterwards, for the caller to compact its own state to
+     */
+    int64_t acknowledgeRevision(const std::string& clientId, int64_t revision);
+    
+    /**
+     * Stop tracking a disconnected client so it no longer holds back the watermark
+     * 
+     * @param clientId ID of the client
+     * @return The low watermark afterwards
+     */
+    int64_t removeClient(const std::string& clientId);
+    
+    /**
+     * Get the lowest revision any tracked client still builds on
+     * Operations below it have been released from the log
+     * 
+     * @return Low watermark, or the current revision when no clients are tracked
+     */
+    int64_t getLowWatermark() const;
+    
+    /**
+     * Check whether a client at a revision has to resync from a snapshot
+     * 
+     * @param baseRevision The client's revision
+     * @return true if the log no longer covers the revision
+     */
+    bool needsResync(int64_t baseRevision) const;
+    
+    /**
+     * Get the log length and what holds the watermark back
+     * 
+     * @return Current metrics
+     */
+    WatermarkStats getWatermarkStats() const;
+    
+    /**
+     * Get the load counters
+     * 
+     * @return Counters since the manager was created
+     */
+    LoadStats getLoadStats() const;
 
 private:
-    std::vector<ot::OperationPtr> operationHistory_;
+    ot::OperationLog operationHistory_;
     int64_t currentRevision_;
+    uint64_t releasedOperations_ = 0;
+    uint64_t operationsProcessed_ = 0;
+    uint64_t operationsTransformed_ = 0;
+    uint64_t transformNanos_ = 0;
+    uint64_t operationsLocked_ = 0;
     std::unordered_map<std::string, int64_t> clientRevisions_;
-    mutable std::mutex mutex_;
+    ot::RegionSet regions_;
+    mutable util::ProfiledMutex mutex_{"operation_manager"};
+    
+    // Update a client's revision and release log entries every client has passed
+    void trackClientRevision(const std::string& clientId, int64_t revision);
+    
+    // Release log entries below the watermark and return it (mutex_ must be held)
+    int64_t releaseBelowWatermark();
+    
+    // Count a transform that began at started and report its time (mutex_ must be held)
+    void recordTransform(int64_t distance, std::chrono::steady_clock::time_point started);
+    
+    // Whether an operation at the current revision touches a read-only region, and which (mutex_ must be held)
+    bool touchesLocked(const ot::Operation& op, std::optional<ot::RegionSet::Region>& lockedBy);
+    bool touchesLocked(const ot::ValueOperation& op, std::optional<ot::RegionSet::Region>& lockedBy);
+    
+    // Minimum tracked client revision (mutex_ must be held)
+    int64_t lowWatermarkLocked() const;
     
     /**
      * Transform an operation against all operations between
@@ -68,6 +247,18 @@ private:
     ot::OperationPtr transformOperation(
         const ot::OperationPtr& op, 
         int64_t baseRevision);
+    
+    /**
+     * Transform a value operation against all operations between
+     * baseRevision and currentRevision
+     * 
+     * @param op Operation to transform
+     * @param baseRevision Base revision of the operation
+     * @return Transformed operation; std::nullopt if it is no longer a single insert or delete
+     */
+    std::optional<ot::ValueOperation> transformOperation(
+        const ot::ValueOperation& op, 
+        int64_t baseRevision);
 };
 
 } // namespace collab
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef COLLABORATIVE_EDITOR_FILE_SYSTEM_H
 #define COLLABORATIVE_EDITOR_FILE_SYSTEM_H
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 #include <memory>
@@ -8,6 +12,12 @@
 #include <chrono>
 #include <optional>
 #include <filesystem>
+#include <string_view>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+#include "common/util/chunked_io.h"
 
 namespace collab {
 namespace fs {
@@ -17,8 +27,31 @@ class FileSystemNode;
 class File;
 class Directory;
 
+/**
+ * Every node of one tree by its path below the tree's root, e.g. "docs/a.txt"
+ * Shared by all the nodes of the tree; entries are checked against the node
+ * they name when looked up, so a stale one is only a miss
+ */
+struct PathIndex {
+    std::weak_ptr<Directory> root;
+    std::shared_mutex mutex;        // Guards nodes; never held while taking another lock
+    std::unordered_map<std::string, std::weak_ptr<FileSystemNode>> nodes;
+    std::atomic<uint64_t> epoch{0}; // Bumped by every rename or move, which outdates the cached paths
+};
+
 /**
  * Base class for file system nodes (files and directories)
+ * 
+ * A node's path is built once from its parent's and cached until it or
+ * an ancestor is renamed or moved, so getPath() is O(1) after the first
+ * call rather than a walk to the root.
+ * 
+ * The tree is safe to use from several threads at once. Each node guards
+ * its name, owner, parent and cached path with a mutex of its own, held
+ * only while those are read or written, never while taking another lock;
+ * getters return copies. A cached path is tagged with the epoch of the
+ * tree's index it was built at, so a rename outdates every cached path of
+ * the tree by bumping one counter instead of visiting the subtree.
  */
 class FileSystemNode : public std::enable_shared_from_this<FileSystemNode> {
 public:
@@ -39,23 +72,36 @@ public:
     virtual ~FileSystemNode() = default;
 
     // Common properties
-    const std::string& getName() const { return name_; }
-    void setName(const std::string& name) { name_ = name; }
+    std::string getName() const {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        return name_;
+    }
+    void setName(const std::string& name);
     
-    const std::string& getOwner() const { return owner_; }
-    void setOwner(const std::string& owner) { owner_ = owner; }
+    std::string getOwner() const {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        return owner_;
+    }
+    void setOwner(const std::string& owner) {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        owner_ = owner;
+    }
     
     Type getType() const { return type_; }
     
     std::chrono::system_clock::time_point getCreatedTime() const { return createdTime_; }
     
-    std::chrono::system_clock::time_point getModifiedTime() const { return modifiedTime_; }
-    void updateModifiedTime() { modifiedTime_ = std::chrono::system_clock::now(); }
+    std::chrono::system_clock::time_point getModifiedTime() const { return modifiedTime_.load(); }
+    // Also brings the latest modified time of every directory above up to it
+    void updateModifiedTime();
     
     // Polymorphic methods
     virtual std::size_t getSize() const = 0;
     virtual std::string getPath() const = 0;
     
+    // Path below the root of the node's tree, e.g. "docs/a.txt"; empty for the root
+    std::string getRelativePath() const { return paths().relative; }
+    
     // Type checking helpers
     bool isFile() const { return type_ == Type::File; }
     bool isDirectory() const { return type_ == Type::Directory; }
@@ -65,47 +111,123 @@ public:
     std::shared_ptr<Directory> asDirectory();
     
     // Parent directory
-    std::weak_ptr<Directory> getParent() const { return parent_; }
-    void setParent(std::weak_ptr<Directory> parent) { parent_ = parent; }
+    std::weak_ptr<Directory> getParent() const {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        return parent_;
+    }
+    void setParent(std::weak_ptr<Directory> parent);
 
 protected:
+    friend class Directory;
+
+    struct Paths {
+        std::string absolute;
+        std::string relative;
+    };
+    
+    // The cached paths, built from the parent's if they are stale
+    Paths paths() const;
+    
+    std::string cachedPath() const { return paths().absolute; }
+    
+    // The index of the tree the node is in, or null
+    std::shared_ptr<PathIndex> indexOf() const {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        return pathIndex_;
+    }
+    
+    // Outdate the cached paths of the node's tree
+    static void bumpEpoch(const std::shared_ptr<PathIndex>& index) {
+        if (index) {
+            index->epoch.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+    
+    // Enter a subtree into a tree's index, or take it out
+    static void indexSubtree(const std::shared_ptr<FileSystemNode>& node, const std::shared_ptr<PathIndex>& index);
+    static void unindexSubtree(const std::shared_ptr<FileSystemNode>& node);
+    
+    // Raise a time to at least another
+    static void raise(std::atomic<std::chrono::system_clock::time_point>& time,
+                      std::chrono::system_clock::time_point to) {
+        auto current = time.load();
+        while (current < to && !time.compare_exchange_weak(current, to)) {
+        }
+    }
+    
+    static constexpr uint64_t NO_EPOCH = UINT64_MAX;
+
+    // Guards the members below that are not atomic; a leaf lock
+    mutable std::mutex nodeMutex_;
     std::string name_;
     std::string owner_;
-    Type type_;
-    std::chrono::system_clock::time_point createdTime_;
-    std::chrono::system_clock::time_point modifiedTime_;
+    const Type type_;
+    const std::chrono::system_clock::time_point createdTime_;
+    std::atomic<std::chrono::system_clock::time_point> modifiedTime_;
     std::weak_ptr<Directory> parent_;
+    std::shared_ptr<PathIndex> pathIndex_;   // Index of the tree the node is in, once it is in one
+    
+    mutable std::string cachedPath_;
+    mutable std::string cachedRelativePath_;
+    mutable uint64_t cachedEpoch_ = NO_EPOCH;  // Epoch of pathIndex_ the cached paths were built at
 };
 
 /**
  * Class representing a directory in the collaborative editor
+ * 
+ * Adding, renaming and removing nodes keeps the tree's PathIndex up to
+ * date, so getNodeByPath() is one hash lookup rather than a walk down the
+ * tree, one component at a time.
+ * 
+ * The size, file count and latest modified time of the subtree are kept
+ * as running totals, adjusted up the parent chain when a file's content
+ * changes or a node is added or removed, so reading them is O(1).
+ * 
+ * Children are kept in one vector sorted by name: lookups are a binary
+ * search, and listings come out in order a page at a time.
+ * 
+ * Each directory guards its children with a reader-writer lock of its
+ * own, so lookups and listings in one directory run in parallel and only
+ * wait for changes to that same directory, not for a rename in another
+ * project. A change locks the directory it is made in, then the
+ * directories below it when it has to re-index a subtree: locks are only
+ * ever nested parent before child. The totals are atomic and carried up
+ * the parent chain one directory at a time, without holding any of the
+ * directories' locks.
  */
 class Directory : public FileSystemNode {
 public:
+    // A child under the name this directory knows it by
+    struct Entry {
+        std::string name;
+        std::shared_ptr<FileSystemNode> node;
+    };
+    
     Directory(const std::string& name, const std::string& owner)
-        : FileSystemNode(name, owner, Type::Directory) {}
+        : FileSystemNode(name, owner, Type::Directory)
+        , latestModifiedTime_(createdTime_) {}
     
     // Implementation of abstract methods
-    std::size_t getSize() const override;
+    std::size_t getSize() const override { return totalSize_.load(); }
     std::string getPath() const override;
+    
+    // Subtree aggregates
+    std::size_t getFileCount() const { return fileCount_.load(); }
+    
+    // Latest modification of the directory or anything below it
+    std::chrono::system_clock::time_point getLatestModifiedTime() const { return latestModifiedTime_.load(); }
 
     // Node management
     bool addNode(std::shared_ptr<FileSystemNode> node);
     
-    bool removeNode(const std::string& name) {
-        auto it = children_.find(name);
-        if (it != children_.end()) {
-            children_.erase(it);
-            updateModifiedTime();
-            return true;
-        }
-        return false;
-    }
+    // The removed node keeps its subtree but leaves this tree; it has no parent after
+    bool removeNode(const std::string& name);
     
-    std::shared_ptr<FileSystemNode> getNode(const std::string& name) const {
-        auto it = children_.find(name);
-        if (it != children_.end()) {
-            return it->second;
+    std::shared_ptr<FileSystemNode> getNode(std::string_view name) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = findChild(name);
+        if (it != children_.end() && it->name == name) {
+            return it->node;
         }
         return nullptr;
     }
@@ -118,31 +240,121 @@ public:
     
     std::shared_ptr<Directory> createDirectory(const std::string& name, const std::string& owner);
     
-    // Directory content access
+    // Directory content access, sorted by name
     std::vector<std::shared_ptr<FileSystemNode>> getChildren() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
         std::vector<std::shared_ptr<FileSystemNode>> result;
-        for (const auto& pair : children_) {
-            result.push_back(pair.second);
+        result.reserve(children_.size());
+        for (const auto& entry : children_) {
+            result.push_back(entry.node);
         }
         return result;
     }
     
+    /**
+     * A page of the children, by position
+     * A copy, so it stays valid while the directory changes
+     * 
+     * @param offset Position of the first child
+     * @param limit Most children returned
+     * @return The children, sorted by name
+     */
+    std::vector<Entry> listChildren(std::size_t offset, std::size_t limit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return page(children_.begin() + static_cast<std::ptrdiff_t>(std::min(offset, children_.size())), limit);
+    }
+    
+    /**
+     * The page of children after a cursor, which stays stable while others are added or removed
+     * A copy, so it stays valid while the directory changes
+     * 
+     * @param after Name of the last child of the previous page; empty for the first page
+     * @param limit Most children returned
+     * @return The children named after the cursor, sorted by name
+     */
+    std::vector<Entry> listChildren(std::string_view after, std::size_t limit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = after.empty() ? children_.begin() : findChild(after);
+        if (it != children_.end() && !after.empty() && it->name == after) {
+            ++it;
+        }
+        return page(it, limit);
+    }
+    
     std::vector<std::shared_ptr<File>> getFiles() const;
     std::vector<std::shared_ptr<Directory>> getSubdirectories() const;
     
-    bool isEmpty() const { return children_.empty(); }
+    bool isEmpty() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return children_.empty();
+    }
     
-    std::size_t getNodeCount() const { return children_.size(); }
+    std::size_t getNodeCount() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return children_.size();
+    }
     
-    // Path-based node access
+    // Path-based node access; absolute paths start at the root of the tree
     std::shared_ptr<FileSystemNode> getNodeByPath(const std::string& path);
 
 private:
-    std::unordered_map<std::string, std::shared_ptr<FileSystemNode>> children_;
+    friend class FileSystemNode;
+    friend class File;
+    
+    // The size and file count a node adds to the totals of the directories above it
+    struct Totals {
+        std::size_t size;
+        std::size_t files;
+    };
+    
+    // Add to the aggregates of this directory and every one above it
+    void adjustAggregates(std::ptrdiff_t sizeDelta, std::ptrdiff_t fileDelta);
+    
+    /**
+     * Hang a node from a directory or take it down
+     * Its totals are read in the same step, so a change below it is counted
+     * either in them or by carrying it on up to the new parent, never both
+     * 
+     * @param node The node
+     * @param parent Its new parent, or none
+     * @return Its totals
+     */
+    static Totals reparent(FileSystemNode& node, std::weak_ptr<Directory> parent);
+    
+    // Up to limit entries from it on (mutex_ must be held)
+    std::vector<Entry> page(std::vector<Entry>::const_iterator it, std::size_t limit) const {
+        const auto end = it + static_cast<std::ptrdiff_t>(std::min<std::size_t>(limit, children_.end() - it));
+        return std::vector<Entry>(it, end);
+    }
+    
+    // The index of the tree this directory is in, made when it is the root of its own
+    std::shared_ptr<PathIndex> treeIndex();
+    
+    // Look a path up one component at a time
+    std::shared_ptr<FileSystemNode> walkPath(std::string_view path);
+    
+    // The first child not named before name (mutex_ must be held)
+    std::vector<Entry>::const_iterator findChild(std::string_view name) const {
+        return std::lower_bound(children_.begin(), children_.end(), name,
+                                [](const Entry& entry, std::string_view key) { return entry.name < key; });
+    }
+    
+    std::vector<Entry>::iterator findChild(std::string_view name) {
+        return children_.begin() + (std::as_const(*this).findChild(name) - children_.cbegin());
+    }
+    
+    mutable std::shared_mutex mutex_;       // Guards children_
+    std::vector<Entry> children_;           // Sorted by name
+    std::atomic<std::size_t> totalSize_{0}; // Bytes of every file below
+    std::atomic<std::size_t> fileCount_{0}; // Files below, at any depth
+    std::atomic<std::chrono::system_clock::time_point> latestModifiedTime_;
 };
 
 /**
  * Class representing a file in the collaborative editor
+ * 
+ * The content, version and MIME type are guarded by a reader-writer lock
+ * of the file's own; getContent() returns a copy.
  */
 class File : public FileSystemNode {
 public:
@@ -157,51 +369,144 @@ public:
         , version_(0) {}
     
     // Content management
-    const std::string& getContent() const { return content_; }
+    std::string getContent() const {
+        std::shared_lock<std::shared_mutex> lock(contentMutex_);
+        return content_;
+    }
     
     void setContent(const std::string& content) {
-        content_ = content;
-        version_++;
+        {
+            std::unique_lock<std::shared_mutex> lock(contentMutex_);
+            const std::size_t oldSize = content_.size();
+            content_ = content;
+            version_++;
+            resized(oldSize);
+        }
         updateModifiedTime();
     }
     
     // Incremental content modification
     void appendContent(const std::string& text) {
-        content_ += text;
-        version_++;
+        {
+            std::unique_lock<std::shared_mutex> lock(contentMutex_);
+            content_ += text;
+            version_++;
+            resized(content_.size() - text.size());
+        }
         updateModifiedTime();
     }
     
     void insertContent(std::size_t position, const std::string& text) {
-        if (position <= content_.length()) {
+        {
+            std::unique_lock<std::shared_mutex> lock(contentMutex_);
+            if (position > content_.length()) {
+                return;
+            }
             content_.insert(position, text);
             version_++;
-            updateModifiedTime();
+            resized(content_.size() - text.size());
         }
+        updateModifiedTime();
     }
     
     bool deleteContent(std::size_t position, std::size_t length) {
-        if (position < content_.length()) {
+        {
+            std::unique_lock<std::shared_mutex> lock(contentMutex_);
+            if (position >= content_.length()) {
+                return false;
+            }
+            const std::size_t oldSize = content_.size();
             content_.erase(position, length);
             version_++;
-            updateModifiedTime();
-            return true;
+            resized(oldSize);
+        }
+        updateModifiedTime();
+        return true;
+    }
+    
+    /**
+     * Replace the content with a stream, e.g. a file being imported or an upload
+     * The content grows a chunk at a time, so no second copy of it is made;
+     * readers of this file wait until it is whole
+     * 
+     * @param source Where the content comes from
+     * @param sizeHint Expected length, to reserve up front and report progress against; 0 if unknown
+     * @param progress Told the bytes read after each chunk
+     * @throws whatever the source throws; the content is then what was read before
+     */
+    void loadContent(const util::ChunkSource& source, uint64_t sizeHint = 0, const util::IoProgress& progress = {}) {
+        std::exception_ptr failure;
+        {
+            std::unique_lock<std::shared_mutex> lock(contentMutex_);
+            const std::size_t oldSize = content_.size();
+            content_.clear();
+            content_.shrink_to_fit();
+            content_.reserve(static_cast<std::size_t>(sizeHint));
+            try {
+                util::pumpChunks(source, [this](std::string_view chunk) { content_.append(chunk); }, progress, sizeHint);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            version_++;
+            resized(oldSize);
+        }
+        updateModifiedTime();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+    
+    /**
+     * Write the content out a chunk at a time, e.g. to a ChunkedFileWriter or a socket
+     * Writers of this file wait until the sink has had it all
+     * 
+     * @param sink Where the chunks go
+     * @param chunkSize Bytes per chunk
+     */
+    void exportContent(const util::ChunkSink& sink, std::size_t chunkSize = util::DEFAULT_IO_CHUNK_SIZE) const {
+        std::shared_lock<std::shared_mutex> lock(contentMutex_);
+        const std::string_view content(content_);
+        chunkSize = std::max<std::size_t>(chunkSize, 1);
+        for (std::size_t offset = 0; offset < content.size(); offset += chunkSize) {
+            sink(content.substr(offset, chunkSize));
         }
-        return false;
     }
     
     // Version management
-    uint64_t getVersion() const { return version_; }
+    uint64_t getVersion() const {
+        std::shared_lock<std::shared_mutex> lock(contentMutex_);
+        return version_;
+    }
     
     // File metadata
-    std::optional<std::string> getMimeType() const { return mimeType_; }
-    void setMimeType(const std::string& mimeType) { mimeType_ = mimeType; }
+    std::optional<std::string> getMimeType() const {
+        std::shared_lock<std::shared_mutex> lock(contentMutex_);
+        return mimeType_;
+    }
+    void setMimeType(const std::string& mimeType) {
+        std::unique_lock<std::shared_mutex> lock(contentMutex_);
+        mimeType_ = mimeType;
+    }
     
     // Implementation of abstract methods
-    std::size_t getSize() const override { return content_.size(); }
+    std::size_t getSize() const override {
+        std::shared_lock<std::shared_mutex> lock(contentMutex_);
+        return content_.size();
+    }
     std::string getPath() const override;
     
 private:
+    friend class Directory;
+    
+    // Carry a change of size to the directories above (contentMutex_ must be held)
+    void resized(std::size_t oldSize) {
+        if (auto parent = getParent().lock()) {
+            parent->adjustAggregates(static_cast<std::ptrdiff_t>(content_.size()) - static_cast<std::ptrdiff_t>(oldSize), 0);
+        }
+    }
+    
+    // Taken before nodeMutex_ when both are needed
+    mutable std::shared_mutex contentMutex_;
     std::string content_;
     uint64_t version_;
     std::optional<std::string> mimeType_;
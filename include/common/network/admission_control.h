@@ -0,0 +1,145 @@
+#ifndef COLLABORATIVE_EDITOR_ADMISSION_CONTROL_H
+#define COLLABORATIVE_EDITOR_ADMISSION_CONTROL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace collab {
+namespace network {
+
+/**
+ * Admission policy for new connections
+ *
+ * Smooths accept storms, such as the reconnects that land on a node when
+ * its neighbour is drained, so they cannot crowd out the clients already
+ * connected. Accepts draw from a token bucket that refills at a steady
+ * rate, and at most a fixed number of connections may be pending, i.e.
+ * accepted but not yet past their first valid frame. A server that is
+ * told to wait leaves further connections in the kernel's listen backlog
+ * until it may accept again.
+ *
+ * Thread-safe; acceptors on several threads may share one.
+ */
+class AdmissionControl {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Returned by try_admit() while too many connections are pending
+    static constexpr clock::duration WAIT_FOR_PENDING = clock::duration::max();
+
+    struct limits {
+        double accept_rate = 0;                     // Connections admitted per second; 0 for no limit
+        std::size_t accept_burst = 64;              // Connections admitted back to back after a quiet spell
+        std::size_t max_pending = 0;                // Connections short of their first frame; 0 for no limit
+        std::chrono::milliseconds handshake_timeout{0};  // Time allowed for the first frame; 0 for no limit
+    };
+
+    struct stats {
+        uint64_t admitted = 0;            // Connections admitted
+        uint64_t rate_limited = 0;        // Times an accept waited for a token
+        uint64_t pending_limited = 0;     // Times an accept waited for a pending connection to finish
+        uint64_t handshake_timeouts = 0;  // Connections closed for not sending a first frame in time
+        std::size_t pending = 0;          // Connections pending right now
+    };
+
+    AdmissionControl()
+        : AdmissionControl(limits{}) {}
+
+    explicit AdmissionControl(const limits& limits)
+        : limits_(limits)
+        , tokens_(static_cast<double>(std::max<std::size_t>(1, limits.accept_burst)))
+        , refilled_(clock::now()) {}
+
+    void set_limits(const limits& limits) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limits_ = limits;
+        tokens_ = std::min(tokens_, static_cast<double>(std::max<std::size_t>(1, limits.accept_burst)));
+    }
+
+    limits get_limits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return limits_;
+    }
+
+    /**
+     * Ask to accept one connection
+     *
+     * Takes a token on success. Each acceptor has at most one accept
+     * outstanding, so the pending limit may be passed by one less than the
+     * number of acceptors.
+     *
+     * @param now The current time
+     * @return Zero to accept now; otherwise how long to wait for a token, or
+     *         WAIT_FOR_PENDING to wait until a pending connection finishes
+     */
+    clock::duration try_admit(clock::time_point now = clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (limits_.max_pending > 0 && pending_ >= limits_.max_pending) {
+            ++stats_.pending_limited;
+            return WAIT_FOR_PENDING;
+        }
+        if (limits_.accept_rate > 0) {
+            const double burst = static_cast<double>(std::max<std::size_t>(1, limits_.accept_burst));
+            const double elapsed = std::chrono::duration<double>(now - refilled_).count();
+            tokens_ = std::min(burst, tokens_ + std::max(0.0, elapsed) * limits_.accept_rate);
+            refilled_ = now;
+            if (tokens_ < 1.0) {
+                ++stats_.rate_limited;
+                const auto wait = std::chrono::duration<double>((1.0 - tokens_) / limits_.accept_rate);
+                return std::max<clock::duration>(
+                    std::chrono::duration_cast<clock::duration>(wait), std::chrono::microseconds(1));
+            }
+            tokens_ -= 1.0;
+        }
+        return clock::duration::zero();
+    }
+
+    // A connection was accepted; it is pending until finish_handshake()
+    void begin_handshake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_;
+        ++stats_.admitted;
+    }
+
+    // A pending connection sent its first frame or closed
+    void finish_handshake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_ > 0) {
+            --pending_;
+        }
+    }
+
+    // A pending connection ran out of time for its first frame; finish_handshake() still follows
+    void record_handshake_timeout() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.handshake_timeouts;
+    }
+
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_;
+    }
+
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats result = stats_;
+        result.pending = pending_;
+        return result;
+    }
+
+private:
+    limits limits_;
+    double tokens_;
+    clock::time_point refilled_;
+    std::size_t pending_ = 0;
+    stats stats_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace network
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_ADMISSION_CONTROL_H
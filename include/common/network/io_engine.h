@@ -0,0 +1,344 @@
+#ifndef COLLABORATIVE_EDITOR_IO_ENGINE_H
+#define COLLABORATIVE_EDITOR_IO_ENGINE_H
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/util/metrics.h"
+#include "common/util/numa_topology.h"
+#include "common/util/thread_profiler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace collab {
+namespace network {
+
+/**
+ * Pool of single-threaded io_contexts, one per thread
+ *
+ * Each io_context is run by exactly one thread, so everything bound to it
+ * (a socket, its connection's buffers and queues, timers) is only ever
+ * touched from that thread and needs no lock. Connections are spread over
+ * the contexts when they are accepted and stay on theirs until they
+ * close; see TcpServer's IoEngine constructor.
+ *
+ * The contexts are created with a concurrency hint of 1, which lets Asio
+ * skip its internal locking. Which kernel interface they wait on is
+ * chosen at build time; see backend_name() and the ENABLE_IO_URING build
+ * option.
+ *
+ * On a NUMA machine place_on_nodes() lays the threads out node by node
+ * and binds each to its node, so what a context's handlers allocate for
+ * it stays in that node's memory.
+ *
+ * With set_busy_poll() the threads never sleep while there is work about:
+ * each spins on poll() instead of blocking in run(), so a handler whose
+ * socket became readable runs without the scheduler's wakeup latency.
+ * An idle thread backs off, spinning, then yielding, then blocking in the
+ * kernel for a bounded time, and goes back to spinning as soon as a poll
+ * finds work. That trades a core per thread for latency; the metrics
+ * collab_io_polls_total and collab_io_idle_seconds (both by role and by
+ * whether the thread was spinning or parked when work came) show how
+ * much of each.
+ */
+class IoEngine {
+public:
+    // How busy-polling threads back off while idle
+    struct busy_poll {
+        std::size_t spin_polls = 20000;                 // Empty polls spun through before yielding
+        std::size_t yield_polls = 200;                  // Then empty polls with a yield between them
+        std::chrono::microseconds park{1000};           // Then the longest one wait blocks in the kernel
+    };
+
+    /**
+     * Create the contexts; no thread runs until start()
+     *
+     * @param threads Number of contexts and threads; 0 for one per hardware thread
+     * @param pin_threads Pin thread i to CPU i, on platforms that support it
+     * @param thread_role Role the threads are named and profiled under, e.g. "io" or "shard"
+     */
+    explicit IoEngine(std::size_t threads = 0, bool pin_threads = false, std::string thread_role = "io")
+        : pin_threads_(pin_threads), thread_role_(std::move(thread_role)) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        contexts_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i) {
+            contexts_.push_back(std::make_unique<boost::asio::io_context>(1));
+        }
+    }
+
+    ~IoEngine() {
+        stop();
+    }
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    /**
+     * Start one thread per context; the contexts keep running while idle until stop()
+     */
+    void start() {
+        if (running_.exchange(true)) {
+            return;
+        }
+        for (std::size_t i = 0; i < contexts_.size(); ++i) {
+            boost::asio::io_context& context = *contexts_[i];
+            context.restart();
+            guards_.emplace_back(boost::asio::make_work_guard(context));
+            threads_.emplace_back([this, i, &context]() {
+                util::nameCurrentThread(thread_role_, i);
+                if (!cpus_.empty()) {
+                    pin_current_thread_to(cpus_[i % cpus_.size()]);
+                } else if (topology_) {
+                    place_current_thread(i);
+                } else if (pin_threads_) {
+                    pin_current_thread(i);
+                }
+                if (busy_poll_) {
+                    run_busy_polling(context);
+                } else {
+                    context.run();
+                }
+            });
+        }
+    }
+
+    /**
+     * Stop every context and wait for the threads; handlers not yet run stay queued until the next start()
+     */
+    void stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        guards_.clear();
+        for (auto& context : contexts_) {
+            context->stop();
+        }
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        threads_.clear();
+    }
+
+    bool is_running() const {
+        return running_;
+    }
+
+    // Number of contexts, and of threads while running
+    std::size_t size() const {
+        return contexts_.size();
+    }
+
+    boost::asio::io_context& context(std::size_t index) {
+        return *contexts_[index % contexts_.size()];
+    }
+
+    /**
+     * Name the kernel interface the contexts run socket I/O on
+     *
+     * @return "io_uring" when built with ENABLE_IO_URING, otherwise the platform's reactor
+     */
+    static constexpr const char* backend_name() {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+        return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+        return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+        return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+        return "kqueue";
+#elif defined(BOOST_ASIO_HAS_DEV_POLL)
+        return "/dev/poll";
+#else
+        return "select";
+#endif
+    }
+
+    // The next context in round-robin order, for a new connection
+    boost::asio::io_context& next() {
+        return context(next_.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    /**
+     * Run the threads on NUMA nodes; call before start()
+     *
+     * Contexts are spread over the nodes in contiguous blocks (see
+     * NumaTopology::nodeForSlot()), and each thread is bound to its node's
+     * CPUs and memory; with pin_threads, to one CPU of its node.
+     *
+     * @param topology The machine's nodes; must outlive the engine
+     */
+    void place_on_nodes(const util::NumaTopology& topology) {
+        topology_ = &topology;
+    }
+
+    /**
+     * Spin the threads on poll() instead of sleeping in run(); call before start()
+     *
+     * @param options How idle threads back off; std::nullopt to block in run() as usual
+     */
+    void set_busy_poll(std::optional<busy_poll> options) {
+        busy_poll_ = options;
+    }
+
+    /**
+     * Pin the threads to a list of CPUs, e.g. cores isolated from the scheduler; call before start()
+     *
+     * Overrides pin_threads and place_on_nodes().
+     *
+     * @param cpus Thread i goes on cpus[i % size]; empty to go back to the other placements
+     */
+    void pin_to(std::vector<unsigned> cpus) {
+        cpus_ = std::move(cpus);
+    }
+
+    /**
+     * The CPUs the kernel keeps other tasks off, from the isolcpus boot parameter
+     *
+     * @return The CPUs, ascending; empty if there are none or it cannot tell
+     */
+    static std::vector<unsigned> isolated_cpus() {
+        std::ifstream file("/sys/devices/system/cpu/isolated");
+        std::string list;
+        if (!file || !std::getline(file, list)) {
+            return {};
+        }
+        return util::NumaTopology::parseCpuList(list);
+    }
+
+    /**
+     * Get the NUMA node a context's thread runs on
+     *
+     * @param index The context
+     * @return Its node's index, or NumaTopology::NO_NODE unless place_on_nodes() was called
+     */
+    std::size_t node_of(std::size_t index) const {
+        return topology_ ? topology_->nodeForSlot(index % contexts_.size(), contexts_.size())
+                         : util::NumaTopology::NO_NODE;
+    }
+
+private:
+    // Bind thread i to its node, and with pinning to the node's CPU of the same rank
+    void place_current_thread(std::size_t index) const {
+        const std::size_t node = node_of(index);
+        std::size_t rank = 0;
+        while (rank < index && node_of(index - rank - 1) == node) {
+            ++rank;
+        }
+        topology_->bindCurrentThread(node, pin_threads_ ? rank : util::NumaTopology::NO_NODE);
+    }
+
+    static void pin_current_thread(std::size_t index) {
+        const unsigned cpus = std::thread::hardware_concurrency();
+        if (cpus == 0) {
+            return;
+        }
+        pin_current_thread_to(static_cast<unsigned>(index % cpus));
+    }
+
+    static void pin_current_thread_to(unsigned cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)cpu;
+#endif
+    }
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Run a context by polling until it is stopped, backing off while it is idle
+    void run_busy_polling(boost::asio::io_context& context) {
+        const busy_poll options = *busy_poll_;
+        util::MetricsRegistry& registry = util::metrics();
+        const char* polls_help = "Polls of a busy-polling I/O thread, by whether they found work";
+        util::Counter& busy = registry.counter("collab_io_polls_total", polls_help,
+                                               {{"role", thread_role_}, {"result", "work"}});
+        util::Counter& empty = registry.counter("collab_io_polls_total", polls_help,
+                                                {{"role", thread_role_}, {"result", "empty"}});
+        const char* idle_help = "Time a busy-polling I/O thread was idle before work came, by how it waited";
+        util::Histogram& spun = registry.histogram("collab_io_idle_seconds", idle_help,
+                                                   {{"role", thread_role_}, {"waited", "spinning"}},
+                                                   util::NANOSECONDS_PER_SECOND);
+        util::Histogram& parked = registry.histogram("collab_io_idle_seconds", idle_help,
+                                                     {{"role", thread_role_}, {"waited", "parked"}},
+                                                     util::NANOSECONDS_PER_SECOND);
+
+        std::size_t idle = 0;
+        bool was_parked = false;
+        std::chrono::steady_clock::time_point idle_since;
+        while (!context.stopped()) {
+            std::size_t ran = context.poll();
+            if (ran == 0 && idle >= options.spin_polls + options.yield_polls) {
+                ran = context.run_one_for(options.park);
+                was_parked = true;
+            }
+            if (ran > 0) {
+                busy.add();
+                if (idle > 0) {
+                    // Counted once per idle stretch, so an idle thread costs no atomics while it spins
+                    empty.add(idle);
+                    const auto waited = std::chrono::steady_clock::now() - idle_since;
+                    (was_parked ? parked : spun).record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()));
+                }
+                idle = 0;
+                was_parked = false;
+                continue;
+            }
+            if (idle++ == 0) {
+                idle_since = std::chrono::steady_clock::now();
+            }
+            if (idle < options.spin_polls) {
+                cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> contexts_;
+    std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> guards_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_{0};
+    std::atomic<bool> running_{false};
+    bool pin_threads_;
+    std::string thread_role_;
+    const util::NumaTopology* topology_ = nullptr;
+    std::vector<unsigned> cpus_;
+    std::optional<busy_poll> busy_poll_;
+};
+
+} // namespace network
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_IO_ENGINE_H
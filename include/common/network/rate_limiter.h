@@ -0,0 +1,268 @@
+#ifndef COLLABORATIVE_EDITOR_RATE_LIMITER_H
+#define COLLABORATIVE_EDITOR_RATE_LIMITER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace collab {
+namespace network {
+
+/**
+ * Keeps one client, or one document, from flooding a node with edits
+ *
+ * A runaway script or a stuck key repeat can send edits faster than the
+ * node transforms them, and every other document on the node waits
+ * behind them. Each session draws from two token buckets, one of bytes
+ * and one of operations, and each document from two more that everyone
+ * editing it shares. A frame is charged its bytes to the session before
+ * it is decoded; an edit is charged one operation to the session, and
+ * one operation and its text's bytes to the document, before it is
+ * transformed. What a bucket cannot pay for is refused whole, with how
+ * long until it could be, for the client to hold back that long.
+ *
+ * A charge larger than a bucket's burst is let through once the bucket is
+ * full and leaves it in debt, so a large frame waits rather than never
+ * passing. A bucket with a rate of 0 does not limit.
+ *
+ * Buckets of documents that have filled up again are dropped now and
+ * then; sessions are dropped by forget_session().
+ *
+ * Thread-safe; every connection of a node may share one.
+ */
+class RateLimiter {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct bucket_limits {
+        double rate = 0;            // Tokens per second; 0 for no limit
+        double burst = 0;           // Tokens spent back to back after a quiet spell
+    };
+
+    struct limits {
+        bucket_limits session_bytes;    // Bytes of frames a session sends
+        bucket_limits session_ops;      // Edits a session sends
+        bucket_limits document_bytes;   // Bytes of inserted text a document takes, from everyone
+        bucket_limits document_ops;     // Edits a document takes, from everyone
+    };
+
+    struct verdict {
+        bool admitted = true;
+        clock::duration retry_after = clock::duration::zero();  // How long to wait, if refused
+        bool notify = false;    // The session's first refusal since it was last admitted; tell it
+    };
+
+    struct stats {
+        uint64_t frames_limited = 0;    // Frames refused before they were decoded
+        uint64_t edits_admitted = 0;
+        uint64_t edits_limited = 0;     // Edits refused before they were transformed
+        std::size_t sessions = 0;       // Sessions with buckets right now
+        std::size_t documents = 0;      // Documents with buckets right now
+    };
+
+    RateLimiter() = default;
+
+    explicit RateLimiter(const limits& limits)
+        : limits_(limits) {}
+
+    void set_limits(const limits& limits) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limits_ = limits;
+    }
+
+    limits get_limits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return limits_;
+    }
+
+    // Whether any bucket limits
+    bool enabled() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return limits_.session_bytes.rate > 0 || limits_.session_ops.rate > 0 ||
+               limits_.document_bytes.rate > 0 || limits_.document_ops.rate > 0;
+    }
+
+    /**
+     * Charge a frame to its session, before decoding it
+     *
+     * @param session The session, e.g. its client ID
+     * @param bytes The frame's size
+     * @param now The current time
+     * @return Whether to decode it
+     */
+    verdict admit_frame(const std::string& session, std::size_t bytes, clock::time_point now = clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (limits_.session_bytes.rate <= 0) {
+            return {};
+        }
+        Session& state = sessions_[session];
+        const clock::duration wait = state.bytes.wait(limits_.session_bytes, static_cast<double>(bytes), now);
+        if (wait > clock::duration::zero()) {
+            ++stats_.frames_limited;
+            return refuse(state, wait);
+        }
+        state.bytes.take(limits_.session_bytes, static_cast<double>(bytes));
+        state.refused = false;
+        return {};
+    }
+
+    /**
+     * Charge an edit to its session and document, before transforming it
+     *
+     * @param session The session
+     * @param document The document it edits
+     * @param bytes The text it inserts
+     * @param now The current time
+     * @return Whether to transform it
+     */
+    verdict admit_edit(const std::string& session, const std::string& document, std::size_t bytes,
+                       clock::time_point now = clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const bool by_session = limits_.session_ops.rate > 0;
+        const bool by_document = limits_.document_ops.rate > 0 || limits_.document_bytes.rate > 0;
+        if (!by_session && !by_document) {
+            ++stats_.edits_admitted;
+            return {};
+        }
+        Session* session_state = by_session ? &sessions_[session] : nullptr;
+        Document* document_state = by_document ? &documents_[document] : nullptr;
+
+        // Every bucket must pay, or none is charged
+        clock::duration wait = clock::duration::zero();
+        if (session_state) {
+            wait = std::max(wait, session_state->ops.wait(limits_.session_ops, 1.0, now));
+        }
+        if (document_state) {
+            wait = std::max(wait, document_state->ops.wait(limits_.document_ops, 1.0, now));
+            wait = std::max(wait, document_state->bytes.wait(limits_.document_bytes, static_cast<double>(bytes), now));
+        }
+        if (wait > clock::duration::zero()) {
+            ++stats_.edits_limited;
+            Session& state = session_state ? *session_state : sessions_[session];
+            return refuse(state, wait);
+        }
+        if (session_state) {
+            session_state->ops.take(limits_.session_ops, 1.0);
+            session_state->refused = false;
+        }
+        if (document_state) {
+            document_state->ops.take(limits_.document_ops, 1.0);
+            document_state->bytes.take(limits_.document_bytes, static_cast<double>(bytes));
+        }
+        ++stats_.edits_admitted;
+        if (++edits_since_sweep_ >= SWEEP_INTERVAL) {
+            sweep(now);
+        }
+        return {};
+    }
+
+    // Drop a session's buckets, e.g. when it disconnects
+    void forget_session(const std::string& session) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.erase(session);
+    }
+
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats result = stats_;
+        result.sessions = sessions_.size();
+        result.documents = documents_.size();
+        return result;
+    }
+
+private:
+    // Edits between sweeps for document buckets that have filled up again
+    static constexpr uint64_t SWEEP_INTERVAL = 4096;
+
+    class Bucket {
+    public:
+        // How long until cost can be paid, after refilling to now; zero if it can
+        clock::duration wait(const bucket_limits& limits, double cost, clock::time_point now) {
+            if (limits.rate <= 0) {
+                return clock::duration::zero();
+            }
+            const double burst = std::max(1.0, limits.burst);
+            if (!started_) {
+                tokens_ = burst;
+                started_ = true;
+            } else {
+                const double elapsed = std::chrono::duration<double>(now - refilled_).count();
+                tokens_ = std::min(burst, tokens_ + std::max(0.0, elapsed) * limits.rate);
+            }
+            refilled_ = now;
+            // More than a burst passes once the bucket is full, and leaves it in debt
+            const double needed = std::min(cost, burst);
+            if (tokens_ >= needed) {
+                return clock::duration::zero();
+            }
+            const auto wait = std::chrono::duration<double>((needed - tokens_) / limits.rate);
+            return std::max<clock::duration>(std::chrono::duration_cast<clock::duration>(wait),
+                                             std::chrono::microseconds(1));
+        }
+
+        // Pay cost, once wait() said it can be
+        void take(const bucket_limits& limits, double cost) {
+            if (limits.rate > 0) {
+                tokens_ -= cost;
+            }
+        }
+
+        // Whether it has refilled to its burst by now, so forgetting it changes nothing
+        bool full(const bucket_limits& limits, clock::time_point now) const {
+            if (!started_ || limits.rate <= 0) {
+                return true;
+            }
+            const double elapsed = std::chrono::duration<double>(now - refilled_).count();
+            return tokens_ + std::max(0.0, elapsed) * limits.rate >= std::max(1.0, limits.burst);
+        }
+
+    private:
+        double tokens_ = 0;
+        clock::time_point refilled_;
+        bool started_ = false;
+    };
+
+    struct Session {
+        Bucket bytes;
+        Bucket ops;
+        bool refused = false;       // Refused since it was last admitted
+    };
+
+    struct Document {
+        Bucket bytes;
+        Bucket ops;
+    };
+
+    verdict refuse(Session& state, clock::duration wait) {
+        const bool first = !state.refused;
+        state.refused = true;
+        return {false, wait, first};
+    }
+
+    void sweep(clock::time_point now) {
+        edits_since_sweep_ = 0;
+        for (auto it = documents_.begin(); it != documents_.end();) {
+            if (it->second.ops.full(limits_.document_ops, now) && it->second.bytes.full(limits_.document_bytes, now)) {
+                it = documents_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    limits limits_;
+    std::unordered_map<std::string, Session> sessions_;
+    std::unordered_map<std::string, Document> documents_;
+    uint64_t edits_since_sweep_ = 0;
+    stats stats_;
+    mutable std::mutex mutex_;  // Guards the members above
+};
+
+} // namespace network
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_RATE_LIMITER_H
@@ -3,6 +3,7 @@
 
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
+#include <algorithm>
 #include <string>
 #include <deque>
 #include <iostream>
@@ -11,7 +12,29 @@
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <memory_resource>
 #include <set>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "common/network/admission_control.h"
+#include "common/network/io_engine.h"
+#include "common/network/tls_context.h"
+#include "common/network/websocket_framing.h"
+#include "common/util/frame_pool.h"
+#include "common/util/logger.h"
+#include "common/util/memory_accounting.h"
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
 
 namespace collab {
 namespace network {
@@ -21,12 +44,65 @@ namespace network {
  * 
  * This class handles the low-level TCP connection for both client and server sides.
  * It provides asynchronous read/write operations and connection management.
+ * 
+ * Frames are either newline-delimited or length-prefixed: FRAME_MARKER and
+ * a 4-byte big-endian payload length, then the payload, which may contain
+ * any byte. The reader accepts both on any connection; the frame mode
+ * picks how write() sends text, and binary payloads are always
+ * length-prefixed. Length-prefixed frames are read without scanning for
+ * delimiters, and a large one is read straight into a buffer of its size.
+ * 
+ * Writes are queued. Everything queued while a write is in flight goes
+ * out in the next one, in a single gathered write of up to
+ * MAX_WRITE_BATCH_BYTES, so a burst of small frames costs one system call
+ * instead of one per frame.
+ * 
+ * With set_tls() the connection is encrypted. Its handshake runs when it
+ * starts, and frames queued meanwhile go out once it is done. Where the
+ * kernel encrypts for it (see TlsContext), frames are written exactly as
+ * in plain text; otherwise OpenSSL encrypts them, with small frames
+ * gathered into full records and large payloads encrypted from where they
+ * are. A TLS connection's handlers run on a strand of its io_context.
+ * 
+ * A connection whose first bytes are an HTTP GET is a WebSocket one: the
+ * upgrade is answered, and from then on frames are read and written as
+ * WebSocket frames, text as text frames and binary payloads as binary
+ * ones (see WebSocketFraming). Everything above the framing sees the
+ * same payloads in either case, so raw TCP and WebSocket clients share
+ * one server, with or without TLS.
  */
 class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 public:
     using pointer = std::shared_ptr<TcpConnection>;
-    using message_handler = std::function<void(pointer, const std::string&)>;
+    // Receives each frame's payload, which points into the read buffer until the handler returns
+    using message_handler = std::function<void(pointer, std::string_view)>;
     using close_handler = std::function<void(pointer)>;
+    // An encoded payload that any number of connections can queue without copying it
+    using shared_payload = std::shared_ptr<const std::string>;
+    
+    // First byte of a length-prefixed frame; newline-delimited text never contains it
+    static constexpr std::uint8_t FRAME_MARKER = 0x00;
+    static constexpr std::size_t FRAME_HEADER_SIZE = 5;
+    
+    // How write() frames text
+    enum class frame_mode {
+        newline_delimited,
+        length_prefixed
+    };
+    
+    // Frames above this size close the connection
+    static constexpr std::size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+    
+    // Most bytes and frames one gathered write takes from the queue; a larger frame still goes alone
+    static constexpr std::size_t MAX_WRITE_BATCH_BYTES = 256 * 1024;
+    static constexpr std::size_t MAX_WRITE_BATCH_FRAMES = 256;
+
+    // Socket options for latency-sensitive connections; the defaults leave the socket as it is
+    struct socket_tuning {
+        bool no_delay = false;      // TCP_NODELAY: send small frames at once rather than coalescing them
+        bool quick_ack = false;     // TCP_QUICKACK: acknowledge at once; the kernel drops it, so it is set after every read
+        int busy_poll_us = 0;       // SO_BUSY_POLL: microseconds a receive may spin on the device queue; Linux only
+    };
 
     /**
      * Create a new TCP connection
@@ -47,18 +123,69 @@ public:
         return socket_;
     }
 
+    /**
+     * Encrypt the connection; call before start()
+     * 
+     * @param context The TLS settings of the server or client
+     * @param peer The server's host name or address, for a client
+     */
+    void set_tls(TlsContext::pointer context, std::string peer = std::string()) {
+        tls_ = std::make_unique<tls_state>(std::move(context), std::move(peer), socket_.get_executor());
+    }
+    
+    bool is_encrypted() const {
+        return tls_ != nullptr;
+    }
+    
+    /**
+     * Tune the socket for latency; call before start()
+     * 
+     * Options the platform lacks or the kernel refuses (SO_BUSY_POLL above
+     * net.core.busy_read needs CAP_NET_ADMIN) are skipped.
+     * 
+     * @param tuning The options
+     */
+    void set_socket_tuning(const socket_tuning& tuning) {
+        tuning_ = tuning;
+    }
+    
+    // Whether the TLS handshake resumed an earlier session; false until it is done
+    bool is_resumed() const {
+        return tls_ && tls_->resumed;
+    }
+    
+    // Whether the kernel encrypts what the connection writes; false until the handshake is done
+    bool is_kernel_encrypted() const {
+        return tls_ && tls_->kernel_send;
+    }
+    
+    // Whether the peer upgraded the connection to WebSocket; false until its upgrade is answered
+    bool is_websocket() const {
+        const websocket_state state = websocket_;
+        return state == websocket_state::open || state == websocket_state::closing;
+    }
+
     /**
      * Start the connection - should be called after connection is established
      */
     void start() {
         connected_ = true;
+        apply_socket_tuning();
         
         // Get the remote endpoint information for connection tracking
         try {
             remote_endpoint_ = socket_.remote_endpoint();
-            std::cout << "Connection established with " << remote_endpoint_ << std::endl;
+            const std::string address = remote_endpoint_.address().to_string();
+            LOGF_RATE_LIMITED(util::LogLevel::INFO, 5, address, "Connection established with {}:{}",
+                              address, remote_endpoint_.port());
         } catch (const boost::system::system_error& e) {
-            std::cerr << "Error getting remote endpoint: " << e.what() << std::endl;
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "remote-endpoint", "Error getting remote endpoint: {}", e.what());
+        }
+        
+        // Reading starts once the handshake is done; posted, as a read would be, so the owner can set handlers first
+        if (tls_) {
+            boost::asio::post(tls_->strand, [this, self = shared_from_this()]() { tls_handshake(); });
+            return;
         }
         
         // Start the first async read operation
@@ -72,7 +199,12 @@ public:
         // Only process close once
         if (!connected_) return;
         
-        std::cout << "Closing connection to " << remote_endpoint_ << std::endl;
+        LOGF_DEBUG("Closing connection to {}:{}", remote_endpoint_.address().to_string(), remote_endpoint_.port());
+        
+        // Say goodbye in TLS too, unless a write on the strand could be using the session now
+        if (tls_ && tls_->established && tls_->strand.running_in_this_thread()) {
+            SSL_shutdown(tls_->ssl.get());
+        }
         
         boost::system::error_code ignored_ec;
         socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
@@ -87,19 +219,65 @@ public:
     }
 
     /**
-     * Send data asynchronously
+     * Close the connection once everything queued before this call is written
      * 
-     * @param data The data to send
+     * Frames queued after it may or may not go out first.
      */
-    void write(const std::string& data) {
-        // Post the write operation to the io_context to ensure thread safety
-        boost::asio::post(socket_.get_executor(), [this, data]() {
-            bool write_in_progress = !write_queue_.empty();
-            write_queue_.push_back(data);
-            if (!write_in_progress) {
-                do_write();
+    void close_when_written() {
+        auto close_if_written = [this, self = shared_from_this()]() {
+            close_when_written_ = true;
+            if (write_queue_.empty() && (!tls_ || tls_->established)) {
+                close();
             }
-        });
+        };
+        if (tls_) {
+            boost::asio::post(tls_->strand, std::move(close_if_written));
+        } else {
+            boost::asio::post(socket_.get_executor(), std::move(close_if_written));
+        }
+    }
+
+    /**
+     * Send text asynchronously, framed according to the frame mode
+     * 
+     * @param data The data to send; must not contain '\n' in newline-delimited mode
+     */
+    void write(std::string data) {
+        write_shared(util::FramePool::share(std::move(data)));
+    }
+    
+    /**
+     * Send text that other connections may be sending too, framed according to the frame mode
+     * 
+     * The connection keeps a reference to the payload until it is written,
+     * so a broadcast encodes once and each recipient only queues a pointer.
+     * 
+     * @param data The data to send; must not contain '\n' in newline-delimited mode
+     */
+    void write_shared(shared_payload data) {
+        queue_frame(std::move(data), payload_kind::text);
+    }
+    
+    /**
+     * Send data asynchronously as a length-prefixed frame, whatever the frame mode
+     * 
+     * @param data The data to send
+     */
+    void write_binary(std::string data) {
+        queue_frame(util::FramePool::share(std::move(data)), payload_kind::binary);
+    }
+    
+    /**
+     * Set how write() frames text; call before the first write
+     * 
+     * @param mode newline_delimited for peers that only read lines, length_prefixed otherwise
+     */
+    void set_frame_mode(frame_mode mode) {
+        frame_mode_ = mode;
+    }
+    
+    frame_mode get_frame_mode() const {
+        return frame_mode_;
     }
 
     /**
@@ -165,65 +343,610 @@ private:
     
     // Asynchronous read operation
     void read() {
+        if (tls_) {
+            tls_read();
+            return;
+        }
         auto self = shared_from_this();
         
-        // Set up async read operation for the header first
-        // For simplicity, we'll use \n as message delimiter
-        boost::asio::async_read_until(
-            socket_,
-            read_buffer_,
-            '\n',
+        // The rest of a large length-prefixed frame is read in one go, straight into place
+        if (expected_size_ > read_buffer_.size() + read_chunk_.size()) {
+            const std::size_t buffered = read_buffer_.size();
+            read_buffer_.resize(expected_size_);
+            boost::asio::async_read(
+                socket_,
+                boost::asio::buffer(read_buffer_.data() + buffered, expected_size_ - buffered),
+                [this, self](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+                    if (!ec) {
+                        if (dispatch_frames()) {
+                            read();
+                        }
+                    } else if (ec != boost::asio::error::operation_aborted) {
+                        LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, ec.message(), "Read error: {}", ec.message());
+                        close();
+                    }
+                });
+            return;
+        }
+        
+        socket_.async_read_some(
+            boost::asio::buffer(read_chunk_),
             [this, self](const boost::system::error_code& ec, std::size_t bytes_transferred) {
                 if (!ec) {
-                    // Extract the message from the buffer
-                    std::string message;
-                    std::istream is(&read_buffer_);
-                    std::getline(is, message);
+                    read_buffer_.append(read_chunk_.data(), bytes_transferred);
                     
-                    // Call the message handler
-                    if (message_handler_) {
-                        message_handler_(self, message);
+                    // Deliver every complete frame, then continue reading
+                    if (dispatch_frames()) {
+                        read();
                     }
-                    
-                    // Continue reading
-                    read();
                 } else if (ec != boost::asio::error::operation_aborted) {
-                    std::cerr << "Read error: " << ec.message() << std::endl;
+                    LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, ec.message(), "Read error: {}", ec.message());
                     close();
                 }
             });
     }
     
-    // Asynchronous write operation
+    void apply_socket_tuning() {
+        boost::system::error_code ignored;
+        if (tuning_.no_delay) {
+            socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+        }
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+        if (tuning_.busy_poll_us > 0) {
+            socket_.set_option(boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>(tuning_.busy_poll_us),
+                               ignored);
+        }
+#endif
+        rearm_quick_ack();
+    }
+    
+    void rearm_quick_ack() {
+#if defined(__linux__) && defined(TCP_QUICKACK)
+        if (tuning_.quick_ack) {
+            boost::system::error_code ignored;
+            socket_.set_option(boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>(true), ignored);
+        }
+#endif
+    }
+    
+    // Pass the complete frames in the read buffer to the handler; false if the connection closed
+    bool dispatch_frames() {
+        auto self = shared_from_this();
+        rearm_quick_ack();
+        std::size_t offset = 0;
+        expected_size_ = 0;
+        
+        while (offset < read_buffer_.size() && connected_) {
+            std::string_view pending(read_buffer_.data() + offset, read_buffer_.size() - offset);
+            std::string_view payload;
+            std::size_t frame_size = 0;
+            
+            // The first bytes tell a WebSocket upgrade from raw frames
+            if (websocket_ == websocket_state::detecting) {
+                if (!WebSocketFraming::may_be_upgrade(pending)) {
+                    websocket_ = websocket_state::off;
+                } else {
+                    const auto request = WebSocketFraming::parse_handshake(pending);
+                    if (request.size == 0) {
+                        if (pending.size() > WebSocketFraming::MAX_HANDSHAKE_SIZE) {
+                            close();
+                            return false;
+                        }
+                        break;
+                    }
+                    queue_frame(util::FramePool::share(std::string(*request.response)), payload_kind::raw);
+                    offset += request.size;
+                    if (!request.accepted) {
+                        websocket_ = websocket_state::refused;
+                        close_when_written();
+                        break;
+                    }
+                    websocket_ = websocket_state::open;
+                    continue;
+                }
+            }
+            if (websocket_ != websocket_state::off) {
+                // Nothing is read after a close
+                if (websocket_ == websocket_state::closing || websocket_ == websocket_state::refused) {
+                    offset = read_buffer_.size();
+                    break;
+                }
+                const std::size_t consumed = dispatch_websocket_frame(offset);
+                if (consumed == 0) {
+                    break;
+                }
+                offset += consumed;
+                continue;
+            }
+            
+            if (static_cast<std::uint8_t>(pending[0]) == FRAME_MARKER) {
+                if (pending.size() < FRAME_HEADER_SIZE) {
+                    break;
+                }
+                std::size_t length = 0;
+                for (std::size_t i = 1; i < FRAME_HEADER_SIZE; ++i) {
+                    length = (length << 8) | static_cast<std::uint8_t>(pending[i]);
+                }
+                if (length > MAX_FRAME_SIZE) {
+                    LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, remote_endpoint_.address().to_string(), "Frame too large from {}:{}",
+                                      remote_endpoint_.address().to_string(), remote_endpoint_.port());
+                    close();
+                    return false;
+                }
+                if (pending.size() < FRAME_HEADER_SIZE + length) {
+                    expected_size_ = FRAME_HEADER_SIZE + length;
+                    break;
+                }
+                payload = pending.substr(FRAME_HEADER_SIZE, length);
+                frame_size = FRAME_HEADER_SIZE + length;
+            } else {
+                std::size_t newline = pending.find('\n');
+                if (newline == std::string_view::npos) {
+                    if (pending.size() > MAX_FRAME_SIZE) {
+                        LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, remote_endpoint_.address().to_string(), "Frame too large from {}:{}",
+                                          remote_endpoint_.address().to_string(), remote_endpoint_.port());
+                        close();
+                        return false;
+                    }
+                    break;
+                }
+                payload = pending.substr(0, newline);
+                frame_size = newline + 1;
+            }
+            
+            if (message_handler_) {
+                message_handler_(self, payload);
+            }
+            offset += frame_size;
+        }
+        
+        read_buffer_.erase(0, offset);
+        return connected_;
+    }
+    
+    /**
+     * Deliver the WebSocket frame at offset in the read buffer, answering control frames
+     * 
+     * @return Its size, or 0 if it has not all arrived or the connection closed
+     */
+    std::size_t dispatch_websocket_frame(std::size_t offset) {
+        char* data = read_buffer_.data() + offset;
+        const std::size_t available = read_buffer_.size() - offset;
+        const auto frame = WebSocketFraming::parse_frame(std::string_view(data, available));
+        if (!frame.complete_header) {
+            return 0;
+        }
+        if (!frame.masked || frame.length > MAX_FRAME_SIZE || websocket_message_.size() + frame.length > MAX_FRAME_SIZE) {
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, remote_endpoint_.address().to_string(),
+                              "Invalid or too large WebSocket frame from {}:{}",
+                              remote_endpoint_.address().to_string(), remote_endpoint_.port());
+            close();
+            return 0;
+        }
+        const std::size_t size = frame.header_size + static_cast<std::size_t>(frame.length);
+        if (available < size) {
+            expected_size_ = size;
+            return 0;
+        }
+        
+        char* body = data + frame.header_size;
+        WebSocketFraming::unmask(body, static_cast<std::size_t>(frame.length), frame.mask);
+        const std::string_view payload(body, static_cast<std::size_t>(frame.length));
+        using opcode = WebSocketFraming::opcode;
+        switch (frame.code) {
+            case opcode::text:
+            case opcode::binary:
+                if (websocket_fragmented_) {
+                    close();
+                    return 0;
+                }
+                if (frame.fin) {
+                    deliver(payload);
+                } else {
+                    websocket_message_.assign(payload);
+                    websocket_fragmented_ = true;
+                }
+                break;
+            case opcode::continuation:
+                if (!websocket_fragmented_) {
+                    close();
+                    return 0;
+                }
+                websocket_message_.append(payload);
+                if (frame.fin) {
+                    websocket_fragmented_ = false;
+                    deliver(websocket_message_);
+                    websocket_message_.clear();
+                }
+                break;
+            case opcode::ping:
+                queue_frame(util::FramePool::share(std::string(payload)), payload_kind::websocket_pong);
+                break;
+            case opcode::pong:
+                break;
+            case opcode::close:
+                // Echo the status, then close once everything before it is written
+                queue_frame(util::FramePool::share(std::string(payload.substr(0, 2))), payload_kind::websocket_close);
+                websocket_ = websocket_state::closing;
+                close_when_written();
+                break;
+            default:
+                close();
+                return 0;
+        }
+        return connected_ ? size : 0;
+    }
+    
+    void deliver(std::string_view payload) {
+        if (message_handler_) {
+            message_handler_(shared_from_this(), payload);
+        }
+    }
+    
+    // What a queued payload is, which picks its framing once it is its turn to be queued
+    enum class payload_kind {
+        text,               // Newline-delimited or length-prefixed by the frame mode, or a WebSocket text frame
+        binary,             // Length-prefixed, or a WebSocket binary frame
+        raw,                // As it is, e.g. the answer to a WebSocket upgrade
+        websocket_pong,
+        websocket_close
+    };
+    
+    // A queued payload with its framing, written without joining them into one string
+    struct pending_frame {
+        std::array<char, WebSocketFraming::MAX_HEADER_SIZE> header;
+        std::size_t header_size;
+        shared_payload payload;
+        bool newline;
+        
+        std::size_t size() const {
+            return header_size + payload->size() + (newline ? 1 : 0);
+        }
+        
+        // Append the frame's non-empty buffers
+        void append_buffers(std::vector<boost::asio::const_buffer>& buffers) const {
+            static constexpr char delimiter = '\n';
+            if (header_size > 0) {
+                buffers.emplace_back(header.data(), header_size);
+            }
+            if (!payload->empty()) {
+                buffers.emplace_back(payload->data(), payload->size());
+            }
+            if (newline) {
+                buffers.emplace_back(&delimiter, 1);
+            }
+        }
+    };
+    
+    // Frame a payload for the connection as it is now; only on the connection's executor
+    pending_frame frame_for(shared_payload payload, payload_kind kind) const {
+        using opcode = WebSocketFraming::opcode;
+        const std::size_t size = payload->size();
+        pending_frame frame{{}, 0, std::move(payload), false};
+        if (kind == payload_kind::raw) {
+            return frame;
+        }
+        if (is_websocket()) {
+            const opcode code = kind == payload_kind::text             ? opcode::text
+                              : kind == payload_kind::binary           ? opcode::binary
+                              : kind == payload_kind::websocket_pong   ? opcode::pong
+                                                                       : opcode::close;
+            frame.header_size = WebSocketFraming::write_header(code, size, frame.header.data());
+            return frame;
+        }
+        if (kind == payload_kind::text && frame_mode_ == frame_mode::newline_delimited) {
+            frame.newline = true;
+            return frame;
+        }
+        frame.header[0] = static_cast<char>(FRAME_MARKER);
+        for (std::size_t i = 1; i < FRAME_HEADER_SIZE; ++i) {
+            frame.header[i] = static_cast<char>((size >> (8 * (FRAME_HEADER_SIZE - 1 - i))) & 0xFF);
+        }
+        frame.header_size = FRAME_HEADER_SIZE;
+        return frame;
+    }
+    
+    // Queue a payload, writing it once those before it are sent
+    void queue_frame(shared_payload payload, payload_kind kind) {
+        // Post the write operation to the io_context to ensure thread safety; it is framed there,
+        // after any upgrade read before it
+        auto push = [this, payload = std::move(payload), kind]() mutable {
+            pending_frame frame = frame_for(std::move(payload), kind);
+            bool write_in_progress = !write_queue_.empty();
+            write_queue_.push_back(std::move(frame));
+            if (!write_in_progress && (!tls_ || tls_->established)) {
+                do_write();
+            }
+        };
+        if (tls_) {
+            boost::asio::post(tls_->strand, std::move(push));
+        } else {
+            boost::asio::post(socket_.get_executor(), std::move(push));
+        }
+    }
+    
+    // Write as many queued frames as fit in one batch with a single gathered write
     void do_write() {
         auto self = shared_from_this();
         
-        // Add newline as message delimiter
-        std::string message = write_queue_.front() + "\n";
+        // The frames stay at the front of the queue until the write completes
+        write_buffers_.clear();
+        std::size_t bytes = 0;
+        std::size_t frames = 0;
+        for (const auto& frame : write_queue_) {
+            if (frames > 0 && (frames == MAX_WRITE_BATCH_FRAMES || bytes + frame.size() > MAX_WRITE_BATCH_BYTES)) {
+                break;
+            }
+            frame.append_buffers(write_buffers_);
+            bytes += frame.size();
+            ++frames;
+        }
         
-        boost::asio::async_write(
-            socket_,
-            boost::asio::buffer(message),
-            [this, self](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
-                if (!ec) {
-                    // Message successfully sent, remove it from the queue
-                    write_queue_.pop_front();
-                    
-                    // If there are more messages to send, continue with the next one
-                    if (!write_queue_.empty()) {
-                        do_write();
+        if (tls_ && !tls_->kernel_send) {
+            tls_->buffer = 0;
+            tls_->offset = 0;
+            tls_send(frames);
+            return;
+        }
+        
+        auto sent = [this, self, frames](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+            finish_write(ec, frames);
+        };
+        if (tls_) {
+            boost::asio::async_write(socket_, write_buffers_, boost::asio::bind_executor(tls_->strand, std::move(sent)));
+        } else {
+            boost::asio::async_write(socket_, write_buffers_, std::move(sent));
+        }
+    }
+    
+    void finish_write(const boost::system::error_code& ec, std::size_t frames) {
+        if (!ec) {
+            // Frames successfully sent, remove them from the queue
+            write_queue_.erase(write_queue_.begin(), write_queue_.begin() + frames);
+            
+            // If more were queued meanwhile, send them all in the next write
+            if (!write_queue_.empty()) {
+                do_write();
+            } else if (close_when_written_) {
+                close();
+            }
+        } else {
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, ec.message(), "Write error: {}", ec.message());
+            close();
+        }
+    }
+    
+    // What a TLS connection keeps; all but the settings are only touched on its strand
+    struct tls_state {
+        tls_state(TlsContext::pointer context, std::string peer, const boost::asio::any_io_executor& executor)
+            : context(std::move(context))
+            , peer(std::move(peer))
+            , strand(executor) {}
+        
+        const TlsContext::pointer context;
+        const std::string peer;
+        boost::asio::strand<boost::asio::any_io_executor> strand;
+        TlsContext::session ssl{nullptr, &TlsContext::release};
+        bool established = false;
+        std::atomic<bool> resumed{false};
+        std::atomic<bool> kernel_send{false};
+        // Where tls_send() is in write_buffers_, and the small frames it gathered into one record
+        std::size_t buffer = 0;
+        std::size_t offset = 0;
+        std::string record;
+        std::size_t record_sent = 0;
+    };
+    
+    // Most plain text in a TLS record
+    static constexpr std::size_t TLS_RECORD_SIZE = 16 * 1024;
+    // Records decrypted in a row before the connection lets others on its thread run
+    static constexpr int TLS_RECORDS_PER_TURN = 16;
+    
+    static boost::asio::socket_base::wait_type tls_wait(int error) {
+        return error == SSL_ERROR_WANT_WRITE ? boost::asio::socket_base::wait_write : boost::asio::socket_base::wait_read;
+    }
+    
+    // Run the handshake over the non-blocking socket, waiting for it as OpenSSL asks, then read and write
+    void tls_handshake() {
+        auto self = shared_from_this();
+        if (!tls_->ssl) {
+            try {
+                socket_.non_blocking(true);
+                tls_->ssl = tls_->context->open(socket_.native_handle(), tls_->peer);
+            } catch (const std::exception& e) {
+                LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "tls-open", "Cannot start TLS with {}: {}", to_string(), e.what());
+                tls_->context->handshake_failed();
+                close();
+                return;
+            }
+        }
+        
+        SSL* ssl = tls_->ssl.get();
+        const int result = SSL_do_handshake(ssl);
+        if (result == 1) {
+            tls_->kernel_send = tls_->context->handshake_done(ssl);
+            tls_->resumed = SSL_session_reused(ssl) != 0;
+            tls_->established = true;
+            read();
+            if (!write_queue_.empty()) {
+                do_write();
+            } else if (close_when_written_) {
+                close();
+            }
+            return;
+        }
+        
+        const int error = SSL_get_error(ssl, result);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            socket_.async_wait(tls_wait(error), boost::asio::bind_executor(tls_->strand,
+                [this, self](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        tls_handshake();
+                    } else if (ec != boost::asio::error::operation_aborted) {
+                        tls_->context->handshake_failed();
+                        close();
                     }
-                } else {
-                    std::cerr << "Write error: " << ec.message() << std::endl;
+                }));
+            return;
+        }
+        LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "tls-handshake", "TLS handshake with {} failed: {}",
+                          to_string(), TlsContext::last_error());
+        tls_->context->handshake_failed();
+        close();
+    }
+    
+    // Wait until OpenSSL can go on reading, then decrypt what arrived
+    void tls_read(boost::asio::socket_base::wait_type wait = boost::asio::socket_base::wait_read) {
+        auto self = shared_from_this();
+        socket_.async_wait(wait, boost::asio::bind_executor(tls_->strand,
+            [this, self](const boost::system::error_code& ec) {
+                if (!ec) {
+                    tls_receive();
+                } else if (ec != boost::asio::error::operation_aborted) {
+                    LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, ec.message(), "Read error: {}", ec.message());
                     close();
                 }
-            });
+            }));
+    }
+    
+    // Decrypt and deliver what is readable, then wait for more
+    void tls_receive() {
+        SSL* ssl = tls_->ssl.get();
+        for (int records = 0; records < TLS_RECORDS_PER_TURN; ++records) {
+            // As in plain text, the rest of a large frame is read straight into place
+            const std::size_t buffered = read_buffer_.size();
+            const bool direct = expected_size_ > buffered + read_chunk_.size();
+            if (direct) {
+                read_buffer_.resize(expected_size_);
+            }
+            char* into = direct ? read_buffer_.data() + buffered : read_chunk_.data();
+            const std::size_t room = direct ? expected_size_ - buffered : read_chunk_.size();
+            
+            std::size_t received = 0;
+            const int result = SSL_read_ex(ssl, into, room, &received);
+            if (direct) {
+                read_buffer_.resize(buffered + received);
+            }
+            if (result == 1) {
+                if (!direct) {
+                    read_buffer_.append(read_chunk_.data(), received);
+                }
+                if (!dispatch_frames()) {
+                    return;
+                }
+                continue;
+            }
+            
+            const int error = SSL_get_error(ssl, result);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+                tls_read(tls_wait(error));
+                return;
+            }
+            if (error != SSL_ERROR_ZERO_RETURN) {
+                LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "tls-read", "TLS read error from {}: {}",
+                                  to_string(), TlsContext::last_error());
+            }
+            close();
+            return;
+        }
+        
+        // More may be buffered or readable; carry on after whatever else is waiting
+        boost::asio::post(tls_->strand, [this, self = shared_from_this()]() { tls_receive(); });
+    }
+    
+    // Encrypt the batch in write_buffers_ in user space, for connections the kernel does not encrypt for
+    void tls_send(std::size_t frames) {
+        auto self = shared_from_this();
+        tls_state& tls = *tls_;
+        for (;;) {
+            if (tls.record.empty()) {
+                while (tls.buffer < write_buffers_.size() && tls.offset == write_buffers_[tls.buffer].size()) {
+                    ++tls.buffer;
+                    tls.offset = 0;
+                }
+                if (tls.buffer == write_buffers_.size()) {
+                    finish_write({}, frames);
+                    return;
+                }
+                
+                // Frames smaller than a record are copied into one, so each record is full; larger ones are not copied
+                if (write_buffers_[tls.buffer].size() - tls.offset < TLS_RECORD_SIZE) {
+                    while (tls.buffer < write_buffers_.size() && tls.record.size() < TLS_RECORD_SIZE) {
+                        const boost::asio::const_buffer& piece = write_buffers_[tls.buffer];
+                        const std::size_t take = std::min(piece.size() - tls.offset, TLS_RECORD_SIZE - tls.record.size());
+                        tls.record.append(static_cast<const char*>(piece.data()) + tls.offset, take);
+                        tls.offset += take;
+                        if (tls.offset == piece.size()) {
+                            ++tls.buffer;
+                            tls.offset = 0;
+                        }
+                    }
+                    tls.record_sent = 0;
+                }
+            }
+            
+            // A write that has to wait is repeated with the same bytes
+            const bool gathered = !tls.record.empty();
+            const char* data = gathered ? tls.record.data() + tls.record_sent
+                                        : static_cast<const char*>(write_buffers_[tls.buffer].data()) + tls.offset;
+            const std::size_t size = gathered ? tls.record.size() - tls.record_sent
+                                              : write_buffers_[tls.buffer].size() - tls.offset;
+            std::size_t written = 0;
+            const int result = SSL_write_ex(tls.ssl.get(), data, size, &written);
+            if (result == 1) {
+                if (!gathered) {
+                    tls.offset += written;
+                } else if ((tls.record_sent += written) == tls.record.size()) {
+                    tls.record.clear();
+                }
+                continue;
+            }
+            
+            const int error = SSL_get_error(tls.ssl.get(), result);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+                socket_.async_wait(tls_wait(error), boost::asio::bind_executor(tls.strand,
+                    [this, self, frames](const boost::system::error_code& ec) {
+                        if (!ec) {
+                            tls_send(frames);
+                        } else {
+                            finish_write(ec, frames);
+                        }
+                    }));
+                return;
+            }
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "tls-write", "TLS write error to {}: {}",
+                              to_string(), TlsContext::last_error());
+            close();
+            return;
+        }
     }
 
 private:
     boost::asio::ip::tcp::socket socket_;
-    boost::asio::streambuf read_buffer_;
-    std::deque<std::string> write_queue_;
+    std::array<char, 8192> read_chunk_;
+    std::string read_buffer_;
+    std::size_t expected_size_ = 0;
+    std::pmr::deque<pending_frame> write_queue_{&util::memoryResource(util::MemoryTag::PROTOCOL)};
+    // Buffers of the frames being written; only touched on the connection's executor
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    frame_mode frame_mode_ = frame_mode::newline_delimited;
+    // Whether the peer speaks WebSocket, told from its first bytes
+    enum class websocket_state : std::uint8_t {
+        detecting,
+        off,
+        open,
+        closing,    // A close was received; nothing more is read
+        refused     // The upgrade was refused; nothing more is read
+    };
+    std::atomic<websocket_state> websocket_{websocket_state::detecting};
+    // A fragmented WebSocket message so far; only touched on the connection's executor
+    std::string websocket_message_;
+    bool websocket_fragmented_ = false;
+    // Close once the write queue empties; only touched on the connection's executor
+    bool close_when_written_ = false;
+    // Set before start() on an encrypted connection
+    std::unique_ptr<tls_state> tls_;
+    socket_tuning tuning_;
     message_handler message_handler_;
     close_handler close_handler_;
     boost::asio::ip::tcp::endpoint remote_endpoint_;
@@ -256,6 +979,8 @@ public:
      * @param port The server port number
      */
     void connect(const std::string& host, const std::string& port) {
+        host_ = host;
+        
         // Start the asynchronous resolve operation
         resolver_.async_resolve(
             host,
@@ -271,6 +996,25 @@ public:
             });
     }
     
+    /**
+     * Abandon a connect in progress, e.g. when it timed out
+     * The error handler is called as the resolve or connect fails; call on the io_context's thread
+     */
+    void cancel() {
+        resolver_.cancel();
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+    
+    /**
+     * Encrypt the connections; the host passed to connect() names the server and keys its session tickets
+     * 
+     * @param context Client TLS settings, which may be shared by many clients
+     */
+    void set_tls(TlsContext::pointer context) {
+        tls_ = std::move(context);
+    }
+    
     /**
      * Set connection handler
      * 
@@ -300,7 +1044,10 @@ private:
                 if (!ec) {
                     // Create and start the connection
                     connection_ = TcpConnection::create(io_context_);
-                    socket_.swap(connection_->socket());
+                    connection_->socket() = std::move(socket_);
+                    if (tls_) {
+                        connection_->set_tls(tls_, host_);
+                    }
                     connection_->start();
                     
                     // Notify about the established connection
@@ -320,18 +1067,38 @@ private:
     boost::asio::ip::tcp::socket socket_;
     boost::asio::ip::tcp::resolver resolver_;
     TcpConnection::pointer connection_;
+    std::string host_;
+    TlsContext::pointer tls_;
     connection_handler connection_handler_;
     error_handler error_handler_;
 };
 
 /**
  * TCP server class for accepting incoming connections
+ * 
+ * Runs on one io_context, or spreads connections over an IoEngine's.
+ * With an engine, each connection is bound to one context for its whole
+ * life, so its handlers all run on that context's thread; the connection
+ * and close handlers may run on any of them.
+ * 
+ * Accepts go through an AdmissionControl. A new connection is pending
+ * until the owner calls handshake_done() for it, once its first valid
+ * frame arrives or it closes; see set_admission_limits(). On a TLS
+ * server that includes the connection's handshake.
  */
 class TcpServer {
 public:
     using pointer = std::shared_ptr<TcpServer>;
     using connection_handler = std::function<void(TcpConnection::pointer)>;
     using error_handler = std::function<void(const std::string&)>;
+    
+    // How an IoEngine server shares incoming connections between its contexts
+    enum class accept_mode {
+        // One acceptor hands each new socket to the next context in turn
+        round_robin,
+        // One SO_REUSEPORT acceptor per context, and the kernel balances between them
+        reuse_port
+    };
 
     /**
      * Constructor
@@ -340,9 +1107,35 @@ public:
      * @param port The port to listen on
      */
     TcpServer(boost::asio::io_context& io_context, unsigned short port)
-        : io_context_(io_context)
-        , acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
-        , running_(false) {}
+        : running_(false) {
+        add_acceptor(io_context, port, false);
+    }
+    
+    /**
+     * Create a server whose connections run on an engine's contexts
+     * 
+     * @param engine The engine; must outlive the server
+     * @param port The port to listen on, 0 for any
+     * @param mode How connections are shared out; reuse_port needs SO_REUSEPORT and falls back to round_robin
+     */
+    TcpServer(IoEngine& engine, unsigned short port, accept_mode mode = accept_mode::round_robin)
+        : engine_(&engine)
+        , running_(false) {
+#ifdef SO_REUSEPORT
+        if (mode == accept_mode::reuse_port && engine.size() > 1) {
+            // A port of 0 is only chosen once; the other acceptors join it
+            add_acceptor(engine.context(0), port, true);
+            const unsigned short bound = acceptors_.front().acceptor->local_endpoint().port();
+            for (std::size_t i = 1; i < engine.size(); ++i) {
+                add_acceptor(engine.context(i), bound, true);
+            }
+            return;
+        }
+#else
+        (void)mode;
+#endif
+        add_acceptor(engine.context(0), port, false);
+    }
 
     /**
      * Start the server
@@ -351,10 +1144,29 @@ public:
         if (running_) return;
         
         running_ = true;
-        std::cout << "Server started on port " << acceptor_.local_endpoint().port() << std::endl;
+        accepting_ = true;
+        std::cout << "Server started on port " << port() << std::endl;
         
         // Start accepting connections
-        accept_connection();
+        for (auto& slot : acceptors_) {
+            accept_connection(slot);
+        }
+    }
+    
+    /**
+     * Stop accepting connections, and leave those accepted open, e.g. while draining the server
+     * 
+     * stop() closes them.
+     */
+    void stop_accepting() {
+        accepting_ = false;
+        for (auto& slot : acceptors_) {
+            boost::asio::post(*slot.context, [&slot]() {
+                boost::system::error_code ignored;
+                slot.acceptor->close(ignored);
+                slot.timer->cancel();
+            });
+        }
     }
     
     /**
@@ -365,16 +1177,22 @@ public:
         
         std::cout << "Stopping server..." << std::endl;
         
-        // Close the acceptor to stop accepting new connections
+        // Close the acceptors to stop accepting new connections
         boost::system::error_code ec;
-        acceptor_.close(ec);
+        for (auto& slot : acceptors_) {
+            slot.acceptor->close(ec);
+            slot.timer->cancel();
+        }
         
-        // Close all active connections
-        std::lock_guard<std::mutex> lock(connections_mutex_);
-        for (auto& conn : active_connections_) {
+        // Close all active connections; their close handlers take the lock again
+        std::set<TcpConnection::pointer> connections;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            connections.swap(active_connections_);
+        }
+        for (auto& conn : connections) {
             conn->close();
         }
-        active_connections_.clear();
         
         running_ = false;
     }
@@ -397,6 +1215,64 @@ public:
         error_handler_ = handler;
     }
     
+    /**
+     * Limit how fast connections are accepted and how many may be pending
+     * 
+     * @param limits The limits; the defaults admit everything at once
+     */
+    void set_admission_limits(const AdmissionControl::limits& limits) {
+        admission_.set_limits(limits);
+    }
+    
+    /**
+     * Encrypt the connections accepted from now on
+     * 
+     * @param context Server TLS settings
+     */
+    void set_tls(TlsContext::pointer context) {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        tls_ = std::move(context);
+    }
+    
+    /**
+     * Tune the sockets accepted from now on for latency
+     * 
+     * @param tuning The options; see TcpConnection::set_socket_tuning()
+     */
+    void set_socket_tuning(const TcpConnection::socket_tuning& tuning) {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        tuning_ = tuning;
+    }
+    
+    AdmissionControl::stats admission_stats() const {
+        return admission_.get_stats();
+    }
+    
+    /**
+     * End a connection's pending state, once its first valid frame arrived or it closed
+     * 
+     * Calling it again for the same connection does nothing.
+     * 
+     * @param connection The connection
+     */
+    void handshake_done(const TcpConnection::pointer& connection) {
+        std::vector<acceptor_slot*> resumed;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            auto it = pending_.find(connection.get());
+            if (it == pending_.end()) {
+                return;
+            }
+            if (it->second) {
+                it->second->cancel();
+            }
+            pending_.erase(it);
+            admission_.finish_handshake();
+            resumed = take_paused();
+        }
+        resume(resumed);
+    }
+    
     /**
      * Get the number of active connections
      * 
@@ -413,7 +1289,7 @@ public:
      * @return The server port
      */
     unsigned short port() const {
-        return acceptor_.local_endpoint().port();
+        return acceptors_.front().acceptor->local_endpoint().port();
     }
     
     /**
@@ -426,15 +1302,63 @@ public:
     }
     
 private:
+    // An acceptor, the context it runs on, and the timer it waits for a token on
+    struct acceptor_slot {
+        boost::asio::io_context* context;
+        std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        // Waiting for a pending connection to finish; guarded by connections_mutex_
+        bool paused = false;
+    };
+    
+    void add_acceptor(boost::asio::io_context& context, unsigned short port, bool reuse_port) {
+        const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+        auto acceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(context);
+        acceptor->open(endpoint.protocol());
+        acceptor->set_option(boost::asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (reuse_port) {
+            acceptor->set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        }
+#else
+        (void)reuse_port;
+#endif
+        acceptor->bind(endpoint);
+        acceptor->listen();
+        acceptors_.push_back({&context, std::move(acceptor), std::make_unique<boost::asio::steady_timer>(context)});
+    }
+    
     // Accept a new connection
-    void accept_connection() {
-        // Create a new connection
-        auto new_connection = TcpConnection::create(io_context_);
+    void accept_connection(acceptor_slot& slot) {
+        if (!running_ || !accepting_) return;
+        
+        // Wait for a token, or for a pending connection to finish, before taking the next one
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            const auto wait = admission_.try_admit();
+            if (wait == AdmissionControl::WAIT_FOR_PENDING) {
+                slot.paused = true;
+                return;
+            }
+            if (wait > AdmissionControl::clock::duration::zero()) {
+                slot.timer->expires_after(wait);
+                slot.timer->async_wait([this, &slot](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        accept_connection(slot);
+                    }
+                });
+                return;
+            }
+        }
+        
+        // Create a new connection on the context it will live on
+        boost::asio::io_context& context = engine_ && acceptors_.size() == 1 ? engine_->next() : *slot.context;
+        auto new_connection = TcpConnection::create(context);
         
         // Set up an asynchronous accept operation
-        acceptor_.async_accept(
+        slot.acceptor->async_accept(
             new_connection->socket(),
-            [this, new_connection](const boost::system::error_code& ec) {
+            [this, &slot, new_connection](const boost::system::error_code& ec) {
                 if (!ec) {
                     // Set up a handler to remove the connection when it closes
                     new_connection->set_close_handler([this](TcpConnection::pointer conn) {
@@ -442,12 +1366,21 @@ private:
                     });
                     
                     // Start the connection
+                    {
+                        std::lock_guard<std::mutex> lock(connections_mutex_);
+                        if (tls_) {
+                            new_connection->set_tls(tls_);
+                        }
+                        new_connection->set_socket_tuning(tuning_);
+                    }
                     new_connection->start();
                     
-                    // Add to active connections
+                    // Add to active connections, pending until its first frame
                     {
                         std::lock_guard<std::mutex> lock(connections_mutex_);
                         active_connections_.insert(new_connection);
+                        admission_.begin_handshake();
+                        pending_.emplace(new_connection.get(), watch_handshake(new_connection));
                     }
                     
                     // Notify about the new connection
@@ -457,7 +1390,7 @@ private:
                     
                     // Continue accepting connections
                     if (running_) {
-                        accept_connection();
+                        accept_connection(slot);
                     }
                 } else if (ec != boost::asio::error::operation_aborted) {
                     if (error_handler_) {
@@ -466,37 +1399,114 @@ private:
                     
                     // Try to recover and continue accepting
                     if (running_) {
-                        accept_connection();
+                        accept_connection(slot);
                     }
                 }
             });
     }
     
+    // Close a connection that sends no first frame in time; call with connections_mutex_ held
+    std::shared_ptr<boost::asio::steady_timer> watch_handshake(const TcpConnection::pointer& connection) {
+        const auto timeout = admission_.get_limits().handshake_timeout;
+        if (timeout.count() <= 0) {
+            return nullptr;
+        }
+        auto timer = std::make_shared<boost::asio::steady_timer>(connection->socket().get_executor(), timeout);
+        std::weak_ptr<TcpConnection> weak = connection;
+        timer->async_wait([this, weak](const boost::system::error_code& ec) {
+            auto conn = weak.lock();
+            if (ec || !conn) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(connections_mutex_);
+                if (pending_.find(conn.get()) == pending_.end()) {
+                    return;
+                }
+            }
+            admission_.record_handshake_timeout();
+            conn->close();
+            handshake_done(conn);
+        });
+        return timer;
+    }
+    
+    // Take the acceptors waiting for a pending connection; call with connections_mutex_ held
+    std::vector<acceptor_slot*> take_paused() {
+        std::vector<acceptor_slot*> paused;
+        for (auto& slot : acceptors_) {
+            if (slot.paused) {
+                slot.paused = false;
+                paused.push_back(&slot);
+            }
+        }
+        return paused;
+    }
+    
+    // Start paused acceptors again, each on its own context
+    void resume(const std::vector<acceptor_slot*>& slots) {
+        for (acceptor_slot* slot : slots) {
+            boost::asio::post(*slot->context, [this, slot]() { accept_connection(*slot); });
+        }
+    }
+    
     // Remove a closed connection from the active connections list
     void remove_connection(TcpConnection::pointer connection) {
-        std::lock_guard<std::mutex> lock(connections_mutex_);
-        active_connections_.erase(connection);
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            active_connections_.erase(connection);
+        }
+        handshake_done(connection);
     }
     
 private:
-    boost::asio::io_context& io_context_;
-    boost::asio::ip::tcp::acceptor acceptor_;
+    IoEngine* engine_ = nullptr;
+    // Never resized after construction, so accept handlers can keep references
+    std::vector<acceptor_slot> acceptors_;
     std::set<TcpConnection::pointer> active_connections_;
+    // Connections short of their first frame, with their handshake timers
+    std::unordered_map<const TcpConnection*, std::shared_ptr<boost::asio::steady_timer>> pending_;
+    AdmissionControl admission_;
     mutable std::mutex connections_mutex_;
+    TlsContext::pointer tls_;
+    TcpConnection::socket_tuning tuning_;
     connection_handler connection_handler_;
     error_handler error_handler_;
     std::atomic<bool> running_;
+    std::atomic<bool> accepting_{false};
+};
+
+/**
+ * Default message codec: each message as the text its toString() returns
+ */
+template<typename MessageType>
+struct TextCodec {
+    std::string encode(const MessageType& message) {
+        return message.toString();
+    }
+    
+    auto decode(std::string_view data) {
+        return MessageType::fromString(std::string(data));
+    }
+    
+    static bool is_binary_frame(std::string_view /*frame*/) {
+        return false;
+    }
 };
 
 /**
  * Message channel that uses the underlying TCP connection for sending/receiving messages
  * and provides a higher-level API for using the protocol messages
+ * 
+ * The codec turns messages into frames and back. It may keep per-connection
+ * state, so the channel encodes and queues each message under one lock.
  */
-template<typename MessageType>
-class MessageChannel : public std::enable_shared_from_this<MessageChannel<MessageType>> {
+template<typename MessageType, typename Codec = TextCodec<MessageType>>
+class MessageChannel : public std::enable_shared_from_this<MessageChannel<MessageType, Codec>> {
 public:
-    using pointer = std::shared_ptr<MessageChannel<MessageType>>;
+    using pointer = std::shared_ptr<MessageChannel<MessageType, Codec>>;
     using message_handler = std::function<void(pointer, const MessageType&)>;
+    using frame_handler = std::function<void(pointer, Codec&, std::string_view)>;
     
     /**
      * Constructor
@@ -507,7 +1517,7 @@ public:
         : connection_(connection) {
         
         // Set up the message handler on the TCP connection
-        connection_->set_message_handler([this](TcpConnection::pointer, const std::string& data) {
+        connection_->set_message_handler([this](TcpConnection::pointer, std::string_view data) {
             handle_raw_message(data);
         });
     }
@@ -519,17 +1529,47 @@ public:
      */
     void send_message(const MessageType& message) {
         if (!connection_->is_connected()) {
-            std::cerr << "Cannot send message: Connection closed" << std::endl;
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "send-closed", "Cannot send message: Connection closed");
             return;
         }
         
         try {
-            // Serialize the message to string and send
-            std::string data = message.toString();
-            connection_->write(data);
+            // Serialize the message and send it in the framing it needs
+            std::lock_guard<std::mutex> lock(send_mutex_);
+            std::string data = codec_.encode(message);
+            if (Codec::is_binary_frame(data)) {
+                connection_->write_binary(std::move(data));
+            } else {
+                connection_->write(std::move(data));
+            }
         } catch (const std::exception& e) {
-            std::cerr << "Error serializing message: " << e.what() << std::endl;
+            LOGF_RATE_LIMITED(util::LogLevel::ERROR, 5, "serialize", "Error serializing message: {}", e.what());
+        }
+    }
+    
+    /**
+     * Send a message that was already serialized
+     * 
+     * Lets a broadcast serialize a message once for all of its recipients.
+     * 
+     * @param data The serialized message as a text frame, as returned by toString()
+     */
+    void send_serialized(const std::string& data) {
+        send_serialized(std::make_shared<const std::string>(data));
+    }
+    
+    /**
+     * Send a message that was already serialized, sharing the text with other channels
+     * 
+     * @param data The serialized message as a text frame; queued by reference, not copied
+     */
+    void send_serialized(TcpConnection::shared_payload data) {
+        if (!connection_->is_connected()) {
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "send-closed", "Cannot send message: Connection closed");
+            return;
         }
+        
+        connection_->write_shared(std::move(data));
     }
     
     /**
@@ -541,6 +1581,28 @@ public:
         message_handler_ = handler;
     }
     
+    /**
+     * Set a handler that decodes frames itself, instead of the message handler
+     * 
+     * The frame points into the connection's read buffer and is only valid
+     * until the handler returns, which lets codecs hand out views of it
+     * (see WireCodec::visit) instead of decoded copies.
+     * 
+     * @param handler The handler to call with the codec and each received frame
+     */
+    void set_frame_handler(frame_handler handler) {
+        frame_handler_ = handler;
+    }
+    
+    /**
+     * Get the codec, e.g. to choose its wire format before connecting
+     * 
+     * @return The codec
+     */
+    Codec& codec() {
+        return codec_;
+    }
+    
     /**
      * Get the underlying TCP connection
      * 
@@ -570,22 +1632,54 @@ public:
     
 private:
     // Handle a raw message from the TCP connection
-    void handle_raw_message(const std::string& data) {
+    void handle_raw_message(std::string_view data) {
         try {
+            if (frame_handler_) {
+                frame_handler_(this->shared_from_this(), codec_, data);
+                return;
+            }
+            
             // Parse the message and call the message handler
-            auto message = MessageType::fromString(data);
+            auto message = codec_.decode(data);
             
             if (message_handler_) {
-                message_handler_(this->shared_from_this(), message);
+                deliver(message);
             }
         } catch (const std::exception& e) {
-            std::cerr << "Error parsing message: " << e.what() << std::endl;
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "parse", "Error parsing message: {}", e.what());
+        }
+    }
+    
+    // Pass a decoded message on; codecs may decode into a variant of message structs
+    template<typename Decoded>
+    void deliver(const Decoded& message) {
+        if constexpr (std::is_convertible_v<const Decoded&, const MessageType&>) {
+            deliver_one(message);
+        } else {
+            std::visit([this](const auto& alternative) {
+                deliver_one(alternative);
+            }, message);
+        }
+    }
+    
+    // Pass a message to the handler, one element at a time if it is a batch
+    template<typename Decoded>
+    void deliver_one(const Decoded& message) {
+        if constexpr (requires { message.messages.front()->type; }) {
+            for (const auto& element : message.messages) {
+                message_handler_(this->shared_from_this(), *element);
+            }
+        } else {
+            message_handler_(this->shared_from_this(), message);
         }
     }
     
 private:
     TcpConnection::pointer connection_;
     message_handler message_handler_;
+    frame_handler frame_handler_;
+    Codec codec_;
+    std::mutex send_mutex_;
 };
 
 } // namespace network
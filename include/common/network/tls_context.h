@@ -0,0 +1,364 @@
+#ifndef COLLABORATIVE_EDITOR_TLS_CONTEXT_H
+#define COLLABORATIVE_EDITOR_TLS_CONTEXT_H
+
+#include <boost/asio/ip/address.hpp>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace collab {
+namespace network {
+
+/**
+ * TLS settings shared by the connections of a server or a client
+ *
+ * Handshakes are what make TLS expensive for short-lived connections, and
+ * a client that reconnects, e.g. after its node was drained, should not
+ * pay for a full one each time. Servers issue session tickets, so they
+ * keep no state per session, and a client keeps the latest ticket of each
+ * server it talks to and offers it on its next connection to that server,
+ * which then resumes without the certificate exchange or key agreement.
+ * Nodes given the same ticket keys resume each other's sessions.
+ *
+ * With kernel_offload, OpenSSL hands the connection's keys to the kernel
+ * once the handshake is done (Linux kTLS) where the kernel, the cipher and
+ * OpenSSL's build allow it. The kernel then encrypts what is written to
+ * the socket, so TcpConnection writes its frames as it does in plain text:
+ * one gathered write straight from the shared payloads of a broadcast,
+ * with no copy into a user-space TLS buffer. Without it frames are
+ * encrypted by OpenSSL, a record at a time.
+ *
+ * Thread-safe; connections on any thread may share one.
+ */
+class TlsContext {
+public:
+    using pointer = std::shared_ptr<TlsContext>;
+
+    // One connection's TLS state
+    using session = std::unique_ptr<SSL, void (*)(SSL*)>;
+
+    enum class role {
+        server,
+        client
+    };
+
+    struct options {
+        // PEM text, or the path of a PEM file; the server's certificate chain and key, or a client's own
+        std::string certificate_chain;
+        std::string private_key;
+        // PEM text or path of the certificates peers are verified against; empty to not verify them
+        std::string trusted_certificates;
+        // 80 bytes of ticket keys shared by the nodes of a cluster; random for each context if empty
+        std::string ticket_keys;
+        // Let the kernel encrypt and decrypt where it can
+        bool kernel_offload = true;
+        // How long a session can be resumed
+        std::chrono::seconds session_lifetime{7200};
+        // Servers a client keeps a ticket for
+        std::size_t max_cached_sessions = 1024;
+    };
+
+    struct stats {
+        uint64_t handshakes = 0;        // Handshakes completed
+        uint64_t resumed = 0;           // Of them, sessions resumed from a ticket
+        uint64_t failed = 0;            // Handshakes that failed
+        uint64_t kernel_send = 0;       // Connections the kernel encrypts for
+        uint64_t kernel_receive = 0;    // Connections the kernel decrypts for
+        std::size_t cached_sessions = 0;  // Tickets a client holds
+    };
+
+    static constexpr std::size_t TICKET_KEYS_SIZE = 80;
+
+    /**
+     * Create a context
+     *
+     * @param side Whether its connections accept or connect
+     * @param options The settings; a server needs a certificate chain and key
+     * @return The context
+     * @throws std::runtime_error if OpenSSL rejects the settings
+     */
+    static pointer create(role side, const options& options) {
+        return pointer(new TlsContext(side, options));
+    }
+
+    ~TlsContext() {
+        for (auto& [peer, cached] : sessions_) {
+            SSL_SESSION_free(cached);
+        }
+    }
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    /**
+     * Start the TLS state of a connection
+     *
+     * A client connection offers the ticket kept for the peer, if any, and
+     * names the peer in SNI and checks its certificate against it.
+     *
+     * @param fd The connected socket; TLS reads and writes it directly
+     * @param peer The server's host name or address, for a client; used as the key of its tickets
+     * @return The connection's state, before its handshake
+     */
+    session open(int fd, const std::string& peer = std::string()) {
+        session ssl(SSL_new(context_), &release);
+        if (!ssl || SSL_set_fd(ssl.get(), fd) != 1) {
+            fail("Cannot create TLS session");
+        }
+        if (role_ == role::server) {
+            SSL_set_accept_state(ssl.get());
+            return ssl;
+        }
+        SSL_set_connect_state(ssl.get());
+        SSL_set_ex_data(ssl.get(), peer_index(), new std::string(peer));
+        if (!peer.empty()) {
+            boost::system::error_code not_address;
+            boost::asio::ip::make_address(peer, not_address);
+            if (not_address) {
+                SSL_set_tlsext_host_name(ssl.get(), peer.c_str());
+            }
+            if (verify_) {
+                SSL_set1_host(ssl.get(), peer.c_str());
+            }
+        }
+        // A ticket is offered once; the resumed connection is sent new ones
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(peer);
+        if (it != sessions_.end()) {
+            if (SSL_SESSION_is_resumable(it->second)) {
+                SSL_set_session(ssl.get(), it->second);
+            }
+            SSL_SESSION_free(it->second);
+            sessions_.erase(it);
+        }
+        return ssl;
+    }
+
+    /**
+     * Record a connection whose handshake completed
+     *
+     * @param ssl Its state
+     * @return True if the kernel encrypts what is written to its socket
+     */
+    bool handshake_done(SSL* ssl) {
+        const bool kernel_send = BIO_get_ktls_send(SSL_get_wbio(ssl)) != 0;
+        const bool kernel_receive = BIO_get_ktls_recv(SSL_get_rbio(ssl)) != 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.handshakes++;
+        stats_.resumed += SSL_session_reused(ssl) ? 1 : 0;
+        stats_.kernel_send += kernel_send ? 1 : 0;
+        stats_.kernel_receive += kernel_receive ? 1 : 0;
+        return kernel_send;
+    }
+
+    void handshake_failed() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.failed++;
+    }
+
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats current = stats_;
+        current.cached_sessions = sessions_.size();
+        return current;
+    }
+
+    SSL_CTX* native_handle() {
+        return context_;
+    }
+
+    /**
+     * Free a connection's TLS state
+     *
+     * OpenSSL stops resuming a session whose connection ended without a
+     * close_notify, but a connection dropped for any reason is the one
+     * whose client most wants to resume, so it is marked as shut down.
+     */
+    static void release(SSL* ssl) {
+        if (ssl) {
+            SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            SSL_free(ssl);
+        }
+    }
+
+    // The text of OpenSSL's latest error on this thread, clearing the queue
+    static std::string last_error() {
+        const unsigned long code = ERR_peek_last_error();
+        ERR_clear_error();
+        if (code == 0) {
+            return "unknown error";
+        }
+        char text[256];
+        ERR_error_string_n(code, text, sizeof(text));
+        return text;
+    }
+
+private:
+    TlsContext(role side, const options& options)
+        : role_(side)
+        , verify_(!options.trusted_certificates.empty())
+        , max_cached_sessions_(options.max_cached_sessions)
+        , owned_context_(SSL_CTX_new(side == role::server ? TLS_server_method() : TLS_client_method()), &SSL_CTX_free)
+        , context_(owned_context_.get()) {
+        if (!context_) {
+            fail("Cannot create TLS context");
+        }
+        SSL_CTX_set_app_data(context_, this);
+        SSL_CTX_set_min_proto_version(context_, TLS1_2_VERSION);
+        SSL_CTX_set_options(context_, SSL_OP_NO_RENEGOTIATION);
+        // Writes may finish in parts and resume from where the frame buffers are by then
+        SSL_CTX_set_mode(context_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+        if (options.kernel_offload) {
+            SSL_CTX_set_options(context_, SSL_OP_ENABLE_KTLS);
+        }
+#endif
+        SSL_CTX_set_timeout(context_, static_cast<long>(options.session_lifetime.count()));
+
+        if (!options.certificate_chain.empty()) {
+            use_certificates(options.certificate_chain, options.private_key);
+        } else if (side == role::server) {
+            throw std::invalid_argument("A TLS server needs a certificate chain");
+        }
+        if (verify_) {
+            trust(options.trusted_certificates);
+            SSL_CTX_set_verify(context_, SSL_VERIFY_PEER, nullptr);
+        }
+
+        if (side == role::server) {
+            static constexpr unsigned char id_context[] = "collab";
+            SSL_CTX_set_session_id_context(context_, id_context, sizeof(id_context) - 1);
+            if (!options.ticket_keys.empty()) {
+                if (options.ticket_keys.size() != TICKET_KEYS_SIZE) {
+                    throw std::invalid_argument("TLS ticket keys must be 80 bytes");
+                }
+                std::string keys = options.ticket_keys;
+                if (SSL_CTX_set_tlsext_ticket_keys(context_, keys.data(), static_cast<long>(keys.size())) != 1) {
+                    fail("Cannot set TLS ticket keys");
+                }
+            }
+        } else {
+            // Tickets are kept here, by peer, instead of in OpenSSL's cache
+            SSL_CTX_set_session_cache_mode(context_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(context_, &TlsContext::on_new_session);
+        }
+    }
+
+    // Keep the latest ticket a server sent, in place of the one before
+    static int on_new_session(SSL* ssl, SSL_SESSION* issued) {
+        auto* self = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        auto* peer = static_cast<std::string*>(SSL_get_ex_data(ssl, peer_index()));
+        if (!peer) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        auto [it, added] = self->sessions_.try_emplace(*peer, issued);
+        if (!added) {
+            SSL_SESSION_free(it->second);
+            it->second = issued;
+        } else if (self->sessions_.size() > self->max_cached_sessions_) {
+            // Any other peer's ticket makes way; it only costs that peer a full handshake
+            auto victim = it == self->sessions_.begin() ? std::next(it) : self->sessions_.begin();
+            SSL_SESSION_free(victim->second);
+            self->sessions_.erase(victim);
+        }
+        return 1;
+    }
+
+    // Index of the peer name a client connection's tickets are kept under
+    static int peer_index() {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+            [](void*, void* peer, CRYPTO_EX_DATA*, int, long, void*) { delete static_cast<std::string*>(peer); });
+        return index;
+    }
+
+    void use_certificates(const std::string& chain, const std::string& key) {
+        if (is_pem(chain)) {
+            auto bio = read_memory(chain);
+            X509* leaf = PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr);
+            if (!leaf || SSL_CTX_use_certificate(context_, leaf) != 1) {
+                X509_free(leaf);
+                fail("Cannot use TLS certificate");
+            }
+            X509_free(leaf);
+            while (X509* intermediate = PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr)) {
+                SSL_CTX_add0_chain_cert(context_, intermediate);
+            }
+            ERR_clear_error();
+        } else if (SSL_CTX_use_certificate_chain_file(context_, chain.c_str()) != 1) {
+            fail("Cannot read TLS certificate chain " + chain);
+        }
+
+        if (is_pem(key)) {
+            auto bio = read_memory(key);
+            EVP_PKEY* pkey = PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr);
+            if (!pkey || SSL_CTX_use_PrivateKey(context_, pkey) != 1) {
+                EVP_PKEY_free(pkey);
+                fail("Cannot use TLS private key");
+            }
+            EVP_PKEY_free(pkey);
+        } else if (SSL_CTX_use_PrivateKey_file(context_, key.c_str(), SSL_FILETYPE_PEM) != 1) {
+            fail("Cannot read TLS private key " + key);
+        }
+        if (SSL_CTX_check_private_key(context_) != 1) {
+            fail("TLS private key does not match the certificate");
+        }
+    }
+
+    void trust(const std::string& certificates) {
+        if (!is_pem(certificates)) {
+            if (SSL_CTX_load_verify_locations(context_, certificates.c_str(), nullptr) != 1) {
+                fail("Cannot read trusted certificates " + certificates);
+            }
+            return;
+        }
+        auto bio = read_memory(certificates);
+        X509_STORE* store = SSL_CTX_get_cert_store(context_);
+        int added = 0;
+        while (X509* certificate = PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr)) {
+            added += X509_STORE_add_cert(store, certificate) == 1 ? 1 : 0;
+            X509_free(certificate);
+        }
+        ERR_clear_error();
+        if (added == 0) {
+            throw std::runtime_error("No trusted certificates in the given PEM text");
+        }
+    }
+
+    static bool is_pem(const std::string& value) {
+        return value.find("-----BEGIN") != std::string::npos;
+    }
+
+    static std::unique_ptr<BIO, decltype(&BIO_free)> read_memory(const std::string& pem) {
+        return {BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size())), &BIO_free};
+    }
+
+    [[noreturn]] static void fail(const std::string& what) {
+        throw std::runtime_error(what + ": " + last_error());
+    }
+
+    const role role_;
+    const bool verify_;
+    const std::size_t max_cached_sessions_;
+    std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> owned_context_;
+    SSL_CTX* const context_;
+
+    mutable std::mutex mutex_;      // Guards the members below
+    // The latest ticket of each server a client connected to
+    std::unordered_map<std::string, SSL_SESSION*> sessions_;
+    stats stats_;
+};
+
+} // namespace network
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_TLS_CONTEXT_H
@@ -0,0 +1,226 @@
+#ifndef COLLABORATIVE_EDITOR_WEBSOCKET_FRAMING_H
+#define COLLABORATIVE_EDITOR_WEBSOCKET_FRAMING_H
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace collab {
+namespace network {
+
+/**
+ * WebSocket (RFC 6455) framing, for a TcpConnection that a browser or other
+ * WebSocket client upgrades
+ *
+ * A connection whose first bytes are an HTTP GET is taken for a WebSocket
+ * upgrade: the request is answered with 101 Switching Protocols, and from
+ * then on every frame read and written is a WebSocket frame instead of a
+ * newline-delimited or length-prefixed one. Text goes out as text frames
+ * and binary payloads as binary ones, so the clients of either transport
+ * are served by one pipeline: the same message handler, batching, codecs
+ * and fan-out.
+ *
+ * Fragmented messages are joined before they are delivered; pings are
+ * answered, and a close is echoed before the connection closes. Frames
+ * from a client must be masked, as the RFC requires, and are unmasked in
+ * place. Extensions and subprotocols are not negotiated.
+ */
+struct WebSocketFraming {
+    enum class opcode : std::uint8_t {
+        continuation = 0x0,
+        text = 0x1,
+        binary = 0x2,
+        close = 0x8,
+        ping = 0x9,
+        pong = 0xA
+    };
+
+    // Longest frame header: 2 bytes, a 64-bit length and a mask
+    static constexpr std::size_t MAX_HEADER_SIZE = 14;
+
+    // Longest upgrade request read before giving up on it
+    static constexpr std::size_t MAX_HANDSHAKE_SIZE = 16 * 1024;
+
+    // Whether data could still turn out to be, or already is, the start of an upgrade request
+    static bool may_be_upgrade(std::string_view data) {
+        constexpr std::string_view method = "GET ";
+        const std::size_t compared = std::min(data.size(), method.size());
+        return data.substr(0, compared) == method.substr(0, compared);
+    }
+
+    // A parsed upgrade request
+    struct handshake {
+        std::size_t size = 0;           // Bytes of the request; 0 until it is complete
+        std::optional<std::string> response;  // 101 for a valid upgrade, 400 otherwise
+        bool accepted = false;
+    };
+
+    /**
+     * Parse an upgrade request from the start of data
+     *
+     * @param data What was read so far
+     * @return The request's size, 0 while it is incomplete, and the response to send
+     */
+    static handshake parse_handshake(std::string_view data) {
+        handshake result;
+        const std::size_t end = data.find("\r\n\r\n");
+        if (end == std::string_view::npos) {
+            return result;
+        }
+        result.size = end + 4;
+        const std::string_view request = data.substr(0, end + 2);
+
+        std::optional<std::string_view> key;
+        bool upgrade = false;
+        std::size_t line = request.find("\r\n") + 2;
+        while (line < request.size()) {
+            const std::size_t next = request.find("\r\n", line);
+            const std::string_view header = request.substr(line, next - line);
+            line = next + 2;
+            const std::size_t colon = header.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            const std::string_view name = header.substr(0, colon);
+            const std::string_view value = trim(header.substr(colon + 1));
+            if (iequals(name, "Sec-WebSocket-Key")) {
+                key = value;
+            } else if (iequals(name, "Upgrade")) {
+                upgrade = iequals(value, "websocket");
+            }
+        }
+        if (!upgrade || !key || key->empty()) {
+            result.response = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+            return result;
+        }
+        result.response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: " + accept_key(*key) + "\r\n\r\n";
+        result.accepted = true;
+        return result;
+    }
+
+    // The Sec-WebSocket-Accept answering a Sec-WebSocket-Key
+    static std::string accept_key(std::string_view key) {
+        std::string input(key);
+        input += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        std::array<unsigned char, SHA_DIGEST_LENGTH> digest;
+        SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest.data());
+        std::array<unsigned char, 4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1> encoded;
+        const int length = EVP_EncodeBlock(encoded.data(), digest.data(), static_cast<int>(digest.size()));
+        return std::string(reinterpret_cast<const char*>(encoded.data()), static_cast<std::size_t>(length));
+    }
+
+    // A frame header read from the start of a buffer
+    struct frame {
+        bool complete_header = false;
+        bool fin = false;
+        opcode code = opcode::continuation;
+        bool masked = false;
+        std::array<std::uint8_t, 4> mask{};
+        std::size_t header_size = 0;
+        std::uint64_t length = 0;
+    };
+
+    // Read a frame header; complete_header is false until all of it has arrived
+    static frame parse_frame(std::string_view data) {
+        frame result;
+        if (data.size() < 2) {
+            return result;
+        }
+        const auto first = static_cast<std::uint8_t>(data[0]);
+        const auto second = static_cast<std::uint8_t>(data[1]);
+        result.fin = (first & 0x80) != 0;
+        result.code = static_cast<opcode>(first & 0x0F);
+        result.masked = (second & 0x80) != 0;
+        std::size_t size = 2;
+        std::size_t extended = 0;
+        result.length = second & 0x7F;
+        if (result.length == 126) {
+            extended = 2;
+        } else if (result.length == 127) {
+            extended = 8;
+        }
+        if (data.size() < size + extended + (result.masked ? 4 : 0)) {
+            return result;
+        }
+        if (extended > 0) {
+            result.length = 0;
+            for (std::size_t i = 0; i < extended; ++i) {
+                result.length = (result.length << 8) | static_cast<std::uint8_t>(data[size + i]);
+            }
+            size += extended;
+        }
+        if (result.masked) {
+            for (std::size_t i = 0; i < 4; ++i) {
+                result.mask[i] = static_cast<std::uint8_t>(data[size + i]);
+            }
+            size += 4;
+        }
+        result.header_size = size;
+        result.complete_header = true;
+        return result;
+    }
+
+    // Unmask a payload in place
+    static void unmask(char* payload, std::size_t size, const std::array<std::uint8_t, 4>& mask) {
+        for (std::size_t i = 0; i < size; ++i) {
+            payload[i] = static_cast<char>(static_cast<std::uint8_t>(payload[i]) ^ mask[i % 4]);
+        }
+    }
+
+    /**
+     * Write the header of an unmasked, unfragmented frame, as a server sends them
+     *
+     * @param code What the frame carries
+     * @param length Its payload's length
+     * @param out At least MAX_HEADER_SIZE bytes
+     * @return The header's size
+     */
+    static std::size_t write_header(opcode code, std::uint64_t length, char* out) {
+        out[0] = static_cast<char>(0x80 | static_cast<std::uint8_t>(code));
+        if (length < 126) {
+            out[1] = static_cast<char>(length);
+            return 2;
+        }
+        if (length <= 0xFFFF) {
+            out[1] = static_cast<char>(126);
+            out[2] = static_cast<char>((length >> 8) & 0xFF);
+            out[3] = static_cast<char>(length & 0xFF);
+            return 4;
+        }
+        out[1] = static_cast<char>(127);
+        for (std::size_t i = 0; i < 8; ++i) {
+            out[2 + i] = static_cast<char>((length >> (8 * (7 - i))) & 0xFF);
+        }
+        return 10;
+    }
+
+private:
+    static std::string_view trim(std::string_view value) {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+            value.remove_prefix(1);
+        }
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+            value.remove_suffix(1);
+        }
+        return value;
+    }
+
+    static bool iequals(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+};
+
+} // namespace network
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_WEBSOCKET_FRAMING_H
@@ -0,0 +1,142 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_CHUNKS_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_CHUNKS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Default size of the chunks a document is streamed in after the first range
+ */
+constexpr size_t DEFAULT_DOCUMENT_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * Check whether a DOC_OPEN asks for the document in chunks
+ *
+ * @param open The DOC_OPEN
+ * @return True if it names the range to send first
+ */
+inline bool isChunkedOpen(const DocumentMessage& open) {
+    return open.type == MessageType::DOC_OPEN && open.contentOffset.has_value() && open.contentLength.has_value();
+}
+
+/**
+ * Cuts the responses to a DOC_OPEN from one revision of a document
+ *
+ * A plain DOC_OPEN gets its whole content in one DOC_RESPONSE. A chunked
+ * one gets the range it asked for first, so the client can show it and
+ * take keystrokes, then the rest of the document after that range and
+ * then before it, chunkSize at a time. next() cuts one response at a time,
+ * so the server can send the first at once and the others as the
+ * connection drains, without holding them all.
+ *
+ * @tparam Content Document text with length() and substr(offset, length),
+ *         e.g. std::string or an ot::Rope snapshot, which stays as it was
+ *         while the document is edited on
+ */
+template <typename Content>
+class DocumentChunker {
+public:
+    /**
+     * @param open The DOC_OPEN being answered
+     * @param content The document as of version
+     * @param version Revision of content, sent with every chunk
+     * @param chunkSize Length of the chunks after the first range
+     */
+    DocumentChunker(const DocumentMessage& open, Content content, uint64_t version,
+                    size_t chunkSize = DEFAULT_DOCUMENT_CHUNK_SIZE)
+        : documentId_(open.documentId),
+          content_(std::move(content)),
+          version_(version),
+          chunkSize_(std::max<size_t>(chunkSize, 1)),
+          chunked_(isChunkedOpen(open)) {
+        const size_t length = content_.length();
+        if (chunked_) {
+            firstBegin_ = std::min<size_t>(*open.contentOffset, length);
+            firstEnd_ = firstBegin_ + std::min<size_t>(*open.contentLength, length - firstBegin_);
+        } else {
+            firstBegin_ = 0;
+            firstEnd_ = length;
+        }
+    }
+
+    /**
+     * Cut the next response
+     *
+     * @return The response, or std::nullopt once the whole document was sent
+     */
+    std::optional<DocumentMessage> next() {
+        const size_t length = content_.length();
+        size_t begin;
+        size_t end;
+        switch (stage_) {
+            case Stage::FIRST:
+                begin = firstBegin_;
+                end = firstEnd_;
+                stage_ = Stage::AFTER;
+                cursor_ = firstEnd_;
+                break;
+            case Stage::AFTER:
+                if (cursor_ < length) {
+                    begin = cursor_;
+                    end = std::min(length, cursor_ + chunkSize_);
+                    cursor_ = end;
+                    break;
+                }
+                stage_ = Stage::BEFORE;
+                cursor_ = 0;
+                [[fallthrough]];
+            case Stage::BEFORE:
+                if (cursor_ < firstBegin_) {
+                    begin = cursor_;
+                    end = std::min(firstBegin_, cursor_ + chunkSize_);
+                    cursor_ = end;
+                    break;
+                }
+                stage_ = Stage::DONE;
+                [[fallthrough]];
+            default:
+                return std::nullopt;
+        }
+        if (!chunked_) {
+            stage_ = Stage::DONE;
+        }
+
+        DocumentMessage response(MessageType::DOC_RESPONSE);
+        response.documentId = documentId_;
+        response.documentContent = content_.substr(begin, end - begin);
+        response.documentVersion = version_;
+        response.success = true;
+        if (chunked_) {
+            response.contentOffset = begin;
+            response.contentLength = length;
+        }
+        return response;
+    }
+
+private:
+    enum class Stage { FIRST, AFTER, BEFORE, DONE };
+
+    std::string documentId_;
+    Content content_;
+    uint64_t version_;
+    size_t chunkSize_;
+    bool chunked_;
+    size_t firstBegin_;
+    size_t firstEnd_;
+    Stage stage_ = Stage::FIRST;
+    size_t cursor_ = 0;
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_CHUNKS_H
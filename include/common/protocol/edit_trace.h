@@ -0,0 +1,122 @@
+#ifndef COLLABORATIVE_EDITOR_EDIT_TRACE_H
+#define COLLABORATIVE_EDITOR_EDIT_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <nlohmann/json.hpp>
+
+#include "common/protocol/protocol.h"
+#include "common/util/uuid_generator.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * The clock edit traces are stamped with: microseconds since the Unix epoch
+ *
+ * Wall-clock time, so stamps from the client and the server compare; the
+ * network stage is only as accurate as their clocks agree.
+ */
+inline uint64_t traceNowMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * The trace context of one edit, as EditMessage carries it
+ *
+ * A stamp of 0 was not taken. Operations sent as bare JSON carry the
+ * context under the same keys as EditMessage, next to their own fields.
+ */
+struct EditTrace {
+    std::string traceId;             // 32 hex digits; empty unless the edit is sampled
+    uint64_t originTime = 0;         // When the client made the edit
+    uint64_t serverReceiveTime = 0;  // When the server read it
+    uint64_t transformTime = 0;      // When the server had transformed it
+    uint64_t broadcastTime = 0;      // When the server queued it for the other clients
+
+    bool sampled() const {
+        return !traceId.empty();
+    }
+
+    // Mark the edit as sampled under a new trace ID, in the W3C / OpenTelemetry form
+    void sample() {
+        traceId = hex(util::UuidGenerator::getInstance().generate());
+    }
+
+    static EditTrace of(const EditMessage& message) {
+        EditTrace trace;
+        trace.traceId = message.traceId.value_or("");
+        trace.originTime = message.originTime.value_or(0);
+        trace.serverReceiveTime = message.serverReceiveTime.value_or(0);
+        trace.transformTime = message.transformTime.value_or(0);
+        trace.broadcastTime = message.broadcastTime.value_or(0);
+        return trace;
+    }
+
+    // Put the stamps taken into a message, e.g. the broadcast of the edit
+    void stamp(EditMessage& message) const {
+        if (sampled()) {
+            message.traceId = traceId;
+        }
+        stampIf(message.originTime, originTime);
+        stampIf(message.serverReceiveTime, serverReceiveTime);
+        stampIf(message.transformTime, transformTime);
+        stampIf(message.broadcastTime, broadcastTime);
+    }
+
+    /**
+     * Read the context from a message parsed as JSON; missing keys stay unset
+     *
+     * @throws nlohmann::json::exception if a key is there with the wrong type
+     */
+    static EditTrace fromJson(const nlohmann::json& j) {
+        EditTrace trace;
+        trace.traceId = j.value("traceId", std::string());
+        trace.originTime = j.value("originTime", uint64_t{0});
+        trace.serverReceiveTime = j.value("serverReceiveTime", uint64_t{0});
+        trace.transformTime = j.value("transformTime", uint64_t{0});
+        trace.broadcastTime = j.value("broadcastTime", uint64_t{0});
+        return trace;
+    }
+
+    void writeTo(nlohmann::json& j) const {
+        if (sampled()) {
+            j["traceId"] = traceId;
+        }
+        for (const auto& [key, time] : {std::pair{"originTime", originTime},
+                                        std::pair{"serverReceiveTime", serverReceiveTime},
+                                        std::pair{"transformTime", transformTime},
+                                        std::pair{"broadcastTime", broadcastTime}}) {
+            if (time != 0) {
+                j[key] = time;
+            }
+        }
+    }
+
+    // Random 64-bit span ID as 16 hex digits
+    static std::string newSpanId() {
+        return hex(util::UuidGenerator::getInstance().generate()).substr(16);
+    }
+
+private:
+    static void stampIf(std::optional<uint64_t>& field, uint64_t time) {
+        if (time != 0) {
+            field = time;
+        }
+    }
+
+    static std::string hex(const util::Uuid& uuid) {
+        std::string text = uuid.toString();
+        std::erase(text, '-');
+        return text;
+    }
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_EDIT_TRACE_H
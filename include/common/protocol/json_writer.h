@@ -0,0 +1,184 @@
+#ifndef COLLABORATIVE_EDITOR_JSON_WRITER_H
+#define COLLABORATIVE_EDITOR_JSON_WRITER_H
+
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Streaming JSON writer for protocol messages
+ *
+ * Appends tokens straight to one output buffer, so a message is serialized
+ * in a single pass without building a DOM. The output parses the same way
+ * as nlohmann::json's dump() of the equivalent object. clear() keeps the
+ * buffer's capacity, so a writer kept around for a connection or a thread
+ * stops allocating once it has seen its largest message.
+ *
+ * The writer does not check the structure it is given: keys must only be
+ * written inside objects, and every begin needs its end.
+ */
+class JsonWriter {
+public:
+    JsonWriter() = default;
+
+    // Write into a buffer of the caller's, e.g. from FramePool, reusing its capacity
+    explicit JsonWriter(std::string buffer) : buffer_(std::move(buffer)) {
+        buffer_.clear();
+    }
+
+    void beginObject() {
+        separate();
+        buffer_ += '{';
+        needComma_ = false;
+    }
+
+    void endObject() {
+        buffer_ += '}';
+        needComma_ = true;
+    }
+
+    void beginArray() {
+        separate();
+        buffer_ += '[';
+        needComma_ = false;
+    }
+
+    void endArray() {
+        buffer_ += ']';
+        needComma_ = true;
+    }
+
+    void key(std::string_view name) {
+        separate();
+        writeEscaped(name);
+        buffer_ += ':';
+        needComma_ = false;
+    }
+
+    void value(std::string_view text) {
+        separate();
+        writeEscaped(text);
+        needComma_ = true;
+    }
+
+    void value(const char* text) {
+        value(std::string_view(text));
+    }
+
+    void value(bool flag) {
+        separate();
+        buffer_ += flag ? "true" : "false";
+        needComma_ = true;
+    }
+
+    template <std::integral T>
+        requires(!std::same_as<T, bool>)
+    void value(T number) {
+        separate();
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), number);
+        buffer_.append(digits, result.ptr);
+        needComma_ = true;
+    }
+
+    void value(const std::vector<std::string>& list) {
+        beginArray();
+        for (const auto& item : list) {
+            value(item);
+        }
+        endArray();
+    }
+
+    void value(const std::map<std::string, std::string>& map) {
+        beginObject();
+        for (const auto& [name, text] : map) {
+            key(name);
+            value(text);
+        }
+        endObject();
+    }
+
+    /**
+     * Write a key and its value
+     *
+     * @param name The key
+     * @param content The value
+     */
+    template <typename T>
+    void field(std::string_view name, const T& content) {
+        key(name);
+        value(content);
+    }
+
+    // Write a key and its value only if the value is present
+    template <typename T>
+    void field(std::string_view name, const std::optional<T>& content) {
+        if (content.has_value()) {
+            field(name, *content);
+        }
+    }
+
+    // Start over, keeping the allocated capacity
+    void clear() {
+        buffer_.clear();
+        needComma_ = false;
+    }
+
+    const std::string& data() const { return buffer_; }
+    std::string take() { return std::move(buffer_); }
+
+private:
+    void separate() {
+        if (needComma_) {
+            buffer_ += ',';
+        }
+    }
+
+    // Write a quoted string, copying runs that need no escaping in one go
+    void writeEscaped(std::string_view text) {
+        static constexpr char hex[] = "0123456789abcdef";
+
+        buffer_ += '"';
+        size_t runStart = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            const auto c = static_cast<unsigned char>(text[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            buffer_.append(text.data() + runStart, i - runStart);
+            runStart = i + 1;
+            switch (c) {
+                case '"':  buffer_ += "\\\""; break;
+                case '\\': buffer_ += "\\\\"; break;
+                case '\b': buffer_ += "\\b"; break;
+                case '\f': buffer_ += "\\f"; break;
+                case '\n': buffer_ += "\\n"; break;
+                case '\r': buffer_ += "\\r"; break;
+                case '\t': buffer_ += "\\t"; break;
+                default:
+                    buffer_ += "\\u00";
+                    buffer_ += hex[c >> 4];
+                    buffer_ += hex[c & 0xF];
+                    break;
+            }
+        }
+        buffer_.append(text.data() + runStart, text.size() - runStart);
+        buffer_ += '"';
+    }
+
+    std::string buffer_;
+    bool needComma_ = false;
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_JSON_WRITER_H
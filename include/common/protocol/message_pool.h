@@ -0,0 +1,116 @@
+#ifndef COLLABORATIVE_EDITOR_MESSAGE_POOL_H
+#define COLLABORATIVE_EDITOR_MESSAGE_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common/protocol/message_schema.h"
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Per-thread free list of message structs of one type
+ *
+ * A pooled message is handed out cleared, as freshly constructed, but its
+ * strings keep their capacity. Decoding into one that carried a message
+ * of a similar size before does not allocate for its required strings, and
+ * the struct itself is not allocated at all. Optional strings and maps are
+ * rebuilt per message, as emptying them frees their memory.
+ *
+ * Messages go back to the pool of the thread that drops them, which keeps
+ * at most MAX_FREE.
+ *
+ * @tparam T A message struct with a fields() table
+ */
+template <typename T>
+class MessagePool {
+public:
+    static constexpr size_t MAX_FREE = 32;
+
+    struct Recycle {
+        void operator()(T* message) const {
+            Local* local = this_thread();
+            if (local && local->free.size() < MAX_FREE) {
+                local->free.emplace_back(message);
+            } else {
+                delete message;
+            }
+        }
+    };
+
+    using Pooled = std::unique_ptr<T, Recycle>;
+
+    /**
+     * Take a message, cleared to what the constructor would make of it
+     *
+     * @param type The message's type; must be one T carries
+     * @return The message, back in the pool once it is destroyed
+     * @throws std::invalid_argument if T does not carry type
+     */
+    static Pooled acquire(MessageType type) {
+        Local* local = this_thread();
+        if (!local || local->free.empty()) {
+            return Pooled(new T(type));
+        }
+        // Check the type the way the constructor does before it is reused
+        T checked(type);
+        std::unique_ptr<T> message = std::move(local->free.back());
+        local->free.pop_back();
+        reset(*message, checked);
+        return Pooled(message.release());
+    }
+
+    // Messages in the calling thread's list
+    static size_t freeCount() {
+        const Local* local = this_thread();
+        return local ? local->free.size() : 0;
+    }
+
+private:
+    struct Local {
+        std::vector<std::unique_ptr<T>> free;
+    };
+
+    // Clear every field in place, keeping string capacity, and copy the scalar ones from a fresh message
+    static void reset(T& message, const T& fresh) {
+        message.type = fresh.type;
+        message.clientId.clear();
+        message.sessionId.clear();
+        message.sequenceNumber = fresh.sequenceNumber;
+        message.timestamp = fresh.timestamp;
+        detail::forEachField(T::fields(), [&](const auto& f) {
+            auto& value = message.*f.member;
+            using V = std::decay_t<decltype(value)>;
+            if constexpr (std::is_same_v<V, std::string>) {
+                value.clear();
+            } else if constexpr (detail::IsCollection<V>::value) {
+                value.clear();
+            } else {
+                value = fresh.*f.member;
+            }
+        });
+    }
+
+    // The thread's list, or nullptr once the thread is tearing down its thread_locals
+    static Local* this_thread() {
+        thread_local bool destroyed = false;
+        if (destroyed) {
+            return nullptr;
+        }
+        thread_local struct Owner {
+            Local local;
+            ~Owner() { destroyed = true; }
+        } owner;
+        return &owner.local;
+    }
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MESSAGE_POOL_H
@@ -0,0 +1,155 @@
+#ifndef COLLABORATIVE_EDITOR_MESSAGE_ROUTER_H
+#define COLLABORATIVE_EDITOR_MESSAGE_ROUTER_H
+
+#include <functional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "common/protocol/message_view.h"
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Dispatches received frames to handlers registered per message struct
+ *
+ *     router.on<EditMessageView>([](const std::string& clientId, const EditMessageView& edit) { ... });
+ *     router.on<AuthMessage>([](const std::string& clientId, const AuthMessage& auth) { ... });
+ *     router.otherwise([](const std::string& clientId, const Message& message) { ... });
+ *
+ * route() decodes a frame straight into the struct its type calls for and
+ * calls that struct's handler; the type is looked at once and no variant
+ * is built. Edit and presence messages can be handled as views, which
+ * decode without copying, or as the owning structs, which are then copied
+ * out of the view. Messages without a handler of their own go to the
+ * fallback as their full struct, so it can still downcast them.
+ *
+ * Register handlers before frames are routed; routing does not lock.
+ *
+ * @tparam Context Arguments passed to every handler ahead of the message, e.g. the client ID
+ */
+template <typename... Context>
+class MessageRouter {
+public:
+    template <typename T>
+    using Handler = std::function<void(Context..., const T&)>;
+
+    // Sees a message ahead of its handler; returns true to say it took the message
+    template <typename T>
+    using Interceptor = std::function<bool(Context..., const T&)>;
+
+    /**
+     * Set the handler for one message struct or view
+     *
+     * @tparam T Message, AuthMessage, DocumentMessage, SyncMessage, EditMessage, EditMessageView,
+     *           PresenceMessage, PresenceMessageView or BatchMessage (an EDIT_BULK)
+     * @param handler The handler, replacing any earlier one for T
+     * @return This router, to chain registrations
+     */
+    template <typename T, typename Fn>
+    MessageRouter& on(Fn&& handler) {
+        std::get<Handler<T>>(handlers_) = std::forward<Fn>(handler);
+        return *this;
+    }
+
+    /**
+     * Set a function that sees every message of one struct before its handler does
+     *
+     * Meant for the server itself, e.g. to answer a DOC_OPEN for a
+     * document another node owns, or to refuse an edit sent too fast,
+     * whatever handlers the application sets. A message the interceptor
+     * returns true for goes no further. Edits are intercepted as views,
+     * whichever struct their handler takes.
+     *
+     * @tparam T Message, AuthMessage, DocumentMessage, SyncMessage or EditMessageView
+     * @param interceptor The interceptor, replacing any earlier one for T
+     * @return This router, to chain registrations
+     */
+    template <typename T, typename Fn>
+    MessageRouter& intercept(Fn&& interceptor) {
+        std::get<Interceptor<T>>(interceptors_) = std::forward<Fn>(interceptor);
+        return *this;
+    }
+
+    /**
+     * Set the handler for messages that have no handler of their own
+     *
+     * @param handler The handler, receiving the message through its base
+     * @return This router, to chain registrations
+     */
+    template <typename Fn>
+    MessageRouter& otherwise(Fn&& handler) {
+        fallback_ = std::forward<Fn>(handler);
+        return *this;
+    }
+
+    /**
+     * Decode a frame and call its handler
+     *
+     * @param codec The connection's codec
+     * @param frame The frame, valid until route() returns
+     * @param context The arguments to pass to the handler
+     * @throws std::runtime_error or nlohmann::json::exception if the frame is malformed
+     */
+    void route(WireCodec& codec, std::string_view frame, Context... context) {
+        codec.visit(frame, [&](const auto& message) {
+            dispatch(message, context...);
+        });
+    }
+
+private:
+    template <typename T>
+    void dispatch(const T& message, Context... context) {
+        if constexpr (std::is_same_v<T, EditMessage>) {
+            // Decoded from JSON; edits are intercepted as views all the same
+            if (const auto& interceptor = std::get<Interceptor<EditMessageView>>(interceptors_);
+                interceptor && interceptor(context..., EditMessageView(message))) {
+                return;
+            }
+        } else if constexpr (INTERCEPTABLE<T>) {
+            if (const auto& interceptor = std::get<Interceptor<T>>(interceptors_); interceptor && interceptor(context..., message)) {
+                return;
+            }
+        }
+        deliver(message, context...);
+    }
+
+    // Call the message's handler, once past its interceptor
+    template <typename T>
+    void deliver(const T& message, Context... context) {
+        if (const auto& handler = std::get<Handler<T>>(handlers_)) {
+            handler(context..., message);
+            return;
+        }
+        if constexpr (requires { message.toMessage(); }) {
+            // No view handler: hand over an owning copy, if anyone wants it
+            using Owned = decltype(message.toMessage());
+            if (std::get<Handler<Owned>>(handlers_) || fallback_) {
+                deliver(message.toMessage(), context...);
+            }
+        } else if (fallback_) {
+            fallback_(context..., message);
+        }
+    }
+
+    std::tuple<Handler<Message>, Handler<AuthMessage>, Handler<DocumentMessage>, Handler<SyncMessage>,
+               Handler<EditMessage>, Handler<EditMessageView>,
+               Handler<PresenceMessage>, Handler<PresenceMessageView>, Handler<BatchMessage>> handlers_;
+    template <typename T>
+    static constexpr bool INTERCEPTABLE = std::is_same_v<T, Message> || std::is_same_v<T, AuthMessage> ||
+                                          std::is_same_v<T, DocumentMessage> || std::is_same_v<T, SyncMessage> ||
+                                          std::is_same_v<T, EditMessageView>;
+
+    std::tuple<Interceptor<Message>, Interceptor<AuthMessage>, Interceptor<DocumentMessage>,
+               Interceptor<SyncMessage>, Interceptor<EditMessageView>> interceptors_;
+    Handler<Message> fallback_;
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MESSAGE_ROUTER_H
@@ -0,0 +1,334 @@
+#ifndef COLLABORATIVE_EDITOR_MESSAGE_SCHEMA_H
+#define COLLABORATIVE_EDITOR_MESSAGE_SCHEMA_H
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#ifdef COLLAB_SIMDJSON
+#include <simdjson.h>
+#endif
+
+#include "common/protocol/json_writer.h"
+#include "common/util/base64.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * How a field travels, beyond its type
+ */
+enum FieldFlags : uint8_t {
+    // Sent in the binary frame header instead of the body; only documentId
+    HEADER_FIELD = 1,
+    // Sent through the binary string table, for strings that repeat on a connection
+    INTERNED_FIELD = 2,
+    // Binary data, base64-encoded in JSON
+    BASE64_FIELD = 4
+};
+
+/**
+ * One field of a message: its name on the wire and the member holding it
+ *
+ * A member of type std::optional is an optional field, left out when
+ * empty. A list or map may be left out and then reads as empty. Any other
+ * member is required.
+ */
+template <typename Owner, typename T, uint8_t Flags>
+struct Field {
+    using owner_type = Owner;
+    using value_type = T;
+    static constexpr uint8_t flags = Flags;
+
+    std::string_view name;
+    T Owner::*member;
+};
+
+/**
+ * Describe a field, for a message's fields() table
+ *
+ * @tparam Flags FieldFlags for the field
+ * @param name The field's JSON key
+ * @param member The member holding it
+ */
+template <uint8_t Flags = 0, typename Owner, typename T>
+constexpr Field<Owner, T, Flags> field(std::string_view name, T Owner::*member) {
+    return {name, member};
+}
+
+namespace detail {
+
+template <typename T>
+struct IsOptional : std::false_type {};
+
+template <typename T>
+struct IsOptional<std::optional<T>> : std::true_type {
+    using value_type = T;
+};
+
+template <typename T>
+struct IsCollection : std::false_type {};
+
+template <typename T>
+struct IsCollection<std::vector<T>> : std::true_type {};
+
+template <typename K, typename V>
+struct IsCollection<std::map<K, V>> : std::true_type {};
+
+template <typename F>
+constexpr bool isOptionalField = IsOptional<typename F::value_type>::value;
+
+template <typename F>
+constexpr bool isRequiredField = !isOptionalField<F> && !IsCollection<typename F::value_type>::value;
+
+// Call a function with every field of a fields() table, in order
+template <typename Fields, typename Fn>
+constexpr void forEachField(const Fields& fields, Fn&& fn) {
+    std::apply([&fn](const auto&... each) { (fn(each), ...); }, fields);
+}
+
+/**
+ * Whether two tables describe the same fields in the same order
+ *
+ * For a view and the struct it views: the decoder of one and the encoder
+ * of the other must agree field by field.
+ */
+template <typename A, typename B>
+constexpr bool sameFields(const A& a, const B& b) {
+    if constexpr (std::tuple_size_v<A> != std::tuple_size_v<B>) {
+        return false;
+    } else {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+            return ((std::get<I>(a).name == std::get<I>(b).name &&
+                     isOptionalField<std::tuple_element_t<I, A>> == isOptionalField<std::tuple_element_t<I, B>> &&
+                     std::tuple_element_t<I, A>::flags == std::tuple_element_t<I, B>::flags) && ...);
+        }(std::make_index_sequence<std::tuple_size_v<A>>{});
+    }
+}
+
+template <typename Fields>
+constexpr size_t countOptionalFields() {
+    return []<size_t... I>(std::index_sequence<I...>) {
+        return (size_t{0} + ... + (isOptionalField<std::tuple_element_t<I, Fields>> ? 1 : 0));
+    }(std::make_index_sequence<std::tuple_size_v<Fields>>{});
+}
+
+// Assign one field's value to the matching field of another struct, e.g. a view
+template <typename To, typename From>
+void assignField(To& to, const From& from) {
+    if constexpr (std::is_assignable_v<To&, const From&>) {
+        to = from;
+    } else if constexpr (requires { from.toMap(); }) {
+        to = from.toMap();
+    } else {
+        to = To(from);
+    }
+}
+
+} // namespace detail
+
+/**
+ * Copy the fields one table describes to those of another, field by field
+ *
+ * For converting between a message and its view; the tables must list
+ * the same fields in the same order.
+ *
+ * @param to The struct to copy to
+ * @param toFields Its fields() table
+ * @param from The struct to copy from
+ * @param fromFields Its fields() table
+ */
+template <typename To, typename ToFields, typename From, typename FromFields>
+void copyFields(To& to, const ToFields& toFields, const From& from, const FromFields& fromFields) {
+    static_assert(std::tuple_size_v<ToFields> == std::tuple_size_v<FromFields>);
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (detail::assignField(to.*std::get<I>(toFields).member, from.*std::get<I>(fromFields).member), ...);
+    }(std::make_index_sequence<std::tuple_size_v<ToFields>>{});
+}
+
+/**
+ * Write the fields a table describes as JSON members
+ *
+ * @param writer The writer, inside the message's object
+ * @param message The message
+ * @param fields The message's fields() table
+ */
+template <typename Message, typename Fields>
+void writeJsonFields(JsonWriter& writer, const Message& message, const Fields& fields) {
+    detail::forEachField(fields, [&](const auto& f) {
+        using F = std::decay_t<decltype(f)>;
+        const auto& value = message.*f.member;
+        if constexpr ((F::flags & BASE64_FIELD) != 0) {
+            if (value.has_value()) {
+                writer.field(f.name, util::base64Encode(*value));
+            }
+        } else {
+            writer.field(f.name, value);
+        }
+    });
+}
+
+/**
+ * Read the fields a table describes from a JSON object, looking each key up once
+ *
+ * @param j The message's object
+ * @param message The message to fill in
+ * @param fields The message's fields() table
+ * @throws nlohmann::json::exception if a required field is missing or a field is mistyped
+ */
+template <typename Message, typename Fields>
+void readJsonFields(const nlohmann::json& j, Message& message, const Fields& fields) {
+    detail::forEachField(fields, [&](const auto& f) {
+        using F = std::decay_t<decltype(f)>;
+        using T = typename F::value_type;
+        auto& value = message.*f.member;
+        if constexpr (detail::isRequiredField<F>) {
+            // Assigns in place, so a reused message keeps its strings' capacity
+            j.at(f.name).get_to(value);
+        } else {
+            auto it = j.find(f.name);
+            if (it == j.end()) {
+                return;
+            }
+            if constexpr ((F::flags & BASE64_FIELD) != 0) {
+                value = util::base64Decode(it->template get<std::string>());
+            } else if constexpr (detail::isOptionalField<F>) {
+                value = it->template get<typename detail::IsOptional<T>::value_type>();
+            } else {
+                value = it->template get<T>();
+            }
+        }
+    });
+}
+
+#ifdef COLLAB_SIMDJSON
+
+namespace detail {
+
+// Read a value from simdjson's on-demand parser into a field's type; each throws simdjson::simdjson_error if mistyped
+inline void readSimdValue(simdjson::ondemand::value value, std::string& out) {
+    const std::string_view text = value.get_string();
+    out.assign(text.data(), text.size());
+}
+
+inline void readSimdValue(simdjson::ondemand::value value, bool& out) {
+    out = value.get_bool();
+}
+
+template <typename T>
+    requires(std::is_integral_v<T> && !std::is_same_v<T, bool>)
+void readSimdValue(simdjson::ondemand::value value, T& out) {
+    if constexpr (std::is_signed_v<T>) {
+        const int64_t number = value.get_int64();
+        if (number < std::numeric_limits<T>::min() || number > std::numeric_limits<T>::max()) {
+            throw simdjson::simdjson_error(simdjson::NUMBER_OUT_OF_RANGE);
+        }
+        out = static_cast<T>(number);
+    } else {
+        const uint64_t number = value.get_uint64();
+        if (number > std::numeric_limits<T>::max()) {
+            throw simdjson::simdjson_error(simdjson::NUMBER_OUT_OF_RANGE);
+        }
+        out = static_cast<T>(number);
+    }
+}
+
+template <typename T>
+void readSimdValue(simdjson::ondemand::value value, std::vector<T>& out) {
+    out.clear();
+    for (simdjson::ondemand::value element : value.get_array()) {
+        readSimdValue(element, out.emplace_back());
+    }
+}
+
+template <typename T>
+void readSimdValue(simdjson::ondemand::value value, std::map<std::string, T>& out) {
+    out.clear();
+    for (simdjson::ondemand::field member : value.get_object()) {
+        const std::string_view key = member.unescaped_key();
+        readSimdValue(member.value(), out[std::string(key)]);
+    }
+}
+
+template <typename T>
+void readSimdValue(simdjson::ondemand::value value, std::optional<T>& out) {
+    readSimdValue(value, out.emplace());
+}
+
+} // namespace detail
+
+/**
+ * Read one member of a JSON object into the field a table has for its key
+ *
+ * For simdjson's on-demand parser, which hands over an object's members
+ * one at a time in the order they come: the value is checked and read
+ * straight from the text into the message, with no DOM in between. The
+ * caller walks the object once and checks with checkSimdFields() at the
+ * end that nothing required was missing.
+ *
+ * @param key The member's key
+ * @param value Its value
+ * @param message The message to fill in
+ * @param fields The message's fields() table
+ * @return The field's index in the table, or std::nullopt if the table has none by that key
+ * @throws simdjson::simdjson_error if the value is mistyped
+ */
+template <typename Message, typename Fields>
+std::optional<size_t> readSimdField(std::string_view key, simdjson::ondemand::value value, Message& message,
+                                    const Fields& fields) {
+    static_assert(std::tuple_size_v<Fields> <= 64, "checkSimdFields() keeps one bit per field");
+    std::optional<size_t> index;
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        const auto read = [&](const auto& f, size_t at) {
+            using F = std::decay_t<decltype(f)>;
+            if (f.name != key) {
+                return false;
+            }
+            if constexpr ((F::flags & BASE64_FIELD) != 0) {
+                std::string encoded;
+                detail::readSimdValue(value, encoded);
+                message.*f.member = util::base64Decode(encoded);
+            } else {
+                detail::readSimdValue(value, message.*f.member);
+            }
+            index = at;
+            return true;
+        };
+        (read(std::get<I>(fields), I) || ...);
+    }(std::make_index_sequence<std::tuple_size_v<Fields>>{});
+    return index;
+}
+
+/**
+ * Check that every required field of a table was read with readSimdField()
+ *
+ * @param seen Bit i set for each index i that readSimdField() returned
+ * @param fields The message's fields() table
+ * @throws std::runtime_error naming the first required field that is missing
+ */
+template <typename Fields>
+void checkSimdFields(uint64_t seen, const Fields& fields) {
+    size_t at = 0;
+    detail::forEachField(fields, [&](const auto& f) {
+        using F = std::decay_t<decltype(f)>;
+        if (detail::isRequiredField<F> && (seen & (uint64_t{1} << at)) == 0) {
+            throw std::runtime_error("Missing field " + std::string(f.name));
+        }
+        ++at;
+    });
+}
+
+#endif // COLLAB_SIMDJSON
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MESSAGE_SCHEMA_H
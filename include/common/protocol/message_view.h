@@ -0,0 +1,231 @@
+#ifndef COLLABORATIVE_EDITOR_MESSAGE_VIEW_H
+#define COLLABORATIVE_EDITOR_MESSAGE_VIEW_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include "common/protocol/protocol.h"
+#include "common/util/binary_io.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Read-only string map of a message view
+ *
+ * Refers either to the encoded pairs inside a binary frame, parsed as they
+ * are iterated, or to the map of a decoded message.
+ */
+class MetadataView {
+public:
+    MetadataView() = default;
+
+    explicit MetadataView(const std::map<std::string, std::string>& map)
+        : map_(&map), count_(map.size()) {}
+
+    /**
+     * Refer to pairs encoded in a frame
+     *
+     * @param encoded The length-prefixed keys and values, back to back
+     * @param count Number of pairs
+     */
+    MetadataView(std::string_view encoded, size_t count)
+        : encoded_(encoded), count_(count) {}
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+
+    /**
+     * Call a function for every pair, in key order for decoded maps and wire order for frames
+     *
+     * @param fn Called with the key and value as string views
+     */
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        if (map_) {
+            for (const auto& [key, value] : *map_) {
+                fn(std::string_view(key), std::string_view(value));
+            }
+            return;
+        }
+        util::BinaryReader reader(encoded_);
+        for (size_t i = 0; i < count_; ++i) {
+            std::string_view key = reader.readString();
+            fn(key, reader.readString());
+        }
+    }
+
+    /**
+     * Look up a value
+     *
+     * @param key The key
+     * @return The value, if the key is present
+     */
+    std::optional<std::string_view> find(std::string_view key) const {
+        std::optional<std::string_view> found;
+        forEach([&](std::string_view name, std::string_view value) {
+            if (!found && name == key) {
+                found = value;
+            }
+        });
+        return found;
+    }
+
+    std::map<std::string, std::string> toMap() const {
+        std::map<std::string, std::string> map;
+        forEach([&](std::string_view key, std::string_view value) {
+            map.emplace(key, value);
+        });
+        return map;
+    }
+
+private:
+    const std::map<std::string, std::string>* map_ = nullptr;
+    std::string_view encoded_;
+    size_t count_ = 0;
+};
+
+/**
+ * Non-owning view of an edit message
+ *
+ * The string fields refer into the frame being decoded, or into the
+ * connection's string table, and are only valid until the handler that
+ * received the view returns. Use toMessage() to keep a copy.
+ */
+struct EditMessageView {
+    MessageType type = MessageType::EDIT_INSERT;
+    std::string_view clientId;
+    std::string_view sessionId;
+    uint64_t sequenceNumber = 0;
+    uint64_t timestamp = 0;
+    std::string_view documentId;
+    uint64_t documentVersion = 0;
+    std::string_view operationId;
+    std::optional<std::size_t> position;
+    std::optional<std::size_t> length;
+    std::optional<std::string_view> text;
+    std::optional<bool> success;
+    std::optional<std::string_view> errorMessage;
+    std::optional<util::Handle> documentHandle;
+    std::optional<std::string_view> traceId;
+    std::optional<uint64_t> originTime;
+    std::optional<uint64_t> serverReceiveTime;
+    std::optional<uint64_t> transformTime;
+    std::optional<uint64_t> broadcastTime;
+    std::optional<uint64_t> retryAfterMillis;
+    std::optional<uint64_t> contentHash;
+
+    // The fields after the base ones, as EditMessage::fields() lists them
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &EditMessageView::documentId),
+            field("documentVersion", &EditMessageView::documentVersion),
+            field("operationId", &EditMessageView::operationId),
+            field("position", &EditMessageView::position),
+            field("length", &EditMessageView::length),
+            field("text", &EditMessageView::text),
+            field("success", &EditMessageView::success),
+            field("errorMessage", &EditMessageView::errorMessage),
+            field("documentHandle", &EditMessageView::documentHandle),
+            field("traceId", &EditMessageView::traceId),
+            field("originTime", &EditMessageView::originTime),
+            field("serverReceiveTime", &EditMessageView::serverReceiveTime),
+            field("transformTime", &EditMessageView::transformTime),
+            field("broadcastTime", &EditMessageView::broadcastTime),
+            field("retryAfterMillis", &EditMessageView::retryAfterMillis),
+            field("contentHash", &EditMessageView::contentHash)
+        };
+    }
+
+    EditMessageView() = default;
+
+    explicit EditMessageView(const EditMessage& message)
+        : type(message.type)
+        , clientId(message.clientId)
+        , sessionId(message.sessionId)
+        , sequenceNumber(message.sequenceNumber)
+        , timestamp(message.timestamp) {
+        copyFields(*this, fields(), message, EditMessage::fields());
+    }
+
+    EditMessage toMessage() const {
+        EditMessage message(type);
+        message.clientId = clientId;
+        message.sessionId = sessionId;
+        message.sequenceNumber = sequenceNumber;
+        message.timestamp = timestamp;
+        copyFields(message, EditMessage::fields(), *this, fields());
+        return message;
+    }
+};
+
+/**
+ * Non-owning view of a presence message
+ *
+ * Valid until the handler that received it returns, like EditMessageView.
+ */
+struct PresenceMessageView {
+    MessageType type = MessageType::PRESENCE_UPDATE;
+    std::string_view clientId;
+    std::string_view sessionId;
+    uint64_t sequenceNumber = 0;
+    uint64_t timestamp = 0;
+    std::string_view documentId;
+    std::string_view username;
+    std::optional<std::string_view> displayName;
+    std::optional<std::size_t> cursorPosition;
+    std::optional<std::size_t> selectionStart;
+    std::optional<std::size_t> selectionEnd;
+    std::optional<std::string_view> userColor;
+    MetadataView metadata;
+    std::optional<util::Handle> documentHandle;
+
+    // The fields after the base ones, as PresenceMessage::fields() lists them
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &PresenceMessageView::documentId),
+            field<INTERNED_FIELD>("username", &PresenceMessageView::username),
+            field("displayName", &PresenceMessageView::displayName),
+            field("cursorPosition", &PresenceMessageView::cursorPosition),
+            field("selectionStart", &PresenceMessageView::selectionStart),
+            field("selectionEnd", &PresenceMessageView::selectionEnd),
+            field("userColor", &PresenceMessageView::userColor),
+            field("documentHandle", &PresenceMessageView::documentHandle),
+            field("metadata", &PresenceMessageView::metadata)
+        };
+    }
+
+    PresenceMessageView() = default;
+
+    explicit PresenceMessageView(const PresenceMessage& message)
+        : type(message.type)
+        , clientId(message.clientId)
+        , sessionId(message.sessionId)
+        , sequenceNumber(message.sequenceNumber)
+        , timestamp(message.timestamp) {
+        copyFields(*this, fields(), message, PresenceMessage::fields());
+    }
+
+    PresenceMessage toMessage() const {
+        PresenceMessage message(type);
+        message.clientId = clientId;
+        message.sessionId = sessionId;
+        message.sequenceNumber = sequenceNumber;
+        message.timestamp = timestamp;
+        copyFields(message, PresenceMessage::fields(), *this, fields());
+        return message;
+    }
+};
+
+// A view decodes what its message encodes, so their tables must not drift apart
+static_assert(detail::sameFields(EditMessageView::fields(), EditMessage::fields()));
+static_assert(detail::sameFields(PresenceMessageView::fields(), PresenceMessage::fields()));
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MESSAGE_VIEW_H
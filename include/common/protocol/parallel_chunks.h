@@ -0,0 +1,173 @@
+#ifndef COLLABORATIVE_EDITOR_PARALLEL_CHUNKS_H
+#define COLLABORATIVE_EDITOR_PARALLEL_CHUNKS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "common/protocol/document_chunks.h"
+#include "common/protocol/wire_codec.h"
+
+namespace collab {
+namespace protocol {
+
+// Takes each frame of a document, in order
+using FrameSink = std::function<void(std::string frame)>;
+
+namespace detail {
+
+// Worker threads to use for a requested count; 0 for one per core
+inline size_t chunkThreads(size_t threads) {
+    return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Run body(0) to body(count - 1) on up to threads threads, the caller's among them
+ * Rethrows the first exception a call threw, once every call has returned.
+ */
+inline void parallelFor(size_t count, size_t threads, const std::function<void(size_t)>& body) {
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    auto work = [&] {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                body(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> helpers;
+    helpers.reserve(threads - 1);
+    for (size_t i = 1; i < threads; ++i) {
+        helpers.emplace_back(work);
+    }
+    work();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+} // namespace detail
+
+/**
+ * Encode every response a DocumentChunker cuts, compressing them on several threads
+ *
+ * Deflate is what takes the time once a document runs to megabytes, so
+ * the responses are cut and encoded in order on the calling thread, as the
+ * codec's string tables need, and a window of them is then compressed at
+ * once, one frame per thread. Each window goes to the sink in order before
+ * the next is cut, so no more than a window of frames is held. Every
+ * response of a chunked open carries its offset and the total length,
+ * which is the index the client reassembles the document by; a plain open
+ * is one response, so only chunked ones gain from this.
+ *
+ * Without compression on the connection, frames are encoded and sent one
+ * at a time as with WireCodec::encode().
+ *
+ * @param chunker The responses to send
+ * @param codec The connection's codec; nothing else may encode with it meanwhile
+ * @param sink Takes each frame, in order, on the calling thread
+ * @param threads Threads to compress on, the caller's included; 0 for one per core
+ * @return Frames sent
+ * @throws whatever the sink throws, or std::runtime_error if a frame cannot be compressed
+ */
+template <typename Content>
+size_t encodeChunks(DocumentChunker<Content>& chunker, WireCodec& codec, const FrameSink& sink, size_t threads = 0) {
+    threads = detail::chunkThreads(threads);
+    size_t sent = 0;
+    if (!codec.compressing() || threads == 1) {
+        while (auto response = chunker.next()) {
+            sink(codec.encode(*response));
+            ++sent;
+        }
+        return sent;
+    }
+
+    // Enough frames per window that threads finishing early find another
+    const size_t window = threads * 4;
+    std::vector<std::string> frames;
+    frames.reserve(window);
+    for (;;) {
+        frames.clear();
+        while (frames.size() < window) {
+            auto response = chunker.next();
+            if (!response) {
+                break;
+            }
+            frames.push_back(codec.encodeUncompressed(*response));
+        }
+        if (frames.empty()) {
+            return sent;
+        }
+        detail::parallelFor(frames.size(), threads, [&](size_t i) {
+            frames[i] = codec.compressFrame(std::move(frames[i]));
+        });
+        for (auto& frame : frames) {
+            sink(std::move(frame));
+            ++sent;
+        }
+    }
+}
+
+/**
+ * Decode the frames of a document sent by encodeChunks(), inflating them on several threads
+ * The frames are inflated at once, then decoded in order on the calling
+ * thread, as the codec's string tables need.
+ *
+ * @param codec The connection's codec; nothing else may decode with it meanwhile
+ * @param frames The frames, in the order they were received
+ * @param threads Threads to inflate on, the caller's included; 0 for one per core
+ * @return The responses, in order
+ * @throws std::runtime_error if a frame is malformed or is not a document message
+ */
+inline std::vector<DocumentMessage> decodeChunks(WireCodec& codec, std::span<const std::string> frames,
+                                                 size_t threads = 0) {
+    std::vector<std::string> inflated(frames.size());
+    std::vector<char> compressed(frames.size(), 0);
+    detail::parallelFor(frames.size(), detail::chunkThreads(threads), [&](size_t i) {
+        compressed[i] = WireCodec::inflateFrame(frames[i], inflated[i]) ? 1 : 0;
+    });
+
+    std::vector<DocumentMessage> responses;
+    responses.reserve(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        DecodedMessage decoded = codec.decode(compressed[i] ? std::string_view(inflated[i]) : std::string_view(frames[i]));
+        auto* response = std::get_if<DocumentMessage>(&decoded);
+        if (!response) {
+            throw std::runtime_error("Not a document message in a chunked document");
+        }
+        responses.push_back(std::move(*response));
+    }
+    return responses;
+}
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_PARALLEL_CHUNKS_H
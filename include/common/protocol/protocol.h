@@ -5,11 +5,19 @@
 #include <vector>
 #include <map>
 #include <optional>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
 #include <variant>
 #include <chrono>
 #include <cstdint>
 #include <nlohmann/json.hpp>
 
+#include "common/protocol/json_writer.h"
+#include "common/protocol/message_schema.h"
+#include "common/util/base64.h"
+#include "common/util/handle_table.h"
+
 namespace collab {
 namespace protocol {
 
@@ -20,6 +28,7 @@ struct DocumentMessage;
 struct EditMessage;
 struct SyncMessage;
 struct PresenceMessage;
+struct BatchMessage;
 
 /**
  * Enumeration of message types
@@ -31,6 +40,7 @@ enum class MessageType {
     AUTH_REGISTER = 102,
     AUTH_SUCCESS = 103,
     AUTH_FAILURE = 104,
+    AUTH_RESUME = 105,
     
     // Document management messages
     DOC_CREATE = 200,
@@ -41,6 +51,7 @@ enum class MessageType {
     DOC_DELETE = 205,
     DOC_RENAME = 206,
     DOC_RESPONSE = 207,
+    DOC_SEARCH = 208,
     
     // Edit operation messages
     EDIT_INSERT = 300,
@@ -48,6 +59,7 @@ enum class MessageType {
     EDIT_REPLACE = 302,
     EDIT_APPLY = 303,
     EDIT_REJECT = 304,
+    EDIT_BULK = 305,
     
     // Synchronization messages
     SYNC_REQUEST = 400,
@@ -62,6 +74,9 @@ enum class MessageType {
     PRESENCE_SELECTION = 503,
     PRESENCE_UPDATE = 504,
     
+    // Batch messages
+    BATCH = 600,
+    
     // System messages
     SYS_ERROR = 900,
     SYS_INFO = 901,
@@ -69,6 +84,70 @@ enum class MessageType {
     SYS_DISCONNECT = 903
 };
 
+/**
+ * The message struct each message type is carried in
+ */
+enum class MessageKind {
+    BASE,
+    AUTH,
+    DOCUMENT,
+    EDIT,
+    SYNC,
+    PRESENCE,
+    BATCH
+};
+
+/**
+ * Get the message struct a type is carried in
+ *
+ * @param type The message type
+ * @return Its kind; types without fields of their own are BASE
+ */
+constexpr MessageKind kindOf(MessageType type) {
+    switch (type) {
+        case MessageType::AUTH_LOGIN:
+        case MessageType::AUTH_LOGOUT:
+        case MessageType::AUTH_REGISTER:
+        case MessageType::AUTH_SUCCESS:
+        case MessageType::AUTH_FAILURE:
+        case MessageType::AUTH_RESUME:
+        case MessageType::SYS_DISCONNECT:
+            return MessageKind::AUTH;
+        case MessageType::DOC_CREATE:
+        case MessageType::DOC_OPEN:
+        case MessageType::DOC_CLOSE:
+        case MessageType::DOC_LIST:
+        case MessageType::DOC_INFO:
+        case MessageType::DOC_DELETE:
+        case MessageType::DOC_RENAME:
+        case MessageType::DOC_RESPONSE:
+        case MessageType::DOC_SEARCH:
+            return MessageKind::DOCUMENT;
+        case MessageType::EDIT_INSERT:
+        case MessageType::EDIT_DELETE:
+        case MessageType::EDIT_REPLACE:
+        case MessageType::EDIT_APPLY:
+        case MessageType::EDIT_REJECT:
+            return MessageKind::EDIT;
+        case MessageType::SYNC_REQUEST:
+        case MessageType::SYNC_RESPONSE:
+        case MessageType::SYNC_STATE:
+        case MessageType::SYNC_ACK:
+            return MessageKind::SYNC;
+        case MessageType::PRESENCE_JOIN:
+        case MessageType::PRESENCE_LEAVE:
+        case MessageType::PRESENCE_CURSOR:
+        case MessageType::PRESENCE_SELECTION:
+        case MessageType::PRESENCE_UPDATE:
+            return MessageKind::PRESENCE;
+        case MessageType::BATCH:
+        case MessageType::EDIT_BULK:
+            return MessageKind::BATCH;
+        default:
+            return MessageKind::BASE;
+    }
+}
+
 /**
  * Base message structure
  */
@@ -89,24 +168,95 @@ struct Message {
     // Virtual destructor for polymorphic behavior
     virtual ~Message() = default;
     
+    /**
+     * Serialize the message as one JSON object
+     *
+     * Appends to the writer's buffer, so a caller that keeps a writer
+     * (and clears it between messages) serializes without allocating.
+     *
+     * @param writer The writer to append to
+     */
+    void writeTo(JsonWriter& writer) const {
+        writer.beginObject();
+        writeFields(writer);
+        writer.endObject();
+    }
+    
     // Utility for converting message to string
-    virtual std::string toString() const {
-        nlohmann::json j;
-        j["type"] = static_cast<int>(type);
-        j["clientId"] = clientId;
-        j["sessionId"] = sessionId;
-        j["sequenceNumber"] = sequenceNumber;
-        j["timestamp"] = timestamp;
-        return j.dump();
+    std::string toString() const {
+        JsonWriter writer;
+        writeTo(writer);
+        return writer.take();
     }
     
     // Utility for parsing a message from string
     static std::variant<Message, AuthMessage, DocumentMessage, EditMessage, 
-                        SyncMessage, PresenceMessage> fromString(const std::string& str);
+                        SyncMessage, PresenceMessage, BatchMessage> fromString(const std::string& str);
+    
+    /**
+     * Read a message of a known struct from parsed JSON
+     *
+     * @param j The parsed message; its type must be one that T carries
+     * @return The message
+     * @throws nlohmann::json::exception if a required field is missing or mistyped
+     */
+    template <typename T>
+    static T fromJson(const nlohmann::json& j) {
+        T msg(static_cast<MessageType>(j.at("type").get<int>()));
+        static_cast<Message&>(msg).readFields(j);
+        return msg;
+    }
+    
+    /**
+     * Read a message of a known struct from parsed JSON into one that already exists
+     *
+     * Sets the fields the JSON carries and leaves the others as they are,
+     * so msg should come cleared, e.g. from a MessagePool.
+     *
+     * @param j The parsed message; its type must be msg's
+     * @param msg The message to read into
+     * @throws nlohmann::json::exception if a required field is missing or mistyped
+     */
+    template <typename T>
+    static void fromJson(const nlohmann::json& j, T& msg) {
+        static_cast<Message&>(msg).readFields(j);
+    }
+
+protected:
+    // Read the fields of the message; overrides read the base fields first
+    virtual void readFields(const nlohmann::json& j) {
+        j.at("clientId").get_to(clientId);
+        j.at("sessionId").get_to(sessionId);
+        j.at("sequenceNumber").get_to(sequenceNumber);
+        j.at("timestamp").get_to(timestamp);
+    }
+    
+    // Write the fields of the message; overrides write the base fields first
+    virtual void writeFields(JsonWriter& writer) const {
+        writer.field("type", static_cast<int>(type));
+        writer.field("clientId", clientId);
+        writer.field("sessionId", sessionId);
+        writer.field("sequenceNumber", sequenceNumber);
+        writer.field("timestamp", timestamp);
+    }
 };
 
 /**
  * Authentication-related messages
+ *
+ * An AUTH_SUCCESS may carry a resume token in token. A client whose
+ * connection dropped sends AUTH_RESUME with that token on a new
+ * connection within the server's grace period, instead of logging in and
+ * opening its documents again; metadata maps each document to the last
+ * revision the client applied, if it knows better than its last SYNC_ACK.
+ * The server answers AUTH_SUCCESS with a new token and sends each
+ * document's missed operations only, or AUTH_FAILURE once the token has
+ * expired (see session_resumption.h).
+ *
+ * A server that is draining tells each client to go with SYS_DISCONNECT,
+ * which is carried here too: token is the client's resume token, and
+ * metadata "reconnect" where to connect to, if the server knows, and
+ * "reconnectAfterMillis" how long to wait first (see drain_schedule.h).
  */
 struct AuthMessage : public Message {
     std::string username;
@@ -114,6 +264,8 @@ struct AuthMessage : public Message {
     std::optional<std::string> token;
     std::optional<std::string> errorMessage;
     std::map<std::string, std::string> metadata;
+    // In AUTH_SUCCESS: the handle the server gave this connection's session
+    std::optional<util::Handle> sessionHandle;
     
     AuthMessage(MessageType type)
         : Message(type) {
@@ -121,27 +273,76 @@ struct AuthMessage : public Message {
             type != MessageType::AUTH_LOGOUT &&
             type != MessageType::AUTH_REGISTER && 
             type != MessageType::AUTH_SUCCESS && 
-            type != MessageType::AUTH_FAILURE) {
+            type != MessageType::AUTH_FAILURE &&
+            type != MessageType::AUTH_RESUME &&
+            type != MessageType::SYS_DISCONNECT) {
             throw std::invalid_argument("Invalid authentication message type");
         }
     }
     
-    std::string toString() const override {
-        nlohmann::json j = nlohmann::json::parse(Message::toString());
-        j["username"] = username;
-        
-        if (password.has_value()) j["password"] = *password;
-        if (token.has_value()) j["token"] = *token;
-        if (errorMessage.has_value()) j["errorMessage"] = *errorMessage;
-        
-        j["metadata"] = metadata;
-        
-        return j.dump();
+    // The fields after the base ones, in wire order (see message_schema.h)
+    static constexpr auto fields() {
+        return std::tuple{
+            field<INTERNED_FIELD>("username", &AuthMessage::username),
+            field("password", &AuthMessage::password),
+            field("token", &AuthMessage::token),
+            field("errorMessage", &AuthMessage::errorMessage),
+            field("sessionHandle", &AuthMessage::sessionHandle),
+            field("metadata", &AuthMessage::metadata)
+        };
+    }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writeJsonFields(writer, *this, fields());
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        readJsonFields(j, *this, fields());
     }
 };
 
 /**
  * Document management messages
+ *
+ * The DOC_RESPONSE to a DOC_OPEN can carry a documentHandle, a number the
+ * server gave the document for this connection. Edit, sync and presence
+ * messages on the connection may then name the document by that handle
+ * and leave documentId empty, so the server finds it by index instead of
+ * by hashing its ID. The handle is valid until the document is closed.
+ *
+ * A DOC_OPEN with contentOffset and contentLength asks for the document in
+ * chunks, starting with that range, usually what the client shows first.
+ * Each DOC_RESPONSE then carries one chunk in documentContent at
+ * contentOffset, with contentLength the length of the whole document and
+ * documentVersion the revision all the chunks are taken from (see
+ * document_chunks.h).
+ *
+ * In a cluster, the DOC_RESPONSE to a DOC_OPEN sent to a node that does
+ * not own the document fails, with metadata "redirect" the address of the
+ * node that does and "owner" its ID. A document moved to another node
+ * while open gets its clients the same DOC_RESPONSE, unasked, with
+ * metadata "migrated" and documentVersion the revision it moved at; each
+ * opens it there with documentVersion its last acknowledged revision.
+ *
+ * A read replica answers DOC_INFO and read-only DOC_OPEN from a copy that
+ * may trail the document, with metadata "replica", "staleRevisions" and
+ * "staleMillis"; metadata "maxStaleRevisions" or "maxStaleMillis" in the
+ * request bound that, and a replica further behind fails it with metadata
+ * "stale" (see document_replica.h).
+ *
+ * A DOC_SEARCH finds the documents that contain metadata "query"; its
+ * DOC_RESPONSE lists them in documentList, with each one's offsets in
+ * metadata "offsets:" + its ID (see search_index.h).
+ *
+ * A DOC_OPEN with metadata "subscription" "view" opens the document to
+ * view only: the client is sent, instead of every edit, a diff of the
+ * document per interval, the edits since the last one composed, with
+ * the revision it brings the document to. The client applies each as it
+ * comes, with no transforms or history, and may not edit; a DOC_OPEN
+ * without it makes the client an editor again (see view_feed.h).
  */
 struct DocumentMessage : public Message {
     std::string documentId;
@@ -153,6 +354,10 @@ struct DocumentMessage : public Message {
     std::map<std::string, std::string> metadata;
     std::optional<bool> success;
     std::optional<std::string> errorMessage;
+    std::optional<util::Handle> documentHandle;
+    // In a DOC_OPEN: the range to send first; in a DOC_RESPONSE: where the chunk goes and the whole length
+    std::optional<uint64_t> contentOffset;
+    std::optional<uint64_t> contentLength;
     
     DocumentMessage(MessageType type)
         : Message(type) {
@@ -163,32 +368,68 @@ struct DocumentMessage : public Message {
             type != MessageType::DOC_INFO &&
             type != MessageType::DOC_DELETE &&
             type != MessageType::DOC_RENAME &&
-            type != MessageType::DOC_RESPONSE) {
+            type != MessageType::DOC_RESPONSE &&
+            type != MessageType::DOC_SEARCH) {
             throw std::invalid_argument("Invalid document message type");
         }
     }
     
-    std::string toString() const override {
-        nlohmann::json j = nlohmann::json::parse(Message::toString());
-        j["documentId"] = documentId;
-        
-        if (documentName.has_value()) j["documentName"] = *documentName;
-        if (documentContent.has_value()) j["documentContent"] = *documentContent;
-        if (documentPath.has_value()) j["documentPath"] = *documentPath;
-        if (documentVersion.has_value()) j["documentVersion"] = *documentVersion;
-        
-        j["documentList"] = documentList;
-        j["metadata"] = metadata;
-        
-        if (success.has_value()) j["success"] = *success;
-        if (errorMessage.has_value()) j["errorMessage"] = *errorMessage;
-        
-        return j.dump();
+    // The fields after the base ones, in wire order (see message_schema.h)
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &DocumentMessage::documentId),
+            field("documentName", &DocumentMessage::documentName),
+            field("documentContent", &DocumentMessage::documentContent),
+            field("documentPath", &DocumentMessage::documentPath),
+            field("documentVersion", &DocumentMessage::documentVersion),
+            field("documentList", &DocumentMessage::documentList),
+            field("metadata", &DocumentMessage::metadata),
+            field("success", &DocumentMessage::success),
+            field("errorMessage", &DocumentMessage::errorMessage),
+            field("documentHandle", &DocumentMessage::documentHandle),
+            field("contentOffset", &DocumentMessage::contentOffset),
+            field("contentLength", &DocumentMessage::contentLength)
+        };
+    }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writeJsonFields(writer, *this, fields());
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        readJsonFields(j, *this, fields());
     }
 };
 
 /**
  * Edit operation messages
+ *
+ * An edit may carry trace context, for measuring the path from keystroke
+ * to remote render: the client sets originTime when the edit is made, the
+ * server adds serverReceiveTime, transformTime once the edit is
+ * transformed and broadcastTime once it is queued for the other clients,
+ * and a client receiving the broadcast has every stage up to its own
+ * render. Times are microseconds since the Unix epoch (see edit_trace.h).
+ * A traceId marks the edit as sampled, to be exported as a trace.
+ *
+ * An edit refused because its client or document is sending too fast is
+ * answered with an EDIT_REJECT carrying retryAfterMillis, how long to
+ * hold back before sending again (see rate_limiter.h). One without an
+ * operationId stands for frames dropped undecoded; the client resyncs.
+ *
+ * An EDIT_APPLY answering edits is cumulative: it acknowledges every edit
+ * its client sent on documentId with a sequenceNumber up to its own, so a
+ * client typing fast gets one per flush rather than one per keystroke,
+ * usually in the same BATCH as the edits broadcast to it (see
+ * ack_coalescer.h).
+ *
+ * An EDIT_APPLY may carry contentHash, the hash of the document as of
+ * documentVersion (see content_hash.h). A client with nothing else in
+ * flight compares it with its own, and on a mismatch finds the range
+ * that differs with SYNC_REQUEST probes (see SyncMessage).
  */
 struct EditMessage : public Message {
     std::string documentId;
@@ -199,6 +440,14 @@ struct EditMessage : public Message {
     std::optional<std::string> text;
     std::optional<bool> success;
     std::optional<std::string> errorMessage;
+    std::optional<util::Handle> documentHandle;
+    std::optional<std::string> traceId;
+    std::optional<uint64_t> originTime;
+    std::optional<uint64_t> serverReceiveTime;
+    std::optional<uint64_t> transformTime;
+    std::optional<uint64_t> broadcastTime;
+    std::optional<uint64_t> retryAfterMillis;
+    std::optional<uint64_t> contentHash;
     
     EditMessage(MessageType type)
         : Message(type)
@@ -212,24 +461,62 @@ struct EditMessage : public Message {
         }
     }
     
-    std::string toString() const override {
-        nlohmann::json j = nlohmann::json::parse(Message::toString());
-        j["documentId"] = documentId;
-        j["documentVersion"] = documentVersion;
-        j["operationId"] = operationId;
-        
-        if (position.has_value()) j["position"] = *position;
-        if (length.has_value()) j["length"] = *length;
-        if (text.has_value()) j["text"] = *text;
-        if (success.has_value()) j["success"] = *success;
-        if (errorMessage.has_value()) j["errorMessage"] = *errorMessage;
-        
-        return j.dump();
+    // The fields after the base ones, in wire order (see message_schema.h)
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &EditMessage::documentId),
+            field("documentVersion", &EditMessage::documentVersion),
+            field("operationId", &EditMessage::operationId),
+            field("position", &EditMessage::position),
+            field("length", &EditMessage::length),
+            field("text", &EditMessage::text),
+            field("success", &EditMessage::success),
+            field("errorMessage", &EditMessage::errorMessage),
+            field("documentHandle", &EditMessage::documentHandle),
+            field("traceId", &EditMessage::traceId),
+            field("originTime", &EditMessage::originTime),
+            field("serverReceiveTime", &EditMessage::serverReceiveTime),
+            field("transformTime", &EditMessage::transformTime),
+            field("broadcastTime", &EditMessage::broadcastTime),
+            field("retryAfterMillis", &EditMessage::retryAfterMillis),
+            field("contentHash", &EditMessage::contentHash)
+        };
+    }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writeJsonFields(writer, *this, fields());
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        readJsonFields(j, *this, fields());
     }
 };
 
 /**
  * Synchronization messages
+ *
+ * Besides operation lists and full document state, CRDT documents sync by
+ * delta: a SYNC_REQUEST carries the client's encoded version vector in
+ * stateVector, and the SYNC_RESPONSE carries only what the client is
+ * missing in delta (see common/crdt/delta_sync.h). Both are binary and are
+ * base64-encoded on the wire.
+ *
+ * A client whose document hashes differently from the server's finds
+ * where they diverge without sending either (see DivergenceSearch in
+ * content_hash.h): each SYNC_REQUEST asks for the hashes of a prefix and
+ * a suffix, prefixLength and suffixLength, and the SYNC_RESPONSE carries
+ * prefixHash and suffixHash with the document's contentHash,
+ * contentLength and revision in toVersion; a search restarts if the
+ * revision moves. Once the search is done, a SYNC_REQUEST with
+ * rangeOffset and rangeLength gets that range of the server's document
+ * in documentState, for the client to put in place of its own.
+ *
+ * A SYNC_ACK may also grant the server creditFrames more messages and
+ * creditBytes more bytes to send the client (see flow_credits.h); a
+ * client that never grants any is sent everything as it comes.
  */
 struct SyncMessage : public Message {
     std::string documentId;
@@ -237,8 +524,21 @@ struct SyncMessage : public Message {
     std::optional<uint64_t> toVersion;
     std::vector<std::string> operations;
     std::optional<std::string> documentState;
+    std::optional<std::string> stateVector;
+    std::optional<std::string> delta;
     std::optional<bool> success;
     std::optional<std::string> errorMessage;
+    std::optional<util::Handle> documentHandle;
+    std::optional<uint64_t> contentHash;
+    std::optional<std::size_t> contentLength;
+    std::optional<std::size_t> prefixLength;
+    std::optional<std::size_t> suffixLength;
+    std::optional<uint64_t> prefixHash;
+    std::optional<uint64_t> suffixHash;
+    std::optional<std::size_t> rangeOffset;
+    std::optional<std::size_t> rangeLength;
+    std::optional<uint64_t> creditFrames;
+    std::optional<uint64_t> creditBytes;
     
     SyncMessage(MessageType type)
         : Message(type) {
@@ -250,20 +550,41 @@ struct SyncMessage : public Message {
         }
     }
     
-    std::string toString() const override {
-        nlohmann::json j = nlohmann::json::parse(Message::toString());
-        j["documentId"] = documentId;
-        
-        if (fromVersion.has_value()) j["fromVersion"] = *fromVersion;
-        if (toVersion.has_value()) j["toVersion"] = *toVersion;
-        
-        j["operations"] = operations;
-        
-        if (documentState.has_value()) j["documentState"] = *documentState;
-        if (success.has_value()) j["success"] = *success;
-        if (errorMessage.has_value()) j["errorMessage"] = *errorMessage;
-        
-        return j.dump();
+    // The fields after the base ones, in wire order (see message_schema.h)
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &SyncMessage::documentId),
+            field("fromVersion", &SyncMessage::fromVersion),
+            field("toVersion", &SyncMessage::toVersion),
+            field("operations", &SyncMessage::operations),
+            field("documentState", &SyncMessage::documentState),
+            field<BASE64_FIELD>("stateVector", &SyncMessage::stateVector),
+            field<BASE64_FIELD>("delta", &SyncMessage::delta),
+            field("success", &SyncMessage::success),
+            field("errorMessage", &SyncMessage::errorMessage),
+            field("documentHandle", &SyncMessage::documentHandle),
+            field("contentHash", &SyncMessage::contentHash),
+            field("contentLength", &SyncMessage::contentLength),
+            field("prefixLength", &SyncMessage::prefixLength),
+            field("suffixLength", &SyncMessage::suffixLength),
+            field("prefixHash", &SyncMessage::prefixHash),
+            field("suffixHash", &SyncMessage::suffixHash),
+            field("rangeOffset", &SyncMessage::rangeOffset),
+            field("rangeLength", &SyncMessage::rangeLength),
+            field("creditFrames", &SyncMessage::creditFrames),
+            field("creditBytes", &SyncMessage::creditBytes)
+        };
+    }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writeJsonFields(writer, *this, fields());
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        readJsonFields(j, *this, fields());
     }
 };
 
@@ -279,6 +600,7 @@ struct PresenceMessage : public Message {
     std::optional<std::size_t> selectionEnd;
     std::optional<std::string> userColor;
     std::map<std::string, std::string> metadata;
+    std::optional<util::Handle> documentHandle;
     
     PresenceMessage(MessageType type)
         : Message(type) {
@@ -291,161 +613,358 @@ struct PresenceMessage : public Message {
         }
     }
     
-    std::string toString() const override {
-        nlohmann::json j = nlohmann::json::parse(Message::toString());
-        j["documentId"] = documentId;
-        j["username"] = username;
-        
-        if (displayName.has_value()) j["displayName"] = *displayName;
-        if (cursorPosition.has_value()) j["cursorPosition"] = *cursorPosition;
-        if (selectionStart.has_value()) j["selectionStart"] = *selectionStart;
-        if (selectionEnd.has_value()) j["selectionEnd"] = *selectionEnd;
-        if (userColor.has_value()) j["userColor"] = *userColor;
-        
-        j["metadata"] = metadata;
-        
-        return j.dump();
+    // The fields after the base ones, in wire order (see message_schema.h)
+    static constexpr auto fields() {
+        return std::tuple{
+            field<HEADER_FIELD>("documentId", &PresenceMessage::documentId),
+            field<INTERNED_FIELD>("username", &PresenceMessage::username),
+            field("displayName", &PresenceMessage::displayName),
+            field("cursorPosition", &PresenceMessage::cursorPosition),
+            field("selectionStart", &PresenceMessage::selectionStart),
+            field("selectionEnd", &PresenceMessage::selectionEnd),
+            field("userColor", &PresenceMessage::userColor),
+            field("documentHandle", &PresenceMessage::documentHandle),
+            field("metadata", &PresenceMessage::metadata)
+        };
+    }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writeJsonFields(writer, *this, fields());
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        readJsonFields(j, *this, fields());
     }
 };
 
-// Implementation of the fromString method
-inline std::variant<Message, AuthMessage, DocumentMessage, EditMessage, 
-                     SyncMessage, PresenceMessage> Message::fromString(const std::string& str) {
-    nlohmann::json j = nlohmann::json::parse(str);
-    MessageType type = static_cast<MessageType>(j["type"].get<int>());
+/**
+ * Several messages carried in one frame
+ *
+ * Each element is a complete message, for any document, nested as a native
+ * object rather than as a string. Receivers handle the elements one by one
+ * and in order, as if each had arrived in a frame of its own (see
+ * WireCodec::visit). Elements are shared, so a server can batch one message
+ * for many recipients without copying it for each.
+ *
+ * Any message but an authentication message or another batch can be
+ * carried: wire format negotiation only looks at frames' top level.
+ *
+ * An EDIT_BULK is a batch of edits applied as one transaction, e.g. a
+ * find and replace across files by an automation client. Receivers
+ * handle it whole rather than element by element. The edits of each
+ * document apply in order, each on the text the ones before it left, and
+ * share one documentVersion; the server composes them into one operation
+ * and applies it or none of them, as one history entry and one broadcast.
+ * Each document is answered with an EDIT_APPLY or EDIT_REJECT carrying
+ * the bulk edit's sequenceNumber (see bulk_editor.h).
+ */
+struct BatchMessage : public Message {
+    std::vector<std::shared_ptr<const Message>> messages;
     
-    // Authentication messages
-    if (type == MessageType::AUTH_LOGIN || 
-        type == MessageType::AUTH_LOGOUT ||
-        type == MessageType::AUTH_REGISTER ||
-        type == MessageType::AUTH_SUCCESS ||
-        type == MessageType::AUTH_FAILURE) {
-        
-        AuthMessage msg(type);
-        msg.clientId = j["clientId"];
-        msg.sessionId = j["sessionId"];
-        msg.sequenceNumber = j["sequenceNumber"];
-        msg.timestamp = j["timestamp"];
-        msg.username = j["username"];
-        
-        if (j.contains("password")) msg.password = j["password"];
-        if (j.contains("token")) msg.token = j["token"];
-        if (j.contains("errorMessage")) msg.errorMessage = j["errorMessage"];
-        if (j.contains("metadata")) msg.metadata = j["metadata"].get<std::map<std::string, std::string>>();
-        
-        return msg;
+    BatchMessage(MessageType type)
+        : Message(type) {
+        if (type != MessageType::BATCH && type != MessageType::EDIT_BULK) {
+            throw std::invalid_argument("Invalid batch message type");
+        }
     }
     
-    // Document messages
-    else if (type == MessageType::DOC_CREATE ||
-             type == MessageType::DOC_OPEN ||
-             type == MessageType::DOC_CLOSE ||
-             type == MessageType::DOC_LIST ||
-             type == MessageType::DOC_INFO ||
-             type == MessageType::DOC_DELETE ||
-             type == MessageType::DOC_RENAME ||
-             type == MessageType::DOC_RESPONSE) {
-        
-        DocumentMessage msg(type);
-        msg.clientId = j["clientId"];
-        msg.sessionId = j["sessionId"];
-        msg.sequenceNumber = j["sequenceNumber"];
-        msg.timestamp = j["timestamp"];
-        msg.documentId = j["documentId"];
-        
-        if (j.contains("documentName")) msg.documentName = j["documentName"];
-        if (j.contains("documentContent")) msg.documentContent = j["documentContent"];
-        if (j.contains("documentPath")) msg.documentPath = j["documentPath"];
-        if (j.contains("documentVersion")) msg.documentVersion = j["documentVersion"];
-        if (j.contains("documentList")) msg.documentList = j["documentList"].get<std::vector<std::string>>();
-        if (j.contains("metadata")) msg.metadata = j["metadata"].get<std::map<std::string, std::string>>();
-        if (j.contains("success")) msg.success = j["success"];
-        if (j.contains("errorMessage")) msg.errorMessage = j["errorMessage"];
-        
-        return msg;
+    // Whether messages of a type can be carried in a batch
+    static bool canCarry(MessageType type) {
+        const MessageKind kind = kindOf(type);
+        return kind != MessageKind::AUTH && kind != MessageKind::BATCH;
     }
     
-    // Edit messages
-    else if (type == MessageType::EDIT_INSERT ||
-             type == MessageType::EDIT_DELETE ||
-             type == MessageType::EDIT_REPLACE ||
-             type == MessageType::EDIT_APPLY ||
-             type == MessageType::EDIT_REJECT) {
-        
-        EditMessage msg(type);
-        msg.clientId = j["clientId"];
-        msg.sessionId = j["sessionId"];
-        msg.sequenceNumber = j["sequenceNumber"];
-        msg.timestamp = j["timestamp"];
-        msg.documentId = j["documentId"];
-        msg.documentVersion = j["documentVersion"];
-        msg.operationId = j["operationId"];
-        
-        if (j.contains("position")) msg.position = j["position"];
-        if (j.contains("length")) msg.length = j["length"];
-        if (j.contains("text")) msg.text = j["text"];
-        if (j.contains("success")) msg.success = j["success"];
-        if (j.contains("errorMessage")) msg.errorMessage = j["errorMessage"];
-        
-        return msg;
+    /**
+     * Copy a message into an element that batches can share
+     *
+     * @param message The message, as its full struct
+     * @return The copy
+     * @throws std::invalid_argument if the message cannot be batched or is not the struct its type calls for
+     */
+    static std::shared_ptr<const Message> share(const Message& message) {
+        switch (kindOf(message.type)) {
+            case MessageKind::DOCUMENT:
+                return copyAs<DocumentMessage>(message);
+            case MessageKind::EDIT:
+                return copyAs<EditMessage>(message);
+            case MessageKind::SYNC:
+                return copyAs<SyncMessage>(message);
+            case MessageKind::PRESENCE:
+                return copyAs<PresenceMessage>(message);
+            case MessageKind::BASE:
+                return std::make_shared<const Message>(message);
+            case MessageKind::AUTH:
+            case MessageKind::BATCH:
+            default:
+                throw std::invalid_argument("Message type cannot be batched");
+        }
+    }
+    
+    /**
+     * Append a message
+     *
+     * @param message The message, shared if it came from share()
+     * @throws std::invalid_argument if the message cannot be batched
+     */
+    void add(std::shared_ptr<const Message> message) {
+        if (!canCarry(message->type)) {
+            throw std::invalid_argument("Message type cannot be batched");
+        }
+        messages.push_back(std::move(message));
+    }
+    
+    void add(const Message& message) {
+        messages.push_back(share(message));
+    }
+    
+    size_t size() const { return messages.size(); }
+    bool empty() const { return messages.empty(); }
+    
+protected:
+    void writeFields(JsonWriter& writer) const override {
+        Message::writeFields(writer);
+        writer.key("messages");
+        writer.beginArray();
+        for (const auto& message : messages) {
+            message->writeTo(writer);
+        }
+        writer.endArray();
+    }
+    
+    void readFields(const nlohmann::json& j) override {
+        Message::readFields(j);
+        messages.clear();
+        for (const auto& element : j.at("messages")) {
+            const MessageType elementType = static_cast<MessageType>(element.at("type").get<int>());
+            switch (kindOf(elementType)) {
+                case MessageKind::DOCUMENT:
+                    messages.push_back(std::make_shared<const DocumentMessage>(fromJson<DocumentMessage>(element)));
+                    break;
+                case MessageKind::EDIT:
+                    messages.push_back(std::make_shared<const EditMessage>(fromJson<EditMessage>(element)));
+                    break;
+                case MessageKind::SYNC:
+                    messages.push_back(std::make_shared<const SyncMessage>(fromJson<SyncMessage>(element)));
+                    break;
+                case MessageKind::PRESENCE:
+                    messages.push_back(std::make_shared<const PresenceMessage>(fromJson<PresenceMessage>(element)));
+                    break;
+                case MessageKind::BASE:
+                    messages.push_back(std::make_shared<const Message>(fromJson<Message>(element)));
+                    break;
+                case MessageKind::AUTH:
+                case MessageKind::BATCH:
+                    throw std::invalid_argument("Message type cannot be batched");
+            }
+        }
+    }
+    
+private:
+    template <typename T>
+    static std::shared_ptr<const Message> copyAs(const Message& message) {
+        const auto* typed = dynamic_cast<const T*>(&message);
+        if (!typed) {
+            throw std::invalid_argument("Message type does not match its struct");
+        }
+        return std::make_shared<const T>(*typed);
+    }
+};
+
+/**
+ * Reads messages from JSON text
+ *
+ * parse() a message, then read() it into the struct its type calls for.
+ * Built with COLLAB_SIMDJSON (the ENABLE_SIMDJSON option), this runs
+ * simdjson's on-demand parser: each member is checked and read straight
+ * from the text into the struct in one pass, with no DOM in between, and
+ * the parser and its padded copy of the text are kept from one message
+ * to the next. Otherwise the text is parsed into an nlohmann::json and
+ * read with fromJson(), which stays the way to read JSON that is already
+ * parsed, e.g. in tests and tools.
+ *
+ * Not thread-safe; each thread uses its own, from local().
+ */
+class JsonMessageReader {
+public:
+    // The calling thread's reader
+    static JsonMessageReader& local() {
+        thread_local JsonMessageReader reader;
+        return reader;
+    }
+    
+    /**
+     * Parse a message's text
+     *
+     * @param text The message; it is copied, so it need not outlive the reader
+     * @return The message's type, which picks the struct to read() it into
+     * @throws simdjson::simdjson_error or nlohmann::json::exception if the text is not an object with a type
+     */
+    MessageType parse(std::string_view text) {
+#ifdef COLLAB_SIMDJSON
+        text_.assign(text.data(), text.size());
+        text_.reserve(text_.size() + simdjson::SIMDJSON_PADDING);
+        document_ = parser_.iterate(text_.data(), text_.size(), text_.capacity());
+        type_ = static_cast<MessageType>(int64_t(document_["type"]));
+        document_.rewind();
+#else
+        json_ = nlohmann::json::parse(text);
+        type_ = static_cast<MessageType>(json_.at("type").get<int>());
+#endif
+        return type_;
     }
     
-    // Sync messages
-    else if (type == MessageType::SYNC_REQUEST ||
-             type == MessageType::SYNC_RESPONSE ||
-             type == MessageType::SYNC_STATE ||
-             type == MessageType::SYNC_ACK) {
-        
-        SyncMessage msg(type);
-        msg.clientId = j["clientId"];
-        msg.sessionId = j["sessionId"];
-        msg.sequenceNumber = j["sequenceNumber"];
-        msg.timestamp = j["timestamp"];
-        msg.documentId = j["documentId"];
-        
-        if (j.contains("fromVersion")) msg.fromVersion = j["fromVersion"];
-        if (j.contains("toVersion")) msg.toVersion = j["toVersion"];
-        if (j.contains("operations")) msg.operations = j["operations"].get<std::vector<std::string>>();
-        if (j.contains("documentState")) msg.documentState = j["documentState"];
-        if (j.contains("success")) msg.success = j["success"];
-        if (j.contains("errorMessage")) msg.errorMessage = j["errorMessage"];
-        
+    /**
+     * Read the parsed message into a new struct
+     *
+     * @tparam T The struct its type calls for
+     * @return The message
+     * @throws simdjson::simdjson_error, nlohmann::json::exception or std::runtime_error
+     *         if a required field is missing or a field is mistyped
+     */
+    template <typename T>
+    T read() {
+        T msg(type_);
+        read(msg);
         return msg;
     }
     
-    // Presence messages
-    else if (type == MessageType::PRESENCE_JOIN ||
-             type == MessageType::PRESENCE_LEAVE ||
-             type == MessageType::PRESENCE_CURSOR ||
-             type == MessageType::PRESENCE_SELECTION ||
-             type == MessageType::PRESENCE_UPDATE) {
-        
-        PresenceMessage msg(type);
-        msg.clientId = j["clientId"];
-        msg.sessionId = j["sessionId"];
-        msg.sequenceNumber = j["sequenceNumber"];
-        msg.timestamp = j["timestamp"];
-        msg.documentId = j["documentId"];
-        msg.username = j["username"];
-        
-        if (j.contains("displayName")) msg.displayName = j["displayName"];
-        if (j.contains("cursorPosition")) msg.cursorPosition = j["cursorPosition"];
-        if (j.contains("selectionStart")) msg.selectionStart = j["selectionStart"];
-        if (j.contains("selectionEnd")) msg.selectionEnd = j["selectionEnd"];
-        if (j.contains("userColor")) msg.userColor = j["userColor"];
-        if (j.contains("metadata")) msg.metadata = j["metadata"].get<std::map<std::string, std::string>>();
-        
+    /**
+     * Read the parsed message into one that already exists
+     *
+     * Sets the fields the text carries and leaves the others as they are,
+     * so msg should come cleared, e.g. from a MessagePool.
+     *
+     * @param msg The message to read into; its type must be the parsed one's
+     */
+    template <typename T>
+    void read(T& msg) {
+#ifdef COLLAB_SIMDJSON
+        readObject(document_.get_object(), msg);
+        if (!document_.at_end()) {
+            throw simdjson::simdjson_error(simdjson::TRAILING_CONTENT);
+        }
+#else
+        Message::fromJson(json_, msg);
+#endif
+    }
+
+private:
+#ifdef COLLAB_SIMDJSON
+    // Read an object's members in the order they come, then check the required ones were there
+    template <typename T>
+    static void readObject(simdjson::ondemand::object object, T& msg) {
+        constexpr uint8_t ALL_BASE_FIELDS = 0xF;
+        uint8_t baseSeen = 0;
+        uint64_t seen = 0;
+        bool hasMessages = false;
+        for (simdjson::ondemand::field member : object) {
+            const std::string_view key = member.unescaped_key();
+            simdjson::ondemand::value value = member.value();
+            if (key == "type") {
+                continue;
+            } else if (key == "clientId") {
+                detail::readSimdValue(value, msg.clientId);
+                baseSeen |= 1;
+            } else if (key == "sessionId") {
+                detail::readSimdValue(value, msg.sessionId);
+                baseSeen |= 2;
+            } else if (key == "sequenceNumber") {
+                detail::readSimdValue(value, msg.sequenceNumber);
+                baseSeen |= 4;
+            } else if (key == "timestamp") {
+                detail::readSimdValue(value, msg.timestamp);
+                baseSeen |= 8;
+            } else if constexpr (std::is_same_v<T, BatchMessage>) {
+                if (key == "messages") {
+                    msg.messages.clear();
+                    for (simdjson::ondemand::object element : value.get_array()) {
+                        msg.messages.push_back(readElement(element));
+                    }
+                    hasMessages = true;
+                }
+            } else if constexpr (!std::is_same_v<T, Message>) {
+                if (const auto index = readSimdField(key, value, msg, T::fields())) {
+                    seen |= uint64_t{1} << *index;
+                }
+            }
+        }
+        if (baseSeen != ALL_BASE_FIELDS) {
+            throw std::runtime_error("Missing base field");
+        }
+        if constexpr (std::is_same_v<T, BatchMessage>) {
+            if (!hasMessages) {
+                throw std::runtime_error("Missing field messages");
+            }
+        } else if constexpr (!std::is_same_v<T, Message>) {
+            checkSimdFields(seen, T::fields());
+        }
+    }
+    
+    // Read an element of a batch, whose type has to be found before its members are read
+    static std::shared_ptr<const Message> readElement(simdjson::ondemand::object object) {
+        const auto type = static_cast<MessageType>(int64_t(object["type"]));
+        object.reset();
+        switch (kindOf(type)) {
+            case MessageKind::DOCUMENT:
+                return readShared<DocumentMessage>(object, type);
+            case MessageKind::EDIT:
+                return readShared<EditMessage>(object, type);
+            case MessageKind::SYNC:
+                return readShared<SyncMessage>(object, type);
+            case MessageKind::PRESENCE:
+                return readShared<PresenceMessage>(object, type);
+            case MessageKind::BASE:
+                return readShared<Message>(object, type);
+            case MessageKind::AUTH:
+            case MessageKind::BATCH:
+            default:
+                throw std::invalid_argument("Message type cannot be batched");
+        }
+    }
+    
+    template <typename T>
+    static std::shared_ptr<const Message> readShared(simdjson::ondemand::object object, MessageType type) {
+        auto msg = std::make_shared<T>(type);
+        readObject(object, *msg);
         return msg;
     }
     
-    // Default case: basic message
-    Message msg(type);
-    msg.clientId = j["clientId"];
-    msg.sessionId = j["sessionId"];
-    msg.sequenceNumber = j["sequenceNumber"];
-    msg.timestamp = j["timestamp"];
+    simdjson::ondemand::parser parser_;
+    simdjson::ondemand::document document_;
+    // The text being read, with the padding the parser reads past its end
+    std::string text_;
+#else
+    nlohmann::json json_;
+#endif
+    MessageType type_ = MessageType::SYS_ERROR;
+};
+
+// Implementation of the fromString method
+inline std::variant<Message, AuthMessage, DocumentMessage, EditMessage, 
+                     SyncMessage, PresenceMessage, BatchMessage> Message::fromString(const std::string& str) {
+    JsonMessageReader& reader = JsonMessageReader::local();
+    const MessageType type = reader.parse(str);
     
-    return msg;
+    switch (kindOf(type)) {
+        case MessageKind::AUTH:
+            return reader.read<AuthMessage>();
+        case MessageKind::DOCUMENT:
+            return reader.read<DocumentMessage>();
+        case MessageKind::EDIT:
+            return reader.read<EditMessage>();
+        case MessageKind::SYNC:
+            return reader.read<SyncMessage>();
+        case MessageKind::PRESENCE:
+            return reader.read<PresenceMessage>();
+        case MessageKind::BATCH:
+            return reader.read<BatchMessage>();
+        case MessageKind::BASE:
+        default:
+            return reader.read<Message>();
+    }
 }
 
 } // namespace protocol
@@ -0,0 +1,910 @@
+#ifndef COLLABORATIVE_EDITOR_WIRE_CODEC_H
+#define COLLABORATIVE_EDITOR_WIRE_CODEC_H
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "common/protocol/message_pool.h"
+#include "common/protocol/message_view.h"
+#include "common/protocol/protocol.h"
+#include "common/util/binary_io.h"
+#include "common/util/compression.h"
+#include "common/util/frame_pool.h"
+#include "common/util/text_scan.h"
+
+namespace collab {
+namespace protocol {
+
+/**
+ * Encodings a connection can carry messages in
+ */
+enum class WireFormat : uint8_t {
+    JSON,
+    BINARY
+};
+
+// First byte of every binary frame; JSON frames always start with '{'
+constexpr uint8_t BINARY_WIRE_VERSION = 1;
+
+// First byte of a compressed frame, which holds a JSON or binary frame
+constexpr uint8_t COMPRESSED_FRAME_MARKER = 2;
+
+// Metadata key offering (AUTH_LOGIN or AUTH_RESUME) and accepting (AUTH_SUCCESS) a wire format
+constexpr const char* WIRE_FORMAT_KEY = "wireFormat";
+constexpr const char* BINARY_WIRE_FORMAT_NAME = "binary/1";
+
+// Metadata key offering and accepting compression of large frames
+constexpr const char* COMPRESSION_KEY = "compression";
+constexpr const char* DEFLATE_COMPRESSION_NAME = "deflate/1";
+
+// Frames smaller than this are sent as they are by default
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 1024;
+
+// Largest frame a compressed frame may expand to
+constexpr size_t MAX_DECOMPRESSED_SIZE = 64 * 1024 * 1024;
+
+using DecodedMessage = std::variant<Message, AuthMessage, DocumentMessage, EditMessage,
+                                    SyncMessage, PresenceMessage, BatchMessage>;
+
+namespace detail {
+
+/**
+ * Strings a connection repeats in every message, sent once and then by index
+ *
+ * Client, session and document IDs and usernames are written as a reference:
+ * 0 followed by the string itself, which both ends then append to their
+ * table, or the 1-based index of an earlier entry. Each direction of a
+ * connection has its own pair of tables, kept in step by TCP's ordering.
+ * Entries never move once added, so views of them stay valid.
+ */
+class StringTable {
+public:
+    // Entries beyond this are sent literally every time
+    static constexpr size_t MAX_ENTRIES = 4096;
+
+    void write(util::BinaryWriter& writer, const std::string& text) {
+        auto it = indices_.find(text);
+        if (it != indices_.end()) {
+            writer.writeVarint(uint64_t{it->second} + 1);
+            return;
+        }
+        writer.writeVarint(0);
+        writer.writeString(text);
+        if (indices_.size() < MAX_ENTRIES) {
+            indices_.emplace(text, static_cast<uint32_t>(indices_.size()));
+        }
+    }
+
+    std::string_view read(util::BinaryReader& reader) {
+        const uint64_t reference = reader.readVarint();
+        if (reference == 0) {
+            std::string_view text = reader.readString();
+            if (entries_.size() < MAX_ENTRIES) {
+                return entries_.emplace_back(text);
+            }
+            return text;
+        }
+        if (reference > entries_.size()) {
+            throw std::runtime_error("Unknown string reference in binary message");
+        }
+        return entries_[reference - 1];
+    }
+
+    // Number of entries read so far, to roll back a frame that failed to decode
+    size_t mark() const { return entries_.size(); }
+    void rollback(size_t mark) { entries_.resize(mark); }
+
+private:
+    std::unordered_map<std::string, uint32_t> indices_;
+    std::deque<std::string> entries_;
+};
+
+inline void writeValue(util::BinaryWriter& writer, const std::string& text) {
+    writer.writeString(text);
+}
+
+inline void writeValue(util::BinaryWriter& writer, bool flag) {
+    writer.writeByte(flag ? 1 : 0);
+}
+
+template <std::unsigned_integral T>
+void writeValue(util::BinaryWriter& writer, T number) {
+    writer.writeVarint(number);
+}
+
+inline void writeValue(util::BinaryWriter& writer, const std::vector<std::string>& list) {
+    writer.writeVarint(list.size());
+    for (const auto& item : list) {
+        writer.writeString(item);
+    }
+}
+
+inline void writeValue(util::BinaryWriter& writer, const std::map<std::string, std::string>& map) {
+    writer.writeVarint(map.size());
+    for (const auto& [key, value] : map) {
+        writer.writeString(key);
+        writer.writeString(value);
+    }
+}
+
+template <typename T>
+void readValue(util::BinaryReader& reader, T& out) {
+    if constexpr (std::same_as<T, std::string_view>) {
+        out = reader.readString();
+    } else if constexpr (std::same_as<T, std::string>) {
+        out = std::string(reader.readString());
+    } else if constexpr (std::same_as<T, bool>) {
+        const uint8_t flag = reader.readByte();
+        if (flag > 1) {
+            throw std::runtime_error("Malformed flag in binary message");
+        }
+        out = flag == 1;
+    } else if constexpr (std::same_as<T, std::vector<std::string>>) {
+        const uint64_t count = reader.readVarint();
+        if (count > reader.remaining()) {
+            throw std::runtime_error("Truncated binary encoding");
+        }
+        out.clear();
+        out.reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            out.emplace_back(reader.readString());
+        }
+    } else if constexpr (std::same_as<T, MetadataView>) {
+        // Skip over the pairs, remembering where they are
+        const uint64_t count = reader.readVarint();
+        if (count > reader.remaining()) {
+            throw std::runtime_error("Truncated binary encoding");
+        }
+        const std::string_view pairs = reader.rest();
+        for (uint64_t i = 0; i < 2 * count; ++i) {
+            reader.readString();
+        }
+        out = MetadataView(pairs.substr(0, pairs.size() - reader.remaining()), count);
+    } else if constexpr (std::same_as<T, std::map<std::string, std::string>>) {
+        const uint64_t count = reader.readVarint();
+        out.clear();
+        for (uint64_t i = 0; i < count; ++i) {
+            std::string key(reader.readString());
+            out[std::move(key)] = std::string(reader.readString());
+        }
+    } else {
+        out = reader.readVarintAs<T>();
+    }
+}
+
+/**
+ * Preset dictionary for compressed frames
+ *
+ * The keys of the JSON envelopes, so their first occurrence in a frame
+ * already compresses to a back-reference. Deflate reaches back furthest
+ * for the end of the dictionary, so the most common keys come last.
+ * Changing it changes the compressed format, hence the version in
+ * DEFLATE_COMPRESSION_NAME.
+ */
+constexpr std::string_view COMPRESSION_DICTIONARY =
+    R"({"errorMessage":"","success":false,"success":true,"documentList":[],"metadata":{},)"
+    R"("documentPath":"","documentName":"","documentVersion":,"operations":[],"fromVersion":,)"
+    R"("toVersion":,"stateVector":"","delta":"","username":"","operationId":"","position":,)"
+    R"("length":,"text":"","documentState":"","documentContent":"","documentId":"","messages":[)"
+    R"({"type":,"clientId":"","sessionId":"","sequenceNumber":,"timestamp":)";
+
+} // namespace detail
+
+/**
+ * Per-connection encoder and decoder for protocol messages
+ *
+ * Connections start in JSON. A client whose preferred format is BINARY
+ * offers it in the metadata of its AUTH_LOGIN; a server that prefers it too
+ * confirms it in the AUTH_SUCCESS, and each side sends binary frames from
+ * the message after that on. The codec handles both steps as the messages
+ * pass through it. Decoding tells the formats apart by their first byte, so
+ * frames already in flight during the switch decode either way, and peers
+ * that never offer, or set JSON as preferred for debugging, stay on JSON.
+ *
+ * A binary frame is:
+ *
+ *     version byte (BINARY_WIRE_VERSION)
+ *     header: type, sequence number, timestamp (varints),
+ *             document, client and session ID (string table references)
+ *     body: required fields, then a presence mask and the optional fields
+ *
+ * with varints for integers and length-prefixed strings. Sync state vectors
+ * and deltas travel as raw bytes instead of base64. A batch's body is the
+ * element count and then each element as a frame without the version byte.
+ * The body follows the message struct's fields() table (see writeBody),
+ * the same table its JSON is generated from. Edit and presence views list
+ * the same fields as their structs, which message_view.h checks at compile
+ * time, so the zero-copy decoders cannot fall out of step.
+ *
+ * Compression of large frames is negotiated the same way, independently of
+ * the format. Once both sides agree, a frame of at least the compression
+ * threshold is sent as COMPRESSED_FRAME_MARKER, its size as a varint and
+ * the frame deflated with COMPRESSION_DICTIONARY, unless that does not make
+ * it smaller. Document contents and sync states are what get compressed in
+ * practice; edit frames stay far below the threshold.
+ *
+ * A client resuming its session on a new connection offers both in its
+ * AUTH_RESUME, which negotiates like an AUTH_LOGIN.
+ *
+ * encode() keeps string tables for the peer, so the frames one codec encodes
+ * must be sent in order; callers serialize encode-and-send (MessageChannel
+ * does). Decode runs on the connection's read path.
+ */
+class WireCodec {
+public:
+    explicit WireCodec(WireFormat preferred = WireFormat::BINARY)
+        : preferred_(preferred) {}
+
+    /**
+     * Set the format to offer and accept during negotiation; call before the first message
+     *
+     * @param preferred JSON to keep the connection readable, BINARY to allow the compact format
+     */
+    void setPreferredFormat(WireFormat preferred) { preferred_ = preferred; }
+    WireFormat getPreferredFormat() const { return preferred_; }
+
+    /**
+     * Set whether to offer and accept compression of large frames; call before the first message
+     *
+     * @param enabled False to keep every frame as it is
+     * @param threshold Size from which a frame is compressed
+     */
+    void setCompression(bool enabled, size_t threshold = DEFAULT_COMPRESSION_THRESHOLD) {
+        compressionWanted_ = enabled;
+        compressionThreshold_ = threshold;
+    }
+
+    // Whether large frames are currently compressed
+    bool compressing() const { return compressing_.load(std::memory_order_acquire); }
+
+    // The format outgoing frames are currently encoded in
+    WireFormat getFormat() const { return format_.load(std::memory_order_acquire); }
+
+    // Whether messages are currently encoded as binary frames
+    bool binary() const { return getFormat() == WireFormat::BINARY; }
+
+    // Whether an encoded frame needs the transport's binary framing
+    static bool is_binary_frame(std::string_view frame) {
+        return !frame.empty() && (static_cast<uint8_t>(frame[0]) == BINARY_WIRE_VERSION ||
+                                  static_cast<uint8_t>(frame[0]) == COMPRESSED_FRAME_MARKER);
+    }
+
+    /**
+     * Encode a message in the connection's current format
+     *
+     * @param message The message to send
+     * @return The frame
+     * @throws std::invalid_argument if the message is a base Message with a type that needs a subclass
+     */
+    std::string encode(const Message& message) {
+        const auto* auth = dynamic_cast<const AuthMessage*>(&message);
+        if (!auth || !negotiates(message.type)) {
+            return encodeFrame(message);
+        }
+
+        // Offer what this side wants, or accept what both sides want
+        const bool login = message.type != MessageType::AUTH_SUCCESS;
+        const bool binary = preferred_ == WireFormat::BINARY &&
+                            (login || peerOffered_.load(std::memory_order_acquire));
+        const bool compress = compressionWanted_ &&
+                              (login || peerOfferedCompression_.load(std::memory_order_acquire));
+        if (!binary && !compress) {
+            return encodeFrame(message);
+        }
+
+        AuthMessage negotiated = *auth;
+        if (binary) {
+            negotiated.metadata[WIRE_FORMAT_KEY] = BINARY_WIRE_FORMAT_NAME;
+        }
+        if (compress) {
+            negotiated.metadata[COMPRESSION_KEY] = DEFLATE_COMPRESSION_NAME;
+        }
+        std::string frame = encodeFrame(negotiated);
+        if (!login) {
+            // The acceptance itself goes out in the old format
+            if (binary) {
+                format_.store(WireFormat::BINARY, std::memory_order_release);
+            }
+            if (compress) {
+                compressing_.store(true, std::memory_order_release);
+            }
+        }
+        return frame;
+    }
+
+    /**
+     * Encode a message in the connection's current format without compressing it
+     * Lets a sender compress large frames on other threads with
+     * compressFrame(): the frames are still encoded here one at a time, in
+     * the order they will be sent.
+     *
+     * @param message The message to send; not an AUTH_LOGIN, AUTH_RESUME or AUTH_SUCCESS, which go through encode()
+     * @return The frame, as encode() would give it before compression
+     * @throws std::invalid_argument if the message negotiates the connection or is a base Message
+     *         with a type that needs a subclass
+     */
+    std::string encodeUncompressed(const Message& message) {
+        if (negotiates(message.type)) {
+            throw std::invalid_argument("Negotiation messages must go through encode()");
+        }
+        return encodeFrame(message, false);
+    }
+
+    /**
+     * Compress a frame from encodeUncompressed() the way encode() would
+     * Safe to call from several threads at once, as long as the compression
+     * settings do not change meanwhile.
+     *
+     * @param frame The frame
+     * @return The frame compressed, or as it was if compression is off, it is small or it does not shrink
+     */
+    std::string compressFrame(std::string frame) const {
+        return compress(std::move(frame));
+    }
+
+    /**
+     * Inflate a compressed frame without decoding it, e.g. on another thread than decode()
+     *
+     * @param frame A frame as received
+     * @param out Receives the frame inside, if frame is compressed
+     * @return False, leaving out alone, if the frame is not compressed
+     * @throws std::runtime_error if the frame is malformed, too large or nests another compressed frame
+     */
+    static bool inflateFrame(std::string_view frame, std::string& out) {
+        if (frame.empty() || static_cast<uint8_t>(frame[0]) != COMPRESSED_FRAME_MARKER) {
+            return false;
+        }
+        util::BinaryReader reader(frame.substr(1));
+        const uint64_t size = reader.readVarint();
+        if (size > MAX_DECOMPRESSED_SIZE) {
+            throw std::runtime_error("Compressed frame too large");
+        }
+        util::inflateDecompress(reader.rest(), static_cast<size_t>(size), out, detail::COMPRESSION_DICTIONARY);
+        if (!out.empty() && static_cast<uint8_t>(out[0]) == COMPRESSED_FRAME_MARKER) {
+            throw std::runtime_error("Compressed frames cannot be nested");
+        }
+        return true;
+    }
+
+    /**
+     * Decode a frame in either format
+     *
+     * @param frame The frame, without transport framing
+     * @return The message; a batch comes back as its BatchMessage
+     * @throws std::runtime_error, or the JSON parser's exception (see JsonMessageReader), if the frame is malformed
+     */
+    DecodedMessage decode(std::string_view frame) {
+        std::optional<DecodedMessage> decoded;
+        std::optional<BatchMessage> batch;
+        visitFrame(frame, [&](const auto& message) {
+            using T = std::decay_t<decltype(message)>;
+            if constexpr (std::same_as<T, BatchMessage>) {
+                batch.emplace(message);
+            } else if (batch) {
+                batch->add(std::make_shared<const decltype(owned(message))>(owned(message)));
+            } else {
+                decoded.emplace(owned(message));
+            }
+        });
+        if (batch) {
+            return std::move(*batch);
+        }
+        return std::move(*decoded);
+    }
+
+    /**
+     * Decode a frame and pass it to a visitor without keeping a copy
+     *
+     * The frame's type picks the struct it is decoded into, with one switch
+     * and no variant in between. Edit and presence messages are passed as
+     * EditMessageView and PresenceMessageView. For binary frames these refer
+     * into the frame and the string table, so the hot edit path decodes
+     * without allocating. Other messages are passed as their struct.
+     * Whatever the visitor receives is only valid until it returns.
+     *
+     * A batch is unpacked: the visitor is called for each element in turn.
+     * Elements of a binary batch are decoded as they are visited, so if one
+     * is malformed the ones before it have already been delivered. An
+     * EDIT_BULK is not: it is decoded whole, then passed as its BatchMessage.
+     *
+     * @param frame The frame, without transport framing
+     * @param visitor Callable with const references to EditMessageView, PresenceMessageView,
+     *                Message, AuthMessage, DocumentMessage, SyncMessage and BatchMessage
+     * @throws std::runtime_error, or the JSON parser's exception (see JsonMessageReader), if the frame is malformed
+     */
+    template <typename Visitor>
+    void visit(std::string_view frame, Visitor&& visitor) {
+        std::optional<BatchMessage> bulk;
+        visitFrame(frame, [&](const auto& message) {
+            using T = std::decay_t<decltype(message)>;
+            if constexpr (std::same_as<T, BatchMessage>) {
+                if (message.type == MessageType::EDIT_BULK) {
+                    bulk.emplace(message);
+                }
+            } else if (bulk) {
+                bulk->add(std::make_shared<const decltype(owned(message))>(owned(message)));
+            } else {
+                visitor(message);
+            }
+        });
+        if (bulk) {
+            visitor(std::as_const(*bulk));
+        }
+    }
+
+private:
+    // Decode a frame and deliver it; a batch is delivered as its envelope, then element by element
+    template <typename Visitor>
+    void visitFrame(std::string_view frame, Visitor&& visitor) {
+        // Decompress into a buffer of the codec's; views of it stay valid until the next frame
+        if (inflateFrame(frame, inflated_)) {
+            visitFrame(std::string_view(inflated_), visitor);
+            return;
+        }
+        if (is_binary_frame(frame)) {
+            visitBinary(frame, visitor);
+            return;
+        }
+
+        // Each message is read whole before it is delivered, so the visitor may decode others on this thread
+        JsonMessageReader& reader = JsonMessageReader::local();
+        const MessageType type = reader.parse(frame);
+        switch (kindOf(type)) {
+            case MessageKind::AUTH:
+                deliver(reader.read<AuthMessage>(), visitor);
+                break;
+            case MessageKind::DOCUMENT:
+                deliver(reader.read<DocumentMessage>(), visitor);
+                break;
+            case MessageKind::EDIT: {
+                // The message path's own types come from the thread's pool
+                const auto message = MessagePool<EditMessage>::acquire(type);
+                reader.read(*message);
+                deliver(*message, visitor);
+                break;
+            }
+            case MessageKind::SYNC:
+                deliver(reader.read<SyncMessage>(), visitor);
+                break;
+            case MessageKind::PRESENCE: {
+                const auto message = MessagePool<PresenceMessage>::acquire(type);
+                reader.read(*message);
+                deliver(*message, visitor);
+                break;
+            }
+            case MessageKind::BASE:
+                deliver(reader.read<Message>(), visitor);
+                break;
+            case MessageKind::BATCH: {
+                const auto batch = reader.read<BatchMessage>();
+                BatchMessage envelope(batch.type);
+                static_cast<Message&>(envelope) = batch;
+                visitor(std::as_const(envelope));
+                for (const auto& element : batch.messages) {
+                    deliverElement(*element, visitor);
+                }
+                break;
+            }
+        }
+    }
+
+    // Frames start in a buffer from the thread's FramePool, which the transport hands back once sent
+    std::string encodeFrame(const Message& message, bool compressed = true) {
+        std::string frame;
+        if (getFormat() == WireFormat::JSON) {
+            JsonWriter writer(util::FramePool::acquire());
+            message.writeTo(writer);
+            frame = writer.take();
+        } else {
+            util::BinaryWriter writer(util::FramePool::acquire());
+            writer.writeByte(BINARY_WIRE_VERSION);
+            writeMessage(writer, message);
+            frame = writer.take();
+        }
+        return compressed ? compress(std::move(frame)) : frame;
+    }
+
+    // Compress a frame if compression is on, the frame is large enough and it gets smaller
+    std::string compress(std::string frame) const {
+        if (frame.size() < compressionThreshold_ || !compressing()) {
+            return frame;
+        }
+        util::BinaryWriter writer;
+        writer.writeByte(COMPRESSED_FRAME_MARKER);
+        writer.writeVarint(frame.size());
+        std::string compressed = writer.take();
+        compressed += util::deflateCompress(frame, detail::COMPRESSION_DICTIONARY);
+        if (compressed.size() >= frame.size()) {
+            return frame;
+        }
+        util::FramePool::release(std::move(frame));
+        return compressed;
+    }
+
+    // Write a message after the version byte: header, then body
+    void writeMessage(util::BinaryWriter& writer, const Message& message) {
+        writer.writeVarint(static_cast<uint32_t>(message.type));
+        writer.writeVarint(message.sequenceNumber);
+        writer.writeVarint(message.timestamp);
+
+        switch (kindOf(message.type)) {
+            case MessageKind::AUTH:
+                writeBody(writer, as<AuthMessage>(message));
+                break;
+            case MessageKind::DOCUMENT:
+                writeBody(writer, as<DocumentMessage>(message));
+                break;
+            case MessageKind::EDIT:
+                writeBody(writer, as<EditMessage>(message));
+                break;
+            case MessageKind::SYNC:
+                writeBody(writer, as<SyncMessage>(message));
+                break;
+            case MessageKind::PRESENCE:
+                writeBody(writer, as<PresenceMessage>(message));
+                break;
+            case MessageKind::BASE:
+                writeHeaderIds(writer, message, NO_DOCUMENT);
+                break;
+            case MessageKind::BATCH: {
+                const auto& msg = as<BatchMessage>(message);
+                writeHeaderIds(writer, msg, NO_DOCUMENT);
+                writer.writeVarint(msg.messages.size());
+                for (const auto& element : msg.messages) {
+                    if (!BatchMessage::canCarry(element->type)) {
+                        throw std::invalid_argument("Message type cannot be batched");
+                    }
+                    writeMessage(writer, *element);
+                }
+                break;
+            }
+        }
+    }
+
+    // Header fields every binary frame starts with
+    struct FrameHeader {
+        MessageType type;
+        uint64_t sequenceNumber;
+        uint64_t timestamp;
+        std::string_view documentId;
+        std::string_view clientId;
+        std::string_view sessionId;
+
+        template <typename T>
+        void applyTo(T& msg) const {
+            msg.sequenceNumber = sequenceNumber;
+            msg.timestamp = timestamp;
+            msg.clientId = clientId;
+            msg.sessionId = sessionId;
+        }
+    };
+
+    /**
+     * Write the header IDs and body of a message as its fields() table describes them
+     *
+     * The header field goes in the header and interned fields through the
+     * string table. The other required fields, lists and maps follow in
+     * table order, then a presence mask of the optional fields and those
+     * that are present, still in table order.
+     */
+    template <typename T>
+    void writeBody(util::BinaryWriter& writer, const T& msg) {
+        constexpr auto fields = T::fields();
+        static_assert(detail::countOptionalFields<decltype(fields)>() < 64, "Too many optional fields for the mask");
+
+        const std::string* documentId = &NO_DOCUMENT;
+        detail::forEachField(fields, [&](const auto& f) {
+            if constexpr ((std::decay_t<decltype(f)>::flags & HEADER_FIELD) != 0) {
+                documentId = &(msg.*f.member);
+            }
+        });
+        writeHeaderIds(writer, msg, *documentId);
+
+        uint64_t mask = 0;
+        uint64_t bit = 1;
+        detail::forEachField(fields, [&](const auto& f) {
+            using F = std::decay_t<decltype(f)>;
+            if constexpr (detail::isOptionalField<F>) {
+                mask |= (msg.*f.member).has_value() ? bit : 0;
+                bit <<= 1;
+            } else if constexpr ((F::flags & HEADER_FIELD) != 0) {
+                // Already in the header
+            } else if constexpr ((F::flags & INTERNED_FIELD) != 0) {
+                encodeStrings_.write(writer, msg.*f.member);
+            } else {
+                detail::writeValue(writer, msg.*f.member);
+            }
+        });
+        writer.writeVarint(mask);
+        detail::forEachField(fields, [&](const auto& f) {
+            if constexpr (detail::isOptionalField<std::decay_t<decltype(f)>>) {
+                if ((msg.*f.member).has_value()) {
+                    detail::writeValue(writer, *(msg.*f.member));
+                }
+            }
+        });
+    }
+
+    // Read the body writeBody() wrote into a message or view
+    template <typename T>
+    void readBody(util::BinaryReader& reader, const FrameHeader& header, T& msg) {
+        constexpr auto fields = T::fields();
+        constexpr size_t optionalCount = detail::countOptionalFields<decltype(fields)>();
+
+        detail::forEachField(fields, [&](const auto& f) {
+            using F = std::decay_t<decltype(f)>;
+            if constexpr (detail::isOptionalField<F>) {
+                // Read after the mask
+            } else if constexpr ((F::flags & HEADER_FIELD) != 0) {
+                msg.*f.member = header.documentId;
+            } else if constexpr ((F::flags & INTERNED_FIELD) != 0) {
+                msg.*f.member = decodeStrings_.read(reader);
+            } else {
+                detail::readValue(reader, msg.*f.member);
+            }
+        });
+
+        const uint64_t mask = reader.readVarint();
+        if (mask >> optionalCount != 0) {
+            // A bit this side does not know is an error rather than a field to skip
+            throw std::runtime_error("Unknown optional fields in binary message");
+        }
+        uint64_t bit = 1;
+        detail::forEachField(fields, [&](const auto& f) {
+            if constexpr (detail::isOptionalField<std::decay_t<decltype(f)>>) {
+                if (mask & bit) {
+                    detail::readValue(reader, (msg.*f.member).emplace());
+                }
+                bit <<= 1;
+            }
+        });
+    }
+
+    // Decode a binary frame into views or structs and deliver them
+    template <typename Visitor>
+    void visitBinary(std::string_view frame, Visitor& visitor) {
+        util::BinaryReader reader(frame);
+        const size_t mark = decodeStrings_.mark();
+        guarded(mark, [&] { reader.readByte(); });
+        const FrameHeader header = readHeader(reader, mark);
+
+        if (kindOf(header.type) != MessageKind::BATCH) {
+            visitBody(reader, header, mark, visitor, true);
+            return;
+        }
+
+        const uint64_t count = guarded(mark, [&] {
+            BatchMessage envelope(header.type);
+            header.applyTo(envelope);
+            const uint64_t elements = reader.readVarint();
+            if (elements > reader.remaining() || (elements == 0 && !reader.atEnd())) {
+                throw std::runtime_error("Malformed batch in binary message");
+            }
+            visitor(std::as_const(envelope));
+            return elements;
+        });
+        for (uint64_t i = 0; i < count; ++i) {
+            const FrameHeader element = readHeader(reader, mark);
+            if (!BatchMessage::canCarry(element.type)) {
+                decodeStrings_.rollback(mark);
+                throw std::runtime_error("Message type cannot be batched");
+            }
+            visitBody(reader, element, mark, visitor, i + 1 == count);
+        }
+    }
+
+    // Decode the body of one message and deliver it; the last message of a frame must end it
+    template <typename Visitor>
+    void visitBody(util::BinaryReader& reader, const FrameHeader& header, size_t mark,
+                   Visitor& visitor, bool last) {
+        switch (kindOf(header.type)) {
+            case MessageKind::EDIT:
+                deliver(decodeBody<EditMessageView>(reader, header, mark, last), visitor);
+                break;
+            case MessageKind::PRESENCE:
+                deliver(decodeBody<PresenceMessageView>(reader, header, mark, last), visitor);
+                break;
+            case MessageKind::AUTH:
+                deliver(decodeBody<AuthMessage>(reader, header, mark, last), visitor);
+                break;
+            case MessageKind::DOCUMENT:
+                deliver(decodeBody<DocumentMessage>(reader, header, mark, last), visitor);
+                break;
+            case MessageKind::SYNC:
+                deliver(decodeBody<SyncMessage>(reader, header, mark, last), visitor);
+                break;
+            case MessageKind::BASE:
+                deliver(guarded(mark, [&] {
+                    Message msg(header.type);
+                    header.applyTo(msg);
+                    if (last) {
+                        expectEnd(reader);
+                    }
+                    return msg;
+                }), visitor);
+                break;
+            case MessageKind::BATCH:
+                decodeStrings_.rollback(mark);
+                throw std::runtime_error("Batches cannot be nested");
+        }
+    }
+
+    // Decode the body of a message or view; the last message of a frame must end it
+    template <typename T>
+    T decodeBody(util::BinaryReader& reader, const FrameHeader& header, size_t mark, bool last) {
+        return guarded(mark, [&] {
+            T msg = [&header] {
+                if constexpr (std::is_constructible_v<T, MessageType>) {
+                    return T(header.type);
+                } else {
+                    T view;
+                    view.type = header.type;
+                    return view;
+                }
+            }();
+            header.applyTo(msg);
+            readBody(reader, header, msg);
+            if constexpr (std::is_same_v<T, EditMessageView>) {
+                // JSON cannot carry malformed UTF-8, so neither may binary; edit text goes into the document
+                if (msg.text && !util::validUtf8(*msg.text)) {
+                    throw std::runtime_error("Edit text is not valid UTF-8");
+                }
+            }
+            if (last) {
+                expectEnd(reader);
+            }
+            return msg;
+        });
+    }
+
+    // Run a decoding step; if it throws, the string table forgets what this frame added
+    template <typename Read>
+    auto guarded(size_t mark, Read read) {
+        try {
+            return read();
+        } catch (...) {
+            decodeStrings_.rollback(mark);
+            throw;
+        }
+    }
+
+    // Read the header of one message, which a batch repeats for each element
+    FrameHeader readHeader(util::BinaryReader& reader, size_t mark) {
+        return guarded(mark, [&] {
+            FrameHeader read;
+            read.type = static_cast<MessageType>(reader.readVarintAs<uint32_t>());
+            read.sequenceNumber = reader.readVarint();
+            read.timestamp = reader.readVarint();
+            read.documentId = decodeStrings_.read(reader);
+            read.clientId = decodeStrings_.read(reader);
+            read.sessionId = decodeStrings_.read(reader);
+            return read;
+        });
+    }
+
+    static void expectEnd(const util::BinaryReader& reader) {
+        if (!reader.atEnd()) {
+            throw std::runtime_error("Trailing bytes after binary message");
+        }
+    }
+
+    // Pass a decoded message on, as a view for the kinds that have one
+    template <typename T, typename Visitor>
+    void deliver(const T& message, Visitor& visitor) {
+        if constexpr (std::same_as<T, AuthMessage>) {
+            observeNegotiation(message);
+        }
+        if constexpr (std::same_as<T, EditMessage>) {
+            visitor(EditMessageView(message));
+        } else if constexpr (std::same_as<T, PresenceMessage>) {
+            visitor(PresenceMessageView(message));
+        } else {
+            visitor(message);
+        }
+    }
+
+    // Deliver an element of a decoded JSON batch as the struct its type calls for
+    template <typename Visitor>
+    void deliverElement(const Message& message, Visitor& visitor) {
+        switch (kindOf(message.type)) {
+            case MessageKind::DOCUMENT:
+                deliver(as<DocumentMessage>(message), visitor);
+                break;
+            case MessageKind::EDIT:
+                deliver(as<EditMessage>(message), visitor);
+                break;
+            case MessageKind::SYNC:
+                deliver(as<SyncMessage>(message), visitor);
+                break;
+            case MessageKind::PRESENCE:
+                deliver(as<PresenceMessage>(message), visitor);
+                break;
+            case MessageKind::BASE:
+                deliver(message, visitor);
+                break;
+            case MessageKind::AUTH:
+            case MessageKind::BATCH:
+                throw std::runtime_error("Message type cannot be batched");
+        }
+    }
+
+    // An owning copy of whatever visitFrame delivered
+    template <typename T>
+    static auto owned(const T& message) {
+        if constexpr (requires { message.toMessage(); }) {
+            return message.toMessage();
+        } else {
+            return message;
+        }
+    }
+
+    // Document ID of the messages that have none
+    static inline const std::string NO_DOCUMENT;
+
+    void writeHeaderIds(util::BinaryWriter& writer, const Message& message, const std::string& documentId) {
+        encodeStrings_.write(writer, documentId);
+        encodeStrings_.write(writer, message.clientId);
+        encodeStrings_.write(writer, message.sessionId);
+    }
+
+    template <typename T>
+    static const T& as(const Message& message) {
+        const auto* typed = dynamic_cast<const T*>(&message);
+        if (!typed) {
+            throw std::invalid_argument("Message type does not match its struct");
+        }
+        return *typed;
+    }
+
+    // The messages that offer and accept a format and compression
+    static bool negotiates(MessageType type) {
+        return type == MessageType::AUTH_LOGIN || type == MessageType::AUTH_RESUME || type == MessageType::AUTH_SUCCESS;
+    }
+
+    void observeNegotiation(const AuthMessage& auth) {
+        const auto named = [&auth](const char* key, const char* name) {
+            auto it = auth.metadata.find(key);
+            return it != auth.metadata.end() && it->second == name;
+        };
+        const bool binaryNamed = named(WIRE_FORMAT_KEY, BINARY_WIRE_FORMAT_NAME);
+        const bool deflateNamed = named(COMPRESSION_KEY, DEFLATE_COMPRESSION_NAME);
+        if (auth.type == MessageType::AUTH_LOGIN || auth.type == MessageType::AUTH_RESUME) {
+            peerOffered_.store(binaryNamed, std::memory_order_release);
+            peerOfferedCompression_.store(deflateNamed, std::memory_order_release);
+        } else if (auth.type == MessageType::AUTH_SUCCESS) {
+            if (binaryNamed && preferred_ == WireFormat::BINARY) {
+                format_.store(WireFormat::BINARY, std::memory_order_release);
+            }
+            if (deflateNamed && compressionWanted_) {
+                compressing_.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    WireFormat preferred_;
+    std::atomic<WireFormat> format_{WireFormat::JSON};
+    std::atomic<bool> peerOffered_{false};
+    bool compressionWanted_ = true;
+    size_t compressionThreshold_ = DEFAULT_COMPRESSION_THRESHOLD;
+    std::atomic<bool> compressing_{false};
+    std::atomic<bool> peerOfferedCompression_{false};
+    std::string inflated_;
+    detail::StringTable encodeStrings_;
+    detail::StringTable decodeStrings_;
+};
+
+} // namespace protocol
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_WIRE_CODEC_H
@@ -0,0 +1,978 @@
+#ifndef COLLABORATIVE_EDITOR_CONVERGENCE_SIMULATOR_H
+#define COLLABORATIVE_EDITOR_CONVERGENCE_SIMULATOR_H
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/crdt/crdt_document.h"
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include "common/ot/client_sync.h"
+#include "common/ot/operation.h"
+#include "common/simulation/network_simulator.h"
+#include "common/util/memory_accounting.h"
+
+namespace collab {
+namespace simulation {
+
+/**
+ * What a simulation runs: how many sites, how they edit, and the network between them
+ */
+struct SimulationOptions {
+    size_t sites = 8;                                  // Editing sites; OT adds a server
+    SimTime duration = std::chrono::seconds(60);       // Simulated time the sites edit for
+    double editsPerSecond = 2;                         // Per site, in simulated time
+    double deleteRatio = 0.3;                          // Fraction of edits that delete
+    double undoRatio = 0.05;                           // Fraction of OT edits that are undos instead
+    size_t documentSize = 1024;                        // Characters every site starts with
+    SimTime ackInterval = std::chrono::milliseconds(500);    // How often sites acknowledge and collect garbage
+    SimTime sampleInterval = std::chrono::seconds(1);        // How often growth is sampled for the report
+    crdt::PositionStrategy strategy = crdt::PositionStrategy::LOGOOT;
+    NetworkOptions network;
+    uint32_t seed = 1;
+
+    /**
+     * Read options from command line arguments of the form --name=value
+     *
+     * @param args The arguments; ones not naming an option are ignored
+     * @return The options, defaults where not given
+     * @throws std::invalid_argument for a value that does not parse or is out of range
+     */
+    static SimulationOptions parse(const std::vector<std::string>& args) {
+        SimulationOptions options;
+        for (const std::string& arg : args) {
+            const size_t equals = arg.find('=');
+            if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+                continue;
+            }
+            const std::string name = arg.substr(2, equals - 2);
+            const std::string_view value(arg.data() + equals + 1, arg.size() - equals - 1);
+            if (name == "sites") {
+                options.sites = number<size_t>(name, value);
+            } else if (name == "seconds") {
+                options.duration = millis(name, value);
+            } else if (name == "edit-rate") {
+                options.editsPerSecond = number<double>(name, value);
+            } else if (name == "delete-ratio") {
+                options.deleteRatio = number<double>(name, value);
+            } else if (name == "undo-ratio") {
+                options.undoRatio = number<double>(name, value);
+            } else if (name == "document-size") {
+                options.documentSize = number<size_t>(name, value);
+            } else if (name == "ack-interval") {
+                options.ackInterval = millis(name, value);
+            } else if (name == "latency") {
+                options.network.latency = millis(name, value);
+            } else if (name == "jitter") {
+                options.network.jitter = millis(name, value);
+            } else if (name == "disconnect-rate") {
+                options.network.disconnectsPerMinute = number<double>(name, value);
+            } else if (name == "offline") {
+                options.network.offlineTime = millis(name, value);
+            } else if (name == "partition-rate") {
+                options.network.partitionsPerMinute = number<double>(name, value);
+            } else if (name == "partition-time") {
+                options.network.partitionTime = millis(name, value);
+            } else if (name == "strategy") {
+                options.strategy = strategyNamed(value);
+            } else if (name == "seed") {
+                options.seed = number<uint32_t>(name, value);
+            }
+        }
+        if (options.sites == 0 || options.editsPerSecond <= 0 || options.duration <= SimTime::zero() ||
+            options.ackInterval <= SimTime::zero()) {
+            throw std::invalid_argument("sites, edit-rate, seconds and ack-interval must be positive");
+        }
+        if (options.deleteRatio < 0 || options.deleteRatio > 1 || options.undoRatio < 0 || options.undoRatio > 1) {
+            throw std::invalid_argument("delete-ratio and undo-ratio must be between 0 and 1");
+        }
+        return options;
+    }
+
+    static const char* strategyName(crdt::PositionStrategy strategy) {
+        switch (strategy) {
+        case crdt::PositionStrategy::WOOT:
+            return "woot";
+        case crdt::PositionStrategy::LSEQ:
+            return "lseq";
+        default:
+            return "logoot";
+        }
+    }
+
+private:
+    template <typename T>
+    static T number(const std::string& name, std::string_view value) {
+        T result{};
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            throw std::invalid_argument("Invalid value for --" + name + ": " + std::string(value));
+        }
+        return result;
+    }
+
+    // Seconds, which may be fractional, for --seconds; milliseconds for the rest
+    static SimTime millis(const std::string& name, std::string_view value) {
+        const double scale = name == "seconds" ? 1e6 : 1e3;
+        const double amount = number<double>(name, value);
+        if (amount < 0) {
+            throw std::invalid_argument("--" + name + " must not be negative");
+        }
+        return SimTime(static_cast<int64_t>(amount * scale));
+    }
+
+    static crdt::PositionStrategy strategyNamed(std::string_view value) {
+        for (auto strategy : {crdt::PositionStrategy::LOGOOT, crdt::PositionStrategy::WOOT,
+                              crdt::PositionStrategy::LSEQ}) {
+            if (value == strategyName(strategy)) {
+                return strategy;
+            }
+        }
+        throw std::invalid_argument("Unknown --strategy " + std::string(value) + "; use logoot, woot or lseq");
+    }
+};
+
+/**
+ * What a simulation measured
+ *
+ * "Retained" is what the model keeps to cope with concurrency: for OT the
+ * operations in the server's log, for CRDT the tombstones, summed over the
+ * sites. Memory is the live bytes of the model's accounted subsystems
+ * above what they held when the run started.
+ */
+struct SimulationReport {
+    struct Sample {
+        double seconds;          // Simulated time
+        size_t retained;
+        int64_t memoryBytes;
+    };
+
+    std::string model;                 // "ot", or "crdt/" and the position strategy
+    SimulationOptions options;
+    bool converged = false;
+    std::string divergence;            // Why not, when not
+    double simulatedSeconds = 0;       // Including the time it took to settle after editing stopped
+    double wallSeconds = 0;
+    uint64_t edits = 0;                // Local edits made
+    uint64_t undos = 0;                // Undos the server applied
+    uint64_t operationsSent = 0;       // Operations put on the network: OT edits after batching, CRDT broadcasts
+    uint64_t transforms = 0;           // OT operations the server transformed
+    uint64_t resyncs = 0;              // Full reloads: OT clients too far behind, CRDT delta syncs
+    uint64_t discardedEdits = 0;       // Pending OT edits lost to a reload
+    SimulatedNetwork::Stats network;
+    size_t peakRetained = 0;
+    size_t finalRetained = 0;
+    int64_t peakMemoryBytes = 0;
+    int64_t finalMemoryBytes = 0;
+    size_t documentLength = 0;
+    double averageDepth = 0;           // CRDT: position digits per character at the end
+    size_t maxDepth = 0;
+    size_t items = 0;                  // CRDT: runs in the sequence, tombstones included
+    std::vector<Sample> samples;
+
+    double editsPerWallSecond() const {
+        return wallSeconds > 0 ? static_cast<double>(edits) / wallSeconds : 0.0;
+    }
+
+    nlohmann::json toJson() const {
+        nlohmann::json growth = nlohmann::json::array();
+        for (const Sample& sample : samples) {
+            growth.push_back({{"seconds", sample.seconds}, {"retained", sample.retained},
+                              {"memoryBytes", sample.memoryBytes}});
+        }
+        return {{"model", model},
+                {"sites", options.sites},
+                {"seed", options.seed},
+                {"converged", converged},
+                {"divergence", divergence},
+                {"simulatedSeconds", simulatedSeconds},
+                {"wallSeconds", wallSeconds},
+                {"edits", edits},
+                {"editsPerWallSecond", editsPerWallSecond()},
+                {"undos", undos},
+                {"operationsSent", operationsSent},
+                {"transforms", transforms},
+                {"resyncs", resyncs},
+                {"discardedEdits", discardedEdits},
+                {"messagesSent", network.sent},
+                {"messagesDelivered", network.delivered},
+                {"messagesDropped", network.dropped},
+                {"disconnects", network.disconnects},
+                {"partitions", network.partitions},
+                {"peakRetained", peakRetained},
+                {"finalRetained", finalRetained},
+                {"peakMemoryBytes", peakMemoryBytes},
+                {"finalMemoryBytes", finalMemoryBytes},
+                {"documentLength", documentLength},
+                {"averageDepth", averageDepth},
+                {"maxDepth", maxDepth},
+                {"items", items},
+                {"samples", growth}};
+    }
+
+    // A summary for a terminal
+    std::string toString() const {
+        std::ostringstream out;
+        out << "Simulation " << model << ": " << options.sites << " sites for " << simulatedSeconds
+            << " simulated s in " << wallSeconds << " s\n"
+            << "  converged          " << (converged ? "yes" : "NO: " + divergence) << "\n"
+            << "  edits              " << edits << " (" << editsPerWallSecond() << "/s wall), " << undos
+            << " undos, " << operationsSent << " operations sent\n"
+            << "  messages           " << network.sent << " sent, " << network.delivered << " delivered, "
+            << network.dropped << " dropped\n"
+            << "  faults             " << network.disconnects << " disconnects, " << network.partitions
+            << " partitions, " << resyncs << " resyncs, " << discardedEdits << " edits discarded\n"
+            << "  retained           peak " << peakRetained << ", final " << finalRetained << "\n"
+            << "  memory             peak " << peakMemoryBytes << " B, final " << finalMemoryBytes << " B\n"
+            << "  document           " << documentLength << " characters";
+        if (items > 0) {
+            out << ", " << items << " runs, depth avg " << averageDepth << " max " << maxDepth;
+        }
+        if (transforms > 0) {
+            out << ", " << transforms << " transforms";
+        }
+        out << "\n";
+        return out.str();
+    }
+};
+
+namespace detail {
+
+// Live bytes of the accounted subsystems a model uses
+inline int64_t liveBytes(std::initializer_list<util::MemoryTag> tags) {
+    int64_t bytes = 0;
+    for (util::MemoryTag tag : tags) {
+        bytes += util::memoryResource(tag).liveBytes();
+    }
+    return bytes;
+}
+
+// The text a site inserts: a few letters, so runs are visible in the CRDT
+inline std::string typed(std::mt19937& random) {
+    const size_t length = std::uniform_int_distribution<size_t>(1, 4)(random);
+    std::string text(length, ' ');
+    for (char& c : text) {
+        c = static_cast<char>(std::uniform_int_distribution<int>('a', 'z')(random));
+    }
+    return text;
+}
+
+/**
+ * The run loop both models share: editing, periodic ticks, faults, then settling
+ *
+ * Sites edit as Poisson processes until options.duration; then the faults
+ * heal and the ticks continue until quiet() holds at one, when settled, or
+ * until as long again as the run plus a minute has passed, when not.
+ */
+template <typename Model>
+void runModel(Model& model, EventQueue& events, SimulatedNetwork& network, const SimulationOptions& options,
+              std::mt19937& random, SimulationReport& report, size_t firstSite, size_t firstFaultyNode) {
+    const auto wallStart = std::chrono::steady_clock::now();
+    const int64_t memoryStart = model.memoryBytes();
+    const SimTime end = options.duration;
+    const SimTime giveUp = end + options.duration + std::chrono::minutes(1);
+
+    std::function<void(size_t)> nextEdit = [&](size_t site) {
+        const double seconds = std::exponential_distribution<double>(options.editsPerSecond)(random);
+        const SimTime delay(static_cast<int64_t>(seconds * 1e6));
+        if (events.now() + delay >= end) {
+            return;
+        }
+        events.schedule(delay, [&, site] {
+            model.edit(site);
+            nextEdit(site);
+        });
+    };
+    for (size_t site = firstSite; site < firstSite + options.sites; ++site) {
+        nextEdit(site);
+    }
+    network.startFaults(end, firstFaultyNode);
+
+    bool healed = false;
+    bool settled = false;
+    std::function<void()> tick = [&] {
+        if (!healed && events.now() >= end) {
+            healed = true;
+            network.heal();
+        }
+        model.tick();
+        if (healed && model.quiet()) {
+            settled = true;
+            return;
+        }
+        if (events.now() < giveUp) {
+            events.schedule(options.ackInterval, tick);
+        }
+    };
+    events.schedule(options.ackInterval, tick);
+
+    std::function<void()> sample = [&] {
+        const size_t retained = model.retained();
+        const int64_t memory = model.memoryBytes() - memoryStart;
+        report.samples.push_back({std::chrono::duration<double>(events.now()).count(), retained, memory});
+        report.peakRetained = std::max(report.peakRetained, retained);
+        report.peakMemoryBytes = std::max(report.peakMemoryBytes, memory);
+        if (!settled && events.now() < giveUp) {
+            events.schedule(options.sampleInterval, sample);
+        }
+    };
+    events.schedule(options.sampleInterval, sample);
+
+    while (!settled && events.step()) {
+    }
+
+    report.simulatedSeconds = std::chrono::duration<double>(events.now()).count();
+    report.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    report.network = network.stats();
+    report.finalRetained = model.retained();
+    report.finalMemoryBytes = model.memoryBytes() - memoryStart;
+    report.peakRetained = std::max(report.peakRetained, report.finalRetained);
+    report.peakMemoryBytes = std::max(report.peakMemoryBytes, report.finalMemoryBytes);
+    if (!settled) {
+        report.divergence = "did not settle";
+        return;
+    }
+    report.divergence = model.divergence();
+    report.converged = report.divergence.empty();
+}
+
+} // namespace detail
+
+/**
+ * Sites editing one document through the OT server path, over a faulty network
+ *
+ * The server is node 0: a DocumentController holding the text and undo
+ * history, and an OperationManager transforming what arrives, as the
+ * self-test drives them. Every other node is a client with its own copy
+ * of the text and a ClientSync, so it keeps at most one operation in
+ * flight and batches what it types meanwhile. Now and then a client asks
+ * the server to undo its last edit instead; the undo reaches every client,
+ * the asker included, as a remote operation.
+ *
+ * On a broken link the server stops sending to the client. When it comes
+ * back the client says which revision it has, and the server replays what
+ * the client missed, acknowledging the client's own edits among it, then
+ * says it is done; a client whose edit in flight was not among them sends
+ * it again. A client the log no longer reaches gets the whole document,
+ * losing what it had pending. Clients acknowledge their revision every
+ * tick, which is what lets the server drop history.
+ */
+class OtSimulation {
+public:
+    explicit OtSimulation(SimulationOptions options)
+        : options_(std::move(options)), random_(options_.seed), events_(),
+          network_(events_, options_.sites + 1, options_.network, options_.seed + 1),
+          document_(initialText()), operations_(10000) {
+        for (size_t i = 0; i < options_.sites; ++i) {
+            clients_.push_back(std::make_unique<Client>("sim-client-" + std::to_string(i), initialText()));
+            Client& client = *clients_.back();
+            const size_t node = i + 1;
+            client.sync.setSendCallback([this, node](const ot::OperationPtr& op, int64_t revision) {
+                ++report_.operationsSent;
+                network_.send(node, 0, [this, node, op, revision] { serverEdit(node, op, revision); });
+            });
+            operations_.acknowledgeRevision(client.id, 0);
+        }
+        document_.registerOperationCallback([this](const ot::OperationPtr& op, const std::string&, int64_t) {
+            committed_.push_back(op);
+        });
+        network_.setLinkCallback([this](size_t a, size_t b, bool up) { linkChanged(a, b, up); });
+    }
+
+    OtSimulation(const OtSimulation&) = delete;
+    OtSimulation& operator=(const OtSimulation&) = delete;
+
+    /**
+     * Edit for the configured time, then settle and check every client has the server's text
+     *
+     * @return What was measured
+     */
+    SimulationReport run() {
+        report_.model = "ot";
+        report_.options = options_;
+        detail::runModel(*this, events_, network_, options_, random_, report_, 1, 1);
+        report_.transforms = operations_.getLoadStats().operationsTransformed;
+        report_.documentLength = document_.getDocument().size();
+        return report_;
+    }
+
+    // The model interface runModel() drives
+
+    void edit(size_t node) {
+        Client& client = *clients_[node - 1];
+        if (std::bernoulli_distribution(options_.undoRatio)(random_)) {
+            network_.send(node, 0, [this, node] { serverUndo(node); });
+            return;
+        }
+        ++report_.edits;
+        ot::OperationPtr op = makeEdit(client.document);
+        if (!op->apply(client.document)) {
+            throw std::logic_error("A simulated edit did not fit its own document");
+        }
+        client.sync.applyClient(*op);
+    }
+
+    void tick() {
+        for (size_t i = 0; i < clients_.size(); ++i) {
+            const int64_t revision = clients_[i]->sync.getRevision();
+            network_.send(i + 1, 0, [this, i, revision] { serverAcknowledge(i, revision); }, false);
+        }
+    }
+
+    bool quiet() const {
+        if (network_.stats().dataInFlight > 0) {
+            return false;
+        }
+        return std::all_of(clients_.begin(), clients_.end(), [](const auto& client) {
+            return client->attached && client->sync.getState() == ot::ClientSync::State::SYNCHRONIZED;
+        });
+    }
+
+    size_t retained() const {
+        return operations_.getWatermarkStats().logLength;
+    }
+
+    int64_t memoryBytes() const {
+        return detail::liveBytes({util::MemoryTag::OT_LOG, util::MemoryTag::HISTORY});
+    }
+
+    std::string divergence() const {
+        const std::string text = document_.getDocument();
+        for (const auto& client : clients_) {
+            if (client->document != text) {
+                return client->id + " holds different text from the server";
+            }
+            if (client->sync.getRevision() != document_.getRevision()) {
+                return client->id + " is at revision " + std::to_string(client->sync.getRevision()) +
+                       ", the server at " + std::to_string(document_.getRevision());
+            }
+        }
+        return {};
+    }
+
+private:
+    struct Client {
+        std::string id;
+        std::string document;
+        ot::ClientSync sync;
+        bool attached = true;         // The server is sending to it
+        bool resendOnCatchUp = false; // An edit was in flight when the link came back
+        bool ackedInCatchUp = false;
+
+        Client(std::string id, const std::string& text) : id(std::move(id)), document(text), sync(0, text.size()) {}
+    };
+
+    // One entry of the server's replay log: revision firstRevision_ + index + 1
+    struct Logged {
+        ot::OperationPtr op;
+        size_t author;   // Node whose edit it was, or 0 for undos, which reach the author too
+    };
+
+    std::string initialText() const {
+        std::string text(options_.documentSize, ' ');
+        for (size_t i = 0; i < text.size(); ++i) {
+            text[i] = static_cast<char>('a' + i % 26);
+        }
+        return text;
+    }
+
+    // An insert or delete somewhere in a document, keeping it around its starting size
+    ot::OperationPtr makeEdit(const std::string& document) {
+        const bool erase = !document.empty() && (document.size() > 2 * options_.documentSize ||
+                                                 std::bernoulli_distribution(options_.deleteRatio)(random_));
+        if (erase) {
+            const size_t position = std::uniform_int_distribution<size_t>(0, document.size() - 1)(random_);
+            const size_t length =
+                std::min(document.size() - position, std::uniform_int_distribution<size_t>(1, 4)(random_));
+            return std::make_shared<ot::DeleteOperation>(position, length);
+        }
+        const size_t position = std::uniform_int_distribution<size_t>(0, document.size())(random_);
+        return std::make_shared<ot::InsertOperation>(position, detail::typed(random_));
+    }
+
+    void linkChanged(size_t a, size_t b, bool up) {
+        if (a != 0) {
+            return;
+        }
+        Client& client = *clients_[b - 1];
+        if (!up) {
+            client.attached = false;
+            return;
+        }
+        client.resendOnCatchUp = client.sync.getState() != ot::ClientSync::State::SYNCHRONIZED;
+        client.ackedInCatchUp = false;
+        const int64_t revision = client.sync.getRevision();
+        network_.send(b, 0, [this, b, revision] { serverHello(b, revision); });
+    }
+
+    // Server side
+
+    void sendToClient(size_t node, std::function<void(Client&)> handle) {
+        network_.send(0, node, [this, node, handle = std::move(handle)] { handle(*clients_[node - 1]); });
+    }
+
+    void sendOperation(size_t node, const ot::OperationPtr& op) {
+        sendToClient(node, [op](Client& client) {
+            if (!client.sync.applyServer(*op)->apply(client.document)) {
+                throw std::logic_error(client.id + " could not apply a transformed remote operation");
+            }
+        });
+    }
+
+    void sendAck(size_t node) {
+        sendToClient(node, [](Client& client) {
+            client.ackedInCatchUp = true;
+            client.sync.serverAck();
+        });
+    }
+
+    void sendResync(size_t node) {
+        ++report_.resyncs;
+        sendToClient(node, [this, text = document_.getDocument(), revision = document_.getRevision()](Client& client) {
+            if (client.sync.getState() != ot::ClientSync::State::SYNCHRONIZED) {
+                ++report_.discardedEdits;
+            }
+            client.document = text;
+            client.sync.reset(revision, text.size());
+            client.resendOnCatchUp = false;
+        });
+    }
+
+    void serverEdit(size_t node, const ot::OperationPtr& op, int64_t revision) {
+        Client& client = *clients_[node - 1];
+        const ot::OperationPtr transformed = operations_.processOperation(op, client.id, revision);
+        if (!transformed || !document_.applyOperation(transformed, client.id)) {
+            sendResync(node);
+            return;
+        }
+        publish(node);
+    }
+
+    void serverUndo(size_t node) {
+        if (document_.undo(clients_[node - 1]->id)) {
+            ++report_.undos;
+            publish(0);
+        }
+    }
+
+    // Record what the document just committed and send it out
+    void publish(size_t author) {
+        for (const ot::OperationPtr& op : committed_) {
+            operations_.recordOperation(op);
+            log_.push_back({op, author});
+            for (size_t node = 1; node <= clients_.size(); ++node) {
+                if (!clients_[node - 1]->attached) {
+                    continue;
+                }
+                if (node == author) {
+                    sendAck(node);
+                } else {
+                    sendOperation(node, op);
+                }
+            }
+        }
+        committed_.clear();
+    }
+
+    void serverHello(size_t node, int64_t revision) {
+        Client& client = *clients_[node - 1];
+        client.attached = true;
+        if (revision < firstRevision_ || operations_.needsResync(revision)) {
+            sendResync(node);
+            return;
+        }
+        for (size_t i = static_cast<size_t>(revision - firstRevision_); i < log_.size(); ++i) {
+            if (log_[i].author == node) {
+                sendAck(node);
+            } else {
+                sendOperation(node, log_[i].op);
+            }
+        }
+        sendToClient(node, [](Client& client) {
+            if (client.resendOnCatchUp && !client.ackedInCatchUp) {
+                client.sync.resend();
+            }
+            client.resendOnCatchUp = false;
+        });
+    }
+
+    void serverAcknowledge(size_t client, int64_t revision) {
+        const int64_t lowWatermark = operations_.acknowledgeRevision(clients_[client]->id, revision);
+        document_.compactBefore(lowWatermark);
+        while (firstRevision_ < lowWatermark && !log_.empty()) {
+            log_.pop_front();
+            ++firstRevision_;
+        }
+    }
+
+    const SimulationOptions options_;
+    std::mt19937 random_;
+    EventQueue events_;
+    SimulatedNetwork network_;
+    DocumentController document_;
+    OperationManager operations_;
+    std::vector<std::unique_ptr<Client>> clients_;
+    std::vector<ot::OperationPtr> committed_;  // Filled by the document's operation callback
+    std::deque<Logged> log_;
+    int64_t firstRevision_ = 0;                // Revision log_ starts after
+    SimulationReport report_;
+};
+
+/**
+ * Sites editing one CrdtDocument each, broadcasting to one another over a faulty network
+ *
+ * Every site sends its inserts as runs and its deletes as identifiers to
+ * every other site directly. Messages from one site reach another in
+ * order, as the version vectors delta sync relies on assume; messages
+ * from different sites arrive in whatever order the jitter makes.
+ *
+ * A site numbers what it broadcasts and keeps, per origin, the highest
+ * number it applied. When a link comes back each side sends the other its
+ * version vector and applies the delta it is answered with, holding what
+ * arrives from that peer meanwhile; messages the delta already covered
+ * are then skipped.
+ *
+ * Tombstones are collected as a server would: every tick a site sends
+ * its peers what it has applied, and a site acknowledges a peer's delete
+ * sequence once that peer, and the site itself, has seen everything each
+ * delete up to it depended on, which for a remote delete includes what its
+ * sender had seen. Only then can no insert of a pruned character still
+ * be on its way.
+ */
+class CrdtSimulation {
+public:
+    explicit CrdtSimulation(SimulationOptions options)
+        : options_(std::move(options)), random_(options_.seed), events_(),
+          network_(events_, options_.sites, options_.network, options_.seed + 1) {
+        for (size_t i = 0; i < options_.sites; ++i) {
+            auto site = std::make_unique<Site>();
+            site->id = "sim-site-" + std::to_string(i);
+            site->document = std::make_unique<crdt::CrdtDocument>(site->id);
+            site->document->setStrategy(options_.strategy);
+            site->document->seedPositions(options_.seed * 7919 + static_cast<uint32_t>(i));
+            site->known.assign(options_.sites, 0);
+            site->reported.assign(options_.sites, std::vector<uint64_t>(options_.sites, 0));
+            site->syncing.assign(options_.sites, false);
+            site->held.resize(options_.sites);
+            site->nextCheck.assign(options_.sites, 0);
+            sites_.push_back(std::move(site));
+        }
+        for (size_t i = 0; i < sites_.size(); ++i) {
+            for (size_t j = 0; j < sites_.size(); ++j) {
+                if (i != j) {
+                    sites_[i]->document->acknowledge(sites_[j]->id, 0);
+                }
+            }
+        }
+
+        // Everyone starts from the same text, as site 0's first message
+        std::string text(options_.documentSize, ' ');
+        for (size_t i = 0; i < text.size(); ++i) {
+            text[i] = static_cast<char>('a' + i % 26);
+        }
+        if (!text.empty()) {
+            const crdt::CrdtItem initial = sites_[0]->document->localInsert(text, 0);
+            sites_[0]->sent = 1;
+            for (auto& site : sites_) {
+                if (site.get() != sites_[0].get()) {
+                    site->document->remoteInsert(initial);
+                }
+                site->known[0] = 1;
+            }
+        }
+        network_.setLinkCallback([this](size_t a, size_t b, bool up) { linkChanged(a, b, up); });
+    }
+
+    CrdtSimulation(const CrdtSimulation&) = delete;
+    CrdtSimulation& operator=(const CrdtSimulation&) = delete;
+
+    /**
+     * Edit for the configured time, then settle and check every site has the same text
+     *
+     * @return What was measured
+     */
+    SimulationReport run() {
+        report_.model = std::string("crdt/") + SimulationOptions::strategyName(options_.strategy);
+        report_.options = options_;
+        detail::runModel(*this, events_, network_, options_, random_, report_, 0, 0);
+
+        const crdt::CrdtDocument& document = *sites_[0]->document;
+        size_t totalDepth = 0;
+        for (size_t i = 0; i < document.size(); ++i) {
+            const size_t depth = document.at(i).getPosition().size();
+            totalDepth += depth;
+            report_.maxDepth = std::max(report_.maxDepth, depth);
+        }
+        report_.documentLength = document.size();
+        report_.averageDepth = document.size() ? static_cast<double>(totalDepth) / document.size() : 0.0;
+        report_.items = document.itemCount();
+        return report_;
+    }
+
+    // The model interface runModel() drives
+
+    void edit(size_t index) {
+        Site& site = *sites_[index];
+        crdt::CrdtDocument& document = *site.document;
+        ++report_.edits;
+        auto message = std::make_shared<Message>();
+        const size_t length = document.size();
+        const bool erase = length > 0 && (length > 2 * options_.documentSize ||
+                                          std::bernoulli_distribution(options_.deleteRatio)(random_));
+        const uint64_t before = document.getDeleteSequence();
+        if (erase) {
+            const size_t position = std::uniform_int_distribution<size_t>(0, length - 1)(random_);
+            const size_t count = std::min(length - position, std::uniform_int_distribution<size_t>(1, 4)(random_));
+            for (size_t i = position; i < position + count; ++i) {
+                message->deletes.push_back(document.at(i).getId());
+            }
+            document.localDelete(position, count);
+        } else {
+            const size_t position = std::uniform_int_distribution<size_t>(0, length)(random_);
+            message->insert = document.localInsert(detail::typed(random_), position);
+        }
+        broadcast(index, std::move(message));
+        recordDeletes(site, before, site.known);
+    }
+
+    void tick() {
+        for (size_t i = 0; i < sites_.size(); ++i) {
+            Site& site = *sites_[i];
+            for (size_t peer = 0; peer < sites_.size(); ++peer) {
+                if (peer != i) {
+                    network_.send(i, peer, [this, i, peer, known = site.known] { receiveAck(peer, i, known); },
+                                  false);
+                }
+            }
+            // A budget no sweep reaches, so what is collected depends on the simulation alone
+            site.document->collectGarbage(std::chrono::seconds(10));
+        }
+    }
+
+    bool quiet() const {
+        if (network_.stats().dataInFlight > 0) {
+            return false;
+        }
+        return std::all_of(sites_.begin(), sites_.end(), [](const auto& site) {
+            return site->stability.empty() &&
+                   std::none_of(site->syncing.begin(), site->syncing.end(), [](bool syncing) { return syncing; });
+        });
+    }
+
+    size_t retained() const {
+        size_t tombstones = 0;
+        for (const auto& site : sites_) {
+            tombstones += site->document->tombstoneCount();
+        }
+        return tombstones;
+    }
+
+    int64_t memoryBytes() const {
+        return detail::liveBytes({util::MemoryTag::CRDT});
+    }
+
+    std::string divergence() const {
+        const std::string text = sites_[0]->document->getText();
+        for (const auto& site : sites_) {
+            if (site->document->getText() != text) {
+                return site->id + " holds different text from " + sites_[0]->id;
+            }
+        }
+        return {};
+    }
+
+private:
+    // A broadcast: a run inserted or characters deleted, with what its sender had applied
+    struct Message {
+        size_t from = 0;
+        uint64_t number = 0;
+        std::vector<uint64_t> context;
+        std::optional<crdt::CrdtItem> insert;
+        std::vector<crdt::Identifier> deletes;
+    };
+    using MessagePtr = std::shared_ptr<const Message>;
+
+    // Delete sequences up to sequence can be acknowledged to a peer that has applied required
+    struct Stability {
+        uint64_t sequence;
+        std::vector<uint64_t> required;
+    };
+
+    struct Site {
+        std::string id;
+        std::unique_ptr<crdt::CrdtDocument> document;
+        uint64_t sent = 0;
+        std::vector<uint64_t> known;                  // Highest message applied per origin; own entry is sent
+        std::vector<std::vector<uint64_t>> reported;  // What each peer last said it had applied
+        std::vector<bool> syncing;                    // Waiting for the delta of a peer whose link came back
+        std::vector<std::deque<MessagePtr>> held;     // What that peer sent meanwhile
+        std::deque<Stability> stability;              // Not yet acknowledged to every peer
+        uint64_t checked = 0;                         // Entries popped off stability
+        std::vector<uint64_t> nextCheck;              // Per peer, first entry not acknowledged to it
+    };
+
+    static bool covers(const std::vector<uint64_t>& known, const std::vector<uint64_t>& required) {
+        for (size_t i = 0; i < known.size(); ++i) {
+            if (known[i] < required[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void merge(std::vector<uint64_t>& into, const std::vector<uint64_t>& other) {
+        for (size_t i = 0; i < into.size(); ++i) {
+            into[i] = std::max(into[i], other[i]);
+        }
+    }
+
+    void broadcast(size_t from, std::shared_ptr<Message> message) {
+        Site& site = *sites_[from];
+        message->from = from;
+        message->number = ++site.sent;
+        site.known[from] = site.sent;
+        message->context = site.known;
+        ++report_.operationsSent;
+        const MessagePtr shared = std::move(message);
+        for (size_t peer = 0; peer < sites_.size(); ++peer) {
+            if (peer != from) {
+                network_.send(from, peer, [this, peer, shared] { receive(peer, shared); });
+            }
+        }
+    }
+
+    // Note the delete sequences a change used, and what a peer must have applied for them to be stable
+    void recordDeletes(Site& site, uint64_t before, std::vector<uint64_t> required) {
+        const uint64_t after = site.document->getDeleteSequence();
+        if (after > before) {
+            site.stability.push_back({after, std::move(required)});
+        }
+    }
+
+    void receive(size_t index, const MessagePtr& message) {
+        Site& site = *sites_[index];
+        if (site.syncing[message->from]) {
+            site.held[message->from].push_back(message);
+            return;
+        }
+        apply(site, *message);
+    }
+
+    void apply(Site& site, const Message& message) {
+        if (message.number <= site.known[message.from]) {
+            return;  // A delta brought it already
+        }
+        if (message.number != site.known[message.from] + 1) {
+            throw std::logic_error(site.id + " missed a message from " + sites_[message.from]->id +
+                                   " without resynchronizing");
+        }
+        const uint64_t before = site.document->getDeleteSequence();
+        if (message.insert) {
+            site.document->remoteInsert(*message.insert);
+        }
+        if (!message.deletes.empty()) {
+            site.document->remoteDeleteBatch(std::span<const crdt::Identifier>(message.deletes));
+        }
+        site.known[message.from] = message.number;
+        std::vector<uint64_t> required = site.known;
+        merge(required, message.context);
+        recordDeletes(site, before, std::move(required));
+    }
+
+    void linkChanged(size_t a, size_t b, bool up) {
+        for (auto [self, peer] : {std::pair{a, b}, std::pair{b, a}}) {
+            Site& site = *sites_[self];
+            site.held[peer].clear();
+            site.syncing[peer] = up;
+            if (up) {
+                network_.send(self, peer,
+                              [this, self, peer, vector = site.document->getVersionVector()] {
+                                  answerSync(peer, self, vector);
+                              });
+            }
+        }
+        if (up) {
+            report_.resyncs += 2;
+        }
+    }
+
+    void answerSync(size_t index, size_t requester, const crdt::VersionVector& vector) {
+        Site& site = *sites_[index];
+        network_.send(index, requester,
+                      [this, index, requester, delta = site.document->getDeltaSince(vector), known = site.known] {
+                          applySync(requester, index, delta, known);
+                      });
+    }
+
+    void applySync(size_t index, size_t peer, const crdt::CrdtDelta& delta, const std::vector<uint64_t>& known) {
+        Site& site = *sites_[index];
+        const uint64_t before = site.document->getDeleteSequence();
+        site.document->applyDelta(delta);
+        merge(site.known, known);
+        recordDeletes(site, before, site.known);
+        site.syncing[peer] = false;
+        std::deque<MessagePtr> held = std::move(site.held[peer]);
+        site.held[peer].clear();
+        for (const MessagePtr& message : held) {
+            apply(site, *message);
+        }
+    }
+
+    void receiveAck(size_t index, size_t peer, const std::vector<uint64_t>& known) {
+        Site& site = *sites_[index];
+        merge(site.reported[peer], known);
+
+        // Acknowledge the peer every delete sequence both it and this site are past
+        uint64_t& next = site.nextCheck[peer];
+        uint64_t acknowledged = 0;
+        while (next - site.checked < site.stability.size()) {
+            const Stability& entry = site.stability[next - site.checked];
+            if (!covers(site.reported[peer], entry.required) || !covers(site.known, entry.required)) {
+                break;
+            }
+            acknowledged = entry.sequence;
+            ++next;
+        }
+        if (acknowledged > 0) {
+            site.document->acknowledge(sites_[peer]->id, acknowledged);
+        }
+
+        // Entries every peer is past are done with
+        uint64_t done = UINT64_MAX;
+        for (size_t other = 0; other < sites_.size(); ++other) {
+            if (other != index) {
+                done = std::min(done, site.nextCheck[other]);
+            }
+        }
+        while (site.checked < done && !site.stability.empty()) {
+            site.stability.pop_front();
+            ++site.checked;
+        }
+    }
+
+    const SimulationOptions options_;
+    std::mt19937 random_;
+    EventQueue events_;
+    SimulatedNetwork network_;
+    std::vector<std::unique_ptr<Site>> sites_;
+    SimulationReport report_;
+};
+
+} // namespace simulation
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CONVERGENCE_SIMULATOR_H
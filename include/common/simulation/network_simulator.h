@@ -0,0 +1,323 @@
+#ifndef COLLABORATIVE_EDITOR_NETWORK_SIMULATOR_H
+#define COLLABORATIVE_EDITOR_NETWORK_SIMULATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace collab {
+namespace simulation {
+
+using SimTime = std::chrono::microseconds;
+
+/**
+ * Discrete-event clock: actions run in the order of the simulated time they are due at
+ *
+ * Actions due at the same time run in the order they were scheduled, so a
+ * run depends only on what was scheduled, never on wall time.
+ */
+class EventQueue {
+public:
+    SimTime now() const {
+        return now_;
+    }
+
+    // Run an action once delay of simulated time has passed
+    void schedule(SimTime delay, std::function<void()> action) {
+        events_.push(Event{now_ + std::max(delay, SimTime::zero()), next_++, std::move(action)});
+    }
+
+    /**
+     * Run the next action due, advancing the clock to it
+     *
+     * @return False if nothing is scheduled
+     */
+    bool step() {
+        if (events_.empty()) {
+            return false;
+        }
+        // The top is popped right after, so its action can be moved out
+        Event event = std::move(const_cast<Event&>(events_.top()));
+        events_.pop();
+        now_ = event.due;
+        event.action();
+        return true;
+    }
+
+    bool empty() const {
+        return events_.empty();
+    }
+
+    size_t size() const {
+        return events_.size();
+    }
+
+private:
+    struct Event {
+        SimTime due;
+        uint64_t order;
+        std::function<void()> action;
+
+        bool operator>(const Event& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    SimTime now_{0};
+    uint64_t next_ = 0;
+};
+
+/**
+ * The network between the simulated sites, and the faults it suffers
+ */
+struct NetworkOptions {
+    SimTime latency = std::chrono::milliseconds(40);    // One-way delay every message has
+    SimTime jitter = std::chrono::milliseconds(60);     // Up to this much more, drawn per message
+    double disconnectsPerMinute = 0;                    // Per site; the site loses all its links
+    SimTime offlineTime = std::chrono::seconds(5);      // How long a disconnected site stays away
+    double partitionsPerMinute = 0;                     // Splits the sites into two halves that cannot talk
+    SimTime partitionTime = std::chrono::seconds(10);   // How long a partition lasts
+};
+
+/**
+ * Links between every pair of nodes, with latency, jitter, disconnects and partitions
+ *
+ * Each link behaves like a TCP connection: messages on it arrive in the
+ * order they were sent, and when it breaks, whatever is in flight on it is
+ * lost, as is anything sent while it is down. Messages on different links
+ * overtake each other freely, so a node sees the traffic of its peers in
+ * an order the jitter decides. When a link comes back the link callback is
+ * told, for the protocol to resynchronize, as it would on a new connection.
+ *
+ * Messages are actions run at the receiving node when they arrive. Data
+ * messages are counted as in flight until they arrive or are lost, so a
+ * simulation can tell when the system has gone quiet.
+ */
+class SimulatedNetwork {
+public:
+    // A link went down or came back up
+    using LinkCallback = std::function<void(size_t a, size_t b, bool up)>;
+
+    struct Stats {
+        uint64_t sent = 0;
+        uint64_t delivered = 0;
+        uint64_t dropped = 0;        // Lost to a broken link, in flight or sent while it was down
+        uint64_t disconnects = 0;
+        uint64_t partitions = 0;
+        uint64_t dataInFlight = 0;   // Data messages sent and neither delivered nor lost yet
+    };
+
+    /**
+     * Constructor
+     *
+     * @param events The clock messages and faults are scheduled on
+     * @param nodes Number of nodes, all linked to each other
+     * @param options Latency and faults
+     * @param seed Seed for the jitter and the faults
+     */
+    SimulatedNetwork(EventQueue& events, size_t nodes, NetworkOptions options, uint32_t seed)
+        : events_(events), options_(options), random_(seed), nodes_(nodes), offline_(nodes, 0),
+          side_(nodes, false), epochs_(nodes * nodes, 0), lastArrival_(nodes * nodes, SimTime::zero()) {
+        if (nodes == 0) {
+            throw std::invalid_argument("A network needs at least one node");
+        }
+    }
+
+    SimulatedNetwork(const SimulatedNetwork&) = delete;
+    SimulatedNetwork& operator=(const SimulatedNetwork&) = delete;
+
+    void setLinkCallback(LinkCallback callback) {
+        linkCallback_ = std::move(callback);
+    }
+
+    /**
+     * Send a message, to run at the receiver when it arrives
+     *
+     * @param from Sending node
+     * @param to Receiving node
+     * @param deliver What the receiver does with the message
+     * @param data False for control traffic, e.g. acknowledgements, that does not keep the system busy
+     * @return False if the link is down and the message was lost at once
+     */
+    bool send(size_t from, size_t to, std::function<void()> deliver, bool data = true) {
+        ++stats_.sent;
+        if (!connected(from, to)) {
+            ++stats_.dropped;
+            return false;
+        }
+        const size_t link = index(from, to);
+        const SimTime delay = options_.latency + SimTime(std::uniform_int_distribution<int64_t>(
+                                                   0, std::max<int64_t>(options_.jitter.count(), 0))(random_));
+        const SimTime arrival = std::max(events_.now() + delay, lastArrival_[link]);
+        lastArrival_[link] = arrival;
+        if (data) {
+            ++stats_.dataInFlight;
+        }
+        events_.schedule(arrival - events_.now(),
+                         [this, from, to, epoch = epochs_[link], deliver = std::move(deliver), data] {
+                             if (data) {
+                                 --stats_.dataInFlight;
+                             }
+                             if (epochs_[index(from, to)] != epoch) {
+                                 ++stats_.dropped;
+                                 return;
+                             }
+                             ++stats_.delivered;
+                             deliver();
+                         });
+        return true;
+    }
+
+    bool connected(size_t a, size_t b) const {
+        return offline_[a] == 0 && offline_[b] == 0 && (!partitioned_ || side_[a] == side_[b]);
+    }
+
+    /**
+     * Schedule random disconnects and partitions up to a time
+     *
+     * Disconnect and partition times are exponentially distributed at the
+     * configured rates; faults still going on at the end keep their duration.
+     *
+     * @param until No fault starts after this
+     * @param firstFaultyNode Nodes below this never disconnect, e.g. a server
+     */
+    void startFaults(SimTime until, size_t firstFaultyNode = 0) {
+        until_ = until;
+        for (size_t node = firstFaultyNode; node < nodes_; ++node) {
+            scheduleDisconnect(node);
+        }
+        schedulePartition();
+    }
+
+    // End every fault now, and start no more
+    void heal() {
+        until_ = SimTime::zero();
+        changeLinks([this] {
+            std::fill(offline_.begin(), offline_.end(), 0);
+            partitioned_ = false;
+        });
+    }
+
+    const Stats& stats() const {
+        return stats_;
+    }
+
+private:
+    size_t index(size_t from, size_t to) const {
+        return from * nodes_ + to;
+    }
+
+    SimTime exponential(double perMinute) {
+        const double minutes = std::exponential_distribution<double>(perMinute)(random_);
+        return SimTime(static_cast<int64_t>(minutes * 60e6));
+    }
+
+    void scheduleDisconnect(size_t node) {
+        if (options_.disconnectsPerMinute <= 0) {
+            return;
+        }
+        const SimTime delay = exponential(options_.disconnectsPerMinute);
+        if (events_.now() + delay >= until_) {
+            return;
+        }
+        events_.schedule(delay, [this, node] {
+            if (events_.now() >= until_) {
+                return;
+            }
+            ++stats_.disconnects;
+            changeLinks([this, node] { ++offline_[node]; });
+            events_.schedule(options_.offlineTime, [this, node] {
+                changeLinks([this, node] { offline_[node] = std::max(offline_[node], 1) - 1; });
+                scheduleDisconnect(node);
+            });
+        });
+    }
+
+    void schedulePartition() {
+        if (options_.partitionsPerMinute <= 0 || nodes_ < 2) {
+            return;
+        }
+        const SimTime delay = exponential(options_.partitionsPerMinute);
+        if (events_.now() + delay >= until_) {
+            return;
+        }
+        events_.schedule(delay, [this] {
+            if (events_.now() >= until_) {
+                return;
+            }
+            ++stats_.partitions;
+            changeLinks([this] {
+                // A random half, which is never everyone
+                std::bernoulli_distribution half(0.5);
+                for (size_t node = 0; node < nodes_; ++node) {
+                    side_[node] = half(random_);
+                }
+                side_[std::uniform_int_distribution<size_t>(0, nodes_ - 1)(random_)] = !side_[0];
+                partitioned_ = true;
+            });
+            events_.schedule(options_.partitionTime, [this] {
+                changeLinks([this] { partitioned_ = false; });
+                schedulePartition();
+            });
+        });
+    }
+
+    // Apply a change to the faults, break the links it took down and report the ones it brought back
+    template <typename Change>
+    void changeLinks(Change change) {
+        std::vector<bool> before(nodes_ * nodes_);
+        for (size_t a = 0; a < nodes_; ++a) {
+            for (size_t b = 0; b < nodes_; ++b) {
+                before[index(a, b)] = connected(a, b);
+            }
+        }
+        change();
+        std::vector<std::pair<size_t, size_t>> restored;
+        for (size_t a = 0; a < nodes_; ++a) {
+            for (size_t b = 0; b < nodes_; ++b) {
+                const bool up = connected(a, b);
+                if (before[index(a, b)] == up || a == b) {
+                    continue;
+                }
+                if (!up) {
+                    ++epochs_[index(a, b)];
+                    if (a < b && linkCallback_) {
+                        linkCallback_(a, b, false);
+                    }
+                } else if (a < b) {
+                    restored.emplace_back(a, b);
+                }
+            }
+        }
+        // Reported once the whole change is in place, as the protocol may send at once
+        for (const auto& [a, b] : restored) {
+            if (linkCallback_) {
+                linkCallback_(a, b, true);
+            }
+        }
+    }
+
+    EventQueue& events_;
+    const NetworkOptions options_;
+    std::mt19937 random_;
+    const size_t nodes_;
+    std::vector<int> offline_;            // Disconnects still going on, per node
+    std::vector<bool> side_;              // Half of the partition, per node
+    bool partitioned_ = false;
+    std::vector<uint64_t> epochs_;        // Per link; bumped when it breaks, dropping what is in flight
+    std::vector<SimTime> lastArrival_;    // Per link, to keep its messages in order
+    SimTime until_{0};
+    LinkCallback linkCallback_;
+    Stats stats_;
+};
+
+} // namespace simulation
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_NETWORK_SIMULATOR_H
@@ -0,0 +1,100 @@
+#ifndef COLLABORATIVE_EDITOR_BASE64_H
+#define COLLABORATIVE_EDITOR_BASE64_H
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace collab {
+namespace util {
+
+/**
+ * Encode binary data as padded base64 (RFC 4648), e.g. to embed it in JSON
+ *
+ * @param data The bytes to encode
+ * @return The base64 text
+ */
+inline std::string base64Encode(std::string_view data) {
+    static constexpr char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string encoded;
+    encoded.reserve((data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        const uint32_t chunk = (static_cast<uint8_t>(data[i]) << 16) |
+                               (static_cast<uint8_t>(data[i + 1]) << 8) |
+                               static_cast<uint8_t>(data[i + 2]);
+        encoded += alphabet[(chunk >> 18) & 0x3F];
+        encoded += alphabet[(chunk >> 12) & 0x3F];
+        encoded += alphabet[(chunk >> 6) & 0x3F];
+        encoded += alphabet[chunk & 0x3F];
+    }
+    if (i < data.size()) {
+        uint32_t chunk = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size()) {
+            chunk |= static_cast<uint8_t>(data[i + 1]) << 8;
+        }
+        encoded += alphabet[(chunk >> 18) & 0x3F];
+        encoded += alphabet[(chunk >> 12) & 0x3F];
+        encoded += i + 1 < data.size() ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        encoded += '=';
+    }
+    return encoded;
+}
+
+/**
+ * Decode padded base64 produced by base64Encode()
+ *
+ * @param text The base64 text
+ * @return The decoded bytes
+ * @throws std::invalid_argument if text is not valid base64
+ */
+inline std::string base64Decode(std::string_view text) {
+    static const std::array<int8_t, 256> values = [] {
+        std::array<int8_t, 256> table{};
+        table.fill(-1);
+        const std::string_view alphabet =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (size_t i = 0; i < alphabet.size(); ++i) {
+            table[static_cast<uint8_t>(alphabet[i])] = static_cast<int8_t>(i);
+        }
+        return table;
+    }();
+
+    if (text.size() % 4 != 0) {
+        throw std::invalid_argument("Invalid base64 length");
+    }
+    std::string decoded;
+    decoded.reserve(text.size() / 4 * 3);
+    for (size_t i = 0; i < text.size(); i += 4) {
+        const bool last = i + 4 == text.size();
+        const size_t padding = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+        if (padding == 1 && text[i + 2] == '=') {
+            throw std::invalid_argument("Invalid base64 padding");
+        }
+        uint32_t chunk = 0;
+        for (size_t j = 0; j < 4 - padding; ++j) {
+            const int8_t value = values[static_cast<uint8_t>(text[i + j])];
+            if (value < 0) {
+                throw std::invalid_argument("Invalid base64 character");
+            }
+            chunk |= static_cast<uint32_t>(value) << (18 - 6 * j);
+        }
+        decoded += static_cast<char>((chunk >> 16) & 0xFF);
+        if (padding < 2) {
+            decoded += static_cast<char>((chunk >> 8) & 0xFF);
+        }
+        if (padding < 1) {
+            decoded += static_cast<char>(chunk & 0xFF);
+        }
+    }
+    return decoded;
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BASE64_H
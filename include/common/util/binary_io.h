@@ -0,0 +1,148 @@
+#ifndef COLLABORATIVE_EDITOR_BINARY_IO_H
+#define COLLABORATIVE_EDITOR_BINARY_IO_H
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace collab {
+namespace util {
+
+/**
+ * Append-only buffer for the compact binary encodings
+ *
+ * Integers are written as LEB128 varints, so the small clocks, lengths and
+ * table indices that dominate CRDT state and protocol messages take one or
+ * two bytes each.
+ */
+class BinaryWriter {
+public:
+    BinaryWriter() = default;
+
+    // Write into a buffer of the caller's, e.g. from FramePool, reusing its capacity
+    explicit BinaryWriter(std::string buffer) : buffer_(std::move(buffer)) {
+        buffer_.clear();
+    }
+
+    void writeByte(uint8_t value) {
+        buffer_.push_back(static_cast<char>(value));
+    }
+
+    void writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            writeByte(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        writeByte(static_cast<uint8_t>(value));
+    }
+
+    // Zigzag-encode so that small negative values stay short too
+    void writeSignedVarint(int64_t value) {
+        writeVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    // Write bytes as they are, without a length prefix
+    void writeRaw(std::string_view bytes) {
+        buffer_.append(bytes);
+    }
+
+    // Write a length-prefixed byte string
+    void writeString(std::string_view bytes) {
+        writeVarint(bytes.size());
+        writeRaw(bytes);
+    }
+
+    const std::string& data() const { return buffer_; }
+    std::string take() { return std::move(buffer_); }
+
+private:
+    std::string buffer_;
+};
+
+/**
+ * Cursor over a buffer produced by BinaryWriter
+ *
+ * Every read checks the remaining length and throws std::runtime_error on
+ * truncated or malformed input, so untrusted payloads from the network can
+ * be decoded directly.
+ */
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view data)
+        : data_(data) {}
+
+    uint8_t readByte() {
+        if (offset_ >= data_.size()) {
+            throw std::runtime_error("Truncated binary encoding");
+        }
+        return static_cast<uint8_t>(data_[offset_++]);
+    }
+
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            const uint8_t byte = readByte();
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Malformed varint in binary encoding");
+    }
+
+    int64_t readSignedVarint() {
+        const uint64_t value = readVarint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    /**
+     * Read a varint that must fit a narrower integer type
+     *
+     * @return The value, checked against the range of T
+     */
+    template <typename T>
+    T readVarintAs() {
+        const uint64_t value = readVarint();
+        if (value > std::numeric_limits<T>::max()) {
+            throw std::runtime_error("Out of range value in binary encoding");
+        }
+        return static_cast<T>(value);
+    }
+
+    /**
+     * Read bytes without a length prefix
+     *
+     * @param length Number of bytes to read
+     * @return View into the underlying buffer
+     */
+    std::string_view readRaw(size_t length) {
+        if (length > data_.size() - offset_) {
+            throw std::runtime_error("Truncated binary encoding");
+        }
+        std::string_view bytes = data_.substr(offset_, length);
+        offset_ += length;
+        return bytes;
+    }
+
+    // Read a length-prefixed byte string
+    std::string_view readString() {
+        return readRaw(readVarintAs<size_t>());
+    }
+
+    bool atEnd() const { return offset_ == data_.size(); }
+    size_t remaining() const { return data_.size() - offset_; }
+
+    // The bytes not read yet
+    std::string_view rest() const { return data_.substr(offset_); }
+
+private:
+    std::string_view data_;
+    size_t offset_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BINARY_IO_H
@@ -0,0 +1,338 @@
+#ifndef COLLABORATIVE_EDITOR_BUFFER_POOL_H
+#define COLLABORATIVE_EDITOR_BUFFER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "common/util/numa_topology.h"
+
+namespace collab {
+namespace util {
+
+/**
+ * Shared pool of I/O buffers in power-of-two size classes
+ *
+ * Connections take a buffer when they have data to read and hand it back
+ * once the data is parsed, so idle connections hold none and each read
+ * reuses memory another one returned. Sizes are rounded up to the next
+ * class, from MIN_CLASS_SIZE to MAX_CLASS_SIZE; larger requests bypass the
+ * pool. Each class keeps at most a fixed number of free buffers and frees
+ * the rest.
+ *
+ * A pool can instead be placed on a NUMA node: its buffers are then cut
+ * from chunks mapped on that node, on huge pages if asked, and a buffer
+ * handed back is always kept for reuse, since it cannot be freed alone.
+ * local() gives each node such a pool for the threads bound to it.
+ *
+ * Thread-safe; each class has its own lock.
+ */
+class BufferPool {
+public:
+    static constexpr size_t MIN_CLASS_SIZE = 512;
+    static constexpr size_t MAX_CLASS_SIZE = size_t{1} << 20;
+    static constexpr size_t CLASS_COUNT = 12;  // 512 B to 1 MiB
+    static constexpr size_t DEFAULT_MAX_FREE = 256;
+
+    struct Stats {
+        uint64_t allocated = 0;  // Buffers taken from the heap
+        uint64_t reused = 0;     // Buffers handed out again from the pool
+        size_t freeBytes = 0;    // Bytes held in the pool right now
+    };
+
+    /**
+     * Buffer taken from a pool, handed back when destroyed
+     */
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(BufferPool* pool, char* data, size_t size)
+            : pool_(pool), data_(data), size_(size) {}
+        Buffer(Buffer&& other) noexcept
+            : pool_(std::exchange(other.pool_, nullptr))
+            , data_(std::exchange(other.data_, nullptr))
+            , size_(std::exchange(other.size_, 0)) {}
+        Buffer& operator=(Buffer&& other) noexcept {
+            if (this != &other) {
+                reset();
+                pool_ = std::exchange(other.pool_, nullptr);
+                data_ = std::exchange(other.data_, nullptr);
+                size_ = std::exchange(other.size_, 0);
+            }
+            return *this;
+        }
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer() { reset(); }
+
+        char* data() const { return data_; }
+        // The class size, at least what was asked for
+        size_t size() const { return size_; }
+        explicit operator bool() const { return data_ != nullptr; }
+
+        // Hand the buffer back now
+        void reset() {
+            if (data_) {
+                pool_->deallocate(data_, size_);
+                data_ = nullptr;
+                size_ = 0;
+            }
+        }
+
+    private:
+        BufferPool* pool_ = nullptr;
+        char* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    /**
+     * Create an empty pool
+     *
+     * @param maxFree Free buffers kept per size class
+     */
+    explicit BufferPool(size_t maxFree = DEFAULT_MAX_FREE)
+        : maxFree_(maxFree) {}
+
+    /**
+     * Create an empty pool whose buffers come from one NUMA node
+     *
+     * @param topology The machine's nodes; must outlive the pool
+     * @param node Node index the memory is taken from
+     * @param hugePages Map the chunks buffers are cut from on transparent huge pages
+     */
+    BufferPool(const NumaTopology& topology, size_t node, bool hugePages = false)
+        : maxFree_(0), topology_(&topology), node_(node), hugePages_(hugePages) {}
+
+    ~BufferPool() {
+        if (topology_) {
+            for (const auto& chunk : chunks_) {
+                topology_->deallocate(chunk.first, chunk.second, hugePages_);
+            }
+            return;
+        }
+        for (auto& sizeClass : classes_) {
+            for (char* data : sizeClass.free) {
+                ::operator delete(data);
+            }
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // The pool shared by every connection of the process
+    static BufferPool& shared() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    /**
+     * The pool for the calling thread's NUMA node
+     *
+     * @return The node's pool if the thread was bound with NumaTopology::bindCurrentThread(), otherwise shared()
+     */
+    static BufferPool& local() {
+        const size_t node = NumaTopology::currentNode();
+        if (node == NumaTopology::NO_NODE) {
+            return shared();
+        }
+        thread_local size_t cachedNode = NumaTopology::NO_NODE;
+        thread_local BufferPool* cached = nullptr;
+        if (cachedNode != node) {
+            NodePools& pools = nodePools();
+            std::lock_guard<std::mutex> lock(pools.mutex);
+            if (pools.pools.size() <= node) {
+                pools.pools.resize(node + 1);
+            }
+            if (!pools.pools[node]) {
+                pools.pools[node] = std::make_unique<BufferPool>(
+                    NumaTopology::system(), node, pools.hugePages.load(std::memory_order_relaxed));
+            }
+            cached = pools.pools[node].get();
+            cachedNode = node;
+        }
+        return *cached;
+    }
+
+    // Have the node pools local() creates from now on map their chunks on huge pages
+    static void setNodeHugePages(bool hugePages) {
+        nodePools().hugePages.store(hugePages, std::memory_order_relaxed);
+    }
+
+    // Node this pool takes its memory from, or NumaTopology::NO_NODE for the heap
+    size_t getNode() const {
+        return topology_ ? node_ : NumaTopology::NO_NODE;
+    }
+
+    // The size a request is rounded up to; itself if larger than any class
+    static size_t classSize(size_t size) {
+        const size_t index = classIndex(size);
+        return index < CLASS_COUNT ? MIN_CLASS_SIZE << index : size;
+    }
+
+    /**
+     * Take a buffer of at least a given size
+     *
+     * @param size Bytes needed
+     * @return The buffer, handed back when it is destroyed or reset
+     */
+    Buffer acquire(size_t size) {
+        const size_t rounded = classSize(size);
+        return Buffer(this, allocate(rounded), rounded);
+    }
+
+    /**
+     * Take raw memory, for allocators; give it back with deallocate() and the same size
+     *
+     * @param size Bytes needed
+     * @return Memory for at least size bytes
+     * @throws std::bad_alloc if the heap is exhausted
+     */
+    char* allocate(size_t size) {
+        const size_t index = classIndex(size);
+        if (index < CLASS_COUNT) {
+            SizeClass& sizeClass = classes_[index];
+            std::lock_guard<std::mutex> lock(sizeClass.mutex);
+            if (!sizeClass.free.empty()) {
+                char* data = sizeClass.free.back();
+                sizeClass.free.pop_back();
+                ++sizeClass.reused;
+                return data;
+            }
+            ++sizeClass.allocated;
+            if (topology_) {
+                return carve(MIN_CLASS_SIZE << index);
+            }
+            return static_cast<char*>(::operator new(MIN_CLASS_SIZE << index));
+        }
+        return static_cast<char*>(::operator new(size));
+    }
+
+    /**
+     * Give back memory from allocate()
+     *
+     * @param data The memory
+     * @param size The size it was allocated with
+     */
+    void deallocate(char* data, size_t size) {
+        const size_t index = classIndex(size);
+        if (index < CLASS_COUNT) {
+            SizeClass& sizeClass = classes_[index];
+            std::lock_guard<std::mutex> lock(sizeClass.mutex);
+            if (topology_ || sizeClass.free.size() < maxFree_) {
+                sizeClass.free.push_back(data);
+                return;
+            }
+        }
+        ::operator delete(data);
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        for (size_t i = 0; i < CLASS_COUNT; ++i) {
+            const SizeClass& sizeClass = classes_[i];
+            std::lock_guard<std::mutex> lock(sizeClass.mutex);
+            stats.allocated += sizeClass.allocated;
+            stats.reused += sizeClass.reused;
+            stats.freeBytes += sizeClass.free.size() * (MIN_CLASS_SIZE << i);
+        }
+        return stats;
+    }
+
+private:
+    struct SizeClass {
+        std::vector<char*> free;
+        uint64_t allocated = 0;
+        uint64_t reused = 0;
+        mutable std::mutex mutex;
+    };
+
+    // Index of the class a size rounds up to; CLASS_COUNT if none
+    static size_t classIndex(size_t size) {
+        size_t index = 0;
+        while (index < CLASS_COUNT && (MIN_CLASS_SIZE << index) < size) {
+            ++index;
+        }
+        return index;
+    }
+
+    struct NodePools {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<BufferPool>> pools;
+        std::atomic<bool> hugePages{false};
+    };
+
+    static NodePools& nodePools() {
+        static NodePools pools;
+        return pools;
+    }
+
+    // Cut a class buffer from the node's current chunk, mapping another when it runs out
+    char* carve(size_t size) {
+        std::lock_guard<std::mutex> lock(chunkMutex_);
+        if (chunkUsed_ + size > chunkSize_) {
+            const size_t bytes = std::max(NumaTopology::HUGE_PAGE_SIZE, MAX_CLASS_SIZE);
+            char* chunk = static_cast<char*>(topology_->allocate(bytes, node_, hugePages_));
+            chunks_.emplace_back(chunk, bytes);
+            chunkUsed_ = 0;
+            chunkSize_ = bytes;
+        }
+        char* data = chunks_.back().first + chunkUsed_;
+        chunkUsed_ += size;
+        return data;
+    }
+
+    std::array<SizeClass, CLASS_COUNT> classes_;
+    size_t maxFree_;
+    // Set for a pool on a NUMA node
+    const NumaTopology* topology_ = nullptr;
+    size_t node_ = 0;
+    bool hugePages_ = false;
+    std::mutex chunkMutex_;
+    std::vector<std::pair<char*, size_t>> chunks_;
+    size_t chunkUsed_ = 0;
+    size_t chunkSize_ = 0;
+};
+
+/**
+ * Standard allocator drawing from a BufferPool, e.g. for a Beast flat_buffer
+ */
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(BufferPool& pool = BufferPool::shared()) noexcept
+        : pool_(&pool) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept
+        : pool_(other.pool()) {}
+
+    T* allocate(size_t n) {
+        return reinterpret_cast<T*>(pool_->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        pool_->deallocate(reinterpret_cast<char*>(p), n * sizeof(T));
+    }
+
+    BufferPool* pool() const noexcept { return pool_; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const noexcept { return pool_ == other.pool(); }
+
+private:
+    BufferPool* pool_;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BUFFER_POOL_H
@@ -0,0 +1,297 @@
+#ifndef COLLABORATIVE_EDITOR_CHUNK_STORE_H
+#define COLLABORATIVE_EDITOR_CHUNK_STORE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <openssl/evp.h>
+
+namespace collab {
+namespace util {
+
+/**
+ * Content-addressed storage of document versions, deduplicated by chunk
+ *
+ * A version is cut into chunks where a rolling hash of the last bytes
+ * hits a pattern (content-defined chunking, FastCDC style), so an edit
+ * only moves the boundaries near it: inserting a line re-cuts one or two
+ * chunks instead of shifting every one after it. Each chunk is stored
+ * once under its SHA-256 and counted per version that uses it, so
+ * snapshots of the same document, and documents copied from a template,
+ * share every chunk they have in common. Storage grows with what changed,
+ * not with the document size times the versions kept.
+ *
+ * put() returns the version's manifest, the chunk list to rebuild it with
+ * get(); release() drops a version's references and frees the chunks no
+ * version uses any more. Thread-safe.
+ */
+class ChunkStore {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    // One chunk of a version
+    struct ChunkRef {
+        Digest digest;
+        uint32_t length;
+    };
+
+    // The chunks of a version, in order
+    using Manifest = std::vector<ChunkRef>;
+
+    // Chunk sizes, in bytes; avgSize must be a power of two
+    struct Params {
+        size_t minSize = 2 * 1024;
+        size_t avgSize = 8 * 1024;
+        size_t maxSize = 64 * 1024;
+    };
+
+    struct Stats {
+        size_t chunks = 0;          // Distinct chunks stored
+        size_t storedBytes = 0;     // Their bytes
+        size_t references = 0;      // Uses of them by the versions held
+        uint64_t putBytes = 0;      // Bytes given to put()
+        uint64_t dedupedBytes = 0;  // Of which were already stored
+    };
+
+    ChunkStore() : ChunkStore(Params()) {}
+
+    /**
+     * @param params Chunk sizes
+     * @throws std::invalid_argument if the sizes are not ordered or avgSize is not a power of two
+     */
+    explicit ChunkStore(Params params) : params_(params) {
+        if (params_.minSize == 0 || params_.minSize > params_.avgSize || params_.avgSize > params_.maxSize ||
+            params_.maxSize > UINT32_MAX || (params_.avgSize & (params_.avgSize - 1)) != 0) {
+            throw std::invalid_argument("Invalid chunk sizes");
+        }
+        // Normalized chunking: harder to cut before the average size, easier after
+        int bits = 0;
+        while ((size_t{1} << bits) < params_.avgSize) {
+            ++bits;
+        }
+        strictMask_ = maskOf(bits + 2);
+        looseMask_ = maskOf(bits > 2 ? bits - 2 : 1);
+    }
+
+    ChunkStore(const ChunkStore&) = delete;
+    ChunkStore& operator=(const ChunkStore&) = delete;
+
+    /**
+     * Store a version, keeping only the chunks not stored yet
+     * Each put needs a matching release() once the version is dropped
+     *
+     * @param content The version's bytes
+     * @return Its manifest
+     */
+    Manifest put(std::string_view content) {
+        // Cut and hash outside the lock; it is the bulk of the work
+        Manifest manifest;
+        std::vector<std::string_view> pieces;
+        for (size_t offset = 0; offset < content.size();) {
+            const size_t length = cut(content.substr(offset));
+            pieces.push_back(content.substr(offset, length));
+            manifest.push_back(ChunkRef{sha256(pieces.back()), static_cast<uint32_t>(length)});
+            offset += length;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.putBytes += content.size();
+        for (size_t i = 0; i < manifest.size(); ++i) {
+            auto [it, added] = chunks_.try_emplace(manifest[i].digest);
+            if (added) {
+                it->second.data.assign(pieces[i]);
+                stats_.storedBytes += pieces[i].size();
+            } else {
+                stats_.dedupedBytes += pieces[i].size();
+            }
+            ++it->second.references;
+            ++stats_.references;
+        }
+        return manifest;
+    }
+
+    /**
+     * Rebuild a version
+     *
+     * @param manifest The version, as put() returned it
+     * @return Its bytes
+     * @throws std::out_of_range if a chunk of it is not stored, e.g. it was released
+     */
+    std::string get(const Manifest& manifest) const {
+        size_t size = 0;
+        for (const ChunkRef& ref : manifest) {
+            size += ref.length;
+        }
+        std::string content;
+        content.reserve(size);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const ChunkRef& ref : manifest) {
+            auto it = chunks_.find(ref.digest);
+            if (it == chunks_.end()) {
+                throw std::out_of_range("Chunk " + toHex(ref.digest) + " is not stored");
+            }
+            content += it->second.data;
+        }
+        return content;
+    }
+
+    /**
+     * Drop a version, freeing the chunks only it used
+     *
+     * @param manifest The version, as put() returned it
+     */
+    void release(const Manifest& manifest) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const ChunkRef& ref : manifest) {
+            auto it = chunks_.find(ref.digest);
+            if (it == chunks_.end()) {
+                continue;
+            }
+            --stats_.references;
+            if (--it->second.references == 0) {
+                stats_.storedBytes -= it->second.data.size();
+                chunks_.erase(it);
+            }
+        }
+    }
+
+    // Whether a chunk is stored, e.g. before sending it to a peer that has the manifest
+    bool contains(const Digest& digest) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return chunks_.count(digest) != 0;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.chunks = chunks_.size();
+        return stats;
+    }
+
+    /**
+     * Where the chunks of some content end
+     *
+     * @param content The content
+     * @return The end offset of each chunk
+     */
+    std::vector<size_t> boundaries(std::string_view content) const {
+        std::vector<size_t> ends;
+        for (size_t offset = 0; offset < content.size();) {
+            offset += cut(content.substr(offset));
+            ends.push_back(offset);
+        }
+        return ends;
+    }
+
+    static std::string toHex(const Digest& digest) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(digest.size() * 2);
+        for (uint8_t byte : digest) {
+            hex += digits[byte >> 4];
+            hex += digits[byte & 0x0f];
+        }
+        return hex;
+    }
+
+    /**
+     * @throws std::runtime_error if OpenSSL fails
+     */
+    static Digest sha256(std::string_view data) {
+        Digest digest;
+        unsigned int length = 0;
+        if (EVP_Digest(data.data(), data.size(), digest.data(), &length, EVP_sha256(), nullptr) != 1 ||
+            length != digest.size()) {
+            throw std::runtime_error("Failed to hash chunk");
+        }
+        return digest;
+    }
+
+private:
+    struct Chunk {
+        std::string data;
+        size_t references = 0;
+    };
+
+    // The digests are uniformly distributed already
+    struct DigestHash {
+        size_t operator()(const Digest& digest) const {
+            size_t hash;
+            std::memcpy(&hash, digest.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    // Spread the mask's bits over the 64-bit hash, whose high bits mix the most input
+    static uint64_t maskOf(int bits) {
+        uint64_t mask = 0;
+        for (int i = 0; i < bits; ++i) {
+            mask |= uint64_t{1} << (63 - 2 * i);
+        }
+        return mask;
+    }
+
+    // Random values per byte for the gear hash, the same on every machine (splitmix64)
+    static const std::array<uint64_t, 256>& gear() {
+        static const std::array<uint64_t, 256> table = [] {
+            std::array<uint64_t, 256> values{};
+            uint64_t state = 0x9e3779b97f4a7c15ull;
+            for (uint64_t& value : values) {
+                uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                value = z ^ (z >> 31);
+            }
+            return values;
+        }();
+        return table;
+    }
+
+    // Length of the chunk at the start of data
+    size_t cut(std::string_view data) const {
+        if (data.size() <= params_.minSize) {
+            return data.size();
+        }
+        const auto& table = gear();
+        const size_t end = std::min(data.size(), params_.maxSize);
+        const size_t normal = std::min(end, params_.avgSize);
+        uint64_t hash = 0;
+        size_t i = params_.minSize;
+        for (; i < normal; ++i) {
+            hash = (hash << 1) + table[static_cast<uint8_t>(data[i])];
+            if ((hash & strictMask_) == 0) {
+                return i + 1;
+            }
+        }
+        for (; i < end; ++i) {
+            hash = (hash << 1) + table[static_cast<uint8_t>(data[i])];
+            if ((hash & looseMask_) == 0) {
+                return i + 1;
+            }
+        }
+        return end;
+    }
+
+    const Params params_;
+    uint64_t strictMask_ = 0;
+    uint64_t looseMask_ = 0;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<Digest, Chunk, DigestHash> chunks_;
+    Stats stats_;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CHUNK_STORE_H
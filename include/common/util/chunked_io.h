@@ -0,0 +1,248 @@
+#ifndef COLLABORATIVE_EDITOR_CHUNKED_IO_H
+#define COLLABORATIVE_EDITOR_CHUNKED_IO_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace collab {
+namespace util {
+
+/**
+ * Default size of the chunks documents are read and written in
+ */
+constexpr size_t DEFAULT_IO_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * Takes one chunk; the view is only valid during the call
+ */
+using ChunkSink = std::function<void(std::string_view chunk)>;
+
+/**
+ * Fills a buffer with up to capacity bytes, e.g. from a socket
+ * Returns the bytes written into it, 0 once the input has ended
+ */
+using ChunkSource = std::function<size_t(char* buffer, size_t capacity)>;
+
+/**
+ * Told the bytes done so far and the total, or 0 for an unknown total
+ */
+using IoProgress = std::function<void(uint64_t done, uint64_t total)>;
+
+/**
+ * Move a stream from a source to a sink through one buffer of chunkSize
+ *
+ * Memory stays at one chunk however long the stream is, so a sink that
+ * appends into a rope or a piece table holds the text once, not once in
+ * a string and again in the buffer.
+ *
+ * @param source Where the bytes come from
+ * @param sink Where each chunk goes
+ * @param progress Told after every chunk, or empty
+ * @param total Expected bytes, passed to progress; 0 if unknown
+ * @param chunkSize Bytes per chunk
+ * @return Bytes moved
+ */
+inline uint64_t pumpChunks(const ChunkSource& source, const ChunkSink& sink, const IoProgress& progress = {},
+                           uint64_t total = 0, size_t chunkSize = DEFAULT_IO_CHUNK_SIZE) {
+    std::vector<char> buffer(std::max<size_t>(chunkSize, 1));
+    uint64_t done = 0;
+    while (true) {
+        const size_t got = source(buffer.data(), buffer.size());
+        if (got == 0) {
+            return done;
+        }
+        sink(std::string_view(buffer.data(), got));
+        done += got;
+        if (progress) {
+            progress(done, total);
+        }
+    }
+}
+
+/**
+ * A file read a chunk at a time
+ */
+class ChunkedFileReader {
+public:
+    /**
+     * Open a file
+     *
+     * @param path The file
+     * @throws std::runtime_error if it cannot be opened
+     */
+    explicit ChunkedFileReader(const std::filesystem::path& path) : path_(path) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd_ < 0 || ::fstat(fd_, &info) != 0) {
+            const std::string reason = std::strerror(errno);
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+            throw std::runtime_error("Failed to open " + path.string() + ": " + reason);
+        }
+        size_ = static_cast<uint64_t>(info.st_size);
+#ifdef POSIX_FADV_SEQUENTIAL
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    ~ChunkedFileReader() {
+        ::close(fd_);
+    }
+
+    ChunkedFileReader(const ChunkedFileReader&) = delete;
+    ChunkedFileReader& operator=(const ChunkedFileReader&) = delete;
+
+    // Size of the file when it was opened
+    uint64_t size() const {
+        return size_;
+    }
+
+    /**
+     * Read the rest of the file
+     *
+     * @param sink Where each chunk goes
+     * @param progress Told after every chunk, or empty
+     * @param chunkSize Bytes per chunk
+     * @return Bytes read
+     * @throws std::runtime_error if a read fails; the sink has had the chunks before it
+     */
+    uint64_t readAll(const ChunkSink& sink, const IoProgress& progress = {},
+                     size_t chunkSize = DEFAULT_IO_CHUNK_SIZE) {
+        return pumpChunks([this](char* buffer, size_t capacity) { return read(buffer, capacity); },
+                          sink, progress, size_, chunkSize);
+    }
+
+    /**
+     * Read the next bytes; usable as a ChunkSource
+     *
+     * @return Bytes read, 0 at the end of the file
+     * @throws std::runtime_error if the read fails
+     */
+    size_t read(char* buffer, size_t capacity) {
+        while (true) {
+            const ssize_t got = ::read(fd_, buffer, capacity);
+            if (got >= 0) {
+                return static_cast<size_t>(got);
+            }
+            if (errno != EINTR) {
+                throw std::runtime_error("Failed to read " + path_.string() + ": " + std::strerror(errno));
+            }
+        }
+    }
+
+private:
+    std::filesystem::path path_;
+    int fd_ = -1;
+    uint64_t size_ = 0;
+};
+
+/**
+ * A file written a chunk at a time, which replaces the target only once it is whole
+ *
+ * Chunks go to a temporary file next to the target; commit() syncs it and
+ * renames it into place. Dropped without commit(), the temporary file is
+ * removed and the target is left as it was.
+ */
+class ChunkedFileWriter {
+public:
+    /**
+     * Start writing a file
+     *
+     * @param path The file to replace
+     * @throws std::runtime_error if the temporary file cannot be created
+     */
+    explicit ChunkedFileWriter(const std::filesystem::path& path) : path_(path), temporary_(path) {
+        temporary_ += ".tmp";
+        fd_ = ::open(temporary_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to create " + temporary_.string() + ": " + std::strerror(errno));
+        }
+    }
+
+    ~ChunkedFileWriter() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            std::error_code ec;
+            std::filesystem::remove(temporary_, ec);
+        }
+    }
+
+    ChunkedFileWriter(const ChunkedFileWriter&) = delete;
+    ChunkedFileWriter& operator=(const ChunkedFileWriter&) = delete;
+
+    /**
+     * Append a chunk; usable as a ChunkSink
+     *
+     * @throws std::runtime_error if the write fails or the file was committed
+     */
+    void write(std::string_view chunk) {
+        if (fd_ < 0) {
+            throw std::runtime_error("Write to committed file " + path_.string());
+        }
+        while (!chunk.empty()) {
+            const ssize_t written = ::write(fd_, chunk.data(), chunk.size());
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw std::runtime_error("Failed to write " + temporary_.string() + ": " + std::strerror(errno));
+            }
+            chunk.remove_prefix(static_cast<size_t>(written));
+            written_ += static_cast<uint64_t>(written);
+        }
+    }
+
+    // Bytes written so far
+    uint64_t written() const {
+        return written_;
+    }
+
+    /**
+     * Sync the file and put it in place of the target
+     *
+     * @throws std::runtime_error if it cannot be synced or renamed
+     */
+    void commit() {
+        if (fd_ < 0) {
+            throw std::runtime_error("File " + path_.string() + " was already committed");
+        }
+        const bool synced = ::fsync(fd_) == 0;
+        ::close(fd_);
+        fd_ = -1;
+        std::error_code ec;
+        if (!synced) {
+            std::filesystem::remove(temporary_, ec);
+            throw std::runtime_error("Failed to sync " + temporary_.string());
+        }
+        std::filesystem::rename(temporary_, path_, ec);
+        if (ec) {
+            std::error_code ignored;
+            std::filesystem::remove(temporary_, ignored);
+            throw std::runtime_error("Failed to replace " + path_.string() + ": " + ec.message());
+        }
+    }
+
+private:
+    std::filesystem::path path_;
+    std::filesystem::path temporary_;
+    int fd_ = -1;
+    uint64_t written_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CHUNKED_IO_H
@@ -0,0 +1,106 @@
+#ifndef COLLABORATIVE_EDITOR_COMPRESSION_H
+#define COLLABORATIVE_EDITOR_COMPRESSION_H
+
+#include <climits>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <zlib.h>
+
+namespace collab {
+namespace util {
+
+/**
+ * Compress data as a raw deflate stream
+ *
+ * A preset dictionary primes the compressor with text the data is likely
+ * to contain, which matters most for data that is only a few kilobytes.
+ * The decompressing side must use the same dictionary.
+ *
+ * @param data The bytes to compress
+ * @param dictionary Preset dictionary, or empty for none
+ * @param level zlib compression level, 1 (fastest) to 9 (smallest)
+ * @return The compressed bytes
+ * @throws std::runtime_error if zlib fails
+ */
+inline std::string deflateCompress(std::string_view data, std::string_view dictionary = {},
+                                   int level = Z_DEFAULT_COMPRESSION) {
+    if (data.size() > UINT_MAX || dictionary.size() > UINT_MAX) {
+        throw std::runtime_error("Data too large to compress");
+    }
+
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize compression");
+    }
+    if (!dictionary.empty() &&
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()),
+                             static_cast<uInt>(dictionary.size())) != Z_OK) {
+        deflateEnd(&stream);
+        throw std::runtime_error("Failed to set compression dictionary");
+    }
+
+    std::string compressed(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+
+    const int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("Failed to compress data");
+    }
+    return compressed;
+}
+
+/**
+ * Decompress a raw deflate stream whose decompressed size is known
+ *
+ * @param data The compressed bytes
+ * @param size The exact size of the decompressed data
+ * @param out Replaced with the decompressed data; its capacity is reused
+ * @param dictionary The preset dictionary the data was compressed with
+ * @throws std::runtime_error if the data is corrupt or does not decompress to exactly size bytes
+ */
+inline void inflateDecompress(std::string_view data, size_t size, std::string& out,
+                              std::string_view dictionary = {}) {
+    if (data.size() > UINT_MAX || size > UINT_MAX || dictionary.size() > UINT_MAX) {
+        throw std::runtime_error("Data too large to decompress");
+    }
+
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        throw std::runtime_error("Failed to initialize decompression");
+    }
+    if (!dictionary.empty() &&
+        inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()),
+                             static_cast<uInt>(dictionary.size())) != Z_OK) {
+        inflateEnd(&stream);
+        throw std::runtime_error("Failed to set compression dictionary");
+    }
+
+    // One spare byte tells a stream that is longer than announced from one that fits
+    out.resize(size + 1);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    const int result = inflate(&stream, Z_FINISH);
+    const size_t produced = stream.total_out;
+    const bool consumed = stream.avail_in == 0;
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END || produced != size || !consumed) {
+        throw std::runtime_error("Corrupt compressed data");
+    }
+    out.resize(size);
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_COMPRESSION_H
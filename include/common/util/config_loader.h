@@ -8,6 +8,15 @@
 #include <stdexcept>
 #include <chrono>
 #include <iostream>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace collab {
 namespace util {
@@ -36,8 +45,200 @@ EditorMode editorModeFromString(const std::string& str);
  */
 std::string editorModeToString(EditorMode mode);
 
+/**
+ * @brief Settings of the server's low-latency mode
+ *
+ * In it the I/O threads busy-poll instead of sleeping, sockets are tuned
+ * for latency and document threads run on their own cores; see
+ * ServerManager::setLowLatency().
+ */
+struct LowLatencySettings {
+    bool enabled = false;                       ///< LOW_LATENCY_MODE
+    uint32_t spinPolls = 20000;                 ///< LOW_LATENCY_SPIN_POLLS: empty polls an idle I/O thread spins through
+    std::chrono::microseconds park{1000};       ///< LOW_LATENCY_PARK_MICROSECONDS: longest an idle I/O thread then sleeps
+    uint32_t socketBusyPoll = 50;               ///< LOW_LATENCY_SOCKET_BUSY_POLL_MICROSECONDS: SO_BUSY_POLL, 0 for none
+    std::vector<unsigned> shardCpus;            ///< LOW_LATENCY_SHARD_CPUS, e.g. "4-7"; empty for the kernel's isolated CPUs
+};
+
+/**
+ * @brief An immutable set of configuration values
+ *
+ * ConfigLoader publishes a new snapshot on every change instead of editing
+ * the values in place, so a reader holding one never sees it change.
+ */
+class ConfigSnapshot {
+public:
+    using Values = std::unordered_map<std::string, std::string>;
+    
+    /**
+     * @brief Constructor
+     * @param values The configuration values
+     * @param version Number of the change that produced them
+     */
+    ConfigSnapshot(Values values, uint64_t version)
+        : values_(std::move(values)), version_(version) {}
+    
+    /**
+     * @brief Find a configuration value
+     * @param key The configuration key
+     * @return The value, or nullptr if the key does not exist
+     */
+    const std::string* find(const std::string& key) const {
+        auto it = values_.find(key);
+        return it != values_.end() ? &it->second : nullptr;
+    }
+    
+    const Values& values() const {
+        return values_;
+    }
+    
+    uint64_t version() const {
+        return version_;
+    }
+
+private:
+    const Values values_;
+    const uint64_t version_;
+};
+
+namespace detail {
+
+template <typename T>
+struct IsDuration : std::false_type {};
+
+template <typename Rep, typename Period>
+struct IsDuration<std::chrono::duration<Rep, Period>> : std::true_type {};
+
+template <typename T>
+std::optional<T> parseNumber(const std::string& text) {
+    T value{};
+    const char* end = text.data() + text.size();
+    auto [parsed, error] = std::from_chars(text.data(), end, value);
+    if (error != std::errc() || parsed != end) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+} // namespace detail
+
+/**
+ * @brief Parse a configuration value as a type ConfigHandle supports
+ *
+ * Integers and floating point numbers must be the whole value and fit the
+ * type, so "-10" is not a valid uint32_t. Durations are a count of their
+ * own unit, as AUTOSAVE_INTERVAL_SECONDS is; booleans are true/false,
+ * yes/no, on/off or 1/0 in any case.
+ *
+ * @param text The value as written in the configuration
+ * @return The value, or std::nullopt if it does not parse
+ */
+template <typename T>
+std::optional<T> parseConfigValue(const std::string& text) {
+    if constexpr (std::is_same_v<T, bool>) {
+        std::string lower = text;
+        for (char& c : lower) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        if (lower == "true" || lower == "yes" || lower == "on" || lower == "1") {
+            return true;
+        }
+        if (lower == "false" || lower == "no" || lower == "off" || lower == "0") {
+            return false;
+        }
+        return std::nullopt;
+    } else if constexpr (std::is_same_v<T, EditorMode>) {
+        return editorModeFromString(text);
+    } else if constexpr (detail::IsDuration<T>::value) {
+        auto count = detail::parseNumber<typename T::rep>(text);
+        return count ? std::optional<T>(T(*count)) : std::nullopt;
+    } else {
+        static_assert(std::is_arithmetic_v<T>, "ConfigHandle supports numbers, bool, durations and EditorMode");
+        return detail::parseNumber<T>(text);
+    }
+}
+
+namespace detail {
+
+// What a ConfigHandle reads, kept current by the loader that made it
+class ConfigHandleState {
+public:
+    virtual ~ConfigHandleState() = default;
+    virtual void update(const ConfigSnapshot& snapshot) = 0;
+};
+
+template <typename T>
+class TypedConfigHandleState : public ConfigHandleState {
+public:
+    TypedConfigHandleState(std::string key, T defaultValue)
+        : key(std::move(key)), defaultValue(defaultValue), value(defaultValue) {}
+    
+    void update(const ConfigSnapshot& snapshot) override {
+        const std::string* text = snapshot.find(key);
+        std::optional<T> parsed = text ? parseConfigValue<T>(*text) : std::nullopt;
+        value.store(parsed.value_or(defaultValue), std::memory_order_relaxed);
+    }
+    
+    const std::string key;
+    const T defaultValue;
+    std::atomic<T> value;
+};
+
+} // namespace detail
+
+/**
+ * @brief A configuration value parsed once per change, for reading on hot paths
+ *
+ * Made by ConfigLoader::handle(). The loader parses the value again each
+ * time the configuration changes, by setValue(), loadFromFile() or a
+ * reload, and stores it in an atomic the handle reads; get() is a relaxed
+ * atomic load, with no lookup, parse or lock. A value that is missing or
+ * does not parse reads as the handle's default. Handles are cheap to copy
+ * and stay valid after their loader is gone, keeping their last value.
+ *
+ * @tparam T A number, bool, std::chrono::duration or EditorMode
+ */
+template <typename T>
+class ConfigHandle {
+    static_assert(std::atomic<T>::is_always_lock_free, "ConfigHandle values must be lock-free atomics");
+
+public:
+    /**
+     * @brief Get the current value
+     * @return The configured value, or the default
+     */
+    T get() const {
+        return state_->value.load(std::memory_order_relaxed);
+    }
+    
+    T operator*() const {
+        return get();
+    }
+    
+    const std::string& key() const {
+        return state_->key;
+    }
+
+private:
+    friend class ConfigLoader;
+    
+    explicit ConfigHandle(std::shared_ptr<detail::TypedConfigHandleState<T>> state)
+        : state_(std::move(state)) {}
+    
+    std::shared_ptr<detail::TypedConfigHandleState<T>> state_;
+};
+
 /**
  * @brief Configuration class that loads and provides access to application settings
+ *
+ * Values live in an immutable ConfigSnapshot that every change replaces
+ * atomically, so reads are safe from any thread while the configuration
+ * is being changed or reloaded. Tuning values read on hot paths should go
+ * through a ConfigHandle, which costs a single atomic load.
+ *
+ * The file last loaded can be reloaded, by reload() or by a watcher thread
+ * started with startWatching(); a reload starts again from the defaults
+ * and the file, so values only set with setValue() are lost.
  */
 class ConfigLoader {
 public:
@@ -46,6 +247,14 @@ public:
      */
     ConfigLoader();
     
+    /**
+     * @brief Destructor, stops the watcher if it runs
+     */
+    ~ConfigLoader();
+    
+    ConfigLoader(const ConfigLoader&) = delete;
+    ConfigLoader& operator=(const ConfigLoader&) = delete;
+    
     /**
      * @brief Load configuration from a file
      * @param configFilePath Path to the configuration file
@@ -96,6 +305,12 @@ public:
      */
     void setAutosaveInterval(std::chrono::seconds seconds);
     
+    /**
+     * @brief Get the low-latency mode settings
+     * @return The settings; values that do not parse keep their defaults
+     */
+    LowLatencySettings getLowLatency() const;
+    
     /**
      * @brief Get a generic configuration value
      * @param key The configuration key
@@ -109,9 +324,65 @@ public:
      * @param value The value to set
      */
     void setValue(const std::string& key, const std::string& value);
+    
+    /**
+     * @brief Get all configuration values as they are now
+     * @return The current snapshot; it never changes once published
+     */
+    std::shared_ptr<const ConfigSnapshot> snapshot() const;
+    
+    /**
+     * @brief Get a typed handle on a configuration value
+     * @param key The configuration key
+     * @param defaultValue Value read while the key is missing or invalid
+     * @return A handle that follows the key through every change
+     */
+    template <typename T>
+    ConfigHandle<T> handle(const std::string& key, T defaultValue) {
+        auto state = std::make_shared<detail::TypedConfigHandleState<T>>(key, defaultValue);
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        state->update(*snapshot_.load());
+        handles_.push_back(state);
+        return ConfigHandle<T>(std::move(state));
+    }
+    
+    /**
+     * @brief Load the file last loaded again, from the defaults
+     * @return true if reloading succeeded, false if nothing was loaded or the file cannot be read
+     */
+    bool reload();
+    
+    /**
+     * @brief Reload the file last loaded if it was modified since
+     * @return true if the file was reloaded
+     */
+    bool reloadIfChanged();
+    
+    /**
+     * @brief Start a thread that reloads the file last loaded whenever it changes
+     * @param interval How often the file is checked
+     */
+    void startWatching(std::chrono::milliseconds interval = std::chrono::seconds{1});
+    
+    /**
+     * @brief Stop the watcher thread, if it runs
+     */
+    void stopWatching();
 
 private:
-    std::unordered_map<std::string, std::string> configValues_;
+    std::atomic<std::shared_ptr<const ConfigSnapshot>> snapshot_;
+    
+    // Serializes changes, which copy the current snapshot and publish the result
+    std::mutex writeMutex_;
+    std::vector<std::weak_ptr<detail::ConfigHandleState>> handles_;
+    std::filesystem::path sourcePath_;
+    std::optional<std::filesystem::file_time_type> sourceModified_;
+    
+    // Watcher thread
+    std::thread watcher_;
+    std::mutex watcherMutex_;
+    std::condition_variable watcherWake_;
+    bool stopWatcher_ = false;
     
     // Default values
     static constexpr uint16_t DEFAULT_PORT = 8080;
@@ -122,12 +393,38 @@ private:
     static constexpr auto PORT_KEY = "SERVER_PORT";
     static constexpr auto EDITOR_MODE_KEY = "EDITOR_MODE";
     static constexpr auto AUTOSAVE_INTERVAL_KEY = "AUTOSAVE_INTERVAL_SECONDS";
+    static constexpr auto LOW_LATENCY_KEY = "LOW_LATENCY_MODE";
+    static constexpr auto LOW_LATENCY_SPIN_POLLS_KEY = "LOW_LATENCY_SPIN_POLLS";
+    static constexpr auto LOW_LATENCY_PARK_KEY = "LOW_LATENCY_PARK_MICROSECONDS";
+    static constexpr auto LOW_LATENCY_SOCKET_BUSY_POLL_KEY = "LOW_LATENCY_SOCKET_BUSY_POLL_MICROSECONDS";
+    static constexpr auto LOW_LATENCY_SHARD_CPUS_KEY = "LOW_LATENCY_SHARD_CPUS";
+    
+    /**
+     * @brief Get the default configuration values
+     * @return Values for the keys that have defaults
+     */
+    static ConfigSnapshot::Values defaults();
+    
+    /**
+     * @brief Read a configuration file into a set of values
+     * @param configFilePath Path to the configuration file
+     * @param values Values to add to or overwrite
+     * @return true if the file could be read
+     */
+    static bool readFile(const std::filesystem::path& configFilePath, ConfigSnapshot::Values& values);
+    
+    /**
+     * @brief Publish new values and bring every handle up to date (writeMutex_ must be held)
+     * @param values The new values
+     */
+    void publish(ConfigSnapshot::Values values);
     
     /**
      * @brief Parse a configuration line in KEY=VALUE format
      * @param line The line to parse
+     * @param values Values to add the entry to
      */
-    void parseLine(const std::string& line);
+    static void parseLine(const std::string& line, ConfigSnapshot::Values& values);
     
     /**
      * @brief Trim whitespace from both ends of a string
@@ -0,0 +1,128 @@
+#ifndef COLLABORATIVE_EDITOR_FRAME_POOL_H
+#define COLLABORATIVE_EDITOR_FRAME_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace util {
+
+/**
+ * Per-thread free list of frame strings, kept with their capacity
+ *
+ * Encoders start each frame in a string from acquire() and the transport
+ * hands it back with release() once it is written, so a thread that
+ * encodes and sends in steady state reuses the same few buffers instead of
+ * allocating one per message. Frames go back to the pool of the thread
+ * that releases them; threads that only release stop keeping frames once
+ * their list is full, and frames above MAX_KEPT_CAPACITY are freed, so a
+ * single large DOC_RESPONSE does not stay pinned.
+ *
+ * No locks: each thread has its own list.
+ */
+class FramePool {
+public:
+    static constexpr size_t MAX_FREE = 64;                        // Frames kept per thread
+    static constexpr size_t MAX_KEPT_CAPACITY = size_t{64} << 10; // Larger frames are freed
+    static constexpr size_t INITIAL_CAPACITY = 256;               // Reserved in a fresh frame
+
+    struct Stats {
+        uint64_t allocated = 0;  // Frames acquire() had to create
+        uint64_t reused = 0;     // Frames acquire() took from the list
+        size_t free = 0;         // Frames in the list right now
+    };
+
+    /**
+     * Take an empty string to encode a frame into
+     *
+     * @return An empty string, with the capacity of a frame released earlier if there is one
+     */
+    static std::string acquire() {
+        Local* local = this_thread();
+        if (local && !local->free.empty()) {
+            ++local->stats.reused;
+            std::string frame = std::move(local->free.back());
+            local->free.pop_back();
+            return frame;
+        }
+        if (local) {
+            ++local->stats.allocated;
+        }
+        std::string frame;
+        frame.reserve(INITIAL_CAPACITY);
+        return frame;
+    }
+
+    /**
+     * Hand a frame back once it is no longer needed
+     *
+     * @param frame The frame; cleared and kept if the list has room and it is not too large
+     */
+    static void release(std::string&& frame) {
+        Local* local = this_thread();
+        if (!local || local->free.size() >= MAX_FREE || frame.capacity() > MAX_KEPT_CAPACITY ||
+            frame.capacity() < INITIAL_CAPACITY) {
+            return;
+        }
+        frame.clear();
+        local->free.push_back(std::move(frame));
+    }
+
+    /**
+     * Share a frame between writers, releasing it when the last one drops it
+     *
+     * @param frame The encoded frame
+     * @return The frame as a transport payload
+     */
+    static std::shared_ptr<const std::string> share(std::string frame) {
+        // One allocation, as make_shared of the string would be; the aliased pointer is the payload
+        auto shared = std::make_shared<Shared>(std::move(frame));
+        return std::shared_ptr<const std::string>(shared, &shared->frame);
+    }
+
+    // The calling thread's counts
+    static Stats stats() {
+        const Local* local = this_thread();
+        if (!local) {
+            return {};
+        }
+        Stats stats = local->stats;
+        stats.free = local->free.size();
+        return stats;
+    }
+
+private:
+    struct Local {
+        std::vector<std::string> free;
+        Stats stats;
+    };
+
+    struct Shared {
+        explicit Shared(std::string&& text) : frame(std::move(text)) {}
+        ~Shared() { release(std::move(frame)); }
+
+        std::string frame;
+    };
+
+    // The thread's list, or nullptr once the thread is tearing down its thread_locals
+    static Local* this_thread() {
+        thread_local bool destroyed = false;
+        if (destroyed) {
+            return nullptr;
+        }
+        thread_local struct Owner {
+            Local local;
+            ~Owner() { destroyed = true; }
+        } owner;
+        return &owner.local;
+    }
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_FRAME_POOL_H
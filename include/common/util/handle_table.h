@@ -0,0 +1,156 @@
+#ifndef COLLABORATIVE_EDITOR_HANDLE_TABLE_H
+#define COLLABORATIVE_EDITOR_HANDLE_TABLE_H
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace util {
+
+// Numeric handle to an entry of a HandleTable; 0 never refers to an entry
+using Handle = uint32_t;
+constexpr Handle NO_HANDLE = 0;
+
+/**
+ * Flat table of entries addressed by 32-bit handles
+ *
+ * A handle is the entry's slot index plus one in the low 24 bits and the
+ * slot's generation in the high 8. Looking one up is an index and a
+ * compare, with no hashing, and a handle kept after its entry was erased
+ * does not find the entry that reuses the slot until the generation wraps
+ * around 256 reuses later. Erased slots are reused first, so the table
+ * stays as large as its peak number of entries.
+ *
+ * Not thread-safe; owners lock around it as they would around a map.
+ *
+ * @tparam T The entry type
+ */
+template <typename T>
+class HandleTable {
+public:
+    static constexpr uint32_t INDEX_BITS = 24;
+    static constexpr uint32_t MAX_ENTRIES = (uint32_t{1} << INDEX_BITS) - 1;
+
+    /**
+     * Add an entry
+     *
+     * @param value The entry
+     * @return Its handle, never NO_HANDLE
+     * @throws std::length_error if the table already holds MAX_ENTRIES entries
+     */
+    Handle insert(T value) {
+        uint32_t index;
+        if (!free_.empty()) {
+            index = free_.back();
+            free_.pop_back();
+        } else {
+            if (slots_.size() >= MAX_ENTRIES) {
+                throw std::length_error("Handle table full");
+            }
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.emplace_back();
+        }
+        Slot& slot = slots_[index];
+        slot.value.emplace(std::move(value));
+        ++size_;
+        return (uint32_t{slot.generation} << INDEX_BITS) | (index + 1);
+    }
+
+    /**
+     * Look up an entry
+     *
+     * @param handle The handle insert() returned
+     * @return The entry, or nullptr if the handle is NO_HANDLE, unknown or erased
+     */
+    T* find(Handle handle) {
+        Slot* slot = slotFor(handle);
+        return slot ? &*slot->value : nullptr;
+    }
+
+    const T* find(Handle handle) const {
+        return const_cast<HandleTable*>(this)->find(handle);
+    }
+
+    /**
+     * Remove an entry
+     *
+     * @param handle The handle insert() returned
+     * @return True if the handle referred to an entry
+     */
+    bool erase(Handle handle) {
+        Slot* slot = slotFor(handle);
+        if (!slot) {
+            return false;
+        }
+        slot->value.reset();
+        ++slot->generation;
+        free_.push_back((handle & MAX_ENTRIES) - 1);
+        --size_;
+        return true;
+    }
+
+    // Call a function with the handle and entry of every entry, in slot order
+    template <typename Fn>
+    void forEach(Fn&& fn) {
+        for (uint32_t index = 0; index < slots_.size(); ++index) {
+            Slot& slot = slots_[index];
+            if (slot.value) {
+                fn((uint32_t{slot.generation} << INDEX_BITS) | (index + 1), *slot.value);
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        const_cast<HandleTable*>(this)->forEach([&fn](Handle handle, const T& value) {
+            fn(handle, value);
+        });
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Remove every entry; handles to them stay stale, as after erase()
+    void clear() {
+        free_.clear();
+        for (uint32_t index = static_cast<uint32_t>(slots_.size()); index-- > 0;) {
+            Slot& slot = slots_[index];
+            if (slot.value) {
+                slot.value.reset();
+                ++slot.generation;
+            }
+            free_.push_back(index);
+        }
+        size_ = 0;
+    }
+
+private:
+    struct Slot {
+        std::optional<T> value;
+        uint8_t generation = 0;
+    };
+
+    Slot* slotFor(Handle handle) {
+        const uint32_t index = handle & MAX_ENTRIES;
+        if (index == 0 || index > slots_.size()) {
+            return nullptr;
+        }
+        Slot& slot = slots_[index - 1];
+        if (!slot.value || slot.generation != static_cast<uint8_t>(handle >> INDEX_BITS)) {
+            return nullptr;
+        }
+        return &slot;
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_;
+    size_t size_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_HANDLE_TABLE_H
@@ -0,0 +1,125 @@
+#ifndef COLLABORATIVE_EDITOR_HANDOFF_QUEUE_H
+#define COLLABORATIVE_EDITOR_HANDOFF_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <utility>
+
+#include "common/util/spsc_ring.h"
+
+namespace collab {
+namespace util {
+
+/**
+ * Hands items from one thread's event loop to another's without either waiting
+ *
+ * Items go through an SpscRing, so neither side takes a lock, and the
+ * consumer is woken once per batch rather than once per item: push()
+ * calls wakeConsumer only when the consumer has no wakeup pending, and
+ * drain() takes everything queued by the time it runs. The wakeups are
+ * the caller's to deliver, e.g. a QMetaObject::invokeMethod() with
+ * Qt::QueuedConnection or a boost::asio::post() onto the other thread.
+ *
+ * The ring is bounded, but the producer never blocks and never drops:
+ * what does not fit waits, in order, on the producer's side. The
+ * consumer, having made room, calls wakeProducer, which should run
+ * retry() on the producer's thread. Without one, what waits goes in
+ * with the next push().
+ *
+ * push() and retry() may be called from one thread at a time and
+ * drain() from one other thread at a time. The wakeups may run on either.
+ */
+template <typename T>
+class HandoffQueue {
+public:
+    using Wake = std::function<void()>;
+
+    /**
+     * @param capacity Most items in the ring; rounded up to a power of two
+     * @param wakeConsumer Arranges a drain() on the consumer's thread
+     * @param wakeProducer Arranges a retry() on the producer's thread; needed only if the ring can fill
+     */
+    HandoffQueue(size_t capacity, Wake wakeConsumer, Wake wakeProducer = {})
+        : ring_(capacity), wakeConsumer_(std::move(wakeConsumer)), wakeProducer_(std::move(wakeProducer)) {}
+
+    HandoffQueue(const HandoffQueue&) = delete;
+    HandoffQueue& operator=(const HandoffQueue&) = delete;
+
+    // Queue an item for the consumer; producer side
+    void push(T value) {
+        if (overflow_.empty() && ring_.tryPush(value)) {
+            wake();
+            return;
+        }
+        overflow_.push_back(std::move(value));
+        retry();
+    }
+
+    // Move what waits on the producer's side into the ring, as far as it has room; producer side
+    void retry() {
+        while (!overflow_.empty() && ring_.tryPush(overflow_.front())) {
+            overflow_.pop_front();
+        }
+        if (!overflow_.empty()) {
+            overflowed_.store(true, std::memory_order_release);
+        }
+        wake();
+    }
+
+    /**
+     * Take everything queued, oldest first; consumer side
+     *
+     * @param consume Called with each item
+     * @return The number of items taken
+     */
+    template <typename F>
+    size_t drain(F&& consume) {
+        // Cleared first, so an item pushed from here on wakes the consumer again
+        wakePending_.store(false, std::memory_order_release);
+        size_t taken = 0;
+        while (auto value = ring_.tryPop()) {
+            consume(std::move(*value));
+            ++taken;
+        }
+        if (overflowed_.exchange(false, std::memory_order_acq_rel) && wakeProducer_) {
+            wakeProducer_();
+        }
+        return taken;
+    }
+
+    // Whether the ring held nothing when checked; what waits on the producer's side is not counted
+    bool empty() const {
+        return ring_.empty();
+    }
+
+    // Items waiting on the producer's side for room in the ring; producer side
+    size_t overflowed() const {
+        return overflow_.size();
+    }
+
+    size_t capacity() const {
+        return ring_.capacity();
+    }
+
+private:
+    // Wake the consumer unless it has a wakeup pending
+    void wake() {
+        if (!ring_.empty() && !wakePending_.exchange(true, std::memory_order_acq_rel) && wakeConsumer_) {
+            wakeConsumer_();
+        }
+    }
+
+    SpscRing<T> ring_;
+    Wake wakeConsumer_;
+    Wake wakeProducer_;
+    std::deque<T> overflow_;                // Producer side only
+    std::atomic<bool> wakePending_{false};
+    std::atomic<bool> overflowed_{false};
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_HANDOFF_QUEUE_H
@@ -0,0 +1,105 @@
+#ifndef COLLABORATIVE_EDITOR_INTERNED_STRING_H
+#define COLLABORATIVE_EDITOR_INTERNED_STRING_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace collab {
+namespace util {
+
+/**
+ * A string stored once per process, held as a 32-bit handle
+ *
+ * For values a few distinct strings take over and over, such as the user
+ * ID on every edit: copying or comparing one is copying or comparing an
+ * integer, and the text is looked up only when asked for. Strings are
+ * never released, so only intern values from a bounded set.
+ *
+ * Handles are local to the process and must not be sent to a peer.
+ */
+class InternedString {
+public:
+    // The empty string
+    InternedString() = default;
+
+    explicit InternedString(std::string_view text) : id_(text.empty() ? 0 : table().intern(text)) {}
+
+    /**
+     * Get the text
+     *
+     * @return The interned text; the reference stays valid for the process lifetime
+     */
+    const std::string& str() const {
+        return table().lookup(id_);
+    }
+
+    uint32_t id() const {
+        return id_;
+    }
+
+    bool empty() const {
+        return id_ == 0;
+    }
+
+    bool operator==(const InternedString& other) const = default;
+
+private:
+    class Table {
+    public:
+        Table() {
+            names_.emplace_back();
+        }
+
+        uint32_t intern(std::string_view text) {
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                auto it = ids_.find(text);
+                if (it != ids_.end()) {
+                    return it->second;
+                }
+            }
+
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            auto it = ids_.find(text);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+            const auto id = static_cast<uint32_t>(names_.size());
+            names_.emplace_back(text);
+            ids_.emplace(names_.back(), id);
+            return id;
+        }
+
+        const std::string& lookup(uint32_t id) const {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            if (id >= names_.size()) {
+                throw std::out_of_range("Unknown interned string");
+            }
+            return names_[id];
+        }
+
+    private:
+        mutable std::shared_mutex mutex_;
+        // Keys view names_, which a deque keeps in place as it grows
+        std::unordered_map<std::string_view, uint32_t> ids_;
+        std::deque<std::string> names_;
+    };
+
+    static Table& table() {
+        static Table instance;
+        return instance;
+    }
+
+    uint32_t id_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_INTERNED_STRING_H
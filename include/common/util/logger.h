@@ -4,6 +4,10 @@
 #include <fstream>
 #include <sstream>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <thread>
 #include <filesystem>
 #include <chrono>
 #include <iomanip>
@@ -13,6 +17,18 @@
 #include <memory>
 #include <ctime>
 #include <regex>
+#include <charconv>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+
+#include "common/util/spsc_ring.h"
+#include "common/util/thread_profiler.h"
 
 namespace collab {
 namespace util {
@@ -29,11 +45,297 @@ enum class LogLevel {
     FATAL
 };
 
+/**
+ * @brief Count the "{}" placeholders of a format string
+ * @param format The format
+ * @return How many arguments it takes
+ */
+constexpr size_t countPlaceholders(std::string_view format) {
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < format.size(); ++i) {
+        if (format[i] == '{' && format[i + 1] == '}') {
+            ++count;
+            ++i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Append one argument of a structured log line as text
+ */
+inline void appendLogArg(std::string& out, const std::string& value) {
+    out += value;
+}
+
+inline void appendLogArg(std::string& out, bool value) {
+    out += value ? "true" : "false";
+}
+
+inline void appendLogArg(std::string& out, char value) {
+    out += value;
+}
+
+inline void appendLogArg(std::string& out, const void* value) {
+    char buffer[2 + 2 * sizeof(void*)] = {'0', 'x'};
+    auto result = std::to_chars(buffer + 2, buffer + sizeof(buffer), reinterpret_cast<uintptr_t>(value), 16);
+    out.append(buffer, result.ptr);
+}
+
+template <typename T>
+    requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>)
+inline void appendLogArg(std::string& out, T value) {
+    char buffer[64];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+template <typename T>
+    requires std::is_enum_v<T>
+inline void appendLogArg(std::string& out, T value) {
+    appendLogArg(out, static_cast<std::underlying_type_t<T>>(value));
+}
+
+/**
+ * @brief How an argument of a structured log line is kept until it is formatted
+ *
+ * Strings are copied, since the caller's may be gone by then; everything
+ * else is kept as it is.
+ */
+template <typename T>
+struct LogArgStorage {
+    using type = std::decay_t<T>;
+};
+
+template <>
+struct LogArgStorage<const char*> {
+    using type = std::string;
+};
+
+template <>
+struct LogArgStorage<char*> {
+    using type = std::string;
+};
+
+template <>
+struct LogArgStorage<std::string_view> {
+    using type = std::string;
+};
+
+template <typename T>
+using LogArg = typename LogArgStorage<std::decay_t<T>>::type;
+
+/**
+ * @brief The arguments of a structured log line, captured raw to be formatted later
+ *
+ * Arguments up to INLINE_SIZE bytes in all are kept inside the object, so
+ * capturing them costs no allocation beyond copying strings.
+ */
+class DeferredArgs {
+public:
+    static constexpr size_t INLINE_SIZE = 64;
+
+    DeferredArgs() = default;
+
+    /**
+     * @brief Capture arguments
+     * @param args The arguments; strings are copied
+     */
+    template <typename... Args>
+    explicit DeferredArgs(Args&&... args) {
+        using Tuple = std::tuple<LogArg<Args>...>;
+        constexpr bool inlined = sizeof(Tuple) <= INLINE_SIZE && alignof(Tuple) <= alignof(std::max_align_t) &&
+                                 std::is_nothrow_move_constructible_v<Tuple>;
+        if constexpr (inlined) {
+            new (storage_) Tuple(std::forward<Args>(args)...);
+        } else {
+            *reinterpret_cast<Tuple**>(storage_) = new Tuple(std::forward<Args>(args)...);
+        }
+        manage_ = &manage<Tuple, inlined>;
+    }
+
+    DeferredArgs(DeferredArgs&& other) noexcept {
+        moveFrom(other);
+    }
+
+    DeferredArgs& operator=(DeferredArgs&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    DeferredArgs(const DeferredArgs&) = delete;
+    DeferredArgs& operator=(const DeferredArgs&) = delete;
+
+    ~DeferredArgs() {
+        reset();
+    }
+
+    /**
+     * @brief Format the arguments into a format string
+     * @param out Where the text goes
+     * @param format The format; each "{}" takes the next argument
+     */
+    void render(std::string& out, std::string_view format) const {
+        if (manage_) {
+            manage_(Op::Render, const_cast<DeferredArgs*>(this), nullptr, &out, format);
+        } else {
+            out += format;
+        }
+    }
+
+private:
+    enum class Op { Render, Move, Destroy };
+    using Manager = void (*)(Op op, DeferredArgs* self, DeferredArgs* target, std::string* out,
+                             std::string_view format);
+
+    template <typename Tuple, bool Inlined>
+    static void manage(Op op, DeferredArgs* self, DeferredArgs* target, std::string* out, std::string_view format) {
+        Tuple* tuple = Inlined ? std::launder(reinterpret_cast<Tuple*>(self->storage_))
+                               : *reinterpret_cast<Tuple**>(self->storage_);
+        switch (op) {
+            case Op::Render: {
+                size_t position = 0;
+                auto next = [&](const auto& value) {
+                    const size_t at = format.find("{}", position);
+                    if (at == std::string_view::npos) {
+                        return;
+                    }
+                    out->append(format.substr(position, at - position));
+                    appendLogArg(*out, value);
+                    position = at + 2;
+                };
+                std::apply([&](const auto&... values) { (next(values), ...); }, *tuple);
+                out->append(format.substr(position));
+                break;
+            }
+            case Op::Move:
+                if constexpr (Inlined) {
+                    new (target->storage_) Tuple(std::move(*tuple));
+                    tuple->~Tuple();
+                } else {
+                    *reinterpret_cast<Tuple**>(target->storage_) = tuple;
+                }
+                break;
+            case Op::Destroy:
+                if constexpr (Inlined) {
+                    tuple->~Tuple();
+                } else {
+                    delete tuple;
+                }
+                break;
+        }
+    }
+
+    void moveFrom(DeferredArgs& other) noexcept {
+        if (other.manage_) {
+            other.manage_(Op::Move, &other, this, nullptr, {});
+            manage_ = other.manage_;
+            other.manage_ = nullptr;
+        }
+    }
+
+    void reset() {
+        if (manage_) {
+            manage_(Op::Destroy, this, nullptr, nullptr, {});
+            manage_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    Manager manage_ = nullptr;
+};
+
+/**
+ * @brief Token buckets per key, to keep a burst of similar lines from flooding the log
+ *
+ * Each key, e.g. a remote address, gets a bucket of burst tokens refilled
+ * at perSecond; a line is only logged if it can take one. At most maxKeys
+ * buckets are kept: past that they are all dropped and start full again.
+ * Thread-safe.
+ */
+class LogRateLimiter {
+public:
+    /**
+     * @param perSecond Lines allowed per key and second, on average
+     * @param burst Lines allowed per key at once
+     * @param maxKeys Keys tracked at once
+     */
+    LogRateLimiter(double perSecond, double burst, size_t maxKeys = 1024)
+        : perSecond_(perSecond), burst_(std::max(burst, 1.0)), maxKeys_(maxKeys) {}
+
+    /**
+     * @brief Take a token from a key's bucket
+     * @param key What the line is about
+     * @param suppressed Set to the lines refused for the key since the last one allowed
+     * @return true if the line should be logged
+     */
+    bool allow(std::string_view key, uint64_t& suppressed) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = buckets_.find(std::string(key));
+        if (it == buckets_.end()) {
+            if (buckets_.size() >= maxKeys_) {
+                buckets_.clear();
+            }
+            it = buckets_.emplace(std::string(key), Bucket{burst_, now, 0}).first;
+        }
+        Bucket& bucket = it->second;
+        const double elapsed = std::chrono::duration<double>(now - bucket.refilled).count();
+        bucket.tokens = std::min(burst_, bucket.tokens + elapsed * perSecond_);
+        bucket.refilled = now;
+        if (bucket.tokens < 1.0) {
+            ++bucket.suppressed;
+            return false;
+        }
+        bucket.tokens -= 1.0;
+        suppressed = bucket.suppressed;
+        bucket.suppressed = 0;
+        return true;
+    }
+
+private:
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+        uint64_t suppressed;
+    };
+
+    const double perSecond_;
+    const double burst_;
+    const size_t maxKeys_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Bucket> buckets_;
+};
+
 /**
  * @brief A simple logger class with file rotation support
+ *
+ * Lines are written by the calling thread under a lock by default. After
+ * startAsync(), log() only formats the line and pushes it onto a lock-free
+ * ring of the calling thread's own; a background writer drains every
+ * thread's ring and writes what it found in one batch, flushed once, so
+ * logging threads never wait for the disk or for each other. The file's
+ * size is tracked as it is written instead of asked of the file system,
+ * and the date and time part of the timestamp is formatted once a second
+ * per thread.
+ *
+ * Until initialize() opens a file, lines only go to the console.
+ *
+ * logFormatted(), used through the LOGF_* macros, takes a constant format
+ * string and keeps the arguments raw; they are only turned into text where
+ * the line is written, which in async mode is the writer thread. A call
+ * below the level costs one atomic load.
  */
 class Logger {
 public:
+    /**
+     * @brief Records each thread can queue in async mode before it waits for the writer
+     */
+    static constexpr size_t DEFAULT_RING_CAPACITY = 4096;
+
     /**
      * @brief Default constructor
      */
@@ -62,6 +364,23 @@ public:
      */
     void log(LogLevel level, const std::string& message);
 
+    /**
+     * @brief Log a line whose arguments are formatted where it is written
+     * @tparam Placeholders Number of "{}" in the format, to check against the arguments
+     * @param level Severity level
+     * @param format The format, a string literal; each "{}" takes the next argument
+     * @param args Numbers, enums, bools, pointers or strings
+     */
+    template <size_t Placeholders, typename... Args>
+    void logFormatted(LogLevel level, const char* format, Args&&... args) {
+        static_assert(Placeholders == sizeof...(Args), "Log format and arguments do not match");
+        if (!isLevelEnabled(level)) {
+            return;
+        }
+        submit(Record{level, std::chrono::system_clock::now(), std::string(), format,
+                      DeferredArgs(std::forward<Args>(args)...)});
+    }
+
     /**
      * @brief Set the minimum log level
      * @param level The minimum level to log
@@ -119,15 +438,97 @@ public:
 
     /**
      * @brief Flush the log file
+     *
+     * In async mode, waits until the writer has written everything logged
+     * before the call.
      */
     void flush();
 
+    /**
+     * @brief Move writing to a background thread
+     * @param ringCapacity Records each logging thread can queue before it waits for the writer
+     */
+    void startAsync(size_t ringCapacity = DEFAULT_RING_CAPACITY);
+
+    /**
+     * @brief Write what is queued and go back to writing on the calling thread
+     */
+    void stopAsync();
+
+    /**
+     * @brief Check whether a background thread does the writing
+     * @return true after startAsync()
+     */
+    bool isAsync() const;
+
 private:
     /**
-     * @brief Format the current time for logging
+     * @brief A line waiting to be written; the writer formats it
+     */
+    struct Record {
+        LogLevel level;
+        std::chrono::system_clock::time_point time;
+        std::string message;            // The text of a plain line
+        const char* format = nullptr;   // Or the format of a structured one
+        DeferredArgs args;              // And its arguments
+    };
+
+    using Ring = SpscRing<Record>;
+
+    /**
+     * @brief Format a time for logging
+     * @param time The time
      * @return Formatted timestamp string
      */
-    std::string formatTimestamp();
+    std::string formatTimestamp(std::chrono::system_clock::time_point time);
+
+    /**
+     * @brief Format a line as it is written, without the line break
+     * @param record The line
+     * @return The text
+     */
+    std::string formatLine(const Record& record);
+
+    /**
+     * @brief Hand a line to the writer, or write it in sync mode
+     * @param record The line
+     */
+    void submit(Record&& record);
+
+    /**
+     * @brief Write lines with one write and one flush per output, the file only once opened (mutex_ must be held)
+     * @param records The lines
+     * @param count How many
+     */
+    void writeRecords(const Record* records, size_t count);
+
+    /**
+     * @brief Write a batch of file lines out, then rotate if the file is full (mutex_ must be held)
+     * @param batch The lines; emptied
+     */
+    void writeFileBatch(std::string& batch);
+
+    /**
+     * @brief The calling thread's ring, made on its first async log
+     * @return The ring
+     */
+    Ring& threadRing();
+
+    /**
+     * @brief Take what every ring holds and write it in one batch
+     * @return Records written
+     */
+    size_t drainRings();
+
+    /**
+     * @brief Body of the background writer
+     */
+    void writerLoop();
+
+    /**
+     * @brief Wake the writer if it is waiting for work
+     */
+    void wakeWriter();
 
     /**
      * @brief Check if log file needs rotation and perform rotation if needed
@@ -144,12 +545,29 @@ private:
     static constexpr int MAX_BACKUP_FILES = 3;
 
     // State
-    std::mutex mutex_;
+    std::mutex mutex_;                          // Guards the file and its size
     std::filesystem::path logFilePath_;
     std::ofstream logFile_;
+    uint64_t fileSize_ = 0;                     // Bytes in logFile_, tracked as written
     bool consoleOutput_ = true;
-    LogLevel minLevel_ = LogLevel::INFO;
+    std::atomic<LogLevel> minLevel_{LogLevel::INFO};
     bool initialized_ = false;
+
+    // Async mode
+    const uint64_t id_;                         // Tells this logger's rings from others' in a thread
+    std::atomic<bool> async_{false};
+    std::atomic<bool> running_{false};          // The writer should keep going
+    std::thread writer_;
+    size_t ringCapacity_ = DEFAULT_RING_CAPACITY;
+    std::mutex ringsMutex_;                     // Guards rings_; taken once per thread to register
+    std::vector<std::shared_ptr<Ring>> rings_;  // One per thread that logged
+    std::mutex wakeMutex_;
+    std::condition_variable wakeCondition_;
+    std::atomic<bool> writerIdle_{false};
+    std::atomic<uint64_t> flushRequests_{0};
+    uint64_t flushesDone_ = 0;                  // Guarded by wakeMutex_
+    bool writerStopped_ = true;                 // Guarded by wakeMutex_
+    std::condition_variable flushCondition_;
 };
 
 /**
@@ -208,8 +626,8 @@ public:
      */
     template<typename T>
     LogStream& operator<<(const T& value) {
-        if (logger_.isLevelEnabled(level_)) {
-            stream_ << value;
+        if (stream_) {
+            *stream_ << value;
         }
         return *this;
     }
@@ -217,7 +635,7 @@ public:
 private:
     Logger& logger_;
     LogLevel level_;
-    std::ostringstream stream_;
+    std::optional<std::ostringstream> stream_;  // Only made when the level is enabled
 };
 
 // Convenience macros for logging
@@ -228,15 +646,58 @@ private:
 #define LOG_ERROR   collab::util::LogStream(collab::util::getLogger(), collab::util::LogLevel::ERROR)
 #define LOG_FATAL   collab::util::LogStream(collab::util::getLogger(), collab::util::LogLevel::FATAL)
 
-// Implementation of all inline functions to avoid linker errors
+// Structured logging: LOGF_DEBUG("client {} at revision {}", clientId, revision)
+// The format must be a string literal; the arguments are formatted where the line is written
+#define LOGF(level, format, ...) \
+    do { \
+        auto& collabLogger_ = collab::util::getLogger(); \
+        if (collabLogger_.isLevelEnabled(level)) { \
+            collabLogger_.logFormatted<collab::util::countPlaceholders(format)>(level, format __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while (0)
 
-// Global logger instance
-namespace {
-    std::unique_ptr<Logger> g_logger = std::make_unique<Logger>();
-}
+// Sampled: only every n-th call of the site on each thread logs, starting with the first
+#define LOGF_EVERY_N(level, n, format, ...) \
+    do { \
+        static thread_local uint64_t collabOccurrences_ = 0; \
+        if (collab::util::getLogger().isLevelEnabled(level) && collabOccurrences_++ % (n) == 0) { \
+            LOGF(level, format __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while (0)
+
+// Rate-limited per key, e.g. a remote address: perSecond lines per key on average, in bursts of as many
+// A line after some were dropped is preceded by how many
+#define LOGF_RATE_LIMITED(level, perSecond, key, format, ...) \
+    do { \
+        auto& collabLogger_ = collab::util::getLogger(); \
+        if (collabLogger_.isLevelEnabled(level)) { \
+            static collab::util::LogRateLimiter collabLimiter_(perSecond, perSecond); \
+            const std::string collabKey_(key); \
+            uint64_t collabSuppressed_ = 0; \
+            if (collabLimiter_.allow(collabKey_, collabSuppressed_)) { \
+                if (collabSuppressed_ > 0) { \
+                    collabLogger_.logFormatted<2>(level, "Suppressed {} similar lines for {}", \
+                                                  collabSuppressed_, collabKey_); \
+                } \
+                collabLogger_.logFormatted<collab::util::countPlaceholders(format)>( \
+                    level, format __VA_OPT__(,) __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define LOGF_TRACE(...)   LOGF(collab::util::LogLevel::TRACE, __VA_ARGS__)
+#define LOGF_DEBUG(...)   LOGF(collab::util::LogLevel::DEBUG, __VA_ARGS__)
+#define LOGF_INFO(...)    LOGF(collab::util::LogLevel::INFO, __VA_ARGS__)
+#define LOGF_WARNING(...) LOGF(collab::util::LogLevel::WARNING, __VA_ARGS__)
+#define LOGF_ERROR(...)   LOGF(collab::util::LogLevel::ERROR, __VA_ARGS__)
+#define LOGF_FATAL(...)   LOGF(collab::util::LogLevel::FATAL, __VA_ARGS__)
+
+// Implementation of all inline functions to avoid linker errors
 
 inline Logger& getLogger() {
-    return *g_logger;
+    // Global logger instance, one for the whole program
+    static Logger logger;
+    return logger;
 }
 
 inline bool initLogger(const std::filesystem::path& logFilePath, 
@@ -272,10 +733,14 @@ inline LogLevel logLevelFromString(const std::string& str) {
     return LogLevel::INFO; // Default to INFO for unknown levels
 }
 
-inline Logger::Logger() : initialized_(false) {
+inline Logger::Logger() : initialized_(false), id_([] {
+        static std::atomic<uint64_t> nextId{0};
+        return nextId.fetch_add(1);
+    }()) {
 }
 
 inline Logger::~Logger() {
+    stopAsync();
     flush();
     if (logFile_.is_open()) {
         logFile_.close();
@@ -285,87 +750,78 @@ inline Logger::~Logger() {
 inline bool Logger::initialize(const std::filesystem::path& logFilePath, 
                         LogLevel minLevel,
                         bool consoleOutput) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    logFilePath_ = logFilePath;
-    consoleOutput_ = consoleOutput;
-    minLevel_ = minLevel;
-    
-    try {
-        // Create directory if it doesn't exist
-        auto parentPath = logFilePath.parent_path();
-        if (!parentPath.empty() && !std::filesystem::exists(parentPath)) {
-            std::filesystem::create_directories(parentPath);
-        }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
         
-        // Open log file in append mode
-        logFile_.open(logFilePath, std::ios::out | std::ios::app);
-        if (!logFile_) {
+        logFilePath_ = logFilePath;
+        consoleOutput_ = consoleOutput;
+        minLevel_ = minLevel;
+        
+        try {
+            // Create directory if it doesn't exist
+            auto parentPath = logFilePath.parent_path();
+            if (!parentPath.empty() && !std::filesystem::exists(parentPath)) {
+                std::filesystem::create_directories(parentPath);
+            }
+            
+            // Open log file in append mode
+            logFile_.open(logFilePath, std::ios::out | std::ios::app);
+            if (!logFile_) {
+                if (consoleOutput_) {
+                    std::cerr << "Failed to open log file: " << logFilePath << std::endl;
+                }
+                return false;
+            }
+            // Asked once; every write adds to it after
+            fileSize_ = std::filesystem::file_size(logFilePath);
+            
+            initialized_ = true;
+        } catch (const std::exception& e) {
             if (consoleOutput_) {
-                std::cerr << "Failed to open log file: " << logFilePath << std::endl;
+                std::cerr << "Error initializing logger: " << e.what() << std::endl;
             }
             return false;
         }
-        
-        initialized_ = true;
-        
-        // Log initialization message
-        std::ostringstream message;
-        message << "Logger initialized with min level: " << logLevelToString(minLevel_);
-        log(LogLevel::INFO, message.str());
-        
-        return true;
-    } catch (const std::exception& e) {
-        if (consoleOutput_) {
-            std::cerr << "Error initializing logger: " << e.what() << std::endl;
-        }
-        return false;
     }
+    
+    // Log initialization message
+    std::ostringstream message;
+    message << "Logger initialized with min level: " << logLevelToString(minLevel);
+    log(LogLevel::INFO, message.str());
+    
+    return true;
 }
 
 inline void Logger::log(LogLevel level, const std::string& message) {
     if (!isLevelEnabled(level)) {
         return;
     }
-    
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (!initialized_) {
-        if (consoleOutput_) {
-            std::cerr << "Logger not initialized" << std::endl;
+    submit(Record{level, std::chrono::system_clock::now(), message, nullptr, DeferredArgs()});
+}
+
+inline void Logger::submit(Record&& record) {
+    if (async_.load(std::memory_order_acquire)) {
+        Ring& ring = threadRing();
+        while (!ring.tryPush(record)) {
+            if (!running_.load(std::memory_order_acquire)) {
+                // Stopping: nobody will drain the ring
+                std::lock_guard<std::mutex> lock(mutex_);
+                writeRecords(&record, 1);
+                return;
+            }
+            wakeWriter();
+            std::this_thread::yield();
+        }
+        if (writerIdle_.load(std::memory_order_acquire)) {
+            wakeWriter();
         }
         return;
     }
     
+    std::lock_guard<std::mutex> lock(mutex_);
+    
     try {
-        std::string timestamp = formatTimestamp();
-        std::string levelStr = logLevelToString(level);
-        
-        std::ostringstream logLine;
-        logLine << timestamp << " [" << std::left << std::setw(7) << levelStr << "] " << message;
-        
-        if (consoleOutput_) {
-            // Color output for console (ANSI escape codes)
-            const char* colorCode = "";
-            const char* resetCode = "\033[0m";
-            
-            switch (level) {
-                case LogLevel::TRACE:   colorCode = "\033[90m"; break; // Gray
-                case LogLevel::DEBUG:   colorCode = "\033[37m"; break; // White
-                case LogLevel::INFO:    colorCode = "\033[32m"; break; // Green
-                case LogLevel::WARNING: colorCode = "\033[33m"; break; // Yellow
-                case LogLevel::ERROR:   colorCode = "\033[31m"; break; // Red
-                case LogLevel::FATAL:   colorCode = "\033[35m"; break; // Magenta
-            }
-            
-            std::cout << colorCode << logLine.str() << resetCode << std::endl;
-        }
-        
-        logFile_ << logLine.str() << std::endl;
-        
-        // Check if we need to rotate the log file
-        checkRotation();
-        
+        writeRecords(&record, 1);
     } catch (const std::exception& e) {
         if (consoleOutput_) {
             std::cerr << "Error writing to log: " << e.what() << std::endl;
@@ -374,7 +830,6 @@ inline void Logger::log(LogLevel level, const std::string& message) {
 }
 
 inline void Logger::setLogLevel(LogLevel level) {
-    std::lock_guard<std::mutex> lock(mutex_);
     minLevel_ = level;
 }
 
@@ -383,7 +838,7 @@ inline LogLevel Logger::getLogLevel() const {
 }
 
 inline bool Logger::isLevelEnabled(LogLevel level) const {
-    return level >= minLevel_;
+    return level >= minLevel_.load(std::memory_order_relaxed);
 }
 
 inline void Logger::trace(const std::string& message) {
@@ -411,58 +866,260 @@ inline void Logger::fatal(const std::string& message) {
 }
 
 inline void Logger::flush() {
+    if (async_.load(std::memory_order_acquire)) {
+        // The writer flushes after every batch; wait for a pass that started after this call
+        const uint64_t target = flushRequests_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        wakeWriter();
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        flushCondition_.wait(lock, [&] { return flushesDone_ >= target || writerStopped_; });
+        return;
+    }
     std::lock_guard<std::mutex> lock(mutex_);
     if (logFile_.is_open()) {
         logFile_.flush();
     }
 }
 
-inline std::string Logger::formatTimestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto time_t_now = std::chrono::system_clock::to_time_t(now);
+inline void Logger::startAsync(size_t ringCapacity) {
+    if (async_.load()) {
+        return;
+    }
+    // Rings made before keep their capacity
+    ringCapacity_ = ringCapacity;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        writerStopped_ = false;
+    }
+    running_.store(true, std::memory_order_release);
+    writer_ = std::thread(&Logger::writerLoop, this);
+    async_.store(true, std::memory_order_release);
+}
+
+inline void Logger::stopAsync() {
+    if (!async_.exchange(false)) {
+        return;
+    }
+    running_.store(false, std::memory_order_release);
+    wakeWriter();
+    writer_.join();
+    // Lines pushed while the writer was finishing; this thread is the only consumer now
+    drainRings();
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        writerStopped_ = true;
+    }
+    flushCondition_.notify_all();
+}
+
+inline bool Logger::isAsync() const {
+    return async_.load(std::memory_order_acquire);
+}
+
+inline std::string Logger::formatTimestamp(std::chrono::system_clock::time_point time) {
+    const auto second = std::chrono::time_point_cast<std::chrono::seconds>(time);
     
     // Get milliseconds
-    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch() % std::chrono::seconds(1)).count();
-    
-    std::ostringstream timestamp;
-    std::tm tm_now;
+    const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(time - second).count();
     
+    // The date and time change once a second; format them only then
+    thread_local std::time_t cachedSecond = -1;
+    thread_local char prefix[32] = {};
+    const std::time_t time_t_now = std::chrono::system_clock::to_time_t(second);
+    if (time_t_now != cachedSecond) {
+        std::tm tm_now;
 #ifdef _WIN32
-    localtime_s(&tm_now, &time_t_now);
+        localtime_s(&tm_now, &time_t_now);
 #else
-    localtime_r(&time_t_now, &tm_now);
+        localtime_r(&time_t_now, &tm_now);
 #endif
+        std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cachedSecond = time_t_now;
+    }
+    
+    char timestamp[48];
+    std::snprintf(timestamp, sizeof(timestamp), "%s.%03d", prefix, static_cast<int>(milliseconds));
+    return timestamp;
+}
+
+inline std::string Logger::formatLine(const Record& record) {
+    const std::string levelStr = logLevelToString(record.level);
+    std::string line = formatTimestamp(record.time);
+    line.reserve(line.size() + record.message.size() + 11);
+    line += " [";
+    line += levelStr;
+    line.append(levelStr.size() < 7 ? 7 - levelStr.size() : 0, ' ');
+    line += "] ";
+    if (record.format) {
+        record.args.render(line, record.format);
+    } else {
+        line += record.message;
+    }
+    return line;
+}
+
+inline void Logger::writeRecords(const Record* records, size_t count) {
+    std::string consoleBatch;
+    std::string fileBatch;
+    for (size_t i = 0; i < count; ++i) {
+        const Record& record = records[i];
+        const std::string line = formatLine(record);
+        if (consoleOutput_) {
+            // Color output for console (ANSI escape codes)
+            const char* colorCode = "";
+            const char* resetCode = "\033[0m";
+            
+            switch (record.level) {
+                case LogLevel::TRACE:   colorCode = "\033[90m"; break; // Gray
+                case LogLevel::DEBUG:   colorCode = "\033[37m"; break; // White
+                case LogLevel::INFO:    colorCode = "\033[32m"; break; // Green
+                case LogLevel::WARNING: colorCode = "\033[33m"; break; // Yellow
+                case LogLevel::ERROR:   colorCode = "\033[31m"; break; // Red
+                case LogLevel::FATAL:   colorCode = "\033[35m"; break; // Magenta
+            }
+            
+            consoleBatch += colorCode;
+            consoleBatch += line;
+            consoleBatch += resetCode;
+            consoleBatch += '\n';
+        }
+        
+        fileBatch += line;
+        fileBatch += '\n';
+        // Rotate between lines, never inside one
+        if (fileSize_ + fileBatch.size() >= MAX_FILE_SIZE) {
+            writeFileBatch(fileBatch);
+        }
+    }
+    
+    if (!consoleBatch.empty()) {
+        std::cout.write(consoleBatch.data(), static_cast<std::streamsize>(consoleBatch.size()));
+        std::cout.flush();
+    }
+    if (!fileBatch.empty()) {
+        writeFileBatch(fileBatch);
+    }
+}
+
+inline void Logger::writeFileBatch(std::string& batch) {
+    if (logFile_.is_open()) {
+        logFile_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+        logFile_.flush();
+        fileSize_ += batch.size();
+    }
+    batch.clear();
+    
+    // Check if we need to rotate the log file
+    checkRotation();
+}
+
+inline Logger::Ring& Logger::threadRing() {
+    // Few loggers log from a thread, so a short list beats a map
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings;
+    for (auto& [id, ring] : rings) {
+        if (id == id_) {
+            return *ring;
+        }
+    }
+    auto ring = std::make_shared<Ring>(ringCapacity_);
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings_.push_back(ring);
+    }
+    rings.emplace_back(id_, ring);
+    return *ring;
+}
+
+inline size_t Logger::drainRings() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings = rings_;
+    }
     
-    timestamp << std::put_time(&tm_now, "%Y-%m-%d %H:%M:%S") 
-              << '.' << std::setfill('0') << std::setw(3) << milliseconds;
+    // At most a ring's worth from each, so one busy thread cannot hold up the others' lines
+    std::vector<Record> batch;
+    for (const auto& ring : rings) {
+        for (size_t taken = 0; taken < ring->capacity(); ++taken) {
+            std::optional<Record> record = ring->tryPop();
+            if (!record) {
+                break;
+            }
+            batch.push_back(std::move(*record));
+        }
+    }
+    if (batch.empty()) {
+        return 0;
+    }
     
-    return timestamp.str();
+    std::lock_guard<std::mutex> lock(mutex_);
+    try {
+        writeRecords(batch.data(), batch.size());
+    } catch (const std::exception& e) {
+        if (consoleOutput_) {
+            std::cerr << "Error writing to log: " << e.what() << std::endl;
+        }
+    }
+    return batch.size();
+}
+
+inline void Logger::writerLoop() {
+    nameCurrentThread("logger", 0);
+    while (true) {
+        const bool stopping = !running_.load(std::memory_order_acquire);
+        const uint64_t requested = flushRequests_.load(std::memory_order_acquire);
+        const size_t written = drainRings();
+        
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex_);
+            if (flushesDone_ < requested) {
+                flushesDone_ = requested;
+                flushCondition_.notify_all();
+            }
+        }
+        if (stopping) {
+            return;
+        }
+        
+        if (written == 0) {
+            // Loggers wake an idle writer; the timeout bounds a wake-up lost to a race
+            std::unique_lock<std::mutex> lock(wakeMutex_);
+            writerIdle_.store(true, std::memory_order_release);
+            wakeCondition_.wait_for(lock, std::chrono::milliseconds(50), [this] {
+                return !writerIdle_.load(std::memory_order_acquire) ||
+                       flushRequests_.load(std::memory_order_acquire) > flushesDone_;
+            });
+            writerIdle_.store(false, std::memory_order_release);
+        }
+    }
+}
+
+inline void Logger::wakeWriter() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        writerIdle_.store(false, std::memory_order_release);
+    }
+    wakeCondition_.notify_one();
 }
 
 inline void Logger::checkRotation() {
-    if (!initialized_ || !logFile_.is_open()) {
+    if (!initialized_ || !logFile_.is_open() || fileSize_ < MAX_FILE_SIZE) {
         return;
     }
     
     try {
-        // Get the current size of the log file
-        auto fileSize = std::filesystem::file_size(logFilePath_);
+        // Close current log file
+        logFile_.close();
         
-        if (fileSize >= MAX_FILE_SIZE) {
-            // Close current log file
-            logFile_.close();
-            
-            // Rotate log files
-            rotateLogFiles();
-            
-            // Reopen the log file
-            logFile_.open(logFilePath_, std::ios::out | std::ios::app);
-            if (!logFile_) {
-                initialized_ = false;
-                if (consoleOutput_) {
-                    std::cerr << "Failed to reopen log file after rotation" << std::endl;
-                }
+        // Rotate log files
+        rotateLogFiles();
+        
+        // Reopen the log file
+        logFile_.open(logFilePath_, std::ios::out | std::ios::app);
+        fileSize_ = 0;
+        if (!logFile_) {
+            initialized_ = false;
+            if (consoleOutput_) {
+                std::cerr << "Failed to reopen log file after rotation" << std::endl;
             }
         }
     } catch (const std::exception& e) {
@@ -511,11 +1168,14 @@ inline void Logger::rotateLogFiles() {
 
 inline LogStream::LogStream(Logger& logger, LogLevel level)
     : logger_(logger), level_(level) {
+    if (logger_.isLevelEnabled(level_)) {
+        stream_.emplace();
+    }
 }
 
 inline LogStream::~LogStream() {
-    if (!stream_.str().empty()) {
-        logger_.log(level_, stream_.str());
+    if (stream_ && !stream_->str().empty()) {
+        logger_.log(level_, stream_->str());
     }
 }
 
@@ -0,0 +1,212 @@
+#ifndef COLLABORATIVE_EDITOR_MAPPED_SNAPSHOT_H
+#define COLLABORATIVE_EDITOR_MAPPED_SNAPSHOT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/util/text_scan.h"
+
+namespace collab {
+namespace util {
+
+/**
+ * A document snapshot file, mapped read-only and used where it lies
+ *
+ * The file is laid out to be used without parsing: a fixed header, the
+ * text, the offsets of its newlines as 64-bit integers (the line index a
+ * piece table needs), and an opaque metadata section, e.g. the CRDT state
+ * from BasicCrdtDocument::toSnapshot(), decoded only by whoever needs it.
+ * Sections start 8-byte aligned. Opening one checks the header and the
+ * section bounds and maps the file; the text is read by page faults as it
+ * is touched, so a cold start costs no parse and no copy.
+ *
+ * write() puts a snapshot in place through a synced temporary file and a
+ * rename, so a file that opens was written whole. The content itself is
+ * not checksummed, which would mean reading it all on open. A snapshot is
+ * immutable; share it with a shared_ptr for as long as views into it live.
+ */
+class MappedSnapshot {
+public:
+    /**
+     * Write a snapshot file, replacing any there
+     *
+     * @param path Where the snapshot goes
+     * @param text The document text
+     * @param revision Revision of the text
+     * @param metadata Extra state kept with it, e.g. CRDT metadata
+     * @throws std::runtime_error if the file cannot be written
+     */
+    static void write(const std::filesystem::path& path, std::string_view text, int64_t revision,
+                      std::string_view metadata = {}) {
+        Header header{};
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.revision = revision;
+        header.textOffset = sizeof(Header);
+        header.textLength = text.size();
+
+        std::vector<uint64_t> breaks;
+        util::findNewlines(text, 0, breaks);
+        header.breaksOffset = align(header.textOffset + header.textLength);
+        header.breakCount = breaks.size();
+        header.metadataOffset = header.breaksOffset + header.breakCount * sizeof(uint64_t);
+        header.metadataLength = metadata.size();
+
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create snapshot " + temporary.string() + ": " + std::strerror(errno));
+        }
+        static const char padding[8] = {};
+        const bool ok = writeAll(fd, &header, sizeof(header)) &&
+                        writeAll(fd, text.data(), text.size()) &&
+                        writeAll(fd, padding, header.breaksOffset - header.textOffset - header.textLength) &&
+                        writeAll(fd, breaks.data(), breaks.size() * sizeof(uint64_t)) &&
+                        writeAll(fd, metadata.data(), metadata.size()) &&
+                        ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok) {
+            throw std::runtime_error("Failed to write snapshot " + temporary.string());
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temporary, path, ec);
+        if (ec) {
+            throw std::runtime_error("Failed to replace snapshot " + path.string() + ": " + ec.message());
+        }
+    }
+
+    /**
+     * Map a snapshot file
+     *
+     * @param path The snapshot
+     * @return The mapped snapshot
+     * @throws std::runtime_error if the file cannot be mapped or is not a whole snapshot
+     */
+    static std::shared_ptr<const MappedSnapshot> open(const std::filesystem::path& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open snapshot " + path.string() + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("Not a document snapshot: " + path.string());
+        }
+        const size_t size = static_cast<size_t>(info.st_size);
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Failed to map snapshot " + path.string() + ": " + std::strerror(errno));
+        }
+
+        std::shared_ptr<MappedSnapshot> snapshot(new MappedSnapshot(static_cast<const char*>(data), size));
+        if (!snapshot->valid()) {
+            throw std::runtime_error("Not a whole document snapshot: " + path.string());
+        }
+        return snapshot;
+    }
+
+    ~MappedSnapshot() {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    int64_t revision() const {
+        return header().revision;
+    }
+
+    std::string_view text() const {
+        return std::string_view(data_ + header().textOffset, static_cast<size_t>(header().textLength));
+    }
+
+    // Offsets of the newlines in text(), in order
+    std::span<const uint64_t> breaks() const {
+        return std::span<const uint64_t>(reinterpret_cast<const uint64_t*>(data_ + header().breaksOffset),
+                                         static_cast<size_t>(header().breakCount));
+    }
+
+    std::string_view metadata() const {
+        return std::string_view(data_ + header().metadataOffset, static_cast<size_t>(header().metadataLength));
+    }
+
+private:
+    static constexpr uint32_t MAGIC = 0x534d4543; // "CEMS"
+    static constexpr uint32_t VERSION = 1;
+
+    // Written as is; snapshots are read back by machines of the same byte order
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        int64_t revision;
+        uint64_t textOffset;
+        uint64_t textLength;
+        uint64_t breaksOffset;
+        uint64_t breakCount;
+        uint64_t metadataOffset;
+        uint64_t metadataLength;
+    };
+
+    MappedSnapshot(const char* data, size_t size)
+        : data_(data), size_(size) {}
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~uint64_t{7};
+    }
+
+    static bool writeAll(int fd, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const ssize_t written = ::write(fd, bytes, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    const Header& header() const {
+        return *reinterpret_cast<const Header*>(data_);
+    }
+
+    // Check the header and that every section lies inside the file; O(1)
+    bool valid() const {
+        const Header& h = header();
+        const uint64_t size = size_;
+        return h.magic == MAGIC && h.version == VERSION &&
+               h.textOffset >= sizeof(Header) && h.textOffset <= size && h.textLength <= size - h.textOffset &&
+               h.breaksOffset % 8 == 0 && h.breaksOffset >= h.textOffset + h.textLength && h.breaksOffset <= size &&
+               h.breakCount <= h.textLength && h.breakCount <= (size - h.breaksOffset) / sizeof(uint64_t) &&
+               h.metadataOffset >= h.breaksOffset + h.breakCount * sizeof(uint64_t) && h.metadataOffset <= size &&
+               h.metadataLength <= size - h.metadataOffset;
+    }
+
+    const char* data_;   // The mapping; page aligned, so the header is too
+    size_t size_;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MAPPED_SNAPSHOT_H
@@ -0,0 +1,211 @@
+#ifndef COLLABORATIVE_EDITOR_MEMORY_ACCOUNTING_H
+#define COLLABORATIVE_EDITOR_MEMORY_ACCOUNTING_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "common/util/metrics.h"
+
+namespace collab {
+namespace util {
+
+/**
+ * The subsystems memory is accounted to
+ */
+enum class MemoryTag {
+    OT_LOG,    // Operation logs: their slots, and the operations they retain
+    CRDT,      // CRDT document trees
+    HISTORY,   // Undo and redo stacks
+    PROTOCOL,  // Queued outgoing frames
+    SESSIONS,  // Session and document lookup maps
+    COUNT
+};
+
+inline const char* memoryTagName(MemoryTag tag) {
+    switch (tag) {
+    case MemoryTag::OT_LOG:
+        return "ot_log";
+    case MemoryTag::CRDT:
+        return "crdt";
+    case MemoryTag::HISTORY:
+        return "history";
+    case MemoryTag::PROTOCOL:
+        return "protocol";
+    case MemoryTag::SESSIONS:
+        return "sessions";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * Memory resource that counts what goes through it
+ *
+ * Passes every allocation to its upstream resource and counts the bytes
+ * allocated and freed, on sharded counters, so containers on different
+ * threads do not contend. Memory a subsystem holds that was allocated
+ * elsewhere, e.g. operations made with make_shared and kept in a log, can
+ * be added with charge() and taken off with discharge(); MemoryCharge
+ * does that for a running total.
+ */
+class TrackingResource : public std::pmr::memory_resource {
+public:
+    explicit TrackingResource(const char* name = "untagged",
+                              std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : name_(name), upstream_(upstream) {}
+
+    TrackingResource(const TrackingResource&) = delete;
+    TrackingResource& operator=(const TrackingResource&) = delete;
+
+    const char* name() const {
+        return name_;
+    }
+
+    // Bytes allocated or charged and not yet freed
+    int64_t liveBytes() const {
+        // Freed first, so a free racing the read is not seen without its allocation
+        const uint64_t freed = freed_.value();
+        return static_cast<int64_t>(allocated_.value()) - static_cast<int64_t>(freed);
+    }
+
+    uint64_t allocatedBytes() const {
+        return allocated_.value();
+    }
+
+    uint64_t allocations() const {
+        return allocations_.value();
+    }
+
+    // Count bytes held that this resource did not allocate
+    void charge(size_t bytes) {
+        allocated_.add(bytes);
+    }
+
+    // Stop counting bytes charged before
+    void discharge(size_t bytes) {
+        freed_.add(bytes);
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        void* memory = upstream_->allocate(bytes, alignment);
+        allocated_.add(bytes);
+        allocations_.add();
+        return memory;
+    }
+
+    void do_deallocate(void* memory, size_t bytes, size_t alignment) override {
+        upstream_->deallocate(memory, bytes, alignment);
+        freed_.add(bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    const char* name_;
+    std::pmr::memory_resource* upstream_;
+    Counter allocated_;
+    Counter freed_;
+    Counter allocations_;
+};
+
+/**
+ * The resource memory of a subsystem is allocated and accounted through
+ *
+ * @param tag The subsystem
+ * @return Its resource, which lives as long as the process
+ */
+inline TrackingResource& memoryResource(MemoryTag tag) {
+    static std::array<TrackingResource, static_cast<size_t>(MemoryTag::COUNT)> resources{
+        TrackingResource(memoryTagName(MemoryTag::OT_LOG)),
+        TrackingResource(memoryTagName(MemoryTag::CRDT)),
+        TrackingResource(memoryTagName(MemoryTag::HISTORY)),
+        TrackingResource(memoryTagName(MemoryTag::PROTOCOL)),
+        TrackingResource(memoryTagName(MemoryTag::SESSIONS))};
+    return resources[static_cast<size_t>(tag)];
+}
+
+/**
+ * Keeps a running total charged to a resource, e.g. the estimated size of what a log retains
+ * Copies charge their total again, moves take it over, and the destructor discharges it
+ */
+class MemoryCharge {
+public:
+    explicit MemoryCharge(TrackingResource& resource) : resource_(&resource) {}
+
+    MemoryCharge(const MemoryCharge& other) : resource_(other.resource_) {
+        set(other.bytes_);
+    }
+
+    MemoryCharge(MemoryCharge&& other) noexcept
+        : resource_(other.resource_), bytes_(std::exchange(other.bytes_, 0)) {}
+
+    MemoryCharge& operator=(const MemoryCharge& other) {
+        set(other.bytes_);
+        return *this;
+    }
+
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept {
+        if (this != &other) {
+            set(0);
+            resource_ = other.resource_;
+            bytes_ = std::exchange(other.bytes_, 0);
+        }
+        return *this;
+    }
+
+    ~MemoryCharge() {
+        set(0);
+    }
+
+    // Make the total bytes, charging or discharging the difference
+    void set(size_t bytes) {
+        if (bytes > bytes_) {
+            resource_->charge(bytes - bytes_);
+        } else if (bytes < bytes_) {
+            resource_->discharge(bytes_ - bytes);
+        }
+        bytes_ = bytes;
+    }
+
+    size_t bytes() const {
+        return bytes_;
+    }
+
+private:
+    TrackingResource* resource_;
+    size_t bytes_ = 0;
+};
+
+// What one subsystem holds
+struct MemoryUsage {
+    const char* tag;
+    int64_t liveBytes;
+    uint64_t allocatedBytes;  // Since the process started
+    uint64_t allocations;
+};
+
+/**
+ * Memory held per subsystem, for capacity planning and finding leaks
+ *
+ * @return One entry per tag
+ */
+inline std::vector<MemoryUsage> memoryUsage() {
+    std::vector<MemoryUsage> usage;
+    for (size_t i = 0; i < static_cast<size_t>(MemoryTag::COUNT); ++i) {
+        const TrackingResource& resource = memoryResource(static_cast<MemoryTag>(i));
+        usage.push_back({resource.name(), resource.liveBytes(), resource.allocatedBytes(), resource.allocations()});
+    }
+    return usage;
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MEMORY_ACCOUNTING_H
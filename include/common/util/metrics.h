@@ -0,0 +1,445 @@
+#ifndef COLLABORATIVE_EDITOR_METRICS_H
+#define COLLABORATIVE_EDITOR_METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace util {
+
+/**
+ * Nanoseconds, which ScopedTimer records, per second, which Prometheus expects
+ */
+constexpr double NANOSECONDS_PER_SECOND = 1e9;
+constexpr double MICROSECONDS_PER_SECOND = 1e6;
+
+/**
+ * Index of the calling thread's shard: threads take consecutive slots, so
+ * the first few never share a cache line
+ */
+inline size_t metricShardIndex() {
+    static std::atomic<size_t> next{0};
+    thread_local const size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+/**
+ * A monotonic count, e.g. of operations applied
+ *
+ * Each thread adds to its own cache line, so hot paths on different
+ * threads never contend; reading sums the shards and may miss adds in
+ * flight.
+ */
+class Counter {
+public:
+    static constexpr size_t SHARDS = 8;
+
+    void add(uint64_t amount = 1) {
+        shards_[metricShardIndex() % SHARDS].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const Shard& shard : shards_) {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, SHARDS> shards_;
+};
+
+/**
+ * A value that goes up and down, e.g. connected clients
+ */
+class Gauge {
+public:
+    void set(int64_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    void add(int64_t amount = 1) {
+        value_.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void sub(int64_t amount = 1) {
+        value_.fetch_sub(amount, std::memory_order_relaxed);
+    }
+
+    int64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+/**
+ * A distribution of values, e.g. latencies in nanoseconds, in HDR-style buckets
+ *
+ * Values below 2^SUB_BITS get a bucket each; above, every power of two is
+ * split into 2^SUB_BITS buckets, so a percentile is off by at most 1/32
+ * of the value however wide the range. Recording is three relaxed adds and
+ * a compare on the calling thread's shard; no lock and no allocation.
+ * Values from 2^MAX_BITS (about 18 minutes in nanoseconds) up count as the
+ * largest bucket.
+ */
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int MAX_BITS = 40;
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BITS;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+    static constexpr size_t SHARDS = 4;
+
+    // Counts merged over the shards at one moment
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> buckets;
+
+        /**
+         * The value a fraction of the recorded values are at or below
+         *
+         * @param quantile Between 0 and 1, e.g. 0.99
+         * @return The highest value of the bucket it falls in, or 0 with nothing recorded
+         */
+        uint64_t valueAt(double quantile) const {
+            uint64_t total = 0;
+            for (uint64_t bucket : buckets) {
+                total += bucket;
+            }
+            if (total == 0) {
+                return 0;
+            }
+            const double clamped = std::clamp(quantile, 0.0, 1.0);
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(clamped * static_cast<double>(total) + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    return std::min(highestEquivalent(i), max);
+                }
+            }
+            return max;
+        }
+
+        double mean() const {
+            return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0;
+        }
+    };
+
+    void record(uint64_t value) {
+        Shard& shard = shards_[metricShardIndex() % SHARDS];
+        shard.buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = shard.max.load(std::memory_order_relaxed);
+        while (value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    Snapshot snapshot() const {
+        Snapshot snapshot;
+        snapshot.buckets.assign(BUCKETS, 0);
+        for (const Shard& shard : shards_) {
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            }
+            snapshot.count += shard.count.load(std::memory_order_relaxed);
+            snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+            snapshot.max = std::max(snapshot.max, shard.max.load(std::memory_order_relaxed));
+        }
+        return snapshot;
+    }
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        const int top = std::bit_width(value) - 1;
+        if (top >= MAX_BITS) {
+            return BUCKETS - 1;
+        }
+        const int group = top - SUB_BITS + 1;
+        return static_cast<size_t>(group) * SUB_BUCKETS + static_cast<size_t>((value >> (group - 1)) - SUB_BUCKETS);
+    }
+
+    // The smallest value that falls in a bucket
+    static uint64_t lowestEquivalent(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const size_t group = bucket / SUB_BUCKETS;
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) << (group - 1);
+    }
+
+    // The largest value that falls in a bucket
+    static uint64_t highestEquivalent(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        return lowestEquivalent(bucket) + (uint64_t{1} << (bucket / SUB_BUCKETS - 1)) - 1;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    std::array<Shard, SHARDS> shards_;
+};
+
+/**
+ * Records the time from construction to destruction, in nanoseconds
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        histogram_.record(elapsed());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    uint64_t elapsed() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+    }
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * The metrics of a process, by name and labels, rendered for Prometheus
+ *
+ * Looking a metric up takes a lock, so hot paths look it up once and keep
+ * the reference; metrics live as long as the registry and never move.
+ * Histograms are exported as summaries with the 0.5, 0.9, 0.99 and 0.999
+ * quantiles, their values divided by the unit given at registration,
+ * e.g. NANOSECONDS_PER_SECOND. Thread-safe.
+ */
+class MetricsRegistry {
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    /**
+     * Get a counter, registering it on first use
+     *
+     * @param name Metric name, e.g. "collab_ops_applied_total"
+     * @param help What it counts; the first registration's text is kept
+     * @param labels Labels of this series
+     * @return The counter
+     * @throws std::invalid_argument if the name is not valid or is registered as another type
+     */
+    Counter& counter(const std::string& name, const std::string& help, const Labels& labels = {}) {
+        return *series(name, help, labels, Type::Counter, 1.0).counter;
+    }
+
+    /**
+     * Get a gauge, registering it on first use
+     *
+     * @throws std::invalid_argument if the name is not valid or is registered as another type
+     */
+    Gauge& gauge(const std::string& name, const std::string& help, const Labels& labels = {}) {
+        return *series(name, help, labels, Type::Gauge, 1.0).gauge;
+    }
+
+    /**
+     * Get a histogram, registering it on first use
+     *
+     * @param unit Recorded values per exported one; the first registration's is kept
+     * @throws std::invalid_argument if the name is not valid or is registered as another type
+     */
+    Histogram& histogram(const std::string& name, const std::string& help, const Labels& labels = {},
+                         double unit = 1.0) {
+        return *series(name, help, labels, Type::Histogram, unit).histogram;
+    }
+
+    /**
+     * Render every metric in the Prometheus text exposition format (version 0.0.4)
+     */
+    std::string renderPrometheus() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string out;
+        for (const auto& [name, family] : families_) {
+            out += "# HELP " + name + ' ' + escape(family.help, false) + '\n';
+            out += "# TYPE " + name + ' ' + typeName(family.type) + '\n';
+            for (const auto& [labels, series] : family.series) {
+                switch (family.type) {
+                case Type::Counter:
+                    appendSample(out, name, labels, "", static_cast<double>(series->counter->value()));
+                    break;
+                case Type::Gauge:
+                    appendSample(out, name, labels, "", static_cast<double>(series->gauge->value()));
+                    break;
+                case Type::Histogram: {
+                    const Histogram::Snapshot snapshot = series->histogram->snapshot();
+                    for (const auto& [quantile, text] : QUANTILES) {
+                        const std::string label = std::string("quantile=\"") + text + '"';
+                        const double value = static_cast<double>(snapshot.valueAt(quantile));
+                        appendSample(out, name, labels.empty() ? label : labels + ',' + label, "",
+                                     value / family.unit);
+                    }
+                    appendSample(out, name, labels, "_sum", static_cast<double>(snapshot.sum) / family.unit);
+                    appendSample(out, name, labels, "_count", static_cast<double>(snapshot.count));
+                    break;
+                }
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    enum class Type { Counter, Gauge, Histogram };
+
+    static constexpr std::pair<double, const char*> QUANTILES[] = {
+        {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}};
+
+    // One labelled series; only the metric of the family's type is set
+    struct Series {
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        Type type;
+        std::string help;
+        double unit;
+        std::map<std::string, std::unique_ptr<Series>> series;  // By rendered labels
+    };
+
+    Series& series(const std::string& name, const std::string& help, const Labels& labels, Type type, double unit) {
+        if (!validName(name)) {
+            throw std::invalid_argument("Invalid metric name " + name);
+        }
+        std::string rendered;
+        for (const auto& [key, value] : labels) {
+            if (!validName(key) || key.find(':') != std::string::npos) {
+                throw std::invalid_argument("Invalid label name " + key + " on metric " + name);
+            }
+            rendered += (rendered.empty() ? "" : ",") + key + "=\"" + escape(value, true) + '"';
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, added] = families_.try_emplace(name, Family{type, help, unit, {}});
+        if (!added && it->second.type != type) {
+            throw std::invalid_argument("Metric " + name + " is registered as a " + typeName(it->second.type));
+        }
+        std::unique_ptr<Series>& slot = it->second.series[rendered];
+        if (!slot) {
+            slot = std::make_unique<Series>();
+            switch (type) {
+            case Type::Counter:
+                slot->counter = std::make_unique<Counter>();
+                break;
+            case Type::Gauge:
+                slot->gauge = std::make_unique<Gauge>();
+                break;
+            case Type::Histogram:
+                slot->histogram = std::make_unique<Histogram>();
+                break;
+            }
+        }
+        return *slot;
+    }
+
+    static bool validName(std::string_view name) {
+        if (name.empty() || (name[0] >= '0' && name[0] <= '9')) {
+            return false;
+        }
+        return std::all_of(name.begin(), name.end(), [](char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ':';
+        });
+    }
+
+    // Escape help text, or a label value, which also escapes its quotes
+    static std::string escape(std::string_view text, bool quotes) {
+        std::string escaped;
+        escaped.reserve(text.size());
+        for (char c : text) {
+            if (c == '\\') {
+                escaped += "\\\\";
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else if (c == '"' && quotes) {
+                escaped += "\\\"";
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static const char* typeName(Type type) {
+        switch (type) {
+        case Type::Counter:
+            return "counter";
+        case Type::Gauge:
+            return "gauge";
+        case Type::Histogram:
+            return "summary";
+        }
+        return "untyped";
+    }
+
+    static void appendSample(std::string& out, const std::string& name, const std::string& labels,
+                             std::string_view suffix, double value) {
+        out += name;
+        out += suffix;
+        if (!labels.empty()) {
+            out += '{' + labels + '}';
+        }
+        out += ' ';
+        char buffer[32];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+        out += '\n';
+    }
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+/**
+ * The process-wide registry the server's components report to
+ */
+inline MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_METRICS_H
@@ -0,0 +1,106 @@
+#ifndef COLLABORATIVE_EDITOR_MPSC_QUEUE_H
+#define COLLABORATIVE_EDITOR_MPSC_QUEUE_H
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace collab {
+namespace util {
+
+/**
+ * Unbounded lock-free queue with many producers and one consumer
+ *
+ * Dmitry Vyukov's intrusive MPSC queue: push() is one atomic exchange and
+ * never waits, so producers on different threads never block each other
+ * or the consumer. A pop can briefly see the queue as empty while a push
+ * is halfway done; callers that schedule the consumer after pushing, as
+ * DocumentInbox does, see that push's item on their next pop.
+ *
+ * push() may be called from any thread; tryPop() and empty() only from the
+ * one consumer at a time.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+    ~MpscQueue() {
+        while (tryPop()) {
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        link(new Node(std::move(value)));
+    }
+
+    /**
+     * Take the oldest item
+     *
+     * @return The item, or nothing if the queue is empty or a push is still linking
+     */
+    std::optional<T> tryPop() {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return std::nullopt;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (!next) {
+            if (tail != head_.load(std::memory_order_acquire)) {
+                // A producer swapped the head but has not linked it yet
+                return std::nullopt;
+            }
+            // Keep one node in the queue so the last item can be taken
+            stub_.next.store(nullptr, std::memory_order_relaxed);
+            link(&stub_);
+            next = tail->next.load(std::memory_order_acquire);
+            if (!next) {
+                return std::nullopt;
+            }
+        }
+        tail_ = next;
+        std::optional<T> value(std::move(*tail->value));
+        delete tail;
+        return value;
+    }
+
+    // Whether nothing is queued or being pushed
+    bool empty() const {
+        // Any node but the stub at the tail still holds its item
+        return tail_ == &stub_ && stub_.next.load(std::memory_order_acquire) == nullptr &&
+               head_.load() == &stub_;
+    }
+
+private:
+    struct Node {
+        Node() = default;
+        explicit Node(T item) : value(std::move(item)) {}
+
+        std::atomic<Node*> next{nullptr};
+        std::optional<T> value;
+    };
+
+    void link(Node* node) {
+        // Sequentially consistent, so a consumer that checks empty() after a push can rely on it
+        Node* previous = head_.exchange(node);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Producers push at the head; the consumer pops at the tail
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_MPSC_QUEUE_H
@@ -0,0 +1,326 @@
+#ifndef COLLABORATIVE_EDITOR_NUMA_TOPOLOGY_H
+#define COLLABORATIVE_EDITOR_NUMA_TOPOLOGY_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace collab {
+namespace util {
+
+/**
+ * The machine's NUMA nodes and the CPUs on each, and placement on them
+ *
+ * On a multi-socket server each socket's memory is a node, and a thread
+ * touching another node's memory pays a cross-socket hop on every cache
+ * miss. bindCurrentThread() keeps a thread on one node's CPUs and has the
+ * kernel prefer that node for the pages it first touches, so whatever the
+ * thread allocates for itself (a shard's documents, logs and buffers)
+ * lands on the node it runs on. allocate() takes memory from a given node
+ * outright, optionally on transparent huge pages.
+ *
+ * Read from sysfs on Linux, without libnuma; a machine without NUMA, or
+ * another platform, is one node with every CPU, and binding then only
+ * sets the thread's affinity. Placement is a hint: calls that the kernel
+ * refuses return false and leave the thread as it was.
+ */
+class NumaTopology {
+public:
+    // currentNode() on a thread that was never bound
+    static constexpr size_t NO_NODE = std::numeric_limits<size_t>::max();
+    // allocate() with hugePages rounds up to this
+    static constexpr size_t HUGE_PAGE_SIZE = size_t{2} << 20;
+
+    /**
+     * A topology with the given CPUs per node, e.g. for tests
+     *
+     * @param cpusByNode CPU numbers of each node; nodes without CPUs are dropped, and none at all is one empty node
+     */
+    explicit NumaTopology(std::vector<std::vector<unsigned>> cpusByNode) {
+        for (auto& cpus : cpusByNode) {
+            if (!cpus.empty()) {
+                std::sort(cpus.begin(), cpus.end());
+                nodes_.push_back(std::move(cpus));
+            }
+        }
+        if (nodes_.empty()) {
+            nodes_.emplace_back();
+        }
+    }
+
+    /**
+     * Read the topology from sysfs
+     *
+     * @param root Directory holding the node<N>/cpulist files
+     * @return The nodes with CPUs, in node order; one node with every CPU if there are none
+     */
+    static NumaTopology detect(const std::filesystem::path& root = "/sys/devices/system/node") {
+        std::vector<std::pair<size_t, std::vector<unsigned>>> found;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(root, error)) {
+            const std::string name = entry.path().filename().string();
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                !std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                continue;
+            }
+            std::ifstream file(entry.path() / "cpulist");
+            std::string list;
+            if (file && std::getline(file, list)) {
+                found.emplace_back(std::stoul(name.substr(4)), parseCpuList(list));
+            }
+        }
+        std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<std::vector<unsigned>> cpusByNode;
+        std::vector<size_t> ids;
+        for (auto& [id, cpus] : found) {
+            if (!cpus.empty()) {
+                ids.push_back(id);
+                cpusByNode.push_back(std::move(cpus));
+            }
+        }
+        if (cpusByNode.empty()) {
+            std::vector<unsigned> all(std::max(1u, std::thread::hardware_concurrency()));
+            for (unsigned cpu = 0; cpu < all.size(); ++cpu) {
+                all[cpu] = cpu;
+            }
+            return NumaTopology({std::move(all)});
+        }
+        NumaTopology topology(std::move(cpusByNode));
+        topology.ids_ = std::move(ids);
+        return topology;
+    }
+
+    // The topology of this machine, detected once
+    static const NumaTopology& system() {
+        static const NumaTopology topology = detect();
+        return topology;
+    }
+
+    /**
+     * Parse a kernel CPU list such as "0-3,8,10-11"
+     *
+     * @param list The list
+     * @return The CPUs in it, ascending; malformed parts are skipped
+     */
+    static std::vector<unsigned> parseCpuList(std::string_view list) {
+        std::vector<unsigned> cpus;
+        while (!list.empty()) {
+            const size_t comma = list.find(',');
+            std::string_view part = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            unsigned first = 0;
+            unsigned last = 0;
+            const size_t dash = part.find('-');
+            if (!parseNumber(part.substr(0, dash), first) ||
+                !parseNumber(dash == std::string_view::npos ? part.substr(0, dash) : part.substr(dash + 1), last) ||
+                last < first) {
+                continue;
+            }
+            for (unsigned cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        return cpus;
+    }
+
+    size_t nodeCount() const {
+        return nodes_.size();
+    }
+
+    // CPUs of a node, ascending; node is an index below nodeCount()
+    const std::vector<unsigned>& cpusOf(size_t node) const {
+        return nodes_[node % nodes_.size()];
+    }
+
+    /**
+     * Get the node a CPU belongs to
+     *
+     * @param cpu The CPU number
+     * @return Its node's index, or NO_NODE if no node has it
+     */
+    size_t nodeOf(unsigned cpu) const {
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            if (std::binary_search(nodes_[node].begin(), nodes_[node].end(), cpu)) {
+                return node;
+            }
+        }
+        return NO_NODE;
+    }
+
+    /**
+     * Spread a number of threads over the nodes, in contiguous blocks
+     *
+     * Thread 0 to n/nodes go on node 0 and so on, so neighbouring indexes,
+     * which often share work, share a node.
+     *
+     * @param slot The thread's index
+     * @param slots The number of threads
+     * @return The node index for that thread
+     */
+    size_t nodeForSlot(size_t slot, size_t slots) const {
+        return slots == 0 ? 0 : std::min(slot * nodes_.size() / slots, nodes_.size() - 1);
+    }
+
+    /**
+     * Keep the calling thread on a node and prefer that node's memory for it
+     *
+     * @param node Node index below nodeCount()
+     * @param cpuSlot Pin to this one of the node's CPUs (modulo their number) rather than to all of them; NO_NODE for all
+     * @return False if the kernel refused the affinity or the memory policy
+     */
+    bool bindCurrentThread(size_t node, size_t cpuSlot = NO_NODE) const {
+        node %= nodes_.size();
+        currentNodeSlot() = node;
+#ifdef __linux__
+        const std::vector<unsigned>& cpus = nodes_[node];
+        if (cpus.empty()) {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpuSlot != NO_NODE) {
+            CPU_SET(cpus[cpuSlot % cpus.size()], &set);
+        } else {
+            for (unsigned cpu : cpus) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        bool placed = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        if (nodes_.size() > 1) {
+            NodeMask mask = maskOf(node);
+            placed = ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), MASK_BITS + 1) == 0 && placed;
+        }
+        return placed;
+#else
+        (void)cpuSlot;
+        return false;
+#endif
+    }
+
+    // The node the calling thread was bound to with bindCurrentThread(), or NO_NODE
+    static size_t currentNode() {
+        return currentNodeSlot();
+    }
+
+    /**
+     * Map memory from a node, e.g. for a shard's buffers
+     *
+     * @param bytes Bytes needed
+     * @param node Node index; its pages are preferred, and others used only if it is full
+     * @param hugePages Ask for transparent huge pages; bytes are rounded up to HUGE_PAGE_SIZE
+     * @return The memory, zeroed and page-aligned; free it with deallocate() and the same bytes and hugePages
+     * @throws std::bad_alloc if nothing could be mapped
+     */
+    void* allocate(size_t bytes, size_t node, bool hugePages = false) const {
+        const size_t length = mappedLength(bytes, hugePages);
+#ifdef __linux__
+        void* data = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (nodes_.size() > 1) {
+            NodeMask mask = maskOf(node % nodes_.size());
+            ::syscall(SYS_mbind, data, length, MPOL_PREFERRED, mask.data(), MASK_BITS + 1, 0);
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages) {
+            ::madvise(data, length, MADV_HUGEPAGE);
+        }
+#endif
+        return data;
+#else
+        (void)node;
+        return ::operator new(length);
+#endif
+    }
+
+    // Give back memory from allocate()
+    void deallocate(void* data, size_t bytes, bool hugePages = false) const {
+        if (!data) {
+            return;
+        }
+#ifdef __linux__
+        ::munmap(data, mappedLength(bytes, hugePages));
+#else
+        (void)bytes;
+        (void)hugePages;
+        ::operator delete(data);
+#endif
+    }
+
+private:
+    // Kernel memory policy modes, from <linux/mempolicy.h>
+    static constexpr int MPOL_PREFERRED = 1;
+    static constexpr size_t MASK_BITS = 1024;
+    using NodeMask = std::array<unsigned long, MASK_BITS / (8 * sizeof(unsigned long))>;
+
+    static bool parseNumber(std::string_view text, unsigned& value) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\n' || text.back() == '\r')) {
+            text.remove_suffix(1);
+        }
+        if (text.empty()) {
+            return false;
+        }
+        value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(c - '0');
+        }
+        return true;
+    }
+
+    static size_t mappedLength(size_t bytes, bool hugePages) {
+        const size_t unit = hugePages ? HUGE_PAGE_SIZE : 4096;
+        return std::max(unit, (bytes + unit - 1) / unit * unit);
+    }
+
+    static size_t& currentNodeSlot() {
+        thread_local size_t node = NO_NODE;
+        return node;
+    }
+
+    // Mask with the kernel's ID of a node index
+    NodeMask maskOf(size_t node) const {
+        NodeMask mask{};
+        const size_t id = node < ids_.size() ? ids_[node] : node;
+        if (id < MASK_BITS) {
+            mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+        }
+        return mask;
+    }
+
+    std::vector<std::vector<unsigned>> nodes_;
+    // Kernel node IDs by index, when read from sysfs; they can have gaps
+    std::vector<size_t> ids_;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_NUMA_TOPOLOGY_H
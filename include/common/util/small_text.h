@@ -0,0 +1,151 @@
+#ifndef COLLABORATIVE_EDITOR_SMALL_TEXT_H
+#define COLLABORATIVE_EDITOR_SMALL_TEXT_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace collab {
+namespace util {
+
+/**
+ * Immutable text held inline up to 15 bytes, in 16 bytes
+ *
+ * Meant for the text an edit carries, which is a keystroke or a short
+ * paste far more often than anything longer: those never touch the heap
+ * and take half a std::string. Longer text lives in one heap block that
+ * holds its length. The last byte is the inline length, or HEAP for text
+ * on the heap.
+ */
+class SmallText {
+public:
+    static constexpr size_t INLINE_CAPACITY = 15;
+
+    SmallText() noexcept : bytes_{} {}
+
+    explicit SmallText(std::string_view text) {
+        assign(text);
+    }
+
+    explicit SmallText(const std::string& text) : SmallText(std::string_view(text)) {}
+
+    explicit SmallText(const char* text) : SmallText(std::string_view(text)) {}
+
+    SmallText(const SmallText& other) {
+        assign(other.view());
+    }
+
+    SmallText(SmallText&& other) noexcept {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        other.bytes_[INLINE_CAPACITY] = 0;
+    }
+
+    SmallText& operator=(const SmallText& other) {
+        if (this != &other) {
+            SmallText copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    SmallText& operator=(SmallText&& other) noexcept {
+        if (this != &other) {
+            release();
+            std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+            other.bytes_[INLINE_CAPACITY] = 0;
+        }
+        return *this;
+    }
+
+    ~SmallText() {
+        release();
+    }
+
+    size_t size() const noexcept {
+        if (!onHeap()) {
+            return static_cast<unsigned char>(bytes_[INLINE_CAPACITY]);
+        }
+        size_t size;
+        std::memcpy(&size, block(), sizeof(size));
+        return size;
+    }
+
+    size_t length() const noexcept {
+        return size();
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    const char* data() const noexcept {
+        return onHeap() ? block() + sizeof(size_t) : bytes_;
+    }
+
+    std::string_view view() const noexcept {
+        return {data(), size()};
+    }
+
+    operator std::string_view() const noexcept {
+        return view();
+    }
+
+    std::string str() const {
+        return std::string(view());
+    }
+
+    // Whether the text took a heap block
+    bool onHeap() const noexcept {
+        return static_cast<unsigned char>(bytes_[INLINE_CAPACITY]) == HEAP;
+    }
+
+    friend bool operator==(const SmallText& a, const SmallText& b) noexcept {
+        return a.view() == b.view();
+    }
+
+    friend bool operator==(const SmallText& a, std::string_view b) noexcept {
+        return a.view() == b;
+    }
+
+private:
+    static constexpr unsigned char HEAP = 0xFF;
+
+    void assign(std::string_view text) {
+        if (text.size() <= INLINE_CAPACITY) {
+            std::memcpy(bytes_, text.data(), text.size());
+            bytes_[INLINE_CAPACITY] = static_cast<char>(text.size());
+            return;
+        }
+        // The block is the length followed by the bytes
+        const size_t size = text.size();
+        auto* block = static_cast<char*>(::operator new(sizeof(size_t) + size));
+        std::memcpy(block, &size, sizeof(size));
+        std::memcpy(block + sizeof(size_t), text.data(), size);
+        std::memcpy(bytes_, &block, sizeof(block));
+        bytes_[INLINE_CAPACITY] = static_cast<char>(HEAP);
+    }
+
+    char* block() const noexcept {
+        char* block;
+        std::memcpy(&block, bytes_, sizeof(block));
+        return block;
+    }
+
+    void release() noexcept {
+        if (onHeap()) {
+            ::operator delete(block());
+        }
+    }
+
+    alignas(8) char bytes_[INLINE_CAPACITY + 1];
+};
+
+static_assert(sizeof(SmallText) == 16, "SmallText should take two words");
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SMALL_TEXT_H
@@ -0,0 +1,154 @@
+#ifndef COLLABORATIVE_EDITOR_SPACE_SAVING_H
+#define COLLABORATIVE_EDITOR_SPACE_SAVING_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace util {
+
+/**
+ * The heaviest keys of a stream, in bounded memory (Space-Saving, Metwally et al.)
+ *
+ * Keeps at most capacity counters. A key already counted adds to its
+ * counter; a new key, once every counter is taken, replaces the smallest
+ * and inherits its count as the error. Any key heavier than total/capacity
+ * is then guaranteed to be held, and a held key's count overestimates it
+ * by at most its error. Counters sit in a min-heap, so each offer is
+ * O(log capacity).
+ *
+ * Not thread-safe; owners lock around it.
+ */
+template <typename Key, typename Hash = std::hash<Key>>
+class SpaceSaving {
+public:
+    struct Entry {
+        Key key;
+        uint64_t count = 0;  // Upper bound of the key's weight
+        uint64_t error = 0;  // How much of count may belong to keys it replaced
+    };
+
+    /**
+     * @param capacity Counters kept; at least 1
+     */
+    explicit SpaceSaving(size_t capacity)
+        : capacity_(std::max<size_t>(capacity, 1)) {
+        heap_.reserve(capacity_);
+        positions_.reserve(capacity_);
+    }
+
+    /**
+     * Count weight for a key
+     *
+     * @param key The key
+     * @param weight Its weight, e.g. 1 per operation or the bytes of a message
+     */
+    void offer(const Key& key, uint64_t weight = 1) {
+        total_ += weight;
+        auto found = positions_.find(key);
+        if (found != positions_.end()) {
+            heap_[found->second].count += weight;
+            siftDown(found->second);
+            return;
+        }
+        if (heap_.size() < capacity_) {
+            heap_.push_back(Entry{key, weight, 0});
+            positions_.emplace(key, heap_.size() - 1);
+            siftUp(heap_.size() - 1);
+            return;
+        }
+        // Replace the smallest counter; the new key may have been it all along
+        Entry& smallest = heap_.front();
+        positions_.erase(smallest.key);
+        smallest.error = smallest.count;
+        smallest.count += weight;
+        smallest.key = key;
+        positions_.emplace(key, 0);
+        siftDown(0);
+    }
+
+    /**
+     * The heaviest keys held
+     *
+     * @param limit Keys returned at most
+     * @return Entries, heaviest first
+     */
+    std::vector<Entry> top(size_t limit) const {
+        std::vector<Entry> entries(heap_.begin(), heap_.end());
+        const size_t count = std::min(limit, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                          [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        entries.resize(count);
+        return entries;
+    }
+
+    // The count held for a key, or 0 if it is not held
+    uint64_t estimate(const Key& key) const {
+        auto found = positions_.find(key);
+        return found != positions_.end() ? heap_[found->second].count : 0;
+    }
+
+    // Weight offered so far
+    uint64_t total() const {
+        return total_;
+    }
+
+    size_t size() const {
+        return heap_.size();
+    }
+
+    void clear() {
+        heap_.clear();
+        positions_.clear();
+        total_ = 0;
+    }
+
+private:
+    void swapEntries(size_t a, size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        positions_[heap_[a].key] = a;
+        positions_[heap_[b].key] = b;
+    }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            const size_t parent = (i - 1) / 2;
+            if (heap_[parent].count <= heap_[i].count) {
+                return;
+            }
+            swapEntries(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap_.size(); ++child) {
+                if (heap_[child].count < heap_[smallest].count) {
+                    smallest = child;
+                }
+            }
+            if (smallest == i) {
+                return;
+            }
+            swapEntries(i, smallest);
+            i = smallest;
+        }
+    }
+
+    const size_t capacity_;
+    std::vector<Entry> heap_;                          // Min-heap by count
+    std::unordered_map<Key, size_t, Hash> positions_;  // Key to its index in heap_
+    uint64_t total_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SPACE_SAVING_H
@@ -0,0 +1,104 @@
+#ifndef COLLABORATIVE_EDITOR_SPSC_RING_H
+#define COLLABORATIVE_EDITOR_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace collab {
+namespace util {
+
+/**
+ * Bounded lock-free ring with one producer and one consumer
+ *
+ * The producer writes only the tail and the consumer only the head, each
+ * on its own cache line, and each side keeps a cached copy of the other's
+ * index, so it reads the shared one only when the ring looks full or
+ * empty. Pushing and popping then cost a store and, mostly, no cache miss.
+ *
+ * tryPush() may be called from one thread at a time and tryPop() from one
+ * other thread at a time.
+ */
+template <typename T>
+class SpscRing {
+public:
+    /**
+     * @param capacity Most items held; rounded up to a power of two
+     */
+    explicit SpscRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        slots_ = std::make_unique<std::optional<T>[]>(size);
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    /**
+     * Add an item unless the ring is full
+     *
+     * @param value The item; left as it was if the ring is full
+     * @return False if the ring is full
+     */
+    bool tryPush(T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ > mask_) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_].emplace(std::move(value));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPush(T&& value) {
+        return tryPush(value);
+    }
+
+    // Take the oldest item, or nothing if the ring is empty
+    std::optional<T> tryPop() {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) {
+                return std::nullopt;
+            }
+        }
+        std::optional<T>& slot = slots_[head & mask_];
+        std::optional<T> value(std::move(*slot));
+        slot.reset();
+        head_.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+    // Whether the ring held nothing when checked; either side may ask
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    std::unique_ptr<std::optional<T>[]> slots_;
+    size_t mask_;
+    // Consumer side: the next slot to pop, and the tail as last seen
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t cachedTail_ = 0;
+    // Producer side: the next slot to fill, and the head as last seen
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t cachedHead_ = 0;
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SPSC_RING_H
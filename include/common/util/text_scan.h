@@ -0,0 +1,95 @@
+#ifndef COLLABORATIVE_EDITOR_TEXT_SCAN_H
+#define COLLABORATIVE_EDITOR_TEXT_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace collab {
+namespace util {
+
+/**
+ * Vectorized scans over document text
+ *
+ * Finding and counting newlines, validating UTF-8, measuring text in
+ * code points and UTF-16 units and finding where two texts first differ,
+ * a register of bytes at a time. Each scan
+ * picks its kernel once per process: AVX2 where the CPU has it, otherwise
+ * SSE2 on x86-64 and NEON on ARM64, otherwise plain loops; all agree byte
+ * for byte. UTF-8 is validated with the lookup-table method under AVX2 and
+ * with an ASCII fast path and a scalar check elsewhere.
+ *
+ * Text positions in the editor are byte offsets into UTF-8. Clients that
+ * count in UTF-16 (Qt's QString, JavaScript) or in code points convert
+ * with the offset functions below; a UTF-16 offset that falls inside a
+ * surrogate pair maps to the start of the character.
+ */
+
+// Name of the kernel set in use: "avx2", "sse2", "neon" or "scalar"
+const char* textScanKernel();
+
+// Newlines ('\n') in text
+size_t countNewlines(std::string_view text);
+
+/**
+ * Append the offset of every newline in text, in order
+ *
+ * @param text Text to scan
+ * @param base Added to each offset, e.g. where text starts in a larger buffer
+ * @param offsets Where the offsets are appended
+ */
+void findNewlines(std::string_view text, uint64_t base, std::vector<uint64_t>& offsets);
+
+/**
+ * Whether text is well-formed UTF-8
+ *
+ * Overlong forms, surrogates, code points above U+10FFFF and truncated
+ * sequences are all rejected, as RFC 3629 requires.
+ */
+bool validUtf8(std::string_view text);
+
+// Bytes a and b have in common from the start
+size_t commonPrefixLength(std::string_view a, std::string_view b);
+
+// Bytes a and b have in common from the end
+size_t commonSuffixLength(std::string_view a, std::string_view b);
+
+// Code points in text, which must be valid UTF-8
+size_t countCodePoints(std::string_view text);
+
+// UTF-16 code units text takes, which must be valid UTF-8: one per code point, two above U+FFFF
+size_t utf16Length(std::string_view text);
+
+/**
+ * Byte offset of a UTF-16 offset into valid UTF-8 text
+ *
+ * @param text The text
+ * @param units UTF-16 units from the start
+ * @return The byte offset; text.size() if units reaches past the end
+ */
+size_t byteOffsetOfUtf16(std::string_view text, size_t units);
+
+/**
+ * Byte offset of a code point offset into valid UTF-8 text
+ *
+ * @param text The text
+ * @param codePoints Code points from the start
+ * @return The byte offset; text.size() if codePoints reaches past the end
+ */
+size_t byteOffsetOfCodePoint(std::string_view text, size_t codePoints);
+
+// UTF-16 offset of a byte offset into valid UTF-8 text, which should start a character
+inline size_t utf16OffsetOfByte(std::string_view text, size_t byteOffset) {
+    return utf16Length(text.substr(0, byteOffset));
+}
+
+// Code point offset of a byte offset into valid UTF-8 text, which should start a character
+inline size_t codePointOffsetOfByte(std::string_view text, size_t byteOffset) {
+    return countCodePoints(text.substr(0, byteOffset));
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_TEXT_SCAN_H
@@ -0,0 +1,410 @@
+#ifndef COLLABORATIVE_EDITOR_THREAD_PROFILER_H
+#define COLLABORATIVE_EDITOR_THREAD_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <csignal>
+#include <ctime>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+namespace collab {
+namespace util {
+
+/**
+ * Sampling CPU profiler over the threads that register with it
+ *
+ * Threads register with a role, e.g. "io", "shard", "persistence" or
+ * "logger", and a name; nameCurrentThread() does that and names the
+ * thread for ps, top and perf as well. Between start() and stop() each
+ * registered thread gets a timer on its own CPU clock that sends it
+ * SIGPROF hz times per second of CPU it uses, and the handler records its
+ * stack in a preallocated buffer without locking or allocating. A thread
+ * that sleeps is not sampled, so a profile shows where CPU goes. The
+ * kernel's tick caps the rate, to 250 Hz on many builds.
+ *
+ * stop() symbolizes the stacks and folds them into collapsed stacks, one
+ * "thread;outer;...;inner count" line per distinct stack, grouped by
+ * role, which flamegraph.pl and speedscope read directly. Functions not
+ * in the dynamic symbol table (link with -rdynamic to put them there)
+ * show as module+offset, for addr2line.
+ *
+ * One profile runs at a time. Linux only; elsewhere start() throws.
+ */
+class SamplingProfiler {
+public:
+    static constexpr unsigned DEFAULT_HZ = 99;
+    static constexpr size_t DEFAULT_MAX_SAMPLES = 16384;
+    static constexpr size_t MAX_DEPTH = 48;
+
+    // The result of one profile
+    struct Profile {
+        // Role, then collapsed stack starting with the thread name, to samples
+        std::map<std::string, std::map<std::string, uint64_t>> stacks;
+        uint64_t samples = 0;
+        uint64_t dropped = 0;  // Samples lost to a full buffer
+
+        /**
+         * Collapsed stacks of one role's threads
+         *
+         * @param role The role
+         * @return One "thread;frame;...;frame count" line per stack
+         */
+        std::string collapsed(const std::string& role) const {
+            auto it = stacks.find(role);
+            return it != stacks.end() ? collapse(it->second, "") : std::string();
+        }
+
+        // Collapsed stacks of every thread, each under its role as the root frame
+        std::string collapsed() const {
+            std::string text;
+            for (const auto& [role, roleStacks] : stacks) {
+                text += collapse(roleStacks, role + ";");
+            }
+            return text;
+        }
+
+    private:
+        static std::string collapse(const std::map<std::string, uint64_t>& roleStacks, const std::string& prefix) {
+            std::string text;
+            for (const auto& [stack, count] : roleStacks) {
+                text += prefix + stack + " " + std::to_string(count) + "\n";
+            }
+            return text;
+        }
+    };
+
+    SamplingProfiler() = default;
+    SamplingProfiler(const SamplingProfiler&) = delete;
+    SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+    ~SamplingProfiler() {
+        if (running()) {
+            stop();
+        }
+    }
+
+    /**
+     * Add the calling thread to those profiles sample; it leaves when it exits
+     *
+     * @param role What the thread does, which groups its stacks
+     * @param name The thread's own name in its stacks
+     */
+    void registerCurrentThread(const std::string& role, const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (currentSlot() < 0) {
+            currentSlot() = static_cast<int>(allocateSlot());
+            static thread_local SlotRelease release{this};
+        }
+        Thread& thread = threads_[static_cast<size_t>(currentSlot())];
+        thread.role = role;
+        thread.name = name;
+        thread.used = true;
+#ifdef __linux__
+        thread.handle = pthread_self();
+        thread.tid = static_cast<pid_t>(syscall(SYS_gettid));
+#endif
+    }
+
+    /**
+     * Start sampling every registered thread
+     *
+     * @param hz Samples per second of CPU each thread uses
+     * @param maxSamples Samples kept; more are counted as dropped
+     * @throws std::runtime_error if a profile is already running or the platform has no support
+     */
+    void start(unsigned hz = DEFAULT_HZ, size_t maxSamples = DEFAULT_MAX_SAMPLES) {
+#ifdef __linux__
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (active_.load() != nullptr) {
+            throw std::runtime_error("A profile is already running");
+        }
+        if (hz == 0 || hz > 10000) {
+            throw std::invalid_argument("Sampling rate must be 1 to 10000 Hz");
+        }
+        installHandler();
+
+        samples_ = std::make_unique<Sample[]>(std::max<size_t>(maxSamples, 1));
+        capacity_ = std::max<size_t>(maxSamples, 1);
+        next_.store(0);
+        dropped_.store(0);
+        profiled_.clear();
+        for (const Thread& thread : threads_) {
+            profiled_.push_back({thread.role, thread.name});
+        }
+        active_.store(this);
+
+        const long interval = 1000000000L / static_cast<long>(hz);
+        for (const Thread& thread : threads_) {
+            clockid_t clock;
+            if (!thread.used || pthread_getcpuclockid(thread.handle, &clock) != 0) {
+                continue;
+            }
+            sigevent event{};
+            event.sigev_notify = SIGEV_THREAD_ID;
+            event.sigev_signo = SIGPROF;
+            event.sigev_notify_thread_id = thread.tid;
+            timer_t timer;
+            if (timer_create(clock, &event, &timer) != 0) {
+                continue;
+            }
+            itimerspec spec{};
+            spec.it_interval.tv_nsec = interval % 1000000000L;
+            spec.it_interval.tv_sec = interval / 1000000000L;
+            spec.it_value = spec.it_interval;
+            timer_settime(timer, 0, &spec, nullptr);
+            timers_.push_back(timer);
+        }
+#else
+        (void)hz;
+        (void)maxSamples;
+        throw std::runtime_error("The sampling profiler needs Linux");
+#endif
+    }
+
+    bool running() const {
+        return active_.load() != nullptr;
+    }
+
+    /**
+     * Stop sampling and fold what was sampled into collapsed stacks
+     *
+     * @return The profile
+     * @throws std::runtime_error if no profile is running
+     */
+    Profile stop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (active_.load() == nullptr) {
+            throw std::runtime_error("No profile is running");
+        }
+#ifdef __linux__
+        for (timer_t timer : timers_) {
+            timer_delete(timer);
+        }
+        timers_.clear();
+#endif
+        // A signal already on its way finds no profile; one being handled is waited out
+        active_.store(nullptr);
+        while (inHandler_.load() > 0) {
+            std::this_thread::yield();
+        }
+
+        Profile profile;
+        profile.dropped = dropped_.load();
+        const size_t count = std::min(next_.load(), capacity_);
+        std::map<void*, std::string> symbols;
+        for (size_t i = 0; i < count; ++i) {
+            const Sample& sample = samples_[i];
+            if (sample.slot >= profiled_.size()) {
+                continue;
+            }
+            const Profiled& thread = profiled_[sample.slot];
+            std::string stack = thread.name;
+            // Outermost first; the first frames are the handler and the signal trampoline
+            for (size_t frame = sample.depth; frame-- > SKIPPED_FRAMES;) {
+                auto [it, added] = symbols.try_emplace(sample.frames[frame]);
+                if (added) {
+                    it->second = symbolize(sample.frames[frame]);
+                }
+                stack += ";" + it->second;
+            }
+            ++profile.stacks[thread.role][stack];
+            ++profile.samples;
+        }
+        samples_.reset();
+        capacity_ = 0;
+        return profile;
+    }
+
+    /**
+     * Profile for a while on the calling thread, which is not sampled meanwhile
+     *
+     * @param duration How long to sample
+     * @param hz Samples per second of CPU each thread uses
+     * @return The profile
+     */
+    Profile capture(std::chrono::milliseconds duration, unsigned hz = DEFAULT_HZ) {
+        start(hz);
+        std::this_thread::sleep_for(duration);
+        return stop();
+    }
+
+private:
+    // backtrace() frames of the signal handler and the trampoline it returns through
+    static constexpr size_t SKIPPED_FRAMES = 2;
+
+    struct Thread {
+        std::string role;
+        std::string name;
+        bool used = false;
+#ifdef __linux__
+        pthread_t handle{};
+        pid_t tid = 0;
+#endif
+    };
+
+    struct Profiled {
+        std::string role;
+        std::string name;
+    };
+
+    struct Sample {
+        size_t slot = 0;
+        size_t depth = 0;
+        void* frames[MAX_DEPTH];
+    };
+
+    // Frees the thread's slot when the thread exits
+    struct SlotRelease {
+        SamplingProfiler* profiler;
+
+        ~SlotRelease() {
+            std::lock_guard<std::mutex> lock(profiler->mutex_);
+            profiler->threads_[static_cast<size_t>(currentSlot())].used = false;
+            currentSlot() = -1;
+        }
+    };
+
+    // Plain int, so reading it in the signal handler never allocates
+    static int& currentSlot() {
+        static thread_local int slot = -1;
+        return slot;
+    }
+
+    size_t allocateSlot() {
+        for (size_t i = 0; i < threads_.size(); ++i) {
+            if (!threads_[i].used) {
+                return i;
+            }
+        }
+        threads_.emplace_back();
+        return threads_.size() - 1;
+    }
+
+#ifdef __linux__
+    static void installHandler() {
+        static std::once_flag installed;
+        std::call_once(installed, [] {
+            // backtrace() loads its unwinder on first use, which must not happen in the handler
+            void* warmUp[1];
+            backtrace(warmUp, 1);
+            currentSlot();
+
+            struct sigaction action{};
+            action.sa_handler = &SamplingProfiler::onSignal;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            // Left installed: a signal still queued from a deleted timer must not kill the process
+            sigaction(SIGPROF, &action, nullptr);
+        });
+    }
+
+    static void onSignal(int) {
+        const int savedErrno = errno;
+        inHandler_.fetch_add(1);
+        SamplingProfiler* profiler = active_.load();
+        const int slot = currentSlot();
+        if (profiler != nullptr && slot >= 0) {
+            const size_t index = profiler->next_.fetch_add(1, std::memory_order_relaxed);
+            if (index < profiler->capacity_) {
+                Sample& sample = profiler->samples_[index];
+                sample.slot = static_cast<size_t>(slot);
+                sample.depth = static_cast<size_t>(backtrace(sample.frames, static_cast<int>(MAX_DEPTH)));
+            } else {
+                profiler->dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        inHandler_.fetch_sub(1);
+        errno = savedErrno;
+    }
+
+    static std::string symbolize(void* address) {
+        Dl_info info{};
+        if (dladdr(address, &info) != 0 && info.dli_sname != nullptr) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+            std::free(demangled);
+            // Semicolons separate frames in collapsed stacks
+            std::replace(name.begin(), name.end(), ';', ':');
+            return name;
+        }
+        char text[32];
+        if (info.dli_fname != nullptr) {
+            std::snprintf(text, sizeof(text), "+0x%zx",
+                          static_cast<size_t>(static_cast<char*>(address) - static_cast<char*>(info.dli_fbase)));
+            std::string module = info.dli_fname;
+            return module.substr(module.find_last_of('/') + 1) + text;
+        }
+        std::snprintf(text, sizeof(text), "%p", address);
+        return text;
+    }
+
+    std::vector<timer_t> timers_;
+#endif
+
+    static inline std::atomic<SamplingProfiler*> active_{nullptr};
+    static inline std::atomic<int> inHandler_{0};
+
+    std::mutex mutex_;
+    std::vector<Thread> threads_;  // Indexed by slot
+    std::vector<Profiled> profiled_;
+    std::unique_ptr<Sample[]> samples_;
+    size_t capacity_ = 0;
+    std::atomic<size_t> next_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+/**
+ * The process's profiler; threads register with it
+ */
+inline SamplingProfiler& profiler() {
+    static SamplingProfiler instance;
+    return instance;
+}
+
+/**
+ * Name the calling thread and register it with the profiler
+ *
+ * The thread is named role-index, cut to the 15 characters Linux keeps,
+ * which is what ps, top, perf and debuggers show.
+ *
+ * @param role What the thread does, e.g. "io" or "shard"
+ * @param index Which of the role's threads it is
+ */
+inline void nameCurrentThread(const std::string& role, size_t index) {
+    const std::string name = role + "-" + std::to_string(index);
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+    profiler().registerCurrentThread(role, name);
+}
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_THREAD_PROFILER_H
@@ -0,0 +1,278 @@
+#ifndef COLLABORATIVE_EDITOR_TIMER_WHEEL_H
+#define COLLABORATIVE_EDITOR_TIMER_WHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+#include "common/util/handle_table.h"
+
+namespace collab {
+namespace util {
+
+/**
+ * Hierarchical timer wheel for many coarse deadlines, such as heartbeats and idle timeouts
+ *
+ * Time advances in ticks. Level 0 has one slot per tick for the next 256
+ * ticks; each level above has slots 256 times as wide. A timer is linked
+ * into the slot its deadline falls in, and a slot of a higher level is
+ * spread over the level below when time reaches it. Scheduling,
+ * rescheduling and cancelling are O(1), and advance() only visits the
+ * slots of the ticks that passed, so a connection's deadline costs the
+ * same whether there are ten connections or a hundred thousand.
+ *
+ * Deadlines are rounded up to whole ticks, so a timer never fires early
+ * and at most a tick late. Deadlines past the top level's range are
+ * parked at its edge and moved on when they get there.
+ *
+ * Not thread-safe; owners lock around it or use it from one thread.
+ * Callbacks run inside advance() and may schedule or cancel timers,
+ * including their own.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+    // Identifies a scheduled timer; stale once it fired or was cancelled
+    using TimerId = Handle;
+
+    static constexpr TimerId NO_TIMER = NO_HANDLE;
+    static constexpr unsigned SLOT_BITS = 8;
+    static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;
+
+    /**
+     * Create a wheel
+     *
+     * @param tick Granularity of deadlines
+     * @param start The time of tick 0
+     * @throws std::invalid_argument if tick is not positive
+     */
+    explicit TimerWheel(Clock::duration tick, Clock::time_point start = Clock::now())
+        : tick_(tick)
+        , start_(start) {
+        if (tick <= Clock::duration::zero()) {
+            throw std::invalid_argument("Timer wheel tick must be positive");
+        }
+        heads_.fill(NO_TIMER);
+    }
+
+    /**
+     * Run a callback once a deadline has passed
+     *
+     * @param deadline When to run it; a time already passed runs it on the next advance()
+     * @param callback What to run
+     * @return The timer's ID, for reschedule() and cancel()
+     */
+    TimerId schedule(Clock::time_point deadline, Callback callback) {
+        const TimerId id = timers_.insert(Timer{tickOf(deadline), std::move(callback)});
+        link(id, current_ + 1);
+        return id;
+    }
+
+    // Run a callback a delay after the wheel's current time
+    TimerId scheduleAfter(Clock::duration delay, Callback callback) {
+        return schedule(now() + delay, std::move(callback));
+    }
+
+    /**
+     * Move a timer to a new deadline, keeping its callback
+     *
+     * @param id The timer
+     * @param deadline The new deadline
+     * @return False if the timer already fired or was cancelled
+     */
+    bool reschedule(TimerId id, Clock::time_point deadline) {
+        Timer* timer = timers_.find(id);
+        if (!timer) {
+            return false;
+        }
+        unlink(id);
+        timer->expires = tickOf(deadline);
+        link(id, current_ + 1);
+        return true;
+    }
+
+    /**
+     * Cancel a timer
+     *
+     * @param id The timer
+     * @return False if the timer already fired or was cancelled
+     */
+    bool cancel(TimerId id) {
+        if (!timers_.find(id)) {
+            return false;
+        }
+        unlink(id);
+        timers_.erase(id);
+        return true;
+    }
+
+    /**
+     * Advance to a time, running the callbacks of every timer due by then
+     *
+     * @param now The current time
+     * @return Number of callbacks run
+     */
+    size_t advance(Clock::time_point now) {
+        const uint64_t target = elapsedTicks(now);
+        size_t fired = 0;
+        while (current_ < target) {
+            // Ticks with nothing to cascade or expire are skipped: when the lowest levels are
+            // empty, jump to just before the next boundary of the first level that is not
+            size_t level = 0;
+            while (level < LEVELS && levelSizes_[level] == 0) {
+                ++level;
+            }
+            if (level == LEVELS) {
+                current_ = target;
+                break;
+            }
+            if (level > 0) {
+                current_ = std::min(current_ | ((uint64_t{1} << (SLOT_BITS * level)) - 1), target);
+                if (current_ == target) {
+                    break;
+                }
+            }
+            ++current_;
+            for (size_t level = 1; level < LEVELS; ++level) {
+                const uint64_t mask = (uint64_t{1} << (SLOT_BITS * level)) - 1;
+                if ((current_ & mask) != 0) {
+                    break;
+                }
+                cascade(level, (current_ >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+            fired += expire(current_ & (SLOTS - 1));
+        }
+        return fired;
+    }
+
+    // The time the wheel has advanced to
+    Clock::time_point now() const {
+        return start_ + tick_ * static_cast<Clock::rep>(current_);
+    }
+
+    Clock::duration getTick() const { return tick_; }
+    size_t size() const { return timers_.size(); }
+    bool empty() const { return timers_.empty(); }
+
+private:
+    struct Timer {
+        uint64_t expires;  // Tick the timer is due at
+        Callback callback;
+        size_t slot = 0;   // Index into heads_
+        TimerId prev = NO_TIMER;
+        TimerId next = NO_TIMER;
+    };
+
+    uint64_t elapsedTicks(Clock::time_point time) const {
+        return time <= start_ ? 0 : static_cast<uint64_t>((time - start_) / tick_);
+    }
+
+    // Round up, so a timer never fires before its deadline
+    uint64_t tickOf(Clock::time_point deadline) const {
+        if (deadline <= start_) {
+            return 0;
+        }
+        const auto elapsed = deadline - start_;
+        const uint64_t ticks = static_cast<uint64_t>(elapsed / tick_);
+        return elapsed % tick_ == Clock::duration::zero() ? ticks : ticks + 1;
+    }
+
+    /**
+     * Link a timer into the slot of its deadline
+     *
+     * @param id The timer
+     * @param earliest The first tick whose slot is still to be visited: the next one, or the
+     *                 current one while advance() cascades into it
+     */
+    void link(TimerId id, uint64_t earliest) {
+        Timer& timer = *timers_.find(id);
+        uint64_t expires = std::max(timer.expires, earliest);
+        uint64_t delta = expires - current_;
+        const uint64_t range = uint64_t{1} << (SLOT_BITS * LEVELS);
+        if (delta >= range) {
+            expires = current_ + range - 1;
+            delta = range - 1;
+        }
+        size_t level = 0;
+        while (delta >= (uint64_t{1} << (SLOT_BITS * (level + 1)))) {
+            ++level;
+        }
+        timer.slot = level * SLOTS + ((expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+        timer.prev = NO_TIMER;
+        timer.next = heads_[timer.slot];
+        if (timer.next != NO_TIMER) {
+            timers_.find(timer.next)->prev = id;
+        }
+        heads_[timer.slot] = id;
+        ++levelSizes_[level];
+    }
+
+    void unlink(TimerId id) {
+        Timer& timer = *timers_.find(id);
+        if (timer.prev != NO_TIMER) {
+            timers_.find(timer.prev)->next = timer.next;
+        } else {
+            heads_[timer.slot] = timer.next;
+        }
+        if (timer.next != NO_TIMER) {
+            timers_.find(timer.next)->prev = timer.prev;
+        }
+        timer.prev = NO_TIMER;
+        timer.next = NO_TIMER;
+        --levelSizes_[timer.slot / SLOTS];
+    }
+
+    // Spread a slot of a higher level over the levels below
+    void cascade(size_t level, size_t index) {
+        TimerId id = std::exchange(heads_[level * SLOTS + index], NO_TIMER);
+        while (id != NO_TIMER) {
+            Timer& timer = *timers_.find(id);
+            const TimerId next = timer.next;
+            --levelSizes_[level];
+            link(id, current_);
+            id = next;
+        }
+    }
+
+    size_t expire(size_t index) {
+        size_t fired = 0;
+        // A callback may cancel or add timers in this slot, so take one at a time
+        for (TimerId id; (id = heads_[index]) != NO_TIMER;) {
+            Timer* timer = timers_.find(id);
+            unlink(id);
+            if (timer->expires > current_) {
+                // Parked at the edge of the range; not due yet
+                link(id, current_ + 1);
+                if (heads_[index] == id) {
+                    break;
+                }
+                continue;
+            }
+            Callback callback = std::move(timer->callback);
+            timers_.erase(id);
+            callback();
+            ++fired;
+        }
+        return fired;
+    }
+
+    Clock::duration tick_;
+    Clock::time_point start_;
+    uint64_t current_ = 0;
+    HandleTable<Timer> timers_;
+    // First timer of each slot, level by level
+    std::array<TimerId, SLOTS * LEVELS> heads_;
+    // Timers linked into each level
+    std::array<size_t, LEVELS> levelSizes_{};
+};
+
+} // namespace util
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_TIMER_WHEEL_H
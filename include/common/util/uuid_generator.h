@@ -1,17 +1,106 @@
 #ifndef COLLABORATIVE_EDITOR_UUID_GENERATOR_H
 #define COLLABORATIVE_EDITOR_UUID_GENERATOR_H
 
-#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <random>
-#include <sstream>
-#include <iomanip>
-#include <mutex>
+#include <string>
+#include <string_view>
 
 namespace collab {
 namespace util {
 
 /**
- * A simple UUID generator class
+ * A 128-bit UUID, for maps keyed by session or operation ID without strings
+ */
+struct Uuid {
+    // Characters in the text form, xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+    static constexpr size_t TEXT_SIZE = 36;
+
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    /**
+     * Write the text form, in lower-case hex
+     *
+     * @param out At least TEXT_SIZE characters; no terminator is written
+     */
+    void toChars(char* out) const {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        size_t pos = 0;
+        for (int nibble = 0; nibble < 32; ++nibble) {
+            if (nibble == 8 || nibble == 12 || nibble == 16 || nibble == 20) {
+                out[pos++] = '-';
+            }
+            const uint64_t word = nibble < 16 ? high : low;
+            out[pos++] = DIGITS[(word >> (60 - 4 * (nibble % 16))) & 0xF];
+        }
+    }
+
+    std::string toString() const {
+        std::string text(TEXT_SIZE, '\0');
+        toChars(text.data());
+        return text;
+    }
+
+    /**
+     * Parse the text form, in either case
+     *
+     * @param text The UUID text
+     * @return The UUID, or nothing if the text is not one
+     */
+    static std::optional<Uuid> fromString(std::string_view text) {
+        if (text.size() != TEXT_SIZE) {
+            return std::nullopt;
+        }
+        Uuid uuid;
+        int nibble = 0;
+        for (size_t pos = 0; pos < TEXT_SIZE; ++pos) {
+            const char c = text[pos];
+            if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+                if (c != '-') {
+                    return std::nullopt;
+                }
+                continue;
+            }
+            uint64_t value;
+            if (c >= '0' && c <= '9') {
+                value = static_cast<uint64_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value = static_cast<uint64_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value = static_cast<uint64_t>(c - 'A' + 10);
+            } else {
+                return std::nullopt;
+            }
+            uint64_t& word = nibble < 16 ? uuid.high : uuid.low;
+            word = (word << 4) | value;
+            ++nibble;
+        }
+        return uuid;
+    }
+
+    bool isNil() const { return high == 0 && low == 0; }
+
+    friend bool operator==(const Uuid& a, const Uuid& b) { return a.high == b.high && a.low == b.low; }
+    friend bool operator!=(const Uuid& a, const Uuid& b) { return !(a == b); }
+    friend bool operator<(const Uuid& a, const Uuid& b) {
+        return a.high != b.high ? a.high < b.high : a.low < b.low;
+    }
+};
+
+/**
+ * Generator of random (version 4) UUIDs
+ *
+ * Each thread has its own xoshiro256** generator, seeded once from
+ * std::random_device, so generating takes no lock and threads minting IDs
+ * at the same time, as in a burst of reconnects, never wait on each other.
+ * Text is formatted by hand, without streams.
+ *
+ * The IDs are unique, not secret: the generator is not cryptographically
+ * secure, so they must not serve as credentials.
  */
 class UuidGenerator {
 public:
@@ -20,63 +109,84 @@ public:
         static UuidGenerator instance;
         return instance;
     }
-    
+
     // Generate a new UUID
+    Uuid generate() {
+        Random& random = threadRandom();
+        Uuid uuid{random.next(), random.next()};
+        // Version 4 in the top nibble of the third group, variant 10 in the top bits of the fourth
+        uuid.high = (uuid.high & ~uint64_t{0xF000}) | uint64_t{0x4000};
+        uuid.low = (uuid.low & ~(uint64_t{0x3} << 62)) | (uint64_t{0x2} << 62);
+        return uuid;
+    }
+
+    // Generate a new UUID in its text form
     std::string generateUuid() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        std::stringstream ss;
-        
-        // Format: xxxxxxxx-xxxx-4xxx-yxxx-xxxxxxxxxxxx
-        // where y is one of: 8, 9, a, b
-        
-        // First 8 hex digits
-        ss << std::hex << std::setfill('0') << std::setw(8) << random();
-        ss << "-";
-        
-        // Next 4 hex digits
-        ss << std::hex << std::setfill('0') << std::setw(4) << (random() & 0xFFFF);
-        ss << "-";
-        
-        // Version 4 (random) UUID
-        ss << "4" << std::hex << std::setfill('0') << std::setw(3) << (random() & 0x0FFF);
-        ss << "-";
-        
-        // Variant bits (y)
-        uint32_t variantBits = random();
-        ss << std::hex << std::setfill('0') << std::setw(1) << ((variantBits & 0x3) + 8);
-        ss << std::hex << std::setfill('0') << std::setw(3) << ((variantBits >> 2) & 0x0FFF);
-        ss << "-";
-        
-        // Last 12 hex digits
-        ss << std::hex << std::setfill('0') << std::setw(12) << random();
-        
-        return ss.str();
+        return generate().toString();
     }
-    
+
 private:
-    // Private constructor for singleton
-    UuidGenerator() {
-        std::random_device rd;
-        rng_.seed(rd());
+    // xoshiro256**, by Blackman and Vigna
+    class Random {
+    public:
+        Random() {
+            std::random_device device;
+            uint64_t seed = (static_cast<uint64_t>(device()) << 32) | device();
+            for (uint64_t& word : state_) {
+                word = splitMix(seed);
+            }
+        }
+
+        uint64_t next() {
+            const uint64_t result = rotate(state_[1] * 5, 7) * 9;
+            const uint64_t t = state_[1] << 17;
+            state_[2] ^= state_[0];
+            state_[3] ^= state_[1];
+            state_[1] ^= state_[2];
+            state_[0] ^= state_[3];
+            state_[2] ^= t;
+            state_[3] = rotate(state_[3], 45);
+            return result;
+        }
+
+    private:
+        static uint64_t rotate(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        // Spreads one seed over the state, as the xoshiro authors recommend
+        static uint64_t splitMix(uint64_t& seed) {
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        uint64_t state_[4];
+    };
+
+    static Random& threadRandom() {
+        thread_local Random random;
+        return random;
     }
-    
+
+    // Private constructor for singleton
+    UuidGenerator() = default;
+
     // Disallow copying
     UuidGenerator(const UuidGenerator&) = delete;
     UuidGenerator& operator=(const UuidGenerator&) = delete;
-    
-    // Generate a random 32-bit integer
-    uint32_t random() {
-        return dist_(rng_);
-    }
-    
-private:
-    std::mt19937 rng_;
-    std::uniform_int_distribution<uint32_t> dist_{0, UINT32_MAX};
-    std::mutex mutex_;
 };
 
 } // namespace util
 } // namespace collab
 
-#endif // COLLABORATIVE_EDITOR_UUID_GENERATOR_H
\ No newline at end of file
+template <>
+struct std::hash<collab::util::Uuid> {
+    size_t operator()(const collab::util::Uuid& uuid) const noexcept {
+        // The bits are random already; fold them
+        return static_cast<size_t>(uuid.high ^ (uuid.low * 0x9E3779B97F4A7C15ULL));
+    }
+};
+
+#endif // COLLABORATIVE_EDITOR_UUID_GENERATOR_H
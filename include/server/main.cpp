@@ -1,16 +1,42 @@
 // FILE: src/server/main.cpp
 // Description: Main entry point for server application
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <filesystem>
 #include <iostream>
 #include <string>
 #include <map>
 #include <memory>
+#include <optional>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include "common/document/document_controller.h"
 #include "common/document/operation_manager.h"
 #include "common/ot/operation.h"
+#include "common/ot/operation_coalescer.h"
+#include "common/ot/write_ahead_log.h"
+#include "common/protocol/edit_trace.h"
+#include "common/protocol/protocol.h"
+#include "common/util/buffer_pool.h"
+#include "common/util/logger.h"
+#include "common/util/memory_accounting.h"
+#include "common/util/metrics.h"
+#include "common/util/thread_profiler.h"
+#include "server/metrics_endpoint.h"
+#include "server/session/ack_coalescer.h"
+#include "server/session/batch_window_controller.h"
+#include "server/session/bulk_editor.h"
+#include "server/session/edit_latency_tracker.h"
+#include "server/session/flow_credits.h"
+#include "server/session/load_tracker.h"
+#include "server/session/open_response_cache.h"
+#include "server/session/self_test.h"
+#include "server/session/view_feed.h"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -18,14 +44,104 @@ namespace websocket = beast::websocket;
 namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
 
+// What to do with a client whose outbound queue is full
+enum class BackpressurePolicy {
+    Coalesce,   // Merge the queued operations into net operations; disconnect if that is not enough
+    Disconnect  // Disconnect the client at once
+};
+
+// Limits on how far a slow client may fall behind
+struct OutboundLimits {
+    size_t maxQueueDepth = 256;  // Queued messages per client, including the one being written
+    BackpressurePolicy policy = BackpressurePolicy::Coalesce;
+};
+
+// Outbound queue metrics, summed over all clients
+struct OutboundStats {
+    size_t queuedMessages = 0;       // Messages waiting or being written
+    size_t deepestQueue = 0;         // Depth of the longest queue right now
+    size_t peakQueueDepth = 0;       // Deepest any queue has been
+    uint64_t coalescedMessages = 0;  // Queued messages merged away under backpressure
+    uint64_t slowDisconnects = 0;    // Clients disconnected for falling behind
+    uint64_t resyncs = 0;            // Clients out of credits whose queued edits were dropped for a fresh document
+};
+
+// Where applied edits are logged; an empty directory keeps the document in memory only
+struct PersistenceOptions {
+    std::filesystem::path directory;
+    bool ackWhenDurable = false;  // Answer each edit with EDIT_APPLY once it is on disk
+};
+
+// Where the edit path reports its latencies; looked up once, recorded lock-free
+struct EditMetrics {
+    collab::util::Histogram& decodeTime;
+    collab::util::Histogram& applyTime;
+    collab::util::Histogram& broadcastTime;
+    collab::util::Histogram& queueDepth;
+    collab::util::Counter& applied;
+    collab::util::Counter& rejected;
+    collab::util::Gauge& clients;
+    
+    static EditMetrics registered(collab::util::MetricsRegistry& registry = collab::util::metrics()) {
+        using collab::util::NANOSECONDS_PER_SECOND;
+        return EditMetrics{
+            registry.histogram("collab_op_decode_seconds", "Time to parse and decode an incoming operation", {},
+                               NANOSECONDS_PER_SECOND),
+            registry.histogram("collab_op_apply_seconds", "Time to apply a transformed operation to the document", {},
+                               NANOSECONDS_PER_SECOND),
+            registry.histogram("collab_broadcast_seconds", "Time to queue an applied operation for every other client",
+                               {}, NANOSECONDS_PER_SECOND),
+            registry.histogram("collab_write_queue_depth", "Depth of a client's outbound queue as a message joins it"),
+            registry.counter("collab_ops_applied_total", "Operations applied to the document"),
+            registry.counter("collab_ops_rejected_total", "Operations dropped as too far behind or not applicable"),
+            registry.gauge("collab_connected_clients", "Clients connected over WebSocket")};
+    }
+};
+
 // A simple WebSocket server that handles collaborative editing operations
 class CollaborativeEditingServer {
 public:
-    CollaborativeEditingServer(net::io_context& ioc, uint16_t port)
-        : acceptor_(ioc, {tcp::v4(), port}),
+    CollaborativeEditingServer(net::io_context& ioc, uint16_t port, OutboundLimits limits = {},
+                               PersistenceOptions persistence = {})
+        : ioc_(ioc),
+          acceptor_(ioc, {tcp::v4(), port}),
           socket_(ioc),
-          documentController_(std::make_shared<collab::DocumentController>()),
-          operationManager_(std::make_shared<collab::OperationManager>()) {
+          operationManager_(std::make_shared<collab::OperationManager>()),
+          limits_(limits),
+          metrics_(EditMetrics::registered()),
+          persistence_(std::move(persistence)),
+          bulkEditor_(
+              [this](const std::string& documentId) -> std::optional<collab::server::BulkEditor::Target> {
+                  if (documentId != DOCUMENT_ID) {
+                      return std::nullopt;
+                  }
+                  return collab::server::BulkEditor::Target{documentController_.get(), operationManager_.get(), walBase_};
+              },
+              [this](const std::string&, const std::string& clientId, const collab::ot::OperationPtr& op, uint64_t) {
+                  metrics_.applied.add();
+                  // Answered by the bulk editor as applied, rather than once durable
+                  persist(clientId, op, false);
+                  broadcastOperation(clientId, op, collab::protocol::EditTrace{});
+              }),
+          viewTimer_(ioc),
+          hibernateTimer_(ioc),
+          batchTimer_(ioc) {
+        
+        // Recover the document from its log, which from then on is written by the commit thread
+        std::string content;
+        if (!persistence_.directory.empty()) {
+            groupCommit_ = std::make_unique<collab::ot::GroupCommit>();
+            wal_ = std::make_unique<collab::ot::WriteAheadLog>(persistence_.directory, DOCUMENT_ID, *groupCommit_);
+            content = wal_->recovery().content.toString();
+            walBase_ = wal_->revision();
+        }
+        documentController_ = std::make_shared<collab::DocumentController>(content);
+        scheduleHibernation();
+        
+        // View diffs wait no longer than the broadcast latency allows, and not at all on a quiet document
+        viewWindow_ = batchWindows_.addWindow("view", collab::server::ViewFeed::DEFAULT_INTERVAL,
+                                              &metrics_.broadcastTime);
+        scheduleBatchWindows();
         
         // Start accepting connections
         doAccept();
@@ -33,35 +149,151 @@ public:
         std::cout << "Server running on port " << port << std::endl;
     }
     
+    // Get the current outbound queue metrics
+    OutboundStats getOutboundStats() const {
+        OutboundStats stats = stats_;
+        for (const auto& [clientId, client] : clients_) {
+            stats.queuedMessages += client.queue.size();
+            stats.deepestQueue = std::max(stats.deepestQueue, client.queue.size());
+        }
+        return stats;
+    }
+    
+    // Get the operation log length and the client holding its watermark back
+    collab::OperationManager::WatermarkStats getWatermarkStats() const {
+        return operationManager_->getWatermarkStats();
+    }
+    
+    // Get how far the log lags behind the edits, if edits are persisted
+    std::optional<collab::ot::WriteAheadLog::Stats> getPersistenceStats() const {
+        if (!wal_) {
+            return std::nullopt;
+        }
+        return wal_->getStats();
+    }
+    
+    // Get where the document's edits spend their time: network, transform or fan-out
+    collab::server::EditLatencyTracker::Breakdown getEditLatency() const {
+        return editLatency_.breakdown(DOCUMENT_ID);
+    }
+    
+    // Take the sampled edit traces, as an OTLP/JSON export request
+    std::string exportTraces() {
+        return editLatency_.exportOtlpJson();
+    }
+    
+    // Get what loads the server, by document and by user, for an admin query
+    nlohmann::json getLoadReport(size_t limit = 10) {
+        const auto document = documentController_->getLoadStats();
+        load_.updateFootprint(DOCUMENT_ID, operationManager_->getLoadStats().transformNanos,
+                              document.historyLength, document.memoryBytes);
+        return load_.report(limit);
+    }
+    
+    // Get the batching windows and the latency they were last set from, for an admin query
+    nlohmann::json getBatchWindows() const {
+        return batchWindows_.report();
+    }
+    
+    // Get the number of messages queued for one client
+    size_t getQueueDepth(const std::string& clientId) const {
+        auto it = clients_.find(clientId);
+        return it != clients_.end() ? it->second.queue.size() : 0;
+    }
+    
 private:
+    using WebSocket = websocket::stream<tcp::socket>;
+    
+    // The one document this server edits
+    static constexpr const char* DOCUMENT_ID = "document";
+    
+    // How long the document goes unedited before it is compressed in memory, and how often that is checked
+    static constexpr auto HIBERNATE_AFTER = std::chrono::minutes(10);
+    static constexpr auto HIBERNATE_CHECK = std::chrono::minutes(1);
+    
+    // How often batching windows follow load and latency
+    static constexpr auto BATCH_WINDOW_UPDATE = std::chrono::seconds(1);
+    
+    // A message waiting to be written; the text is shared by every client it goes to
+    // op is null for a message that is not an operation, e.g. an acknowledgement
+    // body, if set, is the rest of the message after data, shared with other clients, e.g. a cached document
+    struct Outbound {
+        std::shared_ptr<const std::string> data;
+        collab::ot::OperationPtr op;
+        std::shared_ptr<const std::string> body;
+    };
+    
+    // A connected client and the messages not yet written to it
+    // Read buffer whose memory comes from the shared pool and goes back between messages
+    using ReadBuffer = beast::basic_flat_buffer<collab::util::PoolAllocator<char>>;
+    
+    struct Client {
+        std::shared_ptr<WebSocket> ws;
+        // The front is being written while writing is set
+        std::deque<Outbound> queue;
+        bool writing = false;
+        bool viewer = false;    // Subscribed to view only: sent a diff per interval, not every edit
+        collab::server::AckCoalescer acks;  // Durable edits not yet acknowledged
+        collab::server::FlowCredits credits;  // What the client lets the server send it
+        bool resync = false;    // Queued edits were dropped; the document goes out with the next credits
+    };
+    
+    net::io_context& ioc_;
     tcp::acceptor acceptor_;
     tcp::socket socket_;
     std::shared_ptr<collab::DocumentController> documentController_;
     std::shared_ptr<collab::OperationManager> operationManager_;
-    std::map<std::string, std::shared_ptr<websocket::stream<tcp::socket>>> clients_;
+    std::map<std::string, Client> clients_;
+    OutboundLimits limits_;
+    OutboundStats stats_;
+    EditMetrics metrics_;
+    collab::server::EditLatencyTracker editLatency_;
+    collab::server::LoadTracker load_;
+    collab::server::BatchWindowController batchWindows_{load_};
+    collab::server::BatchWindowController::WindowId viewWindow_ = 0;
+    uint64_t nextClientId_ = 1;
+    
+    PersistenceOptions persistence_;
+    std::unique_ptr<collab::ot::GroupCommit> groupCommit_;  // Outlives the log it writes
+    std::unique_ptr<collab::ot::WriteAheadLog> wal_;
+    int64_t walBase_ = 0;                                   // Log revision of the document's revision 0
+    std::atomic<bool> snapshotQueued_{false};
+    collab::server::BulkEditor bulkEditor_;                 // Applies EDIT_BULK requests
+    collab::server::ViewFeed viewFeed_;                     // Coalesces edits for view-only clients
+    collab::server::OpenResponseCache openResponses_;       // The document encoded for DOC_OPEN, per revision
+    net::steady_timer viewTimer_;
+    net::steady_timer hibernateTimer_;
+    net::steady_timer batchTimer_;
+    bool viewFlushArmed_ = false;
+    bool ackFlushPosted_ = false;
     
     void doAccept() {
         acceptor_.async_accept(socket_,
             [this](boost::system::error_code ec) {
                 if (!ec) {
                     // Create a new WebSocket session
-                    std::cout << "New client connected" << std::endl;
+                    LOGF_RATE_LIMITED(collab::util::LogLevel::INFO, 5, "connect", "New client connected");
                     
                     // Create WebSocket from the raw socket
-                    auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket_));
+                    auto ws = std::make_shared<WebSocket>(std::move(socket_));
                     
                     // Accept the WebSocket handshake
                     ws->async_accept(
                         [this, ws](boost::system::error_code ec) {
                             if (!ec) {
                                 // Generate a client ID
-                                std::string clientId = "client_" + std::to_string(clients_.size() + 1);
+                                std::string clientId = "client_" + std::to_string(nextClientId_++);
                                 
                                 // Store the client
-                                clients_[clientId] = ws;
+                                clients_[clientId].ws = ws;
+                                metrics_.clients.add();
+                                load_.setSubscribers(DOCUMENT_ID, clients_.size());
+                                
+                                // It starts from the current document, so the log keeps what it needs from here
+                                operationManager_->acknowledgeRevision(clientId, documentController_->getRevision());
                                 
                                 // Start reading from this client
-                                doRead(clientId, ws);
+                                doRead(clientId, ws, std::make_shared<ReadBuffer>());
                             }
                         });
                 }
@@ -71,26 +303,34 @@ private:
             });
     }
     
-    void doRead(const std::string& clientId, std::shared_ptr<websocket::stream<tcp::socket>> ws) {
-        // Create a buffer for reading
-        auto buffer = std::make_shared<beast::flat_buffer>();
-        
-        // Read a message into our buffer
+    void doRead(const std::string& clientId, std::shared_ptr<WebSocket> ws, std::shared_ptr<ReadBuffer> buffer) {
+        // Read a message into the client's buffer; it outlives the client if that is dropped meanwhile
         ws->async_read(*buffer,
             [this, clientId, ws, buffer](boost::system::error_code ec, std::size_t bytes) {
                 if (!ec) {
                     // Convert the buffer to a string
                     std::string message(boost::asio::buffer_cast<const char*>(buffer->data()), buffer->size());
                     
+                    // Hand the memory back to the pool while the client is quiet
+                    buffer->clear();
+                    buffer->shrink_to_fit();
+                    
                     // Process the message
                     processMessage(clientId, message);
                     
                     // Continue reading
-                    doRead(clientId, ws);
+                    doRead(clientId, ws, buffer);
                 } else {
-                    // Handle disconnect
-                    std::cout << "Client " << clientId << " disconnected" << std::endl;
-                    clients_.erase(clientId);
+                    // Handle disconnect, unless the client was already dropped for falling behind
+                    auto it = clients_.find(clientId);
+                    if (it != clients_.end() && it->second.ws == ws) {
+                        LOGF_RATE_LIMITED(collab::util::LogLevel::INFO, 5, "disconnect", "Client {} disconnected", clientId);
+                        clients_.erase(it);
+                        metrics_.clients.sub();
+                        load_.setSubscribers(DOCUMENT_ID, clients_.size());
+                        viewFeed_.removeViewer(clientId);
+                        reclaimHistory(operationManager_->removeClient(clientId));
+                    }
                 }
             });
     }
@@ -101,56 +341,646 @@ private:
         // 2. Base revision
         
         // For this example, we'll assume the message is the serialized operation
+        const uint64_t received = collab::protocol::traceNowMicros();
         try {
-            // Parse the operation
-            auto op = collab::ot::OperationFactory::deserialize(message);
+            collab::ot::OperationPtr op;
+            collab::protocol::EditTrace trace;
+            {
+                collab::util::ScopedTimer timer(metrics_.decodeTime);
+                
+                // Protocol messages carry a numeric type, operations a named one
+                auto json = nlohmann::json::parse(message);
+                if (json.at("type").is_number_integer()) {
+                    processProtocolMessage(clientId, json);
+                    return;
+                }
+                if (isViewer(clientId)) {
+                    metrics_.rejected.add();
+                    return;
+                }
+                
+                // Parse the operation, and the trace context it may carry
+                op = collab::ot::OperationFactory::deserialize(message);
+                trace = collab::protocol::EditTrace::fromJson(json);
+                trace.serverReceiveTime = received;
+                editLatency_.sample(trace);
+            }
+            load_.recordOperation(DOCUMENT_ID, clientId, message.size());
             
             // Base revision would be included in the message
             int64_t baseRevision = documentController_->getRevision();
             
             // Process operation through the operation manager
             auto transformedOp = operationManager_->processOperation(op, clientId, baseRevision);
+            trace.transformTime = collab::protocol::traceNowMicros();
             
             // Apply the transformed operation to the document
-            if (transformedOp && documentController_->applyOperation(transformedOp, clientId)) {
-                // Record the operation
-                operationManager_->recordOperation(transformedOp);
-                
-                // Broadcast to all other clients
-                broadcastOperation(clientId, transformedOp);
+            bool applied = false;
+            if (transformedOp) {
+                collab::util::ScopedTimer timer(metrics_.applyTime);
+                applied = documentController_->applyOperation(transformedOp, clientId);
+            }
+            if (!applied) {
+                metrics_.rejected.add();
+                return;
+            }
+            metrics_.applied.add();
+            
+            // Record the operation
+            operationManager_->recordOperation(transformedOp);
+            persist(clientId, transformedOp);
+            
+            // Broadcast to all other clients
+            {
+                collab::util::ScopedTimer timer(metrics_.broadcastTime);
+                trace.broadcastTime = collab::protocol::traceNowMicros();
+                broadcastOperation(clientId, transformedOp, trace);
             }
+            editLatency_.record(DOCUMENT_ID, clientId, trace, collab::protocol::traceNowMicros());
         } catch (const std::exception& e) {
-            std::cerr << "Error processing message: " << e.what() << std::endl;
+            LOGF_RATE_LIMITED(collab::util::LogLevel::WARNING, 5, clientId, "Error processing message from {}: {}",
+                              clientId, e.what());
+        }
+    }
+    
+    // Queue an applied edit for the log; no file I/O happens on this thread
+    void persist(const std::string& clientId, const collab::ot::OperationPtr& op, bool acknowledge = true) {
+        if (!wal_) {
+            return;
+        }
+        const int64_t revision = walBase_ + documentController_->getRevision();
+        collab::ot::WriteAheadLog::DurableCallback onDurable;
+        if (acknowledge && persistence_.ackWhenDurable) {
+            // The document as of this revision, for the client to check its copy against
+            const uint64_t contentHash = documentController_->getContentHashes().root;
+            onDurable = [this, clientId, revision, contentHash](bool durable) {
+                // Runs on the commit thread; the clients belong to this one
+                net::post(ioc_, [this, clientId, revision, contentHash, durable] {
+                    acknowledgeEdit(clientId, revision, contentHash, durable);
+                });
+            };
+        }
+        try {
+            wal_->append(revision, *op, std::move(onDurable));
+            if (wal_->wantsSnapshot() && !snapshotQueued_.exchange(true)) {
+                wal_->snapshotAsync(documentController_->getSnapshot().content, revision,
+                                    [this](bool) { snapshotQueued_ = false; });
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error logging revision " << revision << ": " << e.what() << std::endl;
+        }
+    }
+    
+    // Tell a client its edit is on disk, or could not be written
+    // Edits made durable by one group commit are acknowledged together, up to the last of them
+    void acknowledgeEdit(const std::string& clientId, int64_t revision, uint64_t contentHash, bool durable) {
+        auto it = clients_.find(clientId);
+        if (it == clients_.end()) {
+            return;
+        }
+        if (durable) {
+            it->second.acks.acknowledge(DOCUMENT_ID, 0, static_cast<uint64_t>(revision), contentHash);
+            if (!ackFlushPosted_) {
+                ackFlushPosted_ = true;
+                net::post(ioc_, [this] { flushAcknowledgements(); });
+            }
+            return;
+        }
+        // The edits before it are durable, and are told so first
+        if (!sendAcknowledgements(clientId, it->second)) {
+            disconnectSlowClient(clientId);
+            return;
+        }
+        collab::protocol::EditMessage ack(collab::protocol::MessageType::EDIT_APPLY);
+        ack.documentVersion = static_cast<uint64_t>(revision);
+        ack.success = false;
+        ack.errorMessage = "The edit could not be persisted";
+        if (!enqueue(clientId, it->second, {std::make_shared<const std::string>(ack.toString()), nullptr})) {
+            disconnectSlowClient(clientId);
+        }
+    }
+    
+    // Send every client its cumulative acknowledgement, once per turn of the event loop
+    void flushAcknowledgements() {
+        ackFlushPosted_ = false;
+        std::vector<std::string> slowClients;
+        for (auto& [clientId, client] : clients_) {
+            if (!sendAcknowledgements(clientId, client)) {
+                slowClients.push_back(clientId);
+            }
+        }
+        for (const auto& clientId : slowClients) {
+            disconnectSlowClient(clientId);
+        }
+    }
+    
+    // Queue a client's pending acknowledgement, if any; false if the client is too far behind
+    bool sendAcknowledgements(const std::string& clientId, Client& client) {
+        for (const auto& ack : client.acks.take()) {
+            if (!enqueue(clientId, client, {std::make_shared<const std::string>(ack.toString()), nullptr})) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void processProtocolMessage(const std::string& clientId, const nlohmann::json& json) {
+        using collab::protocol::MessageType;
+        const auto type = static_cast<MessageType>(json.at("type").get<int>());
+        if (type == MessageType::SYNC_REQUEST) {
+            answerDivergenceProbe(clientId, collab::protocol::Message::fromJson<collab::protocol::SyncMessage>(json));
+            return;
+        }
+        if (type == MessageType::EDIT_BULK) {
+            if (isViewer(clientId)) {
+                metrics_.rejected.add();
+                return;
+            }
+            applyBulkEdit(clientId, collab::protocol::Message::fromJson<collab::protocol::BatchMessage>(json));
+            return;
+        }
+        if (type == MessageType::DOC_OPEN) {
+            openDocument(clientId, collab::protocol::Message::fromJson<collab::protocol::DocumentMessage>(json));
+            return;
+        }
+        if (type != MessageType::SYNC_ACK) {
+            return;
+        }
+        
+        // The client has applied everything up to toVersion, and may take more
+        auto ack = collab::protocol::Message::fromJson<collab::protocol::SyncMessage>(json);
+        if (ack.toVersion) {
+            reclaimHistory(operationManager_->acknowledgeRevision(clientId, static_cast<int64_t>(*ack.toVersion)));
+        }
+        if (ack.creditFrames || ack.creditBytes) {
+            grantCredits(clientId, ack.creditFrames.value_or(0), ack.creditBytes.value_or(0));
+        }
+    }
+    
+    // Let a client be sent more, first the document if its queued edits were dropped
+    void grantCredits(const std::string& clientId, uint64_t frames, uint64_t bytes) {
+        auto it = clients_.find(clientId);
+        if (it == clients_.end()) {
+            return;
+        }
+        Client& client = it->second;
+        client.credits.grant(frames, bytes);
+        if (client.resync) {
+            client.resync = false;
+            collab::protocol::DocumentMessage request(collab::protocol::MessageType::DOC_OPEN);
+            request.documentId = DOCUMENT_ID;
+            request.metadata[collab::server::ViewFeed::SUBSCRIPTION_KEY] = collab::server::ViewFeed::EDIT_SUBSCRIPTION;
+            openDocument(clientId, request);
+            return;
         }
+        if (!client.writing && !client.queue.empty() && client.credits.canSend()) {
+            doWrite(clientId, client);
+        }
+    }
+    
+    // Answer a client looking for where its copy diverged: the hashes of the ends it asks for, or a range of the text
+    void answerDivergenceProbe(const std::string& clientId, const collab::protocol::SyncMessage& request) {
+        auto it = clients_.find(clientId);
+        if (it == clients_.end() || !(request.prefixLength || request.suffixLength || request.rangeOffset)) {
+            return;
+        }
+        collab::protocol::SyncMessage response(collab::protocol::MessageType::SYNC_RESPONSE);
+        response.documentId = request.documentId;
+        response.sequenceNumber = request.sequenceNumber;
+        response.success = true;
+        if (request.rangeOffset) {
+            const auto snapshot = documentController_->getSnapshot();
+            response.toVersion = static_cast<uint64_t>(walBase_ + snapshot.revision);
+            response.contentLength = snapshot.content.length();
+            response.rangeOffset = std::min(*request.rangeOffset, snapshot.content.length());
+            response.documentState = snapshot.content.substr(*response.rangeOffset, request.rangeLength.value_or(std::string::npos));
+            response.rangeLength = response.documentState->size();
+        } else {
+            const auto hashes = documentController_->getContentHashes(request.prefixLength.value_or(0),
+                                                                      request.suffixLength.value_or(0));
+            response.toVersion = static_cast<uint64_t>(walBase_ + hashes.revision);
+            response.contentHash = hashes.root;
+            response.contentLength = hashes.length;
+            if (request.prefixLength) {
+                response.prefixLength = request.prefixLength;
+                response.prefixHash = hashes.prefix;
+            }
+            if (request.suffixLength) {
+                response.suffixLength = request.suffixLength;
+                response.suffixHash = hashes.suffix;
+            }
+        }
+        if (!enqueue(clientId, it->second, {std::make_shared<const std::string>(response.toString()), nullptr})) {
+            disconnectSlowClient(clientId);
+        }
+    }
+    
+    // Apply a client's bulk edit and answer it per document
+    void applyBulkEdit(const std::string& clientId, const collab::protocol::BatchMessage& request) {
+        bulkEditor_.apply(clientId, request, [this, &clientId](const collab::protocol::EditMessage& result) {
+            if (!result.success.value_or(false)) {
+                metrics_.rejected.add();
+            }
+            auto it = clients_.find(clientId);
+            if (it != clients_.end() && !enqueue(clientId, it->second, {std::make_shared<const std::string>(result.toString()), nullptr})) {
+                disconnectSlowClient(clientId);
+            }
+        });
+    }
+    
+    bool isViewer(const std::string& clientId) const {
+        auto it = clients_.find(clientId);
+        return it != clients_.end() && it->second.viewer;
+    }
+    
+    /**
+     * Send a client the document, as an editor or, with metadata "subscription" "view", as a viewer
+     * A viewer is sent a diff of the document per interval rather than
+     * every edit, and may not edit; it acknowledges nothing, so the log
+     * keeps no history for it. Opening the document again as an editor
+     * makes the client one again, from the revision it is sent.
+     */
+    void openDocument(const std::string& clientId, const collab::protocol::DocumentMessage& request) {
+        using collab::server::ViewFeed;
+        auto it = clients_.find(clientId);
+        if (it == clients_.end()) {
+            return;
+        }
+        Client& client = it->second;
+        const auto subscription = request.metadata.find(ViewFeed::SUBSCRIPTION_KEY);
+        const bool view = subscription != request.metadata.end() && subscription->second == ViewFeed::VIEW_SUBSCRIPTION;
+        const auto snapshot = documentController_->getSnapshot();
+        if (view && !client.viewer) {
+            client.viewer = true;
+            // The other viewers' pending diff goes out before this one has the document past it
+            if (auto pending = viewFeed_.subscribe(DOCUMENT_ID, clientId, snapshot.content.length())) {
+                sendViewDiffs({std::move(*pending)});
+            }
+            reclaimHistory(operationManager_->removeClient(clientId));
+        } else if (!view && client.viewer) {
+            client.viewer = false;
+            viewFeed_.unsubscribe(DOCUMENT_ID, clientId);
+            operationManager_->acknowledgeRevision(clientId, snapshot.revision);
+        }
+        
+        collab::protocol::DocumentMessage response(collab::protocol::MessageType::DOC_RESPONSE);
+        response.documentId = request.documentId;
+        response.sequenceNumber = request.sequenceNumber;
+        auto found = clients_.find(clientId);
+        if (found == clients_.end()) {
+            return;
+        }
+        
+        // Everyone opening at one revision shares one encoding; an editor may also take the edits since
+        const std::string variant = view ? ViewFeed::VIEW_SUBSCRIPTION : ViewFeed::EDIT_SUBSCRIPTION;
+        const int64_t revision = walBase_ + snapshot.revision;
+        auto cached = openResponses_.find(request.documentId, variant, revision, !view);
+        if (!cached) {
+            response.success = true;
+            response.documentContent = snapshot.content.toString();
+            response.documentVersion = static_cast<uint64_t>(revision);
+            response.metadata[ViewFeed::SUBSCRIPTION_KEY] = variant;
+            auto body = collab::server::OpenResponseCache::bodyOf(response.toString());
+            openResponses_.store(request.documentId, variant, revision, body);
+            cached = collab::server::OpenResponseCache::Hit{revision, std::move(body), {}};
+        }
+        auto head = std::make_shared<const std::string>(collab::server::OpenResponseCache::headOf(response.toString()));
+        bool queued = enqueue(clientId, found->second, {std::move(head), nullptr, cached->body});
+        for (size_t i = 0; queued && i < cached->tail.size(); ++i) {
+            queued = enqueue(clientId, found->second, {cached->tail[i], nullptr});
+        }
+        if (!queued) {
+            disconnectSlowClient(clientId);
+        }
+    }
+    
+    // Arm the view timer for the next diff that falls due
+    void scheduleViewFlush() {
+        if (viewFlushArmed_) {
+            return;
+        }
+        const auto next = viewFeed_.nextFlush();
+        if (!next) {
+            return;
+        }
+        viewFlushArmed_ = true;
+        viewTimer_.expires_at(*next);
+        viewTimer_.async_wait([this](boost::system::error_code ec) {
+            viewFlushArmed_ = false;
+            if (ec) {
+                return;
+            }
+            sendViewDiffs(viewFeed_.flush());
+            scheduleViewFlush();
+        });
+    }
+    
+    // Compress the document once it has gone unedited for HIBERNATE_AFTER; the next edit wakes it
+    void scheduleHibernation() {
+        hibernateTimer_.expires_after(HIBERNATE_CHECK);
+        hibernateTimer_.async_wait([this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            if (documentController_->hibernateIfIdle(HIBERNATE_AFTER)) {
+                // The cached open response is a copy of the text
+                openResponses_.invalidate(DOCUMENT_ID);
+            }
+            scheduleHibernation();
+        });
+    }
+    
+    // Set the batching windows from the document's operation rate and the latency since the last update
+    void scheduleBatchWindows() {
+        batchTimer_.expires_after(BATCH_WINDOW_UPDATE);
+        batchTimer_.async_wait([this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            batchWindows_.update();
+            viewFeed_.setInterval(batchWindows_.window(viewWindow_, DOCUMENT_ID));
+            scheduleBatchWindows();
+        });
+    }
+    
+    // Send each diff to its viewers, serialized once with the revision it brings them to
+    void sendViewDiffs(const std::vector<collab::server::ViewFeed::Diff>& diffs) {
+        std::vector<std::string> slowClients;
+        uint64_t bytesOut = 0;
+        for (const auto& diff : diffs) {
+            auto json = nlohmann::json::parse(diff.op->serialize());
+            json["revision"] = diff.revision;
+            auto message = std::make_shared<const std::string>(json.dump());
+            for (const auto& viewerId : diff.viewers) {
+                auto it = clients_.find(viewerId);
+                if (it == clients_.end()) {
+                    continue;
+                }
+                bytesOut += message->size();
+                // Not an operation to the queue: diffs are already as coalesced as they get
+                if (!enqueue(viewerId, it->second, {message, nullptr})) {
+                    slowClients.push_back(viewerId);
+                }
+            }
+        }
+        load_.recordBytesOut(DOCUMENT_ID, bytesOut);
+        for (const auto& clientId : slowClients) {
+            disconnectSlowClient(clientId);
+        }
+    }
+    
+    // Release the history every client has acknowledged, keeping a checkpoint in its place
+    void reclaimHistory(int64_t lowWatermark) {
+        documentController_->compactBefore(lowWatermark);
     }
     
-    void broadcastOperation(const std::string& sourceClientId, const collab::ot::OperationPtr& op) {
-        // Serialize the operation
-        std::string message = op->serialize();
+    void broadcastOperation(const std::string& sourceClientId, const collab::ot::OperationPtr& op,
+                            const collab::protocol::EditTrace& trace) {
+        // Serialize the operation once for every client; a sampled one takes its stamps along
+        auto message = std::make_shared<const std::string>(op->serialize());
+        openResponses_.append(DOCUMENT_ID, walBase_ + documentController_->getRevision(), message);
+        if (trace.sampled()) {
+            auto json = nlohmann::json::parse(*message);
+            trace.writeTo(json);
+            message = std::make_shared<const std::string>(json.dump());
+        }
+        
+        // Queue for all clients except the source; none waits for another's socket
+        // Viewers get the edit in their next diff instead
+        std::vector<std::string> slowClients;
+        uint64_t bytesOut = 0;
+        for (auto& [clientId, client] : clients_) {
+            if (clientId == sourceClientId || client.viewer) {
+                continue;
+            }
+            bytesOut += message->size();
+            if (!enqueue(clientId, client, {message, op})) {
+                slowClients.push_back(clientId);
+            }
+        }
+        load_.recordBytesOut(DOCUMENT_ID, bytesOut);
+        for (const auto& clientId : slowClients) {
+            disconnectSlowClient(clientId);
+        }
         
-        // Send to all clients except the source
-        for (const auto& [clientId, ws] : clients_) {
-            if (clientId != sourceClientId) {
-                try {
-                    ws->write(net::buffer(message));
-                } catch (const std::exception& e) {
-                    std::cerr << "Error sending to client " << clientId << ": " << e.what() << std::endl;
+        if (viewFeed_.hasViewers(DOCUMENT_ID)) {
+            try {
+                if (viewFeed_.record(DOCUMENT_ID, *op, walBase_ + documentController_->getRevision())) {
+                    scheduleViewFlush();
                 }
+            } catch (const std::invalid_argument& e) {
+                LOGF_RATE_LIMITED(collab::util::LogLevel::WARNING, 5, "view-feed", "Edit not sent to viewers: {}", e.what());
             }
         }
     }
+    
+    /**
+     * Queue a message for a client and start writing if it is idle and has credits
+     * 
+     * @param clientId The client's ID
+     * @param client The client
+     * @param message The message
+     * @return False if the client is too far behind and must be disconnected
+     */
+    bool enqueue(const std::string& clientId, Client& client, Outbound message) {
+        if (client.resync && message.op) {
+            // The document the client is sent next has this edit
+            return true;
+        }
+        client.queue.push_back(std::move(message));
+        metrics_.queueDepth.record(client.queue.size());
+        if (client.queue.size() > limits_.maxQueueDepth &&
+            (limits_.policy == BackpressurePolicy::Disconnect || !coalesceQueue(client)) && !awaitResync(client)) {
+            return false;
+        }
+        stats_.peakQueueDepth = std::max(stats_.peakQueueDepth, client.queue.size());
+        if (!client.writing && client.credits.canSend()) {
+            doWrite(clientId, client);
+        }
+        return true;
+    }
+    
+    // Drop the queued edits of a client that is out of credits, to send it the document once it grants more;
+    // true if that brought the queue within its limit
+    bool awaitResync(Client& client) {
+        if (client.credits.canSend()) {
+            return false;
+        }
+        const size_t first = client.writing ? 1 : 0;
+        const size_t before = client.queue.size();
+        client.queue.erase(std::remove_if(client.queue.begin() + first, client.queue.end(),
+                                          [](const Outbound& message) { return message.op != nullptr; }),
+                           client.queue.end());
+        stats_.coalescedMessages += before - client.queue.size();
+        client.resync = true;
+        ++stats_.resyncs;
+        return client.queue.size() <= limits_.maxQueueDepth;
+    }
+    
+    // Merge the client's waiting operations into net ones; true if that brought the queue within its limit
+    bool coalesceQueue(Client& client) {
+        // The message being written must stay where it is
+        const size_t first = client.writing ? 1 : 0;
+        collab::ot::OperationCoalescer coalescer;
+        std::vector<Outbound> others;
+        for (size_t i = first; i < client.queue.size(); ++i) {
+            if (client.queue[i].op) {
+                coalescer.push(client.queue[i].op);
+            } else {
+                others.push_back(std::move(client.queue[i]));
+            }
+        }
+        const size_t before = client.queue.size();
+        client.queue.erase(client.queue.begin() + first, client.queue.end());
+        for (auto& op : coalescer.flush()) {
+            client.queue.push_back({std::make_shared<const std::string>(op->serialize()), op});
+        }
+        // Acknowledgements only say an edit is stored, so they can follow the merged operations
+        for (auto& other : others) {
+            client.queue.push_back(std::move(other));
+        }
+        stats_.coalescedMessages += before - client.queue.size();
+        return client.queue.size() <= limits_.maxQueueDepth;
+    }
+    
+    // Write the message at the front of the client's queue, then the next, until it is empty or out of credits
+    void doWrite(const std::string& clientId, Client& client) {
+        client.writing = true;
+        const Outbound& next = client.queue.front();
+        client.credits.spend(next.data->size() + (next.body ? next.body->size() : 0));
+        auto ws = client.ws;
+        std::array<net::const_buffer, 2> buffers{net::buffer(*next.data), net::const_buffer()};
+        if (next.body) {
+            buffers[1] = net::buffer(*next.body);
+        }
+        ws->async_write(buffers,
+            [this, clientId, ws, data = next.data, body = next.body](boost::system::error_code ec, std::size_t) {
+                // The client may have been dropped while the write was in flight
+                auto it = clients_.find(clientId);
+                if (it == clients_.end() || it->second.ws != ws) {
+                    return;
+                }
+                if (ec) {
+                    LOGF_RATE_LIMITED(collab::util::LogLevel::WARNING, 5, ec.message(), "Error sending to client {}: {}",
+                                      it->first, ec.message());
+                    it->second.queue.clear();
+                    it->second.writing = false;
+                    return;
+                }
+                Client& client = it->second;
+                client.queue.pop_front();
+                if (client.queue.empty() || !client.credits.canSend()) {
+                    client.writing = false;
+                } else {
+                    doWrite(clientId, client);
+                }
+            });
+    }
+    
+    // Drop a client that cannot keep up, so it stops holding memory for everyone else's edits
+    void disconnectSlowClient(const std::string& clientId) {
+        auto it = clients_.find(clientId);
+        if (it == clients_.end()) {
+            return;
+        }
+        LOGF_RATE_LIMITED(collab::util::LogLevel::WARNING, 5, "slow-client", "Disconnecting slow client {} with {} queued messages",
+                          clientId, it->second.queue.size());
+        boost::system::error_code ec;
+        beast::get_lowest_layer(*it->second.ws).close(ec);
+        clients_.erase(it);
+        metrics_.clients.sub();
+        load_.setSubscribers(DOCUMENT_ID, clients_.size());
+        viewFeed_.removeViewer(clientId);
+        ++stats_.slowDisconnects;
+        reclaimHistory(operationManager_->removeClient(clientId));
+    }
 };
 
-// Main entry point for the server
-int main() {
+// Render the memory each subsystem holds, for an admin query
+std::string memoryReport() {
+    nlohmann::json subsystems = nlohmann::json::array();
+    for (const auto& usage : collab::util::memoryUsage()) {
+        subsystems.push_back({{"tag", usage.tag},
+                              {"liveBytes", usage.liveBytes},
+                              {"allocatedBytes", usage.allocatedBytes},
+                              {"allocations", usage.allocations}});
+    }
+    return nlohmann::json{{"subsystems", std::move(subsystems)}}.dump();
+}
+
+// Sample every thread's CPU for a while, then answer with the collapsed stacks, of one role or all
+void startProfile(net::io_context& ioc, const collab::server::MetricsEndpoint::Query& query,
+                  const collab::server::MetricsEndpoint::Respond& respond) {
+    using collab::server::MetricsEndpoint;
+    const long seconds = MetricsEndpoint::queryNumber(query, "seconds", 5);
+    if (seconds < 1 || seconds > 60) {
+        throw std::invalid_argument("seconds must be 1 to 60");
+    }
+    const long hz = MetricsEndpoint::queryNumber(query, "hz", collab::util::SamplingProfiler::DEFAULT_HZ);
+    auto role = query.find("role");
+    collab::util::profiler().start(hz > 0 ? static_cast<unsigned>(hz) : 0);
+    
+    // The I/O thread keeps serving while the profile runs, so it is sampled doing its work
+    auto timer = std::make_shared<net::steady_timer>(ioc, std::chrono::seconds(seconds));
+    timer->async_wait([timer, respond, role = role != query.end() ? role->second : std::string()](
+                          boost::system::error_code) {
+        const auto profile = collab::util::profiler().stop();
+        respond(role.empty() ? profile.collapsed() : profile.collapsed(role));
+    });
+}
+
+// Put synthetic load on this node's edit path and print what it sustained
+int runSelfTest(const std::vector<std::string>& args) {
+    const auto options = collab::server::SelfTestOptions::parse(args);
+    const auto report = collab::server::SelfTest(options).run();
+    const bool json = std::find(args.begin(), args.end(), "--json") != args.end();
+    std::cout << (json ? report.toJson().dump(2) + "\n" : report.toString());
+    return report.edits > 0 ? 0 : 1;
+}
+
+// Main entry point for the server: server [data directory [--ack-durable]]
+// or, to measure the node before it takes traffic,
+// server --selftest [--documents=N] [--clients=N] [--document-size=N] [--edit-rate=N]
+//                   [--presence-ratio=F] [--seconds=N] [--seed=N] [--json]
+int main(int argc, char* argv[]) {
+    // Keep console output off the I/O thread
+    collab::util::getLogger().startAsync();
     try {
+        if (argc > 1 && std::string(argv[1]) == "--selftest") {
+            return runSelfTest(std::vector<std::string>(argv + 1, argv + argc));
+        }
+        
         // Create an I/O context
         net::io_context ioc{1};
         
+        PersistenceOptions persistence;
+        if (argc > 1) {
+            persistence.directory = argv[1];
+            persistence.ackWhenDurable = argc > 2 && std::string(argv[2]) == "--ack-durable";
+        }
+        
         // Create and run the server
-        CollaborativeEditingServer server(ioc, 9002);
+        CollaborativeEditingServer server(ioc, 9002, {}, persistence);
+        
+        // Metrics are optional; the server runs without them if the port is taken
+        std::unique_ptr<collab::server::MetricsEndpoint> metrics;
+        try {
+            metrics = std::make_unique<collab::server::MetricsEndpoint>(ioc, 9102);
+            metrics->addRoute("/v1/traces", "application/json", [&server] { return server.exportTraces(); });
+            metrics->addRoute("/admin/load", "application/json", [&server] { return server.getLoadReport().dump(); });
+            metrics->addRoute("/admin/memory", "application/json", memoryReport);
+            metrics->addAsyncRoute("/admin/profile", "text/plain", [&ioc](const auto& query, const auto& respond) {
+                startProfile(ioc, query, respond);
+            });
+            std::cout << "Metrics on port 9102 at /metrics, sampled edit traces at /v1/traces, "
+                      << "load by document and user at /admin/load, memory by subsystem at /admin/memory, "
+                      << "CPU profiles at /admin/profile?seconds=N[&hz=N][&role=R]" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Metrics endpoint not started: " << e.what() << std::endl;
+        }
         
-        // Run the I/O service
+        // Run the I/O service; this thread is the server's I/O thread
+        collab::util::profiler().registerCurrentThread("io", "io-main");
         ioc.run();
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
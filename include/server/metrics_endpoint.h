@@ -0,0 +1,207 @@
+#ifndef COLLABORATIVE_EDITOR_METRICS_ENDPOINT_H
+#define COLLABORATIVE_EDITOR_METRICS_ENDPOINT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "common/util/metrics.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Serves the metrics registry over HTTP for Prometheus to scrape
+ *
+ * GET /metrics answers with the Prometheus text format, and other paths
+ * with what addRoute() set up for them, e.g. exported traces; anything
+ * else is a 404. A route that throws answers 400 for an invalid_argument
+ * and 500 otherwise, with the message. One request per connection,
+ * answered on the io_context it runs on; rendering reads the metrics
+ * without stopping whoever records them.
+ */
+class MetricsEndpoint {
+public:
+    // Parameters of the query string, e.g. {"seconds": "5"} for ?seconds=5; not percent-decoded
+    using Query = std::map<std::string, std::string>;
+    // Sends the answer; call once, on the io_context's thread
+    using Respond = std::function<void(std::string body)>;
+
+    /**
+     * Start listening
+     *
+     * @param ioc Where the connections are served
+     * @param port The port, e.g. 9102
+     * @param registry The metrics to serve
+     * @throws boost::system::system_error if the port cannot be bound
+     */
+    MetricsEndpoint(boost::asio::io_context& ioc, uint16_t port, util::MetricsRegistry& registry = util::metrics())
+        : acceptor_(ioc, {boost::asio::ip::tcp::v4(), port}) {
+        addRoute("/metrics", "text/plain; version=0.0.4; charset=utf-8",
+                 [&registry] { return registry.renderPrometheus(); });
+        doAccept();
+    }
+
+    /**
+     * Answer GET requests for a path with what a function renders
+     * Set up before the io_context runs; it is called on that thread
+     *
+     * @param path The path, e.g. "/v1/traces"
+     * @param contentType The Content-Type of the answer
+     * @param render Renders the body
+     */
+    void addRoute(const std::string& path, std::string contentType, std::function<std::string()> render) {
+        addAsyncRoute(path, std::move(contentType), [render = std::move(render)](const Query&, const Respond& respond) {
+            respond(render());
+        });
+    }
+
+    /**
+     * Answer GET requests for a path when a function is done, e.g. after a timer
+     * The io_context keeps serving meanwhile
+     *
+     * @param path The path, without a query string
+     * @param contentType The Content-Type of the answer
+     * @param handle Called with the query and what sends the answer
+     */
+    void addAsyncRoute(const std::string& path, std::string contentType,
+                       std::function<void(const Query&, const Respond&)> handle) {
+        routes_[path] = Route{std::move(contentType), std::move(handle)};
+    }
+
+    /**
+     * Read a whole-number query parameter
+     *
+     * @param query The query
+     * @param name The parameter
+     * @param fallback Value when it is absent
+     * @return The value
+     * @throws std::invalid_argument if it is not a whole number
+     */
+    static long queryNumber(const Query& query, const std::string& name, long fallback) {
+        auto it = query.find(name);
+        if (it == query.end()) {
+            return fallback;
+        }
+        size_t used = 0;
+        long value = 0;
+        try {
+            value = std::stol(it->second, &used);
+        } catch (const std::exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != it->second.size()) {
+            throw std::invalid_argument(name + " must be a whole number");
+        }
+        return value;
+    }
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    uint16_t port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    struct Route {
+        std::string contentType;
+        std::function<void(const Query&, const Respond&)> handle;
+    };
+
+    struct Exchange {
+        explicit Exchange(boost::asio::ip::tcp::socket socket) : socket(std::move(socket)) {}
+
+        boost::asio::ip::tcp::socket socket;
+        boost::beast::flat_buffer buffer;
+        boost::beast::http::request<boost::beast::http::empty_body> request;
+        boost::beast::http::response<boost::beast::http::string_body> response;
+    };
+
+    void doAccept() {
+        acceptor_.async_accept([this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec) {
+                serve(std::make_shared<Exchange>(std::move(socket)));
+            }
+            doAccept();
+        });
+    }
+
+    void serve(std::shared_ptr<Exchange> exchange) {
+        namespace http = boost::beast::http;
+        http::async_read(exchange->socket, exchange->buffer, exchange->request,
+            [this, exchange](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    return;
+                }
+                const std::string_view target(exchange->request.target().data(), exchange->request.target().size());
+                const size_t question = target.find('?');
+                auto route = routes_.find(std::string(target.substr(0, question)));
+                if (exchange->request.method() != http::verb::get || route == routes_.end()) {
+                    reply(exchange, http::status::not_found, "text/plain", "Not found\n");
+                    return;
+                }
+                const Query query = question != std::string_view::npos ? parseQuery(target.substr(question + 1)) : Query{};
+                try {
+                    route->second.handle(query, [exchange, contentType = route->second.contentType](std::string body) {
+                        reply(exchange, http::status::ok, contentType, std::move(body));
+                    });
+                } catch (const std::invalid_argument& e) {
+                    reply(exchange, http::status::bad_request, "text/plain", std::string(e.what()) + "\n");
+                } catch (const std::exception& e) {
+                    reply(exchange, http::status::internal_server_error, "text/plain", std::string(e.what()) + "\n");
+                }
+            });
+    }
+
+    static void reply(const std::shared_ptr<Exchange>& exchange, boost::beast::http::status status,
+                      const std::string& contentType, std::string body) {
+        namespace http = boost::beast::http;
+        http::response<http::string_body>& response = exchange->response;
+        response.version(exchange->request.version());
+        response.keep_alive(false);
+        response.result(status);
+        response.set(http::field::content_type, contentType);
+        response.body() = std::move(body);
+        response.prepare_payload();
+        http::async_write(exchange->socket, response, [exchange](boost::system::error_code, std::size_t) {
+            boost::system::error_code ignored;
+            exchange->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+        });
+    }
+
+    static Query parseQuery(std::string_view text) {
+        Query query;
+        while (!text.empty()) {
+            const size_t end = std::min(text.find('&'), text.size());
+            const std::string_view pair = text.substr(0, end);
+            const size_t equals = pair.find('=');
+            if (!pair.empty()) {
+                query[std::string(pair.substr(0, equals))] =
+                    equals != std::string_view::npos ? std::string(pair.substr(equals + 1)) : std::string();
+            }
+            text.remove_prefix(std::min(end + 1, text.size()));
+        }
+        return query;
+    }
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::map<std::string, Route> routes_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_METRICS_ENDPOINT_H
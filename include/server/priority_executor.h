@@ -0,0 +1,224 @@
+#ifndef COLLABORATIVE_EDITOR_PRIORITY_EXECUTOR_H
+#define COLLABORATIVE_EDITOR_PRIORITY_EXECUTOR_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "server/thread_pool.h"
+
+namespace collab {
+namespace server {
+
+// Classes of work, most urgent first
+enum class Lane {
+    Interactive,  // Edits and other requests a user is waiting on
+    Bulk,         // Opening and syncing whole documents
+    Maintenance   // Background sweeps such as idle session checks
+};
+
+constexpr size_t LANE_COUNT = 3;
+
+// Load statistics of one lane
+struct LaneStats {
+    size_t depth = 0;                           // Tasks waiting to start
+    size_t running = 0;                         // Tasks handed to the pool and not yet finished
+    size_t limit = 0;                           // Most tasks the lane may run at once
+    uint64_t completed = 0;                     // Tasks finished
+    std::chrono::microseconds totalWait{0};     // Time finished and running tasks spent waiting
+    std::chrono::microseconds maxWait{0};       // Longest wait of any task
+};
+
+/**
+ * Runs tasks on a ThreadPool in priority lanes
+ *
+ * Each lane is a FIFO queue with a limit on how many of its tasks run at
+ * once, and no more tasks are handed to the pool than it has workers.
+ * When a worker frees up it takes the next task of the most urgent lane
+ * that is under its limit. A burst of bulk work, such as many clients
+ * reopening large documents at once, then only ever occupies its share
+ * of the workers, and edits queued behind it start as soon as a worker
+ * is free.
+ *
+ * Tasks are handed to the pool as small stubs that take the lane's next
+ * task when they run, so scheduling allocates nothing beyond the lane
+ * queues themselves.
+ *
+ * Thread-safe. The destructor waits for the tasks already handed to the
+ * pool; tasks that have not started are dropped.
+ */
+class PriorityExecutor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Create an executor with the default limits: every worker for
+     * interactive work, half of them for bulk work and one for maintenance
+     *
+     * @param pool The pool to run tasks on; must outlive the executor
+     */
+    explicit PriorityExecutor(ThreadPool& pool)
+        : PriorityExecutor(pool, {pool.size(), std::max<size_t>(1, pool.size() / 2), 1}) {}
+
+    /**
+     * Create an executor
+     *
+     * @param pool The pool to run tasks on; must outlive the executor
+     * @param limits Most tasks of each lane running at once, by Lane
+     */
+    PriorityExecutor(ThreadPool& pool, const std::array<size_t, LANE_COUNT>& limits)
+        : pool_(pool) {
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            lanes_[i].limit = std::max<size_t>(1, limits[i]);
+        }
+    }
+
+    ~PriorityExecutor() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+        idle_.wait(lock, [this] { return inFlight_ == 0; });
+    }
+
+    PriorityExecutor(const PriorityExecutor&) = delete;
+    PriorityExecutor& operator=(const PriorityExecutor&) = delete;
+
+    /**
+     * Run a task once the lane's turn comes
+     *
+     * @param lane The lane
+     * @param task The task
+     */
+    void post(Lane lane, Task task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lanes_[index(lane)].queue.push_back(Queued{std::move(task), Clock::now()});
+        dispatch();
+    }
+
+    /**
+     * Change how many tasks of a lane may run at once
+     *
+     * @param lane The lane
+     * @param limit The new limit; at least 1
+     */
+    void setLimit(Lane lane, size_t limit) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lanes_[index(lane)].limit = std::max<size_t>(1, limit);
+        dispatch();
+    }
+
+    LaneStats getLaneStats(Lane lane) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const LaneState& state = lanes_[index(lane)];
+        LaneStats stats;
+        stats.depth = state.queue.size();
+        stats.running = state.dispatched + state.running;
+        stats.limit = state.limit;
+        stats.completed = state.completed;
+        stats.totalWait = std::chrono::duration_cast<std::chrono::microseconds>(state.totalWait);
+        stats.maxWait = std::chrono::duration_cast<std::chrono::microseconds>(state.maxWait);
+        return stats;
+    }
+
+    // Statistics of every lane, by Lane
+    std::array<LaneStats, LANE_COUNT> getStats() const {
+        std::array<LaneStats, LANE_COUNT> stats;
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            stats[i] = getLaneStats(static_cast<Lane>(i));
+        }
+        return stats;
+    }
+
+private:
+    struct Queued {
+        Task task;
+        Clock::time_point queuedAt;
+    };
+
+    struct LaneState {
+        std::deque<Queued> queue;
+        size_t limit = 1;
+        size_t dispatched = 0;  // Stubs handed to the pool that have not taken a task yet
+        size_t running = 0;
+        uint64_t completed = 0;
+        Clock::duration totalWait{0};
+        Clock::duration maxWait{0};
+    };
+
+    static size_t index(Lane lane) {
+        return static_cast<size_t>(lane);
+    }
+
+    // Hand stubs to the pool while workers are free; called with mutex_ held
+    void dispatch() {
+        while (!stopping_ && inFlight_ < pool_.size()) {
+            size_t lane = 0;
+            while (lane < LANE_COUNT && !ready(lanes_[lane])) {
+                ++lane;
+            }
+            if (lane == LANE_COUNT) {
+                return;
+            }
+            ++lanes_[lane].dispatched;
+            ++inFlight_;
+            pool_.post([this, lane]() { run(lane); });
+        }
+    }
+
+    static bool ready(const LaneState& state) {
+        return state.queue.size() > state.dispatched && state.dispatched + state.running < state.limit;
+    }
+
+    void run(size_t lane) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            LaneState& state = lanes_[lane];
+            Queued queued = std::move(state.queue.front());
+            state.queue.pop_front();
+            --state.dispatched;
+            ++state.running;
+            const Clock::duration wait = Clock::now() - queued.queuedAt;
+            state.totalWait += wait;
+            state.maxWait = std::max(state.maxWait, wait);
+            task = std::move(queued.task);
+        }
+        try {
+            task();
+        } catch (...) {
+            finished(lane);
+            throw;
+        }
+        finished(lane);
+    }
+
+    void finished(size_t lane) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        LaneState& state = lanes_[lane];
+        --state.running;
+        ++state.completed;
+        --inFlight_;
+        dispatch();
+        if (inFlight_ == 0) {
+            idle_.notify_all();
+        }
+    }
+
+    ThreadPool& pool_;
+    std::array<LaneState, LANE_COUNT> lanes_;
+    // Tasks handed to the pool and not yet finished, over all lanes
+    size_t inFlight_ = 0;
+    bool stopping_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_PRIORITY_EXECUTOR_H
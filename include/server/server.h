@@ -1,9 +1,17 @@
+#ifndef COLLABORATIVE_EDITOR_SERVER_H
+#define COLLABORATIVE_EDITOR_SERVER_H
+
+#include <algorithm>
+#include <iterator>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <unordered_map>
 #include <functional>
+#include <optional>
 #include <atomic>
 #include <thread>
 #include <mutex>
@@ -11,69 +19,23 @@
 #include <queue>
 #include <future>
 #include <csignal>
+#include <exception>
+#include <type_traits>
+#include <utility>
 #include <boost/asio.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include "common/network/admission_control.h"
+#include "common/util/buffer_pool.h"
+#include "common/util/logger.h"
+#include "common/util/timer_wheel.h"
+#include "server/priority_executor.h"
+#include "server/session/drain_schedule.h"
 #include "server/session_handler.h"
+#include "server/thread_pool.h"
 
 namespace collab {
 namespace server {
 
-class ThreadPool {
-public:
-    ThreadPool(size_t numThreads) : stop_(false) {
-        std::cout << "Creating thread pool with " << numThreads << " worker threads" << std::endl;
-        for (size_t i = 0; i < numThreads; ++i) {
-            workers_.emplace_back([this] {
-                for (;;) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex_);
-                        condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
-                        if (stop_ && tasks_.empty()) return;
-                        task = std::move(tasks_.front());
-                        tasks_.pop();
-                    }
-                    task();
-                }
-            });
-        }
-    }
-    ~ThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            stop_ = true;
-        }
-        condition_.notify_all();
-        for (std::thread& worker : workers_) {
-            if (worker.joinable()) worker.join();
-        }
-    }
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
-        using return_type = decltype(f(args...));
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-        std::future<return_type> result = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            if (stop_) throw std::runtime_error("enqueue on stopped ThreadPool");
-            tasks_.emplace([task]() { (*task)(); });
-        }
-        condition_.notify_one();
-        return result;
-    }
-    size_t size() const { return workers_.size(); }
-    size_t queueSize() const {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        return tasks_.size();
-    }
-private:
-    std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    mutable std::mutex queue_mutex_;
-    std::condition_variable condition_;
-    bool stop_;
-};
-
 class Server {
 public:
     explicit Server(
@@ -88,9 +50,13 @@ public:
           thread_pool_(threadPoolSize),
           session_handler_(),
           cleanup_timer_(io_context),
+          accept_timer_(io_context),
+          drain_timer_(io_context),
           session_cleanup_interval_(sessionCleanupIntervalSeconds),
           max_session_idle_(maxSessionIdleSeconds),
-          running_(true) {
+          idle_timers_(std::chrono::seconds(std::max(1, sessionCleanupIntervalSeconds))),
+          running_(true),
+          executor_(thread_pool_) {
         std::cout << "Server starting on port: " << port << " with " << thread_pool_.size() << " worker threads" << std::endl;
         setupSignalHandling();
         startSessionCleanup();
@@ -102,28 +68,88 @@ public:
         std::cout << "\nShutting down server..." << std::endl;
         boost::system::error_code ec;
         cleanup_timer_.cancel(ec);
+        accept_timer_.cancel(ec);
+        drain_timer_.cancel(ec);
         acceptor_.close(ec);
         if (ec) std::cerr << "Error closing acceptor: " << ec.message() << std::endl;
         std::cout << "Server shutdown complete" << std::endl;
     }
     bool isRunning() const { return running_.load(); }
     boost::asio::ip::tcp::endpoint getEndpoint() const { return acceptor_.local_endpoint(); }
+    // Handle a signal as if it had been delivered; cancelling the signal set would only abort the wait
     void simulateSignal(int signal_number) {
-        boost::system::error_code ec;
-        signals_.async_wait([this, signal_number](const boost::system::error_code& error, int) {
-            if (!error) {
-                std::cout << "\nSimulated signal " << signal_number << " received" << std::endl;
-                stop();
-            }
+        boost::asio::post(io_context_, [this, signal_number]() {
+            std::cout << "\nSimulated signal " << signal_number << " received" << std::endl;
+            stop();
         });
-        signals_.cancel(ec);
     }
     size_t getThreadPoolSize() const { return thread_pool_.size(); }
+    // Depth, running tasks and wait times of each executor lane, by Lane
+    std::array<LaneStats, LANE_COUNT> getExecutorStats() const { return executor_.getStats(); }
+    PriorityExecutor& getExecutor() { return executor_; }
     size_t getSessionCount() const { return session_handler_.getSessionCount(); }
+    /**
+     * Limit how new connections are admitted
+     *
+     * A connection is pending from its accept until its first request line
+     * and has no session until then. Without a handshake timeout, pending
+     * connections are closed when idle like any other.
+     *
+     * @param limits Accept rate and burst, most pending connections, and the time allowed for the first request
+     */
+    void setAdmissionLimits(const network::AdmissionControl::limits& limits) { admission_.set_limits(limits); }
+    network::AdmissionControl::stats getAdmissionStats() const { return admission_.get_stats(); }
     SessionHandler& getSessionHandler() { return session_handler_; }
     const SessionHandler& getSessionHandler() const { return session_handler_; }
+    /**
+     * Set how long the session of a connection that dropped is kept for RESUME
+     *
+     * A client logged in gets a resume token in its LOGIN reply. Its
+     * session outlives a connection error for the grace period, precise
+     * to the cleanup interval; a connection closed by the server, e.g. for
+     * being idle, ends it at once.
+     *
+     * @param grace The grace period; zero to end sessions as their connections drop
+     */
+    void setResumeGrace(std::chrono::seconds grace) { session_handler_.getResumption().setGrace(grace); }
+    /**
+     * Take the server out of service without its clients all reconnecting at once, e.g. for a deploy
+     *
+     * Stops accepting, then tells the connections to go in the waves of a
+     * DrainSchedule. A connection told answers the requests it read
+     * before and ignores those after, is sent "DISCONNECT: Reconnect to
+     * <hint> in <n> ms", with ". Resume token: <token>" if it is logged
+     * in, and closes, its session suspended for RESUME.
+     *
+     * @param options Where clients should reconnect, and the size and interval of the waves
+     * @param done Called on the io_context an interval after the last wave, e.g. to stop()
+     */
+    void drain(DrainSchedule::Options options, std::function<void()> done = {}) {
+        boost::asio::post(io_context_, [this, options = std::move(options), done = std::move(done)]() mutable {
+            if (!running_ || draining_.exchange(true)) return;
+            boost::system::error_code ec;
+            accept_timer_.cancel(ec);
+            acceptor_.close(ec);
+            std::vector<std::weak_ptr<Connection>> connections;
+            {
+                std::lock_guard<std::mutex> lock(connections_mutex_);
+                for (const auto& [connection, weak] : connections_) connections.push_back(weak);
+            }
+            const size_t count = connections.size();
+            drainWave(std::make_shared<Drain>(Drain{DrainSchedule(std::move(options), count),
+                                                    std::move(connections), std::move(done)}), 0);
+        });
+    }
+    bool isDraining() const { return draining_.load(); }
 private:
     class Connection;
+    // The connections a drain tells to go, in the order of its schedule
+    struct Drain {
+        DrainSchedule schedule;
+        std::vector<std::weak_ptr<Connection>> connections;
+        std::function<void()> done;
+    };
+    void drainWave(std::shared_ptr<Drain> drain, size_t wave);
     void setupSignalHandling() {
         signals_.async_wait([this](const boost::system::error_code& error, int signal_number) {
             if (!error) {
@@ -132,140 +158,606 @@ private:
             }
         });
     }
+    // Advance the connections' idle deadlines once per interval, in the maintenance lane;
+    // only those that fall due are looked at
     void startSessionCleanup() {
-        cleanup_timer_.expires_after(std::chrono::seconds(session_cleanup_interval_));
+        cleanup_timer_.expires_after(idle_timers_.getTick());
         cleanup_timer_.async_wait([this](const boost::system::error_code& error) {
             if (!error && running_) {
-                int cleanedCount = session_handler_.cleanupIdleSessions(max_session_idle_);
-                if (cleanedCount > 0) {
-                    std::cout << "Cleaned up " << cleanedCount << " idle sessions" << std::endl;
-                }
+                executor_.post(Lane::Maintenance, [this]() {
+                    {
+                        std::lock_guard<std::mutex> lock(idle_mutex_);
+                        idle_timers_.advance(util::TimerWheel::Clock::now());
+                    }
+                    session_handler_.expireSuspendedSessions();
+                });
                 startSessionCleanup();
             }
         });
     }
+    // Run a callback at a connection's idle deadline; it runs with idle_mutex_ held
+    util::TimerWheel::TimerId scheduleIdleCheck(util::TimerWheel::Clock::time_point deadline,
+                                                util::TimerWheel::Callback callback) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        return idle_timers_.schedule(deadline, std::move(callback));
+    }
+    void cancelIdleCheck(util::TimerWheel::TimerId id) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_timers_.cancel(id);
+    }
     void startAccept() {
+        if (!running_ || draining_) return;
+        // Wait for a token, or for a pending connection to finish, leaving the rest in the backlog
+        const auto wait = admission_.try_admit();
+        if (wait == network::AdmissionControl::WAIT_FOR_PENDING) {
+            accept_paused_ = true;
+            // In case the last pending connection finished meanwhile
+            if (admission_.pending() < admission_.get_limits().max_pending && accept_paused_.exchange(false)) {
+                boost::asio::post(io_context_, [this]() { startAccept(); });
+            }
+            return;
+        }
+        if (wait > network::AdmissionControl::clock::duration::zero()) {
+            accept_timer_.expires_after(wait);
+            accept_timer_.async_wait([this](const boost::system::error_code& error) {
+                if (!error) startAccept();
+            });
+            return;
+        }
         auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_context_);
         acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code& error) {
             if (!error && running_) {
                 handleNewConnection(socket);
                 if (running_) startAccept();
-            } else if (error && running_) {
-                std::cerr << "Accept error: " << error.message() << std::endl;
+            } else if (error && running_ && !draining_) {
+                LOGF_RATE_LIMITED(util::LogLevel::ERROR, 1, error.message(), "Accept error: {}", error.message());
                 if (running_) startAccept();
             }
         });
     }
     void handleNewConnection(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+    void forgetConnection(const Connection* connection) {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.erase(connection);
+    }
+    /**
+     * Run work in an executor lane and resume the caller on its own executor
+     * with the result, e.g. co_await onLane(Lane::Bulk, fn) from a connection's
+     * coroutine. An exception from the work is rethrown by co_await.
+     *
+     * @param lane The lane to run in
+     * @param fn The work; returns the result
+     * @param token Completion token, use_awaitable by default
+     */
+    template <typename Fn, typename CompletionToken = const boost::asio::use_awaitable_t<>&>
+    auto onLane(Lane lane, Fn fn, CompletionToken&& token = boost::asio::use_awaitable) {
+        using Result = std::invoke_result_t<Fn&>;
+        return boost::asio::async_initiate<CompletionToken, void(std::exception_ptr, Result)>(
+            [this, lane](auto handler, Fn fn) {
+                executor_.post(lane, [handler = std::move(handler), fn = std::move(fn)]() mutable {
+                    std::exception_ptr error;
+                    Result result{};
+                    try {
+                        result = fn();
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    auto executor = boost::asio::get_associated_executor(handler);
+                    boost::asio::post(executor, [handler = std::move(handler), error, result = std::move(result)]() mutable {
+                        std::move(handler)(error, std::move(result));
+                    });
+                });
+            },
+            token, std::move(fn));
+    }
+    // A pending connection sent its first request or closed
+    void finishHandshake() {
+        admission_.finish_handshake();
+        if (accept_paused_.exchange(false)) {
+            boost::asio::post(io_context_, [this]() { startAccept(); });
+        }
+    }
     boost::asio::io_context& io_context_;
     boost::asio::ip::tcp::acceptor acceptor_;
     boost::asio::signal_set signals_;
     ThreadPool thread_pool_;
     SessionHandler session_handler_;
     boost::asio::steady_timer cleanup_timer_;
+    // Accepts wait on the timer for a token, or pause until a pending connection finishes
+    network::AdmissionControl admission_;
+    boost::asio::steady_timer accept_timer_;
+    std::atomic<bool> accept_paused_{false};
+    // Open connections, for a drain to tell; each removes itself as it closes
+    std::unordered_map<const Connection*, std::weak_ptr<Connection>> connections_;
+    std::mutex connections_mutex_;
+    boost::asio::steady_timer drain_timer_;
+    std::atomic<bool> draining_{false};
     int session_cleanup_interval_;
     int max_session_idle_;
+    // One deadline per connection, precise to the cleanup interval
+    util::TimerWheel idle_timers_;
+    std::mutex idle_mutex_;
     std::atomic<bool> running_;
+    // Last, so it waits for its running tasks before the members they use go away
+    PriorityExecutor executor_;
 };
 
+/**
+ * One client of the text protocol
+ *
+ * Requests are lines, ending in "\n" (or "\r\n"), and each gets one
+ * reply line. The connection keeps reading while requests are processed,
+ * so a client may send many requests without waiting; they are handled
+ * one at a time in the order they arrived and answered in that order.
+ * Handlers run on the socket's executor.
+ *
+ * Three coroutines share the connection, all on the socket's executor:
+ * one reads and parses requests, one hands them to the executor and
+ * awaits the replies, and one writes. Each is spawned once, when the
+ * connection starts, so handling a request creates no coroutine frame,
+ * and each reads as straight-line code. They wake each other with
+ * Signals.
+ *
+ * An idle connection holds no read buffer: it waits for the socket to
+ * become readable, reads into a buffer from the shared BufferPool and
+ * hands it back once the data is parsed. Only a partial request line is
+ * kept between reads.
+ *
+ * The connection gets its session with its first request line; until
+ * then it is pending, as counted by the server's admission control.
+ *
+ * If the connection drops, its session is suspended rather than ended
+ * (see Server::setResumeGrace()). A client that sends "RESUME:<token>"
+ * on a new connection, with the token from its LOGIN reply, is logged in
+ * again with the documents it had open, each with the last revision it
+ * acknowledged, and gets a new token.
+ *
+ * A draining server tells the connection to go with a DISCONNECT line,
+ * after the replies to what it read before (see Server::drain()).
+ */
 class Server::Connection : public std::enable_shared_from_this<Connection> {
 public:
-    Connection(std::shared_ptr<boost::asio::ip::tcp::socket> socket, Server& server,
-               const std::string& sessionId, std::shared_ptr<UserSession> session)
-        : socket_(socket), server_(server), sessionId_(sessionId), session_(session), buffer_(8192) {}
+    // Longest request line; a longer one closes the connection
+    static constexpr size_t MAX_REQUEST_SIZE = 1 << 20;
+    // Requests waiting for the pool before reading pauses
+    static constexpr size_t MAX_QUEUED_REQUESTS = 1024;
+    // Bytes read at a time
+    static constexpr size_t READ_SIZE = 8192;
+
+    Connection(std::shared_ptr<boost::asio::ip::tcp::socket> socket, Server& server)
+        : socket_(socket), server_(server), handshake_timer_(socket->get_executor()),
+          requestsQueued_(socket->get_executor()), repliesQueued_(socket->get_executor()),
+          roomToRead_(socket->get_executor()) {}
     ~Connection() {}
     void start() {
+        // Reads only follow a readiness wait and must not block if the data is gone
+        boost::system::error_code ignored;
+        socket_->non_blocking(true, ignored);
+        const auto timeout = server_.admission_.get_limits().handshake_timeout;
+        if (timeout.count() > 0) {
+            watchHandshake(timeout);
+        } else {
+            watchIdle(std::chrono::steady_clock::now());
+        }
         auto self(shared_from_this());
-        socket_->async_read_some(boost::asio::buffer(buffer_),
-            [this, self](const boost::system::error_code& error, std::size_t bytes_transferred) {
-                if (!error) {
-                    processDataInThreadPool(bytes_transferred);
-                } else {
-                    handleError(error);
-                }
-            });
+        boost::asio::co_spawn(socket_->get_executor(), readRequests(self), boost::asio::detached);
+        boost::asio::co_spawn(socket_->get_executor(), processRequests(self), boost::asio::detached);
+        boost::asio::co_spawn(socket_->get_executor(), writeReplies(self), boost::asio::detached);
+    }
+    // Queue data for the client, after everything queued before it
+    void send(std::string data) {
+        outgoing_ += data;
+        repliesQueued_.notify();
     }
-    void send(const std::string& data) {
+    // Tell the client to reconnect after a delay, once the requests read so far are answered, and close
+    void drain(const std::string& reconnectHint, std::chrono::milliseconds delay) {
         auto self(shared_from_this());
-        boost::asio::async_write(*socket_, boost::asio::buffer(data),
-            [this, self](const boost::system::error_code& error, std::size_t) {
-                if (error) handleError(error);
-            });
+        boost::asio::post(socket_->get_executor(), [this, self, reconnectHint, delay]() {
+            if (closed_ || drainNotice_) {
+                return;
+            }
+            std::ostringstream notice;
+            notice << "DISCONNECT: Reconnect";
+            if (!reconnectHint.empty()) {
+                notice << " to " << reconnectHint;
+            }
+            notice << " in " << delay.count() << " ms";
+            if (session_ && session_->getState() == UserSession::State::AUTHENTICATED &&
+                !session_->getResumeToken().empty()) {
+                notice << ". Resume token: " << session_->getResumeToken();
+            }
+            drainNotice_ = notice.str();
+            repliesQueued_.notify();
+        });
     }
 private:
-    void processDataInThreadPool(std::size_t bytes_transferred) {
+    /**
+     * Wakes a coroutine of the connection waiting for something to do
+     *
+     * A timer that never expires on its own; notify() cancels the wait.
+     * Only one coroutine waits on a signal, and it checks its condition
+     * before waiting, so a notify() nobody waits for is not needed.
+     */
+    class Signal {
+    public:
+        explicit Signal(const boost::asio::any_io_executor& executor) : timer_(executor) {}
+        boost::asio::awaitable<void> wait() {
+            timer_.expires_at(boost::asio::steady_timer::time_point::max());
+            boost::system::error_code ignored;
+            co_await timer_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ignored));
+        }
+        void notify() {
+            timer_.cancel();
+        }
+    private:
+        boost::asio::steady_timer timer_;
+    };
+
+    // Read and parse requests until the connection closes
+    // self is never read; holding it keeps the connection alive while the coroutine runs
+    boost::asio::awaitable<void> readRequests([[maybe_unused]] std::shared_ptr<Connection> self) {
+        while (!closed_) {
+            if (queued_.size() >= MAX_QUEUED_REQUESTS) {
+                co_await roomToRead_.wait();
+                continue;
+            }
+            boost::system::error_code error;
+            co_await socket_->async_wait(boost::asio::ip::tcp::socket::wait_read,
+                                         boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            if (error) {
+                handleError(error);
+                co_return;
+            }
+            if (closed_) {
+                co_return;
+            }
+            util::BufferPool::Buffer buffer = util::BufferPool::local().acquire(READ_SIZE);
+            std::size_t bytes_transferred =
+                socket_->read_some(boost::asio::buffer(buffer.data(), buffer.size()), error);
+            if (error == boost::asio::error::would_block || error == boost::asio::error::try_again) {
+                continue;
+            }
+            if (error) {
+                handleError(error);
+                co_return;
+            }
+            if (!parseRequests(std::string_view(buffer.data(), bytes_transferred))) {
+                co_return;
+            }
+        }
+    }
+    // Hand the waiting requests to the executor, one lane's batch at a time, which keeps them in order
+    // self is never read; holding it keeps the connection alive while the coroutine runs
+    boost::asio::awaitable<void> processRequests([[maybe_unused]] std::shared_ptr<Connection> self) {
+        while (!closed_) {
+            if (queued_.empty()) {
+                co_await requestsQueued_.wait();
+                continue;
+            }
+            processing_ = true;
+            const Lane lane = laneOf(queued_.front());
+            auto end = std::find_if(queued_.begin(), queued_.end(),
+                [lane](const std::string& request) { return laneOf(request) != lane; });
+            std::vector<std::string> requests;
+            if (end == queued_.end()) {
+                requests.swap(queued_);
+            } else {
+                requests.assign(std::make_move_iterator(queued_.begin()), std::make_move_iterator(end));
+                queued_.erase(queued_.begin(), end);
+            }
+            roomToRead_.notify();
+            std::string replies = co_await server_.onLane(lane, [this, &requests]() {
+                std::string replies;
+                for (const auto& request : requests) {
+                    replies += processData(request);
+                    replies += '\n';
+                }
+                return replies;
+            });
+            processing_ = false;
+            send(std::move(replies));
+        }
+    }
+    // Write everything queued in one go; what is queued meanwhile goes out next
+    // self is never read; holding it keeps the connection alive while the coroutine runs
+    boost::asio::awaitable<void> writeReplies([[maybe_unused]] std::shared_ptr<Connection> self) {
+        while (!closed_) {
+            if (outgoing_.empty()) {
+                // Told to go: the notice follows the last reply, and the connection closes once it is out
+                if (drainNotice_ && queued_.empty() && !processing_) {
+                    if (drainNotice_->empty()) {
+                        close(true);
+                        co_return;
+                    }
+                    reply(*drainNotice_);
+                    drainNotice_->clear();
+                    continue;
+                }
+                co_await repliesQueued_.wait();
+                continue;
+            }
+            writing_buffer_.swap(outgoing_);
+            boost::system::error_code error;
+            co_await boost::asio::async_write(*socket_, boost::asio::buffer(writing_buffer_),
+                                              boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            writing_buffer_.clear();
+            if (error) {
+                handleError(error);
+                co_return;
+            }
+        }
+    }
+    // Handle every complete line in what was just read; false if the connection was closed
+    bool parseRequests(std::string_view chunk) {
+        // Lines are parsed straight from the read buffer unless a partial line is waiting
+        const bool buffered = !received_.empty();
+        if (buffered) {
+            received_.append(chunk);
+        }
+        const std::string_view input = buffered ? std::string_view(received_) : chunk;
+        size_t begin = 0;
+        for (size_t end; (end = input.find('\n', begin)) != std::string_view::npos; begin = end + 1) {
+            std::string_view request = input.substr(begin, end - begin);
+            if (!request.empty() && request.back() == '\r') {
+                request.remove_suffix(1);
+            }
+            if (!request.empty()) {
+                handleRequest(request);
+            }
+        }
+        if (input.size() - begin > MAX_REQUEST_SIZE) {
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, "request-too-long", "Request too long, closing connection");
+            close();
+            return false;
+        }
+        if (buffered) {
+            received_.erase(0, begin);
+        } else {
+            received_.assign(input.substr(begin));
+        }
+        if (received_.empty() && received_.capacity() > READ_SIZE) {
+            std::string().swap(received_);
+        }
+        return true;
+    }
+    // Session commands only touch the session table and are answered on the I/O thread
+    static bool isInlineCommand(std::string_view data) {
+        return data.starts_with("LOGIN:") || data.starts_with("RESUME:") || data.starts_with("CLOSE_DOCUMENT:");
+    }
+    void handleRequest(std::string_view request) {
+        if (drainNotice_) {
+            return;
+        }
+        if (!session_) {
+            openSession();
+        }
+        // Inline only when nothing is ahead of it, so requests still take effect in order
+        if (isInlineCommand(request) && queued_.empty() && !processing_) {
+            reply(processData(request));
+            return;
+        }
+        queued_.emplace_back(request);
+        requestsQueued_.notify();
+    }
+    // Opening a document sends all of it; everything else is a quick request a user waits on
+    static Lane laneOf(std::string_view request) {
+        return request.starts_with("OPEN_DOCUMENT:") ? Lane::Bulk : Lane::Interactive;
+    }
+    void reply(const std::string& response) {
+        outgoing_ += response;
+        outgoing_ += '\n';
+        repliesQueued_.notify();
+    }
+    // The first request arrived: register the session and stop counting as pending
+    void openSession() {
+        auto [sessionId, session] = server_.session_handler_.createSession(socket_);
+        sessionId_ = std::move(sessionId);
+        session_ = std::move(session);
+        handshake_timer_.cancel();
+        if (pending_) {
+            pending_ = false;
+            server_.finishHandshake();
+            // The handshake timer was watching instead of the idle deadline
+            if (idle_timer_ == util::TimerWheel::NO_TIMER) {
+                watchIdle(session_->getLastActivity());
+            }
+        }
+    }
+    // Close the connection if its first request does not come in time
+    void watchHandshake(std::chrono::milliseconds timeout) {
         auto self(shared_from_this());
-        std::string data(buffer_.begin(), buffer_.begin() + bytes_transferred);
-        server_.thread_pool_.enqueue([this, self, data]() {
-            std::string response = processData(data);
-            boost::asio::post(socket_->get_executor(), [this, self, response]() { send(response); });
-            boost::asio::post(socket_->get_executor(), [this, self]() { start(); });
+        handshake_timer_.expires_after(timeout);
+        handshake_timer_.async_wait([this, self](const boost::system::error_code& error) {
+            if (!error && !session_ && !closed_) {
+                server_.admission_.record_handshake_timeout();
+                close();
+            }
         });
     }
-    std::string processData(const std::string& data) {
+    // Check the session once it may have been idle for the server's limit
+    void watchIdle(std::chrono::steady_clock::time_point lastActivity) {
+        std::weak_ptr<Connection> weak = shared_from_this();
+        idle_timer_ = server_.scheduleIdleCheck(lastActivity + std::chrono::seconds(server_.max_session_idle_),
+            [weak]() {
+                // The wheel's lock is held; check on the connection's executor instead
+                if (auto self = weak.lock()) {
+                    boost::asio::post(self->socket_->get_executor(), [self]() { self->checkIdle(); });
+                }
+            });
+    }
+    // Activity only updates the session; the deadline moves when it falls due
+    void checkIdle() {
+        if (closed_) {
+            return;
+        }
+        const auto lastActivity = session_ ? session_->getLastActivity() : accepted_;
+        if (std::chrono::steady_clock::now() - lastActivity >= std::chrono::seconds(server_.max_session_idle_)) {
+            LOGF_DEBUG("Closing idle session: {}", session_ ? sessionId_ : std::string("pending"));
+            close();
+            return;
+        }
+        watchIdle(lastActivity);
+    }
+    // Close the connection; a resumable one keeps its session for the grace period
+    void close(bool resumable = false) {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        server_.forgetConnection(this);
+        server_.cancelIdleCheck(idle_timer_);
+        handshake_timer_.cancel();
+        // Let the coroutines that wait for work see that the connection is gone
+        requestsQueued_.notify();
+        repliesQueued_.notify();
+        roomToRead_.notify();
+        boost::system::error_code ignored;
+        socket_->close(ignored);
+        if (session_) {
+            if (resumable) {
+                server_.getSessionHandler().suspendSession(sessionId_);
+            } else {
+                server_.getSessionHandler().closeSession(sessionId_);
+            }
+        }
+        if (pending_) {
+            pending_ = false;
+            server_.finishHandshake();
+        }
+    }
+    std::string processData(std::string_view data) {
         session_->updateActivity();
-        if (data.substr(0, 6) == "LOGIN:") {
-            std::string username = data.substr(6);
+        if (data.starts_with("LOGIN:")) {
+            std::string username(data.substr(6));
             if (!server_.getSessionHandler().isUsernameAvailable(username)) {
                 return "ERROR: Username already in use";
             }
-            return server_.getSessionHandler().authenticateSession(sessionId_, username)
-                ? "SUCCESS: Logged in as " + username : "ERROR: Authentication failed";
+            if (!server_.getSessionHandler().authenticateSession(sessionId_, username)) {
+                return "ERROR: Authentication failed";
+            }
+            return "SUCCESS: Logged in as " + username + ". Resume token: " +
+                   server_.getSessionHandler().issueResumeToken(sessionId_);
         }
-        if (data.substr(0, 11) == "OPEN_DOCUMENT:") {
+        if (data.starts_with("RESUME:")) {
+            return resume(std::string(data.substr(7)));
+        }
+        if (data.starts_with("OPEN_DOCUMENT:")) {
             if (session_->getState() != UserSession::State::AUTHENTICATED) {
                 return "ERROR: Not authenticated";
             }
-            std::string documentId = data.substr(11);
+            std::string documentId(data.substr(14));
             session_->addDocument(documentId);
             auto users = server_.getSessionHandler().getUsersOnDocument(documentId);
             std::ostringstream oss;
-            oss << "SUCCESS: Opened document " << documentId << "\nUsers on this document: ";
+            oss << "SUCCESS: Opened document " << documentId << ". Users on this document: ";
             for (size_t i = 0; i < users.size(); ++i) {
                 if (i > 0) oss << ", ";
                 oss << users[i];
             }
             return oss.str();
         }
-        if (data.substr(0, 12) == "CLOSE_DOCUMENT:") {
+        if (data.starts_with("CLOSE_DOCUMENT:")) {
             if (session_->getState() != UserSession::State::AUTHENTICATED) {
                 return "ERROR: Not authenticated";
             }
-            std::string documentId = data.substr(12);
+            std::string documentId(data.substr(15));
             return session_->removeDocument(documentId)
                 ? "SUCCESS: Closed document " + documentId : "ERROR: Document not open";
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
         std::ostringstream oss;
         oss << "Server received: " << data << " (processed by thread " << std::this_thread::get_id()
             << " for user " << (session_->getUsername().empty() ? "anonymous" : session_->getUsername()) << ")";
-        std::cout << "Processed: " << data << " in thread " << std::this_thread::get_id()
-                  << " for session " << sessionId_ << std::endl;
+        LOGF_EVERY_N(util::LogLevel::DEBUG, 1000, "Processed: {} for session {}", data, sessionId_);
+        return oss.str();
+    }
+    // Take over the session a dropped connection left with the token
+    std::string resume(const std::string& token) {
+        if (session_->getState() == UserSession::State::AUTHENTICATED) {
+            return "ERROR: Already logged in";
+        }
+        auto state = server_.getSessionHandler().resumeSession(sessionId_, token);
+        if (!state) {
+            return "ERROR: Session cannot be resumed";
+        }
+        // Each document with the last revision acknowledged on it, to carry on from
+        std::ostringstream oss;
+        oss << "SUCCESS: Resumed as " << state->username << ". Resume token: " << session_->getResumeToken();
+        const char* separator = ". Open documents: ";
+        for (const auto& [documentId, revision] : state->acknowledged) {
+            oss << separator << documentId << '@' << revision;
+            separator = ", ";
+        }
         return oss.str();
     }
     void handleError(const boost::system::error_code& error) {
+        if (closed_) {
+            return;
+        }
         if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset) {
-            std::cout << "Connection closed by client" << std::endl;
+            LOGF_DEBUG("Connection closed by client");
         } else {
-            std::cerr << "Connection error: " << error.message() << std::endl;
+            LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, error.message(), "Connection error: {}", error.message());
         }
-        server_.getSessionHandler().closeSession(sessionId_);
+        close(true);
     }
     std::shared_ptr<boost::asio::ip::tcp::socket> socket_;
     Server& server_;
+    // Set by the first request
     std::string sessionId_;
     std::shared_ptr<UserSession> session_;
-    std::vector<char> buffer_;
+    // Until the first request: counted as pending, and closed if the handshake timer fires first
+    bool pending_ = true;
+    boost::asio::steady_timer handshake_timer_;
+    std::chrono::steady_clock::time_point accepted_ = std::chrono::steady_clock::now();
+    // Start of a request line whose end has not arrived yet
+    std::string received_;
+    // Requests waiting for the executor, and whether a batch is there already
+    std::vector<std::string> queued_;
+    bool processing_ = false;
+    // Replies not yet written, and those being written
+    std::string outgoing_;
+    std::string writing_buffer_;
+    bool closed_ = false;
+    // Set once a drain told the connection to go; emptied once the notice is queued
+    std::optional<std::string> drainNotice_;
+    // Wake the processing, writing and reading coroutines
+    Signal requestsQueued_;
+    Signal repliesQueued_;
+    Signal roomToRead_;
+    util::TimerWheel::TimerId idle_timer_ = util::TimerWheel::NO_TIMER;
 };
 
 inline void Server::handleNewConnection(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
     boost::asio::ip::tcp::endpoint remote_ep = socket->remote_endpoint();
-    std::cout << "New connection from: " << remote_ep.address().to_string() << ":" << remote_ep.port() << std::endl;
-    auto [sessionId, session] = session_handler_.createSession(socket);
-    auto connection = std::make_shared<Connection>(socket, *this, sessionId, session);
+    // A connect storm from one address logs a few lines a second, not one per connection
+    const std::string address = remote_ep.address().to_string();
+    LOGF_RATE_LIMITED(util::LogLevel::INFO, 5, address, "New connection from: {}:{}", address, remote_ep.port());
+    admission_.begin_handshake();
+    auto connection = std::make_shared<Connection>(socket, *this);
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.emplace(connection.get(), connection);
+    }
     connection->start();
 }
 
+inline void Server::drainWave(std::shared_ptr<Drain> drain, size_t wave) {
+    if (wave >= drain->schedule.waveCount()) {
+        if (drain->done) drain->done();
+        return;
+    }
+    const auto [first, last] = drain->schedule.wave(wave);
+    for (size_t i = first; i < last; ++i) {
+        if (auto connection = drain->connections[i].lock()) {
+            connection->drain(drain->schedule.getOptions().reconnectHint, drain->schedule.reconnectDelay(i));
+        }
+    }
+    drain_timer_.expires_after(drain->schedule.getOptions().waveInterval);
+    drain_timer_.async_wait([this, drain, wave](const boost::system::error_code& error) {
+        if (!error) drainWave(drain, wave + 1);
+    });
+}
+
 } // namespace server
 } // namespace collab
 
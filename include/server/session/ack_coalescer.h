@@ -0,0 +1,98 @@
+#ifndef COLLABORATIVE_EDITOR_ACK_COALESCER_H
+#define COLLABORATIVE_EDITOR_ACK_COALESCER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Folds one client's edit acknowledgements into cumulative ones
+ *
+ * Answering every edit with its own EDIT_APPLY costs a frame, a write and
+ * a client wakeup per keystroke, as much as the broadcasts themselves.
+ * Here the acknowledgements of a client are collected per document, and
+ * take() hands out one EDIT_APPLY per document saying "applied up to
+ * sequenceNumber N, as of documentVersion V": every edit of the client on
+ * that document with a sequenceNumber up to N. The caller sends them once
+ * per flush, or in the batch of broadcasts it sends the client anyway.
+ *
+ * Acknowledgements only ever move forward: a lower sequenceNumber or
+ * documentVersion than one already pending does not take it back. A
+ * contentHash goes with the documentVersion it was computed at.
+ *
+ * Not thread-safe; the owner guards it with the client's lock.
+ */
+class AckCoalescer {
+public:
+    /**
+     * Record that a client's edit is applied
+     *
+     * @param documentId The document edited
+     * @param sequenceNumber The edit's sequenceNumber, as the client sent it
+     * @param documentVersion The revision the edit brought the document to
+     * @param contentHash The document's hash as of that revision, if known
+     * @return True if nothing was pending before, i.e. the caller should arrange a flush
+     */
+    bool acknowledge(const std::string& documentId, uint64_t sequenceNumber, uint64_t documentVersion,
+                     std::optional<uint64_t> contentHash = std::nullopt) {
+        const bool first = pending_.empty();
+        ++acknowledged_;
+        auto it = std::find_if(pending_.begin(), pending_.end(),
+                               [&](const protocol::EditMessage& ack) { return ack.documentId == documentId; });
+        if (it == pending_.end()) {
+            protocol::EditMessage ack(protocol::MessageType::EDIT_APPLY);
+            ack.documentId = documentId;
+            ack.sequenceNumber = sequenceNumber;
+            ack.documentVersion = documentVersion;
+            ack.success = true;
+            ack.contentHash = contentHash;
+            pending_.push_back(std::move(ack));
+            return first;
+        }
+        it->sequenceNumber = std::max(it->sequenceNumber, sequenceNumber);
+        if (documentVersion >= it->documentVersion) {
+            it->documentVersion = documentVersion;
+            it->contentHash = contentHash;
+        }
+        return first;
+    }
+
+    // Take the cumulative acknowledgements, one per document, in the order the documents were first acknowledged
+    std::vector<protocol::EditMessage> take() {
+        sent_ += pending_.size();
+        return std::exchange(pending_, {});
+    }
+
+    bool empty() const {
+        return pending_.empty();
+    }
+
+    // Edits acknowledged so far
+    uint64_t getAcknowledged() const {
+        return acknowledged_;
+    }
+
+    // EDIT_APPLY messages taken so far
+    uint64_t getSent() const {
+        return sent_;
+    }
+
+private:
+    std::vector<protocol::EditMessage> pending_;
+    uint64_t acknowledged_ = 0;
+    uint64_t sent_ = 0;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_ACK_COALESCER_H
@@ -0,0 +1,200 @@
+#ifndef COLLABORATIVE_EDITOR_BATCH_WINDOW_CONTROLLER_H
+#define COLLABORATIVE_EDITOR_BATCH_WINDOW_CONTROLLER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/util/metrics.h"
+#include "server/session/load_tracker.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Sets the windows of batching features from load and measured latency
+ *
+ * Presence flushes, view diffs, outbound composition and group commits
+ * each hold work back for a window so it goes out as one. A fixed window
+ * delays every edit of a quiet document for nothing, and one short
+ * enough for that batches too little on a busy one. Here each feature
+ * registers a window with its upper bound and, optionally, a latency
+ * histogram of the metrics registry that the window adds to. window()
+ * then gives, for a document:
+ *
+ *     zero                 at or below idleRate operations a second
+ *     cap * load           between, load going from 0 to 1 at busyRate
+ *     cap                  at or above busyRate
+ *
+ * with the document's rate from the LoadTracker. The cap starts at the
+ * smaller of the feature's bound and the latency SLO, and update(),
+ * called from a timer, adjusts it from the histogram's quantile over
+ * what was recorded since the last update: halved when the quantile is
+ * above the SLO, grown back by an eighth of the bound while it is below
+ * half of it. A feature without a histogram keeps its cap.
+ *
+ * Thread-safe.
+ */
+class BatchWindowController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        Clock::duration slo = std::chrono::milliseconds(100);   // Latency the quantile is kept under
+        double quantile = 0.99;
+        double idleRate = 1.0;                                  // Operations a second with no window
+        double busyRate = 50.0;                                 // Operations a second with the whole cap
+    };
+
+    // Index of a window, from addWindow()
+    using WindowId = size_t;
+
+    /**
+     * @param load Where the documents' operation rates come from
+     * @param config SLO and the rates windows scale between
+     */
+    BatchWindowController(const LoadTracker& load, Config config)
+        : load_(load), config_(config) {}
+
+    explicit BatchWindowController(const LoadTracker& load)
+        : BatchWindowController(load, Config()) {}
+
+    BatchWindowController(const BatchWindowController&) = delete;
+    BatchWindowController& operator=(const BatchWindowController&) = delete;
+
+    /**
+     * Register a batching feature
+     *
+     * @param name For report(), e.g. "view"
+     * @param maxWindow The longest the feature may hold work back
+     * @param latency Histogram of the latency the window adds to, or nullptr to go by load only
+     * @param unitsPerSecond Recorded values per second in the histogram, e.g. util::NANOSECONDS_PER_SECOND
+     * @return The window's ID
+     */
+    WindowId addWindow(std::string name, Clock::duration maxWindow, const util::Histogram* latency = nullptr,
+                       double unitsPerSecond = util::NANOSECONDS_PER_SECOND) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Window& window = windows_.emplace_back();
+        window.name = std::move(name);
+        window.bound = std::min(maxWindow, config_.slo);
+        window.cap = window.bound;
+        window.latency = latency;
+        window.unitsPerSecond = unitsPerSecond;
+        if (latency) {
+            window.seen = latency->snapshot().buckets;
+        }
+        return windows_.size() - 1;
+    }
+
+    /**
+     * Adjust the caps from the latency recorded since the last update
+     */
+    void update() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Window& window : windows_) {
+            if (!window.latency) {
+                continue;
+            }
+            util::Histogram::Snapshot recent = window.latency->snapshot();
+            std::vector<uint64_t> buckets = recent.buckets;
+            bool any = false;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                recent.buckets[i] -= std::min(recent.buckets[i], window.seen[i]);
+                any = any || recent.buckets[i] > 0;
+            }
+            window.seen = std::move(buckets);
+            if (!any) {
+                continue;
+            }
+            window.observed = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                static_cast<double>(recent.valueAt(config_.quantile)) / window.unitsPerSecond));
+            if (window.observed > config_.slo) {
+                window.cap /= 2;
+            } else if (window.observed < config_.slo / 2) {
+                window.cap = std::min(window.bound, window.cap + window.bound / 8);
+            }
+        }
+    }
+
+    /**
+     * The window a feature should use for a document now
+     *
+     * @param id The feature's window
+     * @param documentId The document
+     * @return Zero for a quiet document, up to the window's cap for a busy one
+     */
+    Clock::duration window(WindowId id, const std::string& documentId) const {
+        return windowAt(id, load_.document(documentId).operationsPerSecond);
+    }
+
+    /**
+     * The window a feature should use at a given operation rate
+     *
+     * @param id The feature's window
+     * @param operationsPerSecond The rate
+     */
+    Clock::duration windowAt(WindowId id, double operationsPerSecond) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Clock::duration cap = windows_.at(id).cap;
+        if (operationsPerSecond <= config_.idleRate) {
+            return Clock::duration::zero();
+        }
+        const double load = config_.busyRate > config_.idleRate
+            ? (operationsPerSecond - config_.idleRate) / (config_.busyRate - config_.idleRate) : 1.0;
+        return std::chrono::duration_cast<Clock::duration>(cap * std::min(load, 1.0));
+    }
+
+    // The longest a feature's window is now, at or above busyRate
+    Clock::duration cap(WindowId id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return windows_.at(id).cap;
+    }
+
+    /**
+     * Each window's cap and the latency it was last set from, for an admin query
+     *
+     * @return {"sloSeconds", "windows": [{"name", "capSeconds", "boundSeconds", "observedSeconds"}]}
+     */
+    nlohmann::json report() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nlohmann::json windows = nlohmann::json::array();
+        for (const Window& window : windows_) {
+            windows.push_back({
+                {"name", window.name},
+                {"capSeconds", seconds(window.cap)},
+                {"boundSeconds", seconds(window.bound)},
+                {"observedSeconds", seconds(window.observed)}});
+        }
+        return {{"sloSeconds", seconds(config_.slo)}, {"windows", std::move(windows)}};
+    }
+
+private:
+    struct Window {
+        std::string name;
+        Clock::duration bound{};              // The feature's maximum, at most the SLO
+        Clock::duration cap{};
+        Clock::duration observed{};           // The quantile at the last update with samples
+        const util::Histogram* latency = nullptr;
+        double unitsPerSecond = 1.0;
+        std::vector<uint64_t> seen;           // Buckets at the last update
+    };
+
+    static double seconds(Clock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    const LoadTracker& load_;
+    const Config config_;
+    mutable std::mutex mutex_;
+    std::vector<Window> windows_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BATCH_WINDOW_CONTROLLER_H
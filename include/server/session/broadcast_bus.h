@@ -0,0 +1,220 @@
+#ifndef COLLABORATIVE_EDITOR_BROADCAST_BUS_H
+#define COLLABORATIVE_EDITOR_BROADCAST_BUS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace server {
+
+/**
+ * A broadcast as it travels between nodes: encoded once by the node that made it
+ *
+ * The payload is the message's JSON text, which is the same for every
+ * receiver, unlike binary frames that refer to one connection's string
+ * table. Receiving nodes hand it to their JSON clients as it is.
+ */
+struct BusFrame {
+    std::string topic;          // The document the message is about; empty for every client of every node
+    std::string origin;         // The node that published it
+    std::string coalesceKey;    // If set, a later frame with the same key replaces this one while both wait
+    std::shared_ptr<const std::string> payload;
+};
+
+/**
+ * Frames waiting to go to each destination node, coalesced per node
+ *
+ * Transports keep one and take each node's batch when they flush, so a
+ * node is sent one batch per flush however many documents the frames are
+ * about. A frame with a coalesce key takes the place of the waiting frame
+ * with the same key, e.g. the newer cursor of the same user, and keeps
+ * the older one's place in the batch.
+ *
+ * Not thread-safe; transports lock around it.
+ */
+class BusOutbox {
+public:
+    // Queue a frame for a node; false if it replaced one waiting with the same key
+    bool add(const std::string& node, const BusFrame& frame) {
+        Pending& pending = pending_[node];
+        if (!frame.coalesceKey.empty()) {
+            auto [it, added] = pending.byKey.try_emplace(frame.coalesceKey, pending.frames.size());
+            if (!added) {
+                pending.frames[it->second] = frame;
+                return false;
+            }
+        }
+        pending.frames.push_back(frame);
+        return true;
+    }
+
+    // Take every node's batch, leaving the outbox empty
+    std::vector<std::pair<std::string, std::vector<BusFrame>>> take() {
+        std::vector<std::pair<std::string, std::vector<BusFrame>>> batches;
+        batches.reserve(pending_.size());
+        for (auto& [node, pending] : pending_) {
+            if (!pending.frames.empty()) {
+                batches.emplace_back(node, std::move(pending.frames));
+            }
+        }
+        pending_.clear();
+        return batches;
+    }
+
+    bool empty() const {
+        return pending_.empty();
+    }
+
+private:
+    struct Pending {
+        std::vector<BusFrame> frames;
+        std::unordered_map<std::string, size_t> byKey;  // Index in frames of the frame with each key
+    };
+
+    std::unordered_map<std::string, Pending> pending_;
+};
+
+/**
+ * Carries broadcasts between the nodes of a cluster
+ *
+ * Each node attaches once and subscribes to the topics, document IDs, its
+ * own clients have joined; every node gets the empty topic. A published
+ * frame goes to each other node subscribed to its topic, batched and
+ * coalesced per node until the next flush(), and a node's handler gets
+ * its batch in the order the frames were published.
+ *
+ * Implementations decide how frames travel: InProcessBus hands them over
+ * in memory, a mesh of TCP connections or an external broker would send
+ * each node's batch as one message. All of them are to be thread-safe,
+ * and call handlers outside their own locks.
+ */
+class BroadcastBus {
+public:
+    using Handler = std::function<void(const std::vector<BusFrame>& frames)>;
+
+    virtual ~BroadcastBus() = default;
+
+    /**
+     * Join the bus as a node
+     *
+     * @param node The node's ID
+     * @param handler Gets the node's batches; may run on any thread
+     */
+    virtual void attach(const std::string& node, Handler handler) = 0;
+
+    // Leave the bus; nothing is delivered to the node once this returns
+    virtual void detach(const std::string& node) = 0;
+
+    // Start or stop receiving a topic's frames
+    virtual void subscribe(const std::string& node, const std::string& topic) = 0;
+    virtual void unsubscribe(const std::string& node, const std::string& topic) = 0;
+
+    // Queue a frame for every other node subscribed to its topic
+    virtual void publish(const BusFrame& frame) = 0;
+
+    // Send every node what was queued for it
+    virtual void flush() = 0;
+};
+
+/**
+ * A bus between nodes in one process, e.g. for tests or several nodes on one machine
+ */
+class InProcessBus : public BroadcastBus {
+public:
+    struct Stats {
+        uint64_t published = 0;
+        uint64_t coalesced = 0;     // Frames replaced before they were delivered
+        uint64_t batches = 0;       // Handler calls
+        uint64_t delivered = 0;     // Frames in them
+    };
+
+    void attach(const std::string& node, Handler handler) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nodes_[node].handler = std::make_shared<const Handler>(std::move(handler));
+        nodes_[node].topics.insert(std::string());
+    }
+
+    void detach(const std::string& node) override {
+        // Takes deliveryMutex_ too, so no batch for the node is still being handed over
+        std::lock_guard<std::mutex> delivering(deliveryMutex_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        nodes_.erase(node);
+    }
+
+    void subscribe(const std::string& node, const std::string& topic) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = nodes_.find(node);
+        if (it != nodes_.end()) {
+            it->second.topics.insert(topic);
+        }
+    }
+
+    void unsubscribe(const std::string& node, const std::string& topic) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = nodes_.find(node);
+        if (it != nodes_.end() && !topic.empty()) {
+            it->second.topics.erase(topic);
+        }
+    }
+
+    void publish(const BusFrame& frame) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.published++;
+        for (const auto& [node, member] : nodes_) {
+            if (node != frame.origin && member.topics.count(frame.topic) > 0 && !outbox_.add(node, frame)) {
+                stats_.coalesced++;
+            }
+        }
+    }
+
+    void flush() override {
+        // One flush at a time, so each node gets its batches in order
+        std::lock_guard<std::mutex> delivering(deliveryMutex_);
+        std::vector<std::pair<std::shared_ptr<const Handler>, std::vector<BusFrame>>> deliveries;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& [node, frames] : outbox_.take()) {
+                auto it = nodes_.find(node);
+                if (it == nodes_.end()) {
+                    continue;
+                }
+                stats_.batches++;
+                stats_.delivered += frames.size();
+                deliveries.emplace_back(it->second.handler, std::move(frames));
+            }
+        }
+        for (const auto& [handler, frames] : deliveries) {
+            (*handler)(frames);
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Member {
+        std::shared_ptr<const Handler> handler;
+        std::unordered_set<std::string> topics;
+    };
+
+    std::mutex deliveryMutex_;
+    mutable std::mutex mutex_;      // Guards the members below
+    std::unordered_map<std::string, Member> nodes_;
+    BusOutbox outbox_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BROADCAST_BUS_H
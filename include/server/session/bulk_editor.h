@@ -0,0 +1,247 @@
+#ifndef COLLABORATIVE_EDITOR_BULK_EDITOR_H
+#define COLLABORATIVE_EDITOR_BULK_EDITOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include "common/ot/operation.h"
+#include "common/ot/text_operation.h"
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Applies EDIT_BULK requests: many edits, across documents, in one request
+ *
+ * Automation clients, a codemod or a find and replace across files, make
+ * thousands of edits at a time. Sent one EditMessage each, every edit is
+ * transformed, applied, logged and broadcast on its own, and a failure
+ * halfway leaves a document half edited. Here the edits of each document
+ * are transformed once against what the client had not seen, composed
+ * into one operation (see ot::TextOperation) and applied whole: one
+ * revision, one undo step and one broadcast. If an edit does not fit the
+ * document, or one touches a read-only region, none of the document's
+ * edits apply.
+ *
+ * Documents are independent of each other: each is answered as soon as
+ * it is done, in the order they first appear in the request, with an
+ * EDIT_APPLY carrying its new documentVersion or an EDIT_REJECT saying
+ * why. A document the node does not have is rejected without holding up
+ * the rest.
+ *
+ * Call apply() wherever the documents' other edits are serialized, e.g.
+ * on their DocumentExecutor. Beyond its counters the editor keeps no state.
+ */
+class BulkEditor {
+public:
+    // A document's OT state
+    struct Target {
+        DocumentController* document = nullptr;
+        OperationManager* operations = nullptr;
+        int64_t versionOffset = 0;      // documentVersion of revision 0 on the wire, e.g. where a log resumed
+    };
+
+    // Looks a document up; std::nullopt if the node does not have it
+    using Resolve = std::function<std::optional<Target>(const std::string& documentId)>;
+
+    // Hands on what a document's edits did, once, e.g. to log it and broadcast it to the other clients
+    using Applied = std::function<void(const std::string& documentId, const std::string& clientId,
+                                       const ot::OperationPtr& op, uint64_t documentVersion)>;
+
+    // Sends the client one document's result
+    using Reply = std::function<void(const protocol::EditMessage& result)>;
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t documentsApplied = 0;
+        uint64_t documentsRejected = 0;
+        uint64_t editsApplied = 0;      // Edits of the documents applied, before composing
+    };
+
+    BulkEditor(Resolve resolve, Applied applied)
+        : resolve_(std::move(resolve)), applied_(std::move(applied)) {}
+
+    /**
+     * Apply an EDIT_BULK
+     *
+     * A request carrying anything but inserts, deletes and replaces is
+     * rejected whole, with one EDIT_REJECT naming no document.
+     *
+     * @param clientId The client that sent it
+     * @param request The EDIT_BULK
+     * @param reply Called with each document's result as it is done
+     * @return How many documents the edits applied to
+     */
+    size_t apply(const std::string& clientId, const protocol::BatchMessage& request, const Reply& reply) {
+        {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            stats_.requests++;
+        }
+
+        // The edits of each document, in order, and the documents in the order they first appear
+        std::vector<std::pair<std::string, std::vector<const protocol::EditMessage*>>> documents;
+        std::unordered_map<std::string, size_t> indexOf;
+        for (const auto& element : request.messages) {
+            const auto* edit = dynamic_cast<const protocol::EditMessage*>(element.get());
+            if (!edit || !isEdit(edit->type)) {
+                reply(rejection(request, {}, "A bulk edit carries only inserts, deletes and replaces"));
+                return 0;
+            }
+            auto [it, added] = indexOf.try_emplace(edit->documentId, documents.size());
+            if (added) {
+                documents.emplace_back(edit->documentId, std::vector<const protocol::EditMessage*>());
+            }
+            documents[it->second].second.push_back(edit);
+        }
+
+        size_t appliedCount = 0;
+        for (const auto& [documentId, edits] : documents) {
+            std::string error;
+            std::optional<protocol::EditMessage> result = applyDocument(clientId, request, documentId, edits, error);
+            {
+                std::lock_guard<std::mutex> lock(statsMutex_);
+                if (result) {
+                    stats_.documentsApplied++;
+                    stats_.editsApplied += edits.size();
+                } else {
+                    stats_.documentsRejected++;
+                }
+            }
+            appliedCount += result ? 1 : 0;
+            reply(result ? *result : rejection(request, documentId, error));
+        }
+        return appliedCount;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        return stats_;
+    }
+
+private:
+    static bool isEdit(protocol::MessageType type) {
+        return type == protocol::MessageType::EDIT_INSERT || type == protocol::MessageType::EDIT_DELETE ||
+               type == protocol::MessageType::EDIT_REPLACE;
+    }
+
+    // Add what one edit does to a composite; false if it lacks the fields its type needs
+    static bool addEdit(const protocol::EditMessage& edit, ot::CompositeOperation& composite) {
+        if (!edit.position) {
+            return false;
+        }
+        const bool removes = edit.type != protocol::MessageType::EDIT_INSERT;
+        const bool adds = edit.type != protocol::MessageType::EDIT_DELETE;
+        if ((removes && !edit.length) || (adds && !edit.text)) {
+            return false;
+        }
+        // A replace is one operation, transformed and applied in one step
+        if (removes && adds && *edit.length > 0 && !edit.text->empty()) {
+            composite.addOperation(std::make_shared<ot::ReplaceOperation>(*edit.position, *edit.length, *edit.text));
+            return true;
+        }
+        if (removes && *edit.length > 0) {
+            composite.addOperation(std::make_shared<ot::DeleteOperation>(*edit.position, *edit.length));
+        }
+        if (adds && !edit.text->empty()) {
+            composite.addOperation(std::make_shared<ot::InsertOperation>(*edit.position, *edit.text));
+        }
+        return true;
+    }
+
+    static protocol::EditMessage rejection(const protocol::BatchMessage& request, const std::string& documentId,
+                                           const std::string& error) {
+        protocol::EditMessage reject(protocol::MessageType::EDIT_REJECT);
+        reject.documentId = documentId;
+        reject.sequenceNumber = request.sequenceNumber;
+        reject.success = false;
+        reject.errorMessage = error;
+        return reject;
+    }
+
+    // Apply one document's edits as one operation; std::nullopt, with error set, if they do not apply
+    std::optional<protocol::EditMessage> applyDocument(const std::string& clientId, const protocol::BatchMessage& request,
+                                                       const std::string& documentId,
+                                                       const std::vector<const protocol::EditMessage*>& edits,
+                                                       std::string& error) {
+        const std::optional<Target> target = resolve_(documentId);
+        if (!target || !target->document || !target->operations) {
+            error = "Document is not open on this node";
+            return std::nullopt;
+        }
+        const uint64_t baseVersion = edits.front()->documentVersion;
+        auto composite = std::make_shared<ot::CompositeOperation>();
+        for (const protocol::EditMessage* edit : edits) {
+            if (edit->documentVersion != baseVersion) {
+                error = "Edits of a document must share their documentVersion";
+                return std::nullopt;
+            }
+            if (!addEdit(*edit, *composite)) {
+                error = "Malformed edit";
+                return std::nullopt;
+            }
+        }
+
+        protocol::EditMessage result(protocol::MessageType::EDIT_APPLY);
+        result.documentId = documentId;
+        result.sequenceNumber = request.sequenceNumber;
+        result.success = true;
+        const Target& at = *target;
+        if (composite->getOperations().empty()) {
+            result.documentVersion = static_cast<uint64_t>(at.versionOffset + at.document->getRevision());
+            return result;
+        }
+
+        // One transform for all of them, then one operation for the history
+        std::optional<ot::RegionSet::Region> lockedBy;
+        const ot::OperationPtr transformed = at.operations->processOperation(
+            composite, clientId, static_cast<int64_t>(baseVersion) - at.versionOffset, lockedBy);
+        if (!transformed) {
+            error = lockedBy ? "Edits a read-only region" + (lockedBy->label.empty() ? "" : ": " + lockedBy->label)
+                             : "Edits are based on a version no longer kept; resync";
+            return std::nullopt;
+        }
+        ot::OperationPtr composed;
+        try {
+            const ot::TextOperation text =
+                ot::TextOperation::fromOperation(*transformed, at.document->getSnapshot().content.length());
+            composed = text.isNoop() ? nullptr : text.toOperation();
+        } catch (const std::invalid_argument&) {
+            error = "Edits do not fit the document";
+            return std::nullopt;
+        }
+        if (composed) {
+            if (!at.document->applyOperation(composed, clientId)) {
+                error = "Edits do not fit the document";
+                return std::nullopt;
+            }
+            at.operations->recordOperation(composed);
+        }
+        result.documentVersion = static_cast<uint64_t>(at.versionOffset + at.document->getRevision());
+        if (composed && applied_) {
+            applied_(documentId, clientId, composed, result.documentVersion);
+        }
+        return result;
+    }
+
+    Resolve resolve_;
+    Applied applied_;
+    mutable std::mutex statsMutex_;     // Guards the member below
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_BULK_EDITOR_H
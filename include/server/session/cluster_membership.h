@@ -0,0 +1,363 @@
+#ifndef COLLABORATIVE_EDITOR_CLUSTER_MEMBERSHIP_H
+#define COLLABORATIVE_EDITOR_CLUSTER_MEMBERSHIP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace collab {
+namespace server {
+
+// A node of the cluster: its ID and where clients reach it, e.g. "10.0.0.7:12345"
+struct ClusterNode {
+    std::string id;
+    std::string address;
+
+    friend bool operator==(const ClusterNode&, const ClusterNode&) = default;
+};
+
+/**
+ * Assigns documents to nodes by consistent hashing
+ *
+ * Each node is hashed onto a ring at VIRTUAL_NODES points, and a document
+ * belongs to the node of the first point at or after its own hash. With
+ * many points per node the documents spread evenly, and adding or
+ * removing a node only moves the documents on the arcs it gains or loses,
+ * about 1/N of them, each straight to or from that node.
+ *
+ * The hash is FNV-1a finished with splitmix64, so every node, whatever it
+ * was built with, computes the same owners from the same members.
+ *
+ * Immutable once built, so it is shared between threads without a lock.
+ */
+class HashRing {
+public:
+    static constexpr size_t VIRTUAL_NODES = 128;
+
+    HashRing() = default;
+
+    /**
+     * @param nodes The members; a repeated ID keeps its first entry
+     * @param virtualNodes Points per node on the ring
+     */
+    explicit HashRing(std::vector<ClusterNode> nodes, size_t virtualNodes = VIRTUAL_NODES) {
+        for (auto& node : nodes) {
+            if (!find(node.id)) {
+                nodes_.push_back(std::move(node));
+            }
+        }
+        points_.reserve(nodes_.size() * virtualNodes);
+        for (uint32_t index = 0; index < nodes_.size(); ++index) {
+            for (size_t point = 0; point < virtualNodes; ++point) {
+                points_.push_back({hash(nodes_[index].id + '#' + std::to_string(point)), index});
+            }
+        }
+        // Ties, which are all but impossible, go to the lower ID on every node alike
+        std::sort(points_.begin(), points_.end(), [this](const Point& a, const Point& b) {
+            return a.hash != b.hash ? a.hash < b.hash : nodes_[a.node].id < nodes_[b.node].id;
+        });
+    }
+
+    /**
+     * Find the node a document belongs to
+     *
+     * @param documentId The document's ID
+     * @return Its owner, or nullptr if the ring has no nodes
+     */
+    const ClusterNode* ownerOf(std::string_view documentId) const {
+        if (points_.empty()) {
+            return nullptr;
+        }
+        const uint64_t key = hash(documentId);
+        auto it = std::lower_bound(points_.begin(), points_.end(), key,
+                                   [](const Point& point, uint64_t value) { return point.hash < value; });
+        if (it == points_.end()) {
+            it = points_.begin();
+        }
+        return &nodes_[it->node];
+    }
+
+    // Get a member by ID, nullptr if it is not one
+    const ClusterNode* find(std::string_view nodeId) const {
+        auto it = std::find_if(nodes_.begin(), nodes_.end(), [&](const ClusterNode& node) { return node.id == nodeId; });
+        return it != nodes_.end() ? &*it : nullptr;
+    }
+
+    const std::vector<ClusterNode>& nodes() const {
+        return nodes_;
+    }
+
+    size_t size() const {
+        return nodes_.size();
+    }
+
+    bool empty() const {
+        return nodes_.empty();
+    }
+
+    // The ring's hash: stable across processes, builds and machines
+    static uint64_t hash(std::string_view key) {
+        uint64_t value = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            value = (value ^ c) * 1099511628211ull;
+        }
+        value += 0x9E3779B97F4A7C15ull;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+private:
+    struct Point {
+        uint64_t hash;
+        uint32_t node;
+    };
+
+    std::vector<ClusterNode> nodes_;
+    std::vector<Point> points_;
+};
+
+/**
+ * The members of the cluster as one node knows them, and the ring they make
+ *
+ * Every change to the members makes a new view with a higher epoch. Nodes
+ * exchange views (toJson() / fromJson()) with their peers, e.g. on every
+ * heartbeat, and a node adopts a view it is sent if it is newer than its
+ * own, so the newest view spreads to every node and they all agree on the
+ * owners again. Two changes made on different nodes at once get the same
+ * epoch; the view whose author has the higher ID wins on every node, and
+ * the node whose change lost makes it again once it sees the change
+ * missing from the view it adopted.
+ *
+ * A node joins by asking any member to join() it and gossiping the view it
+ * gets back; it leaves by having leave() called for it, after handing off
+ * its documents. Either way only the documents on the arcs of the ring
+ * the node gains or loses move (see HashRing), and moves() lists which of
+ * a node's documents those are and where each goes.
+ *
+ * ownerOf() reads the published ring without a lock, so it is cheap
+ * enough for every DOC_OPEN. Changes are guarded by a mutex and reported
+ * to the change handler outside it, in the order they were made; the
+ * handler may read ring() and ownerOf() but must not change the members.
+ */
+class ClusterMembership {
+public:
+    // A view of the members: newer views have the higher (epoch, author)
+    struct View {
+        uint64_t epoch = 0;
+        std::string author;              // The node that made the change
+        std::vector<ClusterNode> nodes;
+
+        bool newerThan(const View& other) const {
+            return epoch != other.epoch ? epoch > other.epoch : author > other.author;
+        }
+    };
+
+    // A document that changes owner between two rings
+    struct Move {
+        std::string documentId;
+        ClusterNode from;
+        ClusterNode to;
+    };
+
+    // Called with the rings before and after each change of view
+    using ChangeHandler = std::function<void(const HashRing& before, const HashRing& after)>;
+
+    /**
+     * @param self This node; it is the only member until it joins a cluster or others join it
+     * @param virtualNodes Points per node on the ring; the same on every node
+     */
+    explicit ClusterMembership(ClusterNode self, size_t virtualNodes = HashRing::VIRTUAL_NODES)
+        : self_(std::move(self)), virtualNodes_(virtualNodes) {
+        view_.author = self_.id;
+        view_.nodes.push_back(self_);
+        ring_.store(std::make_shared<const HashRing>(view_.nodes, virtualNodes_));
+    }
+
+    ClusterMembership(const ClusterMembership&) = delete;
+    ClusterMembership& operator=(const ClusterMembership&) = delete;
+
+    // Set the function told of each change of view, e.g. to hand off documents that moved
+    void setChangeHandler(ChangeHandler handler) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        onChange_ = std::move(handler);
+    }
+
+    /**
+     * Add a node, or update its address
+     *
+     * @param node The node joining
+     * @return False if it was a member already, at that address
+     */
+    bool join(const ClusterNode& node) {
+        return change([&](std::vector<ClusterNode>& nodes) {
+            auto it = std::find_if(nodes.begin(), nodes.end(), [&](const ClusterNode& n) { return n.id == node.id; });
+            if (it != nodes.end()) {
+                if (*it == node) {
+                    return false;
+                }
+                *it = node;
+            } else {
+                nodes.push_back(node);
+            }
+            return true;
+        });
+    }
+
+    /**
+     * Remove a node
+     *
+     * @param nodeId The node leaving
+     * @return True if the node was a member
+     */
+    bool leave(const std::string& nodeId) {
+        return change([&](std::vector<ClusterNode>& nodes) {
+            auto it = std::find_if(nodes.begin(), nodes.end(), [&](const ClusterNode& n) { return n.id == nodeId; });
+            if (it == nodes.end()) {
+                return false;
+            }
+            nodes.erase(it);
+            return true;
+        });
+    }
+
+    /**
+     * Adopt a view from a peer if it is newer than this node's
+     *
+     * @param view The peer's view
+     * @return True if it was adopted
+     */
+    bool merge(View view) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!view.newerThan(view_)) {
+            return false;
+        }
+        view_ = std::move(view);
+        publish(lock);
+        return true;
+    }
+
+    // Get this node's view, e.g. to send to a peer
+    View getView() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return view_;
+    }
+
+    // Get the ring of the current view
+    std::shared_ptr<const HashRing> ring() const {
+        return ring_.load();
+    }
+
+    // Get the node a document belongs to, nullptr if there are no members
+    std::optional<ClusterNode> ownerOf(std::string_view documentId) const {
+        const std::shared_ptr<const HashRing> ring = ring_.load();
+        if (const ClusterNode* owner = ring->ownerOf(documentId)) {
+            return *owner;
+        }
+        return std::nullopt;
+    }
+
+    // Check whether a document belongs to this node; true if there are no members at all
+    bool ownsLocally(std::string_view documentId) const {
+        const std::shared_ptr<const HashRing> ring = ring_.load();
+        const ClusterNode* owner = ring->ownerOf(documentId);
+        return !owner || owner->id == self_.id;
+    }
+
+    const ClusterNode& self() const {
+        return self_;
+    }
+
+    /**
+     * List the documents that change owner between two rings
+     *
+     * @param documentIds The documents to look at, e.g. those resident on this node
+     * @param before The ring they were placed by
+     * @param after The ring they are to be placed by
+     * @return Each document whose owner differs, with both owners
+     */
+    static std::vector<Move> moves(const std::vector<std::string>& documentIds, const HashRing& before,
+                                   const HashRing& after) {
+        std::vector<Move> moved;
+        for (const auto& documentId : documentIds) {
+            const ClusterNode* from = before.ownerOf(documentId);
+            const ClusterNode* to = after.ownerOf(documentId);
+            if (from && to && from->id != to->id) {
+                moved.push_back({documentId, *from, *to});
+            }
+        }
+        return moved;
+    }
+
+    static nlohmann::json toJson(const View& view) {
+        nlohmann::json nodes = nlohmann::json::array();
+        for (const auto& node : view.nodes) {
+            nodes.push_back({{"id", node.id}, {"address", node.address}});
+        }
+        return {{"epoch", view.epoch}, {"author", view.author}, {"nodes", std::move(nodes)}};
+    }
+
+    // @throws nlohmann::json::exception if a field is missing or mistyped
+    static View fromJson(const nlohmann::json& j) {
+        View view;
+        j.at("epoch").get_to(view.epoch);
+        j.at("author").get_to(view.author);
+        for (const auto& node : j.at("nodes")) {
+            view.nodes.push_back({node.at("id").get<std::string>(), node.at("address").get<std::string>()});
+        }
+        return view;
+    }
+
+private:
+    // Apply a change to the members as a new view; edit returns false if it changed nothing
+    template <typename Edit>
+    bool change(Edit&& edit) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::vector<ClusterNode> nodes = view_.nodes;
+        if (!edit(nodes)) {
+            return false;
+        }
+        view_.epoch++;
+        view_.author = self_.id;
+        view_.nodes = std::move(nodes);
+        publish(lock);
+        return true;
+    }
+
+    // Publish the ring of view_ and report the change; releases the lock to call the handler
+    void publish(std::unique_lock<std::mutex>& lock) {
+        auto after = std::make_shared<const HashRing>(view_.nodes, virtualNodes_);
+        std::shared_ptr<const HashRing> before = ring_.exchange(after);
+        ChangeHandler onChange = onChange_;
+        // Held by the reporting thread, so changes are reported in order
+        std::lock_guard<std::mutex> reporting(reportMutex_);
+        lock.unlock();
+        if (onChange) {
+            onChange(*before, *after);
+        }
+    }
+
+    const ClusterNode self_;
+    const size_t virtualNodes_;
+
+    mutable std::mutex mutex_;          // Guards view_ and onChange_
+    View view_;
+    ChangeHandler onChange_;
+    std::mutex reportMutex_;
+    std::atomic<std::shared_ptr<const HashRing>> ring_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CLUSTER_MEMBERSHIP_H
@@ -0,0 +1,248 @@
+#ifndef COLLABORATIVE_EDITOR_CORE_MESH_H
+#define COLLABORATIVE_EDITOR_CORE_MESH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "common/network/io_engine.h"
+#include "common/util/spsc_ring.h"
+#include "server/thread_pool.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Message rings between the cores of a shared-nothing server
+ *
+ * Each core is one of an IoEngine's single-threaded contexts and owns the
+ * connections, sessions and documents it was given; nothing it owns is
+ * touched from another thread. When work has to cross to another core, as
+ * when a client opens a document homed elsewhere, it is posted as a task
+ * through a lock-free SPSC ring: every pair of cores has its own ring in
+ * each direction, so no two senders ever share one.
+ *
+ * A core is woken with one post to its context when its rings go from
+ * empty to not, and then drains them in batches; further tasks while it
+ * is draining cost only the ring push. A full ring does not block the
+ * sender: its tasks wait, in order, on the sender's core until there is
+ * room.
+ */
+class CoreMesh {
+public:
+    static constexpr size_t DEFAULT_RING_CAPACITY = 1024;
+    // Tasks taken from one ring before the core looks at the next
+    static constexpr size_t DRAIN_BATCH = 64;
+    // currentCore() on a thread that is not a core
+    static constexpr size_t NOT_A_CORE = std::numeric_limits<size_t>::max();
+
+    struct Stats {
+        uint64_t sent = 0;       // Tasks sent to other cores through the rings
+        uint64_t deferred = 0;   // Tasks that found their ring full and waited
+        uint64_t wakeups = 0;    // Posts that woke a core to drain its rings
+    };
+
+    /**
+     * Set up the rings for every context of an engine; call before the engine starts
+     *
+     * @param engine The engine whose contexts are the cores; must outlive the mesh and stop before it goes
+     * @param ringCapacity Tasks each ring holds before senders wait
+     */
+    explicit CoreMesh(network::IoEngine& engine, size_t ringCapacity = DEFAULT_RING_CAPACITY)
+        : engine_(engine), cores_(engine.size()) {
+        const size_t count = engine.size();
+        for (size_t to = 0; to < count; ++to) {
+            cores_[to].inbound.reserve(count);
+            cores_[to].deferred.resize(count);
+            for (size_t from = 0; from < count; ++from) {
+                cores_[to].inbound.push_back(std::make_unique<util::SpscRing<Task>>(ringCapacity));
+            }
+            // The first handler each core runs tells its thread which core it is
+            boost::asio::post(engine.context(to), [this, to]() {
+                currentMesh() = this;
+                currentIndex() = to;
+            });
+        }
+    }
+
+    CoreMesh(const CoreMesh&) = delete;
+    CoreMesh& operator=(const CoreMesh&) = delete;
+
+    size_t size() const {
+        return cores_.size();
+    }
+
+    boost::asio::io_context& context(size_t core) {
+        return engine_.context(core);
+    }
+
+    // The core the calling thread runs, or NOT_A_CORE
+    size_t currentCore() const {
+        return currentMesh() == this ? currentIndex() : NOT_A_CORE;
+    }
+
+    // The core that owns a key such as a document ID
+    size_t homeOf(std::string_view key) const {
+        return std::hash<std::string_view>{}(key) % cores_.size();
+    }
+
+    /**
+     * Run a task on a core, after the tasks sent to it from the same core before
+     *
+     * From a core this goes through that core's ring to the target. Other
+     * threads, which have no ring of their own, post to the target's
+     * context instead.
+     *
+     * @param core The core to run the task on
+     * @param task The task
+     */
+    void post(size_t core, Task task) {
+        const size_t from = currentCore();
+        if (from == NOT_A_CORE || from == core) {
+            boost::asio::post(engine_.context(core), std::move(task));
+            return;
+        }
+        Core& sender = cores_[from];
+        std::deque<Task>& waiting = sender.deferred[core];
+        // Behind the tasks already waiting, so nothing overtakes them
+        if (!waiting.empty() || !cores_[core].inbound[from]->tryPush(task)) {
+            waiting.push_back(std::move(task));
+            ++sender.stats.deferred;
+            scheduleRetry(from);
+            return;
+        }
+        ++sender.stats.sent;
+        wake(from, core);
+    }
+
+    /**
+     * Get a core's counters; call on that core for a consistent result
+     *
+     * @param core The core
+     * @return What the core sent
+     */
+    Stats getStats(size_t core) const {
+        return cores_[core].stats;
+    }
+
+private:
+    struct alignas(64) Core {
+        // Rings into this core, one per sending core
+        std::vector<std::unique_ptr<util::SpscRing<Task>>> inbound;
+        // Set while a drain is posted or running
+        std::atomic<bool> scheduled{false};
+        // Written only on this core: tasks waiting for room, per target core, and the counters
+        std::vector<std::deque<Task>> deferred;
+        bool retryPosted = false;
+        Stats stats;
+    };
+
+    static CoreMesh*& currentMesh() {
+        thread_local CoreMesh* mesh = nullptr;
+        return mesh;
+    }
+
+    static size_t& currentIndex() {
+        thread_local size_t index = NOT_A_CORE;
+        return index;
+    }
+
+    // Make sure the target drains its rings; call on the sending core after a push
+    void wake(size_t from, size_t to) {
+        // Orders the push before the flag, as drain() orders clearing the flag before its last look
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!cores_[to].scheduled.exchange(true)) {
+            ++cores_[from].stats.wakeups;
+            boost::asio::post(engine_.context(to), [this, to]() { drain(to); });
+        }
+    }
+
+    // Run what the other cores sent; on the receiving core
+    void drain(size_t core) {
+        Core& self = cores_[core];
+        bool more = false;
+        for (auto& ring : self.inbound) {
+            for (size_t taken = 0; taken < DRAIN_BATCH; ++taken) {
+                auto task = ring->tryPop();
+                if (!task) {
+                    break;
+                }
+                run(*task);
+                if (taken + 1 == DRAIN_BATCH) {
+                    more = true;
+                }
+            }
+        }
+        if (!more) {
+            self.scheduled.store(false);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (auto& ring : self.inbound) {
+                if (!ring->empty()) {
+                    more = !self.scheduled.exchange(true);
+                    break;
+                }
+            }
+        }
+        // Behind whatever else the core has to do
+        if (more) {
+            boost::asio::post(engine_.context(core), [this, core]() { drain(core); });
+        }
+    }
+
+    // Try the waiting tasks again on the next turn of the sender's loop
+    void scheduleRetry(size_t from) {
+        Core& sender = cores_[from];
+        if (sender.retryPosted) {
+            return;
+        }
+        sender.retryPosted = true;
+        boost::asio::post(engine_.context(from), [this, from]() {
+            Core& sender = cores_[from];
+            sender.retryPosted = false;
+            bool waiting = false;
+            for (size_t to = 0; to < cores_.size(); ++to) {
+                std::deque<Task>& tasks = sender.deferred[to];
+                bool pushed = false;
+                while (!tasks.empty() && cores_[to].inbound[from]->tryPush(tasks.front())) {
+                    tasks.pop_front();
+                    ++sender.stats.sent;
+                    pushed = true;
+                }
+                if (pushed) {
+                    wake(from, to);
+                }
+                waiting = waiting || !tasks.empty();
+            }
+            if (waiting) {
+                scheduleRetry(from);
+            }
+        });
+    }
+
+    static void run(Task& task) {
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Core task failed: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Core task failed" << std::endl;
+        }
+    }
+
+    network::IoEngine& engine_;
+    std::vector<Core> cores_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_CORE_MESH_H
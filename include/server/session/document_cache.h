@@ -0,0 +1,488 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_CACHE_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/document/document_controller.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Keeps the documents in use in memory and evicts the cold ones
+ *
+ * A document is loaded on its first open() and pinned while it has
+ * subscribers, i.e. opens without a matching close(). Unpinned documents
+ * stay resident on an LRU list, most recently active last, until the
+ * resident bytes exceed the budget or evictIdle() finds them idle; then
+ * the least recently active is saved, e.g. as a snapshot, and freed.
+ *
+ * The loader and saver run outside the cache's lock, so a slow disk holds
+ * up only the document concerned. Opening a document that is still being
+ * loaded waits for that load; opening one that is being saved takes it
+ * back once the save is done, so no edit can land in a copy loaded from a
+ * snapshot older than the one being written. A document someone else
+ * still holds a reference to, e.g. a queued task, is not evicted.
+ */
+class DocumentCache {
+public:
+    using Controller = std::shared_ptr<DocumentController>;
+
+    // Builds a document from storage; may throw, and open() rethrows
+    using Loader = std::function<Controller(const std::string& documentId)>;
+
+    // Writes a document to storage before it is freed; may throw, and it then stays resident
+    using Saver = std::function<void(const std::string& documentId, const DocumentController& document)>;
+
+    // Estimates the bytes a resident document holds
+    using Sizer = std::function<size_t(const DocumentController& document)>;
+
+    struct Stats {
+        size_t resident = 0;        // Documents in memory
+        size_t pinned = 0;          // Of which have subscribers
+        size_t bytes = 0;           // Their estimated size
+        uint64_t hits = 0;          // Opens of a resident document
+        uint64_t misses = 0;        // Opens that loaded the document
+        uint64_t evictions = 0;     // Documents saved and freed
+        uint64_t saveFailures = 0;  // Evictions the saver refused
+        uint64_t prefetches = 0;    // Documents prefetch() loaded
+        uint64_t prefetchHits = 0;  // Opens that found a document prefetch() loaded and nothing had opened
+        uint64_t prefetchSkips = 0; // prefetch() calls turned down for want of room
+    };
+
+    /**
+     * @param budgetBytes Resident bytes above which unpinned documents are evicted
+     * @param loader Builds a document that is not resident
+     * @param saver Saves a document about to be freed
+     * @param sizer Size estimate of a document; by default, its text
+     */
+    DocumentCache(size_t budgetBytes, Loader loader, Saver saver, Sizer sizer = {})
+        : budgetBytes_(budgetBytes),
+          loader_(std::move(loader)),
+          saver_(std::move(saver)),
+          sizer_(sizer ? std::move(sizer) : Sizer(textSize)) {}
+
+    DocumentCache(const DocumentCache&) = delete;
+    DocumentCache& operator=(const DocumentCache&) = delete;
+
+    /**
+     * Subscribe to a document, loading it if it is not resident
+     * Each successful open needs a matching close()
+     *
+     * @param documentId The document
+     * @return The document, pinned until closed
+     * @throws whatever the loader throws; the open does not count then
+     */
+    Controller open(const std::string& documentId) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto found = entries_.find(documentId);
+        if (found != entries_.end()) {
+            Entry& entry = found->second;
+            ++entry.subscribers;
+            entry.lastActive = Clock::now();
+            unlink(entry);
+            if (entry.prefetched) {
+                entry.prefetched = false;
+                ++stats_.prefetchHits;
+            }
+            if (entry.controller) {
+                ++stats_.hits;
+                return entry.controller;
+            }
+            // Being loaded or saved: wait for that to finish
+            std::shared_future<Controller> pending = entry.pending;
+            lock.unlock();
+            return pending.get();
+        }
+
+        ++stats_.misses;
+        std::promise<Controller> loaded;
+        Entry& entry = entries_[documentId];
+        entry.subscribers = 1;
+        entry.lastActive = Clock::now();
+        entry.pending = loaded.get_future().share();
+        lock.unlock();
+
+        Controller controller;
+        size_t bytes = 0;
+        try {
+            controller = loader_(documentId);
+            if (!controller) {
+                throw std::runtime_error("No document " + documentId);
+            }
+            bytes = sizer_(*controller);
+        } catch (...) {
+            lock.lock();
+            entries_.erase(documentId);
+            loaded.set_exception(std::current_exception());
+            throw;
+        }
+
+        std::vector<Victim> victims;
+        lock.lock();
+        entry.controller = controller;
+        entry.bytes = bytes;
+        entry.pending = {};
+        bytes_ += bytes;
+        loaded.set_value(controller);
+        victims = evictLocked();
+        lock.unlock();
+        save(std::move(victims));
+        return controller;
+    }
+
+    /**
+     * Load a document without subscribing to it, e.g. to warm the cache on start
+     * It stays resident, unpinned, until it is evicted like any other; an
+     * open() meanwhile waits for this load instead of starting its own. Counts
+     * as an open in the stats.
+     *
+     * @param documentId The document
+     * @throws whatever the loader throws
+     */
+    void preload(const std::string& documentId) {
+        open(documentId);
+        close(documentId);
+    }
+
+    /**
+     * Load a document that is likely to be opened soon, if there is room for it
+     * Unlike preload(), it never displaces another document: nothing is
+     * loaded while the resident bytes are at the budget, and the document
+     * goes to the cold end of the LRU list, so if it does not fit it is the
+     * first evicted. An open() meanwhile waits for the load. A document
+     * already resident, or being loaded, is left where it is.
+     *
+     * @param documentId The document
+     * @return Whether the document was loaded, or was already in memory
+     * @throws whatever the loader throws
+     */
+    bool prefetch(const std::string& documentId) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (entries_.count(documentId) != 0) {
+            return true;
+        }
+        if (bytes_ >= budgetBytes_) {
+            ++stats_.prefetchSkips;
+            return false;
+        }
+        std::promise<Controller> loaded;
+        Entry& entry = entries_[documentId];
+        entry.pending = loaded.get_future().share();
+        entry.prefetched = true;
+        lock.unlock();
+
+        Controller controller;
+        size_t bytes = 0;
+        try {
+            controller = loader_(documentId);
+            if (!controller) {
+                throw std::runtime_error("No document " + documentId);
+            }
+            bytes = sizer_(*controller);
+        } catch (...) {
+            lock.lock();
+            entries_.erase(documentId);
+            loaded.set_exception(std::current_exception());
+            throw;
+        }
+
+        std::vector<Victim> victims;
+        lock.lock();
+        ++stats_.prefetches;
+        entry.controller = controller;
+        entry.bytes = bytes;
+        entry.pending = {};
+        bytes_ += bytes;
+        if (entry.subscribers == 0) {
+            // Coldest, so the budget takes it before anything that was in use; lru_ stays
+            // ordered by activity, so evictIdle() takes it along with the coldest
+            entry.lastActive = lru_.empty() ? Clock::now() : entries_.at(lru_.front()).lastActive;
+            entry.position = lru_.insert(lru_.begin(), documentId);
+            entry.linked = true;
+        }
+        loaded.set_value(controller);
+        victims = evictLocked();
+        lock.unlock();
+        save(std::move(victims));
+        return true;
+    }
+
+    /**
+     * Unsubscribe from a document; without subscribers it may be evicted
+     *
+     * @param documentId The document, opened before
+     */
+    void close(const std::string& documentId) {
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = entries_.find(documentId);
+            if (found == entries_.end() || found->second.subscribers == 0) {
+                return;
+            }
+            Entry& entry = found->second;
+            entry.lastActive = Clock::now();
+            if (--entry.subscribers == 0 && entry.controller) {
+                link(documentId, entry);
+            }
+            victims = evictLocked();
+        }
+        save(std::move(victims));
+    }
+
+    /**
+     * Note activity on a document, e.g. an edit, so it is evicted later
+     * Call refreshSize() too when the document has grown
+     *
+     * @param documentId The document
+     */
+    void touch(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = entries_.find(documentId);
+        if (found == entries_.end()) {
+            return;
+        }
+        found->second.lastActive = Clock::now();
+        if (found->second.linked) {
+            lru_.splice(lru_.end(), lru_, found->second.position);
+        }
+    }
+
+    /**
+     * Size a resident document again after it changed, evicting others if it outgrew the budget
+     *
+     * @param documentId The document
+     */
+    void refreshSize(const std::string& documentId) {
+        Controller controller = find(documentId);
+        if (!controller) {
+            return;
+        }
+        const size_t bytes = sizer_(*controller);
+
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = entries_.find(documentId);
+            if (found == entries_.end() || found->second.controller != controller) {
+                return;
+            }
+            bytes_ = bytes_ - found->second.bytes + bytes;
+            found->second.bytes = bytes;
+            victims = evictLocked();
+        }
+        save(std::move(victims));
+    }
+
+    /**
+     * Get a resident document without subscribing to it
+     *
+     * @param documentId The document
+     * @return The document, or nullptr if it is not in memory
+     */
+    Controller find(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = entries_.find(documentId);
+        return found != entries_.end() ? found->second.controller : nullptr;
+    }
+
+    /**
+     * Evict every unpinned document that has been idle for a while, e.g. from a timer
+     *
+     * @param idleFor How long since a document's last activity
+     * @return Documents evicted
+     */
+    size_t evictIdle(std::chrono::steady_clock::duration idleFor) {
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto cutoff = Clock::now() - idleFor;
+            for (auto it = lru_.begin(); it != lru_.end();) {
+                Entry& entry = entries_.at(*it);
+                if (entry.lastActive > cutoff) {
+                    break;
+                }
+                const std::string documentId = *it++;
+                if (entry.controller.use_count() == 1) {
+                    victims.push_back(detach(documentId, entry));
+                }
+            }
+        }
+        const size_t evicted = victims.size();
+        save(std::move(victims));
+        return evicted;
+    }
+
+    /**
+     * Compress every resident document that has not been edited for a while, pinned ones included
+     * Unlike eviction the documents stay open; the next edit decompresses
+     * one in place (see DocumentController::hibernate())
+     *
+     * @param idleFor How long since a document's last edit
+     * @return Documents compressed
+     */
+    size_t hibernateIdle(std::chrono::steady_clock::duration idleFor) {
+        std::vector<std::pair<std::string, Controller>> resident;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [documentId, entry] : entries_) {
+                if (entry.controller) {
+                    resident.emplace_back(documentId, entry.controller);
+                }
+            }
+        }
+        size_t hibernated = 0;
+        for (const auto& [documentId, controller] : resident) {
+            if (controller->hibernateIfIdle(idleFor)) {
+                ++hibernated;
+                refreshSize(documentId);
+            }
+        }
+        return hibernated;
+    }
+
+    /**
+     * Change the budget, evicting at once if it shrank below what is resident
+     *
+     * @param budgetBytes The new budget
+     */
+    void setBudget(size_t budgetBytes) {
+        std::vector<Victim> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budgetBytes_ = budgetBytes;
+            victims = evictLocked();
+        }
+        save(std::move(victims));
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        for (const auto& [documentId, entry] : entries_) {
+            stats.resident += entry.controller ? 1 : 0;
+            stats.pinned += entry.subscribers > 0 ? 1 : 0;
+        }
+        stats.bytes = bytes_;
+        return stats;
+    }
+
+    // Default size estimate: the text, which dominates once history is budgeted (see setHistoryBudget)
+    static size_t textSize(const DocumentController& document) {
+        return document.getTextBytes();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Controller controller;                    // Null while being loaded or saved
+        std::shared_future<Controller> pending;   // The load or save in progress
+        size_t subscribers = 0;
+        size_t bytes = 0;
+        Clock::time_point lastActive;
+        std::list<std::string>::iterator position;  // In lru_, when linked
+        bool linked = false;
+        bool prefetched = false;                  // Loaded by prefetch() and not opened since
+    };
+
+    // A document taken out of memory, to be saved outside the lock
+    struct Victim {
+        std::string documentId;
+        Controller controller;
+        std::shared_ptr<std::promise<Controller>> saved;
+    };
+
+    void link(const std::string& documentId, Entry& entry) {
+        entry.position = lru_.insert(lru_.end(), documentId);
+        entry.linked = true;
+    }
+
+    void unlink(Entry& entry) {
+        if (entry.linked) {
+            lru_.erase(entry.position);
+            entry.linked = false;
+        }
+    }
+
+    // Take a resident, unpinned document out of memory until it is saved
+    Victim detach(const std::string& documentId, Entry& entry) {
+        unlink(entry);
+        Victim victim{documentId, std::move(entry.controller), std::make_shared<std::promise<Controller>>()};
+        entry.controller.reset();
+        entry.pending = victim.saved->get_future().share();
+        bytes_ -= entry.bytes;
+        return victim;
+    }
+
+    // Detach the least recently active documents until the budget holds (mutex_ must be held)
+    std::vector<Victim> evictLocked() {
+        std::vector<Victim> victims;
+        for (auto it = lru_.begin(); it != lru_.end() && bytes_ > budgetBytes_;) {
+            const std::string documentId = *it++;
+            Entry& entry = entries_.at(documentId);
+            // Someone else still works on it; its edits would be lost
+            if (entry.controller.use_count() == 1) {
+                victims.push_back(detach(documentId, entry));
+            }
+        }
+        return victims;
+    }
+
+    // Save and free detached documents; a document reopened meanwhile, or that failed to save, stays
+    void save(std::vector<Victim> victims) {
+        for (Victim& victim : victims) {
+            bool saved = true;
+            try {
+                saver_(victim.documentId, *victim.controller);
+            } catch (...) {
+                saved = false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry& entry = entries_.at(victim.documentId);
+            entry.pending = {};
+            if (saved && entry.subscribers == 0) {
+                entries_.erase(victim.documentId);
+                ++stats_.evictions;
+                victim.saved->set_value(nullptr);
+                continue;
+            }
+            stats_.saveFailures += saved ? 0 : 1;
+            entry.controller = victim.controller;
+            bytes_ += entry.bytes;
+            if (entry.subscribers == 0) {
+                link(victim.documentId, entry);
+            }
+            victim.saved->set_value(victim.controller);
+        }
+    }
+
+    size_t budgetBytes_;
+    Loader loader_;
+    Saver saver_;
+    Sizer sizer_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;  // Resident documents and those being loaded or saved
+    std::list<std::string> lru_;                      // Unpinned resident documents, least recently active first
+    size_t bytes_ = 0;                                // Estimated size of the resident documents
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_CACHE_H
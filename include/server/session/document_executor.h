@@ -0,0 +1,299 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_EXECUTOR_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_EXECUTOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "common/network/io_engine.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Runs the work of each document on one fixed thread
+ *
+ * A document's ID picks one of a fixed number of shards, each a single
+ * thread, and every task posted for the document runs there in the order
+ * it was posted. OT state (a DocumentController and its OperationManager)
+ * is then only ever touched from one thread, so its locks go uncontended,
+ * while different documents spread across the shards.
+ *
+ * One very busy document can leave the other documents hashed to its
+ * shard waiting behind it. rebalance(), which a timer can also run every
+ * interval, moves those other documents to the least loaded shards so
+ * the hot one has its shard to itself. A document only moves while it
+ * has no task queued, so its tasks never run out of order.
+ *
+ * With setNumaPlacement() the shards are bound to NUMA nodes, and a
+ * document first posted from a thread bound to a node (an I/O thread
+ * serving the connection that opened it) is homed on a shard of that
+ * node, and is only rebalanced between that node's shards, so its state
+ * and the connection's buffers share a node.
+ */
+class DocumentExecutor {
+public:
+    using Task = std::function<void()>;
+
+    // Load statistics of one shard since the last rebalance
+    struct ShardStats {
+        uint64_t tasks = 0;    // Tasks posted
+        size_t queued = 0;     // Tasks posted but not yet finished
+        size_t documents = 0;  // Documents seen
+    };
+
+    /**
+     * Create the shards; no task runs until start()
+     *
+     * @param shards Number of shards and threads; 0 for one per hardware thread
+     * @param hotFactor How many times the average load a shard must carry before rebalance() moves work off it
+     */
+    explicit DocumentExecutor(size_t shards = 0, double hotFactor = 1.5)
+        : engine_(shards, false, "shard")
+        , hotFactor_(hotFactor)
+        , rebalanceTimer_(engine_.context(0)) {}
+
+    ~DocumentExecutor() {
+        stop();
+    }
+
+    void start() {
+        engine_.start();
+    }
+
+    /**
+     * Bind the shards to NUMA nodes and home documents on their first poster's node; call before start()
+     *
+     * @param topology The machine's nodes; must outlive the executor
+     */
+    void setNumaPlacement(const util::NumaTopology& topology) {
+        engine_.place_on_nodes(topology);
+        numa_ = true;
+    }
+
+    /**
+     * Run the shards on the given CPUs, e.g. cores isolated for them; call before start()
+     *
+     * @param cpus Shard i runs on cpus[i % size]; empty for no pinning
+     */
+    void setCpus(std::vector<unsigned> cpus) {
+        engine_.pin_to(std::move(cpus));
+    }
+
+    // Stop the shards; tasks not yet run are kept for the next start()
+    void stop() {
+        engine_.stop();
+    }
+
+    size_t getShardCount() const {
+        return engine_.size();
+    }
+
+    /**
+     * Run a task on the document's shard, after the tasks posted for it before
+     *
+     * @param documentId The document the task works on
+     * @param task The task
+     */
+    void post(const std::string& documentId, Task task) {
+        size_t shard;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = documents_.find(documentId);
+            if (found == documents_.end()) {
+                found = documents_.emplace(documentId, DocumentLoad(homeShard(documentId))).first;
+            }
+            DocumentLoad& load = found->second;
+            ++load.tasks;
+            ++load.queued;
+            shard = load.shard;
+        }
+        boost::asio::post(engine_.context(shard), [this, documentId, task = std::move(task)]() {
+            try {
+                task();
+            } catch (...) {
+                finished(documentId);
+                throw;
+            }
+            finished(documentId);
+        });
+    }
+
+    /**
+     * Get the shard a document's tasks currently run on
+     *
+     * @param documentId The document
+     * @return The shard index
+     */
+    size_t shardOf(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        return it != documents_.end() ? it->second.shard : hashShard(documentId);
+    }
+
+    // Load per shard since the last rebalance
+    std::vector<ShardStats> getShardStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<ShardStats> stats(engine_.size());
+        for (const auto& [documentId, load] : documents_) {
+            stats[load.shard].tasks += load.tasks;
+            stats[load.shard].queued += load.queued;
+            ++stats[load.shard].documents;
+        }
+        return stats;
+    }
+
+    /**
+     * Move documents off shards that carry much more than their share of the load
+     *
+     * Each hot shard keeps its busiest document; the others move, coolest
+     * last, to the least loaded shards until the hot shard is back near the
+     * average. Documents with tasks queued stay where they are. Load
+     * counts then start over, and idle documents are forgotten.
+     *
+     * @return Number of documents moved
+     */
+    size_t rebalance() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t shards = engine_.size();
+        std::vector<uint64_t> shardLoad(shards, 0);
+        std::vector<std::vector<std::pair<const std::string, DocumentLoad>*>> byShard(shards);
+        uint64_t total = 0;
+        for (auto& entry : documents_) {
+            shardLoad[entry.second.shard] += entry.second.tasks;
+            byShard[entry.second.shard].push_back(&entry);
+            total += entry.second.tasks;
+        }
+
+        size_t moved = 0;
+        const double average = static_cast<double>(total) / static_cast<double>(shards);
+        for (size_t shard = 0; shard < shards && shards > 1; ++shard) {
+            if (static_cast<double>(shardLoad[shard]) <= hotFactor_ * average || byShard[shard].size() < 2) {
+                continue;
+            }
+            auto& documents = byShard[shard];
+            std::sort(documents.begin(), documents.end(), [](const auto* a, const auto* b) {
+                return a->second.tasks > b->second.tasks;
+            });
+            for (size_t i = 1; i < documents.size() && static_cast<double>(shardLoad[shard]) > average; ++i) {
+                DocumentLoad& load = documents[i]->second;
+                if (load.queued > 0) {
+                    continue;
+                }
+                size_t target = shard;
+                for (size_t candidate = 0; candidate < shards; ++candidate) {
+                    if (shardLoad[candidate] < shardLoad[target] &&
+                        (!numa_ || engine_.node_of(candidate) == engine_.node_of(shard))) {
+                        target = candidate;
+                    }
+                }
+                if (target == shard) {
+                    break;
+                }
+                shardLoad[shard] -= load.tasks;
+                shardLoad[target] += load.tasks;
+                load.shard = target;
+                ++moved;
+            }
+        }
+
+        for (auto it = documents_.begin(); it != documents_.end();) {
+            if (it->second.queued == 0 && it->second.tasks == 0) {
+                it = documents_.erase(it);
+            } else {
+                it->second.tasks = 0;
+                ++it;
+            }
+        }
+        return moved;
+    }
+
+    /**
+     * Run rebalance() on a timer
+     *
+     * @param interval Time between rebalances; zero to stop
+     */
+    void setRebalanceInterval(std::chrono::milliseconds interval) {
+        boost::asio::post(engine_.context(0), [this, interval]() {
+            rebalanceInterval_ = interval;
+            scheduleRebalance();
+        });
+    }
+
+private:
+    struct DocumentLoad {
+        explicit DocumentLoad(size_t shard)
+            : shard(shard) {}
+
+        size_t shard;
+        uint64_t tasks = 0;
+        size_t queued = 0;
+    };
+
+    size_t hashShard(const std::string& documentId) const {
+        return std::hash<std::string>{}(documentId) % engine_.size();
+    }
+
+    // A new document's shard: by hash among those on the caller's node, if placed
+    size_t homeShard(const std::string& documentId) const {
+        const size_t node = util::NumaTopology::currentNode();
+        if (!numa_ || node == util::NumaTopology::NO_NODE) {
+            return hashShard(documentId);
+        }
+        std::vector<size_t> local;
+        for (size_t shard = 0; shard < engine_.size(); ++shard) {
+            if (engine_.node_of(shard) == node) {
+                local.push_back(shard);
+            }
+        }
+        if (local.empty()) {
+            return hashShard(documentId);
+        }
+        return local[std::hash<std::string>{}(documentId) % local.size()];
+    }
+
+    void finished(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        if (it != documents_.end() && it->second.queued > 0) {
+            --it->second.queued;
+        }
+    }
+
+    // Runs on shard 0, like the timer
+    void scheduleRebalance() {
+        rebalanceTimer_.cancel();
+        if (rebalanceInterval_.count() <= 0) {
+            return;
+        }
+        rebalanceTimer_.expires_after(rebalanceInterval_);
+        rebalanceTimer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                rebalance();
+                scheduleRebalance();
+            }
+        });
+    }
+
+    network::IoEngine engine_;
+    bool numa_ = false;
+    double hotFactor_;
+    // Documents with recent or queued tasks; the rest are on the shard their ID hashes to
+    std::unordered_map<std::string, DocumentLoad> documents_;
+    mutable std::mutex mutex_;
+    boost::asio::steady_timer rebalanceTimer_;
+    std::chrono::milliseconds rebalanceInterval_{0};
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_EXECUTOR_H
@@ -0,0 +1,577 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_EXPORTER_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_EXPORTER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/ot/rope.h"
+#include "server/priority_executor.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Exports documents as Markdown, HTML or PDF, off the threads that apply edits
+ *
+ * An export takes a snapshot of the document, which shares the rope's
+ * chunks and costs one copy of its root under the document's lock, and
+ * formats it on the executor's maintenance lane. So at most that lane's
+ * share of the workers formats exports. Each task formats one chunk
+ * of output and posts the next task, so an edit queued behind an export
+ * waits at most one chunk for a worker, however large the document.
+ *
+ * Output streams to the sink chunk by chunk as it is formatted.
+ * Finished exports are cached by document, revision and format, within a
+ * byte budget, least recently used first out; exporting a revision again
+ * replays the cached chunks without formatting. A request for an export
+ * that is still being formatted joins it: its sink gets the chunks so far
+ * at once, and the rest as they come.
+ *
+ * Sinks are called one at a time per export, on a worker, or on the
+ * caller's thread for chunks already formatted. They should only queue the
+ * chunk, e.g. on a connection. The executor must outlive the exporter.
+ * The destructor waits for the task formatting each export; exports it
+ * stops are left without their last chunk, and are not cached.
+ */
+class DocumentExporter {
+public:
+    enum class Format {
+        Markdown,   // The text with Markdown's syntax escaped, line breaks kept
+        Html,       // A page with the text preformatted
+        Pdf         // Monospaced pages, long lines wrapped
+    };
+
+    // Output formatted per task, and the size of the chunks sinks get
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    // One piece of an export's output
+    struct Chunk {
+        std::string_view data;
+        size_t offset = 0;      // Of data in the whole output
+        bool last = false;      // Whether the output ends with it
+    };
+
+    using Sink = std::function<void(const Chunk& chunk)>;
+
+    // A finished export, as cached
+    struct Export {
+        std::string documentId;
+        int64_t revision = 0;
+        Format format = Format::Markdown;
+        std::vector<std::string> chunks;
+        size_t bytes = 0;
+    };
+
+    struct Stats {
+        uint64_t exports = 0;       // Exports formatted
+        uint64_t cacheHits = 0;     // Requests replayed from the cache
+        uint64_t joined = 0;        // Requests that joined an export being formatted
+        uint64_t evictions = 0;
+        uint64_t bytesFormatted = 0;
+        size_t cached = 0;          // Exports in the cache
+        size_t cachedBytes = 0;
+        size_t running = 0;         // Exports being formatted
+    };
+
+    /**
+     * Constructor
+     *
+     * @param executor Where exports are formatted, on its maintenance lane
+     * @param cacheBudget Most bytes of output kept for exporting again
+     * @param chunkSize Output formatted per task
+     */
+    explicit DocumentExporter(PriorityExecutor& executor, size_t cacheBudget = 64 * 1024 * 1024,
+                              size_t chunkSize = DEFAULT_CHUNK_SIZE)
+        : executor_(executor), cacheBudget_(cacheBudget), chunkSize_(std::max<size_t>(chunkSize, 1)) {}
+
+    ~DocumentExporter() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+        idle_.wait(lock, [this] { return jobs_.empty(); });
+    }
+
+    DocumentExporter(const DocumentExporter&) = delete;
+    DocumentExporter& operator=(const DocumentExporter&) = delete;
+
+    /**
+     * Export a document as it is now
+     *
+     * @param documentId The document
+     * @param document Its OT state; only read here, for a snapshot
+     * @param format What to export it as
+     * @param sink Gets the output
+     * @return True if the export was cached and the sink already has all of it
+     */
+    bool exportDocument(const std::string& documentId, const DocumentController& document, Format format, Sink sink) {
+        return exportSnapshot(documentId, document.getSnapshot(), format, std::move(sink));
+    }
+
+    // Export a snapshot of a document; true if it was cached and the sink already has all of it
+    bool exportSnapshot(const std::string& documentId, DocumentController::DocumentSnapshot snapshot, Format format,
+                        Sink sink) {
+        const std::string key = keyOf(documentId, snapshot.revision, format);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (auto cached = cacheIndex_.find(key); cached != cacheIndex_.end()) {
+            cache_.splice(cache_.begin(), cache_, cached->second);
+            std::shared_ptr<const Export> result = *cached->second;
+            stats_.cacheHits++;
+            lock.unlock();
+            size_t offset = 0;
+            for (size_t i = 0; i < result->chunks.size(); ++i) {
+                sink(Chunk{result->chunks[i], offset, i + 1 == result->chunks.size()});
+                offset += result->chunks[i].size();
+            }
+            if (result->chunks.empty()) {
+                sink(Chunk{{}, 0, true});
+            }
+            return true;
+        }
+        if (auto running = jobs_.find(key); running != jobs_.end()) {
+            // Replay what it has so far under its lock, so no chunk comes between
+            std::shared_ptr<Job> job = running->second;
+            stats_.joined++;
+            std::lock_guard<std::mutex> jobLock(job->mutex);
+            lock.unlock();
+            const std::vector<std::string>& chunks = job->result.chunks;
+            size_t offset = 0;
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                sink(Chunk{chunks[i], offset, job->finished && i + 1 == chunks.size()});
+                offset += chunks[i].size();
+            }
+            if (job->finished && chunks.empty()) {
+                sink(Chunk{{}, 0, true});
+            }
+            if (!job->finished) {
+                job->sinks.push_back(std::move(sink));
+            }
+            return false;
+        }
+
+        auto job = std::make_shared<Job>();
+        job->key = key;
+        job->result.documentId = documentId;
+        job->result.revision = snapshot.revision;
+        job->result.format = format;
+        job->formatter = makeFormatter(format, documentId, std::move(snapshot.content));
+        job->sinks.push_back(std::move(sink));
+        jobs_.emplace(key, job);
+        stats_.exports++;
+        lock.unlock();
+        schedule(std::move(job));
+        return false;
+    }
+
+    // A finished export, if it is cached
+    std::shared_ptr<const Export> getCached(const std::string& documentId, int64_t revision, Format format) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cacheIndex_.find(keyOf(documentId, revision, format));
+        return it != cacheIndex_.end() ? *it->second : nullptr;
+    }
+
+    // Drop a document's cached exports, e.g. once it is deleted
+    void forget(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = cache_.begin(); it != cache_.end();) {
+            if ((*it)->documentId == documentId) {
+                cachedBytes_ -= (*it)->bytes;
+                cacheIndex_.erase(keyOf((*it)->documentId, (*it)->revision, (*it)->format));
+                it = cache_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.cached = cache_.size();
+        stats.cachedBytes = cachedBytes_;
+        stats.running = jobs_.size();
+        return stats;
+    }
+
+private:
+    // Turns a text into a format's output a piece at a time
+    class Formatter {
+    public:
+        explicit Formatter(ot::Rope text)
+            : text_(std::move(text)) {}
+
+        virtual ~Formatter() = default;
+
+        // Append about budget bytes of output; true once all of it is appended
+        virtual bool next(std::string& out, size_t budget) = 0;
+
+    protected:
+        // Feed characters of the text from where the last call stopped, until out holds budget bytes
+        template <typename Fn>
+        bool feed(std::string& out, size_t budget, Fn&& append) {
+            const size_t length = text_.length();
+            if (position_ < length) {
+                text_.forEachChunk(position_, length - position_, [&](std::string_view piece) {
+                    for (char c : piece) {
+                        append(c, out);
+                        ++position_;
+                        if (out.size() >= budget) {
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+            }
+            return position_ == length;
+        }
+
+        ot::Rope text_;
+        size_t position_ = 0;
+    };
+
+    class MarkdownFormatter : public Formatter {
+    public:
+        using Formatter::Formatter;
+
+        bool next(std::string& out, size_t budget) override {
+            return feed(out, budget, [this](char c, std::string& to) { append(c, to); });
+        }
+
+    private:
+        void append(char c, std::string& out) {
+            if (c == '\r') {
+                return;
+            }
+            if (c == '\n') {
+                // Two trailing spaces keep the line break; an empty line still ends the paragraph
+                if (column_ > 0) {
+                    out += "  ";
+                }
+                out += '\n';
+                column_ = 0;
+                digitRun_ = false;
+                leading_ = true;
+                return;
+            }
+            // Leading blanks would make an indented code block
+            if (leading_ && (c == ' ' || c == '\t')) {
+                out += c == '\t' ? "&nbsp;&nbsp;&nbsp;&nbsp;" : "&nbsp;";
+                ++column_;
+                return;
+            }
+            const bool startsBlock = column_ == 0 && std::strchr("#+-=", c) != nullptr;
+            const bool endsNumber = digitRun_ && (c == '.' || c == ')');
+            if (std::strchr("\\`*_[]<>|~&", c) != nullptr || startsBlock || endsNumber) {
+                out += '\\';
+            }
+            out += c;
+            digitRun_ = (column_ == 0 || digitRun_) && c >= '0' && c <= '9';
+            leading_ = false;
+            ++column_;
+        }
+
+        size_t column_ = 0;
+        bool digitRun_ = false;     // The line so far is a number
+        bool leading_ = true;       // The line so far is blank
+    };
+
+    class HtmlFormatter : public Formatter {
+    public:
+        HtmlFormatter(ot::Rope text, const std::string& title)
+            : Formatter(std::move(text)), title_(title) {}
+
+        bool next(std::string& out, size_t budget) override {
+            if (!started_) {
+                out += "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>";
+                for (char c : title_) {
+                    escape(c, out);
+                }
+                out += "</title>\n</head>\n<body>\n<pre>";
+                started_ = true;
+            }
+            if (!feed(out, budget, escape)) {
+                return false;
+            }
+            out += "</pre>\n</body>\n</html>\n";
+            return true;
+        }
+
+    private:
+        static void escape(char c, std::string& out) {
+            switch (c) {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                case '\r': break;
+                default: out += c;
+            }
+        }
+
+        std::string title_;
+        bool started_ = false;
+    };
+
+    /**
+     * Writes PDF 1.4 by hand: US Letter pages of Courier, one content
+     * stream each. Objects 1 to 3 are the catalog, the page tree and the
+     * font; pages follow as content and page pairs, and the page tree,
+     * which lists them, is written last, with the offsets for the xref.
+     * Characters outside ASCII are shown as '?'.
+     */
+    class PdfFormatter : public Formatter {
+    public:
+        using Formatter::Formatter;
+
+        static constexpr size_t LINES_PER_PAGE = 57;
+        static constexpr size_t COLUMNS = 84;
+
+        bool next(std::string& out, size_t budget) override {
+            if (offsets_.empty()) {
+                offsets_.assign(4, 0);
+                emit(out, "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+                object(out, 3, "<< /Type /Font /Subtype /Type1 /BaseFont /Courier >>");
+            }
+            while (out.size() < budget) {
+                if (page(out)) {
+                    finish(out);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        // Write the next page; true if it was the last
+        bool page(std::string& out) {
+            std::vector<std::string> lines;
+            std::string line;
+            bool full = false;
+            const size_t length = text_.length();
+            while (position_ < length && !full) {
+                text_.forEachChunk(position_, length - position_, [&](std::string_view piece) {
+                    for (char c : piece) {
+                        // A character that would not fit wraps, unless the page is full
+                        if (c != '\n' && line.size() == COLUMNS) {
+                            lines.push_back(std::move(line));
+                            line.clear();
+                        }
+                        if (lines.size() == LINES_PER_PAGE) {
+                            full = true;
+                            return false;
+                        }
+                        ++position_;
+                        if (c == '\n') {
+                            lines.push_back(std::move(line));
+                            line.clear();
+                        } else if (c == '\t') {
+                            line += ' ';
+                        } else if (static_cast<unsigned char>(c) < 0x80) {
+                            if (c != '\r') {
+                                line += c;
+                            }
+                        } else if ((static_cast<unsigned char>(c) & 0xC0) != 0x80) {
+                            line += '?';
+                        }
+                    }
+                    return true;
+                });
+            }
+            if (!line.empty()) {
+                lines.push_back(std::move(line));
+            }
+
+            std::string content = "BT /F1 10 Tf 12 TL 54 750 Td\n";
+            for (const std::string& shown : lines) {
+                content += '(';
+                for (char c : shown) {
+                    if (c == '(' || c == ')' || c == '\\') {
+                        content += '\\';
+                    }
+                    content += c;
+                }
+                content += ") '\n";
+            }
+            content += "ET";
+
+            const size_t number = offsets_.size();
+            offsets_.resize(number + 2, 0);
+            object(out, number, "<< /Length " + std::to_string(content.size()) + " >>\nstream\n" + content +
+                                    "\nendstream");
+            object(out, number + 1, "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] /Contents " +
+                                        std::to_string(number) + " 0 R /Resources << /Font << /F1 3 0 R >> >> >>");
+            pages_.push_back(number + 1);
+            return position_ == length;
+        }
+
+        void finish(std::string& out) {
+            std::string kids;
+            for (size_t page : pages_) {
+                kids += std::to_string(page) + " 0 R ";
+            }
+            object(out, 2, "<< /Type /Pages /Kids [" + kids + "] /Count " + std::to_string(pages_.size()) + " >>");
+            object(out, 1, "<< /Type /Catalog /Pages 2 0 R >>");
+            const size_t xref = written_;
+            std::string table = "xref\n0 " + std::to_string(offsets_.size()) + "\n0000000000 65535 f \n";
+            for (size_t i = 1; i < offsets_.size(); ++i) {
+                char entry[24];
+                std::snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offsets_[i]);
+                table += entry;
+            }
+            table += "trailer\n<< /Size " + std::to_string(offsets_.size()) + " /Root 1 0 R >>\nstartxref\n" +
+                     std::to_string(xref) + "\n%%EOF\n";
+            emit(out, table);
+        }
+
+        void object(std::string& out, size_t number, const std::string& body) {
+            offsets_[number] = written_;
+            emit(out, std::to_string(number) + " 0 obj\n" + body + "\nendobj\n");
+        }
+
+        void emit(std::string& out, std::string_view data) {
+            out += data;
+            written_ += data.size();
+        }
+
+        std::vector<size_t> offsets_;   // Of each object, by number; empty until the header is written
+        std::vector<size_t> pages_;     // Object numbers of the pages
+        size_t written_ = 0;
+    };
+
+    struct Job {
+        std::string key;
+        std::unique_ptr<Formatter> formatter;
+        std::mutex mutex;               // Guards the members below; held while sinks get all but the last chunk
+        Export result;
+        std::vector<Sink> sinks;
+        bool finished = false;          // All of it is formatted; its sinks are being handed the last chunk
+    };
+
+    static std::string keyOf(const std::string& documentId, int64_t revision, Format format) {
+        std::string key = documentId;
+        key += '\0';
+        key += std::to_string(revision);
+        key += '\0';
+        key += static_cast<char>('0' + static_cast<int>(format));
+        return key;
+    }
+
+    static std::unique_ptr<Formatter> makeFormatter(Format format, const std::string& documentId, ot::Rope text) {
+        switch (format) {
+            case Format::Html:
+                return std::make_unique<HtmlFormatter>(std::move(text), documentId);
+            case Format::Pdf:
+                return std::make_unique<PdfFormatter>(std::move(text));
+            case Format::Markdown:
+            default:
+                return std::make_unique<MarkdownFormatter>(std::move(text));
+        }
+    }
+
+    void schedule(std::shared_ptr<Job> job) {
+        executor_.post(Lane::Maintenance, [this, job = std::move(job)]() mutable {
+            step(std::move(job));
+        });
+    }
+
+    // Format one chunk of an export and hand it on; post the next, or cache the whole
+    void step(std::shared_ptr<Job> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) {
+                jobs_.erase(job->key);
+                idle_.notify_all();
+                return;
+            }
+        }
+        std::string chunk;
+        chunk.reserve(chunkSize_);
+        const bool done = job->formatter->next(chunk, chunkSize_);
+        if (!done) {
+            {
+                std::lock_guard<std::mutex> jobLock(job->mutex);
+                const Chunk piece{chunk, job->result.bytes, false};
+                for (const Sink& sink : job->sinks) {
+                    sink(piece);
+                }
+                job->result.bytes += chunk.size();
+                if (!chunk.empty()) {
+                    job->result.chunks.push_back(std::move(chunk));
+                }
+            }
+            schedule(std::move(job));
+            return;
+        }
+
+        // Cache the whole before the last chunk goes out, so whoever has all of it finds it cached;
+        // the cache is looked up before the running jobs, so nobody joins a cached job
+        std::vector<Sink> sinks;
+        const size_t offset = job->result.bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::lock_guard<std::mutex> jobLock(job->mutex);
+            job->result.bytes += chunk.size();
+            if (!chunk.empty()) {
+                job->result.chunks.push_back(chunk);
+            }
+            job->finished = true;
+            sinks.swap(job->sinks);
+            stats_.bytesFormatted += job->result.bytes;
+            if (job->result.bytes <= cacheBudget_) {
+                cache_.push_front(std::make_shared<const Export>(std::move(job->result)));
+                cacheIndex_[job->key] = cache_.begin();
+                cachedBytes_ += cache_.front()->bytes;
+                evict();
+            }
+        }
+        const Chunk piece{chunk, offset, true};
+        for (const Sink& sink : sinks) {
+            sink(piece);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(job->key);
+        idle_.notify_all();
+    }
+
+    // Drop the least recently used exports past the budget (mutex_ must be held)
+    void evict() {
+        while (cachedBytes_ > cacheBudget_ && !cache_.empty()) {
+            const Export& oldest = *cache_.back();
+            cachedBytes_ -= oldest.bytes;
+            cacheIndex_.erase(keyOf(oldest.documentId, oldest.revision, oldest.format));
+            cache_.pop_back();
+            stats_.evictions++;
+        }
+    }
+
+    using CacheList = std::list<std::shared_ptr<const Export>>;
+
+    PriorityExecutor& executor_;
+    const size_t cacheBudget_;
+    const size_t chunkSize_;
+    mutable std::mutex mutex_;      // Guards the members below
+    std::condition_variable idle_;
+    CacheList cache_;               // Most recently used first
+    std::unordered_map<std::string, CacheList::iterator> cacheIndex_;
+    size_t cachedBytes_ = 0;
+    std::unordered_map<std::string, std::shared_ptr<Job>> jobs_;
+    Stats stats_;
+    bool stopping_ = false;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_EXPORTER_H
@@ -0,0 +1,376 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_MIGRATION_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_MIGRATION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/document/document_controller.h"
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * One step of moving a document to another node, as the source sends it
+ *
+ * The first batch carries the content at fromRevision; every batch then
+ * carries the operations applied from fromRevision on, so the target's
+ * log holds them too and can transform edits based on any of them. The
+ * last one is made as the source freezes. Batches after it carry no
+ * operations, only the edits the source held since, still to be
+ * transformed.
+ */
+struct MigrationBatch {
+    std::string documentId;
+    int64_t fromRevision = 0;
+    std::optional<std::string> content;                // First batch only
+    std::vector<ot::OperationPtr> operations;
+    bool last = false;
+    std::vector<DocumentController::Edit> pending;     // Batches after the last only
+
+    // The revision the target is at once it applied the batch
+    int64_t toRevision() const {
+        return fromRevision + static_cast<int64_t>(operations.size());
+    }
+
+    nlohmann::json toJson() const {
+        nlohmann::json j = {{"documentId", documentId}, {"fromRevision", fromRevision}, {"last", last}};
+        if (content) {
+            j["content"] = *content;
+        }
+        nlohmann::json ops = nlohmann::json::array();
+        for (const auto& op : operations) {
+            ops.push_back({{"id", op->getId()}, {"op", op->serialize()}});
+        }
+        j["operations"] = std::move(ops);
+        nlohmann::json edits = nlohmann::json::array();
+        for (const auto& edit : pending) {
+            edits.push_back({{"id", edit.op->getId()}, {"op", edit.op->serialize()},
+                             {"userId", edit.userId}, {"baseRevision", edit.baseRevision}});
+        }
+        j["pending"] = std::move(edits);
+        return j;
+    }
+
+    // @throws nlohmann::json::exception or std::runtime_error if the batch is malformed
+    static MigrationBatch fromJson(const nlohmann::json& j) {
+        MigrationBatch batch;
+        j.at("documentId").get_to(batch.documentId);
+        j.at("fromRevision").get_to(batch.fromRevision);
+        j.at("last").get_to(batch.last);
+        if (j.contains("content")) {
+            batch.content = j.at("content").get<std::string>();
+        }
+        for (const auto& entry : j.at("operations")) {
+            batch.operations.push_back(operationOf(entry));
+        }
+        for (const auto& entry : j.at("pending")) {
+            batch.pending.push_back({operationOf(entry), entry.at("userId").get<std::string>(),
+                                     entry.at("baseRevision").get<int64_t>()});
+        }
+        return batch;
+    }
+
+private:
+    static ot::OperationPtr operationOf(const nlohmann::json& entry) {
+        ot::OperationPtr op = ot::OperationFactory::deserialize(entry.at("op").get<std::string>());
+        op->setId(entry.at("id").get<int64_t>());
+        return op;
+    }
+};
+
+/**
+ * Apply operations another node already transformed, at the same revisions and with the same IDs
+ * Who made them is not carried over, so undo history stays behind on that node
+ *
+ * @param document The document, at the revision the first operation was applied at
+ * @param operations The operations, oldest first
+ * @throws std::runtime_error if one does not apply
+ */
+inline void replayOperations(DocumentController& document, const std::vector<ot::OperationPtr>& operations) {
+    for (const auto& op : operations) {
+        ot::OperationPtr copy = op->clone();
+        copy->setId(op->getId());
+        copy->setSource(op->getSource());
+        if (!document.applyOperation(copy, std::string(), false)) {
+            throw std::runtime_error("Operation from another node does not apply at revision " +
+                                     std::to_string(document.getRevision()));
+        }
+    }
+}
+
+/**
+ * The node a document moves away from
+ *
+ * Moving a document while it is edited takes three steps:
+ *
+ * 1. start() sends the content at a revision every client is at or past,
+ *    with the operations since, while edits carry on as usual.
+ * 2. catchUp() sends what was applied since the last batch, as often as
+ *    it takes for the target to be nearly level, e.g. until lag() is a
+ *    few operations.
+ * 3. freeze() stops edits, from then on held by submit() instead of
+ *    applied, and makes the last batch of whatever is left. Once the
+ *    target has applied it, redirect() tells the clients where the
+ *    document went, and forwardHeld() sends on the edits held meanwhile
+ *    and any that arrive before every client has moved.
+ *
+ * Only step 3 holds edits back, for one batch of a few operations, so
+ * clients see a pause of a round trip between the nodes. Nothing is
+ * dropped: an edit held by the source reaches the target with its base
+ * revision, and the target transforms it as the source would have.
+ *
+ * While a migration runs, the document's edits go through submit(),
+ * which applies them under the lock freeze() takes, so none slips in
+ * after the last batch was made. Thread-safe.
+ */
+class MigrationSource {
+public:
+    /**
+     * @param document The document to move
+     * @param documentId Its ID
+     * @param lowWatermark The oldest revision a client of the document may still send edits on
+     */
+    MigrationSource(std::shared_ptr<DocumentController> document, std::string documentId, int64_t lowWatermark)
+        : document_(std::move(document)), documentId_(std::move(documentId)), lowWatermark_(lowWatermark) {}
+
+    /**
+     * Make the first batch: the content a client may still be behind at, and what was applied since
+     *
+     * @return The batch
+     * @throws std::runtime_error if that revision can no longer be rebuilt
+     */
+    MigrationBatch start() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const int64_t base = std::max(lowWatermark_, document_->getOldestRevision());
+        std::optional<DocumentController::DocumentSnapshot> snapshot = document_->materializeAt(base);
+        std::optional<std::vector<ot::OperationPtr>> operations = document_->getOperationsSince(base);
+        if (!snapshot || !operations) {
+            throw std::runtime_error("Cannot rebuild the document to migrate it from revision " + std::to_string(base));
+        }
+        MigrationBatch batch = makeBatch(base, std::move(*operations));
+        batch.content = snapshot->content.toString();
+        return batch;
+    }
+
+    // Make a batch of what was applied since the last one; call after start()
+    MigrationBatch catchUp() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return nextBatchLocked();
+    }
+
+    // Operations applied since the last batch, what the next one would carry
+    int64_t lag() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return document_->getRevision() - sent_;
+    }
+
+    /**
+     * Stop applying edits and make the last batch
+     *
+     * @return The batch; the target is at the cutover revision once it applied it
+     */
+    MigrationBatch freeze() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frozen_ = true;
+        MigrationBatch batch = nextBatchLocked();
+        batch.last = true;
+        cutover_ = batch.toRevision();
+        return batch;
+    }
+
+    /**
+     * Apply an edit to the document, or hold it if the document is frozen
+     * Held edits go to the target with forwardHeld()
+     *
+     * @param edit The edit as received, not yet transformed
+     * @return The edit as applied, nullptr if it did not apply; std::nullopt if it was held
+     */
+    std::optional<ot::OperationPtr> submit(DocumentController::Edit edit) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (frozen_) {
+            held_.push_back(std::move(edit));
+            return std::nullopt;
+        }
+        return document_->applyBatch(std::span<const DocumentController::Edit>(&edit, 1)).front();
+    }
+
+    /**
+     * Make a batch of the edits held since freeze() or the last forwardHeld()
+     *
+     * @return The batch, with no pending edits if none were held
+     * @throws std::logic_error if the source was not frozen
+     */
+    MigrationBatch forwardHeld() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!frozen_) {
+            throw std::logic_error("Forwarding edits before the document was frozen");
+        }
+        MigrationBatch batch;
+        batch.documentId = documentId_;
+        batch.fromRevision = cutover_;
+        batch.pending = std::move(held_);
+        held_.clear();
+        return batch;
+    }
+
+    bool frozen() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return frozen_;
+    }
+
+    /**
+     * Make the message that sends the document's clients to the target, once it applied the last batch
+     * A DOC_RESPONSE that fails, with metadata "redirect" the target's
+     * address and "migrated" set, and documentVersion the cutover
+     * revision. Each client opens the document at the target again with
+     * documentVersion its last acknowledged revision, and gets only what
+     * it missed (see MigrationTarget::resume()).
+     *
+     * @param address Where clients reach the target
+     * @return The message, to broadcast to the document's clients
+     * @throws std::logic_error if the source was not frozen
+     */
+    protocol::DocumentMessage redirect(const std::string& address) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!frozen_) {
+            throw std::logic_error("Redirect before the document was frozen");
+        }
+        protocol::DocumentMessage message(protocol::MessageType::DOC_RESPONSE);
+        message.documentId = documentId_;
+        message.success = false;
+        message.errorMessage = "Document moved to another node";
+        message.documentVersion = static_cast<uint64_t>(cutover_);
+        message.metadata["redirect"] = address;
+        message.metadata["migrated"] = "true";
+        return message;
+    }
+
+private:
+    MigrationBatch makeBatch(int64_t from, std::vector<ot::OperationPtr> operations) {
+        MigrationBatch batch;
+        batch.documentId = documentId_;
+        batch.fromRevision = from;
+        batch.operations = std::move(operations);
+        sent_ = batch.toRevision();
+        return batch;
+    }
+
+    // mutex_ must be held
+    MigrationBatch nextBatchLocked() {
+        std::optional<std::vector<ot::OperationPtr>> operations = document_->getOperationsSince(sent_);
+        if (!operations) {
+            throw std::runtime_error("The document's log moved past the migration at revision " + std::to_string(sent_));
+        }
+        return makeBatch(sent_, std::move(*operations));
+    }
+
+    const std::shared_ptr<DocumentController> document_;
+    const std::string documentId_;
+    const int64_t lowWatermark_;
+
+    mutable std::mutex mutex_;      // Guards the members below
+    int64_t sent_ = 0;              // Revision the target is at after the batches made so far
+    bool frozen_ = false;
+    int64_t cutover_ = 0;
+    std::vector<DocumentController::Edit> held_;
+};
+
+/**
+ * The node a document moves to
+ *
+ * Builds the document from the source's batches, in the order they were
+ * made. The document is not to be edited until ready(), after the last
+ * batch; the edits the source forwards after that are transformed and
+ * applied like any other.
+ * Not thread-safe; the owner serializes access, e.g. by running it as the
+ * document's tasks.
+ */
+class MigrationTarget {
+public:
+    // @param logRetention Operations the document keeps for transforming late edits
+    explicit MigrationTarget(size_t logRetention = 10000) : logRetention_(logRetention) {}
+
+    /**
+     * Apply a batch from the source
+     *
+     * @param batch The next batch
+     * @return The forwarded edits as applied, nullptr for each that could not be
+     * @throws std::runtime_error if the batch does not follow the one before or an operation does not apply
+     */
+    std::vector<ot::OperationPtr> receive(const MigrationBatch& batch) {
+        if (!document_) {
+            if (!batch.content) {
+                throw std::runtime_error("Migration of \"" + batch.documentId + "\" started without its content");
+            }
+            documentId_ = batch.documentId;
+            document_ = std::make_shared<DocumentController>(
+                DocumentController::DocumentSnapshot{ot::Rope(*batch.content), batch.fromRevision}, logRetention_);
+        } else if (batch.documentId != documentId_ ||
+                   (ready_ ? batch.fromRevision != cutover_ || !batch.operations.empty()
+                           : batch.fromRevision != document_->getRevision() || !batch.pending.empty())) {
+            throw std::runtime_error("Migration batch for \"" + batch.documentId + "\" out of order");
+        }
+        if (ready_) {
+            return batch.pending.empty() ? std::vector<ot::OperationPtr>() : document_->applyBatch(batch.pending);
+        }
+
+        // Already transformed on the source: applied as they are
+        replayOperations(*document_, batch.operations);
+        if (batch.last) {
+            ready_ = true;
+            cutover_ = document_->getRevision();
+        }
+        return {};
+    }
+
+    /**
+     * Get what a redirected client missed since its last acknowledged revision
+     *
+     * @param revision The client's last acknowledged revision
+     * @return The operations since, or std::nullopt if the client must load a snapshot instead
+     */
+    std::optional<std::vector<ot::OperationPtr>> resume(int64_t revision) const {
+        if (!document_) {
+            return std::nullopt;
+        }
+        return document_->getOperationsSince(revision);
+    }
+
+    // Check whether the last batch was applied, and the document may be edited here
+    bool ready() const {
+        return ready_;
+    }
+
+    // The revision the source froze at, once ready()
+    int64_t cutoverRevision() const {
+        return cutover_;
+    }
+
+    // The document, nullptr before the first batch
+    const std::shared_ptr<DocumentController>& document() const {
+        return document_;
+    }
+
+private:
+    const size_t logRetention_;
+    std::string documentId_;
+    std::shared_ptr<DocumentController> document_;
+    bool ready_ = false;
+    int64_t cutover_ = 0;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_MIGRATION_H
@@ -0,0 +1,287 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_PREFETCHER_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_PREFETCHER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "common/models/file_system.h"
+#include "server/priority_executor.h"
+#include "server/session/document_cache.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Warms the documents a user is likely to open next from a directory they are browsing
+ *
+ * Someone who lists a directory usually opens one of its files next,
+ * most often one that changed lately or one opened often. onListing()
+ * scores the directory's files by both: the recency of their last change
+ * and how often they were opened (see recordOpen()), each decaying by its
+ * half-life. It then prefetches the best few that are not in memory
+ * already, so the DOC_OPEN that follows finds them warm.
+ *
+ * Each prefetch is a task in the Maintenance lane of a PriorityExecutor,
+ * behind edits and opens. It loads the document through
+ * DocumentCache::prefetch(), which builds it from its snapshot and log,
+ * and then hands it to the warm hook for whatever else an open needs,
+ * e.g. the search index or the encoded DOC_OPEN body (OpenResponseCache).
+ * The cache's budget bounds prefetching: nothing is loaded into a full
+ * cache, and what is loaded is first in line for eviction, so it never
+ * displaces a document in use. Few prefetches run at once, and a listing
+ * that comes while they are busy does not queue more.
+ *
+ * Thread-safe. The destructor waits for the prefetches already posted,
+ * so the cache and the executor must outlive the prefetcher.
+ */
+class DocumentPrefetcher {
+public:
+    using Clock = std::chrono::system_clock;  // As file modification times
+
+    // Names the document a file holds; by default, its path below the workspace root
+    using DocumentIdOf = std::function<std::string(const fs::File& file)>;
+
+    // Prepares a prefetched document for its open beyond loading it; may throw
+    using Warm = std::function<void(const std::string& documentId, const DocumentCache::Controller& document)>;
+
+    struct Config {
+        size_t candidates = 3;                        // Documents prefetched per listing
+        size_t maxInFlight = 4;                       // Prefetches posted and not yet finished
+        std::chrono::seconds recencyHalfLife{3600};   // Age at which a change scores half of one made now
+        std::chrono::seconds frequencyHalfLife{86400};  // Age at which an open counts half
+        double frequencyWeight = 0.5;                 // Score of a fresh open, against 1 for a fresh change
+        size_t maxTracked = 4096;                     // Documents whose opens are remembered
+    };
+
+    struct Stats {
+        uint64_t listings = 0;     // onListing() calls
+        uint64_t scheduled = 0;    // Prefetches posted
+        uint64_t loaded = 0;       // Documents prefetched into the cache, and warmed
+        uint64_t resident = 0;     // Candidates found in memory already
+        uint64_t skipped = 0;      // Prefetches the cache turned down for want of room
+        uint64_t dropped = 0;      // Candidates not posted because maxInFlight were running
+        uint64_t failed = 0;       // Prefetches whose load or warm hook threw
+    };
+
+    /**
+     * @param cache The cache to prefetch into; must outlive the prefetcher
+     * @param executor Runs the prefetches in its Maintenance lane; must outlive the prefetcher
+     * @param documentIdOf The document a file holds
+     * @param warm Further preparation of a prefetched document; none by default
+     */
+    DocumentPrefetcher(DocumentCache& cache, PriorityExecutor& executor, DocumentIdOf documentIdOf = {},
+                       Warm warm = {})
+        : DocumentPrefetcher(cache, executor, Config(), std::move(documentIdOf), std::move(warm)) {}
+
+    DocumentPrefetcher(DocumentCache& cache, PriorityExecutor& executor, Config config,
+                       DocumentIdOf documentIdOf = {}, Warm warm = {})
+        : cache_(cache),
+          executor_(executor),
+          config_(config),
+          documentIdOf_(documentIdOf ? std::move(documentIdOf) : DocumentIdOf(relativePath)),
+          warm_(std::move(warm)) {}
+
+    ~DocumentPrefetcher() {
+        wait();
+    }
+
+    DocumentPrefetcher(const DocumentPrefetcher&) = delete;
+    DocumentPrefetcher& operator=(const DocumentPrefetcher&) = delete;
+
+    /**
+     * Note that a document was opened, for the frequency part of the score
+     *
+     * @param documentId The document
+     * @param now When
+     */
+    void recordOpen(const std::string& documentId, Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Opens& opens = opens_[documentId];
+        opens.count = decayed(opens, now) + 1.0;
+        opens.at = now;
+        if (opens_.size() > config_.maxTracked) {
+            forgetRarest(now);
+        }
+    }
+
+    /**
+     * Prefetch the likeliest next opens of a directory a user listed; returns at once
+     *
+     * @param directory The directory listed
+     * @param now When, for the scores
+     * @return The documents posted for prefetching, likeliest first
+     */
+    std::vector<std::string> onListing(const fs::Directory& directory, Clock::time_point now = Clock::now()) {
+        std::vector<std::pair<double, std::string>> scored;
+        std::string after;
+        for (;;) {
+            const std::vector<fs::Directory::Entry> page = directory.listChildren(after, LIST_PAGE);
+            for (const auto& entry : page) {
+                if (auto file = entry.node->asFile()) {
+                    std::string documentId = documentIdOf_(*file);
+                    scored.emplace_back(score(documentId, file->getModifiedTime(), now), std::move(documentId));
+                }
+            }
+            if (page.size() < LIST_PAGE) {
+                break;
+            }
+            after = page.back().name;
+        }
+        std::sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::vector<std::string> posted;
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.listings;
+        for (auto& [score, documentId] : scored) {
+            if (posted.size() == config_.candidates) {
+                break;
+            }
+            if (inFlight_.count(documentId) != 0) {
+                continue;
+            }
+            if (cache_.find(documentId)) {
+                ++stats_.resident;
+                continue;
+            }
+            if (inFlight_.size() >= config_.maxInFlight) {
+                ++stats_.dropped;
+                continue;
+            }
+            inFlight_.insert(documentId);
+            ++stats_.scheduled;
+            posted.push_back(documentId);
+            executor_.post(Lane::Maintenance, [this, documentId = std::move(documentId)] { prefetch(documentId); });
+        }
+        return posted;
+    }
+
+    /**
+     * Score a document as a candidate
+     *
+     * @param documentId The document
+     * @param modified When its file last changed
+     * @param now The time to score at
+     * @return 1 for a change made now, halving every recencyHalfLife, plus frequencyWeight per decayed open
+     */
+    double score(const std::string& documentId, Clock::time_point modified, Clock::time_point now) const {
+        double result = halving(now - modified, config_.recencyHalfLife);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = opens_.find(documentId);
+        if (found != opens_.end()) {
+            result += config_.frequencyWeight * decayed(found->second, now);
+        }
+        return result;
+    }
+
+    // Wait until every prefetch posted has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return inFlight_.empty(); });
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    // Default document ID: the file's path below the workspace root, e.g. "docs/a.txt"
+    static std::string relativePath(const fs::File& file) {
+        return file.getRelativePath();
+    }
+
+private:
+    // Directory entries taken under one lock at a time while listing
+    static constexpr size_t LIST_PAGE = 256;
+
+    // Opens of a document, decayed up to `at`
+    struct Opens {
+        double count = 0.0;
+        Clock::time_point at;
+    };
+
+    // 1 for an age of 0, halving every halfLife; ages in the future count as 0
+    static double halving(Clock::duration age, std::chrono::seconds halfLife) {
+        if (halfLife.count() <= 0) {
+            return 0.0;
+        }
+        const double halves = std::chrono::duration<double>(age).count() / static_cast<double>(halfLife.count());
+        return std::exp2(-std::max(0.0, halves));
+    }
+
+    // mutex_ must be held
+    double decayed(const Opens& opens, Clock::time_point now) const {
+        return opens.count * halving(now - opens.at, config_.frequencyHalfLife);
+    }
+
+    // Drop the documents opened least, down to three quarters of maxTracked (mutex_ must be held)
+    void forgetRarest(Clock::time_point now) {
+        std::vector<std::pair<double, std::string>> counts;
+        counts.reserve(opens_.size());
+        for (const auto& [documentId, opens] : opens_) {
+            counts.emplace_back(decayed(opens, now), documentId);
+        }
+        const size_t keep = config_.maxTracked * 3 / 4;
+        std::nth_element(counts.begin(), counts.begin() + static_cast<std::ptrdiff_t>(counts.size() - keep),
+                         counts.end());
+        for (size_t i = 0; i < counts.size() - keep; ++i) {
+            opens_.erase(counts[i].second);
+        }
+    }
+
+    void prefetch(const std::string& documentId) {
+        bool loaded = false;
+        bool failed = false;
+        try {
+            loaded = cache_.prefetch(documentId);
+            if (loaded && warm_) {
+                if (DocumentCache::Controller document = cache_.find(documentId)) {
+                    warm_(documentId, document);
+                }
+            }
+        } catch (...) {
+            failed = true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed) {
+            ++stats_.failed;
+        } else if (loaded) {
+            ++stats_.loaded;
+        } else {
+            ++stats_.skipped;
+        }
+        inFlight_.erase(documentId);
+        if (inFlight_.empty()) {
+            idle_.notify_all();
+        }
+    }
+
+    DocumentCache& cache_;
+    PriorityExecutor& executor_;
+    const Config config_;
+    const DocumentIdOf documentIdOf_;
+    const Warm warm_;
+
+    mutable std::mutex mutex_;            // Guards the members below
+    std::condition_variable idle_;
+    std::unordered_map<std::string, Opens> opens_;
+    std::unordered_set<std::string> inFlight_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_PREFETCHER_H
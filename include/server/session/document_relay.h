@@ -0,0 +1,262 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_RELAY_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_RELAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Fans a document's traffic out to the viewers on an edge node, over one subscription to its owner
+ *
+ * A document with thousands of viewers costs its owner a send per viewer
+ * for every edit and cursor move. A relay node takes the viewers'
+ * connections instead and is one client of the owner: it opens each
+ * document upstream once, for its first viewer, and closes it for its
+ * last, and hands every message the owner broadcasts for the document to
+ * its own viewers, through a ServerManager's broadcast (serialized once,
+ * batched and presence-coalesced as on any node). The owner then pays
+ * one send per relay.
+ *
+ * What viewers send, opens and the rare edit among them, goes upstream
+ * with clientId set to the viewer, so the owner can tell them apart. The
+ * owner answers the viewer the same way: replies it sends the relay alone
+ * (DOC_RESPONSE, EDIT_APPLY, EDIT_REJECT, SYNC_RESPONSE, SYS_ERROR) with
+ * clientId naming a viewer go to that viewer only. Everything else, and
+ * replies that name no viewer of the relay, go to all of the document's
+ * viewers.
+ *
+ * Viewer closes stay on the relay, which closes upstream once no viewer
+ * has the document open. Thread-safe; the upstream and downstream
+ * functions are called outside the relay's lock.
+ */
+class DocumentRelay {
+public:
+    // The relay's connection to the owner
+    struct Upstream {
+        std::function<bool(const protocol::Message& message)> send;
+    };
+
+    // The relay's own viewers, e.g. a ServerManager's (see forServer())
+    struct Downstream {
+        std::function<void(const protocol::Message& message)> broadcast;             // To the document's viewers
+        std::function<bool(const std::string& viewerId, const protocol::Message& message)> send;
+        std::function<bool(const std::string& viewerId, const std::string& documentId)> join;
+        std::function<bool(const std::string& viewerId, const std::string& documentId)> leave;
+    };
+
+    struct Stats {
+        size_t documents = 0;       // Documents open upstream
+        size_t viewers = 0;         // Viewer-document pairs
+        uint64_t forwarded = 0;     // Messages sent upstream for viewers
+        uint64_t fannedOut = 0;     // Messages from upstream broadcast to viewers
+        uint64_t replies = 0;       // Messages from upstream for one viewer
+    };
+
+    DocumentRelay(Upstream upstream, Downstream downstream)
+        : upstream_(std::move(upstream)), downstream_(std::move(downstream)) {}
+
+    DocumentRelay(const DocumentRelay&) = delete;
+    DocumentRelay& operator=(const DocumentRelay&) = delete;
+
+    /**
+     * Handle a message from a viewer
+     *
+     * A DOC_OPEN makes the viewer one of the document's and goes upstream
+     * for the viewer's DOC_RESPONSE; a DOC_CLOSE takes it out, and goes
+     * upstream on the relay's behalf once the last viewer is gone. Other
+     * messages go upstream as they are.
+     *
+     * @param viewerId The viewer's client ID on this node
+     * @param message The message, a struct with a documentId unless it is a plain Message
+     * @return False if it had to go upstream and could not
+     */
+    template <typename T>
+    bool fromViewer(const std::string& viewerId, const T& message) {
+        T forwarded = message;
+        forwarded.clientId = viewerId;
+        if constexpr (std::is_same_v<T, protocol::DocumentMessage>) {
+            if (message.type == protocol::MessageType::DOC_OPEN) {
+                join(viewerId, message.documentId);
+            } else if (message.type == protocol::MessageType::DOC_CLOSE) {
+                if (!leave(viewerId, message.documentId)) {
+                    return true;
+                }
+                // The last viewer: the relay itself closes it
+                forwarded.clientId.clear();
+            }
+        }
+        count(&Stats::forwarded);
+        return upstream_.send(forwarded);
+    }
+
+    /**
+     * Handle a message the owner sent the relay
+     *
+     * @param message The message
+     */
+    template <typename T>
+    void fromUpstream(const T& message) {
+        if (isReply(message.type) && !message.clientId.empty() && isViewer(message)) {
+            count(&Stats::replies);
+            downstream_.send(message.clientId, message);
+            return;
+        }
+        count(&Stats::fannedOut);
+        downstream_.broadcast(message);
+    }
+
+    /**
+     * Forget a viewer that disconnected, closing upstream the documents only it had open
+     *
+     * @param viewerId The viewer's client ID
+     */
+    void removeViewer(const std::string& viewerId) {
+        std::vector<std::string> closed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = viewers_.begin(); it != viewers_.end();) {
+                if (it->second.erase(viewerId) > 0) {
+                    stats_.viewers--;
+                    if (it->second.empty()) {
+                        closed.push_back(it->first);
+                        it = viewers_.erase(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+            stats_.documents = viewers_.size();
+        }
+        for (const auto& documentId : closed) {
+            protocol::DocumentMessage close(protocol::MessageType::DOC_CLOSE);
+            close.documentId = documentId;
+            upstream_.send(close);
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    // Viewers of a document on this relay
+    size_t viewerCount(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = viewers_.find(documentId);
+        return it != viewers_.end() ? it->second.size() : 0;
+    }
+
+    // Check whether a message is a reply to one client rather than something for every client of a document
+    static bool isReply(protocol::MessageType type) {
+        switch (type) {
+            case protocol::MessageType::DOC_RESPONSE:
+            case protocol::MessageType::EDIT_APPLY:
+            case protocol::MessageType::EDIT_REJECT:
+            case protocol::MessageType::SYNC_RESPONSE:
+            case protocol::MessageType::SYS_ERROR:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Make the downstream of a relay that serves its viewers through a ServerManager
+     *
+     * @param server The relay node's server; viewers' messages reach the relay from its router()
+     * @return The downstream
+     */
+    template <typename Server>
+    static Downstream forServer(Server& server) {
+        return Downstream{
+            [&server](const protocol::Message& message) { server.broadcastMessage(message); },
+            [&server](const std::string& viewerId, const protocol::Message& message) {
+                return server.sendMessage(viewerId, message);
+            },
+            [&server](const std::string& viewerId, const std::string& documentId) {
+                return server.joinDocument(viewerId, documentId);
+            },
+            [&server](const std::string& viewerId, const std::string& documentId) {
+                return server.leaveDocument(viewerId, documentId);
+            }};
+    }
+
+private:
+    void join(const std::string& viewerId, const std::string& documentId) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (viewers_[documentId].insert(viewerId).second) {
+                stats_.viewers++;
+            }
+            stats_.documents = viewers_.size();
+        }
+        downstream_.join(viewerId, documentId);
+    }
+
+    // True if the viewer was the document's last
+    bool leave(const std::string& viewerId, const std::string& documentId) {
+        bool last = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = viewers_.find(documentId);
+            if (it == viewers_.end() || it->second.erase(viewerId) == 0) {
+                return false;
+            }
+            stats_.viewers--;
+            if (it->second.empty()) {
+                viewers_.erase(it);
+                last = true;
+            }
+            stats_.documents = viewers_.size();
+        }
+        downstream_.leave(viewerId, documentId);
+        return last;
+    }
+
+    // Check whether a reply names a viewer of its document, or of any document if it names none
+    template <typename T>
+    bool isViewer(const T& message) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if constexpr (requires { message.documentId; }) {
+            auto it = viewers_.find(message.documentId);
+            return it != viewers_.end() && it->second.count(message.clientId) > 0;
+        } else {
+            for (const auto& [documentId, viewers] : viewers_) {
+                if (viewers.count(message.clientId) > 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    void count(uint64_t Stats::*counter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.*counter += 1;
+    }
+
+    const Upstream upstream_;
+    const Downstream downstream_;
+
+    mutable std::mutex mutex_;      // Guards the members below
+    // Viewers of each document open upstream
+    std::unordered_map<std::string, std::unordered_set<std::string>> viewers_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_RELAY_H
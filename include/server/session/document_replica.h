@@ -0,0 +1,411 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_REPLICA_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_REPLICA_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/protocol/protocol.h"
+#include "server/session/document_migration.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * A read-only follower of a document, for the reads that need not be current
+ *
+ * History views, exports and DOC_INFO on a large document cost the node
+ * that edits it CPU it would rather spend on edits. A replica, on another
+ * thread or another node, keeps its own copy of the document by tailing
+ * the leader's operation log: each sync() asks the feed for what the
+ * leader applied since the replica's revision and replays it, or starts
+ * over from the leader's content once its log has moved past. Readers
+ * are answered from the copy, never waiting for the leader.
+ *
+ * The copy is behind the leader by whatever was applied since the last
+ * sync. The leader tells the replica its revision as it goes (notify(),
+ * e.g. from an operation callback, which costs it an atomic store), so
+ * every answer says how far behind it is, in revisions and in time since
+ * the replica was last level with the leader. A reader bounds that: a
+ * replica further behind refuses instead of answering, and the reader
+ * asks the leader.
+ *
+ * Thread-safe: reads run alongside a sync, and see the copy as it was
+ * before or after each replayed operation.
+ */
+class DocumentReplica {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * What the leader applied since a revision
+     * A batch with content the leader's content at fromRevision, if its log
+     * no longer goes back to the revision; std::nullopt if the leader
+     * cannot be reached
+     */
+    using Feed = std::function<std::optional<MigrationBatch>(int64_t revision)>;
+
+    // How far behind a replica is
+    struct Staleness {
+        int64_t revisions = 0;              // Revisions the leader is known to be ahead
+        std::chrono::milliseconds age{0};   // Since the replica was last level with the leader
+    };
+
+    // How far behind a reader accepts; zero for no bound
+    struct Bound {
+        int64_t revisions = 0;
+        std::chrono::milliseconds age{0};
+
+        bool admits(const Staleness& staleness) const {
+            return (revisions <= 0 || staleness.revisions <= revisions) &&
+                   (age.count() <= 0 || staleness.age <= age);
+        }
+    };
+
+    struct Stats {
+        uint64_t syncs = 0;
+        uint64_t replayed = 0;      // Operations replayed
+        uint64_t reseeds = 0;       // Times the replica started over from the leader's content
+        uint64_t served = 0;        // Reads answered
+        uint64_t refused = 0;       // Reads refused as too stale
+    };
+
+    /**
+     * @param documentId The document's ID
+     * @param feed Where the leader's operations come from, e.g. follow() or a connection to the leader's node
+     * @param bound How far behind reads that give none accept; none if not given
+     * @param logRetention Operations the copy keeps, for history reads
+     */
+    DocumentReplica(std::string documentId, Feed feed, Bound bound, size_t logRetention = 10000)
+        : documentId_(std::move(documentId)), feed_(std::move(feed)), bound_(bound), logRetention_(logRetention) {}
+
+    DocumentReplica(std::string documentId, Feed feed)
+        : DocumentReplica(std::move(documentId), std::move(feed), Bound()) {}
+
+    DocumentReplica(const DocumentReplica&) = delete;
+    DocumentReplica& operator=(const DocumentReplica&) = delete;
+
+    /**
+     * Make a feed that tails a leader in this process
+     * What it copies out of the leader is the operation pointers, under
+     * the leader's lock only as long as that takes; the content only when
+     * the replica starts over.
+     *
+     * @param leader The document as edited
+     * @param documentId Its ID
+     */
+    static Feed follow(std::shared_ptr<const DocumentController> leader, std::string documentId) {
+        return [leader = std::move(leader), documentId = std::move(documentId)](int64_t revision) {
+            MigrationBatch batch;
+            batch.documentId = documentId;
+            batch.fromRevision = revision;
+            if (revision >= 0) {
+                if (auto operations = leader->getOperationsSince(revision)) {
+                    batch.operations = std::move(*operations);
+                    return std::optional<MigrationBatch>(std::move(batch));
+                }
+            }
+            DocumentController::DocumentSnapshot snapshot = leader->getSnapshot();
+            batch.fromRevision = snapshot.revision;
+            batch.content = snapshot.content.toString();
+            return std::optional<MigrationBatch>(std::move(batch));
+        };
+    }
+
+    // Tell the replica the leader's revision; cheap enough to call on every edit
+    void notify(int64_t leaderRevision) {
+        int64_t known = leaderRevision_.load(std::memory_order_relaxed);
+        while (known < leaderRevision &&
+               !leaderRevision_.compare_exchange_weak(known, leaderRevision, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * Catch up with the leader
+     *
+     * @return False if the feed had nothing, e.g. the leader could not be reached
+     * @throws std::runtime_error if what the feed sent does not follow the copy
+     */
+    bool sync() {
+        // One sync at a time; reads go on meanwhile
+        std::lock_guard<std::mutex> syncing(syncMutex_);
+        const Clock::time_point asked = Clock::now();
+        std::shared_ptr<DocumentController> document = current();
+        std::optional<MigrationBatch> batch = feed_(document ? document->getRevision() : -1);
+        if (!batch) {
+            return false;
+        }
+
+        if (batch->content) {
+            auto seeded = std::make_shared<DocumentController>(
+                DocumentController::DocumentSnapshot{ot::Rope(*batch->content), batch->fromRevision}, logRetention_);
+            replayOperations(*seeded, batch->operations);
+            std::lock_guard<std::mutex> lock(mutex_);
+            document_ = std::move(seeded);
+            stats_.reseeds++;
+        } else if (!document || batch->fromRevision != document->getRevision()) {
+            throw std::runtime_error("Replica of \"" + documentId_ + "\" fed operations from revision " +
+                                     std::to_string(batch->fromRevision));
+        } else {
+            replayOperations(*document, batch->operations);
+        }
+
+        notify(batch->toRevision());
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.syncs++;
+        stats_.replayed += batch->operations.size();
+        // Level with the leader as it was when asked
+        levelAt_ = asked;
+        return true;
+    }
+
+    // How far behind the replica is now; as far as it can be before the first sync
+    Staleness staleness() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stalenessLocked();
+    }
+
+    // Revision of the copy, -1 before the first sync
+    int64_t getRevision() const {
+        std::shared_ptr<DocumentController> document = current();
+        return document ? document->getRevision() : -1;
+    }
+
+    /**
+     * Read the copy, if it is close enough to the leader
+     *
+     * @param bound How far behind the reader accepts
+     * @return The content and revision, with how far behind they are; std::nullopt if further
+     */
+    std::optional<std::pair<DocumentController::DocumentSnapshot, Staleness>> read(const Bound& bound) {
+        std::shared_ptr<DocumentController> document;
+        Staleness staleness;
+        if (!admit(bound, document, staleness)) {
+            return std::nullopt;
+        }
+        return std::make_pair(document->getSnapshot(), staleness);
+    }
+
+    /**
+     * Answer a read-only request from the copy
+     *
+     * A DOC_INFO gets the revision and length; a DOC_OPEN gets the content
+     * too, or, with documentVersion set, the content at that revision, as
+     * long as the copy's log goes back to it. Every DOC_RESPONSE has
+     * metadata "replica", "staleRevisions" and "staleMillis". The request's
+     * metadata "maxStaleRevisions" and "maxStaleMillis", if set, bound the
+     * staleness instead of the replica's default; a replica further behind
+     * fails the request with metadata "stale", and the reader asks the
+     * leader instead.
+     *
+     * @param request A DOC_INFO or DOC_OPEN
+     * @return The DOC_RESPONSE
+     */
+    protocol::DocumentMessage answer(const protocol::DocumentMessage& request) {
+        protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+        response.documentId = documentId_;
+        response.clientId = request.clientId;
+        response.metadata["replica"] = "true";
+
+        std::shared_ptr<DocumentController> document;
+        Staleness staleness;
+        const bool admitted = admit(boundOf(request), document, staleness);
+        response.metadata["staleRevisions"] = std::to_string(staleness.revisions);
+        response.metadata["staleMillis"] = std::to_string(staleness.age.count());
+        if (!admitted) {
+            response.success = false;
+            response.errorMessage = "Replica is further behind than the request allows";
+            response.metadata["stale"] = "true";
+            return response;
+        }
+
+        std::optional<DocumentController::DocumentSnapshot> snapshot;
+        if (request.type == protocol::MessageType::DOC_OPEN && request.documentVersion) {
+            snapshot = document->materializeAt(static_cast<int64_t>(*request.documentVersion));
+            if (!snapshot) {
+                response.success = false;
+                response.errorMessage = "Revision " + std::to_string(*request.documentVersion) +
+                                        " is no longer held by the replica";
+                return response;
+            }
+        } else {
+            snapshot = document->getSnapshot();
+        }
+        response.success = true;
+        response.documentVersion = static_cast<uint64_t>(snapshot->revision);
+        response.contentLength = snapshot->content.length();
+        if (request.type == protocol::MessageType::DOC_OPEN) {
+            response.documentContent = snapshot->content.toString();
+        }
+        return response;
+    }
+
+    const std::string& documentId() const {
+        return documentId_;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    std::shared_ptr<DocumentController> current() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return document_;
+    }
+
+    // Check a read against a bound, getting the copy to read and how far behind it is
+    bool admit(const Bound& bound, std::shared_ptr<DocumentController>& document, Staleness& staleness) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        document = document_;
+        staleness = stalenessLocked();
+        if (!document || !bound.admits(staleness)) {
+            stats_.refused++;
+            return false;
+        }
+        stats_.served++;
+        return true;
+    }
+
+    // mutex_ must be held
+    Staleness stalenessLocked() const {
+        Staleness staleness;
+        if (!document_) {
+            staleness.revisions = leaderRevision_.load(std::memory_order_relaxed);
+            staleness.age = std::chrono::milliseconds::max();
+            return staleness;
+        }
+        staleness.revisions = std::max<int64_t>(0, leaderRevision_.load(std::memory_order_relaxed) -
+                                                       document_->getRevision());
+        staleness.age = staleness.revisions == 0
+                            ? std::chrono::milliseconds(0)
+                            : std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - levelAt_);
+        return staleness;
+    }
+
+    Bound boundOf(const protocol::DocumentMessage& request) const {
+        Bound bound = bound_;
+        auto revisions = request.metadata.find("maxStaleRevisions");
+        auto millis = request.metadata.find("maxStaleMillis");
+        try {
+            if (revisions != request.metadata.end()) {
+                bound.revisions = std::stoll(revisions->second);
+            }
+            if (millis != request.metadata.end()) {
+                bound.age = std::chrono::milliseconds(std::stoll(millis->second));
+            }
+        } catch (const std::exception&) {
+            // A malformed bound is ignored, leaving the replica's own
+        }
+        return bound;
+    }
+
+    const std::string documentId_;
+    const Feed feed_;
+    const Bound bound_;
+    const size_t logRetention_;
+    std::atomic<int64_t> leaderRevision_{0};
+    std::mutex syncMutex_;
+
+    mutable std::mutex mutex_;      // Guards the members below
+    std::shared_ptr<DocumentController> document_;
+    Clock::time_point levelAt_;
+    Stats stats_;
+};
+
+/**
+ * Keeps replicas in sync from a thread of its own
+ *
+ * Syncs each replica every interval, or sooner for those woken, e.g. by
+ * the leader after an edit, so a replica trails its leader by about one
+ * interval while the leader's edit path does no more than wake().
+ * A replica whose feed fails stays as it was, and further behind, until a
+ * later sync succeeds.
+ */
+class ReplicaTailer {
+public:
+    explicit ReplicaTailer(std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+        : interval_(interval), thread_([this] { run(); }) {}
+
+    ~ReplicaTailer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    ReplicaTailer(const ReplicaTailer&) = delete;
+    ReplicaTailer& operator=(const ReplicaTailer&) = delete;
+
+    void add(std::shared_ptr<DocumentReplica> replica) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        replicas_.push_back(std::move(replica));
+    }
+
+    void remove(const std::shared_ptr<DocumentReplica>& replica) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        replicas_.erase(std::remove(replicas_.begin(), replicas_.end(), replica), replicas_.end());
+    }
+
+    // Sync the replicas now rather than at the end of the interval
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            woken_ = true;
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            cv_.wait_for(lock, interval_, [this] { return stopping_ || woken_; });
+            if (stopping_) {
+                break;
+            }
+            woken_ = false;
+            std::vector<std::shared_ptr<DocumentReplica>> replicas = replicas_;
+            lock.unlock();
+            for (const auto& replica : replicas) {
+                try {
+                    replica->sync();
+                } catch (const std::exception&) {
+                    // Tried again next time, from where the replica got to
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    const std::chrono::milliseconds interval_;
+
+    std::mutex mutex_;              // Guards the members below
+    std::condition_variable cv_;
+    std::vector<std::shared_ptr<DocumentReplica>> replicas_;
+    bool woken_ = false;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_REPLICA_H
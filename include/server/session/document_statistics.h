@@ -0,0 +1,306 @@
+#ifndef COLLABORATIVE_EDITOR_DOCUMENT_STATISTICS_H
+#define COLLABORATIVE_EDITOR_DOCUMENT_STATISTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+
+#include "common/document/document_controller.h"
+#include "common/ot/operation.h"
+#include "common/ot/rope.h"
+#include "common/ot/value_operation.h"
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Word, line and character counts of documents, kept current as they are edited
+ *
+ * Status bars and DOC_INFO ask for the counts far more often than a
+ * document changes, and counting means reading the whole text. Here each
+ * edit adjusts the counts by what it removed and inserted, and reading
+ * them costs a lookup. A word is a run of bytes other than ASCII
+ * whitespace, counted where it starts: an edit can only change whether
+ * the bytes it touched start a word, and the byte right after it, which
+ * may join the word before the edit or be split from it. So a keystroke
+ * costs the bytes it touched and the one on either side, however long
+ * the document is.
+ *
+ * Characters are UTF-8 code points; a document has one line more than
+ * it has newlines. Each document's text is kept as a rope, which the
+ * edits keep in step and read their neighbours from; a copy made from a
+ * DocumentController shares its chunks. Feed it every operation the
+ * document applies (see watch()), or the whole content again with add().
+ *
+ * Thread-safe: reads run alongside each other, edits one at a time.
+ */
+class DocumentStatistics {
+public:
+    // Metadata keys of the counts in DOC_RESPONSE and presence
+    static constexpr const char* WORDS_KEY = "words";
+    static constexpr const char* LINES_KEY = "lines";
+    static constexpr const char* CHARACTERS_KEY = "characters";
+
+    struct Counts {
+        size_t words = 0;
+        size_t lines = 1;
+        size_t characters = 0;      // UTF-8 code points
+        size_t bytes = 0;
+
+        bool operator==(const Counts&) const = default;
+    };
+
+    /**
+     * Count a document, replacing what was counted for it
+     *
+     * @param documentId The document
+     * @param content Its content
+     */
+    void add(const std::string& documentId, ot::Rope content) {
+        Document document;
+        document.counts = countOf(content);
+        document.text = std::move(content);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        documents_[documentId] = std::move(document);
+    }
+
+    void add(const std::string& documentId, std::string_view content) {
+        add(documentId, ot::Rope(content));
+    }
+
+    // Forget a document, e.g. once it is closed; false if it was not counted
+    bool remove(const std::string& documentId) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        return documents_.erase(documentId) > 0;
+    }
+
+    /**
+     * Apply an edit a document made, recounting only what it touched
+     *
+     * @param documentId The document
+     * @param op The edit, as applied to the document
+     * @return False if the document is not counted or the edit does not fit its text
+     */
+    bool apply(const std::string& documentId, const ot::ValueOperation& op) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        return it != documents_.end() && applyLocked(it->second, op);
+    }
+
+    // Apply an operation a document made; a composite's children apply in order
+    bool apply(const std::string& documentId, const ot::Operation& op) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        return it != documents_.end() && applyLocked(it->second, op);
+    }
+
+    /**
+     * Keep a document's counts current from its operations
+     * The document is counted now, and every operation it applies from
+     * here on is applied to the counts. This takes the document's one
+     * operation callback; the statistics must outlive the document.
+     *
+     * @param documentId The document
+     * @param document Its OT state
+     */
+    void watch(const std::string& documentId, DocumentController& document) {
+        add(documentId, document.getSnapshot().content);
+        document.registerOperationCallback([this, documentId](const ot::OperationPtr& op, const std::string&, int64_t) {
+            if (op) {
+                apply(documentId, *op);
+            }
+        });
+    }
+
+    // A document's counts, or std::nullopt if it is not counted
+    std::optional<Counts> get(const std::string& documentId) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        if (it == documents_.end()) {
+            return std::nullopt;
+        }
+        return it->second.counts;
+    }
+
+    /**
+     * Add a document's counts to message metadata, e.g. of a DOC_RESPONSE or a presence snapshot
+     *
+     * @param documentId The document
+     * @param metadata Where WORDS_KEY, LINES_KEY and CHARACTERS_KEY go
+     * @return False, leaving metadata as it was, if the document is not counted
+     */
+    bool annotate(const std::string& documentId, std::map<std::string, std::string>& metadata) const {
+        const std::optional<Counts> counts = get(documentId);
+        if (!counts) {
+            return false;
+        }
+        metadata[WORDS_KEY] = std::to_string(counts->words);
+        metadata[LINES_KEY] = std::to_string(counts->lines);
+        metadata[CHARACTERS_KEY] = std::to_string(counts->characters);
+        return true;
+    }
+
+    /**
+     * Answer a DOC_INFO from the counts, without reading the document
+     *
+     * @param request The DOC_INFO
+     * @return A DOC_RESPONSE with the length in contentLength and the counts in its metadata
+     */
+    protocol::DocumentMessage answer(const protocol::DocumentMessage& request) const {
+        protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+        response.documentId = request.documentId;
+        response.clientId = request.clientId;
+        response.sequenceNumber = request.sequenceNumber;
+        const std::optional<Counts> counts = get(request.documentId);
+        if (!counts) {
+            response.success = false;
+            response.errorMessage = "Document is not counted";
+            return response;
+        }
+        response.success = true;
+        response.contentLength = counts->bytes;
+        response.metadata[WORDS_KEY] = std::to_string(counts->words);
+        response.metadata[LINES_KEY] = std::to_string(counts->lines);
+        response.metadata[CHARACTERS_KEY] = std::to_string(counts->characters);
+        return response;
+    }
+
+private:
+    struct Document {
+        ot::Rope text;
+        Counts counts;
+    };
+
+    // What a run of bytes adds to the counts, following the byte before it
+    struct Tally {
+        size_t wordStarts = 0;
+        size_t newlines = 0;
+        size_t characters = 0;
+        char last;
+
+        explicit Tally(char before)
+            : last(before) {}
+
+        void add(std::string_view text) {
+            for (char c : text) {
+                if (!isSpace(c) && isSpace(last)) {
+                    wordStarts++;
+                }
+                if (c == '\n') {
+                    newlines++;
+                }
+                // Every byte but a continuation byte starts a code point
+                if ((static_cast<unsigned char>(c) & 0xC0) != 0x80) {
+                    characters++;
+                }
+                last = c;
+            }
+        }
+
+        // Whether the byte after the run starts a word, given the run
+        size_t startsWord(std::optional<char> after) const {
+            return after && !isSpace(*after) && isSpace(last) ? 1 : 0;
+        }
+    };
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    static Counts countOf(const ot::Rope& text) {
+        Tally tally(' ');
+        text.forEachChunk(0, text.length(), [&tally](std::string_view chunk) {
+            tally.add(chunk);
+            return true;
+        });
+        Counts counts;
+        counts.words = tally.wordStarts;
+        counts.lines = tally.newlines + 1;
+        counts.characters = tally.characters;
+        counts.bytes = text.length();
+        return counts;
+    }
+
+    // mutex_ must be held
+    static bool applyLocked(Document& document, const ot::ValueOperation& op) {
+        return std::visit([&document](const auto& edit) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, ot::InsertOp>) {
+                return replace(document, edit.position, 0, edit.text);
+            } else {
+                return replace(document, edit.position, edit.length, {});
+            }
+        }, op);
+    }
+
+    // mutex_ must be held
+    static bool applyLocked(Document& document, const ot::Operation& op) {
+        if (std::optional<ot::ValueOperation> value = ot::toValueOperation(op)) {
+            return applyLocked(document, *value);
+        }
+        if (op.getKind() == ot::OperationKind::REPLACE) {
+            const auto& edit = static_cast<const ot::ReplaceOperation&>(op);
+            return replace(document, edit.getPosition(), edit.getLength(), edit.getText());
+        }
+        if (op.getKind() != ot::OperationKind::COMPOSITE) {
+            return false;
+        }
+        for (const auto& child : static_cast<const ot::CompositeOperation&>(op).getOperations()) {
+            if (child && !applyLocked(document, *child)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Replace length bytes of a document's text at position with text,
+     * recounting the bytes replaced, the ones inserted and whether the
+     * byte after them starts a word (mutex_ must be held)
+     */
+    static bool replace(Document& document, size_t position, size_t length, std::string_view text) {
+        ot::Rope& rope = document.text;
+        const size_t size = rope.length();
+        if (position > size || length > size - position) {
+            return false;
+        }
+        const char before = position > 0 ? rope.at(position - 1) : ' ';
+        std::optional<char> after = std::nullopt;
+        if (position + length < size) {
+            after = rope.at(position + length);
+        }
+        Tally removed(before);
+        rope.forEachChunk(position, length, [&removed](std::string_view chunk) {
+            removed.add(chunk);
+            return true;
+        });
+        Tally added(before);
+        added.add(text);
+
+        Counts& counts = document.counts;
+        counts.words = counts.words + added.wordStarts + added.startsWord(after) -
+                       removed.wordStarts - removed.startsWord(after);
+        counts.lines = counts.lines + added.newlines - removed.newlines;
+        counts.characters = counts.characters + added.characters - removed.characters;
+        counts.bytes = counts.bytes + text.size() - length;
+        rope.replace(position, length, text);
+        return true;
+    }
+
+    mutable std::shared_mutex mutex_;   // Guards the member below
+    std::unordered_map<std::string, Document> documents_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DOCUMENT_STATISTICS_H
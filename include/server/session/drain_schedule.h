@@ -0,0 +1,101 @@
+#ifndef COLLABORATIVE_EDITOR_DRAIN_SCHEDULE_H
+#define COLLABORATIVE_EDITOR_DRAIN_SCHEDULE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * When each client of a draining node is told to go, and how long it waits before reconnecting
+ *
+ * A node taken out of service for a deploy that closed all of its
+ * connections at once would have every client reconnect to the next node
+ * in the same second. Instead the clients go in waves of waveSize, one
+ * wave per waveInterval, and each client of a wave is told to wait a
+ * different part of the interval before it reconnects, so the next node
+ * sees an even waveSize clients per interval however many there are.
+ *
+ * Clients are numbered in the order they are drained; client i is in
+ * wave i / waveSize.
+ */
+class DrainSchedule {
+public:
+    // SYS_DISCONNECT metadata keys
+    static constexpr const char* RECONNECT_KEY = "reconnect";
+    static constexpr const char* RECONNECT_AFTER_KEY = "reconnectAfterMillis";
+
+    struct Options {
+        std::string reconnectHint;                      // Where clients should reconnect, e.g. the next node's address; empty to leave it to them
+        size_t waveSize = 500;                          // Clients told to go at a time
+        std::chrono::milliseconds waveInterval{1000};   // Between one wave and the next
+    };
+
+    DrainSchedule(Options options, size_t clients)
+        : options_(std::move(options)), clients_(clients) {
+        options_.waveSize = std::max<size_t>(1, options_.waveSize);
+    }
+
+    const Options& getOptions() const {
+        return options_;
+    }
+
+    size_t getClientCount() const {
+        return clients_;
+    }
+
+    size_t waveCount() const {
+        return (clients_ + options_.waveSize - 1) / options_.waveSize;
+    }
+
+    // The clients of a wave, as the first and one past the last
+    std::pair<size_t, size_t> wave(size_t index) const {
+        const size_t first = std::min(clients_, index * options_.waveSize);
+        return {first, std::min(clients_, first + options_.waveSize)};
+    }
+
+    // When a wave goes, from the start of the drain
+    std::chrono::milliseconds waveStart(size_t index) const {
+        return options_.waveInterval * static_cast<std::chrono::milliseconds::rep>(index);
+    }
+
+    // How long a client waits before reconnecting: its place in its wave, spread over the interval
+    std::chrono::milliseconds reconnectDelay(size_t client) const {
+        const auto place = static_cast<std::chrono::milliseconds::rep>(client % options_.waveSize);
+        return options_.waveInterval * place / static_cast<std::chrono::milliseconds::rep>(options_.waveSize);
+    }
+
+    /**
+     * Make the SYS_DISCONNECT that tells a client to go
+     *
+     * @param client The client's number
+     * @param resumeToken The token to resume its session with; empty if it has none
+     * @return The message
+     */
+    protocol::AuthMessage notice(size_t client, const std::string& resumeToken) const {
+        protocol::AuthMessage message(protocol::MessageType::SYS_DISCONNECT);
+        if (!resumeToken.empty()) {
+            message.token = resumeToken;
+        }
+        if (!options_.reconnectHint.empty()) {
+            message.metadata[RECONNECT_KEY] = options_.reconnectHint;
+        }
+        message.metadata[RECONNECT_AFTER_KEY] = std::to_string(reconnectDelay(client).count());
+        return message;
+    }
+
+private:
+    Options options_;
+    size_t clients_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_DRAIN_SCHEDULE_H
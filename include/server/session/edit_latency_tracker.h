@@ -0,0 +1,282 @@
+#ifndef COLLABORATIVE_EDITOR_EDIT_LATENCY_TRACKER_H
+#define COLLABORATIVE_EDITOR_EDIT_LATENCY_TRACKER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/protocol/edit_trace.h"
+#include "common/util/metrics.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Splits edit latency into stages, per document, and keeps sampled traces
+ *
+ * Each edit the server finishes is reported with its trace context and
+ * the time its broadcast was queued for the last client. Its latency
+ * splits into:
+ *
+ *     network    originTime -> serverReceiveTime, client to server
+ *     transform  serverReceiveTime -> transformTime, decode and OT
+ *     fanout     transformTime -> broadcast done, apply, log and queueing
+ *
+ * so a slow edit path shows as network, OT or fan-out. Every stage goes to
+ * a histogram of the metrics registry, labelled by stage only; per
+ * document, the tracker keeps a count, mean and maximum per stage, which
+ * stays small with many documents open.
+ *
+ * Edits the client sampled (they carry a trace ID), and one in sampleEvery
+ * of the others (see sample()), are kept as traces until exportOtlpJson()
+ * takes them, up to maxTraces; older ones are dropped first. Thread-safe.
+ */
+class EditLatencyTracker {
+public:
+    enum Stage { NETWORK, TRANSFORM, FANOUT, STAGES };
+
+    static constexpr size_t DEFAULT_SAMPLE_EVERY = 256;
+    static constexpr size_t DEFAULT_MAX_TRACES = 1024;
+
+    struct StageStats {
+        uint64_t count = 0;
+        uint64_t totalMicros = 0;
+        uint64_t maxMicros = 0;
+
+        double meanMicros() const {
+            return count ? static_cast<double>(totalMicros) / static_cast<double>(count) : 0.0;
+        }
+    };
+
+    // Latency of one document's edits, by stage
+    using Breakdown = std::array<StageStats, STAGES>;
+
+    /**
+     * @param sampleEvery Keep a trace of one in this many edits the client did not sample; 0 for none
+     * @param maxTraces Traces held until exported
+     * @param registry Where the stage histograms go
+     */
+    explicit EditLatencyTracker(size_t sampleEvery = DEFAULT_SAMPLE_EVERY, size_t maxTraces = DEFAULT_MAX_TRACES,
+                                util::MetricsRegistry& registry = util::metrics())
+        : sampleEvery_(sampleEvery), maxTraces_(maxTraces) {
+        for (int stage = 0; stage < STAGES; ++stage) {
+            histograms_[stage] = &registry.histogram(
+                "collab_edit_stage_seconds", "Edit latency by stage: network, transform or fanout",
+                {{"stage", stageName(static_cast<Stage>(stage))}}, util::MICROSECONDS_PER_SECOND);
+        }
+    }
+
+    EditLatencyTracker(const EditLatencyTracker&) = delete;
+    EditLatencyTracker& operator=(const EditLatencyTracker&) = delete;
+
+    /**
+     * Sample one in sampleEvery edits the client did not, giving it a trace ID
+     * Call as an edit arrives, so the broadcast of it carries the ID
+     *
+     * @param trace The edit's trace context
+     * @return Whether the edit is sampled
+     */
+    bool sample(protocol::EditTrace& trace) {
+        if (trace.sampled()) {
+            return true;
+        }
+        if (sampleEvery_ == 0 || unsampled_.fetch_add(1, std::memory_order_relaxed) % sampleEvery_ != 0) {
+            return false;
+        }
+        trace.sample();
+        return true;
+    }
+
+    /**
+     * Report an edit the server is done with; a sampled one is kept as a trace
+     *
+     * @param documentId The document edited
+     * @param clientId Who made the edit
+     * @param trace Its trace context
+     * @param fanoutDone When its broadcast was queued for every client, by traceNowMicros()
+     */
+    void record(const std::string& documentId, const std::string& clientId, const protocol::EditTrace& trace,
+                uint64_t fanoutDone) {
+        const std::array<std::pair<uint64_t, uint64_t>, STAGES> bounds = {
+            std::pair{trace.originTime, trace.serverReceiveTime},
+            std::pair{trace.serverReceiveTime, trace.transformTime},
+            std::pair{trace.transformTime, fanoutDone}};
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Breakdown& breakdown = documents_[documentId];
+        for (int stage = 0; stage < STAGES; ++stage) {
+            const auto [start, end] = bounds[stage];
+            // A stamp that was not taken, or a client clock ahead of ours
+            if (start == 0 || end < start) {
+                continue;
+            }
+            const uint64_t micros = end - start;
+            histograms_[stage]->record(micros);
+            StageStats& stats = breakdown[stage];
+            ++stats.count;
+            stats.totalMicros += micros;
+            stats.maxMicros = std::max(stats.maxMicros, micros);
+        }
+
+        if (!trace.sampled() || maxTraces_ == 0) {
+            return;
+        }
+        if (traces_.size() >= maxTraces_) {
+            traces_.pop_front();
+            ++droppedTraces_;
+        }
+        traces_.push_back({documentId, clientId, trace, fanoutDone});
+    }
+
+    // Latency of a document's edits so far; all zero for one without edits
+    Breakdown breakdown(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        return it != documents_.end() ? it->second : Breakdown{};
+    }
+
+    /**
+     * The documents whose edits spend the longest in a stage, on average
+     *
+     * @param stage The stage
+     * @param limit Documents returned at most
+     * @return Documents and their breakdowns, slowest first
+     */
+    std::vector<std::pair<std::string, Breakdown>> slowest(Stage stage, size_t limit) const {
+        std::vector<std::pair<std::string, Breakdown>> result;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            result.assign(documents_.begin(), documents_.end());
+        }
+        const size_t count = std::min(limit, result.size());
+        std::partial_sort(result.begin(), result.begin() + count, result.end(), [stage](const auto& a, const auto& b) {
+            return a.second[stage].meanMicros() > b.second[stage].meanMicros();
+        });
+        result.resize(count);
+        return result;
+    }
+
+    // Stop tracking a document, e.g. once it is closed
+    void forget(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_.erase(documentId);
+    }
+
+    // Traces dropped because they were not exported in time
+    uint64_t droppedTraces() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return droppedTraces_;
+    }
+
+    /**
+     * Take the traces held, as an OTLP/JSON ExportTraceServiceRequest
+     *
+     * Each edit is a root span from its origin (or receipt, without one)
+     * to the end of its fan-out, with a child span per stage. The result
+     * can be posted to an OpenTelemetry collector's /v1/traces.
+     *
+     * @param serviceName The service.name resource attribute
+     * @return The request body
+     */
+    std::string exportOtlpJson(const std::string& serviceName = "collab-server") {
+        std::deque<Trace> traces;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            traces.swap(traces_);
+        }
+
+        nlohmann::json spans = nlohmann::json::array();
+        for (const Trace& trace : traces) {
+            const protocol::EditTrace& context = trace.context;
+            const std::string rootId = protocol::EditTrace::newSpanId();
+            const uint64_t start = context.originTime ? context.originTime : context.serverReceiveTime;
+            nlohmann::json root = span(context.traceId, rootId, "", "edit", start, trace.fanoutDone);
+            root["kind"] = 2;  // SPAN_KIND_SERVER
+            root["attributes"] = {attribute("document.id", trace.documentId), attribute("client.id", trace.clientId)};
+            spans.push_back(std::move(root));
+
+            const std::array<std::pair<uint64_t, uint64_t>, STAGES> bounds = {
+                std::pair{context.originTime, context.serverReceiveTime},
+                std::pair{context.serverReceiveTime, context.transformTime},
+                std::pair{context.transformTime, trace.fanoutDone}};
+            for (int stage = 0; stage < STAGES; ++stage) {
+                const auto [from, to] = bounds[stage];
+                if (from != 0 && to >= from) {
+                    spans.push_back(span(context.traceId, protocol::EditTrace::newSpanId(), rootId,
+                                         stageName(static_cast<Stage>(stage)), from, to));
+                }
+            }
+        }
+
+        nlohmann::json request = {
+            {"resourceSpans", nlohmann::json::array({{
+                {"resource", {{"attributes", {attribute("service.name", serviceName)}}}},
+                {"scopeSpans", nlohmann::json::array({{
+                    {"scope", {{"name", "collab.edit"}}},
+                    {"spans", std::move(spans)}}})}}})}};
+        return request.dump();
+    }
+
+    static const char* stageName(Stage stage) {
+        switch (stage) {
+        case NETWORK:
+            return "network";
+        case TRANSFORM:
+            return "transform";
+        case FANOUT:
+            return "fanout";
+        default:
+            return "unknown";
+        }
+    }
+
+private:
+    struct Trace {
+        std::string documentId;
+        std::string clientId;
+        protocol::EditTrace context;
+        uint64_t fanoutDone;
+    };
+
+    // Times are nanoseconds in OTLP, and 64-bit integers travel as strings in its JSON
+    static nlohmann::json span(const std::string& traceId, const std::string& spanId, const std::string& parentId,
+                               const std::string& name, uint64_t startMicros, uint64_t endMicros) {
+        nlohmann::json span = {
+            {"traceId", traceId},
+            {"spanId", spanId},
+            {"name", name},
+            {"startTimeUnixNano", std::to_string(startMicros * 1000)},
+            {"endTimeUnixNano", std::to_string(endMicros * 1000)}};
+        if (!parentId.empty()) {
+            span["parentSpanId"] = parentId;
+        }
+        return span;
+    }
+
+    static nlohmann::json attribute(const std::string& key, const std::string& value) {
+        return {{"key", key}, {"value", {{"stringValue", value}}}};
+    }
+
+    const size_t sampleEvery_;
+    const size_t maxTraces_;
+    std::array<util::Histogram*, STAGES> histograms_{};
+    std::atomic<uint64_t> unsampled_{0};
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Breakdown> documents_;
+    std::deque<Trace> traces_;
+    uint64_t droppedTraces_ = 0;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_EDIT_LATENCY_TRACKER_H
@@ -0,0 +1,79 @@
+#ifndef COLLABORATIVE_EDITOR_FLOW_CREDITS_H
+#define COLLABORATIVE_EDITOR_FLOW_CREDITS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace collab {
+namespace server {
+
+/**
+ * What a client lets the server send it, in messages and bytes
+ *
+ * A client that reads slowly grants credits as it consumes what it was
+ * sent, e.g. with each SYNC_ACK, and the server writes only while it has
+ * both kinds left. Messages it may not send wait in the client's queue,
+ * where operations are merged, and past the queue's limit are dropped in
+ * favour of a fresh copy of the document once credits come back, so a
+ * slow client holds a bounded amount of the server's memory.
+ *
+ * A message is sent whole once any byte credit is left, even if it is
+ * larger, so a document bigger than the window still goes out; the
+ * bytes then run out until the next grant. A client that has never
+ * granted anything is not limited. Not thread-safe; the owner serializes
+ * access.
+ */
+class FlowCredits {
+public:
+    /**
+     * Add what the client granted
+     *
+     * @param frames Further messages it takes
+     * @param bytes Further bytes it takes
+     */
+    void grant(uint64_t frames, uint64_t bytes) {
+        limited_ = true;
+        frames_ += frames;
+        bytes_ += bytes;
+    }
+
+    bool limited() const {
+        return limited_;
+    }
+
+    // Whether a message may be written now
+    bool canSend() const {
+        return !limited_ || (frames_ > 0 && bytes_ > 0);
+    }
+
+    /**
+     * Account for a message written
+     *
+     * @param bytes Its size
+     */
+    void spend(size_t bytes) {
+        if (!limited_) {
+            return;
+        }
+        frames_ -= frames_ > 0 ? 1 : 0;
+        bytes_ -= bytes < bytes_ ? bytes : bytes_;
+    }
+
+    uint64_t frames() const {
+        return frames_;
+    }
+
+    uint64_t bytes() const {
+        return bytes_;
+    }
+
+private:
+    bool limited_ = false;
+    uint64_t frames_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_FLOW_CREDITS_H
@@ -0,0 +1,193 @@
+#ifndef COLLABORATIVE_EDITOR_HISTORY_PLAYBACK_H
+#define COLLABORATIVE_EDITOR_HISTORY_PLAYBACK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/ot/text_operation.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Plays a document's history back to one client, e.g. for an audit or "what changed this week"
+ *
+ * seek() starts the stream at a revision: the client gets the document
+ * as it was then, rebuilt from the nearest checkpoint before it (see
+ * DocumentController::materializeAt()), instead of replaying the log
+ * from its start. next() then gives the operations that followed, a run
+ * at a time, composed into one TextOperation per run: the client applies
+ * a run at once, and text typed and deleted within it never goes out.
+ *
+ * At a speed in revisions per second each run covers one tick of it and
+ * says how long to wait before the next; at speed 0 runs are as long as
+ * runOps allows and go out as fast as the client takes them. Scrubbing
+ * forward by at most maxCatchUp revisions is played as fast-forward runs
+ * from where the stream is, so the client keeps its copy; scrubbing back,
+ * or further, sends a new keyframe.
+ *
+ * The stream holds its position, the length of the text there and one
+ * run of operations at a time; the log's spilled operations are paged in
+ * as the stream reaches them. Not thread-safe; one stream per client.
+ */
+class HistoryPlayback {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        size_t runOps = 256;                          // Most operations composed into one run
+        size_t maxCatchUp = 4096;                     // Furthest forward seek played as runs, not a keyframe
+        double revisionsPerSecond = 0.0;              // Playback speed; 0 for as fast as possible
+        std::chrono::milliseconds tick{100};          // Time one paced run covers
+    };
+
+    // The document at the revision a seek landed on
+    struct Keyframe {
+        int64_t revision = 0;
+        std::string content;
+    };
+
+    // What a seek asks the client to do
+    struct Seek {
+        int64_t revision = 0;               // Where the stream will be once the client is caught up
+        std::optional<Keyframe> keyframe;   // Replace the copy with this; std::nullopt to keep it and fast-forward
+    };
+
+    // Operations that followed one another, as one
+    struct Run {
+        int64_t fromRevision = 0;
+        int64_t toRevision = 0;             // Exclusive; the revision the client is at after it
+        ot::TextOperation op;               // Composed, on the text at fromRevision
+        Clock::duration delay{0};           // Wait this long after the previous run before applying it
+    };
+
+    /**
+     * @param document The document to play; kept alive by the stream
+     * @param config Run size and speed
+     */
+    explicit HistoryPlayback(std::shared_ptr<const DocumentController> document)
+        : HistoryPlayback(std::move(document), Config()) {}
+
+    HistoryPlayback(std::shared_ptr<const DocumentController> document, Config config)
+        : document_(std::move(document)), config_(config) {}
+
+    /**
+     * Move the stream to a revision
+     *
+     * @param revision The revision to play from
+     * @return How the client gets there; std::nullopt if that revision can no longer be rebuilt
+     */
+    std::optional<Seek> seek(int64_t revision) {
+        if (revision > document_->getRevision()) {
+            return std::nullopt;
+        }
+        if (started_ && revision >= position_ && revision - position_ <= static_cast<int64_t>(config_.maxCatchUp)) {
+            catchUpTo_ = revision;
+            return Seek{revision, std::nullopt};
+        }
+        std::optional<DocumentController::DocumentSnapshot> snapshot = document_->materializeAt(revision);
+        if (!snapshot) {
+            return std::nullopt;
+        }
+        std::string content = snapshot->content.toString();
+        started_ = true;
+        position_ = revision;
+        catchUpTo_ = revision;
+        length_ = content.size();
+        return Seek{revision, Keyframe{revision, std::move(content)}};
+    }
+
+    /**
+     * Stop the stream at a revision, e.g. the end of an audited range
+     *
+     * @param revision The revision to stop at; std::nullopt to follow the document as it grows
+     */
+    void setEnd(std::optional<int64_t> revision) {
+        end_ = revision;
+    }
+
+    // Change the speed, in revisions per second; 0 for as fast as possible
+    void setSpeed(double revisionsPerSecond) {
+        config_.revisionsPerSecond = std::max(0.0, revisionsPerSecond);
+    }
+
+    /**
+     * Take the next run
+     *
+     * @return The run; std::nullopt at the end, or before the first seek(), or if the
+     *         operations were released meanwhile, in which case seek() again
+     */
+    std::optional<Run> next() {
+        if (!started_) {
+            return std::nullopt;
+        }
+        const bool catchingUp = position_ < catchUpTo_;
+        const double speed = config_.revisionsPerSecond;
+        size_t wanted = config_.runOps;
+        if (catchingUp) {
+            wanted = std::min(wanted, static_cast<size_t>(catchUpTo_ - position_));
+        } else if (speed > 0.0) {
+            const double perTick = speed * std::chrono::duration<double>(config_.tick).count();
+            wanted = std::min(wanted, static_cast<size_t>(std::max(1.0, std::floor(perTick))));
+        }
+        if (end_) {
+            wanted = std::min(wanted, static_cast<size_t>(std::max<int64_t>(0, *end_ - position_)));
+        }
+        if (wanted == 0) {
+            return std::nullopt;
+        }
+
+        std::optional<std::vector<ot::OperationPtr>> operations = document_->getOperationsFrom(position_, wanted);
+        if (!operations || operations->empty()) {
+            return std::nullopt;
+        }
+        Run run;
+        run.fromRevision = position_;
+        run.toRevision = position_ + static_cast<int64_t>(operations->size());
+        run.op.retain(length_);
+        try {
+            for (const auto& op : *operations) {
+                run.op = run.op.compose(ot::TextOperation::fromOperation(*op, run.op.getTargetLength()));
+            }
+        } catch (const std::exception&) {
+            started_ = false;
+            return std::nullopt;
+        }
+        if (!catchingUp && speed > 0.0) {
+            run.delay = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(operations->size()) / speed));
+        }
+        position_ = run.toRevision;
+        length_ = run.op.getTargetLength();
+        return run;
+    }
+
+    // The revision the client is at once it applied every run taken so far
+    int64_t position() const {
+        return position_;
+    }
+
+private:
+    std::shared_ptr<const DocumentController> document_;
+    Config config_;
+    bool started_ = false;
+    int64_t position_ = 0;
+    int64_t catchUpTo_ = 0;             // Runs up to here go out without delay
+    size_t length_ = 0;                 // Of the text at position_
+    std::optional<int64_t> end_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_HISTORY_PLAYBACK_H
@@ -0,0 +1,257 @@
+#ifndef COLLABORATIVE_EDITOR_LOAD_TRACKER_H
+#define COLLABORATIVE_EDITOR_LOAD_TRACKER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/util/space_saving.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Accounts the load each document and each user puts on the node
+ *
+ * Per document the tracker keeps cheap counters: operations and their
+ * rate, bytes in and out, subscribers, transform time, history length and
+ * memory footprint. The last three come from the document itself
+ * (DocumentController::getLoadStats()) and are set with updateFootprint()
+ * when they are wanted, e.g. before report(). Documents are forgotten
+ * with forget() once closed.
+ *
+ * Users, who may be many more, get no counters of their own: they go,
+ * with the documents, into top-K Space-Saving sketches weighted by
+ * operations, which find the heaviest in fixed memory however many there
+ * are. Rates are taken over windows, rolled as work arrives once a window
+ * has passed or by rollWindow() from a timer.
+ *
+ * Thread-safe.
+ */
+class LoadTracker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t DEFAULT_SKETCH_SIZE = 128;
+    static constexpr Clock::duration DEFAULT_WINDOW = std::chrono::seconds(10);
+
+    struct DocumentLoad {
+        uint64_t operations = 0;
+        double operationsPerSecond = 0;  // Over the last window
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        size_t subscribers = 0;
+        uint64_t transformNanos = 0;
+        size_t historyLength = 0;
+        size_t memoryBytes = 0;
+    };
+
+    // A heavy document or user, from the sketches
+    struct Hot {
+        std::string id;
+        uint64_t operations = 0;  // Upper bound
+        uint64_t error = 0;       // How far above the true count it may be
+    };
+
+    /**
+     * @param sketchSize Counters in each top-K sketch; the top few of many times this hold exactly
+     * @param window Time rates are taken over
+     */
+    explicit LoadTracker(size_t sketchSize = DEFAULT_SKETCH_SIZE, Clock::duration window = DEFAULT_WINDOW)
+        : window_(window), documentSketch_(sketchSize), userSketch_(sketchSize), windowStart_(Clock::now()) {}
+
+    LoadTracker(const LoadTracker&) = delete;
+    LoadTracker& operator=(const LoadTracker&) = delete;
+
+    /**
+     * Count an operation received for a document
+     *
+     * @param documentId The document
+     * @param userId Who sent it
+     * @param bytes Its size on the wire
+     */
+    void recordOperation(const std::string& documentId, const std::string& userId, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rollIfDue(Clock::now());
+        Document& document = documents_[documentId];
+        ++document.load.operations;
+        ++document.windowOperations;
+        document.load.bytesIn += bytes;
+        documentSketch_.offer(documentId);
+        userSketch_.offer(userId);
+    }
+
+    // Count bytes sent for a document, e.g. a broadcast times its recipients
+    void recordBytesOut(const std::string& documentId, uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_[documentId].load.bytesOut += bytes;
+    }
+
+    void setSubscribers(const std::string& documentId, size_t subscribers) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_[documentId].load.subscribers = subscribers;
+    }
+
+    /**
+     * Set what a document reports about itself
+     *
+     * @param documentId The document
+     * @param transformNanos Its transform time so far
+     * @param historyLength Operations in its log
+     * @param memoryBytes Its memory footprint
+     */
+    void updateFootprint(const std::string& documentId, uint64_t transformNanos, size_t historyLength,
+                         size_t memoryBytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        DocumentLoad& load = documents_[documentId].load;
+        load.transformNanos = transformNanos;
+        load.historyLength = historyLength;
+        load.memoryBytes = memoryBytes;
+    }
+
+    // Stop counting a document; the sketch still remembers it
+    void forget(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents_.erase(documentId);
+    }
+
+    // A document's counters; all zero for one not tracked
+    DocumentLoad document(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        return it != documents_.end() ? it->second.load : DocumentLoad{};
+    }
+
+    /**
+     * The tracked documents with the highest operation rate
+     *
+     * @param limit Documents returned at most
+     * @return Documents and their counters, busiest first
+     */
+    std::vector<std::pair<std::string, DocumentLoad>> busiestDocuments(size_t limit) const {
+        std::vector<std::pair<std::string, DocumentLoad>> result;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            result.reserve(documents_.size());
+            for (const auto& [documentId, document] : documents_) {
+                result.emplace_back(documentId, document.load);
+            }
+        }
+        const size_t count = std::min(limit, result.size());
+        std::partial_sort(result.begin(), result.begin() + count, result.end(), [](const auto& a, const auto& b) {
+            return a.second.operationsPerSecond > b.second.operationsPerSecond ||
+                   (a.second.operationsPerSecond == b.second.operationsPerSecond &&
+                    a.second.operations > b.second.operations);
+        });
+        result.resize(count);
+        return result;
+    }
+
+    // The documents with the most operations since the tracker started, from the sketch
+    std::vector<Hot> hottestDocuments(size_t limit) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hot(documentSketch_, limit);
+    }
+
+    // The users with the most operations since the tracker started, from the sketch
+    std::vector<Hot> hottestUsers(size_t limit) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hot(userSketch_, limit);
+    }
+
+    /**
+     * Close the current window and take operation rates over it
+     *
+     * @param now The time; by default, now
+     */
+    void rollWindow(Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        roll(now);
+    }
+
+    /**
+     * Everything an operator looks at to find what loads the node, for an admin query
+     *
+     * @param limit Entries in each list
+     * @return {"documents": busiest tracked documents with their counters,
+     *          "hottestDocuments"/"hottestUsers": the sketches' top entries}
+     */
+    nlohmann::json report(size_t limit = 10) const {
+        nlohmann::json documents = nlohmann::json::array();
+        for (const auto& [documentId, load] : busiestDocuments(limit)) {
+            documents.push_back({
+                {"id", documentId},
+                {"operations", load.operations},
+                {"operationsPerSecond", load.operationsPerSecond},
+                {"bytesIn", load.bytesIn},
+                {"bytesOut", load.bytesOut},
+                {"subscribers", load.subscribers},
+                {"transformSeconds", static_cast<double>(load.transformNanos) / 1e9},
+                {"historyLength", load.historyLength},
+                {"memoryBytes", load.memoryBytes}});
+        }
+        return {
+            {"windowSeconds", std::chrono::duration<double>(window_).count()},
+            {"documents", std::move(documents)},
+            {"hottestDocuments", toJson(hottestDocuments(limit))},
+            {"hottestUsers", toJson(hottestUsers(limit))}};
+    }
+
+private:
+    struct Document {
+        DocumentLoad load;
+        uint64_t windowOperations = 0;
+    };
+
+    void rollIfDue(Clock::time_point now) {
+        if (now - windowStart_ >= window_) {
+            roll(now);
+        }
+    }
+
+    // Take the rates over the window that ends now (mutex_ must be held)
+    void roll(Clock::time_point now) {
+        const double seconds = std::chrono::duration<double>(now - windowStart_).count();
+        for (auto& [documentId, document] : documents_) {
+            document.load.operationsPerSecond =
+                seconds > 0 ? static_cast<double>(document.windowOperations) / seconds : 0.0;
+            document.windowOperations = 0;
+        }
+        windowStart_ = now;
+    }
+
+    static std::vector<Hot> hot(const util::SpaceSaving<std::string>& sketch, size_t limit) {
+        std::vector<Hot> result;
+        for (const auto& entry : sketch.top(limit)) {
+            result.push_back(Hot{entry.key, entry.count, entry.error});
+        }
+        return result;
+    }
+
+    static nlohmann::json toJson(const std::vector<Hot>& entries) {
+        nlohmann::json result = nlohmann::json::array();
+        for (const Hot& entry : entries) {
+            result.push_back({{"id", entry.id}, {"operations", entry.operations}, {"error", entry.error}});
+        }
+        return result;
+    }
+
+    const Clock::duration window_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Document> documents_;
+    util::SpaceSaving<std::string> documentSketch_;
+    util::SpaceSaving<std::string> userSketch_;
+    Clock::time_point windowStart_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_LOAD_TRACKER_H
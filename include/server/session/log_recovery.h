@@ -0,0 +1,260 @@
+#ifndef COLLABORATIVE_EDITOR_LOG_RECOVERY_H
+#define COLLABORATIVE_EDITOR_LOG_RECOVERY_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "server/session/document_cache.h"
+#include "server/thread_pool.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Recovers the documents a crash left in their logs, several at once, while the node serves
+ *
+ * Each document is rebuilt from its snapshot and the operations logged
+ * after it (see ot::WriteAheadLog) through the cache's loader, so
+ * recovering one is a DocumentCache::preload(). Documents do not depend
+ * on each other, so up to parallelism of them replay at once, on that
+ * many runners of a ThreadPool that each take the next document when they
+ * finish one.
+ *
+ * The node need not wait for all of them. A document that is recovered
+ * is resident and opens at once; an open of one still being replayed
+ * waits for that replay only; and an open of one not reached yet loads it
+ * itself. Documents that clients are about to want, e.g. those of the
+ * sessions reconnecting, are moved ahead of the rest with prioritize().
+ *
+ * A document whose replay throws is counted and skipped; a later open
+ * tries it again. The destructor drops the documents not started and
+ * waits for the replays under way, so the cache and the pool must outlive
+ * the recovery.
+ */
+class LogRecovery {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t documents = 0;     // Documents to recover
+        size_t recovered = 0;     // Resident after their replay
+        size_t failed = 0;        // Replays that threw
+        size_t prioritized = 0;   // Moved ahead by prioritize()
+        bool done = false;        // Every replay has finished
+        std::chrono::nanoseconds elapsed{0};  // Since start(), up to when it was done
+    };
+
+    /**
+     * @param cache The cache to recover into; its loader replays a document's log
+     * @param pool The pool the replays run on
+     * @param parallelism Documents replayed at once; 0 for one per worker of the pool
+     */
+    LogRecovery(DocumentCache& cache, ThreadPool& pool, size_t parallelism = 0)
+        : cache_(cache), pool_(pool), parallelism_(parallelism ? parallelism : pool.size()) {}
+
+    ~LogRecovery() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.clear();
+            urgent_.clear();
+        }
+        wait();
+    }
+
+    LogRecovery(const LogRecovery&) = delete;
+    LogRecovery& operator=(const LogRecovery&) = delete;
+
+    /**
+     * The documents with a log in a directory
+     *
+     * @param directory Where the logs are, as <documentId>.snapshot and <documentId>.wal
+     * @return Their IDs, each once, in name order
+     */
+    static std::vector<std::string> documentsIn(const std::filesystem::path& directory) {
+        std::vector<std::string> documents;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+            const std::filesystem::path& path = entry.path();
+            if (entry.is_regular_file(error) && (path.extension() == ".wal" || path.extension() == ".snapshot")) {
+                documents.push_back(path.stem().string());
+            }
+        }
+        std::sort(documents.begin(), documents.end());
+        documents.erase(std::unique(documents.begin(), documents.end()), documents.end());
+        return documents;
+    }
+
+    /**
+     * Start recovering documents; returns at once
+     * Call at most once per recovery
+     *
+     * @param documents The documents, in the order to recover them unless prioritized
+     */
+    void start(std::vector<std::string> documents) {
+        size_t runners = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            started_ = Clock::now();
+            for (auto& documentId : documents) {
+                if (states_.try_emplace(documentId, State::Waiting).second) {
+                    queue_.push_back(std::move(documentId));
+                }
+            }
+            runners = std::min(parallelism_, queue_.size());
+            runners_ = runners;
+            if (runners == 0) {
+                finished_ = started_;
+            }
+        }
+        for (size_t i = 0; i < runners; ++i) {
+            try {
+                pool_.post([this] { run(); });
+            } catch (...) {
+                // The pool is stopping; the documents left are loaded when opened
+                finishRunner();
+            }
+        }
+    }
+
+    /**
+     * Recover a document before those not started yet, e.g. for a client reconnecting to it
+     *
+     * @param documentId The document
+     * @return True if it was waiting and moved ahead
+     */
+    bool prioritize(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = states_.find(documentId);
+        if (it == states_.end() || it->second != State::Waiting) {
+            return false;
+        }
+        it->second = State::Urgent;
+        urgent_.push_back(documentId);
+        ++prioritized_;
+        return true;
+    }
+
+    /**
+     * Whether a document is still to be recovered or being replayed
+     *
+     * @param documentId The document
+     * @return False once it is recovered or failed, or if it was never among the documents
+     */
+    bool isPending(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = states_.find(documentId);
+        return it != states_.end() && it->second != State::Recovered && it->second != State::Failed;
+    }
+
+    /**
+     * Wait until every replay has finished
+     *
+     * @return The final counts
+     */
+    Stats wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return runners_ == 0; });
+        return statsLocked();
+    }
+
+    /**
+     * Get the counts so far, e.g. for a readiness probe
+     */
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return statsLocked();
+    }
+
+private:
+    enum class State { Waiting, Urgent, Running, Recovered, Failed };
+
+    // Replay documents until none is left
+    void run() {
+        for (;;) {
+            std::string documentId;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!takeLocked(documentId)) {
+                    break;
+                }
+            }
+            bool recovered = true;
+            try {
+                cache_.preload(documentId);
+            } catch (...) {
+                recovered = false;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            states_[documentId] = recovered ? State::Recovered : State::Failed;
+            ++(recovered ? recovered_ : failed_);
+        }
+        finishRunner();
+    }
+
+    // Take the next document, prioritized ones first; false if none is left (mutex_ held)
+    bool takeLocked(std::string& documentId) {
+        for (std::deque<std::string>* queue : {&urgent_, &queue_}) {
+            while (!queue->empty()) {
+                documentId = std::move(queue->front());
+                queue->pop_front();
+                State& state = states_[documentId];
+                // A prioritized document is also still in the main queue
+                if (state == State::Waiting || (state == State::Urgent && queue == &urgent_)) {
+                    state = State::Running;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void finishRunner() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--runners_ == 0) {
+            finished_ = Clock::now();
+            done_.notify_all();
+        }
+    }
+
+    // mutex_ must be held
+    Stats statsLocked() const {
+        Stats stats;
+        stats.documents = states_.size();
+        stats.recovered = recovered_;
+        stats.failed = failed_;
+        stats.prioritized = prioritized_;
+        stats.done = runners_ == 0;
+        stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            (stats.done ? finished_ : Clock::now()) - started_);
+        return stats;
+    }
+
+    DocumentCache& cache_;
+    ThreadPool& pool_;
+    const size_t parallelism_;
+    mutable std::mutex mutex_;            // Guards the members below
+    std::condition_variable done_;
+    std::unordered_map<std::string, State> states_;
+    std::deque<std::string> queue_;       // In start() order
+    std::deque<std::string> urgent_;      // Prioritized, first come first
+    size_t runners_ = 0;                  // Runners posted and not yet finished
+    size_t recovered_ = 0;
+    size_t failed_ = 0;
+    size_t prioritized_ = 0;
+    Clock::time_point started_;
+    Clock::time_point finished_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_LOG_RECOVERY_H
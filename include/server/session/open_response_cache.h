@@ -0,0 +1,187 @@
+#ifndef COLLABORATIVE_EDITOR_OPEN_RESPONSE_CACHE_H
+#define COLLABORATIVE_EDITOR_OPEN_RESPONSE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace server {
+
+/**
+ * Encoded DOC_RESPONSEs to DOC_OPEN, kept per document and revision
+ *
+ * When a room of clients opens a document at once, each DOC_OPEN would
+ * otherwise copy the whole content out of the document and escape it
+ * into a new message. Here the part of the response that is the same for
+ * every client, from documentId to the end, is encoded once per revision
+ * and shared by reference; a client's response is its own few base
+ * fields (see headOf()) followed by that body, written as one message
+ * without copying it.
+ *
+ * A document that changed since its body was encoded is not encoded
+ * again straight away: the operations applied since, as encoded for the
+ * broadcast, are kept after the body, and a client that may take them
+ * (an editor, which applies operations as they come) is sent the body
+ * and then that tail. Once the tail reaches maxTail operations, or an
+ * operation arrives out of order, the entry is dropped and the next open
+ * encodes the document as it is.
+ *
+ * Entries are keyed by document and by variant, e.g. the subscription
+ * the response names, since that is part of the body. Thread-safe.
+ */
+class OpenResponseCache {
+public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    static constexpr size_t DEFAULT_MAX_TAIL = 256;
+
+    // What a cached open sends
+    struct Hit {
+        int64_t revision = 0;       // Revision the body is at
+        Payload body;               // The response from documentId on
+        std::vector<Payload> tail;  // Operations applied after revision, oldest first
+    };
+
+    struct Stats {
+        uint64_t hits = 0;       // Opens answered from a body, with or without a tail
+        uint64_t misses = 0;     // Opens that had to encode the document
+        uint64_t tailOps = 0;    // Operations sent after a body instead of encoding it again
+    };
+
+    /**
+     * @param maxTail Operations kept after a body before it is dropped
+     */
+    explicit OpenResponseCache(size_t maxTail = DEFAULT_MAX_TAIL)
+        : maxTail_(maxTail) {}
+
+    /**
+     * Look for a body that brings a client to the document's current revision
+     *
+     * @param documentId The document
+     * @param variant Which body, e.g. the subscription
+     * @param revision The document's current revision
+     * @param allowTail Whether the client may be sent operations after the body
+     * @return The body and tail, or std::nullopt to encode and store() a new one
+     */
+    std::optional<Hit> find(const std::string& documentId, const std::string& variant, int64_t revision,
+                            bool allowTail) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find({documentId, variant});
+        if (it == entries_.end() || it->second.revision + static_cast<int64_t>(it->second.tail.size()) != revision ||
+            (!allowTail && !it->second.tail.empty())) {
+            ++stats_.misses;
+            return std::nullopt;
+        }
+        ++stats_.hits;
+        stats_.tailOps += it->second.tail.size();
+        return Hit{it->second.revision, it->second.body, it->second.tail};
+    }
+
+    /**
+     * Keep a freshly encoded body
+     *
+     * @param documentId The document
+     * @param variant Which body
+     * @param revision The revision it is at
+     * @param body The response from documentId on; see bodyOf()
+     */
+    void store(const std::string& documentId, const std::string& variant, int64_t revision, Payload body) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[{documentId, variant}];
+        entry.revision = revision;
+        entry.body = std::move(body);
+        entry.tail.clear();
+    }
+
+    /**
+     * Add an operation a document applied to the tails of its bodies
+     *
+     * @param documentId The document
+     * @param revision The revision the operation brought it to
+     * @param operation The operation as broadcast
+     */
+    void append(const std::string& documentId, int64_t revision, const Payload& operation) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = entries_.lower_bound({documentId, std::string()});
+             it != entries_.end() && it->first.first == documentId;) {
+            Entry& entry = it->second;
+            if (entry.revision + static_cast<int64_t>(entry.tail.size()) + 1 != revision ||
+                entry.tail.size() >= maxTail_) {
+                it = entries_.erase(it);
+                continue;
+            }
+            entry.tail.push_back(operation);
+            ++it;
+        }
+    }
+
+    // Drop a document's bodies, e.g. when it is closed or replaced
+    void invalidate(const std::string& documentId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.lower_bound({documentId, std::string()});
+        while (it != entries_.end() && it->first.first == documentId) {
+            it = entries_.erase(it);
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    /**
+     * Take the shared part of an encoded DocumentMessage
+     *
+     * The base fields (type, clientId, sessionId, sequenceNumber and
+     * timestamp) come first on the wire and documentId right after them,
+     * so everything from documentId on is the same for every client.
+     * Inside a JSON string every quote is escaped, so the first unescaped
+     * "documentId" key is the field itself.
+     *
+     * @param encoded The whole message as text
+     * @return From the documentId field to the closing brace
+     */
+    static Payload bodyOf(const std::string& encoded) {
+        return std::make_shared<const std::string>(encoded.substr(splitAt(encoded)));
+    }
+
+    /**
+     * Take the per-client part of an encoded DocumentMessage, to be followed by a body
+     *
+     * @param encoded The client's response, which needs nothing beyond its base fields and documentId
+     * @return Everything before the documentId field
+     */
+    static std::string headOf(const std::string& encoded) {
+        return encoded.substr(0, splitAt(encoded));
+    }
+
+private:
+    struct Entry {
+        int64_t revision = 0;
+        Payload body;
+        std::vector<Payload> tail;
+    };
+
+    static size_t splitAt(const std::string& encoded) {
+        const size_t at = encoded.find("\"documentId\":");
+        return at == std::string::npos ? encoded.size() : at;
+    }
+
+    const size_t maxTail_;
+    mutable std::mutex mutex_;
+    // By document, then variant, so one document's entries are adjacent
+    std::map<std::pair<std::string, std::string>, Entry> entries_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_OPEN_RESPONSE_CACHE_H
@@ -0,0 +1,334 @@
+#ifndef COLLABORATIVE_EDITOR_PRESENCE_AGGREGATOR_H
+#define COLLABORATIVE_EDITOR_PRESENCE_AGGREGATOR_H
+
+#include <chrono>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/ot/cursor_transform.h"
+#include "common/protocol/protocol.h"
+#include "server/session/document_statistics.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Coalesces presence updates per document before they are broadcast
+ *
+ * Cursor and selection moves arrive far more often than anyone can see
+ * them. The aggregator keeps only each user's latest presence per
+ * document, and flush() turns what changed since the last flush into one
+ * PRESENCE_UPDATE per user, holding only the fields that differ from what
+ * was last sent: usually just the cursor. Moves that a later move, or a
+ * move back, supersedes within the window are never sent. Each document
+ * is flushed at most once per interval; a document that was quiet
+ * flushes its first move at once.
+ *
+ * Users are told apart by the message's clientId, or by username for
+ * messages without one. Document handles are left out of what is sent, as
+ * they only mean something on the connection they were given to.
+ *
+ * Edits move the cursors and selections of their document (see
+ * transform()), as every client moves the ones it shows, so a client need
+ * not send its cursor again because the text under it moved.
+ *
+ * snapshot() gives everyone's presence in a document at once, for a
+ * client that just opened it, with the document's counts if kept.
+ *
+ * Not thread-safe; owners lock around it.
+ */
+class PresenceAggregator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 20 flushes a second per document
+    static constexpr Clock::duration DEFAULT_INTERVAL = std::chrono::milliseconds(50);
+
+    explicit PresenceAggregator(Clock::duration interval = DEFAULT_INTERVAL)
+        : interval_(interval) {}
+
+    void setInterval(Clock::duration interval) { interval_ = interval; }
+    Clock::duration getInterval() const { return interval_; }
+
+    // Whether a presence message type is coalesced, rather than sent as it is
+    static bool coalesces(protocol::MessageType type) {
+        return type == protocol::MessageType::PRESENCE_CURSOR ||
+               type == protocol::MessageType::PRESENCE_SELECTION ||
+               type == protocol::MessageType::PRESENCE_UPDATE;
+    }
+
+    /**
+     * Record a presence message
+     *
+     * A join is sent as it is by the caller and becomes the state later
+     * diffs are taken against. A leave forgets the user, and any move of
+     * theirs not yet flushed. Other types are merged into the user's state
+     * and wait for flush().
+     *
+     * @param message The presence message
+     */
+    void update(const protocol::PresenceMessage& message) {
+        const std::string& user = userOf(message);
+        if (message.type == protocol::MessageType::PRESENCE_LEAVE) {
+            removeUser(message.documentId, user);
+            return;
+        }
+
+        Document& document = documents_[message.documentId];
+        auto [it, added] = document.users.try_emplace(user, message.type);
+        UserPresence& presence = it->second;
+        merge(presence.current, message);
+        if (message.type == protocol::MessageType::PRESENCE_JOIN) {
+            presence.sent = presence.current;
+            return;
+        }
+        presence.dirty = true;
+        dirty_.insert(message.documentId);
+    }
+
+    /**
+     * Move a document's cursors and selections through an edit applied to it
+     *
+     * Both each user's latest presence and what was last sent of it
+     * move, so the edit by itself makes no diff; a move not yet flushed
+     * stays pending. Every position of the document goes through in one
+     * sorted pass.
+     *
+     * @param documentId The document
+     * @param position Where the edit starts
+     * @param removed Characters it removed
+     * @param added Characters it inserted in their place
+     */
+    void transform(const std::string& documentId, size_t position, size_t removed, size_t added) {
+        movePositions(documentId, [&](ot::CursorSet& positions) { positions.transform(position, removed, added); });
+    }
+
+    // Move a document's cursors and selections through a batch of edits, oldest first
+    void transform(const std::string& documentId, std::span<const ot::ValueOperation> ops) {
+        movePositions(documentId, [&](ot::CursorSet& positions) { positions.transform(ops); });
+    }
+
+    /**
+     * Forget a client in every document, e.g. when it disconnects
+     *
+     * @param clientId The client's ID
+     */
+    void removeClient(const std::string& clientId) {
+        for (auto it = documents_.begin(); it != documents_.end();) {
+            it->second.users.erase(clientId);
+            if (it->second.users.empty()) {
+                dirty_.erase(it->first);
+                it = documents_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /**
+     * Produce the diffs of the documents that are due
+     *
+     * @param now The current time
+     * @return One PRESENCE_UPDATE per user whose presence changed, grouped by document
+     */
+    std::vector<protocol::PresenceMessage> flush(Clock::time_point now) {
+        std::vector<protocol::PresenceMessage> diffs;
+        for (auto it = dirty_.begin(); it != dirty_.end();) {
+            Document& document = documents_.at(*it);
+            if (document.lastFlush && now - *document.lastFlush < interval_) {
+                ++it;
+                continue;
+            }
+            for (auto& [user, presence] : document.users) {
+                if (presence.dirty) {
+                    appendDiff(diffs, presence);
+                }
+            }
+            document.lastFlush = now;
+            it = dirty_.erase(it);
+        }
+        return diffs;
+    }
+
+    /**
+     * When the next document falls due
+     *
+     * @return The earliest time flush() has something to produce, or nothing if no presence is pending
+     */
+    std::optional<Clock::time_point> nextFlush() const {
+        std::optional<Clock::time_point> next;
+        for (const auto& documentId : dirty_) {
+            const Document& document = documents_.at(documentId);
+            const Clock::time_point due = document.lastFlush ? *document.lastFlush + interval_
+                                                             : Clock::time_point::min();
+            if (!next || due < *next) {
+                next = due;
+            }
+        }
+        return next;
+    }
+
+    /**
+     * The presence of everyone in a document, e.g. for a client that just opened it
+     *
+     * @param documentId The document
+     * @param statistics Where to look up the document's counts, added to each message's metadata; none if nullptr
+     * @return One PRESENCE_UPDATE per user with everything heard from them
+     */
+    std::vector<protocol::PresenceMessage> snapshot(const std::string& documentId,
+                                                    const DocumentStatistics* statistics = nullptr) const {
+        std::vector<protocol::PresenceMessage> messages;
+        auto it = documents_.find(documentId);
+        if (it == documents_.end()) {
+            return messages;
+        }
+        messages.reserve(it->second.users.size());
+        for (const auto& [user, presence] : it->second.users) {
+            protocol::PresenceMessage message = presence.current;
+            message.type = protocol::MessageType::PRESENCE_UPDATE;
+            message.documentHandle.reset();
+            if (statistics) {
+                statistics->annotate(documentId, message.metadata);
+            }
+            messages.push_back(std::move(message));
+        }
+        return messages;
+    }
+
+    // Number of users present in a document
+    size_t getUserCount(const std::string& documentId) const {
+        auto it = documents_.find(documentId);
+        return it != documents_.end() ? it->second.users.size() : 0;
+    }
+
+private:
+    struct UserPresence {
+        explicit UserPresence(protocol::MessageType type)
+            : current(type), sent(type) {}
+
+        // Everything heard from the user so far
+        protocol::PresenceMessage current;
+        // What the last flush, or the join, told the others
+        protocol::PresenceMessage sent;
+        bool dirty = false;
+    };
+
+    struct Document {
+        std::unordered_map<std::string, UserPresence> users;
+        std::optional<Clock::time_point> lastFlush;
+    };
+
+    static const std::string& userOf(const protocol::PresenceMessage& message) {
+        return message.clientId.empty() ? message.username : message.clientId;
+    }
+
+    void removeUser(const std::string& documentId, const std::string& user) {
+        auto it = documents_.find(documentId);
+        if (it == documents_.end()) {
+            return;
+        }
+        it->second.users.erase(user);
+        if (it->second.users.empty()) {
+            dirty_.erase(documentId);
+            documents_.erase(it);
+        }
+    }
+
+    // Gather the document's positions, move them and put them back
+    template <typename Move>
+    void movePositions(const std::string& documentId, Move&& move) {
+        auto it = documents_.find(documentId);
+        if (it == documents_.end()) {
+            return;
+        }
+        positions_.clear();
+        targets_.clear();
+        const auto track = [this](std::optional<size_t>& position) {
+            if (position) {
+                positions_.add(*position);
+                targets_.push_back(&*position);
+            }
+        };
+        for (auto& [user, presence] : it->second.users) {
+            for (protocol::PresenceMessage* state : {&presence.current, &presence.sent}) {
+                track(state->cursorPosition);
+                track(state->selectionStart);
+                track(state->selectionEnd);
+            }
+        }
+        if (targets_.empty()) {
+            return;
+        }
+        move(positions_);
+        for (size_t i = 0; i < targets_.size(); ++i) {
+            *targets_[i] = positions_.get(static_cast<ot::CursorSet::Handle>(i));
+        }
+    }
+
+    // Take over the header and every field the message carries
+    static void merge(protocol::PresenceMessage& state, const protocol::PresenceMessage& message) {
+        state.type = message.type;
+        state.clientId = message.clientId;
+        state.sessionId = message.sessionId;
+        state.sequenceNumber = message.sequenceNumber;
+        state.timestamp = message.timestamp;
+        state.documentId = message.documentId;
+        state.username = message.username;
+        if (message.displayName) state.displayName = message.displayName;
+        if (message.cursorPosition) state.cursorPosition = message.cursorPosition;
+        if (message.selectionStart) state.selectionStart = message.selectionStart;
+        if (message.selectionEnd) state.selectionEnd = message.selectionEnd;
+        if (message.userColor) state.userColor = message.userColor;
+        if (!message.metadata.empty()) state.metadata = message.metadata;
+    }
+
+    // Add what changed since the last flush, if anything did
+    static void appendDiff(std::vector<protocol::PresenceMessage>& diffs, UserPresence& presence) {
+        const protocol::PresenceMessage& current = presence.current;
+        const protocol::PresenceMessage& sent = presence.sent;
+        protocol::PresenceMessage diff(protocol::MessageType::PRESENCE_UPDATE);
+        diff.clientId = current.clientId;
+        diff.sessionId = current.sessionId;
+        diff.sequenceNumber = current.sequenceNumber;
+        diff.timestamp = current.timestamp;
+        diff.documentId = current.documentId;
+        diff.username = current.username;
+
+        bool changed = false;
+        const auto differs = [&changed](auto& out, const auto& now, const auto& before) {
+            if (now != before) {
+                out = now;
+                changed = true;
+            }
+        };
+        differs(diff.displayName, current.displayName, sent.displayName);
+        differs(diff.cursorPosition, current.cursorPosition, sent.cursorPosition);
+        differs(diff.selectionStart, current.selectionStart, sent.selectionStart);
+        differs(diff.selectionEnd, current.selectionEnd, sent.selectionEnd);
+        differs(diff.userColor, current.userColor, sent.userColor);
+        differs(diff.metadata, current.metadata, sent.metadata);
+
+        presence.sent = current;
+        presence.dirty = false;
+        if (changed) {
+            diffs.push_back(std::move(diff));
+        }
+    }
+
+    Clock::duration interval_;
+    std::unordered_map<std::string, Document> documents_;
+    // Documents with presence not yet flushed
+    std::unordered_set<std::string> dirty_;
+    // Scratch space for movePositions(), kept to reuse its capacity
+    ot::CursorSet positions_;
+    std::vector<size_t*> targets_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_PRESENCE_AGGREGATOR_H
@@ -0,0 +1,214 @@
+#ifndef COLLABORATIVE_EDITOR_REGIONAL_DOCUMENT_H
+#define COLLABORATIVE_EDITOR_REGIONAL_DOCUMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "common/crdt/crdt_document.h"
+#include "common/crdt/delta_sync.h"
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * One region's copy of a document edited in several regions at once
+ *
+ * Sending every edit to one sequencer costs a round trip to its region on
+ * each acknowledgement, which for a user on another continent is most of
+ * the latency they see. Here each region sequences its own users' edits
+ * with the OT engine, as a single-region node does: submit() transforms
+ * an edit with the OperationManager, applies it and acknowledges it at
+ * once, without waiting for any other region.
+ *
+ * Regions converge through a CRDT instead of a global sequencer. Every
+ * edit applied here is mirrored into a CrdtDocument under the region's
+ * site, and regions exchange what the others are missing as deltas
+ * (stateVector() and deltaFor(), in the delta sync encoding). merge()
+ * integrates a peer's delta into the CRDT and replays what it did to the
+ * text as operations of the local OT history, so the region's clients
+ * get them like anyone's edit and their concurrent edits are transformed
+ * against them. Both copies of the text are the same after every call.
+ *
+ * All regions start from the same CRDT state: the first creates the
+ * document from its content, the others join from its snapshot().
+ *
+ * Thread-safe; edits and merges are serialized.
+ */
+class RegionalDocument {
+public:
+    // User ID the operations replayed from other regions are applied as
+    static constexpr const char* MERGE_USER = "region-merge";
+
+    // An operation in the local history, for the region's clients
+    struct Sequenced {
+        int64_t revision = 0;           // The revision it made
+        ot::ValueOperation operation;   // As applied
+    };
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t rejected = 0;          // Edits that did not apply or whose client must resync
+        uint64_t merges = 0;
+        uint64_t mergedOperations = 0;  // Operations replayed from other regions
+    };
+
+    /**
+     * Create a document, in its first region
+     *
+     * @param region The region's ID, unique among the regions; its CRDT site
+     * @param content The document's content
+     */
+    RegionalDocument(const std::string& region, const std::string& content)
+        : region_(region), crdt_(region), document_(content), operations_(10000) {
+        if (!content.empty()) {
+            crdt_.localInsert(content, 0);
+        }
+    }
+
+    /**
+     * Join a document another region created
+     *
+     * @param region The region's ID, unique among the regions
+     * @param snapshot Another region's snapshot()
+     * @return The document
+     * @throws std::runtime_error if the snapshot is malformed
+     */
+    static std::unique_ptr<RegionalDocument> join(const std::string& region, std::string_view snapshot) {
+        crdt::CrdtDocument crdt(region);
+        crdt.loadSnapshot(snapshot);
+        return std::unique_ptr<RegionalDocument>(new RegionalDocument(region, crdt.getText(), snapshot));
+    }
+
+    RegionalDocument(const RegionalDocument&) = delete;
+    RegionalDocument& operator=(const RegionalDocument&) = delete;
+
+    const std::string& getRegion() const {
+        return region_;
+    }
+
+    /**
+     * Sequence an edit of one of the region's clients
+     *
+     * @param op The edit
+     * @param clientId The client
+     * @param baseRevision The local revision it was made on
+     * @return The edit as applied, to acknowledge and broadcast; std::nullopt if it did not
+     *         apply or the client must resync
+     */
+    std::optional<Sequenced> submit(const ot::ValueOperation& op, const std::string& clientId, int64_t baseRevision) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.submitted++;
+        std::optional<ot::ValueOperation> transformed = operations_.processOperation(op, clientId, baseRevision);
+        if (!transformed || !document_.applyOperation(*transformed, clientId)) {
+            stats_.rejected++;
+            return std::nullopt;
+        }
+        operations_.recordOperation(*transformed);
+        std::visit([this](const auto& applied) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(applied)>, ot::InsertOp>) {
+                crdt_.localInsert(applied.text, applied.position);
+            } else {
+                crdt_.localDelete(applied.position, applied.length);
+            }
+        }, *transformed);
+        return Sequenced{operations_.getCurrentRevision(), std::move(*transformed)};
+    }
+
+    // What the region has seen, for a peer to work out the delta it is missing
+    std::string stateVector() const {
+        return crdt::encodeStateVector(crdt_.getVersionVector());
+    }
+
+    /**
+     * Everything a peer region is missing
+     *
+     * @param peerStateVector The peer's stateVector()
+     * @return The delta, for the peer's merge()
+     * @throws std::runtime_error if the state vector is malformed
+     */
+    std::string deltaFor(std::string_view peerStateVector) const {
+        return crdt::encodeDelta(crdt_.getDeltaSince(crdt::decodeStateVector(peerStateVector)));
+    }
+
+    /**
+     * Merge what a peer region sent
+     *
+     * @param delta The peer's deltaFor() this region
+     * @return The operations the merge made in the local history, in order, to broadcast to the
+     *         region's clients; none if the region had it all
+     * @throws std::runtime_error if the delta is malformed; nothing is merged then
+     */
+    std::vector<Sequenced> merge(std::string_view delta) {
+        const crdt::CrdtDelta decoded = crdt::decodeDelta(delta);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.merges++;
+        std::vector<Sequenced> sequenced;
+        for (crdt::TextChange& change : crdt_.applyDeltaWithChanges(decoded)) {
+            ot::ValueOperation op = change.deleted > 0
+                ? ot::ValueOperation(ot::DeleteOp{change.position, change.deleted, {}})
+                : ot::ValueOperation(ot::InsertOp{change.position, std::move(change.inserted)});
+            // Made on the current revision, so nothing to transform; both copies moved together
+            document_.applyOperation(op, MERGE_USER, false);
+            operations_.recordOperation(op);
+            sequenced.push_back({operations_.getCurrentRevision(), std::move(op)});
+        }
+        stats_.mergedOperations += sequenced.size();
+        return sequenced;
+    }
+
+    // The CRDT state, for another region to join from
+    std::string snapshot() const {
+        return crdt_.toSnapshot();
+    }
+
+    std::string getText() const {
+        return crdt_.getText();
+    }
+
+    int64_t getRevision() const {
+        return operations_.getCurrentRevision();
+    }
+
+    // The local OT state, e.g. for acknowledgements, compaction and resync
+    OperationManager& getOperations() {
+        return operations_;
+    }
+
+    DocumentController& getDocument() {
+        return document_;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    RegionalDocument(const std::string& region, const std::string& content, std::string_view snapshot)
+        : region_(region), crdt_(region), document_(content), operations_(10000) {
+        crdt_.loadSnapshot(snapshot);
+    }
+
+    std::string region_;
+    mutable std::mutex mutex_;      // Serializes edits and merges, which change both copies
+    crdt::CrdtDocument crdt_;
+    DocumentController document_;
+    OperationManager operations_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_REGIONAL_DOCUMENT_H
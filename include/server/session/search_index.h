@@ -0,0 +1,454 @@
+#ifndef COLLABORATIVE_EDITOR_SEARCH_INDEX_H
+#define COLLABORATIVE_EDITOR_SEARCH_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/models/file_system.h"
+#include "common/ot/value_operation.h"
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Full-text search over the documents of a workspace, kept current as they are edited
+ *
+ * An inverted index from trigrams, every three consecutive bytes of a
+ * document folded to lower case, to the documents that contain them. A
+ * query is looked up by its own trigrams: only the documents that have
+ * every one of them can match, and only those are scanned for it, so a
+ * query over 100k documents reads the few that could hold it instead of
+ * all of them. The scan checks the match exactly, case-sensitive or not,
+ * and finds its offsets.
+ *
+ * Edits update the index in place. An insert or delete only changes the
+ * trigrams that overlap the range it touched, including the two on each
+ * side that straddle its ends, so a keystroke costs a handful of trigram
+ * updates however long the document is. The index keeps its own copy of
+ * each document's text, which the scans read and the edits keep in step.
+ * Feed it every operation the document applies (see watch()), or the
+ * whole content again with add().
+ *
+ * Queries shorter than a trigram scan every document.
+ *
+ * Thread-safe: queries run alongside each other, edits one at a time.
+ */
+class SearchIndex {
+public:
+    // DOC_SEARCH metadata keys
+    static constexpr const char* QUERY_KEY = "query";
+    static constexpr const char* LIMIT_KEY = "limit";
+    static constexpr const char* IGNORE_CASE_KEY = "ignoreCase";
+    // DOC_RESPONSE metadata key prefix of a matching document's offsets, e.g. "offsets:docs/a.txt" = "4,120"
+    static constexpr const char* OFFSETS_KEY_PREFIX = "offsets:";
+
+    // Documents a query returns unless it asks for fewer
+    static constexpr size_t DEFAULT_LIMIT = 100;
+    // Offsets reported per document
+    static constexpr size_t MAX_OFFSETS = 100;
+
+    struct Match {
+        std::string documentId;
+        std::vector<size_t> offsets;    // Where the query starts, in order; at most MAX_OFFSETS
+    };
+
+    struct Stats {
+        size_t documents = 0;
+        size_t trigrams = 0;            // Distinct trigrams indexed
+        uint64_t queries = 0;
+        uint64_t scanned = 0;           // Documents the queries had to scan
+        uint64_t edits = 0;             // Inserts and deletes applied in place
+        uint64_t reindexed = 0;         // Documents indexed whole, by add() or an operation that is not an insert or delete
+    };
+
+    /**
+     * Index a document, replacing what was indexed for it
+     *
+     * @param documentId The document
+     * @param content Its content
+     */
+    void add(const std::string& documentId, std::string content) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto [it, added] = ids_.try_emplace(documentId, 0);
+        if (added) {
+            it->second = slot();
+            documents_[it->second] = std::make_unique<Document>();
+            documents_[it->second]->id = documentId;
+        } else {
+            unindex(it->second, 0, documents_[it->second]->text.size());
+        }
+        Document& document = *documents_[it->second];
+        document.text = std::move(content);
+        index(it->second, 0, document.text.size());
+        stats_.reindexed++;
+    }
+
+    // Index a file's content, under its path below the workspace root unless named otherwise
+    void add(const fs::File& file, const std::string& documentId = {}) {
+        add(documentId.empty() ? file.getRelativePath() : documentId, file.getContent());
+    }
+
+    /**
+     * Index every file below a directory, under its path below the workspace root
+     *
+     * @param root The directory
+     * @return Files indexed
+     */
+    size_t addTree(const fs::Directory& root) {
+        size_t files = 0;
+        std::string after;
+        for (;;) {
+            const std::vector<fs::Directory::Entry> page = root.listChildren(after, LIST_PAGE);
+            for (const auto& entry : page) {
+                if (auto directory = entry.node->asDirectory()) {
+                    files += addTree(*directory);
+                } else if (auto file = entry.node->asFile()) {
+                    add(*file);
+                    files++;
+                }
+            }
+            if (page.size() < LIST_PAGE) {
+                return files;
+            }
+            after = page.back().name;
+        }
+    }
+
+    // Forget a document, e.g. once it is deleted; false if it was not indexed
+    bool remove(const std::string& documentId) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(documentId);
+        if (it == ids_.end()) {
+            return false;
+        }
+        unindex(it->second, 0, documents_[it->second]->text.size());
+        documents_[it->second].reset();
+        free_.push_back(it->second);
+        ids_.erase(it);
+        return true;
+    }
+
+    /**
+     * Apply an edit a document made, updating only the trigrams it touched
+     *
+     * @param documentId The document
+     * @param op The edit, as applied to the document
+     * @return False if the document is not indexed or the edit does not fit its text
+     */
+    bool apply(const std::string& documentId, const ot::ValueOperation& op) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(documentId);
+        if (it == ids_.end()) {
+            return false;
+        }
+        const size_t size = documents_[it->second]->text.size();
+        const bool applied = std::visit([&](const auto& edit) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, ot::InsertOp>) {
+                if (edit.position > size) {
+                    return false;
+                }
+                replace(it->second, edit.position, 0, edit.text);
+            } else {
+                if (edit.position > size || edit.length > size - edit.position) {
+                    return false;
+                }
+                replace(it->second, edit.position, edit.length, {});
+            }
+            return true;
+        }, op);
+        if (applied) {
+            stats_.edits++;
+        }
+        return applied;
+    }
+
+    // Apply an operation a document made; one that is not a single insert or delete reindexes the document
+    bool apply(const std::string& documentId, const ot::Operation& op) {
+        if (std::optional<ot::ValueOperation> value = ot::toValueOperation(op)) {
+            return apply(documentId, *value);
+        }
+        std::string text;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = ids_.find(documentId);
+            if (it == ids_.end()) {
+                return false;
+            }
+            text = documents_[it->second]->text;
+        }
+        if (!op.apply(text)) {
+            return false;
+        }
+        add(documentId, std::move(text));
+        return true;
+    }
+
+    /**
+     * Keep a document's entry current from its operations
+     * The document's content is indexed now, and every operation it
+     * applies from here on is applied to the index. The index must outlive
+     * the document.
+     *
+     * @param documentId The document
+     * @param document Its OT state
+     */
+    void watch(const std::string& documentId, DocumentController& document) {
+        add(documentId, document.getDocument());
+        document.registerOperationCallback([this, documentId](const ot::OperationPtr& op, const std::string&, int64_t) {
+            if (op) {
+                apply(documentId, *op);
+            }
+        });
+    }
+
+    /**
+     * Find the documents that contain a text
+     *
+     * @param query The text
+     * @param limit Documents to return at most
+     * @param ignoreCase Whether ASCII letters match either case
+     * @return Each matching document with where the text starts in it, in the order they were indexed
+     */
+    std::vector<Match> search(std::string_view query, size_t limit = DEFAULT_LIMIT, bool ignoreCase = false) const {
+        std::vector<Match> matches;
+        if (query.empty() || limit == 0) {
+            return matches;
+        }
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        uint64_t scanned = 0;
+        auto scan = [&](uint32_t slot) {
+            scanned++;
+            const Document& document = *documents_[slot];
+            std::vector<size_t> offsets = find(document.text, query, ignoreCase);
+            if (!offsets.empty()) {
+                matches.push_back({document.id, std::move(offsets)});
+            }
+            return matches.size() < limit;
+        };
+
+        if (query.size() < TRIGRAM) {
+            for (uint32_t slot = 0; slot < documents_.size(); ++slot) {
+                if (documents_[slot] && !scan(slot)) {
+                    break;
+                }
+            }
+        } else {
+            // The query's trigrams' documents, the fewest first, so the intersection shrinks fastest
+            std::vector<const std::vector<uint32_t>*> lists;
+            for (size_t i = 0; i + TRIGRAM <= query.size(); ++i) {
+                auto it = postings_.find(trigramAt(query, i));
+                if (it == postings_.end()) {
+                    lists.clear();
+                    break;
+                }
+                lists.push_back(&it->second);
+            }
+            std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+            lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+            if (!lists.empty()) {
+                for (uint32_t slot : *lists.front()) {
+                    const bool candidate = std::all_of(lists.begin() + 1, lists.end(), [slot](const auto* list) {
+                        return std::binary_search(list->begin(), list->end(), slot);
+                    });
+                    if (candidate && !scan(slot)) {
+                        break;
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> statsLock(statsMutex_);
+        queryStats_.queries++;
+        queryStats_.scanned += scanned;
+        return matches;
+    }
+
+    /**
+     * Answer a DOC_SEARCH
+     *
+     * The request has the text to find in metadata "query", and may set
+     * "limit" to the documents to return and "ignoreCase" to "true". The
+     * DOC_RESPONSE lists the matching documents in documentList, and each
+     * one's offsets, comma-separated, in metadata "offsets:" + its ID.
+     *
+     * @param request The DOC_SEARCH
+     * @return The DOC_RESPONSE
+     */
+    protocol::DocumentMessage answer(const protocol::DocumentMessage& request) const {
+        protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+        response.clientId = request.clientId;
+        auto query = request.metadata.find(QUERY_KEY);
+        if (query == request.metadata.end() || query->second.empty()) {
+            response.success = false;
+            response.errorMessage = "No query";
+            return response;
+        }
+        size_t limit = DEFAULT_LIMIT;
+        auto requested = request.metadata.find(LIMIT_KEY);
+        if (requested != request.metadata.end()) {
+            try {
+                limit = std::min<size_t>(DEFAULT_LIMIT, std::stoul(requested->second));
+            } catch (const std::exception&) {
+                // Not a number; the default stands
+            }
+        }
+        auto ignoreCase = request.metadata.find(IGNORE_CASE_KEY);
+        const bool folded = ignoreCase != request.metadata.end() && ignoreCase->second == "true";
+
+        response.success = true;
+        for (const Match& match : search(query->second, limit, folded)) {
+            std::string offsets;
+            for (size_t offset : match.offsets) {
+                offsets += (offsets.empty() ? "" : ",") + std::to_string(offset);
+            }
+            response.metadata[OFFSETS_KEY_PREFIX + match.documentId] = std::move(offsets);
+            response.documentList.push_back(match.documentId);
+        }
+        return response;
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            stats = stats_;
+            stats.documents = ids_.size();
+            stats.trigrams = postings_.size();
+        }
+        std::lock_guard<std::mutex> statsLock(statsMutex_);
+        stats.queries = queryStats_.queries;
+        stats.scanned = queryStats_.scanned;
+        return stats;
+    }
+
+private:
+    static constexpr size_t TRIGRAM = 3;
+    // Directory entries taken under one lock at a time while walking a tree
+    static constexpr size_t LIST_PAGE = 256;
+
+    struct Document {
+        std::string id;
+        std::string text;
+        std::unordered_map<uint32_t, uint32_t> trigrams;    // How often each trigram occurs in the text
+    };
+
+    struct QueryStats {
+        uint64_t queries = 0;
+        uint64_t scanned = 0;
+    };
+
+    static unsigned char fold(char c) {
+        const auto byte = static_cast<unsigned char>(c);
+        return byte >= 'A' && byte <= 'Z' ? static_cast<unsigned char>(byte + ('a' - 'A')) : byte;
+    }
+
+    static uint32_t trigramAt(std::string_view text, size_t offset) {
+        return (uint32_t{fold(text[offset])} << 16) | (uint32_t{fold(text[offset + 1])} << 8) |
+               uint32_t{fold(text[offset + 2])};
+    }
+
+    // Where query starts in text, up to MAX_OFFSETS of them
+    static std::vector<size_t> find(std::string_view text, std::string_view query, bool ignoreCase) {
+        std::vector<size_t> offsets;
+        if (!ignoreCase) {
+            for (size_t at = text.find(query); at != std::string_view::npos && offsets.size() < MAX_OFFSETS;
+                 at = text.find(query, at + 1)) {
+                offsets.push_back(at);
+            }
+            return offsets;
+        }
+        auto same = [](char a, char b) { return fold(a) == fold(b); };
+        for (auto it = text.begin(); offsets.size() < MAX_OFFSETS; ++it) {
+            it = std::search(it, text.end(), query.begin(), query.end(), same);
+            if (it == text.end()) {
+                break;
+            }
+            offsets.push_back(static_cast<size_t>(it - text.begin()));
+        }
+        return offsets;
+    }
+
+    // A free document slot (mutex_ must be held)
+    uint32_t slot() {
+        if (!free_.empty()) {
+            const uint32_t slot = free_.back();
+            free_.pop_back();
+            return slot;
+        }
+        documents_.emplace_back();
+        return static_cast<uint32_t>(documents_.size() - 1);
+    }
+
+    /**
+     * Replace length bytes of a document's text at position, updating the
+     * trigrams that start up to two bytes before the range and inside it
+     * (mutex_ must be held)
+     */
+    void replace(uint32_t slot, size_t position, size_t length, const std::string& text) {
+        const size_t from = position >= TRIGRAM - 1 ? position - (TRIGRAM - 1) : 0;
+        unindex(slot, from, position + length);
+        documents_[slot]->text.replace(position, length, text);
+        index(slot, from, position + text.size());
+    }
+
+    // Count the trigrams starting in [from, to) (mutex_ must be held)
+    void index(uint32_t slot, size_t from, size_t to) {
+        Document& document = *documents_[slot];
+        const std::string_view text(document.text);
+        for (size_t i = from; i < to && i + TRIGRAM <= text.size(); ++i) {
+            const uint32_t trigram = trigramAt(text, i);
+            if (document.trigrams[trigram]++ == 0) {
+                std::vector<uint32_t>& list = postings_[trigram];
+                list.insert(std::lower_bound(list.begin(), list.end(), slot), slot);
+            }
+        }
+    }
+
+    // Uncount the trigrams starting in [from, to) (mutex_ must be held)
+    void unindex(uint32_t slot, size_t from, size_t to) {
+        Document& document = *documents_[slot];
+        const std::string_view text(document.text);
+        for (size_t i = from; i < to && i + TRIGRAM <= text.size(); ++i) {
+            const uint32_t trigram = trigramAt(text, i);
+            auto count = document.trigrams.find(trigram);
+            if (--count->second > 0) {
+                continue;
+            }
+            document.trigrams.erase(count);
+            auto posting = postings_.find(trigram);
+            std::vector<uint32_t>& list = posting->second;
+            list.erase(std::lower_bound(list.begin(), list.end(), slot));
+            if (list.empty()) {
+                postings_.erase(posting);
+            }
+        }
+    }
+
+    mutable std::shared_mutex mutex_;   // Guards the members below
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<std::unique_ptr<Document>> documents_;     // By slot; null if free
+    std::vector<uint32_t> free_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings_; // Each trigram's document slots, sorted
+    Stats stats_;
+
+    mutable std::mutex statsMutex_;     // Guards queryStats_, which queries update under the shared lock
+    mutable QueryStats queryStats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SEARCH_INDEX_H
@@ -0,0 +1,377 @@
+#ifndef COLLABORATIVE_EDITOR_SECTIONED_DOCUMENT_H
+#define COLLABORATIVE_EDITOR_SECTIONED_DOCUMENT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common/document/document_controller.h"
+#include "common/ot/operation.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * A very large document sequenced as independent sections, so edits to different parts run in parallel
+ *
+ * One DocumentController sequences every edit of its document under one
+ * lock, so however many cores a node has, a document with hundreds of
+ * editors is edited on one of them at a time. Here the text is cut into
+ * sections, each a DocumentController of its own with its own revisions,
+ * operation log and undo history. An edit names the section it falls in
+ * and that section's revision it was made on, in the section's own
+ * positions, and is transformed and applied there only: edits to
+ * different sections take different locks and proceed in parallel.
+ *
+ * The sections keep the boundaries they were cut at; one may shrink to
+ * nothing and grow again. Two things cross them:
+ * - Global positions. layout() gives every section's offset, length and
+ *   revision as one consistent cut, which a client gets with the
+ *   document and keeps current from the sections' operations; split()
+ *   turns an edit made on global positions into section edits with it,
+ *   and locate() finds the section of a global position on the server.
+ * - Edits spanning a boundary, e.g. a delete of a selection across two
+ *   sections. submit() with several section edits applies them as one:
+ *   they are checked against their sections first and applied only if
+ *   every one of them applies, while no single-section edit runs.
+ * Both take the whole document for an instant; edits within a section,
+ * the common case, never wait for each other's sections.
+ *
+ * Edits go through submit(); a section's undo, history and callbacks are
+ * reached with section(). Thread-safe.
+ */
+class SectionedDocument {
+public:
+    // Size a section is cut at by default; the cut moves to the next line break when there is one
+    static constexpr size_t DEFAULT_SECTION_BYTES = size_t{1} << 20;
+    // Cuts move at most this far to find a line break
+    static constexpr size_t MAX_CUT_SEARCH = 4096;
+
+    // An edit of one section
+    struct SectionEdit {
+        size_t section = 0;
+        int64_t baseRevision = 0;   // The section's revision the edit was made on
+        ot::OperationPtr op;        // In the section's positions
+    };
+
+    // A section edit as applied, to acknowledge and broadcast
+    struct Sequenced {
+        size_t section = 0;
+        int64_t revision = 0;       // The section's revision it made
+        ot::OperationPtr op;        // As applied, in the section's positions at that revision
+    };
+
+    // Where a section is in the document
+    struct SectionInfo {
+        size_t offset = 0;          // Global position of its first character
+        size_t length = 0;
+        int64_t revision = 0;
+    };
+
+    // A global position within a section
+    struct Position {
+        size_t section = 0;
+        size_t offset = 0;          // In the section
+        int64_t revision = 0;       // The section's revision the offset holds at
+    };
+
+    struct Stats {
+        uint64_t submitted = 0;     // Edits within one section
+        uint64_t spanning = 0;      // Edits across sections
+        uint64_t rejected = 0;      // Edits that did not apply, or whose client must resync
+        uint64_t globalReads = 0;   // layout(), locate() and getDocument() calls, which hold every section
+    };
+
+    /**
+     * Cut a document into sections
+     *
+     * @param content The document's text
+     * @param sectionBytes Size to cut at; each cut moves to just after the next line break, if one is close
+     * @param logRetention Operations each section's log keeps
+     */
+    explicit SectionedDocument(const std::string& content, size_t sectionBytes = DEFAULT_SECTION_BYTES,
+                               size_t logRetention = 10000) {
+        const std::vector<size_t> at = cuts(content, std::max<size_t>(1, sectionBytes));
+        for (size_t i = 0; i < at.size(); ++i) {
+            const size_t end = i + 1 < at.size() ? at[i + 1] : content.size();
+            auto section = std::make_unique<Section>();
+            section->document = std::make_shared<DocumentController>(content.substr(at[i], end - at[i]), logRetention);
+            section->length = end - at[i];
+            sections_.push_back(std::move(section));
+        }
+    }
+
+    SectionedDocument(const SectionedDocument&) = delete;
+    SectionedDocument& operator=(const SectionedDocument&) = delete;
+
+    size_t sectionCount() const {
+        return sections_.size();
+    }
+
+    // A section's document, e.g. to register its callbacks or undo in it; edit it through submit()
+    const std::shared_ptr<DocumentController>& section(size_t index) const {
+        return sections_.at(index)->document;
+    }
+
+    /**
+     * Sequence an edit within one section
+     *
+     * @param edit The edit
+     * @param userId The client
+     * @return The edit as applied; std::nullopt if it did not apply or the client must resync
+     */
+    std::optional<Sequenced> submit(const SectionEdit& edit, const std::string& userId) {
+        std::shared_lock<std::shared_mutex> layout(layoutMutex_);
+        if (edit.section >= sections_.size() || !edit.op) {
+            return reject();
+        }
+        Section& section = *sections_[edit.section];
+        std::lock_guard<std::mutex> lock(section.mutex);
+        const DocumentController::Edit batch{edit.op, userId, edit.baseRevision};
+        ot::OperationPtr applied = section.document->applyBatch(std::span<const DocumentController::Edit>(&batch, 1)).front();
+        if (!applied) {
+            return reject();
+        }
+        section.length = lengthAfter(section, *applied);
+        {
+            std::lock_guard<std::mutex> stats(statsMutex_);
+            ++stats_.submitted;
+        }
+        return Sequenced{edit.section, section.document->getRevision(), std::move(applied)};
+    }
+
+    /**
+     * Sequence an edit made of several section edits, e.g. one that spans a boundary, as one
+     * Every part is an insert or a delete, in a section of its own; they are
+     * applied only if all of them apply
+     *
+     * @param edits The parts, at most one per section, e.g. from split()
+     * @param userId The client
+     * @return Each part as applied, in order; empty if any did not apply or the client must resync
+     */
+    std::vector<Sequenced> submit(std::span<const SectionEdit> edits, const std::string& userId) {
+        if (edits.size() == 1) {
+            std::optional<Sequenced> applied = submit(edits.front(), userId);
+            return applied ? std::vector<Sequenced>{std::move(*applied)} : std::vector<Sequenced>();
+        }
+        std::unique_lock<std::shared_mutex> layout(layoutMutex_);
+
+        // Nothing else is applied meanwhile, so each part transformed now is what gets applied
+        std::vector<ot::OperationPtr> transformed;
+        std::vector<bool> seen(sections_.size());
+        for (const SectionEdit& edit : edits) {
+            if (edit.section >= sections_.size() || seen[edit.section] || !edit.op) {
+                reject();
+                return {};
+            }
+            seen[edit.section] = true;
+            Section& section = *sections_[edit.section];
+            ot::OperationPtr op = section.document->transformOperation(edit.op, edit.baseRevision);
+            if (!op || !fits(*op, section.length)) {
+                reject();
+                return {};
+            }
+            transformed.push_back(std::move(op));
+        }
+
+        std::vector<Sequenced> sequenced;
+        for (size_t i = 0; i < edits.size(); ++i) {
+            Section& section = *sections_[edits[i].section];
+            const DocumentController::Edit batch{transformed[i], userId, section.document->getRevision()};
+            ot::OperationPtr applied = section.document->applyBatch(std::span<const DocumentController::Edit>(&batch, 1)).front();
+            if (!applied) {
+                // Checked above; a section whose text no longer matches its length must resync
+                continue;
+            }
+            section.length = lengthAfter(section, *applied);
+            sequenced.push_back({edits[i].section, section.document->getRevision(), std::move(applied)});
+        }
+        std::lock_guard<std::mutex> stats(statsMutex_);
+        ++stats_.spanning;
+        return sequenced;
+    }
+
+    /**
+     * Get where every section is, as one consistent cut
+     *
+     * @return Offset, length and revision of each section, in order
+     */
+    std::vector<SectionInfo> layout() const {
+        std::unique_lock<std::shared_mutex> layout(layoutMutex_);
+        countGlobalRead();
+        return layoutLocked();
+    }
+
+    /**
+     * Find the section of a global position
+     * A position on a boundary belongs to the section it ends, so an insert there goes at its end
+     *
+     * @param position Global position
+     * @return The section, the offset in it and the revision it holds at; std::nullopt past the end
+     */
+    std::optional<Position> locate(size_t position) const {
+        std::unique_lock<std::shared_mutex> layout(layoutMutex_);
+        countGlobalRead();
+        return locateIn(layoutLocked(), position);
+    }
+
+    // The whole text, as one consistent cut
+    std::string getDocument() const {
+        std::unique_lock<std::shared_mutex> layout(layoutMutex_);
+        countGlobalRead();
+        std::string text;
+        for (const auto& section : sections_) {
+            text += section->document->getDocument();
+        }
+        return text;
+    }
+
+    /**
+     * Turn an edit made on global positions into section edits
+     * Run by the client against the layout it has, so the parts carry the section revisions it saw
+     *
+     * @param op An insert or a delete, in global positions
+     * @param layout The sections as the client sees them
+     * @return One part per section the edit touches, in order; empty if the edit is of another kind or out of range
+     */
+    static std::vector<SectionEdit> split(const ot::Operation& op, std::span<const SectionInfo> layout) {
+        std::vector<SectionEdit> parts;
+        if (op.getKind() == ot::OperationKind::INSERT) {
+            const auto& insert = static_cast<const ot::InsertOperation&>(op);
+            if (std::optional<Position> at = locateIn(layout, insert.getPosition())) {
+                parts.push_back({at->section, at->revision,
+                                 std::make_shared<ot::InsertOperation>(at->offset, insert.getText())});
+            }
+            return parts;
+        }
+        if (op.getKind() != ot::OperationKind::DELETE) {
+            return parts;
+        }
+        const auto& remove = static_cast<const ot::DeleteOperation&>(op);
+        const size_t begin = remove.getPosition();
+        const size_t end = begin + remove.getLength();
+        const std::string& deleted = remove.getDeletedText();
+        for (size_t i = 0; i < layout.size() && begin < end; ++i) {
+            const size_t first = std::max(begin, layout[i].offset);
+            const size_t last = std::min(end, layout[i].offset + layout[i].length);
+            if (first >= last) {
+                continue;
+            }
+            ot::OperationPtr part = deleted.size() == remove.getLength()
+                ? std::make_shared<ot::DeleteOperation>(first - layout[i].offset, last - first,
+                                                        deleted.substr(first - begin, last - first))
+                : std::make_shared<ot::DeleteOperation>(first - layout[i].offset, last - first);
+            parts.push_back({i, layout[i].revision, std::move(part)});
+        }
+        const size_t total = layout.empty() ? 0 : layout.back().offset + layout.back().length;
+        if (end > total) {
+            parts.clear();
+        }
+        return parts;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        return stats_;
+    }
+
+private:
+    struct Section {
+        std::shared_ptr<DocumentController> document;
+        std::mutex mutex;       // Orders its edits with its length; under layoutMutex_ shared
+        size_t length = 0;      // Its text's length, kept with each edit
+    };
+
+    // Where each section starts: sectionBytes apart, moved just past the next line break if one is near
+    static std::vector<size_t> cuts(const std::string& content, size_t sectionBytes) {
+        std::vector<size_t> at{0};
+        size_t next = sectionBytes;
+        while (next < content.size()) {
+            const size_t lineBreak = content.find('\n', next - 1);
+            const size_t cut = lineBreak != std::string::npos && lineBreak + 1 - next < MAX_CUT_SEARCH ? lineBreak + 1 : next;
+            if (cut >= content.size()) {
+                break;
+            }
+            at.push_back(cut);
+            next = cut + sectionBytes;
+        }
+        return at;
+    }
+
+    static std::optional<Position> locateIn(std::span<const SectionInfo> layout, size_t position) {
+        for (size_t i = 0; i < layout.size(); ++i) {
+            if (position <= layout[i].offset + layout[i].length) {
+                return Position{i, position - layout[i].offset, layout[i].revision};
+            }
+        }
+        return std::nullopt;
+    }
+
+    // layoutMutex_ must be held exclusively
+    std::vector<SectionInfo> layoutLocked() const {
+        std::vector<SectionInfo> result;
+        result.reserve(sections_.size());
+        size_t offset = 0;
+        for (const auto& section : sections_) {
+            result.push_back({offset, section->length, section->document->getRevision()});
+            offset += section->length;
+        }
+        return result;
+    }
+
+    // Whether an insert or delete fits a text of the given length
+    static bool fits(const ot::Operation& op, size_t length) {
+        if (op.getKind() == ot::OperationKind::INSERT) {
+            return static_cast<const ot::InsertOperation&>(op).getPosition() <= length;
+        }
+        if (op.getKind() == ot::OperationKind::DELETE) {
+            const auto& remove = static_cast<const ot::DeleteOperation&>(op);
+            return remove.getPosition() + remove.getLength() <= length;
+        }
+        return false;
+    }
+
+    static size_t lengthAfterEdit(size_t length, const ot::Operation& op) {
+        if (op.getKind() == ot::OperationKind::INSERT) {
+            return length + static_cast<const ot::InsertOperation&>(op).getText().size();
+        }
+        return length - std::min(length, static_cast<const ot::DeleteOperation&>(op).getLength());
+    }
+
+    // A section's length after an operation it applied; other kinds than insert and delete are measured
+    static size_t lengthAfter(const Section& section, const ot::Operation& applied) {
+        if (applied.getKind() == ot::OperationKind::INSERT || applied.getKind() == ot::OperationKind::DELETE) {
+            return lengthAfterEdit(section.length, applied);
+        }
+        return section.document->getDocument().size();
+    }
+
+    std::nullopt_t reject() {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        ++stats_.rejected;
+        return std::nullopt;
+    }
+
+    void countGlobalRead() const {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        ++stats_.globalReads;
+    }
+
+    std::vector<std::unique_ptr<Section>> sections_;
+    // Shared by edits within a section, held alone by spanning edits and global reads
+    mutable std::shared_mutex layoutMutex_;
+    mutable std::mutex statsMutex_;
+    mutable Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SECTIONED_DOCUMENT_H
@@ -0,0 +1,415 @@
+#ifndef COLLABORATIVE_EDITOR_SELF_TEST_H
+#define COLLABORATIVE_EDITOR_SELF_TEST_H
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include "common/ot/bulk_transform.h"
+#include "common/ot/operation.h"
+#include "common/protocol/protocol.h"
+#include "common/util/metrics.h"
+#include "common/util/thread_profiler.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * The traffic a self-test puts on the node
+ */
+struct SelfTestOptions {
+    size_t documents = 4;                          // Documents edited at once, each on a thread of its own
+    size_t clientsPerDocument = 8;                 // Virtual clients editing each document
+    size_t documentSize = 16 * 1024;               // Characters each document starts with, and is kept around
+    double editsPerSecond = 0;                     // Per client; 0 sends as fast as the node takes them
+    double presenceRatio = 0.5;                    // Fraction of messages that are cursor updates
+    std::chrono::milliseconds duration{std::chrono::seconds(10)};
+    uint32_t seed = 1;
+
+    /**
+     * Read options from command line arguments of the form --name=value
+     *
+     * @param args The arguments; ones not naming an option are ignored,
+     *             e.g. --selftest itself
+     * @return The options, defaults where not given
+     * @throws std::invalid_argument for a value that does not parse or is out of range
+     */
+    static SelfTestOptions parse(const std::vector<std::string>& args) {
+        SelfTestOptions options;
+        for (const std::string& arg : args) {
+            const size_t equals = arg.find('=');
+            if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+                continue;
+            }
+            const std::string name = arg.substr(2, equals - 2);
+            const std::string_view value(arg.data() + equals + 1, arg.size() - equals - 1);
+            if (name == "documents") {
+                options.documents = number<size_t>(name, value);
+            } else if (name == "clients") {
+                options.clientsPerDocument = number<size_t>(name, value);
+            } else if (name == "document-size") {
+                options.documentSize = number<size_t>(name, value);
+            } else if (name == "edit-rate") {
+                options.editsPerSecond = number<double>(name, value);
+            } else if (name == "presence-ratio") {
+                options.presenceRatio = number<double>(name, value);
+            } else if (name == "seconds") {
+                options.duration = std::chrono::milliseconds(static_cast<int64_t>(number<double>(name, value) * 1000));
+            } else if (name == "seed") {
+                options.seed = number<uint32_t>(name, value);
+            }
+        }
+        if (options.documents == 0 || options.clientsPerDocument == 0) {
+            throw std::invalid_argument("documents and clients must be at least 1");
+        }
+        if (options.presenceRatio < 0 || options.presenceRatio > 1) {
+            throw std::invalid_argument("presence-ratio must be between 0 and 1");
+        }
+        if (options.editsPerSecond < 0 || options.duration.count() <= 0) {
+            throw std::invalid_argument("edit-rate must not be negative and seconds must be positive");
+        }
+        return options;
+    }
+
+private:
+    template <typename T>
+    static T number(const std::string& name, std::string_view value) {
+        T result{};
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            throw std::invalid_argument("Invalid value for --" + name + ": " + std::string(value));
+        }
+        return result;
+    }
+};
+
+/**
+ * What a self-test measured
+ */
+struct SelfTestReport {
+    SelfTestOptions options;
+    double seconds = 0;           // Wall time the traffic ran for
+    uint64_t edits = 0;           // Edits applied
+    uint64_t rejected = 0;        // Edits the node could not transform or apply
+    uint64_t presenceUpdates = 0; // Cursor updates relayed
+    uint64_t deliveries = 0;      // Messages decoded by receiving clients
+    util::Histogram::Snapshot editLatency;      // Nanoseconds from send to queued for every other client
+    util::Histogram::Snapshot presenceLatency;  // The same for cursor updates
+
+    double editsPerSecond() const {
+        return seconds > 0 ? static_cast<double>(edits) / seconds : 0.0;
+    }
+
+    double deliveriesPerSecond() const {
+        return seconds > 0 ? static_cast<double>(deliveries) / seconds : 0.0;
+    }
+
+    nlohmann::json toJson() const {
+        return {
+            {"documents", options.documents},
+            {"clientsPerDocument", options.clientsPerDocument},
+            {"seconds", seconds},
+            {"edits", edits},
+            {"rejected", rejected},
+            {"presenceUpdates", presenceUpdates},
+            {"deliveries", deliveries},
+            {"editsPerSecond", editsPerSecond()},
+            {"deliveriesPerSecond", deliveriesPerSecond()},
+            {"editLatency", latencyJson(editLatency)},
+            {"presenceLatency", latencyJson(presenceLatency)}};
+    }
+
+    // A summary for a terminal
+    std::string toString() const {
+        std::ostringstream out;
+        out << "Self-test: " << options.documents << " documents x " << options.clientsPerDocument
+            << " clients for " << seconds << " s\n"
+            << "  edits applied      " << edits << " (" << editsPerSecond() << "/s), " << rejected << " rejected\n"
+            << "  presence updates   " << presenceUpdates << "\n"
+            << "  deliveries         " << deliveries << " (" << deliveriesPerSecond() << "/s)\n"
+            << "  edit latency       " << latencyLine(editLatency) << "\n"
+            << "  presence latency   " << latencyLine(presenceLatency) << "\n";
+        return out.str();
+    }
+
+private:
+    static double micros(uint64_t nanos) {
+        return static_cast<double>(nanos) / 1000.0;
+    }
+
+    static nlohmann::json latencyJson(const util::Histogram::Snapshot& latency) {
+        return {{"count", latency.count},
+                {"p50Micros", micros(latency.valueAt(0.5))},
+                {"p90Micros", micros(latency.valueAt(0.9))},
+                {"p99Micros", micros(latency.valueAt(0.99))},
+                {"p999Micros", micros(latency.valueAt(0.999))},
+                {"maxMicros", micros(latency.max)}};
+    }
+
+    static std::string latencyLine(const util::Histogram::Snapshot& latency) {
+        std::ostringstream out;
+        out << "p50 " << micros(latency.valueAt(0.5)) << " us, p90 " << micros(latency.valueAt(0.9))
+            << " us, p99 " << micros(latency.valueAt(0.99)) << " us, p99.9 " << micros(latency.valueAt(0.999))
+            << " us, max " << micros(latency.max) << " us";
+        return out.str();
+    }
+};
+
+/**
+ * Synthetic load on the node's own edit path, to find what it can take
+ *
+ * Every document gets a thread, a DocumentController and an
+ * OperationManager, and a set of virtual clients that take turns. On its
+ * turn, a client first decodes what was broadcast to it, then sends one
+ * message: an edit, serialized as the server receives them, or a
+ * PRESENCE_CURSOR update. The node side does what the server does with
+ * it: decodes it, transforms the edit with processOperation(), applies it
+ * with applyOperation(), records it, serializes it once and queues it for
+ * every other client; the sender gets an EDIT_APPLY. Clients build on the
+ * revision they have caught up to, so with more clients edits are
+ * transformed across more concurrent ones, and they acknowledge it with
+ * SYNC_ACK now and then so history is compacted as it is in service.
+ *
+ * Latency is from the moment a message was due to be sent to the moment
+ * it is queued for the last recipient. With a set edit rate, messages are
+ * due on a fixed schedule, so a node that falls behind shows it in the
+ * latency rather than by quietly sending less.
+ */
+class SelfTest {
+public:
+    explicit SelfTest(SelfTestOptions options) : options_(std::move(options)) {}
+
+    SelfTest(const SelfTest&) = delete;
+    SelfTest& operator=(const SelfTest&) = delete;
+
+    /**
+     * Run the traffic for the configured duration
+     *
+     * @return What was measured
+     * @throws std::exception if a document thread failed
+     */
+    SelfTestReport run() {
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(options_.documents);
+        const auto start = Clock::now();
+        const auto deadline = start + options_.duration;
+        for (size_t i = 0; i < options_.documents; ++i) {
+            threads.emplace_back([this, i, deadline, &errors] {
+                util::nameCurrentThread("selftest", i);
+                try {
+                    runDocument(i, deadline);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        SelfTestReport report;
+        report.options = options_;
+        report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        report.edits = edits_.value();
+        report.rejected = rejected_.value();
+        report.presenceUpdates = presenceUpdates_.value();
+        report.deliveries = deliveries_.value();
+        report.editLatency = editLatency_.snapshot();
+        report.presenceLatency = presenceLatency_.snapshot();
+        return report;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // How often a client acknowledges the revision it has caught up to
+    static constexpr uint64_t ACK_EVERY = 32;
+
+    struct VirtualClient {
+        std::string id;
+        int64_t revision = 0;                          // Operations and acknowledgements decoded so far
+        std::deque<std::shared_ptr<const std::string>> inbox;
+        uint64_t sinceAck = 0;
+    };
+
+    // The node side of one document, and how long it was at each revision still built on
+    struct Node {
+        DocumentController document;
+        OperationManager operations;
+        std::deque<size_t> lengths;  // lengths[r - firstRevision]: length at revision r
+        int64_t firstRevision = 0;
+
+        explicit Node(const std::string& content) : document(content), lengths{content.size()} {}
+
+        size_t lengthAt(int64_t revision) const {
+            return lengths[static_cast<size_t>(revision - firstRevision)];
+        }
+    };
+
+    void runDocument(size_t index, Clock::time_point deadline) {
+        std::mt19937 random(options_.seed + static_cast<uint32_t>(index));
+        Node node(std::string(options_.documentSize, 'x'));
+        const std::string documentId = "selftest-" + std::to_string(index);
+
+        std::vector<VirtualClient> clients(options_.clientsPerDocument);
+        for (size_t i = 0; i < clients.size(); ++i) {
+            clients[i].id = documentId + "-client-" + std::to_string(i);
+            node.operations.acknowledgeRevision(clients[i].id, 0);
+        }
+
+        // With a rate, one client's message is due every interval, round-robin
+        const bool paced = options_.editsPerSecond > 0;
+        const auto interval = paced ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                                          1.0 / (options_.editsPerSecond * static_cast<double>(clients.size()))))
+                                    : Clock::duration::zero();
+        std::bernoulli_distribution presence(options_.presenceRatio);
+        auto due = Clock::now();
+        for (size_t turn = 0; due < deadline; ++turn) {
+            if (paced) {
+                std::this_thread::sleep_until(due);
+            }
+            VirtualClient& client = clients[turn % clients.size()];
+            receive(node, client);
+            if (!paced) {
+                due = Clock::now();
+            }
+            if (presence(random)) {
+                sendPresence(node, clients, client, documentId, random, due);
+            } else {
+                sendEdit(node, clients, client, random, due);
+            }
+            if (paced) {
+                due += interval;
+            }
+        }
+    }
+
+    // Decode what was broadcast to a client, and acknowledge it now and then as a client would
+    void receive(Node& node, VirtualClient& client) {
+        using protocol::MessageType;
+        while (!client.inbox.empty()) {
+            const auto message = std::move(client.inbox.front());
+            client.inbox.pop_front();
+            deliveries_.add();
+            const auto json = nlohmann::json::parse(*message);
+            if (!json.at("type").is_number_integer()) {
+                ot::OperationFactory::deserialize(*message);
+                ++client.revision;
+            } else if (static_cast<MessageType>(json.at("type").get<int>()) == MessageType::EDIT_APPLY) {
+                ++client.revision;
+            } else {
+                protocol::Message::fromJson<protocol::PresenceMessage>(json);
+                continue;
+            }
+            ++client.sinceAck;
+        }
+        if (client.sinceAck >= ACK_EVERY) {
+            client.sinceAck = 0;
+            protocol::SyncMessage ack(MessageType::SYNC_ACK);
+            ack.clientId = client.id;
+            ack.toVersion = static_cast<uint64_t>(client.revision);
+            const auto decoded = protocol::Message::fromJson<protocol::SyncMessage>(nlohmann::json::parse(ack.toString()));
+            const int64_t lowWatermark =
+                node.operations.acknowledgeRevision(decoded.clientId, static_cast<int64_t>(*decoded.toVersion));
+            node.document.compactBefore(lowWatermark);
+            while (node.firstRevision < lowWatermark && node.lengths.size() > 1) {
+                node.lengths.pop_front();
+                ++node.firstRevision;
+            }
+        }
+    }
+
+    // An edit from a client, through the node and out to everyone
+    void sendEdit(Node& node, std::vector<VirtualClient>& clients, VirtualClient& client, std::mt19937& random,
+                  Clock::time_point due) {
+        // Keep the document around its starting size: grow it when smaller, otherwise insert or delete evenly
+        const size_t length = node.lengthAt(client.revision);
+        const bool insert = length == 0 || length < options_.documentSize || std::bernoulli_distribution(0.5)(random);
+        const size_t position = std::uniform_int_distribution<size_t>(0, insert ? length : length - 1)(random);
+        ot::OperationPtr sent;
+        if (insert) {
+            sent = std::make_shared<ot::InsertOperation>(
+                position, std::string(std::uniform_int_distribution<size_t>(1, 8)(random), 'a' + position % 26));
+        } else {
+            sent = std::make_shared<ot::DeleteOperation>(
+                position, std::min(length - position, std::uniform_int_distribution<size_t>(1, 4)(random)));
+        }
+        const std::string wire = sent->serialize();
+
+        // The node: decode, transform, apply, record, then fan out
+        const auto op = ot::OperationFactory::deserialize(wire);
+        const auto transformed = node.operations.processOperation(op, client.id, client.revision);
+        if (!transformed || !node.document.applyOperation(transformed, client.id)) {
+            rejected_.add();
+            return;
+        }
+        node.operations.recordOperation(transformed);
+        node.lengths.push_back(static_cast<size_t>(static_cast<int64_t>(node.lengths.back()) +
+                                                   ot::lengthDelta(*transformed)));
+
+        auto message = std::make_shared<const std::string>(transformed->serialize());
+        for (auto& other : clients) {
+            if (&other != &client) {
+                other.inbox.push_back(message);
+            }
+        }
+        protocol::EditMessage applied(protocol::MessageType::EDIT_APPLY);
+        applied.documentVersion = static_cast<uint64_t>(node.document.getRevision());
+        applied.success = true;
+        client.inbox.push_back(std::make_shared<const std::string>(applied.toString()));
+        edits_.add();
+        editLatency_.record(static_cast<uint64_t>(std::chrono::nanoseconds(Clock::now() - due).count()));
+    }
+
+    // A cursor move from a client, relayed to everyone else
+    void sendPresence(Node& node, std::vector<VirtualClient>& clients, VirtualClient& client,
+                      const std::string& documentId, std::mt19937& random, Clock::time_point due) {
+        protocol::PresenceMessage cursor(protocol::MessageType::PRESENCE_CURSOR);
+        cursor.clientId = client.id;
+        cursor.documentId = documentId;
+        cursor.username = client.id;
+        cursor.cursorPosition = std::uniform_int_distribution<size_t>(0, node.lengthAt(client.revision))(random);
+        const std::string wire = cursor.toString();
+
+        const auto decoded = protocol::Message::fromJson<protocol::PresenceMessage>(nlohmann::json::parse(wire));
+        auto message = std::make_shared<const std::string>(decoded.toString());
+        for (auto& other : clients) {
+            if (&other != &client) {
+                other.inbox.push_back(message);
+            }
+        }
+        presenceUpdates_.add();
+        presenceLatency_.record(static_cast<uint64_t>(std::chrono::nanoseconds(Clock::now() - due).count()));
+    }
+
+    const SelfTestOptions options_;
+    util::Counter edits_;
+    util::Counter rejected_;
+    util::Counter presenceUpdates_;
+    util::Counter deliveries_;
+    util::Histogram editLatency_;
+    util::Histogram presenceLatency_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SELF_TEST_H
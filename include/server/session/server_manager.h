@@ -1,22 +1,61 @@
 #ifndef COLLABORATIVE_EDITOR_SERVER_MANAGER_H
 #define COLLABORATIVE_EDITOR_SERVER_MANAGER_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <mutex>
 #include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <variant>
+#include <vector>
 #include <boost/asio.hpp>
 
+#include "common/network/admission_control.h"
+#include "common/network/io_engine.h"
+#include "common/network/rate_limiter.h"
 #include "common/network/tcp_connection.h"
+#include "common/protocol/message_router.h"
 #include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "common/util/buffer_pool.h"
+#include "common/util/config_loader.h"
+#include "common/util/handle_table.h"
+#include "common/util/logger.h"
+#include "common/util/numa_topology.h"
+#include "common/util/profiled_mutex.h"
+#include "common/util/timer_wheel.h"
 #include "common/util/uuid_generator.h"
+#include "server/session/ack_coalescer.h"
+#include "server/session/broadcast_bus.h"
+#include "server/session/cluster_membership.h"
+#include "server/session/core_mesh.h"
+#include "server/session/document_executor.h"
+#include "server/session/drain_schedule.h"
+#include "server/session/presence_aggregator.h"
 
 namespace collab {
 namespace server {
 
 /**
  * Class that manages the server side of the collaborative editor
+ *
+ * The connected clients, all of them and those on each document, are
+ * published as immutable snapshots. Broadcasts read the snapshot without a
+ * lock and serialize each message once, so connects and disconnects, which
+ * copy the lists they change under clientsMutex_, never wait for one. Each
+ * client's own lock keeps what is sent to it in order.
+ *
+ * Raw TCP and WebSocket clients connect to the same port and go through
+ * the same pipeline, from admission and rate limits through the router
+ * and document threads to batched fan-out; only the framing differs, and
+ * each connection picks its own from its first bytes (see
+ * TcpConnection). A browser needs no proxy or second server.
  */
 class ServerManager {
 public:
@@ -33,11 +72,47 @@ public:
         }
         
         try {
-            // Create a new io_context
-            io_context_ = std::make_unique<boost::asio::io_context>();
+            // One io_context per thread; each client's connection stays on one of them
+            engine_ = std::make_unique<network::IoEngine>(ioThreads_, sharedNothing_);
+            if (numaPlacement_) {
+                engine_->place_on_nodes(util::NumaTopology::system());
+                util::BufferPool::setNodeHugePages(hugePages_);
+            }
+            if (lowLatency_.enabled) {
+                network::IoEngine::busy_poll busyPoll;
+                busyPoll.spin_polls = lowLatency_.spinPolls;
+                busyPoll.park = lowLatency_.park;
+                engine_->set_busy_poll(busyPoll);
+            }
+            if (sharedNothing_) {
+                mesh_ = std::make_unique<CoreMesh>(*engine_);
+            }
+            
+            presenceTimer_ = std::make_unique<boost::asio::steady_timer>(engine_->context(0));
+            
+            // Heartbeats and idle timeouts, if either is on
+            if (heartbeatInterval_.count() > 0 || idleTimeout_.count() > 0) {
+                std::lock_guard<std::mutex> lock(livenessMutex_);
+                liveness_ = std::make_unique<util::TimerWheel>(LIVENESS_TICK);
+                livenessTimer_ = std::make_unique<boost::asio::steady_timer>(engine_->context(0));
+                scheduleLivenessTick();
+            }
             
             // Create a TCP server
-            server_ = std::make_shared<network::TcpServer>(*io_context_, port);
+            server_ = std::make_shared<network::TcpServer>(*engine_, port, acceptMode_);
+            // A connection that never sends a frame is idle too
+            network::AdmissionControl::limits limits = admissionLimits_;
+            if (limits.handshake_timeout.count() <= 0 && idleTimeout_.count() > 0) {
+                limits.handshake_timeout = idleTimeout_;
+            }
+            server_->set_admission_limits(limits);
+            if (lowLatency_.enabled) {
+                network::TcpConnection::socket_tuning tuning;
+                tuning.no_delay = true;
+                tuning.quick_ack = true;
+                tuning.busy_poll_us = static_cast<int>(lowLatency_.socketBusyPoll);
+                server_->set_socket_tuning(tuning);
+            }
             
             // Set the connection handler
             server_->set_connection_handler([this](network::TcpConnection::pointer connection) {
@@ -52,10 +127,29 @@ public:
             // Start the server
             server_->start();
             
-            // Start the io_context in a separate thread
-            io_thread_ = std::thread([this]() {
-                io_context_->run();
-            });
+            // Broadcasts from the other nodes go to this node's clients
+            if (bus_) {
+                bus_->attach(busNode_, [this](const std::vector<BusFrame>& frames) {
+                    deliverFromBus(frames);
+                });
+            }
+            
+            // Run the contexts, each on its own thread
+            engine_->start();
+            
+            // Per-document work runs apart from the I/O threads, one shard per document, unless the cores own it
+            if (!mesh_) {
+                documents_ = std::make_unique<DocumentExecutor>(documentThreads_);
+                if (numaPlacement_) {
+                    documents_->setNumaPlacement(util::NumaTopology::system());
+                }
+                if (lowLatency_.enabled) {
+                    documents_->setCpus(lowLatency_.shardCpus.empty() ? network::IoEngine::isolated_cpus()
+                                                                      : lowLatency_.shardCpus);
+                }
+                documents_->setRebalanceInterval(rebalanceInterval_);
+                documents_->start();
+            }
             
             running_ = true;
             return true;
@@ -75,52 +169,521 @@ public:
         if (server_) {
             server_->stop();
         }
-        
-        // Stop the io_context
-        if (io_context_) {
-            io_context_->stop();
+        if (bus_) {
+            bus_->detach(busNode_);
         }
         
-        // Wait for the thread to finish
-        if (io_thread_.joinable()) {
-            io_thread_.join();
+        // Stop the contexts and wait for their threads to finish
+        if (engine_) {
+            engine_->stop();
         }
+        if (documents_) {
+            documents_->stop();
+        }
+        // Its rings hold tasks for the engine's contexts, and go with them
+        mesh_.reset();
         
         // Clear all clients
         {
-            std::lock_guard<std::mutex> lock(clientsMutex_);
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
             clients_.clear();
+            clientHandles_.clear();
+            pendingChannels_.clear();
+            audience_.store(std::make_shared<const Audience>());
+            flushPosted_ = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(presenceMutex_);
+            presence_ = PresenceAggregator(presence_.getInterval());
+            presenceTimer_.reset();
+            presenceFlushArmed_ = false;
         }
+        {
+            std::lock_guard<std::mutex> lock(livenessMutex_);
+            livenessTimer_.reset();
+            liveness_.reset();
+            heartbeatsDue_.clear();
+            idleChecksDue_.clear();
+        }
+        // The acceptors belong to the engine's contexts, and go before them
+        server_.reset();
         
         running_ = false;
     }
     
-    // Send a message to a specific client
-    bool sendMessage(const std::string& clientId, const protocol::Message& message) {
-        std::lock_guard<std::mutex> lock(clientsMutex_);
+    /**
+     * Take the node out of service without its clients all reconnecting at once, e.g. for a deploy
+     * 
+     * Stops accepting, closes the connections that never sent a frame,
+     * and sends everything waiting to be broadcast: batches, coalesced
+     * presence and frames for the bus. Then persist runs, e.g. to save
+     * the open documents, and the clients are told to go in the waves of
+     * a DrainSchedule. Each is sent a SYS_DISCONNECT, after whatever was
+     * broadcast to it before, with its resume token and where and when to
+     * reconnect, and its connection closes once that is written.
+     * 
+     * Blocks until the last wave is sent; stop() afterwards. Call from
+     * outside the I/O threads, which keep serving the clients not yet told.
+     * 
+     * @param options Where clients should reconnect, and the size and interval of the waves
+     * @param persist Runs once the broadcasts are flushed, before any client is told; may be empty
+     * @param resumeToken Gives the token a client resumes its session with, by client ID, so it skips a full resync; may be empty
+     * @return The number of clients told to go
+     */
+    size_t drain(const DrainSchedule::Options& options, const std::function<void()>& persist = {},
+                 const std::function<std::string(const std::string& clientId)>& resumeToken = {}) {
+        if (!running_ || !server_) {
+            return 0;
+        }
+        server_->stop_accepting();
         
-        auto it = clients_.find(clientId);
-        if (it != clients_.end()) {
-            it->second->send_message(message);
+        std::vector<network::TcpConnection::pointer> pending;
+        {
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+            for (const auto& [connection, channel] : pendingChannels_) {
+                pending.push_back(channel->get_connection());
+            }
+        }
+        // On the connection's own thread; closing runs the close handler, which takes clientsMutex_
+        for (const auto& connection : pending) {
+            boost::asio::post(connection->socket().get_executor(), [connection]() { connection->close(); });
+        }
+        
+        flushBroadcasts();
+        if (persist) {
+            persist();
+        }
+        
+        // In the order they became clients
+        const std::shared_ptr<const ClientList> clients = audience_.load()->all;
+        const DrainSchedule schedule(options, clients->size());
+        const auto started = std::chrono::steady_clock::now();
+        for (size_t wave = 0; wave < schedule.waveCount(); ++wave) {
+            std::this_thread::sleep_until(started + schedule.waveStart(wave));
+            const auto [first, last] = schedule.wave(wave);
+            for (size_t i = first; i < last; ++i) {
+                const std::shared_ptr<Client>& client = (*clients)[i];
+                sendTo(*client, schedule.notice(i, resumeToken ? resumeToken(client->clientId) : std::string()));
+                client->channel->get_connection()->close_when_written();
+            }
+        }
+        return clients->size();
+    }
+    
+    /**
+     * Send a message to a specific client
+     * 
+     * An AUTH_SUCCESS without a sessionHandle gets the client's handle.
+     * 
+     * @param clientId The client's ID
+     * @param message The message, as its full struct
+     * @return False if the client is not connected
+     */
+    bool sendMessage(const std::string& clientId, const protocol::Message& message) {
+        std::shared_ptr<Client> client = findClient(clientId);
+        if (!client) {
+            return false;
+        }
+        sendTo(*client, message);
+        return true;
+    }
+    
+    // Send a message to the client with a handle from getClientHandle(), without hashing its ID
+    bool sendMessage(util::Handle handle, const protocol::Message& message) {
+        std::shared_ptr<Client> client;
+        {
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+            if (auto* found = clients_.find(handle)) {
+                client = *found;
+            }
+        }
+        if (!client) {
+            return false;
+        }
+        sendTo(*client, message);
+        return true;
+    }
+    
+    // Get the handle of a connected client, NO_HANDLE if there is none
+    util::Handle getClientHandle(const std::string& clientId) const {
+        std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+        auto it = clientHandles_.find(clientId);
+        return it != clientHandles_.end() ? it->second : util::NO_HANDLE;
+    }
+    
+    /**
+     * Acknowledge a client's edit, cumulatively
+     * 
+     * Rather than an EDIT_APPLY per edit, the client is sent one per
+     * document and flush, carrying the highest sequenceNumber applied (see
+     * AckCoalescer). It goes in the batch of broadcasts the client is sent
+     * on the next turn of the event loop, or on its own if there are none,
+     * and before any message sent to the client after this call.
+     * 
+     * @param clientId The client's ID
+     * @param documentId The document edited
+     * @param sequenceNumber The edit's sequenceNumber, as the client sent it
+     * @param documentVersion The revision the edit brought the document to
+     * @param contentHash The document's hash as of that revision, if known
+     * @return False if the client is not connected
+     */
+    bool acknowledgeEdit(const std::string& clientId, const std::string& documentId, uint64_t sequenceNumber,
+                         uint64_t documentVersion, std::optional<uint64_t> contentHash = std::nullopt) {
+        std::shared_ptr<Client> client = findClient(clientId);
+        if (!client) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            if (!client->acks.acknowledge(documentId, sequenceNumber, documentVersion, contentHash)) {
+                return true;
+            }
+        }
+        if (engine_ && !flushPosted_.exchange(true)) {
+            boost::asio::post(engine_->context(0), [this]() {
+                flushAll();
+            });
+        }
+        return true;
+    }
+    
+    /**
+     * Add a client to a document's audience, so broadcasts about the document reach it
+     * 
+     * @param clientId The client's ID
+     * @param documentId The document
+     * @return False if the client is not connected
+     */
+    bool joinDocument(const std::string& clientId, const std::string& documentId) {
+        std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+        auto it = clientHandles_.find(clientId);
+        if (it == clientHandles_.end()) {
+            return false;
+        }
+        const std::shared_ptr<Client>& client = *clients_.find(it->second);
+        if (std::find(client->documents.begin(), client->documents.end(), documentId) != client->documents.end()) {
             return true;
         }
+        client->documents.push_back(documentId);
         
-        return false;
+        auto audience = std::make_shared<Audience>(*audience_.load());
+        auto members = std::make_shared<ClientList>();
+        if (auto found = audience->documents.find(documentId); found != audience->documents.end()) {
+            *members = *found->second;
+        } else if (bus_) {
+            // The node's first client of the document: hear what the other nodes broadcast for it
+            bus_->subscribe(busNode_, documentId);
+        }
+        members->push_back(client);
+        audience->documents[documentId] = std::move(members);
+        audience_.store(std::move(audience));
+        return true;
     }
     
-    // Broadcast a message to all clients
+    // Take a client out of a document's audience; false if it had not joined it
+    bool leaveDocument(const std::string& clientId, const std::string& documentId) {
+        std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+        auto it = clientHandles_.find(clientId);
+        if (it == clientHandles_.end()) {
+            return false;
+        }
+        Client& client = **clients_.find(it->second);
+        auto joined = std::find(client.documents.begin(), client.documents.end(), documentId);
+        if (joined == client.documents.end()) {
+            return false;
+        }
+        client.documents.erase(joined);
+        
+        auto audience = std::make_shared<Audience>(*audience_.load());
+        removeMember(*audience, documentId, &client);
+        audience_.store(std::move(audience));
+        return true;
+    }
+    
+    /**
+     * Broadcast a message to the clients it concerns
+     * 
+     * Messages with a documentId go to the clients that joined that
+     * document (see joinDocument()), others to every client.
+     * 
+     * Messages that can be batched are queued and sent on the next turn of
+     * the event loop, one frame per client for everything broadcast until
+     * then. Others flush the client's queue and are sent at once, so every
+     * client still receives messages in the order they were broadcast.
+     * 
+     * Cursor, selection and presence updates are coalesced per document
+     * (see PresenceAggregator) and go out as diffs at the presence rate,
+     * unless that is set to 0. Broadcast edits move the coalesced
+     * positions of their document, as the clients move theirs.
+     * 
+     * @param message The message, as its full struct
+     */
     void broadcastMessage(const protocol::Message& message) {
-        std::lock_guard<std::mutex> lock(clientsMutex_);
+        if (const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message)) {
+            movePresence(*edit);
+        } else if (const auto* presence = dynamic_cast<const protocol::PresenceMessage*>(&message)) {
+            std::lock_guard<std::mutex> lock(presenceMutex_);
+            if (presenceTimer_ && presence_.getInterval() > PresenceAggregator::Clock::duration::zero()) {
+                presence_.update(*presence);
+                if (PresenceAggregator::coalesces(presence->type)) {
+                    schedulePresenceFlush();
+                    return;
+                }
+            }
+        }
         
-        for (auto& client : clients_) {
-            client.second->send_message(message);
+        // Any presence that gets here is sent as it is, so another node may coalesce it
+        const auto* presence = dynamic_cast<const protocol::PresenceMessage*>(&message);
+        publish(message, presence && PresenceAggregator::coalesces(presence->type));
+        broadcastLocal(message, nullptr);
+    }
+    
+    /**
+     * Carry broadcasts to and from the other nodes of a cluster; call before start()
+     * 
+     * Every broadcast is published on the bus as well, encoded once as
+     * JSON, to the nodes with clients of its document; coalesced presence
+     * goes as the diffs this node flushes. What the other nodes publish
+     * reaches this node's clients as their own broadcasts do, without
+     * being published again, and JSON clients are sent the frame as it
+     * arrived.
+     * 
+     * @param bus The bus, shared by the nodes
+     * @param nodeId This node's ID on it
+     */
+    void setBus(std::shared_ptr<BroadcastBus> bus, std::string nodeId) {
+        bus_ = std::move(bus);
+        busNode_ = std::move(nodeId);
+    }
+    
+    /**
+     * Set how often each document's coalesced presence is flushed
+     * 
+     * @param perSecond Flushes per second and document, 20 by default; 0 sends every presence message as it comes
+     */
+    void setPresenceRate(double perSecond) {
+        std::lock_guard<std::mutex> lock(presenceMutex_);
+        presence_.setInterval(perSecond > 0
+            ? std::chrono::duration_cast<PresenceAggregator::Clock::duration>(
+                  std::chrono::duration<double>(1.0 / perSecond))
+            : PresenceAggregator::Clock::duration::zero());
+    }
+    
+    /**
+     * Set up heartbeats and idle timeouts; call before start()
+     * 
+     * Deadlines are kept on a timer wheel, so each client costs the same
+     * however many are connected, and are precise to a second.
+     * 
+     * @param heartbeatInterval How often each client is sent SYS_HEARTBEAT; zero for never
+     * @param idleTimeout How long a client may send nothing before it is disconnected; zero for ever
+     */
+    void setHeartbeat(std::chrono::seconds heartbeatInterval, std::chrono::seconds idleTimeout) {
+        heartbeatInterval_ = heartbeatInterval;
+        idleTimeout_ = idleTimeout;
+    }
+    
+    /**
+     * Limit how new connections are admitted; call before start()
+     * 
+     * A connection is pending from its accept until its first frame, and
+     * gets no client ID or client entry until then. The defaults admit
+     * every connection at once; without a handshake timeout, the idle
+     * timeout of setHeartbeat() applies to pending connections as well.
+     * 
+     * @param limits Accept rate and burst, most pending connections, and the time allowed for the first frame
+     */
+    void setAdmissionLimits(const network::AdmissionControl::limits& limits) {
+        admissionLimits_ = limits;
+    }
+    
+    // Admission counters of the running server; all zero while stopped
+    network::AdmissionControl::stats getAdmissionStats() const {
+        return server_ ? server_->admission_stats() : network::AdmissionControl::stats{};
+    }
+    
+    /**
+     * Limit how fast each client, and each document, may send edits; call before start()
+     * 
+     * A frame over its client's byte budget is dropped before it is
+     * decoded, and an EDIT_INSERT, EDIT_DELETE or EDIT_REPLACE over its
+     * client's or document's budget before any handler transforms it.
+     * Either way the client is answered with an EDIT_REJECT carrying
+     * retryAfterMillis (see protocol.h): once per run of dropped frames,
+     * and for each refused edit. Documents are told apart by documentId;
+     * an edit naming its document by handle only counts against its client.
+     * 
+     * @param limits Rate and burst of each bucket; all zero, the default, limits nothing
+     */
+    void setRateLimits(const network::RateLimiter::limits& limits) {
+        rateLimiter_.set_limits(limits);
+        rateLimited_ = rateLimiter_.enabled();
+        if (!rateLimited_) {
+            router_.intercept<protocol::EditMessageView>(Router::Interceptor<protocol::EditMessageView>());
+            return;
         }
+        router_.intercept<protocol::EditMessageView>([this](const std::string& clientId, const protocol::EditMessageView& edit) {
+            return rejectTooFast(clientId, edit);
+        });
+    }
+    
+    // Rate limiting counters, and how many clients and documents have buckets
+    network::RateLimiter::stats getRateLimitStats() const {
+        return rateLimiter_.get_stats();
     }
     
-    // Set a function to handle incoming messages
+    // Set a function to handle incoming messages that have no typed handler on router()
     using MessageHandler = std::function<void(const std::string& clientId, const protocol::Message& message)>;
     void setMessageHandler(MessageHandler handler) {
-        messageHandler_ = handler;
+        router_.otherwise(std::move(handler));
+    }
+    
+    // Route messages to handlers by type, e.g. router().on<protocol::EditMessageView>(...); set up before start()
+    using Router = protocol::MessageRouter<const std::string&>;
+    Router& router() {
+        return router_;
+    }
+    
+    // Set the wire format to accept from clients that offer it; JSON keeps traffic readable and uncompressed
+    void setWireFormat(protocol::WireFormat format) {
+        wireFormat_ = format;
+    }
+    
+    /**
+     * Set how many threads serve connections; call before start()
+     * 
+     * Each thread runs its own io_context and owns the connections it was
+     * given, so handlers on router() may run on several threads at once.
+     * 
+     * @param threads Number of I/O threads, 0 for one per hardware thread
+     * @param mode reuse_port for one SO_REUSEPORT acceptor per thread, round_robin for one acceptor
+     */
+    void setIoThreads(size_t threads,
+                      network::TcpServer::accept_mode mode = network::TcpServer::accept_mode::round_robin) {
+        ioThreads_ = threads;
+        acceptMode_ = mode;
+    }
+    
+    /**
+     * Set how many threads run per-document work; call before start()
+     * 
+     * @param threads Number of document shards, 0 for one per hardware thread
+     * @param rebalanceInterval How often documents are moved off busy shards; zero never to move them
+     */
+    void setDocumentThreads(size_t threads,
+                            std::chrono::milliseconds rebalanceInterval = std::chrono::seconds(1)) {
+        documentThreads_ = threads;
+        rebalanceInterval_ = rebalanceInterval;
+    }
+    
+    /**
+     * Run shared-nothing, one core per I/O thread; call before start()
+     * 
+     * Each core is an I/O thread pinned to its CPU that accepts its own
+     * connections on a SO_REUSEPORT socket and keeps them. Documents are
+     * homed on a core by their ID, and postDocumentTask() runs their work
+     * there, sent through the cores' SPSC rings (see CoreMesh) instead of
+     * to separate document threads, so a document's state stays on one
+     * core's thread and the cores share no locks on the way.
+     * 
+     * @param cores Number of cores, 0 for one per hardware thread
+     */
+    void setSharedNothing(size_t cores) {
+        sharedNothing_ = true;
+        ioThreads_ = cores;
+        acceptMode_ = network::TcpServer::accept_mode::reuse_port;
+    }
+    
+    /**
+     * Place threads and memory on the machine's NUMA nodes; call before start()
+     * 
+     * The I/O threads, and the document threads, are spread over the
+     * nodes and bound to them, and each thread prefers its node's memory,
+     * so the documents, logs and buffers a shard allocates stay local to
+     * it; BufferPool::local() gives each node its own buffers. A document
+     * is homed on a document thread of the node whose I/O thread first
+     * posts work for it, i.e. of the connection that opened it, since a
+     * connection is placed when it is accepted, before it names a
+     * document. In shared-nothing mode documents stay homed by ID.
+     * 
+     * @param hugePages Cut the node pools' buffers from transparent huge pages
+     */
+    void setNumaPlacement(bool hugePages = false) {
+        numaPlacement_ = true;
+        hugePages_ = hugePages;
+    }
+    
+    /**
+     * Trade CPU for latency, e.g. from ConfigLoader::getLowLatency(); call before start()
+     * 
+     * The I/O threads busy-poll their contexts instead of sleeping between
+     * events (see IoEngine::set_busy_poll()), each keeping its core even
+     * while idle, up to the backoff. Accepted sockets get TCP_NODELAY,
+     * TCP_QUICKACK and SO_BUSY_POLL. The document threads are pinned to
+     * the settings' shard CPUs, or to the cores the kernel was told to
+     * isolate (isolcpus) if there are none, so no other task delays them.
+     * collab_io_polls_total and collab_io_idle_seconds show what the
+     * spinning costs and how long work waited.
+     * 
+     * @param settings The settings; nothing changes unless enabled
+     */
+    void setLowLatency(const util::LowLatencySettings& settings) {
+        lowLatency_ = settings;
+    }
+    
+    /**
+     * Run work on a document, e.g. applying an edit from a router() handler
+     * 
+     * Tasks for one document run one at a time, in the order they were
+     * posted, so the document's OT state is only touched from one thread.
+     * In shared-nothing mode that is the document's home core; tasks
+     * posted from one core keep their order, and tasks from different
+     * cores interleave.
+     * 
+     * @param documentId The document the task works on
+     * @param task The task
+     * @return False if the server is not running and the task was dropped
+     */
+    bool postDocumentTask(const std::string& documentId, DocumentExecutor::Task task) {
+        if (!running_) {
+            return false;
+        }
+        if (mesh_) {
+            mesh_->post(mesh_->homeOf(documentId), std::move(task));
+            return true;
+        }
+        if (!documents_) {
+            return false;
+        }
+        documents_->post(documentId, std::move(task));
+        return true;
+    }
+    
+    /**
+     * Run as one node of a cluster; call before start()
+     * 
+     * Documents belong to the members by consistent hashing (see
+     * ClusterMembership). A DOC_OPEN for a document another node owns is
+     * answered here and goes to no handler: the DOC_RESPONSE fails and
+     * names the owner in its metadata, "redirect" its address and "owner"
+     * its ID, for the client to open the document there.
+     * 
+     * @param membership This node's view of the cluster; nullptr to own every document
+     */
+    void setCluster(std::shared_ptr<ClusterMembership> membership) {
+        cluster_ = std::move(membership);
+        if (!cluster_) {
+            router_.intercept<protocol::DocumentMessage>(Router::Interceptor<protocol::DocumentMessage>());
+            return;
+        }
+        router_.intercept<protocol::DocumentMessage>([this](const std::string& clientId, const protocol::DocumentMessage& message) {
+            return redirectElsewhere(clientId, message);
+        });
+    }
+    
+    // This node's view of the cluster, nullptr unless setCluster() was given one
+    const std::shared_ptr<ClusterMembership>& getCluster() const {
+        return cluster_;
     }
     
     // Check if the server is running
@@ -128,56 +691,664 @@ public:
         return running_;
     }
     
+    // The port the server listens on, e.g. the one picked for start(0); 0 while stopped
+    int getPort() const {
+        return server_ ? server_->port() : 0;
+    }
+    
     // Get the number of connected clients
     size_t getClientCount() const {
-        std::lock_guard<std::mutex> lock(clientsMutex_);
-        return clients_.size();
+        return audience_.load()->all->size();
     }
 
 private:
+    using Channel = network::MessageChannel<protocol::Message, protocol::WireCodec>;
+    
+    struct Client {
+        std::shared_ptr<Channel> channel;
+        std::string clientId;
+        util::Handle handle;
+        // When the client last sent a frame, in steady_clock ticks; written by the connection's thread
+        std::shared_ptr<std::atomic<util::TimerWheel::Clock::rep>> lastHeard;
+        // Documents the client joined; guarded by clientsMutex_
+        std::vector<std::string> documents;
+        // Keeps what is sent to the client in order
+        std::mutex mutex;
+        // Messages broadcast to the client since the last flush; guarded by mutex
+        std::optional<protocol::BatchMessage> pending;
+        // Edits of the client applied since the last flush; guarded by mutex
+        AckCoalescer acks;
+    };
+    
+    using ClientList = std::vector<std::shared_ptr<Client>>;
+    
+    // Who broadcasts go to; never changed once published, so it is read without a lock
+    struct Audience {
+        std::shared_ptr<const ClientList> all = std::make_shared<const ClientList>();
+        std::unordered_map<std::string, std::shared_ptr<const ClientList>> documents;
+    };
+    
+    // Granularity of heartbeat and idle deadlines
+    static constexpr std::chrono::seconds LIVENESS_TICK{1};
+    
+    // JSON text shared by the JSON clients that are sent the same messages; each queues a reference to it
+    struct SharedJson {
+        std::vector<std::shared_ptr<const protocol::Message>> messages;
+        network::TcpConnection::shared_payload text;
+    };
+    
+    // Send a message after what was broadcast to the client before, serializing it only once for the JSON clients
+    static void sendNow(Client& client, const protocol::Message& message, SharedJson& json, SharedJson& pendingJson) {
+        Channel& channel = *client.channel;
+        // Binary frames refer to each connection's string table, so they are encoded per client
+        const bool binary = channel.codec().binary();
+        if (!binary && !json.text) {
+            json.text = std::make_shared<const std::string>(message.toString());
+        }
+        std::lock_guard<std::mutex> lock(client.mutex);
+        flushPending(client, pendingJson);
+        if (binary) {
+            channel.send_message(message);
+        } else {
+            channel.send_serialized(json.text);
+        }
+    }
+    
+    // Send a message to one client after what was broadcast to it before
+    void sendTo(Client& client, const protocol::Message& message) {
+        std::optional<protocol::AuthMessage> success;
+        const auto* auth = dynamic_cast<const protocol::AuthMessage*>(&message);
+        if (auth && auth->type == protocol::MessageType::AUTH_SUCCESS && !auth->sessionHandle) {
+            success = *auth;
+            success->sessionHandle = client.handle;
+        }
+        std::lock_guard<std::mutex> lock(client.mutex);
+        SharedJson json;
+        flushPending(client, json);
+        client.channel->send_message(success ? *success : message);
+    }
+    
+    // Look up a connected client by ID
+    std::shared_ptr<Client> findClient(const std::string& clientId) const {
+        std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+        auto it = clientHandles_.find(clientId);
+        return it != clientHandles_.end() ? *clients_.find(it->second) : nullptr;
+    }
+    
+    // The document a message is about, nullptr if it names none
+    static const std::string* documentOf(const protocol::Message& message) {
+        if (const auto* document = dynamic_cast<const protocol::DocumentMessage*>(&message)) {
+            return &document->documentId;
+        } else if (const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message)) {
+            return &edit->documentId;
+        } else if (const auto* sync = dynamic_cast<const protocol::SyncMessage*>(&message)) {
+            return &sync->documentId;
+        } else if (const auto* presence = dynamic_cast<const protocol::PresenceMessage*>(&message)) {
+            return &presence->documentId;
+        }
+        return nullptr;
+    }
+    
+    // Send a broadcast to this node's clients; JSON clients get the payload, if given, as it is
+    void broadcastLocal(const protocol::Message& message, network::TcpConnection::shared_payload payload) {
+        const std::shared_ptr<const ClientList> targets = audienceOf(message);
+        if (!protocol::BatchMessage::canCarry(message.type)) {
+            SharedJson json;
+            json.text = std::move(payload);
+            SharedJson pendingJson;
+            for (const auto& client : *targets) {
+                sendNow(*client, message, json, pendingJson);
+            }
+            return;
+        }
+        queueBroadcast(message, *targets);
+    }
+    
+    // Publish a broadcast to the other nodes, flushed on the next turn of the event loop
+    void publish(const protocol::Message& message, bool coalesce = false) {
+        if (!bus_ || !engine_) {
+            return;
+        }
+        BusFrame frame;
+        if (const std::string* documentId = documentOf(message)) {
+            frame.topic = *documentId;
+        }
+        frame.origin = busNode_;
+        // A user's cursor replaces their last one still waiting
+        if (const auto* presence = dynamic_cast<const protocol::PresenceMessage*>(&message); presence && coalesce) {
+            frame.coalesceKey = std::to_string(static_cast<int>(presence->type)) + '/' + presence->documentId + '/' +
+                                (presence->clientId.empty() ? presence->username : presence->clientId);
+        }
+        frame.payload = std::make_shared<const std::string>(message.toString());
+        bus_->publish(frame);
+        if (!busFlushPosted_.exchange(true)) {
+            boost::asio::post(engine_->context(0), [this]() {
+                busFlushPosted_ = false;
+                bus_->flush();
+            });
+        }
+    }
+    
+    // Hand what other nodes published to this node's clients
+    void deliverFromBus(const std::vector<BusFrame>& frames) {
+        for (const auto& frame : frames) {
+            try {
+                auto decoded = protocol::Message::fromString(*frame.payload);
+                std::visit([&](const auto& message) {
+                    if (const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message)) {
+                        movePresence(*edit);
+                    }
+                    broadcastLocal(message, frame.payload);
+                }, decoded);
+            } catch (const std::exception& e) {
+                LOGF_RATE_LIMITED(util::LogLevel::WARNING, 5, frame.origin, "Dropped a broadcast from node {}: {}",
+                                  frame.origin, e.what());
+            }
+        }
+    }
+    
+    // The clients a broadcast goes to: the document's audience if it names one, or everyone
+    std::shared_ptr<const ClientList> audienceOf(const protocol::Message& message) const {
+        const std::string* documentId = documentOf(message);
+        
+        const std::shared_ptr<const Audience> audience = audience_.load();
+        if (!documentId || documentId->empty()) {
+            return audience->all;
+        }
+        auto it = audience->documents.find(*documentId);
+        if (it == audience->documents.end()) {
+            static const auto nobody = std::make_shared<const ClientList>();
+            return nobody;
+        }
+        return it->second;
+    }
+    
+    // Drop a client from a document's list in an audience being built; call with clientsMutex_ held
+    void removeMember(Audience& audience, const std::string& documentId, const Client* client) {
+        auto it = audience.documents.find(documentId);
+        if (it == audience.documents.end()) {
+            return;
+        }
+        auto members = std::make_shared<ClientList>();
+        members->reserve(it->second->size());
+        for (const auto& member : *it->second) {
+            if (member.get() != client) {
+                members->push_back(member);
+            }
+        }
+        if (members->empty()) {
+            audience.documents.erase(it);
+            if (bus_) {
+                bus_->unsubscribe(busNode_, documentId);
+            }
+        } else {
+            it->second = std::move(members);
+        }
+    }
+    
+    // Send what was broadcast to a client since the last flush; call with the client's mutex held
+    static void flushPending(Client& client, SharedJson& json) {
+        if (!client.acks.empty()) {
+            // The acknowledgements ride in the frame of the broadcasts, or make the only frame of the flush
+            if (!client.pending) {
+                client.pending.emplace(protocol::MessageType::BATCH);
+            }
+            for (const auto& ack : client.acks.take()) {
+                client.pending->add(ack);
+            }
+        }
+        if (!client.pending) {
+            return;
+        }
+        Channel& channel = *client.channel;
+        const protocol::BatchMessage& batch = *client.pending;
+        const protocol::Message& frame = batch.size() == 1 ? *batch.messages.front() : batch;
+        
+        if (channel.codec().binary()) {
+            channel.send_message(frame);
+        } else {
+            // Clients that joined or left mid-tick get different batches
+            if (!json.text || json.messages != batch.messages) {
+                json.messages = batch.messages;
+                json.text = std::make_shared<const std::string>(frame.toString());
+            }
+            channel.send_serialized(json.text);
+        }
+        client.pending.reset();
+    }
+    
+    // Add a message to each target's pending batch, flushed on the next turn of the event loop
+    void queueBroadcast(const protocol::Message& message, const ClientList& targets) {
+        if (targets.empty()) {
+            return;
+        }
+        // One copy of the message, shared by every client's batch
+        auto shared = protocol::BatchMessage::share(message);
+        
+        for (const auto& client : targets) {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            if (!client->pending) {
+                client->pending.emplace(protocol::MessageType::BATCH);
+            }
+            client->pending->add(shared);
+        }
+        if (!flushPosted_.exchange(true)) {
+            boost::asio::post(engine_->context(0), [this]() {
+                flushAll();
+            });
+        }
+    }
+    
+    // Move the coalesced cursors of an edit's document through it
+    void movePresence(const protocol::EditMessage& edit) {
+        if (!edit.position) {
+            return;
+        }
+        const bool removes = edit.type == protocol::MessageType::EDIT_DELETE || edit.type == protocol::MessageType::EDIT_REPLACE;
+        const bool adds = edit.type == protocol::MessageType::EDIT_INSERT || edit.type == protocol::MessageType::EDIT_REPLACE;
+        if (!removes && !adds) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(presenceMutex_);
+        presence_.transform(edit.documentId, *edit.position, removes ? edit.length.value_or(0) : 0,
+                            adds && edit.text ? edit.text->size() : 0);
+    }
+    
+    // Arm the presence timer for the next document that falls due; call with presenceMutex_ held
+    void schedulePresenceFlush() {
+        if (presenceFlushArmed_) {
+            return;
+        }
+        const auto next = presence_.nextFlush();
+        if (!next) {
+            return;
+        }
+        presenceFlushArmed_ = true;
+        presenceTimer_->expires_at(std::max(*next, PresenceAggregator::Clock::now()));
+        presenceTimer_->async_wait([this](const boost::system::error_code& error) {
+            if (error) {
+                return;
+            }
+            std::vector<protocol::PresenceMessage> diffs;
+            {
+                std::lock_guard<std::mutex> lock(presenceMutex_);
+                presenceFlushArmed_ = false;
+                diffs = presence_.flush(PresenceAggregator::Clock::now());
+                schedulePresenceFlush();
+            }
+            // Batched like any broadcast, so a tick's diffs reach each client in one frame
+            for (const auto& diff : diffs) {
+                publish(diff);
+                queueBroadcast(diff, *audienceOf(diff));
+            }
+        });
+    }
+    
+    // Arm a client's first heartbeat and idle check
+    void watchLiveness(util::Handle handle) {
+        std::lock_guard<std::mutex> lock(livenessMutex_);
+        if (!liveness_) {
+            return;
+        }
+        const auto now = util::TimerWheel::Clock::now();
+        if (heartbeatInterval_.count() > 0) {
+            scheduleHeartbeat(handle, now + heartbeatInterval_);
+        }
+        if (idleTimeout_.count() > 0) {
+            scheduleIdleCheck(handle, now + idleTimeout_);
+        }
+    }
+    
+    // Timers only note which clients fell due; call with livenessMutex_ held
+    void scheduleHeartbeat(util::Handle handle, util::TimerWheel::Clock::time_point deadline) {
+        liveness_->schedule(deadline, [this, handle]() { heartbeatsDue_.push_back(handle); });
+    }
+    
+    void scheduleIdleCheck(util::Handle handle, util::TimerWheel::Clock::time_point deadline) {
+        liveness_->schedule(deadline, [this, handle]() { idleChecksDue_.push_back(handle); });
+    }
+    
+    // Advance the wheel once per tick; call with livenessMutex_ held
+    void scheduleLivenessTick() {
+        livenessTimer_->expires_after(LIVENESS_TICK);
+        livenessTimer_->async_wait([this](const boost::system::error_code& error) {
+            if (error) {
+                return;
+            }
+            std::vector<util::Handle> heartbeats;
+            std::vector<util::Handle> idleChecks;
+            {
+                std::lock_guard<std::mutex> lock(livenessMutex_);
+                if (!liveness_) {
+                    return;
+                }
+                liveness_->advance(util::TimerWheel::Clock::now());
+                heartbeats.swap(heartbeatsDue_);
+                idleChecks.swap(idleChecksDue_);
+                scheduleLivenessTick();
+            }
+            checkLiveness(heartbeats, idleChecks);
+        });
+    }
+    
+    /**
+     * Send the heartbeats that fell due and disconnect clients that went quiet
+     * 
+     * Clients that disconnected since are skipped. A client heard from
+     * since its idle check was armed gets a new check at its new deadline.
+     */
+    void checkLiveness(const std::vector<util::Handle>& heartbeats, const std::vector<util::Handle>& idleChecks) {
+        using Clock = util::TimerWheel::Clock;
+        const auto now = Clock::now();
+        std::vector<std::shared_ptr<Client>> beaten;
+        std::vector<std::pair<util::Handle, Clock::time_point>> rearmed;
+        std::vector<network::TcpConnection::pointer> idle;
+        {
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+            for (util::Handle handle : heartbeats) {
+                if (auto* client = clients_.find(handle)) {
+                    beaten.push_back(*client);
+                }
+            }
+            for (util::Handle handle : idleChecks) {
+                if (auto* client = clients_.find(handle)) {
+                    const Clock::time_point lastHeard(Clock::duration((*client)->lastHeard->load(std::memory_order_relaxed)));
+                    if (now - lastHeard >= idleTimeout_) {
+                        idle.push_back((*client)->channel->get_connection());
+                    } else {
+                        rearmed.emplace_back(handle, lastHeard + idleTimeout_);
+                    }
+                }
+            }
+        }
+        const protocol::Message heartbeat(protocol::MessageType::SYS_HEARTBEAT);
+        for (const auto& client : beaten) {
+            sendTo(*client, heartbeat);
+        }
+        {
+            std::lock_guard<std::mutex> lock(livenessMutex_);
+            if (liveness_) {
+                // From the tick they fell due on, so rounding up to a tick does not add up
+                for (const auto& client : beaten) {
+                    scheduleHeartbeat(client->handle, liveness_->now() + heartbeatInterval_);
+                }
+                for (const auto& [handle, deadline] : rearmed) {
+                    scheduleIdleCheck(handle, deadline);
+                }
+            }
+        }
+        // On the connection's own thread; closing runs the close handler, which takes clientsMutex_
+        for (const auto& connection : idle) {
+            boost::asio::post(connection->socket().get_executor(), [connection]() {
+                LOGF_DEBUG("Disconnecting idle client");
+                connection->close();
+            });
+        }
+    }
+    
+    // Send everything waiting to be broadcast: coalesced presence, batches and frames for the bus
+    void flushBroadcasts() {
+        std::vector<protocol::PresenceMessage> diffs;
+        {
+            std::lock_guard<std::mutex> lock(presenceMutex_);
+            // An interval from now, every document is due
+            diffs = presence_.flush(PresenceAggregator::Clock::now() + presence_.getInterval());
+        }
+        for (const auto& diff : diffs) {
+            publish(diff);
+            queueBroadcast(diff, *audienceOf(diff));
+        }
+        flushAll();
+        if (bus_) {
+            bus_->flush();
+        }
+    }
+    
+    // Send every client's pending batch
+    void flushAll() {
+        flushPosted_ = false;
+        const std::shared_ptr<const Audience> audience = audience_.load();
+        SharedJson json;
+        for (const auto& client : *audience->all) {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            flushPending(*client, json);
+        }
+    }
+    
     // Private constructor for singleton
     ServerManager()
-        : running_(false) {}
+        : running_(false), audience_(std::make_shared<const Audience>()) {}
     
-    // Handle a new client connection
+    // What a connection is known by once its first frame made it a client
+    struct ClientSlot {
+        std::string clientId;
+        util::Handle handle = util::NO_HANDLE;
+        std::shared_ptr<std::atomic<util::TimerWheel::Clock::rep>> lastHeard;
+    };
+    
+    // Handle a new client connection; it becomes a client on its first frame
     void handleNewConnection(network::TcpConnection::pointer connection) {
-        // Generate a client ID
-        std::string clientId = util::UuidGenerator::getInstance().generateUuid();
-        
         // Create a message channel
-        auto channel = std::make_shared<network::MessageChannel<protocol::Message>>(connection);
+        auto channel = std::make_shared<Channel>(connection);
+        channel->codec().setPreferredFormat(wireFormat_);
+        if (wireFormat_ == protocol::WireFormat::JSON) {
+            // JSON mode keeps every frame readable
+            channel->codec().setCompression(false);
+        } else {
+            // Length-prefixed frames need no delimiter scan
+            connection->set_frame_mode(network::TcpConnection::frame_mode::length_prefixed);
+        }
+        
+        // Both handlers run on the connection's thread
+        auto slot = std::make_shared<ClientSlot>();
         
         // Set the message handler
-        channel->set_message_handler([this, clientId](auto, const protocol::Message& message) {
-            // Call the message handler
-            if (messageHandler_) {
-                messageHandler_(clientId, message);
+        channel->set_frame_handler([this, slot](auto channel, protocol::WireCodec& codec, std::string_view frame) {
+            if (slot->handle == util::NO_HANDLE) {
+                addClient(channel, *slot);
+            }
+            if (idleTimeout_.count() > 0) {
+                slot->lastHeard->store(util::TimerWheel::Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            }
+            if (rateLimited_) {
+                const network::RateLimiter::verdict verdict = rateLimiter_.admit_frame(slot->clientId, frame.size());
+                if (!verdict.admitted) {
+                    if (verdict.notify) {
+                        sendRetryAfter(slot->clientId, protocol::EditMessage(protocol::MessageType::EDIT_REJECT), verdict);
+                    }
+                    return;
+                }
             }
+            // Decode straight into the handler for the message's type
+            router_.route(codec, frame, slot->clientId);
         });
         
-        // Add the client to the list
+        // Until then only the channel is kept
         {
-            std::lock_guard<std::mutex> lock(clientsMutex_);
-            clients_[clientId] = channel;
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+            pendingChannels_[connection.get()] = channel;
         }
         
         // Set up a handler to remove the client when the connection is closed
-        connection->set_close_handler([this, clientId](auto) {
-            std::lock_guard<std::mutex> lock(clientsMutex_);
-            clients_.erase(clientId);
+        connection->set_close_handler([this, slot](network::TcpConnection::pointer connection) {
+            {
+                std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+                if (slot->handle != util::NO_HANDLE) {
+                    removeClient(slot->handle);
+                    clientHandles_.erase(slot->clientId);
+                } else {
+                    pendingChannels_.erase(connection.get());
+                }
+            }
+            if (server_) {
+                server_->handshake_done(connection);
+            }
+            if (slot->handle != util::NO_HANDLE) {
+                std::lock_guard<std::mutex> lock(presenceMutex_);
+                presence_.removeClient(slot->clientId);
+            }
+            if (rateLimited_ && slot->handle != util::NO_HANDLE) {
+                rateLimiter_.forget_session(slot->clientId);
+            }
         });
     }
+    
+    // Turn a pending connection into a client, on its first frame
+    void addClient(const std::shared_ptr<Channel>& channel, ClientSlot& slot) {
+        slot.clientId = util::UuidGenerator::getInstance().generateUuid();
+        // When the client was last heard from, for the idle timeout
+        slot.lastHeard = std::make_shared<std::atomic<util::TimerWheel::Clock::rep>>(
+            util::TimerWheel::Clock::now().time_since_epoch().count());
+        auto client = std::make_shared<Client>();
+        client->channel = channel;
+        client->clientId = slot.clientId;
+        client->lastHeard = slot.lastHeard;
+        {
+            std::lock_guard<util::ProfiledMutex> lock(clientsMutex_);
+            pendingChannels_.erase(channel->get_connection().get());
+            slot.handle = clients_.insert(client);
+            client->handle = slot.handle;
+            clientHandles_[slot.clientId] = slot.handle;
+            
+            auto audience = std::make_shared<Audience>(*audience_.load());
+            auto all = std::make_shared<ClientList>(*audience->all);
+            all->push_back(client);
+            audience->all = std::move(all);
+            audience_.store(std::move(audience));
+        }
+        watchLiveness(slot.handle);
+        server_->handshake_done(channel->get_connection());
+    }
+    
+    // Send a client to the owner of the document it opens, if that is another node; false if it is this one
+    bool redirectElsewhere(const std::string& clientId, const protocol::DocumentMessage& open) {
+        if (open.type != protocol::MessageType::DOC_OPEN) {
+            return false;
+        }
+        const std::optional<ClusterNode> owner = cluster_->ownerOf(open.documentId);
+        if (!owner || owner->id == cluster_->self().id) {
+            return false;
+        }
+        protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+        response.documentId = open.documentId;
+        response.sequenceNumber = open.sequenceNumber;
+        response.success = false;
+        response.errorMessage = "Document is owned by another node";
+        response.metadata["redirect"] = owner->address;
+        response.metadata["owner"] = owner->id;
+        sendMessage(clientId, response);
+        return true;
+    }
+    
+    // Refuse an edit its client or document cannot pay for yet; false to let it through
+    bool rejectTooFast(const std::string& clientId, const protocol::EditMessageView& edit) {
+        if (edit.type != protocol::MessageType::EDIT_INSERT &&
+            edit.type != protocol::MessageType::EDIT_DELETE &&
+            edit.type != protocol::MessageType::EDIT_REPLACE) {
+            return false;
+        }
+        const network::RateLimiter::verdict verdict = rateLimiter_.admit_edit(
+            clientId, std::string(edit.documentId), edit.text ? edit.text->size() : 0);
+        if (verdict.admitted) {
+            return false;
+        }
+        protocol::EditMessage reject(protocol::MessageType::EDIT_REJECT);
+        reject.documentId = edit.documentId;
+        reject.documentVersion = edit.documentVersion;
+        reject.operationId = edit.operationId;
+        reject.sequenceNumber = edit.sequenceNumber;
+        reject.documentHandle = edit.documentHandle;
+        sendRetryAfter(clientId, std::move(reject), verdict);
+        return true;
+    }
+    
+    // Send a client an EDIT_REJECT telling it how long to hold back
+    void sendRetryAfter(const std::string& clientId, protocol::EditMessage reject, const network::RateLimiter::verdict& verdict) {
+        reject.success = false;
+        reject.errorMessage = "Rate limited";
+        // Rounded up, so a client waiting this long is admitted
+        reject.retryAfterMillis = static_cast<uint64_t>(
+            std::chrono::ceil<std::chrono::milliseconds>(verdict.retry_after).count());
+        sendMessage(clientId, reject);
+    }
+    
+    // Forget a client and publish the audience without it; call with clientsMutex_ held
+    void removeClient(util::Handle handle) {
+        auto* found = clients_.find(handle);
+        if (!found) {
+            return;
+        }
+        const std::shared_ptr<Client> client = *found;
+        clients_.erase(handle);
+        
+        auto audience = std::make_shared<Audience>(*audience_.load());
+        auto all = std::make_shared<ClientList>();
+        all->reserve(audience->all->size());
+        for (const auto& other : *audience->all) {
+            if (other != client) {
+                all->push_back(other);
+            }
+        }
+        audience->all = std::move(all);
+        for (const auto& documentId : client->documents) {
+            removeMember(*audience, documentId, client.get());
+        }
+        audience_.store(std::move(audience));
+    }
 
 private:
-    std::unique_ptr<boost::asio::io_context> io_context_;
+    std::unique_ptr<network::IoEngine> engine_;
     std::shared_ptr<network::TcpServer> server_;
-    std::thread io_thread_;
+    size_t ioThreads_ = 0;
+    network::TcpServer::accept_mode acceptMode_ = network::TcpServer::accept_mode::round_robin;
     std::atomic<bool> running_;
     
-    std::unordered_map<std::string, std::shared_ptr<network::MessageChannel<protocol::Message>>> clients_;
-    mutable std::mutex clientsMutex_;
+    // Threads for per-document work, apart from the I/O threads
+    std::unique_ptr<DocumentExecutor> documents_;
+    // In shared-nothing mode, the rings between the I/O threads that own the documents instead
+    std::unique_ptr<CoreMesh> mesh_;
+    bool sharedNothing_ = false;
+    bool numaPlacement_ = false;
+    bool hugePages_ = false;
+    util::LowLatencySettings lowLatency_;
+    size_t documentThreads_ = 0;
+    std::chrono::milliseconds rebalanceInterval_ = std::chrono::seconds(1);
+    
+    // Connected clients by handle, and the handles by client ID; guarded by clientsMutex_
+    util::HandleTable<std::shared_ptr<Client>> clients_;
+    std::unordered_map<std::string, util::Handle> clientHandles_;
+    // Connections that have not sent their first frame yet; guarded by clientsMutex_
+    std::unordered_map<const network::TcpConnection*, std::shared_ptr<Channel>> pendingChannels_;
+    network::AdmissionControl::limits admissionLimits_;
+    // Budgets of edits by client and document; rateLimited_ is set before start() if any bucket limits
+    network::RateLimiter rateLimiter_;
+    bool rateLimited_ = false;
+    mutable util::ProfiledMutex clientsMutex_{"server_manager_clients"};
+    // Published by clientsMutex_ holders, read by broadcasts without it
+    std::atomic<std::shared_ptr<const Audience>> audience_;
+    std::atomic<bool> flushPosted_{false};
+    
+    // Presence waiting to be flushed, and the timer that flushes it; guarded by presenceMutex_
+    PresenceAggregator presence_;
+    std::unique_ptr<boost::asio::steady_timer> presenceTimer_;
+    bool presenceFlushArmed_ = false;
+    std::mutex presenceMutex_;
+    
+    // Heartbeat and idle deadlines, the timer that advances them, and the clients due; guarded by livenessMutex_
+    std::unique_ptr<util::TimerWheel> liveness_;
+    std::unique_ptr<boost::asio::steady_timer> livenessTimer_;
+    std::vector<util::Handle> heartbeatsDue_;
+    std::vector<util::Handle> idleChecksDue_;
+    std::mutex livenessMutex_;
+    std::chrono::seconds heartbeatInterval_{0};
+    std::chrono::seconds idleTimeout_{0};
     
-    MessageHandler messageHandler_;
+    Router router_;
+    std::shared_ptr<ClusterMembership> cluster_;
+    std::shared_ptr<BroadcastBus> bus_;
+    std::string busNode_;
+    std::atomic<bool> busFlushPosted_{false};
+    std::atomic<protocol::WireFormat> wireFormat_{protocol::WireFormat::BINARY};
 };
 
 } // namespace server
@@ -0,0 +1,244 @@
+#ifndef COLLABORATIVE_EDITOR_SESSION_RESUMPTION_H
+#define COLLABORATIVE_EDITOR_SESSION_RESUMPTION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/protocol/protocol.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Keeps the state of sessions whose connection dropped, for a client to take back on a new one
+ *
+ * A client gets a resume token when it logs in. If its connection drops,
+ * e.g. as a phone changes networks, the server suspends the session
+ * under that token instead of ending it: who the user was, the documents
+ * it had open and the last revision it acknowledged on each. A client
+ * that comes back within the grace period presents the token on its new
+ * connection (RESUME, or AUTH_RESUME) and carries on from those
+ * revisions: it is sent the operations it missed instead of logging in,
+ * opening each document and loading all of it again.
+ *
+ * A token resumes a session once; the resumed session gets a new one.
+ * Sessions not resumed in time are dropped by expire(), which hands them
+ * back so the caller can release what they held, such as the revision
+ * each pinned in an operation log.
+ *
+ * Tokens are 128 bits from std::random_device. Thread-safe; the lock is
+ * taken last, after any of the session handler's.
+ */
+class SessionResumption {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::seconds DEFAULT_GRACE{60};
+
+    // AUTH_RESUME metadata key prefix of the revision a client applied up to on a document
+    static constexpr const char* REVISION_KEY_PREFIX = "revision:";
+
+    // What a suspended session keeps
+    struct Retained {
+        std::string username;
+        std::map<std::string, int64_t> acknowledged;   // Each open document, and the last revision acknowledged on it
+    };
+
+    struct Stats {
+        uint64_t issued = 0;
+        uint64_t suspended = 0;
+        uint64_t resumed = 0;
+        uint64_t expired = 0;
+        uint64_t rejected = 0;      // Resumes with a token unknown, expired or not suspended
+        size_t retained = 0;        // Sessions suspended now
+    };
+
+    // @param grace How long a suspended session is kept; zero to end sessions as they drop
+    explicit SessionResumption(std::chrono::seconds grace = DEFAULT_GRACE) : grace_(grace) {}
+
+    SessionResumption(const SessionResumption&) = delete;
+    SessionResumption& operator=(const SessionResumption&) = delete;
+
+    // Change the grace period; sessions suspended already keep theirs
+    void setGrace(std::chrono::seconds grace) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        grace_ = grace;
+    }
+
+    std::chrono::seconds getGrace() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return grace_;
+    }
+
+    // Issue a token for a session that logged in
+    std::string issue() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string token;
+        do {
+            token = randomToken();
+        } while (tokens_.count(token) > 0);
+        tokens_.emplace(token, Entry());
+        stats_.issued++;
+        return token;
+    }
+
+    /**
+     * Keep a session whose connection dropped
+     *
+     * @param token The session's token
+     * @param state What it had
+     * @return False if the token was not issued, or is suspended already, or there is no grace period
+     */
+    bool suspend(const std::string& token, Retained state) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tokens_.find(token);
+        if (it == tokens_.end() || it->second.state) {
+            return false;
+        }
+        if (grace_.count() <= 0) {
+            tokens_.erase(it);
+            return false;
+        }
+        it->second.state = std::move(state);
+        it->second.expiresAt = Clock::now() + grace_;
+        expiry_.emplace_back(it->second.expiresAt, token);
+        stats_.suspended++;
+        stats_.retained++;
+        return true;
+    }
+
+    /**
+     * Take back a suspended session
+     *
+     * @param token The token the client presented
+     * @return What the session had, or std::nullopt if the token is unknown, expired or not suspended
+     */
+    std::optional<Retained> resume(const std::string& token) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tokens_.find(token);
+        if (it == tokens_.end() || !it->second.state || it->second.expiresAt <= Clock::now()) {
+            stats_.rejected++;
+            return std::nullopt;
+        }
+        Retained state = std::move(*it->second.state);
+        tokens_.erase(it);
+        stats_.resumed++;
+        stats_.retained--;
+        return state;
+    }
+
+    // Forget a token whose session ended for good, e.g. on logout
+    void revoke(const std::string& token) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tokens_.find(token);
+        if (it != tokens_.end()) {
+            if (it->second.state) {
+                stats_.retained--;
+            }
+            tokens_.erase(it);
+        }
+    }
+
+    /**
+     * Drop the suspended sessions whose grace period is over
+     *
+     * @param now The time to check against
+     * @return What each of them had, to release
+     */
+    std::vector<Retained> expire(Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Retained> expired;
+        // Suspended in order and kept as long as each other, so they expire in order too,
+        // unless the grace period changed; a later one then waits for the one before
+        while (!expiry_.empty() && expiry_.front().first <= now) {
+            auto it = tokens_.find(expiry_.front().second);
+            if (it != tokens_.end() && it->second.state && it->second.expiresAt == expiry_.front().first) {
+                expired.push_back(std::move(*it->second.state));
+                tokens_.erase(it);
+                stats_.expired++;
+                stats_.retained--;
+            }
+            expiry_.pop_front();
+        }
+        return expired;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    /**
+     * Find the revision a resumed client carries on from on a document
+     * The server's record of what the client acknowledged, or the revision
+     * the client says it applied up to if that is later; any revision in
+     * between is in the operation log, which keeps what the acknowledged
+     * revision needs.
+     *
+     * @param state The resumed session
+     * @param documentId One of its documents
+     * @param request The client's AUTH_RESUME
+     * @param current The document's revision now
+     * @return The revision to send the operations from
+     */
+    static int64_t resumeFrom(const Retained& state, const std::string& documentId,
+                              const protocol::AuthMessage& request, int64_t current) {
+        auto known = state.acknowledged.find(documentId);
+        int64_t revision = known != state.acknowledged.end() ? known->second : 0;
+        auto claimed = request.metadata.find(REVISION_KEY_PREFIX + documentId);
+        if (claimed != request.metadata.end()) {
+            try {
+                const int64_t applied = std::stoll(claimed->second);
+                if (applied > revision && applied <= current) {
+                    revision = applied;
+                }
+            } catch (const std::exception&) {
+                // Not a revision; the server's record stands
+            }
+        }
+        return revision;
+    }
+
+private:
+    struct Entry {
+        std::optional<Retained> state;  // Set while suspended
+        Clock::time_point expiresAt;
+    };
+
+    // mutex_ must be held
+    std::string randomToken() {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        std::string token;
+        token.reserve(32);
+        for (int word = 0; word < 4; ++word) {
+            uint32_t bits = random_();
+            for (int digit = 0; digit < 8; ++digit, bits >>= 4) {
+                token.push_back(DIGITS[bits & 0xF]);
+            }
+        }
+        return token;
+    }
+
+    mutable std::mutex mutex_;      // Guards the members below
+    std::chrono::seconds grace_;
+    std::random_device random_;
+    std::unordered_map<std::string, Entry> tokens_;
+    std::deque<std::pair<Clock::time_point, std::string>> expiry_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SESSION_RESUMPTION_H
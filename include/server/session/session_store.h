@@ -0,0 +1,394 @@
+#ifndef COLLABORATIVE_EDITOR_SESSION_STORE_H
+#define COLLABORATIVE_EDITOR_SESSION_STORE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace server {
+
+// The session a username is logged in on, somewhere in the cluster
+struct SessionOwner {
+    std::string node;
+    std::string sessionId;
+
+    bool operator==(const SessionOwner&) const = default;
+};
+
+/**
+ * Which session of which node each username is logged in on, shared by the nodes of a cluster
+ *
+ * A username is held by one session at a time: claim() takes it if no
+ * other session has it, and release() gives it back if the session still
+ * has it, so two nodes racing to log in the same user agree on one. Nodes
+ * watch the store to hear of every change another node makes, which is
+ * what keeps their caches (see SessionDirectory) correct.
+ *
+ * Implementations decide where the names live: InProcessSessionStore
+ * keeps them in memory, a key-value service would keep them remotely. All
+ * of them are to be thread-safe, and call handlers outside their own
+ * locks.
+ */
+class SessionStore {
+public:
+    // Told the username whose owner changed
+    using Handler = std::function<void(const std::string& username)>;
+
+    virtual ~SessionStore() = default;
+
+    /**
+     * Hear of the changes other nodes make
+     *
+     * @param node The watching node's ID; its own changes are not sent to it
+     * @param handler Gets each changed username; may run on any thread
+     */
+    virtual void watch(const std::string& node, Handler handler) = 0;
+
+    // Stop watching; nothing is delivered to the node once this returns
+    virtual void unwatch(const std::string& node) = 0;
+
+    // Take a username for a session; false if another session has it
+    virtual bool claim(const std::string& username, const SessionOwner& owner) = 0;
+
+    // Give a username back, if the session still has it
+    virtual void release(const std::string& username, const SessionOwner& owner) = 0;
+
+    // Give back every username a node's sessions have, e.g. as it leaves the cluster
+    virtual void releaseNode(const std::string& node) = 0;
+
+    // The session that has a username, or std::nullopt if it is free
+    virtual std::optional<SessionOwner> lookup(const std::string& username) = 0;
+};
+
+/**
+ * A session store in memory, e.g. for tests or several nodes in one process
+ */
+class InProcessSessionStore : public SessionStore {
+public:
+    struct Stats {
+        uint64_t claims = 0;
+        uint64_t conflicts = 0;     // Claims of a name another session had
+        uint64_t releases = 0;
+        uint64_t lookups = 0;
+        uint64_t invalidations = 0; // Handler calls
+        size_t usernames = 0;       // Held now
+    };
+
+    void watch(const std::string& node, Handler handler) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        watchers_[node] = std::make_shared<const Handler>(std::move(handler));
+    }
+
+    void unwatch(const std::string& node) override {
+        // Takes deliveryMutex_ too, so no change is still being handed to the node
+        std::lock_guard<std::mutex> delivering(deliveryMutex_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        watchers_.erase(node);
+    }
+
+    bool claim(const std::string& username, const SessionOwner& owner) override {
+        std::unique_lock<std::mutex> delivering(deliveryMutex_);
+        std::vector<std::shared_ptr<const Handler>> handlers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto [it, added] = owners_.try_emplace(username, owner);
+            if (!added) {
+                if (!(it->second == owner)) {
+                    stats_.conflicts++;
+                    return false;
+                }
+                return true;
+            }
+            stats_.claims++;
+            stats_.usernames = owners_.size();
+            handlers = othersThan(owner.node);
+        }
+        notify(handlers, {username});
+        return true;
+    }
+
+    void release(const std::string& username, const SessionOwner& owner) override {
+        std::unique_lock<std::mutex> delivering(deliveryMutex_);
+        std::vector<std::shared_ptr<const Handler>> handlers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = owners_.find(username);
+            if (it == owners_.end() || !(it->second == owner)) {
+                return;
+            }
+            owners_.erase(it);
+            stats_.releases++;
+            stats_.usernames = owners_.size();
+            handlers = othersThan(owner.node);
+        }
+        notify(handlers, {username});
+    }
+
+    void releaseNode(const std::string& node) override {
+        std::unique_lock<std::mutex> delivering(deliveryMutex_);
+        std::vector<std::shared_ptr<const Handler>> handlers;
+        std::vector<std::string> released;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = owners_.begin(); it != owners_.end();) {
+                if (it->second.node == node) {
+                    released.push_back(it->first);
+                    it = owners_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            stats_.releases += released.size();
+            stats_.usernames = owners_.size();
+            handlers = othersThan(node);
+        }
+        notify(handlers, released);
+    }
+
+    std::optional<SessionOwner> lookup(const std::string& username) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.lookups++;
+        auto it = owners_.find(username);
+        if (it == owners_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    // mutex_ must be held
+    std::vector<std::shared_ptr<const Handler>> othersThan(const std::string& node) const {
+        std::vector<std::shared_ptr<const Handler>> handlers;
+        handlers.reserve(watchers_.size());
+        for (const auto& [watcher, handler] : watchers_) {
+            if (watcher != node) {
+                handlers.push_back(handler);
+            }
+        }
+        return handlers;
+    }
+
+    // deliveryMutex_ must be held, mutex_ not
+    void notify(const std::vector<std::shared_ptr<const Handler>>& handlers, const std::vector<std::string>& usernames) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.invalidations += handlers.size() * usernames.size();
+        }
+        for (const auto& handler : handlers) {
+            for (const auto& username : usernames) {
+                (*handler)(username);
+            }
+        }
+    }
+
+    // Changes are handed over one at a time, so each node hears of them in order
+    std::mutex deliveryMutex_;
+    mutable std::mutex mutex_;      // Guards the members below
+    std::unordered_map<std::string, SessionOwner> owners_;
+    std::unordered_map<std::string, std::shared_ptr<const Handler>> watchers_;
+    Stats stats_;
+};
+
+/**
+ * One node's view of a session store, with a local cache in front of it
+ *
+ * Checking whether a username is free, or where its session is, must
+ * not cost a round trip to the store on every login screen keystroke or
+ * routed message. The directory answers from a cache: the names this
+ * node's own sessions claimed, which stay until they are released, and
+ * the answers the store gave about others, free names included, for ttl.
+ * The store tells the directory of every change another node makes and
+ * the directory drops that name, so an answer is only stale for as long
+ * as an invalidation takes to arrive; ttl bounds that if one is lost.
+ *
+ * Claims always go to the store, which is what makes them correct
+ * across the cluster. Thread-safe; the store is called outside the lock.
+ */
+class SessionDirectory {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::milliseconds ttl{30000};   // How long the store's answer about another node's name is trusted
+        size_t maxEntries = 100000;             // Answers cached at most; this node's own names do not count
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;        // Lookups that went to the store
+        uint64_t invalidations = 0; // Changes other nodes made that the store told of
+        uint64_t claims = 0;
+        uint64_t conflicts = 0;     // Claims refused as another session had the name
+        size_t entries = 0;
+    };
+
+    /**
+     * Join a store as a node
+     *
+     * @param store The store the nodes share
+     * @param node This node's ID, unique in the cluster
+     * @param options How to cache
+     */
+    SessionDirectory(std::shared_ptr<SessionStore> store, std::string node, Options options)
+        : store_(std::move(store)), node_(std::move(node)), options_(options) {
+        store_->watch(node_, [this](const std::string& username) { invalidate(username); });
+    }
+
+    // Leaves the store, giving back the names this node's sessions still have
+    ~SessionDirectory() {
+        store_->unwatch(node_);
+        store_->releaseNode(node_);
+    }
+
+    SessionDirectory(const SessionDirectory&) = delete;
+    SessionDirectory& operator=(const SessionDirectory&) = delete;
+
+    const std::string& getNode() const {
+        return node_;
+    }
+
+    /**
+     * Take a username for one of this node's sessions
+     *
+     * @param username The name it logs in with
+     * @param sessionId The session
+     * @return False if another session, on any node, has the name
+     */
+    bool claim(const std::string& username, const std::string& sessionId) {
+        const SessionOwner owner{node_, sessionId};
+        const bool claimed = store_->claim(username, owner);
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        if (claimed) {
+            stats_.claims++;
+            erase(username);
+            entries_[username] = {owner, Clock::time_point::max()};
+            own_++;
+        } else {
+            // Whatever was cached said the name was free, or ours
+            stats_.conflicts++;
+            erase(username);
+        }
+        stats_.entries = entries_.size();
+        return claimed;
+    }
+
+    // Give back a username of one of this node's sessions, if the session still has it
+    void release(const std::string& username, const std::string& sessionId) {
+        store_->release(username, {node_, sessionId});
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        auto it = entries_.find(username);
+        if (it != entries_.end() && it->second.owner && it->second.owner->node == node_ &&
+            it->second.owner->sessionId == sessionId) {
+            erase(username);
+        }
+        stats_.entries = entries_.size();
+    }
+
+    /**
+     * Find the session that has a username
+     *
+     * @param username The name
+     * @param now The time to check cached answers against
+     * @return Its session, or std::nullopt if the name is free
+     */
+    std::optional<SessionOwner> lookup(const std::string& username, Clock::time_point now = Clock::now()) {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(username);
+            if (it != entries_.end() && it->second.expiresAt > now) {
+                stats_.hits++;
+                return it->second.owner;
+            }
+            stats_.misses++;
+            generation = generation_;
+        }
+        std::optional<SessionOwner> owner = store_->lookup(username);
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Not if anything changed while the store was asked, which the answer may predate
+        if (generation == generation_ && (!owner || owner->node != node_)) {
+            cache(username, owner, now + options_.ttl, now);
+        }
+        return owner;
+    }
+
+    bool isAvailable(const std::string& username, Clock::time_point now = Clock::now()) {
+        return !lookup(username, now).has_value();
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::optional<SessionOwner> owner;  // std::nullopt if the name was free
+        Clock::time_point expiresAt;        // Never for this node's own names
+    };
+
+    void invalidate(const std::string& username) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        stats_.invalidations++;
+        erase(username);
+        stats_.entries = entries_.size();
+    }
+
+    // mutex_ must be held
+    void cache(const std::string& username, std::optional<SessionOwner> owner,
+               Clock::time_point expiresAt, Clock::time_point now) {
+        if (entries_.size() - own_ >= options_.maxEntries) {
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                it = it->second.expiresAt <= now ? entries_.erase(it) : std::next(it);
+            }
+            if (entries_.size() - own_ >= options_.maxEntries) {
+                return;
+            }
+        }
+        entries_[username] = {std::move(owner), expiresAt};
+        stats_.entries = entries_.size();
+    }
+
+    // mutex_ must be held
+    void erase(const std::string& username) {
+        auto it = entries_.find(username);
+        if (it == entries_.end()) {
+            return;
+        }
+        if (it->second.expiresAt == Clock::time_point::max()) {
+            own_--;
+        }
+        entries_.erase(it);
+    }
+
+    std::shared_ptr<SessionStore> store_;
+    std::string node_;
+    Options options_;
+    mutable std::mutex mutex_;      // Guards the members below
+    std::unordered_map<std::string, Entry> entries_;
+    size_t own_ = 0;                // Entries of this node's own names
+    uint64_t generation_ = 0;       // Counts changes, so a lookup does not cache an answer they made stale
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_SESSION_STORE_H
@@ -0,0 +1,280 @@
+#ifndef COLLABORATIVE_EDITOR_VIEW_FEED_H
+#define COLLABORATIVE_EDITOR_VIEW_FEED_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/ot/operation.h"
+#include "common/ot/text_operation.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Feeds view-only subscribers a document's edits as periodic diffs
+ *
+ * A dashboard with thousands of viewers costs an editor's share of every
+ * edit for each of them: a queued message per operation, a watermark the
+ * operation log keeps history for, a trace stamp. Viewers never edit, so
+ * they need none of it, only the document as it changes. Here a
+ * document's edits are composed as they are applied (see
+ * ot::TextOperation) into one net diff, and flush() hands each document's
+ * diff out at most once per interval, for the caller to serialize once and
+ * send to all of its viewers. Edits that a later one undoes within the
+ * interval, typing then backspacing, never reach a viewer.
+ *
+ * A viewer applies each diff to its copy as it is: nothing it has not
+ * seen is in flight from it, so it needs no transforms, no acknowledgements
+ * and no history. Each diff carries the revision it brings the document
+ * to; a viewer that misses one opens the document again.
+ *
+ * Edits are composed only for documents with viewers; the first viewer of
+ * a document gives its length, and from then on every edit the document
+ * applies must be recorded, in order. A viewer joining mid-interval is
+ * sent the document as it is, so the diff pending for the others is
+ * taken then, to go out before anything the new viewer is sent.
+ *
+ * Thread-safe.
+ */
+class ViewFeed {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 4 diffs a second per document
+    static constexpr Clock::duration DEFAULT_INTERVAL = std::chrono::milliseconds(250);
+
+    // Metadata of a DOC_OPEN, and its DOC_RESPONSE, that subscribes to view only
+    static constexpr const char* SUBSCRIPTION_KEY = "subscription";
+    static constexpr const char* VIEW_SUBSCRIPTION = "view";
+    static constexpr const char* EDIT_SUBSCRIPTION = "edit";
+
+    // What a document's viewers are sent
+    struct Diff {
+        std::string documentId;
+        ot::OperationPtr op;            // The net edit since the last diff
+        int64_t revision = 0;           // The revision it brings the document to
+        std::vector<std::string> viewers;
+    };
+
+    struct Stats {
+        size_t viewers = 0;             // Viewer-document pairs
+        size_t documents = 0;           // Documents with viewers
+        uint64_t operations = 0;        // Edits composed into diffs
+        uint64_t diffs = 0;             // Diffs flushed
+        uint64_t deliveries = 0;        // Diffs times the viewers they went to
+    };
+
+    explicit ViewFeed(Clock::duration interval = DEFAULT_INTERVAL)
+        : interval_(interval) {}
+
+    Clock::duration getInterval() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return interval_;
+    }
+
+    /**
+     * Change the interval, e.g. from a BatchWindowController
+     * Diffs already pending keep the time they fall due
+     *
+     * @param interval Shortest time between two diffs of a document; zero sends every edit as it comes
+     */
+    void setInterval(Clock::duration interval) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        interval_ = interval;
+    }
+
+    /**
+     * Subscribe a viewer to a document
+     *
+     * @param documentId The document
+     * @param viewerId The viewer
+     * @param documentLength The document's length now, as the viewer is sent it
+     * @param now The time
+     * @return The diff pending for the document's other viewers, to send them first, if any
+     */
+    std::optional<Diff> subscribe(const std::string& documentId, const std::string& viewerId, size_t documentLength,
+                                  Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, added] = documents_.try_emplace(documentId);
+        Document& document = it->second;
+        if (added) {
+            document.length = documentLength;
+        }
+        if (document.viewers.count(viewerId) > 0) {
+            return std::nullopt;
+        }
+        std::optional<Diff> pending = take(documentId, document, now);
+        document.viewers.insert(viewerId);
+        byViewer_[viewerId].insert(documentId);
+        return pending;
+    }
+
+    // Unsubscribe a viewer from a document; the document's pending diff goes with its last viewer
+    bool unsubscribe(const std::string& documentId, const std::string& viewerId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto viewer = byViewer_.find(viewerId);
+        if (viewer == byViewer_.end() || viewer->second.erase(documentId) == 0) {
+            return false;
+        }
+        if (viewer->second.empty()) {
+            byViewer_.erase(viewer);
+        }
+        dropViewer(documentId, viewerId);
+        return true;
+    }
+
+    // Unsubscribe a viewer from every document, e.g. once it disconnects
+    void removeViewer(const std::string& viewerId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto viewer = byViewer_.find(viewerId);
+        if (viewer == byViewer_.end()) {
+            return;
+        }
+        for (const auto& documentId : viewer->second) {
+            dropViewer(documentId, viewerId);
+        }
+        byViewer_.erase(viewer);
+    }
+
+    bool isViewer(const std::string& viewerId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return byViewer_.count(viewerId) > 0;
+    }
+
+    bool hasViewers(const std::string& documentId) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return documents_.count(documentId) > 0;
+    }
+
+    /**
+     * Compose an edit a document applied into its viewers' next diff
+     *
+     * @param documentId The document
+     * @param op The edit, as applied
+     * @param revision The revision it brought the document to
+     * @param now When it was applied
+     * @return True if the diff was empty before, so a flush is now due at nextFlush()
+     * @throws std::invalid_argument if the edit does not fit the document as last recorded
+     */
+    bool record(const std::string& documentId, const ot::Operation& op, int64_t revision, Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = documents_.find(documentId);
+        if (it == documents_.end()) {
+            return false;
+        }
+        Document& document = it->second;
+        const ot::TextOperation edit = ot::TextOperation::fromOperation(op, document.length);
+        const bool first = !document.pending;
+        document.pending = first ? edit : document.pending->compose(edit);
+        document.length = edit.getTargetLength();
+        document.revision = revision;
+        if (first) {
+            // A document quiet for a whole interval sends its first edit at once
+            document.due = std::max(now, document.lastFlush + interval_);
+        }
+        ++stats_.operations;
+        return first;
+    }
+
+    // When the next document's diff falls due, or std::nullopt if none is pending
+    std::optional<Clock::time_point> nextFlush() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::optional<Clock::time_point> next;
+        for (const auto& [documentId, document] : documents_) {
+            if (document.pending && (!next || document.due < *next)) {
+                next = document.due;
+            }
+        }
+        return next;
+    }
+
+    /**
+     * Take the diffs that are due
+     * A diff that composed to nothing, an insert deleted again, is dropped
+     * without being sent.
+     *
+     * @param now The time
+     * @return One diff per document due, with its viewers
+     */
+    std::vector<Diff> flush(Clock::time_point now = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Diff> diffs;
+        for (auto& [documentId, document] : documents_) {
+            if (document.pending && document.due <= now) {
+                if (std::optional<Diff> diff = take(documentId, document, now)) {
+                    diffs.push_back(std::move(*diff));
+                }
+            }
+        }
+        return diffs;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.documents = documents_.size();
+        for (const auto& [documentId, document] : documents_) {
+            stats.viewers += document.viewers.size();
+        }
+        return stats;
+    }
+
+private:
+    struct Document {
+        std::unordered_set<std::string> viewers;
+        size_t length = 0;                          // As of the last edit recorded
+        std::optional<ot::TextOperation> pending;   // Composed since the last flush
+        int64_t revision = 0;
+        Clock::time_point due;
+        Clock::time_point lastFlush;
+    };
+
+    // Take a document's pending diff for its viewers, unless it composed to nothing (mutex_ must be held)
+    std::optional<Diff> take(const std::string& documentId, Document& document, Clock::time_point now) {
+        if (!document.pending) {
+            return std::nullopt;
+        }
+        const ot::TextOperation edit = std::move(*document.pending);
+        document.pending.reset();
+        document.lastFlush = now;
+        if (edit.isNoop() || document.viewers.empty()) {
+            return std::nullopt;
+        }
+        Diff diff;
+        diff.documentId = documentId;
+        diff.op = edit.toOperation();
+        diff.revision = document.revision;
+        diff.viewers.assign(document.viewers.begin(), document.viewers.end());
+        ++stats_.diffs;
+        stats_.deliveries += diff.viewers.size();
+        return diff;
+    }
+
+    // mutex_ must be held
+    void dropViewer(const std::string& documentId, const std::string& viewerId) {
+        auto it = documents_.find(documentId);
+        if (it != documents_.end() && it->second.viewers.erase(viewerId) > 0 && it->second.viewers.empty()) {
+            documents_.erase(it);
+        }
+    }
+
+    Clock::duration interval_;
+    mutable std::mutex mutex_;      // Guards the members below
+    std::unordered_map<std::string, Document> documents_;
+    std::unordered_map<std::string, std::unordered_set<std::string>> byViewer_;
+    Stats stats_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_VIEW_FEED_H
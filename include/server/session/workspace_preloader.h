@@ -0,0 +1,231 @@
+#ifndef COLLABORATIVE_EDITOR_WORKSPACE_PRELOADER_H
+#define COLLABORATIVE_EDITOR_WORKSPACE_PRELOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/models/file_system.h"
+#include "server/session/document_cache.h"
+#include "server/thread_pool.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Loads every document of a workspace tree into a DocumentCache at once, e.g. when the node starts
+ *
+ * The walk and the loads are tasks on a ThreadPool. Each directory is
+ * listed by a task of its own, which posts one task per subdirectory and
+ * one per page of files; posted from a worker, they go on that worker's
+ * deque and idle workers steal them, so a deep or lopsided tree spreads
+ * over every core without a queue of its own. Each file is loaded through
+ * the cache's loader, which maps its snapshot and builds the document,
+ * and stays resident, unpinned, as soon as it is done: opens need not wait
+ * for the rest, and one that comes in while its document is still being
+ * loaded waits only for that load (see DocumentCache::preload()).
+ *
+ * A document that fails to load is counted and skipped; a later open()
+ * tries it again. Whatever the loader throws is not reported otherwise.
+ * The cache's budget still holds: a workspace larger than it keeps the
+ * documents loaded last.
+ *
+ * The destructor waits for the walk, so the cache and the pool must
+ * outlive the preloader.
+ */
+class WorkspacePreloader {
+public:
+    // Names the document a file holds; by default, its path below the workspace root
+    using DocumentIdOf = std::function<std::string(const fs::File& file)>;
+
+    // Files one task loads, so small documents do not cost a task each
+    static constexpr size_t FILES_PER_TASK = 8;
+
+    struct Stats {
+        size_t files = 0;       // Files found so far
+        size_t loaded = 0;      // Documents resident after their load
+        size_t failed = 0;      // Loads that threw
+        bool done = false;      // The walk and every load have finished
+        std::chrono::nanoseconds elapsed{0};  // Since start(), up to when it was done
+    };
+
+    /**
+     * @param cache The cache to load into; must outlive the preloader
+     * @param pool The pool the walk and the loads run on; must outlive the preloader
+     * @param documentIdOf The document a file holds
+     */
+    WorkspacePreloader(DocumentCache& cache, ThreadPool& pool, DocumentIdOf documentIdOf = {})
+        : cache_(cache),
+          pool_(pool),
+          documentIdOf_(documentIdOf ? std::move(documentIdOf) : DocumentIdOf(relativePath)) {}
+
+    ~WorkspacePreloader() {
+        wait();
+    }
+
+    WorkspacePreloader(const WorkspacePreloader&) = delete;
+    WorkspacePreloader& operator=(const WorkspacePreloader&) = delete;
+
+    /**
+     * Start loading a workspace; returns at once
+     * Call at most once per preloader
+     *
+     * @param root The workspace's root directory
+     */
+    void start(std::shared_ptr<fs::Directory> root) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            started_ = Clock::now();
+            done_ = false;
+        }
+        // Held until the walk is done: the paths of the files are built through their parents
+        root_ = std::move(root);
+        spawn([this] { walk(*root_); });
+    }
+
+    /**
+     * Wait until the walk and every load have finished
+     *
+     * @return The final counts
+     */
+    Stats wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return done_; });
+        return statsLocked();
+    }
+
+    /**
+     * Get the counts so far, e.g. for a readiness probe
+     *
+     * @return Files found, documents loaded and failed
+     */
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return statsLocked();
+    }
+
+    // Default document ID: the file's path below the workspace root, e.g. "docs/a.txt"
+    static std::string relativePath(const fs::File& file) {
+        return file.getRelativePath();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Directory entries taken under one lock at a time while listing
+    static constexpr size_t LIST_PAGE = 256;
+
+    // Post a task, counted until it has run
+    void spawn(Task task) {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        try {
+            pool_.post([this, task = std::move(task)]() mutable {
+                try {
+                    task();
+                } catch (const std::exception&) {
+                    // A directory that could not be listed; what was posted from it still runs
+                }
+                finish();
+            });
+        } catch (...) {
+            // The pool is stopping
+            finish();
+            throw;
+        }
+    }
+
+    void finish() {
+        if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = Clock::now();
+            done_ = true;
+            done_cv_.notify_all();
+        }
+    }
+
+    // List a directory a page at a time, posting each subdirectory and each run of files
+    void walk(fs::Directory& directory) {
+        std::vector<std::shared_ptr<fs::File>> files;
+        std::string after;
+        for (;;) {
+            const std::vector<fs::Directory::Entry> page = directory.listChildren(after, LIST_PAGE);
+            for (const auto& entry : page) {
+                if (auto subdirectory = entry.node->asDirectory()) {
+                    spawn([this, subdirectory = std::move(subdirectory)] { walk(*subdirectory); });
+                } else if (auto file = entry.node->asFile()) {
+                    files.push_back(std::move(file));
+                    if (files.size() == FILES_PER_TASK) {
+                        loadFiles(std::move(files));
+                        files.clear();
+                    }
+                }
+            }
+            if (page.size() < LIST_PAGE) {
+                break;
+            }
+            after = page.back().name;
+        }
+        if (!files.empty()) {
+            loadFiles(std::move(files));
+        }
+    }
+
+    void loadFiles(std::vector<std::shared_ptr<fs::File>> files) {
+        files_.fetch_add(files.size(), std::memory_order_relaxed);
+        spawn([this, files = std::move(files)] {
+            for (const auto& file : files) {
+                load(*file);
+            }
+        });
+    }
+
+    void load(const fs::File& file) {
+        try {
+            cache_.preload(documentIdOf_(file));
+            loaded_.fetch_add(1, std::memory_order_relaxed);
+        } catch (...) {
+            failed_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // mutex_ must be held
+    Stats statsLocked() const {
+        Stats stats;
+        stats.files = files_.load(std::memory_order_relaxed);
+        stats.loaded = loaded_.load(std::memory_order_relaxed);
+        stats.failed = failed_.load(std::memory_order_relaxed);
+        stats.done = done_;
+        stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>((done_ ? finished_ : Clock::now()) - started_);
+        return stats;
+    }
+
+    DocumentCache& cache_;
+    ThreadPool& pool_;
+    const DocumentIdOf documentIdOf_;
+    std::shared_ptr<fs::Directory> root_;
+
+    std::atomic<size_t> outstanding_{0};  // Tasks posted and not yet finished
+    std::atomic<size_t> files_{0};
+    std::atomic<size_t> loaded_{0};
+    std::atomic<size_t> failed_{0};
+
+    mutable std::mutex mutex_;            // Guards the members below
+    std::condition_variable done_cv_;
+    bool done_ = true;                    // Nothing is outstanding, or nothing was started
+    Clock::time_point started_;
+    Clock::time_point finished_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_WORKSPACE_PRELOADER_H
@@ -1,19 +1,163 @@
+#ifndef COLLABORATIVE_EDITOR_SESSION_HANDLER_H
+#define COLLABORATIVE_EDITOR_SESSION_HANDLER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <chrono>
+#include <stdexcept>
+#include <vector>
 #include <boost/asio.hpp>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
+
+#include "common/util/handle_table.h"
+#include "common/util/logger.h"
+#include "common/util/memory_accounting.h"
+#include "common/util/profiled_mutex.h"
+#include "common/util/uuid_generator.h"
+#include "server/session/session_resumption.h"
+#include "server/session/session_store.h"
 
 namespace collab {
 namespace server {
 
-class UserSession {
+class UserSession;
+
+/**
+ * Index from documents to the sessions that have them open
+ *
+ * Kept up to date by the sessions themselves as they open and close
+ * documents. Each document's subscribers are an immutable vector that is
+ * copied and swapped in whole when a session joins or leaves, so readers
+ * such as broadcast and presence code take a snapshot with one atomic
+ * load and iterate it without holding any lock; a snapshot stays valid,
+ * and keeps its sessions alive, for as long as the reader holds it.
+ * Joins and leaves, which are far rarer than reads, serialize per shard.
+ */
+class DocumentMembership {
+public:
+    static constexpr size_t SHARDS = 16;
+
+    using SubscriberList = std::vector<std::shared_ptr<UserSession>>;
+
+    /**
+     * Subscribers of one document, for readers that look them up often
+     *
+     * Stays current for as long as it is held, even while the document has
+     * no subscribers.
+     */
+    class Subscribers {
+    public:
+        Subscribers() : list_(emptyList()) {}
+        // The subscribers right now; never null
+        std::shared_ptr<const SubscriberList> load() const { return list_.load(std::memory_order_acquire); }
+    private:
+        friend class DocumentMembership;
+        std::atomic<std::shared_ptr<const SubscriberList>> list_;
+    };
+
+    void add(const std::string& documentId, std::shared_ptr<UserSession> session) {
+        Shard& shard = shardFor(documentId);
+        std::lock_guard<util::ProfiledMutex> lock(shard.mutex);
+        auto& subscribers = shard.documents[documentId];
+        if (!subscribers) {
+            subscribers = std::make_shared<Subscribers>();
+        }
+        auto current = subscribers->load();
+        if (std::find(current->begin(), current->end(), session) != current->end()) {
+            return;
+        }
+        auto next = std::make_shared<SubscriberList>();
+        next->reserve(current->size() + 1);
+        *next = *current;
+        next->push_back(std::move(session));
+        subscribers->list_.store(std::move(next), std::memory_order_release);
+    }
+    void remove(const std::string& documentId, const UserSession* session) {
+        Shard& shard = shardFor(documentId);
+        std::lock_guard<util::ProfiledMutex> lock(shard.mutex);
+        auto it = shard.documents.find(documentId);
+        if (it == shard.documents.end()) {
+            return;
+        }
+        auto current = it->second->load();
+        auto next = std::make_shared<SubscriberList>();
+        next->reserve(current->size());
+        for (const auto& subscriber : *current) {
+            if (subscriber.get() != session) {
+                next->push_back(subscriber);
+            }
+        }
+        if (next->size() == current->size()) {
+            return;
+        }
+        if (next->empty() && it->second.use_count() == 1) {
+            // Nobody holds on to the document's subscribers; forget it
+            shard.documents.erase(it);
+            return;
+        }
+        it->second->list_.store(std::move(next), std::memory_order_release);
+    }
+    /**
+     * Take a snapshot of a document's subscribers
+     *
+     * @param documentId The document
+     * @return The sessions on it; never null. Iterate it without locking.
+     */
+    std::shared_ptr<const SubscriberList> getSubscribers(const std::string& documentId) const {
+        const Shard& shard = shardFor(documentId);
+        std::lock_guard<util::ProfiledMutex> lock(shard.mutex);
+        auto it = shard.documents.find(documentId);
+        return it != shard.documents.end() ? it->second->load() : emptyList();
+    }
+    /**
+     * Get a document's subscribers to keep, skipping the lookup on every read
+     *
+     * @param documentId The document
+     * @return Its subscribers, kept up to date while held
+     */
+    std::shared_ptr<const Subscribers> watch(const std::string& documentId) {
+        Shard& shard = shardFor(documentId);
+        std::lock_guard<util::ProfiledMutex> lock(shard.mutex);
+        auto& subscribers = shard.documents[documentId];
+        if (!subscribers) {
+            subscribers = std::make_shared<Subscribers>();
+        }
+        return subscribers;
+    }
+    size_t getMemberCount(const std::string& documentId) const {
+        return getSubscribers(documentId)->size();
+    }
+private:
+    struct Shard {
+        std::pmr::unordered_map<std::string, std::shared_ptr<Subscribers>> documents{
+            &util::memoryResource(util::MemoryTag::SESSIONS)};
+        // Taken by joins, leaves and lookups of the map, never while a list is iterated
+        mutable util::ProfiledMutex mutex{"session_handler_documents"};
+    };
+    static const std::shared_ptr<const SubscriberList>& emptyList() {
+        static const std::shared_ptr<const SubscriberList> empty = std::make_shared<const SubscriberList>();
+        return empty;
+    }
+    Shard& shardFor(const std::string& documentId) {
+        return shards_[std::hash<std::string>{}(documentId) % SHARDS];
+    }
+    const Shard& shardFor(const std::string& documentId) const {
+        return shards_[std::hash<std::string>{}(documentId) % SHARDS];
+    }
+    std::array<Shard, SHARDS> shards_;
+};
+
+class UserSession : public std::enable_shared_from_this<UserSession> {
 public:
     enum class State { CONNECTING, AUTHENTICATING, AUTHENTICATED, DISCONNECTED };
     UserSession(const std::string& id, const std::string& username = "")
@@ -31,20 +175,60 @@ public:
         auto now = std::chrono::steady_clock::now();
         return std::chrono::duration_cast<std::chrono::seconds>(now - last_activity_);
     }
+    // The handle the session was registered under, or NO_HANDLE
+    util::Handle getHandle() const { return handle_; }
+    void setHandle(util::Handle handle) { handle_ = handle; }
+    // The index the session reports its open documents to, while it is registered
+    void setMembership(std::weak_ptr<DocumentMembership> membership) { membership_ = std::move(membership); }
     bool addDocument(const std::string& documentId) {
         auto result = active_documents_.insert(documentId);
-        if (result.second) updateActivity();
+        if (result.second) {
+            document_handles_[documentId] = document_ids_.insert(documentId);
+            if (auto membership = membership_.lock()) {
+                membership->add(documentId, shared_from_this());
+            }
+            updateActivity();
+        }
         return result.second;
     }
     bool removeDocument(const std::string& documentId) {
         auto count = active_documents_.erase(documentId);
-        if (count > 0) updateActivity();
+        if (count > 0) {
+            auto it = document_handles_.find(documentId);
+            document_ids_.erase(it->second);
+            document_handles_.erase(it);
+            acknowledged_.erase(documentId);
+            if (auto membership = membership_.lock()) {
+                membership->remove(documentId, this);
+            }
+            updateActivity();
+        }
         return count > 0;
     }
+    // The handle of an open document, to send in the DOC_RESPONSE; NO_HANDLE if it is not open
+    util::Handle getDocumentHandle(const std::string& documentId) const {
+        auto it = document_handles_.find(documentId);
+        return it != document_handles_.end() ? it->second : util::NO_HANDLE;
+    }
+    // The open document a handle refers to, by index and without hashing; nullptr if closed
+    const std::string* getDocumentId(util::Handle handle) const { return document_ids_.find(handle); }
     bool hasDocument(const std::string& documentId) const {
         return active_documents_.find(documentId) != active_documents_.end();
     }
     const std::unordered_set<std::string>& getActiveDocuments() const { return active_documents_; }
+    // Record the last revision the client acknowledged on an open document; kept if the connection drops
+    void acknowledge(const std::string& documentId, int64_t revision) {
+        if (hasDocument(documentId)) {
+            acknowledged_[documentId] = revision;
+        }
+    }
+    int64_t getAcknowledged(const std::string& documentId) const {
+        auto it = acknowledged_.find(documentId);
+        return it != acknowledged_.end() ? it->second : 0;
+    }
+    // The token that resumes the session after its connection drops; empty until it logs in
+    const std::string& getResumeToken() const { return resume_token_; }
+    void setResumeToken(std::string token) { resume_token_ = std::move(token); }
 private:
     std::string id_;
     std::string username_;
@@ -52,6 +236,12 @@ private:
     std::chrono::steady_clock::time_point creation_time_;
     std::chrono::steady_clock::time_point last_activity_;
     std::unordered_set<std::string> active_documents_;
+    util::Handle handle_ = util::NO_HANDLE;
+    util::HandleTable<std::string> document_ids_;
+    std::pmr::unordered_map<std::string, util::Handle> document_handles_{&util::memoryResource(util::MemoryTag::SESSIONS)};
+    std::weak_ptr<DocumentMembership> membership_;
+    std::unordered_map<std::string, int64_t> acknowledged_;
+    std::string resume_token_;
 };
 
 class SocketGuard {
@@ -78,109 +268,408 @@ private:
     std::shared_ptr<boost::asio::ip::tcp::socket> socket_;
 };
 
+/**
+ * Registry of connected sessions
+ *
+ * Sessions are spread over SHARDS shards by a hash of their ID, each with
+ * its own reader-writer lock, so lookups on different shards never
+ * contend and lookups on one shard only wait for a session being created
+ * or closed there. Within a shard sessions live in a flat table: each gets
+ * a 32-bit handle, sent to the client in AUTH_SUCCESS, whose low bits name
+ * the shard, and lookups by handle index the table instead of hashing a
+ * session ID. The ID lookups remain for code that only has one.
+ *
+ * Who has which document open is kept in a DocumentMembership index, so
+ * getUsersOnDocument() visits the document's members, not every session.
+ *
+ * A session that logged in has a resume token. suspendSession() ends a
+ * session whose connection dropped but keeps its user, documents and
+ * acknowledged revisions for the grace period (see SessionResumption),
+ * and resumeSession() gives them to the session of the client's new
+ * connection.
+ *
+ * In a cluster the handler can share who is logged in with the other
+ * nodes through a SessionStore (see setSessionStore()): a username then
+ * logs in on one session of one node only, and isUsernameAvailable() and
+ * locateUser() answer for the whole cluster from this node's cache of it.
+ * A name is claimed in the store before the session's locks are taken.
+ *
+ * Locks are taken in the order session shard, usernames, document shard,
+ * resumption.
+ */
 class SessionHandler {
 public:
-    SessionHandler() : uuid_generator_() {}
+    static constexpr uint32_t SHARD_BITS = 4;
+    static constexpr size_t SHARDS = size_t{1} << SHARD_BITS;
+    // Sessions per shard; the shard bits come out of the handle's index bits
+    static constexpr size_t MAX_SHARD_SESSIONS = (size_t{1} << (util::HandleTable<int>::INDEX_BITS - SHARD_BITS)) - 1;
+
+    SessionHandler() : membership_(std::make_shared<DocumentMembership>()) {}
     ~SessionHandler() {}
+    /**
+     * Share who is logged in with the other nodes of a cluster
+     * To be called before any session logs in.
+     *
+     * @param store The store the nodes share
+     * @param node This node's ID, unique in the cluster
+     * @param options How this node caches the store's answers
+     */
+    void setSessionStore(std::shared_ptr<SessionStore> store, const std::string& node,
+                         SessionDirectory::Options options = SessionDirectory::Options()) {
+        directory_.reset();
+        directory_ = std::make_unique<SessionDirectory>(std::move(store), node, options);
+    }
+    // This node's view of the session store, or nullptr if sessions are not shared
+    SessionDirectory* getDirectory() { return directory_.get(); }
     std::pair<std::string, std::shared_ptr<UserSession>> createSession(
         std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
-        boost::uuids::uuid uuid = uuid_generator_();
-        std::string sessionId = boost::uuids::to_string(uuid);
+        std::string sessionId = util::UuidGenerator::getInstance().generateUuid();
         auto session = std::make_shared<UserSession>(sessionId);
         auto socketGuard = std::make_shared<SocketGuard>(socket);
-        std::lock_guard<std::mutex> lock(mutex_);
-        sessions_[sessionId] = session;
-        sockets_[sessionId] = socketGuard;
-        std::cout << "Created session: " << sessionId << std::endl;
+        const size_t shardIndex = shardOf(sessionId);
+        Shard& shard = shards_[shardIndex];
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (shard.sessions.size() >= MAX_SHARD_SESSIONS) {
+                throw std::length_error("Session table full");
+            }
+            const util::Handle handle = toHandle(shard.sessions.insert({session, socketGuard}), shardIndex);
+            session->setHandle(handle);
+            session->setMembership(membership_);
+            shard.handles[sessionId] = handle;
+        }
+        LOGF_DEBUG("Created session: {}", sessionId);
         return {sessionId, session};
     }
     bool authenticateSession(const std::string& sessionId, const std::string& username) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = sessions_.find(sessionId);
-        if (it != sessions_.end()) {
-            it->second->setUsername(username);
-            it->second->setState(UserSession::State::AUTHENTICATED);
-            username_to_session_[username] = sessionId;
-            std::cout << "Authenticated session " << sessionId << " as " << username << std::endl;
+        if (directory_ && !directory_->claim(username, sessionId)) {
+            LOGF_DEBUG("Username {} is logged in elsewhere", username);
+            return false;
+        }
+        Shard& shard = shards_[shardOf(sessionId)];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        Entry* entry = shard.find(sessionId);
+        if (entry) {
+            entry->session->setUsername(username);
+            entry->session->setState(UserSession::State::AUTHENTICATED);
+            {
+                std::unique_lock<std::shared_mutex> usersLock(users_mutex_);
+                username_to_session_[username] = sessionId;
+            }
+            LOGF_DEBUG("Authenticated session {} as {}", sessionId, username);
             return true;
         }
+        if (directory_) {
+            directory_->release(username, sessionId);
+        }
         return false;
     }
     std::shared_ptr<UserSession> getSession(const std::string& sessionId) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = sessions_.find(sessionId);
-        return it != sessions_.end() ? it->second : nullptr;
+        const Shard& shard = shards_[shardOf(sessionId)];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Entry* entry = shard.find(sessionId);
+        return entry ? entry->session : nullptr;
+    }
+    // Look up a session by the handle it was created with, without hashing
+    std::shared_ptr<UserSession> getSession(util::Handle handle) {
+        const Shard& shard = shards_[handle & (SHARDS - 1)];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Entry* entry = shard.sessions.find(toShardHandle(handle));
+        return entry ? entry->session : nullptr;
     }
     std::shared_ptr<UserSession> getSessionByUsername(const std::string& username) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = username_to_session_.find(username);
-        if (it != username_to_session_.end()) {
-            auto sessionIt = sessions_.find(it->second);
-            return sessionIt != sessions_.end() ? sessionIt->second : nullptr;
+        std::string sessionId;
+        {
+            std::shared_lock<std::shared_mutex> lock(users_mutex_);
+            auto it = username_to_session_.find(username);
+            if (it == username_to_session_.end()) {
+                return nullptr;
+            }
+            sessionId = it->second;
+        }
+        return getSession(sessionId);
+    }
+    /**
+     * Find where a user is logged in, on this node or, with a session store, any other
+     *
+     * @param username The user
+     * @return Its session and node, the node empty without a store; std::nullopt if it is not logged in
+     */
+    std::optional<SessionOwner> locateUser(const std::string& username) {
+        {
+            std::shared_lock<std::shared_mutex> lock(users_mutex_);
+            auto it = username_to_session_.find(username);
+            if (it != username_to_session_.end()) {
+                return SessionOwner{directory_ ? directory_->getNode() : std::string(), it->second};
+            }
         }
-        return nullptr;
+        return directory_ ? directory_->lookup(username) : std::nullopt;
     }
     std::shared_ptr<SocketGuard> getSocket(const std::string& sessionId) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = sockets_.find(sessionId);
-        return it != sockets_.end() ? it->second : nullptr;
+        const Shard& shard = shards_[shardOf(sessionId)];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Entry* entry = shard.find(sessionId);
+        return entry ? entry->socket : nullptr;
     }
     bool closeSession(const std::string& sessionId) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto sessionIt = sessions_.find(sessionId);
-        if (sessionIt == sessions_.end()) return false;
-        if (sessionIt->second->getState() == UserSession::State::AUTHENTICATED) {
-            username_to_session_.erase(sessionIt->second->getUsername());
-        }
-        sessionIt->second->setState(UserSession::State::DISCONNECTED);
-        sockets_.erase(sessionId);
-        sessions_.erase(sessionIt);
-        std::cout << "Closed session: " << sessionId << std::endl;
+        std::string token;
+        if (!removeSession(sessionId, token, nullptr)) {
+            return false;
+        }
+        if (!token.empty()) {
+            resumption_.revoke(token);
+        }
+        LOGF_DEBUG("Closed session: {}", sessionId);
         return true;
     }
+    /**
+     * Close a session whose connection dropped, keeping what it had for the client to resume
+     *
+     * @param sessionId The session
+     * @return True if it was kept; false if it was closed for good, e.g. as it had not logged in
+     *         or there is no grace period, or if there was no such session
+     */
+    bool suspendSession(const std::string& sessionId) {
+        std::string token;
+        SessionResumption::Retained retained;
+        if (!removeSession(sessionId, token, &retained)) {
+            return false;
+        }
+        if (!token.empty() && !retained.username.empty() && resumption_.suspend(token, std::move(retained))) {
+            LOGF_DEBUG("Suspended session: {}", sessionId);
+            return true;
+        }
+        if (!token.empty()) {
+            resumption_.revoke(token);
+        }
+        LOGF_DEBUG("Closed session: {}", sessionId);
+        return false;
+    }
+    /**
+     * Give a session a new resume token, revoking the one it had
+     *
+     * @param sessionId The session, once it logged in
+     * @return The token, or an empty string if there is no such session
+     */
+    std::string issueResumeToken(const std::string& sessionId) {
+        Shard& shard = shards_[shardOf(sessionId)];
+        std::string previous;
+        std::string token;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            Entry* entry = shard.find(sessionId);
+            if (!entry) {
+                return std::string();
+            }
+            token = resumption_.issue();
+            previous = entry->session->getResumeToken();
+            entry->session->setResumeToken(token);
+        }
+        if (!previous.empty()) {
+            resumption_.revoke(previous);
+        }
+        return token;
+    }
+    /**
+     * Give a new session the user, documents and acknowledged revisions of a suspended one
+     * The session gets a new resume token.
+     *
+     * @param sessionId The new session, not logged in
+     * @param token The token the client presented; used up either way
+     * @return What the suspended session had, or std::nullopt if the token is not a suspended
+     *         session's or the user logged in again meanwhile
+     */
+    std::optional<SessionResumption::Retained> resumeSession(const std::string& sessionId, const std::string& token) {
+        std::optional<SessionResumption::Retained> state = resumption_.resume(token);
+        if (!state) {
+            return std::nullopt;
+        }
+        if (directory_ && !directory_->claim(state->username, sessionId)) {
+            return std::nullopt;
+        }
+        auto unclaim = [&]() {
+            if (directory_) {
+                directory_->release(state->username, sessionId);
+            }
+            return std::nullopt;
+        };
+        std::shared_ptr<UserSession> session;
+        {
+            Shard& shard = shards_[shardOf(sessionId)];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            Entry* entry = shard.find(sessionId);
+            if (!entry || entry->session->getState() == UserSession::State::AUTHENTICATED) {
+                lock.unlock();
+                return unclaim();
+            }
+            {
+                std::unique_lock<std::shared_mutex> usersLock(users_mutex_);
+                if (!username_to_session_.try_emplace(state->username, sessionId).second) {
+                    usersLock.unlock();
+                    lock.unlock();
+                    return unclaim();
+                }
+            }
+            session = entry->session;
+            session->setUsername(state->username);
+            session->setState(UserSession::State::AUTHENTICATED);
+        }
+        for (const auto& [documentId, revision] : state->acknowledged) {
+            session->addDocument(documentId);
+            session->acknowledge(documentId, revision);
+        }
+        issueResumeToken(sessionId);
+        LOGF_DEBUG("Resumed session {} as {}", sessionId, state->username);
+        return state;
+    }
+    // Drop the suspended sessions whose grace period is over, returning what they had
+    std::vector<SessionResumption::Retained> expireSuspendedSessions() {
+        return resumption_.expire();
+    }
+    SessionResumption& getResumption() { return resumption_; }
+    /**
+     * Visit every session, one shard at a time with that shard locked for reading
+     *
+     * @param fn Called with each session; must not create or close sessions
+     */
+    template <typename Fn>
+    void forEachSession(Fn&& fn) const {
+        for (const Shard& shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            shard.sessions.forEach([&fn](util::Handle, const Entry& entry) {
+                fn(entry.session);
+            });
+        }
+    }
+    // A copy of the whole registry; forEachSession() visits it without copying
     std::unordered_map<std::string, std::shared_ptr<UserSession>> getSessions() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return sessions_;
+        std::unordered_map<std::string, std::shared_ptr<UserSession>> sessions;
+        forEachSession([&sessions](const std::shared_ptr<UserSession>& session) {
+            sessions.emplace(session->getId(), session);
+        });
+        return sessions;
     }
     size_t getSessionCount() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return sessions_.size();
+        size_t count = 0;
+        for (const Shard& shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            count += shard.sessions.size();
+        }
+        return count;
     }
+    // Users of the authenticated sessions on a document; visits only its members
     std::vector<std::string> getUsersOnDocument(const std::string& documentId) {
         std::vector<std::string> users;
-        std::lock_guard<std::mutex> lock(mutex_);
-        for (const auto& [sessionId, session] : sessions_) {
-            if (session->hasDocument(documentId) && session->getState() == UserSession::State::AUTHENTICATED) {
+        const auto subscribers = membership_->getSubscribers(documentId);
+        for (const auto& session : *subscribers) {
+            if (session->getState() == UserSession::State::AUTHENTICATED) {
                 users.push_back(session->getUsername());
             }
         }
         return users;
     }
+    // The document index, for broadcast and presence code that iterates subscribers
+    DocumentMembership& getMembership() { return *membership_; }
+    // Whether nobody is logged in as a user, on this node or, with a session store, any other
     bool isUsernameAvailable(const std::string& username) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return username_to_session_.find(username) == username_to_session_.end();
+        {
+            std::shared_lock<std::shared_mutex> lock(users_mutex_);
+            if (username_to_session_.find(username) != username_to_session_.end()) {
+                return false;
+            }
+        }
+        return !directory_ || directory_->isAvailable(username);
     }
     int cleanupIdleSessions(int maxIdleSeconds) {
         std::vector<std::string> sessionsToClose;
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            for (const auto& [sessionId, session] : sessions_) {
-                if (session->getIdleSeconds().count() > maxIdleSeconds) {
-                    sessionsToClose.push_back(sessionId);
-                }
+        forEachSession([&](const std::shared_ptr<UserSession>& session) {
+            if (session->getIdleSeconds().count() > maxIdleSeconds) {
+                sessionsToClose.push_back(session->getId());
             }
-        }
+        });
         for (const auto& sessionId : sessionsToClose) {
             closeSession(sessionId);
         }
         return static_cast<int>(sessionsToClose.size());
     }
 private:
-    mutable std::mutex mutex_;
-    std::unordered_map<std::string, std::shared_ptr<UserSession>> sessions_;
-    std::unordered_map<std::string, std::shared_ptr<SocketGuard>> sockets_;
-    std::unordered_map<std::string, std::string> username_to_session_;
-    boost::uuids::random_generator uuid_generator_;
+    // Take a session out of the registry and the index, with its resume token and, if asked, what it had
+    bool removeSession(const std::string& sessionId, std::string& token, SessionResumption::Retained* retained) {
+        Shard& shard = shards_[shardOf(sessionId)];
+        std::string released;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto handleIt = shard.handles.find(sessionId);
+            if (handleIt == shard.handles.end()) return false;
+            const util::Handle handle = toShardHandle(handleIt->second);
+            const auto& session = shard.sessions.find(handle)->session;
+            token = session->getResumeToken();
+            if (retained && session->getState() == UserSession::State::AUTHENTICATED) {
+                retained->username = session->getUsername();
+                for (const auto& documentId : session->getActiveDocuments()) {
+                    retained->acknowledged[documentId] = session->getAcknowledged(documentId);
+                }
+            }
+            if (session->getState() == UserSession::State::AUTHENTICATED) {
+                std::unique_lock<std::shared_mutex> usersLock(users_mutex_);
+                auto userIt = username_to_session_.find(session->getUsername());
+                if (userIt != username_to_session_.end() && userIt->second == sessionId) {
+                    released = userIt->first;
+                    username_to_session_.erase(userIt);
+                }
+            }
+            // Out of the index before the registry lets go of it
+            session->setMembership({});
+            for (const auto& documentId : session->getActiveDocuments()) {
+                membership_->remove(documentId, session.get());
+            }
+            session->setState(UserSession::State::DISCONNECTED);
+            shard.sessions.erase(handle);
+            shard.handles.erase(handleIt);
+        }
+        if (directory_ && !released.empty()) {
+            directory_->release(released, sessionId);
+        }
+        return true;
+    }
+    struct Entry {
+        std::shared_ptr<UserSession> session;
+        std::shared_ptr<SocketGuard> socket;
+    };
+    struct Shard {
+        util::HandleTable<Entry> sessions;
+        // Session ID to the session's handle, shard bits included
+        std::pmr::unordered_map<std::string, util::Handle> handles{&util::memoryResource(util::MemoryTag::SESSIONS)};
+        mutable std::shared_mutex mutex;
+
+        Entry* find(const std::string& sessionId) {
+            auto it = handles.find(sessionId);
+            return it != handles.end() ? sessions.find(toShardHandle(it->second)) : nullptr;
+        }
+        const Entry* find(const std::string& sessionId) const {
+            return const_cast<Shard*>(this)->find(sessionId);
+        }
+    };
+    static size_t shardOf(const std::string& sessionId) {
+        return std::hash<std::string>{}(sessionId) % SHARDS;
+    }
+    // Fold the shard into the low bits of a shard table's handle, keeping its generation
+    static util::Handle toHandle(util::Handle shardHandle, size_t shard) {
+        constexpr util::Handle INDEX_MASK = (util::Handle{1} << util::HandleTable<Entry>::INDEX_BITS) - 1;
+        return (shardHandle & ~INDEX_MASK) | ((shardHandle & INDEX_MASK) << SHARD_BITS) |
+               static_cast<util::Handle>(shard);
+    }
+    static util::Handle toShardHandle(util::Handle handle) {
+        constexpr util::Handle INDEX_MASK = (util::Handle{1} << util::HandleTable<Entry>::INDEX_BITS) - 1;
+        return (handle & ~INDEX_MASK) | ((handle & INDEX_MASK) >> SHARD_BITS);
+    }
+    std::array<Shard, SHARDS> shards_;
+    std::pmr::unordered_map<std::string, std::string> username_to_session_{
+        &util::memoryResource(util::MemoryTag::SESSIONS)};
+    mutable std::shared_mutex users_mutex_;
+    std::shared_ptr<DocumentMembership> membership_;
+    SessionResumption resumption_;
+    std::unique_ptr<SessionDirectory> directory_;
 };
 
 } // namespace server
@@ -0,0 +1,523 @@
+#ifndef COLLABORATIVE_EDITOR_THREAD_POOL_H
+#define COLLABORATIVE_EDITOR_THREAD_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common/util/metrics.h"
+#include "common/util/profiled_mutex.h"
+#include "common/util/thread_profiler.h"
+
+namespace collab {
+namespace server {
+
+/**
+ * Move-only callable with room for small captures inline
+ *
+ * Callables up to INLINE_SIZE bytes that move without throwing are stored
+ * in the task itself, so posting them allocates nothing; larger ones go to
+ * the heap, as in std::function.
+ */
+class Task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (fitsInline<Fn>()) {
+            ::new (static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+            ops_ = &INLINE_OPS<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HEAP_OPS<Fn>;
+        }
+    }
+
+    Task(Task&& other) noexcept {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const {
+        return ops_ != nullptr;
+    }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    // Whether a callable is stored without allocating
+    template <typename Fn>
+    static constexpr bool fitsInline() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Fn>
+    static constexpr Ops INLINE_OPS{
+        [](void* storage) { (*static_cast<Fn*>(storage))(); },
+        [](void* from, void* to) noexcept {
+            ::new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        },
+        [](void* storage) noexcept { static_cast<Fn*>(storage)->~Fn(); }};
+
+    template <typename Fn>
+    static constexpr Ops HEAP_OPS{
+        [](void* storage) { (**static_cast<Fn**>(storage))(); },
+        [](void* from, void* to) noexcept { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+        [](void* storage) noexcept { delete *static_cast<Fn**>(storage); }};
+
+    void moveFrom(Task& other) noexcept {
+        if (other.ops_) {
+            other.ops_->move(other.storage_, storage_);
+            ops_ = std::exchange(other.ops_, nullptr);
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+};
+
+/**
+ * Fixed-size Chase-Lev work-stealing deque
+ *
+ * The owning thread pushes and pops at the bottom without locking; other
+ * threads steal from the top with one compare-and-swap. Holds pointers,
+ * so a thief that loses a race never touches an item it did not get.
+ *
+ * @tparam T The item type, held by pointer
+ */
+template <typename T>
+class WorkStealingDeque {
+public:
+    /**
+     * @param capacity Most items held at once; rounded up to a power of two
+     */
+    explicit WorkStealingDeque(size_t capacity = 1024) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        ring_ = std::make_unique<std::atomic<T*>[]>(size);
+    }
+
+    // Owner only; false if full
+    bool push(T* item) {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        if (bottom - top > static_cast<int64_t>(mask_)) {
+            return false;
+        }
+        ring_[bottom & mask_].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only; the most recently pushed item, or nullptr
+    T* pop() {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = ring_[bottom & mask_].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // The last item; a thief may be taking it too
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread; the oldest item, or nullptr if empty or another thread got it first
+    T* steal() {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        T* item = ring_[top & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Approximate while other threads are pushing or stealing
+    size_t size() const {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::unique_ptr<std::atomic<T*>[]> ring_;
+    size_t mask_ = 0;
+};
+
+/**
+ * Work-stealing thread pool
+ *
+ * Each worker has its own deque. Tasks posted from a worker go on that
+ * worker's deque and are run newest first while they are hot in cache;
+ * idle workers steal the oldest from the others. Tasks posted from other
+ * threads, such as the I/O thread, go to a shared injection queue that
+ * workers take from in batches, so its lock is taken once per batch
+ * rather than once per task. Tasks posted from workers reuse the worker's
+ * task nodes and allocate nothing once the pool is warm, apart from
+ * callables too large for a Task's inline storage.
+ *
+ * A worker with nothing to do spins for a while, trying to steal, before
+ * it parks on a condition variable; posting only takes the parking lock
+ * when some worker is parked.
+ *
+ * The destructor runs every task already posted before the workers exit.
+ */
+class ThreadPool {
+public:
+    // Tasks a worker takes from the injection queue at a time
+    static constexpr size_t INJECT_BATCH = 32;
+    // Attempts to find work before a worker parks
+    static constexpr int SPIN_ROUNDS = 64;
+
+    /**
+     * @param numThreads Workers; at least one is started
+     * @param role Role the workers are named and profiled under
+     */
+    explicit ThreadPool(size_t numThreads, std::string role = "worker")
+        : role_(std::move(role)),
+          waitTime_(util::metrics().histogram("collab_thread_pool_wait_seconds",
+                                              "Time tasks wait in a thread pool before they start", {},
+                                              util::NANOSECONDS_PER_SECOND)) {
+        if (numThreads == 0) {
+            numThreads = 1;
+        }
+        std::cout << "Creating thread pool with " << numThreads << " worker threads" << std::endl;
+        workers_.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers_.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers_[i]->thread = std::thread([this, i] { run(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+            stop_.store(true);
+        }
+        park_cv_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Run a task on the pool, without a future to wait on
+     *
+     * An exception the task throws is reported and dropped. Tasks may
+     * still post more while the pool stops; they run before it is gone.
+     *
+     * @param task The task
+     * @throws std::runtime_error if the pool is stopping and the caller is not one of its workers
+     */
+    void post(Task task) {
+        Worker* self = currentWorker();
+        if (!self && stop_.load(std::memory_order_relaxed)) {
+            throw std::runtime_error("enqueue on stopped ThreadPool");
+        }
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+        const uint64_t posted = now();
+        bool queued = false;
+        if (self) {
+            TaskNode* node = self->acquireNode(std::move(task), posted);
+            queued = self->deque.push(node);
+            if (!queued) {
+                task = std::move(node->task);
+                self->releaseNode(node);
+            }
+        }
+        if (!queued) {
+            std::lock_guard<util::ProfiledMutex> lock(inject_mutex_);
+            inject_.push_back({std::move(task), posted});
+        }
+        wakeOne();
+    }
+
+    /**
+     * Run a function on the pool and get its result
+     *
+     * @param f The function
+     * @param args Its arguments
+     * @return A future for the result, or for the exception it threw
+     * @throws std::runtime_error if the pool is stopping and the caller is not one of its workers
+     */
+    template <class F, class... Args>
+    auto enqueue(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
+        using return_type = decltype(f(args...));
+        std::packaged_task<return_type()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> result = task.get_future();
+        post([task = std::move(task)]() mutable { task(); });
+        return result;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    // Tasks posted and not yet started
+    size_t queueSize() const {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct TaskNode {
+        Task task;
+        uint64_t posted = 0;  // When it was posted, for the wait time
+        TaskNode* next = nullptr;
+    };
+
+    // A task posted from outside the pool
+    struct Injected {
+        Task task;
+        uint64_t posted;
+    };
+
+    struct Worker {
+        // Nodes a worker keeps for reuse; more are freed
+        static constexpr size_t MAX_FREE_NODES = 1024;
+
+        WorkStealingDeque<TaskNode> deque;
+        std::thread thread;
+        TaskNode* free = nullptr;
+        size_t freeCount = 0;
+
+        ~Worker() {
+            while (free) {
+                delete std::exchange(free, free->next);
+            }
+        }
+
+        TaskNode* acquireNode(Task task, uint64_t posted) {
+            TaskNode* node;
+            if (free) {
+                node = std::exchange(free, free->next);
+                --freeCount;
+            } else {
+                node = new TaskNode;
+            }
+            node->task = std::move(task);
+            node->posted = posted;
+            return node;
+        }
+
+        void releaseNode(TaskNode* node) {
+            node->task.reset();
+            if (freeCount >= MAX_FREE_NODES) {
+                delete node;
+                return;
+            }
+            node->next = free;
+            free = node;
+            ++freeCount;
+        }
+    };
+
+    // The worker of this pool the calling thread is, if any
+    Worker* currentWorker() const {
+        return current_pool_ == this ? workers_[current_index_].get() : nullptr;
+    }
+
+    void run(size_t index) {
+        util::nameCurrentThread(role_, index);
+        current_pool_ = this;
+        current_index_ = index;
+        Worker& self = *workers_[index];
+        size_t victim = index;
+        for (;;) {
+            Task task;
+            for (int spin = 0; !task && spin < SPIN_ROUNDS; ++spin) {
+                task = findTask(self, index, victim);
+                if (!task) {
+                    std::this_thread::yield();
+                }
+            }
+            if (!task) {
+                if (!park()) {
+                    return;
+                }
+                continue;
+            }
+            try {
+                task();
+            } catch (const std::exception& e) {
+                std::cerr << "Thread pool task failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Thread pool task failed" << std::endl;
+            }
+        }
+    }
+
+    // Own deque first, then a batch from the injection queue, then the other workers
+    Task findTask(Worker& self, size_t index, size_t& victim) {
+        if (TaskNode* node = self.deque.pop()) {
+            return take(self, node);
+        }
+        if (Task task = takeInjected(self)) {
+            return task;
+        }
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            victim = (victim + 1) % workers_.size();
+            if (victim == index) {
+                continue;
+            }
+            if (TaskNode* node = workers_[victim]->deque.steal()) {
+                return take(self, node);
+            }
+        }
+        return Task();
+    }
+
+    Task take(Worker& self, TaskNode* node) {
+        Task task = std::move(node->task);
+        waitTime_.record(now() - node->posted);
+        self.releaseNode(node);
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    // Take a batch from the injection queue: run the first, keep the rest on the own deque
+    Task takeInjected(Worker& self) {
+        std::lock_guard<util::ProfiledMutex> lock(inject_mutex_);
+        if (inject_.empty()) {
+            return Task();
+        }
+        Task first = std::move(inject_.front().task);
+        waitTime_.record(now() - inject_.front().posted);
+        inject_.pop_front();
+        for (size_t i = 1; i < INJECT_BATCH && !inject_.empty(); ++i) {
+            TaskNode* node = self.acquireNode(std::move(inject_.front().task), inject_.front().posted);
+            if (!self.deque.push(node)) {
+                inject_.front().task = std::move(node->task);
+                self.releaseNode(node);
+                break;
+            }
+            inject_.pop_front();
+        }
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        if (!inject_.empty() || self.deque.size() > 0) {
+            // Others can steal what this worker took
+            wakeOne();
+        }
+        return first;
+    }
+
+    // Sleep until there may be work; false once the pool stops and no work is left
+    bool park() {
+        std::unique_lock<std::mutex> lock(park_mutex_);
+        parked_.fetch_add(1, std::memory_order_seq_cst);
+        park_cv_.wait(lock, [this] {
+            return pending_.load(std::memory_order_seq_cst) > 0 || stop_.load();
+        });
+        parked_.fetch_sub(1, std::memory_order_relaxed);
+        return pending_.load(std::memory_order_seq_cst) > 0 || !stop_.load();
+    }
+
+    void wakeOne() {
+        if (parked_.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+            park_cv_.notify_one();
+        }
+    }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static inline thread_local const ThreadPool* current_pool_ = nullptr;
+    static inline thread_local size_t current_index_ = 0;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::deque<Injected> inject_;
+    util::ProfiledMutex inject_mutex_{"thread_pool_inject"};
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> parked_{0};
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+    std::atomic<bool> stop_{false};
+    const std::string role_;
+    util::Histogram& waitTime_;
+};
+
+} // namespace server
+} // namespace collab
+
+#endif // COLLABORATIVE_EDITOR_THREAD_POOL_H
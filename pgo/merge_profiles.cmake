@@ -0,0 +1,15 @@
+# Merge the raw profiles a Clang-instrumented run wrote into the one file -fprofile-use reads
+# Run as: cmake -DLLVM_PROFDATA=<llvm-profdata> -DPROFILE_DIR=<dir> -P merge_profiles.cmake
+file(GLOB RAW_PROFILES "${PROFILE_DIR}/*.profraw")
+if(NOT RAW_PROFILES)
+    message(FATAL_ERROR "No raw profiles in ${PROFILE_DIR}; was the training run built with PGO_MODE=GENERATE?")
+endif()
+
+execute_process(
+    COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIR}/default.profdata ${RAW_PROFILES}
+    RESULT_VARIABLE MERGE_RESULT
+)
+if(NOT MERGE_RESULT EQUAL 0)
+    message(FATAL_ERROR "llvm-profdata merge failed")
+endif()
+file(REMOVE ${RAW_PROFILES})
@@ -0,0 +1,454 @@
+// FILE: pgo/pgo_training.cpp
+// Description: Training workload for profile-guided builds of the server's hot paths
+//
+// Usage: pgo_training [--rounds=N] [--seed=N]
+//
+// Run by the pgo-train target of a PGO_MODE=GENERATE build, whose profile a
+// PGO_MODE=USE build of the same tree then optimizes with. The workload is
+// what a busy node spends its time on, in three phases:
+//
+//   edits     Edit traces replayed through OperationManager and
+//             DocumentController as the server applies them: keystrokes,
+//             pastes and deletions from clients at their own, often stale,
+//             revisions, so that transforms both step through the log and
+//             compose far-behind suffixes.
+//   codecs    Every message of the protocol corpus encoded and decoded, as
+//             JSON and as negotiated binary frames, compressed and not.
+//   pipeline  Edits sent over loopback TCP through MessageChannel, in both
+//             framings, applied by the server side and fanned out to every
+//             client.
+//
+// Everything is generated from the seed and sized by the rounds alone, never
+// by a clock: two runs with the same arguments apply the same edits and send
+// the same messages, and only the interleaving of the pipeline's threads
+// varies, so profiles from different build machines agree.
+
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include "common/network/tcp_connection.h"
+#include "common/ot/operation.h"
+#include "common/protocol/protocol.h"
+#include "common/protocol/wire_codec.h"
+#include "common/util/logger.h"
+#include "fuzz/protocol_corpus.h"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace collab;
+using network::TcpConnection;
+
+struct Options {
+    size_t rounds = 5;
+    uint32_t seed = 1;
+
+    static Options parse(int argc, char** argv) {
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg(argv[i]);
+            if (arg.rfind("--rounds=", 0) == 0) {
+                options.rounds = number<size_t>(arg.substr(9), arg);
+            } else if (arg.rfind("--seed=", 0) == 0) {
+                options.seed = number<uint32_t>(arg.substr(7), arg);
+            } else {
+                throw std::invalid_argument("Unknown argument " + std::string(arg));
+            }
+        }
+        if (options.rounds == 0) {
+            throw std::invalid_argument("--rounds must be at least 1");
+        }
+        return options;
+    }
+
+private:
+    template <typename T>
+    static T number(std::string_view value, std::string_view arg) {
+        T result{};
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            throw std::invalid_argument("Invalid value in " + std::string(arg));
+        }
+        return result;
+    }
+};
+
+// The shape of one trace: how its clients type
+struct TraceShape {
+    const char* name;
+    size_t clients;
+    size_t edits;
+    size_t maxLag;          // Revisions a client may be behind when it sends
+    double deleteRatio;
+    size_t pasteEvery;      // Every nth insert is a paste; 0 for none
+};
+
+constexpr TraceShape TRACE_SHAPES[] = {
+    {"typing", 2, 4000, 2, 0.15, 0},
+    {"meeting-notes", 12, 6000, 24, 0.2, 50},
+    {"far-behind", 4, 3000, 200, 0.25, 20},
+};
+
+// One virtual client's random edit against a document of the given length
+ot::OperationPtr randomEdit(std::mt19937& random, const TraceShape& shape, size_t length, size_t sent) {
+    if (length > 0 && std::uniform_real_distribution<double>(0, 1)(random) < shape.deleteRatio) {
+        const size_t position = std::uniform_int_distribution<size_t>(0, length - 1)(random);
+        const size_t deleted = std::min<size_t>(length - position, 1 + random() % 8);
+        return std::make_shared<ot::DeleteOperation>(position, deleted);
+    }
+    const size_t position = std::uniform_int_distribution<size_t>(0, length)(random);
+    if (shape.pasteEvery > 0 && sent % shape.pasteEvery == 0) {
+        return std::make_shared<ot::InsertOperation>(position, std::string(256 + random() % 2048, 'p'));
+    }
+    return std::make_shared<ot::InsertOperation>(position, std::string(1, static_cast<char>('a' + random() % 26)));
+}
+
+// Replay each trace shape as the server applies edits, acknowledging and compacting as clients catch up
+uint64_t replayEditTraces(const Options& options) {
+    uint64_t applied = 0;
+    for (size_t round = 0; round < options.rounds; ++round) {
+        for (const TraceShape& shape : TRACE_SHAPES) {
+            std::mt19937 random(options.seed + static_cast<uint32_t>(round));
+            DocumentController document(std::string(16 * 1024, 'x'));
+            OperationManager manager(10000);
+            std::vector<int64_t> synced(shape.clients, 0);
+            std::vector<size_t> lengths{16 * 1024};    // By revision
+
+            for (size_t sent = 0; sent < shape.edits; ++sent) {
+                const size_t client = sent % shape.clients;
+                const std::string clientId = "client-" + std::to_string(client);
+                const int64_t head = document.getRevision();
+                // A client edits the document as of the revision it last heard of
+                synced[client] = std::max(synced[client], head - static_cast<int64_t>(random() % (shape.maxLag + 1)));
+                auto op = randomEdit(random, shape, lengths[static_cast<size_t>(synced[client])], sent);
+                auto transformed = manager.processOperation(op, clientId, synced[client]);
+                if (transformed && document.applyOperation(transformed, clientId)) {
+                    manager.recordOperation(transformed);
+                    lengths.push_back(document.getSnapshot().content.length());
+                    ++applied;
+                }
+                if (sent % 256 == 0) {
+                    document.compactBefore(manager.acknowledgeRevision(clientId, document.getRevision()));
+                }
+            }
+        }
+    }
+    return applied;
+}
+
+// Encode and decode the whole protocol corpus both ways, plain and compressed
+uint64_t exerciseCodecs(const Options& options) {
+    const auto corpus = fuzz::protocolCorpus(64 * 1024);
+    uint64_t bytes = 0;
+    for (size_t round = 0; round < options.rounds; ++round) {
+        protocol::WireCodec client;
+        protocol::WireCodec server;
+        // Odd rounds also deflate the frames that are large enough
+        client.setCompression(round % 2 == 1);
+        server.setCompression(round % 2 == 1);
+        fuzz::negotiateBinary(client, server);
+        for (size_t i = 0; i < 200; ++i) {
+            for (const fuzz::CorpusEntry& entry : corpus) {
+                const std::string json = entry.message->toString();
+                protocol::Message::fromString(json);
+                const std::string frame = client.encode(*entry.message);
+                server.decode(frame);
+                bytes += json.size() + frame.size();
+            }
+        }
+    }
+    return bytes;
+}
+
+// Keeps the banner TcpServer::start() prints out of the training output
+class QuietStdout {
+public:
+    QuietStdout() : previous_(std::cout.rdbuf(&discard_)) {}
+    ~QuietStdout() { std::cout.rdbuf(previous_); }
+
+private:
+    struct Discard : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+
+    Discard discard_;
+    std::streambuf* previous_;
+};
+
+// An io_context running on a thread of its own until stopped or destroyed
+class IoThread {
+public:
+    IoThread() : guard_(boost::asio::make_work_guard(io_)), thread_([this] { io_.run(); }) {}
+
+    ~IoThread() {
+        stop();
+    }
+
+    // Stop running handlers; those still queued are dropped
+    void stop() {
+        guard_.reset();
+        io_.stop();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    boost::asio::io_context& context() { return io_; }
+
+private:
+    boost::asio::io_context io_;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> guard_;
+    std::thread thread_;
+};
+
+// Counts down to zero and wakes whoever waits for it
+class Countdown {
+public:
+    void reset(uint64_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remaining_ = count;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (remaining_ > 0 && --remaining_ == 0) {
+            zero_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        zero_.wait(lock, [this] { return remaining_ == 0; });
+    }
+
+private:
+    uint64_t remaining_ = 0;
+    std::mutex mutex_;
+    std::condition_variable zero_;
+};
+
+/**
+ * Clients editing one document on a server over loopback
+ *
+ * The server side decodes each edit, transforms it with an OperationManager,
+ * applies it and sends every client an EDIT_APPLY with the new revision, the
+ * way a node fans out an edit; the clients send their next edits at the
+ * revision they last heard of.
+ */
+template <typename Codec>
+class Pipeline {
+public:
+    using Channel = network::MessageChannel<protocol::Message, Codec>;
+    static constexpr bool BINARY = std::is_same_v<Codec, protocol::WireCodec>;
+    static constexpr size_t CLIENTS = 8;
+
+    Pipeline() : server_(serverIo_.context(), 0), document_(std::string(16 * 1024, 'x')) {
+        constexpr auto mode = BINARY ? TcpConnection::frame_mode::length_prefixed
+                                     : TcpConnection::frame_mode::newline_delimited;
+        server_.set_connection_handler([this, mode](TcpConnection::pointer connection) {
+            connection->set_frame_mode(mode);
+            auto channel = std::make_shared<Channel>(connection);
+            if constexpr (BINARY) {
+                protocol::WireCodec client;
+                fuzz::negotiateBinary(client, channel->codec());
+            }
+            channel->set_message_handler([this](typename Channel::pointer, const protocol::Message& message) {
+                serve(message);
+            });
+            server_.handshake_done(connection);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                serverChannels_.push_back(std::move(channel));
+            }
+            connected_.done();
+        });
+        // Fan-out is many small frames, which the server sends as they come
+        server_.set_socket_tuning({true, true, 0});
+        {
+            QuietStdout quiet;
+            server_.start();
+        }
+
+        connected_.reset(2 * CLIENTS);
+        const std::string port = std::to_string(server_.port());
+        for (size_t i = 0; i < CLIENTS; ++i) {
+            auto connector = std::make_unique<network::TcpClient>(clientIo_.context());
+            connector->set_connection_handler([this, mode](TcpConnection::pointer connection) {
+                connection->set_frame_mode(mode);
+                connection->socket().set_option(boost::asio::ip::tcp::no_delay(true));
+                auto channel = std::make_shared<Channel>(connection);
+                if constexpr (BINARY) {
+                    protocol::WireCodec server;
+                    fuzz::negotiateBinary(channel->codec(), server);
+                }
+                channel->set_message_handler([this](typename Channel::pointer, const protocol::Message& message) {
+                    if (const auto* applied = dynamic_cast<const protocol::EditMessage*>(&message)) {
+                        heard_.store(static_cast<int64_t>(applied->documentVersion), std::memory_order_relaxed);
+                    }
+                    delivered_.done();
+                });
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    clients_.push_back(connection);
+                    clientChannels_.push_back(std::move(channel));
+                }
+                connected_.done();
+            });
+            connector->connect("127.0.0.1", port);
+            connectors_.push_back(std::move(connector));
+        }
+        connected_.wait();
+    }
+
+    // Closes each side on its own thread, as its reads may be closing it too, then stops both
+    // before anything their handlers use is destroyed
+    ~Pipeline() {
+        QuietStdout quiet;
+        onThread(clientIo_, [this] {
+            for (auto& client : clients_) {
+                client->close();
+            }
+        });
+        onThread(serverIo_, [this] { server_.stop(); });
+        clientIo_.stop();
+        serverIo_.stop();
+    }
+
+    // Send edits in bursts, each burst fanned out to every client before the next
+    uint64_t run(std::mt19937& random, size_t bursts) {
+        const TraceShape& shape = TRACE_SHAPES[1];
+        size_t sent = 0;
+        for (size_t burst = 0; burst < bursts; ++burst) {
+            delivered_.reset(CLIENTS * CLIENTS * 4);
+            for (size_t i = 0; i < 4; ++i) {
+                for (const auto& channel : clientChannels_) {
+                    protocol::EditMessage edit(protocol::MessageType::EDIT_INSERT);
+                    edit.documentId = "training";
+                    edit.documentVersion = static_cast<uint64_t>(heard_.load(std::memory_order_relaxed));
+                    edit.operationId = "op-" + std::to_string(sent);
+                    auto op = randomEdit(random, shape, 16 * 1024, ++sent);
+                    if (const auto* erase = dynamic_cast<const ot::DeleteOperation*>(op.get())) {
+                        edit.type = protocol::MessageType::EDIT_DELETE;
+                        edit.position = erase->getPosition();
+                        edit.length = erase->getLength();
+                    } else {
+                        const auto& insert = static_cast<const ot::InsertOperation&>(*op);
+                        edit.position = insert.getPosition();
+                        edit.text = insert.getText();
+                    }
+                    channel->send_message(edit);
+                }
+            }
+            delivered_.wait();
+        }
+        return sent;
+    }
+
+private:
+    template <typename Function>
+    static void onThread(IoThread& thread, Function function) {
+        std::promise<void> done;
+        boost::asio::post(thread.context(), [&] {
+            function();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+
+    // Apply an edit on the server's I/O thread and tell every client of the revision it made
+    void serve(const protocol::Message& message) {
+        const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message);
+        if (!edit) {
+            return;
+        }
+        ot::OperationPtr op;
+        if (edit->type == protocol::MessageType::EDIT_DELETE) {
+            op = std::make_shared<ot::DeleteOperation>(edit->position.value_or(0), edit->length.value_or(0));
+        } else {
+            op = std::make_shared<ot::InsertOperation>(edit->position.value_or(0), edit->text.value_or(""));
+        }
+        auto transformed = manager_.processOperation(op, edit->clientId, static_cast<int64_t>(edit->documentVersion));
+        if (transformed && document_.applyOperation(transformed, edit->clientId)) {
+            manager_.recordOperation(transformed);
+        }
+
+        protocol::EditMessage applied(protocol::MessageType::EDIT_APPLY);
+        applied.documentId = edit->documentId;
+        applied.operationId = edit->operationId;
+        applied.documentVersion = static_cast<uint64_t>(document_.getRevision());
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& channel : serverChannels_) {
+            channel->send_message(applied);
+        }
+    }
+
+    IoThread serverIo_;
+    IoThread clientIo_;
+    network::TcpServer server_;
+    DocumentController document_;
+    OperationManager manager_;
+    Countdown connected_;
+    Countdown delivered_;
+    std::atomic<int64_t> heard_{0};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<network::TcpClient>> connectors_;
+    std::vector<TcpConnection::pointer> clients_;
+    std::vector<typename Channel::pointer> serverChannels_;
+    std::vector<typename Channel::pointer> clientChannels_;
+};
+
+uint64_t exercisePipeline(const Options& options) {
+    // Every connect, accept and close logs a line otherwise
+    util::getLogger().setLogLevel(util::LogLevel::ERROR);
+    std::mt19937 random(options.seed);
+    uint64_t sent = 0;
+    {
+        Pipeline<network::TextCodec<protocol::Message>> text;
+        sent += text.run(random, 200 * options.rounds);
+    }
+    {
+        Pipeline<protocol::WireCodec> binary;
+        sent += binary.run(random, 200 * options.rounds);
+    }
+    return sent;
+}
+
+// Runs a phase and prints what it did and how long it took
+template <typename Phase>
+void run(const char* name, const char* unit, Phase phase) {
+    const auto started = std::chrono::steady_clock::now();
+    const uint64_t count = phase();
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << name << ": " << count << " " << unit << " in " << elapsed << " s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const Options options = Options::parse(argc, argv);
+        run("edits", "operations applied", [&] { return replayEditTraces(options); });
+        run("codecs", "bytes encoded", [&] { return exerciseCodecs(options); });
+        run("pipeline", "edits sent", [&] { return exercisePipeline(options); });
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "pgo_training: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,4 +1,504 @@
-#include <iostream>
-namespace collab { namespace client {
-void document_client_placeholder() { std::cout << "Document client placeholder" << std::endl; }
-}} // namespace collab::client
+#include "document_client.h"
+#include "client/network/client_manager.h"
+#include <stdexcept>
+#include <variant>
+
+namespace collab {
+namespace client {
+
+namespace {
+
+// The edit message carrying a single insert, delete or replace
+protocol::EditMessage toEditMessage(const ot::Operation& op) {
+    switch (op.getKind()) {
+        case ot::OperationKind::INSERT: {
+            const auto& insert = static_cast<const ot::InsertOperation&>(op);
+            protocol::EditMessage edit(protocol::MessageType::EDIT_INSERT);
+            edit.position = insert.getPosition();
+            edit.text = insert.getText();
+            return edit;
+        }
+        case ot::OperationKind::DELETE: {
+            const auto& remove = static_cast<const ot::DeleteOperation&>(op);
+            protocol::EditMessage edit(protocol::MessageType::EDIT_DELETE);
+            edit.position = remove.getPosition();
+            edit.length = remove.getLength();
+            return edit;
+        }
+        case ot::OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ot::ReplaceOperation&>(op);
+            protocol::EditMessage edit(protocol::MessageType::EDIT_REPLACE);
+            edit.position = replace.getPosition();
+            edit.length = replace.getLength();
+            edit.text = replace.getText();
+            return edit;
+        }
+        case ot::OperationKind::COMPOSITE:
+        default:
+            throw std::invalid_argument("A composite operation is sent as an EDIT_BULK");
+    }
+}
+
+// The operation an edit message from the server carries, nullptr if it carries none
+ot::OperationPtr fromEditMessage(const protocol::EditMessage& edit) {
+    if (!edit.position) {
+        return nullptr;
+    }
+    switch (edit.type) {
+        case protocol::MessageType::EDIT_INSERT:
+            return edit.text ? std::make_shared<ot::InsertOperation>(*edit.position, *edit.text) : nullptr;
+        case protocol::MessageType::EDIT_DELETE:
+            return edit.length ? std::make_shared<ot::DeleteOperation>(*edit.position, *edit.length) : nullptr;
+        case protocol::MessageType::EDIT_REPLACE:
+            return edit.length && edit.text
+                ? std::make_shared<ot::ReplaceOperation>(*edit.position, *edit.length, *edit.text)
+                : nullptr;
+        default:
+            return nullptr;
+    }
+}
+
+} // namespace
+
+DocumentClient::DocumentClient(const std::string& initialContent)
+    : editor_(initialContent),
+      connected_(false),
+      sync_(0, initialContent.size()) {
+    editor_.setOperationCallback([this](const ot::OperationPtr& op, int64_t version) {
+        handleLocalOperation(op, version);
+    });
+    editor_.setContentCallback([this](const std::string& content) {
+        if (contentCallback_) {
+            contentCallback_(content);
+        }
+    });
+    sync_.setSendCallback([this](const ot::OperationPtr& op, int64_t revision) {
+        sendOperation(op, revision);
+    });
+}
+
+DocumentClient::~DocumentClient() {
+    // The stream's handler refers to this client
+    disconnect();
+}
+
+void DocumentClient::setCallbacks(ContentCallback contentCallback, StatusCallback statusCallback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    contentCallback_ = std::move(contentCallback);
+    statusCallback_ = std::move(statusCallback);
+}
+
+void DocumentClient::setOperationCallback(OperationCallback operationCallback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    operationCallback_ = std::move(operationCallback);
+}
+
+bool DocumentClient::connect(ClientManager& manager, const std::string& documentId) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (manager_) {
+            return false;
+        }
+    }
+    if (!manager.streams().open(documentId, [this](const protocol::Message& message) {
+            std::string json = message.toString();
+            // Applied by applyRemoteOperations(), without waiting for the UI thread here
+            if (remoteOperations_) {
+                remoteOperations_->push(std::move(json));
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            processRemoteOperation(json);
+        })) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    manager_ = &manager;
+    documentId_ = documentId;
+    connected_ = true;
+
+    // The server answers with the document; anything unconfirmed is sent again then
+    protocol::DocumentMessage open(protocol::MessageType::DOC_OPEN);
+    open.documentId = documentId;
+    manager.sendOnStream(documentId, open);
+    setStatus("Opening " + documentId);
+    return true;
+}
+
+bool DocumentClient::connect(const std::string& host, const std::string& port) {
+    int portNumber = 0;
+    try {
+        portNumber = std::stoi(port);
+    } catch (const std::exception&) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        setStatus("Invalid port: " + port);
+        return false;
+    }
+
+    // Opened first, so the DOC_OPEN waits on the stream while the connection is retried
+    ClientManager& manager = ClientManager::getInstance();
+    if (!connect(manager, SERVER_DOCUMENT_ID)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ownsConnection_ = true;
+    }
+
+    if (!manager.connect(host, portNumber)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        setStatus("Cannot reach " + host + ":" + port + ", retrying");
+        return false;
+    }
+    return true;
+}
+
+void DocumentClient::disconnect() {
+    ClientManager* owned = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!manager_) {
+            return;
+        }
+        manager_->streams().close(documentId_);
+        if (ownsConnection_) {
+            owned = manager_;
+        }
+        manager_ = nullptr;
+        ownsConnection_ = false;
+        connected_ = false;
+        setStatus("Disconnected");
+    }
+
+    // Outside the lock: stopping joins the network thread, which may be waiting for it
+    if (owned) {
+        owned->disconnect();
+    }
+}
+
+bool DocumentClient::insert(size_t position, const std::string& text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return editor_.insert(position, text);
+}
+
+bool DocumentClient::deleteText(size_t position, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return editor_.deleteText(position, length);
+}
+
+bool DocumentClient::undo() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return editor_.undo();
+}
+
+bool DocumentClient::redo() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return editor_.redo();
+}
+
+bool DocumentClient::canUndo() const {
+    return editor_.canUndo();
+}
+
+bool DocumentClient::canRedo() const {
+    return editor_.canRedo();
+}
+
+std::string DocumentClient::getContent() const {
+    return editor_.getContent();
+}
+
+bool DocumentClient::isConnected() const {
+    return connected_;
+}
+
+void DocumentClient::setCoalescingPolicy(const ot::CoalescingPolicy& policy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    coalescer_.setPolicy(policy);
+    if (coalescer_.shouldFlush()) {
+        flushPendingLocked();
+    }
+}
+
+void DocumentClient::flushPending(bool force) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!force && !coalescer_.shouldFlush()) {
+        return;
+    }
+    flushPendingLocked();
+}
+
+void DocumentClient::flushPendingLocked() {
+    if (coalescer_.empty()) {
+        return;
+    }
+    try {
+        for (const auto& op : coalescer_.flush()) {
+            sync_.applyClient(*op);
+        }
+    } catch (const std::invalid_argument& e) {
+        setStatus(std::string("Local edit out of step with the document: ") + e.what());
+    }
+}
+
+bool DocumentClient::setOfflineJournal(const std::string& path) {
+    std::shared_ptr<ot::OfflineJournal> journal;
+    try {
+        journal = std::make_shared<ot::OfflineJournal>(path);
+    } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        setStatus(std::string("Cannot open offline journal: ") + e.what());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushPendingLocked();
+
+    // Edits kept by an earlier run, taken up if the document is where they started
+    if (!journal->empty() && sync_.getState() == ot::ClientSync::State::SYNCHRONIZED &&
+        sync_.getRevision() == journal->baseRevision() && sync_.getDocumentLength() == journal->baseLength()) {
+        ot::OperationPtr recovered = journal->pending()->toOperation();
+        // Not undoable: they belong to a session that is over
+        if (editor_.handleRemoteOperation(recovered, journal->baseRevision()) && sync_.restore(*journal)) {
+            if (operationCallback_) {
+                operationCallback_(recovered);
+            }
+            setStatus("Recovered unconfirmed edits");
+        }
+    }
+
+    // Starts the file over from what is unconfirmed now
+    journal_ = journal;
+    try {
+        sync_.setJournal(journal_);
+    } catch (const std::exception& e) {
+        journal_.reset();
+        sync_.setJournal(nullptr);
+        setStatus(std::string("Cannot write offline journal: ") + e.what());
+        return false;
+    }
+    return true;
+}
+
+void DocumentClient::setRemoteWakeup(std::function<void()> wake) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    remoteOperations_ = std::make_unique<util::HandoffQueue<std::string>>(REMOTE_QUEUE_CAPACITY, std::move(wake), [this]() {
+        // Called by applyRemoteOperations() with mutex_ held, once it has made room
+        if (manager_) {
+            manager_->postToNetwork([this]() { remoteOperations_->retry(); });
+        }
+    });
+}
+
+size_t DocumentClient::applyRemoteOperations() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!remoteOperations_) {
+        return 0;
+    }
+
+    std::vector<std::string> messages;
+    remoteOperations_->drain([&](std::string json) { messages.push_back(std::move(json)); });
+
+    // Another client's edits up to the next ack or document are applied as one
+    std::vector<ot::OperationPtr> run;
+    size_t applied = 0;
+    for (const auto& json : messages) {
+        applied += processRemoteOperation(json, &run);
+    }
+    return applied + applyRemoteRun(run);
+}
+
+void DocumentClient::handleLocalOperation(const ot::OperationPtr& operation, int64_t /*version*/) {
+    if (operationCallback_) {
+        operationCallback_(operation);
+    }
+    coalescer_.push(operation);
+
+    // A full buffer goes out now; otherwise it waits for the flush window, see flushPending()
+    if (coalescer_.shouldFlush()) {
+        flushPendingLocked();
+    }
+}
+
+void DocumentClient::sendOperation(const ot::OperationPtr& operation, int64_t revision) {
+    // Offline, the operation stays in flight and goes out when the document is opened
+    if (!manager_) {
+        return;
+    }
+
+    const uint64_t sequence = ++sequence_;
+    auto address = [&](protocol::EditMessage& edit) {
+        edit.documentId = documentId_;
+        edit.documentVersion = static_cast<uint64_t>(revision);
+        edit.sequenceNumber = sequence;
+        edit.operationId = std::to_string(sequence);
+    };
+
+    if (operation->getKind() != ot::OperationKind::COMPOSITE) {
+        protocol::EditMessage edit = toEditMessage(*operation);
+        address(edit);
+        manager_->sendOnStream(documentId_, edit);
+        return;
+    }
+
+    // Edits in several places go as one EDIT_BULK, which the server applies as one revision
+    protocol::BatchMessage bulk(protocol::MessageType::EDIT_BULK);
+    bulk.sequenceNumber = sequence;
+    for (const auto& part : static_cast<const ot::CompositeOperation&>(*operation).getOperations()) {
+        protocol::EditMessage edit = toEditMessage(*part);
+        address(edit);
+        bulk.add(edit);
+    }
+    manager_->sendOnStream(documentId_, bulk);
+}
+
+size_t DocumentClient::processRemoteOperation(const std::string& json, std::vector<ot::OperationPtr>* run) {
+    size_t applied = 0;
+    // Another client's edit joins the run; anything else comes after it
+    auto remote = [&](const ot::OperationPtr& op) {
+        if (run) {
+            run->push_back(op);
+        } else {
+            applied += applyRemote(op);
+        }
+    };
+    auto other = [&]() {
+        if (run) {
+            applied += applyRemoteRun(*run);
+        }
+    };
+
+    try {
+        std::visit([&](const auto& message) {
+            using T = std::decay_t<decltype(message)>;
+            if constexpr (std::is_same_v<T, protocol::DocumentMessage>) {
+                if (message.type == protocol::MessageType::DOC_RESPONSE) {
+                    other();
+                    loadDocument(message);
+                }
+            } else if constexpr (std::is_same_v<T, protocol::EditMessage>) {
+                if (message.type == protocol::MessageType::EDIT_APPLY || message.type == protocol::MessageType::EDIT_REJECT) {
+                    other();
+                }
+                if (message.type == protocol::MessageType::EDIT_APPLY) {
+                    if (message.success.value_or(true)) {
+                        processServerAck();
+                    } else {
+                        setStatus("Edit not applied: " + message.errorMessage.value_or("unknown error"));
+                    }
+                } else if (message.type == protocol::MessageType::EDIT_REJECT) {
+                    setStatus("Edit rejected: " + message.errorMessage.value_or("unknown error"));
+                } else if (auto op = fromEditMessage(message)) {
+                    remote(op);
+                }
+            } else if constexpr (std::is_same_v<T, protocol::BatchMessage>) {
+                if (message.type != protocol::MessageType::EDIT_BULK) {
+                    return;
+                }
+                auto composite = std::make_shared<ot::CompositeOperation>();
+                for (const auto& part : message.messages) {
+                    const auto* edit = dynamic_cast<const protocol::EditMessage*>(part.get());
+                    auto op = edit ? fromEditMessage(*edit) : nullptr;
+                    if (!op) {
+                        return;
+                    }
+                    composite->addOperation(op);
+                }
+                remote(composite);
+            }
+        }, protocol::Message::fromString(json));
+    } catch (const std::exception& e) {
+        setStatus(std::string("Dropped a message from the server: ") + e.what());
+    }
+    return applied;
+}
+
+size_t DocumentClient::applyRemote(const ot::OperationPtr& operation) {
+    // sync_ transforms remote operations past what it knows of, so it is told of every local edit first
+    flushPendingLocked();
+    try {
+        ot::OperationPtr local = sync_.applyServer(*operation);
+        if (!editor_.handleRemoteOperation(local, sync_.getRevision())) {
+            return 0;
+        }
+        if (operationCallback_) {
+            operationCallback_(local);
+        }
+        return 1;
+    } catch (const std::invalid_argument& e) {
+        setStatus(std::string("Remote edit out of step with the document: ") + e.what());
+        return 0;
+    }
+}
+
+size_t DocumentClient::applyRemoteRun(std::vector<ot::OperationPtr>& run) {
+    if (run.empty()) {
+        return 0;
+    }
+    std::vector<ot::OperationPtr> operations;
+    operations.swap(run);
+
+    flushPendingLocked();
+    try {
+        // One transform past what is unconfirmed, one change to the content
+        ot::OperationPtr local = sync_.applyServerBatch(operations);
+        if (!editor_.handleRemoteOperation(local, sync_.getRevision())) {
+            return 0;
+        }
+        if (operationCallback_) {
+            operationCallback_(local);
+        }
+        return operations.size();
+    } catch (const std::invalid_argument& e) {
+        setStatus(std::string("Remote edits out of step with the document: ") + e.what());
+        return 0;
+    }
+}
+
+void DocumentClient::processServerAck() {
+    // Acks are cumulative; one that arrives with nothing in flight confirms nothing new
+    if (sync_.getState() == ot::ClientSync::State::SYNCHRONIZED) {
+        return;
+    }
+    sync_.serverAck();
+}
+
+void DocumentClient::loadDocument(const protocol::DocumentMessage& response) {
+    if (!response.success.value_or(true)) {
+        setStatus("Cannot open " + response.documentId + ": " + response.errorMessage.value_or("unknown error"));
+        return;
+    }
+    if (!response.documentContent) {
+        return;
+    }
+
+    // Unconfirmed edits are based on a revision the server has; they go out again
+    flushPendingLocked();
+    if (sync_.getState() != ot::ClientSync::State::SYNCHRONIZED) {
+        sync_.resend();
+        setStatus("Opened " + response.documentId + ", resending unconfirmed edits");
+        return;
+    }
+
+    const std::string& content = *response.documentContent;
+    const int64_t revision = static_cast<int64_t>(response.documentVersion.value_or(0));
+    const std::string previous = editor_.getContent();
+    editor_.restoreFromSnapshot(ot::DocumentState(content, revision));
+    sync_.reset(revision, content.size());
+
+    // To whoever mirrors the content, the server's copy replaces the local one
+    if (content != previous && operationCallback_) {
+        operationCallback_(std::make_shared<ot::ReplaceOperation>(0, previous.size(), content, previous));
+    }
+    setStatus("Opened " + response.documentId);
+}
+
+void DocumentClient::setStatus(const std::string& message) {
+    if (statusCallback_) {
+        statusCallback_(message);
+    }
+}
+
+} // namespace client
+} // namespace collab
@@ -1,19 +1,44 @@
 #pragma once
 
+#include "../common/ot/client_sync.h"
 #include "../common/ot/editor.h"
+#include "../common/ot/operation_coalescer.h"
+#include "common/util/handoff_queue.h"
+#include <atomic>
 #include <string>
 #include <mutex>
 #include <optional>
 #include <functional>
-#include <deque>
+#include <memory>
 #include <vector>
 
 namespace collab {
+namespace protocol {
+struct DocumentMessage;
+}
+
 namespace client {
 
+class ClientManager;
+
 /**
  * A client for editing documents with undo/redo functionality
  * Wraps the OT editor with network capabilities
+ * 
+ * At most one operation is in flight to the server; edits made while it
+ * is unconfirmed are composed into one buffered operation, sent on the ack
+ * (see ot::ClientSync).
+ * 
+ * With an offline journal, unconfirmed edits are also kept on disk. Edits
+ * made offline compose into one operation there, which is sent as a
+ * single edit on reconnect, also after a crash.
+ * 
+ * On the wire the document is opened with a DOC_OPEN, answered by a
+ * DOC_RESPONSE carrying its content and revision. Each operation goes as
+ * an EDIT_INSERT, EDIT_DELETE or EDIT_REPLACE based on the revision in
+ * documentVersion, or as an EDIT_BULK of them if it edits several places.
+ * The server confirms it with an EDIT_APPLY and sends the edits of other
+ * clients the same way, in the order it applied them.
  */
 class DocumentClient {
 public:
@@ -27,6 +52,16 @@ public:
      */
     using StatusCallback = std::function<void(const std::string&)>;
     
+    /**
+     * Callback for each operation applied to the content, local or remote
+     */
+    using OperationCallback = std::function<void(const ot::OperationPtr&)>;
+    
+    /**
+     * The document connect(host, port) opens, the one the server edits
+     */
+    static constexpr const char* SERVER_DOCUMENT_ID = "document";
+    
     /**
      * Constructor
      * 
@@ -36,8 +71,9 @@ public:
     
     /**
      * Destructor
+     * Closes the document's stream
      */
-    ~DocumentClient() = default;
+    ~DocumentClient();
     
     /**
      * Set callbacks for document changes and status updates
@@ -48,7 +84,19 @@ public:
     void setCallbacks(ContentCallback contentCallback, StatusCallback statusCallback);
     
     /**
-     * Connect to a collaborative editing server
+     * Set a callback for every operation applied to the content
+     * Called in the order the operations were applied, on the thread that
+     * applied them, so a view can mirror the content edit by edit
+     * 
+     * @param operationCallback Called after each operation is applied
+     */
+    void setOperationCallback(OperationCallback operationCallback);
+    
+    /**
+     * Connect to a collaborative editing server and open its document
+     * The document is opened on ClientManager's shared connection, which keeps
+     * retrying if the server cannot be reached; the edits made meanwhile are
+     * sent once it is
      * 
      * @param host Server hostname
      * @param port Server port
@@ -56,6 +104,17 @@ public:
      */
     bool connect(const std::string& host, const std::string& port);
     
+    /**
+     * Open the document as a stream of a shared connection instead of a connection of its own
+     * The connection, its handshake and its heartbeat are shared with every
+     * other document opened this way (see ClientManager::streams())
+     * 
+     * @param manager The shared connection
+     * @param documentId The document to open
+     * @return False if the document is already open on that connection
+     */
+    bool connect(ClientManager& manager, const std::string& documentId);
+    
     /**
      * Disconnect from server
      */
@@ -120,22 +179,96 @@ public:
      * @return True if connected to server
      */
     bool isConnected() const;
+    
+    /**
+     * Configure how local edits are batched before sending
+     * 
+     * @param policy Flush window and maximum number of buffered operations
+     */
+    void setCoalescingPolicy(const ot::CoalescingPolicy& policy);
+    
+    /**
+     * Send buffered local operations if the flush window has elapsed
+     * Called from the client's event loop tick
+     * 
+     * @param force Send immediately regardless of the flush window
+     */
+    void flushPending(bool force = false);
+    
+    /**
+     * Keep unconfirmed edits in an append-only journal file
+     * Edits the file holds from an earlier run are taken up and applied to the
+     * document if it is at their base revision, and sent once connected
+     * 
+     * @param path The journal file
+     * @return False if the journal cannot be opened
+     */
+    bool setOfflineJournal(const std::string& path);
+    
+    /**
+     * Apply remote operations on the UI thread rather than the network thread
+     * The network thread then only queues each decoded operation on a
+     * lock-free ring and calls wake, at most once per batch; the callbacks
+     * run from applyRemoteOperations(), so neither thread waits on mutex_
+     * while the other holds it. Set before connect()
+     * 
+     * @param wake Arranges an applyRemoteOperations() on the UI thread, e.g. with QMetaObject::invokeMethod()
+     */
+    void setRemoteWakeup(std::function<void()> wake);
+    
+    /**
+     * Apply every remote operation queued since the last call, as one frame
+     * Consecutive operations go through sync_.applyServerBatch() and reach
+     * editor_ as one, up to the next ack, so the content and operation
+     * callbacks fire once per run rather than per operation
+     * Call on the UI thread when wake asks to
+     * 
+     * @return The number of operations applied
+     */
+    size_t applyRemoteOperations();
 
 private:
     /**
      * Handle operation generated locally
+     * Buffers the operation in coalescer_; merged runs go to sync_ on flush
+     * Called by editor_ with mutex_ held
      * 
      * @param operation Operation to send
      * @param version Version operation was created against
      */
     void handleLocalOperation(const ot::OperationPtr& operation, int64_t version);
     
+    // Hand the buffered local operations to sync_ (mutex_ held)
+    void flushPendingLocked();
+    
     /**
-     * Process incoming operation from server
+     * Process incoming message from server: the document, an ack of ours or another client's edit
+     * Called with mutex_ held
      * 
-     * @param json JSON-serialized operation
+     * @param json JSON-serialized message
+     * @param run If set, another client's edit is added to it rather than applied,
+     *            and it is applied before any other message
+     * @return The number of remote operations applied
      */
-    void processRemoteOperation(const std::string& json);
+    size_t processRemoteOperation(const std::string& json, std::vector<ot::OperationPtr>* run = nullptr);
+    
+    /**
+     * Process the server's confirmation of the operation in flight
+     * Sends what was buffered meanwhile
+     */
+    void processServerAck();
+    
+    // Send an operation from sync_ on the document's stream (mutex_ held)
+    void sendOperation(const ot::OperationPtr& operation, int64_t revision);
+    
+    // Transform a remote operation past what is unconfirmed and apply it; returns 1 if applied (mutex_ held)
+    size_t applyRemote(const ot::OperationPtr& operation);
+    
+    // Apply a run of remote operations as one and clear it; returns how many applied (mutex_ held)
+    size_t applyRemoteRun(std::vector<ot::OperationPtr>& run);
+    
+    // Take the document the server sent, or resend what it has not confirmed (mutex_ held)
+    void loadDocument(const protocol::DocumentMessage& response);
     
     /**
      * Update status message
@@ -145,12 +278,23 @@ private:
     void setStatus(const std::string& message);
 
 private:
+    // Most messages from the network thread waiting for applyRemoteOperations()
+    static constexpr size_t REMOTE_QUEUE_CAPACITY = 1024;
+    
     ot::Editor editor_;                      // OT editor with history
     ContentCallback contentCallback_;        // Callback for document changes
     StatusCallback statusCallback_;          // Callback for status updates
-    bool connected_;                         // Connection status
+    OperationCallback operationCallback_;    // Callback for each applied operation
+    std::atomic<bool> connected_;            // Connection status
     std::mutex mutex_;                       // Mutex for thread safety
-    std::deque<ot::OperationPtr> pending_;   // Pending operations to send
+    ot::ClientSync sync_;                    // The operation in flight and the buffer behind it
+    ot::OperationCoalescer coalescer_;       // Merges local edits before they enter pending_
+    std::shared_ptr<ot::OfflineJournal> journal_;  // Unconfirmed edits on disk, if set
+    ClientManager* manager_ = nullptr;       // The connection the document is open on, if any
+    bool ownsConnection_ = false;            // manager_ was connected by connect(host, port)
+    std::string documentId_;                 // The document, once opened
+    uint64_t sequence_ = 0;                  // sequenceNumber of the last edit sent
+    std::unique_ptr<util::HandoffQueue<std::string>> remoteOperations_;  // From the network thread, if a wakeup is set
 };
 
 } // namespace client
@@ -1,4 +1,295 @@
-#include <iostream>
-namespace collab { namespace client {
-void document_editor_placeholder() { std::cout << "Document editor placeholder" << std::endl; }
-}} // namespace collab::client
+#include "document_editor.h"
+#include <QHBoxLayout>
+#include <QKeySequence>
+#include <QMetaObject>
+#include <QTextDocument>
+#include <QThread>
+#include <QVBoxLayout>
+#include <algorithm>
+#include <span>
+#include <vector>
+
+namespace collab {
+namespace client {
+
+namespace {
+
+// One frame at 60 Hz; remote edits arriving within it are applied together
+constexpr int REMOTE_FRAME_MS = 16;
+
+} // namespace
+
+DocumentEditor::DocumentEditor(QWidget* parent)
+    : QWidget(parent),
+      textEdit_(nullptr),
+      toolbar_(nullptr),
+      undoAction_(nullptr),
+      redoAction_(nullptr),
+      historyView_(nullptr),
+      historyModel_(nullptr),
+      ignoreTextChanges_(false),
+      pendingRemote_(REMOTE_QUEUE_CAPACITY, [this]() {
+          // Runs on the thread that queued; the timer belongs to the UI thread
+          QMetaObject::invokeMethod(remoteFrameTimer_, [this]() { remoteFrameTimer_->start(); }, Qt::QueuedConnection);
+      }),
+      remoteFrameTimer_(nullptr),
+      viewRevision_(0),
+      localStep_(LocalStep::NONE),
+      resyncNeeded_(false) {
+    setupUi();
+    setupConnections();
+}
+
+DocumentEditor::~DocumentEditor() {
+    // The controller may outlive the editor
+    if (controller_) {
+        controller_->registerOperationCallback(nullptr);
+    }
+}
+
+void DocumentEditor::setupUi() {
+    auto* layout = new QVBoxLayout(this);
+
+    toolbar_ = new QToolBar(this);
+    undoAction_ = toolbar_->addAction(tr("Undo"));
+    undoAction_->setShortcut(QKeySequence::Undo);
+    redoAction_ = toolbar_->addAction(tr("Redo"));
+    redoAction_->setShortcut(QKeySequence::Redo);
+    layout->addWidget(toolbar_);
+
+    auto* body = new QHBoxLayout();
+    textEdit_ = new QTextEdit(this);
+    textEdit_->setAcceptRichText(false);
+    // Undo goes through the controller, which undoes this user's edits and not everyone's
+    textEdit_->setUndoRedoEnabled(false);
+    body->addWidget(textEdit_, 3);
+    historyView_ = new QListView(this);
+    body->addWidget(historyView_, 1);
+    layout->addLayout(body);
+
+    remoteFrameTimer_ = new QTimer(this);
+    remoteFrameTimer_->setSingleShot(true);
+    remoteFrameTimer_->setInterval(REMOTE_FRAME_MS);
+
+    updateUndoRedoActions();
+}
+
+void DocumentEditor::setupConnections() {
+    connect(undoAction_, &QAction::triggered, this, &DocumentEditor::undo);
+    connect(redoAction_, &QAction::triggered, this, &DocumentEditor::redo);
+    connect(textEdit_->document(), &QTextDocument::contentsChange, this, &DocumentEditor::onContentsChange);
+    connect(remoteFrameTimer_, &QTimer::timeout, this, &DocumentEditor::applyRemoteOperations);
+}
+
+void DocumentEditor::setDocumentController(std::shared_ptr<DocumentController> controller, const std::string& userId) {
+    if (controller_) {
+        controller_->registerOperationCallback(nullptr);
+    }
+    controller_ = std::move(controller);
+    userId_ = userId;
+
+    historyView_->setModel(nullptr);
+    delete historyModel_;
+    historyModel_ = nullptr;
+    if (!controller_) {
+        onDocumentChanged("", 0);
+        return;
+    }
+
+    historyModel_ = new HistoryModel([controller = controller_, userId](size_t from, size_t count) {
+        return controller->historyEntries(userId, from, count);
+    }, this);
+    historyView_->setModel(historyModel_);
+
+    controller_->registerOperationCallback([this](const ot::OperationPtr& op, const std::string&, int64_t revision) {
+        // Only the UI thread makes local steps, so only it reads localStep_
+        if (QThread::currentThread() == thread() && localStep_ != LocalStep::NONE) {
+            onLocalOperation(op, revision);
+        } else {
+            queueRemoteOperation(op, revision);
+        }
+    });
+    resync();
+}
+
+QString DocumentEditor::getDocument() const {
+    return textEdit_->toPlainText();
+}
+
+bool DocumentEditor::canUndo() const {
+    return controller_ && controller_->canUndo(userId_);
+}
+
+bool DocumentEditor::canRedo() const {
+    return controller_ && controller_->canRedo(userId_);
+}
+
+void DocumentEditor::undo() {
+    if (controller_) {
+        // Caught up first, so the step lands on the revision the view shows
+        applyRemoteOperations();
+        applyLocal(LocalStep::HISTORY, [this]() { return controller_->undo(userId_); });
+    }
+}
+
+void DocumentEditor::redo() {
+    if (controller_) {
+        applyRemoteOperations();
+        applyLocal(LocalStep::HISTORY, [this]() { return controller_->redo(userId_); });
+    }
+}
+
+void DocumentEditor::onContentsChange(int position, int charsRemoved, int charsAdded) {
+    if (ignoreTextChanges_ || !controller_) {
+        return;
+    }
+
+    ot::OperationPtr op = createOperationFromChange(position, charsRemoved, charsAdded);
+    if (!op) {
+        return;
+    }
+    applyLocal(LocalStep::VIEW, [this, &op]() {
+        // Transformed past whatever the controller applied since the view's revision
+        const DocumentController::Edit edit{op, userId_, viewRevision_};
+        auto applied = controller_->applyBatch(std::span<const DocumentController::Edit>(&edit, 1));
+        return !applied.empty() && applied.front() != nullptr;
+    });
+}
+
+ot::OperationPtr DocumentEditor::createOperationFromChange(int position, int charsRemoved, int charsAdded) {
+    // Only the added text is read back; text_ still has what was removed
+    QTextDocument* textDocument = textEdit_->document();
+    const int end = std::max(position, std::min(position + charsAdded, textDocument->characterCount() - 1));
+    QTextCursor cursor(textDocument);
+    cursor.setPosition(position);
+    cursor.setPosition(end, QTextCursor::KeepAnchor);
+
+    // A selection separates blocks with U+2029 where the plain text has a newline; both are one unit
+    QString added = cursor.selectedText();
+    added.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    added.replace(QChar::LineSeparator, QLatin1Char('\n'));
+
+    // Qt may count the separator after the last block in charsRemoved; text_ stops at its end
+    return text_.change(static_cast<size_t>(position), static_cast<size_t>(charsRemoved), added.toStdString());
+}
+
+void DocumentEditor::applyLocal(LocalStep step, const std::function<bool()>& apply) {
+    localStep_ = step;
+    const bool applied = apply();
+    localStep_ = LocalStep::NONE;
+
+    // An edit the controller refused is still in the view
+    if (resyncNeeded_ || (step == LocalStep::VIEW && !applied)) {
+        resync();
+    }
+    updateUndoRedoActions();
+}
+
+void DocumentEditor::onLocalOperation(const ot::OperationPtr& op, int64_t revision) {
+    // The controller applied something the view has not shown yet, and op was transformed past it
+    if (revision != viewRevision_ + 1) {
+        resyncNeeded_ = true;
+        return;
+    }
+
+    // An undo or redo is not in the view yet
+    if (localStep_ == LocalStep::HISTORY) {
+        QTextCursor cursor(textEdit_->document());
+        ignoreTextChanges_ = true;
+        const bool applied = applyToCursor(cursor, *op);
+        ignoreTextChanges_ = false;
+        if (!applied) {
+            resyncNeeded_ = true;
+            return;
+        }
+    }
+    viewRevision_ = revision;
+}
+
+void DocumentEditor::queueRemoteOperation(const ot::OperationPtr& op, int64_t revision) {
+    pendingRemote_.push(RemoteOperation{op, revision});
+}
+
+void DocumentEditor::applyRemoteOperations() {
+    std::vector<RemoteOperation> operations;
+    pendingRemote_.drain([&](RemoteOperation remote) { operations.push_back(std::move(remote)); });
+    if (!controller_) {
+        return;
+    }
+
+    // One edit block: one contentsChange, one layout and one repaint for the frame
+    QTextCursor cursor(textEdit_->document());
+    ignoreTextChanges_ = true;
+    cursor.beginEditBlock();
+    for (const auto& remote : operations) {
+        // Already in the view, through a reload
+        if (remote.revision <= viewRevision_) {
+            continue;
+        }
+        if (remote.revision != viewRevision_ + 1 || !applyToCursor(cursor, *remote.op)) {
+            resyncNeeded_ = true;
+            break;
+        }
+        viewRevision_ = remote.revision;
+    }
+    cursor.endEditBlock();
+    ignoreTextChanges_ = false;
+
+    // What did not fit in the ring waits for the producer's next push. Everything up to the
+    // controller's revision was pushed when it is read, so with the ring empty the rest is waiting
+    if (!resyncNeeded_ && controller_->getRevision() > viewRevision_ && pendingRemote_.empty()) {
+        resyncNeeded_ = true;
+    }
+    if (resyncNeeded_) {
+        resync();
+    } else if (!operations.empty()) {
+        updateUndoRedoActions();
+    }
+}
+
+bool DocumentEditor::applyToCursor(QTextCursor& cursor, const ot::Operation& op) {
+    const auto edits = text_.apply(op);
+    if (!edits) {
+        return false;
+    }
+    // Edits through a cursor move the text edit's own cursor along with the text
+    for (const auto& edit : *edits) {
+        cursor.setPosition(static_cast<int>(edit.position));
+        cursor.setPosition(static_cast<int>(edit.position + edit.removed), QTextCursor::KeepAnchor);
+        cursor.insertText(QString::fromStdString(edit.inserted));
+    }
+    return true;
+}
+
+void DocumentEditor::resync() {
+    const DocumentController::DocumentSnapshot snapshot = controller_->getSnapshot();
+    onDocumentChanged(snapshot.content.toString(), snapshot.revision);
+}
+
+void DocumentEditor::onDocumentChanged(const std::string& content, int64_t revision) {
+    // The cursor stays where it was, as far as the new text allows
+    const int position = textEdit_->textCursor().position();
+
+    ignoreTextChanges_ = true;
+    textEdit_->setPlainText(QString::fromStdString(content));
+    ignoreTextChanges_ = false;
+    text_ = document::Utf16Text(ot::Rope(content));
+    viewRevision_ = revision;
+    resyncNeeded_ = false;
+
+    QTextCursor cursor = textEdit_->textCursor();
+    cursor.setPosition(std::min(position, textEdit_->document()->characterCount() - 1));
+    textEdit_->setTextCursor(cursor);
+    updateUndoRedoActions();
+}
+
+void DocumentEditor::updateUndoRedoActions() {
+    undoAction_->setEnabled(canUndo());
+    redoAction_->setEnabled(canRedo());
+    if (historyModel_) {
+        historyModel_->refresh();
+    }
+}
+
+} // namespace client
+} // namespace collab
@@ -7,16 +7,46 @@
 #include <QTextEdit>
 #include <QToolBar>
 #include <QAction>
-#include <QUndoView>
+#include <QListView>
+#include <QTextCursor>
+#include <QTimer>
+#include <functional>
 #include <memory>
 #include <string>
+#include "client/editor/utf16_text.h"
 #include "common/document/document_controller.h"
+#include "common/util/handoff_queue.h"
+#include "history_model.h"
 
 namespace collab {
 namespace client {
 
 /**
  * Document editor widget with undo/redo UI
+ * 
+ * Local edits are taken from QTextDocument::contentsChange, which names
+ * the range an edit touched, so an edit costs what it changed rather than
+ * a diff of the whole text. Qt counts positions in UTF-16 and operations
+ * in bytes of UTF-8, so the editor mirrors the text in a
+ * document::Utf16Text, a Rope kept in step by the same edits, to convert
+ * between them. Each edit goes to the controller based on the revision
+ * the view shows; when the controller had applied something else first,
+ * the view is reloaded from it.
+ * 
+ * Remote edits arrive as operations from the controller's operation
+ * callback. They are queued and applied once per frame through a
+ * QTextCursor inside one edit block, so rendering follows the size of the
+ * change and the local cursor and undo view survive. The queue is a
+ * lock-free handoff (see util::HandoffQueue), so the network thread never
+ * waits on the UI thread to queue one, nor the UI on the network thread.
+ * Each carries the revision it produced, so one the view already shows
+ * after a reload is skipped, and undo and redo, which the controller
+ * reports the same way, are replayed on the spot.
+ * 
+ * The history panel is a QListView over a HistoryModel of the local
+ * user's entries in the controller, rather than a QUndoView, which would
+ * need a QUndoCommand per entry up front; it reads only the rows in view
+ * and is refreshed with the undo and redo actions.
  */
 class DocumentEditor : public QWidget {
     Q_OBJECT
@@ -65,30 +95,83 @@ public slots:
      */
     void redo();
     
+    /**
+     * Queue an operation applied by someone else for the next frame
+     * May be called from one thread at a time, usually the network thread
+     * 
+     * @param op The operation, valid for the document after everything queued before it
+     * @param revision The controller's revision op produced
+     */
+    void queueRemoteOperation(const ot::OperationPtr& op, int64_t revision);
+    
 private:
+    // What this thread is applying to the controller: an edit already in the view, or an undo or redo
+    enum class LocalStep { NONE, VIEW, HISTORY };
+    
+    // An operation applied by someone else, and the revision it produced
+    struct RemoteOperation {
+        ot::OperationPtr op;
+        int64_t revision = 0;
+    };
+    
     QTextEdit* textEdit_;
     QToolBar* toolbar_;
     QAction* undoAction_;
     QAction* redoAction_;
+    QListView* historyView_;
+    HistoryModel* historyModel_;  // Over controller_->historyEntries() for userId_; replaced with the controller
     
     std::shared_ptr<DocumentController> controller_;
     std::string userId_;
-    QString lastKnownText_;
     
     // Flag to ignore text changes during programmatic updates
     bool ignoreTextChanges_;
     
+    // Remote operations waiting for the next frame, in the order they were applied
+    // Waking the UI starts remoteFrameTimer_ through a queued QMetaObject::invokeMethod()
+    static constexpr size_t REMOTE_QUEUE_CAPACITY = 4096;
+    util::HandoffQueue<RemoteOperation> pendingRemote_;
+    QTimer* remoteFrameTimer_;  // Single-shot, one frame long; started by the first queued operation
+    
+    document::Utf16Text text_;  // The view's text, as of viewRevision_ and the edits since
+    int64_t viewRevision_;      // The controller's revision the view shows
+    LocalStep localStep_;       // Read only on the UI thread
+    bool resyncNeeded_;         // A local step found the view out of step
+    
     void setupUi();
     void setupConnections();
     
-    // Create operation from text edit changes
-    ot::OperationPtr createOperationFromChange(const QString& oldText, const QString& newText);
+    /**
+     * Create the operation for one change of the text edit's document, and apply it to text_
+     * 
+     * @param position Where the change starts
+     * @param charsRemoved Characters removed there
+     * @param charsAdded Characters added there, read back from the document
+     * @return An insert, a delete or a replace; nullptr if the text did not change
+     */
+    ot::OperationPtr createOperationFromChange(int position, int charsRemoved, int charsAdded);
+    
+    // Run apply, which makes a local step on the controller, then reload the view if it fell out of step
+    void applyLocal(LocalStep step, const std::function<bool()>& apply);
+    
+    // The controller applied a local step (from its operation callback, with its lock held)
+    void onLocalOperation(const ot::OperationPtr& op, int64_t revision);
+    
+    // Reload the view from the controller
+    void resync();
+    
+    // Apply one operation as cursor edits, and to text_; false if it does not fit the view
+    bool applyToCursor(QTextCursor& cursor, const ot::Operation& op);
     
-    // Update editor state based on undo/redo availability
+    // Update editor state based on undo/redo availability, and refresh the history panel
     void updateUndoRedoActions();
 
 private slots:
-    void onTextChanged();
+    // Connected to QTextDocument::contentsChange
+    void onContentsChange(int position, int charsRemoved, int charsAdded);
+    // Applies every queued remote operation in one edit block
+    void applyRemoteOperations();
+    // Only for a full resync, such as loading a document; remote edits go through queueRemoteOperation
     void onDocumentChanged(const std::string& document, int64_t revision);
 };
 
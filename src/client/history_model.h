@@ -0,0 +1,204 @@
+// FILE: src/client/history_model.h
+// Description: Lazy list model over the undo history, for the editor's history view
+
+#pragma once
+
+#include <QAbstractListModel>
+#include <QBrush>
+#include <QModelIndex>
+#include <QString>
+#include <QVariant>
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+#include "common/document/history_manager.h"
+
+namespace collab {
+namespace client {
+
+/**
+ * List model over a history engine's entries, newest first
+ * 
+ * Unlike QUndoView over a QUndoStack, which needs a QUndoCommand made for
+ * every entry before it shows any, the model describes only the rows a
+ * view asks for. Rows are read from the engine a page at a time through
+ * HistoryManager::entries(), which costs the rows asked for however long
+ * the history is, and a few pages are kept for scrolling back and forth.
+ * rowCount() starts at FETCH_ROWS and grows through fetchMore() as the
+ * view scrolls to the end, so opening the history of a long-lived
+ * document reads one page.
+ * 
+ * Rows follow HistoryPage: the entries to redo, furthest first, then the
+ * entries to undo from the next undo (currentRow()) down to the oldest.
+ * A grouped entry, such as a typed word, is one row.
+ * The model does not watch the engine; call refresh() whenever the
+ * history may have changed, e.g. with the undo and redo actions.
+ */
+class HistoryModel : public QAbstractListModel {
+    Q_OBJECT
+    
+public:
+    // Reads rows [from, from + count) of the history
+    using Source = std::function<HistoryManager::HistoryPage(size_t from, size_t count)>;
+    
+    enum Role {
+        RevisionRole = Qt::UserRole + 1,  // qint64 revision of the entry's first operation
+        UndoneRole                        // bool, whether the entry waits to be redone
+    };
+    
+    static constexpr int FETCH_ROWS = 100;   // Rows added to rowCount() per fetchMore()
+    static constexpr size_t PAGE_ROWS = 64;  // Rows read from the source at once
+    static constexpr size_t MAX_PAGES = 8;   // Pages kept; the least recently read is dropped first
+    static constexpr int LABEL_CHARS = 32;   // Text quoted in a label before it is elided
+    
+    /**
+     * @param source Reads rows of the history, e.g. DocumentController::historyEntries for a user
+     * @param parent Owning object
+     */
+    explicit HistoryModel(Source source, QObject* parent = nullptr)
+        : QAbstractListModel(parent), source_(std::move(source)) {
+        readCounts();
+        loaded_ = std::min(FETCH_ROWS, totalRows());
+    }
+    
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : loaded_;
+    }
+    
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override {
+        if (!index.isValid() || index.row() < 0 || index.row() >= loaded_) {
+            return QVariant();
+        }
+        const HistoryManager::EntryInfo* entry = entryAt(static_cast<size_t>(index.row()));
+        if (!entry) {
+            return QVariant();
+        }
+        switch (role) {
+            case Qt::DisplayRole:
+            case Qt::ToolTipRole:
+                return describe(*entry);
+            case Qt::ForegroundRole:
+                return entry->undone ? QVariant(QBrush(Qt::gray)) : QVariant();
+            case RevisionRole:
+                return QVariant::fromValue<qint64>(entry->first);
+            case UndoneRole:
+                return entry->undone;
+            default:
+                return QVariant();
+        }
+    }
+    
+    bool canFetchMore(const QModelIndex& parent) const override {
+        return !parent.isValid() && loaded_ < totalRows();
+    }
+    
+    void fetchMore(const QModelIndex& parent) override {
+        if (parent.isValid()) {
+            return;
+        }
+        const int more = std::min(FETCH_ROWS, totalRows() - loaded_);
+        if (more <= 0) {
+            return;
+        }
+        beginInsertRows(QModelIndex(), loaded_, loaded_ + more - 1);
+        loaded_ += more;
+        endInsertRows();
+    }
+    
+    // Row of the next undo, which the view marks as the current state; rowCount() if there is none loaded
+    int currentRow() const {
+        return std::min(static_cast<int>(redoCount_), loaded_);
+    }
+    
+public slots:
+    /**
+     * Read the history again after it changed
+     * Rows shown stay shown; if only the entries changed, not how many
+     * there are, the view repaints them, otherwise the model is reset
+     */
+    void refresh() {
+        const size_t undoCount = undoCount_;
+        const size_t redoCount = redoCount_;
+        pages_.clear();
+        pageOrder_.clear();
+        readCounts();
+        if (undoCount == undoCount_ && redoCount == redoCount_) {
+            if (loaded_ > 0) {
+                emit dataChanged(index(0), index(loaded_ - 1));
+            }
+            return;
+        }
+        beginResetModel();
+        loaded_ = std::min(std::max(loaded_, FETCH_ROWS), totalRows());
+        endResetModel();
+    }
+    
+private:
+    using Page = std::vector<HistoryManager::EntryInfo>;
+    
+    int totalRows() const {
+        return static_cast<int>(undoCount_ + redoCount_);
+    }
+    
+    void readCounts() {
+        HistoryManager::HistoryPage page = source_(0, 0);
+        undoCount_ = page.undoCount;
+        redoCount_ = page.redoCount;
+    }
+    
+    // The entry of a row, reading its page if it is not kept
+    const HistoryManager::EntryInfo* entryAt(size_t row) const {
+        const size_t first = row / PAGE_ROWS * PAGE_ROWS;
+        auto it = pages_.find(first);
+        if (it == pages_.end()) {
+            if (pages_.size() >= MAX_PAGES) {
+                pages_.erase(pageOrder_.front());
+                pageOrder_.pop_front();
+            }
+            it = pages_.emplace(first, source_(first, PAGE_ROWS).entries).first;
+            pageOrder_.push_back(first);
+        }
+        const size_t offset = row - first;
+        return offset < it->second.size() ? &it->second[offset] : nullptr;
+    }
+    
+    // What an entry does: what redo would do for an undone one, what undo would revert otherwise
+    static QString describe(const HistoryManager::EntryInfo& entry) {
+        if (!entry.op) {
+            return tr("Edit at revision %1").arg(entry.first);
+        }
+        // An undone entry is logged as its undo, so it is described as that undo's inverse
+        bool inserts = false;
+        QString text;
+        if (entry.op->getKind() == ot::OperationKind::INSERT) {
+            inserts = !entry.undone;
+            text = QString::fromStdString(static_cast<const ot::InsertOperation&>(*entry.op).getText());
+        } else if (entry.op->getKind() == ot::OperationKind::DELETE) {
+            inserts = entry.undone;
+            text = QString::fromStdString(static_cast<const ot::DeleteOperation&>(*entry.op).getDeletedText());
+        } else {
+            return QString::fromStdString(entry.op->getType());
+        }
+        if (text.size() > LABEL_CHARS) {
+            text = text.left(LABEL_CHARS) + QStringLiteral("…");
+        }
+        text.replace(QLatin1Char('\n'), QStringLiteral("↵"));
+        return inserts ? tr("Type \"%1\"").arg(text) : tr("Delete \"%1\"").arg(text);
+    }
+    
+    Source source_;
+    size_t undoCount_ = 0;
+    size_t redoCount_ = 0;
+    int loaded_ = 0;  // Rows the view has been told about
+    
+    // Pages read, by first row, and the order they were read in
+    mutable std::map<size_t, Page> pages_;
+    mutable std::deque<size_t> pageOrder_;
+};
+
+} // namespace client
+} // namespace collab
@@ -1,4 +1,23 @@
-#include < MAGIX
-namespace collab { namespace client {
-void ncurses_client_placeholder() { std::cout << "NCurses client placeholder" << std::endl; }
-}} // namespace collab::client
+#include "terminal_client.h"
+#include <iostream>
+
+// Usage: ncurses_client <host> <port> [offline journal]
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [offline journal]" << std::endl;
+        return 1;
+    }
+
+    collab::client::DocumentClient client;
+    if (argc > 3 && !client.setOfflineJournal(argv[3])) {
+        std::cerr << "Cannot open offline journal " << argv[3] << std::endl;
+        return 1;
+    }
+
+    // Mirror the content before connecting, so no remote edit arrives unseen
+    collab::client::TerminalClient terminal(client);
+    if (!client.connect(argv[1], argv[2])) {
+        std::cerr << "Cannot connect to " << argv[1] << ":" << argv[2] << ", editing offline" << std::endl;
+    }
+    return terminal.run();
+}
@@ -1,4 +1,279 @@
-#include <iostream>
-namespace collab { namespace client {
-void terminal_client_placeholder() { std::cout << "Terminal client placeholder" << std::endl; }
-}} // namespace collab::client
+#include "terminal_client.h"
+#include <algorithm>
+#include <curses.h>
+
+namespace collab {
+namespace client {
+
+namespace {
+
+constexpr int KEY_CTRL_Q = 17;
+
+// Holds the terminal in curses mode, restoring it however run() ends
+struct CursesSession {
+    CursesSession() {
+        initscr();
+        raw();
+        noecho();
+        keypad(stdscr, TRUE);
+    }
+
+    ~CursesSession() {
+        endwin();
+    }
+};
+
+} // namespace
+
+TerminalClient::TerminalClient(DocumentClient& client, std::chrono::milliseconds frameInterval)
+    : client_(client),
+      frameInterval_(frameInterval),
+      document_("terminal"),
+      damage_(document_) {
+    document_.addChangeSummaryListener([this](const document::ChangeSummary& summary) {
+        damage_.noteChange(summary);
+    });
+    client_.setOperationCallback([this](const ot::OperationPtr& op) {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        queued_.push_back(op);
+    });
+    document_.setText(client_.getContent());
+}
+
+int TerminalClient::run() {
+    CursesSession session;
+    running_ = true;
+
+    auto nextFrame = std::chrono::steady_clock::now();
+    while (running_) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= nextFrame) {
+            applyQueuedOperations();
+            client_.flushPending();
+            render();
+            nextFrame = now + frameInterval_;
+        }
+
+        // Wait for a key, but no longer than the next frame
+        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            nextFrame - std::chrono::steady_clock::now());
+        timeout(static_cast<int>(std::max<std::chrono::milliseconds::rep>(wait.count(), 0)));
+        const int key = getch();
+        if (key != ERR) {
+            handleKey(key);
+        }
+    }
+    return 0;
+}
+
+void TerminalClient::stop() {
+    running_ = false;
+}
+
+void TerminalClient::applyQueuedOperations() {
+    std::vector<ot::OperationPtr> operations;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        operations.swap(queued_);
+    }
+    if (operations.empty()) {
+        return;
+    }
+
+    // One batch, so the frame gets one damaged range however many edits arrived
+    document::Document::Batch batch(document_);
+    for (const auto& op : operations) {
+        if (op) {
+            applyOperation(*op);
+        }
+    }
+}
+
+void TerminalClient::applyOperation(const ot::Operation& op) {
+    switch (op.getKind()) {
+        case ot::OperationKind::INSERT: {
+            const auto& insert = static_cast<const ot::InsertOperation&>(op);
+            const size_t position = std::min(insert.getPosition(), document_.getTextLength());
+            document_.insertText(document_.linearToCursor(position), insert.getText());
+            if (position <= cursor_) {
+                cursor_ += insert.getText().size();
+            }
+            break;
+        }
+        case ot::OperationKind::DELETE: {
+            const auto& erase = static_cast<const ot::DeleteOperation&>(op);
+            const size_t position = erase.getPosition();
+            document_.deleteText(document_.linearToCursor(position), erase.getLength());
+            if (position < cursor_) {
+                cursor_ -= std::min(erase.getLength(), cursor_ - position);
+            }
+            break;
+        }
+        case ot::OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ot::ReplaceOperation&>(op);
+            const size_t position = replace.getPosition();
+            document_.replaceText(document_.linearToCursor(position), replace.getLength(), replace.getText());
+            // A cursor inside the replaced text ends up after the new text
+            if (position < cursor_) {
+                cursor_ = cursor_ >= position + replace.getLength()
+                    ? cursor_ - replace.getLength() + replace.getText().size()
+                    : position + replace.getText().size();
+            }
+            break;
+        }
+        case ot::OperationKind::COMPOSITE:
+            for (const auto& part : static_cast<const ot::CompositeOperation&>(op).getOperations()) {
+                if (part) {
+                    applyOperation(*part);
+                }
+            }
+            break;
+    }
+    cursor_ = std::min(cursor_, document_.getTextLength());
+}
+
+void TerminalClient::handleKey(int key) {
+    // Edits are made at offsets of document_; catch up first so they are also offsets of client_
+    applyQueuedOperations();
+
+    const size_t length = document_.getTextLength();
+    switch (key) {
+        case KEY_CTRL_Q:
+            running_ = false;
+            return;
+        case KEY_LEFT:
+            cursor_ = cursor_ > 0 ? cursor_ - 1 : 0;
+            return;
+        case KEY_RIGHT:
+            cursor_ = std::min(cursor_ + 1, length);
+            return;
+        case KEY_UP:
+            moveVertically(-1);
+            return;
+        case KEY_DOWN:
+            moveVertically(1);
+            return;
+        case KEY_PPAGE:
+            moveVertically(-std::max(screenRows_ - 1, 1));
+            return;
+        case KEY_NPAGE:
+            moveVertically(std::max(screenRows_ - 1, 1));
+            return;
+        case KEY_HOME:
+            cursor_ = document_.cursorToLinear(document::CursorPosition(document_.linearToCursor(cursor_).line, 0));
+            return;
+        case KEY_END: {
+            const size_t line = document_.linearToCursor(cursor_).line;
+            cursor_ = document_.cursorToLinear(document::CursorPosition(line, document_.getLine(line).size()));
+            return;
+        }
+        case KEY_RESIZE:
+            damage_.invalidateAll();
+            return;
+        case KEY_BACKSPACE:
+        case 127:
+        case '\b':
+            if (cursor_ > 0) {
+                client_.deleteText(cursor_ - 1, 1);
+            }
+            break;
+        case KEY_DC:
+            if (cursor_ < length) {
+                client_.deleteText(cursor_, 1);
+            }
+            break;
+        case KEY_ENTER:
+        case '\n':
+        case '\r':
+            client_.insert(cursor_, "\n");
+            break;
+        default:
+            if (key == '\t' || (key >= ' ' && key < 127)) {
+                client_.insert(cursor_, std::string(1, static_cast<char>(key)));
+            }
+            break;
+    }
+
+    // Echo the edit now rather than a frame later; the cursor follows the operation
+    applyQueuedOperations();
+}
+
+void TerminalClient::moveVertically(int lines) {
+    const document::CursorPosition position = document_.linearToCursor(cursor_);
+    const size_t lastLine = document_.getLineCount() - 1;
+    size_t line;
+    if (lines < 0) {
+        line = position.line - std::min(position.line, static_cast<size_t>(-lines));
+    } else {
+        line = std::min(position.line + static_cast<size_t>(lines), lastLine);
+    }
+    const size_t column = std::min(position.column, document_.getLine(line).size());
+    cursor_ = document_.cursorToLinear(document::CursorPosition(line, column));
+}
+
+void TerminalClient::scrollToCursor(size_t rows) {
+    const size_t line = document_.linearToCursor(cursor_).line;
+    const size_t top = top_;
+    if (line < top_) {
+        top_ = line;
+    } else if (line >= top_ + rows) {
+        top_ = line - rows + 1;
+    }
+    if (top_ != top) {
+        damage_.invalidateAll();
+    }
+}
+
+void TerminalClient::render() {
+    int rows;
+    int columns;
+    getmaxyx(stdscr, rows, columns);
+    if (rows != screenRows_ || columns != screenColumns_) {
+        screenRows_ = rows;
+        screenColumns_ = columns;
+        damage_.invalidateAll();
+    }
+
+    // The last row is the status line
+    const int textRows = std::max(rows - 1, 1);
+    scrollToCursor(static_cast<size_t>(textRows));
+
+    if (const auto damaged = damage_.collect()) {
+        for (int row = 0; row < textRows; ++row) {
+            const size_t line = top_ + static_cast<size_t>(row);
+            if (damaged->contains(line)) {
+                drawLine(line, row, columns);
+            }
+        }
+    }
+    drawStatus(rows - 1, columns);
+
+    const document::CursorPosition position = document_.linearToCursor(cursor_);
+    move(static_cast<int>(position.line - top_),
+         static_cast<int>(std::min<size_t>(position.column, static_cast<size_t>(std::max(columns - 1, 0)))));
+    refresh();
+}
+
+void TerminalClient::drawLine(size_t line, int row, int columns) {
+    move(row, 0);
+    if (line < document_.getLineCount()) {
+        const std::string text = document_.getLine(line);
+        addnstr(text.c_str(), static_cast<int>(std::min<size_t>(text.size(), static_cast<size_t>(columns))));
+    }
+    clrtoeol();
+}
+
+void TerminalClient::drawStatus(int row, int columns) {
+    const document::CursorPosition position = document_.linearToCursor(cursor_);
+    std::string status = " " + std::to_string(position.line + 1) + ":" + std::to_string(position.column + 1) +
+                         " of " + std::to_string(document_.getLineCount()) + " lines  " +
+                         (client_.isConnected() ? "connected" : "offline") + "  Ctrl-Q quits";
+    status.resize(static_cast<size_t>(std::max(columns, 0)), ' ');
+
+    attron(A_REVERSE);
+    mvaddnstr(row, 0, status.c_str(), columns);
+    attroff(A_REVERSE);
+}
+
+} // namespace client
+} // namespace collab
@@ -0,0 +1,96 @@
+// FILE: src/client/terminal_client.h
+// Description: Terminal client drawing a document with curses, redrawing only damaged lines
+
+#pragma once
+
+#include "document_client.h"
+#include "client/editor/damage_tracker.h"
+#include "client/editor/document.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace collab {
+namespace client {
+
+/**
+ * Full-screen terminal editor for a shared document, usable over SSH
+ *
+ * The DocumentClient owns the content; every operation it applies, local
+ * or remote, is queued through its operation callback and mirrored into a
+ * document::Document once per frame, inside one batch. The batch's change
+ * summary goes to a DamageTracker, and a frame redraws only the rows of
+ * the damaged lines, so the bytes sent to the terminal follow the size of
+ * the change rather than of the document or the screen.
+ *
+ * Frames are at least frameInterval apart (60 per second by default);
+ * keys read in between are applied at once, everything else waits for
+ * the next frame.
+ */
+class TerminalClient {
+public:
+    /**
+     * Constructor
+     *
+     * @param client Connected (or offline) document client to edit through
+     * @param frameInterval Shortest time between two redraws
+     */
+    explicit TerminalClient(DocumentClient& client,
+                            std::chrono::milliseconds frameInterval = std::chrono::milliseconds(16));
+
+    TerminalClient(const TerminalClient&) = delete;
+    TerminalClient& operator=(const TerminalClient&) = delete;
+
+    /**
+     * Take over the terminal and edit until the user quits (Ctrl-Q)
+     *
+     * @return Exit code for main()
+     */
+    int run();
+
+    /**
+     * Make run() return after the current frame; may be called from any thread
+     */
+    void stop();
+
+private:
+    // Mirror the queued operations into document_ as one batch (main thread)
+    void applyQueuedOperations();
+
+    // Mirror one operation, moving the cursor past text inserted before it
+    void applyOperation(const ot::Operation& op);
+
+    void handleKey(int key);
+
+    // Move the cursor by lines, keeping the column where the line allows
+    void moveVertically(int lines);
+
+    // Scroll so the cursor is on screen; damages everything if the view moved
+    void scrollToCursor(size_t rows);
+
+    void render();
+
+    void drawLine(size_t line, int row, int columns);
+
+    void drawStatus(int row, int columns);
+
+    DocumentClient& client_;
+    const std::chrono::milliseconds frameInterval_;
+
+    document::Document document_;        // What is on screen, as of the last frame
+    document::DamageTracker damage_;
+
+    std::mutex queueMutex_;
+    std::vector<ot::OperationPtr> queued_;   // Applied by client_, not yet mirrored
+
+    size_t cursor_ = 0;       // Linear offset of the cursor in document_
+    size_t top_ = 0;          // First line on screen
+    int screenRows_ = 0;      // Screen size at the last frame
+    int screenColumns_ = 0;
+    std::atomic<bool> running_{false};
+};
+
+} // namespace client
+} // namespace collab
@@ -1,4 +1,523 @@
-#include <iostream>
-namespace collab { namespace common {
-void document_controller_placeholder() { std::cout << "Document controller placeholder" << std::endl; }
-}} // namespace collab::common
+#include "common/document/document_controller.h"
+#include "common/ot/transform_arena.h"
+#include "common/util/compression.h"
+#include <algorithm>
+#include <chrono>
+#include <span>
+#include <stdexcept>
+
+namespace collab {
+
+namespace {
+
+// Adds the time until it goes out of scope to a total
+class ElapsedTime {
+public:
+    explicit ElapsedTime(uint64_t& total)
+        : total_(total), started_(std::chrono::steady_clock::now()) {}
+    
+    ~ElapsedTime() {
+        total_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - started_).count());
+    }
+    
+    ElapsedTime(const ElapsedTime&) = delete;
+    ElapsedTime& operator=(const ElapsedTime&) = delete;
+    
+private:
+    uint64_t& total_;
+    std::chrono::steady_clock::time_point started_;
+};
+
+} // namespace
+
+DocumentController::DocumentController(const std::string& initialContent, size_t logRetention)
+    : document_(initialContent),
+      operationLog_(logRetention),
+      historyManager_(operationLog_),
+      revision_(0),
+      nextOperationId_(1) {
+    checkpoints_.reset(document_, revision_);
+    contentHash_.reset(document_);
+    annotations_.reset(document_.length());
+}
+
+DocumentController::DocumentController(const DocumentSnapshot& snapshot, size_t logRetention)
+    : document_(snapshot.content),
+      operationLog_(logRetention),
+      historyManager_(operationLog_),
+      revision_(snapshot.revision),
+      nextOperationId_(1) {
+    operationLog_.reset(revision_);
+    checkpoints_.reset(document_, revision_);
+    contentHash_.reset(document_);
+    annotations_.reset(document_.length());
+}
+
+bool DocumentController::applyOperation(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo) {
+    if (!op) {
+        return false;
+    }
+    
+    std::unique_lock<util::ProfiledMutex> lock(documentMutex_);
+    wakeLocked();
+    
+    if (!applyLocked(op, userId, recordForUndo)) {
+        return false;
+    }
+    notifyDocumentChanged();
+    publishChanges(lock);
+    return true;
+}
+
+bool DocumentController::applyOperation(const ot::ValueOperation& op, const std::string& userId, bool recordForUndo) {
+    std::unique_lock<util::ProfiledMutex> lock(documentMutex_);
+    wakeLocked();
+    
+    // Capture the removed text up front so the recorded delete can be undone
+    ot::ValueOperation applied = op;
+    if (auto* del = std::get_if<ot::DeleteOp>(&applied)) {
+        if (del->position + del->length > document_.length()) {
+            return false;
+        }
+        del->deletedText = document_.substr(del->position, del->length);
+    }
+    
+    if (!ot::applyOperation(applied, document_)) {
+        return false;
+    }
+    
+    ot::OperationPtr recorded = ot::toOperation(applied);
+    recorded->setId(nextOperationId_++);
+    commitOperation(recorded, userId, recordForUndo);
+    notifyDocumentChanged();
+    publishChanges(lock);
+    return true;
+}
+
+std::vector<ot::OperationPtr> DocumentController::applyBatch(std::span<const Edit> edits, bool recordForUndo) {
+    std::vector<ot::OperationPtr> applied;
+    applied.reserve(edits.size());
+    
+    std::unique_lock<util::ProfiledMutex> lock(documentMutex_);
+    wakeLocked();
+    
+    for (const auto& edit : edits) {
+        ot::OperationPtr op = edit.op ? transformLocked(edit.op, edit.baseRevision) : nullptr;
+        if (op && !applyLocked(op, edit.userId, recordForUndo)) {
+            op = nullptr;
+        }
+        applied.push_back(std::move(op));
+    }
+    
+    if (std::any_of(applied.begin(), applied.end(), [](const ot::OperationPtr& op) { return op != nullptr; })) {
+        notifyDocumentChanged();
+        publishChanges(lock);
+    }
+    return applied;
+}
+
+bool DocumentController::undo(const std::string& userId) {
+    std::unique_lock<util::ProfiledMutex> lock(documentMutex_);
+    wakeLocked();
+    
+    int64_t revision = applyHistoryStep(historyManager_.undo(userId), userId);
+    if (revision < 0) {
+        return false;
+    }
+    
+    historyManager_.recordUndo(revision, userId);
+    notifyDocumentChanged();
+    publishChanges(lock);
+    return true;
+}
+
+bool DocumentController::redo(const std::string& userId) {
+    std::unique_lock<util::ProfiledMutex> lock(documentMutex_);
+    wakeLocked();
+    
+    int64_t revision = applyHistoryStep(historyManager_.redo(userId), userId);
+    if (revision < 0) {
+        return false;
+    }
+    
+    historyManager_.recordRedo(revision, userId);
+    notifyDocumentChanged();
+    publishChanges(lock);
+    return true;
+}
+
+int64_t DocumentController::applyHistoryStep(const HistoryManager::Step& step, const std::string& userId) {
+    if (!step.op) {
+        return -1;
+    }
+    
+    // Selective undo: only what was applied after the user's operation is transformed against;
+    // below the log's memory the operations are paged in from its spill
+    ot::OperationPtr op = operationLog_.canCatchUp(step.baseRevision)
+        ? transformLocked(step.op, step.baseRevision)
+        : historyManager_.rebase(step);
+    if (!op) {
+        return -1;
+    }
+    op->setSource(step.op->getSource());
+    if (auto related = step.op->getRelatedOperationId()) {
+        op->setRelatedOperationId(*related);
+    }
+    op->setId(nextOperationId_++);
+    
+    // Capture deleted text so the step can itself be reverted
+    ot::OperationPtr applied = op->applyAndCapture(document_);
+    if (!applied) {
+        return -1;
+    }
+    int64_t revision = operationLog_.headRevision();
+    commitOperation(applied, userId, false);
+    return revision;
+}
+
+bool DocumentController::canUndo(const std::string& userId) const {
+    return historyManager_.canUndo(userId);
+}
+
+bool DocumentController::canRedo(const std::string& userId) const {
+    return historyManager_.canRedo(userId);
+}
+
+HistoryManager::HistoryPage DocumentController::historyEntries(const std::string& userId, size_t from,
+                                                               size_t count) const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return historyManager_.entries(userId, from, count);
+}
+
+std::string DocumentController::getDocument() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return contentLocked().toString();
+}
+
+int64_t DocumentController::getRevision() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return revision_;
+}
+
+DocumentController::DocumentSnapshot DocumentController::getSnapshot() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return DocumentSnapshot{contentLocked(), revision_};
+}
+
+DocumentController::ContentHashes DocumentController::getContentHashes(size_t prefixLength, size_t suffixLength) const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    ContentHashes hashes;
+    hashes.root = contentHash_.root();
+    hashes.length = contentHash_.length();
+    hashes.revision = revision_;
+    if (prefixLength == 0 && suffixLength == 0) {
+        return hashes;
+    }
+    const ot::Rope content = contentLocked();
+    if (prefixLength > 0) {
+        hashes.prefix = contentHash_.prefix(prefixLength, content);
+    }
+    if (suffixLength > 0) {
+        hashes.suffix = contentHash_.suffix(suffixLength, content);
+    }
+    return hashes;
+}
+
+ot::AnnotationStore::Id DocumentController::addAnnotation(size_t start, size_t end, std::string author, std::string text) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return annotations_.add(start, end, std::move(author), std::move(text));
+}
+
+bool DocumentController::removeAnnotation(ot::AnnotationStore::Id id) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return annotations_.remove(id);
+}
+
+DocumentController::AnnotationView DocumentController::getAnnotations(size_t from, size_t to) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return AnnotationView{annotations_.inRange(from, to), revision_};
+}
+
+DocumentController::LoadStats DocumentController::getLoadStats() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    LoadStats stats;
+    stats.operationsApplied = operationsApplied_;
+    stats.transformNanos = transformNanos_;
+    stats.historyLength = operationLog_.size();
+    stats.memoryBytes = (hibernated_ ? hibernated_->compressed.size() : document_.length()) + operationLog_.bytes();
+    return stats;
+}
+
+std::optional<DocumentController::DocumentSnapshot> DocumentController::materializeAt(int64_t revision) const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    if (revision == revision_) {
+        return DocumentSnapshot{contentLocked(), revision_};
+    }
+    if (revision < 0 || revision > revision_) {
+        return std::nullopt;
+    }
+    
+    std::optional<ot::Rope> content = checkpoints_.materializeAt(revision, operationLog_);
+    if (!content) {
+        return std::nullopt;
+    }
+    return DocumentSnapshot{std::move(*content), revision};
+}
+
+int64_t DocumentController::getOldestRevision() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return operationLog_.firstRevision();
+}
+
+std::optional<std::vector<ot::OperationPtr>> DocumentController::getOperationsSince(int64_t revision) const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    if (!operationLog_.canCatchUp(revision)) {
+        return std::nullopt;
+    }
+    std::span<const ot::OperationPtr> since = operationLog_.since(revision);
+    return std::vector<ot::OperationPtr>(since.begin(), since.end());
+}
+
+std::optional<std::vector<ot::OperationPtr>> DocumentController::getOperationsFrom(int64_t revision,
+                                                                                size_t maxCount) const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    if (!operationLog_.canReplay(revision)) {
+        return std::nullopt;
+    }
+    const size_t count = std::min(maxCount, static_cast<size_t>(revision_ - revision));
+    if (operationLog_.canCatchUp(revision)) {
+        std::span<const ot::OperationPtr> since = operationLog_.since(revision).first(count);
+        return std::vector<ot::OperationPtr>(since.begin(), since.end());
+    }
+    std::vector<ot::OperationPtr> operations;
+    operations.reserve(count);
+    for (int64_t at = revision; at < revision + static_cast<int64_t>(count); ++at) {
+        ot::OperationPtr op = operationLog_.fetch(at);
+        if (!op) {
+            return std::nullopt;
+        }
+        operations.push_back(std::move(op));
+    }
+    return operations;
+}
+
+void DocumentController::setHistoryBudget(size_t documentBytes, size_t userBytes,
+                                          const std::filesystem::path& spillPath) {
+    std::shared_ptr<ot::OperationSegment> spill;
+    if (!spillPath.empty()) {
+        spill = std::make_shared<ot::OperationSegment>(spillPath);
+    }
+    
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    // The spill goes first so whatever the budget drops is kept on disk
+    operationLog_.setSpill(std::move(spill));
+    operationLog_.setByteBudget(documentBytes);
+    historyManager_.setByteBudget(userBytes);
+}
+
+void DocumentController::compactBefore(int64_t revision) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    compactLocked(std::min(revision, revision_));
+}
+
+bool DocumentController::hibernate() {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return hibernateLocked();
+}
+
+bool DocumentController::hibernateIfIdle(std::chrono::steady_clock::duration idleFor) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    if (hibernated_ || std::chrono::steady_clock::now() - lastEdit_ < idleFor) {
+        return false;
+    }
+    return hibernateLocked();
+}
+
+bool DocumentController::isHibernating() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return hibernated_.has_value();
+}
+
+size_t DocumentController::getTextBytes() const {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return hibernated_ ? hibernated_->compressed.size() : document_.length();
+}
+
+std::shared_ptr<ChangeFeed::Subscription> DocumentController::subscribeChanges(size_t maxPending) {
+    return changeFeed_.subscribe(maxPending);
+}
+
+void DocumentController::registerChangeCallback(DocumentChangeCallback callback) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    changeCallback_ = std::move(callback);
+}
+
+void DocumentController::registerSnapshotCallback(SnapshotCallback callback) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    snapshotCallback_ = std::move(callback);
+}
+
+void DocumentController::registerOperationCallback(OperationCallback callback) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    operationCallback_ = std::move(callback);
+}
+
+int64_t DocumentController::generateOperationId() {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return nextOperationId_++;
+}
+
+ot::OperationPtr DocumentController::transformOperation(const ot::OperationPtr& op, int64_t baseRevision) {
+    if (!op) {
+        return nullptr;
+    }
+    
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    return transformLocked(op, baseRevision);
+}
+
+ot::OperationPtr DocumentController::transformLocked(const ot::OperationPtr& op, int64_t baseRevision) {
+    baseRevision = std::min(baseRevision, revision_);
+    if (!operationLog_.canCatchUp(baseRevision)) {
+        return nullptr;
+    }
+    
+    ElapsedTime elapsed(transformNanos_);
+    return operationLog_.transformSince(op, baseRevision);
+}
+
+std::optional<ot::ValueOperation> DocumentController::transformOperation(const ot::ValueOperation& op, int64_t baseRevision) {
+    std::lock_guard<util::ProfiledMutex> lock(documentMutex_);
+    
+    baseRevision = std::min(baseRevision, revision_);
+    if (!operationLog_.canCatchUp(baseRevision)) {
+        return std::nullopt;
+    }
+    
+    ElapsedTime elapsed(transformNanos_);
+    std::optional<ot::ValueOperation> result = op;
+    for (const auto& entry : operationLog_.since(baseRevision)) {
+        result = ot::transform(*result, *entry);
+        if (!result) {
+            break;
+        }
+    }
+    
+    return result;
+}
+
+bool DocumentController::applyLocked(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo) {
+    if (op->getId() == 0) {
+        op->setId(nextOperationId_++);
+    }
+    
+    // Only undoable operations pay for capturing deleted text
+    if (recordForUndo) {
+        ot::OperationPtr captured = op->applyAndCapture(document_);
+        if (!captured) {
+            return false;
+        }
+        commitOperation(captured, userId, true);
+        return true;
+    }
+    
+    if (!op->apply(document_)) {
+        return false;
+    }
+    
+    commitOperation(op, userId, false);
+    return true;
+}
+
+void DocumentController::commitOperation(const ot::OperationPtr& op, const std::string& userId, bool recordForUndo) {
+    int64_t logged = operationLog_.append(op);
+    revision_++;
+    operationsApplied_++;
+    lastEdit_ = std::chrono::steady_clock::now();
+    checkpoints_.record(*op, document_, revision_);
+    if (!contentHash_.apply(*op, document_)) {
+        contentHash_.reset(document_);
+    }
+    if (!annotations_.apply(*op)) {
+        annotations_.reset(document_.length());
+    }
+    
+    if (recordForUndo) {
+        historyManager_.recordOperation(logged, userId);
+    }
+    if (operationCallback_) {
+        operationCallback_(op, userId, revision_);
+    }
+    if (changeFeed_.hasSubscribers()) {
+        unpublished_.push_back(ChangeFeed::Event{revision_, op, userId});
+    }
+}
+
+void DocumentController::compactLocked(int64_t revision) {
+    if (revision <= operationLog_.firstRevision()) {
+        return;
+    }
+    
+    // Past revisions from here on stay rebuildable without the released operations
+    checkpoints_.compactTo(revision, operationLog_);
+    operationLog_.discardBefore(revision);
+}
+
+bool DocumentController::hibernateLocked() {
+    if (hibernated_) {
+        return false;
+    }
+    compactLocked(revision_);
+    
+    // The fastest level: a sleeping document is woken by the next keystroke
+    const std::string text = document_.toString();
+    hibernated_ = Hibernated{util::deflateCompress(text, {}, 1), text.size()};
+    document_ = ot::Rope();
+    // The checkpoint at the current revision would otherwise keep the text alive
+    checkpoints_.reset(document_, revision_);
+    return true;
+}
+
+void DocumentController::wakeLocked() {
+    if (!hibernated_) {
+        return;
+    }
+    document_ = contentLocked();
+    hibernated_.reset();
+    checkpoints_.reset(document_, revision_);
+}
+
+ot::Rope DocumentController::contentLocked() const {
+    if (!hibernated_) {
+        return document_;
+    }
+    std::string text;
+    util::inflateDecompress(hibernated_->compressed, hibernated_->length, text);
+    return ot::Rope(text);
+}
+
+void DocumentController::notifyDocumentChanged() {
+    // Called with documentMutex_ held; only string listeners pay for a full copy
+    if (snapshotCallback_) {
+        snapshotCallback_(DocumentSnapshot{document_, revision_});
+    }
+    if (changeCallback_) {
+        changeCallback_(document_.toString(), revision_);
+    }
+}
+
+void DocumentController::publishChanges(std::unique_lock<util::ProfiledMutex>& lock) {
+    if (unpublished_.empty()) {
+        return;
+    }
+    std::vector<ChangeFeed::Event> events = std::move(unpublished_);
+    unpublished_.clear();
+    
+    // Taken before the document is unlocked, so the next apply cannot publish ahead of these
+    std::lock_guard<std::mutex> order(publishMutex_);
+    lock.unlock();
+    changeFeed_.publish(events);
+}
+
+} // namespace collab
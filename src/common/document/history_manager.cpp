@@ -1,4 +1,372 @@
-#include <iostream>
-namespace collab { namespace common {
-void history_manager_placeholder() { std::cout << "History manager placeholder" << std::endl; }
-}} // namespace collab::common
+#include "common/document/history_manager.h"
+#include "common/ot/bulk_transform.h"
+#include "common/ot/transform_arena.h"
+#include <algorithm>
+#include <cctype>
+#include <span>
+#include <stdexcept>
+
+namespace collab {
+
+namespace {
+
+bool isSpace(char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+// Whether text added after `previous` starts a new word with `next`
+bool startsWord(char previous, char next) {
+    return isSpace(previous) && !isSpace(next);
+}
+
+// Whether next, applied right after previous, continues the same run of typing or deleting
+bool continues(const ot::Operation& previous, const ot::Operation& next, bool breakAtWords) {
+    if (previous.getKind() == ot::OperationKind::INSERT && next.getKind() == ot::OperationKind::INSERT) {
+        const auto& before = static_cast<const ot::InsertOperation&>(previous);
+        const auto& after = static_cast<const ot::InsertOperation&>(next);
+        if (after.getPosition() != before.getPosition() + before.getText().length()) {
+            return false;
+        }
+        return !breakAtWords || before.getText().empty() || after.getText().empty() ||
+               !startsWord(before.getText().back(), after.getText().front());
+    }
+    
+    if (previous.getKind() == ot::OperationKind::DELETE && next.getKind() == ot::OperationKind::DELETE) {
+        const auto& before = static_cast<const ot::DeleteOperation&>(previous);
+        const auto& after = static_cast<const ot::DeleteOperation&>(next);
+        const std::string& deleted = before.getDeletedText();
+        const std::string& more = after.getDeletedText();
+        if (deleted.empty() || more.empty()) {
+            return false;
+        }
+        // Backspacing meets the text before the run, forward deletes the text after it
+        if (after.getPosition() + after.getLength() == before.getPosition()) {
+            return !breakAtWords || !startsWord(deleted.front(), more.back());
+        }
+        if (after.getPosition() == before.getPosition()) {
+            return !breakAtWords || !startsWord(deleted.back(), more.front());
+        }
+    }
+    
+    return false;
+}
+
+size_t costOf(const ot::OperationPtr& op) {
+    return op ? ot::changedLength(*op) : 0;
+}
+
+} // namespace
+
+HistoryManager::HistoryManager(const ot::OperationLog& log, size_t maxHistorySize, UndoGroupingPolicy grouping)
+    : log_(log), maxHistorySize_(maxHistorySize), grouping_(grouping) {
+}
+
+void HistoryManager::recordOperation(int64_t revision, const std::string& userId, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    UserHistory& history = historyOf(userId);
+    history.redoStack.clear();
+    
+    if (continuesGroup(history, revision, now)) {
+        Entry& top = history.undoStack.back();
+        size_t cost = costOf(log_.at(revision));
+        top.last = revision;
+        top.bytes += cost;
+        history.bytes += cost;
+        trimUserHistory(history);
+    } else {
+        pushEntry(history, revision);
+    }
+    history.groupOpen = true;
+    history.lastRecorded = now;
+}
+
+HistoryManager::Step HistoryManager::undo(const std::string& userId) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    
+    UserHistory* history = findHistory(userId);
+    if (!history) {
+        return {};
+    }
+    history->groupOpen = false;
+    
+    while (!history->undoStack.empty()) {
+        Entry entry = history->undoStack.back();
+        history->undoStack.pop_back();
+        history->bytes -= entry.bytes;
+        
+        ot::OperationPtr op = merge(entry);
+        if (!op) {
+            continue;
+        }
+        
+        ot::OperationPtr inverseOp;
+        try {
+            inverseOp = op->inverse();
+        } catch (const std::exception&) {
+            // The operation cannot be inverted, leave the history untouched
+            history->undoStack.push_back(entry);
+            history->bytes += entry.bytes;
+            return {};
+        }
+        
+        inverseOp->setSource(ot::OperationSource::LOCAL_UNDO);
+        inverseOp->setRelatedOperationId(op->getId());
+        return {inverseOp, entry.last + 1};
+    }
+    return {};
+}
+
+void HistoryManager::recordUndo(int64_t revision, const std::string& userId) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    historyOf(userId).redoStack.push_back(revision);
+}
+
+HistoryManager::Step HistoryManager::redo(const std::string& userId) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    
+    UserHistory* history = findHistory(userId);
+    if (!history) {
+        return {};
+    }
+    history->groupOpen = false;
+    
+    // Redoing reverts the undo
+    while (!history->redoStack.empty()) {
+        int64_t revision = history->redoStack.back();
+        history->redoStack.pop_back();
+        
+        ot::OperationPtr undoOp = log_.fetch(revision);
+        if (!undoOp) {
+            continue;
+        }
+        
+        ot::OperationPtr redoOp;
+        try {
+            redoOp = undoOp->inverse();
+        } catch (const std::exception&) {
+            history->redoStack.push_back(revision);
+            return {};
+        }
+        
+        redoOp->setSource(ot::OperationSource::LOCAL_REDO);
+        redoOp->setRelatedOperationId(undoOp->getRelatedOperationId().value_or(undoOp->getId()));
+        return {redoOp, revision + 1};
+    }
+    return {};
+}
+
+void HistoryManager::recordRedo(int64_t revision, const std::string& userId) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    UserHistory& history = historyOf(userId);
+    pushEntry(history, revision);
+    history.groupOpen = false;
+}
+
+ot::OperationPtr HistoryManager::rebase(const Step& step) const {
+    if (!step.op || !log_.canReplay(step.baseRevision)) {
+        return nullptr;
+    }
+    
+    // Deep undo reaches below what the log keeps in memory: page the rest in from its spill
+    std::vector<ot::OperationPtr> paged;
+    std::span<const ot::OperationPtr> concurrent;
+    if (log_.canCatchUp(step.baseRevision)) {
+        concurrent = log_.since(step.baseRevision);
+    } else {
+        try {
+            paged = log_.collect(step.baseRevision);
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+        concurrent = paged;
+    }
+    
+    ot::OperationPtr op = ot::transformThrough(step.op, concurrent);
+    if (!op) {
+        return nullptr;
+    }
+    
+    // Transforms build new operations; keep what the step says it is
+    if (op != step.op) {
+        op->setSource(step.op->getSource());
+        if (auto related = step.op->getRelatedOperationId()) {
+            op->setRelatedOperationId(*related);
+        }
+    }
+    return op;
+}
+
+bool HistoryManager::canUndo(const std::string& userId) const {
+    return undoCount(userId) > 0;
+}
+
+bool HistoryManager::canRedo(const std::string& userId) const {
+    return redoCount(userId) > 0;
+}
+
+size_t HistoryManager::undoCount(const std::string& userId) const {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    const UserHistory* history = findHistory(userId);
+    return history ? history->undoStack.size() : 0;
+}
+
+size_t HistoryManager::redoCount(const std::string& userId) const {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    const UserHistory* history = findHistory(userId);
+    return history ? history->redoStack.size() : 0;
+}
+
+HistoryManager::HistoryPage HistoryManager::entries(const std::string& userId, size_t from, size_t count) const {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    HistoryPage page;
+    const UserHistory* history = findHistory(userId);
+    if (!history) {
+        return page;
+    }
+    page.undoCount = history->undoStack.size();
+    page.redoCount = history->redoStack.size();
+    
+    const size_t end = std::min(from + count, page.redoCount + page.undoCount);
+    for (size_t row = from; row < end; ++row) {
+        EntryInfo info;
+        if (row < page.redoCount) {
+            // The stack is oldest undo first, so its front is the furthest redo
+            info.first = info.last = history->redoStack[row];
+            info.undone = true;
+            info.op = log_.at(info.first);
+        } else {
+            const Entry& entry = history->undoStack[page.undoCount - 1 - (row - page.redoCount)];
+            info.first = entry.first;
+            info.last = entry.last;
+            info.bytes = entry.bytes;
+            info.op = merge(entry, false);
+        }
+        page.entries.push_back(std::move(info));
+    }
+    return page;
+}
+
+void HistoryManager::clearUserHistory(const std::string& userId) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    if (UserHistory* history = findHistory(userId)) {
+        // The ID stays interned; releasing the stacks is what saves memory
+        *history = UserHistory{};
+    }
+}
+
+void HistoryManager::clearAllHistory() {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    userIndices_.clear();
+    users_.clear();
+}
+
+size_t HistoryManager::totalOperationCount() const {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    size_t total = 0;
+    for (const auto& history : users_) {
+        total += history.undoStack.size() + history.redoStack.size();
+    }
+    return total;
+}
+
+void HistoryManager::setGroupingPolicy(UndoGroupingPolicy grouping) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    grouping_ = grouping;
+    for (auto& history : users_) {
+        history.groupOpen = false;
+    }
+}
+
+void HistoryManager::setByteBudget(size_t bytesPerUser) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    byteBudget_ = bytesPerUser;
+    for (auto& history : users_) {
+        trimUserHistory(history);
+    }
+}
+
+size_t HistoryManager::historyBytes(const std::string& userId) const {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    const UserHistory* history = findHistory(userId);
+    return history ? history->bytes : 0;
+}
+
+HistoryManager::UserHistory& HistoryManager::historyOf(const std::string& userId) {
+    auto [it, inserted] = userIndices_.try_emplace(userId, static_cast<uint32_t>(users_.size()));
+    if (inserted) {
+        users_.emplace_back();
+    }
+    return users_[it->second];
+}
+
+HistoryManager::UserHistory* HistoryManager::findHistory(const std::string& userId) {
+    auto it = userIndices_.find(userId);
+    return it == userIndices_.end() ? nullptr : &users_[it->second];
+}
+
+const HistoryManager::UserHistory* HistoryManager::findHistory(const std::string& userId) const {
+    auto it = userIndices_.find(userId);
+    return it == userIndices_.end() ? nullptr : &users_[it->second];
+}
+
+bool HistoryManager::continuesGroup(const UserHistory& history, int64_t revision, Clock::time_point now) const {
+    if (!history.groupOpen || history.undoStack.empty() || grouping_.idleGap.count() <= 0 ||
+        now - history.lastRecorded >= grouping_.idleGap) {
+        return false;
+    }
+    
+    // Anything logged in between, from anyone, moved the text under the run
+    const Entry& top = history.undoStack.back();
+    if (top.last + 1 != revision) {
+        return false;
+    }
+    
+    ot::OperationPtr previous = log_.fetch(top.last);
+    ot::OperationPtr next = log_.at(revision);
+    return previous && next && continues(*previous, *next, grouping_.breakAtWords);
+}
+
+void HistoryManager::pushEntry(UserHistory& history, int64_t revision) {
+    size_t bytes = sizeof(Entry) + costOf(log_.at(revision));
+    history.undoStack.push_back({revision, revision, bytes});
+    history.bytes += bytes;
+    trimUserHistory(history);
+}
+
+ot::OperationPtr HistoryManager::merge(const Entry& entry, bool pageIn) const {
+    auto lookup = [&](int64_t revision) { return pageIn ? log_.fetch(revision) : log_.at(revision); };
+    ot::OperationPtr first = lookup(entry.first);
+    if (!first || !lookup(entry.last)) {
+        return nullptr;
+    }
+    if (entry.first == entry.last) {
+        return first;
+    }
+    
+    // Only grouped runs of inserts or of deletes share an entry, and each one extends the last
+    ot::OperationPtr merged = first->clone();
+    merged->setId(first->getId());
+    for (int64_t revision = entry.first + 1; revision <= entry.last; ++revision) {
+        ot::OperationPtr next = lookup(revision);
+        if (!next) {
+            return nullptr;
+        }
+        bool extended = merged->getKind() == ot::OperationKind::INSERT
+            ? static_cast<ot::InsertOperation&>(*merged).extend(static_cast<const ot::InsertOperation&>(*next))
+            : static_cast<ot::DeleteOperation&>(*merged).extend(static_cast<const ot::DeleteOperation&>(*next));
+        if (!extended) {
+            return nullptr;
+        }
+    }
+    return merged;
+}
+
+void HistoryManager::trimUserHistory(UserHistory& history) {
+    while (history.undoStack.size() > maxHistorySize_ ||
+           (byteBudget_ > 0 && history.bytes > byteBudget_ && history.undoStack.size() > 1)) {
+        history.bytes -= history.undoStack.front().bytes;
+        history.undoStack.pop_front();
+    }
+}
+
+} // namespace collab
@@ -1,4 +1,286 @@
-#include <iostream>
-namespace collab { namespace common {
-void operation_manager_placeholder() { std::cout << "Operation manager placeholder" << std::endl; }
-}} // namespace collab::common
+#include "common/document/operation_manager.h"
+#include "common/ot/transform_arena.h"
+#include "common/util/logger.h"
+#include "common/util/metrics.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+namespace collab {
+
+namespace {
+
+// Transform time of one operation, by how many operations it was transformed past
+util::Histogram& transformTime(int64_t distance) {
+    static const std::array<const char*, 5> bounds = {"1", "8", "64", "512", "+Inf"};
+    static const std::array<util::Histogram*, 5> histograms = [] {
+        std::array<util::Histogram*, 5> result{};
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            result[i] = &util::metrics().histogram(
+                "collab_ot_transform_seconds", "Time to transform an operation past the history it missed",
+                {{"history_le", bounds[i]}}, util::NANOSECONDS_PER_SECOND);
+        }
+        return result;
+    }();
+    size_t bucket = 0;
+    for (int64_t bound = 1; bucket + 1 < bounds.size() && distance > bound; bound *= 8) {
+        ++bucket;
+    }
+    return *histograms[bucket];
+}
+
+// How many operations each transformed operation missed
+util::Histogram& transformDistance() {
+    static util::Histogram& histogram = util::metrics().histogram(
+        "collab_ot_transform_history_ops", "Operations an incoming operation was transformed past");
+    return histogram;
+}
+
+} // namespace
+
+OperationManager::OperationManager(size_t logRetention)
+    : operationHistory_(logRetention),
+      currentRevision_(0) {
+}
+
+ot::OperationPtr OperationManager::processOperation(
+    const ot::OperationPtr& op, 
+    const std::string& clientId,
+    int64_t baseRevision) {
+    
+    std::optional<ot::RegionSet::Region> lockedBy;
+    return processOperation(op, clientId, baseRevision, lockedBy);
+}
+
+ot::OperationPtr OperationManager::processOperation(
+    const ot::OperationPtr& op, 
+    const std::string& clientId,
+    int64_t baseRevision,
+    std::optional<ot::RegionSet::Region>& lockedBy) {
+    
+    lockedBy.reset();
+    if (!op) {
+        return nullptr;
+    }
+    
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    ++operationsProcessed_;
+    
+    if (!operationHistory_.canCatchUp(baseRevision)) {
+        LOGF_DEBUG("Operation from {} at revision {} is behind the history at {}",
+                   clientId, baseRevision, currentRevision_);
+        return nullptr;
+    }
+    trackClientRevision(clientId, baseRevision);
+    
+    if (baseRevision >= currentRevision_) {
+        return touchesLocked(*op, lockedBy) ? nullptr : op;
+    }
+    
+    LOGF_DEBUG("Transforming operation from {} from revision {} to {}", clientId, baseRevision, currentRevision_);
+    const auto started = std::chrono::steady_clock::now();
+    auto result = transformOperation(op, baseRevision);
+    recordTransform(currentRevision_ - baseRevision, started);
+    return result && touchesLocked(*result, lockedBy) ? nullptr : result;
+}
+
+std::optional<ot::ValueOperation> OperationManager::processOperation(
+    const ot::ValueOperation& op, 
+    const std::string& clientId,
+    int64_t baseRevision) {
+    
+    std::optional<ot::RegionSet::Region> lockedBy;
+    return processOperation(op, clientId, baseRevision, lockedBy);
+}
+
+std::optional<ot::ValueOperation> OperationManager::processOperation(
+    const ot::ValueOperation& op, 
+    const std::string& clientId,
+    int64_t baseRevision,
+    std::optional<ot::RegionSet::Region>& lockedBy) {
+    
+    lockedBy.reset();
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    ++operationsProcessed_;
+    
+    if (!operationHistory_.canCatchUp(baseRevision)) {
+        LOGF_DEBUG("Operation from {} at revision {} is behind the history at {}",
+                   clientId, baseRevision, currentRevision_);
+        return std::nullopt;
+    }
+    trackClientRevision(clientId, baseRevision);
+    
+    if (baseRevision >= currentRevision_) {
+        return touchesLocked(op, lockedBy) ? std::nullopt : std::optional<ot::ValueOperation>(op);
+    }
+    
+    LOGF_DEBUG("Transforming operation from {} from revision {} to {}", clientId, baseRevision, currentRevision_);
+    const auto started = std::chrono::steady_clock::now();
+    auto result = transformOperation(op, baseRevision);
+    recordTransform(currentRevision_ - baseRevision, started);
+    return result && touchesLocked(*result, lockedBy) ? std::nullopt : result;
+}
+
+void OperationManager::recordOperation(const ot::OperationPtr& op) {
+    if (!op) {
+        return;
+    }
+    
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    operationHistory_.append(op);
+    currentRevision_ = operationHistory_.headRevision();
+    regions_.transform(*op);
+}
+
+void OperationManager::recordOperation(const ot::ValueOperation& op) {
+    recordOperation(ot::toOperation(op));
+}
+
+ot::RegionSet::Id OperationManager::addRegion(size_t start, size_t end, ot::RegionSet::Attributes attributes,
+                                               std::string label) {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return regions_.add(start, end, attributes, std::move(label));
+}
+
+bool OperationManager::removeRegion(ot::RegionSet::Id id) {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return regions_.remove(id);
+}
+
+std::vector<ot::RegionSet::Region> OperationManager::getRegions() const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return regions_.regions();
+}
+
+bool OperationManager::touchesLocked(const ot::Operation& op, std::optional<ot::RegionSet::Region>& lockedBy) {
+    const ot::RegionSet::Region* region = regions_.empty() ? nullptr : regions_.lockedAt(op);
+    if (!region) {
+        return false;
+    }
+    lockedBy = *region;
+    ++operationsLocked_;
+    return true;
+}
+
+bool OperationManager::touchesLocked(const ot::ValueOperation& op, std::optional<ot::RegionSet::Region>& lockedBy) {
+    const ot::RegionSet::Region* region = regions_.empty() ? nullptr : regions_.lockedAt(op);
+    if (!region) {
+        return false;
+    }
+    lockedBy = *region;
+    ++operationsLocked_;
+    return true;
+}
+
+int64_t OperationManager::getCurrentRevision() const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return currentRevision_;
+}
+
+int64_t OperationManager::acknowledgeRevision(const std::string& clientId, int64_t revision) {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    trackClientRevision(clientId, std::min(revision, currentRevision_));
+    return lowWatermarkLocked();
+}
+
+int64_t OperationManager::removeClient(const std::string& clientId) {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    clientRevisions_.erase(clientId);
+    return releaseBelowWatermark();
+}
+
+int64_t OperationManager::getLowWatermark() const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return lowWatermarkLocked();
+}
+
+bool OperationManager::needsResync(int64_t baseRevision) const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    return !operationHistory_.canCatchUp(baseRevision);
+}
+
+OperationManager::WatermarkStats OperationManager::getWatermarkStats() const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    WatermarkStats stats;
+    stats.logLength = operationHistory_.size();
+    stats.currentRevision = currentRevision_;
+    stats.lowWatermark = currentRevision_;
+    stats.trackedClients = clientRevisions_.size();
+    stats.releasedOperations = releasedOperations_;
+    for (const auto& [clientId, revision] : clientRevisions_) {
+        if (revision < stats.lowWatermark) {
+            stats.lowWatermark = revision;
+            stats.laggingClient = clientId;
+        }
+    }
+    return stats;
+}
+
+OperationManager::LoadStats OperationManager::getLoadStats() const {
+    std::lock_guard<util::ProfiledMutex> lock(mutex_);
+    LoadStats stats;
+    stats.operationsProcessed = operationsProcessed_;
+    stats.operationsTransformed = operationsTransformed_;
+    stats.transformNanos = transformNanos_;
+    stats.operationsLocked = operationsLocked_;
+    stats.historyLength = operationHistory_.size();
+    return stats;
+}
+
+void OperationManager::recordTransform(int64_t distance, std::chrono::steady_clock::time_point started) {
+    const auto nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count());
+    ++operationsTransformed_;
+    transformNanos_ += nanos;
+    transformDistance().record(static_cast<uint64_t>(distance));
+    transformTime(distance).record(nanos);
+}
+
+ot::OperationPtr OperationManager::transformOperation(
+    const ot::OperationPtr& op, 
+    int64_t baseRevision) {
+    
+    return operationHistory_.transformSince(op, baseRevision);
+}
+
+std::optional<ot::ValueOperation> OperationManager::transformOperation(
+    const ot::ValueOperation& op, 
+    int64_t baseRevision) {
+    
+    std::optional<ot::ValueOperation> result = op;
+    for (const auto& entry : operationHistory_.since(baseRevision)) {
+        result = ot::transform(*result, *entry);
+        if (!result) {
+            break;
+        }
+    }
+    
+    return result;
+}
+
+void OperationManager::trackClientRevision(const std::string& clientId, int64_t revision) {
+    auto [it, inserted] = clientRevisions_.try_emplace(clientId, revision);
+    if (!inserted) {
+        it->second = std::max(it->second, revision);
+    }
+    releaseBelowWatermark();
+}
+
+int64_t OperationManager::releaseBelowWatermark() {
+    // Nobody can ask to be transformed from below the watermark any more
+    int64_t watermark = lowWatermarkLocked();
+    size_t before = operationHistory_.size();
+    operationHistory_.discardBefore(watermark);
+    releasedOperations_ += before - operationHistory_.size();
+    return watermark;
+}
+
+int64_t OperationManager::lowWatermarkLocked() const {
+    int64_t watermark = currentRevision_;
+    for (const auto& [clientId, revision] : clientRevisions_) {
+        watermark = std::min(watermark, revision);
+    }
+    return watermark;
+}
+
+} // namespace collab
@@ -1,66 +1,253 @@
 #include "common/models/file_system.h"
 
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+
 namespace collab {
 namespace fs {
 
-// File class method implementations
-std::string File::getPath() const {
-    auto parent = getParent().lock();
+// FileSystemNode method implementations
+void FileSystemNode::setName(const std::string& name) {
+    std::shared_ptr<PathIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        name_ = name;
+        index = pathIndex_;
+    }
+    bumpEpoch(index);
+}
+
+void FileSystemNode::setParent(std::weak_ptr<Directory> parent) {
+    std::shared_ptr<PathIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        parent_ = parent;
+        index = pathIndex_;
+    }
+    bumpEpoch(index);
+}
+
+void FileSystemNode::updateModifiedTime() {
+    const auto now = std::chrono::system_clock::now();
+    modifiedTime_.store(now);
+    if (isDirectory()) {
+        raise(static_cast<Directory*>(this)->latestModifiedTime_, now);
+    }
+    for (auto dir = getParent().lock(); dir; dir = dir->getParent().lock()) {
+        raise(dir->latestModifiedTime_, now);
+    }
+}
+
+FileSystemNode::Paths FileSystemNode::paths() const {
+    std::shared_ptr<PathIndex> index;
+    uint64_t epoch = NO_EPOCH;
+    std::string name;
+    std::shared_ptr<Directory> parent;
+    {
+        std::lock_guard<std::mutex> lock(nodeMutex_);
+        index = pathIndex_;
+        // Read the epoch before the names, so a rename after it outdates what is built from them
+        if (index) {
+            epoch = index->epoch.load(std::memory_order_acquire);
+            if (cachedEpoch_ == epoch) {
+                return Paths{cachedPath_, cachedRelativePath_};
+            }
+        }
+        name = name_;
+        parent = parent_.lock();
+    }
+    
+    Paths paths;
     if (parent) {
-        std::string parentPath = parent->getPath();
-        if (parentPath == "/") {
-            return parentPath + getName();
-        } else {
-            return parentPath + "/" + getName();
+        const Paths parentPaths = parent->paths();
+        paths.absolute = parentPaths.absolute == "/" ? parentPaths.absolute + name : parentPaths.absolute + "/" + name;
+        paths.relative = parentPaths.relative.empty() ? name : parentPaths.relative + "/" + name;
+    } else {
+        // A file without a directory is just its name; a root directory is absolute
+        paths.absolute = isDirectory() ? "/" + name : name;
+    }
+    
+    std::lock_guard<std::mutex> lock(nodeMutex_);
+    if (index && pathIndex_ == index) {
+        cachedPath_ = paths.absolute;
+        cachedRelativePath_ = paths.relative;
+        cachedEpoch_ = epoch;
+    }
+    return paths;
+}
+
+void FileSystemNode::indexSubtree(const std::shared_ptr<FileSystemNode>& node, const std::shared_ptr<PathIndex>& index) {
+    {
+        std::lock_guard<std::mutex> lock(node->nodeMutex_);
+        node->pathIndex_ = index;
+        node->cachedEpoch_ = NO_EPOCH;
+    }
+    const std::string path = node->getRelativePath();
+    {
+        std::unique_lock<std::shared_mutex> lock(index->mutex);
+        index->nodes[path] = node;
+    }
+    if (node->isDirectory()) {
+        auto directory = std::static_pointer_cast<Directory>(node);
+        std::shared_lock<std::shared_mutex> lock(directory->mutex_);
+        for (const auto& entry : directory->children_) {
+            indexSubtree(entry.node, index);
         }
     }
-    return getName();
 }
 
-// Directory class method implementations
-std::size_t Directory::getSize() const {
-    std::size_t totalSize = 0;
-    for (const auto& pair : children_) {
-        totalSize += pair.second->getSize();
+void FileSystemNode::unindexSubtree(const std::shared_ptr<FileSystemNode>& node) {
+    if (auto index = node->indexOf()) {
+        const std::string path = node->getRelativePath();
+        {
+            std::unique_lock<std::shared_mutex> lock(index->mutex);
+            auto it = index->nodes.find(path);
+            if (it != index->nodes.end() && it->second.lock() == node) {
+                index->nodes.erase(it);
+            }
+        }
+        std::lock_guard<std::mutex> lock(node->nodeMutex_);
+        node->pathIndex_.reset();
+        node->cachedEpoch_ = NO_EPOCH;
+    }
+    if (node->isDirectory()) {
+        auto directory = std::static_pointer_cast<Directory>(node);
+        std::shared_lock<std::shared_mutex> lock(directory->mutex_);
+        for (const auto& entry : directory->children_) {
+            unindexSubtree(entry.node);
+        }
     }
-    return totalSize;
 }
 
+// File class method implementations
+std::string File::getPath() const {
+    return cachedPath();
+}
+
+// Directory class method implementations
 std::string Directory::getPath() const {
-    auto parent = getParent().lock();
-    if (parent) {
-        std::string parentPath = parent->getPath();
-        if (parentPath == "/") {
-            return parentPath + getName();
+    return cachedPath();
+}
+
+void Directory::adjustAggregates(std::ptrdiff_t sizeDelta, std::ptrdiff_t fileDelta) {
+    // One directory at a time, each step atomic with reading its parent (see reparent)
+    std::shared_ptr<Directory> dir = std::static_pointer_cast<Directory>(shared_from_this());
+    while (dir) {
+        std::lock_guard<std::mutex> lock(dir->nodeMutex_);
+        // Unsigned wrap-around makes adding a negative delta a subtraction
+        dir->totalSize_ += static_cast<std::size_t>(sizeDelta);
+        dir->fileCount_ += static_cast<std::size_t>(fileDelta);
+        dir = dir->parent_.lock();
+    }
+}
+
+Directory::Totals Directory::reparent(FileSystemNode& node, std::weak_ptr<Directory> parent) {
+    // A file's size only changes under its content lock, which is taken before nodeMutex_
+    std::shared_lock<std::shared_mutex> content;
+    if (node.isFile()) {
+        content = std::shared_lock<std::shared_mutex>(static_cast<File&>(node).contentMutex_);
+    }
+    Totals totals;
+    std::shared_ptr<PathIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(node.nodeMutex_);
+        node.parent_ = parent;
+        index = node.pathIndex_;
+        if (node.isFile()) {
+            totals = Totals{static_cast<File&>(node).content_.size(), 1};
         } else {
-            return parentPath + "/" + getName();
+            auto& directory = static_cast<Directory&>(node);
+            totals = Totals{directory.totalSize_.load(), directory.fileCount_.load()};
         }
     }
-    return "/" + getName();
+    bumpEpoch(index);
+    return totals;
+}
+
+std::shared_ptr<PathIndex> Directory::treeIndex() {
+    if (auto index = indexOf()) {
+        return index;
+    }
+    std::shared_ptr<PathIndex> index;
+    if (auto parent = getParent().lock()) {
+        index = parent->treeIndex();
+    } else {
+        index = std::make_shared<PathIndex>();
+        index->root = std::static_pointer_cast<Directory>(shared_from_this());
+    }
+    // Another thread may have made one meanwhile; keep the first
+    std::lock_guard<std::mutex> lock(nodeMutex_);
+    if (!pathIndex_) {
+        pathIndex_ = index;
+    }
+    return pathIndex_;
 }
 
 bool Directory::addNode(std::shared_ptr<FileSystemNode> node) {
-    if (children_.find(node->getName()) != children_.end()) {
+    const std::string name = node->getName();
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = findChild(name);
+    if (it != children_.end() && it->name == name) {
         return false; // Name conflict
     }
     
-    node->setParent(std::static_pointer_cast<Directory>(shared_from_this()));
-    children_[node->getName()] = node;
+    // It may come from another tree, or be the root of its own
+    unindexSubtree(node);
+    const Totals totals = reparent(*node, std::static_pointer_cast<Directory>(shared_from_this()));
+    children_.insert(it, Entry{name, node});
+    // A path being built from before the move must not be cached once the node is back in the index
+    const auto index = treeIndex();
+    bumpEpoch(index);
+    indexSubtree(node, index);
+    adjustAggregates(static_cast<std::ptrdiff_t>(totals.size), static_cast<std::ptrdiff_t>(totals.files));
+    lock.unlock();
+    // Now is later than anything in the subtree, so this covers its modified times too
+    updateModifiedTime();
+    return true;
+}
+
+bool Directory::removeNode(const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = findChild(name);
+    if (it == children_.end() || it->name != name) {
+        return false;
+    }
+    auto node = it->node;
+    children_.erase(it);
+    unindexSubtree(node);
+    const Totals totals = reparent(*node, std::weak_ptr<Directory>());
+    adjustAggregates(-static_cast<std::ptrdiff_t>(totals.size), -static_cast<std::ptrdiff_t>(totals.files));
+    lock.unlock();
     updateModifiedTime();
     return true;
 }
 
 bool Directory::renameNode(const std::string& oldName, const std::string& newName) {
-    if (children_.find(newName) != children_.end()) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto target = findChild(newName);
+    if (target != children_.end() && target->name == newName) {
         return false; // New name already exists
     }
     
-    auto it = children_.find(oldName);
-    if (it != children_.end()) {
-        auto node = it->second;
-        children_.erase(it);
+    auto it = findChild(oldName);
+    if (it != children_.end() && it->name == oldName) {
+        auto node = it->node;
+        // Slide the entries between the two positions over by one instead of erasing and inserting
+        if (target > it) {
+            std::rotate(it, it + 1, target);
+            it = target - 1;
+        } else {
+            std::rotate(target, it, it + 1);
+            it = target;
+        }
+        it->name = newName;
+        unindexSubtree(node);
         node->setName(newName);
-        children_[newName] = node;
+        const auto index = treeIndex();
+        bumpEpoch(index);
+        indexSubtree(node, index);
+        lock.unlock();
         updateModifiedTime();
         return true;
     }
@@ -85,20 +272,22 @@ std::shared_ptr<Directory> Directory::createDirectory(const std::string& name, c
 }
 
 std::vector<std::shared_ptr<File>> Directory::getFiles() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     std::vector<std::shared_ptr<File>> files;
-    for (const auto& pair : children_) {
-        if (pair.second->isFile()) {
-            files.push_back(std::static_pointer_cast<File>(pair.second));
+    for (const auto& entry : children_) {
+        if (entry.node->isFile()) {
+            files.push_back(std::static_pointer_cast<File>(entry.node));
         }
     }
     return files;
 }
 
 std::vector<std::shared_ptr<Directory>> Directory::getSubdirectories() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     std::vector<std::shared_ptr<Directory>> directories;
-    for (const auto& pair : children_) {
-        if (pair.second->isDirectory()) {
-            directories.push_back(std::static_pointer_cast<Directory>(pair.second));
+    for (const auto& entry : children_) {
+        if (entry.node->isDirectory()) {
+            directories.push_back(std::static_pointer_cast<Directory>(entry.node));
         }
     }
     return directories;
@@ -107,36 +296,59 @@ std::vector<std::shared_ptr<Directory>> Directory::getSubdirectories() const {
 std::shared_ptr<FileSystemNode> Directory::getNodeByPath(const std::string& path) {
     if (path.empty()) return nullptr;
     
-    // Handle absolute paths
+    auto index = treeIndex();
+    auto root = index->root.lock();
+    if (!root) {
+        return nullptr;
+    }
+    
+    // Absolute paths start at the root of the tree, relative ones here
+    std::string key;
     if (path[0] == '/') {
-        // Find the root directory
-        std::shared_ptr<Directory> root = std::static_pointer_cast<Directory>(shared_from_this());
-        while (auto parent = root->getParent().lock()) {
-            root = parent;
-        }
-        
-        // If this is just the root directory
         if (path == "/") return root;
-        
-        // Otherwise, resolve the path relative to the root
-        return root->getNodeByPath(path.substr(1));
+        key = path.substr(1);
+    } else {
+        const std::string base = getRelativePath();
+        key = base.empty() ? path : base + "/" + path;
     }
     
-    // Handle relative paths
-    size_t pos = path.find('/');
-    if (pos == std::string::npos) {
-        // This is the final component of the path
-        return getNode(path);
+    std::shared_ptr<FileSystemNode> node;
+    {
+        std::shared_lock<std::shared_mutex> lock(index->mutex);
+        auto it = index->nodes.find(key);
+        if (it != index->nodes.end()) {
+            node = it->second.lock();
+        }
+    }
+    if (node && node->indexOf() == index && node->getRelativePath() == key) {
+        return node;
+    }
+    
+    // Not indexed, e.g. renamed through setName(): find it the slow way and remember it
+    node = root->walkPath(key);
+    const bool indexed = node && node->indexOf() == index;
+    std::unique_lock<std::shared_mutex> lock(index->mutex);
+    if (indexed) {
+        index->nodes[key] = node;
     } else {
-        // We need to traverse deeper
-        std::string dirName = path.substr(0, pos);
-        std::string remainingPath = path.substr(pos + 1);
-        
-        auto node = getNode(dirName);
-        if (node && node->isDirectory()) {
-            return std::static_pointer_cast<Directory>(node)->getNodeByPath(remainingPath);
+        index->nodes.erase(key);
+    }
+    return node;
+}
+
+std::shared_ptr<FileSystemNode> Directory::walkPath(std::string_view path) {
+    std::shared_ptr<FileSystemNode> node = shared_from_this();
+    while (true) {
+        const size_t pos = path.find('/');
+        auto child = std::static_pointer_cast<Directory>(node)->getNode(path.substr(0, pos));
+        if (!child || pos == std::string_view::npos) {
+            return child;
         }
-        return nullptr;
+        if (!child->isDirectory()) {
+            return nullptr;
+        }
+        node = child;
+        path.remove_prefix(pos + 1);
     }
 }
 
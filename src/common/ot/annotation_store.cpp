@@ -0,0 +1,237 @@
+#include "annotation_store.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+AnnotationStore::Id AnnotationStore::add(size_t start, size_t end, std::string author, std::string text) {
+    rebase();
+    if (end < start || end > length_) {
+        throw std::invalid_argument("Annotation [" + std::to_string(start) + ", " + std::to_string(end) +
+                                    "] does not fit a document of length " + std::to_string(length_));
+    }
+    Slot slot;
+    if (freeSlots_.empty()) {
+        slot = static_cast<Slot>(annotations_.size());
+        annotations_.emplace_back();
+    } else {
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    }
+    const Id id = nextId_++;
+    annotations_[slot] = Annotation{id, start, end, std::move(author), std::move(text)};
+    slotOf_[id] = slot;
+
+    auto byStart = std::upper_bound(byStart_.begin(), byStart_.end(), start, [this](size_t offset, Slot other) {
+        return offset < annotations_[other].start;
+    });
+    const size_t index = static_cast<size_t>(byStart - byStart_.begin());
+    byStart_.insert(byStart, slot);
+    auto byEnd = std::upper_bound(byEnd_.begin(), byEnd_.end(), end, [this](size_t offset, Slot other) {
+        return offset < annotations_[other].end;
+    });
+    byEnd_.insert(byEnd, slot);
+    refresh(index);
+    return id;
+}
+
+bool AnnotationStore::remove(Id id) {
+    auto found = slotOf_.find(id);
+    if (found == slotOf_.end()) {
+        return false;
+    }
+    rebase();
+    const Slot slot = found->second;
+    const Annotation& annotation = annotations_[slot];
+    auto byStart = locate(byStart_, slot, annotation.start, [](const Annotation& a) { return a.start; });
+    const size_t index = static_cast<size_t>(byStart - byStart_.begin());
+    byStart_.erase(byStart);
+    byEnd_.erase(locate(byEnd_, slot, annotation.end, [](const Annotation& a) { return a.end; }));
+    annotations_[slot] = Annotation{};
+    freeSlots_.push_back(slot);
+    slotOf_.erase(found);
+    refresh(index);
+    return true;
+}
+
+std::optional<AnnotationStore::Annotation> AnnotationStore::find(Id id) {
+    auto found = slotOf_.find(id);
+    if (found == slotOf_.end()) {
+        return std::nullopt;
+    }
+    rebase();
+    return annotations_[found->second];
+}
+
+void AnnotationStore::reset(size_t documentLength) {
+    pending_.reset();
+    length_ = documentLength;
+    for (const auto& [id, slot] : slotOf_) {
+        Annotation& annotation = annotations_[slot];
+        annotation.start = std::min(annotation.start, documentLength);
+        annotation.end = std::min(annotation.end, documentLength);
+    }
+    // Clamping keeps each order sorted
+    refresh(0);
+}
+
+bool AnnotationStore::apply(const Operation& op) {
+    try {
+        compose(TextOperation::fromOperation(op, length()));
+        return true;
+    } catch (const std::invalid_argument&) {
+        return false;
+    }
+}
+
+bool AnnotationStore::apply(const ValueOperation& op) {
+    const OperationPtr converted = toOperation(op);
+    return converted && apply(*converted);
+}
+
+bool AnnotationStore::apply(std::span<const OperationPtr> ops) {
+    for (const auto& op : ops) {
+        if (op && !apply(*op)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AnnotationStore::compose(const TextOperation& edit) {
+    if (edit.isNoop()) {
+        return;
+    }
+    // Nothing to move: only the length changes
+    if (slotOf_.empty()) {
+        length_ = edit.getTargetLength();
+        pending_.reset();
+        return;
+    }
+    pending_ = pending_ ? pending_->compose(edit) : edit;
+    if (pending_->getComponents().size() > REBASE_THRESHOLD) {
+        rebase();
+    }
+}
+
+template <typename Position>
+void AnnotationStore::remap(const TextOperation& edit, const std::vector<Slot>& order, Position position, bool after) {
+    size_t oldOffset = 0;
+    size_t newOffset = 0;
+    auto it = order.begin();
+    for (const TextComponent& component : edit.getComponents()) {
+        switch (component.type) {
+            case TextComponent::Type::RETAIN:
+                for (; it != order.end() && position(*it) < oldOffset + component.count; ++it) {
+                    position(*it) = position(*it) - oldOffset + newOffset;
+                }
+                oldOffset += component.count;
+                newOffset += component.count;
+                break;
+            case TextComponent::Type::INSERT:
+                // Positions where the text goes stay before it, unless they stick after it
+                if (!after) {
+                    for (; it != order.end() && position(*it) <= oldOffset; ++it) {
+                        position(*it) = newOffset;
+                    }
+                }
+                newOffset += component.count;
+                break;
+            case TextComponent::Type::DELETE:
+                for (; it != order.end() && position(*it) < oldOffset + component.count; ++it) {
+                    position(*it) = newOffset;
+                }
+                oldOffset += component.count;
+                break;
+        }
+    }
+    // At the end of the document
+    for (; it != order.end(); ++it) {
+        position(*it) = position(*it) - oldOffset + newOffset;
+    }
+}
+
+void AnnotationStore::rebase() {
+    if (!pending_) {
+        return;
+    }
+    const TextOperation edit = std::move(*pending_);
+    pending_.reset();
+    length_ = edit.getTargetLength();
+    ++rebases_;
+
+    // Starts stick after inserted text and ends before it, so it lands outside the range
+    remap(edit, byStart_, [this](Slot slot) -> size_t& { return annotations_[slot].start; }, true);
+    remap(edit, byEnd_, [this](Slot slot) -> size_t& { return annotations_[slot].end; }, false);
+
+    // A point where text went in stays before it; only that can reorder the starts
+    bool reordered = false;
+    for (Slot slot : byStart_) {
+        Annotation& annotation = annotations_[slot];
+        if (annotation.start > annotation.end) {
+            annotation.start = annotation.end;
+            reordered = true;
+        }
+    }
+    if (reordered) {
+        std::stable_sort(byStart_.begin(), byStart_.end(), [this](Slot a, Slot b) {
+            return annotations_[a].start < annotations_[b].start;
+        });
+    }
+    refresh(0);
+}
+
+std::vector<AnnotationStore::Annotation> AnnotationStore::inRange(size_t from, size_t to) {
+    rebase();
+    // The annotations starting by the viewport's end; walk back while the furthest of them reaches it
+    const auto last = std::upper_bound(byStart_.begin(), byStart_.end(), to, [this](size_t offset, Slot slot) {
+        return offset < annotations_[slot].start;
+    });
+    std::vector<Annotation> found;
+    for (size_t i = static_cast<size_t>(last - byStart_.begin()); i > 0 && reach_[i - 1] >= from; --i) {
+        const Annotation& annotation = annotations_[byStart_[i - 1]];
+        if (annotation.end >= from) {
+            found.push_back(annotation);
+        }
+    }
+    std::reverse(found.begin(), found.end());
+    return found;
+}
+
+std::string AnnotationStore::serialize(const std::vector<Annotation>& annotations) {
+    nlohmann::json j = nlohmann::json::array();
+    for (const Annotation& annotation : annotations) {
+        j.push_back({{"id", annotation.id},
+                     {"start", annotation.start},
+                     {"end", annotation.end},
+                     {"author", annotation.author},
+                     {"text", annotation.text}});
+    }
+    return j.dump();
+}
+
+void AnnotationStore::refresh(size_t from) {
+    reach_.resize(byStart_.size());
+    for (size_t i = from; i < byStart_.size(); ++i) {
+        const size_t end = annotations_[byStart_[i]].end;
+        reach_[i] = i > 0 ? std::max(reach_[i - 1], end) : end;
+    }
+}
+
+template <typename Position>
+std::vector<AnnotationStore::Slot>::iterator AnnotationStore::locate(std::vector<Slot>& order, Slot slot, size_t at,
+                                                                     Position position) {
+    // Among those at the same position, the slot itself
+    auto it = std::lower_bound(order.begin(), order.end(), at, [&](Slot other, size_t offset) {
+        return position(annotations_[other]) < offset;
+    });
+    while (*it != slot) {
+        ++it;
+    }
+    return it;
+}
+
+} // namespace ot
+} // namespace collab
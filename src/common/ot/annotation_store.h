@@ -0,0 +1,177 @@
+// FILE: include/common/ot/annotation_store.h
+// Description: Comments anchored to ranges of a document, rebased through its edits in bulk
+
+#pragma once
+
+#include "operation.h"
+#include "text_operation.h"
+#include "value_operation.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Inline comments and other annotations of a document, each anchored to a
+ * range that follows the text it was made on through every edit.
+ *
+ * Anchors are offsets moved as every client moves its cursors (see
+ * cursor_transform.h), but sticky at the edges: text inserted where a
+ * range starts or ends lands outside it, and within a point annotation's
+ * range, after it. A range whose text is deleted collapses to a point
+ * where it was, and the annotation stays, for its thread to be resolved.
+ *
+ * Edits are not applied to the anchors one at a time. Each is composed
+ * into a pending TextOperation, and the anchors are rebased through it in
+ * one pass once something reads them, or once it has grown past
+ * REBASE_THRESHOLD components: the starts and the ends are each kept
+ * sorted, an edit never reorders them, so the pass merges each order with
+ * the components instead of looking every anchor up. Typing into a
+ * document with ten thousand comments composes a keystroke into a few
+ * components, whatever the number of comments.
+ *
+ * inRange() finds the annotations of a viewport by binary search on the
+ * starts, walking back only as far as the greatest end of the annotations
+ * up to a start still reaches the viewport (as RegionSet does), so only
+ * those are read and serialized for a client.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+class AnnotationStore {
+public:
+    using Id = uint32_t;
+
+    // Pending components past which edits are rebased at once rather than on the next read
+    static constexpr size_t REBASE_THRESHOLD = 64;
+
+    struct Annotation {
+        Id id = 0;
+        size_t start = 0;
+        size_t end = 0;             // At least start; equal for a point
+        std::string author;
+        std::string text;
+    };
+
+    explicit AnnotationStore(size_t documentLength = 0)
+        : length_(documentLength) {}
+
+    /**
+     * Annotate a range
+     *
+     * @param start Where it starts
+     * @param end Where it ends, at or past start
+     * @param author Who made it
+     * @param text What it says
+     * @return Its ID
+     * @throws std::invalid_argument if the range does not fit the document
+     */
+    Id add(size_t start, size_t end, std::string author, std::string text);
+
+    // Drop an annotation; false if it is not there
+    bool remove(Id id);
+
+    // An annotation as it is now, or std::nullopt
+    std::optional<Annotation> find(Id id);
+
+    size_t size() const {
+        return slotOf_.size();
+    }
+
+    bool empty() const {
+        return slotOf_.empty();
+    }
+
+    // Length of the document, with the pending edits
+    size_t length() const {
+        return pending_ ? pending_->getTargetLength() : length_;
+    }
+
+    // Start over from a document of this length, clamping the anchors to it, e.g. when the text was replaced
+    void reset(size_t documentLength);
+
+    /**
+     * Account for an applied operation; a composite's children apply in order
+     *
+     * @param op The operation, as applied to the document
+     * @return False, changing nothing, if it does not fit the document
+     */
+    bool apply(const Operation& op);
+    bool apply(const ValueOperation& op);
+
+    // Account for a batch of applied operations, oldest first; false, from the first that does not fit
+    bool apply(std::span<const OperationPtr> ops);
+
+    // Move the anchors through the pending edits now
+    void rebase();
+
+    /**
+     * The annotations touching [from, to], sorted by start
+     * Rebases the pending edits first.
+     *
+     * @param from Where the viewport starts
+     * @param to Where it ends
+     */
+    std::vector<Annotation> inRange(size_t from, size_t to);
+
+    // Every annotation, sorted by start
+    std::vector<Annotation> all() {
+        return inRange(0, length());
+    }
+
+    // Edits composed but not yet applied to the anchors
+    bool pending() const {
+        return pending_.has_value();
+    }
+
+    // Rebase passes so far
+    uint64_t rebases() const {
+        return rebases_;
+    }
+
+    /**
+     * Serialize annotations for a client, e.g. a viewport's from inRange()
+     *
+     * @return A JSON array of {"id", "start", "end", "author", "text"}
+     */
+    static std::string serialize(const std::vector<Annotation>& annotations);
+
+private:
+    using Slot = uint32_t;
+
+    // Compose an edit into the pending ones, rebasing once they grow too long
+    void compose(const TextOperation& edit);
+
+    /**
+     * Move positions, sorted in the order given, through an edit; where
+     * text is inserted at a position, after keeps the position after it
+     */
+    template <typename Position>
+    static void remap(const TextOperation& edit, const std::vector<Slot>& order, Position position, bool after);
+
+    // Recompute the greatest ends from a start on
+    void refresh(size_t from);
+
+    // Where a slot is in an order, by its position
+    template <typename Position>
+    std::vector<Slot>::iterator locate(std::vector<Slot>& order, Slot slot, size_t at, Position position);
+
+    std::vector<Annotation> annotations_;       // By slot; freed slots are reused
+    std::vector<Slot> freeSlots_;
+    std::unordered_map<Id, Slot> slotOf_;
+    std::vector<Slot> byStart_;                 // Sorted by start
+    std::vector<Slot> byEnd_;                   // Sorted by end
+    std::vector<size_t> reach_;                 // Greatest end of byStart_[0..i]
+    std::optional<TextOperation> pending_;      // Composed since the last rebase
+    size_t length_;                             // As of the last rebase
+    uint64_t rebases_ = 0;
+    Id nextId_ = 1;
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,133 @@
+#include "bulk_transform.h"
+#include "transform_arena.h"
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+TextOperation composeSpan(TextOperation composed, std::span<const OperationPtr> history) {
+    for (const auto& op : history) {
+        composed = composed.compose(TextOperation::fromOperation(*op, composed.getTargetLength()));
+    }
+    return composed;
+}
+
+} // namespace
+
+HistoryComposer::HistoryComposer(size_t maxCachedRanges)
+    : maxCachedRanges_(maxCachedRanges) {
+}
+
+const TextOperation& HistoryComposer::compose(
+    int64_t fromRevision, 
+    std::span<const OperationPtr> history, 
+    size_t baseLength) {
+    
+    int64_t toRevision = fromRevision + static_cast<int64_t>(history.size());
+    auto it = cache_.find(fromRevision);
+    
+    // Reuse a cached prefix of this range and compose only the new entries
+    if (it != cache_.end() && it->second.toRevision <= toRevision &&
+        it->second.composed.getBaseLength() == baseLength) {
+        size_t cached = static_cast<size_t>(it->second.toRevision - fromRevision);
+        it->second.composed = composeSpan(std::move(it->second.composed), history.subspan(cached));
+        it->second.toRevision = toRevision;
+        return it->second.composed;
+    }
+    
+    TextOperation start;
+    start.retain(baseLength);
+    Entry entry{toRevision, composeSpan(std::move(start), history)};
+    
+    if (it != cache_.end()) {
+        it->second = std::move(entry);
+        return it->second.composed;
+    }
+    
+    // Evict the oldest starting revision; reconnecting clients tend to be recent
+    if (cache_.size() >= maxCachedRanges_ && !cache_.empty()) {
+        cache_.erase(cache_.begin());
+    }
+    return cache_.emplace(fromRevision, std::move(entry)).first->second.composed;
+}
+
+void HistoryComposer::invalidateFrom(int64_t revision) {
+    for (auto it = cache_.begin(); it != cache_.end();) {
+        if (it->second.toRevision > revision) {
+            it = cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void HistoryComposer::evictBefore(int64_t revision) {
+    cache_.erase(cache_.begin(), cache_.lower_bound(revision));
+}
+
+int64_t lengthDelta(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT:
+            return static_cast<int64_t>(static_cast<const InsertOperation&>(op).getText().length());
+        case OperationKind::DELETE:
+            return -static_cast<int64_t>(static_cast<const DeleteOperation&>(op).getLength());
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            return static_cast<int64_t>(replace.getText().length()) - static_cast<int64_t>(replace.getLength());
+        }
+        case OperationKind::COMPOSITE: {
+            int64_t delta = 0;
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                delta += lengthDelta(*child);
+            }
+            return delta;
+        }
+    }
+    return 0;
+}
+
+size_t changedLength(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT:
+            return static_cast<const InsertOperation&>(op).getText().length();
+        case OperationKind::DELETE:
+            return static_cast<const DeleteOperation&>(op).getLength();
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            return replace.getLength() + replace.getText().length();
+        }
+        case OperationKind::COMPOSITE: {
+            size_t length = 0;
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                length += changedLength(*child);
+            }
+            return length;
+        }
+    }
+    return 0;
+}
+
+TextOperation transformAgainst(const TextOperation& op, const TextOperation& composedHistory) {
+    // History goes first so it wins insert ties, as in the single-step rules
+    return TextOperation::transform(composedHistory, op).second;
+}
+
+OperationPtr transformAgainst(const Operation& op, const TextOperation& composedHistory) {
+    TextOperation text = TextOperation::fromOperation(op, composedHistory.getBaseLength());
+    OperationPtr result = transformAgainst(text, composedHistory).toOperation();
+    result->setId(op.getId());
+    result->setSource(op.getSource());
+    if (auto related = op.getRelatedOperationId()) {
+        result->setRelatedOperationId(*related);
+    }
+    return result;
+}
+
+OperationPtr transformAgainst(const Operation& op, std::span<const OperationPtr> history) {
+    // Not through a composition of the span: its ties can differ from those of the entries
+    return transformThrough(op.clone(), history);
+}
+
+} // namespace ot
+} // namespace collab
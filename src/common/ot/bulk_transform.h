@@ -0,0 +1,137 @@
+// FILE: include/common/ot/bulk_transform.h
+// Description: Transform an operation against a whole range of history, and compose such ranges
+
+#pragma once
+
+#include "operation.h"
+#include "text_operation.h"
+#include <cstdint>
+#include <map>
+#include <span>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Composes contiguous ranges of an operation log into a single TextOperation
+ * and caches the result keyed by the first revision of the range.
+ * A cached range is extended in place as the log grows, so clients that
+ * reconnect from the same revision share one composition.
+ * Not thread-safe; the owner serializes access.
+ */
+class HistoryComposer {
+public:
+    /**
+     * Constructor
+     * 
+     * @param maxCachedRanges Number of starting revisions to keep cached
+     */
+    explicit HistoryComposer(size_t maxCachedRanges = 16);
+    
+    /**
+     * Compose log entries [fromRevision, fromRevision + history.size())
+     * 
+     * @param fromRevision Revision the range starts at
+     * @param history Log entries starting at fromRevision
+     * @param baseLength Length of the document at fromRevision
+     * @return The composed range
+     * @throws std::invalid_argument if the history does not fit baseLength
+     */
+    const TextOperation& compose(int64_t fromRevision, std::span<const OperationPtr> history, size_t baseLength);
+    
+    /**
+     * Drop every cached range that ends after the given revision
+     * Used when the log is rewritten or truncated
+     * 
+     * @param revision First revision that changed
+     */
+    void invalidateFrom(int64_t revision);
+    
+    /**
+     * Drop every cached range that starts before the given revision
+     * Used when the start of the log has been released
+     * 
+     * @param revision Oldest revision still in the log
+     */
+    void evictBefore(int64_t revision);
+    
+    /**
+     * Drop all cached ranges
+     */
+    void clear() {
+        cache_.clear();
+    }
+    
+    /**
+     * Get number of cached ranges
+     * 
+     * @return Cache size
+     */
+    size_t size() const {
+        return cache_.size();
+    }
+
+private:
+    struct Entry {
+        int64_t toRevision;
+        TextOperation composed;
+    };
+    
+    size_t maxCachedRanges_;
+    std::map<int64_t, Entry> cache_;
+};
+
+/**
+ * Net change in document length caused by an operation
+ * 
+ * @param op The operation
+ * @return Characters inserted minus characters deleted
+ */
+int64_t lengthDelta(const Operation& op);
+
+/**
+ * Number of characters an operation inserts or deletes
+ * 
+ * @param op The operation
+ * @return Characters inserted plus characters deleted
+ */
+size_t changedLength(const Operation& op);
+
+/**
+ * Transform an operation against a composed run of concurrent history
+ * Inserts at the same position as a history insert are placed after it,
+ * matching the single-step transform rules. A run that puts text in and
+ * later moves or deletes around it can meet an insert at a different tie
+ * than its parts do, so this can differ from transforming through the run;
+ * the server transforms client operations with the span overload instead.
+ * 
+ * @param op Operation created against the document at the start of the run
+ * @param composedHistory The composed run
+ * @return Operation applicable after the run
+ */
+TextOperation transformAgainst(const TextOperation& op, const TextOperation& composedHistory);
+
+/**
+ * Transform a polymorphic operation against a composed run of history
+ * The result keeps the id, source and related id of the input.
+ * 
+ * @param op Operation created against the document at the start of the run
+ * @param composedHistory The composed run
+ * @return Operation applicable after the run
+ */
+OperationPtr transformAgainst(const Operation& op, const TextOperation& composedHistory);
+
+/**
+ * Transform an operation against a contiguous span of history
+ * One transform step per entry, with the intermediate results in a
+ * TransformArena, so the result is the stepwise one however long the span.
+ * The result keeps the id, source and related id of the input.
+ * 
+ * @param op Operation created against the document at the start of the span
+ * @param history Concurrent operations, oldest first
+ * @return Operation applicable after the span
+ */
+OperationPtr transformAgainst(const Operation& op, std::span<const OperationPtr> history);
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,80 @@
+#include "checkpoint_store.h"
+#include <algorithm>
+
+namespace collab {
+namespace ot {
+
+CheckpointStore::CheckpointStore(size_t opsInterval, size_t bytesInterval, size_t maxCheckpoints)
+    : opsInterval_(std::max<size_t>(opsInterval, 1)),
+      bytesInterval_(std::max<size_t>(bytesInterval, 1)),
+      maxCheckpoints_(std::max<size_t>(maxCheckpoints, 1)) {
+}
+
+void CheckpointStore::reset(const Rope& content, int64_t revision) {
+    checkpoints_.clear();
+    checkpoint(content, revision);
+}
+
+void CheckpointStore::record(const Operation& op, const Rope& content, int64_t revision) {
+    opsSince_++;
+    bytesSince_ += changedLength(op);
+    if (opsSince_ >= opsInterval_ || bytesSince_ >= bytesInterval_) {
+        checkpoint(content, revision);
+    }
+}
+
+std::optional<Rope> CheckpointStore::materializeAt(int64_t revision, const OperationLog& log) const {
+    // Nearest checkpoint at or before the revision
+    auto it = checkpoints_.upper_bound(revision);
+    if (it == checkpoints_.begin()) {
+        return std::nullopt;
+    }
+    --it;
+    
+    Rope content = it->second;
+    if (it->first == revision) {
+        return content;
+    }
+    if (revision > log.headRevision() || !log.canCatchUp(it->first)) {
+        return std::nullopt;
+    }
+    
+    std::span<const OperationPtr> delta = log.since(it->first).first(static_cast<size_t>(revision - it->first));
+    for (const auto& op : delta) {
+        if (!op->apply(content)) {
+            return std::nullopt;
+        }
+    }
+    return content;
+}
+
+bool CheckpointStore::compactTo(int64_t revision, const OperationLog& log) {
+    if (checkpoints_.count(revision)) {
+        return true;
+    }
+    
+    std::optional<Rope> content = materializeAt(revision, log);
+    if (!content) {
+        return false;
+    }
+    // Off the periodic schedule: the count towards the next checkpoint carries on
+    checkpoints_.emplace(revision, std::move(*content));
+    trim();
+    return checkpoints_.count(revision) > 0;
+}
+
+void CheckpointStore::checkpoint(const Rope& content, int64_t revision) {
+    checkpoints_.insert_or_assign(revision, content);
+    opsSince_ = 0;
+    bytesSince_ = 0;
+    trim();
+}
+
+void CheckpointStore::trim() {
+    while (checkpoints_.size() > maxCheckpoints_) {
+        checkpoints_.erase(checkpoints_.begin());
+    }
+}
+
+} // namespace ot
+} // namespace collab
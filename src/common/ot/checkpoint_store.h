@@ -0,0 +1,96 @@
+// FILE: include/common/ot/checkpoint_store.h
+// Description: Periodic document checkpoints for reconstructing past revisions
+
+#pragma once
+
+#include "bulk_transform.h"
+#include "operation.h"
+#include "operation_log.h"
+#include "rope.h"
+#include <cstdint>
+#include <map>
+#include <optional>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Copy-on-write snapshots of a document taken every so many operations or
+ * changed bytes, indexed by revision.
+ * A past revision is rebuilt from the nearest checkpoint at or before it by
+ * replaying only the logged operations in between, instead of the whole
+ * history. Snapshots share unchanged chunks with the live document and
+ * with each other, so a checkpoint costs little more than the text that
+ * changed since the previous one. Checkpoints older than the log are
+ * kept, up to the limit, so those revisions can still be rebuilt exactly.
+ * Not thread-safe; the owner serializes access.
+ */
+class CheckpointStore {
+public:
+    /**
+     * Constructor
+     * 
+     * @param opsInterval Operations between checkpoints (default: 256)
+     * @param bytesInterval Characters inserted or deleted between checkpoints (default: 64 KiB)
+     * @param maxCheckpoints Checkpoints kept; the oldest go first (default: 256)
+     */
+    explicit CheckpointStore(size_t opsInterval = 256, size_t bytesInterval = 64 * 1024, size_t maxCheckpoints = 256);
+    
+    /**
+     * Drop all checkpoints and start again from a document
+     * 
+     * @param content The document
+     * @param revision Its revision
+     */
+    void reset(const Rope& content, int64_t revision);
+    
+    /**
+     * Account for an applied operation, checkpointing the document when due
+     * 
+     * @param op The operation just applied
+     * @param content The document after it
+     * @param revision The revision after it
+     */
+    void record(const Operation& op, const Rope& content, int64_t revision);
+    
+    /**
+     * Rebuild the document at a past revision
+     * 
+     * @param revision The revision
+     * @param log Operations applied since the checkpoints were taken
+     * @return The document, or std::nullopt if no checkpoint precedes the
+     *         revision or the operations after it are no longer logged
+     */
+    std::optional<Rope> materializeAt(int64_t revision, const OperationLog& log) const;
+    
+    /**
+     * Fold the logged operations below a revision into a checkpoint at it,
+     * so the log can release them and the revision still be rebuilt
+     * 
+     * @param revision The revision
+     * @param log Operations applied since the checkpoints were taken
+     * @return false if the revision could not be rebuilt to checkpoint it
+     */
+    bool compactTo(int64_t revision, const OperationLog& log);
+    
+    size_t size() const {
+        return checkpoints_.size();
+    }
+
+private:
+    void checkpoint(const Rope& content, int64_t revision);
+    
+    // Drop the oldest checkpoints over the limit
+    void trim();
+    
+    size_t opsInterval_;
+    size_t bytesInterval_;
+    size_t maxCheckpoints_;
+    std::map<int64_t, Rope> checkpoints_;
+    // Changes since the last checkpoint
+    size_t opsSince_ = 0;
+    size_t bytesSince_ = 0;
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,158 @@
+#include "client_sync.h"
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+ClientSync::ClientSync(int64_t revision, size_t documentLength)
+    : revision_(revision), documentLength_(documentLength) {
+}
+
+void ClientSync::setSendCallback(SendCallback callback) {
+    sendCallback_ = std::move(callback);
+}
+
+void ClientSync::setJournal(std::shared_ptr<OfflineJournal> journal) {
+    journal_ = std::move(journal);
+    journalState();
+}
+
+bool ClientSync::restore(const OfflineJournal& journal) {
+    if (journal.empty()) {
+        return false;
+    }
+    revision_ = journal.baseRevision();
+    outstanding_ = journal.pending();
+    buffer_.reset();
+    documentLength_ = outstanding_->getTargetLength();
+    state_ = State::AWAITING_CONFIRM;
+    return true;
+}
+
+void ClientSync::applyClient(const Operation& op) {
+    TextOperation local = TextOperation::fromOperation(op, documentLength_);
+    documentLength_ = local.getTargetLength();
+    if (journal_) {
+        // Everything unconfirmed is based on revision_, so a local edit extends the journal as is;
+        // remote edits while synchronized are not journaled, so the first edit starts it over
+        if (state_ == State::SYNCHRONIZED) {
+            journal_->reset(revision_, local.getBaseLength(), local);
+        } else {
+            journal_->append(local);
+        }
+    }
+    
+    switch (state_) {
+        case State::SYNCHRONIZED:
+            outstanding_ = std::move(local);
+            state_ = State::AWAITING_CONFIRM;
+            send(*outstanding_);
+            break;
+        case State::AWAITING_CONFIRM:
+            buffer_ = std::move(local);
+            state_ = State::AWAITING_WITH_BUFFER;
+            break;
+        case State::AWAITING_WITH_BUFFER:
+            buffer_ = buffer_->compose(local);
+            break;
+    }
+}
+
+OperationPtr ClientSync::applyServer(const Operation& op) {
+    // The server document is the local one without what is still pending
+    size_t serverLength = outstanding_ ? outstanding_->getBaseLength() : documentLength_;
+    TextOperation remote = TextOperation::fromOperation(op, serverLength);
+    revision_++;
+    return transformRemote(std::move(remote));
+}
+
+OperationPtr ClientSync::applyServerBatch(std::span<const OperationPtr> ops) {
+    if (ops.empty()) {
+        return nullptr;
+    }
+    size_t serverLength = outstanding_ ? outstanding_->getBaseLength() : documentLength_;
+    TextOperation remote = TextOperation::fromOperation(*ops.front(), serverLength);
+    for (size_t i = 1; i < ops.size(); ++i) {
+        remote = remote.compose(TextOperation::fromOperation(*ops[i], remote.getTargetLength()));
+    }
+    revision_ += static_cast<int64_t>(ops.size());
+    return transformRemote(std::move(remote));
+}
+
+OperationPtr ClientSync::transformRemote(TextOperation remote) {
+    if (outstanding_) {
+        auto [remotePrime, outstandingPrime] = TextOperation::transform(remote, *outstanding_);
+        outstanding_ = std::move(outstandingPrime);
+        remote = std::move(remotePrime);
+    }
+    if (buffer_) {
+        auto [remotePrime, bufferPrime] = TextOperation::transform(remote, *buffer_);
+        buffer_ = std::move(bufferPrime);
+        remote = std::move(remotePrime);
+    }
+    
+    documentLength_ = remote.getTargetLength();
+    if (outstanding_) {
+        journalState();
+    }
+    OperationPtr result = remote.toOperation();
+    result->setSource(OperationSource::REMOTE);
+    return result;
+}
+
+void ClientSync::serverAck() {
+    if (!outstanding_) {
+        throw std::logic_error("No operation is awaiting confirmation");
+    }
+    
+    revision_++;
+    outstanding_.reset();
+    if (state_ == State::AWAITING_WITH_BUFFER) {
+        // Everything edited during the round trip goes out as one operation
+        outstanding_ = std::move(buffer_);
+        buffer_.reset();
+        state_ = State::AWAITING_CONFIRM;
+        send(*outstanding_);
+    } else {
+        state_ = State::SYNCHRONIZED;
+    }
+    journalState();
+}
+
+void ClientSync::resend() {
+    if (outstanding_) {
+        send(*outstanding_);
+    }
+}
+
+void ClientSync::reset(int64_t revision, size_t documentLength) {
+    state_ = State::SYNCHRONIZED;
+    revision_ = revision;
+    documentLength_ = documentLength;
+    outstanding_.reset();
+    buffer_.reset();
+    journalState();
+}
+
+void ClientSync::journalState() {
+    if (!journal_) {
+        return;
+    }
+    if (!outstanding_) {
+        journal_->reset(revision_, documentLength_);
+        return;
+    }
+    TextOperation pending = buffer_ ? outstanding_->compose(*buffer_) : *outstanding_;
+    journal_->reset(revision_, pending.getBaseLength(), pending);
+}
+
+void ClientSync::send(const TextOperation& op) {
+    if (sendCallback_) {
+        OperationPtr sent = op.toOperation();
+        sent->setSource(OperationSource::LOCAL);
+        sendCallback_(sent, revision_);
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,184 @@
+// FILE: include/common/ot/client_sync.h
+// Description: Client-side OT state machine keeping at most one operation in flight
+
+#pragma once
+
+#include "offline_journal.h"
+#include "operation.h"
+#include "text_operation.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+
+namespace collab {
+namespace ot {
+
+/**
+ * The client half of the OT protocol, as a three-state machine.
+ * 
+ * SYNCHRONIZED: nothing is waiting for the server. A local edit is sent
+ * at once and the client moves to AWAITING_CONFIRM.
+ * AWAITING_CONFIRM: one operation is in flight. Local edits compose into
+ * a buffer instead of being sent (AWAITING_WITH_BUFFER).
+ * On the server's ack the buffer, if any, is sent as one operation.
+ * 
+ * Remote operations are transformed against the in-flight operation and
+ * the buffer, both kept as TextOperations, so the cost does not grow with
+ * the number of local edits. The server in turn sees one operation per
+ * round trip, based on a revision at most one round trip old, and only has
+ * to transform it against what other clients did in that time.
+ * 
+ * With a journal set, what is in flight and buffered is also kept on disk,
+ * as one operation based on the latest revision: local edits are appended
+ * as they are made, and acks and remote operations rewrite it. Offline
+ * editing then costs an append per edit, and after a crash restore()
+ * picks the edits up again to be sent as one operation.
+ * 
+ * Ties follow the server: a remote insert at the same position as a
+ * pending local one is placed first, as the server places the operation it
+ * logged first.
+ * Not thread-safe; the owner serializes access.
+ */
+class ClientSync {
+public:
+    enum class State {
+        SYNCHRONIZED,
+        AWAITING_CONFIRM,
+        AWAITING_WITH_BUFFER
+    };
+    
+    /**
+     * Called to send an operation to the server
+     * @param op The operation
+     * @param revision The server revision it is based on
+     */
+    using SendCallback = std::function<void(const OperationPtr&, int64_t)>;
+    
+    /**
+     * Constructor
+     * 
+     * @param revision Server revision the client's document is at
+     * @param documentLength Length of the client's document
+     */
+    explicit ClientSync(int64_t revision = 0, size_t documentLength = 0);
+    
+    /**
+     * Set the function that sends operations to the server
+     * 
+     * @param callback The send function
+     */
+    void setSendCallback(SendCallback callback);
+    
+    /**
+     * Keep what is unconfirmed in a journal from now on
+     * The journal starts over from the current state
+     * 
+     * @param journal The journal, or nullptr for none
+     */
+    void setJournal(std::shared_ptr<OfflineJournal> journal);
+    
+    /**
+     * Take up the edits a journal kept from an earlier run
+     * They become the operation in flight, to be sent with resend() once connected;
+     * the owner applies journal.pending() to the document at journal.baseRevision()
+     * 
+     * @param journal A journal recovered from disk
+     * @return False if the journal holds no edits
+     */
+    bool restore(const OfflineJournal& journal);
+    
+    /**
+     * Account for an edit already applied to the local document
+     * Sent at once when nothing is in flight, otherwise composed into the buffer
+     * 
+     * @param op The local operation
+     * @throws std::invalid_argument if the operation does not fit the document
+     */
+    void applyClient(const Operation& op);
+    
+    /**
+     * Transform an operation from another client for the local document
+     * 
+     * @param op The remote operation, as the server logged it
+     * @return The operation to apply locally
+     * @throws std::invalid_argument if the operation does not fit the server document
+     */
+    OperationPtr applyServer(const Operation& op);
+    
+    /**
+     * Transform a run of consecutive operations from other clients at once
+     * The run is composed into one operation, which is transformed once
+     * against the operation in flight and once against the buffer, so
+     * catching up on n operations after a reconnect costs n compositions
+     * and two transforms rather than 2n transforms
+     * Ties are decided against the composed run, so a remote insert can land
+     * on the other side of a pending one than it would one at a time; the
+     * server transforms the pending operations the same way, so it agrees
+     * 
+     * @param ops The remote operations, in server order, the first based on getRevision()
+     * @return One operation to apply locally, or nullptr if ops is empty
+     * @throws std::invalid_argument if the operations do not fit the server document
+     */
+    OperationPtr applyServerBatch(std::span<const OperationPtr> ops);
+    
+    /**
+     * Handle the server's confirmation of the operation in flight
+     * Sends the buffer, if any
+     * 
+     * @throws std::logic_error if nothing is in flight
+     */
+    void serverAck();
+    
+    /**
+     * Send the operation in flight again, e.g. after reconnecting
+     */
+    void resend();
+    
+    /**
+     * Start over from a document the server sent, dropping unsent state
+     * 
+     * @param revision The document's server revision
+     * @param documentLength Its length
+     */
+    void reset(int64_t revision, size_t documentLength);
+    
+    State getState() const {
+        return state_;
+    }
+    
+    /**
+     * Get the server revision the client has seen
+     * 
+     * @return Latest server revision applied locally
+     */
+    int64_t getRevision() const {
+        return revision_;
+    }
+    
+    size_t getDocumentLength() const {
+        return documentLength_;
+    }
+
+private:
+    void send(const TextOperation& op);
+    
+    // Transform a remote operation on the server document past what is pending
+    OperationPtr transformRemote(TextOperation remote);
+    
+    // Write what is unconfirmed to the journal, if there is one
+    void journalState();
+    
+    State state_ = State::SYNCHRONIZED;
+    int64_t revision_;
+    size_t documentLength_;
+    // Sent and not yet acknowledged, then everything edited since
+    std::optional<TextOperation> outstanding_;
+    std::optional<TextOperation> buffer_;
+    SendCallback sendCallback_;
+    std::shared_ptr<OfflineJournal> journal_;
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,302 @@
+#include "content_hash.h"
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <variant>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+constexpr uint64_t MODULUS = (uint64_t{1} << 61) - 1;
+constexpr uint64_t BASE = 0x2F0F5D3A7B1C9E45 % MODULUS;
+
+uint64_t mulMod(uint64_t a, uint64_t b) {
+    const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    const uint64_t folded = static_cast<uint64_t>(product & MODULUS) + static_cast<uint64_t>(product >> 61);
+    return folded >= MODULUS ? folded - MODULUS : folded;
+}
+
+uint64_t addMod(uint64_t a, uint64_t b) {
+    const uint64_t sum = a + b;
+    return sum >= MODULUS ? sum - MODULUS : sum;
+}
+
+uint64_t subMod(uint64_t a, uint64_t b) {
+    return a >= b ? a - b : a + MODULUS - b;
+}
+
+// BASE^exponent
+uint64_t powerOf(size_t exponent) {
+    uint64_t result = 1;
+    uint64_t square = BASE;
+    for (; exponent > 0; exponent >>= 1) {
+        if (exponent & 1) {
+            result = mulMod(result, square);
+        }
+        square = mulMod(square, square);
+    }
+    return result;
+}
+
+// Bytes count from 1, so leading zero bytes still change the hash
+uint64_t digitOf(char c) {
+    return static_cast<uint64_t>(static_cast<unsigned char>(c)) + 1;
+}
+
+// Widen [low, length - tail) to cover an edit of [position, position + removed), and apply it to length
+bool widen(size_t position, size_t removed, size_t added, size_t& length, size_t& low, size_t& tail) {
+    if (position > length || removed > length - position) {
+        return false;
+    }
+    low = std::min(low, position);
+    tail = std::min(tail, length - position - removed);
+    length = length - removed + added;
+    return true;
+}
+
+bool widen(const Operation& op, size_t& length, size_t& low, size_t& tail) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            return widen(insert.getPosition(), 0, insert.getText().size(), length, low, tail);
+        }
+        case OperationKind::DELETE: {
+            const auto& erase = static_cast<const DeleteOperation&>(op);
+            return widen(erase.getPosition(), erase.getLength(), 0, length, low, tail);
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            return widen(replace.getPosition(), replace.getLength(), replace.getText().size(), length, low, tail);
+        }
+        case OperationKind::COMPOSITE:
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                if (child && !widen(*child, length, low, tail)) {
+                    return false;
+                }
+            }
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+uint64_t ContentHash::hash(std::string_view text) {
+    uint64_t result = 0;
+    for (char c : text) {
+        result = addMod(mulMod(result, BASE), digitOf(c));
+    }
+    return result;
+}
+
+uint64_t ContentHash::concat(uint64_t first, uint64_t second, size_t secondLength) {
+    return addMod(mulMod(first, powerOf(secondLength)), second);
+}
+
+void ContentHash::reset(const Rope& text) {
+    chunks_.clear();
+    cut(text, 0, text.length(), chunks_);
+    rebuild();
+}
+
+bool ContentHash::update(size_t position, size_t removed, size_t added, const Rope& text) {
+    const size_t oldLength = length();
+    if (position > oldLength || removed > oldLength - position || text.length() != oldLength - removed + added) {
+        return false;
+    }
+    if (chunks_.empty()) {
+        reset(text);
+        return true;
+    }
+
+    // The chunks the edit touched; an insert at the very end goes into the last
+    size_t start = 0;
+    size_t first = position < oldLength ? locate(position, start) : chunks_.size() - 1;
+    if (position == oldLength) {
+        start = oldLength - chunks_.back().length;
+    }
+    size_t end = first;
+    if (removed > 0) {
+        size_t lastStart = 0;
+        end = locate(position + removed - 1, lastStart);
+    }
+    size_t spanLength = 0;
+    for (size_t i = first; i <= end; ++i) {
+        spanLength += chunks_[i].length;
+    }
+    spanLength = spanLength - removed + added;
+    // A chunk shrunk too far takes in the next one
+    if (spanLength < CHUNK_SIZE / 2 && end + 1 < chunks_.size()) {
+        end++;
+        spanLength += chunks_[end].length;
+    }
+
+    std::vector<Node> pieces;
+    cut(text, start, spanLength, pieces);
+    if (pieces.size() == end - first + 1) {
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            chunks_[first + i] = pieces[i];
+            refresh(first + i);
+        }
+        return true;
+    }
+    chunks_.erase(chunks_.begin() + static_cast<std::ptrdiff_t>(first),
+                  chunks_.begin() + static_cast<std::ptrdiff_t>(end + 1));
+    chunks_.insert(chunks_.begin() + static_cast<std::ptrdiff_t>(first), pieces.begin(), pieces.end());
+    rebuild();
+    return true;
+}
+
+bool ContentHash::apply(const Operation& op, const Rope& text) {
+    const size_t oldLength = length();
+    size_t newLength = oldLength;
+    size_t low = std::numeric_limits<size_t>::max();
+    size_t tail = std::numeric_limits<size_t>::max();
+    if (!widen(op, newLength, low, tail)) {
+        return false;
+    }
+    if (low == std::numeric_limits<size_t>::max()) {
+        // Nothing in it touched the text
+        return text.length() == oldLength;
+    }
+    return update(low, oldLength - tail - low, newLength - tail - low, text);
+}
+
+bool ContentHash::apply(const ValueOperation& op, const Rope& text) {
+    return std::visit([&](const auto& edit) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, InsertOp>) {
+            return update(edit.position, 0, edit.text.size(), text);
+        } else {
+            return update(edit.position, edit.length, 0, text);
+        }
+    }, op);
+}
+
+uint64_t ContentHash::prefix(size_t length, const Rope& text) const {
+    length = std::min(length, this->length());
+    if (length == 0) {
+        return 0;
+    }
+    if (length == this->length()) {
+        return root();
+    }
+    size_t start = 0;
+    const size_t chunk = locate(length - 1, start);
+    return combine(leading(chunk), hashRange(text, start, length - start)).hash;
+}
+
+uint64_t ContentHash::suffix(size_t length, const Rope& text) const {
+    length = std::min(length, this->length());
+    return range(this->length() - length, length, text);
+}
+
+uint64_t ContentHash::range(size_t position, size_t length, const Rope& text) const {
+    position = std::min(position, this->length());
+    length = std::min(length, this->length() - position);
+    // hash[a, b) = hash[0, b) - hash[0, a) * BASE^(b - a)
+    return subMod(prefix(position + length, text), mulMod(prefix(position, text), powerOf(length)));
+}
+
+ContentHash::Node ContentHash::combine(const Node& left, const Node& right) {
+    return {addMod(mulMod(left.hash, right.power), right.hash), mulMod(left.power, right.power),
+            left.length + right.length};
+}
+
+ContentHash::Node ContentHash::hashRange(const Rope& text, size_t position, size_t length) {
+    Node node;
+    text.forEachChunk(position, length, [&node](std::string_view piece) {
+        for (char c : piece) {
+            node.hash = addMod(mulMod(node.hash, BASE), digitOf(c));
+            node.power = mulMod(node.power, BASE);
+        }
+        node.length += piece.size();
+        return true;
+    });
+    return node;
+}
+
+void ContentHash::cut(const Rope& text, size_t position, size_t length, std::vector<Node>& out) {
+    if (length == 0) {
+        return;
+    }
+    // Up to twice the target stays one chunk, so typing does not split a chunk on every keystroke
+    const size_t count = length <= 2 * CHUNK_SIZE ? 1 : (length + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t from = length * i / count;
+        const size_t to = length * (i + 1) / count;
+        out.push_back(hashRange(text, position + from, to - from));
+    }
+}
+
+void ContentHash::rebuild() {
+    leaves_ = 1;
+    while (leaves_ < chunks_.size()) {
+        leaves_ *= 2;
+    }
+    tree_.assign(2 * leaves_, Node{});
+    std::copy(chunks_.begin(), chunks_.end(), tree_.begin() + static_cast<std::ptrdiff_t>(leaves_));
+    for (size_t i = leaves_ - 1; i >= 1; --i) {
+        tree_[i] = combine(tree_[2 * i], tree_[2 * i + 1]);
+    }
+}
+
+void ContentHash::refresh(size_t chunk) {
+    size_t i = leaves_ + chunk;
+    tree_[i] = chunks_[chunk];
+    for (i /= 2; i >= 1; i /= 2) {
+        tree_[i] = combine(tree_[2 * i], tree_[2 * i + 1]);
+    }
+}
+
+size_t ContentHash::locate(size_t offset, size_t& start) const {
+    size_t node = 1;
+    start = 0;
+    while (node < leaves_) {
+        const size_t left = tree_[2 * node].length;
+        if (offset < left) {
+            node = 2 * node;
+        } else {
+            offset -= left;
+            start += left;
+            node = 2 * node + 1;
+        }
+    }
+    return node - leaves_;
+}
+
+ContentHash::Node ContentHash::leading(size_t count) const {
+    Node left;
+    Node right;
+    for (size_t low = leaves_, high = leaves_ + count; low < high; low /= 2, high /= 2) {
+        if (low & 1) {
+            left = combine(left, tree_[low++]);
+        }
+        if (high & 1) {
+            right = combine(tree_[--high], right);
+        }
+    }
+    return combine(left, right);
+}
+
+DivergenceSearch::DivergenceSearch(size_t localLength, size_t remoteLength)
+    : localLength_(localLength)
+    , remoteLength_(remoteLength)
+    , prefix_{0, std::min(localLength, remoteLength)}
+    , suffix_{0, std::min(localLength, remoteLength)} {}
+
+void DivergenceSearch::narrow(bool prefixMatches, bool suffixMatches) {
+    prefix_.narrow(prefixMatches);
+    suffix_.narrow(suffixMatches);
+    rounds_++;
+}
+
+DivergenceSearch::Range DivergenceSearch::range() const {
+    const size_t common = prefix_.low;
+    const size_t shared = std::min(suffix_.low, std::min(localLength_, remoteLength_) - common);
+    return {common, localLength_ - common - shared, remoteLength_ - common - shared};
+}
+
+} // namespace ot
+} // namespace collab
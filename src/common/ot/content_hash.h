@@ -0,0 +1,231 @@
+// FILE: include/common/ot/content_hash.h
+// Description: Merkle tree of chunk hashes over a document, for checking two copies agree
+
+#pragma once
+
+#include "operation.h"
+#include "rope.h"
+#include "value_operation.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Hashes of a document's text, kept current as it is edited, so two copies
+ * can tell whether they agree by comparing one number.
+ *
+ * The hash is polynomial, the text's bytes as the digits of a number
+ * modulo 2^61 - 1, so the hash of two pieces side by side follows from
+ * the hash and length of each. The text is cut into chunks of about
+ * CHUNK_SIZE bytes, and a tree over the chunks combines their hashes up
+ * to the root: the hash of the whole text. An edit rehashes the chunks it
+ * touched and the tree above them, O(CHUNK_SIZE + log n), instead of the
+ * whole text. Where the chunks fall does not change the hash, so copies
+ * that chunked the same text differently, after different edits, still
+ * hash the same, and any prefix, suffix or range can be hashed from the
+ * tree in O(CHUNK_SIZE + log n) too (see DivergenceSearch).
+ *
+ * Only lengths and hashes are kept; the text itself is read from the
+ * document's rope, as it is after each edit.
+ * Not thread-safe; the owner serializes access.
+ */
+class ContentHash {
+public:
+    /**
+     * Target chunk size; chunks grown past twice this are split, and ones
+     * shrunk below half of it are merged with the next
+     */
+    static constexpr size_t CHUNK_SIZE = 512;
+
+    // Hash of a text, as root() of a ContentHash of it would be
+    static uint64_t hash(std::string_view text);
+
+    /**
+     * Hash of two texts side by side, from theirs
+     *
+     * @param first Hash of the first text
+     * @param second Hash of the second
+     * @param secondLength Length of the second
+     */
+    static uint64_t concat(uint64_t first, uint64_t second, size_t secondLength);
+
+    ContentHash() = default;
+
+    explicit ContentHash(const Rope& text) {
+        reset(text);
+    }
+
+    // Start over from a text, hashing it whole
+    void reset(const Rope& text);
+
+    /**
+     * Account for an edit of [position, position + removed) into added bytes
+     *
+     * @param position Where the edit starts
+     * @param removed Bytes it removed
+     * @param added Bytes it inserted in their place
+     * @param text The document after the edit
+     * @return False, changing nothing, if the edit does not fit the hashed text
+     */
+    bool update(size_t position, size_t removed, size_t added, const Rope& text);
+
+    // Account for an applied operation; a composite rehashes the span its children touched
+    bool apply(const Operation& op, const Rope& text);
+    bool apply(const ValueOperation& op, const Rope& text);
+
+    // Hash of the whole text
+    uint64_t root() const {
+        return tree_.empty() ? 0 : tree_[1].hash;
+    }
+
+    size_t length() const {
+        return tree_.empty() ? 0 : tree_[1].length;
+    }
+
+    size_t chunkCount() const {
+        return chunks_.size();
+    }
+
+    /**
+     * Hash of the first bytes of the text
+     *
+     * @param length How many, clamped to the text
+     * @param text The document, as hashed
+     */
+    uint64_t prefix(size_t length, const Rope& text) const;
+
+    // Hash of the last length bytes of the text, clamped to the text
+    uint64_t suffix(size_t length, const Rope& text) const;
+
+    // Hash of [position, position + length) of the text, clamped to the text
+    uint64_t range(size_t position, size_t length, const Rope& text) const;
+
+private:
+    // A piece of text hashed, or chunks combined: the hash, base^length and the length
+    struct Node {
+        uint64_t hash = 0;
+        uint64_t power = 1;
+        size_t length = 0;
+    };
+
+    static Node combine(const Node& left, const Node& right);
+
+    // Hash [position, position + length) of the text
+    static Node hashRange(const Rope& text, size_t position, size_t length);
+
+    // Cut [position, position + length) of the text into chunks of about CHUNK_SIZE
+    static void cut(const Rope& text, size_t position, size_t length, std::vector<Node>& out);
+
+    // Lay the tree out again over chunks_, e.g. when their number changed
+    void rebuild();
+
+    // Recombine the nodes above a chunk
+    void refresh(size_t chunk);
+
+    // The chunk holding offset, and where it starts; offset must be less than length()
+    size_t locate(size_t offset, size_t& start) const;
+
+    // Chunks [0, count) combined
+    Node leading(size_t count) const;
+
+    std::vector<Node> chunks_;
+    std::vector<Node> tree_;    // Heap order over chunks_, leaves from leaves_; empty until reset()
+    size_t leaves_ = 0;
+};
+
+/**
+ * Finds where two copies of a document diverge, by comparing hashes of
+ * their prefixes and suffixes rather than their text.
+ *
+ * Each round asks the other side for the hash of a prefix and of a
+ * suffix (probe()) and compares them with the local ones (narrow()), a
+ * binary search on each end; after O(log n) rounds the longest common
+ * prefix and suffix are known, and only what lies between them differs
+ * (range()). The side holding the wrong copy fetches that range from the
+ * other and replaces its own with it: one edit repairs any divergence,
+ * however far apart its ends.
+ */
+class DivergenceSearch {
+public:
+    // What to ask the other side to hash
+    struct Probe {
+        size_t prefixLength;
+        size_t suffixLength;
+    };
+
+    // Local [position, position + localLength) is remote [position, position + remoteLength)
+    struct Range {
+        size_t position;
+        size_t localLength;
+        size_t remoteLength;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param localLength Length of this copy
+     * @param remoteLength Length of the other
+     */
+    DivergenceSearch(size_t localLength, size_t remoteLength);
+
+    // Whether range() is known
+    bool done() const {
+        return prefix_.low == prefix_.high && suffix_.low == suffix_.high;
+    }
+
+    // Lengths to hash next, on both sides
+    Probe probe() const {
+        return {prefix_.next(), suffix_.next()};
+    }
+
+    /**
+     * Take in the answers to probe()
+     *
+     * @param prefixMatches Whether the prefixes hashed the same
+     * @param suffixMatches Whether the suffixes did
+     */
+    void narrow(bool prefixMatches, bool suffixMatches);
+
+    // Rounds done so far
+    size_t rounds() const {
+        return rounds_;
+    }
+
+    // What differs, once done(); a common prefix and suffix never overlap in it
+    Range range() const;
+
+private:
+    // Binary search for the longest common length in [low, high]
+    struct Bound {
+        size_t low;
+        size_t high;
+
+        size_t next() const {
+            return low + (high - low + 1) / 2;
+        }
+
+        void narrow(bool matches) {
+            if (low == high) {
+                return;
+            }
+            if (matches) {
+                low = next();
+            } else {
+                high = next() - 1;
+            }
+        }
+    };
+
+    size_t localLength_;
+    size_t remoteLength_;
+    Bound prefix_;
+    Bound suffix_;
+    size_t rounds_ = 0;
+};
+
+} // namespace ot
+} // namespace collab
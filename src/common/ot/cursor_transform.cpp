@@ -0,0 +1,122 @@
+#include "cursor_transform.h"
+#include <algorithm>
+#include <type_traits>
+#include <variant>
+
+namespace collab {
+namespace ot {
+
+size_t transformPosition(size_t offset, const ValueOperation& op) {
+    return std::visit([offset](const auto& edit) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, InsertOp>) {
+            return transformPosition(offset, edit.position, 0, edit.text.size());
+        } else {
+            return transformPosition(offset, edit.position, edit.length, 0);
+        }
+    }, op);
+}
+
+CursorSet::Handle CursorSet::add(size_t position) {
+    const auto handle = static_cast<Handle>(slots_.size());
+    if (!entries_.empty() && position < entries_.back().position) {
+        sorted_ = false;
+    }
+    slots_.push_back(entries_.size());
+    entries_.push_back({position, handle});
+    return handle;
+}
+
+void CursorSet::set(Handle handle, size_t position) {
+    const size_t slot = slots_[handle];
+    entries_[slot].position = position;
+    // Out of order with a neighbour: the next edit sorts
+    if ((slot > 0 && entries_[slot - 1].position > position) ||
+        (slot + 1 < entries_.size() && entries_[slot + 1].position < position)) {
+        sorted_ = false;
+    }
+}
+
+void CursorSet::clear() {
+    entries_.clear();
+    slots_.clear();
+    sorted_ = true;
+}
+
+void CursorSet::sort() {
+    std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+        return a.position < b.position;
+    });
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        slots_[entries_[i].handle] = i;
+    }
+    sorted_ = true;
+}
+
+void CursorSet::transform(size_t position, size_t removed, size_t added) {
+    if (!sorted_) {
+        sort();
+    }
+    // Positions before the edit stay; from the first one it reaches, each moves
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), position, [](const Entry& entry, size_t offset) {
+        return entry.position < offset;
+    });
+    for (; it != entries_.end() && it->position < position + removed; ++it) {
+        it->position = position;
+    }
+    if (removed == added) {
+        return;
+    }
+    for (; it != entries_.end(); ++it) {
+        it->position = it->position - removed + added;
+    }
+}
+
+void CursorSet::transform(const ValueOperation& op) {
+    std::visit([this](const auto& edit) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, InsertOp>) {
+            transform(edit.position, 0, edit.text.size());
+        } else {
+            transform(edit.position, edit.length, 0);
+        }
+    }, op);
+}
+
+void CursorSet::transform(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            transform(insert.getPosition(), 0, insert.getText().size());
+            break;
+        }
+        case OperationKind::DELETE: {
+            const auto& erase = static_cast<const DeleteOperation&>(op);
+            transform(erase.getPosition(), erase.getLength(), 0);
+            break;
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            transform(replace.getPosition(), replace.getLength(), replace.getText().size());
+            break;
+        }
+        case OperationKind::COMPOSITE:
+            transform(std::span<const OperationPtr>(static_cast<const CompositeOperation&>(op).getOperations()));
+            break;
+    }
+}
+
+void CursorSet::transform(std::span<const ValueOperation> ops) {
+    for (const auto& op : ops) {
+        transform(op);
+    }
+}
+
+void CursorSet::transform(std::span<const OperationPtr> ops) {
+    for (const auto& op : ops) {
+        if (op) {
+            transform(*op);
+        }
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,121 @@
+// FILE: include/common/ot/cursor_transform.h
+// Description: Move every tracked cursor of a document through an edit in one sorted pass
+
+#pragma once
+
+#include "operation.h"
+#include "value_operation.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Move a position through an edit of [position, position + removed) into added characters
+ * A position before the edit stays, one inside the removed text goes to
+ * its start, and one at or after its end shifts with the text after it,
+ * so a cursor where text is inserted ends up after the insertion.
+ *
+ * @param offset The position
+ * @param position Where the edit starts
+ * @param removed Characters it removed
+ * @param added Characters it inserted in their place
+ * @return The position after the edit
+ */
+inline size_t transformPosition(size_t offset, size_t position, size_t removed, size_t added) {
+    if (offset < position) {
+        return offset;
+    }
+    if (offset < position + removed) {
+        return position;
+    }
+    return offset - removed + added;
+}
+
+/**
+ * Move a position through an operation
+ *
+ * @param offset The position
+ * @param op The operation
+ * @return The position after the operation
+ */
+size_t transformPosition(size_t offset, const ValueOperation& op);
+
+/**
+ * The cursor and selection ends of a document, moved through its edits together
+ *
+ * Positions are kept sorted, so an edit finds the first one it moves by
+ * binary search and shifts the rest in one pass: a hundred cursors cost
+ * one pass per edit rather than a hundred lookups. An edit never
+ * reorders positions, so they stay sorted through any number of edits;
+ * only add() and set() break the order, and the next edit sorts again.
+ *
+ * Positions are named by the handle add() returns.
+ * Not thread-safe; the owner serializes access.
+ */
+class CursorSet {
+public:
+    using Handle = uint32_t;
+
+    /**
+     * Track a position
+     *
+     * @param position The position
+     * @return Its handle
+     */
+    Handle add(size_t position);
+
+    // Move a tracked position, e.g. when its user moves the cursor
+    void set(Handle handle, size_t position);
+
+    size_t get(Handle handle) const {
+        return entries_[slots_[handle]].position;
+    }
+
+    size_t size() const {
+        return slots_.size();
+    }
+
+    bool empty() const {
+        return slots_.empty();
+    }
+
+    // Forget every position; handles start again from 0
+    void clear();
+
+    /**
+     * Move every position through an edit of [position, position + removed) into added characters
+     *
+     * @param position Where the edit starts
+     * @param removed Characters it removed
+     * @param added Characters it inserted in their place
+     */
+    void transform(size_t position, size_t removed, size_t added);
+
+    // Move every position through an operation; a composite's children apply in order
+    void transform(const ValueOperation& op);
+    void transform(const Operation& op);
+
+    // Move every position through a batch of operations, oldest first
+    void transform(std::span<const ValueOperation> ops);
+    void transform(std::span<const OperationPtr> ops);
+
+private:
+    struct Entry {
+        size_t position;
+        Handle handle;
+    };
+
+    // Restore the order add() and set() broke
+    void sort();
+
+    std::vector<Entry> entries_;   // Sorted by position unless sorted_ is false
+    std::vector<size_t> slots_;    // Index of each handle's entry
+    bool sorted_ = true;
+};
+
+} // namespace ot
+} // namespace collab
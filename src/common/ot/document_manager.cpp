@@ -15,20 +15,18 @@ DocumentManager::DocumentManager(const std::string& initial_content)
 
 std::string DocumentManager::getContent() const {
     std::lock_guard<std::mutex> lock(document_mutex_);
-    return document_;
+    return document_.toString();
 }
 
 void DocumentManager::setContent(const std::string& content) {
     std::lock_guard<std::mutex> lock(document_mutex_);
-    document_ = content;
+    document_ = Rope(content);
     
     // Clear undo/redo history as it's no longer valid
     undo_redo_manager_.clear();
     
     // Notify document change
-    if (document_change_callback_) {
-        document_change_callback_(document_);
-    }
+    notifyDocumentChanged();
 }
 
 bool DocumentManager::applyLocalOperation(const OperationPtr& operation) {
@@ -49,21 +47,21 @@ bool DocumentManager::applyLocalOperation(const OperationPtr& operation) {
         operation->setId(generateOperationId());
     }
     
-    // Apply the operation
-    if (!operation->apply(document_)) {
-        return false;
-    }
-    
     // Only add to undo history if it's a local user operation
-    // (not an undo/redo operation itself)
+    // (not an undo/redo operation itself), capturing what the undo needs
     if (operation->getSource() == OperationSource::LOCAL) {
-        undo_redo_manager_.addOperation(operation);
+        OperationPtr captured = operation->applyAndCapture(document_);
+        if (!captured) {
+            return false;
+        }
+        undo_redo_manager_.addOperation(captured);
+    }
+    else if (!operation->apply(document_)) {
+        return false;
     }
     
     // Notify document change
-    if (document_change_callback_) {
-        document_change_callback_(document_);
-    }
+    notifyDocumentChanged();
     
     // Notify operation applied
     if (operation_callback_) {
@@ -92,9 +90,7 @@ bool DocumentManager::applyRemoteOperation(const OperationPtr& operation) {
     undo_redo_manager_.transformHistory(operation);
     
     // Notify document change
-    if (document_change_callback_) {
-        document_change_callback_(document_);
-    }
+    notifyDocumentChanged();
     
     // Notify operation applied
     if (operation_callback_) {
@@ -113,9 +109,7 @@ bool DocumentManager::undo() {
     }
     
     // Notify document change
-    if (document_change_callback_) {
-        document_change_callback_(document_);
-    }
+    notifyDocumentChanged();
     
     return true;
 }
@@ -129,17 +123,34 @@ bool DocumentManager::redo() {
     }
     
     // Notify document change
-    if (document_change_callback_) {
-        document_change_callback_(document_);
-    }
+    notifyDocumentChanged();
     
     return true;
 }
 
+Rope DocumentManager::getSnapshot() const {
+    std::lock_guard<std::mutex> lock(document_mutex_);
+    return document_;
+}
+
 void DocumentManager::setDocumentChangeCallback(std::function<void(const std::string&)> callback) {
     document_change_callback_ = callback;
 }
 
+void DocumentManager::setSnapshotCallback(std::function<void(const Rope&)> callback) {
+    snapshot_callback_ = callback;
+}
+
+void DocumentManager::notifyDocumentChanged() {
+    // Snapshot listeners share the rope; only string listeners pay for a full copy
+    if (snapshot_callback_) {
+        snapshot_callback_(document_);
+    }
+    if (document_change_callback_) {
+        document_change_callback_(document_.toString());
+    }
+}
+
 void DocumentManager::setOperationCallback(std::function<void(const OperationPtr&)> callback) {
     operation_callback_ = callback;
 }
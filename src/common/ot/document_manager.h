@@ -78,6 +78,22 @@ public:
      */
     void setDocumentChangeCallback(std::function<void(const std::string&)> callback);
     
+    /**
+     * Register a callback that receives an immutable snapshot on every change
+     * Cheaper than setDocumentChangeCallback, which copies the whole document
+     * 
+     * @param callback Function to call when the document changes
+     */
+    void setSnapshotCallback(std::function<void(const Rope&)> callback);
+    
+    /**
+     * Get an immutable snapshot of the current document in O(1)
+     * Later edits never change a snapshot that was already taken
+     * 
+     * @return The current document content
+     */
+    Rope getSnapshot() const;
+    
     /**
      * Register a callback function to be called when an operation is applied
      * 
@@ -122,7 +138,7 @@ public:
     
 private:
     // The current document content
-    std::string document_;
+    Rope document_;
     
     // The undo/redo manager
     UndoRedoManager undo_redo_manager_;
@@ -130,6 +146,9 @@ private:
     // Document change callback
     std::function<void(const std::string&)> document_change_callback_;
     
+    // Snapshot change callback
+    std::function<void(const Rope&)> snapshot_callback_;
+    
     // Operation callback
     std::function<void(const OperationPtr&)> operation_callback_;
     
@@ -138,6 +157,9 @@ private:
     
     // Operation counter for generating unique IDs
     std::atomic<int64_t> operation_counter_{0};
+    
+    // Invoke the change callbacks (document_mutex_ must be held)
+    void notifyDocumentChanged();
 };
 
 } // namespace ot
@@ -1,4 +1,168 @@
-#include <iostream>
-namespace collab { namespace common { namespace ot {
-void editor_placeholder() { std::cout << "OT editor placeholder" << std::endl; }
-}}} // namespace collab::common::ot
+#include "editor.h"
+#include "text_operation.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+Editor::Editor(const std::string& initialContent)
+    : document_(initialContent) {
+
+    // Undo and redo apply their step inside the manager; keep it to send on
+    document_.setOperationCallback([this](const OperationPtr& op) {
+        lastApplied_ = op;
+    });
+}
+
+void Editor::setOperationCallback(OperationCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opCallback_ = std::move(callback);
+}
+
+void Editor::setContentCallback(ContentCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    contentCallback_ = std::move(callback);
+
+    // Without a listener the manager never copies the document out
+    if (contentCallback_) {
+        document_.setDocumentChangeCallback([this](const std::string& content) {
+            onContentChanged(content);
+        });
+    } else {
+        document_.setDocumentChangeCallback(nullptr);
+    }
+}
+
+bool Editor::insert(size_t position, const std::string& text) {
+    if (text.empty()) {
+        return false;
+    }
+    return applyLocal(std::make_shared<InsertOperation>(position, text));
+}
+
+bool Editor::deleteText(size_t position, size_t length) {
+    if (length == 0) {
+        return false;
+    }
+    return applyLocal(std::make_shared<DeleteOperation>(position, length));
+}
+
+bool Editor::applyLocal(const OperationPtr& op) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!document_.applyLocalOperation(op)) {
+        return false;
+    }
+    notifyOperationGenerated(op, version_++);
+    return true;
+}
+
+bool Editor::handleRemoteOperation(const OperationPtr& operation, int64_t sourceVersion) {
+    if (!operation) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!document_.applyRemoteOperation(operation)) {
+        return false;
+    }
+    version_ = std::max(version_, sourceVersion) + 1;
+    return true;
+}
+
+bool Editor::handleRemoteOperations(std::span<const OperationPtr> operations, int64_t fromVersion) {
+    if (operations.empty()) {
+        return true;
+    }
+    if (operations.size() == 1) {
+        return handleRemoteOperation(operations.front(), fromVersion);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Compose the run first, so an operation that does not fit leaves the document untouched
+    OperationPtr composed;
+    try {
+        TextOperation run = TextOperation::fromOperation(*operations.front(), document_.getSnapshot().length());
+        for (size_t i = 1; i < operations.size(); ++i) {
+            run = run.compose(TextOperation::fromOperation(*operations[i], run.getTargetLength()));
+        }
+        composed = run.toOperation();
+    } catch (const std::invalid_argument&) {
+        return false;
+    }
+
+    if (!document_.applyRemoteOperation(composed)) {
+        return false;
+    }
+    version_ = std::max(version_, fromVersion) + static_cast<int64_t>(operations.size());
+    return true;
+}
+
+bool Editor::undo() {
+    return step([this]() { return document_.undo(); });
+}
+
+bool Editor::redo() {
+    return step([this]() { return document_.redo(); });
+}
+
+bool Editor::step(const std::function<bool()>& apply) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    lastApplied_.reset();
+    if (!apply() || !lastApplied_) {
+        return false;
+    }
+    notifyOperationGenerated(lastApplied_, version_++);
+    lastApplied_.reset();
+    return true;
+}
+
+bool Editor::canUndo() const {
+    return document_.canUndo();
+}
+
+bool Editor::canRedo() const {
+    return document_.canRedo();
+}
+
+std::string Editor::getContent() const {
+    return document_.getContent();
+}
+
+int64_t Editor::getVersion() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+DocumentState Editor::createSnapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return DocumentState(document_.getContent(), version_);
+}
+
+bool Editor::restoreFromSnapshot(const DocumentState& snapshot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Clears the history, which no longer applies to the content
+    document_.setContent(snapshot.content);
+    version_ = snapshot.version;
+    return true;
+}
+
+void Editor::onContentChanged(const std::string& content) {
+    if (contentCallback_) {
+        contentCallback_(content);
+    }
+}
+
+void Editor::notifyOperationGenerated(const OperationPtr& op, int64_t version) {
+    if (opCallback_) {
+        opCallback_(op, version);
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "history.h"
+#include "document_manager.h"
 #include "operation.h"
 #include <string>
 #include <functional>
@@ -8,13 +8,27 @@
 #include <vector>
 #include <mutex>
 #include <optional>
+#include <span>
 
 namespace collab {
 namespace ot {
 
+/**
+ * Represents a document state at a specific point in time with version tracking
+ */
+struct DocumentState {
+    std::string content;
+    int64_t version;
+    
+    DocumentState(const std::string& content = "", int64_t version = 0)
+        : content(content), version(version) {}
+};
+
 /**
  * Document editor that manages OT operations and history
  * Provides undo/redo functionality and handles remote operation integration
+ * The document and its one history live in a DocumentManager
+ * Callbacks run with the editor's lock held and must not call back into it
  */
 class Editor {
 public:
@@ -88,6 +102,19 @@ public:
      */
     bool handleRemoteOperation(const OperationPtr& operation, int64_t sourceVersion);
     
+    /**
+     * Handle a run of consecutive remote operations, e.g. the backlog replayed after a reconnect
+     * The run is composed into one operation, applied once and adjusted in
+     * the history once, under one lock; the content callback fires once at
+     * the end. Transform the run against pending local operations first,
+     * e.g. with ClientSync::applyServerBatch()
+     * 
+     * @param operations Remote operations in server order, each based on the one before
+     * @param fromVersion Version the first operation was created against
+     * @return True if successful; on failure nothing is applied
+     */
+    bool handleRemoteOperations(std::span<const OperationPtr> operations, int64_t fromVersion);
+    
     /**
      * Undo the last local operation
      * 
@@ -160,12 +187,20 @@ private:
      * @param version Version the operation was created against
      */
     void notifyOperationGenerated(const OperationPtr& op, int64_t version);
+    
+    // Apply a local edit and report it
+    bool applyLocal(const OperationPtr& op);
+    
+    // Run an undo or redo and report the step it applied
+    bool step(const std::function<bool()>& apply);
 
 private:
-    History history_;                  // Document history
+    DocumentManager document_;         // Document content and history
+    int64_t version_ = 0;              // Document version
     OperationCallback opCallback_;     // Callback for operations
     ContentCallback contentCallback_;  // Callback for content changes
     mutable std::mutex mutex_;         // Mutex for thread safety
+    OperationPtr lastApplied_;         // Step of the undo or redo under way
 };
 
 } // namespace ot
@@ -1,4 +0,0 @@
-#include <iostream>
-namespace collab { namespace common { namespace ot {
-void history_placeholder() { std::cout << "OT history placeholder" << std::endl; }
-}}} // namespace collab::common::ot
@@ -0,0 +1,150 @@
+#include "offline_journal.h"
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+constexpr uint32_t JOURNAL_MAGIC = 0x314a4543; // "CEJ1"
+
+// Written as is; the journal is read back by the machine that wrote it
+struct JournalHeader {
+    uint32_t magic;
+    int64_t baseRevision;
+    uint64_t baseLength;
+};
+
+} // namespace
+
+OfflineJournal::OfflineJournal(std::filesystem::path path)
+    : path_(std::move(path)) {
+    if (!recover()) {
+        rewrite();
+        return;
+    }
+    file_.open(path_, std::ios::out | std::ios::binary | std::ios::app);
+    if (!file_) {
+        throw std::runtime_error("Failed to open offline journal " + path_.string());
+    }
+}
+
+void OfflineJournal::reset(int64_t baseRevision, size_t baseLength, const std::optional<TextOperation>& pending) {
+    baseRevision_ = baseRevision;
+    baseLength_ = baseLength;
+    pending_ = pending && !pending->isNoop() ? pending : std::nullopt;
+    rewrite();
+}
+
+void OfflineJournal::append(const TextOperation& op) {
+    // Compose first: an edit that does not fit must not reach the file
+    std::optional<TextOperation> composed = pending_ ? pending_->compose(op) : op;
+    if (composed->getBaseLength() != baseLength_) {
+        throw std::invalid_argument("Journaled edit does not fit the base document");
+    }
+
+    writeRecord(op);
+    pending_ = std::move(composed);
+    if (++records_ >= COMPACT_RECORDS) {
+        compact();
+    }
+}
+
+void OfflineJournal::compact() {
+    rewrite();
+}
+
+bool OfflineJournal::recover() {
+    std::ifstream in(path_, std::ios::binary);
+    JournalHeader header;
+    if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != JOURNAL_MAGIC) {
+        return false;
+    }
+    baseRevision_ = header.baseRevision;
+    baseLength_ = static_cast<size_t>(header.baseLength);
+    pending_.reset();
+    records_ = 0;
+
+    std::streamoff intact = static_cast<std::streamoff>(sizeof(header));
+    uint32_t length;
+    while (in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+        std::string payload(length, '\0');
+        if (!in.read(payload.data(), static_cast<std::streamsize>(payload.size()))) {
+            break;
+        }
+        try {
+            TextOperation op = TextOperation::deserialize(payload);
+            std::optional<TextOperation> composed = pending_ ? pending_->compose(op) : op;
+            if (composed->getBaseLength() != baseLength_) {
+                break;
+            }
+            pending_ = std::move(composed);
+        } catch (const std::invalid_argument&) {
+            break;
+        }
+        intact += static_cast<std::streamoff>(sizeof(length) + payload.size());
+        ++records_;
+    }
+    in.close();
+
+    // Drop whatever a crash left half written, so appends follow the last whole record
+    std::error_code ec;
+    if (std::filesystem::file_size(path_, ec) != static_cast<uintmax_t>(intact) && !ec) {
+        std::filesystem::resize_file(path_, static_cast<uintmax_t>(intact), ec);
+    }
+    if (ec) {
+        throw std::runtime_error("Failed to recover offline journal " + path_.string());
+    }
+    return true;
+}
+
+void OfflineJournal::rewrite() {
+    std::filesystem::path temporary = path_;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        JournalHeader header{JOURNAL_MAGIC, baseRevision_, static_cast<uint64_t>(baseLength_)};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (pending_) {
+            std::string payload = pending_->serialize();
+            uint32_t length = static_cast<uint32_t>(payload.size());
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Failed to write offline journal " + temporary.string());
+        }
+    }
+
+    file_.close();
+    std::error_code ec;
+    std::filesystem::rename(temporary, path_, ec);
+    if (ec) {
+        throw std::runtime_error("Failed to replace offline journal " + path_.string());
+    }
+    records_ = pending_ ? 1 : 0;
+
+    file_.open(path_, std::ios::out | std::ios::binary | std::ios::app);
+    if (!file_) {
+        throw std::runtime_error("Failed to open offline journal " + path_.string());
+    }
+}
+
+void OfflineJournal::writeRecord(const TextOperation& op) {
+    std::string payload = op.serialize();
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    file_.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file_.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+    // Flushed per edit: the edit survives the client crashing right after it
+    file_.flush();
+    if (!file_) {
+        file_.clear();
+        throw std::runtime_error("Failed to write offline journal " + path_.string());
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,115 @@
+// FILE: include/common/ot/offline_journal.h
+// Description: Append-only local file of the edits not yet confirmed by the server
+
+#pragma once
+
+#include "text_operation.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+
+namespace collab {
+namespace ot {
+
+/**
+ * The local edits the server has not confirmed, kept on disk so a crash
+ * or an hour offline loses none of them.
+ *
+ * The file starts with the server revision the edits are based on and the
+ * document length there, followed by one record per edit, appended and
+ * flushed as it is made. In memory the edits are kept composed into one
+ * TextOperation, so however long the client was offline it replays them
+ * as a single operation. Every COMPACT_RECORDS appends the file is
+ * rewritten as that one operation, so it stays as small as the change.
+ *
+ * Opening an existing journal recovers it; a record cut short by a crash
+ * is dropped. Rewrites go through a temporary file renamed over the
+ * journal, so the file always holds either the old edits or the new ones.
+ * Not thread-safe; the owner serializes access.
+ */
+class OfflineJournal {
+public:
+    /**
+     * Appends after which the file is rewritten as one record
+     */
+    static constexpr size_t COMPACT_RECORDS = 256;
+
+    /**
+     * Constructor
+     *
+     * @param path The journal file; recovered if it exists, created otherwise
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    explicit OfflineJournal(std::filesystem::path path);
+
+    OfflineJournal(const OfflineJournal&) = delete;
+    OfflineJournal& operator=(const OfflineJournal&) = delete;
+
+    /**
+     * Start over with edits based on a server revision
+     *
+     * @param baseRevision Server revision the edits apply to
+     * @param baseLength Document length at that revision
+     * @param pending The edits, if any
+     * @throws std::runtime_error if the file cannot be rewritten
+     */
+    void reset(int64_t baseRevision, size_t baseLength, const std::optional<TextOperation>& pending = std::nullopt);
+
+    /**
+     * Record one more edit, made on top of the ones before it
+     *
+     * @param op The edit
+     * @throws std::invalid_argument if it does not follow the pending edits
+     * @throws std::runtime_error if the record cannot be written
+     */
+    void append(const TextOperation& op);
+
+    /**
+     * Rewrite the file as one record of the composed edits
+     *
+     * @throws std::runtime_error if the file cannot be rewritten
+     */
+    void compact();
+
+    bool empty() const {
+        return !pending_.has_value();
+    }
+
+    // The edits composed, or nothing if there are none
+    const std::optional<TextOperation>& pending() const {
+        return pending_;
+    }
+
+    int64_t baseRevision() const {
+        return baseRevision_;
+    }
+
+    size_t baseLength() const {
+        return baseLength_;
+    }
+
+    // Records in the file since it was last rewritten
+    size_t records() const {
+        return records_;
+    }
+
+private:
+    // Read the file back, dropping a torn last record; false if it is not a journal
+    bool recover();
+
+    // Write the header and the pending edits to a new file and put it in place
+    void rewrite();
+
+    void writeRecord(const TextOperation& op);
+
+    std::filesystem::path path_;
+    std::ofstream file_;
+    int64_t baseRevision_ = 0;
+    size_t baseLength_ = 0;
+    std::optional<TextOperation> pending_;
+    size_t records_ = 0;
+};
+
+} // namespace ot
+} // namespace collab
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "rope.h"
 #include <string>
 #include <memory>
 #include <vector>
@@ -16,6 +17,28 @@ namespace ot {
 class Operation;
 using OperationPtr = std::shared_ptr<Operation>;
 
+class TransformArena;
+
+namespace detail {
+struct TransformKernels;
+}
+
+/**
+ * Enumeration of concrete operation kinds
+ * Used as a cheap tag to dispatch transforms without RTTI or string compares
+ */
+enum class OperationKind : uint8_t {
+    INSERT,
+    DELETE,
+    REPLACE,
+    COMPOSITE
+};
+
+/**
+ * Number of operation kinds, used to size the transform dispatch table
+ */
+constexpr size_t OPERATION_KIND_COUNT = 4;
+
 /**
  * Enumeration of operation sources
  * Used to track the origin of operations for undo/redo management
@@ -37,16 +60,53 @@ enum class OperationSource {
  */
 class Operation {
 public:
+    explicit Operation(OperationKind kind) : kind_(kind) {}
     virtual ~Operation() = default;
     
+    /**
+     * Get the concrete kind of this operation
+     * Prefer this over getType() on hot paths, it does not allocate
+     * 
+     * @return Kind tag of the operation
+     */
+    OperationKind getKind() const {
+        return kind_;
+    }
+    
     /**
      * Apply this operation to the given document
+     * Never modifies the operation, so it can be shared between threads
      * 
      * @param document The document to apply the operation to
      * @return true if successful, false otherwise
      */
     virtual bool apply(std::string& document) const = 0;
     
+    /**
+     * Apply this operation and capture what is needed to invert it
+     * Undo-capable callers use this instead of apply()
+     * 
+     * @param document The document to apply the operation to
+     * @return Copy of this operation whose inverse() is valid, or nullptr on failure
+     */
+    virtual OperationPtr applyAndCapture(std::string& document) const = 0;
+    
+    /**
+     * Apply this operation to a rope-backed document
+     * 
+     * @param document The document to apply the operation to
+     * @return true if successful, false otherwise
+     */
+    virtual bool apply(Rope& document) const = 0;
+    
+    /**
+     * Apply this operation to a rope-backed document and capture its inverse
+     * 
+     * @param document The document to apply the operation to
+     * @return Copy of this operation whose inverse() is valid, or nullptr on failure
+     */
+    virtual OperationPtr applyAndCapture(Rope& document) const = 0;
+    
     /**
      * Transform this operation against another operation
      * 
@@ -139,6 +199,7 @@ public:
     }
 
 private:
+    OperationKind kind_; // Concrete kind, fixed at construction
     OperationSource source_ = OperationSource::LOCAL; // Default to local operation
     std::optional<int64_t> relatedOperationId_; // ID of related operation (for undo/redo)
     int64_t id_ = 0; // Unique identifier for this operation
@@ -152,17 +213,30 @@ public:
     InsertOperation(size_t position, const std::string& text);
     
     bool apply(std::string& document) const override;
+    OperationPtr applyAndCapture(std::string& document) const override;
+    bool apply(Rope& document) const override;
+    OperationPtr applyAndCapture(Rope& document) const override;
     OperationPtr transform(const OperationPtr& other) const override;
     OperationPtr inverse() const override;
     OperationPtr clone() const override;
     std::string serialize() const override;
     std::string getType() const override;
     
+    /**
+     * Extend this insert, in place, with one typed right after its end
+     * 
+     * @param next Insert applied right after this one
+     * @return true if next was absorbed, false if it does not continue this insert
+     */
+    bool extend(const InsertOperation& next);
+    
     // Accessors
     size_t getPosition() const { return position_; }
     const std::string& getText() const { return text_; }
     
 private:
+    friend struct detail::TransformKernels;
+    
     size_t position_;
     std::string text_;
 };
@@ -176,30 +250,82 @@ public:
     DeleteOperation(size_t position, size_t length, const std::string& deleted_text);
     
     bool apply(std::string& document) const override;
+    OperationPtr applyAndCapture(std::string& document) const override;
+    bool apply(Rope& document) const override;
+    OperationPtr applyAndCapture(Rope& document) const override;
     OperationPtr transform(const OperationPtr& other) const override;
     OperationPtr inverse() const override;
     OperationPtr clone() const override;
     std::string serialize() const override;
     std::string getType() const override;
     
+    /**
+     * Extend this delete, in place, with a backspace or forward delete right next to it
+     * Both deletes must have captured their text, or neither
+     * 
+     * @param next Delete applied right after this one
+     * @return true if next was absorbed, false if it does not continue this delete
+     */
+    bool extend(const DeleteOperation& next);
+    
     // Accessors
     size_t getPosition() const { return position_; }
     size_t getLength() const { return length_; }
     const std::string& getDeletedText() const { return deleted_text_; }
     
 private:
+    friend struct detail::TransformKernels;
+    
     size_t position_;
     size_t length_;
     std::string deleted_text_;
 };
 
+/**
+ * Replace text operation: a range is deleted and text inserted in its place
+ * A find and replace or an autocompletion is one of these rather than a
+ * composite of a delete and an insert, so it is applied in one pass and kept
+ * as one history entry. Transformed, it is the insert of its text followed by
+ * the delete of its range: text a concurrent edit puts inside the range is
+ * kept, which can leave a composite.
+ */
+class ReplaceOperation : public Operation {
+public:
+    ReplaceOperation(size_t position, size_t length, const std::string& text);
+    ReplaceOperation(size_t position, size_t length, const std::string& text, const std::string& replaced_text);
+    
+    bool apply(std::string& document) const override;
+    OperationPtr applyAndCapture(std::string& document) const override;
+    bool apply(Rope& document) const override;
+    OperationPtr applyAndCapture(Rope& document) const override;
+    OperationPtr transform(const OperationPtr& other) const override;
+    OperationPtr inverse() const override;
+    OperationPtr clone() const override;
+    std::string serialize() const override;
+    std::string getType() const override;
+    
+    // Accessors
+    size_t getPosition() const { return position_; }
+    size_t getLength() const { return length_; }
+    const std::string& getText() const { return text_; }
+    const std::string& getReplacedText() const { return replaced_text_; }
+    
+private:
+    friend struct detail::TransformKernels;
+    
+    size_t position_;
+    size_t length_;
+    std::string text_;
+    std::string replaced_text_;
+};
+
 /**
  * Composite operation that combines multiple operations into one atomic unit
  * Useful for complex edits that should be undone/redone as a single operation
  */
 class CompositeOperation : public Operation {
 public:
-    CompositeOperation() = default;
+    CompositeOperation() : Operation(OperationKind::COMPOSITE) {}
     
     /**
      * Add an operation to this composite
@@ -216,6 +342,9 @@ public:
     const std::vector<OperationPtr>& getOperations() const { return operations_; }
     
     bool apply(std::string& document) const override;
+    OperationPtr applyAndCapture(std::string& document) const override;
+    bool apply(Rope& document) const override;
+    OperationPtr applyAndCapture(Rope& document) const override;
     OperationPtr transform(const OperationPtr& other) const override;
     OperationPtr inverse() const override;
     OperationPtr clone() const override;
@@ -223,9 +352,52 @@ public:
     std::string getType() const override;
     
 private:
+    friend class TransformArena;
+    
     std::vector<OperationPtr> operations_;
 };
 
+/**
+ * Transform an operation against another one using the kind-indexed
+ * dispatch table. This is what the per-class transform() overrides call.
+ * 
+ * @param op The operation to transform
+ * @param other The operation to transform against
+ * @return A new operation that has been transformed
+ */
+OperationPtr transform(const Operation& op, const Operation& other);
+
+/**
+ * One transform step of an insert or delete, worked out from shapes alone
+ * For the steps that only move or resize the operation, this gives the
+ * position and length transform() would without either operation at hand,
+ * so a log can scan packed columns and build operations only for the
+ * steps that need their text.
+ * 
+ * @param kind Kind of the operation being transformed
+ * @param position Its position, updated
+ * @param length Its deleted length, updated; ignored for an insert
+ * @param otherKind Kind of the operation transformed against
+ * @param otherPosition Its position
+ * @param otherLength Its inserted or deleted length
+ * @return false, leaving position and length alone, if the step needs transform()
+ *         itself: a replace or composite on either side, a delete against a delete, or a delete
+ *         with an insert strictly inside it
+ */
+bool transformShape(OperationKind kind, size_t& position, size_t& length,
+                    OperationKind otherKind, size_t otherPosition, size_t otherLength);
+
+/**
+ * Copy an insert or delete with a new position and length, allocated like a transform result
+ * The copy keeps the text, ID, source and related ID; an insert takes only the position.
+ * 
+ * @param op The insert or delete
+ * @param position New position
+ * @param length New deleted length
+ * @return The copy; a plain transformed clone for a replace or composite
+ */
+OperationPtr reshape(const Operation& op, size_t position, size_t length);
+
 /**
  * Factory for creating operations from serialized representation
  */
@@ -0,0 +1,132 @@
+#include "operation_coalescer.h"
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+OperationPtr mergeInserts(const InsertOperation& first, const InsertOperation& second) {
+    size_t start = first.getPosition();
+    size_t end = start + first.getText().length();
+    
+    // The second insert must land inside or at the edges of the first
+    if (second.getPosition() < start || second.getPosition() > end) {
+        return nullptr;
+    }
+    
+    std::string text = first.getText();
+    text.insert(second.getPosition() - start, second.getText());
+    return std::make_shared<InsertOperation>(start, text);
+}
+
+OperationPtr mergeDeletes(const DeleteOperation& first, const DeleteOperation& second) {
+    // Deleted text is only kept if both sides captured it
+    bool haveText = !first.getDeletedText().empty() && !second.getDeletedText().empty();
+    
+    // Forward delete: same position, range grows to the right
+    if (second.getPosition() == first.getPosition()) {
+        return std::make_shared<DeleteOperation>(
+            first.getPosition(),
+            first.getLength() + second.getLength(),
+            haveText ? first.getDeletedText() + second.getDeletedText() : "");
+    }
+    
+    // Backspace: second range ends where the first started
+    if (second.getPosition() + second.getLength() == first.getPosition()) {
+        return std::make_shared<DeleteOperation>(
+            second.getPosition(),
+            first.getLength() + second.getLength(),
+            haveText ? second.getDeletedText() + first.getDeletedText() : "");
+    }
+    
+    return nullptr;
+}
+
+OperationPtr mergeInsertDelete(const InsertOperation& first, const DeleteOperation& second) {
+    size_t start = first.getPosition();
+    size_t end = start + first.getText().length();
+    
+    // Only deletes of text that was just inserted can be folded away
+    if (second.getPosition() < start || second.getPosition() + second.getLength() > end) {
+        return nullptr;
+    }
+    
+    std::string text = first.getText();
+    text.erase(second.getPosition() - start, second.getLength());
+    return std::make_shared<InsertOperation>(start, text);
+}
+
+bool isEmptyInsert(const Operation& op) {
+    return op.getKind() == OperationKind::INSERT &&
+           static_cast<const InsertOperation&>(op).getText().empty();
+}
+
+} // namespace
+
+OperationCoalescer::OperationCoalescer(CoalescingPolicy policy)
+    : policy_(policy) {
+}
+
+void OperationCoalescer::push(const OperationPtr& op, Clock::time_point now) {
+    if (!op) {
+        return;
+    }
+    
+    if (pending_.empty()) {
+        oldest_ = now;
+    }
+    pending_.push_back(op);
+}
+
+bool OperationCoalescer::shouldFlush(Clock::time_point now) const {
+    if (pending_.empty()) {
+        return false;
+    }
+    
+    return pending_.size() >= policy_.maxPendingOperations ||
+           now - oldest_ >= policy_.flushWindow;
+}
+
+std::vector<OperationPtr> OperationCoalescer::flush() {
+    std::vector<OperationPtr> result;
+    
+    for (const auto& op : pending_) {
+        if (!result.empty()) {
+            if (OperationPtr merged = merge(*result.back(), *op)) {
+                result.back() = merged;
+                continue;
+            }
+        }
+        result.push_back(op);
+    }
+    pending_.clear();
+    
+    // Inserts that were typed and erased again before sending have no effect
+    std::erase_if(result, [](const OperationPtr& op) { return isEmptyInsert(*op); });
+    return result;
+}
+
+OperationPtr OperationCoalescer::merge(const Operation& first, const Operation& second) {
+    OperationPtr merged;
+    
+    if (first.getKind() == OperationKind::INSERT && second.getKind() == OperationKind::INSERT) {
+        merged = mergeInserts(static_cast<const InsertOperation&>(first),
+                              static_cast<const InsertOperation&>(second));
+    } else if (first.getKind() == OperationKind::DELETE && second.getKind() == OperationKind::DELETE) {
+        merged = mergeDeletes(static_cast<const DeleteOperation&>(first),
+                              static_cast<const DeleteOperation&>(second));
+    } else if (first.getKind() == OperationKind::INSERT && second.getKind() == OperationKind::DELETE) {
+        merged = mergeInsertDelete(static_cast<const InsertOperation&>(first),
+                                   static_cast<const DeleteOperation&>(second));
+    }
+    
+    if (merged) {
+        // The net operation takes over the identity of the first edit in the run
+        merged->setId(first.getId());
+        merged->setSource(first.getSource());
+    }
+    return merged;
+}
+
+} // namespace ot
+} // namespace collab
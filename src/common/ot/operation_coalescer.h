@@ -0,0 +1,101 @@
+// FILE: include/common/ot/operation_coalescer.h
+// Description: Merges runs of adjacent local edits into net operations before sending
+
+#pragma once
+
+#include "operation.h"
+#include <chrono>
+#include <deque>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Controls when buffered operations are flushed
+ */
+struct CoalescingPolicy {
+    std::chrono::milliseconds flushWindow{16}; // Flush once the oldest pending op is this old
+    size_t maxPendingOperations = 64;          // Flush once this many ops are buffered
+};
+
+/**
+ * Buffers outbound operations and merges adjacent inserts and deletes
+ * (typing runs, backspace runs, typos fixed before sending) into
+ * single net operations.
+ * Not thread-safe; the owner serializes access.
+ */
+class OperationCoalescer {
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    /**
+     * Constructor
+     * 
+     * @param policy Flush window and size limit
+     */
+    explicit OperationCoalescer(CoalescingPolicy policy = {});
+    
+    /**
+     * Buffer an operation
+     * 
+     * @param op Operation to buffer, in the order it was applied locally
+     * @param now Time the operation was generated
+     */
+    void push(const OperationPtr& op, Clock::time_point now = Clock::now());
+    
+    /**
+     * Check whether the buffered operations should be sent
+     * 
+     * @param now Current time
+     * @return true if the flush window elapsed or the size limit was reached
+     */
+    bool shouldFlush(Clock::time_point now = Clock::now()) const;
+    
+    /**
+     * Merge and remove all buffered operations
+     * 
+     * @return Net operations to send, in order
+     */
+    std::vector<OperationPtr> flush();
+    
+    /**
+     * Get number of buffered operations
+     * 
+     * @return Count of operations pushed since the last flush
+     */
+    size_t size() const {
+        return pending_.size();
+    }
+    
+    bool empty() const {
+        return pending_.empty();
+    }
+    
+    /**
+     * Change the flush policy
+     * 
+     * @param policy New flush window and size limit
+     */
+    void setPolicy(CoalescingPolicy policy) {
+        policy_ = policy;
+    }
+    
+    /**
+     * Merge two consecutive operations into one
+     * An insert fully removed by the following delete merges into an empty insert.
+     * 
+     * @param first Operation applied first
+     * @param second Operation applied right after first
+     * @return The merged operation, or nullptr if they cannot be merged
+     */
+    static OperationPtr merge(const Operation& first, const Operation& second);
+
+private:
+    CoalescingPolicy policy_;
+    std::deque<OperationPtr> pending_;
+    Clock::time_point oldest_;
+};
+
+} // namespace ot
+} // namespace collab
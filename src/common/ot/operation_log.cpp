@@ -0,0 +1,232 @@
+#include "operation_log.h"
+#include "bulk_transform.h"
+#include "transform_arena.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+size_t footprint(const OperationPtr& op) {
+    return op ? changedLength(*op) + OperationLog::ENTRY_OVERHEAD : 0;
+}
+
+struct Shape {
+    OperationKind kind = OperationKind::COMPOSITE;
+    size_t position = 0;
+    size_t length = 0;
+};
+
+Shape shapeOf(const OperationPtr& op) {
+    if (!op) {
+        return {};
+    }
+    switch (op->getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(*op);
+            return {OperationKind::INSERT, insert.getPosition(), insert.getText().length()};
+        }
+        case OperationKind::DELETE: {
+            const auto& remove = static_cast<const DeleteOperation&>(*op);
+            return {OperationKind::DELETE, remove.getPosition(), remove.getLength()};
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(*op);
+            return {OperationKind::REPLACE, replace.getPosition(), replace.getLength()};
+        }
+        case OperationKind::COMPOSITE:
+            break;
+    }
+    return {};
+}
+
+} // namespace
+
+OperationLog::OperationLog(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)),
+      slots_(2 * capacity_, &util::memoryResource(util::MemoryTag::OT_LOG)),
+      kinds_(2 * capacity_, OperationKind::COMPOSITE, &util::memoryResource(util::MemoryTag::OT_LOG)),
+      positions_(2 * capacity_, 0, &util::memoryResource(util::MemoryTag::OT_LOG)),
+      lengths_(2 * capacity_, 0, &util::memoryResource(util::MemoryTag::OT_LOG)) {
+}
+
+int64_t OperationLog::append(const OperationPtr& op) {
+    // Full: the slot about to be written holds the oldest entry
+    if (size() == capacity_) {
+        release(firstRevision_++);
+    }
+    
+    int64_t revision = headRevision_++;
+    size_t index = slot(revision);
+    slots_[index] = op;
+    slots_[index + capacity_] = op;
+    const Shape shape = shapeOf(op);
+    kinds_[index] = kinds_[index + capacity_] = shape.kind;
+    positions_[index] = positions_[index + capacity_] = shape.position;
+    lengths_[index] = lengths_[index + capacity_] = shape.length;
+    bytes_ += footprint(op);
+    charge_.set(bytes_);
+    enforceBudget();
+    return revision;
+}
+
+OperationPtr OperationLog::at(int64_t revision) const {
+    if (revision < firstRevision_ || revision >= headRevision_) {
+        return nullptr;
+    }
+    return slots_[slot(revision)];
+}
+
+OperationPtr OperationLog::fetch(int64_t revision) const {
+    if (revision >= firstRevision_ || !spill_) {
+        return at(revision);
+    }
+    return spill_->read(revision);
+}
+
+std::vector<OperationPtr> OperationLog::collect(int64_t revision) const {
+    if (!canReplay(revision)) {
+        throw std::out_of_range("Revision " + std::to_string(revision) + " is neither retained nor spilled");
+    }
+    
+    std::vector<OperationPtr> ops;
+    ops.reserve(static_cast<size_t>(headRevision_ - revision));
+    for (; revision < firstRevision_; ++revision) {
+        ops.push_back(spill_->read(revision));
+        if (!ops.back()) {
+            throw std::runtime_error("Failed to read revision " + std::to_string(revision) + " back from the spill");
+        }
+    }
+    std::span<const OperationPtr> retained = since(revision);
+    ops.insert(ops.end(), retained.begin(), retained.end());
+    return ops;
+}
+
+std::span<const OperationPtr> OperationLog::since(int64_t revision) const {
+    if (!canCatchUp(revision)) {
+        throw std::out_of_range("Revision " + std::to_string(revision) + " is not retained in the operation log");
+    }
+    
+    size_t count = static_cast<size_t>(headRevision_ - revision);
+    if (count == 0) {
+        return {};
+    }
+    return std::span<const OperationPtr>(slots_.data() + slot(revision), count);
+}
+
+OperationPtr OperationLog::transformSince(const OperationPtr& op, int64_t revision) const {
+    std::span<const OperationPtr> history = since(revision);
+    // Only inserts and deletes have shapes that move without their operation
+    if (!op || history.empty() || op->getKind() == OperationKind::REPLACE || op->getKind() == OperationKind::COMPOSITE) {
+        return transformThrough(op, history);
+    }
+    
+    // Declared before the operations it holds, so it outlives them
+    TransformArena arena;
+    OperationPtr current = op;
+    Shape shape = shapeOf(current);
+    bool moved = false;  // Whether shape is ahead of current
+    const size_t begin = slot(revision);
+    for (size_t i = begin; i < begin + history.size(); ++i) {
+        if (transformShape(shape.kind, shape.position, shape.length, kinds_[i], positions_[i], lengths_[i])) {
+            moved = true;
+            continue;
+        }
+        if (moved) {
+            current = reshape(*current, shape.position, shape.length);
+            moved = false;
+        }
+        current = current->transform(slots_[i]);
+        if (!current) {
+            return nullptr;
+        }
+        shape = shapeOf(current);
+    }
+    if (moved) {
+        current = reshape(*current, shape.position, shape.length);
+    }
+    return arena.promote(*current);
+}
+
+int64_t OperationLog::lengthDeltaSince(int64_t revision) const {
+    const size_t count = since(revision).size();
+    int64_t delta = 0;
+    const size_t begin = slot(revision);
+    for (size_t i = begin; i < begin + count; ++i) {
+        switch (kinds_[i]) {
+            case OperationKind::INSERT:
+                delta += static_cast<int64_t>(lengths_[i]);
+                break;
+            case OperationKind::DELETE:
+                delta -= static_cast<int64_t>(lengths_[i]);
+                break;
+            case OperationKind::REPLACE:
+            case OperationKind::COMPOSITE:
+                if (slots_[i]) {
+                    delta += lengthDelta(*slots_[i]);
+                }
+                break;
+        }
+    }
+    return delta;
+}
+
+void OperationLog::discardBefore(int64_t revision) {
+    revision = std::min(revision, headRevision_);
+    while (firstRevision_ < revision) {
+        release(firstRevision_++);
+    }
+}
+
+void OperationLog::reset(int64_t revision) {
+    std::fill(slots_.begin(), slots_.end(), nullptr);
+    firstRevision_ = revision;
+    headRevision_ = revision;
+    bytes_ = 0;
+    charge_.set(0);
+    if (spill_) {
+        spill_->clear(revision);
+    }
+}
+
+void OperationLog::setByteBudget(size_t bytes) {
+    byteBudget_ = bytes;
+    enforceBudget();
+}
+
+void OperationLog::setSpill(std::shared_ptr<OperationSegment> spill) {
+    spill_ = std::move(spill);
+    if (spill_) {
+        spill_->clear(firstRevision_);
+    }
+}
+
+void OperationLog::enforceBudget() {
+    while (byteBudget_ > 0 && bytes_ > byteBudget_ && size() > 1) {
+        release(firstRevision_++);
+    }
+}
+
+void OperationLog::release(int64_t revision) {
+    size_t index = slot(revision);
+    const OperationPtr& op = slots_[index];
+    if (op) {
+        bytes_ -= footprint(op);
+        charge_.set(bytes_);
+        if (spill_) {
+            try {
+                spill_->append(revision, *op);
+            } catch (const std::exception&) {
+                // Nothing older than a lost record can be replayed, start the spill over after it
+                spill_->clear(revision + 1);
+            }
+        }
+    }
+    slots_[index].reset();
+    slots_[index + capacity_].reset();
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,236 @@
+// FILE: include/common/ot/operation_log.h
+// Description: Bounded, revision-indexed log of applied operations
+
+#pragma once
+
+#include "operation.h"
+#include "operation_segment.h"
+#include "common/util/memory_accounting.h"
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Ring buffer of applied operations indexed by revision.
+ * The entry at revision N moved the document from revision N to N + 1.
+ * 
+ * Every entry is stored twice, at slot and slot + capacity, so any
+ * retained suffix of the log can be handed out as one contiguous span.
+ * Once full, appending overwrites the oldest entry.
+ * 
+ * Besides the entry count the log can be held to a byte budget, measured
+ * as the text each entry inserts or deletes plus a fixed overhead, and
+ * then drops the oldest entries until it fits again. Entries that leave
+ * memory, for either reason or through discardBefore(), go to a spill
+ * segment when one is set, where fetch() and collect() still find them:
+ * memory stays bounded while deep history is paged in from disk.
+ * 
+ * Alongside the slots the log keeps each entry's kind, position and
+ * inserted or deleted length in packed columns, mirrored the same way.
+ * Transforming through the log scans those and only reaches into an
+ * operation when a step needs its text.
+ * The slots, the columns and the accounted bytes of the entries count
+ * towards util::MemoryTag::OT_LOG.
+ * Not thread-safe; the owner serializes access.
+ */
+class OperationLog {
+public:
+    /**
+     * Constructor
+     * 
+     * @param capacity Maximum number of operations retained (default: 10000)
+     */
+    explicit OperationLog(size_t capacity = 10000);
+    
+    /**
+     * Approximate memory held per entry besides its text
+     */
+    static constexpr size_t ENTRY_OVERHEAD = 96;
+    
+    /**
+     * Append an applied operation
+     * 
+     * @param op The operation
+     * @return Revision the operation was applied at
+     */
+    int64_t append(const OperationPtr& op);
+    
+    /**
+     * Look up the operation applied at a revision
+     * 
+     * @param revision The revision
+     * @return The operation, or nullptr if it is not retained
+     */
+    OperationPtr at(int64_t revision) const;
+    
+    /**
+     * Look up the operation applied at a revision, in memory or spilled
+     * 
+     * @param revision The revision
+     * @return The operation, or nullptr if it is neither retained nor spilled;
+     *         a spilled one is a fresh copy read from disk
+     */
+    OperationPtr fetch(int64_t revision) const;
+    
+    /**
+     * Get all operations from a revision up to head, spilled ones included
+     * 
+     * @param revision First revision of the range
+     * @return Operations [revision, headRevision()), oldest first
+     * @throws std::out_of_range if canReplay(revision) is false
+     */
+    std::vector<OperationPtr> collect(int64_t revision) const;
+    
+    /**
+     * Get all retained operations from a revision up to head
+     * 
+     * @param revision First revision of the range
+     * @return Operations [revision, headRevision()), oldest first
+     * @throws std::out_of_range if revision is not between firstRevision() and headRevision()
+     */
+    std::span<const OperationPtr> since(int64_t revision) const;
+    
+    /**
+     * Transform an operation through every retained operation from a revision up to head
+     * Gives the same result as transformThrough(op, since(revision)), but
+     * steps that only move an insert or move or resize a delete are read
+     * off the columns without building an operation.
+     * 
+     * @param op The operation to transform
+     * @param revision The revision op was based on
+     * @return The transformed operation, op itself if nothing is newer, or nullptr if a step fails
+     * @throws std::out_of_range if canCatchUp(revision) is false
+     */
+    OperationPtr transformSince(const OperationPtr& op, int64_t revision) const;
+    
+    /**
+     * Get how much the retained operations from a revision up to head change the document length
+     * 
+     * @param revision First revision of the range
+     * @return Sum of lengthDelta() over [revision, headRevision())
+     * @throws std::out_of_range if canCatchUp(revision) is false
+     */
+    int64_t lengthDeltaSince(int64_t revision) const;
+    
+    /**
+     * Check whether the log can bring a client at a revision up to head
+     * 
+     * @param revision The client's base revision
+     * @return true if every operation after the revision is retained
+     */
+    bool canCatchUp(int64_t revision) const {
+        return revision >= firstRevision_ && revision <= headRevision_;
+    }
+    
+    /**
+     * Check whether every operation after a revision is still reachable through collect()
+     * 
+     * @param revision The base revision
+     * @return true if the operations are retained or spilled
+     */
+    bool canReplay(int64_t revision) const {
+        return canCatchUp(revision) ||
+               (spill_ && revision <= headRevision_ && spill_->contains(revision) &&
+                spill_->endRevision() == firstRevision_);
+    }
+    
+    /**
+     * Hold the retained entries to a byte budget, dropping the oldest at once if over it
+     * The newest entry is kept even if it alone exceeds the budget
+     * 
+     * @param bytes Budget in bytes; 0 for none
+     */
+    void setByteBudget(size_t bytes);
+    
+    /**
+     * Send entries that leave memory to a segment on disk
+     * 
+     * @param spill The segment, or nullptr to drop them; shared so the owner can inspect it
+     */
+    void setSpill(std::shared_ptr<OperationSegment> spill);
+    
+    /**
+     * Release every operation below a revision
+     * Called with the low watermark once all clients have moved past it
+     * 
+     * @param revision First revision to keep
+     */
+    void discardBefore(int64_t revision);
+    
+    /**
+     * Drop all operations and restart at a revision
+     * 
+     * @param revision Revision of the next appended operation
+     */
+    void reset(int64_t revision = 0);
+    
+    /**
+     * Get the oldest retained revision
+     * 
+     * @return Oldest revision, equal to headRevision() when empty
+     */
+    int64_t firstRevision() const {
+        return firstRevision_;
+    }
+    
+    /**
+     * Get the revision the next operation will be applied at
+     * 
+     * @return Head revision
+     */
+    int64_t headRevision() const {
+        return headRevision_;
+    }
+    
+    size_t size() const {
+        return static_cast<size_t>(headRevision_ - firstRevision_);
+    }
+    
+    size_t capacity() const {
+        return capacity_;
+    }
+    
+    bool empty() const {
+        return headRevision_ == firstRevision_;
+    }
+    
+    /**
+     * Get the bytes the retained entries are accounted for
+     * 
+     * @return Accounted bytes
+     */
+    size_t bytes() const {
+        return bytes_;
+    }
+
+private:
+    size_t slot(int64_t revision) const {
+        return static_cast<size_t>(revision) % capacity_;
+    }
+    
+    // Drop the oldest entries while over the byte budget
+    void enforceBudget();
+    
+    void release(int64_t revision);
+    
+    size_t capacity_;
+    std::pmr::vector<OperationPtr> slots_; // 2 * capacity_, mirrored halves
+    // Shapes of the slots, mirrored the same way; an empty slot reads as a composite
+    std::pmr::vector<OperationKind> kinds_;
+    std::pmr::vector<size_t> positions_;
+    std::pmr::vector<size_t> lengths_;     // Inserted or deleted length, replaced for a replace, 0 for a composite
+    int64_t firstRevision_ = 0;
+    int64_t headRevision_ = 0;
+    size_t byteBudget_ = 0;
+    size_t bytes_ = 0;
+    util::MemoryCharge charge_{util::memoryResource(util::MemoryTag::OT_LOG)};  // Follows bytes_
+    std::shared_ptr<OperationSegment> spill_;
+};
+
+} // namespace ot
+} // namespace collab
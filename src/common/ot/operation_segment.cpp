@@ -0,0 +1,101 @@
+#include "operation_segment.h"
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+// Written as is; the file never outlives the process that wrote it
+struct RecordHeader {
+    uint32_t length;     // Bytes of serialized operation after the header
+    uint8_t source;
+    uint8_t hasRelated;
+    int64_t id;
+    int64_t relatedId;
+};
+
+} // namespace
+
+OperationSegment::OperationSegment(std::filesystem::path path)
+    : path_(std::move(path)) {
+    open();
+}
+
+OperationSegment::~OperationSegment() {
+    file_.close();
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+}
+
+void OperationSegment::append(int64_t revision, const Operation& op) {
+    if (revision != endRevision()) {
+        clear(revision);
+    }
+    
+    std::string payload = op.serialize();
+    std::optional<int64_t> related = op.getRelatedOperationId();
+    RecordHeader header{
+        static_cast<uint32_t>(payload.size()),
+        static_cast<uint8_t>(op.getSource()),
+        static_cast<uint8_t>(related.has_value()),
+        op.getId(),
+        related.value_or(0)
+    };
+    
+    file_.seekp(static_cast<std::streamoff>(bytes_));
+    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file_.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+    if (!file_) {
+        file_.clear();
+        throw std::runtime_error("Failed to write operation segment " + path_.string());
+    }
+    
+    offsets_.push_back(bytes_);
+    bytes_ += sizeof(header) + payload.size();
+}
+
+OperationPtr OperationSegment::read(int64_t revision) const {
+    if (!contains(revision)) {
+        return nullptr;
+    }
+    
+    RecordHeader header;
+    file_.seekg(static_cast<std::streamoff>(offsets_[static_cast<size_t>(revision - firstRevision_)]));
+    file_.read(reinterpret_cast<char*>(&header), sizeof(header));
+    std::string payload(header.length, '\0');
+    file_.read(payload.data(), static_cast<std::streamsize>(payload.size()));
+    if (!file_) {
+        file_.clear();
+        return nullptr;
+    }
+    
+    OperationPtr op = OperationFactory::deserialize(payload);
+    op->setId(header.id);
+    op->setSource(static_cast<OperationSource>(header.source));
+    if (header.hasRelated) {
+        op->setRelatedOperationId(header.relatedId);
+    }
+    return op;
+}
+
+void OperationSegment::clear(int64_t revision) {
+    file_.close();
+    open();
+    offsets_.clear();
+    firstRevision_ = revision;
+    bytes_ = 0;
+}
+
+void OperationSegment::open() {
+    file_.open(path_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        throw std::runtime_error("Failed to open operation segment " + path_.string());
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,113 @@
+// FILE: include/common/ot/operation_segment.h
+// Description: Append-only file of operations released from an operation log
+
+#pragma once
+
+#include "operation.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * On-disk continuation of an OperationLog.
+ * Operations leave the log oldest first, so the segment holds one run of
+ * consecutive revisions that ends where the log's memory begins. Each
+ * record is the operation's serialized form behind a small header with
+ * its ID, related ID and source; an in-memory index of record offsets
+ * pages any one of them back in with a single seek.
+ * 
+ * The file is scratch space: it is truncated when the segment is created
+ * and removed when it is destroyed.
+ * Not thread-safe; the owner serializes access.
+ */
+class OperationSegment {
+public:
+    /**
+     * Constructor
+     * 
+     * @param path File to write the segment to; truncated if it exists
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    explicit OperationSegment(std::filesystem::path path);
+    
+    ~OperationSegment();
+    
+    OperationSegment(const OperationSegment&) = delete;
+    OperationSegment& operator=(const OperationSegment&) = delete;
+    
+    /**
+     * Append the operation applied at a revision
+     * A revision that does not follow the last one starts the segment over
+     * 
+     * @param revision Revision the operation was applied at
+     * @param op The operation
+     * @throws std::runtime_error if the record cannot be written
+     */
+    void append(int64_t revision, const Operation& op);
+    
+    /**
+     * Read back the operation applied at a revision
+     * 
+     * @param revision The revision
+     * @return A new copy of the operation, or nullptr if it is not in the segment
+     */
+    OperationPtr read(int64_t revision) const;
+    
+    bool contains(int64_t revision) const {
+        return revision >= firstRevision_ && revision < endRevision();
+    }
+    
+    /**
+     * Get the oldest revision in the segment
+     * 
+     * @return Oldest revision, equal to endRevision() when empty
+     */
+    int64_t firstRevision() const {
+        return firstRevision_;
+    }
+    
+    /**
+     * Get the revision after the newest one in the segment
+     * 
+     * @return End revision
+     */
+    int64_t endRevision() const {
+        return firstRevision_ + static_cast<int64_t>(offsets_.size());
+    }
+    
+    /**
+     * Get the size of the file
+     * 
+     * @return Bytes written
+     */
+    uint64_t bytes() const {
+        return bytes_;
+    }
+    
+    bool empty() const {
+        return offsets_.empty();
+    }
+    
+    /**
+     * Drop every record and truncate the file
+     * 
+     * @param revision Revision the next appended operation is expected at
+     */
+    void clear(int64_t revision = 0);
+    
+private:
+    void open();
+    
+    std::filesystem::path path_;
+    mutable std::fstream file_;
+    std::vector<uint64_t> offsets_; // File offset of each record, by revision - firstRevision_
+    int64_t firstRevision_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+} // namespace ot
+} // namespace collab
@@ -1,8 +1,15 @@
 #include "operation.h"
+#include "transform_arena.h"
 #include <nlohmann/json.hpp>
 #include <stdexcept>
 #include <algorithm>
 #include <memory>
+#include <memory_resource>
+#include <tuple>
+
+#ifdef COLLAB_SIMDJSON
+#include <simdjson.h>
+#endif
 
 namespace collab {
 namespace ot {
@@ -12,7 +19,7 @@ namespace ot {
 //
 
 InsertOperation::InsertOperation(size_t position, const std::string& text)
-    : position_(position), text_(text) {
+    : Operation(OperationKind::INSERT), position_(position), text_(text) {
 }
 
 bool InsertOperation::apply(std::string& document) const {
@@ -24,40 +31,30 @@ bool InsertOperation::apply(std::string& document) const {
     return true;
 }
 
-OperationPtr InsertOperation::transform(const OperationPtr& other) const {
-    if (auto otherInsert = std::dynamic_pointer_cast<InsertOperation>(other)) {
-        // Transform against another insert operation
-        auto result = std::make_shared<InsertOperation>(*this);
-        
-        // If the other insert is before or at our position, shift our position right
-        if (otherInsert->getPosition() <= position_) {
-            result->position_ += otherInsert->getText().length();
-        }
-        
-        return result;
+OperationPtr InsertOperation::applyAndCapture(std::string& document) const {
+    // An insert already carries everything its inverse needs
+    if (!apply(document)) {
+        return nullptr;
     }
-    else if (auto otherDelete = std::dynamic_pointer_cast<DeleteOperation>(other)) {
-        // Transform against a delete operation
-        auto result = std::make_shared<InsertOperation>(*this);
-        
-        size_t deleteEnd = otherDelete->getPosition() + otherDelete->getLength();
-        
-        if (otherDelete->getPosition() < position_) {
-            // The delete affects our position
-            if (deleteEnd <= position_) {
-                // Delete is entirely before our position, shift left
-                result->position_ -= otherDelete->getLength();
-            } else {
-                // Delete overlaps with or contains our position
-                result->position_ = otherDelete->getPosition();
-            }
-        }
-        
-        return result;
+    return std::make_shared<InsertOperation>(*this);
+}
+
+bool InsertOperation::apply(Rope& document) const {
+    return document.insert(position_, text_);
+}
+
+OperationPtr InsertOperation::applyAndCapture(Rope& document) const {
+    if (!apply(document)) {
+        return nullptr;
     }
-    
-    // Unknown operation type, return a clone
-    return clone();
+    return std::make_shared<InsertOperation>(*this);
+}
+
+OperationPtr InsertOperation::transform(const OperationPtr& other) const {
+    if (!other) {
+        return clone();
+    }
+    return ot::transform(*this, *other);
 }
 
 OperationPtr InsertOperation::inverse() const {
@@ -81,16 +78,24 @@ std::string InsertOperation::getType() const {
     return "insert";
 }
 
+bool InsertOperation::extend(const InsertOperation& next) {
+    if (next.position_ != position_ + text_.length()) {
+        return false;
+    }
+    text_ += next.text_;
+    return true;
+}
+
 //
 // DeleteOperation Implementation
 //
 
 DeleteOperation::DeleteOperation(size_t position, size_t length)
-    : position_(position), length_(length) {
+    : Operation(OperationKind::DELETE), position_(position), length_(length) {
 }
 
 DeleteOperation::DeleteOperation(size_t position, size_t length, const std::string& deleted_text)
-    : position_(position), length_(length), deleted_text_(deleted_text) {
+    : Operation(OperationKind::DELETE), position_(position), length_(length), deleted_text_(deleted_text) {
 }
 
 bool DeleteOperation::apply(std::string& document) const {
@@ -98,142 +103,958 @@ bool DeleteOperation::apply(std::string& document) const {
         return false;
     }
     
-    // Store the deleted text if it wasn't provided
-    if (deleted_text_.empty()) {
-        const_cast<std::string&>(deleted_text_) = document.substr(position_, length_);
+    document.erase(position_, length_);
+    return true;
+}
+
+OperationPtr DeleteOperation::applyAndCapture(std::string& document) const {
+    if (position_ + length_ > document.length()) {
+        return nullptr;
     }
     
+    auto captured = std::make_shared<DeleteOperation>(*this);
+    captured->deleted_text_ = document.substr(position_, length_);
     document.erase(position_, length_);
-    return true;
+    return captured;
+}
+
+bool DeleteOperation::apply(Rope& document) const {
+    return document.erase(position_, length_);
+}
+
+OperationPtr DeleteOperation::applyAndCapture(Rope& document) const {
+    if (position_ + length_ > document.length()) {
+        return nullptr;
+    }
+    
+    auto captured = std::make_shared<DeleteOperation>(*this);
+    captured->deleted_text_ = document.substr(position_, length_);
+    document.erase(position_, length_);
+    return captured;
 }
 
 OperationPtr DeleteOperation::transform(const OperationPtr& other) const {
-    if (auto otherInsert = std::dynamic_pointer_cast<InsertOperation>(other)) {
-        // Transform against an insert operation
-        auto result = std::make_shared<DeleteOperation>(*this);
-        
+    if (!other) {
+        return clone();
+    }
+    return ot::transform(*this, *other);
+}
+
+OperationPtr DeleteOperation::inverse() const {
+    // The inverse of a delete is an insert of the deleted text
+    if (deleted_text_.empty()) {
+        throw std::runtime_error("Cannot invert delete operation without deleted text");
+    }
+    
+    return std::make_shared<InsertOperation>(position_, deleted_text_);
+}
+
+OperationPtr DeleteOperation::clone() const {
+    return std::make_shared<DeleteOperation>(position_, length_, deleted_text_);
+}
+
+std::string DeleteOperation::serialize() const {
+    nlohmann::json j;
+    j["type"] = "delete";
+    j["position"] = position_;
+    j["length"] = length_;
+    j["text"] = deleted_text_;
+    return j.dump();
+}
+
+std::string DeleteOperation::getType() const {
+    return "delete";
+}
+
+bool DeleteOperation::extend(const DeleteOperation& next) {
+    if (deleted_text_.empty() != next.deleted_text_.empty()) {
+        return false;
+    }
+    
+    // Forward delete: same position, range grows to the right
+    if (next.position_ == position_) {
+        length_ += next.length_;
+        deleted_text_ += next.deleted_text_;
+        return true;
+    }
+    
+    // Backspace: the next range ends where this one starts
+    if (next.position_ + next.length_ == position_) {
+        position_ = next.position_;
+        length_ += next.length_;
+        deleted_text_.insert(0, next.deleted_text_);
+        return true;
+    }
+    
+    return false;
+}
+
+//
+// ReplaceOperation Implementation
+//
+
+ReplaceOperation::ReplaceOperation(size_t position, size_t length, const std::string& text)
+    : Operation(OperationKind::REPLACE), position_(position), length_(length), text_(text) {
+}
+
+ReplaceOperation::ReplaceOperation(size_t position, size_t length, const std::string& text,
+                                   const std::string& replaced_text)
+    : Operation(OperationKind::REPLACE), position_(position), length_(length), text_(text),
+      replaced_text_(replaced_text) {
+}
+
+bool ReplaceOperation::apply(std::string& document) const {
+    if (position_ + length_ > document.length()) {
+        return false;
+    }
+    
+    // One move of the tail, by the difference in length
+    document.replace(position_, length_, text_);
+    return true;
+}
+
+OperationPtr ReplaceOperation::applyAndCapture(std::string& document) const {
+    if (position_ + length_ > document.length()) {
+        return nullptr;
+    }
+    
+    auto captured = std::make_shared<ReplaceOperation>(*this);
+    captured->replaced_text_ = document.substr(position_, length_);
+    document.replace(position_, length_, text_);
+    return captured;
+}
+
+bool ReplaceOperation::apply(Rope& document) const {
+    return document.replace(position_, length_, text_);
+}
+
+OperationPtr ReplaceOperation::applyAndCapture(Rope& document) const {
+    if (position_ + length_ > document.length()) {
+        return nullptr;
+    }
+    
+    auto captured = std::make_shared<ReplaceOperation>(*this);
+    captured->replaced_text_ = document.substr(position_, length_);
+    document.replace(position_, length_, text_);
+    return captured;
+}
+
+OperationPtr ReplaceOperation::transform(const OperationPtr& other) const {
+    if (!other) {
+        return clone();
+    }
+    return ot::transform(*this, *other);
+}
+
+OperationPtr ReplaceOperation::inverse() const {
+    // The inverse of a replace puts the replaced text back over the new one
+    if (replaced_text_.length() != length_) {
+        throw std::runtime_error("Cannot invert replace operation without replaced text");
+    }
+    
+    return std::make_shared<ReplaceOperation>(position_, text_.length(), replaced_text_, text_);
+}
+
+OperationPtr ReplaceOperation::clone() const {
+    return std::make_shared<ReplaceOperation>(position_, length_, text_, replaced_text_);
+}
+
+std::string ReplaceOperation::serialize() const {
+    nlohmann::json j;
+    j["type"] = "replace";
+    j["position"] = position_;
+    j["length"] = length_;
+    j["text"] = text_;
+    j["replaced"] = replaced_text_;
+    return j.dump();
+}
+
+std::string ReplaceOperation::getType() const {
+    return "replace";
+}
+
+//
+// CompositeOperation Implementation
+//
+
+void CompositeOperation::addOperation(const OperationPtr& op) {
+    if (op) {
+        operations_.push_back(op);
+    }
+}
+
+bool CompositeOperation::apply(std::string& document) const {
+    // Apply to a scratch copy so a failing child leaves the document untouched
+    std::string result = document;
+    for (const auto& op : operations_) {
+        if (!op->apply(result)) {
+            return false;
+        }
+    }
+    document.swap(result);
+    return true;
+}
+
+OperationPtr CompositeOperation::applyAndCapture(std::string& document) const {
+    auto captured = std::make_shared<CompositeOperation>(*this);
+    captured->operations_.clear();
+    
+    std::string result = document;
+    for (const auto& op : operations_) {
+        OperationPtr child = op->applyAndCapture(result);
+        if (!child) {
+            return nullptr;
+        }
+        captured->operations_.push_back(std::move(child));
+    }
+    document.swap(result);
+    return captured;
+}
+
+bool CompositeOperation::apply(Rope& document) const {
+    // Copying a rope is O(1), so the scratch copy costs nothing up front
+    Rope result = document;
+    for (const auto& op : operations_) {
+        if (!op->apply(result)) {
+            return false;
+        }
+    }
+    document = std::move(result);
+    return true;
+}
+
+OperationPtr CompositeOperation::applyAndCapture(Rope& document) const {
+    auto captured = std::make_shared<CompositeOperation>(*this);
+    captured->operations_.clear();
+    
+    Rope result = document;
+    for (const auto& op : operations_) {
+        OperationPtr child = op->applyAndCapture(result);
+        if (!child) {
+            return nullptr;
+        }
+        captured->operations_.push_back(std::move(child));
+    }
+    document = std::move(result);
+    return captured;
+}
+
+OperationPtr CompositeOperation::transform(const OperationPtr& other) const {
+    if (!other) {
+        return clone();
+    }
+    return ot::transform(*this, *other);
+}
+
+OperationPtr CompositeOperation::inverse() const {
+    // Undo the children in reverse order
+    auto result = std::make_shared<CompositeOperation>();
+    for (auto it = operations_.rbegin(); it != operations_.rend(); ++it) {
+        result->addOperation((*it)->inverse());
+    }
+    return result;
+}
+
+OperationPtr CompositeOperation::clone() const {
+    auto result = std::make_shared<CompositeOperation>();
+    for (const auto& op : operations_) {
+        result->addOperation(op->clone());
+    }
+    return result;
+}
+
+std::string CompositeOperation::serialize() const {
+    nlohmann::json j;
+    j["type"] = "composite";
+    j["operations"] = nlohmann::json::array();
+    for (const auto& op : operations_) {
+        j["operations"].push_back(nlohmann::json::parse(op->serialize()));
+    }
+    return j.dump();
+}
+
+std::string CompositeOperation::getType() const {
+    return "composite";
+}
+
+//
+// Transform dispatch
+//
+
+namespace detail {
+
+/**
+ * Allocate a transform result, from the current TransformArena if there is one
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> makeTransformed(Args&&... args) {
+    if (std::pmr::memory_resource* arena = TransformArena::current()) {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(arena), std::forward<Args>(args)...);
+    }
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+/**
+ * What clone() returns, allocated like a transform result
+ */
+OperationPtr cloneTransformed(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            return makeTransformed<InsertOperation>(insert.getPosition(), insert.getText());
+        }
+        case OperationKind::DELETE: {
+            const auto& del = static_cast<const DeleteOperation&>(op);
+            return makeTransformed<DeleteOperation>(del.getPosition(), del.getLength(), del.getDeletedText());
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            return makeTransformed<ReplaceOperation>(replace.getPosition(), replace.getLength(), replace.getText(),
+                                                     replace.getReplacedText());
+        }
+        case OperationKind::COMPOSITE: {
+            auto result = makeTransformed<CompositeOperation>();
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                result->addOperation(cloneTransformed(*child));
+            }
+            return result;
+        }
+    }
+    return op.clone();
+}
+
+/**
+ * Pairwise transform kernels, indexed by [op kind][other kind].
+ * The kernels receive operations whose kinds have already been checked,
+ * so they downcast with static_cast and never touch RTTI or refcounts.
+ * otherFirst says whose text goes first where both put text at one point;
+ * transform() passes true, and only a composite's walk passes false.
+ */
+struct TransformKernels {
+    using Fn = OperationPtr (*)(const Operation&, const Operation&, bool otherFirst);
+    
+    // Move an insert past an insert or delete; the kernels and transformShape() share these rules
+    static void shiftInsert(size_t& position, OperationKind otherKind, size_t otherPosition, size_t otherLength,
+                            bool otherFirst = true) {
+        if (otherKind == OperationKind::INSERT) {
+            // If the other insert is before our position, or at it and goes first, shift our position right
+            if (otherPosition < position || (otherFirst && otherPosition == position)) {
+                position += otherLength;
+            }
+        } else if (otherPosition < position) {
+            // The delete affects our position
+            if (otherPosition + otherLength <= position) {
+                // Delete is entirely before our position, shift left
+                position -= otherLength;
+            } else {
+                // Delete overlaps with or contains our position
+                position = otherPosition;
+            }
+        }
+    }
+    
+    // Move a delete past an insert; false if the insert is strictly inside it, which splits the delete
+    static bool shiftDelete(size_t& position, size_t length, size_t insertPosition, size_t insertLength) {
         // If the insert is before or at our position, shift our position right
-        if (otherInsert->getPosition() <= position_) {
-            result->position_ += otherInsert->getText().length();
+        if (insertPosition <= position) {
+            position += insertLength;
         }
-        // If the insert is in the middle of our delete range, we need to increase length
-        else if (otherInsert->getPosition() < position_ + length_) {
-            // No change to position, but increase length
-            result->length_ += otherInsert->getText().length();
+        // An insert in the middle of our range is kept, as insertDelete() keeps it
+        else if (insertPosition < position + length) {
+            return false;
+        }
+        return true;
+    }
+    
+    // A delete of [position, position + length) with text kept at split, which the delete goes either side of
+    static OperationPtr splitDelete(const DeleteOperation& self, size_t split, size_t keptLength) {
+        const std::string& deleted = self.deleted_text_;
+        const bool captured = deleted.length() == self.length_;
+        const size_t head = split - self.position_;
+        auto result = makeTransformed<CompositeOperation>();
+        result->addOperation(makeTransformed<DeleteOperation>(self.position_, head, captured ? deleted.substr(0, head) : ""));
+        result->addOperation(makeTransformed<DeleteOperation>(self.position_ + keptLength, self.length_ - head,
+                                                              captured ? deleted.substr(head) : ""));
+        return result;
+    }
+    
+    static OperationPtr insertInsert(const Operation& op, const Operation& other, bool otherFirst) {
+        const auto& self = static_cast<const InsertOperation&>(op);
+        const auto& otherInsert = static_cast<const InsertOperation&>(other);
+        auto result = makeTransformed<InsertOperation>(self);
+        shiftInsert(result->position_, OperationKind::INSERT, otherInsert.position_, otherInsert.text_.length(), otherFirst);
+        return result;
+    }
+    
+    static OperationPtr insertDelete(const Operation& op, const Operation& other, bool) {
+        const auto& self = static_cast<const InsertOperation&>(op);
+        const auto& otherDelete = static_cast<const DeleteOperation&>(other);
+        auto result = makeTransformed<InsertOperation>(self);
+        shiftInsert(result->position_, OperationKind::DELETE, otherDelete.position_, otherDelete.length_);
+        return result;
+    }
+    
+    static OperationPtr deleteInsert(const Operation& op, const Operation& other, bool) {
+        const auto& self = static_cast<const DeleteOperation&>(op);
+        const auto& otherInsert = static_cast<const InsertOperation&>(other);
+        auto result = makeTransformed<DeleteOperation>(self);
+        if (!shiftDelete(result->position_, result->length_, otherInsert.position_, otherInsert.text_.length())) {
+            return splitDelete(self, otherInsert.position_, otherInsert.text_.length());
         }
-        
         return result;
     }
-    else if (auto otherDelete = std::dynamic_pointer_cast<DeleteOperation>(other)) {
-        // Transform against a delete operation
-        size_t otherStart = otherDelete->getPosition();
-        size_t otherEnd = otherStart + otherDelete->getLength();
-        size_t thisStart = position_;
-        size_t thisEnd = thisStart + length_;
+    
+    static OperationPtr deleteDelete(const Operation& op, const Operation& other, bool) {
+        const auto& self = static_cast<const DeleteOperation&>(op);
+        const auto& otherDelete = static_cast<const DeleteOperation&>(other);
+        const std::string& deletedText = self.deleted_text_;
+        
+        size_t otherStart = otherDelete.position_;
+        size_t otherEnd = otherStart + otherDelete.length_;
+        size_t thisStart = self.position_;
+        size_t thisEnd = thisStart + self.length_;
         
         // Case 1: Other delete is completely before this one
         if (otherEnd <= thisStart) {
             // Shift position left
-            return std::make_shared<DeleteOperation>(
-                thisStart - otherDelete->getLength(),
-                length_,
-                deleted_text_
+            return makeTransformed<DeleteOperation>(
+                thisStart - otherDelete.length_,
+                self.length_,
+                deletedText
             );
         }
         // Case 2: Other delete completely contains this one
         else if (otherStart <= thisStart && otherEnd >= thisEnd) {
             // This delete has been completely deleted by the other
-            return std::make_shared<DeleteOperation>(otherStart, 0, "");
+            return makeTransformed<DeleteOperation>(otherStart, 0, "");
         }
         // Case 3: Other delete overlaps the beginning of this one
         else if (otherStart <= thisStart && otherEnd < thisEnd) {
             // Adjust position and length
             size_t newPosition = otherStart;
             size_t newLength = thisEnd - otherEnd;
-            std::string newDeletedText = (deleted_text_.length() >= newLength) 
-                ? deleted_text_.substr(deleted_text_.length() - newLength) 
+            std::string newDeletedText = (deletedText.length() >= newLength) 
+                ? deletedText.substr(deletedText.length() - newLength) 
                 : "";
             
-            return std::make_shared<DeleteOperation>(newPosition, newLength, newDeletedText);
+            return makeTransformed<DeleteOperation>(newPosition, newLength, newDeletedText);
         }
         // Case 4: Other delete overlaps the end of this one
         else if (otherStart > thisStart && otherStart < thisEnd && otherEnd >= thisEnd) {
             // Keep same position, reduce length
             size_t newLength = otherStart - thisStart;
-            std::string newDeletedText = (deleted_text_.length() >= newLength) 
-                ? deleted_text_.substr(0, newLength) 
+            std::string newDeletedText = (deletedText.length() >= newLength) 
+                ? deletedText.substr(0, newLength) 
                 : "";
             
-            return std::make_shared<DeleteOperation>(thisStart, newLength, newDeletedText);
+            return makeTransformed<DeleteOperation>(thisStart, newLength, newDeletedText);
         }
         // Case 5: Other delete is in the middle of this one
         else if (otherStart > thisStart && otherEnd < thisEnd) {
             // Reduce length by the other delete length
-            size_t newLength = length_ - otherDelete->getLength();
+            size_t newLength = self.length_ - otherDelete.length_;
             std::string newDeletedText;
             
-            if (deleted_text_.length() >= length_) {
+            if (deletedText.length() >= self.length_) {
                 // Create new deleted text by removing the middle part
-                newDeletedText = deleted_text_.substr(0, otherStart - thisStart) + 
-                                deleted_text_.substr(otherEnd - thisStart);
+                newDeletedText = deletedText.substr(0, otherStart - thisStart) + 
+                                 deletedText.substr(otherEnd - thisStart);
             }
             
-            return std::make_shared<DeleteOperation>(thisStart, newLength, newDeletedText);
+            return makeTransformed<DeleteOperation>(thisStart, newLength, newDeletedText);
         }
+        
+        // No transformation needed, return a clone
+        return cloneTransformed(self);
     }
     
-    // Unknown operation type or no transformation needed, return a clone
-    return clone();
-}
-
-OperationPtr DeleteOperation::inverse() const {
-    // The inverse of a delete is an insert of the deleted text
-    if (deleted_text_.empty()) {
-        throw std::runtime_error("Cannot invert delete operation without deleted text");
+    /**
+     * How a deleted range lies against a replaced one
+     * Whatever the overlap, the replace's new text stays, as an insert's does.
+     */
+    enum class Overlap {
+        BEFORE,     // The delete ends by the replaced range's start
+        AFTER,      // The delete starts at or past its end
+        COVERS,     // The delete contains it
+        INSIDE,     // It contains the delete
+        HEAD,       // The delete takes its start
+        TAIL        // The delete takes its end
+    };
+    
+    static Overlap overlap(size_t deleteStart, size_t deleteEnd, size_t replaceStart, size_t replaceEnd) {
+        if (deleteEnd <= replaceStart) {
+            return Overlap::BEFORE;
+        }
+        if (deleteStart >= replaceEnd) {
+            return Overlap::AFTER;
+        }
+        if (deleteStart <= replaceStart && deleteEnd >= replaceEnd) {
+            return Overlap::COVERS;
+        }
+        if (replaceStart <= deleteStart && replaceEnd >= deleteEnd) {
+            return Overlap::INSIDE;
+        }
+        return deleteStart < replaceStart ? Overlap::HEAD : Overlap::TAIL;
     }
     
-    return std::make_shared<InsertOperation>(position_, deleted_text_);
-}
+    static OperationPtr insertReplace(const Operation& op, const Operation& other, bool otherFirst) {
+        const auto& self = static_cast<const InsertOperation&>(op);
+        const auto& otherReplace = static_cast<const ReplaceOperation&>(other);
+        auto result = makeTransformed<InsertOperation>(self);
+        const size_t start = otherReplace.position_;
+        const size_t end = start + otherReplace.length_;
+        
+        if (self.position_ > start || (otherFirst && self.position_ == start)) {
+            // From the range's start on the insert follows the new text, as it follows an insert at one point;
+            // past the range it moves by the range's change in length
+            result->position_ = self.position_ >= end
+                ? self.position_ - otherReplace.length_ + otherReplace.text_.length()
+                : start + otherReplace.text_.length();
+        }
+        return result;
+    }
+    
+    static OperationPtr deleteReplace(const Operation& op, const Operation& other, bool) {
+        const auto& self = static_cast<const DeleteOperation&>(op);
+        const auto& otherReplace = static_cast<const ReplaceOperation&>(other);
+        const size_t start = self.position_;
+        const size_t end = start + self.length_;
+        const size_t replaceStart = otherReplace.position_;
+        const size_t replaceEnd = replaceStart + otherReplace.length_;
+        const std::string& text = otherReplace.text_;
+        const std::string& deleted = self.deleted_text_;
+        const bool captured = deleted.length() == self.length_;
+        
+        switch (overlap(start, end, replaceStart, replaceEnd)) {
+            case Overlap::BEFORE:
+                break;
+            case Overlap::AFTER:
+                return makeTransformed<DeleteOperation>(start - otherReplace.length_ + text.length(), self.length_, deleted);
+            case Overlap::COVERS:
+                if (start == replaceStart) {
+                    return makeTransformed<DeleteOperation>(start + text.length(), end - replaceEnd,
+                                                            captured ? deleted.substr(otherReplace.length_) : "");
+                }
+                if (end == replaceEnd) {
+                    return makeTransformed<DeleteOperation>(start, replaceStart - start,
+                                                            captured ? deleted.substr(0, replaceStart - start) : "");
+                }
+                // The new text is inside the range and stays: delete either side of it
+                {
+                    auto result = makeTransformed<CompositeOperation>();
+                    result->addOperation(makeTransformed<DeleteOperation>(
+                        start, replaceStart - start, captured ? deleted.substr(0, replaceStart - start) : ""));
+                    result->addOperation(makeTransformed<DeleteOperation>(
+                        start + text.length(), end - replaceEnd, captured ? deleted.substr(replaceEnd - start) : ""));
+                    return result;
+                }
+            case Overlap::INSIDE:
+                // The replace took the whole range already
+                return makeTransformed<DeleteOperation>(replaceStart, 0, "");
+            case Overlap::HEAD:
+                return makeTransformed<DeleteOperation>(start, replaceStart - start,
+                                                        captured ? deleted.substr(0, replaceStart - start) : "");
+            case Overlap::TAIL:
+                return makeTransformed<DeleteOperation>(replaceStart + text.length(), end - replaceEnd,
+                                                        captured ? deleted.substr(replaceEnd - start) : "");
+        }
+        return cloneTransformed(self);
+    }
+    
+    static OperationPtr replaceInsert(const Operation& op, const Operation& other, bool otherFirst) {
+        const auto& self = static_cast<const ReplaceOperation&>(op);
+        const auto& otherInsert = static_cast<const InsertOperation&>(other);
+        const size_t position = otherInsert.position_;
+        
+        if (position < self.position_ || (otherFirst && position == self.position_)) {
+            auto result = makeTransformed<ReplaceOperation>(self);
+            result->position_ += otherInsert.text_.length();
+            return result;
+        }
+        if (position >= self.position_ + self.length_ && position > self.position_) {
+            return cloneTransformed(self);
+        }
+        // The insert lands in our range, or at its start behind our text, and is kept
+        return transformSplit(self, other, otherFirst);
+    }
+    
+    static OperationPtr replaceDelete(const Operation& op, const Operation& other, bool) {
+        const auto& self = static_cast<const ReplaceOperation&>(op);
+        const auto& otherDelete = static_cast<const DeleteOperation&>(other);
+        const size_t start = self.position_;
+        const size_t end = start + self.length_;
+        const size_t deleteStart = otherDelete.position_;
+        const size_t deleteEnd = deleteStart + otherDelete.length_;
+        const std::string& replaced = self.replaced_text_;
+        const bool captured = replaced.length() == self.length_;
+        
+        switch (overlap(deleteStart, deleteEnd, start, end)) {
+            case Overlap::BEFORE:
+                return makeTransformed<ReplaceOperation>(start - otherDelete.length_, self.length_, self.text_, replaced);
+            case Overlap::AFTER:
+                break;
+            case Overlap::COVERS:
+                // The range is gone; the new text stays where it was
+                return makeTransformed<ReplaceOperation>(deleteStart, 0, self.text_, "");
+            case Overlap::INSIDE:
+                return makeTransformed<ReplaceOperation>(
+                    start, self.length_ - otherDelete.length_, self.text_,
+                    captured ? replaced.substr(0, deleteStart - start) + replaced.substr(deleteEnd - start) : "");
+            case Overlap::HEAD:
+                return makeTransformed<ReplaceOperation>(deleteStart, end - deleteEnd, self.text_,
+                                                         captured ? replaced.substr(deleteEnd - start) : "");
+            case Overlap::TAIL:
+                return makeTransformed<ReplaceOperation>(start, deleteStart - start, self.text_,
+                                                         captured ? replaced.substr(0, deleteStart - start) : "");
+        }
+        return cloneTransformed(self);
+    }
+    
+    static OperationPtr replaceReplace(const Operation& op, const Operation& other, bool otherFirst) {
+        const auto& self = static_cast<const ReplaceOperation&>(op);
+        const auto& otherReplace = static_cast<const ReplaceOperation&>(other);
+        const size_t start = self.position_;
+        const size_t end = start + self.length_;
+        const size_t otherStart = otherReplace.position_;
+        const size_t otherEnd = otherStart + otherReplace.length_;
+        
+        // Disjoint ranges with their texts at different points move as a delete and an insert would
+        if (otherEnd <= start && otherStart < start) {
+            auto result = makeTransformed<ReplaceOperation>(self);
+            result->position_ = start - otherReplace.length_ + otherReplace.text_.length();
+            return result;
+        }
+        if (otherStart >= end && otherStart > start) {
+            return cloneTransformed(self);
+        }
+        // Overlapping ranges are deleted once, and both new texts are kept
+        return transformSplit(self, other, otherFirst);
+    }
+    
+    /**
+     * Transform a replace as the insert of its text followed by the delete of its range,
+     * so text the other operation puts inside the range is kept rather than taken into ours;
+     * the two are put back together into a replace where they still meet
+     */
+    static OperationPtr transformSplit(const ReplaceOperation& self, const Operation& other, bool otherFirst) {
+        const bool captured = self.replaced_text_.length() == self.length_;
+        CompositeOperation split;
+        split.addOperation(makeTransformed<InsertOperation>(self.position_, self.text_));
+        split.addOperation(makeTransformed<DeleteOperation>(self.position_ + self.text_.length(), self.length_,
+                                                            captured ? self.replaced_text_ : ""));
+        OperationPtr transformed = compositeAny(split, other, otherFirst);
+        
+        const auto& parts = static_cast<const CompositeOperation&>(*transformed).getOperations();
+        const auto& insert = static_cast<const InsertOperation&>(*parts[0]);
+        if (parts.size() == 2 && parts[1]->getKind() == OperationKind::DELETE) {
+            const auto& del = static_cast<const DeleteOperation&>(*parts[1]);
+            if (del.length_ == 0 || del.position_ == insert.position_ + insert.text_.length()) {
+                return makeTransformed<ReplaceOperation>(insert.position_, del.length_, insert.text_, del.deleted_text_);
+            }
+        }
+        return transformed;
+    }
+    
+    static OperationPtr compositeAny(const Operation& op, const Operation& other, bool otherFirst) {
+        // Walk the children, transforming each one against the other operation
+        // and advancing the other operation past the child for the next step,
+        // where the other operation keeps its side of any tie
+        const auto& self = static_cast<const CompositeOperation&>(op);
+        std::vector<OperationPtr> children;
+        OperationPtr current = cloneTransformed(other);
+        
+        for (const auto& child : self.getOperations()) {
+            addNormalized(children, transform(*child, *current, otherFirst));
+            current = transform(*current, *child, !otherFirst);
+        }
+        
+        auto result = makeTransformed<CompositeOperation>();
+        for (const auto& child : children) {
+            result->addOperation(child);
+        }
+        return result;
+    }
+    
+    /**
+     * Append a transformed child to a composite's children, flattening composites
+     * and putting text that lands where the previous child deleted ahead of that
+     * delete, as TextOperation orders them; later transforms then see the same
+     * operation whichever form it came in
+     */
+    static void addNormalized(std::vector<OperationPtr>& children, const OperationPtr& op) {
+        if (op->getKind() == OperationKind::COMPOSITE) {
+            for (const auto& child : static_cast<const CompositeOperation&>(*op).getOperations()) {
+                addNormalized(children, child);
+            }
+            return;
+        }
+        OperationPtr next = op;
+        while (!children.empty() && next->getKind() != OperationKind::DELETE) {
+            // The text the next child puts in, and where
+            const bool isInsert = next->getKind() == OperationKind::INSERT;
+            const auto& nextText = isInsert ? static_cast<const InsertOperation&>(*next).text_
+                                            : static_cast<const ReplaceOperation&>(*next).text_;
+            const size_t nextPosition = isInsert ? static_cast<const InsertOperation&>(*next).position_
+                                                 : static_cast<const ReplaceOperation&>(*next).position_;
+            const size_t nextLength = isInsert ? 0 : static_cast<const ReplaceOperation&>(*next).length_;
+            const std::string& nextReplaced = isInsert ? std::string() : static_cast<const ReplaceOperation&>(*next).replaced_text_;
+            
+            const Operation& previous = *children.back();
+            size_t position = 0;
+            size_t length = 0;
+            std::string text;
+            std::string replaced;
+            if (previous.getKind() == OperationKind::DELETE) {
+                const auto& del = static_cast<const DeleteOperation&>(previous);
+                if (del.position_ != nextPosition) {
+                    break;
+                }
+                position = del.position_;
+                length = del.length_;
+                replaced = del.deleted_text_.length() == del.length_ ? del.deleted_text_ : "";
+            } else if (previous.getKind() == OperationKind::REPLACE) {
+                const auto& replace = static_cast<const ReplaceOperation&>(previous);
+                if (replace.position_ + replace.text_.length() != nextPosition) {
+                    break;
+                }
+                position = replace.position_;
+                length = replace.length_;
+                text = replace.text_;
+                replaced = replace.replaced_text_.length() == replace.length_ ? replace.replaced_text_ : "";
+            } else {
+                break;
+            }
+            const bool captured = replaced.length() == length && nextReplaced.length() == nextLength;
+            next = makeTransformed<ReplaceOperation>(position, length + nextLength, text + nextText,
+                                                     captured ? replaced + nextReplaced : "");
+            children.pop_back();
+        }
+        children.push_back(next);
+    }
+    
+    static OperationPtr anyComposite(const Operation& op, const Operation& other, bool otherFirst) {
+        // Transform against each child of the composite in order
+        const auto& otherComposite = static_cast<const CompositeOperation&>(other);
+        OperationPtr result = cloneTransformed(op);
+        
+        for (const auto& child : otherComposite.getOperations()) {
+            result = transform(*result, *child, otherFirst);
+        }
+        
+        return result;
+    }
+    
+    static OperationPtr reshape(const Operation& op, size_t position, size_t length) {
+        switch (op.getKind()) {
+            case OperationKind::INSERT: {
+                auto result = makeTransformed<InsertOperation>(static_cast<const InsertOperation&>(op));
+                result->position_ = position;
+                return result;
+            }
+            case OperationKind::DELETE: {
+                auto result = makeTransformed<DeleteOperation>(static_cast<const DeleteOperation&>(op));
+                result->position_ = position;
+                result->length_ = length;
+                return result;
+            }
+            case OperationKind::REPLACE:
+            case OperationKind::COMPOSITE:
+                break;
+        }
+        return cloneTransformed(op);
+    }
+    
+    static constexpr Fn table[OPERATION_KIND_COUNT][OPERATION_KIND_COUNT] = {
+        //  other: INSERT        DELETE          REPLACE          COMPOSITE
+        { &insertInsert,  &insertDelete,  &insertReplace,  &anyComposite },  // op: INSERT
+        { &deleteInsert,  &deleteDelete,  &deleteReplace,  &anyComposite },  // op: DELETE
+        { &replaceInsert, &replaceDelete, &replaceReplace, &anyComposite },  // op: REPLACE
+        { &compositeAny,  &compositeAny,  &compositeAny,   &compositeAny },  // op: COMPOSITE
+    };
+    
+    static OperationPtr transform(const Operation& op, const Operation& other, bool otherFirst) {
+        auto row = static_cast<size_t>(op.getKind());
+        auto column = static_cast<size_t>(other.getKind());
+        return table[row][column](op, other, otherFirst);
+    }
+};
 
-OperationPtr DeleteOperation::clone() const {
-    return std::make_shared<DeleteOperation>(position_, length_, deleted_text_);
+} // namespace detail
+
+OperationPtr transform(const Operation& op, const Operation& other) {
+    OperationPtr result = detail::TransformKernels::transform(op, other, true);
+    // A kernel that builds a new composite, such as a delete split around an insert, starts without these
+    result->setId(op.getId());
+    result->setSource(op.getSource());
+    if (auto related = op.getRelatedOperationId()) {
+        result->setRelatedOperationId(*related);
+    }
+    return result;
 }
 
-std::string DeleteOperation::serialize() const {
-    nlohmann::json j;
-    j["type"] = "delete";
-    j["position"] = position_;
-    j["length"] = length_;
-    j["text"] = deleted_text_;
-    return j.dump();
+bool transformShape(OperationKind kind, size_t& position, size_t& length,
+                    OperationKind otherKind, size_t otherPosition, size_t otherLength) {
+    // A replace moves by both its lengths, which the shape does not carry
+    if (otherKind == OperationKind::REPLACE || otherKind == OperationKind::COMPOSITE) {
+        return false;
+    }
+    switch (kind) {
+        case OperationKind::INSERT:
+            detail::TransformKernels::shiftInsert(position, otherKind, otherPosition, otherLength);
+            return true;
+        case OperationKind::DELETE:
+            // Deletes against deletes trim the deleted text, which takes the operations
+            if (otherKind == OperationKind::DELETE) {
+                return false;
+            }
+            // An insert strictly inside splits the delete in two, which the shape cannot hold
+            return detail::TransformKernels::shiftDelete(position, length, otherPosition, otherLength);
+        case OperationKind::REPLACE:
+        case OperationKind::COMPOSITE:
+            break;
+    }
+    return false;
 }
 
-std::string DeleteOperation::getType() const {
-    return "delete";
+OperationPtr reshape(const Operation& op, size_t position, size_t length) {
+    return detail::TransformKernels::reshape(op, position, length);
 }
 
 //
 // OperationFactory Implementation
 //
 
+namespace {
+
+#ifdef COLLAB_SIMDJSON
+
+// Read a required member's value, or throw naming it
+template <typename T>
+const T& require(const std::optional<T>& value, const char* name) {
+    if (!value) {
+        throw std::runtime_error(std::string("Missing field ") + name);
+    }
+    return *value;
+}
+
+/**
+ * Read an operation's members in the order they come, in one pass
+ *
+ * serialize() writes the keys sorted, so the type comes last: every
+ * member is kept until then, and a composite's children are read as
+ * they come too.
+ */
+OperationPtr deserializeSimd(simdjson::ondemand::object object) {
+    std::string_view type;
+    std::optional<size_t> position;
+    std::optional<size_t> length;
+    std::optional<std::string_view> text;
+    std::string_view replaced;
+    std::optional<std::vector<OperationPtr>> children;
+    
+    for (simdjson::ondemand::field member : object) {
+        const std::string_view key = member.unescaped_key();
+        simdjson::ondemand::value value = member.value();
+        if (key == "type") {
+            type = value.get_string();
+        } else if (key == "position") {
+            position = uint64_t(value.get_uint64());
+        } else if (key == "length") {
+            length = uint64_t(value.get_uint64());
+        } else if (key == "text") {
+            text = value.get_string();
+        } else if (key == "replaced") {
+            replaced = value.get_string();
+        } else if (key == "operations") {
+            children.emplace();
+            for (simdjson::ondemand::object child : value.get_array()) {
+                children->push_back(deserializeSimd(child));
+            }
+        }
+    }
+    
+    if (type == "insert") {
+        return std::make_shared<InsertOperation>(require(position, "position"), std::string(require(text, "text")));
+    }
+    else if (type == "delete") {
+        return std::make_shared<DeleteOperation>(require(position, "position"), require(length, "length"),
+                                                 std::string(text.value_or(std::string_view())));
+    }
+    else if (type == "replace") {
+        return std::make_shared<ReplaceOperation>(require(position, "position"), require(length, "length"),
+                                                  std::string(require(text, "text")), std::string(replaced));
+    }
+    else if (type == "composite") {
+        auto composite = std::make_shared<CompositeOperation>();
+        for (const auto& child : require(children, "operations")) {
+            composite->addOperation(child);
+        }
+        return composite;
+    }
+    
+    throw std::runtime_error("Unknown operation type: " + std::string(type));
+}
+
+#else
+
+OperationPtr deserializeJson(const nlohmann::json& j) {
+    std::string type = j.at("type");
+    
+    if (type == "insert") {
+        size_t position = j.at("position");
+        std::string text = j.at("text");
+        return std::make_shared<InsertOperation>(position, text);
+    }
+    else if (type == "delete") {
+        size_t position = j.at("position");
+        size_t length = j.at("length");
+        std::string text = j.contains("text") ? j.at("text").get<std::string>() : "";
+        return std::make_shared<DeleteOperation>(position, length, text);
+    }
+    else if (type == "replace") {
+        size_t position = j.at("position");
+        size_t length = j.at("length");
+        std::string text = j.at("text");
+        std::string replaced = j.contains("replaced") ? j.at("replaced").get<std::string>() : "";
+        return std::make_shared<ReplaceOperation>(position, length, text, replaced);
+    }
+    else if (type == "composite") {
+        auto composite = std::make_shared<CompositeOperation>();
+        for (const auto& child : j.at("operations")) {
+            composite->addOperation(deserializeJson(child));
+        }
+        return composite;
+    }
+    
+    throw std::runtime_error("Unknown operation type: " + type);
+}
+
+#endif // COLLAB_SIMDJSON
+
+} // namespace
+
 OperationPtr OperationFactory::deserialize(const std::string& json) {
     try {
-        auto j = nlohmann::json::parse(json);
-        std::string type = j["type"];
-        
-        if (type == "insert") {
-            size_t position = j["position"];
-            std::string text = j["text"];
-            return std::make_shared<InsertOperation>(position, text);
+#ifdef COLLAB_SIMDJSON
+        // Operations come off the wire and out of logs on every thread; each keeps its own parser
+        thread_local simdjson::ondemand::parser parser;
+        thread_local std::string padded;
+        simdjson::ondemand::document document;
+        if (json.capacity() - json.size() >= simdjson::SIMDJSON_PADDING) {
+            document = parser.iterate(json.data(), json.size(), json.capacity());
+        } else {
+            padded.assign(json);
+            padded.reserve(json.size() + simdjson::SIMDJSON_PADDING);
+            document = parser.iterate(padded.data(), padded.size(), padded.capacity());
         }
-        else if (type == "delete") {
-            size_t position = j["position"];
-            size_t length = j["length"];
-            std::string text = j.contains("text") ? j["text"].get<std::string>() : "";
-            return std::make_shared<DeleteOperation>(position, length, text);
+        OperationPtr op = deserializeSimd(document.get_object());
+        if (!document.at_end()) {
+            throw simdjson::simdjson_error(simdjson::TRAILING_CONTENT);
         }
-        
-        throw std::runtime_error("Unknown operation type: " + type);
+        return op;
+#else
+        return deserializeJson(nlohmann::json::parse(json));
+#endif
     }
     catch (const std::exception& e) {
         throw std::runtime_error(std::string("Error deserializing operation: ") + e.what());
@@ -0,0 +1,188 @@
+#include "region_set.h"
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+namespace collab {
+namespace ot {
+
+RegionSet::Id RegionSet::add(size_t start, size_t end, Attributes attributes, std::string label) {
+    if (end <= start) {
+        throw std::invalid_argument("Region [" + std::to_string(start) + ", " + std::to_string(end) + ") is empty");
+    }
+    auto it = std::upper_bound(regions_.begin(), regions_.end(), start, [](size_t offset, const Region& region) {
+        return offset < region.start;
+    });
+    const size_t index = static_cast<size_t>(it - regions_.begin());
+    const Id id = nextId_++;
+    regions_.insert(it, Region{id, start, end, attributes, std::move(label)});
+    refresh(index);
+    return id;
+}
+
+bool RegionSet::remove(Id id) {
+    auto it = std::find_if(regions_.begin(), regions_.end(), [id](const Region& region) { return region.id == id; });
+    if (it == regions_.end()) {
+        return false;
+    }
+    const size_t index = static_cast<size_t>(it - regions_.begin());
+    regions_.erase(it);
+    refresh(index);
+    return true;
+}
+
+const RegionSet::Region* RegionSet::find(Id id) const {
+    auto it = std::find_if(regions_.begin(), regions_.end(), [id](const Region& region) { return region.id == id; });
+    return it != regions_.end() ? &*it : nullptr;
+}
+
+void RegionSet::clear() {
+    regions_.clear();
+    refresh(0);
+}
+
+const RegionSet::Region* RegionSet::lockedAt(size_t position, size_t removed) const {
+    // The regions starting before the edit ends; one of them reaches into it if the furthest does
+    const auto before = std::lower_bound(regions_.begin(), regions_.end(), position + removed,
+                                         [](const Region& region, size_t offset) { return region.start < offset; });
+    const size_t count = static_cast<size_t>(before - regions_.begin());
+    if (count == 0 || lockedReach_[count - 1] <= position) {
+        return nullptr;
+    }
+    return &regions_[lockedBy_[count - 1]];
+}
+
+const RegionSet::Region* RegionSet::lockedAt(const ValueOperation& op) const {
+    return std::visit([this](const auto& edit) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, InsertOp>) {
+            return lockedAt(edit.position, 0);
+        } else {
+            return lockedAt(edit.position, edit.length);
+        }
+    }, op);
+}
+
+const RegionSet::Region* RegionSet::lockedAt(const Operation& op) const {
+    switch (op.getKind()) {
+        case OperationKind::INSERT:
+            return lockedAt(static_cast<const InsertOperation&>(op).getPosition(), 0);
+        case OperationKind::DELETE: {
+            const auto& erase = static_cast<const DeleteOperation&>(op);
+            return lockedAt(erase.getPosition(), erase.getLength());
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            return lockedAt(replace.getPosition(), replace.getLength());
+        }
+        case OperationKind::COMPOSITE: {
+            // Each child is checked against the regions as the children before it left them
+            RegionSet moved = *this;
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                if (!child) {
+                    continue;
+                }
+                if (const Region* locked = moved.lockedAt(*child)) {
+                    return find(locked->id);
+                }
+                moved.transform(*child);
+            }
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+void RegionSet::transform(size_t position, size_t removed, size_t added) {
+    if (regions_.empty() || (removed == 0 && added == 0)) {
+        return;
+    }
+    const size_t end = position + removed;
+    // Inserts at an edge land outside the region: a start there moves, an end stays
+    const auto moveStart = [&](size_t offset) {
+        return offset >= end ? offset - removed + added : std::min(offset, position);
+    };
+    const auto moveEnd = [&](size_t offset) {
+        return offset > end ? offset - removed + added : std::min(offset, position);
+    };
+
+    // Regions starting at or after the edit move whole
+    const auto from = std::lower_bound(regions_.begin(), regions_.end(), position,
+                                       [](const Region& region, size_t offset) { return region.start < offset; });
+    size_t changed = static_cast<size_t>(from - regions_.begin());
+    for (auto it = from; it != regions_.end(); ++it) {
+        it->start = moveStart(it->start);
+        it->end = moveEnd(it->end);
+    }
+    // Of those starting before it, only the ones reaching past its start change, and reach_ says where they stop
+    for (size_t i = changed; i > 0 && reach_[i - 1] > position; --i) {
+        Region& region = regions_[i - 1];
+        if (region.end > position) {
+            region.end = moveEnd(region.end);
+            changed = i - 1;
+        }
+    }
+    if (changed == regions_.size()) {
+        return;
+    }
+    regions_.erase(std::remove_if(regions_.begin() + static_cast<std::ptrdiff_t>(changed), regions_.end(),
+                                  [](const Region& region) { return region.start >= region.end; }),
+                   regions_.end());
+    refresh(changed);
+}
+
+void RegionSet::transform(const ValueOperation& op) {
+    std::visit([this](const auto& edit) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(edit)>, InsertOp>) {
+            transform(edit.position, 0, edit.text.size());
+        } else {
+            transform(edit.position, edit.length, 0);
+        }
+    }, op);
+}
+
+void RegionSet::transform(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            transform(insert.getPosition(), 0, insert.getText().size());
+            break;
+        }
+        case OperationKind::DELETE: {
+            const auto& erase = static_cast<const DeleteOperation&>(op);
+            transform(erase.getPosition(), erase.getLength(), 0);
+            break;
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            transform(replace.getPosition(), replace.getLength(), replace.getText().size());
+            break;
+        }
+        case OperationKind::COMPOSITE:
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                if (child) {
+                    transform(*child);
+                }
+            }
+            break;
+    }
+}
+
+void RegionSet::refresh(size_t from) {
+    reach_.resize(regions_.size());
+    lockedReach_.resize(regions_.size());
+    lockedBy_.resize(regions_.size());
+    for (size_t i = from; i < regions_.size(); ++i) {
+        const Region& region = regions_[i];
+        reach_[i] = std::max(i > 0 ? reach_[i - 1] : 0, region.end);
+        lockedReach_[i] = i > 0 ? lockedReach_[i - 1] : 0;
+        lockedBy_[i] = i > 0 ? lockedBy_[i - 1] : 0;
+        if ((region.attributes & READ_ONLY) != 0 && region.end > lockedReach_[i]) {
+            lockedReach_[i] = region.end;
+            lockedBy_[i] = i;
+        }
+    }
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,125 @@
+// FILE: include/common/ot/region_set.h
+// Description: Annotated ranges of a document, moved through its edits, with O(log n) checks for locked ones
+
+#pragma once
+
+#include "operation.h"
+#include "value_operation.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Ranges of a document with attributes, such as the read-only sections of
+ * a template or an approved chapter, kept in step with its edits.
+ *
+ * Regions are kept sorted by start, each with the greatest end of the
+ * regions up to it, overall and among the read-only ones. Whether an edit
+ * touches a read-only region is then one binary search: the regions
+ * starting before the edit ends reach into it if the greatest end among
+ * them lies past where it starts. Regions may overlap and nest.
+ *
+ * An edit moves the regions as every client moves its cursors (see
+ * cursor_transform.h), except at their edges: text inserted where a
+ * region starts or ends lands outside it, so typing next to a locked
+ * section is allowed and does not grow the section. A region deleted to
+ * nothing is dropped.
+ *
+ * Regions are named by the ID add() returns; finding or removing one by
+ * ID scans the regions, as those are rare next to edits.
+ * Not thread-safe; the owner serializes access.
+ */
+class RegionSet {
+public:
+    using Id = uint32_t;
+    using Attributes = uint32_t;
+
+    // Edits may not touch the region
+    static constexpr Attributes READ_ONLY = 1;
+
+    struct Region {
+        Id id = 0;
+        size_t start = 0;
+        size_t end = 0;
+        Attributes attributes = 0;
+        std::string label;          // What it is, e.g. "template" or "approved"
+    };
+
+    /**
+     * Annotate a range
+     *
+     * @param start Where it starts
+     * @param end Where it ends, past start
+     * @param attributes What it is, e.g. READ_ONLY
+     * @param label A name for it
+     * @return Its ID
+     * @throws std::invalid_argument if the range is empty
+     */
+    Id add(size_t start, size_t end, Attributes attributes, std::string label = {});
+
+    // Drop a region; false if it is not there, e.g. it was deleted to nothing
+    bool remove(Id id);
+
+    // A region by ID, or nullptr
+    const Region* find(Id id) const;
+
+    // The regions, sorted by start
+    const std::vector<Region>& regions() const {
+        return regions_;
+    }
+
+    size_t size() const {
+        return regions_.size();
+    }
+
+    bool empty() const {
+        return regions_.empty();
+    }
+
+    void clear();
+
+    /**
+     * The read-only region an edit of [position, position + removed) would touch, in O(log n)
+     * An insert touches a region it falls strictly inside; a delete, one
+     * it overlaps.
+     *
+     * @param position Where the edit starts
+     * @param removed Characters it removes
+     * @return One such region, or nullptr if the edit touches none
+     */
+    const Region* lockedAt(size_t position, size_t removed) const;
+
+    // The read-only region an operation would touch, or nullptr; a composite's children are checked in order
+    const Region* lockedAt(const ValueOperation& op) const;
+    const Region* lockedAt(const Operation& op) const;
+
+    /**
+     * Move the regions through an edit of [position, position + removed) into added characters
+     *
+     * @param position Where the edit starts
+     * @param removed Characters it removed
+     * @param added Characters it inserted in their place
+     */
+    void transform(size_t position, size_t removed, size_t added);
+
+    // Move the regions through an operation; a composite's children apply in order
+    void transform(const ValueOperation& op);
+    void transform(const Operation& op);
+
+private:
+    // Recompute the greatest ends from a region on
+    void refresh(size_t from);
+
+    std::vector<Region> regions_;       // Sorted by start
+    std::vector<size_t> reach_;         // Greatest end of regions_[0..i]
+    std::vector<size_t> lockedReach_;   // Greatest end of the read-only ones among them, 0 if none
+    std::vector<size_t> lockedBy_;      // Index of the region with that end
+    Id nextId_ = 1;
+};
+
+} // namespace ot
+} // namespace collab
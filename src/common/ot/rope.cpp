@@ -0,0 +1,359 @@
+#include "rope.h"
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+namespace detail {
+
+struct RopeNode {
+    std::string chunk;
+    size_t length;      // Length of the whole subtree
+    uint32_t priority;  // Heap priority, parents always have higher priority
+    std::shared_ptr<const RopeNode> left;
+    std::shared_ptr<const RopeNode> right;
+};
+
+} // namespace detail
+
+namespace {
+
+using Node = detail::RopeNode;
+using NodePtr = std::shared_ptr<const Node>;
+
+uint32_t randomPriority() {
+    thread_local std::mt19937 rng(std::random_device{}());
+    return rng();
+}
+
+size_t lengthOf(const NodePtr& node) {
+    return node ? node->length : 0;
+}
+
+NodePtr makeNode(std::string chunk, uint32_t priority, NodePtr left, NodePtr right) {
+    size_t length = lengthOf(left) + chunk.length() + lengthOf(right);
+    return std::make_shared<const Node>(Node{std::move(chunk), length, priority, std::move(left), std::move(right)});
+}
+
+NodePtr merge(const NodePtr& a, const NodePtr& b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    
+    if (a->priority > b->priority) {
+        return makeNode(a->chunk, a->priority, a->left, merge(a->right, b));
+    }
+    return makeNode(b->chunk, b->priority, merge(a, b->left), b->right);
+}
+
+// Split into [0, position) and [position, end), cutting a chunk if needed
+std::pair<NodePtr, NodePtr> split(const NodePtr& node, size_t position) {
+    if (!node) {
+        return {nullptr, nullptr};
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    size_t chunkEnd = leftLength + node->chunk.length();
+    
+    if (position <= leftLength) {
+        auto [left, right] = split(node->left, position);
+        return {left, makeNode(node->chunk, node->priority, right, node->right)};
+    }
+    if (position >= chunkEnd) {
+        auto [left, right] = split(node->right, position - chunkEnd);
+        return {makeNode(node->chunk, node->priority, node->left, left), right};
+    }
+    
+    // Both halves keep the node's priority, which still dominates the children
+    size_t offset = position - leftLength;
+    return {makeNode(node->chunk.substr(0, offset), node->priority, node->left, nullptr),
+            makeNode(node->chunk.substr(offset), node->priority, nullptr, node->right)};
+}
+
+NodePtr build(std::string_view text) {
+    NodePtr result;
+    for (size_t offset = 0; offset < text.length(); offset += Rope::CHUNK_SIZE) {
+        result = merge(result, makeNode(std::string(text.substr(offset, Rope::CHUNK_SIZE)), randomPriority(), nullptr, nullptr));
+    }
+    return result;
+}
+
+// Insert into an existing chunk when it stays within twice the chunk size,
+// copying only the path to it; returns nullptr if no chunk has room
+NodePtr insertInPlace(const NodePtr& node, size_t position, std::string_view text) {
+    if (!node) {
+        return nullptr;
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    size_t chunkEnd = leftLength + node->chunk.length();
+    
+    if (position < leftLength || (position == leftLength && node->left)) {
+        NodePtr left = insertInPlace(node->left, position, text);
+        return left ? makeNode(node->chunk, node->priority, std::move(left), node->right) : nullptr;
+    }
+    if (position > chunkEnd) {
+        NodePtr right = insertInPlace(node->right, position - chunkEnd, text);
+        return right ? makeNode(node->chunk, node->priority, node->left, std::move(right)) : nullptr;
+    }
+    
+    if (node->chunk.length() + text.length() > 2 * Rope::CHUNK_SIZE) {
+        return nullptr;
+    }
+    
+    std::string chunk = node->chunk;
+    chunk.insert(position - leftLength, text);
+    return makeNode(std::move(chunk), node->priority, node->left, node->right);
+}
+
+// Erase inside a single chunk without emptying it; returns nullptr otherwise
+NodePtr eraseInPlace(const NodePtr& node, size_t position, size_t length) {
+    if (!node) {
+        return nullptr;
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    size_t chunkEnd = leftLength + node->chunk.length();
+    
+    if (position < leftLength) {
+        NodePtr left = eraseInPlace(node->left, position, length);
+        return left ? makeNode(node->chunk, node->priority, std::move(left), node->right) : nullptr;
+    }
+    if (position >= chunkEnd) {
+        NodePtr right = eraseInPlace(node->right, position - chunkEnd, length);
+        return right ? makeNode(node->chunk, node->priority, node->left, std::move(right)) : nullptr;
+    }
+    
+    size_t offset = position - leftLength;
+    if (offset + length > node->chunk.length() || length == node->chunk.length()) {
+        return nullptr;
+    }
+    
+    std::string chunk = node->chunk;
+    chunk.erase(offset, length);
+    return makeNode(std::move(chunk), node->priority, node->left, node->right);
+}
+
+// Replace inside a single chunk that stays within twice the chunk size and is not emptied;
+// returns nullptr otherwise
+NodePtr replaceInPlace(const NodePtr& node, size_t position, size_t length, std::string_view text) {
+    if (!node) {
+        return nullptr;
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    size_t chunkEnd = leftLength + node->chunk.length();
+    
+    if (position < leftLength) {
+        NodePtr left = replaceInPlace(node->left, position, length, text);
+        return left ? makeNode(node->chunk, node->priority, std::move(left), node->right) : nullptr;
+    }
+    if (position >= chunkEnd) {
+        NodePtr right = replaceInPlace(node->right, position - chunkEnd, length, text);
+        return right ? makeNode(node->chunk, node->priority, node->left, std::move(right)) : nullptr;
+    }
+    
+    size_t offset = position - leftLength;
+    if (offset + length > node->chunk.length() ||
+        node->chunk.length() - length + text.length() > 2 * Rope::CHUNK_SIZE) {
+        return nullptr;
+    }
+    
+    std::string chunk = node->chunk;
+    chunk.replace(offset, length, text);
+    return makeNode(std::move(chunk), node->priority, node->left, node->right);
+}
+
+void appendRange(const NodePtr& node, size_t position, size_t length, std::string& out) {
+    if (!node || length == 0) {
+        return;
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    if (position < leftLength) {
+        size_t take = std::min(length, leftLength - position);
+        appendRange(node->left, position, take, out);
+        position += take;
+        length -= take;
+    }
+    
+    size_t chunkEnd = leftLength + node->chunk.length();
+    if (length > 0 && position < chunkEnd) {
+        size_t offset = position - leftLength;
+        size_t take = std::min(length, node->chunk.length() - offset);
+        out.append(node->chunk, offset, take);
+        position += take;
+        length -= take;
+    }
+    
+    if (length > 0) {
+        appendRange(node->right, position - chunkEnd, length, out);
+    }
+}
+
+// In-order walk over [position, position + length); false once the visitor stopped
+bool visitRange(const NodePtr& node, size_t position, size_t length,
+                const std::function<bool(std::string_view)>& visitor) {
+    if (!node || length == 0) {
+        return true;
+    }
+    
+    size_t leftLength = lengthOf(node->left);
+    if (position < leftLength) {
+        size_t take = std::min(length, leftLength - position);
+        if (!visitRange(node->left, position, take, visitor)) {
+            return false;
+        }
+        position += take;
+        length -= take;
+    }
+    
+    size_t chunkEnd = leftLength + node->chunk.length();
+    if (length > 0 && position < chunkEnd) {
+        size_t offset = position - leftLength;
+        size_t take = std::min(length, node->chunk.length() - offset);
+        if (!visitor(std::string_view(node->chunk).substr(offset, take))) {
+            return false;
+        }
+        position += take;
+        length -= take;
+    }
+    
+    return length == 0 || visitRange(node->right, position - chunkEnd, length, visitor);
+}
+
+size_t countChunks(const NodePtr& node) {
+    return node ? 1 + countChunks(node->left) + countChunks(node->right) : 0;
+}
+
+} // namespace
+
+Rope::Rope(std::string_view text)
+    : root_(build(text)) {
+}
+
+bool Rope::insert(size_t position, std::string_view text) {
+    if (position > length()) {
+        return false;
+    }
+    if (text.empty()) {
+        return true;
+    }
+    
+    if (text.length() <= CHUNK_SIZE) {
+        if (NodePtr updated = insertInPlace(root_, position, text)) {
+            root_ = std::move(updated);
+            return true;
+        }
+    }
+    
+    auto [left, right] = split(root_, position);
+    root_ = merge(merge(left, build(text)), right);
+    return true;
+}
+
+void Rope::append(std::string_view text) {
+    if (text.length() <= CHUNK_SIZE) {
+        insert(length(), text);
+        return;
+    }
+    root_ = merge(root_, build(text));
+}
+
+bool Rope::erase(size_t position, size_t length) {
+    if (position + length > this->length()) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+    
+    if (NodePtr updated = eraseInPlace(root_, position, length)) {
+        root_ = std::move(updated);
+        return true;
+    }
+    
+    auto [left, rest] = split(root_, position);
+    auto [removed, right] = split(rest, length);
+    root_ = merge(left, right);
+    return true;
+}
+
+bool Rope::replace(size_t position, size_t length, std::string_view text) {
+    if (position + length > this->length()) {
+        return false;
+    }
+    if (length == 0) {
+        return insert(position, text);
+    }
+    if (text.empty()) {
+        return erase(position, length);
+    }
+    
+    if (NodePtr updated = replaceInPlace(root_, position, length, text)) {
+        root_ = std::move(updated);
+        return true;
+    }
+    
+    auto [left, rest] = split(root_, position);
+    auto [removed, right] = split(rest, length);
+    root_ = merge(merge(left, build(text)), right);
+    return true;
+}
+
+std::string Rope::substr(size_t position, size_t length) const {
+    std::string result;
+    size_t total = this->length();
+    if (position >= total) {
+        return result;
+    }
+    
+    length = std::min(length, total - position);
+    result.reserve(length);
+    appendRange(root_, position, length, result);
+    return result;
+}
+
+void Rope::forEachChunk(size_t position, size_t length, const std::function<bool(std::string_view)>& visitor) const {
+    size_t total = this->length();
+    if (position >= total) {
+        return;
+    }
+    visitRange(root_, position, std::min(length, total - position), visitor);
+}
+
+char Rope::at(size_t position) const {
+    const Node* node = root_.get();
+    while (node) {
+        size_t leftLength = lengthOf(node->left);
+        if (position < leftLength) {
+            node = node->left.get();
+        } else if (position < leftLength + node->chunk.length()) {
+            return node->chunk[position - leftLength];
+        } else {
+            position -= leftLength + node->chunk.length();
+            node = node->right.get();
+        }
+    }
+    return '\0';
+}
+
+std::string Rope::toString() const {
+    return substr(0);
+}
+
+size_t Rope::length() const {
+    return lengthOf(root_);
+}
+
+size_t Rope::chunkCount() const {
+    return countChunks(root_);
+}
+
+} // namespace ot
+} // namespace collab
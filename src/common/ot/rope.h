@@ -0,0 +1,143 @@
+// FILE: include/common/ot/rope.h
+// Description: Persistent rope text buffer with logarithmic edits
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace collab {
+namespace ot {
+
+namespace detail {
+struct RopeNode;
+}
+
+/**
+ * Text buffer stored as a balanced tree (treap) of string chunks.
+ * 
+ * Insert, erase and substring run in O(log n) plus the size of the text
+ * involved, instead of moving the whole tail of a std::string.
+ * Nodes are immutable and shared, so copying a Rope is O(1) and a copy
+ * never changes when the original is edited.
+ * A single Rope object is not thread-safe; separate copies are.
+ */
+class Rope {
+public:
+    /**
+     * Target size of a leaf chunk; edits split and extend chunks around it
+     */
+    static constexpr size_t CHUNK_SIZE = 1024;
+    
+    Rope() = default;
+    
+    /**
+     * Constructor
+     * 
+     * @param text Initial content
+     */
+    explicit Rope(std::string_view text);
+    
+    /**
+     * Insert text at a position
+     * 
+     * @param position Position to insert at
+     * @param text Text to insert
+     * @return true if successful, false if position is past the end
+     */
+    bool insert(size_t position, std::string_view text);
+    
+    /**
+     * Append text at the end, e.g. one chunk of a file being imported
+     * Costs O(log n) plus the text, and only new chunks are allocated
+     * 
+     * @param text Text to append
+     */
+    void append(std::string_view text);
+    
+    /**
+     * Erase a range of text
+     * 
+     * @param position Start of the range
+     * @param length Number of characters to erase
+     * @return true if successful, false if the range is past the end
+     */
+    bool erase(size_t position, size_t length);
+    
+    /**
+     * Replace a range of text with other text in one edit
+     * 
+     * @param position Start of the range
+     * @param length Number of characters to replace
+     * @param text Text to put in their place
+     * @return true if successful, false if the range is past the end
+     */
+    bool replace(size_t position, size_t length, std::string_view text);
+    
+    /**
+     * Copy a range of text
+     * 
+     * @param position Start of the range
+     * @param length Maximum number of characters to copy
+     * @return The text, clamped to the end of the buffer
+     */
+    std::string substr(size_t position, size_t length = std::string::npos) const;
+    
+    /**
+     * Visit a range chunk by chunk without copying it, e.g. to export it
+     * 
+     * @param position Start of the range
+     * @param length Maximum number of characters visited, clamped to the end of the buffer
+     * @param visitor Called with each piece of the range in order; returns false to stop
+     */
+    void forEachChunk(size_t position, size_t length, const std::function<bool(std::string_view)>& visitor) const;
+    
+    /**
+     * Get the character at a position
+     * 
+     * @param position Position in the buffer, must be less than length()
+     * @return The character
+     */
+    char at(size_t position) const;
+    
+    /**
+     * Copy the whole buffer into a string
+     * 
+     * @return The full content
+     */
+    std::string toString() const;
+    
+    size_t length() const;
+    
+    bool empty() const {
+        return length() == 0;
+    }
+    
+    /**
+     * Get number of leaf chunks, mostly useful for diagnostics
+     * 
+     * @return Chunk count
+     */
+    size_t chunkCount() const;
+    
+    void clear() {
+        root_.reset();
+    }
+    
+    bool operator==(const Rope& other) const {
+        return root_ == other.root_ || toString() == other.toString();
+    }
+    
+    bool operator==(std::string_view other) const {
+        return length() == other.length() && toString() == other;
+    }
+
+private:
+    std::shared_ptr<const detail::RopeNode> root_;
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,236 @@
+#include "text_diff.h"
+#include "common/util/text_scan.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+// Bytes [aBegin, aEnd) of the old text become bytes [bBegin, bEnd) of the new one
+struct Hunk {
+    size_t aBegin;
+    size_t aEnd;
+    size_t bBegin;
+    size_t bEnd;
+};
+
+/**
+ * Myers' diff in linear space: find the middle snake of the shortest edit
+ * script by searching from both ends, then recurse on either side of it
+ * (Myers 1986, section 4b). Hunks come out in order.
+ */
+class Differ {
+public:
+    Differ(std::string_view a, std::string_view b, size_t maxCost)
+        : a_(a), b_(b), maxCost_(maxCost),
+          // Edit step d explores about 2d diagonals, so the budget cannot take d past its square root
+          maxSteps_(static_cast<ptrdiff_t>(std::sqrt(static_cast<double>(maxCost))) + 1) {}
+
+    std::vector<Hunk> run() {
+        diff(0, a_.size(), 0, b_.size());
+        return std::move(hunks_);
+    }
+
+private:
+    void diff(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd) {
+        const size_t prefix = util::commonPrefixLength(a_.substr(aBegin, aEnd - aBegin), b_.substr(bBegin, bEnd - bBegin));
+        aBegin += prefix;
+        bBegin += prefix;
+        const size_t suffix = util::commonSuffixLength(a_.substr(aBegin, aEnd - aBegin), b_.substr(bBegin, bEnd - bBegin));
+        aEnd -= suffix;
+        bEnd -= suffix;
+
+        size_t aMiddle;
+        size_t bMiddle;
+        if (aBegin == aEnd || bBegin == bEnd || !bisect(aBegin, aEnd, bBegin, bEnd, aMiddle, bMiddle)) {
+            add({aBegin, aEnd, bBegin, bEnd});
+            return;
+        }
+        diff(aBegin, aMiddle, bBegin, bMiddle);
+        diff(aMiddle, aEnd, bMiddle, bEnd);
+    }
+
+    // Find where the forward and reverse searches meet; false if the budget ran out first
+    bool bisect(size_t aBegin, size_t aEnd, size_t bBegin, size_t bEnd, size_t& aMiddle, size_t& bMiddle) {
+        const char* a = a_.data() + aBegin;
+        const char* b = b_.data() + bBegin;
+        const auto n = static_cast<ptrdiff_t>(aEnd - aBegin);
+        const auto m = static_cast<ptrdiff_t>(bEnd - bBegin);
+        const ptrdiff_t maxD = std::min((n + m + 1) / 2, maxSteps_);
+        const ptrdiff_t offset = maxD;
+        const ptrdiff_t length = 2 * maxD + 2;
+
+        // Furthest x reached on each diagonal k = x - y, from the front and from the back
+        forward_.assign(static_cast<size_t>(length), -1);
+        reverse_.assign(static_cast<size_t>(length), -1);
+        forward_[offset + 1] = 0;
+        reverse_[offset + 1] = 0;
+
+        // With an odd difference in length the forward search is the one that can close the gap
+        const ptrdiff_t delta = n - m;
+        const bool front = delta % 2 != 0;
+
+        // Diagonals to skip at either edge once they run off the grid
+        ptrdiff_t k1Start = 0;
+        ptrdiff_t k1End = 0;
+        ptrdiff_t k2Start = 0;
+        ptrdiff_t k2End = 0;
+
+        for (ptrdiff_t d = 0; d < maxD; ++d) {
+            if (cost_ >= maxCost_) {
+                return false;
+            }
+
+            for (ptrdiff_t k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+                const ptrdiff_t k1Offset = offset + k1;
+                ptrdiff_t x1 = k1 == -d || (k1 != d && forward_[k1Offset - 1] < forward_[k1Offset + 1])
+                                   ? forward_[k1Offset + 1]
+                                   : forward_[k1Offset - 1] + 1;
+                ptrdiff_t y1 = x1 - k1;
+                // Most diagonals end at once; only call out for a snake that gets going
+                if (x1 < n && y1 < m && a[x1] == b[y1]) {
+                    const auto snake = static_cast<ptrdiff_t>(util::commonPrefixLength(
+                        std::string_view(a + x1, n - x1), std::string_view(b + y1, m - y1)));
+                    x1 += snake;
+                    y1 += snake;
+                }
+                ++cost_;
+                forward_[k1Offset] = x1;
+
+                if (x1 > n) {
+                    k1End += 2;
+                } else if (y1 > m) {
+                    k1Start += 2;
+                } else if (front) {
+                    const ptrdiff_t k2Offset = offset + delta - k1;
+                    if (k2Offset >= 0 && k2Offset < length && reverse_[k2Offset] != -1 && x1 >= n - reverse_[k2Offset]) {
+                        aMiddle = aBegin + static_cast<size_t>(x1);
+                        bMiddle = bBegin + static_cast<size_t>(y1);
+                        return true;
+                    }
+                }
+            }
+
+            for (ptrdiff_t k2 = -d + k2Start; k2 <= d - k2End; k2 += 2) {
+                const ptrdiff_t k2Offset = offset + k2;
+                ptrdiff_t x2 = k2 == -d || (k2 != d && reverse_[k2Offset - 1] < reverse_[k2Offset + 1])
+                                   ? reverse_[k2Offset + 1]
+                                   : reverse_[k2Offset - 1] + 1;
+                ptrdiff_t y2 = x2 - k2;
+                if (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                    const auto snake = static_cast<ptrdiff_t>(util::commonSuffixLength(
+                        std::string_view(a, n - x2), std::string_view(b, m - y2)));
+                    x2 += snake;
+                    y2 += snake;
+                }
+                ++cost_;
+                reverse_[k2Offset] = x2;
+
+                if (x2 > n) {
+                    k2End += 2;
+                } else if (y2 > m) {
+                    k2Start += 2;
+                } else if (!front) {
+                    const ptrdiff_t k1Offset = offset + delta - k2;
+                    if (k1Offset >= 0 && k1Offset < length && forward_[k1Offset] != -1) {
+                        const ptrdiff_t x1 = forward_[k1Offset];
+                        if (x1 >= n - x2) {
+                            aMiddle = aBegin + static_cast<size_t>(x1);
+                            bMiddle = bBegin + static_cast<size_t>(offset + x1 - k1Offset);
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    void add(const Hunk& hunk) {
+        if (hunk.aBegin == hunk.aEnd && hunk.bBegin == hunk.bEnd) {
+            return;
+        }
+        if (!hunks_.empty() && hunks_.back().aEnd == hunk.aBegin && hunks_.back().bEnd == hunk.bBegin) {
+            hunks_.back().aEnd = hunk.aEnd;
+            hunks_.back().bEnd = hunk.bEnd;
+            return;
+        }
+        hunks_.push_back(hunk);
+    }
+
+    std::string_view a_;
+    std::string_view b_;
+    size_t maxCost_;
+    size_t cost_ = 0;
+    ptrdiff_t maxSteps_;
+    std::vector<ptrdiff_t> forward_;
+    std::vector<ptrdiff_t> reverse_;
+    std::vector<Hunk> hunks_;
+};
+
+// Whether a boundary before offset falls inside a UTF-8 character
+bool splitsCharacter(std::string_view text, size_t offset) {
+    return offset < text.size() && (static_cast<unsigned char>(text[offset]) & 0xC0) == 0x80;
+}
+
+/**
+ * Widen hunks to whole characters
+ * Between two hunks the texts are equal, so both sides of a hunk can be
+ * moved together; a hunk that grows into the next one absorbs it.
+ */
+std::vector<Hunk> widenToCharacters(const std::vector<Hunk>& hunks, std::string_view a, std::string_view b) {
+    std::vector<Hunk> widened;
+    widened.reserve(hunks.size());
+    for (size_t i = 0; i < hunks.size(); ++i) {
+        Hunk hunk = hunks[i];
+        while (hunk.aBegin > 0 && hunk.bBegin > 0 && (splitsCharacter(a, hunk.aBegin) || splitsCharacter(b, hunk.bBegin))) {
+            --hunk.aBegin;
+            --hunk.bBegin;
+        }
+        for (;;) {
+            if (i + 1 < hunks.size() && hunks[i + 1].aBegin == hunk.aEnd) {
+                hunk.aEnd = hunks[i + 1].aEnd;
+                hunk.bEnd = hunks[i + 1].bEnd;
+                ++i;
+            } else if (splitsCharacter(a, hunk.aEnd) || splitsCharacter(b, hunk.bEnd)) {
+                ++hunk.aEnd;
+                ++hunk.bEnd;
+            } else {
+                break;
+            }
+        }
+
+        // The previous hunk ends on a character boundary, so widening stops there at the latest
+        if (!widened.empty() && widened.back().aEnd == hunk.aBegin) {
+            widened.back().aEnd = hunk.aEnd;
+            widened.back().bEnd = hunk.bEnd;
+        } else {
+            widened.push_back(hunk);
+        }
+    }
+    return widened;
+}
+
+} // namespace
+
+TextOperation diff(std::string_view before, std::string_view after, const DiffOptions& options) {
+    const std::vector<Hunk> hunks = widenToCharacters(Differ(before, after, options.maxCost).run(), before, after);
+
+    TextOperation op;
+    size_t position = 0;
+    for (const Hunk& hunk : hunks) {
+        op.retain(hunk.aBegin - position);
+        op.insert(std::string(after.substr(hunk.bBegin, hunk.bEnd - hunk.bBegin)));
+        op.remove(hunk.aEnd - hunk.aBegin);
+        position = hunk.aEnd;
+    }
+    op.retain(before.size() - position);
+    return op;
+}
+
+} // namespace ot
+} // namespace collab
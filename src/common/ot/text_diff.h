@@ -0,0 +1,41 @@
+// FILE: include/common/ot/text_diff.h
+// Description: Minimal TextOperation between two versions of a document's text
+
+#pragma once
+
+#include "text_operation.h"
+#include <cstddef>
+#include <string_view>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Limits on how hard diff() works
+ */
+struct DiffOptions {
+    // Diagonals to explore in the differing middle, around 10 ms; what is left unmatched when they run out is replaced whole
+    size_t maxCost = size_t{1} << 20;
+};
+
+/**
+ * Compute the operation that turns one text into another
+ *
+ * The common prefix and suffix are trimmed with vector compares, then
+ * the rest is diffed with Myers' linear-space algorithm, so the result
+ * inserts and deletes as few bytes as possible. Texts that differ too
+ * much for the cost budget get a replace of whatever is still unmatched
+ * instead, which is correct but not minimal.
+ *
+ * Edits never split a UTF-8 character: each is widened to the
+ * characters it touches, so inserted text is whole characters.
+ *
+ * @param before The text the operation applies to
+ * @param after The text it produces
+ * @param options Cost budget
+ * @return Retain, insert and delete components with before.size() as base length
+ */
+TextOperation diff(std::string_view before, std::string_view after, const DiffOptions& options = {});
+
+} // namespace ot
+} // namespace collab
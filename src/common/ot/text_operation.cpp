@@ -0,0 +1,383 @@
+#include "text_operation.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+/**
+ * Walks a component list, allowing components to be consumed partially
+ */
+class ComponentCursor {
+public:
+    explicit ComponentCursor(const std::vector<TextComponent>& components)
+        : components_(components) {}
+    
+    bool done() const {
+        return index_ >= components_.size();
+    }
+    
+    TextComponent::Type type() const {
+        return components_[index_].type;
+    }
+    
+    size_t remaining() const {
+        return components_[index_].count - offset_;
+    }
+    
+    std::string text(size_t count) const {
+        return components_[index_].text.substr(offset_, count);
+    }
+    
+    void advance(size_t count) {
+        offset_ += count;
+        if (offset_ >= components_[index_].count) {
+            ++index_;
+            offset_ = 0;
+        }
+    }
+
+private:
+    const std::vector<TextComponent>& components_;
+    size_t index_ = 0;
+    size_t offset_ = 0;
+};
+
+using Type = TextComponent::Type;
+
+} // namespace
+
+TextOperation& TextOperation::retain(size_t count) {
+    if (count == 0) {
+        return *this;
+    }
+    
+    baseLength_ += count;
+    targetLength_ += count;
+    
+    if (!components_.empty() && components_.back().type == Type::RETAIN) {
+        components_.back().count += count;
+    } else {
+        components_.push_back({Type::RETAIN, count, ""});
+    }
+    return *this;
+}
+
+TextOperation& TextOperation::insert(const std::string& text) {
+    if (text.empty()) {
+        return *this;
+    }
+    
+    targetLength_ += text.length();
+    
+    // Keep inserts ahead of deletes so equivalent operations compare equal
+    auto it = components_.end();
+    if (!components_.empty() && components_.back().type == Type::DELETE) {
+        --it;
+    }
+    
+    if (it != components_.begin() && std::prev(it)->type == Type::INSERT) {
+        std::prev(it)->text += text;
+        std::prev(it)->count += text.length();
+    } else {
+        components_.insert(it, {Type::INSERT, text.length(), text});
+    }
+    return *this;
+}
+
+TextOperation& TextOperation::remove(size_t count) {
+    if (count == 0) {
+        return *this;
+    }
+    
+    baseLength_ += count;
+    
+    if (!components_.empty() && components_.back().type == Type::DELETE) {
+        components_.back().count += count;
+    } else {
+        components_.push_back({Type::DELETE, count, ""});
+    }
+    return *this;
+}
+
+bool TextOperation::apply(std::string& document) const {
+    if (document.length() != baseLength_) {
+        return false;
+    }
+    
+    std::string result;
+    result.reserve(targetLength_);
+    size_t position = 0;
+    
+    for (const auto& component : components_) {
+        switch (component.type) {
+            case Type::RETAIN:
+                result.append(document, position, component.count);
+                position += component.count;
+                break;
+            case Type::INSERT:
+                result.append(component.text);
+                break;
+            case Type::DELETE:
+                position += component.count;
+                break;
+        }
+    }
+    
+    document = std::move(result);
+    return true;
+}
+
+TextOperation TextOperation::inverse(const std::string& document) const {
+    TextOperation result;
+    size_t position = 0;
+    
+    for (const auto& component : components_) {
+        switch (component.type) {
+            case Type::RETAIN:
+                result.retain(component.count);
+                position += component.count;
+                break;
+            case Type::INSERT:
+                result.remove(component.count);
+                break;
+            case Type::DELETE:
+                result.insert(document.substr(position, component.count));
+                position += component.count;
+                break;
+        }
+    }
+    
+    return result;
+}
+
+TextOperation TextOperation::compose(const TextOperation& next) const {
+    if (targetLength_ != next.baseLength_) {
+        throw std::invalid_argument("Composed operations must line up: target length of the first must equal base length of the second");
+    }
+    
+    TextOperation result;
+    ComponentCursor first(components_);
+    ComponentCursor second(next.components_);
+    
+    while (!first.done() || !second.done()) {
+        // Deletes from the first operation and inserts from the second pass straight through
+        if (!first.done() && first.type() == Type::DELETE) {
+            result.remove(first.remaining());
+            first.advance(first.remaining());
+            continue;
+        }
+        if (!second.done() && second.type() == Type::INSERT) {
+            result.insert(second.text(second.remaining()));
+            second.advance(second.remaining());
+            continue;
+        }
+        if (first.done() || second.done()) {
+            throw std::invalid_argument("Composed operations have mismatched lengths");
+        }
+        
+        size_t count = std::min(first.remaining(), second.remaining());
+        
+        if (first.type() == Type::RETAIN && second.type() == Type::RETAIN) {
+            result.retain(count);
+        } else if (first.type() == Type::INSERT && second.type() == Type::RETAIN) {
+            result.insert(first.text(count));
+        } else if (first.type() == Type::RETAIN && second.type() == Type::DELETE) {
+            result.remove(count);
+        }
+        // Insert followed by delete of the same text cancels out
+        
+        first.advance(count);
+        second.advance(count);
+    }
+    
+    return result;
+}
+
+std::pair<TextOperation, TextOperation> TextOperation::transform(const TextOperation& a, const TextOperation& b) {
+    if (a.baseLength_ != b.baseLength_) {
+        throw std::invalid_argument("Concurrent operations must have the same base length");
+    }
+    
+    TextOperation aPrime;
+    TextOperation bPrime;
+    ComponentCursor left(a.components_);
+    ComponentCursor right(b.components_);
+    
+    while (!left.done() || !right.done()) {
+        // Inserts go first, with a winning ties
+        if (!left.done() && left.type() == Type::INSERT) {
+            aPrime.insert(left.text(left.remaining()));
+            bPrime.retain(left.remaining());
+            left.advance(left.remaining());
+            continue;
+        }
+        if (!right.done() && right.type() == Type::INSERT) {
+            aPrime.retain(right.remaining());
+            bPrime.insert(right.text(right.remaining()));
+            right.advance(right.remaining());
+            continue;
+        }
+        if (left.done() || right.done()) {
+            throw std::invalid_argument("Concurrent operations have mismatched lengths");
+        }
+        
+        size_t count = std::min(left.remaining(), right.remaining());
+        
+        if (left.type() == Type::RETAIN && right.type() == Type::RETAIN) {
+            aPrime.retain(count);
+            bPrime.retain(count);
+        } else if (left.type() == Type::DELETE && right.type() == Type::RETAIN) {
+            aPrime.remove(count);
+        } else if (left.type() == Type::RETAIN && right.type() == Type::DELETE) {
+            bPrime.remove(count);
+        }
+        // Both deleted the same range, nothing left to do for either side
+        
+        left.advance(count);
+        right.advance(count);
+    }
+    
+    return {std::move(aPrime), std::move(bPrime)};
+}
+
+TextOperation TextOperation::fromOperation(const Operation& op, size_t documentLength) {
+    TextOperation result;
+    
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            if (insert.getPosition() > documentLength) {
+                throw std::invalid_argument("Insert position is past the end of the document");
+            }
+            result.retain(insert.getPosition())
+                  .insert(insert.getText())
+                  .retain(documentLength - insert.getPosition());
+            break;
+        }
+        case OperationKind::DELETE: {
+            const auto& del = static_cast<const DeleteOperation&>(op);
+            if (del.getPosition() + del.getLength() > documentLength) {
+                throw std::invalid_argument("Delete range is past the end of the document");
+            }
+            result.retain(del.getPosition())
+                  .remove(del.getLength())
+                  .retain(documentLength - del.getPosition() - del.getLength());
+            break;
+        }
+        case OperationKind::REPLACE: {
+            const auto& replace = static_cast<const ReplaceOperation&>(op);
+            if (replace.getPosition() + replace.getLength() > documentLength) {
+                throw std::invalid_argument("Replace range is past the end of the document");
+            }
+            result.retain(replace.getPosition())
+                  .remove(replace.getLength())
+                  .insert(replace.getText())
+                  .retain(documentLength - replace.getPosition() - replace.getLength());
+            break;
+        }
+        case OperationKind::COMPOSITE: {
+            result.retain(documentLength);
+            for (const auto& child : static_cast<const CompositeOperation&>(op).getOperations()) {
+                result = result.compose(fromOperation(*child, result.getTargetLength()));
+            }
+            break;
+        }
+    }
+    
+    return result;
+}
+
+OperationPtr TextOperation::toOperation() const {
+    auto composite = std::make_shared<CompositeOperation>();
+    size_t position = 0;
+    
+    for (size_t i = 0; i < components_.size(); ++i) {
+        const TextComponent& component = components_[i];
+        switch (component.type) {
+            case Type::RETAIN:
+                position += component.count;
+                break;
+            case Type::INSERT:
+                // Inserts come ahead of deletes, so text put in place of a range is one replace
+                if (i + 1 < components_.size() && components_[i + 1].type == Type::DELETE) {
+                    composite->addOperation(
+                        std::make_shared<ReplaceOperation>(position, components_[i + 1].count, component.text));
+                    ++i;
+                } else {
+                    composite->addOperation(std::make_shared<InsertOperation>(position, component.text));
+                }
+                position += component.count;
+                break;
+            case Type::DELETE:
+                composite->addOperation(std::make_shared<DeleteOperation>(position, component.count));
+                break;
+        }
+    }
+    
+    if (composite->getOperations().size() == 1) {
+        return composite->getOperations().front();
+    }
+    return composite;
+}
+
+bool TextOperation::isNoop() const {
+    return components_.empty() ||
+           (components_.size() == 1 && components_.front().type == Type::RETAIN);
+}
+
+std::string TextOperation::serialize() const {
+    nlohmann::json j = nlohmann::json::array();
+    
+    for (const auto& component : components_) {
+        switch (component.type) {
+            case Type::RETAIN:
+                j.push_back(static_cast<int64_t>(component.count));
+                break;
+            case Type::INSERT:
+                j.push_back(component.text);
+                break;
+            case Type::DELETE:
+                j.push_back(-static_cast<int64_t>(component.count));
+                break;
+        }
+    }
+    
+    return j.dump();
+}
+
+TextOperation TextOperation::deserialize(const std::string& data) {
+    TextOperation result;
+    
+    try {
+        nlohmann::json j = nlohmann::json::parse(data);
+        if (!j.is_array()) {
+            throw std::invalid_argument("Text operation must be a JSON array");
+        }
+        
+        for (const auto& item : j) {
+            if (item.is_string()) {
+                result.insert(item.get<std::string>());
+            } else if (item.is_number_integer()) {
+                int64_t count = item.get<int64_t>();
+                if (count > 0) {
+                    result.retain(static_cast<size_t>(count));
+                } else {
+                    result.remove(static_cast<size_t>(-count));
+                }
+            } else {
+                throw std::invalid_argument("Invalid text operation component");
+            }
+        }
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(std::string("Failed to deserialize text operation: ") + e.what());
+    }
+    
+    return result;
+}
+
+} // namespace ot
+} // namespace collab
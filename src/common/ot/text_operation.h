@@ -0,0 +1,187 @@
+// FILE: include/common/ot/text_operation.h
+// Description: Retain/insert/delete operation sequences with linear compose and transform
+
+#pragma once
+
+#include "operation.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace collab {
+namespace ot {
+
+/**
+ * A single component of a TextOperation
+ */
+struct TextComponent {
+    enum class Type : uint8_t {
+        RETAIN,  // Skip over count characters
+        INSERT,  // Insert text at the cursor
+        DELETE   // Remove count characters at the cursor
+    };
+    
+    Type type;
+    size_t count;      // Characters retained or deleted, text length for inserts
+    std::string text;  // Only used by inserts
+    
+    bool operator==(const TextComponent& other) const = default;
+};
+
+/**
+ * An operation over the whole document expressed as a sequence of
+ * retain, insert and delete components (the ot.js TextOperation model).
+ * 
+ * The cursor walks the document once, so applying, composing and
+ * transforming all run in linear time over the components.
+ * Adjacent components of the same type are always merged.
+ */
+class TextOperation {
+public:
+    TextOperation() = default;
+    
+    /**
+     * Skip over characters
+     * 
+     * @param count Number of characters to retain
+     * @return Reference to this operation for chaining
+     */
+    TextOperation& retain(size_t count);
+    
+    /**
+     * Insert text at the current position
+     * 
+     * @param text Text to insert
+     * @return Reference to this operation for chaining
+     */
+    TextOperation& insert(const std::string& text);
+    
+    /**
+     * Delete characters at the current position
+     * 
+     * @param count Number of characters to delete
+     * @return Reference to this operation for chaining
+     */
+    TextOperation& remove(size_t count);
+    
+    /**
+     * Apply this operation to a document in a single pass
+     * 
+     * @param document The document to modify
+     * @return true if successful, false if the base length does not match
+     */
+    bool apply(std::string& document) const;
+    
+    /**
+     * Create the inverse of this operation
+     * 
+     * @param document The document this operation applies to
+     * @return Operation that reverts this one
+     */
+    TextOperation inverse(const std::string& document) const;
+    
+    /**
+     * Compose this operation with one that follows it
+     * apply(apply(doc, a), b) == apply(doc, a.compose(b))
+     * 
+     * @param next Operation applied after this one
+     * @return The combined operation
+     * @throws std::invalid_argument if the lengths do not line up
+     */
+    TextOperation compose(const TextOperation& next) const;
+    
+    /**
+     * Transform two concurrent operations against each other
+     * apply(apply(doc, a), b') == apply(apply(doc, b), a')
+     * On equal positions, inserts from a are placed first.
+     * 
+     * @param a First operation
+     * @param b Second operation
+     * @return The pair (a', b')
+     * @throws std::invalid_argument if the base lengths differ
+     */
+    static std::pair<TextOperation, TextOperation> transform(const TextOperation& a, const TextOperation& b);
+    
+    /**
+     * Build a sequence from a polymorphic operation
+     * Composite operations are folded into one sequence.
+     * 
+     * @param op The operation to convert
+     * @param documentLength Length of the document the operation applies to
+     * @return The equivalent sequence
+     * @throws std::invalid_argument if the operation is out of range
+     */
+    static TextOperation fromOperation(const Operation& op, size_t documentLength);
+    
+    /**
+     * Convert this sequence to the polymorphic hierarchy
+     * Each insert, delete or replace becomes one child, positioned for sequential application
+     * 
+     * @return A single operation, or a CompositeOperation for multi-part edits
+     */
+    OperationPtr toOperation() const;
+    
+    /**
+     * Get the components of this operation
+     * 
+     * @return The merged component list
+     */
+    const std::vector<TextComponent>& getComponents() const {
+        return components_;
+    }
+    
+    /**
+     * Get the length of the document this operation applies to
+     * 
+     * @return Base length
+     */
+    size_t getBaseLength() const {
+        return baseLength_;
+    }
+    
+    /**
+     * Get the length of the document after applying this operation
+     * 
+     * @return Target length
+     */
+    size_t getTargetLength() const {
+        return targetLength_;
+    }
+    
+    /**
+     * Check whether this operation leaves the document unchanged
+     * 
+     * @return true if the operation only retains
+     */
+    bool isNoop() const;
+    
+    /**
+     * Serializes this operation to a JSON string
+     * Retains are positive numbers, deletes negative numbers, inserts strings
+     * 
+     * @return JSON string representation of this operation
+     */
+    std::string serialize() const;
+    
+    /**
+     * Deserialize an operation from a JSON string
+     * 
+     * @param data JSON string representation
+     * @return The deserialized operation
+     * @throws std::invalid_argument if the data is malformed
+     */
+    static TextOperation deserialize(const std::string& data);
+    
+    bool operator==(const TextOperation& other) const {
+        return components_ == other.components_;
+    }
+
+private:
+    std::vector<TextComponent> components_;
+    size_t baseLength_ = 0;
+    size_t targetLength_ = 0;
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,62 @@
+#include "transform_arena.h"
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+thread_local std::pmr::memory_resource* currentResource = nullptr;
+
+} // namespace
+
+TransformArena::TransformArena()
+    : resource_(buffer_, sizeof(buffer_)), previous_(currentResource) {
+    currentResource = &resource_;
+}
+
+TransformArena::~TransformArena() {
+    currentResource = previous_;
+}
+
+std::pmr::memory_resource* TransformArena::current() {
+    return currentResource;
+}
+
+OperationPtr TransformArena::promote(const Operation& op) const {
+    switch (op.getKind()) {
+        case OperationKind::INSERT:
+            return std::make_shared<InsertOperation>(static_cast<const InsertOperation&>(op));
+        case OperationKind::DELETE:
+            return std::make_shared<DeleteOperation>(static_cast<const DeleteOperation&>(op));
+        case OperationKind::REPLACE:
+            return std::make_shared<ReplaceOperation>(static_cast<const ReplaceOperation&>(op));
+        case OperationKind::COMPOSITE: {
+            auto result = std::make_shared<CompositeOperation>(static_cast<const CompositeOperation&>(op));
+            for (auto& child : result->operations_) {
+                child = promote(*child);
+            }
+            return result;
+        }
+    }
+    return nullptr;
+}
+
+OperationPtr transformThrough(const OperationPtr& op, std::span<const OperationPtr> history) {
+    if (!op || history.empty()) {
+        return op;
+    }
+
+    // Declared before the operations it holds, so it outlives them
+    TransformArena arena;
+    OperationPtr result = op;
+    for (const auto& entry : history) {
+        result = result->transform(entry);
+        if (!result) {
+            return nullptr;
+        }
+    }
+    return arena.promote(*result);
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,71 @@
+// FILE: include/common/ot/transform_arena.h
+// Description: Scratch memory for the operations a chain of transforms throws away
+
+#pragma once
+
+#include "operation.h"
+#include <cstddef>
+#include <memory_resource>
+#include <span>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Arena the transform kernels allocate their results from while it is alive.
+ * Transforming an operation through a stretch of history builds a new
+ * operation per step and drops the one before it, so all but the last are
+ * garbage as soon as they are made. Inside an arena each of those is a
+ * pointer bump into one buffer instead of a heap allocation, and the buffer
+ * goes back in one piece when the arena does. Text longer than the small
+ * string buffer is still copied onto the heap.
+ *
+ * Arenas are per thread and nest; the innermost one is current. Results
+ * must be promote()d before they outlive the arena, and every operation
+ * from it must be released before the arena is destroyed.
+ */
+class TransformArena {
+public:
+    TransformArena();
+    ~TransformArena();
+
+    TransformArena(const TransformArena&) = delete;
+    TransformArena& operator=(const TransformArena&) = delete;
+
+    /**
+     * Copy an operation made in this arena onto the heap
+     *
+     * @param op Operation to copy; composites are copied with their children
+     * @return A copy that may outlive the arena, keeping the ID, source and related ID
+     */
+    OperationPtr promote(const Operation& op) const;
+
+    /**
+     * The memory the transform kernels on this thread allocate from
+     *
+     * @return The current arena's memory, or nullptr outside of any arena
+     */
+    static std::pmr::memory_resource* current();
+
+private:
+    // Holds a few dozen operations, the usual distance a client is behind, before going to the heap
+    static constexpr size_t INLINE_BYTES = 4096;
+
+    alignas(std::max_align_t) std::byte buffer_[INLINE_BYTES];
+    std::pmr::monotonic_buffer_resource resource_;
+    std::pmr::memory_resource* previous_;  // The enclosing arena's, restored on destruction
+};
+
+/**
+ * Transform an operation through consecutive history entries, one step per entry
+ * The intermediate operations live in a TransformArena; only the result is
+ * allocated on the heap.
+ *
+ * @param op The operation to transform
+ * @param history Entries concurrent with op, oldest first
+ * @return The transformed operation, op itself if history is empty, or nullptr if a step fails
+ */
+OperationPtr transformThrough(const OperationPtr& op, std::span<const OperationPtr> history);
+
+} // namespace ot
+} // namespace collab
@@ -1,59 +1,56 @@
-
 #include "undo_redo_manager.h"
-#include <algorithm>
 
 namespace collab {
 namespace ot {
 
-UndoRedoManager::UndoRedoManager(size_t max_history_size) 
-    : max_history_size_(max_history_size) {}
+namespace {
+
+// The one user this manager keeps history for
+const std::string LOCAL_USER;
+
+} // namespace
+
+UndoRedoManager::UndoRedoManager(size_t max_history_size, size_t max_logged_operations,
+                                 UndoGroupingPolicy grouping)
+    : log_(max_logged_operations), history_(log_, max_history_size, grouping) {}
 
-void UndoRedoManager::addOperation(const OperationPtr& op) {
+void UndoRedoManager::addOperation(const OperationPtr& op, std::chrono::steady_clock::time_point now) {
     // Only local operations are added to the undo stack
     if (!op || op->getSource() != OperationSource::LOCAL) {
         return;
     }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Clear the redo stack when a new operation is added
-    redo_stack_.clear();
     
-    // Add the operation to the undo stack
-    undo_stack_.push_back(op->clone());
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    // Ensure we don't exceed the maximum history size
-    trimUndoStack();
+    // Operations are never modified once applied, so the log can share it
+    history_.recordOperation(log_.append(op), LOCAL_USER, now);
 }
 
 std::optional<OperationPtr> UndoRedoManager::undo(std::string& document) {
+    return undoImpl(document);
+}
+
+std::optional<OperationPtr> UndoRedoManager::redo(std::string& document) {
+    return redoImpl(document);
+}
+
+std::optional<OperationPtr> UndoRedoManager::undo(Rope& document) {
+    return undoImpl(document);
+}
+
+std::optional<OperationPtr> UndoRedoManager::redo(Rope& document) {
+    return redoImpl(document);
+}
+
+template <typename Document>
+std::optional<OperationPtr> UndoRedoManager::undoImpl(Document& document) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    // Check if there are operations to undo
-    if (undo_stack_.empty()) {
-        return std::nullopt;
-    }
-    
-    // Get the most recent operation
-    OperationPtr op = undo_stack_.back();
-    undo_stack_.pop_back();
-    
-    // Create an inverse operation
-    OperationPtr inverse_op = op->inverse();
-    
-    // Mark it as an undo operation and link to original
-    inverse_op->setSource(OperationSource::LOCAL_UNDO);
-    inverse_op->setRelatedOperationId(op->getId());
-    
-    // Apply the inverse operation to the document
-    if (!inverse_op->apply(document)) {
-        // If application fails, put the original operation back
-        undo_stack_.push_back(op);
+    OperationPtr inverse_op = applyStep(history_.undo(LOCAL_USER), document);
+    if (!inverse_op) {
         return std::nullopt;
     }
-    
-    // Add the original operation to the redo stack
-    redo_stack_.push_back(op);
+    history_.recordUndo(log_.headRevision() - 1, LOCAL_USER);
     
     // Trigger callback if set
     if (operation_callback_) {
@@ -63,34 +60,15 @@ std::optional<OperationPtr> UndoRedoManager::undo(std::string& document) {
     return inverse_op;
 }
 
-std::optional<OperationPtr> UndoRedoManager::redo(std::string& document) {
+template <typename Document>
+std::optional<OperationPtr> UndoRedoManager::redoImpl(Document& document) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    // Check if there are operations to redo
-    if (redo_stack_.empty()) {
+    OperationPtr redo_op = applyStep(history_.redo(LOCAL_USER), document);
+    if (!redo_op) {
         return std::nullopt;
     }
-    
-    // Get the most recent undone operation
-    OperationPtr op = redo_stack_.back();
-    redo_stack_.pop_back();
-    
-    // Clone the operation for redo
-    OperationPtr redo_op = op->clone();
-    
-    // Mark it as a redo operation and link to original
-    redo_op->setSource(OperationSource::LOCAL_REDO);
-    redo_op->setRelatedOperationId(op->getId());
-    
-    // Apply the redo operation to the document
-    if (!redo_op->apply(document)) {
-        // If application fails, put the original operation back
-        redo_stack_.push_back(op);
-        return std::nullopt;
-    }
-    
-    // Add the operation back to the undo stack
-    undo_stack_.push_back(op);
+    history_.recordRedo(log_.headRevision() - 1, LOCAL_USER);
     
     // Trigger callback if set
     if (operation_callback_) {
@@ -100,20 +78,40 @@ std::optional<OperationPtr> UndoRedoManager::redo(std::string& document) {
     return redo_op;
 }
 
+template <typename Document>
+OperationPtr UndoRedoManager::applyStep(const HistoryManager::Step& step, Document& document) {
+    // Bring the step up to date with the remote operations since its base
+    OperationPtr op = history_.rebase(step);
+    if (!op) {
+        return nullptr;
+    }
+    
+    // Capture deleted text so the step can itself be reverted
+    OperationPtr applied = op->applyAndCapture(document);
+    if (!applied) {
+        return nullptr;
+    }
+    log_.append(applied);
+    return op;
+}
+
 void UndoRedoManager::clear() {
     std::lock_guard<std::mutex> lock(mutex_);
-    undo_stack_.clear();
-    redo_stack_.clear();
+    history_.clearAllHistory();
+    log_.reset();
 }
 
 size_t UndoRedoManager::undoCount() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return undo_stack_.size();
+    return history_.undoCount(LOCAL_USER);
 }
 
 size_t UndoRedoManager::redoCount() const {
+    return history_.redoCount(LOCAL_USER);
+}
+
+HistoryManager::HistoryPage UndoRedoManager::entries(size_t from, size_t count) const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return redo_stack_.size();
+    return history_.entries(LOCAL_USER, from, count);
 }
 
 void UndoRedoManager::transformHistory(const OperationPtr& op) {
@@ -123,27 +121,12 @@ void UndoRedoManager::transformHistory(const OperationPtr& op) {
     
     std::lock_guard<std::mutex> lock(mutex_);
     
-    // Transform all operations in the undo stack
-    for (auto& undo_op : undo_stack_) {
-        undo_op = undo_op->transform(op);
-        
-        // If transformation failed, we must clear the history as it's no longer valid
-        if (!undo_op) {
-            clear();
-            return;
-        }
-    }
-    
-    // Transform all operations in the redo stack
-    for (auto& redo_op : redo_stack_) {
-        redo_op = redo_op->transform(op);
-        
-        // If transformation failed, we must clear the history as it's no longer valid
-        if (!redo_op) {
-            clear();
-            return;
-        }
-    }
+    // Entries catch up when they are used
+    log_.append(op);
+}
+
+void UndoRedoManager::transformHistory(const ValueOperation& op) {
+    transformHistory(toOperation(op));
 }
 
 void UndoRedoManager::setOperationCallback(std::function<void(const OperationPtr&)> callback) {
@@ -151,11 +134,20 @@ void UndoRedoManager::setOperationCallback(std::function<void(const OperationPtr
     operation_callback_ = callback;
 }
 
-void UndoRedoManager::trimUndoStack() {
-    while (undo_stack_.size() > max_history_size_) {
-        undo_stack_.pop_front();
+void UndoRedoManager::setGroupingPolicy(UndoGroupingPolicy grouping) {
+    history_.setGroupingPolicy(grouping);
+}
+
+void UndoRedoManager::setHistoryBudget(size_t max_bytes, const std::filesystem::path& spill_path) {
+    std::shared_ptr<OperationSegment> spill;
+    if (!spill_path.empty()) {
+        spill = std::make_shared<OperationSegment>(spill_path);
     }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    log_.setSpill(std::move(spill));
+    log_.setByteBudget(max_bytes);
 }
 
 } // namespace ot
-} // namespace collab
\ No newline at end of file
+} // namespace collab
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "operation.h"
-#include <deque>
+#include "operation_log.h"
+#include "value_operation.h"
+#include "common/document/history_manager.h"
+#include <chrono>
+#include <filesystem>
 #include <vector>
 #include <optional>
 #include <memory>
@@ -11,20 +15,42 @@
 namespace collab {
 namespace ot {
 
+using UndoGroupingPolicy = collab::UndoGroupingPolicy;
+
 /**
  * Class responsible for managing the history of operations for undo/redo functionality
  * Thread-safe implementation
+ * 
+ * A single-user front end to HistoryManager: every operation applied to
+ * the document, local or remote, goes into one operation log, and the
+ * history engine keeps the local user's entries as revisions into it.
+ * History is transformed lazily; only the entry being undone or redone is
+ * brought up to date, against the operations logged after it, and
+ * consecutive keystrokes are grouped into one entry as the engine's
+ * policy says.
  */
 class UndoRedoManager {
 public:
-    UndoRedoManager(size_t max_history_size = 100);
+    /**
+     * Constructor
+     * 
+     * @param max_history_size Maximum number of entries that can be undone
+     * @param max_logged_operations Operations retained in the log, local and remote;
+     *        entries older than that are dropped
+     * @param grouping Which consecutive operations are undone together
+     */
+    UndoRedoManager(size_t max_history_size = 100, size_t max_logged_operations = 4096,
+                    UndoGroupingPolicy grouping = {});
     
     /**
      * Add an operation to the history
+     * Deletes must carry their deleted text, as returned by Operation::applyAndCapture
      * 
      * @param op Operation to add to the history
+     * @param now Time the operation was made, for grouping
      */
-    void addOperation(const OperationPtr& op);
+    void addOperation(const OperationPtr& op,
+                      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
     
     /**
      * Create and execute an undo operation for the most recent local operation
@@ -42,6 +68,22 @@ public:
      */
     std::optional<OperationPtr> redo(std::string& document);
     
+    /**
+     * Undo the most recent local operation on a rope-backed document
+     * 
+     * @param document The current document state
+     * @return An optional containing the undo operation if available, empty otherwise
+     */
+    std::optional<OperationPtr> undo(Rope& document);
+    
+    /**
+     * Redo the most recently undone operation on a rope-backed document
+     * 
+     * @param document The current document state
+     * @return An optional containing the redo operation if available, empty otherwise
+     */
+    std::optional<OperationPtr> redo(Rope& document);
+    
     /**
      * Reset the history
      * Useful when loading a new document
@@ -63,13 +105,29 @@ public:
     size_t redoCount() const;
     
     /**
-     * Transform all history operations against a new operation
-     * Used when receiving remote operations to maintain consistency
+     * Describe some rows of the history, e.g. those a history view shows
+     * 
+     * @param from First row, 0 being the furthest redo or, without one, the next undo
+     * @param count Rows wanted
+     * @return The counts and the rows that exist in that range; see HistoryManager::entries()
+     */
+    HistoryManager::HistoryPage entries(size_t from, size_t count) const;
+    
+    /**
+     * Log a remote operation the history must be transformed against
+     * Entries are transformed when they are next undone or redone
      * 
      * @param op The operation to transform against
      */
     void transformHistory(const OperationPtr& op);
     
+    /**
+     * Log a remote value operation the history must be transformed against
+     * 
+     * @param op The operation to transform against
+     */
+    void transformHistory(const ValueOperation& op);
+    
     /**
      * Set a callback to be invoked when an operation is executed
      * 
@@ -77,15 +135,30 @@ public:
      */
     void setOperationCallback(std::function<void(const OperationPtr&)> callback);
     
-private:
-    // Maximum number of operations to keep in history
-    size_t max_history_size_;
+    /**
+     * Change how consecutive operations are grouped
+     * 
+     * @param grouping New grouping policy
+     */
+    void setGroupingPolicy(UndoGroupingPolicy grouping);
     
-    // Undo stack (operations that can be undone)
-    std::deque<OperationPtr> undo_stack_;
+    /**
+     * Bound the memory the log holds
+     * Operations dropped to stay in budget go to the spill file when one is
+     * given and are read back when undo reaches them
+     * 
+     * @param max_bytes Budget for the log; 0 for none
+     * @param spill_path File for operations dropped from memory; empty to discard them
+     * @throws std::runtime_error if the spill file cannot be created
+     */
+    void setHistoryBudget(size_t max_bytes, const std::filesystem::path& spill_path = {});
     
-    // Redo stack (operations that can be redone)
-    std::deque<OperationPtr> redo_stack_;
+private:
+    // Every operation applied to the document since the history was cleared
+    OperationLog log_;
+    
+    // The local user's history, over log_
+    HistoryManager history_;
     
     // Callback for when operations are executed
     std::function<void(const OperationPtr&)> operation_callback_;
@@ -93,8 +166,16 @@ private:
     // Thread safety
     mutable std::mutex mutex_;
     
-    // Helper method to remove oldest history entries when exceeding max size
-    void trimUndoStack();
+    // Shared undo/redo implementation for string and rope documents
+    template <typename Document>
+    std::optional<OperationPtr> undoImpl(Document& document);
+    
+    template <typename Document>
+    std::optional<OperationPtr> redoImpl(Document& document);
+    
+    // Transform a step to the log head and apply it; the operation applied, or nullptr
+    template <typename Document>
+    OperationPtr applyStep(const HistoryManager::Step& step, Document& document);
 };
 
 } // namespace ot
@@ -0,0 +1,190 @@
+#include "value_operation.h"
+#include <stdexcept>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+InsertOp transformInsert(const InsertOp& op, size_t otherPosition, size_t otherLength, bool otherIsInsert) {
+    InsertOp result = op;
+    
+    if (otherIsInsert) {
+        // If the other insert is before or at our position, shift our position right
+        if (otherPosition <= op.position) {
+            result.position += otherLength;
+        }
+    } else if (otherPosition < op.position) {
+        // Delete is entirely before our position: shift left, otherwise clamp to its start
+        result.position = (otherPosition + otherLength <= op.position)
+            ? op.position - otherLength
+            : otherPosition;
+    }
+    
+    return result;
+}
+
+std::optional<DeleteOp> transformDelete(const DeleteOp& op, size_t otherPosition, size_t otherLength, bool otherIsInsert) {
+    if (otherIsInsert) {
+        DeleteOp result = op;
+        if (otherPosition <= op.position) {
+            result.position += otherLength;
+        } else if (otherPosition < op.position + op.length) {
+            // Insert lands inside our range and is kept, which splits the range in two
+            return std::nullopt;
+        }
+        return result;
+    }
+    
+    size_t otherStart = otherPosition;
+    size_t otherEnd = otherStart + otherLength;
+    size_t thisStart = op.position;
+    size_t thisEnd = thisStart + op.length;
+    const std::string& text = op.deletedText;
+    
+    // Other delete is completely before this one
+    if (otherEnd <= thisStart) {
+        return DeleteOp{thisStart - otherLength, op.length, text};
+    }
+    // Other delete completely contains this one
+    if (otherStart <= thisStart && otherEnd >= thisEnd) {
+        return DeleteOp{otherStart, 0, ""};
+    }
+    // Other delete overlaps the beginning of this one
+    if (otherStart <= thisStart && otherEnd < thisEnd) {
+        size_t newLength = thisEnd - otherEnd;
+        return DeleteOp{otherStart, newLength,
+                        text.length() >= newLength ? text.substr(text.length() - newLength) : ""};
+    }
+    // Other delete overlaps the end of this one
+    if (otherStart > thisStart && otherStart < thisEnd && otherEnd >= thisEnd) {
+        size_t newLength = otherStart - thisStart;
+        return DeleteOp{thisStart, newLength,
+                        text.length() >= newLength ? text.substr(0, newLength) : ""};
+    }
+    // Other delete is in the middle of this one
+    if (otherStart > thisStart && otherEnd < thisEnd) {
+        std::string newText;
+        if (text.length() >= op.length) {
+            newText = text.substr(0, otherStart - thisStart) + text.substr(otherEnd - thisStart);
+        }
+        return DeleteOp{thisStart, op.length - otherLength, std::move(newText)};
+    }
+    
+    return op;
+}
+
+std::optional<ValueOperation> transformAgainst(const ValueOperation& op, size_t otherPosition,
+                                               size_t otherLength, bool otherIsInsert) {
+    if (const auto* insert = std::get_if<InsertOp>(&op)) {
+        return transformInsert(*insert, otherPosition, otherLength, otherIsInsert);
+    }
+    if (auto result = transformDelete(std::get<DeleteOp>(op), otherPosition, otherLength, otherIsInsert)) {
+        return std::move(*result);
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+bool applyOperation(const ValueOperation& op, std::string& document) {
+    if (const auto* insert = std::get_if<InsertOp>(&op)) {
+        if (insert->position > document.length()) {
+            return false;
+        }
+        document.insert(insert->position, insert->text);
+        return true;
+    }
+    
+    const auto& del = std::get<DeleteOp>(op);
+    if (del.position + del.length > document.length()) {
+        return false;
+    }
+    document.erase(del.position, del.length);
+    return true;
+}
+
+bool applyOperation(const ValueOperation& op, Rope& document) {
+    if (const auto* insert = std::get_if<InsertOp>(&op)) {
+        return document.insert(insert->position, insert->text);
+    }
+    
+    const auto& del = std::get<DeleteOp>(op);
+    return document.erase(del.position, del.length);
+}
+
+std::optional<ValueOperation> transform(const ValueOperation& op, const ValueOperation& other) {
+    if (const auto* insert = std::get_if<InsertOp>(&other)) {
+        return transformAgainst(op, insert->position, insert->text.length(), true);
+    }
+    const auto& del = std::get<DeleteOp>(other);
+    return transformAgainst(op, del.position, del.length, false);
+}
+
+std::optional<ValueOperation> transform(const ValueOperation& op, const Operation& other) {
+    switch (other.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(other);
+            return transformAgainst(op, insert.getPosition(), insert.getText().length(), true);
+        }
+        case OperationKind::DELETE: {
+            const auto& del = static_cast<const DeleteOperation&>(other);
+            return transformAgainst(op, del.getPosition(), del.getLength(), false);
+        }
+        case OperationKind::REPLACE: {
+            // The replace rules are the polymorphic kernels'; a delete around the new text becomes a composite
+            return toValueOperation(*ot::transform(*toOperation(op), other));
+        }
+        case OperationKind::COMPOSITE: {
+            std::optional<ValueOperation> result = op;
+            for (const auto& child : static_cast<const CompositeOperation&>(other).getOperations()) {
+                if (!result) {
+                    break;
+                }
+                result = transform(*result, *child);
+            }
+            return result;
+        }
+    }
+    return op;
+}
+
+ValueOperation inverse(const ValueOperation& op) {
+    if (const auto* insert = std::get_if<InsertOp>(&op)) {
+        return DeleteOp{insert->position, insert->text.length(), insert->text};
+    }
+    
+    const auto& del = std::get<DeleteOp>(op);
+    if (del.deletedText.empty()) {
+        throw std::runtime_error("Cannot invert delete operation without deleted text");
+    }
+    return InsertOp{del.position, del.deletedText};
+}
+
+std::optional<ValueOperation> toValueOperation(const Operation& op) {
+    switch (op.getKind()) {
+        case OperationKind::INSERT: {
+            const auto& insert = static_cast<const InsertOperation&>(op);
+            return InsertOp{insert.getPosition(), insert.getText()};
+        }
+        case OperationKind::DELETE: {
+            const auto& del = static_cast<const DeleteOperation&>(op);
+            return DeleteOp{del.getPosition(), del.getLength(), del.getDeletedText()};
+        }
+        case OperationKind::REPLACE:
+        case OperationKind::COMPOSITE:
+            break;
+    }
+    return std::nullopt;
+}
+
+OperationPtr toOperation(const ValueOperation& op) {
+    if (const auto* insert = std::get_if<InsertOp>(&op)) {
+        return std::make_shared<InsertOperation>(insert->position, insert->text);
+    }
+    const auto& del = std::get<DeleteOp>(op);
+    return std::make_shared<DeleteOperation>(del.position, del.length, del.deletedText);
+}
+
+} // namespace ot
+} // namespace collab
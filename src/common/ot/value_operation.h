@@ -0,0 +1,107 @@
+// FILE: include/common/ot/value_operation.h
+// Description: Allocation-free value representation of insert/delete operations
+
+#pragma once
+
+#include "operation.h"
+#include <string>
+#include <variant>
+#include <optional>
+#include <cstdint>
+
+namespace collab {
+namespace ot {
+
+/**
+ * Value-type insert operation
+ * The text relies on std::string's small-string storage, so single
+ * keystrokes never touch the heap.
+ */
+struct InsertOp {
+    size_t position = 0;
+    std::string text;
+};
+
+/**
+ * Value-type delete operation
+ * deletedText is optional and only needed when the operation will be inverted.
+ */
+struct DeleteOp {
+    size_t position = 0;
+    size_t length = 0;
+    std::string deletedText = {};   // For inverting; empty until known
+};
+
+/**
+ * Compact operation value used on hot paths instead of OperationPtr.
+ * Replace and composite operations are not representable; use the
+ * polymorphic hierarchy for those.
+ */
+using ValueOperation = std::variant<InsertOp, DeleteOp>;
+
+/**
+ * Apply a value operation to a document
+ * 
+ * @param op The operation to apply
+ * @param document The document to modify
+ * @return true if successful, false if the operation is out of range
+ */
+bool applyOperation(const ValueOperation& op, std::string& document);
+
+/**
+ * Apply a value operation to a rope-backed document
+ * 
+ * @param op The operation to apply
+ * @param document The document to modify
+ * @return true if successful, false if the operation is out of range
+ */
+bool applyOperation(const ValueOperation& op, Rope& document);
+
+/**
+ * Transform a value operation against another value operation
+ * Follows exactly the same rules as the polymorphic transform()
+ * 
+ * @param op The operation to transform
+ * @param other The operation to transform against
+ * @return The transformed operation; std::nullopt for a delete with an insert strictly
+ *         inside it, which keeps the inserted text and splits the delete in two
+ */
+std::optional<ValueOperation> transform(const ValueOperation& op, const ValueOperation& other);
+
+/**
+ * Transform a value operation against a polymorphic operation
+ * Reads the other operation in place, so history entries are not copied
+ * 
+ * @param op The operation to transform
+ * @param other The operation to transform against
+ * @return The transformed operation; std::nullopt if it is no longer a single insert or delete
+ */
+std::optional<ValueOperation> transform(const ValueOperation& op, const Operation& other);
+
+/**
+ * Create the inverse of a value operation
+ * 
+ * @param op The operation to invert
+ * @return The inverse operation
+ * @throws std::runtime_error if a delete has no captured text
+ */
+ValueOperation inverse(const ValueOperation& op);
+
+/**
+ * Convert a polymorphic operation to a value operation
+ * 
+ * @param op The operation to convert
+ * @return The value operation, or std::nullopt for replace and composite operations
+ */
+std::optional<ValueOperation> toValueOperation(const Operation& op);
+
+/**
+ * Convert a value operation to the polymorphic hierarchy
+ * 
+ * @param op The operation to convert
+ * @return A newly allocated operation
+ */
+OperationPtr toOperation(const ValueOperation& op);
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,505 @@
+#include "write_ahead_log.h"
+#include "common/util/compression.h"
+#include "common/util/thread_profiler.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace collab {
+namespace ot {
+
+namespace {
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x31534543; // "CES1"
+constexpr uint32_t WAL_MAGIC = 0x32574543;      // "CEW2"
+constexpr size_t SNAPSHOT_PIECE = 1024 * 1024;  // Text copied out of the rope at a time
+constexpr size_t DEFLATE_FROM = 256;            // Smaller frames are written as they are
+constexpr uint32_t FRAME_DEFLATED = 1;
+
+// Written as is; the files are read back by the machine that wrote them
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t crc;           // Of the text
+    int64_t revision;
+    uint64_t length;
+};
+
+struct WalHeader {
+    uint32_t magic;
+    uint32_t reserved;
+};
+
+// One commit's records; the checksum covers the header fields after it and the payload
+struct FrameHeader {
+    uint32_t length;        // Bytes of payload after the header
+    uint32_t crc;
+    int64_t lastRevision;   // Revision of the last record
+    uint32_t rawLength;     // Bytes of records, once inflated
+    uint32_t flags;         // FRAME_DEFLATED if the payload is deflated
+};
+
+struct RecordHeader {
+    uint32_t length;        // Bytes of serialized operation after the header
+    uint32_t crc;           // Of the revision and the serialized operation
+    int64_t revision;
+};
+
+uint32_t recordCrc(int64_t revision, const std::string& payload) {
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(&revision), sizeof(revision));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(payload.data()), static_cast<uInt>(payload.size()));
+    return static_cast<uint32_t>(crc);
+}
+
+uint32_t frameCrc(const FrameHeader& header, const std::string& payload) {
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(&header.lastRevision),
+                      sizeof(header) - offsetof(FrameHeader, lastRevision));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(payload.data()), static_cast<uInt>(payload.size()));
+    return static_cast<uint32_t>(crc);
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t got = ::read(fd, data, size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool syncData(int fd) {
+#ifdef __linux__
+    return ::fdatasync(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+// Make a rename in the directory durable
+void syncDirectory(const std::filesystem::path& directory) {
+    const int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::runtime_error fileError(const std::string& what, const std::filesystem::path& path) {
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+GroupCommit::GroupCommit(std::chrono::milliseconds interval)
+    : interval_(interval) {
+    thread_ = std::thread([this] { run(); });
+}
+
+GroupCommit::~GroupCommit() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void GroupCommit::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushRequested_ = true;
+    wake_.notify_all();
+    committed_.wait(lock, [this] { return dirty_.empty() && !committing_; });
+}
+
+void GroupCommit::schedule(WriteAheadLog* log) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dirty_.push_back(log);
+    wake_.notify_all();
+}
+
+void GroupCommit::forget(WriteAheadLog* log) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    dirty_.erase(std::remove(dirty_.begin(), dirty_.end(), log), dirty_.end());
+    committed_.wait(lock, [this] { return !committing_; });
+}
+
+void GroupCommit::run() {
+    util::nameCurrentThread("persistence", 0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || !dirty_.empty(); });
+        if (dirty_.empty()) {
+            break;
+        }
+
+        // Let appends gather for one interval, unless someone is waiting
+        wake_.wait_for(lock, interval_, [this] { return stopping_ || flushRequested_; });
+        std::vector<WriteAheadLog*> batch;
+        batch.swap(dirty_);
+        flushRequested_ = false;
+        committing_ = true;
+        lock.unlock();
+
+        for (WriteAheadLog* log : batch) {
+            log->commit();
+        }
+
+        lock.lock();
+        committing_ = false;
+        committed_.notify_all();
+    }
+}
+
+WriteAheadLog::WriteAheadLog(const std::filesystem::path& directory, const std::string& documentId,
+                             GroupCommit& commit, uint64_t snapshotBytes)
+    : commit_(commit),
+      snapshotBytes_(snapshotBytes) {
+    if (documentId.empty() || documentId == "." || documentId == ".." ||
+        documentId.find_first_of("/\\") != std::string::npos) {
+        throw std::invalid_argument("Document ID is not a file name: " + documentId);
+    }
+    std::filesystem::create_directories(directory);
+    walPath_ = directory / (documentId + ".wal");
+    snapshotPath_ = directory / (documentId + ".snapshot");
+    recover();
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    commit_.forget(this);
+    commit();
+    ::close(fd_);
+}
+
+void WriteAheadLog::append(int64_t revision, const Operation& op, DurableCallback onDurable) {
+    if (revision != revision_ + 1) {
+        throw std::invalid_argument("Logged revision " + std::to_string(revision) +
+                                    " does not follow " + std::to_string(revision_));
+    }
+    if (failed_) {
+        throw std::runtime_error("Write-ahead log " + walPath_.string() + " failed");
+    }
+
+    const std::string payload = op.serialize();
+    const RecordHeader header{static_cast<uint32_t>(payload.size()), recordCrc(revision, payload), revision};
+    Pending pending;
+    pending.revision = revision;
+    pending.record.reserve(sizeof(header) + payload.size());
+    pending.record.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    pending.record.append(payload);
+    pending.onDurable = std::move(onDurable);
+
+    revision_ = revision;
+    walBytes_ += pending.record.size();
+    enqueue(std::move(pending));
+}
+
+void WriteAheadLog::snapshotAsync(Rope content, int64_t revision, DurableCallback onDone) {
+    if (revision != revision_) {
+        throw std::invalid_argument("Snapshot revision " + std::to_string(revision) +
+                                    " is not the logged revision " + std::to_string(revision_));
+    }
+    Pending pending;
+    pending.revision = revision;
+    pending.onDurable = std::move(onDone);
+    pending.snapshot = std::move(content);
+    enqueue(std::move(pending));
+}
+
+void WriteAheadLog::enqueue(Pending pending) {
+    queuedBytes_ += pending.record.size();
+    queue_.push(std::move(pending));
+    // A commit clears the flag before draining, so it either takes this item or the next commit does
+    if (!scheduled_.exchange(true)) {
+        commit_.schedule(this);
+    }
+}
+
+WriteAheadLog::Stats WriteAheadLog::getStats() const {
+    Stats stats;
+    stats.revision = revision_.load();
+    stats.durableRevision = durableRevision_.load();
+    stats.queuedBytes = queuedBytes_.load();
+    stats.frames = frames_.load();
+    stats.rawBytes = rawBytes_.load();
+    stats.writtenBytes = writtenBytes_.load();
+    return stats;
+}
+
+void WriteAheadLog::snapshot(const Rope& content, int64_t revision) {
+    if (revision != revision_) {
+        throw std::invalid_argument("Snapshot revision " + std::to_string(revision) +
+                                    " is not the logged revision " + std::to_string(revision_));
+    }
+    // Settle the operations still queued; their callbacks want to hear about the disk
+    commit();
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    writeSnapshot(content, revision);
+}
+
+void WriteAheadLog::writeSnapshot(const Rope& content, int64_t revision) {
+    std::filesystem::path temporary = snapshotPath_;
+    temporary += ".tmp";
+    const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw fileError("Failed to create snapshot", temporary);
+    }
+
+    SnapshotHeader header{SNAPSHOT_MAGIC, 0, revision, static_cast<uint64_t>(content.length())};
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (size_t position = 0; position < content.length(); position += SNAPSHOT_PIECE) {
+        const std::string piece = content.substr(position, SNAPSHOT_PIECE);
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(piece.data()), static_cast<uInt>(piece.size()));
+    }
+    header.crc = static_cast<uint32_t>(crc);
+
+    bool ok = writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t position = 0; ok && position < content.length(); position += SNAPSHOT_PIECE) {
+        const std::string piece = content.substr(position, SNAPSHOT_PIECE);
+        ok = writeAll(fd, piece.data(), piece.size());
+    }
+    ok = ok && syncData(fd);
+    ::close(fd);
+    if (!ok) {
+        throw fileError("Failed to write snapshot", temporary);
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, snapshotPath_, ec);
+    if (ec) {
+        throw std::runtime_error("Failed to replace snapshot " + snapshotPath_.string() + ": " + ec.message());
+    }
+    syncDirectory(snapshotPath_.parent_path());
+
+    // The snapshot holds every logged operation now; a crash before this leaves records it skips
+    if (::ftruncate(fd_, sizeof(WalHeader)) != 0 || !syncData(fd_)) {
+        throw fileError("Failed to truncate write-ahead log", walPath_);
+    }
+    walBytes_ = 0;
+}
+
+void WriteAheadLog::recover() {
+    // The snapshot, if there is one, is whole: it only ever appears by rename
+    const int snapshotFd = ::open(snapshotPath_.c_str(), O_RDONLY);
+    if (snapshotFd >= 0) {
+        SnapshotHeader header{};
+        Rope content;
+        bool ok = readAll(snapshotFd, reinterpret_cast<char*>(&header), sizeof(header)) &&
+                  header.magic == SNAPSHOT_MAGIC;
+        // Streamed into the rope a piece at a time, so the text is only held once
+        uLong crc = crc32(0L, Z_NULL, 0);
+        std::string piece;
+        for (uint64_t left = header.length; ok && left > 0; left -= piece.size()) {
+            piece.resize(static_cast<size_t>(std::min<uint64_t>(left, SNAPSHOT_PIECE)));
+            ok = readAll(snapshotFd, piece.data(), piece.size());
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(piece.data()), static_cast<uInt>(piece.size()));
+            content.append(piece);
+        }
+        ok = ok && static_cast<uint32_t>(crc) == header.crc;
+        ::close(snapshotFd);
+        if (!ok) {
+            throw std::runtime_error("Damaged snapshot " + snapshotPath_.string());
+        }
+        recovery_.content = std::move(content);
+        recovery_.revision = header.revision;
+    } else if (errno != ENOENT) {
+        throw fileError("Failed to open snapshot", snapshotPath_);
+    }
+
+    fd_ = ::open(walPath_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        throw fileError("Failed to open write-ahead log", walPath_);
+    }
+
+    // Replay the frames after the snapshot; the first bad one ends the log
+    off_t intact = 0;
+    uint64_t rawBytes = 0;
+    WalHeader walHeader;
+    if (readAll(fd_, reinterpret_cast<char*>(&walHeader), sizeof(walHeader)) && walHeader.magic == WAL_MAGIC) {
+        intact = sizeof(walHeader);
+        FrameHeader frame;
+        std::string records;
+        while (readAll(fd_, reinterpret_cast<char*>(&frame), sizeof(frame))) {
+            std::string payload(frame.length, '\0');
+            if (!readAll(fd_, payload.data(), payload.size()) || frameCrc(frame, payload) != frame.crc) {
+                break;
+            }
+            try {
+                if (frame.flags & FRAME_DEFLATED) {
+                    util::inflateDecompress(payload, frame.rawLength, records);
+                } else {
+                    records.swap(payload);
+                }
+            } catch (const std::exception&) {
+                break;
+            }
+
+            // A frame is applied whole or not at all; the copy shares the rope's chunks
+            Rope content = recovery_.content;
+            int64_t revision = recovery_.revision;
+            size_t replayed = 0;
+            bool whole = true;
+            for (size_t offset = 0; whole && offset < records.size();) {
+                RecordHeader header;
+                if (records.size() - offset < sizeof(header)) {
+                    whole = false;
+                    break;
+                }
+                std::memcpy(&header, records.data() + offset, sizeof(header));
+                offset += sizeof(header);
+                if (header.length > records.size() - offset) {
+                    whole = false;
+                    break;
+                }
+                const std::string record = records.substr(offset, header.length);
+                offset += header.length;
+                if (recordCrc(header.revision, record) != header.crc) {
+                    whole = false;
+                } else if (header.revision > revision) {
+                    OperationPtr op;
+                    try {
+                        op = OperationFactory::deserialize(record);
+                    } catch (const std::exception&) {
+                        op = nullptr;
+                    }
+                    whole = header.revision == revision + 1 && op && op->apply(content);
+                    revision = header.revision;
+                    ++replayed;
+                }
+            }
+            if (!whole) {
+                break;
+            }
+            recovery_.content = std::move(content);
+            recovery_.revision = revision;
+            recovery_.replayed += replayed;
+            intact += static_cast<off_t>(sizeof(frame) + frame.length);
+            rawBytes += records.size();
+        }
+    }
+
+    // Cut off whatever a crash left behind, or start the file
+    bool ok;
+    if (intact == 0) {
+        WalHeader header{WAL_MAGIC, 0};
+        ok = ::ftruncate(fd_, 0) == 0 && writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header));
+        intact = sizeof(header);
+    } else {
+        ok = ::lseek(fd_, 0, SEEK_END) == intact || ::ftruncate(fd_, intact) == 0;
+    }
+    if (!ok || !syncData(fd_)) {
+        ::close(fd_);
+        throw fileError("Failed to recover write-ahead log", walPath_);
+    }
+
+    revision_ = recovery_.revision;
+    durableRevision_ = recovery_.revision;
+    walBytes_ = rawBytes;
+}
+
+void WriteAheadLog::commit() {
+    // Only one thread may drain the queue
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    scheduled_ = false;
+
+    std::string records;
+    std::vector<DurableCallback> callbacks;
+    int64_t lastRevision = durableRevision_;
+    const auto settle = [&] {
+        const bool ok = !failed_ && writeFrame(records, lastRevision);
+        if (!ok) {
+            failed_ = true;
+        }
+        for (const auto& callback : callbacks) {
+            callback(ok);
+        }
+        records.clear();
+        callbacks.clear();
+    };
+
+    while (auto pending = queue_.tryPop()) {
+        queuedBytes_ -= pending->record.size();
+        if (pending->snapshot) {
+            // The operations before it go to disk first
+            settle();
+            bool ok = !failed_;
+            if (ok) {
+                try {
+                    writeSnapshot(*pending->snapshot, pending->revision);
+                } catch (const std::exception&) {
+                    ok = false;
+                }
+            }
+            if (pending->onDurable) {
+                pending->onDurable(ok);
+            }
+            continue;
+        }
+        records += pending->record;
+        lastRevision = pending->revision;
+        if (pending->onDurable) {
+            callbacks.push_back(std::move(pending->onDurable));
+        }
+    }
+    settle();
+}
+
+bool WriteAheadLog::writeFrame(const std::string& records, int64_t lastRevision) {
+    if (records.empty()) {
+        return true;
+    }
+
+    // Deflate at the fastest level: the commit thread has a whole interval of edits to keep up with
+    std::string deflated;
+    if (records.size() >= DEFLATE_FROM) {
+        try {
+            deflated = util::deflateCompress(records, {}, Z_BEST_SPEED);
+        } catch (const std::exception&) {
+            deflated.clear();
+        }
+    }
+    const bool compressed = !deflated.empty() && deflated.size() < records.size();
+    const std::string& payload = compressed ? deflated : records;
+
+    FrameHeader header{static_cast<uint32_t>(payload.size()), 0, lastRevision,
+                       static_cast<uint32_t>(records.size()), compressed ? FRAME_DEFLATED : 0};
+    header.crc = frameCrc(header, payload);
+    if (!writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header)) ||
+        !writeAll(fd_, payload.data(), payload.size()) || !syncData(fd_)) {
+        return false;
+    }
+
+    durableRevision_ = lastRevision;
+    ++frames_;
+    rawBytes_ += records.size();
+    writtenBytes_ += sizeof(header) + payload.size();
+    return true;
+}
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,262 @@
+// FILE: include/common/ot/write_ahead_log.h
+// Description: Durable per-document log of operations, written off the edit path in group commits, with snapshot compaction
+
+#pragma once
+
+#include "operation.h"
+#include "rope.h"
+#include "common/util/mpsc_queue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace collab {
+namespace ot {
+
+class WriteAheadLog;
+
+/**
+ * Writes and syncs the records logs have queued, every interval, on one thread
+ *
+ * An edit is only queued in memory when it is appended; the next commit
+ * packs each log's queue into one frame, compresses it, writes it with
+ * one sequential write and syncs the file once, then tells every edit in
+ * the frame that it is durable. However many edits and documents a commit
+ * covers, each log costs one write and one sync per interval, and none of
+ * it runs on the threads applying the edits.
+ */
+class GroupCommit {
+public:
+    /**
+     * Start the commit thread
+     *
+     * @param interval How long appends gather before they are committed
+     */
+    explicit GroupCommit(std::chrono::milliseconds interval = std::chrono::milliseconds(5));
+
+    // Commits whatever is still buffered, then stops the thread
+    ~GroupCommit();
+
+    GroupCommit(const GroupCommit&) = delete;
+    GroupCommit& operator=(const GroupCommit&) = delete;
+
+    /**
+     * Commit everything buffered now and wait until it is durable
+     */
+    void flush();
+
+    std::chrono::milliseconds interval() const {
+        return interval_;
+    }
+
+private:
+    friend class WriteAheadLog;
+
+    // The log has records to commit
+    void schedule(WriteAheadLog* log);
+
+    // The log is going away; waits out a commit that may be writing it
+    void forget(WriteAheadLog* log);
+
+    void run();
+
+    const std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable wake_;       // New work, a flush or stopping
+    std::condition_variable committed_;  // A commit finished
+    std::vector<WriteAheadLog*> dirty_;  // Logs with buffered records, each once
+    bool committing_ = false;
+    bool flushRequested_ = false;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+/**
+ * Durable history of one document: a snapshot of its text at some
+ * revision, and an append-only file of the operations since
+ *
+ * append() encodes the operation applied at the next revision and pushes
+ * it onto a lock-free queue; it takes no lock and does no I/O, so it can
+ * run on the thread applying edits. The GroupCommit drains the queue,
+ * writes and syncs the batch as one checksummed frame, deflated when that
+ * makes it smaller, then publishes durableRevision() and calls the
+ * callbacks, so a server can hold the ack to a client until the edit is
+ * on disk. getStats() shows how far the disk lags behind the edits.
+ *
+ * snapshot() writes the whole text at the last revision to a new snapshot
+ * file, renamed into place, then empties the operation file; call it when
+ * wantsSnapshot() says the operations have outgrown the threshold, or
+ * queue it with snapshotAsync() to have the commit thread write it.
+ * Opening a log recovers the document from the snapshot and the
+ * operations after it; a frame cut short or damaged by a crash ends the
+ * log there.
+ *
+ * The files are <documentId>.snapshot and <documentId>.wal in the
+ * directory. append(), snapshot() and snapshotAsync() are serialized by
+ * the owner, e.g. the document's executor shard; the commit thread only
+ * touches what was queued.
+ */
+class WriteAheadLog {
+public:
+    /**
+     * Called once the operation is durable, with false if it could not be written
+     */
+    using DurableCallback = std::function<void(bool)>;
+
+    /**
+     * The document as the files left it
+     */
+    struct Recovery {
+        Rope content;
+        int64_t revision = 0;   // Revision of content
+        size_t replayed = 0;    // Operations applied on top of the snapshot
+    };
+
+    /**
+     * How far the disk is behind the edits, and what the commits wrote
+     */
+    struct Stats {
+        int64_t revision = 0;         // Last revision appended
+        int64_t durableRevision = 0;  // Last revision on disk
+        uint64_t queuedBytes = 0;     // Encoded operations not written yet
+        uint64_t frames = 0;          // Commits that wrote operations
+        uint64_t rawBytes = 0;        // Encoded operations they wrote
+        uint64_t writtenBytes = 0;    // Bytes they took on disk, after compression
+    };
+
+    /**
+     * Open a document's log, recovering it if it exists
+     *
+     * @param directory Where the document's files are kept; created if missing
+     * @param documentId The document; must be usable as a file name
+     * @param commit The group commit that writes this log
+     * @param snapshotBytes Operation file size from which wantsSnapshot() is true
+     * @throws std::invalid_argument if documentId is not a file name
+     * @throws std::runtime_error if the files cannot be opened or the snapshot is damaged
+     */
+    WriteAheadLog(const std::filesystem::path& directory, const std::string& documentId,
+                  GroupCommit& commit, uint64_t snapshotBytes = 4 * 1024 * 1024);
+
+    // Commits what is still buffered
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /**
+     * What opening the log recovered
+     */
+    const Recovery& recovery() const {
+        return recovery_;
+    }
+
+    /**
+     * Log the operation applied at the revision after the last one
+     *
+     * @param revision Revision the operation produced; must be revision() + 1
+     * @param op The operation
+     * @param onDurable Called from the commit thread once the operation is on disk
+     * @throws std::invalid_argument if the revision does not follow the last one
+     * @throws std::runtime_error if an earlier commit of this log failed
+     */
+    void append(int64_t revision, const Operation& op, DurableCallback onDurable = {});
+
+    /**
+     * Queue a snapshot for the commit thread, to be written after the operations before it
+     *
+     * @param content The document at revision(); a Rope copy shares its chunks
+     * @param revision Revision of content; must be revision()
+     * @param onDone Called from the commit thread once the snapshot is in place, or failed
+     * @throws std::invalid_argument if the revision is not the last one logged
+     */
+    void snapshotAsync(Rope content, int64_t revision, DurableCallback onDone = {});
+
+    /**
+     * Replace the snapshot with the document at revision() and empty the operation file
+     *
+     * @param content The document at revision()
+     * @param revision Revision of content; must be revision()
+     * @throws std::invalid_argument if the revision is not the last one logged
+     * @throws std::runtime_error if the snapshot cannot be written
+     */
+    void snapshot(const Rope& content, int64_t revision);
+
+    // True once the operation file has grown past the snapshot threshold
+    bool wantsSnapshot() const {
+        return walBytes_.load() >= snapshotBytes_;
+    }
+
+    // Revision of the last operation logged, or of the snapshot
+    int64_t revision() const {
+        return revision_.load();
+    }
+
+    // Revision of the last operation known to be on disk
+    int64_t durableRevision() const {
+        return durableRevision_.load();
+    }
+
+    Stats getStats() const;
+
+    // Bytes of operations since the snapshot, buffered ones included
+    uint64_t walBytes() const {
+        return walBytes_.load();
+    }
+
+private:
+    friend class GroupCommit;
+
+    // Rebuild the document from the files and cut off a torn tail
+    void recover();
+
+    // An operation or a snapshot waiting for the commit thread
+    struct Pending {
+        int64_t revision = 0;
+        std::string record;            // Record header and serialized operation
+        DurableCallback onDurable;
+        std::optional<Rope> snapshot;  // Set for a snapshot of the document at revision
+    };
+
+    // Queue an item and have the group commit take it
+    void enqueue(Pending pending);
+
+    // Write and sync the queued records, then run their callbacks
+    void commit();
+
+    // Write, sync and publish the records as one frame (fileMutex_ must be held)
+    bool writeFrame(const std::string& records, int64_t lastRevision);
+
+    // Replace the snapshot and empty the operation file (fileMutex_ must be held)
+    void writeSnapshot(const Rope& content, int64_t revision);
+
+    std::filesystem::path walPath_;
+    std::filesystem::path snapshotPath_;
+    GroupCommit& commit_;
+    const uint64_t snapshotBytes_;
+    int fd_ = -1;                          // The operation file, opened for appending
+    Recovery recovery_;
+    std::atomic<int64_t> revision_{0};     // Written by the owner only
+    std::atomic<uint64_t> walBytes_{0};
+
+    util::MpscQueue<Pending> queue_;       // Pushed by the owner, drained by whoever holds fileMutex_
+    std::atomic<bool> scheduled_{false};   // Queued with the group commit
+    std::atomic<bool> failed_{false};      // A commit could not write the file
+    std::atomic<int64_t> durableRevision_{0};
+    std::atomic<uint64_t> queuedBytes_{0};
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> rawBytes_{0};
+    std::atomic<uint64_t> writtenBytes_{0};
+
+    std::mutex fileMutex_;                 // Serializes draining queue_ and the writes, syncs and truncation of fd_
+};
+
+} // namespace ot
+} // namespace collab
@@ -0,0 +1,292 @@
+#include "common/util/config_loader.h"
+#include "common/util/numa_topology.h"
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <iomanip>
+#include <regex>
+
+namespace collab {
+namespace util {
+
+EditorMode editorModeFromString(const std::string& str) {
+    std::string upperStr = str;
+    std::transform(upperStr.begin(), upperStr.end(), upperStr.begin(),
+                  [](unsigned char c) { return std::toupper(c); });
+    
+    if (upperStr == "CODE") return EditorMode::CODE;
+    if (upperStr == "MARKDOWN") return EditorMode::MARKDOWN;
+    if (upperStr == "RICH_TEXT") return EditorMode::RICH_TEXT;
+    return EditorMode::TEXT; // Default
+}
+
+std::string editorModeToString(EditorMode mode) {
+    switch (mode) {
+        case EditorMode::CODE: return "CODE";
+        case EditorMode::MARKDOWN: return "MARKDOWN";
+        case EditorMode::RICH_TEXT: return "RICH_TEXT";
+        default: return "TEXT";
+    }
+}
+
+ConfigLoader::ConfigLoader()
+    : snapshot_(std::make_shared<const ConfigSnapshot>(defaults(), 0)) {
+}
+
+ConfigLoader::~ConfigLoader() {
+    stopWatching();
+}
+
+ConfigSnapshot::Values ConfigLoader::defaults() {
+    return {
+        {PORT_KEY, std::to_string(DEFAULT_PORT)},
+        {EDITOR_MODE_KEY, editorModeToString(DEFAULT_EDITOR_MODE)},
+        {AUTOSAVE_INTERVAL_KEY, std::to_string(DEFAULT_AUTOSAVE_INTERVAL.count())}};
+}
+
+bool ConfigLoader::readFile(const std::filesystem::path& configFilePath, ConfigSnapshot::Values& values) {
+    std::ifstream configFile(configFilePath);
+    if (!configFile.is_open()) {
+        return false;
+    }
+    
+    std::string line;
+    while (std::getline(configFile, line)) {
+        // Skip empty lines and comments
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        parseLine(line, values);
+    }
+    
+    return true;
+}
+
+bool ConfigLoader::loadFromFile(const std::filesystem::path& configFilePath) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    
+    // Take the time first, so a write racing the read shows as a change next time
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(configFilePath, ec);
+    ConfigSnapshot::Values values = snapshot_.load()->values();
+    if (!readFile(configFilePath, values)) {
+        return false;
+    }
+    
+    sourcePath_ = configFilePath;
+    sourceModified_ = ec ? std::nullopt : std::optional(modified);
+    publish(std::move(values));
+    return true;
+}
+
+bool ConfigLoader::reload() {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    if (sourcePath_.empty()) {
+        return false;
+    }
+    
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(sourcePath_, ec);
+    ConfigSnapshot::Values values = defaults();
+    if (!readFile(sourcePath_, values)) {
+        return false;
+    }
+    
+    sourceModified_ = ec ? std::nullopt : std::optional(modified);
+    publish(std::move(values));
+    return true;
+}
+
+bool ConfigLoader::reloadIfChanged() {
+    {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        if (sourcePath_.empty()) {
+            return false;
+        }
+        std::error_code ec;
+        auto modified = std::filesystem::last_write_time(sourcePath_, ec);
+        // A file that is gone, e.g. while an editor replaces it, keeps the values we have
+        if (ec || modified == sourceModified_) {
+            return false;
+        }
+    }
+    return reload();
+}
+
+void ConfigLoader::startWatching(std::chrono::milliseconds interval) {
+    if (watcher_.joinable()) {
+        return;
+    }
+    stopWatcher_ = false;
+    watcher_ = std::thread([this, interval] {
+        std::unique_lock<std::mutex> lock(watcherMutex_);
+        while (!watcherWake_.wait_for(lock, interval, [this] { return stopWatcher_; })) {
+            lock.unlock();
+            reloadIfChanged();
+            lock.lock();
+        }
+    });
+}
+
+void ConfigLoader::stopWatching() {
+    if (!watcher_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(watcherMutex_);
+        stopWatcher_ = true;
+    }
+    watcherWake_.notify_all();
+    watcher_.join();
+}
+
+bool ConfigLoader::saveToFile(const std::filesystem::path& configFilePath) const {
+    std::ofstream configFile(configFilePath);
+    if (!configFile.is_open()) {
+        return false;
+    }
+    
+    configFile << "# CollabEdit Configuration File\n";
+    // Not every standard library can print a time_point yet
+    const std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    configFile << "# Generated on " << std::put_time(std::gmtime(&now), "%Y-%m-%d %H:%M:%S UTC") << "\n\n";
+    
+    // Save all configuration values
+    auto current = snapshot();
+    for (const auto& [key, value] : current->values()) {
+        configFile << key << "=" << value << "\n";
+    }
+    
+    return configFile.good();
+}
+
+uint16_t ConfigLoader::getServerPort() const {
+    const auto& portStr = getValue(PORT_KEY).value_or(std::to_string(DEFAULT_PORT));
+    
+    try {
+        uint16_t port = static_cast<uint16_t>(std::stoi(portStr));
+        return port;
+    } catch (const std::exception& e) {
+        // Log error and return default
+        std::cerr << "Error parsing port value: " << e.what() << std::endl;
+        return DEFAULT_PORT;
+    }
+}
+
+void ConfigLoader::setServerPort(uint16_t port) {
+    setValue(PORT_KEY, std::to_string(port));
+}
+
+EditorMode ConfigLoader::getEditorMode() const {
+    const auto& modeStr = getValue(EDITOR_MODE_KEY).value_or(editorModeToString(DEFAULT_EDITOR_MODE));
+    return editorModeFromString(modeStr);
+}
+
+void ConfigLoader::setEditorMode(EditorMode mode) {
+    setValue(EDITOR_MODE_KEY, editorModeToString(mode));
+}
+
+std::chrono::seconds ConfigLoader::getAutosaveInterval() const {
+    const auto& intervalStr = getValue(AUTOSAVE_INTERVAL_KEY).value_or(
+                                std::to_string(DEFAULT_AUTOSAVE_INTERVAL.count()));
+    
+    try {
+        auto seconds = std::chrono::seconds(std::stoi(intervalStr));
+        return seconds;
+    } catch (const std::exception& e) {
+        // Log error and return default
+        std::cerr << "Error parsing autosave interval: " << e.what() << std::endl;
+        return DEFAULT_AUTOSAVE_INTERVAL;
+    }
+}
+
+void ConfigLoader::setAutosaveInterval(std::chrono::seconds seconds) {
+    setValue(AUTOSAVE_INTERVAL_KEY, std::to_string(seconds.count()));
+}
+
+LowLatencySettings ConfigLoader::getLowLatency() const {
+    auto current = snapshot();
+    LowLatencySettings settings;
+    auto read = [&current](const char* key, auto& value) {
+        if (const std::string* text = current->find(key)) {
+            value = parseConfigValue<std::decay_t<decltype(value)>>(*text).value_or(value);
+        }
+    };
+    read(LOW_LATENCY_KEY, settings.enabled);
+    read(LOW_LATENCY_SPIN_POLLS_KEY, settings.spinPolls);
+    read(LOW_LATENCY_PARK_KEY, settings.park);
+    read(LOW_LATENCY_SOCKET_BUSY_POLL_KEY, settings.socketBusyPoll);
+    if (const std::string* cpus = current->find(LOW_LATENCY_SHARD_CPUS_KEY)) {
+        settings.shardCpus = NumaTopology::parseCpuList(*cpus);
+    }
+    return settings;
+}
+
+std::optional<std::string> ConfigLoader::getValue(const std::string& key) const {
+    auto current = snapshot();
+    if (const std::string* value = current->find(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+void ConfigLoader::setValue(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    ConfigSnapshot::Values values = snapshot_.load()->values();
+    values[key] = value;
+    publish(std::move(values));
+}
+
+std::shared_ptr<const ConfigSnapshot> ConfigLoader::snapshot() const {
+    return snapshot_.load(std::memory_order_acquire);
+}
+
+void ConfigLoader::publish(ConfigSnapshot::Values values) {
+    auto next = std::make_shared<const ConfigSnapshot>(std::move(values), snapshot_.load()->version() + 1);
+    snapshot_.store(next, std::memory_order_release);
+    
+    // Handles whose owners are gone are dropped on the way
+    std::erase_if(handles_, [&next](const std::weak_ptr<detail::ConfigHandleState>& weak) {
+        auto state = weak.lock();
+        if (!state) {
+            return true;
+        }
+        state->update(*next);
+        return false;
+    });
+}
+
+void ConfigLoader::parseLine(const std::string& line, ConfigSnapshot::Values& values) {
+    // Match KEY=VALUE pattern, allowing for spaces around the = sign
+    std::regex configPattern(R"(^\s*([A-Za-z][A-Za-z0-9_]*)\s*=\s*(.*)$)");
+    std::smatch matches;
+    
+    if (std::regex_match(line, matches, configPattern) && matches.size() == 3) {
+        std::string key = matches[1].str();
+        std::string value = trim(matches[2].str());
+        
+        // Remove quotes if present
+        if ((value.front() == '"' && value.back() == '"') || 
+            (value.front() == '\'' && value.back() == '\'')) {
+            value = value.substr(1, value.length() - 2);
+        }
+        
+        values[key] = value;
+    }
+}
+
+std::string ConfigLoader::trim(const std::string& str) {
+    auto start = std::find_if_not(str.begin(), str.end(), [](unsigned char c) {
+        return std::isspace(c);
+    });
+    
+    auto end = std::find_if_not(str.rbegin(), str.rend(), [](unsigned char c) {
+        return std::isspace(c);
+    }).base();
+    
+    return (start < end) ? std::string(start, end) : std::string();
+}
+
+} // namespace util
+} // namespace collab
\ No newline at end of file
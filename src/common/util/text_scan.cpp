@@ -0,0 +1,652 @@
+#include "common/util/text_scan.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define COLLAB_TEXT_SCAN_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define COLLAB_TEXT_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace collab {
+namespace util {
+
+namespace {
+
+// Bytes the kernels count
+enum class Match {
+    NEWLINE,       // '\n'
+    CONTINUATION,  // 10xxxxxx, which does not start a code point
+    FOUR_BYTE      // 11110xxx and up, which starts a code point beyond U+FFFF
+};
+
+struct Kernels {
+    const char* name;
+    size_t (*count)(const unsigned char* text, size_t length, Match match);
+    void (*findNewlines)(const unsigned char* text, size_t length, uint64_t base, std::vector<uint64_t>& offsets);
+    bool (*validUtf8)(const unsigned char* text, size_t length);
+    // Bytes a and b share from the front, and from the back, of their first length bytes
+    size_t (*commonPrefix)(const unsigned char* a, const unsigned char* b, size_t length);
+    size_t (*commonSuffix)(const unsigned char* a, const unsigned char* b, size_t length);
+};
+
+//
+// Scalar
+//
+
+bool matches(unsigned char byte, Match match) {
+    switch (match) {
+        case Match::NEWLINE:
+            return byte == '\n';
+        case Match::CONTINUATION:
+            return (byte & 0xC0) == 0x80;
+        case Match::FOUR_BYTE:
+            return byte >= 0xF0;
+    }
+    return false;
+}
+
+size_t countScalar(const unsigned char* text, size_t length, Match match) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; ++i) {
+        count += matches(text[i], match) ? 1 : 0;
+    }
+    return count;
+}
+
+void findNewlinesScalar(const unsigned char* text, size_t length, uint64_t base, std::vector<uint64_t>& offsets) {
+    const auto* begin = reinterpret_cast<const char*>(text);
+    const char* end = begin + length;
+    for (const char* p = begin; (p = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr; ++p) {
+        offsets.push_back(base + static_cast<uint64_t>(p - begin));
+    }
+}
+
+constexpr size_t INVALID = static_cast<size_t>(-1);
+
+// Check the character starting at offset; returns where the next one starts, or INVALID
+size_t stepUtf8(const unsigned char* text, size_t length, size_t offset) {
+    const unsigned char lead = text[offset];
+    if (lead < 0x80) {
+        return offset + 1;
+    }
+    size_t size;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        size = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        size = 3;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        size = 4;
+    } else {
+        return INVALID;
+    }
+    if (length - offset < size) {
+        return INVALID;
+    }
+    const unsigned char second = text[offset + 1];
+    if ((second & 0xC0) != 0x80 ||
+        (lead == 0xE0 && second < 0xA0) ||  // Overlong three-byte form
+        (lead == 0xED && second > 0x9F) ||  // Surrogate
+        (lead == 0xF0 && second < 0x90) ||  // Overlong four-byte form
+        (lead == 0xF4 && second > 0x8F)) {  // Above U+10FFFF
+        return INVALID;
+    }
+    for (size_t i = 2; i < size; ++i) {
+        if ((text[offset + i] & 0xC0) != 0x80) {
+            return INVALID;
+        }
+    }
+    return offset + size;
+}
+
+bool validUtf8Scalar(const unsigned char* text, size_t length) {
+    for (size_t i = 0; i < length;) {
+        i = stepUtf8(text, length, i);
+        if (i == INVALID) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Skip blocks the vector test finds all ASCII; check the others a character at a time
+template <size_t Block, typename AsciiBlock>
+bool validUtf8AsciiFast(const unsigned char* text, size_t length, AsciiBlock asciiBlock) {
+    size_t i = 0;
+    while (i < length) {
+        if (length - i >= Block && asciiBlock(text + i)) {
+            i += Block;
+            continue;
+        }
+        // Characters may run past the block; the next block starts after the last one
+        const size_t end = std::min(length, i + Block);
+        while (i < end) {
+            i = stepUtf8(text, length, i);
+            if (i == INVALID) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t commonPrefixScalar(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    // A word at a time; the first differing byte is the lowest set one on little-endian
+    for (; length - i >= 8; i += 8) {
+        uint64_t left;
+        uint64_t right;
+        std::memcpy(&left, a + i, 8);
+        std::memcpy(&right, b + i, 8);
+        if (left != right) {
+            if constexpr (std::endian::native == std::endian::little) {
+                return i + static_cast<size_t>(std::countr_zero(left ^ right) / 8);
+            }
+            break;
+        }
+    }
+    while (i < length && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+size_t commonSuffixScalar(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    while (i < length && a[length - 1 - i] == b[length - 1 - i]) {
+        ++i;
+    }
+    return i;
+}
+
+constexpr Kernels SCALAR{"scalar", &countScalar, &findNewlinesScalar, &validUtf8Scalar,
+                         &commonPrefixScalar, &commonSuffixScalar};
+
+#if defined(COLLAB_TEXT_SCAN_X86)
+
+//
+// SSE2, which every x86-64 CPU has
+//
+
+__m128i matchSse2(__m128i bytes, Match match) {
+    switch (match) {
+        case Match::NEWLINE:
+            return _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+        case Match::CONTINUATION:
+            // 0x80 to 0xBF are the signed bytes -128 to -65
+            return _mm_cmplt_epi8(bytes, _mm_set1_epi8(-64));
+        case Match::FOUR_BYTE:
+            return _mm_cmpeq_epi8(_mm_max_epu8(bytes, _mm_set1_epi8(static_cast<char>(0xF0))), bytes);
+    }
+    return _mm_setzero_si128();
+}
+
+size_t countSse2(const unsigned char* text, size_t length, Match match) {
+    size_t count = 0;
+    size_t i = 0;
+    while (length - i >= 16) {
+        // Byte counters take 255 blocks before they could wrap
+        __m128i counters = _mm_setzero_si128();
+        for (size_t blocks = 0; blocks < 255 && length - i >= 16; ++blocks, i += 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+            counters = _mm_sub_epi8(counters, matchSse2(bytes, match));
+        }
+        const __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += static_cast<size_t>(_mm_cvtsi128_si64(sums)) +
+                 static_cast<size_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums)));
+    }
+    return count + countScalar(text + i, length - i, match);
+}
+
+void findNewlinesSse2(const unsigned char* text, size_t length, uint64_t base, std::vector<uint64_t>& offsets) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        for (auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline))); mask != 0;
+             mask &= mask - 1) {
+            offsets.push_back(base + i + static_cast<uint64_t>(std::countr_zero(mask)));
+        }
+    }
+    findNewlinesScalar(text + i, length - i, base + i, offsets);
+}
+
+bool validUtf8Sse2(const unsigned char* text, size_t length) {
+    return validUtf8AsciiFast<16>(text, length, [](const unsigned char* block) {
+        return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block))) == 0;
+    });
+}
+
+// Bit i set where byte i of the two blocks differs
+unsigned differsSse2(const unsigned char* a, const unsigned char* b) {
+    const __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+    return ~static_cast<unsigned>(_mm_movemask_epi8(equal)) & 0xFFFF;
+}
+
+size_t commonPrefixSse2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        if (const unsigned differs = differsSse2(a + i, b + i); differs != 0) {
+            return i + static_cast<size_t>(std::countr_zero(differs));
+        }
+    }
+    return i + commonPrefixScalar(a + i, b + i, length - i);
+}
+
+size_t commonSuffixSse2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        const size_t block = length - i - 16;
+        if (const unsigned differs = differsSse2(a + block, b + block); differs != 0) {
+            return i + static_cast<size_t>(std::countl_zero(static_cast<uint16_t>(differs)));
+        }
+    }
+    return i + commonSuffixScalar(a, b, length - i);
+}
+
+constexpr Kernels SSE2{"sse2", &countSse2, &findNewlinesSse2, &validUtf8Sse2, &commonPrefixSse2, &commonSuffixSse2};
+
+//
+// AVX2
+//
+
+#define COLLAB_AVX2 __attribute__((target("avx2")))
+
+COLLAB_AVX2 inline __m256i matchAvx2(__m256i bytes, Match match) {
+    switch (match) {
+        case Match::NEWLINE:
+            return _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+        case Match::CONTINUATION:
+            return _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), bytes);
+        case Match::FOUR_BYTE:
+            return _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, _mm256_set1_epi8(static_cast<char>(0xF0))), bytes);
+    }
+    return _mm256_setzero_si256();
+}
+
+COLLAB_AVX2 size_t countAvx2(const unsigned char* text, size_t length, Match match) {
+    size_t count = 0;
+    size_t i = 0;
+    while (length - i >= 32) {
+        __m256i counters = _mm256_setzero_si256();
+        for (size_t blocks = 0; blocks < 255 && length - i >= 32; ++blocks, i += 32) {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+            counters = _mm256_sub_epi8(counters, matchAvx2(bytes, match));
+        }
+        const __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+        count += static_cast<size_t>(_mm256_extract_epi64(sums, 0)) + static_cast<size_t>(_mm256_extract_epi64(sums, 1)) +
+                 static_cast<size_t>(_mm256_extract_epi64(sums, 2)) + static_cast<size_t>(_mm256_extract_epi64(sums, 3));
+    }
+    return count + countScalar(text + i, length - i, match);
+}
+
+COLLAB_AVX2 void findNewlinesAvx2(const unsigned char* text, size_t length, uint64_t base,
+                                  std::vector<uint64_t>& offsets) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        for (auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline))); mask != 0;
+             mask &= mask - 1) {
+            offsets.push_back(base + i + static_cast<uint64_t>(std::countr_zero(mask)));
+        }
+    }
+    findNewlinesScalar(text + i, length - i, base + i, offsets);
+}
+
+/**
+ * UTF-8 validation by table lookup, after Keiser and Lemire, "Validating
+ * UTF-8 In Less Than One Instruction Per Byte" (2021)
+ *
+ * Each byte is classified by the high and low nibble of the byte before it
+ * and the high nibble of itself; the three lookups are ANDed, and any bit
+ * left is a specific error. Three- and four-byte sequences are then
+ * checked for the continuation bytes their leads require.
+ */
+class Utf8CheckerAvx2 {
+public:
+    COLLAB_AVX2 Utf8CheckerAvx2()
+        : error_(_mm256_setzero_si256()), incomplete_(_mm256_setzero_si256()), previous_(_mm256_setzero_si256()) {}
+
+    COLLAB_AVX2 void check(__m256i input) {
+        if (_mm256_movemask_epi8(input) == 0) {
+            // ASCII cannot continue a sequence the last block left open
+            error_ = _mm256_or_si256(error_, incomplete_);
+            incomplete_ = _mm256_setzero_si256();
+        } else {
+            const __m256i prev1 = previous<1>(input);
+            const __m256i special = specialCases(input, prev1);
+            error_ = _mm256_or_si256(error_, multibyteLengths(input, special));
+            incomplete_ = isIncomplete(input);
+        }
+        previous_ = input;
+    }
+
+    COLLAB_AVX2 bool valid() {
+        error_ = _mm256_or_si256(error_, incomplete_);
+        return _mm256_testz_si256(error_, error_) != 0;
+    }
+
+private:
+    static constexpr uint8_t TOO_SHORT = 1 << 0;       // Lead byte followed by a non-continuation
+    static constexpr uint8_t TOO_LONG = 1 << 1;        // ASCII followed by a continuation
+    static constexpr uint8_t OVERLONG_3 = 1 << 2;
+    static constexpr uint8_t TOO_LARGE = 1 << 3;
+    static constexpr uint8_t SURROGATE = 1 << 4;
+    static constexpr uint8_t OVERLONG_2 = 1 << 5;
+    static constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+    static constexpr uint8_t OVERLONG_4 = 1 << 6;
+    static constexpr uint8_t TWO_CONTS = 1 << 7;       // Two continuations in a row
+    static constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    // The input shifted right by N bytes, with the last N bytes of the block before in front
+    template <int N>
+    COLLAB_AVX2 __m256i previous(__m256i input) const {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous_, input, 0x21), 16 - N);
+    }
+
+    COLLAB_AVX2 static __m256i highNibbles(__m256i bytes) {
+        return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    COLLAB_AVX2 static __m256i table(uint8_t v0, uint8_t v1, uint8_t v2, uint8_t v3, uint8_t v4, uint8_t v5,
+                                     uint8_t v6, uint8_t v7, uint8_t v8, uint8_t v9, uint8_t v10, uint8_t v11,
+                                     uint8_t v12, uint8_t v13, uint8_t v14, uint8_t v15) {
+        return _mm256_setr_epi8(
+            static_cast<char>(v0), static_cast<char>(v1), static_cast<char>(v2), static_cast<char>(v3),
+            static_cast<char>(v4), static_cast<char>(v5), static_cast<char>(v6), static_cast<char>(v7),
+            static_cast<char>(v8), static_cast<char>(v9), static_cast<char>(v10), static_cast<char>(v11),
+            static_cast<char>(v12), static_cast<char>(v13), static_cast<char>(v14), static_cast<char>(v15),
+            static_cast<char>(v0), static_cast<char>(v1), static_cast<char>(v2), static_cast<char>(v3),
+            static_cast<char>(v4), static_cast<char>(v5), static_cast<char>(v6), static_cast<char>(v7),
+            static_cast<char>(v8), static_cast<char>(v9), static_cast<char>(v10), static_cast<char>(v11),
+            static_cast<char>(v12), static_cast<char>(v13), static_cast<char>(v14), static_cast<char>(v15));
+    }
+
+    COLLAB_AVX2 static __m256i specialCases(__m256i input, __m256i prev1) {
+        const __m256i byte1High = _mm256_shuffle_epi8(
+            table(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                  TOO_SHORT | OVERLONG_2,
+                  TOO_SHORT,
+                  TOO_SHORT | OVERLONG_3 | SURROGATE,
+                  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+            highNibbles(prev1));
+        constexpr uint8_t LARGE = CARRY | TOO_LARGE | TOO_LARGE_1000;
+        const __m256i byte1Low = _mm256_shuffle_epi8(
+            table(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                  CARRY | OVERLONG_2,
+                  CARRY, CARRY,
+                  CARRY | TOO_LARGE,
+                  LARGE, LARGE, LARGE, LARGE, LARGE, LARGE, LARGE, LARGE,
+                  LARGE | SURROGATE,
+                  LARGE, LARGE),
+            _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+        constexpr uint8_t CONTINUATION = TOO_LONG | OVERLONG_2 | TWO_CONTS;
+        const __m256i byte2High = _mm256_shuffle_epi8(
+            table(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                  CONTINUATION | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                  CONTINUATION | OVERLONG_3 | TOO_LARGE,
+                  CONTINUATION | SURROGATE | TOO_LARGE,
+                  CONTINUATION | SURROGATE | TOO_LARGE,
+                  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+            highNibbles(input));
+        return _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+    }
+
+    COLLAB_AVX2 __m256i multibyteLengths(__m256i input, __m256i special) const {
+        // Only 111xxxxx two back and 1111xxxx three back reach 0x80 after these subtractions
+        const __m256i third = _mm256_subs_epu8(previous<2>(input), _mm256_set1_epi8(0xE0 - 0x80));
+        const __m256i fourth = _mm256_subs_epu8(previous<3>(input), _mm256_set1_epi8(0xF0 - 0x80));
+        const __m256i mustContinue = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                                      _mm256_set1_epi8(static_cast<char>(0x80)));
+        return _mm256_xor_si256(mustContinue, special);
+    }
+
+    // Nonzero where the block's last bytes start a sequence the block does not finish
+    COLLAB_AVX2 static __m256i isIncomplete(__m256i input) {
+        const __m256i limits = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+        return _mm256_subs_epu8(input, limits);
+    }
+
+    __m256i error_;
+    __m256i incomplete_;
+    __m256i previous_;
+};
+
+COLLAB_AVX2 bool validUtf8Avx2(const unsigned char* text, size_t length) {
+    Utf8CheckerAvx2 checker;
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        checker.check(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i)));
+    }
+    if (i < length) {
+        // Pad the tail with ASCII, which ends any sequence left open as too short
+        alignas(32) unsigned char tail[32] = {};
+        std::memcpy(tail, text + i, length - i);
+        checker.check(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+    }
+    return checker.valid();
+}
+
+COLLAB_AVX2 inline uint32_t differsAvx2(const unsigned char* a, const unsigned char* b) {
+    const __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+                                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(equal));
+}
+
+COLLAB_AVX2 size_t commonPrefixAvx2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        if (const uint32_t differs = differsAvx2(a + i, b + i); differs != 0) {
+            return i + static_cast<size_t>(std::countr_zero(differs));
+        }
+    }
+    return i + commonPrefixScalar(a + i, b + i, length - i);
+}
+
+COLLAB_AVX2 size_t commonSuffixAvx2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        const size_t block = length - i - 32;
+        if (const uint32_t differs = differsAvx2(a + block, b + block); differs != 0) {
+            return i + static_cast<size_t>(std::countl_zero(differs));
+        }
+    }
+    return i + commonSuffixScalar(a, b, length - i);
+}
+
+#undef COLLAB_AVX2
+
+constexpr Kernels AVX2{"avx2", &countAvx2, &findNewlinesAvx2, &validUtf8Avx2, &commonPrefixAvx2, &commonSuffixAvx2};
+
+#elif defined(COLLAB_TEXT_SCAN_NEON)
+
+//
+// NEON, which every ARM64 CPU has
+//
+
+uint8x16_t matchNeon(uint8x16_t bytes, Match match) {
+    switch (match) {
+        case Match::NEWLINE:
+            return vceqq_u8(bytes, vdupq_n_u8('\n'));
+        case Match::CONTINUATION:
+            return vceqq_u8(vandq_u8(bytes, vdupq_n_u8(0xC0)), vdupq_n_u8(0x80));
+        case Match::FOUR_BYTE:
+            return vcgeq_u8(bytes, vdupq_n_u8(0xF0));
+    }
+    return vdupq_n_u8(0);
+}
+
+size_t countNeon(const unsigned char* text, size_t length, Match match) {
+    size_t count = 0;
+    size_t i = 0;
+    while (length - i >= 16) {
+        uint8x16_t counters = vdupq_n_u8(0);
+        for (size_t blocks = 0; blocks < 255 && length - i >= 16; ++blocks, i += 16) {
+            counters = vsubq_u8(counters, matchNeon(vld1q_u8(text + i), match));
+        }
+        count += vaddlvq_u8(counters);
+    }
+    return count + countScalar(text + i, length - i, match);
+}
+
+void findNewlinesNeon(const unsigned char* text, size_t length, uint64_t base, std::vector<uint64_t>& offsets) {
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        // Narrow the comparison to four bits per byte, a 64-bit mask
+        const uint8x16_t equal = vceqq_u8(vld1q_u8(text + i), newline);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        for (; mask != 0; mask &= ~(uint64_t{0xF} << (std::countr_zero(mask) & ~3))) {
+            offsets.push_back(base + i + static_cast<uint64_t>(std::countr_zero(mask) >> 2));
+        }
+    }
+    findNewlinesScalar(text + i, length - i, base + i, offsets);
+}
+
+bool validUtf8Neon(const unsigned char* text, size_t length) {
+    return validUtf8AsciiFast<16>(text, length, [](const unsigned char* block) {
+        return vmaxvq_u8(vld1q_u8(block)) < 0x80;
+    });
+}
+
+// Four bits per byte, set where the two blocks differ
+uint64_t differsNeon(const unsigned char* a, const unsigned char* b) {
+    const uint8x16_t equal = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+    return ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+}
+
+size_t commonPrefixNeon(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        if (const uint64_t differs = differsNeon(a + i, b + i); differs != 0) {
+            return i + static_cast<size_t>(std::countr_zero(differs) >> 2);
+        }
+    }
+    return i + commonPrefixScalar(a + i, b + i, length - i);
+}
+
+size_t commonSuffixNeon(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        const size_t block = length - i - 16;
+        if (const uint64_t differs = differsNeon(a + block, b + block); differs != 0) {
+            return i + static_cast<size_t>(std::countl_zero(differs) >> 2);
+        }
+    }
+    return i + commonSuffixScalar(a, b, length - i);
+}
+
+constexpr Kernels NEON{"neon", &countNeon, &findNewlinesNeon, &validUtf8Neon, &commonPrefixNeon, &commonSuffixNeon};
+
+#endif
+
+const Kernels& kernels() {
+    static const Kernels& selected = [] () -> const Kernels& {
+#if defined(COLLAB_TEXT_SCAN_X86)
+        return __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+#elif defined(COLLAB_TEXT_SCAN_NEON)
+        return NEON;
+#else
+        return SCALAR;
+#endif
+    }();
+    return selected;
+}
+
+const unsigned char* bytesOf(std::string_view text) {
+    return reinterpret_cast<const unsigned char*>(text.data());
+}
+
+// Units a byte adds: one if it starts a code point, and one more for UTF-16 if it starts a surrogate pair
+size_t weightOf(unsigned char byte, bool utf16) {
+    if ((byte & 0xC0) == 0x80) {
+        return 0;
+    }
+    return utf16 && byte >= 0xF0 ? 2 : 1;
+}
+
+size_t weightOf(std::string_view text, bool utf16) {
+    const Kernels& k = kernels();
+    const size_t codePoints = text.size() - k.count(bytesOf(text), text.size(), Match::CONTINUATION);
+    return utf16 ? codePoints + k.count(bytesOf(text), text.size(), Match::FOUR_BYTE) : codePoints;
+}
+
+// Byte offset where units code points or UTF-16 units end
+size_t byteOffsetOf(std::string_view text, size_t units, bool utf16) {
+    // Whole chunks at a time while they fit, then character by character
+    constexpr size_t CHUNK = 1024;
+    size_t offset = 0;
+    while (text.size() - offset >= CHUNK) {
+        const size_t weight = weightOf(text.substr(offset, CHUNK), utf16);
+        if (weight > units) {
+            break;
+        }
+        units -= weight;
+        offset += CHUNK;
+    }
+    const unsigned char* bytes = bytesOf(text);
+    for (; offset < text.size(); ++offset) {
+        const size_t weight = weightOf(bytes[offset], utf16);
+        if (weight > units) {
+            break;
+        }
+        units -= weight;
+    }
+    return offset;
+}
+
+} // namespace
+
+const char* textScanKernel() {
+    return kernels().name;
+}
+
+size_t countNewlines(std::string_view text) {
+    return kernels().count(bytesOf(text), text.size(), Match::NEWLINE);
+}
+
+void findNewlines(std::string_view text, uint64_t base, std::vector<uint64_t>& offsets) {
+    kernels().findNewlines(bytesOf(text), text.size(), base, offsets);
+}
+
+bool validUtf8(std::string_view text) {
+    return kernels().validUtf8(bytesOf(text), text.size());
+}
+
+size_t countCodePoints(std::string_view text) {
+    return weightOf(text, false);
+}
+
+size_t commonPrefixLength(std::string_view a, std::string_view b) {
+    return kernels().commonPrefix(bytesOf(a), bytesOf(b), std::min(a.size(), b.size()));
+}
+
+size_t commonSuffixLength(std::string_view a, std::string_view b) {
+    const size_t length = std::min(a.size(), b.size());
+    return kernels().commonSuffix(bytesOf(a) + a.size() - length, bytesOf(b) + b.size() - length, length);
+}
+
+size_t utf16Length(std::string_view text) {
+    return weightOf(text, true);
+}
+
+size_t byteOffsetOfUtf16(std::string_view text, size_t units) {
+    return byteOffsetOf(text, units, true);
+}
+
+size_t byteOffsetOfCodePoint(std::string_view text, size_t codePoints) {
+    return byteOffsetOf(text, codePoints, false);
+}
+
+} // namespace util
+} // namespace collab
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include "common/protocol/wire_codec.h"
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+
+using namespace collab::protocol;
+
+// Counting heap allocations means replacing operator new for the whole
+// process, so these tests build into their own binary (allocation_tests)
+// rather than changing the allocator under every other test.
+
+namespace {
+
+// The counter of the CountAllocations alive on this thread, if any
+thread_local size_t* activeCounter = nullptr;
+
+// Counts the calling thread's heap allocations while it is alive
+class CountAllocations {
+public:
+    CountAllocations() { activeCounter = &count_; }
+    ~CountAllocations() { activeCounter = nullptr; }
+    CountAllocations(const CountAllocations&) = delete;
+    CountAllocations& operator=(const CountAllocations&) = delete;
+
+    size_t count() const { return count_; }
+
+private:
+    size_t count_ = 0;
+};
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    if (activeCounter) {
+        ++*activeCounter;
+    }
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// Kept out of line: inlined next to a new-expression, GCC would pair free() with it and warn
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+EditMessage makeEdit(uint64_t sequence) {
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.clientId = "4f1c2a9e-8b7d-4e3f-9a21-0c5d6e7f8a9b";
+    edit.sessionId = "b7e2d1c0-3f4a-4b5c-8d9e-1a2b3c4d5e6f";
+    edit.sequenceNumber = sequence;
+    edit.documentId = "9c8b7a6f-5e4d-4c3b-2a19-0f8e7d6c5b4a";
+    edit.documentVersion = 1000 + sequence;
+    edit.operationId = "op-" + std::to_string(sequence);
+    edit.position = 42;
+    edit.text = "a";
+    return edit;
+}
+
+// Run the AUTH_LOGIN / AUTH_SUCCESS exchange between two codecs
+void negotiate(WireCodec& client, WireCodec& server) {
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    auto received = std::get<AuthMessage>(server.decode(client.encode(login)));
+
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    success.username = received.username;
+    client.decode(server.encode(success));
+}
+
+} // namespace
+
+TEST(WireCodecAllocationTest, VisitDecodesBinaryEditsWithoutAllocating) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+    ASSERT_EQ(server.getFormat(), WireFormat::BINARY);
+    server.decode(client.encode(makeEdit(1)));
+
+    const EditMessage edit = makeEdit(2);
+    const std::string frame = client.encode(edit);
+    std::string_view operationId;
+    std::optional<std::string_view> text;
+    size_t seen = 0;
+
+    size_t allocations = 0;
+    {
+        CountAllocations counting;
+        server.visit(frame, [&](const auto& message) {
+            using T = std::decay_t<decltype(message)>;
+            if constexpr (std::is_same_v<T, EditMessageView>) {
+                operationId = message.operationId;
+                text = message.text;
+                seen += message.documentId == edit.documentId && message.clientId == edit.clientId;
+            }
+        });
+        allocations = counting.count();
+    }
+
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(seen, 1u);
+    EXPECT_EQ(operationId, "op-2");
+    EXPECT_EQ(text, std::optional<std::string_view>("a"));
+    EXPECT_EQ(operationId.data(), frame.data() + frame.find("op-2"));
+}
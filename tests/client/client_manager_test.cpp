@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include "client/network/client_manager.h"
+#include <chrono>
+#include <random>
+
+using namespace collab::client;
+using namespace std::chrono_literals;
+
+TEST(ClientManagerTest, BackoffDoublesUpToTheCapWithJitter) {
+    ClientManager::ConnectOptions options;
+    options.initialBackoff = 100ms;
+    options.maxBackoff = 1000ms;
+    std::mt19937 random(1);
+    
+    for (unsigned attempt = 0; attempt < 12; ++attempt) {
+        const auto ceiling = std::min<std::chrono::milliseconds>(100ms * (1 << std::min(attempt, 10u)), 1000ms);
+        for (int i = 0; i < 20; ++i) {
+            const auto delay = ClientManager::backoffDelay(options, attempt, random);
+            EXPECT_GE(delay, ceiling / 2);
+            EXPECT_LE(delay, ceiling);
+        }
+    }
+}
+
+TEST(ClientManagerTest, ConnectReturnsAsSoonAsTheServerAccepts) {
+    boost::asio::io_context server;
+    boost::asio::ip::tcp::acceptor acceptor(server, {boost::asio::ip::make_address("127.0.0.1"), 0});
+    const int port = acceptor.local_endpoint().port();
+    boost::asio::ip::tcp::socket accepted(server);
+    acceptor.async_accept(accepted, [](const boost::system::error_code&) {});
+    std::thread serverThread([&server]() { server.run(); });
+    
+    ClientManager& manager = ClientManager::getInstance();
+    const auto started = std::chrono::steady_clock::now();
+    EXPECT_TRUE(manager.connect("127.0.0.1", port));
+    EXPECT_LT(std::chrono::steady_clock::now() - started, 1s);
+    EXPECT_TRUE(manager.isConnected());
+    
+    manager.disconnect();
+    EXPECT_FALSE(manager.isConnected());
+    serverThread.join();
+}
+
+TEST(ClientManagerTest, RefusedConnectFailsWithoutWaitingOutTheTimeout) {
+    // A port nothing listens on: bind one, then let it go
+    int port;
+    {
+        boost::asio::io_context probe;
+        boost::asio::ip::tcp::acceptor acceptor(probe, {boost::asio::ip::make_address("127.0.0.1"), 0});
+        port = acceptor.local_endpoint().port();
+    }
+    
+    ClientManager::ConnectOptions options;
+    options.timeout = 5s;
+    options.reconnect = false;
+    
+    ClientManager& manager = ClientManager::getInstance();
+    const auto started = std::chrono::steady_clock::now();
+    std::future<bool> connected = manager.connectAsync("127.0.0.1", port, options);
+    ASSERT_EQ(connected.wait_for(2s), std::future_status::ready);
+    EXPECT_FALSE(connected.get());
+    EXPECT_LT(std::chrono::steady_clock::now() - started, 2s);
+    manager.disconnect();
+}
+
+TEST(ClientManagerTest, RetriesUntilTheServerComesUp) {
+    boost::asio::io_context server;
+    boost::asio::ip::tcp::endpoint endpoint;
+    {
+        boost::asio::ip::tcp::acceptor probe(server, {boost::asio::ip::make_address("127.0.0.1"), 0});
+        endpoint = probe.local_endpoint();
+    }
+    
+    ClientManager::ConnectOptions options;
+    options.initialBackoff = 20ms;
+    options.maxBackoff = 100ms;
+    
+    ClientManager& manager = ClientManager::getInstance();
+    std::promise<void> reconnected;
+    manager.setConnectionStatusCallback([&reconnected](bool connected) {
+        if (connected) {
+            reconnected.set_value();
+        }
+    });
+    EXPECT_FALSE(manager.connect("127.0.0.1", endpoint.port(), options));
+    
+    // The server comes up after the first attempt was refused
+    boost::asio::ip::tcp::acceptor acceptor(server, endpoint);
+    boost::asio::ip::tcp::socket accepted(server);
+    acceptor.async_accept(accepted, [](const boost::system::error_code&) {});
+    std::thread serverThread([&server]() { server.run(); });
+    
+    EXPECT_EQ(reconnected.get_future().wait_for(5s), std::future_status::ready);
+    EXPECT_TRUE(manager.isConnected());
+    manager.disconnect();
+    manager.setConnectionStatusCallback(nullptr);
+    serverThread.join();
+}
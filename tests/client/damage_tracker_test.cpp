@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "client/editor/damage_tracker.h"
+#include <optional>
+
+using namespace collab::document;
+
+namespace {
+
+std::string textWithLines(size_t count) {
+    std::string text;
+    for (size_t i = 0; i < count; ++i) {
+        text += "line " + std::to_string(i) + (i + 1 < count ? "\n" : "");
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(DamageTrackerTest, FirstFrameDrawsEverything) {
+    Document document;
+    document.setText(textWithLines(3));
+    DamageTracker damage(document);
+    
+    const std::optional<DamagedLines> first = damage.collect();
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(first->first, 0u);
+    EXPECT_EQ(first->last, DamagedLines::TO_END);
+    EXPECT_FALSE(damage.collect().has_value());
+}
+
+TEST(DamageTrackerTest, EditsInALineDamageOnlyThatLine) {
+    Document document;
+    document.setText(textWithLines(100));
+    DamageTracker damage(document);
+    document.addChangeSummaryListener([&](const ChangeSummary& summary) { damage.noteChange(summary); });
+    damage.collect();
+    
+    ASSERT_TRUE(document.insertText(CursorPosition(40, 2), "xy"));
+    ASSERT_TRUE(document.deleteText(CursorPosition(40, 0), 1));
+    
+    const std::optional<DamagedLines> damaged = damage.collect();
+    ASSERT_TRUE(damaged.has_value());
+    EXPECT_EQ(damaged->first, 40u);
+    EXPECT_EQ(damaged->last, 40u);
+    EXPECT_FALSE(damaged->contains(41));
+}
+
+TEST(DamageTrackerTest, NewLinesDamageEverythingBelow) {
+    Document document;
+    document.setText(textWithLines(100));
+    DamageTracker damage(document);
+    document.addChangeSummaryListener([&](const ChangeSummary& summary) { damage.noteChange(summary); });
+    damage.collect();
+    
+    {
+        Document::Batch batch(document);
+        ASSERT_TRUE(document.insertText(CursorPosition(70, 0), "new\n"));
+        ASSERT_TRUE(document.insertText(CursorPosition(10, 1), "!"));
+    }
+    
+    const std::optional<DamagedLines> damaged = damage.collect();
+    ASSERT_TRUE(damaged.has_value());
+    EXPECT_EQ(damaged->first, 10u);
+    EXPECT_EQ(damaged->last, DamagedLines::TO_END);
+    
+    damage.invalidateAll();
+    EXPECT_EQ(damage.collect()->first, 0u);
+}
@@ -0,0 +1,347 @@
+#include <gtest/gtest.h>
+#include "client/document_client.h"
+#include "client/network/client_manager.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace collab;
+using namespace collab::client;
+
+// The client manager is not connected here: what a document sends waits
+// on its stream, and what the server would send is delivered to the stream.
+
+namespace {
+
+protocol::DocumentMessage opened(const std::string& documentId, const std::string& content, uint64_t version) {
+    protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+    response.documentId = documentId;
+    response.documentContent = content;
+    response.documentVersion = version;
+    response.success = true;
+    return response;
+}
+
+protocol::EditMessage remoteInsert(const std::string& documentId, size_t position, const std::string& text) {
+    protocol::EditMessage edit(protocol::MessageType::EDIT_INSERT);
+    edit.documentId = documentId;
+    edit.position = position;
+    edit.text = text;
+    return edit;
+}
+
+std::filesystem::path journalPath(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+protocol::EditMessage applied(const std::string& documentId) {
+    protocol::EditMessage ack(protocol::MessageType::EDIT_APPLY);
+    ack.documentId = documentId;
+    ack.success = true;
+    return ack;
+}
+
+} // namespace
+
+TEST(DocumentClientTest, ConnectOpensTheDocumentAsAStream) {
+    ClientManager& manager = ClientManager::getInstance();
+    const size_t before = manager.streams().pending();
+    {
+        DocumentClient client;
+        ASSERT_TRUE(client.connect(manager, "document-client-open"));
+        EXPECT_TRUE(client.isConnected());
+        EXPECT_TRUE(manager.streams().isOpen("document-client-open"));
+        // The DOC_OPEN waits on the stream
+        EXPECT_EQ(manager.streams().pending(), before + 1);
+
+        DocumentClient other;
+        EXPECT_FALSE(other.connect(manager, "document-client-open"));
+        EXPECT_FALSE(other.isConnected());
+    }
+    EXPECT_FALSE(manager.streams().isOpen("document-client-open"));
+    EXPECT_EQ(manager.streams().pending(), before);
+}
+
+TEST(DocumentClientTest, AnUnreachableServerLeavesTheDocumentOpenForTheRetry) {
+    // A port nothing listens on
+    unsigned short port = 0;
+    {
+        boost::asio::io_context io;
+        boost::asio::ip::tcp::acceptor acceptor(io, {boost::asio::ip::make_address("127.0.0.1"), 0});
+        port = acceptor.local_endpoint().port();
+    }
+
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    std::string status;
+    client.setCallbacks(nullptr, [&](const std::string& message) { status = message; });
+    EXPECT_FALSE(client.connect("127.0.0.1", "not a port"));
+    EXPECT_FALSE(manager.streams().isOpen(DocumentClient::SERVER_DOCUMENT_ID));
+
+    EXPECT_FALSE(client.connect("127.0.0.1", std::to_string(port)));
+    EXPECT_NE(status.find("retrying"), std::string::npos);
+    EXPECT_TRUE(manager.streams().isOpen(DocumentClient::SERVER_DOCUMENT_ID));
+    ASSERT_TRUE(client.insert(0, "offline"));
+
+    // Stops the retries along with the document
+    client.disconnect();
+    EXPECT_FALSE(manager.streams().isOpen(DocumentClient::SERVER_DOCUMENT_ID));
+    EXPECT_FALSE(manager.isConnected());
+    EXPECT_EQ(client.getContent(), "offline");
+}
+
+TEST(DocumentClientTest, TheServersDocumentReplacesTheLocalOne) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client("draft");
+    std::vector<ot::OperationPtr> applied;
+    client.setOperationCallback([&](const ot::OperationPtr& op) { applied.push_back(op); });
+    ASSERT_TRUE(client.connect(manager, "document-client-load"));
+
+    manager.streams().deliver(opened("document-client-load", "hello", 7));
+
+    EXPECT_EQ(client.getContent(), "hello");
+    ASSERT_EQ(applied.size(), 1u);
+    std::string mirrored = "draft";
+    ASSERT_TRUE(applied[0]->apply(mirrored));
+    EXPECT_EQ(mirrored, "hello");
+}
+
+TEST(DocumentClientTest, EditsMadeWhileOneIsUnconfirmedGoOutOnTheAck) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    ASSERT_TRUE(client.connect(manager, "document-client-ack"));
+    manager.streams().deliver(opened("document-client-ack", "hello", 3));
+    const size_t start = manager.streams().pending();
+
+    ASSERT_TRUE(client.insert(5, " world"));
+    client.flushPending(true);
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+
+    // Buffered behind the edit in flight, composed into one
+    ASSERT_TRUE(client.insert(11, "!"));
+    client.flushPending(true);
+    ASSERT_TRUE(client.insert(0, ">"));
+    client.flushPending(true);
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+
+    manager.streams().deliver(applied("document-client-ack"));
+    EXPECT_EQ(manager.streams().pending(), start + 2);
+
+    // Nothing left in flight after the second ack, so a stray one changes nothing
+    manager.streams().deliver(applied("document-client-ack"));
+    manager.streams().deliver(applied("document-client-ack"));
+    EXPECT_EQ(manager.streams().pending(), start + 2);
+    EXPECT_EQ(client.getContent(), ">hello world!");
+}
+
+TEST(DocumentClientTest, RemoteEditsAreTransformedPastUnconfirmedOnes) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    std::vector<ot::OperationPtr> applied;
+    ASSERT_TRUE(client.connect(manager, "document-client-remote"));
+    manager.streams().deliver(opened("document-client-remote", "hello", 1));
+    client.setOperationCallback([&](const ot::OperationPtr& op) { applied.push_back(op); });
+
+    ASSERT_TRUE(client.insert(0, ">> "));
+    // Based on the server's "hello", without the unconfirmed insert
+    manager.streams().deliver(remoteInsert("document-client-remote", 5, "!"));
+
+    EXPECT_EQ(client.getContent(), ">> hello!");
+
+    // The mirror sees each edit as it applies to the content
+    std::string mirrored = "hello";
+    for (const auto& op : applied) {
+        ASSERT_TRUE(op->apply(mirrored));
+    }
+    EXPECT_EQ(mirrored, ">> hello!");
+}
+
+TEST(DocumentClientTest, UndoIsSentLikeAnyEdit) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    ASSERT_TRUE(client.connect(manager, "document-client-undo"));
+    manager.streams().deliver(opened("document-client-undo", "", 1));
+    const size_t start = manager.streams().pending();
+
+    ASSERT_TRUE(client.insert(0, "typo"));
+    client.flushPending(true);
+    manager.streams().deliver(applied("document-client-undo"));
+    ASSERT_TRUE(client.canUndo());
+    ASSERT_TRUE(client.undo());
+    client.flushPending(true);
+
+    EXPECT_EQ(client.getContent(), "");
+    EXPECT_EQ(manager.streams().pending(), start + 2);
+    EXPECT_TRUE(client.canRedo());
+}
+
+TEST(DocumentClientTest, TypingIsHeldUntilTheFlushWindowAndSentAsOneEdit) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    ot::CoalescingPolicy policy;
+    policy.flushWindow = std::chrono::hours(1);
+    client.setCoalescingPolicy(policy);
+    ASSERT_TRUE(client.connect(manager, "document-client-coalesce"));
+    manager.streams().deliver(opened("document-client-coalesce", "", 1));
+    const size_t start = manager.streams().pending();
+
+    for (char c : std::string("hello")) {
+        ASSERT_TRUE(client.insert(client.getContent().size(), std::string(1, c)));
+    }
+    ASSERT_TRUE(client.deleteText(4, 1));
+
+    // Applied locally at once, sent only when the window is up
+    EXPECT_EQ(client.getContent(), "hell");
+    client.flushPending();
+    EXPECT_EQ(manager.streams().pending(), start);
+
+    client.flushPending(true);
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+
+    // Nothing buffered is left to send
+    client.flushPending(true);
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+}
+
+TEST(DocumentClientTest, AFullBufferIsSentWithoutWaitingForATick) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    ot::CoalescingPolicy policy;
+    policy.flushWindow = std::chrono::hours(1);
+    policy.maxPendingOperations = 3;
+    client.setCoalescingPolicy(policy);
+    ASSERT_TRUE(client.connect(manager, "document-client-full"));
+    manager.streams().deliver(opened("document-client-full", "", 1));
+    const size_t start = manager.streams().pending();
+
+    ASSERT_TRUE(client.insert(0, "a"));
+    ASSERT_TRUE(client.insert(1, "b"));
+    EXPECT_EQ(manager.streams().pending(), start);
+    ASSERT_TRUE(client.insert(2, "c"));
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+}
+
+TEST(DocumentClientTest, BufferedEditsAreAccountedForBeforeARemoteOne) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    ot::CoalescingPolicy policy;
+    policy.flushWindow = std::chrono::hours(1);
+    client.setCoalescingPolicy(policy);
+    ASSERT_TRUE(client.connect(manager, "document-client-buffered"));
+    manager.streams().deliver(opened("document-client-buffered", "world", 1));
+    const size_t start = manager.streams().pending();
+
+    ASSERT_TRUE(client.insert(0, "hello "));
+    manager.streams().deliver(remoteInsert("document-client-buffered", 5, "!"));
+
+    EXPECT_EQ(client.getContent(), "hello world!");
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+}
+
+TEST(DocumentClientTest, RemoteEditsWaitForTheUiThreadAndApplyAsOne) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    int wakes = 0;
+    client.setRemoteWakeup([&]() { ++wakes; });
+    ASSERT_TRUE(client.connect(manager, "document-client-handoff"));
+
+    manager.streams().deliver(opened("document-client-handoff", "hello", 1));
+    std::vector<ot::OperationPtr> applied;
+    client.setOperationCallback([&](const ot::OperationPtr& op) { applied.push_back(op); });
+    manager.streams().deliver(remoteInsert("document-client-handoff", 5, " world"));
+    manager.streams().deliver(remoteInsert("document-client-handoff", 11, "!"));
+
+    // Nothing is applied on the network thread, and the UI is woken once
+    EXPECT_EQ(client.getContent(), "");
+    EXPECT_EQ(wakes, 1);
+
+    EXPECT_EQ(client.applyRemoteOperations(), 2u);
+    EXPECT_EQ(client.getContent(), "hello world!");
+    // The document, then the run of edits as one
+    ASSERT_EQ(applied.size(), 2u);
+    EXPECT_EQ(client.applyRemoteOperations(), 0u);
+
+    manager.streams().deliver(remoteInsert("document-client-handoff", 0, ">"));
+    EXPECT_EQ(wakes, 2);
+}
+
+TEST(DocumentClientTest, AnAckEndsARunOfRemoteEdits) {
+    ClientManager& manager = ClientManager::getInstance();
+    DocumentClient client;
+    client.setRemoteWakeup([]() {});
+    ASSERT_TRUE(client.connect(manager, "document-client-handoff-ack"));
+    manager.streams().deliver(opened("document-client-handoff-ack", "hello", 1));
+    client.applyRemoteOperations();
+
+    ASSERT_TRUE(client.insert(0, ">"));
+    client.flushPending(true);
+
+    // The server applied another client's edit before ours, then one after it
+    manager.streams().deliver(remoteInsert("document-client-handoff-ack", 5, "!"));
+    manager.streams().deliver(applied("document-client-handoff-ack"));
+    manager.streams().deliver(remoteInsert("document-client-handoff-ack", 7, "?"));
+
+    EXPECT_EQ(client.applyRemoteOperations(), 2u);
+    EXPECT_EQ(client.getContent(), ">hello!?");
+}
+
+TEST(DocumentClientTest, EditsMadeOfflineAreRecoveredAndSentOnOpen) {
+    const auto path = journalPath("collabedit_document_client.jnl");
+    {
+        DocumentClient offline("hello");
+        ASSERT_TRUE(offline.setOfflineJournal(path.string()));
+        ASSERT_TRUE(offline.insert(5, " world"));
+        ASSERT_TRUE(offline.insert(0, ">"));
+        offline.flushPending(true);
+    }
+
+    // The next run starts from the same document and finds the edits on disk
+    DocumentClient client("hello");
+    std::vector<ot::OperationPtr> recovered;
+    client.setOperationCallback([&](const ot::OperationPtr& op) { recovered.push_back(op); });
+    ASSERT_TRUE(client.setOfflineJournal(path.string()));
+    EXPECT_EQ(client.getContent(), ">hello world");
+    ASSERT_EQ(recovered.size(), 1u);
+
+    // Opening the document sends them as one edit rather than loading the server's copy over them
+    ClientManager& manager = ClientManager::getInstance();
+    ASSERT_TRUE(client.connect(manager, "document-client-journal"));
+    const size_t start = manager.streams().pending();
+    manager.streams().deliver(opened("document-client-journal", "hello", 0));
+    EXPECT_EQ(client.getContent(), ">hello world");
+    EXPECT_EQ(manager.streams().pending(), start + 1);
+
+    // Confirmed, they are gone from the journal
+    manager.streams().deliver(applied("document-client-journal"));
+    client.disconnect();
+    EXPECT_TRUE(ot::OfflineJournal(path).empty());
+    std::filesystem::remove(path);
+}
+
+TEST(DocumentClientTest, JournalEditsForAnotherDocumentAreNotApplied) {
+    const auto path = journalPath("collabedit_document_client_other.jnl");
+    {
+        DocumentClient offline("hello");
+        ASSERT_TRUE(offline.setOfflineJournal(path.string()));
+        ASSERT_TRUE(offline.insert(5, "!"));
+        offline.flushPending(true);
+    }
+
+    DocumentClient client("something else");
+    ASSERT_TRUE(client.setOfflineJournal(path.string()));
+    EXPECT_EQ(client.getContent(), "something else");
+    std::filesystem::remove(path);
+}
+
+TEST(DocumentClientTest, AJournalThatCannotBeOpenedIsRefused) {
+    DocumentClient client;
+    std::string status;
+    client.setCallbacks(nullptr, [&](const std::string& message) { status = message; });
+    EXPECT_FALSE(client.setOfflineJournal("/nonexistent-collabedit-dir/journal.jnl"));
+    EXPECT_NE(status.find("offline journal"), std::string::npos);
+}
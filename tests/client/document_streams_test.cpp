@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "client/network/document_streams.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace collab::client;
+using namespace collab::protocol;
+using namespace std::chrono_literals;
+
+namespace {
+
+std::shared_ptr<const Message> editFor(const std::string& documentId, const std::string& text) {
+    auto edit = std::make_shared<EditMessage>(MessageType::EDIT_INSERT);
+    edit->documentId = documentId;
+    edit->text = text;
+    return edit;
+}
+
+} // namespace
+
+TEST(DocumentStreamsTest, RoutesReceivedMessagesByDocument) {
+    DocumentStreams streams([](const Message&) {});
+    std::vector<std::string> seen;
+    ASSERT_TRUE(streams.open("a", [&](const Message& message) { seen.push_back("a:" + std::to_string(static_cast<int>(message.type))); }));
+    ASSERT_TRUE(streams.open("b", [&](const Message&) { seen.push_back("b"); }));
+    EXPECT_FALSE(streams.open("a", nullptr));
+    EXPECT_EQ(streams.streamCount(), 2u);
+
+    EXPECT_TRUE(streams.deliver(*editFor("a", "x")));
+    SyncMessage sync(MessageType::SYNC_RESPONSE);
+    sync.documentId = "b";
+    EXPECT_TRUE(streams.deliver(sync));
+    EXPECT_FALSE(streams.deliver(*editFor("c", "x")));
+    EXPECT_FALSE(streams.deliver(AuthMessage(MessageType::AUTH_SUCCESS)));
+
+    streams.close("a");
+    EXPECT_FALSE(streams.deliver(*editFor("a", "y")));
+    EXPECT_EQ(seen, (std::vector<std::string>{"a:300", "b"}));
+}
+
+TEST(DocumentStreamsTest, TakesTurnsBetweenStreams) {
+    std::vector<std::string> written;
+    DocumentStreams streams([&](const Message& message) {
+        const auto& edit = dynamic_cast<const EditMessage&>(message);
+        written.push_back(edit.documentId + *edit.text);
+    }, 2);
+    streams.open("backlog", nullptr);
+    streams.open("typing", nullptr);
+    for (int i = 0; i < 6; ++i) {
+        streams.send("backlog", editFor("backlog", std::to_string(i)));
+    }
+    streams.send("typing", editFor("typing", "0"));
+    EXPECT_FALSE(streams.send("closed", editFor("closed", "0")));
+    EXPECT_EQ(streams.pending(), 7u);
+
+    // The keystroke goes out after two of the backlog, not after all six
+    EXPECT_EQ(streams.flush(3), 3u);
+    EXPECT_EQ(written, (std::vector<std::string>{"backlog0", "backlog1", "typing0"}));
+
+    // The next flush picks up where this one stopped
+    streams.send("typing", editFor("typing", "1"));
+    EXPECT_EQ(streams.flush(1), 1u);
+    EXPECT_EQ(written.back(), "backlog2");
+    EXPECT_EQ(streams.flush(), 4u);
+    EXPECT_EQ(written, (std::vector<std::string>{"backlog0", "backlog1", "typing0", "backlog2", "backlog3",
+                                                 "typing1", "backlog4", "backlog5"}));
+
+    // Closing a stream drops what it had not written
+    streams.send("backlog", editFor("backlog", "6"));
+    streams.close("backlog");
+    EXPECT_EQ(streams.pending(), 0u);
+    EXPECT_EQ(streams.flush(), 0u);
+}
+
+TEST(DocumentStreamsTest, SendsOneHeartbeatForAllStreamsWhenQuiet) {
+    std::vector<MessageType> written;
+    DocumentStreams streams([&](const Message& message) { written.push_back(message.type); });
+    streams.open("a", nullptr);
+    streams.open("b", nullptr);
+
+    const auto start = DocumentStreams::Clock::now();
+    EXPECT_FALSE(streams.keepalive(15s, start));
+    EXPECT_TRUE(streams.keepalive(15s, start + 16s));
+    EXPECT_FALSE(streams.keepalive(15s, start + 20s));
+    EXPECT_EQ(written, std::vector<MessageType>{MessageType::SYS_HEARTBEAT});
+}
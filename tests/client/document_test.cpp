@@ -0,0 +1,494 @@
+#include <gtest/gtest.h>
+#include "client/editor/document.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+using namespace collab::document;
+
+TEST(PieceTableTest, FindsLinesAndOffsets) {
+    PieceTable table("ab\n\ncde");
+    
+    EXPECT_EQ(table.length(), 7);
+    EXPECT_EQ(table.lineCount(), 3);
+    EXPECT_EQ(table.lineStart(1), 3);
+    EXPECT_EQ(table.lineStart(2), 4);
+    EXPECT_EQ(table.lineLength(2), 3);
+    EXPECT_EQ(table.lineAt(2), 0);  // The newline ending line 0
+    EXPECT_EQ(table.lineAt(3), 1);
+    EXPECT_EQ(table.lineAt(7), 2);
+    
+    table.insert(3, "wxyz");
+    EXPECT_EQ(table.lineStart(2), 8);
+    EXPECT_EQ(table.lineAt(7), 1);
+    EXPECT_EQ(table.length(), 11);
+    EXPECT_EQ(table.text(), "ab\nwxyz\ncde");
+}
+
+TEST(PieceTableTest, MatchesAStringUnderRandomEdits) {
+    std::string expected = "first\nsecond\n\nfourth";
+    PieceTable table(expected);
+    std::mt19937 random(7);
+    for (int i = 0; i < 2000; ++i) {
+        const size_t offset = random() % (expected.size() + 1);
+        if (random() % 3 != 0) {
+            const std::string text = random() % 4 == 0 ? "\n" : std::string(1 + random() % 3, static_cast<char>('a' + i % 26));
+            table.insert(offset, text);
+            expected.insert(offset, text);
+        } else {
+            const size_t count = random() % 5;
+            table.erase(offset, count);
+            expected.erase(offset, count);
+        }
+    }
+    
+    ASSERT_EQ(table.text(), expected);
+    size_t line = 0;
+    size_t lineStart = 0;
+    for (size_t offset = 0; offset <= expected.size(); ++offset) {
+        ASSERT_EQ(table.lineAt(offset), line);
+        if (offset < expected.size() && expected[offset] == '\n') {
+            ASSERT_EQ(table.lineLength(line), offset - lineStart);
+            ++line;
+            lineStart = offset + 1;
+            ASSERT_EQ(table.lineStart(line), lineStart);
+        }
+    }
+    EXPECT_EQ(table.lineCount(), line + 1);
+}
+
+TEST(PieceTableTest, TypingGrowsOnePiece) {
+    PieceTable table("0123456789");
+    for (size_t i = 0; i < 100; ++i) {
+        table.insert(5 + i, "x");
+    }
+    
+    // One split of the original, and one piece for everything typed
+    EXPECT_EQ(table.pieceCount(), 3);
+    EXPECT_EQ(table.substr(4, 3), "4xx");
+}
+
+TEST(DocumentTest, ConversionsFollowEdits) {
+    Document document;
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += (i ? "\nline " : "line ") + std::to_string(i);
+    }
+    document.setText(text);
+    ASSERT_EQ(document.getTextLength(), text.size());
+    
+    ASSERT_TRUE(document.insertText(CursorPosition(10, 2), "xyz"));
+    ASSERT_TRUE(document.deleteText(CursorPosition(50, 0), 3));
+    ASSERT_TRUE(document.insertText(CursorPosition(20, 0), "a\nb\n"));
+    ASSERT_TRUE(document.deleteText(CursorPosition(30, 4), 3));
+    
+    const std::string current = document.getText();
+    ASSERT_EQ(document.getTextLength(), current.size());
+    for (size_t position = 0; position <= current.size(); position += 7) {
+        CursorPosition cursor = document.linearToCursor(position);
+        EXPECT_EQ(document.cursorToLinear(cursor), position);
+        size_t lineStart = current.rfind('\n', position == 0 ? 0 : position - 1);
+        lineStart = (lineStart == std::string::npos || position == 0) ? 0 : lineStart + 1;
+        EXPECT_EQ(cursor.column, position - lineStart);
+    }
+    EXPECT_EQ(document.linearToCursor(current.size() + 5),
+              CursorPosition(document.getLineCount() - 1, document.getLine(document.getLineCount() - 1).size()));
+}
+
+TEST(DocumentTest, RangesWalkOnlyTheLinesTheyTouch) {
+    Document document;
+    document.setText("one\ntwo\nthree");
+    
+    EXPECT_EQ(document.getTextRange(CursorPosition(0, 1), 6), "ne\ntwo");
+    EXPECT_EQ(document.getTextRange(CursorPosition(2, 2), CursorPosition(1, 1)), "wo\nth");
+    EXPECT_EQ(document.getTextRange(CursorPosition(1, 0), 100), "two\nthree");
+    
+    std::string visited;
+    document.visitTextRange(CursorPosition(0, 3), 5, [&](std::string_view piece) { visited.append(piece); });
+    EXPECT_EQ(visited, "\ntwo\n");
+    
+    ASSERT_TRUE(document.deleteText(CursorPosition(0, 2), 7));
+    EXPECT_EQ(document.getText(), "onhree");
+    EXPECT_EQ(document.getLineCount(), 1);
+    EXPECT_EQ(document.getTextLength(), 6);
+}
+
+TEST(DocumentTest, ReplaceSpansLines) {
+    Document document;
+    document.setText("one\ntwo\nthree\n");
+    EXPECT_EQ(document.getLineCount(), 4);
+    
+    ASSERT_TRUE(document.replaceText(CursorPosition(0, 2), 7, "w\nt"));
+    EXPECT_EQ(document.getText(), "onw\nthree\n");
+    EXPECT_EQ(document.getLine(1), "three");
+    EXPECT_EQ(document.getOperationHistory().back().getType(), OperationType::REPLACE);
+}
+
+TEST(DocumentTest, UpdateTextReplacesOnlyWhatChanged) {
+    Document document;
+    document.setText("one\ntwo\nthree\nfour\n");
+    std::vector<DocumentOperation> operations;
+    std::vector<ChangeSummary> summaries;
+    document.addChangeListener([&](const DocumentOperation& op) { operations.push_back(op); });
+    document.addChangeSummaryListener([&](const ChangeSummary& summary) { summaries.push_back(summary); });
+    const size_t history = document.getOperationHistory().size();
+    
+    EXPECT_EQ(document.updateText("one\nTWO\nthree\nfour and more\n"), 2u);
+    EXPECT_EQ(document.getText(), "one\nTWO\nthree\nfour and more\n");
+    
+    // Two spans, each a replace at its own position, notified as one batch
+    ASSERT_EQ(operations.size(), 2u);
+    EXPECT_EQ(operations[0].getPosition().line, 1u);
+    EXPECT_EQ(operations[0].getText(), "TWO");
+    EXPECT_EQ(operations[0].getLength(), 3u);
+    EXPECT_EQ(operations[1].getPosition().line, 3u);
+    EXPECT_EQ(operations[1].getPosition().column, 4u);
+    EXPECT_EQ(operations[1].getText(), " and more");
+    EXPECT_NE(operations[0].getTimestamp(), operations[1].getTimestamp());
+    ASSERT_EQ(summaries.size(), 1u);
+    EXPECT_EQ(summaries[0].start, 4u);
+    EXPECT_EQ(document.getOperationHistory().size(), history + 2);
+    
+    // The same text again changes nothing
+    const uint64_t version = document.getVersion();
+    EXPECT_EQ(document.updateText(document.getText()), 0u);
+    EXPECT_EQ(document.getVersion(), version);
+    EXPECT_EQ(operations.size(), 2u);
+}
+
+TEST(DocumentTest, OperationsCarryTextAndUser) {
+    Document document;
+    const std::string user = "6f1c0e2a-93b4-4d7e-8a5f-2c9d4b7e1a30";
+    const std::string paste(40, 'p');
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 0), "k", user));
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 1), paste, "other"));
+    
+    const auto& history = document.getOperationHistory();
+    ASSERT_EQ(history.size(), 2u);
+    EXPECT_EQ(history[0].getText(), "k");
+    EXPECT_EQ(history[0].getUserId(), user);
+    EXPECT_EQ(history[1].getText(), paste);
+    EXPECT_EQ(history[1].getUserId(), "other");
+    
+    // Copies, as undo stacks and listeners make, keep both
+    const DocumentOperation copy = history[1];
+    EXPECT_EQ(copy.getText(), paste);
+    EXPECT_EQ(copy.getUserId(), "other");
+}
+
+TEST(DocumentTest, LoadsAFileWithoutRecordingAnEdit) {
+    const std::string path = testing::TempDir() + "document_test_load.txt";
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (int i = 0; i < 1000; ++i) {
+            out << "line " << i << '\n';
+        }
+    }
+    
+    Document document;
+    document.setText("before");
+    ASSERT_TRUE(document.loadFile(path));
+    std::remove(path.c_str());
+    
+    EXPECT_EQ(document.getLineCount(), 1001);
+    EXPECT_EQ(document.getLine(500), "line 500");
+    EXPECT_TRUE(document.getOperationHistory().empty());
+    EXPECT_FALSE(document.loadFile(path));
+    EXPECT_EQ(document.getLine(999), "line 999");
+}
+
+TEST(DocumentTest, StreamsAFileInAndOut) {
+    const std::string path = testing::TempDir() + "document_test_stream.txt";
+    std::string expected;
+    for (int i = 0; i < 200000; ++i) {
+        expected += "entry " + std::to_string(i) + "\n";
+    }
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << expected;
+    }
+    
+    Document document;
+    std::vector<uint64_t> progress;
+    ASSERT_TRUE(document.loadFile(path, [&](uint64_t done, uint64_t total) {
+        EXPECT_EQ(total, expected.size());
+        progress.push_back(done);
+    }));
+    EXPECT_GT(progress.size(), 1u);
+    EXPECT_EQ(progress.back(), expected.size());
+    EXPECT_EQ(document.getLineCount(), 200001);
+    EXPECT_EQ(document.getLine(123456), "entry 123456");
+    
+    // Edit, then write it back out a chunk at a time
+    document.insertText({0, 0}, "head\n");
+    uint64_t written = 0;
+    ASSERT_TRUE(document.saveFile(path, [&](uint64_t done, uint64_t) { written = done; }));
+    EXPECT_EQ(written, expected.size() + 5);
+    
+    Document reread;
+    ASSERT_TRUE(reread.loadFile(path));
+    std::remove(path.c_str());
+    EXPECT_EQ(reread.getText(), "head\n" + expected);
+    EXPECT_FALSE(document.saveFile(testing::TempDir() + "missing_dir/x.txt"));
+}
+
+TEST(DocumentTest, ChunkedLoadFillsPlaceholders) {
+    const std::string text = "alpha\nbeta\ngamma\ndelta";
+    Document document;
+    document.beginChunkedLoad(text.size());
+    EXPECT_FALSE(document.isFullyLoaded());
+    EXPECT_EQ(document.getTextLength(), text.size());
+    
+    // The viewport arrives first and is edited before the rest is in
+    ASSERT_TRUE(document.loadChunk(6, text.substr(6, 5)));
+    EXPECT_TRUE(document.isRangeLoaded(CursorPosition(0, 6), 4));
+    EXPECT_FALSE(document.isRangeLoaded(CursorPosition(0, 0), 7));
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 8), "!!"));
+    
+    ASSERT_TRUE(document.loadChunk(11, text.substr(11)));
+    ASSERT_TRUE(document.loadChunk(0, text.substr(0, 6)));
+    EXPECT_FALSE(document.loadChunk(20, "too long for the document"));
+    
+    EXPECT_TRUE(document.isFullyLoaded());
+    EXPECT_EQ(document.getText(), "alpha\nbe!!ta\ngamma\ndelta");
+    EXPECT_EQ(document.getLineCount(), 4);
+    EXPECT_EQ(document.getLine(1), "be!!ta");
+    EXPECT_EQ(document.linearToCursor(13), CursorPosition(2, 0));
+}
+
+TEST(DocumentTest, BatchNotifiesOnceWithTheChangedRange) {
+    Document document;
+    document.setText("hello world");
+    std::vector<DocumentOperation> operations;
+    std::vector<ChangeSummary> summaries;
+    document.addChangeListener([&](const DocumentOperation& op) { operations.push_back(op); });
+    document.addChangeSummaryListener([&](const ChangeSummary& summary) { summaries.push_back(summary); });
+    
+    const std::string before = document.getText();
+    {
+        Document::Batch batch(document);
+        ASSERT_TRUE(document.insertText(CursorPosition(0, 0), "A"));
+        ASSERT_TRUE(document.deleteText(CursorPosition(0, 7), 3));
+        EXPECT_TRUE(operations.empty());
+        EXPECT_TRUE(summaries.empty());
+    }
+    
+    ASSERT_EQ(operations.size(), 2u);
+    ASSERT_EQ(summaries.size(), 1u);
+    const ChangeSummary& summary = summaries[0];
+    EXPECT_EQ(summary.operations, 2u);
+    
+    // Splicing the new range into the old text gives the new text
+    const std::string after = document.getText();
+    EXPECT_EQ(after, "Ahello ld");
+    EXPECT_EQ(before.substr(0, summary.start) + after.substr(summary.start, summary.added) +
+              before.substr(summary.start + summary.removed), after);
+    
+    // Outside a batch every edit is its own summary
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 9), "!"));
+    ASSERT_EQ(summaries.size(), 2u);
+    EXPECT_EQ(summaries[1].start, 9u);
+    EXPECT_EQ(summaries[1].added, 1u);
+    EXPECT_EQ(summaries[1].operations, 1u);
+}
+
+TEST(PieceTableTest, EditsOverABaseHeldElsewhere) {
+    const std::string base = "first\nsecond\nthird";
+    const std::vector<uint64_t> breaks{5, 12};
+    PieceTable table;
+    table.assignBase(base, breaks, std::make_shared<int>(0));
+    
+    EXPECT_EQ(table.lineCount(), 3);
+    EXPECT_EQ(table.lineStart(2), 13);
+    table.insert(6, "inserted\n");
+    table.erase(0, 2);
+    EXPECT_EQ(table.text(), "rst\ninserted\nsecond\nthird");
+    EXPECT_EQ(table.lineCount(), 4);
+    EXPECT_EQ(table.lineAt(14), 2);
+    EXPECT_FALSE(table.fillOriginal(0, "xx"));
+    
+    table.assign("own");
+    EXPECT_EQ(table.text(), "own");
+}
+
+TEST(DocumentTest, LoadsASnapshotInPlace) {
+    const auto path = std::filesystem::temp_directory_path() / "collabedit_document_snapshot.snap";
+    std::filesystem::remove(path);
+    Document source;
+    source.setText("alpha\nbeta\ngamma");
+    ASSERT_TRUE(source.saveSnapshot(path, 7, "meta"));
+    
+    Document document;
+    EXPECT_EQ(document.loadSnapshot(path.string() + ".missing"), nullptr);
+    auto snapshot = document.loadSnapshot(path);
+    ASSERT_NE(snapshot, nullptr);
+    EXPECT_EQ(snapshot->revision(), 7);
+    EXPECT_EQ(snapshot->metadata(), "meta");
+    EXPECT_EQ(document.getLineCount(), 3);
+    EXPECT_EQ(document.getLine(1), "beta");
+    EXPECT_TRUE(document.getOperationHistory().empty());
+    
+    ASSERT_TRUE(document.insertText(CursorPosition(2, 5), "!"));
+    EXPECT_EQ(document.getText(), "alpha\nbeta\ngamma!");
+    snapshot.reset();
+    EXPECT_EQ(document.getLine(0), "alpha");
+}
+
+namespace {
+
+// UTF-16 units and code points before each byte offset of valid UTF-8, counted a byte at a time
+struct Positions {
+    std::vector<size_t> utf16;
+    std::vector<size_t> codePoints;
+};
+
+Positions positionsOf(const std::string& text) {
+    Positions positions;
+    size_t units = 0;
+    size_t codePoints = 0;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        positions.utf16.push_back(units);
+        positions.codePoints.push_back(codePoints);
+        if (i < text.size()) {
+            const auto byte = static_cast<unsigned char>(text[i]);
+            if ((byte & 0xC0) != 0x80) {
+                ++codePoints;
+                units += byte >= 0xF0 ? 2 : 1;
+            }
+        }
+    }
+    return positions;
+}
+
+void expectUnitsMatch(const PieceTable& table, const std::string& text) {
+    const Positions positions = positionsOf(text);
+    ASSERT_EQ(table.utf16Length(), positions.utf16.back());
+    ASSERT_EQ(table.codePointCount(), positions.codePoints.back());
+    for (size_t offset = 0; offset <= text.size(); ++offset) {
+        if (offset < text.size() && (static_cast<unsigned char>(text[offset]) & 0xC0) == 0x80) {
+            continue;
+        }
+        ASSERT_EQ(table.utf16OffsetOf(offset), positions.utf16[offset]) << "offset " << offset;
+        ASSERT_EQ(table.codePointOffsetOf(offset), positions.codePoints[offset]) << "offset " << offset;
+        ASSERT_EQ(table.offsetOfUtf16(positions.utf16[offset]), offset) << "offset " << offset;
+        ASSERT_EQ(table.offsetOfCodePoint(positions.codePoints[offset]), offset) << "offset " << offset;
+    }
+}
+
+} // namespace
+
+TEST(PieceTableTest, MapsUtf16AndCodePointsUnderRandomEdits) {
+    // ASCII, Latin, CJK and an emoji, the last a surrogate pair in UTF-16
+    const std::string samples[] = {"a", "\n", "\xc3\xa9", "\xe4\xb8\xad\xe6\x96\x87", "\xf0\x9f\x98\x80"};
+    std::mt19937 random(11);
+    std::string expected;
+    for (int i = 0; i < 2000; ++i) {
+        expected += samples[random() % 5];
+    }
+    PieceTable table(expected);
+    expectUnitsMatch(table, expected);
+    
+    // Edits at character boundaries keep the index the first conversion built
+    auto boundary = [&expected, &random] {
+        size_t offset = random() % (expected.size() + 1);
+        while (offset < expected.size() && (static_cast<unsigned char>(expected[offset]) & 0xC0) == 0x80) {
+            ++offset;
+        }
+        return offset;
+    };
+    for (int i = 0; i < 400; ++i) {
+        const size_t offset = boundary();
+        if (random() % 3 != 0) {
+            std::string text;
+            for (size_t n = 1 + random() % 4; n > 0; --n) {
+                text += samples[random() % 5];
+            }
+            table.insert(offset, text);
+            expected.insert(offset, text);
+        } else {
+            const size_t end = std::max(offset, boundary());
+            table.erase(offset, end - offset);
+            expected.erase(offset, end - offset);
+        }
+        if (i % 100 == 0) {
+            expectUnitsMatch(table, expected);
+        }
+    }
+    ASSERT_EQ(table.text(), expected);
+    expectUnitsMatch(table, expected);
+    
+    // Inside a surrogate pair maps to the start of its character
+    const size_t emoji = expected.find("\xf0\x9f\x98\x80");
+    ASSERT_NE(emoji, std::string::npos);
+    EXPECT_EQ(table.offsetOfUtf16(table.utf16OffsetOf(emoji) + 1), emoji);
+    EXPECT_EQ(table.offsetOfUtf16(table.utf16Length() + 5), expected.size());
+}
+
+TEST(PieceTableTest, UnitIndexFollowsChunkedFill) {
+    std::string text;
+    for (int i = 0; i < 600; ++i) {
+        text += i % 3 == 0 ? "\xe4\xb8\xad" : "ab";
+    }
+    PieceTable table;
+    table.reserveOriginal(text.size());
+    // Placeholders count one unit each until they are filled
+    EXPECT_EQ(table.utf16Length(), text.size());
+    table.insert(0, "\xf0\x9f\x98\x80");
+    
+    ASSERT_TRUE(table.fillOriginal(500, text.substr(500, 500)));
+    ASSERT_TRUE(table.fillOriginal(0, text.substr(0, 500)));
+    ASSERT_TRUE(table.fillOriginal(1000, text.substr(1000)));
+    expectUnitsMatch(table, "\xf0\x9f\x98\x80" + text);
+}
+
+TEST(DocumentTest, ConvertsUtf16OffsetsForRemoteClients) {
+    Document document;
+    document.setText("\xe4\xbd\xa0\xe5\xa5\xbd\n\xf0\x9f\x98\x80 ok");
+    
+    // U+4F60 U+597D, a newline, then U+1F600, which takes two UTF-16 units
+    EXPECT_EQ(document.linearToUtf16(6), 2);
+    EXPECT_EQ(document.linearToUtf16(7), 3);
+    EXPECT_EQ(document.linearToUtf16(11), 5);
+    EXPECT_EQ(document.utf16ToLinear(5), 11);
+    EXPECT_EQ(document.utf16ToLinear(4), 7);
+    EXPECT_EQ(document.linearToCodePoint(11), 4);
+    EXPECT_EQ(document.codePointToLinear(4), 11);
+    
+    // The index follows edits
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 3), "\xc3\xa9"));
+    EXPECT_EQ(document.utf16ToLinear(2), 5);
+    EXPECT_EQ(document.linearToUtf16(document.getTextLength()), 9);
+}
+
+TEST(DocumentTest, CursorsAndSelectionsFollowEdits) {
+    Document document("doc");
+    document.setText("one\ntwo\nthree");
+    document.setCursorPosition("alice", CursorPosition(1, 1));
+    document.setCursorPosition("bob", CursorPosition(2, 5));
+    document.setSelection("carol", Selection(CursorPosition(0, 0), CursorPosition(2, 2)));
+
+    // A line inserted above moves everyone down
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 0), "zero\n"));
+    EXPECT_EQ(document.getCursorPosition("alice"), CursorPosition(2, 1));
+    EXPECT_EQ(document.getCursorPosition("bob"), CursorPosition(3, 5));
+    EXPECT_EQ(document.getSelection("carol").start, CursorPosition(1, 0));
+    EXPECT_EQ(document.getSelection("carol").end, CursorPosition(3, 2));
+
+    // Text deleted around a cursor leaves it where the text was; a batch moves them per edit
+    {
+        Document::Batch batch(document);
+        ASSERT_TRUE(document.deleteText(CursorPosition(2, 0), 4));
+        ASSERT_TRUE(document.replaceText(CursorPosition(2, 0), 2, "TH"));
+    }
+    EXPECT_EQ(document.getText(), "zero\none\nTHree");
+    EXPECT_EQ(document.getCursorPosition("alice"), CursorPosition(2, 0));
+    EXPECT_EQ(document.getCursorPosition("bob"), CursorPosition(2, 5));
+    EXPECT_EQ(document.getAllSelections().at("carol").end, CursorPosition(2, 2));
+    EXPECT_EQ(document.getAllCursors().size(), 2u);
+
+    // Moving a cursor by hand still works after edits have moved it
+    document.setCursorPosition("alice", CursorPosition(0, 4));
+    ASSERT_TRUE(document.insertText(CursorPosition(0, 0), ">"));
+    EXPECT_EQ(document.getCursorPosition("alice"), CursorPosition(0, 5));
+}
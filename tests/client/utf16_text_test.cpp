@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include "client/editor/utf16_text.h"
+#include <string>
+
+using namespace collab;
+using namespace collab::document;
+
+namespace {
+
+// What the operation makes of text
+std::string applied(std::string text, const ot::OperationPtr& op) {
+    EXPECT_TRUE(op && op->apply(text));
+    return text;
+}
+
+} // namespace
+
+TEST(Utf16TextTest, TypingAndDeletingBecomeAnInsertAndADelete) {
+    Utf16Text text(ot::Rope("hello"));
+
+    auto typed = text.change(5, 0, " world");
+    ASSERT_TRUE(typed);
+    EXPECT_EQ(typed->getKind(), ot::OperationKind::INSERT);
+
+    auto deleted = text.change(0, 1, "");
+    ASSERT_TRUE(deleted);
+    EXPECT_EQ(deleted->getKind(), ot::OperationKind::DELETE);
+
+    EXPECT_EQ(applied(applied("hello", typed), deleted), "ello world");
+    EXPECT_EQ(text.text().toString(), "ello world");
+    EXPECT_EQ(text.change(3, 0, ""), nullptr);
+}
+
+TEST(Utf16TextTest, AReplacementIsOneOperation) {
+    Utf16Text text(ot::Rope("one two three"));
+    auto op = text.change(4, 3, "2");
+
+    ASSERT_TRUE(op);
+    EXPECT_EQ(op->getKind(), ot::OperationKind::REPLACE);
+    EXPECT_EQ(applied("one two three", op), "one 2 three");
+}
+
+TEST(Utf16TextTest, TextReplacedByItselfIsNoChange) {
+    Utf16Text text(ot::Rope("bold"));
+    EXPECT_EQ(text.change(0, 4, "bold"), nullptr);
+    EXPECT_EQ(text.text().toString(), "bold");
+}
+
+TEST(Utf16TextTest, PositionsCountUtf16UnitsAndOperationsBytes) {
+    // "é" is one unit in two bytes, the emoji two units in four
+    const std::string before = "caf\xC3\xA9 \xF0\x9F\x98\x80!";
+    Utf16Text text{ot::Rope(before)};
+
+    EXPECT_EQ(text.byteOffset(4), 5u);
+    EXPECT_EQ(text.byteOffset(5), 6u);
+    // Inside the surrogate pair is the start of the character
+    EXPECT_EQ(text.byteOffset(6), 6u);
+    EXPECT_EQ(text.byteOffset(7), 10u);
+    EXPECT_EQ(text.byteOffset(100), before.size());
+
+    // Replacing the emoji, as a QTextDocument reports it
+    auto op = text.change(5, 2, "\xE2\x9C\x93");
+    EXPECT_EQ(applied(before, op), "caf\xC3\xA9 \xE2\x9C\x93!");
+}
+
+TEST(Utf16TextTest, ARemovalPastTheEndStopsThere) {
+    // QTextDocument counts a paragraph separator after the last character
+    Utf16Text text(ot::Rope("abc"));
+    EXPECT_EQ(applied("abc", text.change(0, 4, "xyz")), "xyz");
+}
+
+TEST(Utf16TextTest, OffsetsHoldAcrossChunksThatSplitACharacter) {
+    // Chunks of the rope end wherever they fall, also inside a character
+    std::string before;
+    for (int i = 0; i < 1000; ++i) {
+        before += "a\xC3\xA9\xF0\x9F\x98\x80";
+    }
+    Utf16Text text{ot::Rope(before)};
+
+    // Each repetition is 4 units in 7 bytes
+    for (size_t repetition : {0u, 1u, 146u, 147u, 500u, 999u}) {
+        EXPECT_EQ(text.byteOffset(repetition * 4), repetition * 7);
+        EXPECT_EQ(text.byteOffset(repetition * 4 + 2), repetition * 7 + 3);
+        EXPECT_EQ(text.byteOffset(repetition * 4 + 3), repetition * 7 + 3);
+    }
+    EXPECT_EQ(text.byteOffset(4000), before.size());
+}
+
+TEST(Utf16TextTest, AnOperationBecomesAnEditAtItsUtf16Position) {
+    // "é" is one unit in two bytes
+    Utf16Text text(ot::Rope("caf\xC3\xA9 au lait"));
+
+    auto edits = text.apply(ot::ReplaceOperation(0, 5, "th\xC3\xA9"));
+    ASSERT_TRUE(edits);
+    ASSERT_EQ(edits->size(), 1u);
+    EXPECT_EQ((*edits)[0].position, 0u);
+    EXPECT_EQ((*edits)[0].removed, 4u);
+    EXPECT_EQ((*edits)[0].inserted, "th\xC3\xA9");
+
+    edits = text.apply(ot::InsertOperation(4, " \xF0\x9F\x8D\xB5"));
+    ASSERT_TRUE(edits);
+    EXPECT_EQ((*edits)[0].position, 3u);
+    EXPECT_EQ((*edits)[0].removed, 0u);
+
+    // The emoji is two units
+    edits = text.apply(ot::DeleteOperation(4, 5));
+    ASSERT_TRUE(edits);
+    EXPECT_EQ((*edits)[0].position, 3u);
+    EXPECT_EQ((*edits)[0].removed, 3u);
+    EXPECT_EQ(text.text().toString(), "th\xC3\xA9 au lait");
+}
+
+TEST(Utf16TextTest, EachPartOfACompositeIsAnEdit) {
+    Utf16Text text(ot::Rope("\xC3\xA9t\xC3\xA9"));
+    ot::CompositeOperation composite;
+    composite.addOperation(std::make_shared<ot::InsertOperation>(5, "!"));
+    composite.addOperation(std::make_shared<ot::DeleteOperation>(0, 2));
+
+    auto edits = text.apply(composite);
+    ASSERT_TRUE(edits);
+    ASSERT_EQ(edits->size(), 2u);
+    EXPECT_EQ((*edits)[0].position, 3u);
+    EXPECT_EQ((*edits)[1].position, 0u);
+    EXPECT_EQ((*edits)[1].removed, 1u);
+    EXPECT_EQ(text.text().toString(), "t\xC3\xA9!");
+}
+
+TEST(Utf16TextTest, AnOperationThatDoesNotFitChangesNothing) {
+    Utf16Text text(ot::Rope("abc"));
+    ot::CompositeOperation composite;
+    composite.addOperation(std::make_shared<ot::InsertOperation>(0, "x"));
+    composite.addOperation(std::make_shared<ot::DeleteOperation>(3, 5));
+
+    EXPECT_FALSE(text.apply(composite));
+    EXPECT_FALSE(text.apply(ot::InsertOperation(4, "x")));
+    EXPECT_EQ(text.text().toString(), "abc");
+}
@@ -0,0 +1,523 @@
+#include <gtest/gtest.h>
+#include "common/crdt/crdt_document.h"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <span>
+#include <thread>
+
+using namespace collab::crdt;
+
+TEST(CrdtIdentifierTest, PositionStaysInlineForShortDigits) {
+    Position position{1, 2, 3};
+    EXPECT_TRUE(position.isInline());
+    EXPECT_EQ(position.size(), 3);
+    
+    position.push_back(4);
+    position.push_back(5);
+    EXPECT_FALSE(position.isInline());
+    EXPECT_EQ(position.toVector(), (std::vector<int>{1, 2, 3, 4, 5}));
+    
+    Position copy = position;
+    Position moved = std::move(position);
+    EXPECT_EQ(copy, moved);
+    EXPECT_TRUE(Position({1, 2}) < Position({1, 2, 0}));
+    EXPECT_LT(Position({1, 2, 9}).compare(Position({1, 3})), 0);
+}
+
+TEST(CrdtIdentifierTest, SiteIdsAreInternedOnce) {
+    auto& registry = SiteRegistry::getInstance();
+    SiteId alice = registry.intern("alice");
+    EXPECT_EQ(registry.intern("alice"), alice);
+    EXPECT_EQ(registry.getAuthorId(alice), "alice");
+    
+    // Ordering between sites follows the author strings, not intern order
+    SiteId zed = registry.intern("zed");
+    SiteId bob = registry.intern("bob");
+    EXPECT_LT(registry.compare(bob, zed), 0);
+    EXPECT_GT(registry.compare(zed, alice), 0);
+}
+
+TEST(CrdtIdentifierTest, CompareUsesPositionThenClockThenAuthor) {
+    CrdtChar a('a', "bob", Position{5}, 1);
+    CrdtChar b('b', "alice", Position{5}, 2);
+    CrdtChar c('c', "alice", Position{5}, 1);
+    
+    EXPECT_LT(a.compareTo(b), 0);
+    EXPECT_LT(c.compareTo(a), 0);
+    EXPECT_EQ(a.getAuthorId(), "bob");
+    EXPECT_EQ(a, CrdtChar('x', "bob", Position{5}, 1));
+    EXPECT_LE(sizeof(CrdtChar), 56u);
+}
+
+TEST(CrdtIdentifierTest, CompareAtMatchesTheAdvancedCopy) {
+    const SiteId sites[] = {SiteRegistry::getInstance().intern("alice"), SiteRegistry::getInstance().intern("bob")};
+    std::mt19937 rng(5);
+    // Few digits and sites, so most pairs share a prefix and differ deep down, inline or spilled
+    auto randomId = [&] {
+        Identifier id;
+        for (size_t depth = 1 + rng() % 7; depth > 0; --depth) {
+            id.position.push_back(static_cast<int32_t>(rng() % 3), sites[rng() % 2]);
+        }
+        id.clock = rng() % 4;
+        id.site = sites[rng() % 2];
+        return id;
+    };
+    auto sign = [](int value) { return (value > 0) - (value < 0); };
+    for (int i = 0; i < 20000; ++i) {
+        const Identifier a = randomId();
+        const Identifier b = randomId();
+        const uint32_t offset = rng() % 3;
+        const Identifier advanced = a.advanced(offset);
+        ASSERT_EQ(sign(a.compareAt(offset, b)), sign(advanced.compare(b)));
+        ASSERT_EQ(sign(a.position.compare(b.position)), sign(a.position.compare(Position(b.position))));
+        ASSERT_EQ(a.compareAt(offset, advanced), 0);
+        ASSERT_TRUE(a.advancesTo(offset, advanced));
+        ASSERT_EQ(a.advancesTo(offset, b), advanced == b);
+    }
+}
+
+TEST(CrdtDocumentTest, ReplicasConvergeOnRemoteInserts) {
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    
+    alice.localInsert('h', 0);
+    alice.localInsert('i', 1);
+    for (size_t i = 0; i < alice.size(); ++i) {
+        bob.remoteInsert(alice.at(i));
+    }
+    EXPECT_EQ(bob.getText(), "hi");
+    
+    bob.localInsert('!', 2);
+    alice.remoteInsert(bob.at(2));
+    EXPECT_EQ(alice.getText(), "hi!");
+    EXPECT_EQ(alice.at(2).getAuthorId(), "bob");
+    
+    alice.remoteDelete(bob.at(0).getPosition());
+    EXPECT_EQ(alice.getText(), "i!");
+}
+
+TEST(CrdtDocumentTest, ContiguousInsertsShareOneItem) {
+    CrdtDocument doc("alice");
+    std::string snippet(50000, 'x');
+    doc.localInsert(snippet, 0);
+    EXPECT_EQ(doc.itemCount(), 1);
+    
+    // Typing on at the end of our own run keeps extending it, except that
+    // runs past the extension cap start a new one
+    for (char c : std::string("hello")) {
+        doc.localInsert(c, doc.size());
+    }
+    EXPECT_EQ(doc.itemCount(), 2);
+    EXPECT_EQ(doc.size(), 50005);
+    EXPECT_EQ(doc.getText().substr(49998), "xxhello");
+    
+    // Interior edits split the run
+    doc.localInsert("--", 10);
+    EXPECT_EQ(doc.itemCount(), 4);
+    doc.localDelete(100, 5);
+    EXPECT_EQ(doc.itemCount(), 6);  // the deleted range stays as a tombstone
+    EXPECT_EQ(doc.tombstoneCount(), 5);
+    EXPECT_EQ(doc.size(), 50002);
+    EXPECT_EQ(doc.getText().substr(8, 6), "xx--xx");
+}
+
+TEST(CrdtDocumentTest, RemoteRunsMergeAndSplit) {
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    
+    CrdtItem first = alice.localInsert("hello", 0);
+    CrdtItem second = alice.localInsert(" world", 5);
+    bob.remoteInsert(first);
+    bob.remoteInsert(second);
+    bob.remoteInsert(second);  // duplicates are ignored
+    EXPECT_EQ(bob.getText(), "hello world");
+    EXPECT_EQ(bob.itemCount(), 1);
+    
+    CrdtItem comma = bob.localInsert(",", 5);
+    alice.remoteInsert(comma);
+    EXPECT_EQ(alice.getText(), "hello, world");
+    EXPECT_EQ(alice.itemCount(), 3);
+    
+    Identifier h = alice.at(0).getId();
+    alice.localDelete(0);
+    bob.remoteDelete(h);
+    EXPECT_EQ(bob.getText(), "ello, world");
+}
+
+TEST(CrdtDocumentTest, ConcurrentEditsConverge) {
+    std::mt19937 rng(7);
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    CrdtItem seed = alice.localInsert("the quick brown fox", 0);
+    bob.remoteInsert(seed);
+    
+    for (int round = 0; round < 50; ++round) {
+        std::vector<CrdtItem> fromAlice;
+        std::vector<CrdtItem> fromBob;
+        std::vector<Identifier> deletedByAlice;
+        std::vector<Identifier> deletedByBob;
+        
+        auto edit = [&rng](CrdtDocument& doc, std::vector<CrdtItem>& inserts, std::vector<Identifier>& deletes) {
+            for (int i = 0; i < 4; ++i) {
+                size_t index = std::uniform_int_distribution<size_t>(0, doc.size())(rng);
+                if (rng() % 3 == 0 && index < doc.size()) {
+                    deletes.push_back(doc.at(index).getId());
+                    doc.localDelete(index);
+                } else {
+                    std::string text(1 + rng() % 3, static_cast<char>('a' + rng() % 26));
+                    inserts.push_back(doc.localInsert(text, index));
+                }
+            }
+        };
+        edit(alice, fromAlice, deletedByAlice);
+        edit(bob, fromBob, deletedByBob);
+        
+        for (const auto& item : fromAlice) bob.remoteInsert(item);
+        for (const auto& id : deletedByAlice) bob.remoteDelete(id);
+        for (const auto& item : fromBob) alice.remoteInsert(item);
+        for (const auto& id : deletedByBob) alice.remoteDelete(id);
+        
+        ASSERT_EQ(alice.getText(), bob.getText()) << "round " << round;
+    }
+    EXPECT_EQ(alice.size(), alice.getText().size());
+}
+
+TEST(CrdtDocumentTest, RemoteDeletesOnLargeDocument) {
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    std::mt19937 rng(11);
+    
+    // Scattered typing produces many runs
+    for (int i = 0; i < 2000; ++i) {
+        size_t index = std::uniform_int_distribution<size_t>(0, alice.size())(rng);
+        bob.remoteInsert(alice.localInsert(std::string(100, static_cast<char>('a' + i % 26)), index));
+    }
+    ASSERT_EQ(bob.size(), 200000);
+    ASSERT_GT(bob.itemCount(), 2000);
+    
+    for (int i = 0; i < 2000; ++i) {
+        size_t index = std::uniform_int_distribution<size_t>(0, alice.size() - 1)(rng);
+        Identifier id = alice.at(index).getId();
+        alice.localDelete(index);
+        bob.remoteDelete(id);
+    }
+    EXPECT_EQ(bob.size(), 198000);
+    EXPECT_EQ(alice.getText(), bob.getText());
+}
+
+TEST(CrdtDocumentTest, DeleteOvertakingInsertKeepsCharacterDeleted) {
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    
+    CrdtItem hello = alice.localInsert("hello", 0);
+    Identifier e = hello.idAt(1);
+    bob.remoteDelete(e);
+    bob.remoteInsert(hello);
+    EXPECT_EQ(bob.getText(), "hllo");
+    EXPECT_EQ(bob.tombstoneCount(), 1);
+}
+
+TEST(CrdtDocumentTest, GarbageCollectionWaitsForEverySite) {
+    CrdtDocument server("server");
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    
+    const auto typed = alice.localInsert("abcdef", 0);
+    server.remoteInsert(typed);
+    bob.remoteInsert(typed);
+    server.remoteInsert(bob.localInsert("xyz", 6));
+    
+    // Backspacing over bob's run coalesces into a single tombstone
+    for (int i = 0; i < 3; ++i) {
+        server.localDelete(server.size() - 1);
+    }
+    EXPECT_EQ(server.tombstoneCount(), 3);
+    size_t items = server.itemCount();
+    
+    const uint64_t sequence = server.getDeleteSequence();
+    server.acknowledge("alice", sequence);
+    EXPECT_EQ(server.collectGarbage(), 0);
+    
+    server.acknowledge("bob", sequence);
+    EXPECT_EQ(server.collectGarbage(), 3);
+    EXPECT_EQ(server.tombstoneCount(), 0);
+    EXPECT_EQ(server.itemCount(), items - 1);
+    EXPECT_EQ(server.size(), 6);
+    
+    // Departed sites no longer hold collection back
+    server.localDelete(0);
+    server.acknowledge("alice", server.getDeleteSequence());
+    server.removeSite("bob");
+    EXPECT_EQ(server.collectGarbage(std::chrono::microseconds(0)), 1);
+}
+
+TEST(CrdtDocumentTest, LseqPositionsStayShallow) {
+    CrdtDocument doc("alice");
+    doc.setStrategy(CrdtDocument::Strategy::LSEQ);
+    std::mt19937 rng(5);
+    
+    for (int i = 0; i < 2000; ++i) {
+        size_t index = i % 2 == 0 ? 0 : std::uniform_int_distribution<size_t>(0, doc.size())(rng);
+        doc.localInsert(static_cast<char>('a' + i % 26), index);
+    }
+    
+    size_t maxDepth = 0;
+    for (size_t i = 0; i < doc.size(); ++i) {
+        maxDepth = std::max<size_t>(maxDepth, doc.at(i).getPosition().size());
+        if (i > 0) {
+            ASSERT_LT(doc.at(i - 1).getId(), doc.at(i).getId());
+        }
+    }
+    EXPECT_LE(maxDepth, 16);
+}
+
+TEST(CrdtDocumentTest, BatchRemoteApplyCoalescesAndNotifiesOnce) {
+    CrdtDocument alice("alice");
+    CrdtDocument bob("bob");
+    int notifications = 0;
+    bob.setChangeCallback([&notifications, &bob] {
+        ++notifications;
+        EXPECT_FALSE(bob.getText().empty());  // callback may read the document
+    });
+    
+    alice.localInsert(std::string(10000, 'p'), 0);
+    std::vector<CrdtChar> chars;
+    for (size_t i = 0; i < alice.size(); ++i) {
+        chars.push_back(alice.at(i));
+    }
+    std::shuffle(chars.begin(), chars.end(), std::mt19937(9));
+    
+    bob.remoteInsertBatch(std::span<const CrdtChar>(chars));
+    EXPECT_EQ(notifications, 1);
+    EXPECT_EQ(bob.getText(), alice.getText());
+    EXPECT_EQ(bob.itemCount(), 1);
+    
+    std::vector<Identifier> ids;
+    std::vector<Position> positions;
+    for (size_t i = 0; i < 100; ++i) {
+        ids.push_back(chars[i].getId());
+        positions.push_back(chars[100 + i].getPosition());
+    }
+    bob.remoteDeleteBatch(std::span<const Identifier>(ids));
+    bob.remoteDeleteBatch(std::span<const Position>(positions));
+    EXPECT_EQ(notifications, 3);
+    EXPECT_EQ(bob.size(), 9800);
+    EXPECT_EQ(bob.tombstoneCount(), 200);
+}
+
+TEST(CrdtDocumentTest, VersionVectorDeltaCatchesUpReconnectingPeer) {
+    CrdtDocument server("server");
+    CrdtDocument laptop("laptop");
+    
+    server.remoteInsert(laptop.localInsert("shared base ", 0));
+    laptop.remoteInsertBatch(std::span<const CrdtItem>(server.getItemsSince(laptop.getVersionVector())));
+    EXPECT_EQ(laptop.getText(), server.getText());
+    
+    // While the laptop sleeps, others type and delete
+    VersionVector asleep = laptop.getVersionVector();
+    server.localInsert("edits", server.size());
+    server.localInsert("gone", 0);
+    server.localDelete(0, 4);
+    
+    std::vector<CrdtItem> delta = server.getItemsSince(asleep);
+    size_t shipped = 0;
+    for (const auto& item : delta) {
+        shipped += item.length();
+    }
+    EXPECT_EQ(shipped, 9);  // only the new characters, not the shared base
+    
+    laptop.remoteInsertBatch(std::span<const CrdtItem>(delta));
+    EXPECT_EQ(laptop.getText(), "shared base edits");
+    EXPECT_EQ(laptop.getText(), server.getText());
+    EXPECT_TRUE(laptop.getVersionVector().dominates(server.getVersionVector()));
+    EXPECT_EQ(laptop.tombstoneCount(), 4);
+    EXPECT_TRUE(server.getItemsSince(laptop.getVersionVector()).empty());
+}
+
+TEST(CrdtDocumentTest, DeltaChangesReplayOnPlainText) {
+    std::mt19937 random(7);
+    for (int round = 0; round < 20; ++round) {
+        CrdtDocument left("left");
+        CrdtDocument right("right");
+        left.seedPositions(static_cast<uint32_t>(round));
+        right.seedPositions(static_cast<uint32_t>(round) + 100);
+        right.applyDelta(left.getDeltaSince(right.getVersionVector()));
+        
+        // Both edit the same text concurrently, away from each other
+        for (CrdtDocument* document : {&left, &right}) {
+            for (int edit = 0; edit < 30; ++edit) {
+                const size_t size = document->size();
+                if (size > 0 && random() % 3 == 0) {
+                    document->localDelete(random() % size, 1 + random() % 3);
+                } else {
+                    document->localInsert(std::string(1 + random() % 4, static_cast<char>('a' + edit % 26)),
+                                          size == 0 ? 0 : random() % (size + 1));
+                }
+            }
+        }
+        
+        std::string text = right.getText();
+        for (const TextChange& change : right.applyDeltaWithChanges(left.getDeltaSince(right.getVersionVector()))) {
+            ASSERT_LE(change.position + change.deleted, text.size());
+            text.erase(change.position, change.deleted);
+            text.insert(change.position, change.inserted);
+        }
+        EXPECT_EQ(text, right.getText());
+        left.applyDelta(right.getDeltaSince(left.getVersionVector()));
+        EXPECT_EQ(left.getText(), right.getText());
+        EXPECT_TRUE(right.applyDeltaWithChanges(left.getDeltaSince(right.getVersionVector())).empty());
+    }
+}
+
+TEST(CrdtDocumentTest, SnapshotRoundTripsFullState) {
+    CrdtDocument server("snap-server");
+    CrdtDocument alice("snap-alice");
+    
+    server.remoteInsert(alice.localInsert("hello world", 0));
+    server.localInsert("big ", 6);
+    server.localDelete(0, 6);
+    server.acknowledge("snap-alice", 0);
+    
+    std::string snapshot = server.toSnapshot();
+    EXPECT_LT(snapshot.size(), 120u);
+    
+    CrdtDocument restored("snap-server");
+    restored.loadSnapshot(snapshot);
+    EXPECT_EQ(restored.getText(), "big world");
+    EXPECT_EQ(restored.itemCount(), server.itemCount());
+    EXPECT_EQ(restored.tombstoneCount(), 6);
+    EXPECT_EQ(restored.getVersionVector(), server.getVersionVector());
+    EXPECT_EQ(restored.at(0).getId(), server.at(0).getId());
+    
+    // Editing and garbage collection carry on where the snapshot left off
+    restored.remoteInsert(alice.localInsert("!", alice.size()));
+    restored.localInsert("a ", 0);
+    EXPECT_EQ(restored.getText(), "a big world!");
+    EXPECT_EQ(restored.collectGarbage(std::chrono::seconds(1)), 0);
+    restored.acknowledge("snap-alice", restored.getDeleteSequence());
+    EXPECT_EQ(restored.collectGarbage(std::chrono::seconds(1)), 6);
+    EXPECT_EQ(restored.tombstoneCount(), 0);
+}
+
+TEST(CrdtDocumentTest, MalformedSnapshotLeavesDocumentUnchanged) {
+    CrdtDocument source("snap-bob");
+    source.localInsert("some text", 0);
+    source.localDelete(2, 3);
+    std::string snapshot = source.toSnapshot();
+    
+    CrdtDocument doc("snap-carol");
+    doc.localInsert("keep", 0);
+    for (size_t length = 0; length < snapshot.size(); ++length) {
+        EXPECT_THROW(doc.loadSnapshot(snapshot.substr(0, length)), std::runtime_error);
+    }
+    EXPECT_THROW(doc.loadSnapshot(snapshot + 'x'), std::runtime_error);
+    EXPECT_EQ(doc.getText(), "keep");
+    
+    doc.loadSnapshot(snapshot);
+    EXPECT_EQ(doc.getText(), "sotext");
+}
+
+namespace {
+
+// Always proposes the same digit, leaving the document's fallback to cope
+struct FixedDigitStrategy {
+    Position between(const Position&, const Position&, size_t) {
+        return {7};
+    }
+};
+
+template <typename Document>
+concept HasSetStrategy = requires(Document& doc) { doc.setStrategy(PositionStrategy::LSEQ); };
+
+} // namespace
+
+TEST(CrdtDocumentTest, CompileTimePoliciesInteroperate) {
+    static_assert(HasSetStrategy<CrdtDocument>);
+    static_assert(!HasSetStrategy<LseqCrdtDocument>);
+    
+    LseqCrdtDocument alice("alice");
+    LogootCrdtDocument bob("bob");
+    BasicCrdtDocument<FixedDigitStrategy> carol("carol");
+    
+    std::mt19937 rng(5);
+    for (int i = 0; i < 300; ++i) {
+        CrdtItem fromAlice = alice.localInsert("a", rng() % (alice.size() + 1));
+        CrdtItem fromBob = bob.localInsert("b", rng() % (bob.size() + 1));
+        CrdtItem fromCarol = carol.localInsert("c", rng() % (carol.size() + 1));
+        alice.remoteInsert(fromBob);
+        alice.remoteInsert(fromCarol);
+        bob.remoteInsert(fromAlice);
+        bob.remoteInsert(fromCarol);
+        carol.remoteInsert(fromAlice);
+        carol.remoteInsert(fromBob);
+    }
+    
+    EXPECT_EQ(alice.size(), 900);
+    EXPECT_EQ(alice.getText(), bob.getText());
+    EXPECT_EQ(alice.getText(), carol.getText());
+}
+
+TEST(CrdtDocumentTest, SnapshotsStayImmutableWhileWriterEdits) {
+    CrdtDocument doc("alice");
+    doc.localInsert("hello world", 0);
+    auto before = doc.snapshot();
+    
+    doc.localInsert("big ", 6);
+    doc.localDelete(0, 6);
+    EXPECT_EQ(before->getText(), "hello world");
+    EXPECT_EQ(before->size(), 11);
+    EXPECT_EQ(before->at(0).getValue(), 'h');
+    EXPECT_EQ(doc.getText(), "big world");
+    EXPECT_EQ(doc.snapshot()->itemCount(), doc.itemCount());
+    EXPECT_THROW(doc.at(9), std::out_of_range);
+}
+
+TEST(CrdtDocumentTest, ReadersSeeConsistentSnapshotsDuringRemoteApply) {
+    CrdtDocument writer("alice");
+    CrdtDocument doc("bob");
+    std::atomic<bool> done{false};
+    std::atomic<size_t> reads{0};
+    
+    std::thread reader([&] {
+        while (!done.load()) {
+            auto view = doc.snapshot();
+            const std::string& text = view->getText();
+            ASSERT_EQ(text.size(), view->size());
+            ASSERT_EQ(text.find_first_not_of('x'), std::string::npos);
+            if (!text.empty()) {
+                ASSERT_EQ(view->at(text.size() - 1).getValue(), 'x');
+            }
+            reads.fetch_add(1);
+        }
+    });
+    
+    std::mt19937 rng(3);
+    for (int i = 0; i < 2000; ++i) {
+        doc.remoteInsert(writer.localInsert("xx", rng() % (writer.size() + 1)));
+        if (i % 3 == 0) {
+            doc.localDelete(rng() % doc.size(), 1);
+        }
+    }
+    done.store(true);
+    reader.join();
+    
+    EXPECT_GT(reads.load(), 0u);
+    EXPECT_EQ(doc.size(), 4000u - 667u);
+}
+
+TEST(CrdtIdentifierTest, VersionVectorMergeAndDominance) {
+    VersionVector a;
+    VersionVector b;
+    a.observe("alice", 5);
+    b.observe("alice", 3);
+    b.observe("bob", 7);
+    EXPECT_TRUE(a.includes(SiteRegistry::getInstance().intern("alice"), 5));
+    EXPECT_FALSE(a.dominates(b));
+    
+    a.merge(b);
+    EXPECT_EQ(a.get("alice"), 5);
+    EXPECT_EQ(a.get("bob"), 7);
+    EXPECT_TRUE(a.dominates(b));
+    EXPECT_FALSE(b.dominates(a));
+}
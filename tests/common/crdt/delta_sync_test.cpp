@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include "common/crdt/delta_sync.h"
+#include "common/protocol/protocol.h"
+#include "common/util/base64.h"
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+using namespace collab::crdt;
+using collab::protocol::Message;
+using collab::protocol::MessageType;
+using collab::protocol::SyncMessage;
+
+TEST(DeltaSyncTest, Base64RoundTripsBinary) {
+    std::string bytes;
+    for (int i = 0; i < 256; ++i) {
+        bytes += static_cast<char>(i);
+    }
+    for (size_t length : {0u, 1u, 2u, 3u, 4u, 256u}) {
+        std::string slice = bytes.substr(0, length);
+        EXPECT_EQ(collab::util::base64Decode(collab::util::base64Encode(slice)), slice);
+    }
+    EXPECT_EQ(collab::util::base64Encode("ab"), "YWI=");
+    EXPECT_THROW(collab::util::base64Decode("YW=I"), std::invalid_argument);
+    EXPECT_THROW(collab::util::base64Decode("YWI"), std::invalid_argument);
+}
+
+TEST(DeltaSyncTest, StateVectorRoundTrips) {
+    VersionVector vector;
+    vector.observe("alice", 3);
+    vector.observe("bob", 300000);
+
+    std::string encoded = encodeStateVector(vector);
+    EXPECT_EQ(decodeStateVector(encoded), vector);
+    EXPECT_LT(encoded.size(), 20u);
+    EXPECT_THROW(decodeStateVector(encoded.substr(0, encoded.size() - 1)), std::runtime_error);
+    EXPECT_THROW(decodeStateVector(encoded + '\0'), std::runtime_error);
+}
+
+TEST(DeltaSyncTest, ResumingClientReceivesOnlyWhatItMissed) {
+    CrdtDocument server("sync-server");
+    CrdtDocument laptop("sync-laptop");
+
+    server.localInsert(std::string(100000, 'x'), 0);
+    laptop.applyDelta(decodeDelta(encodeDelta(server.getDeltaSince(laptop.getVersionVector()))));
+    EXPECT_EQ(laptop.getText(), server.getText());
+
+    // While the laptop sleeps the server inserts, and deletes from the shared text
+    server.localInsert("morning ", 0);
+    server.localInsert("tmp", 4);
+    server.localDelete(4, 3);
+    server.localDelete(server.size() - 10, 10);
+
+    SyncMessage request(MessageType::SYNC_REQUEST);
+    request.documentId = "doc";
+    request.stateVector = encodeStateVector(laptop.getVersionVector());
+    auto received = std::get<SyncMessage>(Message::fromString(request.toString()));
+    ASSERT_TRUE(received.stateVector.has_value());
+
+    SyncMessage response(MessageType::SYNC_RESPONSE);
+    response.documentId = received.documentId;
+    response.delta = encodeDelta(server.getDeltaSince(decodeStateVector(*received.stateVector)));
+    EXPECT_LT(response.delta->size(), 200u);
+
+    auto reply = std::get<SyncMessage>(Message::fromString(response.toString()));
+    ASSERT_TRUE(reply.delta.has_value());
+    int notifications = 0;
+    laptop.setChangeCallback([&notifications] { ++notifications; });
+    laptop.applyDelta(decodeDelta(*reply.delta));
+
+    EXPECT_EQ(notifications, 1);
+    EXPECT_EQ(laptop.getText(), server.getText());
+    EXPECT_EQ(laptop.size(), 100008u - 10u);
+    EXPECT_TRUE(laptop.getVersionVector().dominates(server.getVersionVector()));
+    EXPECT_TRUE(server.getDeltaSince(laptop.getVersionVector()).items.empty());
+}
+
+TEST(DeltaSyncTest, MalformedDeltaIsRejected) {
+    CrdtDocument doc("sync-alice");
+    doc.localInsert("hello", 0);
+    std::string encoded = encodeDelta(doc.getDeltaSince(VersionVector()));
+
+    for (size_t length = 0; length < encoded.size(); ++length) {
+        EXPECT_THROW(decodeDelta(encoded.substr(0, length)), std::runtime_error);
+    }
+    std::string badVersion = encoded;
+    badVersion[0] = 7;
+    EXPECT_THROW(decodeDelta(badVersion), std::runtime_error);
+
+    CrdtDelta delta = decodeDelta(encoded);
+    ASSERT_EQ(delta.items.size(), 1u);
+    EXPECT_EQ(delta.items[0].getText(), "hello");
+    EXPECT_EQ(delta.items[0].getId().site, SiteRegistry::getInstance().intern("sync-alice"));
+}
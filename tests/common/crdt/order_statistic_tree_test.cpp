@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include "common/crdt/order_statistic_tree.h"
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace collab::crdt;
+
+namespace {
+
+struct Chunk {
+    std::string text;
+    size_t weight() const { return text.size(); }
+};
+
+std::string concat(const OrderStatisticTree<Chunk>& tree) {
+    std::string result;
+    tree.forEach([&result](const Chunk& chunk) { result += chunk.text; });
+    return result;
+}
+
+} // namespace
+
+TEST(OrderStatisticTreeTest, RankAndWeightQueries) {
+    OrderStatisticTree<Chunk> tree;
+    tree.insert(0, {"world"});
+    tree.insert(0, {"hello "});
+    tree.insert(2, {"!"});
+    
+    EXPECT_EQ(tree.size(), 3);
+    EXPECT_EQ(tree.weight(), 12);
+    EXPECT_EQ(concat(tree), "hello world!");
+    EXPECT_EQ(tree.at(1).text, "world");
+    
+    auto location = tree.locate(7);
+    EXPECT_EQ(location.rank, 1);
+    EXPECT_EQ(location.offset, 1);
+    EXPECT_EQ(tree.locate(12).rank, 3);
+    EXPECT_EQ(tree.weightBefore(2), 11);
+    
+    tree.modify(1, [](Chunk& chunk) { chunk.text = "there"; });
+    tree.erase(2);
+    EXPECT_EQ(concat(tree), "hello there");
+    EXPECT_THROW(tree.at(5), std::out_of_range);
+}
+
+TEST(OrderStatisticTreeTest, MatchesVectorUnderRandomEdits) {
+    std::mt19937 rng(3);
+    OrderStatisticTree<Chunk> tree;
+    std::vector<int> reference;
+    
+    for (int i = 0; i < 5000; ++i) {
+        size_t rank = std::uniform_int_distribution<size_t>(0, reference.size())(rng);
+        if (rng() % 3 == 0 && rank < reference.size()) {
+            reference.erase(reference.begin() + rank);
+            tree.erase(rank);
+        } else {
+            reference.insert(reference.begin() + rank, i);
+            tree.insert(rank, {std::to_string(i)});
+        }
+    }
+    
+    ASSERT_EQ(tree.size(), reference.size());
+    for (size_t rank = 0; rank < reference.size(); rank += 97) {
+        EXPECT_EQ(tree.at(rank).text, std::to_string(reference[rank]));
+    }
+    
+    // Sorted content supports binary search by predicate
+    OrderStatisticTree<Chunk> sorted;
+    for (int i = 0; i < 100; ++i) {
+        sorted.insert(sorted.size(), {std::string(1, static_cast<char>('a' + i % 26)) + std::to_string(1000 + i)});
+    }
+    EXPECT_EQ(sorted.partitionPoint([](const Chunk& chunk) { return chunk.text.substr(1) < "1042"; }), 42);
+}
+
+TEST(OrderStatisticTreeTest, AssignBuildsSearchableTree) {
+    std::vector<Chunk> chunks;
+    std::string expected;
+    for (int i = 0; i < 5000; ++i) {
+        chunks.push_back({std::string(static_cast<size_t>(i % 7), static_cast<char>('a' + i % 26))});
+        expected += chunks.back().text;
+    }
+    
+    OrderStatisticTree<Chunk> tree;
+    tree.insert(0, {"stale"});
+    tree.assign(chunks);
+    EXPECT_EQ(tree.size(), chunks.size());
+    EXPECT_EQ(tree.weight(), expected.size());
+    EXPECT_EQ(concat(tree), expected);
+    EXPECT_EQ(tree.at(4999).text, chunks[4999].text);
+    EXPECT_EQ(tree.weightBefore(100), 295u);
+    
+    tree.insert(1, {"xyz"});
+    tree.erase(0);
+    EXPECT_EQ(tree.at(0).text, "xyz");
+}
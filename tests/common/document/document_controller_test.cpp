@@ -0,0 +1,440 @@
+#include <gtest/gtest.h>
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include <filesystem>
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(DocumentControllerTest, ApplyAndUndoValueOperations) {
+    DocumentController controller("hello world");
+    
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{5, ","}}, "alice"));
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{DeleteOp{6, 6}}, "alice"));
+    EXPECT_EQ(controller.getDocument(), "hello,");
+    EXPECT_EQ(controller.getRevision(), 2);
+    
+    ASSERT_TRUE(controller.undo("alice"));
+    EXPECT_EQ(controller.getDocument(), "hello, world");
+    ASSERT_TRUE(controller.redo("alice"));
+    EXPECT_EQ(controller.getDocument(), "hello,");
+    
+    EXPECT_FALSE(controller.canUndo("bob"));
+}
+
+TEST(DocumentControllerTest, TransformAgainstLog) {
+    DocumentController controller("abcdef");
+    controller.applyOperation(std::make_shared<InsertOperation>(0, "xx"), "alice");
+    
+    auto value = controller.transformOperation(ValueOperation{InsertOp{3, "!"}}, 0);
+    auto ptr = controller.transformOperation(std::make_shared<InsertOperation>(3, "!"), 0);
+    ASSERT_TRUE(value.has_value());
+    EXPECT_EQ(std::get<InsertOp>(*value).position, 5);
+    EXPECT_EQ(std::static_pointer_cast<InsertOperation>(ptr)->getPosition(), 5);
+}
+
+TEST(OperationManagerTest, ProcessValueOperation) {
+    OperationManager manager;
+    manager.recordOperation(ValueOperation{InsertOp{0, "abc"}});
+    manager.recordOperation(ValueOperation{DeleteOp{0, 1}});
+    EXPECT_EQ(manager.getCurrentRevision(), 2);
+    
+    auto result = manager.processOperation(ValueOperation{InsertOp{0, "z"}}, "bob", 0);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(std::get<InsertOp>(*result).position, 2);
+    
+    result = manager.processOperation(ValueOperation{InsertOp{0, "z"}}, "bob", 2);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(std::get<InsertOp>(*result).position, 0);
+}
+
+TEST(OperationManagerTest, WatermarkForcesResync) {
+    OperationManager manager(100);
+    manager.acknowledgeRevision("alice", 0);
+    manager.acknowledgeRevision("bob", 0);
+    for (int i = 0; i < 5; ++i) {
+        manager.recordOperation(ValueOperation{InsertOp{0, "a"}});
+    }
+    
+    manager.acknowledgeRevision("alice", 5);
+    manager.acknowledgeRevision("bob", 3);
+    EXPECT_EQ(manager.getLowWatermark(), 3);
+    EXPECT_TRUE(manager.needsResync(2));
+    EXPECT_FALSE(manager.processOperation(ValueOperation{InsertOp{0, "z"}}, "carol", 1).has_value());
+    EXPECT_NE(manager.processOperation(std::make_shared<InsertOperation>(0, "z"), "bob", 4), nullptr);
+    
+    manager.removeClient("bob");
+    EXPECT_EQ(manager.getLowWatermark(), 5);
+}
+
+TEST(DocumentControllerTest, SnapshotsAreImmutable) {
+    DocumentController controller("draft");
+    auto before = controller.getSnapshot();
+    
+    std::vector<int64_t> revisions;
+    controller.registerSnapshotCallback([&](const DocumentController::DocumentSnapshot& snapshot) {
+        revisions.push_back(snapshot.revision);
+        EXPECT_EQ(snapshot.content.length(), 10);
+    });
+    
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{5, " text"}}, "alice"));
+    
+    EXPECT_EQ(before.content.toString(), "draft");
+    EXPECT_EQ(before.revision, 0);
+    EXPECT_EQ(controller.getSnapshot().content.toString(), "draft text");
+    EXPECT_EQ(revisions, std::vector<int64_t>{1});
+}
+
+TEST(DocumentControllerTest, MaterializesPastRevisions) {
+    DocumentController controller("draft");
+    for (int i = 0; i < 600; ++i) {
+        ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{0, "x"}}, "alice"));
+    }
+    ASSERT_TRUE(controller.undo("alice"));
+    
+    auto original = controller.materializeAt(0);
+    ASSERT_TRUE(original);
+    EXPECT_EQ(original->content.toString(), "draft");
+    
+    auto past = controller.materializeAt(300);
+    ASSERT_TRUE(past);
+    EXPECT_EQ(past->revision, 300);
+    EXPECT_EQ(past->content.toString(), std::string(300, 'x') + "draft");
+    
+    EXPECT_EQ(controller.materializeAt(601)->content.toString(), controller.getDocument());
+    EXPECT_FALSE(controller.materializeAt(602));
+}
+
+TEST(DocumentControllerTest, SelectiveUndoSkipsOtherUsersEdits) {
+    DocumentController controller("world");
+    
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{5, "!"}}, "alice"));
+    for (int i = 0; i < 40; ++i) {
+        ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{0, "-"}}, "bob"));
+    }
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{DeleteOp{0, 10}}, "bob"));
+    
+    ASSERT_TRUE(controller.undo("alice"));
+    EXPECT_EQ(controller.getDocument(), std::string(30, '-') + "world");
+    ASSERT_TRUE(controller.redo("alice"));
+    EXPECT_EQ(controller.getDocument(), std::string(30, '-') + "world!");
+    ASSERT_TRUE(controller.undo("bob"));
+    EXPECT_EQ(controller.getDocument(), std::string(40, '-') + "world!");
+}
+
+TEST(DocumentControllerTest, OperationCallbackRebuildsTheDocument) {
+    DocumentController controller("hello");
+    std::string mirror = controller.getDocument();
+    std::vector<std::string> users;
+    int64_t lastRevision = 0;
+    controller.registerOperationCallback([&](const OperationPtr& op, const std::string& userId, int64_t revision) {
+        ASSERT_TRUE(op->apply(mirror));
+        users.push_back(userId);
+        lastRevision = revision;
+    });
+    
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{5, " world"}}, "alice"));
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<DeleteOperation>(0, 1), "bob"));
+    ASSERT_TRUE(controller.undo("alice"));
+    
+    EXPECT_EQ(mirror, controller.getDocument());
+    EXPECT_EQ(users, (std::vector<std::string>{"alice", "bob", "alice"}));
+    EXPECT_EQ(lastRevision, controller.getRevision());
+}
+
+TEST(DocumentControllerTest, DeepUndoPagesInSpilledHistory) {
+    DocumentController controller("");
+    controller.setHistoryBudget(8 * ot::OperationLog::ENTRY_OVERHEAD, 0,
+                                std::filesystem::temp_directory_path() / "collabedit_controller_spill_test.ops");
+    
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{0, "base"}}, "alice"));
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{0, "-"}}, "bob"));
+    }
+    
+    // Long gone from memory, the insert is read back and transformed past bob's edits
+    ASSERT_TRUE(controller.undo("alice"));
+    EXPECT_EQ(controller.getDocument(), std::string(50, '-'));
+    ASSERT_TRUE(controller.redo("alice"));
+    EXPECT_EQ(controller.getDocument(), std::string(50, '-') + "base");
+}
+
+TEST(OperationManagerTest, AcksReleaseTheLogAndReportTheLaggingClient) {
+    OperationManager manager;
+    manager.acknowledgeRevision("alice", 0);
+    manager.acknowledgeRevision("bob", 0);
+    for (int i = 0; i < 10; ++i) {
+        manager.recordOperation(std::make_shared<InsertOperation>(0, "x"));
+    }
+    
+    EXPECT_EQ(manager.acknowledgeRevision("alice", 10), 0);
+    EXPECT_EQ(manager.acknowledgeRevision("bob", 4), 4);
+    // Late acks do not move a client back
+    EXPECT_EQ(manager.acknowledgeRevision("bob", 2), 4);
+    
+    auto stats = manager.getWatermarkStats();
+    EXPECT_EQ(stats.logLength, 6);
+    EXPECT_EQ(stats.lowWatermark, 4);
+    EXPECT_EQ(stats.laggingClient, "bob");
+    EXPECT_EQ(stats.releasedOperations, 4);
+    
+    EXPECT_EQ(manager.removeClient("bob"), 10);
+    stats = manager.getWatermarkStats();
+    EXPECT_EQ(stats.logLength, 0);
+    EXPECT_TRUE(stats.laggingClient.empty());
+}
+
+TEST(DocumentControllerTest, CompactionKeepsRevisionsRebuildable) {
+    DocumentController controller("");
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{static_cast<size_t>(i), "x"}}, "alice"));
+    }
+    
+    controller.compactBefore(6);
+    auto compacted = controller.materializeAt(6);
+    ASSERT_TRUE(compacted);
+    EXPECT_EQ(compacted->content.toString(), "xxxxxx");
+    EXPECT_EQ(controller.materializeAt(8)->content.toString(), "xxxxxxxx");
+    // Late clients from below the compaction point must resync
+    EXPECT_FALSE(controller.transformOperation(std::make_shared<InsertOperation>(0, "y"), 5));
+    EXPECT_TRUE(controller.transformOperation(std::make_shared<InsertOperation>(0, "y"), 6));
+}
+
+TEST(OperationManagerTest, LateClientsGetTheStepwiseTransformHoweverFarBehind) {
+    // Either side of 32 revisions behind, where the composed history used to take over
+    for (size_t behind : {31, 32, 33, 64}) {
+        OperationManager manager;
+        std::string document = "hello";
+        std::vector<OperationPtr> history;
+        for (size_t i = 0; i < behind; ++i) {
+            OperationPtr op = i % 4 == 3 ? OperationPtr(std::make_shared<DeleteOperation>(1, 1))
+                                         : OperationPtr(std::make_shared<InsertOperation>(0, "ab"));
+            ASSERT_TRUE(op->apply(document));
+            manager.recordOperation(op);
+            history.push_back(op);
+        }
+        
+        // Ties at the start included
+        for (size_t position : {0, 1, 2, 4, 5}) {
+            auto late = std::make_shared<InsertOperation>(position, "!");
+            OperationPtr expected = late;
+            for (const auto& op : history) {
+                expected = expected->transform(op);
+            }
+            
+            const std::string client = std::to_string(behind) + "/" + std::to_string(position);
+            auto transformed = manager.processOperation(late, "client" + client, 0);
+            ASSERT_TRUE(transformed);
+            EXPECT_EQ(transformed->serialize(), expected->serialize()) << client;
+            
+            auto value = manager.processOperation(ValueOperation{InsertOp{position, "!"}}, "value" + client, 0);
+            ASSERT_TRUE(value);
+            EXPECT_EQ(std::get<InsertOp>(*value).position,
+                      std::static_pointer_cast<InsertOperation>(expected)->getPosition()) << client;
+        }
+    }
+}
+
+TEST(OperationManagerTest, KeepsTextTypedIntoALateDeleteHoweverFarBehind) {
+    for (size_t behind : {1, 31, 32, 33, 64}) {
+        OperationManager manager;
+        std::string document = "0123456789";
+        std::vector<OperationPtr> history = {std::make_shared<InsertOperation>(5, "X")};
+        for (size_t i = 1; i < behind; ++i) {
+            history.push_back(std::make_shared<InsertOperation>(10 + i, "a"));
+        }
+        for (const auto& op : history) {
+            ASSERT_TRUE(op->apply(document));
+            manager.recordOperation(op);
+        }
+        
+        auto late = std::make_shared<DeleteOperation>(0, 10);
+        OperationPtr expected = late;
+        for (const auto& op : history) {
+            expected = expected->transform(op);
+        }
+        auto transformed = manager.processOperation(late, "bob", 0);
+        ASSERT_TRUE(transformed);
+        EXPECT_EQ(transformed->serialize(), expected->serialize()) << behind << " revisions behind";
+        ASSERT_TRUE(transformed->apply(document));
+        EXPECT_EQ(document, "X" + std::string(behind - 1, 'a'));
+    }
+}
+
+TEST(DocumentControllerTest, ReportsLoadStats) {
+    DocumentController controller("abc");
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{0, "x"}}, "alice"));
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<InsertOperation>(1, "y"), "bob"));
+    ASSERT_TRUE(controller.undo("bob"));
+    controller.transformOperation(ValueOperation{InsertOp{3, "!"}}, 0);
+    
+    const auto stats = controller.getLoadStats();
+    EXPECT_EQ(stats.operationsApplied, 3u);
+    EXPECT_EQ(stats.historyLength, 3u);
+    EXPECT_GE(stats.memoryBytes, controller.getDocument().size());
+    
+    // Only the edit behind the head is transformed
+    OperationManager manager;
+    manager.recordOperation(manager.processOperation(std::make_shared<InsertOperation>(0, "ab"), "alice", 0));
+    ASSERT_TRUE(manager.processOperation(std::make_shared<InsertOperation>(0, "c"), "alice", 0));
+    const auto managerStats = manager.getLoadStats();
+    EXPECT_EQ(managerStats.operationsProcessed, 2u);
+    EXPECT_EQ(managerStats.operationsTransformed, 1u);
+    EXPECT_EQ(managerStats.historyLength, 1u);
+}
+
+TEST(DocumentControllerTest, CarriesOnFromASnapshotRevision) {
+    DocumentController restored(DocumentController::DocumentSnapshot{ot::Rope("abc"), 42});
+    EXPECT_EQ(restored.getRevision(), 42);
+    EXPECT_EQ(restored.getOldestRevision(), 42);
+    EXPECT_TRUE(restored.applyOperation(std::make_shared<ot::InsertOperation>(3, "d"), "alice"));
+    EXPECT_EQ(restored.getRevision(), 43);
+
+    // An edit based on the restored revision is transformed past the one since
+    auto late = restored.transformOperation(std::make_shared<ot::InsertOperation>(3, "e"), 42);
+    ASSERT_NE(late, nullptr);
+    EXPECT_TRUE(restored.applyOperation(late, "bob"));
+    EXPECT_EQ(restored.getDocument(), "abcde");
+    EXPECT_EQ(restored.getOperationsSince(42)->size(), 2u);
+    EXPECT_FALSE(restored.getOperationsSince(41).has_value());
+    ASSERT_TRUE(restored.materializeAt(42).has_value());
+    EXPECT_EQ(restored.materializeAt(42)->content.toString(), "abc");
+}
+
+TEST(DocumentControllerTest, KeepsTheContentHashCurrent) {
+    DocumentController controller("hello world");
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{InsertOp{5, ","}}, "alice"));
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<DeleteOperation>(0, 1), "bob"));
+    ASSERT_TRUE(controller.undo("bob"));
+
+    DocumentController::ContentHashes hashes = controller.getContentHashes(5, 3);
+    EXPECT_EQ(hashes.root, ContentHash::hash("hello, world"));
+    EXPECT_EQ(hashes.length, 12u);
+    EXPECT_EQ(hashes.revision, 3);
+    EXPECT_EQ(hashes.prefix, ContentHash::hash("hello"));
+    EXPECT_EQ(hashes.suffix, ContentHash::hash("rld"));
+    EXPECT_EQ(DocumentController(controller.getSnapshot()).getContentHashes().root, hashes.root);
+}
+
+TEST(OperationManagerTest, RejectsEditsToReadOnlyRegions) {
+    OperationManager manager;
+    manager.recordOperation(ValueOperation{InsertOp{0, "Dear Sir, [body] Regards"}});
+    const RegionSet::Id greeting = manager.addRegion(0, 9, RegionSet::READ_ONLY, "greeting");
+    manager.addRegion(17, 24, RegionSet::READ_ONLY, "closing");
+
+    std::optional<RegionSet::Region> lockedBy;
+    EXPECT_FALSE(manager.processOperation(ValueOperation{DeleteOp{5, 5}}, "alice", 1, lockedBy).has_value());
+    ASSERT_TRUE(lockedBy.has_value());
+    EXPECT_EQ(lockedBy->label, "greeting");
+    // Typing right after the greeting is allowed
+    EXPECT_TRUE(manager.processOperation(ValueOperation{InsertOp{9, "!"}}, "alice", 1, lockedBy).has_value());
+    EXPECT_FALSE(lockedBy.has_value());
+
+    // A concurrent edit is checked where it lands once transformed
+    manager.recordOperation(ValueOperation{InsertOp{0, ">> "}});
+    EXPECT_EQ(manager.getRegions()[1].start, 20u);
+    EXPECT_EQ(manager.processOperation(std::make_shared<InsertOperation>(19, "x"), "bob", 1), nullptr);
+    EXPECT_NE(manager.processOperation(std::make_shared<InsertOperation>(19, "x"), "bob", 2), nullptr);
+
+    EXPECT_TRUE(manager.removeRegion(greeting));
+    EXPECT_TRUE(manager.processOperation(ValueOperation{DeleteOp{5, 5}}, "alice", 2).has_value());
+    EXPECT_EQ(manager.getLoadStats().operationsLocked, 2u);
+}
+
+TEST(DocumentControllerTest, AnnotationsFollowEditsAndUndo) {
+    DocumentController controller("fix the typo here");
+    const auto note = controller.addAnnotation(8, 12, "ana", "typo");
+    EXPECT_THROW(controller.addAnnotation(8, 40, "ana", "past the end"), std::invalid_argument);
+
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<InsertOperation>(0, "Please "), "bob"));
+    auto view = controller.getAnnotations(0, 100);
+    ASSERT_EQ(view.annotations.size(), 1u);
+    EXPECT_EQ(view.revision, 1);
+    EXPECT_EQ(view.annotations[0].start, 15u);
+    EXPECT_EQ(view.annotations[0].end, 19u);
+    EXPECT_TRUE(controller.getAnnotations(0, 10).annotations.empty());
+
+    ASSERT_TRUE(controller.undo("bob"));
+    view = controller.getAnnotations(0, 100);
+    EXPECT_EQ(view.annotations[0].start, 8u);
+    EXPECT_EQ(controller.getDocument().substr(view.annotations[0].start, 4), "typo");
+
+    EXPECT_TRUE(controller.removeAnnotation(note));
+    EXPECT_TRUE(controller.getAnnotations(0, 100).annotations.empty());
+}
+
+TEST(DocumentControllerTest, PublishesChangesToSubscribersAfterTheLock) {
+    DocumentController controller("abc");
+    auto feed = controller.subscribeChanges();
+    auto slow = controller.subscribeChanges(2);
+    
+    // A subscriber may read the document while it handles events, so none are held under the lock
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<InsertOperation>(3, "d"), "alice"));
+    ASSERT_TRUE(controller.applyOperation(ValueOperation{DeleteOp{0, 1}}, "bob"));
+    ASSERT_TRUE(controller.undo("bob"));
+    
+    auto events = feed->take();
+    ASSERT_EQ(events.size(), 3u);
+    EXPECT_EQ(events[0].revision, 1);
+    EXPECT_EQ(events[0].userId, "alice");
+    EXPECT_EQ(events[1].revision, 2);
+    EXPECT_EQ(events[1].op->getKind(), OperationKind::DELETE);
+    EXPECT_EQ(events[2].revision, 3);
+    EXPECT_EQ(events[2].op->getKind(), OperationKind::INSERT);
+    std::string copy = "abc";
+    for (const auto& event : events) {
+        ASSERT_TRUE(event.op->apply(copy));
+    }
+    EXPECT_EQ(copy, controller.getDocument());
+    EXPECT_TRUE(feed->take().empty());
+    
+    // Two behind, the slow one gets a gap at the latest revision instead
+    events = slow->take();
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_TRUE(events[0].isGap());
+    EXPECT_EQ(events[0].revision, 3);
+    EXPECT_EQ(slow->getGaps(), 1u);
+    
+    // Dropping a subscription unsubscribes it
+    slow.reset();
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<InsertOperation>(0, "!"), "alice"));
+    events = feed->waitFor(std::chrono::seconds(1));
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_EQ(events[0].revision, 4);
+}
+
+TEST(DocumentControllerTest, HibernatesIdleDocumentsAndWakesOnTheNextEdit) {
+    std::string text;
+    for (int i = 0; i < 2000; ++i) {
+        text += "line " + std::to_string(i % 50) + " of a document nobody is editing\n";
+    }
+    DocumentController controller(text);
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<InsertOperation>(0, "# "), "alice"));
+    const auto hashes = controller.getContentHashes(16, 16);
+    
+    // Edited just now, so not idle yet
+    EXPECT_FALSE(controller.hibernateIfIdle(std::chrono::minutes(10)));
+    ASSERT_TRUE(controller.hibernateIfIdle(std::chrono::seconds(0)));
+    EXPECT_TRUE(controller.isHibernating());
+    EXPECT_FALSE(controller.hibernate());
+    EXPECT_LT(controller.getTextBytes() * 5, text.size());
+    EXPECT_EQ(controller.getLoadStats().historyLength, 0u);
+    
+    // Reads see the text and leave it compressed
+    EXPECT_EQ(controller.getDocument(), "# " + text);
+    EXPECT_EQ(controller.getSnapshot().content.toString(), "# " + text);
+    const auto asleep = controller.getContentHashes(16, 16);
+    EXPECT_EQ(asleep.root, hashes.root);
+    EXPECT_EQ(asleep.prefix, hashes.prefix);
+    EXPECT_EQ(asleep.suffix, hashes.suffix);
+    EXPECT_TRUE(controller.isHibernating());
+    
+    // The next edit decompresses it; history starts again from the checkpoint
+    ASSERT_TRUE(controller.applyOperation(std::make_shared<DeleteOperation>(0, 2), "alice"));
+    EXPECT_FALSE(controller.isHibernating());
+    EXPECT_EQ(controller.getDocument(), text);
+    EXPECT_EQ(controller.getRevision(), 2);
+    EXPECT_EQ(controller.getOldestRevision(), 1);
+    EXPECT_EQ(controller.materializeAt(1)->content.toString(), "# " + text);
+    EXPECT_FALSE(controller.transformOperation(std::make_shared<InsertOperation>(0, "y"), 0));
+}
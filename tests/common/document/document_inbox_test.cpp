@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "common/document/document_inbox.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(DocumentInboxTest, DrainsABatchIntoTheDocument) {
+    DocumentController document("abc");
+    DocumentInbox inbox;
+
+    // Only the first post asks for a drain
+    EXPECT_TRUE(inbox.post({std::make_shared<InsertOperation>(0, "x"), "alice", 0}));
+    EXPECT_FALSE(inbox.post({std::make_shared<InsertOperation>(3, "y"), "bob", 0}));
+    EXPECT_FALSE(inbox.post({std::make_shared<InsertOperation>(1, "z"), "carol", 99}));
+    EXPECT_EQ(inbox.pending(), 3u);
+
+    int revisions = 0;
+    document.registerSnapshotCallback([&revisions](const DocumentController::DocumentSnapshot&) { ++revisions; });
+    int flushes = 0;
+    const bool more = inbox.drainInto(document, [&](std::span<const DocumentInbox::Edit> edits,
+                                                    const std::vector<OperationPtr>& applied) {
+        ++flushes;
+        ASSERT_EQ(edits.size(), 3u);
+        ASSERT_EQ(applied.size(), 3u);
+        EXPECT_EQ(edits[1].userId, "bob");
+        // Bob's edit was made on revision 0, so it moves past Alice's
+        EXPECT_EQ(std::static_pointer_cast<InsertOperation>(applied[1])->getPosition(), 4);
+    });
+    EXPECT_FALSE(more);
+    EXPECT_EQ(flushes, 1);
+    EXPECT_EQ(revisions, 1);
+    EXPECT_EQ(document.getRevision(), 3);
+    EXPECT_EQ(document.getDocument(), "xzabcy");
+    EXPECT_EQ(inbox.pending(), 0u);
+
+    // Idle again: the next post asks for a drain
+    EXPECT_TRUE(inbox.post({std::make_shared<DeleteOperation>(0, 1), "alice", 3}));
+}
+
+TEST(DocumentInboxTest, LongInboxesDrainInSeveralBatches) {
+    DocumentInbox inbox;
+    for (int i = 0; i < 5; ++i) {
+        inbox.post({std::make_shared<InsertOperation>(0, "a"), "alice", i});
+    }
+    std::vector<size_t> batches;
+    auto record = [&batches](std::span<DocumentInbox::Edit> edits) { batches.push_back(edits.size()); };
+    EXPECT_TRUE(inbox.drain(record, 2));
+    EXPECT_TRUE(inbox.drain(record, 2));
+    EXPECT_FALSE(inbox.drain(record, 2));
+    EXPECT_EQ(batches, (std::vector<size_t>{2, 2, 1}));
+}
+
+TEST(DocumentInboxTest, ConcurrentPostsAreAllApplied) {
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 500;
+    DocumentController document;
+    DocumentInbox inbox;
+    std::atomic<int> scheduled{0};
+    std::atomic<int> drained{0};
+    std::atomic<bool> done{false};
+
+    // A single actor runs the drains the producers schedule
+    std::thread actor([&]() {
+        while (!done || scheduled > 0) {
+            if (scheduled == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            const bool more = inbox.drainInto(document, [&](std::span<const DocumentInbox::Edit> edits,
+                                                            const std::vector<OperationPtr>&) {
+                drained += static_cast<int>(edits.size());
+            }, 64);
+            if (!more) {
+                --scheduled;
+            }
+        }
+    });
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < PER_PRODUCER; ++i) {
+                if (inbox.post({std::make_shared<InsertOperation>(0, "a"), "user", document.getRevision()})) {
+                    ++scheduled;
+                }
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    done = true;
+    actor.join();
+
+    EXPECT_EQ(drained.load(), PRODUCERS * PER_PRODUCER);
+    EXPECT_EQ(document.getDocument().size(), static_cast<size_t>(PRODUCERS * PER_PRODUCER));
+    EXPECT_EQ(inbox.pending(), 0u);
+}
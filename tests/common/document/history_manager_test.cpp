@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include "common/document/history_manager.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(HistoryManagerTest, UndoesFromTheSharedLogPerUser) {
+    OperationLog log;
+    HistoryManager history(log);
+    
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(0, "a")), "alice");
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(1, "b")), "bob");
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(2, "c")), "alice");
+    EXPECT_EQ(history.undoCount("alice"), 2);
+    EXPECT_EQ(history.totalOperationCount(), 3);
+    
+    HistoryManager::Step undo = history.undo("alice");
+    ASSERT_TRUE(undo.op);
+    EXPECT_EQ(undo.baseRevision, 3);
+    EXPECT_EQ(undo.op->getSource(), OperationSource::LOCAL_UNDO);
+    auto* inverse = dynamic_cast<DeleteOperation*>(undo.op.get());
+    ASSERT_NE(inverse, nullptr);
+    EXPECT_EQ(inverse->getPosition(), 2);
+    EXPECT_EQ(history.undoCount("alice"), 1);
+    EXPECT_EQ(history.undoCount("bob"), 1);
+    
+    // Applied undos are logged like any operation and redone from there
+    history.recordUndo(log.append(std::make_shared<DeleteOperation>(2, 1, "c")), "alice");
+    HistoryManager::Step redo = history.redo("alice");
+    ASSERT_TRUE(redo.op);
+    EXPECT_EQ(redo.baseRevision, 4);
+    EXPECT_EQ(redo.op->getSource(), OperationSource::LOCAL_REDO);
+    history.recordRedo(log.append(redo.op), "alice");
+    EXPECT_EQ(history.undoCount("alice"), 2);
+    EXPECT_FALSE(history.canRedo("alice"));
+    
+    history.clearUserHistory("alice");
+    EXPECT_FALSE(history.canUndo("alice"));
+    EXPECT_EQ(history.totalOperationCount(), 1);
+}
+
+TEST(HistoryManagerTest, DropsEntriesThatLeftTheLog) {
+    OperationLog log(2);
+    HistoryManager history(log);
+    
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(0, "a")), "alice");
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(0, "b")), "alice");
+    log.append(std::make_shared<InsertOperation>(0, "c"));
+    
+    EXPECT_TRUE(history.undo("alice").op);
+    EXPECT_FALSE(history.undo("alice").op);
+    EXPECT_FALSE(history.canUndo("alice"));
+}
+
+TEST(HistoryManagerTest, GroupsConsecutiveTypingIntoOneEntry) {
+    OperationLog log;
+    HistoryManager history(log);
+    auto now = HistoryManager::Clock::now();
+    
+    const std::string text = "hi there";
+    for (size_t i = 0; i < text.size(); ++i) {
+        history.recordOperation(log.append(std::make_shared<InsertOperation>(i, text.substr(i, 1))), "alice", now);
+    }
+    // Someone else's edit in between ends the run
+    log.append(std::make_shared<InsertOperation>(0, ">"));
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(9, "!")), "alice", now);
+    EXPECT_EQ(history.undoCount("alice"), 3);
+    
+    ASSERT_TRUE(history.undo("alice").op);
+    HistoryManager::Step word = history.undo("alice");
+    auto* inverse = dynamic_cast<DeleteOperation*>(word.op.get());
+    ASSERT_NE(inverse, nullptr);
+    EXPECT_EQ(inverse->getPosition(), 3);
+    EXPECT_EQ(inverse->getDeletedText(), "there");
+    EXPECT_EQ(word.baseRevision, 8);
+}
+
+TEST(HistoryManagerTest, ByteBudgetDropsOldestEntries) {
+    OperationLog log;
+    HistoryManager history(log, 1000, UndoGroupingPolicy{std::chrono::milliseconds(0)});
+    
+    for (int i = 0; i < 5; ++i) {
+        history.recordOperation(log.append(std::make_shared<InsertOperation>(0, std::string(100, 'x'))), "alice");
+    }
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(0, "y")), "bob");
+    EXPECT_GE(history.historyBytes("alice"), 500);
+    
+    history.setByteBudget(250);
+    EXPECT_EQ(history.undoCount("alice"), 2);
+    EXPECT_LE(history.historyBytes("alice"), 250);
+    EXPECT_EQ(history.undoCount("bob"), 1);
+    
+    // The newest entry stays however large it is
+    history.recordOperation(log.append(std::make_shared<InsertOperation>(0, std::string(1000, 'z'))), "alice");
+    EXPECT_EQ(history.undoCount("alice"), 1);
+    ASSERT_TRUE(history.undo("alice").op);
+    EXPECT_EQ(history.historyBytes("alice"), 0);
+}
+
+TEST(HistoryManagerTest, DescribesAWindowOfEntriesNewestFirst) {
+    OperationLog log;
+    HistoryManager history(log, 1000, UndoGroupingPolicy{std::chrono::milliseconds(0), true});
+    
+    for (int i = 0; i < 500; ++i) {
+        history.recordOperation(log.append(std::make_shared<InsertOperation>(i, "x")), "alice");
+    }
+    std::string document(500, 'x');
+    HistoryManager::Step undo = history.undo("alice");
+    ASSERT_TRUE(undo.op);
+    history.recordUndo(log.append(undo.op->applyAndCapture(document)), "alice");
+    
+    HistoryManager::HistoryPage page = history.entries("alice", 0, 3);
+    EXPECT_EQ(page.undoCount, 499);
+    EXPECT_EQ(page.redoCount, 1);
+    ASSERT_EQ(page.entries.size(), 3);
+    // The undone entry comes first, as its undo, then the next undo
+    EXPECT_TRUE(page.entries[0].undone);
+    EXPECT_EQ(page.entries[0].first, 500);
+    EXPECT_EQ(page.entries[0].op->getKind(), OperationKind::DELETE);
+    EXPECT_FALSE(page.entries[1].undone);
+    EXPECT_EQ(page.entries[1].first, 498);
+    EXPECT_EQ(page.entries[2].first, 497);
+    
+    // A window past the end holds what exists
+    page = history.entries("alice", 498, 10);
+    ASSERT_EQ(page.entries.size(), 2);
+    EXPECT_EQ(page.entries[1].first, 0);
+    EXPECT_TRUE(history.entries("alice", 500, 10).entries.empty());
+    EXPECT_TRUE(history.entries("bob", 0, 10).entries.empty());
+}
+
+TEST(HistoryManagerTest, DescribesAGroupedEntryAsItsMergedOperations) {
+    OperationLog log;
+    HistoryManager history(log);
+    auto now = HistoryManager::Clock::now();
+    
+    const std::string text = "word";
+    for (size_t i = 0; i < text.size(); ++i) {
+        history.recordOperation(log.append(std::make_shared<InsertOperation>(i, text.substr(i, 1))), "alice", now);
+    }
+    
+    HistoryManager::HistoryPage page = history.entries("alice", 0, 10);
+    ASSERT_EQ(page.entries.size(), 1);
+    EXPECT_EQ(page.entries[0].first, 0);
+    EXPECT_EQ(page.entries[0].last, 3);
+    auto* insert = dynamic_cast<InsertOperation*>(page.entries[0].op.get());
+    ASSERT_NE(insert, nullptr);
+    EXPECT_EQ(insert->getText(), "word");
+    // Describing does not take the operations the log holds
+    EXPECT_EQ(log.at(0)->getKind(), OperationKind::INSERT);
+    EXPECT_EQ(static_cast<InsertOperation&>(*log.at(0)).getText(), "w");
+}
@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+#include "common/models/file_system.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace collab::fs;
+
+namespace {
+
+std::shared_ptr<Directory> workspace() {
+    auto root = std::make_shared<Directory>("", "owner");
+    auto docs = root->createDirectory("docs", "owner");
+    auto specs = docs->createDirectory("specs", "owner");
+    specs->createFile("design.md", "owner", "# Design");
+    docs->createFile("readme.txt", "owner");
+    return root;
+}
+
+} // namespace
+
+TEST(FileSystemTest, LooksUpAbsoluteAndRelativePaths) {
+    auto root = workspace();
+    auto docs = root->getNode("docs")->asDirectory();
+    auto design = root->getNodeByPath("/docs/specs/design.md");
+    ASSERT_NE(design, nullptr);
+    EXPECT_EQ(design->asFile()->getContent(), "# Design");
+    EXPECT_EQ(design->getPath(), "/docs/specs/design.md");
+    EXPECT_EQ(design->getRelativePath(), "docs/specs/design.md");
+
+    EXPECT_EQ(docs->getNodeByPath("specs/design.md"), design);
+    EXPECT_EQ(docs->getNodeByPath("/docs/readme.txt"), root->getNodeByPath("docs/readme.txt"));
+    EXPECT_EQ(docs->getNodeByPath("/"), root);
+    EXPECT_EQ(root->getPath(), "/");
+    EXPECT_EQ(root->getNodeByPath("docs/missing.txt"), nullptr);
+    EXPECT_EQ(root->getNodeByPath("docs/readme.txt/x"), nullptr);
+    EXPECT_EQ(root->getNodeByPath(""), nullptr);
+}
+
+TEST(FileSystemTest, RenameMovesTheSubtreeToItsNewPaths) {
+    auto root = workspace();
+    auto design = root->getNodeByPath("/docs/specs/design.md");
+    ASSERT_TRUE(root->renameNode("docs", "notes"));
+
+    EXPECT_EQ(root->getNodeByPath("/docs/specs/design.md"), nullptr);
+    EXPECT_EQ(root->getNodeByPath("/notes/specs/design.md"), design);
+    EXPECT_EQ(design->getPath(), "/notes/specs/design.md");
+
+    // Renaming a node directly, bypassing its directory, still refreshes the paths below it
+    root->getNodeByPath("notes/specs")->setName("plans");
+    EXPECT_EQ(design->getPath(), "/notes/plans/design.md");
+}
+
+TEST(FileSystemTest, RemovedAndMovedSubtreesLeaveTheIndex) {
+    auto root = workspace();
+    auto docs = root->getNode("docs")->asDirectory();
+    auto specs = docs->getNode("specs");
+    ASSERT_TRUE(docs->removeNode("specs"));
+    EXPECT_EQ(root->getNodeByPath("/docs/specs/design.md"), nullptr);
+    EXPECT_EQ(specs->getPath(), "/specs");
+
+    // Moved into another tree, it is found there
+    auto other = std::make_shared<Directory>("", "owner");
+    auto archive = other->createDirectory("archive", "owner");
+    ASSERT_TRUE(archive->addNode(specs));
+    EXPECT_EQ(other->getNodeByPath("/archive/specs/design.md")->getPath(), "/archive/specs/design.md");
+    EXPECT_EQ(root->getNodeByPath("/docs/specs/design.md"), nullptr);
+}
+
+TEST(FileSystemTest, DirectoriesKeepSubtreeTotals) {
+    auto root = workspace();
+    auto docs = root->getNode("docs")->asDirectory();
+    auto design = root->getNodeByPath("docs/specs/design.md")->asFile();
+    EXPECT_EQ(root->getSize(), 8u);
+    EXPECT_EQ(root->getFileCount(), 2u);
+
+    design->insertContent(8, "\n\nDraft");
+    design->deleteContent(0, 2);
+    EXPECT_EQ(root->getSize(), 13u);
+    EXPECT_EQ(docs->getSize(), 13u);
+    docs->getNode("readme.txt")->asFile()->setContent("read me");
+    EXPECT_EQ(root->getSize(), 20u);
+    EXPECT_EQ(root->getLatestModifiedTime(), docs->getNode("readme.txt")->getModifiedTime());
+
+    auto specs = docs->getNode("specs");
+    ASSERT_TRUE(docs->removeNode("specs"));
+    EXPECT_EQ(root->getSize(), 7u);
+    EXPECT_EQ(root->getFileCount(), 1u);
+    EXPECT_GE(root->getLatestModifiedTime(), docs->getModifiedTime());
+
+    ASSERT_TRUE(root->addNode(specs));
+    EXPECT_EQ(root->getSize(), 20u);
+    EXPECT_EQ(root->getFileCount(), 2u);
+    EXPECT_EQ(docs->getFileCount(), 1u);
+
+    // Edits after the move reach the new parent only
+    design->appendContent("!");
+    EXPECT_EQ(root->getSize(), 21u);
+    EXPECT_EQ(docs->getSize(), 7u);
+}
+
+TEST(FileSystemTest, ListsChildrenInPagesSortedByName) {
+    auto shared = std::make_shared<Directory>("big", "owner");
+    for (int i = 999; i >= 0; --i) {
+        char name[16];
+        std::snprintf(name, sizeof(name), "file%04d", i);
+        shared->createFile(name, "owner");
+    }
+    shared->createDirectory("assets", "owner");
+    ASSERT_EQ(shared->getNodeCount(), 1001u);
+
+    auto first = shared->listChildren(std::string_view(), 10);
+    ASSERT_EQ(first.size(), 10u);
+    EXPECT_EQ(first[0].name, "assets");
+    EXPECT_EQ(first[9].name, "file0008");
+
+    // Walk every page by cursor; renaming one already listed does not shift the rest
+    std::string cursor = first.back().name;
+    ASSERT_TRUE(shared->renameNode("file0003", "zzz"));
+    size_t listed = first.size();
+    std::string previous = cursor;
+    for (auto page = shared->listChildren(cursor, 100); !page.empty(); page = shared->listChildren(cursor, 100)) {
+        for (const auto& entry : page) {
+            EXPECT_LT(previous, entry.name);
+            EXPECT_EQ(entry.node->getName(), entry.name);
+            previous = entry.name;
+        }
+        listed += page.size();
+        cursor = page.back().name;
+    }
+    EXPECT_EQ(listed, 1002u);   // zzz shows up again, at the end
+    EXPECT_EQ(previous, "zzz");
+
+    EXPECT_EQ(shared->listChildren(995, 10).size(), 6u);
+    EXPECT_TRUE(shared->listChildren(2000, 10).empty());
+    EXPECT_EQ(shared->getNode("zzz"), shared->getNodeByPath("zzz"));
+    EXPECT_EQ(shared->getNode("file0003"), nullptr);
+    ASSERT_TRUE(shared->renameNode("zzz", "aaa"));
+    EXPECT_EQ(shared->listChildren(0, 1)[0].name, "aaa");
+    EXPECT_EQ(shared->getFiles().size(), 1000u);
+    EXPECT_EQ(shared->getSubdirectories().size(), 1u);
+}
+
+TEST(FileSystemTest, FilesLoadAndExportInChunks) {
+    auto root = workspace();
+    auto file = root->createFile("big.log", "owner");
+    const std::string text(100000, 'x');
+    size_t offset = 0;
+    file->loadContent([&](char* buffer, size_t capacity) {
+        const size_t take = std::min<size_t>(std::min<size_t>(capacity, 4096), text.size() - offset);
+        std::copy_n(text.data() + offset, take, buffer);
+        offset += take;
+        return take;
+    }, text.size());
+    EXPECT_EQ(file->getContent(), text);
+    EXPECT_EQ(root->getSize(), 8u + text.size());
+
+    std::string exported;
+    size_t chunks = 0;
+    file->exportContent([&](std::string_view chunk) {
+        exported.append(chunk);
+        ++chunks;
+    }, 30000);
+    EXPECT_EQ(exported, text);
+    EXPECT_EQ(chunks, 4u);
+}
+
+TEST(FileSystemTest, ProjectsChangeConcurrentlyWhileOthersReadThem) {
+    auto root = std::make_shared<Directory>("", "owner");
+    constexpr int projects = 4;
+    constexpr int rounds = 200;
+    for (int p = 0; p < projects; ++p) {
+        auto project = root->createDirectory("project" + std::to_string(p), "owner");
+        project->createDirectory("src", "owner")->createFile("main.cpp", "owner", "int main() {}");
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> misses{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; ++r) {
+        readers.emplace_back([&] {
+            while (!done) {
+                for (int p = 0; p < projects; ++p) {
+                    const std::string project = "project" + std::to_string(p);
+                    auto main = root->getNodeByPath("/" + project + "/src/main.cpp");
+                    if (!main || main->getPath() != "/" + project + "/src/main.cpp") {
+                        ++misses;
+                    }
+                    auto directory = root->getNode(project)->asDirectory();
+                    for (const auto& entry : directory->listChildren(std::string_view(), 16)) {
+                        if (entry.node->getRelativePath() != project + "/" + entry.name &&
+                            entry.node->getName() == entry.name) {
+                            ++misses;
+                        }
+                    }
+                    root->getSize();
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int p = 0; p < projects; ++p) {
+        writers.emplace_back([&, p] {
+            auto project = root->getNode("project" + std::to_string(p))->asDirectory();
+            auto notes = project->createFile("notes", "owner");
+            for (int i = 0; i < rounds; ++i) {
+                auto scratch = project->createDirectory("scratch", "owner");
+                scratch->createFile("a.txt", "owner", "12345");
+                ASSERT_TRUE(project->renameNode("scratch", "kept" + std::to_string(i)));
+                notes->appendContent("x");
+                if (i % 2 == 0) {
+                    ASSERT_TRUE(project->removeNode("kept" + std::to_string(i)));
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(misses, 0u);
+    // Per project: main.cpp, notes, and one a.txt in every odd round's directory that was kept
+    const size_t perProject = 13 + rounds + 5 * (rounds / 2);
+    EXPECT_EQ(root->getSize(), projects * perProject);
+    EXPECT_EQ(root->getFileCount(), static_cast<size_t>(projects * (2 + rounds / 2)));
+    auto kept = root->getNodeByPath("/project3/kept199/a.txt");
+    ASSERT_NE(kept, nullptr);
+    EXPECT_EQ(kept->getPath(), "/project3/kept199/a.txt");
+    EXPECT_EQ(root->getNodeByPath("project0/kept198"), nullptr);
+}
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include "common/network/admission_control.h"
+
+using collab::network::AdmissionControl;
+using namespace std::chrono_literals;
+
+TEST(AdmissionControlTest, TokenBucketAdmitsABurstThenTheRate) {
+    AdmissionControl::limits limits;
+    limits.accept_rate = 10;
+    limits.accept_burst = 3;
+    AdmissionControl admission(limits);
+
+    const auto start = AdmissionControl::clock::now();
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(admission.try_admit(start), AdmissionControl::clock::duration::zero());
+    }
+    // The bucket is empty: one token comes every 100ms
+    const auto wait = admission.try_admit(start);
+    EXPECT_GT(wait, 99ms);
+    EXPECT_LE(wait, 100ms);
+    EXPECT_GT(admission.try_admit(start + 50ms), 49ms);
+    EXPECT_EQ(admission.try_admit(start + 100ms), AdmissionControl::clock::duration::zero());
+
+    // A long quiet spell refills no more than the burst
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(admission.try_admit(start + 10s), AdmissionControl::clock::duration::zero());
+    }
+    EXPECT_GT(admission.try_admit(start + 10s), AdmissionControl::clock::duration::zero());
+    EXPECT_EQ(admission.get_stats().rate_limited, 3u);
+}
+
+TEST(AdmissionControlTest, WaitsForPendingHandshakes) {
+    AdmissionControl::limits limits;
+    limits.max_pending = 2;
+    AdmissionControl admission(limits);
+
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(admission.try_admit(), AdmissionControl::clock::duration::zero());
+        admission.begin_handshake();
+    }
+    EXPECT_EQ(admission.try_admit(), AdmissionControl::WAIT_FOR_PENDING);
+
+    admission.record_handshake_timeout();
+    admission.finish_handshake();
+    EXPECT_EQ(admission.try_admit(), AdmissionControl::clock::duration::zero());
+
+    const auto stats = admission.get_stats();
+    EXPECT_EQ(stats.admitted, 2u);
+    EXPECT_EQ(stats.pending, 1u);
+    EXPECT_EQ(stats.pending_limited, 1u);
+    EXPECT_EQ(stats.handshake_timeouts, 1u);
+}
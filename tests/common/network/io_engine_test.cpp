@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <future>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/network/io_engine.h"
+#include "common/util/metrics.h"
+
+using collab::network::IoEngine;
+
+TEST(IoEngineTest, RunsEachContextOnItsOwnThread) {
+    IoEngine engine(4);
+    ASSERT_EQ(engine.size(), 4u);
+    engine.start();
+
+    std::vector<std::thread::id> threads;
+    for (size_t i = 0; i < engine.size(); ++i) {
+        for (int repeat = 0; repeat < 3; ++repeat) {
+            std::promise<std::thread::id> ran;
+            boost::asio::post(engine.context(i), [&ran] { ran.set_value(std::this_thread::get_id()); });
+            threads.push_back(ran.get_future().get());
+        }
+    }
+    engine.stop();
+
+    // Every handler of a context ran on the same thread, and no two contexts share one
+    std::set<std::thread::id> distinct;
+    for (size_t i = 0; i < engine.size(); ++i) {
+        EXPECT_EQ(threads[3 * i], threads[3 * i + 1]);
+        EXPECT_EQ(threads[3 * i], threads[3 * i + 2]);
+        distinct.insert(threads[3 * i]);
+    }
+    EXPECT_EQ(distinct.size(), engine.size());
+}
+
+TEST(IoEngineTest, HandsOutContextsRoundRobinAndRestarts) {
+    IoEngine engine(3);
+    boost::asio::io_context* first = &engine.next();
+    EXPECT_NE(&engine.next(), first);
+    EXPECT_NE(&engine.next(), first);
+    EXPECT_EQ(&engine.next(), first);
+
+    // Work posted while stopped runs once the engine starts again
+    std::promise<void> ran;
+    boost::asio::post(engine.context(1), [&ran] { ran.set_value(); });
+    engine.start();
+    engine.stop();
+    engine.start();
+    EXPECT_EQ(ran.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+}
+
+TEST(IoEngineTest, NamesItsBackend) {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    EXPECT_STREQ(IoEngine::backend_name(), "io_uring");
+#elif defined(__linux__)
+    EXPECT_STREQ(IoEngine::backend_name(), "epoll");
+#else
+    EXPECT_NE(std::string(IoEngine::backend_name()), "");
+#endif
+}
+
+TEST(IoEngineTest, BusyPollsAndBacksOffWhileIdle) {
+    IoEngine engine(2, false, "busy_poll_test");
+    IoEngine::busy_poll options;
+    options.spin_polls = 100;
+    options.yield_polls = 10;
+    options.park = std::chrono::microseconds(200);
+    engine.set_busy_poll(options);
+    engine.start();
+
+    // Handlers posted while the threads spin, and after they have parked, both run
+    for (int round = 0; round < 2; ++round) {
+        std::vector<std::promise<void>> ran(engine.size());
+        for (size_t i = 0; i < engine.size(); ++i) {
+            boost::asio::post(engine.context(i), [&ran, i] { ran[i].set_value(); });
+        }
+        for (auto& promise : ran) {
+            EXPECT_EQ(promise.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    engine.stop();
+
+    auto& registry = collab::util::metrics();
+    EXPECT_GE(registry.counter("collab_io_polls_total", "", {{"role", "busy_poll_test"}, {"result", "work"}}).value(), 2u);
+    EXPECT_GT(registry.counter("collab_io_polls_total", "", {{"role", "busy_poll_test"}, {"result", "empty"}}).value(), 0u);
+    EXPECT_GT(registry.histogram("collab_io_idle_seconds", "", {{"role", "busy_poll_test"}, {"waited", "parked"}},
+                                 collab::util::NANOSECONDS_PER_SECOND).snapshot().count, 0u);
+}
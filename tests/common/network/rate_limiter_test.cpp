@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include "common/network/rate_limiter.h"
+
+using collab::network::RateLimiter;
+using namespace std::chrono_literals;
+
+TEST(RateLimiterTest, SessionsSpendTheirOwnBuckets) {
+    RateLimiter::limits limits;
+    limits.session_ops = {10, 2};
+    RateLimiter limiter(limits);
+    ASSERT_TRUE(limiter.enabled());
+
+    const auto start = RateLimiter::clock::now();
+    EXPECT_TRUE(limiter.admit_edit("a", "doc", 1, start).admitted);
+    EXPECT_TRUE(limiter.admit_edit("a", "doc", 1, start).admitted);
+    // The burst is spent: one edit every 100ms, and only the first refusal is to be told
+    const auto refused = limiter.admit_edit("a", "doc", 1, start);
+    EXPECT_FALSE(refused.admitted);
+    EXPECT_TRUE(refused.notify);
+    EXPECT_GT(refused.retry_after, 99ms);
+    EXPECT_LE(refused.retry_after, 100ms);
+    EXPECT_FALSE(limiter.admit_edit("a", "doc", 1, start + 50ms).notify);
+
+    // Another session is not held back
+    EXPECT_TRUE(limiter.admit_edit("b", "doc", 1, start).admitted);
+    EXPECT_TRUE(limiter.admit_edit("a", "doc", 1, start + 100ms).admitted);
+    // A refusal after an admission starts a new run, to be told again
+    EXPECT_TRUE(limiter.admit_edit("a", "doc", 1, start + 120ms).notify);
+
+    const auto stats = limiter.get_stats();
+    EXPECT_EQ(stats.edits_admitted, 4u);
+    EXPECT_EQ(stats.edits_limited, 3u);
+    EXPECT_EQ(stats.sessions, 2u);
+    limiter.forget_session("a");
+    EXPECT_EQ(limiter.get_stats().sessions, 1u);
+}
+
+TEST(RateLimiterTest, DocumentsChargeBytesAndOpsTogether) {
+    RateLimiter::limits limits;
+    limits.document_ops = {100, 10};
+    limits.document_bytes = {1000, 100};
+    RateLimiter limiter(limits);
+
+    const auto start = RateLimiter::clock::now();
+    // Two sessions share the document's bytes
+    EXPECT_TRUE(limiter.admit_edit("a", "doc", 60, start).admitted);
+    const auto refused = limiter.admit_edit("b", "doc", 60, start);
+    EXPECT_FALSE(refused.admitted);
+    EXPECT_GT(refused.retry_after, 19ms);
+    EXPECT_LE(refused.retry_after, 20ms);
+    // A refused edit charged nothing, so a small one still fits
+    EXPECT_TRUE(limiter.admit_edit("b", "doc", 40, start).admitted);
+    EXPECT_TRUE(limiter.admit_edit("b", "other", 60, start).admitted);
+
+    // More than a burst passes once the bucket is full, and leaves it in debt
+    EXPECT_TRUE(limiter.admit_edit("a", "big", 150, start).admitted);
+    EXPECT_FALSE(limiter.admit_edit("a", "big", 1, start).admitted);
+    EXPECT_TRUE(limiter.admit_edit("a", "big", 1, start + 52ms).admitted);
+}
+
+TEST(RateLimiterTest, FramesAreChargedTheirBytes) {
+    RateLimiter limiter;
+    EXPECT_FALSE(limiter.enabled());
+    EXPECT_TRUE(limiter.admit_frame("a", 1 << 20).admitted);
+
+    RateLimiter::limits limits;
+    limits.session_bytes = {1000, 500};
+    limiter.set_limits(limits);
+    const auto start = RateLimiter::clock::now();
+    EXPECT_TRUE(limiter.admit_frame("a", 400, start).admitted);
+    const auto refused = limiter.admit_frame("a", 400, start);
+    EXPECT_FALSE(refused.admitted);
+    EXPECT_TRUE(refused.notify);
+    EXPECT_GT(refused.retry_after, 299ms);
+    EXPECT_LE(refused.retry_after, 300ms);
+    EXPECT_TRUE(limiter.admit_frame("a", 400, start + 301ms).admitted);
+    EXPECT_EQ(limiter.get_stats().frames_limited, 1u);
+}
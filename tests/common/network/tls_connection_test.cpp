@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/network/tcp_connection.h"
+
+using namespace collab::network;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Credentials {
+    std::string certificate;
+    std::string key;
+};
+
+std::string pem(BIO* bio) {
+    char* data = nullptr;
+    const long size = BIO_get_mem_data(bio, &data);
+    std::string text(data, static_cast<size_t>(size));
+    BIO_free(bio);
+    return text;
+}
+
+// A self-signed certificate for a host name, trusted by the clients of these tests
+Credentials selfSigned(const std::string& host) {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* certificate = X509_new();
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_set_pubkey(certificate, key);
+    X509_NAME* name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(host.c_str()), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509V3_CTX context;
+    X509V3_set_ctx_nodb(&context);
+    X509V3_set_ctx(&context, certificate, certificate, nullptr, nullptr, 0);
+    X509_EXTENSION* alternative = X509V3_EXT_conf_nid(nullptr, &context, NID_subject_alt_name, ("DNS:" + host).c_str());
+    X509_add_ext(certificate, alternative, -1);
+    X509_EXTENSION_free(alternative);
+    X509_sign(certificate, key, EVP_sha256());
+
+    Credentials credentials;
+    BIO* out = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(out, certificate);
+    credentials.certificate = pem(out);
+    out = BIO_new(BIO_s_mem());
+    PEM_write_bio_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+    credentials.key = pem(out);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    return credentials;
+}
+
+// A TLS server that echoes every frame back as a length-prefixed one
+class EchoServer {
+public:
+    explicit EchoServer(const TlsContext::options& options)
+        : context(TlsContext::create(TlsContext::role::server, options))
+        , server_(io_, 0) {
+        server_.set_tls(context);
+        server_.set_connection_handler([](TcpConnection::pointer connection) {
+            connection->set_message_handler([](TcpConnection::pointer from, std::string_view payload) {
+                from->write_binary(std::string(payload));
+            });
+        });
+        server_.start();
+        thread_ = std::thread([this] { io_.run(); });
+    }
+
+    ~EchoServer() {
+        io_.stop();
+        thread_.join();
+        server_.stop();
+    }
+
+    unsigned short port() const {
+        return server_.port();
+    }
+
+    TlsContext::pointer context;
+
+private:
+    boost::asio::io_context io_;
+    TcpServer server_;
+    std::thread thread_;
+};
+
+// Connect, send each frame, and wait for all of them to come back
+struct EchoResult {
+    std::vector<std::string> frames;
+    bool resumed = false;
+    bool kernelEncrypted = false;
+};
+
+EchoResult echo(const TlsContext::pointer& context, unsigned short port, const std::vector<std::string>& frames) {
+    boost::asio::io_context io;
+    TcpClient client(io);
+    client.set_tls(context);
+    std::promise<void> done;
+    EchoResult result;
+    TcpConnection::pointer connection;
+    client.set_error_handler([&done](const std::string& error) {
+        done.set_exception(std::make_exception_ptr(std::runtime_error(error)));
+    });
+    client.set_connection_handler([&](TcpConnection::pointer connected) {
+        connection = connected;
+        connected->set_close_handler([&done, &result, &frames](TcpConnection::pointer) {
+            if (result.frames.size() < frames.size()) {
+                done.set_exception(std::make_exception_ptr(std::runtime_error("closed")));
+            }
+        });
+        connected->set_message_handler([&](TcpConnection::pointer from, std::string_view payload) {
+            result.frames.emplace_back(payload);
+            if (result.frames.size() == frames.size()) {
+                result.resumed = from->is_resumed();
+                result.kernelEncrypted = from->is_kernel_encrypted();
+                done.set_value();
+            }
+        });
+        // Queued before the handshake is done; they go out once it is
+        for (const auto& frame : frames) {
+            connected->write_binary(frame);
+        }
+    });
+    client.connect("localhost", std::to_string(port));
+    std::thread runner([&io] { io.run(); });
+    auto finished = done.get_future();
+    const bool ready = finished.wait_for(10s) == std::future_status::ready;
+    io.stop();
+    runner.join();
+    if (connection) {
+        connection->close();
+    }
+    EXPECT_TRUE(ready);
+    if (ready) {
+        finished.get();
+    }
+    return result;
+}
+
+} // namespace
+
+TEST(TlsConnectionTest, EncryptsFramesOfAnySize) {
+    const Credentials credentials = selfSigned("localhost");
+    for (const bool offload : {false, true}) {
+        TlsContext::options serverOptions;
+        serverOptions.certificate_chain = credentials.certificate;
+        serverOptions.private_key = credentials.key;
+        serverOptions.kernel_offload = offload;
+        EchoServer server(serverOptions);
+
+        TlsContext::options clientOptions;
+        clientOptions.trusted_certificates = credentials.certificate;
+        clientOptions.kernel_offload = offload;
+        auto client = TlsContext::create(TlsContext::role::client, clientOptions);
+
+        // Small frames share records; the large one spans many
+        std::vector<std::string> frames;
+        for (int i = 0; i < 50; ++i) {
+            frames.push_back("frame " + std::to_string(i));
+        }
+        std::string large(300 * 1024, 'x');
+        for (size_t i = 0; i < large.size(); ++i) {
+            large[i] = static_cast<char>(i % 251);
+        }
+        frames.push_back(large);
+        frames.push_back("after");
+
+        const EchoResult result = echo(client, server.port(), frames);
+        EXPECT_EQ(result.frames, frames);
+        EXPECT_FALSE(result.resumed);
+        const TlsContext::stats stats = client->get_stats();
+        EXPECT_EQ(stats.handshakes, 1u);
+        EXPECT_EQ(stats.failed, 0u);
+        EXPECT_EQ(stats.kernel_send, result.kernelEncrypted ? 1u : 0u);
+        if (!offload) {
+            EXPECT_FALSE(result.kernelEncrypted);
+        }
+    }
+}
+
+TEST(TlsConnectionTest, ReconnectsResumeFromTheServersTicket) {
+    const Credentials credentials = selfSigned("localhost");
+    TlsContext::options serverOptions;
+    serverOptions.certificate_chain = credentials.certificate;
+    serverOptions.private_key = credentials.key;
+    serverOptions.ticket_keys = std::string(TlsContext::TICKET_KEYS_SIZE, 'k');
+    EchoServer server(serverOptions);
+
+    TlsContext::options clientOptions;
+    clientOptions.trusted_certificates = credentials.certificate;
+    auto client = TlsContext::create(TlsContext::role::client, clientOptions);
+
+    EXPECT_FALSE(echo(client, server.port(), {"first"}).resumed);
+    EXPECT_EQ(client->get_stats().cached_sessions, 1u);
+    EXPECT_TRUE(echo(client, server.port(), {"second"}).resumed);
+
+    // Another node with the same ticket keys resumes it too
+    EchoServer other(serverOptions);
+    EXPECT_TRUE(echo(client, other.port(), {"third"}).resumed);
+    EXPECT_EQ(client->get_stats().resumed, 2u);
+    EXPECT_EQ(server.context->get_stats().resumed, 1u);
+
+    // A client that does not trust the server's certificate does not get through
+    TlsContext::options stranger;
+    stranger.trusted_certificates = selfSigned("localhost").certificate;
+    auto untrusting = TlsContext::create(TlsContext::role::client, stranger);
+    EXPECT_THROW(echo(untrusting, server.port(), {"rejected"}), std::runtime_error);
+    EXPECT_EQ(untrusting->get_stats().failed, 1u);
+}
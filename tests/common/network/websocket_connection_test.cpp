@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include "common/network/tcp_connection.h"
+
+using namespace collab::network;
+using namespace std::chrono_literals;
+namespace websocket = boost::beast::websocket;
+
+namespace {
+
+// Echoes text frames as text, and "binary:" ones as binary without the prefix
+class EchoServer {
+public:
+    EchoServer()
+        : server_(io_, 0) {
+        server_.set_connection_handler([](TcpConnection::pointer connection) {
+            connection->set_message_handler([](TcpConnection::pointer from, std::string_view payload) {
+                constexpr std::string_view binary = "binary:";
+                if (payload.substr(0, binary.size()) == binary) {
+                    from->write_binary(std::string(payload.substr(binary.size())));
+                } else {
+                    from->write(std::string(payload) + (from->is_websocket() ? " over websocket" : ""));
+                }
+            });
+        });
+        server_.start();
+        thread_ = std::thread([this] { io_.run(); });
+    }
+
+    ~EchoServer() {
+        io_.stop();
+        thread_.join();
+        server_.stop();
+    }
+
+    unsigned short port() const {
+        return server_.port();
+    }
+
+private:
+    boost::asio::io_context io_;
+    TcpServer server_;
+    std::thread thread_;
+};
+
+std::string receive(websocket::stream<boost::asio::ip::tcp::socket>& ws, bool& text) {
+    boost::beast::flat_buffer buffer;
+    ws.read(buffer);
+    text = ws.got_text();
+    return boost::beast::buffers_to_string(buffer.data());
+}
+
+} // namespace
+
+TEST(WebSocketConnectionTest, ServesWebSocketClientsOnTheSameServer) {
+    EchoServer server;
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::socket socket(io);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), server.port()});
+    websocket::stream<boost::asio::ip::tcp::socket> ws(std::move(socket));
+    ws.handshake("localhost", "/");
+
+    bool text = false;
+    ws.text(true);
+    ws.write(boost::asio::buffer(std::string("{\"type\":1}")));
+    EXPECT_EQ(receive(ws, text), "{\"type\":1} over websocket");
+    EXPECT_TRUE(text);
+
+    // Binary payloads go out as binary frames, large ones with 64-bit lengths
+    const std::string large(100000, 'x');
+    ws.binary(true);
+    ws.write(boost::asio::buffer("binary:" + large));
+    EXPECT_EQ(receive(ws, text), large);
+    EXPECT_FALSE(text);
+
+    // A fragmented message is delivered whole
+    ws.text(true);
+    ws.write_some(false, boost::asio::buffer(std::string("frag")));
+    ws.write_some(false, boost::asio::buffer(std::string("men")));
+    ws.write_some(true, boost::asio::buffer(std::string("ted")));
+    EXPECT_EQ(receive(ws, text), "fragmented over websocket");
+
+    // Pings are answered, and a close is echoed
+    std::promise<void> ponged;
+    ws.control_callback([&ponged](websocket::frame_type kind, boost::beast::string_view) {
+        if (kind == websocket::frame_type::pong) {
+            ponged.set_value();
+        }
+    });
+    ws.ping({});
+    ws.write(boost::asio::buffer(std::string("after ping")));
+    EXPECT_EQ(receive(ws, text), "after ping over websocket");
+    EXPECT_EQ(ponged.get_future().wait_for(0s), std::future_status::ready);
+    // Returns once the server's close arrives
+    boost::system::error_code ec;
+    ws.close(websocket::close_code::normal, ec);
+    EXPECT_FALSE(ec) << ec.message();
+}
+
+TEST(WebSocketConnectionTest, RawClientsAndBadUpgradesAreToldApart) {
+    EchoServer server;
+    boost::asio::io_context io;
+
+    // A raw client is served as before
+    boost::asio::ip::tcp::socket raw(io);
+    raw.connect({boost::asio::ip::make_address("127.0.0.1"), server.port()});
+    boost::asio::write(raw, boost::asio::buffer(std::string("{\"type\":2}\n")));
+    boost::asio::streambuf line;
+    boost::asio::read_until(raw, line, '\n');
+    EXPECT_EQ(std::string(boost::asio::buffers_begin(line.data()), boost::asio::buffers_end(line.data())),
+              "{\"type\":2}\n");
+
+    // A GET that is not an upgrade is refused and closed
+    boost::asio::ip::tcp::socket http(io);
+    http.connect({boost::asio::ip::make_address("127.0.0.1"), server.port()});
+    boost::asio::write(http, boost::asio::buffer(std::string("GET / HTTP/1.1\r\nHost: x\r\n\r\n")));
+    std::string response;
+    boost::system::error_code ec;
+    boost::asio::read(http, boost::asio::dynamic_buffer(response), ec);
+    EXPECT_EQ(ec, boost::asio::error::eof);
+    EXPECT_EQ(response.rfind("HTTP/1.1 400", 0), 0u);
+
+    EXPECT_EQ(WebSocketFraming::accept_key("dGhlIHNhbXBsZSBub25jZQ=="), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
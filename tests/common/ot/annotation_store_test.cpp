@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "common/ot/annotation_store.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+namespace {
+
+InsertOperation insertAt(size_t position, const std::string& text) {
+    return InsertOperation(position, text);
+}
+
+DeleteOperation deleteAt(size_t position, size_t length) {
+    return DeleteOperation(position, length);
+}
+
+} // namespace
+
+TEST(AnnotationStoreTest, AnchorsStickToTheirTextThroughEdits) {
+    // "hello world"
+    AnnotationStore store(11);
+    const auto word = store.add(6, 11, "ana", "Which world?");
+    const auto point = store.add(5, 5, "ben", "Comma here");
+    EXPECT_THROW(store.add(4, 12, "ana", "Too long"), std::invalid_argument);
+
+    // Text typed at a range's edges or at a point lands outside it
+    ASSERT_TRUE(store.apply(insertAt(6, "big ")));     // "hello big world"
+    ASSERT_TRUE(store.apply(insertAt(15, "!")));       // "hello big world!"
+    ASSERT_TRUE(store.apply(insertAt(5, ",")));        // "hello, big world!"
+    EXPECT_TRUE(store.pending());
+    EXPECT_EQ(store.find(word)->start, 11u);
+    EXPECT_EQ(store.find(word)->end, 16u);
+    EXPECT_EQ(store.find(point)->start, 5u);
+    EXPECT_EQ(store.find(point)->end, 5u);
+    EXPECT_FALSE(store.pending());
+
+    // Text typed inside it grows it; deleting its text leaves a point
+    ASSERT_TRUE(store.apply(insertAt(13, "rrr")));     // "hello, big worrrrld!"
+    EXPECT_EQ(store.find(word)->end, 19u);
+    ASSERT_TRUE(store.apply(deleteAt(7, 13)));         // "hello, "
+    const auto collapsed = store.find(word);
+    EXPECT_EQ(collapsed->start, 7u);
+    EXPECT_EQ(collapsed->end, 7u);
+    EXPECT_EQ(collapsed->text, "Which world?");
+
+    // An edit that does not fit changes nothing
+    EXPECT_FALSE(store.apply(deleteAt(5, 10)));
+    EXPECT_EQ(store.length(), 7u);
+
+    EXPECT_TRUE(store.remove(point));
+    EXPECT_FALSE(store.remove(point));
+    EXPECT_EQ(store.size(), 1u);
+}
+
+TEST(AnnotationStoreTest, TypingComposesWithoutTouchingTheAnchorsUntilRead) {
+    const size_t comments = 10000;
+    AnnotationStore store(comments * 10);
+    for (size_t i = 0; i < comments; ++i) {
+        store.add(i * 10, i * 10 + 5, "bot", "Comment " + std::to_string(i));
+    }
+
+    // A thousand keystrokes in one place compose into one insert
+    for (size_t i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(store.apply(insertAt(52 + i, "x")));
+    }
+    EXPECT_EQ(store.rebases(), 0u);
+    EXPECT_EQ(store.length(), comments * 10 + 1000);
+
+    // Read once: one pass moves them all
+    const auto annotations = store.all();
+    EXPECT_EQ(store.rebases(), 1u);
+    ASSERT_EQ(annotations.size(), comments);
+    EXPECT_EQ(annotations[5].start, 50u);
+    EXPECT_EQ(annotations[5].end, 1055u);
+    EXPECT_EQ(annotations[6].start, 1060u);
+    EXPECT_EQ(annotations.back().end, (comments - 1) * 10 + 5 + 1000);
+
+    // Edits all over the document rebase once they no longer compose small
+    for (size_t i = 0; i < 2 * AnnotationStore::REBASE_THRESHOLD; ++i) {
+        ASSERT_TRUE(store.apply(deleteAt(i * 500, 1)));
+    }
+    EXPECT_GE(store.rebases(), 2u);
+    EXPECT_LT(store.rebases(), 2 * AnnotationStore::REBASE_THRESHOLD);
+}
+
+TEST(AnnotationStoreTest, ServesOnlyTheViewportsAnnotations) {
+    AnnotationStore store(1000);
+    std::vector<AnnotationStore::Id> ids;
+    for (size_t i = 0; i < 100; ++i) {
+        ids.push_back(store.add(i * 10, i * 10 + 3, "ana", "Note " + std::to_string(i)));
+    }
+    // One long annotation that spans every viewport
+    const auto chapter = store.add(0, 1000, "ben", "Rewrite this chapter");
+
+    const auto viewport = store.inRange(502, 531);
+    ASSERT_EQ(viewport.size(), 5u);
+    EXPECT_EQ(viewport[0].id, chapter);
+    EXPECT_EQ(viewport[1].start, 500u);
+    EXPECT_EQ(viewport[4].start, 530u);
+
+    auto json = nlohmann::json::parse(AnnotationStore::serialize(viewport));
+    ASSERT_EQ(json.size(), 5u);
+    EXPECT_EQ(json[1]["text"], "Note 50");
+    EXPECT_EQ(json[1]["start"], 500);
+
+    EXPECT_TRUE(store.remove(chapter));
+    EXPECT_EQ(store.inRange(504, 509).size(), 0u);
+    EXPECT_EQ(store.inRange(503, 509).size(), 1u);
+}
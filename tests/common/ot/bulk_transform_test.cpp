@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "common/ot/bulk_transform.h"
+#include "common/document/document_controller.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+namespace {
+
+std::vector<OperationPtr> typingHistory(size_t count) {
+    // Someone typing at the start of the line while deleting from the end
+    std::vector<OperationPtr> history;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 3 == 2) {
+            history.push_back(std::make_shared<DeleteOperation>(i, 1));
+        } else {
+            history.push_back(std::make_shared<InsertOperation>(i, "x"));
+        }
+    }
+    return history;
+}
+
+} // namespace
+
+TEST(BulkTransformTest, MatchesStepwiseTransform) {
+    const std::string base = "0123456789abcdefghijklmnopqrstuvwxyz0123456789";
+    auto history = typingHistory(30);
+    
+    std::vector<OperationPtr> incoming = {
+        std::make_shared<InsertOperation>(40, "!"),
+        std::make_shared<InsertOperation>(0, "^"),
+        std::make_shared<DeleteOperation>(42, 3),
+        std::make_shared<DeleteOperation>(0, 10),
+        std::make_shared<InsertOperation>(4, "="),
+    };
+    
+    for (const auto& op : incoming) {
+        OperationPtr stepwise = op;
+        for (const auto& entry : history) {
+            stepwise = stepwise->transform(entry);
+        }
+        
+        OperationPtr bulk = transformAgainst(*op, std::span<const OperationPtr>(history));
+        EXPECT_EQ(bulk->serialize(), stepwise->serialize());
+        
+        std::string expected = base;
+        std::string actual = base;
+        for (const auto& entry : history) {
+            ASSERT_TRUE(entry->apply(expected));
+            ASSERT_TRUE(entry->apply(actual));
+        }
+        ASSERT_TRUE(stepwise->apply(expected));
+        ASSERT_TRUE(bulk->apply(actual));
+        EXPECT_EQ(actual, expected);
+    }
+}
+
+TEST(BulkTransformTest, ComposerExtendsCachedRange) {
+    auto history = typingHistory(10);
+    std::span<const OperationPtr> all(history);
+    HistoryComposer composer;
+    
+    const TextOperation& prefix = composer.compose(0, all.first(4), 20);
+    EXPECT_EQ(prefix.getBaseLength(), 20);
+    
+    const TextOperation& full = composer.compose(0, all, 20);
+    EXPECT_EQ(composer.size(), 1);
+    
+    std::string viaComposed(20, '.');
+    std::string viaSteps = viaComposed;
+    ASSERT_TRUE(full.apply(viaComposed));
+    for (const auto& op : history) {
+        ASSERT_TRUE(op->apply(viaSteps));
+    }
+    EXPECT_EQ(viaComposed, viaSteps);
+    
+    composer.invalidateFrom(5);
+    EXPECT_EQ(composer.size(), 0);
+}
+
+TEST(BulkTransformTest, DocumentControllerMatchesStepwiseHoweverFarBehind) {
+    // A delete around text someone typed into it, from just short of to well past 32 revisions behind,
+    // where the composed history used to take over
+    for (size_t behind : {1, 31, 32, 33, 64}) {
+        DocumentController controller("0123456789");
+        std::vector<OperationPtr> history = {std::make_shared<InsertOperation>(5, "X")};
+        ASSERT_TRUE(controller.applyOperation(history.front(), "alice", false));
+        for (size_t i = 1; i < behind; ++i) {
+            history.push_back(std::make_shared<InsertOperation>(11 + i - 1, "a"));
+            ASSERT_TRUE(controller.applyOperation(history.back(), "alice", false));
+        }
+        
+        auto op = std::make_shared<DeleteOperation>(0, 10);
+        op->setId(99);
+        OperationPtr stepwise = op;
+        for (const auto& entry : history) {
+            stepwise = stepwise->transform(entry);
+        }
+        auto result = controller.transformOperation(op, 0);
+        ASSERT_TRUE(result);
+        EXPECT_EQ(result->serialize(), stepwise->serialize()) << behind << " revisions behind";
+        EXPECT_EQ(result->getId(), 99);
+        
+        ASSERT_TRUE(controller.applyOperation(result, "bob"));
+        EXPECT_EQ(controller.getDocument(), "X" + std::string(behind - 1, 'a'));
+    }
+}
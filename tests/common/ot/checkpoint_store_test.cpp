@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+#include "common/ot/checkpoint_store.h"
+
+using namespace collab::ot;
+
+TEST(CheckpointStoreTest, ReplaysFromTheNearestCheckpoint) {
+    CheckpointStore store(4);
+    OperationLog log;
+    Rope document("");
+    store.reset(document, 0);
+    
+    for (int i = 0; i < 10; ++i) {
+        auto op = std::make_shared<InsertOperation>(document.length(), std::to_string(i));
+        ASSERT_TRUE(op->apply(document));
+        log.append(op);
+        store.record(*op, document, log.headRevision());
+    }
+    
+    EXPECT_EQ(store.size(), 3);
+    EXPECT_EQ(store.materializeAt(0, log)->toString(), "");
+    EXPECT_EQ(store.materializeAt(4, log)->toString(), "0123");
+    EXPECT_EQ(store.materializeAt(7, log)->toString(), "0123456");
+    EXPECT_EQ(store.materializeAt(10, log)->toString(), "0123456789");
+    EXPECT_FALSE(store.materializeAt(11, log));
+}
+
+TEST(CheckpointStoreTest, CheckpointsAfterEnoughChangedBytes) {
+    CheckpointStore store(1000, 8);
+    OperationLog log(2);
+    Rope document("");
+    store.reset(document, 0);
+    
+    for (const char* text : {"abcd", "efgh", "ij"}) {
+        auto op = std::make_shared<InsertOperation>(document.length(), text);
+        ASSERT_TRUE(op->apply(document));
+        log.append(op);
+        store.record(*op, document, log.headRevision());
+    }
+    
+    // Revision 1 needs the first operation, which the log has dropped
+    EXPECT_EQ(store.size(), 2);
+    EXPECT_FALSE(store.materializeAt(1, log));
+    EXPECT_EQ(store.materializeAt(0, log)->toString(), "");
+    EXPECT_EQ(store.materializeAt(3, log)->toString(), "abcdefghij");
+}
@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+#include "common/ot/client_sync.h"
+#include "common/document/document_controller.h"
+#include "common/document/operation_manager.h"
+#include <deque>
+
+using namespace collab;
+using namespace collab::ot;
+
+namespace {
+
+// A client with its own copy of the document, talking to the server through queues
+struct TestClient {
+    std::string name;
+    std::string document;
+    ClientSync sync;
+    std::deque<std::pair<OperationPtr, int64_t>> outbox;
+    std::deque<OperationPtr> inbox; // nullptr is the ack of the client's own operation
+    
+    TestClient(std::string name, const std::string& document)
+        : name(std::move(name)), document(document), sync(0, document.size()) {
+        sync.setSendCallback([this](const OperationPtr& op, int64_t revision) {
+            outbox.emplace_back(op, revision);
+        });
+    }
+    
+    void edit(const OperationPtr& op) {
+        ASSERT_TRUE(op->apply(document));
+        sync.applyClient(*op);
+    }
+    
+    void receiveAll() {
+        while (!inbox.empty()) {
+            OperationPtr op = inbox.front();
+            inbox.pop_front();
+            if (!op) {
+                sync.serverAck();
+            } else {
+                ASSERT_TRUE(sync.applyServer(*op)->apply(document));
+            }
+        }
+    }
+};
+
+// Apply everything the clients sent and route the results back
+size_t serve(DocumentController& server, std::vector<TestClient*> clients) {
+    size_t received = 0;
+    for (TestClient* sender : clients) {
+        while (!sender->outbox.empty()) {
+            auto [op, revision] = sender->outbox.front();
+            sender->outbox.pop_front();
+            ++received;
+            
+            OperationPtr transformed = server.transformOperation(op, revision);
+            EXPECT_TRUE(transformed && server.applyOperation(transformed, sender->name));
+            for (TestClient* client : clients) {
+                client->inbox.push_back(client == sender ? nullptr : transformed);
+            }
+        }
+    }
+    return received;
+}
+
+} // namespace
+
+TEST(ClientSyncTest, BuffersEditsWhileOneIsInFlight) {
+    ClientSync sync(0, 5);
+    std::vector<std::pair<OperationPtr, int64_t>> sent;
+    sync.setSendCallback([&](const OperationPtr& op, int64_t revision) { sent.emplace_back(op, revision); });
+    
+    sync.applyClient(InsertOperation(5, "!"));
+    EXPECT_EQ(sync.getState(), ClientSync::State::AWAITING_CONFIRM);
+    sync.applyClient(InsertOperation(6, "?"));
+    sync.applyClient(InsertOperation(0, ">"));
+    EXPECT_EQ(sync.getState(), ClientSync::State::AWAITING_WITH_BUFFER);
+    EXPECT_EQ(sent.size(), 1);
+    
+    sync.serverAck();
+    ASSERT_EQ(sent.size(), 2);
+    EXPECT_EQ(sent[1].second, 1);
+    std::string document = "hello!";
+    ASSERT_TRUE(sent[1].first->apply(document));
+    EXPECT_EQ(document, ">hello!?");
+    
+    sync.serverAck();
+    EXPECT_EQ(sync.getState(), ClientSync::State::SYNCHRONIZED);
+    EXPECT_EQ(sync.getRevision(), 2);
+    EXPECT_THROW(sync.serverAck(), std::logic_error);
+}
+
+TEST(ClientSyncTest, ConvergesWithOneOperationPerRoundTrip) {
+    DocumentController server("shared text");
+    TestClient alice("alice", "shared text");
+    TestClient bob("bob", "shared text");
+    
+    // Both type a burst while the first edit of each is in flight
+    for (int i = 0; i < 5; ++i) {
+        alice.edit(std::make_shared<InsertOperation>(i, "a"));
+        bob.edit(std::make_shared<InsertOperation>(bob.document.size(), "b"));
+    }
+    bob.edit(std::make_shared<DeleteOperation>(0, 3));
+    alice.edit(std::make_shared<InsertOperation>(5, "|"));
+    
+    EXPECT_EQ(serve(server, {&alice, &bob}), 2);
+    
+    // Remote edits arrive while each still has its buffer waiting
+    alice.edit(std::make_shared<InsertOperation>(0, "<"));
+    alice.receiveAll();
+    bob.receiveAll();
+    EXPECT_EQ(serve(server, {&alice, &bob}), 2);
+    alice.receiveAll();
+    bob.receiveAll();
+    EXPECT_EQ(serve(server, {&alice, &bob}), 0);
+    
+    EXPECT_EQ(alice.sync.getState(), ClientSync::State::SYNCHRONIZED);
+    EXPECT_EQ(bob.sync.getState(), ClientSync::State::SYNCHRONIZED);
+    EXPECT_EQ(alice.document, server.getDocument());
+    EXPECT_EQ(bob.document, server.getDocument());
+    EXPECT_EQ(alice.sync.getRevision(), server.getRevision());
+}
+
+TEST(ClientSyncTest, AppliesARunOfRemoteOperationsAsOne) {
+    const std::string base = "the quick brown fox";
+    std::vector<OperationPtr> remote = {
+        std::make_shared<InsertOperation>(4, "very "),
+        std::make_shared<DeleteOperation>(0, 4),
+        std::make_shared<InsertOperation>(20, " jumps"),
+        std::make_shared<DeleteOperation>(5, 6),
+    };
+    
+    // Two clients with the same local edits pending, one catching up operation by operation
+    TestClient single("single", base);
+    TestClient batched("batched", base);
+    for (TestClient* client : {&single, &batched}) {
+        client->edit(std::make_shared<InsertOperation>(10, "red "));
+        client->edit(std::make_shared<InsertOperation>(0, ">"));
+        client->edit(std::make_shared<DeleteOperation>(15, 5));
+    }
+    for (const OperationPtr& op : remote) {
+        ASSERT_TRUE(single.sync.applyServer(*op)->apply(single.document));
+    }
+    OperationPtr combined = batched.sync.applyServerBatch(remote);
+    ASSERT_TRUE(combined);
+    ASSERT_TRUE(combined->apply(batched.document));
+    
+    EXPECT_EQ(batched.document.size(), single.document.size());
+    EXPECT_EQ(batched.sync.getRevision(), 4);
+    EXPECT_EQ(batched.sync.getDocumentLength(), batched.document.size());
+    EXPECT_EQ(batched.sync.getState(), ClientSync::State::AWAITING_WITH_BUFFER);
+    
+    // A composed run can meet a pending insert at a different tie than its parts did,
+    // so the two may order those inserts differently; each still converges with the server
+    for (TestClient* client : {&single, &batched}) {
+        DocumentController server(base);
+        for (const OperationPtr& op : remote) {
+            ASSERT_TRUE(server.applyOperation(op, "other"));
+        }
+        while (serve(server, {client}) > 0) {
+            client->receiveAll();
+        }
+        EXPECT_EQ(client->sync.getState(), ClientSync::State::SYNCHRONIZED);
+        EXPECT_EQ(client->document, server.getDocument());
+    }
+    
+    EXPECT_EQ(batched.sync.applyServerBatch({}), nullptr);
+}
+
+TEST(ClientSyncTest, KeepsAnInsertInsideAConcurrentDeleteLikeTheServer) {
+    const std::string base = "0123456789";
+    OperationManager server;
+    std::string serverDocument = base;
+    TestClient alice("alice", base);
+    TestClient bob("bob", base);
+    
+    // Alice deletes everything while Bob types in the middle, both at revision 0
+    alice.edit(std::make_shared<DeleteOperation>(0, 10));
+    bob.edit(std::make_shared<InsertOperation>(5, "X"));
+    
+    // The server applies Bob's insert first
+    for (TestClient* sender : {&bob, &alice}) {
+        auto [op, revision] = sender->outbox.front();
+        sender->outbox.pop_front();
+        OperationPtr transformed = server.processOperation(op, sender->name, revision);
+        ASSERT_TRUE(transformed);
+        ASSERT_TRUE(transformed->apply(serverDocument));
+        server.recordOperation(transformed);
+        for (TestClient* client : {&alice, &bob}) {
+            client->inbox.push_back(client == sender ? nullptr : transformed);
+        }
+    }
+    alice.receiveAll();
+    bob.receiveAll();
+    
+    EXPECT_EQ(serverDocument, "X");
+    EXPECT_EQ(alice.document, serverDocument);
+    EXPECT_EQ(bob.document, serverDocument);
+    EXPECT_EQ(alice.sync.getState(), ClientSync::State::SYNCHRONIZED);
+    EXPECT_EQ(bob.sync.getState(), ClientSync::State::SYNCHRONIZED);
+}
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include "common/ot/content_hash.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(ContentHashTest, RootIsTheHashOfTheTextHoweverItIsChunked) {
+    const std::string text(5000, 'x');
+    Rope rope(text);
+    ContentHash whole(rope);
+    EXPECT_GT(whole.chunkCount(), 1u);
+    EXPECT_EQ(whole.root(), ContentHash::hash(text));
+    EXPECT_EQ(whole.length(), text.size());
+    EXPECT_EQ(ContentHash::concat(ContentHash::hash("ab"), ContentHash::hash("cd"), 2), ContentHash::hash("abcd"));
+    // Leading zero bytes still count
+    EXPECT_NE(ContentHash::hash(std::string("\0a", 2)), ContentHash::hash("a"));
+
+    // The same text reached by edits hashes the same
+    Rope edited(text.substr(0, 100));
+    ContentHash grown(edited);
+    for (size_t at = 100; at < text.size(); at += 100) {
+        edited.insert(at, text.substr(at, 100));
+        ASSERT_TRUE(grown.update(at, 0, 100, edited));
+    }
+    EXPECT_EQ(grown.root(), whole.root());
+    EXPECT_FALSE(grown.update(10, 0, 6000, edited));
+}
+
+TEST(ContentHashTest, StaysCurrentThroughRandomEdits) {
+    std::mt19937 random(5);
+    std::string text = "hello world";
+    Rope rope(text);
+    ContentHash hash(rope);
+    for (int i = 0; i < 3000; ++i) {
+        const size_t position = random() % (text.size() + 1);
+        if (random() % 3 == 0 && position < text.size()) {
+            const size_t length = std::min<size_t>(random() % 900 + 1, text.size() - position);
+            text.erase(position, length);
+            rope.erase(position, length);
+            ASSERT_TRUE(hash.apply(ValueOperation(DeleteOp{position, length, {}}), rope));
+        } else {
+            const std::string inserted(random() % (i % 50 == 0 ? 3000 : 8) + 1, static_cast<char>('a' + random() % 26));
+            text.insert(position, inserted);
+            rope.insert(position, inserted);
+            ASSERT_TRUE(hash.apply(ValueOperation(InsertOp{position, inserted}), rope));
+        }
+        ASSERT_EQ(hash.root(), ContentHash::hash(text)) << i;
+        ASSERT_EQ(hash.length(), text.size());
+        if (i % 100 == 0) {
+            const size_t at = random() % (text.size() + 1);
+            EXPECT_EQ(hash.prefix(at, rope), ContentHash::hash(text.substr(0, at)));
+            EXPECT_EQ(hash.suffix(at, rope), ContentHash::hash(text.substr(text.size() - std::min(at, text.size()))));
+            EXPECT_EQ(hash.range(at / 2, at / 3, rope), ContentHash::hash(text.substr(at / 2, at / 3)));
+        }
+    }
+}
+
+TEST(ContentHashTest, CompositesRehashTheSpanTheyTouched) {
+    std::string text(3000, '.');
+    Rope rope(text);
+    ContentHash hash(rope);
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<InsertOperation>(2500, "end"));
+    composite->addOperation(std::make_shared<DeleteOperation>(100, 50));
+    composite->addOperation(std::make_shared<InsertOperation>(10, "start"));
+    ASSERT_TRUE(composite->apply(rope));
+    ASSERT_TRUE(hash.apply(*composite, rope));
+    ASSERT_TRUE(composite->apply(text));
+    EXPECT_EQ(hash.root(), ContentHash::hash(text));
+    EXPECT_FALSE(hash.apply(DeleteOperation(5000, 1), rope));
+}
+
+TEST(ContentHashTest, DivergenceSearchFindsTheRangeThatDiffers) {
+    std::mt19937 random(9);
+    std::string base;
+    for (int i = 0; i < 100000; ++i) {
+        base += static_cast<char>('a' + random() % 26);
+    }
+    for (int trial = 0; trial < 20; ++trial) {
+        // The client lost a stretch and made up another
+        std::string local = base;
+        const size_t position = random() % base.size();
+        const size_t lost = std::min<size_t>(random() % 2000, base.size() - position);
+        local.replace(position, lost, std::string(random() % 100, '#'));
+        const Rope localRope(local);
+        const Rope remoteRope(base);
+        const ContentHash localHash(localRope);
+        const ContentHash remoteHash(remoteRope);
+        ASSERT_NE(localHash.root(), remoteHash.root());
+
+        DivergenceSearch search(local.size(), base.size());
+        while (!search.done()) {
+            const DivergenceSearch::Probe probe = search.probe();
+            search.narrow(localHash.prefix(probe.prefixLength, localRope) == remoteHash.prefix(probe.prefixLength, remoteRope),
+                          localHash.suffix(probe.suffixLength, localRope) == remoteHash.suffix(probe.suffixLength, remoteRope));
+        }
+        EXPECT_LE(search.rounds(), 18u);
+
+        // Putting the remote range in place of the local one repairs the copy
+        const DivergenceSearch::Range range = search.range();
+        EXPECT_LE(range.localLength + range.remoteLength, lost + 100 + 2);
+        local.replace(range.position, range.localLength, base.substr(range.position, range.remoteLength));
+        EXPECT_EQ(local, base) << trial;
+    }
+
+    // Copies that agree need no repair
+    DivergenceSearch same(5, 5);
+    while (!same.done()) {
+        same.narrow(true, true);
+    }
+    EXPECT_EQ(same.range().localLength, 0u);
+    EXPECT_EQ(same.range().remoteLength, 0u);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <random>
+#include "common/ot/cursor_transform.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(CursorTransformTest, MovesPositionsWithTheText) {
+    // Before, at and after an insert at 5
+    EXPECT_EQ(transformPosition(4, InsertOp{5, "abc"}), 4u);
+    EXPECT_EQ(transformPosition(5, InsertOp{5, "abc"}), 8u);
+    EXPECT_EQ(transformPosition(9, InsertOp{5, "abc"}), 12u);
+    // Before, inside and after a delete of [5, 8)
+    EXPECT_EQ(transformPosition(5, DeleteOp{5, 3, {}}), 5u);
+    EXPECT_EQ(transformPosition(7, DeleteOp{5, 3, {}}), 5u);
+    EXPECT_EQ(transformPosition(8, DeleteOp{5, 3, {}}), 5u);
+    EXPECT_EQ(transformPosition(10, DeleteOp{5, 3, {}}), 7u);
+    // A replace moves a position inside it to its start
+    EXPECT_EQ(transformPosition(6, 5, 3, 1), 5u);
+    EXPECT_EQ(transformPosition(8, 5, 3, 1), 6u);
+}
+
+TEST(CursorTransformTest, SetMatchesOnePositionAtATime) {
+    std::mt19937 random(3);
+    CursorSet cursors;
+    std::vector<size_t> expected;
+    for (int i = 0; i < 100; ++i) {
+        expected.push_back(random() % 1000);
+        EXPECT_EQ(cursors.add(expected.back()), static_cast<CursorSet::Handle>(i));
+    }
+
+    std::vector<ValueOperation> batch;
+    for (int i = 0; i < 200; ++i) {
+        if (i % 50 == 0) {
+            // A user moves their cursor between edits
+            expected[i % 100] = random() % 1000;
+            cursors.set(static_cast<CursorSet::Handle>(i % 100), expected[i % 100]);
+        }
+        const size_t position = random() % 1000;
+        ValueOperation op = i % 3 == 0 ? ValueOperation(DeleteOp{position, random() % 20, {}})
+                                       : ValueOperation(InsertOp{position, std::string(random() % 5 + 1, 'x')});
+        batch.push_back(op);
+        if (i % 2 == 0) {
+            cursors.transform(op);
+        } else {
+            cursors.transform(std::span<const ValueOperation>(batch).last(1));
+        }
+        for (auto& offset : expected) {
+            offset = transformPosition(offset, op);
+        }
+    }
+    ASSERT_EQ(cursors.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(cursors.get(static_cast<CursorSet::Handle>(i)), expected[i]) << i;
+    }
+}
+
+TEST(CursorTransformTest, FollowsCompositeOperations) {
+    CursorSet cursors;
+    const auto start = cursors.add(0);
+    const auto middle = cursors.add(6);
+    const auto end = cursors.add(11);
+
+    // "hello world" -> "hey world!"
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<DeleteOperation>(2, 3));
+    composite->addOperation(std::make_shared<InsertOperation>(2, "y"));
+    composite->addOperation(std::make_shared<InsertOperation>(9, "!"));
+    std::vector<OperationPtr> ops = {composite};
+    cursors.transform(std::span<const OperationPtr>(ops));
+
+    EXPECT_EQ(cursors.get(start), 0u);
+    EXPECT_EQ(cursors.get(middle), 4u);
+    EXPECT_EQ(cursors.get(end), 10u);
+
+    cursors.clear();
+    EXPECT_TRUE(cursors.empty());
+    EXPECT_EQ(cursors.add(3), 0u);
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "common/ot/editor.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace collab::ot;
+
+TEST(EditorTest, LocalEditsAndTheirUndoAreReported) {
+    Editor editor("hello");
+    std::vector<std::pair<OperationPtr, int64_t>> generated;
+    editor.setOperationCallback([&](const OperationPtr& op, int64_t version) {
+        generated.emplace_back(op, version);
+    });
+
+    ASSERT_TRUE(editor.insert(5, " world"));
+    ASSERT_TRUE(editor.deleteText(0, 1));
+    EXPECT_FALSE(editor.insert(100, "!"));
+    EXPECT_EQ(editor.getContent(), "ello world");
+
+    ASSERT_TRUE(editor.undo());
+    EXPECT_EQ(editor.getContent(), "hello world");
+    ASSERT_EQ(generated.size(), 3u);
+    EXPECT_EQ(generated[2].second, 2);
+    EXPECT_EQ(editor.getVersion(), 3);
+
+    // Replaying what was reported rebuilds the document elsewhere
+    std::string mirrored = "hello";
+    for (const auto& [op, version] : generated) {
+        ASSERT_TRUE(op->apply(mirrored));
+    }
+    EXPECT_EQ(mirrored, "hello world");
+}
+
+TEST(EditorTest, ARunOfRemoteOperationsChangesTheContentOnce) {
+    Editor editor("abc");
+    std::vector<std::string> contents;
+    editor.setContentCallback([&](const std::string& content) { contents.push_back(content); });
+
+    const std::vector<OperationPtr> run = {
+        std::make_shared<InsertOperation>(3, "d"),
+        std::make_shared<InsertOperation>(4, "e"),
+        std::make_shared<DeleteOperation>(0, 1),
+        std::make_shared<ReplaceOperation>(1, 2, "CD"),
+    };
+    ASSERT_TRUE(editor.handleRemoteOperations(run, 10));
+
+    EXPECT_EQ(editor.getContent(), "bCDe");
+    ASSERT_EQ(contents.size(), 1u);
+    EXPECT_EQ(contents[0], "bCDe");
+    EXPECT_EQ(editor.getVersion(), 14);
+}
+
+TEST(EditorTest, ARunThatDoesNotFitAppliesNothing) {
+    Editor editor("abc");
+    int changes = 0;
+    editor.setContentCallback([&](const std::string&) { ++changes; });
+
+    const std::vector<OperationPtr> run = {
+        std::make_shared<InsertOperation>(0, "x"),
+        std::make_shared<DeleteOperation>(3, 5),
+    };
+    EXPECT_FALSE(editor.handleRemoteOperations(run, 0));
+
+    EXPECT_EQ(editor.getContent(), "abc");
+    EXPECT_EQ(changes, 0);
+    EXPECT_EQ(editor.getVersion(), 0);
+}
+
+TEST(EditorTest, UndoStillFindsLocalTextAfterARemoteRun) {
+    Editor editor("world");
+    ASSERT_TRUE(editor.insert(0, "hello "));
+
+    const std::vector<OperationPtr> run = {
+        std::make_shared<InsertOperation>(0, "> "),
+        std::make_shared<InsertOperation>(13, "!"),
+    };
+    ASSERT_TRUE(editor.handleRemoteOperations(run, 1));
+    EXPECT_EQ(editor.getContent(), "> hello world!");
+
+    ASSERT_TRUE(editor.undo());
+    EXPECT_EQ(editor.getContent(), "> world!");
+}
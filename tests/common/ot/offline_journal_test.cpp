@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "common/ot/offline_journal.h"
+#include "common/ot/client_sync.h"
+#include <filesystem>
+#include <fstream>
+
+using namespace collab::ot;
+
+namespace {
+
+std::filesystem::path journalPath(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+TextOperation typeAt(size_t length, size_t position, const std::string& text) {
+    TextOperation op;
+    op.retain(position).insert(text).retain(length - position);
+    return op;
+}
+
+} // namespace
+
+TEST(OfflineJournalTest, ComposesAndRecoversEdits) {
+    auto path = journalPath("collabedit_journal_recover.jnl");
+    std::string document = "hello";
+    {
+        OfflineJournal journal(path);
+        EXPECT_TRUE(journal.empty());
+        journal.reset(12, document.size());
+        for (int i = 0; i < 40; ++i) {
+            TextOperation op = typeAt(document.size(), document.size(), "!");
+            ASSERT_TRUE(op.apply(document));
+            journal.append(op);
+        }
+        EXPECT_EQ(journal.records(), 40u);
+    }
+    
+    // A crash mid-append leaves a torn record behind
+    {
+        std::ofstream torn(path, std::ios::binary | std::ios::app);
+        const uint32_t length = 100;
+        torn.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        torn << "[5,";
+    }
+    
+    OfflineJournal recovered(path);
+    ASSERT_FALSE(recovered.empty());
+    EXPECT_EQ(recovered.baseRevision(), 12);
+    EXPECT_EQ(recovered.baseLength(), 5u);
+    std::string replayed = "hello";
+    ASSERT_TRUE(recovered.pending()->apply(replayed));
+    EXPECT_EQ(replayed, document);
+    
+    // Appends carry on after the last whole record
+    recovered.append(typeAt(replayed.size(), 0, ">"));
+    OfflineJournal reopened(path);
+    replayed = "hello";
+    ASSERT_TRUE(reopened.pending()->apply(replayed));
+    EXPECT_EQ(replayed, ">" + document);
+    std::filesystem::remove(path);
+}
+
+TEST(OfflineJournalTest, CompactsToOneRecord) {
+    auto path = journalPath("collabedit_journal_compact.jnl");
+    OfflineJournal journal(path);
+    journal.reset(0, 0);
+    size_t length = 0;
+    for (size_t i = 0; i < OfflineJournal::COMPACT_RECORDS * 3 + 10; ++i) {
+        journal.append(typeAt(length, length, "x"));
+        ++length;
+    }
+    
+    EXPECT_LT(journal.records(), OfflineJournal::COMPACT_RECORDS);
+    EXPECT_LT(std::filesystem::file_size(path), 4096u);
+    EXPECT_EQ(journal.pending()->getTargetLength(), length);
+    EXPECT_THROW(journal.append(typeAt(length + 1, 0, "y")), std::invalid_argument);
+    std::filesystem::remove(path);
+}
+
+TEST(OfflineJournalTest, ClientSyncReplaysTheJournalAsOneOperation) {
+    auto path = journalPath("collabedit_journal_sync.jnl");
+    std::string document = "draft";
+    {
+        ClientSync sync(3, document.size());
+        sync.setJournal(std::make_shared<OfflineJournal>(path));
+        // Offline: the sends go nowhere
+        for (const char* word : {" one", " two", " three"}) {
+            InsertOperation op(document.size(), word);
+            ASSERT_TRUE(op.apply(document));
+            sync.applyClient(op);
+        }
+        
+        // A remote edit rebases what is pending onto revision 4
+        DeleteOperation remote(0, 1);
+        ASSERT_TRUE(sync.applyServer(remote)->apply(document));
+    }
+    
+    OfflineJournal journal(path);
+    ClientSync restored;
+    std::vector<std::pair<OperationPtr, int64_t>> sent;
+    restored.setSendCallback([&sent](const OperationPtr& op, int64_t revision) { sent.emplace_back(op, revision); });
+    ASSERT_TRUE(restored.restore(journal));
+    EXPECT_EQ(restored.getState(), ClientSync::State::AWAITING_CONFIRM);
+    restored.resend();
+    
+    ASSERT_EQ(sent.size(), 1u);
+    EXPECT_EQ(sent[0].second, 4);
+    std::string server = "raft";
+    ASSERT_TRUE(sent[0].first->apply(server));
+    EXPECT_EQ(server, document);
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include "common/ot/operation_coalescer.h"
+
+using namespace collab::ot;
+
+namespace {
+
+// Coalesced output must produce the same document as the raw edits
+void expectEquivalent(const std::vector<OperationPtr>& edits, const std::vector<OperationPtr>& merged,
+                      const std::string& initial) {
+    std::string raw = initial;
+    for (const auto& op : edits) {
+        ASSERT_TRUE(op->apply(raw));
+    }
+    
+    std::string net = initial;
+    for (const auto& op : merged) {
+        ASSERT_TRUE(op->apply(net));
+    }
+    EXPECT_EQ(net, raw);
+}
+
+} // namespace
+
+TEST(OperationCoalescerTest, TypingRunBecomesOneInsert) {
+    OperationCoalescer coalescer;
+    std::vector<OperationPtr> edits;
+    std::string word = "hello";
+    for (size_t i = 0; i < word.size(); ++i) {
+        edits.push_back(std::make_shared<InsertOperation>(3 + i, std::string(1, word[i])));
+        coalescer.push(edits.back());
+    }
+    edits.front()->setId(7);
+    
+    auto merged = coalescer.flush();
+    ASSERT_EQ(merged.size(), 1);
+    EXPECT_EQ(std::static_pointer_cast<InsertOperation>(merged[0])->getText(), "hello");
+    EXPECT_EQ(merged[0]->getId(), 7);
+    EXPECT_TRUE(coalescer.empty());
+    expectEquivalent(edits, merged, "abcdef");
+}
+
+TEST(OperationCoalescerTest, BackspaceAndForwardDelete) {
+    OperationCoalescer coalescer;
+    std::vector<OperationPtr> edits = {
+        std::make_shared<DeleteOperation>(5, 1, "f"),
+        std::make_shared<DeleteOperation>(4, 1, "e"),
+        std::make_shared<DeleteOperation>(4, 1, "g"),
+    };
+    for (const auto& op : edits) {
+        coalescer.push(op);
+    }
+    
+    auto merged = coalescer.flush();
+    ASSERT_EQ(merged.size(), 1);
+    auto del = std::static_pointer_cast<DeleteOperation>(merged[0]);
+    EXPECT_EQ(del->getPosition(), 4);
+    EXPECT_EQ(del->getLength(), 3);
+    EXPECT_EQ(del->getDeletedText(), "efg");
+    expectEquivalent(edits, merged, "abcdefgh");
+}
+
+TEST(OperationCoalescerTest, TypoFixedBeforeSend) {
+    OperationCoalescer coalescer;
+    std::vector<OperationPtr> edits = {
+        std::make_shared<InsertOperation>(0, "teh"),
+        std::make_shared<DeleteOperation>(1, 2),
+        std::make_shared<InsertOperation>(1, "he"),
+        std::make_shared<InsertOperation>(9, "!"),
+        std::make_shared<DeleteOperation>(9, 1),
+    };
+    for (const auto& op : edits) {
+        coalescer.push(op);
+    }
+    
+    auto merged = coalescer.flush();
+    ASSERT_EQ(merged.size(), 1);
+    expectEquivalent(edits, merged, " document");
+}
+
+TEST(OperationCoalescerTest, FlushPolicy) {
+    using namespace std::chrono_literals;
+    OperationCoalescer coalescer(CoalescingPolicy{16ms, 3});
+    auto start = OperationCoalescer::Clock::now();
+    
+    EXPECT_FALSE(coalescer.shouldFlush(start));
+    coalescer.push(std::make_shared<InsertOperation>(0, "a"), start);
+    EXPECT_FALSE(coalescer.shouldFlush(start + 5ms));
+    EXPECT_TRUE(coalescer.shouldFlush(start + 16ms));
+    
+    coalescer.push(std::make_shared<InsertOperation>(10, "b"), start);
+    coalescer.push(std::make_shared<InsertOperation>(20, "c"), start);
+    EXPECT_TRUE(coalescer.shouldFlush(start));
+    EXPECT_EQ(coalescer.flush().size(), 3);
+}
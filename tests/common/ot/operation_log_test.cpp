@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "common/ot/operation_log.h"
+#include "common/ot/bulk_transform.h"
+#include "common/ot/transform_arena.h"
+#include <filesystem>
+#include <random>
+
+using namespace collab::ot;
+
+TEST(OperationLogTest, LookupByRevision) {
+    OperationLog log(4);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(log.append(std::make_shared<InsertOperation>(i, "x")), i);
+    }
+    
+    EXPECT_EQ(log.size(), 3);
+    EXPECT_EQ(std::static_pointer_cast<InsertOperation>(log.at(1))->getPosition(), 1);
+    EXPECT_EQ(log.at(3), nullptr);
+    EXPECT_EQ(log.since(1).size(), 2);
+    EXPECT_TRUE(log.since(3).empty());
+}
+
+TEST(OperationLogTest, OverwritesOldestAndStaysContiguous) {
+    OperationLog log(4);
+    for (int i = 0; i < 10; ++i) {
+        log.append(std::make_shared<InsertOperation>(i, "x"));
+    }
+    
+    EXPECT_EQ(log.firstRevision(), 6);
+    EXPECT_EQ(log.headRevision(), 10);
+    EXPECT_FALSE(log.canCatchUp(5));
+    EXPECT_THROW(log.since(5), std::out_of_range);
+    
+    auto suffix = log.since(6);
+    ASSERT_EQ(suffix.size(), 4);
+    for (size_t i = 0; i < suffix.size(); ++i) {
+        EXPECT_EQ(std::static_pointer_cast<InsertOperation>(suffix[i])->getPosition(), 6 + i);
+    }
+}
+
+TEST(OperationLogTest, DiscardReleasesOperations) {
+    OperationLog log(8);
+    auto op = std::make_shared<InsertOperation>(0, "x");
+    log.append(op);
+    log.append(std::make_shared<InsertOperation>(1, "y"));
+    EXPECT_EQ(op.use_count(), 3);
+    
+    log.discardBefore(1);
+    EXPECT_EQ(op.use_count(), 1);
+    EXPECT_EQ(log.firstRevision(), 1);
+    EXPECT_EQ(log.at(0), nullptr);
+    
+    log.reset(42);
+    EXPECT_TRUE(log.empty());
+    EXPECT_EQ(log.append(op), 42);
+}
+
+TEST(OperationLogTest, ByteBudgetSpillsOldestToSegment) {
+    OperationLog log(64);
+    log.setSpill(std::make_shared<OperationSegment>(
+        std::filesystem::temp_directory_path() / "collabedit_log_spill_test.ops"));
+    log.setByteBudget(4 * (OperationLog::ENTRY_OVERHEAD + 10));
+    
+    for (int i = 0; i < 10; ++i) {
+        log.append(std::make_shared<InsertOperation>(i, std::string(10, 'a' + i)));
+    }
+    EXPECT_EQ(log.size(), 4);
+    EXPECT_LE(log.bytes(), 4 * (OperationLog::ENTRY_OVERHEAD + 10));
+    EXPECT_EQ(log.at(0), nullptr);
+    EXPECT_FALSE(log.canCatchUp(0));
+    
+    ASSERT_TRUE(log.canReplay(0));
+    auto oldest = std::dynamic_pointer_cast<InsertOperation>(log.fetch(0));
+    ASSERT_NE(oldest, nullptr);
+    EXPECT_EQ(oldest->getText(), std::string(10, 'a'));
+    
+    auto all = log.collect(2);
+    ASSERT_EQ(all.size(), 8);
+    for (size_t i = 0; i < all.size(); ++i) {
+        EXPECT_EQ(std::static_pointer_cast<InsertOperation>(all[i])->getPosition(), 2 + i);
+    }
+    
+    // Without a spill, what leaves memory is gone
+    log.setSpill(nullptr);
+    log.discardBefore(8);
+    EXPECT_FALSE(log.canReplay(7));
+    EXPECT_EQ(log.fetch(7), nullptr);
+}
+
+namespace {
+
+OperationPtr randomOperation(std::mt19937& rng) {
+    const size_t position = rng() % 40;
+    switch (rng() % 5) {
+        case 0:
+        case 1:
+            return std::make_shared<InsertOperation>(position, std::string(1 + rng() % 4, 'x'));
+        case 2:
+        case 3:
+            return std::make_shared<DeleteOperation>(position, 1 + rng() % 6);
+        default: {
+            auto composite = std::make_shared<CompositeOperation>();
+            composite->addOperation(std::make_shared<InsertOperation>(position, "ab"));
+            composite->addOperation(std::make_shared<DeleteOperation>(position + 5, 2));
+            return composite;
+        }
+    }
+}
+
+} // namespace
+
+TEST(OperationLogTest, TransformSinceMatchesStepwiseTransform) {
+    std::mt19937 rng(11);
+    // A small capacity so the scans wrap around the ring
+    OperationLog log(16);
+    for (int round = 0; round < 500; ++round) {
+        log.append(randomOperation(rng));
+        const int64_t base = log.firstRevision() + static_cast<int64_t>(rng() % (log.size() + 1));
+        
+        OperationPtr op = randomOperation(rng);
+        op->setId(round + 1);
+        OperationPtr expected = transformThrough(op, log.since(base));
+        OperationPtr actual = log.transformSince(op, base);
+        ASSERT_NE(actual, nullptr);
+        EXPECT_EQ(actual->serialize(), expected->serialize());
+        EXPECT_EQ(actual->getId(), expected->getId());
+        
+        int64_t delta = 0;
+        for (const auto& entry : log.since(base)) {
+            delta += lengthDelta(*entry);
+        }
+        EXPECT_EQ(log.lengthDeltaSince(base), delta);
+    }
+    
+    OperationPtr op = std::make_shared<InsertOperation>(0, "x");
+    EXPECT_EQ(log.transformSince(op, log.headRevision()), op);
+    EXPECT_THROW(log.transformSince(op, log.firstRevision() - 1), std::out_of_range);
+}
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+#include "common/ot/operation_segment.h"
+#include <filesystem>
+
+using namespace collab::ot;
+
+TEST(OperationSegmentTest, ReadsBackWhatWasAppended) {
+    auto path = std::filesystem::temp_directory_path() / "collabedit_segment_test.ops";
+    {
+        OperationSegment segment(path);
+        auto insert = std::make_shared<InsertOperation>(3, "abc");
+        insert->setId(7);
+        auto undo = std::make_shared<DeleteOperation>(3, 3, "abc");
+        undo->setId(8);
+        undo->setSource(OperationSource::LOCAL_UNDO);
+        undo->setRelatedOperationId(7);
+        segment.append(10, *insert);
+        segment.append(11, *undo);
+        
+        EXPECT_EQ(segment.firstRevision(), 10);
+        EXPECT_EQ(segment.endRevision(), 12);
+        EXPECT_GT(segment.bytes(), 0);
+        EXPECT_EQ(segment.read(9), nullptr);
+        
+        auto first = std::dynamic_pointer_cast<InsertOperation>(segment.read(10));
+        ASSERT_NE(first, nullptr);
+        EXPECT_EQ(first->getPosition(), 3);
+        EXPECT_EQ(first->getText(), "abc");
+        EXPECT_EQ(first->getId(), 7);
+        EXPECT_FALSE(first->getRelatedOperationId());
+        
+        auto second = std::dynamic_pointer_cast<DeleteOperation>(segment.read(11));
+        ASSERT_NE(second, nullptr);
+        EXPECT_EQ(second->getDeletedText(), "abc");
+        EXPECT_EQ(second->getSource(), OperationSource::LOCAL_UNDO);
+        EXPECT_EQ(second->getRelatedOperationId(), 7);
+        
+        // A gap starts the segment over
+        segment.append(20, *insert);
+        EXPECT_FALSE(segment.contains(10));
+        EXPECT_TRUE(segment.contains(20));
+        EXPECT_EQ(std::dynamic_pointer_cast<InsertOperation>(segment.read(20))->getText(), "abc");
+    }
+    EXPECT_FALSE(std::filesystem::exists(path));
+}
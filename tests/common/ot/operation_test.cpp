@@ -0,0 +1,306 @@
+#include <gtest/gtest.h>
+#include "common/ot/operation.h"
+#include "common/ot/text_operation.h"
+
+using namespace collab::ot;
+
+TEST(OperationTest, KindTags) {
+    EXPECT_EQ(InsertOperation(0, "a").getKind(), OperationKind::INSERT);
+    EXPECT_EQ(DeleteOperation(0, 1).getKind(), OperationKind::DELETE);
+    EXPECT_EQ(ReplaceOperation(0, 1, "b").getKind(), OperationKind::REPLACE);
+    EXPECT_EQ(CompositeOperation().getKind(), OperationKind::COMPOSITE);
+}
+
+TEST(OperationTest, InsertTransformKeepsMetadata) {
+    auto op = std::make_shared<InsertOperation>(5, "abc");
+    op->setId(42);
+    op->setSource(OperationSource::REMOTE);
+    
+    auto result = op->transform(std::make_shared<InsertOperation>(2, "xy"));
+    auto insert = std::static_pointer_cast<InsertOperation>(result);
+    EXPECT_EQ(insert->getPosition(), 7);
+    EXPECT_EQ(insert->getId(), 42);
+    EXPECT_EQ(insert->getSource(), OperationSource::REMOTE);
+}
+
+TEST(OperationTest, DeleteTransformPairs) {
+    DeleteOperation del(4, 4, "efgh");
+    
+    auto shifted = std::static_pointer_cast<DeleteOperation>(
+        del.transform(std::make_shared<DeleteOperation>(0, 2, "ab")));
+    EXPECT_EQ(shifted->getPosition(), 2);
+    EXPECT_EQ(shifted->getLength(), 4);
+    
+    auto middle = std::static_pointer_cast<DeleteOperation>(
+        del.transform(std::make_shared<DeleteOperation>(5, 2, "fg")));
+    EXPECT_EQ(middle->getPosition(), 4);
+    EXPECT_EQ(middle->getDeletedText(), "eh");
+    
+    // An insert inside the range is kept, and the delete goes either side of it
+    auto split = del.transform(std::make_shared<InsertOperation>(6, "zz"));
+    ASSERT_EQ(split->getKind(), OperationKind::COMPOSITE);
+    std::string doc = "abcdefzzghij";
+    ASSERT_TRUE(split->apply(doc));
+    EXPECT_EQ(doc, "abcdzzij");
+    ASSERT_TRUE(split->inverse()->apply(doc));
+    EXPECT_EQ(doc, "abcdefzzghij");
+    
+    // The split delete is still the operation it came from
+    DeleteOperation tagged(2, 4);
+    tagged.setId(7);
+    tagged.setSource(OperationSource::REMOTE);
+    tagged.setRelatedOperationId(3);
+    auto taggedSplit = tagged.transform(std::make_shared<InsertOperation>(4, "zz"));
+    ASSERT_EQ(taggedSplit->getKind(), OperationKind::COMPOSITE);
+    EXPECT_EQ(taggedSplit->getId(), 7);
+    EXPECT_EQ(taggedSplit->getSource(), OperationSource::REMOTE);
+    EXPECT_EQ(taggedSplit->getRelatedOperationId(), 3);
+}
+
+TEST(OperationTest, CompositeApplyAndInverse) {
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<InsertOperation>(0, "Hello "));
+    composite->addOperation(std::make_shared<DeleteOperation>(6, 3, "old"));
+    
+    std::string doc = "oldworld";
+    ASSERT_TRUE(composite->apply(doc));
+    EXPECT_EQ(doc, "Hello world");
+    
+    ASSERT_TRUE(composite->inverse()->apply(doc));
+    EXPECT_EQ(doc, "oldworld");
+}
+
+TEST(OperationTest, ApplyDoesNotMutateOperation) {
+    const DeleteOperation del(0, 3);
+    std::string doc = "abcdef";
+    ASSERT_TRUE(del.apply(doc));
+    EXPECT_TRUE(del.getDeletedText().empty());
+    EXPECT_THROW(del.inverse(), std::runtime_error);
+    
+    doc = "abcdef";
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<DeleteOperation>(0, 3));
+    composite->addOperation(std::make_shared<InsertOperation>(0, "xyz"));
+    composite->setId(5);
+    
+    auto captured = composite->applyAndCapture(doc);
+    ASSERT_NE(captured, nullptr);
+    EXPECT_EQ(doc, "xyzdef");
+    EXPECT_EQ(captured->getId(), 5);
+    ASSERT_TRUE(captured->inverse()->apply(doc));
+    EXPECT_EQ(doc, "abcdef");
+    
+    EXPECT_EQ(DeleteOperation(4, 10).applyAndCapture(doc), nullptr);
+    EXPECT_EQ(doc, "abcdef");
+}
+
+TEST(OperationTest, CompositeTransformConverges) {
+    const std::string base = "abcdef";
+    
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<InsertOperation>(1, "X"));
+    composite->addOperation(std::make_shared<DeleteOperation>(4, 1, "d"));
+    auto other = std::make_shared<InsertOperation>(0, ">>");
+    
+    std::string left = base;
+    ASSERT_TRUE(composite->apply(left));
+    ASSERT_TRUE(other->transform(composite)->apply(left));
+    
+    std::string right = base;
+    ASSERT_TRUE(other->apply(right));
+    ASSERT_TRUE(composite->transform(other)->apply(right));
+    
+    EXPECT_EQ(left, right);
+    EXPECT_EQ(left, ">>aXbcef");
+}
+
+TEST(OperationTest, CompositeSerializationRoundTrip) {
+    CompositeOperation composite;
+    composite.addOperation(std::make_shared<InsertOperation>(3, "hi"));
+    composite.addOperation(std::make_shared<DeleteOperation>(0, 1, "a"));
+    
+    auto restored = OperationFactory::deserialize(composite.serialize());
+    ASSERT_EQ(restored->getKind(), OperationKind::COMPOSITE);
+    EXPECT_EQ(std::static_pointer_cast<CompositeOperation>(restored)->getOperations().size(), 2);
+    EXPECT_EQ(restored->serialize(), composite.serialize());
+}
+
+TEST(OperationTest, DeserializeReadsMembersInAnyOrder) {
+    // Keys escaped, spaced out and in another order than serialize() writes them
+    auto restored = OperationFactory::deserialize(
+        R"( {"text": "a\"b\u00e9", "type": "replace", "replaced": "", "length": 2, "position": 1} )");
+    ASSERT_EQ(restored->getKind(), OperationKind::REPLACE);
+    std::string doc = "xyzw";
+    ASSERT_TRUE(restored->apply(doc));
+    EXPECT_EQ(doc, "xa\"b\xc3\xa9w");
+    
+    auto nested = OperationFactory::deserialize(
+        R"({"operations":[{"type":"delete","position":0,"length":1},{"operations":[],"type":"composite"}],"type":"composite"})");
+    ASSERT_EQ(nested->getKind(), OperationKind::COMPOSITE);
+    EXPECT_EQ(std::static_pointer_cast<CompositeOperation>(nested)->getOperations().size(), 2);
+    
+    EXPECT_THROW(OperationFactory::deserialize(R"({"type":"insert","text":"a"})"), std::runtime_error);
+    EXPECT_THROW(OperationFactory::deserialize(R"({"type":"insert","position":"1","text":"a"})"), std::runtime_error);
+    EXPECT_THROW(OperationFactory::deserialize(R"({"type":"move","position":1})"), std::runtime_error);
+    EXPECT_THROW(OperationFactory::deserialize(R"({"type":"insert","position":1,"text":"a"} x)"), std::runtime_error);
+}
+
+TEST(OperationTest, ReplaceAppliesCapturesAndInverts) {
+    const ReplaceOperation replace(4, 5, "there");
+    
+    std::string doc = "Hey world!";
+    auto captured = std::static_pointer_cast<ReplaceOperation>(replace.applyAndCapture(doc));
+    ASSERT_NE(captured, nullptr);
+    EXPECT_EQ(doc, "Hey there!");
+    EXPECT_EQ(captured->getReplacedText(), "world");
+    EXPECT_THROW(replace.inverse(), std::runtime_error);
+    ASSERT_TRUE(captured->inverse()->apply(doc));
+    EXPECT_EQ(doc, "Hey world!");
+    
+    Rope rope("Hey world!");
+    ASSERT_TRUE(replace.apply(rope));
+    EXPECT_EQ(rope, "Hey there!");
+    EXPECT_FALSE(ReplaceOperation(8, 5, "x").apply(rope));
+    EXPECT_EQ(rope, "Hey there!");
+    
+    auto restored = OperationFactory::deserialize(captured->serialize());
+    ASSERT_EQ(restored->getKind(), OperationKind::REPLACE);
+    EXPECT_EQ(restored->serialize(), captured->serialize());
+}
+
+TEST(OperationTest, ReplaceTransformsConverge) {
+    // Every edit of a short document, against a replace of every range
+    const std::string base = "abcdef";
+    std::vector<OperationPtr> edits;
+    for (size_t position = 0; position <= base.size(); ++position) {
+        edits.push_back(std::make_shared<InsertOperation>(position, "+"));
+        for (size_t length = 0; position + length <= base.size(); ++length) {
+            edits.push_back(std::make_shared<DeleteOperation>(position, length, base.substr(position, length)));
+            edits.push_back(std::make_shared<ReplaceOperation>(position, length, "XY", base.substr(position, length)));
+            edits.push_back(std::make_shared<ReplaceOperation>(position, length, "Q", base.substr(position, length)));
+        }
+    }
+    
+    // Of two texts put at one point the other's goes first whichever side transforms, as the server's
+    // history does, so those pairs are left out; a replace puts its text at its start
+    const auto insertsAt = [](const Operation& op) -> std::optional<size_t> {
+        if (op.getKind() == OperationKind::INSERT) {
+            return static_cast<const InsertOperation&>(op).getPosition();
+        }
+        return static_cast<const ReplaceOperation&>(op).getPosition();
+    };
+    
+    for (const auto& replace : edits) {
+        if (replace->getKind() != OperationKind::REPLACE) {
+            continue;
+        }
+        for (const auto& other : edits) {
+            if (other->getKind() != OperationKind::DELETE) {
+                std::optional<size_t> point = insertsAt(*other);
+                if (point && point == insertsAt(*replace)) {
+                    continue;
+                }
+            }
+            
+            std::string left = base;
+            ASSERT_TRUE(replace->apply(left));
+            ASSERT_TRUE(other->transform(replace)->applyAndCapture(left));
+            
+            std::string right = base;
+            ASSERT_TRUE(other->apply(right));
+            auto transformed = replace->transform(other)->applyAndCapture(right);
+            ASSERT_TRUE(transformed);
+            EXPECT_EQ(left, right) << replace->serialize() << " against " << other->serialize();
+            
+            // The replaced text stays right through the transform, so undo restores what the other edit left
+            std::string undone = right;
+            ASSERT_TRUE(replace->transform(other)->inverse()->apply(undone));
+            ASSERT_TRUE(transformed->inverse()->apply(right));
+            EXPECT_EQ(undone, right) << replace->serialize() << " against " << other->serialize();
+        }
+    }
+}
+
+TEST(OperationTest, ReplaceMergesOverlappingReplaces) {
+    const std::string base = "the quick fox";
+    auto first = std::make_shared<ReplaceOperation>(4, 5, "slow", "quick");
+    auto second = std::make_shared<ReplaceOperation>(4, 9, "cat", "quick fox");
+    
+    std::string left = base;
+    ASSERT_TRUE(first->apply(left));
+    ASSERT_TRUE(second->transform(first)->apply(left));
+    EXPECT_EQ(left, "the slowcat");
+    
+    // The same replace made twice puts its text in twice, as the same insert made twice does
+    std::string twice = base;
+    ASSERT_TRUE(first->apply(twice));
+    ASSERT_TRUE(first->transform(first->clone())->apply(twice));
+    EXPECT_EQ(twice, "the slowslow fox");
+    
+    // A delete keeps the new text, whether it shares an edge or goes around it
+    std::string kept = base;
+    ASSERT_TRUE(first->apply(kept));
+    ASSERT_TRUE(std::make_shared<DeleteOperation>(4, 9)->transform(first)->apply(kept));
+    EXPECT_EQ(kept, "the slow");
+    
+    std::string taken = base;
+    ASSERT_TRUE(first->apply(taken));
+    ASSERT_TRUE(std::make_shared<DeleteOperation>(3, 7)->transform(first)->apply(taken));
+    EXPECT_EQ(taken, "theslowfox");
+}
+
+TEST(OperationTest, StepwiseTransformsMatchTextOperation) {
+    // A client's pending edit against history it has not seen, as the server transforms it step by step
+    // and as a client's TextOperation does; both must leave the same document
+    struct Case {
+        OperationPtr pending;
+        std::vector<OperationPtr> history;
+        std::string expected;
+    };
+    const auto composite = [](std::vector<OperationPtr> children) {
+        auto result = std::make_shared<CompositeOperation>();
+        for (const auto& child : children) {
+            result->addOperation(child);
+        }
+        return result;
+    };
+    const std::string base = "0123456789";
+    const std::vector<Case> cases = {
+        // Text the history puts in a replaced range is kept, not taken into the replace
+        {std::make_shared<ReplaceOperation>(2, 4, "uu"),
+         {std::make_shared<DeleteOperation>(6, 3), std::make_shared<InsertOperation>(5, "II")},
+         "01uuII9"},
+        // The history's text goes first at one point, from every child of a composite
+        {composite({std::make_shared<InsertOperation>(6, "V"), std::make_shared<ReplaceOperation>(9, 1, "z")}),
+         {std::make_shared<ReplaceOperation>(6, 4, "f")},
+         "012345fVz"},
+        // Text that lands where the pending edit deleted goes ahead of that delete
+        {composite({std::make_shared<ReplaceOperation>(1, 2, "rr"), std::make_shared<InsertOperation>(4, "VV")}),
+         {std::make_shared<DeleteOperation>(3, 4), std::make_shared<InsertOperation>(2, "Q")},
+         "0rrVVQ789"},
+    };
+    
+    for (const auto& [pending, history, expected] : cases) {
+        std::string server = base;
+        OperationPtr transformed = pending;
+        for (const auto& entry : history) {
+            ASSERT_TRUE(entry->apply(server));
+            transformed = transformed->transform(entry);
+        }
+        ASSERT_TRUE(transformed->apply(server));
+        EXPECT_EQ(server, expected);
+        
+        std::string client = base;
+        ASSERT_TRUE(pending->apply(client));
+        TextOperation outstanding = TextOperation::fromOperation(*pending, base.size());
+        size_t length = base.size();
+        for (const auto& entry : history) {
+            TextOperation remote = TextOperation::fromOperation(*entry, length);
+            length = remote.getTargetLength();
+            auto [remoteAfter, outstandingAfter] = TextOperation::transform(remote, outstanding);
+            ASSERT_TRUE(remoteAfter.apply(client));
+            outstanding = outstandingAfter;
+        }
+        EXPECT_EQ(client, expected);
+    }
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "common/ot/region_set.h"
+
+using namespace collab;
+using namespace collab::ot;
+
+TEST(RegionSetTest, FindsTheLockedRegionAnEditTouches) {
+    RegionSet regions;
+    const RegionSet::Id header = regions.add(0, 10, RegionSet::READ_ONLY, "header");
+    regions.add(20, 30, 0, "comment");
+    const RegionSet::Id footer = regions.add(40, 50, RegionSet::READ_ONLY, "footer");
+    EXPECT_THROW(regions.add(5, 5, RegionSet::READ_ONLY), std::invalid_argument);
+
+    ASSERT_NE(regions.lockedAt(3, 2), nullptr);
+    EXPECT_EQ(regions.lockedAt(3, 2)->id, header);
+    EXPECT_EQ(regions.lockedAt(35, 10)->id, footer);
+    // Inserts at an edge and edits of regions that are not read-only pass
+    EXPECT_EQ(regions.lockedAt(10, 0), nullptr);
+    EXPECT_EQ(regions.lockedAt(40, 0), nullptr);
+    EXPECT_EQ(regions.lockedAt(10, 30), nullptr);
+    EXPECT_EQ(regions.lockedAt(25, 0), nullptr);
+    EXPECT_EQ(regions.lockedAt(InsertOperation(5, "x"))->id, header);
+
+    // A composite's later children are checked where the earlier ones left the regions
+    CompositeOperation composite;
+    composite.addOperation(std::make_shared<DeleteOperation>(10, 20));
+    composite.addOperation(std::make_shared<InsertOperation>(25, "x"));
+    EXPECT_EQ(regions.lockedAt(composite)->id, footer);
+
+    EXPECT_TRUE(regions.remove(footer));
+    EXPECT_FALSE(regions.remove(footer));
+    EXPECT_EQ(regions.lockedAt(composite), nullptr);
+}
+
+TEST(RegionSetTest, MovesThroughEditsAndDropsThoseDeletedToNothing) {
+    RegionSet regions;
+    const RegionSet::Id outer = regions.add(5, 20, RegionSet::READ_ONLY);
+    const RegionSet::Id inner = regions.add(8, 12, 0);
+
+    regions.transform(ValueOperation{InsertOp{5, "abc"}});
+    EXPECT_EQ(regions.find(outer)->start, 8u);
+    EXPECT_EQ(regions.find(outer)->end, 23u);
+    regions.transform(ValueOperation{InsertOp{23, "abc"}});
+    EXPECT_EQ(regions.find(outer)->end, 23u);
+    regions.transform(ValueOperation{InsertOp{15, "abc"}});
+    EXPECT_EQ(regions.find(outer)->end, 26u);
+    EXPECT_EQ(regions.find(inner)->start, 11u);
+    EXPECT_EQ(regions.find(inner)->end, 15u);
+
+    regions.transform(ValueOperation{DeleteOp{10, 10}});
+    EXPECT_EQ(regions.find(inner), nullptr);
+    EXPECT_EQ(regions.size(), 1u);
+    EXPECT_EQ(regions.find(outer)->end, 16u);
+    EXPECT_EQ(regions.lockedAt(15, 0)->id, outer);
+    EXPECT_EQ(regions.lockedAt(16, 0), nullptr);
+}
+
+TEST(RegionSetTest, AgreesWithAScanThroughRandomEdits) {
+    std::mt19937 random(11);
+    RegionSet regions;
+    struct Expected { size_t start; size_t end; bool locked; };
+    std::vector<Expected> expected;
+    for (int i = 0; i < 200; ++i) {
+        const size_t start = random() % 5000;
+        const size_t end = start + random() % 100 + 1;
+        const bool locked = random() % 2 == 0;
+        regions.add(start, end, locked ? RegionSet::READ_ONLY : 0);
+        expected.push_back({start, end, locked});
+    }
+    for (int i = 0; i < 2000; ++i) {
+        const size_t position = random() % 5200;
+        const size_t removed = random() % 3 == 0 ? random() % 200 : 0;
+        const size_t added = removed == 0 ? random() % 50 + 1 : random() % 20;
+
+        bool touches = false;
+        for (const Expected& region : expected) {
+            if (region.locked && region.start < position + removed && region.end > position &&
+                (removed > 0 || region.start < position)) {
+                touches = true;
+            }
+        }
+        ASSERT_EQ(regions.lockedAt(position, removed) != nullptr, touches) << "at step " << i;
+
+        std::vector<Expected> moved;
+        for (Expected region : expected) {
+            const size_t end = position + removed;
+            region.start = region.start >= end ? region.start - removed + added : std::min(region.start, position);
+            region.end = region.end > end ? region.end - removed + added : std::min(region.end, position);
+            if (region.start < region.end) {
+                moved.push_back(region);
+            }
+        }
+        expected = std::move(moved);
+        regions.transform(position, removed, added);
+        ASSERT_EQ(regions.size(), expected.size()) << "at step " << i;
+    }
+}
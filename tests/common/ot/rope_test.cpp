@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "common/ot/rope.h"
+#include "common/ot/operation.h"
+#include <random>
+
+using namespace collab::ot;
+
+TEST(RopeTest, BasicEdits) {
+    Rope rope("hello world");
+    EXPECT_EQ(rope.length(), 11);
+    
+    ASSERT_TRUE(rope.insert(5, ","));
+    ASSERT_TRUE(rope.erase(0, 1));
+    ASSERT_TRUE(rope.insert(0, "J"));
+    EXPECT_EQ(rope.toString(), "Jello, world");
+    EXPECT_EQ(rope.substr(7, 100), "world");
+    EXPECT_EQ(rope.at(1), 'e');
+    
+    EXPECT_FALSE(rope.insert(100, "x"));
+    EXPECT_FALSE(rope.erase(10, 5));
+    EXPECT_FALSE(rope.replace(10, 5, "x"));
+    EXPECT_EQ(rope, std::string_view("Jello, world"));
+}
+
+TEST(RopeTest, MatchesStringUnderRandomEdits) {
+    std::mt19937 rng(42);
+    std::string reference(3 * Rope::CHUNK_SIZE + 17, 'a');
+    for (size_t i = 0; i < reference.size(); ++i) {
+        reference[i] = static_cast<char>('a' + i % 26);
+    }
+    Rope rope(reference);
+    
+    for (int i = 0; i < 2000; ++i) {
+        size_t position = std::uniform_int_distribution<size_t>(0, reference.size())(rng);
+        const auto edit = rng() % 3;
+        if (edit == 0) {
+            size_t length = std::uniform_int_distribution<size_t>(1, rng() % 10 == 0 ? 3000 : 8)(rng);
+            std::string text(length, static_cast<char>('A' + i % 26));
+            reference.insert(position, text);
+            ASSERT_TRUE(rope.insert(position, text));
+        } else if (edit == 1) {
+            size_t length = std::uniform_int_distribution<size_t>(0, std::min<size_t>(reference.size() - position, 40))(rng);
+            std::string text(std::uniform_int_distribution<size_t>(0, rng() % 10 == 0 ? 2500 : 12)(rng),
+                             static_cast<char>('a' + i % 26));
+            reference.replace(position, length, text);
+            ASSERT_TRUE(rope.replace(position, length, text));
+        } else {
+            size_t length = std::uniform_int_distribution<size_t>(0, std::min<size_t>(reference.size() - position, 400))(rng);
+            reference.erase(position, length);
+            ASSERT_TRUE(rope.erase(position, length));
+        }
+        ASSERT_EQ(rope.length(), reference.size());
+    }
+    
+    EXPECT_EQ(rope.toString(), reference);
+    EXPECT_EQ(rope.substr(100, 2500), reference.substr(100, 2500));
+}
+
+TEST(RopeTest, AppendsAndVisitsChunks) {
+    Rope rope;
+    std::string expected;
+    for (int i = 0; i < 50; ++i) {
+        const std::string chunk(i % 2 ? 10 : 5000, static_cast<char>('a' + i % 26));
+        rope.append(chunk);
+        expected += chunk;
+    }
+    EXPECT_EQ(rope.toString(), expected);
+    
+    std::string visited;
+    size_t pieces = 0;
+    rope.forEachChunk(1234, 60000, [&](std::string_view piece) {
+        visited.append(piece);
+        ++pieces;
+        return true;
+    });
+    EXPECT_EQ(visited, expected.substr(1234, 60000));
+    EXPECT_GT(pieces, 1u);
+    
+    // The visitor can stop early, and ranges clamp to the end
+    size_t seen = 0;
+    rope.forEachChunk(0, std::string::npos, [&](std::string_view piece) {
+        seen += piece.size();
+        return seen < 3000;
+    });
+    EXPECT_GE(seen, 3000u);
+    EXPECT_LT(seen, expected.size());
+    visited.clear();
+    rope.forEachChunk(expected.size() - 3, 100, [&](std::string_view piece) {
+        visited.append(piece);
+        return true;
+    });
+    EXPECT_EQ(visited, expected.substr(expected.size() - 3));
+}
+
+TEST(RopeTest, CopiesAreIndependent) {
+    Rope original(std::string(5000, 'x'));
+    Rope snapshot = original;
+    
+    original.insert(10, "edit");
+    original.erase(0, 2);
+    EXPECT_EQ(snapshot.toString(), std::string(5000, 'x'));
+    EXPECT_EQ(original.length(), 5002);
+}
+
+TEST(RopeTest, OperationsApplyToRope) {
+    Rope doc("hello world");
+    
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<DeleteOperation>(0, 5));
+    composite->addOperation(std::make_shared<InsertOperation>(0, "goodbye"));
+    
+    auto captured = composite->applyAndCapture(doc);
+    ASSERT_NE(captured, nullptr);
+    EXPECT_EQ(doc.toString(), "goodbye world");
+    
+    ASSERT_TRUE(captured->inverse()->apply(doc));
+    EXPECT_EQ(doc.toString(), "hello world");
+    
+    EXPECT_FALSE(DeleteOperation(8, 10).apply(doc));
+    EXPECT_EQ(doc.toString(), "hello world");
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include "common/ot/text_diff.h"
+#include "common/util/text_scan.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace collab::ot;
+
+namespace {
+
+// Bytes the operation inserts and deletes
+size_t editSize(const TextOperation& op) {
+    size_t size = 0;
+    for (const auto& component : op.getComponents()) {
+        if (component.type != TextComponent::Type::RETAIN) {
+            size += component.count;
+        }
+    }
+    return size;
+}
+
+// Fewest bytes inserted and deleted to turn a into b: |a| + |b| - 2 * LCS
+size_t shortestEdit(const std::string& a, const std::string& b) {
+    std::vector<std::vector<size_t>> lcs(a.size() + 1, std::vector<size_t>(b.size() + 1, 0));
+    for (size_t i = 1; i <= a.size(); ++i) {
+        for (size_t j = 1; j <= b.size(); ++j) {
+            lcs[i][j] = a[i - 1] == b[j - 1] ? lcs[i - 1][j - 1] + 1 : std::max(lcs[i - 1][j], lcs[i][j - 1]);
+        }
+    }
+    return a.size() + b.size() - 2 * lcs[a.size()][b.size()];
+}
+
+std::string randomString(std::mt19937& rng, size_t length, const std::string& alphabet) {
+    std::string text;
+    for (size_t i = 0; i < length; ++i) {
+        text += alphabet[rng() % alphabet.size()];
+    }
+    return text;
+}
+
+// A few scattered inserts and deletes, the way a full-text update usually differs
+std::string randomEdits(const std::string& text, std::mt19937& rng, int edits) {
+    std::string edited = text;
+    for (int i = 0; i < edits; ++i) {
+        const size_t at = edited.empty() ? 0 : rng() % edited.size();
+        if (rng() % 2 == 0) {
+            edited.insert(at, randomString(rng, 1 + rng() % 8, "xyz\n"));
+        } else {
+            edited.erase(at, 1 + rng() % 8);
+        }
+    }
+    return edited;
+}
+
+void expectTransforms(const std::string& before, const std::string& after, const DiffOptions& options = {}) {
+    const TextOperation op = diff(before, after, options);
+    EXPECT_EQ(op.getBaseLength(), before.size());
+    std::string document = before;
+    ASSERT_TRUE(op.apply(document));
+    EXPECT_EQ(document, after);
+}
+
+} // namespace
+
+TEST(TextDiffTest, EqualTextsOnlyRetain) {
+    EXPECT_TRUE(diff("", "").isNoop());
+    EXPECT_TRUE(diff("same text", "same text").isNoop());
+    EXPECT_EQ(diff("same text", "same text").getBaseLength(), 9u);
+}
+
+TEST(TextDiffTest, TrimsCommonPrefixAndSuffix) {
+    TextOperation expected;
+    expected.retain(4).insert("quick brown ").retain(3);
+    EXPECT_EQ(diff("The fox", "The quick brown fox"), expected);
+
+    TextOperation removal;
+    removal.retain(4).remove(6).retain(3);
+    EXPECT_EQ(diff("The lazy  dog", "The dog"), removal);
+
+    TextOperation everything;
+    everything.insert("new").remove(3);
+    EXPECT_EQ(diff("old", "new"), everything);
+    expectTransforms("", "inserted");
+    expectTransforms("deleted", "");
+}
+
+TEST(TextDiffTest, FindsShortestEdit) {
+    std::mt19937 rng(17);
+    for (int round = 0; round < 2000; ++round) {
+        // A two-letter alphabet makes many equally long matchings to choose from
+        const std::string a = randomString(rng, rng() % 24, "ab");
+        const std::string b = randomString(rng, rng() % 24, "ab");
+        const TextOperation op = diff(a, b);
+        std::string document = a;
+        ASSERT_TRUE(op.apply(document));
+        ASSERT_EQ(document, b);
+        ASSERT_EQ(editSize(op), shortestEdit(a, b)) << a << " -> " << b;
+    }
+}
+
+TEST(TextDiffTest, DiffsScatteredEditsInLongText) {
+    std::mt19937 rng(29);
+    const std::string text = randomString(rng, 100'000, "abcdefghij klmnop\n");
+    for (int edits : {1, 5, 50}) {
+        const std::string edited = randomEdits(text, rng, edits);
+        const TextOperation op = diff(text, edited);
+        std::string document = text;
+        ASSERT_TRUE(op.apply(document));
+        ASSERT_EQ(document, edited);
+        // Each edit touches at most 8 bytes
+        EXPECT_LE(editSize(op), static_cast<size_t>(edits) * 8);
+    }
+}
+
+TEST(TextDiffTest, KeepsUtf8CharactersWhole) {
+    // \xc3\xa9 and \xc3\xa8 share their lead byte, but the edit replaces the character
+    TextOperation expected;
+    expected.retain(3).insert("\xc3\xa8").remove(2).retain(1);
+    EXPECT_EQ(diff("caf\xc3\xa9!", "caf\xc3\xa8!"), expected);
+
+    // Inserted and retained spans always start and end on a character
+    std::mt19937 rng(31);
+    const std::vector<std::string> characters = {"a", "b", "\xc3\xa9", "\xc3\xa8", "\xe2\x82\xac", "\xe2\x82\xad",
+                                                 "\xf0\x9f\x98\x80", "\xf0\x9f\x98\x81"};
+    auto randomText = [&](size_t length) {
+        std::string text;
+        for (size_t i = 0; i < length; ++i) {
+            text += characters[rng() % characters.size()];
+        }
+        return text;
+    };
+    for (int round = 0; round < 1000; ++round) {
+        const std::string a = randomText(rng() % 20);
+        const std::string b = randomText(rng() % 20);
+        const TextOperation op = diff(a, b);
+        std::string document = a;
+        ASSERT_TRUE(op.apply(document));
+        ASSERT_EQ(document, b);
+
+        size_t position = 0;
+        for (const auto& component : op.getComponents()) {
+            ASSERT_TRUE(collab::util::validUtf8(component.text));
+            if (component.type != TextComponent::Type::INSERT) {
+                position += component.count;
+                ASSERT_TRUE(position == a.size() || (static_cast<unsigned char>(a[position]) & 0xC0) != 0x80);
+            }
+        }
+    }
+}
+
+TEST(TextDiffTest, ReplacesWhatTheBudgetCannotMatch) {
+    // With no budget the middle is replaced whole, still past the trimmed ends
+    TextOperation expected;
+    expected.retain(3).insert("1b2").remove(3).retain(3);
+    EXPECT_EQ(diff("abcxbzdef", "abc1b2def", DiffOptions{0}), expected);
+
+    // Unrelated texts stop early and remain correct
+    std::mt19937 rng(37);
+    const std::string a = randomString(rng, 20'000, "ab");
+    const std::string b = randomString(rng, 20'000, "ab");
+    expectTransforms(a, b, DiffOptions{10'000});
+    expectTransforms(a, randomEdits(a, rng, 200), DiffOptions{1'000});
+}
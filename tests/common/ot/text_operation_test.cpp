@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include "common/ot/text_operation.h"
+#include <random>
+
+using namespace collab::ot;
+
+namespace {
+
+TextOperation randomOperation(const std::string& document, std::mt19937& rng) {
+    TextOperation op;
+    size_t position = 0;
+    
+    while (position < document.length()) {
+        size_t span = std::uniform_int_distribution<size_t>(1, document.length() - position)(rng);
+        switch (std::uniform_int_distribution<int>(0, 2)(rng)) {
+            case 0: op.retain(span); break;
+            case 1: op.remove(span); break;
+            default: op.insert(std::string(span, 'x')).retain(span); break;
+        }
+        position += span;
+    }
+    
+    if (std::uniform_int_distribution<int>(0, 1)(rng)) {
+        op.insert("tail");
+    }
+    return op;
+}
+
+} // namespace
+
+TEST(TextOperationTest, BuildAndApply) {
+    TextOperation op;
+    op.retain(5).insert(",").retain(1).remove(5).insert("there");
+    
+    EXPECT_EQ(op.getBaseLength(), 11);
+    EXPECT_EQ(op.getTargetLength(), 12);
+    
+    std::string doc = "hello world";
+    ASSERT_TRUE(op.apply(doc));
+    EXPECT_EQ(doc, "hello, there");
+    
+    std::string wrongLength = "short";
+    EXPECT_FALSE(op.apply(wrongLength));
+}
+
+TEST(TextOperationTest, ComponentsAreMerged) {
+    TextOperation a;
+    a.retain(2).retain(3).remove(1).insert("ab").insert("c");
+    
+    TextOperation b;
+    b.retain(5).insert("abc").remove(1);
+    
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.getComponents().size(), 3);
+    EXPECT_TRUE(TextOperation().retain(4).isNoop());
+}
+
+TEST(TextOperationTest, InverseRestoresDocument) {
+    std::string original = "collaborative";
+    TextOperation op;
+    op.remove(3).insert("X").retain(10);
+    
+    std::string doc = original;
+    TextOperation undo = op.inverse(doc);
+    ASSERT_TRUE(op.apply(doc));
+    ASSERT_TRUE(undo.apply(doc));
+    EXPECT_EQ(doc, original);
+}
+
+TEST(TextOperationTest, ComposeAndTransformProperties) {
+    std::mt19937 rng(1234);
+    
+    for (int i = 0; i < 200; ++i) {
+        std::string doc = "the quick brown fox";
+        TextOperation a = randomOperation(doc, rng);
+        TextOperation b = randomOperation(doc, rng);
+        
+        // Transform converges
+        auto [aPrime, bPrime] = TextOperation::transform(a, b);
+        std::string left = doc;
+        std::string right = doc;
+        ASSERT_TRUE(a.apply(left) && bPrime.apply(left));
+        ASSERT_TRUE(b.apply(right) && aPrime.apply(right));
+        EXPECT_EQ(left, right);
+        
+        // Compose matches sequential application
+        TextOperation c = randomOperation(left, rng);
+        std::string sequential = doc;
+        std::string composed = doc;
+        ASSERT_TRUE(a.compose(bPrime).compose(c).apply(composed));
+        ASSERT_TRUE(a.apply(sequential) && bPrime.apply(sequential) && c.apply(sequential));
+        EXPECT_EQ(composed, sequential);
+    }
+}
+
+TEST(TextOperationTest, FromCompositeOperation) {
+    CompositeOperation composite;
+    composite.addOperation(std::make_shared<InsertOperation>(0, ">> "));
+    composite.addOperation(std::make_shared<DeleteOperation>(8, 6));
+    
+    std::string expected = "hello world";
+    ASSERT_TRUE(composite.apply(expected));
+    
+    std::string doc = "hello world";
+    TextOperation op = TextOperation::fromOperation(composite, doc.length());
+    ASSERT_TRUE(op.apply(doc));
+    EXPECT_EQ(doc, expected);
+}
+
+TEST(TextOperationTest, TextInPlaceOfARangeIsOneReplace) {
+    TextOperation op;
+    op.retain(6).remove(5).insert("there").retain(1);
+    
+    auto converted = op.toOperation();
+    ASSERT_EQ(converted->getKind(), OperationKind::REPLACE);
+    std::string doc = "hello world!";
+    ASSERT_TRUE(converted->apply(doc));
+    EXPECT_EQ(doc, "hello there!");
+    EXPECT_EQ(TextOperation::fromOperation(*converted, 12), op);
+}
+
+TEST(TextOperationTest, SerializationRoundTrip) {
+    TextOperation op;
+    op.retain(3).insert("abc").remove(2);
+    
+    EXPECT_EQ(op.serialize(), "[3,\"abc\",-2]");
+    EXPECT_EQ(TextOperation::deserialize(op.serialize()), op);
+    EXPECT_THROW(TextOperation::deserialize("{}"), std::invalid_argument);
+    
+    TextOperation shorter;
+    shorter.retain(1);
+    EXPECT_THROW(op.compose(shorter), std::invalid_argument);
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "common/ot/transform_arena.h"
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+using namespace collab::ot;
+
+namespace {
+
+std::vector<OperationPtr> mixedHistory(size_t count) {
+    std::vector<OperationPtr> history;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 4 == 3) {
+            auto composite = std::make_shared<CompositeOperation>();
+            composite->addOperation(std::make_shared<InsertOperation>(i, "ab"));
+            composite->addOperation(std::make_shared<DeleteOperation>(0, 1, "x"));
+            history.push_back(composite);
+        } else if (i % 4 == 2) {
+            history.push_back(std::make_shared<DeleteOperation>(i, 2, "zz"));
+        } else {
+            history.push_back(std::make_shared<InsertOperation>(i, "a text longer than the small string buffer"));
+        }
+    }
+    return history;
+}
+
+} // namespace
+
+TEST(TransformArenaTest, MatchesStepwiseTransform) {
+    const auto history = mixedHistory(40);
+    std::vector<OperationPtr> incoming = {
+        std::make_shared<InsertOperation>(30, "!"),
+        std::make_shared<DeleteOperation>(5, 20, std::string(20, 'd')),
+    };
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<InsertOperation>(3, "one"));
+    composite->addOperation(std::make_shared<DeleteOperation>(10, 4, "four"));
+    incoming.push_back(composite);
+
+    for (const auto& op : incoming) {
+        OperationPtr stepwise = op;
+        for (const auto& entry : history) {
+            stepwise = stepwise->transform(entry);
+        }
+        const OperationPtr through = transformThrough(op, history);
+        ASSERT_NE(through, nullptr);
+        EXPECT_EQ(through->serialize(), stepwise->serialize());
+    }
+}
+
+TEST(TransformArenaTest, KernelsAllocateFromTheCurrentArena) {
+    EXPECT_EQ(TransformArena::current(), nullptr);
+    const OperationPtr insert = std::make_shared<InsertOperation>(4, "x");
+    const OperationPtr before = std::make_shared<InsertOperation>(0, "y");
+    {
+        TransformArena outer;
+        std::pmr::memory_resource* outerResource = TransformArena::current();
+        ASSERT_NE(outerResource, nullptr);
+        {
+            TransformArena inner;
+            EXPECT_NE(TransformArena::current(), outerResource);
+        }
+        EXPECT_EQ(TransformArena::current(), outerResource);
+
+        // The result sits in the arena's inline buffer, next to the arena itself
+        const OperationPtr shifted = insert->transform(before);
+        const auto* address = reinterpret_cast<const std::byte*>(shifted.get());
+        const auto* arena = reinterpret_cast<const std::byte*>(&outer);
+        EXPECT_GE(address, arena);
+        EXPECT_LT(address, arena + sizeof(TransformArena));
+    }
+    EXPECT_EQ(TransformArena::current(), nullptr);
+}
+
+TEST(TransformArenaTest, PromotedResultsOutliveTheArenaWithTheirMetadata) {
+    OperationPtr promoted;
+    {
+        TransformArena arena;
+        auto composite = std::make_shared<CompositeOperation>();
+        composite->addOperation(std::make_shared<InsertOperation>(2, "kept"));
+        composite->addOperation(std::make_shared<DeleteOperation>(8, 1, "k"));
+        OperationPtr transformed = composite->transform(std::make_shared<InsertOperation>(0, "-"));
+        transformed->setId(7);
+        transformed->setSource(OperationSource::LOCAL_UNDO);
+        transformed->setRelatedOperationId(3);
+        promoted = arena.promote(*transformed);
+    }
+    EXPECT_EQ(promoted->getId(), 7);
+    EXPECT_EQ(promoted->getSource(), OperationSource::LOCAL_UNDO);
+    EXPECT_EQ(promoted->getRelatedOperationId(), 3);
+
+    std::string document = "-0123456789";
+    ASSERT_TRUE(promoted->apply(document));
+    EXPECT_EQ(document, "-01kept2356789");
+}
+
+TEST(TransformArenaTest, EmptyHistoryReturnsTheOperationItself) {
+    const OperationPtr op = std::make_shared<InsertOperation>(1, "x");
+    EXPECT_EQ(transformThrough(op, std::span<const OperationPtr>()), op);
+    EXPECT_EQ(transformThrough(nullptr, mixedHistory(3)), nullptr);
+}
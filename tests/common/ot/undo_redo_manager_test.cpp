@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include "common/ot/undo_redo_manager.h"
+
+using namespace collab::ot;
+
+namespace {
+
+// Apply a local operation the way DocumentManager does and record it
+void applyLocal(UndoRedoManager& manager, std::string& document, OperationPtr op) {
+    op->setSource(OperationSource::LOCAL);
+    OperationPtr captured = op->applyAndCapture(document);
+    ASSERT_TRUE(captured);
+    manager.addOperation(captured);
+}
+
+// Type text one character at a time, as an editor sends it
+void type(UndoRedoManager& manager, std::string& document, size_t position, const std::string& text,
+          std::chrono::steady_clock::time_point now) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        auto op = std::make_shared<InsertOperation>(position + i, std::string(1, text[i]));
+        op->setSource(OperationSource::LOCAL);
+        ASSERT_TRUE(op->apply(document));
+        manager.addOperation(op, now);
+    }
+}
+
+void applyRemote(UndoRedoManager& manager, std::string& document, OperationPtr op) {
+    op->setSource(OperationSource::REMOTE);
+    ASSERT_TRUE(op->apply(document));
+    manager.transformHistory(op);
+}
+
+} // namespace
+
+TEST(UndoRedoManagerTest, UndoesAgainstRemoteOperationsSinceTheEntry) {
+    UndoRedoManager manager;
+    std::string document = "world";
+    
+    applyLocal(manager, document, std::make_shared<InsertOperation>(5, "!"));
+    applyLocal(manager, document, std::make_shared<DeleteOperation>(0, 1));
+    applyRemote(manager, document, std::make_shared<InsertOperation>(0, "hello "));
+    applyRemote(manager, document, std::make_shared<InsertOperation>(6, "big "));
+    EXPECT_EQ(document, "hello big orld!");
+    
+    ASSERT_TRUE(manager.undo(document));
+    EXPECT_EQ(document, "hello big world!");
+    ASSERT_TRUE(manager.undo(document));
+    EXPECT_EQ(document, "hello big world");
+    EXPECT_EQ(manager.undoCount(), 0);
+    
+    applyRemote(manager, document, std::make_shared<DeleteOperation>(6, 4));
+    ASSERT_TRUE(manager.redo(document));
+    EXPECT_EQ(document, "hello world!");
+    EXPECT_EQ(manager.redoCount(), 1);
+}
+
+TEST(UndoRedoManagerTest, DropsHistoryOlderThanTheRemoteLog) {
+    UndoRedoManager manager(100, 2);
+    std::string document = "abc";
+    
+    applyLocal(manager, document, std::make_shared<InsertOperation>(3, "d"));
+    for (int i = 0; i < 3; ++i) {
+        applyRemote(manager, document, std::make_shared<InsertOperation>(0, "x"));
+    }
+    
+    EXPECT_FALSE(manager.undo(document));
+    EXPECT_EQ(document, "xxxabcd");
+    EXPECT_EQ(manager.undoCount(), 0);
+}
+
+TEST(UndoRedoManagerTest, GroupsTypingByWordAndIdleGap) {
+    UndoRedoManager manager;
+    std::string document;
+    auto now = std::chrono::steady_clock::now();
+    
+    type(manager, document, 0, "hello world", now);
+    EXPECT_EQ(manager.undoCount(), 2);
+    type(manager, document, 11, "!", now + std::chrono::seconds(1));
+    EXPECT_EQ(manager.undoCount(), 3);
+    
+    ASSERT_TRUE(manager.undo(document));
+    ASSERT_TRUE(manager.undo(document));
+    EXPECT_EQ(document, "hello ");
+    ASSERT_TRUE(manager.redo(document));
+    EXPECT_EQ(document, "hello world");
+}
+
+TEST(UndoRedoManagerTest, GroupsBackspacesInPlace) {
+    UndoRedoManager manager;
+    std::string document = "hello world";
+    auto now = std::chrono::steady_clock::now();
+    
+    for (size_t end = document.size(); end > 0; --end) {
+        applyLocal(manager, document, std::make_shared<DeleteOperation>(end - 1, 1));
+    }
+    EXPECT_TRUE(document.empty());
+    EXPECT_EQ(manager.undoCount(), 2);
+    
+    ASSERT_TRUE(manager.undo(document));
+    EXPECT_EQ(document, "hello");
+    
+    // A remote edit in between ends the group
+    type(manager, document, 5, "!", now);
+    applyRemote(manager, document, std::make_shared<InsertOperation>(0, ">"));
+    type(manager, document, 7, "?", now);
+    EXPECT_EQ(document, ">hello!?");
+    EXPECT_EQ(manager.undoCount(), 3);
+}
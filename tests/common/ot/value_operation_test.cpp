@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include "common/ot/value_operation.h"
+
+using namespace collab::ot;
+
+namespace {
+
+// Polymorphic and value transforms must agree on every pair, and on which pairs leave a single operation
+void expectSameTransform(const OperationPtr& op, const OperationPtr& other) {
+    auto expected = toValueOperation(*op->transform(other));
+    auto actual = transform(*toValueOperation(*op), *toValueOperation(*other));
+    ASSERT_EQ(actual.has_value(), expected.has_value());
+    if (!expected) {
+        return;
+    }
+    
+    std::string a = "0123456789abcdefghij";
+    std::string b = a;
+    ASSERT_EQ(applyOperation(*expected, a), applyOperation(*actual, b));
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(actual->index(), expected->index());
+}
+
+} // namespace
+
+TEST(ValueOperationTest, ApplyAndInverse) {
+    std::string doc = "hello world";
+    ValueOperation insert = InsertOp{5, ","};
+    ASSERT_TRUE(applyOperation(insert, doc));
+    EXPECT_EQ(doc, "hello, world");
+    
+    ASSERT_TRUE(applyOperation(inverse(insert), doc));
+    EXPECT_EQ(doc, "hello world");
+    
+    EXPECT_FALSE(applyOperation(ValueOperation{DeleteOp{10, 5}}, doc));
+    EXPECT_THROW(inverse(ValueOperation{DeleteOp{0, 1}}), std::runtime_error);
+}
+
+TEST(ValueOperationTest, TransformMatchesPolymorphic) {
+    std::vector<OperationPtr> ops = {
+        std::make_shared<InsertOperation>(0, "ab"),
+        std::make_shared<InsertOperation>(5, "xyz"),
+        std::make_shared<DeleteOperation>(2, 3, "234"),
+        std::make_shared<DeleteOperation>(4, 6, "456789"),
+        std::make_shared<DeleteOperation>(3, 1, "3"),
+        std::make_shared<DeleteOperation>(0, 10, "0123456789"),
+    };
+    
+    for (const auto& op : ops) {
+        for (const auto& other : ops) {
+            expectSameTransform(op, other);
+        }
+    }
+}
+
+TEST(ValueOperationTest, TransformAgainstComposite) {
+    auto composite = std::make_shared<CompositeOperation>();
+    composite->addOperation(std::make_shared<InsertOperation>(0, "ab"));
+    composite->addOperation(std::make_shared<DeleteOperation>(4, 2));
+    
+    auto result = transform(ValueOperation{InsertOp{8, "!"}}, *composite);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(std::get<InsertOp>(*result).position, 8);
+}
+
+TEST(ValueOperationTest, Adapters) {
+    auto del = toOperation(DeleteOp{1, 2, "bc"});
+    EXPECT_EQ(del->getKind(), OperationKind::DELETE);
+    
+    auto back = toValueOperation(*del);
+    ASSERT_TRUE(back.has_value());
+    EXPECT_EQ(std::get<DeleteOp>(*back).deletedText, "bc");
+    
+    EXPECT_FALSE(toValueOperation(CompositeOperation()).has_value());
+}
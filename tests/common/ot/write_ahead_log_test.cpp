@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include "common/ot/write_ahead_log.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+using namespace collab::ot;
+
+namespace {
+
+std::filesystem::path logDirectory(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove_all(path);
+    return path;
+}
+
+} // namespace
+
+TEST(WriteAheadLogTest, RecoversCommittedOperations) {
+    auto directory = logDirectory("collabedit_wal_recover");
+    GroupCommit commit(std::chrono::milliseconds(1));
+    std::atomic<int> durable{0};
+    {
+        WriteAheadLog log(directory, "doc", commit);
+        EXPECT_EQ(log.revision(), 0);
+        EXPECT_TRUE(log.recovery().content.empty());
+        
+        log.append(1, InsertOperation(0, "hello"), [&](bool ok) { durable += ok; });
+        log.append(2, InsertOperation(5, " world"), [&](bool ok) { durable += ok; });
+        log.append(3, DeleteOperation(0, 1), [&](bool ok) { durable += ok; });
+        EXPECT_THROW(log.append(5, InsertOperation(0, "x")), std::invalid_argument);
+        commit.flush();
+        EXPECT_EQ(durable, 3);
+    }
+    
+    WriteAheadLog reopened(directory, "doc", commit);
+    EXPECT_EQ(reopened.recovery().content, "ello world");
+    EXPECT_EQ(reopened.recovery().revision, 3);
+    EXPECT_EQ(reopened.recovery().replayed, 3u);
+    EXPECT_EQ(reopened.revision(), 3);
+}
+
+TEST(WriteAheadLogTest, SnapshotEmptiesTheOperationFile) {
+    auto directory = logDirectory("collabedit_wal_snapshot");
+    GroupCommit commit(std::chrono::milliseconds(1));
+    {
+        WriteAheadLog log(directory, "doc", commit, 64);
+        Rope content;
+        for (int64_t revision = 1; revision <= 20; ++revision) {
+            InsertOperation op(content.length(), "line\n");
+            op.apply(content);
+            log.append(revision, op);
+        }
+        EXPECT_TRUE(log.wantsSnapshot());
+        
+        log.snapshot(content, 20);
+        EXPECT_FALSE(log.wantsSnapshot());
+        EXPECT_EQ(log.walBytes(), 0u);
+        
+        log.append(21, InsertOperation(0, "top\n"));
+    }
+    
+    WriteAheadLog reopened(directory, "doc", commit);
+    EXPECT_EQ(reopened.recovery().revision, 21);
+    EXPECT_EQ(reopened.recovery().replayed, 1u);
+    EXPECT_EQ(reopened.recovery().content.length(), 4u + 20 * 5);
+    EXPECT_EQ(reopened.recovery().content.substr(0, 9), "top\nline\n");
+}
+
+TEST(WriteAheadLogTest, DropsATornRecord) {
+    auto directory = logDirectory("collabedit_wal_torn");
+    GroupCommit commit(std::chrono::milliseconds(1));
+    {
+        WriteAheadLog log(directory, "doc", commit);
+        log.append(1, InsertOperation(0, "kept"));
+    }
+    {
+        // A crash in the middle of the next record
+        std::ofstream wal(directory / "doc.wal", std::ios::binary | std::ios::app);
+        wal.write("\x40\x00\x00\x00\x12\x34", 6);
+    }
+    {
+        WriteAheadLog log(directory, "doc", commit);
+        EXPECT_EQ(log.recovery().content, "kept");
+        EXPECT_EQ(log.revision(), 1);
+        log.append(2, InsertOperation(4, "!"));
+    }
+    
+    WriteAheadLog reopened(directory, "doc", commit);
+    EXPECT_EQ(reopened.recovery().content, "kept!");
+    EXPECT_THROW(WriteAheadLog(directory, "../doc", commit), std::invalid_argument);
+}
+
+TEST(WriteAheadLogTest, CommitsQueuedEditsAsCompressedFrames) {
+    auto directory = logDirectory("collabedit_wal_frames");
+    GroupCommit commit(std::chrono::milliseconds(20));
+    Rope content;
+    {
+        WriteAheadLog log(directory, "doc", commit);
+        std::atomic<int64_t> durableSeen{0};
+        for (int64_t revision = 1; revision <= 200; ++revision) {
+            InsertOperation op(content.length(), "the same line again\n");
+            op.apply(content);
+            log.append(revision, op, [&, revision](bool ok) {
+                if (ok) {
+                    durableSeen = revision;
+                }
+            });
+        }
+        // Nothing has waited on the disk so far
+        EXPECT_EQ(log.getStats().revision, 200);
+        EXPECT_LE(log.durableRevision(), 200);
+
+        commit.flush();
+        const auto stats = log.getStats();
+        EXPECT_EQ(log.durableRevision(), 200);
+        EXPECT_EQ(durableSeen, 200);
+        EXPECT_EQ(stats.queuedBytes, 0u);
+        EXPECT_LT(stats.frames, 200u);
+        EXPECT_LT(stats.writtenBytes, stats.rawBytes / 2);
+
+        // A queued snapshot lands after the operations before it
+        log.snapshotAsync(content, 200);
+        InsertOperation last(0, "top\n");
+        last.apply(content);
+        log.append(201, last);
+        commit.flush();
+        EXPECT_EQ(log.durableRevision(), 201);
+    }
+
+    WriteAheadLog reopened(directory, "doc", commit);
+    EXPECT_EQ(reopened.recovery().revision, 201);
+    EXPECT_EQ(reopened.recovery().replayed, 1u);
+    EXPECT_EQ(reopened.recovery().content.length(), content.length());
+    EXPECT_EQ(reopened.durableRevision(), 201);
+}
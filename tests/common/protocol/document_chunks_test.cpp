@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "common/protocol/document_chunks.h"
+#include "common/ot/rope.h"
+#include <string>
+#include <vector>
+
+using namespace collab;
+using namespace collab::protocol;
+
+namespace {
+
+std::vector<DocumentMessage> drain(DocumentChunker<ot::Rope>& chunker) {
+    std::vector<DocumentMessage> responses;
+    while (auto response = chunker.next()) {
+        responses.push_back(std::move(*response));
+    }
+    return responses;
+}
+
+} // namespace
+
+TEST(DocumentChunksTest, PlainOpenGetsOneResponse) {
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "doc";
+    ASSERT_FALSE(isChunkedOpen(open));
+    
+    DocumentChunker<ot::Rope> chunker(open, ot::Rope("whole text"), 7, 3);
+    std::vector<DocumentMessage> responses = drain(chunker);
+    ASSERT_EQ(responses.size(), 1u);
+    EXPECT_EQ(responses[0].documentContent, "whole text");
+    EXPECT_EQ(responses[0].documentVersion, 7u);
+    EXPECT_FALSE(responses[0].contentOffset);
+}
+
+TEST(DocumentChunksTest, ChunkedOpenSendsTheViewportFirst) {
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "line " + std::to_string(i) + "\n";
+    }
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "doc";
+    open.contentOffset = 300;
+    open.contentLength = 50;
+    ASSERT_TRUE(isChunkedOpen(open));
+    
+    DocumentChunker<ot::Rope> chunker(open, ot::Rope(text), 3, 128);
+    std::vector<DocumentMessage> responses = drain(chunker);
+    ASSERT_FALSE(responses.empty());
+    EXPECT_EQ(*responses[0].contentOffset, 300u);
+    EXPECT_EQ(*responses[0].documentContent, text.substr(300, 50));
+    
+    // Every chunk goes where it says, and together they cover the document once
+    std::string rebuilt(text.size(), '\0');
+    size_t covered = 0;
+    for (const auto& response : responses) {
+        EXPECT_EQ(*response.contentLength, text.size());
+        EXPECT_EQ(*response.documentVersion, 3u);
+        EXPECT_LE(response.documentContent->size(), response.contentOffset == 300u ? 50u : 128u);
+        rebuilt.replace(*response.contentOffset, response.documentContent->size(), *response.documentContent);
+        covered += response.documentContent->size();
+    }
+    EXPECT_EQ(rebuilt, text);
+    EXPECT_EQ(covered, text.size());
+    
+    // The fields survive the wire
+    DocumentMessage decoded = Message::fromJson<DocumentMessage>(nlohmann::json::parse(responses[1].toString()));
+    EXPECT_EQ(decoded.contentOffset, responses[1].contentOffset);
+    EXPECT_EQ(decoded.contentLength, responses[1].contentLength);
+}
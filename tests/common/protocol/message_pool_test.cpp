@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "common/protocol/message_pool.h"
+#include "common/protocol/wire_codec.h"
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace collab::protocol;
+
+namespace {
+
+template <typename Fn>
+void onFreshThread(Fn fn) {
+    std::thread(fn).join();
+}
+
+} // namespace
+
+TEST(MessagePoolTest, ReusedMessagesComeBackClearedWithTheirCapacity) {
+    onFreshThread([] {
+        const EditMessage* first = nullptr;
+        size_t capacity = 0;
+        {
+            auto edit = MessagePool<EditMessage>::acquire(MessageType::EDIT_INSERT);
+            edit->documentId = std::string(100, 'd');
+            edit->clientId = "client";
+            edit->documentVersion = 9;
+            edit->position = 4;
+            edit->text = "text";
+            first = edit.get();
+            capacity = edit->documentId.capacity();
+        }
+        EXPECT_EQ(MessagePool<EditMessage>::freeCount(), 1u);
+
+        auto again = MessagePool<EditMessage>::acquire(MessageType::EDIT_DELETE);
+        EXPECT_EQ(again.get(), first);
+        EXPECT_EQ(again->type, MessageType::EDIT_DELETE);
+        EXPECT_TRUE(again->documentId.empty());
+        EXPECT_EQ(again->documentId.capacity(), capacity);
+        EXPECT_TRUE(again->clientId.empty());
+        EXPECT_EQ(again->documentVersion, 0u);
+        EXPECT_FALSE(again->position);
+        EXPECT_FALSE(again->text);
+        EXPECT_GT(again->timestamp, 0u);
+    });
+}
+
+TEST(MessagePoolTest, RejectsTypesTheStructDoesNotCarry) {
+    onFreshThread([] {
+        { auto presence = MessagePool<PresenceMessage>::acquire(MessageType::PRESENCE_CURSOR); }
+        EXPECT_THROW(MessagePool<PresenceMessage>::acquire(MessageType::EDIT_INSERT), std::invalid_argument);
+        EXPECT_EQ(MessagePool<PresenceMessage>::freeCount(), 1u);
+    });
+}
+
+TEST(MessagePoolTest, JsonDecodingRecyclesEditAndPresenceMessages) {
+    onFreshThread([] {
+        EditMessage edit(MessageType::EDIT_INSERT);
+        edit.documentId = "doc";
+        edit.operationId = "op-1";
+        edit.position = 3;
+        edit.text = "abc";
+        PresenceMessage cursor(MessageType::PRESENCE_CURSOR);
+        cursor.documentId = "doc";
+        cursor.username = "alice";
+        cursor.cursorPosition = 7;
+
+        WireCodec codec;
+        for (int i = 0; i < 3; ++i) {
+            codec.visit(codec.encode(edit), [&](const auto& message) {
+                using T = std::decay_t<decltype(message)>;
+                ASSERT_TRUE((std::is_same_v<T, EditMessageView>));
+                if constexpr (std::is_same_v<T, EditMessageView>) {
+                    EXPECT_EQ(message.documentId, "doc");
+                    EXPECT_EQ(message.text, "abc");
+                    EXPECT_EQ(message.position, 3u);
+                }
+            });
+            codec.visit(codec.encode(cursor), [&](const auto& message) {
+                using T = std::decay_t<decltype(message)>;
+                ASSERT_TRUE((std::is_same_v<T, PresenceMessageView>));
+                if constexpr (std::is_same_v<T, PresenceMessageView>) {
+                    EXPECT_EQ(message.username, "alice");
+                    EXPECT_EQ(message.cursorPosition, 7u);
+                }
+            });
+        }
+        EXPECT_EQ(MessagePool<EditMessage>::freeCount(), 1u);
+        EXPECT_EQ(MessagePool<PresenceMessage>::freeCount(), 1u);
+    });
+}
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+#include "common/protocol/message_router.h"
+#include <string>
+#include <vector>
+
+using namespace collab::protocol;
+
+namespace {
+
+EditMessage makeEdit(const std::string& text) {
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.clientId = "client";
+    edit.documentId = "doc";
+    edit.operationId = "op";
+    edit.position = 1;
+    edit.text = text;
+    return edit;
+}
+
+} // namespace
+
+TEST(MessageRouterTest, RoutesEachStructToItsHandler) {
+    MessageRouter<const std::string&> router;
+    std::vector<std::string> calls;
+
+    router.on<EditMessageView>([&](const std::string& from, const EditMessageView& edit) {
+        calls.push_back(from + " edit " + std::string(*edit.text));
+    });
+    router.on<AuthMessage>([&](const std::string& from, const AuthMessage& auth) {
+        calls.push_back(from + " auth " + auth.username);
+    });
+    router.otherwise([&](const std::string& from, const Message& message) {
+        // The fallback receives the full struct, not a sliced copy
+        const auto* document = dynamic_cast<const DocumentMessage*>(&message);
+        calls.push_back(from + " other " + (document ? document->documentId : std::string("?")));
+    });
+
+    WireCodec codec;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "readme";
+
+    router.route(codec, login.toString(), "c1");
+    router.route(codec, makeEdit("x").toString(), "c1");
+    router.route(codec, open.toString(), "c2");
+
+    EXPECT_EQ(calls, (std::vector<std::string>{"c1 auth alice", "c1 edit x", "c2 other readme"}));
+}
+
+TEST(MessageRouterTest, OwningHandlersReceiveCopiesOfBinaryViews) {
+    WireCodec client;
+    WireCodec server;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    server.decode(client.encode(login));
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    client.decode(server.encode(success));
+    ASSERT_TRUE(client.binary());
+
+    MessageRouter<> router;
+    std::vector<EditMessage> edits;
+    int others = 0;
+    router.on<EditMessage>([&](const EditMessage& edit) { edits.push_back(edit); });
+    router.otherwise([&](const Message&) { ++others; });
+
+    router.route(server, client.encode(makeEdit("first")));
+    router.route(server, client.encode(makeEdit("second")));
+    PresenceMessage presence(MessageType::PRESENCE_JOIN);
+    router.route(server, client.encode(presence));
+
+    ASSERT_EQ(edits.size(), 2u);
+    EXPECT_EQ(edits[0].text, "first");
+    EXPECT_EQ(edits[1].text, "second");
+    EXPECT_EQ(edits[1].documentId, "doc");
+    EXPECT_EQ(others, 1);
+}
+
+TEST(MessageRouterTest, InterceptorsSeeMessagesBeforeTheirHandlers) {
+    MessageRouter<const std::string&> router;
+    std::vector<std::string> calls;
+    router.on<DocumentMessage>([&](const std::string&, const DocumentMessage& doc) { calls.push_back("handler " + doc.documentId); });
+    router.intercept<DocumentMessage>([&](const std::string&, const DocumentMessage& doc) {
+        calls.push_back("intercepted " + doc.documentId);
+        return doc.documentId == "elsewhere";
+    });
+
+    WireCodec codec;
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "here";
+    router.route(codec, open.toString(), "c1");
+    open.documentId = "elsewhere";
+    router.route(codec, open.toString(), "c1");
+
+    EXPECT_EQ(calls, (std::vector<std::string>{"intercepted here", "handler here", "intercepted elsewhere"}));
+}
+
+TEST(MessageRouterTest, EditsAreInterceptedAsViewsInEitherFormat) {
+    WireCodec client;
+    WireCodec server;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    server.decode(client.encode(login));
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    client.decode(server.encode(success));
+    ASSERT_TRUE(client.binary());
+
+    MessageRouter<> router;
+    std::vector<std::string> calls;
+    router.on<EditMessage>([&](const EditMessage& edit) { calls.push_back("handler " + *edit.text); });
+    router.intercept<EditMessageView>([&](const EditMessageView& edit) {
+        calls.push_back("intercepted " + std::string(*edit.text));
+        return *edit.text == "dropped";
+    });
+
+    // Binary frames decode to views; JSON ones to structs
+    WireCodec json;
+    router.route(server, client.encode(makeEdit("binary")));
+    router.route(json, makeEdit("json").toString());
+    router.route(json, makeEdit("dropped").toString());
+
+    EXPECT_EQ(calls, (std::vector<std::string>{"intercepted binary", "handler binary", "intercepted json", "handler json",
+                                               "intercepted dropped"}));
+}
+
+TEST(MessageRouterTest, BulkEditsAreRoutedWholeInEitherFormat) {
+    WireCodec client;
+    WireCodec server;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    server.decode(client.encode(login));
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    client.decode(server.encode(success));
+    ASSERT_TRUE(client.binary());
+
+    MessageRouter<> router;
+    std::vector<std::string> calls;
+    router.on<EditMessage>([&](const EditMessage& edit) { calls.push_back("edit " + *edit.text); });
+    router.on<BatchMessage>([&](const BatchMessage& bulk) {
+        std::string texts;
+        for (const auto& element : bulk.messages) {
+            texts += *dynamic_cast<const EditMessage&>(*element).text;
+        }
+        calls.push_back("bulk " + texts);
+    });
+
+    BatchMessage bulk(MessageType::EDIT_BULK);
+    bulk.add(makeEdit("a"));
+    bulk.add(makeEdit("b"));
+    BatchMessage batch(MessageType::BATCH);
+    batch.add(makeEdit("c"));
+
+    WireCodec json;
+    router.route(server, client.encode(bulk));
+    router.route(json, bulk.toString());
+    router.route(json, batch.toString());
+
+    EXPECT_EQ(calls, (std::vector<std::string>{"bulk ab", "bulk ab", "edit c"}));
+}
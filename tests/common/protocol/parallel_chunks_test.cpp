@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+#include "common/protocol/parallel_chunks.h"
+#include "common/ot/rope.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace collab;
+using namespace collab::protocol;
+
+namespace {
+
+// Run the AUTH_LOGIN / AUTH_SUCCESS exchange between two codecs
+void negotiate(WireCodec& client, WireCodec& server) {
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    auto received = std::get<AuthMessage>(server.decode(client.encode(login)));
+
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    success.username = received.username;
+    client.decode(server.encode(success));
+}
+
+std::string makeText(size_t lines) {
+    std::string text;
+    for (size_t line = 0; line < lines; ++line) {
+        text += "line " + std::to_string(line) + " of a document that repeats itself\n";
+    }
+    return text;
+}
+
+DocumentMessage chunkedOpen(size_t offset, size_t length) {
+    DocumentMessage open(MessageType::DOC_OPEN);
+    open.documentId = "doc";
+    open.contentOffset = offset;
+    open.contentLength = length;
+    return open;
+}
+
+// Put a document back together from its responses by their offsets
+std::string reassemble(const std::vector<DocumentMessage>& responses) {
+    std::string text(*responses.at(0).contentLength, '\0');
+    for (const auto& response : responses) {
+        text.replace(*response.contentOffset, response.documentContent->size(), *response.documentContent);
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(ParallelChunksTest, RoundTripsInOrderInEitherFormat) {
+    const std::string text = makeText(5000);
+    const DocumentMessage open = chunkedOpen(text.size() / 2, 1000);
+
+    for (WireFormat format : {WireFormat::JSON, WireFormat::BINARY}) {
+        for (size_t threads : {1, 4}) {
+            WireCodec client(format);
+            WireCodec server(format);
+            negotiate(client, server);
+            ASSERT_TRUE(server.compressing());
+
+            // What a single-threaded encoder sends, to compare against
+            DocumentChunker<ot::Rope> reference(open, ot::Rope(text), 3, 4096);
+            std::vector<DocumentMessage> expected;
+            while (auto response = reference.next()) {
+                expected.push_back(*response);
+            }
+
+            DocumentChunker<ot::Rope> chunker(open, ot::Rope(text), 3, 4096);
+            std::vector<std::string> frames;
+            const size_t sent = encodeChunks(chunker, server, [&](std::string frame) { frames.push_back(std::move(frame)); },
+                                             threads);
+            ASSERT_EQ(sent, expected.size());
+            ASSERT_EQ(frames.size(), expected.size());
+            EXPECT_EQ(static_cast<uint8_t>(frames[0][0]), COMPRESSED_FRAME_MARKER);
+
+            const std::vector<DocumentMessage> responses = decodeChunks(client, frames, threads);
+            ASSERT_EQ(responses.size(), expected.size());
+            for (size_t i = 0; i < responses.size(); ++i) {
+                EXPECT_EQ(responses[i].documentId, "doc");
+                EXPECT_EQ(responses[i].contentOffset, expected[i].contentOffset);
+                EXPECT_EQ(responses[i].documentContent, expected[i].documentContent);
+                EXPECT_EQ(responses[i].documentVersion, 3u);
+            }
+            EXPECT_EQ(reassemble(responses), text);
+
+            // The codecs are still in step afterwards
+            DocumentMessage close(MessageType::DOC_CLOSE);
+            close.documentId = "doc";
+            EXPECT_EQ(std::get<DocumentMessage>(client.decode(server.encode(close))).documentId, "doc");
+        }
+    }
+}
+
+TEST(ParallelChunksTest, SendsFramesAsTheyAreWithoutCompression) {
+    const std::string text = makeText(500);
+    WireCodec client;
+    WireCodec server;
+    server.setCompression(false);
+    negotiate(client, server);
+
+    DocumentChunker<ot::Rope> chunker(chunkedOpen(0, 100), ot::Rope(text), 1, 2048);
+    std::vector<std::string> frames;
+    encodeChunks(chunker, server, [&](std::string frame) { frames.push_back(std::move(frame)); }, 4);
+    ASSERT_GT(frames.size(), 1u);
+    for (const auto& frame : frames) {
+        EXPECT_NE(static_cast<uint8_t>(frame[0]), COMPRESSED_FRAME_MARKER);
+    }
+    EXPECT_EQ(reassemble(decodeChunks(client, frames, 4)), text);
+}
+
+TEST(ParallelChunksTest, RejectsFramesThatAreNotDocuments) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+    const std::vector<std::string> frames = {server.encode(Message(MessageType::SYS_HEARTBEAT))};
+    EXPECT_THROW(decodeChunks(client, frames), std::runtime_error);
+    EXPECT_THROW(server.encodeUncompressed(AuthMessage(MessageType::AUTH_LOGIN)), std::invalid_argument);
+}
@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include "common/protocol/json_writer.h"
+#include "common/protocol/protocol.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <variant>
+
+using namespace collab::protocol;
+
+TEST(ProtocolTest, JsonWriterEscapesLikeNlohmann) {
+    std::string text = "quote\" backslash\\ newline\n tab\t bell\x07 nul";
+    text += '\0';
+    text += " del\x7f utf8 \xc3\xa9";
+
+    JsonWriter writer;
+    writer.beginObject();
+    writer.field("text", text);
+    writer.field("count", uint64_t{18446744073709551615u});
+    writer.field("negative", -42);
+    writer.field("flag", false);
+    writer.field("list", std::vector<std::string>{"a", "", "c"});
+    writer.field("map", std::map<std::string, std::string>{{"k", "v"}});
+    writer.field("missing", std::optional<std::string>());
+    writer.endObject();
+
+    nlohmann::json expected;
+    expected["text"] = text;
+    expected["count"] = uint64_t{18446744073709551615u};
+    expected["negative"] = -42;
+    expected["flag"] = false;
+    expected["list"] = std::vector<std::string>{"a", "", "c"};
+    expected["map"] = std::map<std::string, std::string>{{"k", "v"}};
+    EXPECT_EQ(nlohmann::json::parse(writer.data()), expected);
+}
+
+TEST(ProtocolTest, JsonWriterClearKeepsCapacity) {
+    JsonWriter writer;
+    writer.value(std::string(1000, 'x'));
+    const size_t capacity = writer.data().capacity();
+
+    writer.clear();
+    writer.beginArray();
+    writer.value(true);
+    writer.value(1);
+    writer.endArray();
+    EXPECT_EQ(writer.data(), "[true,1]");
+    EXPECT_EQ(writer.data().capacity(), capacity);
+}
+
+TEST(ProtocolTest, MessagesRoundTripThroughJson) {
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.clientId = "client \"1\"";
+    edit.sessionId = "session";
+    edit.sequenceNumber = 7;
+    edit.documentId = "doc";
+    edit.documentVersion = 12;
+    edit.operationId = "op";
+    edit.position = 3;
+    edit.text = "line\nbreak";
+
+    auto decodedEdit = std::get<EditMessage>(Message::fromString(edit.toString()));
+    EXPECT_EQ(decodedEdit.clientId, edit.clientId);
+    EXPECT_EQ(decodedEdit.sequenceNumber, 7u);
+    EXPECT_EQ(decodedEdit.timestamp, edit.timestamp);
+    EXPECT_EQ(decodedEdit.documentVersion, 12u);
+    EXPECT_EQ(decodedEdit.position, edit.position);
+    EXPECT_FALSE(decodedEdit.length.has_value());
+    EXPECT_EQ(decodedEdit.text, edit.text);
+    EXPECT_FALSE(decodedEdit.success.has_value());
+
+    AuthMessage auth(MessageType::AUTH_LOGIN);
+    auth.username = "alice";
+    auth.token = "secret";
+    auth.metadata["client"] = "desktop";
+    auto decodedAuth = std::get<AuthMessage>(Message::fromString(auth.toString()));
+    EXPECT_EQ(decodedAuth.username, "alice");
+    EXPECT_FALSE(decodedAuth.password.has_value());
+    EXPECT_EQ(decodedAuth.token, auth.token);
+    EXPECT_EQ(decodedAuth.metadata, auth.metadata);
+
+    DocumentMessage document(MessageType::DOC_LIST);
+    document.documentList = {"one", "two"};
+    document.success = true;
+    auto decodedDocument = std::get<DocumentMessage>(Message::fromString(document.toString()));
+    EXPECT_EQ(decodedDocument.documentList, document.documentList);
+    EXPECT_EQ(decodedDocument.success, true);
+
+    PresenceMessage presence(MessageType::PRESENCE_CURSOR);
+    presence.username = "bob";
+    presence.cursorPosition = 0;
+    presence.userColor = "#ff0000";
+    auto decodedPresence = std::get<PresenceMessage>(Message::fromString(presence.toString()));
+    EXPECT_EQ(decodedPresence.cursorPosition, presence.cursorPosition);
+    EXPECT_EQ(decodedPresence.userColor, presence.userColor);
+    EXPECT_FALSE(decodedPresence.selectionStart.has_value());
+
+    Message heartbeat(MessageType::SYS_HEARTBEAT);
+    heartbeat.clientId = "client";
+    auto decodedHeartbeat = std::get<Message>(Message::fromString(heartbeat.toString()));
+    EXPECT_EQ(decodedHeartbeat.type, MessageType::SYS_HEARTBEAT);
+    EXPECT_EQ(decodedHeartbeat.clientId, "client");
+}
+
+TEST(ProtocolTest, WriteToAppendsThroughBaseReference) {
+    SyncMessage sync(MessageType::SYNC_RESPONSE);
+    sync.documentId = "doc";
+    sync.delta = std::string("\0\x01\xff", 3);
+    const Message& message = sync;
+
+    JsonWriter writer;
+    message.writeTo(writer);
+    EXPECT_EQ(writer.data(), sync.toString());
+
+    auto decoded = std::get<SyncMessage>(Message::fromString(writer.data()));
+    EXPECT_EQ(decoded.delta, sync.delta);
+    EXPECT_TRUE(decoded.operations.empty());
+}
+
+TEST(ProtocolTest, SyncAckCarriesFlowCredits) {
+    SyncMessage ack(MessageType::SYNC_ACK);
+    ack.documentId = "doc";
+    ack.toVersion = 42;
+    ack.creditFrames = 64;
+    ack.creditBytes = 1 << 20;
+
+    auto decoded = std::get<SyncMessage>(Message::fromString(ack.toString()));
+    EXPECT_EQ(decoded.toVersion, 42u);
+    EXPECT_EQ(decoded.creditFrames, 64u);
+    EXPECT_EQ(decoded.creditBytes, uint64_t{1} << 20);
+
+    SyncMessage plain(MessageType::SYNC_ACK);
+    plain.documentId = "doc";
+    EXPECT_EQ(plain.toString().find("credit"), std::string::npos);
+}
+
+TEST(ProtocolTest, BatchNestsMessagesAsObjects) {
+    EditMessage edit(MessageType::EDIT_APPLY);
+    edit.documentId = "doc";
+    edit.operationId = "op";
+    edit.text = "say \"hi\"";
+    PresenceMessage presence(MessageType::PRESENCE_CURSOR);
+    presence.documentId = "other";
+    presence.username = "bob";
+
+    BatchMessage batch(MessageType::BATCH);
+    batch.add(edit);
+    batch.add(BatchMessage::share(presence));
+    EXPECT_THROW(batch.add(AuthMessage(MessageType::AUTH_LOGIN)), std::invalid_argument);
+
+    const std::string json = batch.toString();
+    EXPECT_TRUE(nlohmann::json::parse(json)["messages"][0].is_object());
+    // Nested natively, so the element's quotes are escaped once, not twice
+    EXPECT_NE(json.find(R"(say \"hi\")"), std::string::npos);
+
+    auto decoded = std::get<BatchMessage>(Message::fromString(json));
+    ASSERT_EQ(decoded.size(), 2u);
+    const auto* decodedEdit = dynamic_cast<const EditMessage*>(decoded.messages[0].get());
+    ASSERT_NE(decodedEdit, nullptr);
+    EXPECT_EQ(decodedEdit->text, edit.text);
+    const auto* decodedPresence = dynamic_cast<const PresenceMessage*>(decoded.messages[1].get());
+    ASSERT_NE(decodedPresence, nullptr);
+    EXPECT_EQ(decodedPresence->documentId, "other");
+}
+
+TEST(ProtocolTest, FieldTablesNameTheJsonMembers) {
+    DocumentMessage doc(MessageType::DOC_RESPONSE);
+    doc.documentId = "doc";
+    doc.documentName = "notes";
+    doc.documentContent = "text";
+    doc.documentPath = "/notes";
+    doc.documentVersion = 3;
+    doc.success = true;
+    doc.errorMessage = "none";
+    doc.documentHandle = 7;
+    doc.contentOffset = 0;
+    doc.contentLength = 4;
+
+    // Every field the table lists is written, under the name it gives
+    const nlohmann::json j = nlohmann::json::parse(doc.toString());
+    size_t named = 0;
+    std::apply([&](const auto&... f) { ((named += j.contains(f.name) ? 1 : 0), ...); }, DocumentMessage::fields());
+    EXPECT_EQ(named, std::tuple_size_v<decltype(DocumentMessage::fields())>);
+
+    // Required fields must be present; optional ones may be left out
+    nlohmann::json partial = j;
+    partial.erase("documentHandle");
+    partial.erase("documentList");
+    auto decoded = Message::fromJson<DocumentMessage>(partial);
+    EXPECT_FALSE(decoded.documentHandle.has_value());
+    EXPECT_EQ(decoded.documentContent, doc.documentContent);
+    partial.erase("documentId");
+    EXPECT_THROW(Message::fromJson<DocumentMessage>(partial), nlohmann::json::exception);
+
+    partial = j;
+    partial["documentVersion"] = "three";
+    EXPECT_THROW(Message::fromJson<DocumentMessage>(partial), nlohmann::json::exception);
+}
+
+TEST(ProtocolTest, JsonMessageReaderReadsEachStruct) {
+    SyncMessage sync(MessageType::SYNC_RESPONSE);
+    sync.clientId = "client";
+    sync.sessionId = "session";
+    sync.sequenceNumber = 18446744073709551615u;
+    sync.documentId = "doc\n\"quoted\"";
+    sync.operations = {"[1]", "[\"a\"]"};
+    sync.stateVector = std::string("\0\xff\x01", 3);
+    sync.documentHandle = 4000000000u;
+    sync.creditBytes = 0;
+
+    JsonMessageReader& reader = JsonMessageReader::local();
+    ASSERT_EQ(reader.parse(sync.toString()), MessageType::SYNC_RESPONSE);
+    const auto decoded = reader.read<SyncMessage>();
+    EXPECT_EQ(decoded.toString(), sync.toString());
+    EXPECT_EQ(decoded.stateVector, sync.stateVector);
+
+    AuthMessage auth(MessageType::AUTH_SUCCESS);
+    auth.username = "ana";
+    auth.metadata = {{"wireFormat", "binary/1"}, {"k\u00e9y", ""}};
+    auth.sessionHandle = 9;
+    EXPECT_EQ(std::get<AuthMessage>(Message::fromString(auth.toString())).toString(), auth.toString());
+
+    // A batch's elements are read by their own types
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.documentId = "doc";
+    edit.operationId = "op";
+    edit.position = 3;
+    edit.text = "x";
+    BatchMessage batch(MessageType::BATCH);
+    batch.add(edit);
+    batch.add(Message(MessageType::SYS_HEARTBEAT));
+    const auto decodedBatch = std::get<BatchMessage>(Message::fromString(batch.toString()));
+    EXPECT_EQ(decodedBatch.toString(), batch.toString());
+    ASSERT_NE(dynamic_cast<const EditMessage*>(decodedBatch.messages[0].get()), nullptr);
+
+    // Reading into a message that exists, as the pooled path does
+    PresenceMessage presence(MessageType::PRESENCE_CURSOR);
+    presence.documentId = "doc";
+    presence.username = "ana";
+    presence.cursorPosition = 12;
+    PresenceMessage into(MessageType::PRESENCE_CURSOR);
+    reader.parse(presence.toString());
+    reader.read(into);
+    EXPECT_EQ(into.toString(), presence.toString());
+}
+
+TEST(ProtocolTest, JsonMessageReaderChecksTheText) {
+    // Members in any order, the type last, and unknown ones skipped
+    const std::string reordered =
+        R"({"documentVersion":2,"extra":{"nested":[1,{"a":null}]},"operationId":"op","documentId":"d",)"
+        R"("timestamp":5,"sequenceNumber":1,"sessionId":"s","clientId":"c","type":303})";
+    const auto edit = std::get<EditMessage>(Message::fromString(reordered));
+    EXPECT_EQ(edit.type, MessageType::EDIT_APPLY);
+    EXPECT_EQ(edit.documentVersion, 2u);
+    EXPECT_EQ(edit.clientId, "c");
+
+    const std::string missing = R"({"type":303,"clientId":"c","sessionId":"s","sequenceNumber":1,"timestamp":5,)"
+                                R"("operationId":"op","documentId":"d"})";
+    EXPECT_ANY_THROW(Message::fromString(missing));
+    EXPECT_ANY_THROW(Message::fromString(R"({"type":303,"clientId":"c"})"));
+    EXPECT_ANY_THROW(Message::fromString(reordered + "x"));
+    EXPECT_ANY_THROW(Message::fromString(R"({"type":"303"})"));
+    std::string mistyped = reordered;
+    mistyped.replace(mistyped.find("2,"), 1, "\"2\"");
+    EXPECT_ANY_THROW(Message::fromString(mistyped));
+
+    // Authentication messages cannot be batched
+    const std::string nestedAuth = R"({"type":600,"clientId":"c","sessionId":"s","sequenceNumber":1,"timestamp":5,)"
+                                   R"("messages":[{"type":100,"clientId":"c","sessionId":"s","sequenceNumber":1,)"
+                                   R"("timestamp":5,"username":"u"}]})";
+    EXPECT_THROW(Message::fromString(nestedAuth), std::invalid_argument);
+}
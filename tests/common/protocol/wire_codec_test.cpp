@@ -0,0 +1,351 @@
+#include <gtest/gtest.h>
+#include "common/protocol/wire_codec.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+using namespace collab::protocol;
+
+namespace {
+
+EditMessage makeEdit(uint64_t sequence) {
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.clientId = "4f1c2a9e-8b7d-4e3f-9a21-0c5d6e7f8a9b";
+    edit.sessionId = "b7e2d1c0-3f4a-4b5c-8d9e-1a2b3c4d5e6f";
+    edit.sequenceNumber = sequence;
+    edit.documentId = "9c8b7a6f-5e4d-4c3b-2a19-0f8e7d6c5b4a";
+    edit.documentVersion = 1000 + sequence;
+    edit.operationId = "op-" + std::to_string(sequence);
+    edit.position = 42;
+    edit.text = "a";
+    return edit;
+}
+
+// Run the AUTH_LOGIN / AUTH_SUCCESS exchange between two codecs
+void negotiate(WireCodec& client, WireCodec& server) {
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    auto received = std::get<AuthMessage>(server.decode(client.encode(login)));
+    EXPECT_EQ(received.username, "alice");
+
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    success.username = received.username;
+    client.decode(server.encode(success));
+}
+
+} // namespace
+
+TEST(WireCodecTest, NegotiatesBinaryDuringLogin) {
+    WireCodec client;
+    WireCodec server;
+    EXPECT_EQ(client.getFormat(), WireFormat::JSON);
+
+    negotiate(client, server);
+    EXPECT_EQ(client.getFormat(), WireFormat::BINARY);
+    EXPECT_EQ(server.getFormat(), WireFormat::BINARY);
+
+    EditMessage edit = makeEdit(1);
+    std::string frame = client.encode(edit);
+    EXPECT_TRUE(WireCodec::is_binary_frame(frame));
+    auto decoded = std::get<EditMessage>(server.decode(frame));
+    EXPECT_EQ(decoded.clientId, edit.clientId);
+    EXPECT_EQ(decoded.sessionId, edit.sessionId);
+    EXPECT_EQ(decoded.sequenceNumber, 1u);
+    EXPECT_EQ(decoded.timestamp, edit.timestamp);
+    EXPECT_EQ(decoded.documentId, edit.documentId);
+    EXPECT_EQ(decoded.documentVersion, 1001u);
+    EXPECT_EQ(decoded.operationId, "op-1");
+    EXPECT_EQ(decoded.position, edit.position);
+    EXPECT_FALSE(decoded.length.has_value());
+    EXPECT_EQ(decoded.text, edit.text);
+
+    // JSON frames still decode after the switch
+    auto fromJson = std::get<EditMessage>(server.decode(makeEdit(2).toString()));
+    EXPECT_EQ(fromJson.operationId, "op-2");
+}
+
+TEST(WireCodecTest, NegotiatesAgainWhenAClientResumes) {
+    WireCodec client;
+    WireCodec server;
+    AuthMessage resume(MessageType::AUTH_RESUME);
+    resume.token = "0123456789abcdef0123456789abcdef";
+    auto received = std::get<AuthMessage>(server.decode(client.encode(resume)));
+    EXPECT_EQ(received.type, MessageType::AUTH_RESUME);
+    EXPECT_EQ(received.token, resume.token);
+
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    client.decode(server.encode(success));
+    EXPECT_EQ(client.getFormat(), WireFormat::BINARY);
+    EXPECT_EQ(server.getFormat(), WireFormat::BINARY);
+    EXPECT_THROW(client.encodeUncompressed(resume), std::invalid_argument);
+}
+
+TEST(WireCodecTest, JsonPreferenceKeepsBothSidesOnJson) {
+    WireCodec client(WireFormat::JSON);
+    WireCodec server;
+    negotiate(client, server);
+    EXPECT_EQ(client.getFormat(), WireFormat::JSON);
+    EXPECT_EQ(server.getFormat(), WireFormat::JSON);
+
+    WireCodec binaryClient;
+    WireCodec jsonServer(WireFormat::JSON);
+    negotiate(binaryClient, jsonServer);
+    EXPECT_EQ(binaryClient.getFormat(), WireFormat::JSON);
+    EXPECT_EQ(jsonServer.encode(makeEdit(1)), makeEdit(1).toString());
+}
+
+TEST(WireCodecTest, RepeatedEditFramesAreMuchSmallerThanJson) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    // The first frame defines the connection's IDs, later ones refer to them
+    server.decode(client.encode(makeEdit(1)));
+    EditMessage edit = makeEdit(2);
+    std::string frame = client.encode(edit);
+    EXPECT_LT(frame.size() * 5, edit.toString().size());
+    EXPECT_EQ(std::get<EditMessage>(server.decode(frame)).operationId, "op-2");
+}
+
+TEST(WireCodecTest, BinaryRoundTripsEveryMessageKind) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    SyncMessage sync(MessageType::SYNC_RESPONSE);
+    sync.documentId = "doc";
+    sync.operations = {"a", "b"};
+    sync.delta = std::string("\0\n\xff", 3);
+    sync.success = false;
+    auto decodedSync = std::get<SyncMessage>(server.decode(client.encode(sync)));
+    EXPECT_EQ(decodedSync.operations, sync.operations);
+    EXPECT_EQ(decodedSync.delta, sync.delta);
+    EXPECT_EQ(decodedSync.success, false);
+    EXPECT_FALSE(decodedSync.stateVector.has_value());
+
+    DocumentMessage document(MessageType::DOC_RESPONSE);
+    document.documentId = "doc";
+    document.documentList = {"one"};
+    document.metadata["owner"] = "alice";
+    document.documentVersion = 7;
+    auto decodedDocument = std::get<DocumentMessage>(server.decode(client.encode(document)));
+    EXPECT_EQ(decodedDocument.documentList, document.documentList);
+    EXPECT_EQ(decodedDocument.metadata, document.metadata);
+    EXPECT_EQ(decodedDocument.documentVersion, 7u);
+
+    PresenceMessage presence(MessageType::PRESENCE_SELECTION);
+    presence.documentId = "doc";
+    presence.username = "alice";
+    presence.selectionStart = 3;
+    presence.selectionEnd = 9;
+    auto decodedPresence = std::get<PresenceMessage>(server.decode(client.encode(presence)));
+    EXPECT_EQ(decodedPresence.username, "alice");
+    EXPECT_EQ(decodedPresence.selectionEnd, presence.selectionEnd);
+    EXPECT_FALSE(decodedPresence.cursorPosition.has_value());
+
+    Message heartbeat(MessageType::SYS_HEARTBEAT);
+    heartbeat.sequenceNumber = 99;
+    EXPECT_EQ(std::get<Message>(server.decode(client.encode(heartbeat))).sequenceNumber, 99u);
+
+    Message mislabeled(MessageType::EDIT_INSERT);
+    EXPECT_THROW(client.encode(mislabeled), std::invalid_argument);
+}
+
+TEST(WireCodecTest, MalformedFrameDoesNotDesyncStringTable) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    std::string first = client.encode(makeEdit(1));
+    for (size_t length = 1; length < first.size(); ++length) {
+        EXPECT_THROW(server.decode(first.substr(0, length)), std::runtime_error);
+    }
+    EXPECT_THROW(server.decode(first + '\0'), std::runtime_error);
+
+    // The IDs in the first frame are defined once the complete frame arrives
+    EXPECT_EQ(std::get<EditMessage>(server.decode(first)).operationId, "op-1");
+    EXPECT_EQ(std::get<EditMessage>(server.decode(client.encode(makeEdit(2)))).clientId,
+              makeEdit(2).clientId);
+}
+
+TEST(WireCodecTest, RejectsBinaryEditsWithMalformedUtf8) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    // Define the IDs first; the rejected frame then only refers to them
+    server.decode(client.encode(makeEdit(1)));
+    EditMessage edit = makeEdit(1);
+    edit.text = "caf\xc3\x28";
+    EXPECT_THROW(server.decode(client.encode(edit)), std::runtime_error);
+
+    edit.text = "caf\xc3\xa9";
+    EXPECT_EQ(std::get<EditMessage>(server.decode(client.encode(edit))).text, "caf\xc3\xa9");
+}
+
+TEST(WireCodecTest, VisitPassesViewsForJsonAndBinaryFrames) {
+    WireCodec client;
+    WireCodec server;
+    PresenceMessage presence(MessageType::PRESENCE_CURSOR);
+    presence.documentId = "doc";
+    presence.username = "bob";
+    presence.cursorPosition = 5;
+    presence.metadata["color"] = "red";
+
+    int views = 0;
+    auto check = [&](const auto& message) {
+        using T = std::decay_t<decltype(message)>;
+        if constexpr (std::is_same_v<T, PresenceMessageView>) {
+            ++views;
+            EXPECT_EQ(message.username, "bob");
+            EXPECT_EQ(message.cursorPosition, presence.cursorPosition);
+            EXPECT_EQ(message.metadata.find("color"), std::optional<std::string_view>("red"));
+            EXPECT_FALSE(message.metadata.find("missing").has_value());
+            EXPECT_EQ(message.toMessage().metadata, presence.metadata);
+        }
+    };
+
+    server.visit(client.encode(presence), check);
+    negotiate(client, server);
+    server.visit(client.encode(presence), check);
+    EXPECT_EQ(views, 2);
+}
+
+TEST(WireCodecTest, BatchesRoundTripAndUnpackInOrder) {
+    WireCodec client;
+    WireCodec server;
+
+    PresenceMessage presence(MessageType::PRESENCE_CURSOR);
+    presence.documentId = "doc";
+    presence.username = "bob";
+    presence.cursorPosition = 7;
+    SyncMessage ack(MessageType::SYNC_ACK);
+    ack.documentId = "other";
+    ack.toVersion = 12;
+
+    BatchMessage batch(MessageType::BATCH);
+    batch.add(makeEdit(1));
+    batch.add(presence);
+    batch.add(makeEdit(2));
+    batch.add(ack);
+
+    for (int round = 0; round < 2; ++round) {
+        const std::string frame = server.encode(batch);
+        EXPECT_EQ(WireCodec::is_binary_frame(frame), round == 1);
+
+        std::vector<std::string> seen;
+        client.visit(frame, [&](const auto& message) {
+            using T = std::decay_t<decltype(message)>;
+            if constexpr (std::is_same_v<T, EditMessageView>) {
+                seen.push_back("edit " + std::string(message.operationId));
+            } else if constexpr (std::is_same_v<T, PresenceMessageView>) {
+                seen.push_back("presence " + std::to_string(*message.cursorPosition));
+            } else if constexpr (std::is_same_v<T, SyncMessage>) {
+                seen.push_back("ack " + message.documentId);
+            } else {
+                seen.push_back("other");
+            }
+        });
+        EXPECT_EQ(seen, (std::vector<std::string>{"edit op-1", "presence 7", "edit op-2", "ack other"}));
+
+        auto decoded = std::get<BatchMessage>(client.decode(server.encode(batch)));
+        ASSERT_EQ(decoded.size(), 4u);
+        const auto* edit = dynamic_cast<const EditMessage*>(decoded.messages[2].get());
+        ASSERT_NE(edit, nullptr);
+        EXPECT_EQ(edit->documentId, makeEdit(2).documentId);
+        EXPECT_EQ(edit->text, "a");
+
+        if (round == 0) {
+            negotiate(client, server);
+        }
+    }
+}
+
+TEST(WireCodecTest, RejectsNestedBatches) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    BatchMessage inner(MessageType::BATCH);
+    inner.add(makeEdit(1));
+    BatchMessage outer(MessageType::BATCH);
+    outer.messages.push_back(std::make_shared<const BatchMessage>(inner));
+    EXPECT_THROW(server.encode(outer), std::invalid_argument);
+}
+
+TEST(WireCodecTest, CompressesOnlyLargeFramesOnceNegotiated) {
+    DocumentMessage open(MessageType::DOC_RESPONSE);
+    open.documentId = "doc";
+    std::string content;
+    for (int line = 0; line < 200; ++line) {
+        content += "line " + std::to_string(line) + " of a document that repeats itself\n";
+    }
+    open.documentContent = content;
+
+    for (WireFormat format : {WireFormat::JSON, WireFormat::BINARY}) {
+        WireCodec client(format);
+        WireCodec server(format);
+        const size_t uncompressed = server.encode(open).size();
+        client.decode(server.encode(open));
+
+        negotiate(client, server);
+        EXPECT_TRUE(client.compressing());
+        EXPECT_TRUE(server.compressing());
+
+        const std::string frame = server.encode(open);
+        EXPECT_TRUE(WireCodec::is_binary_frame(frame));
+        EXPECT_EQ(static_cast<uint8_t>(frame[0]), COMPRESSED_FRAME_MARKER);
+        EXPECT_LT(frame.size() * 5, uncompressed);
+        EXPECT_EQ(std::get<DocumentMessage>(client.decode(frame)).documentContent, open.documentContent);
+
+        // Small frames are sent as they are
+        const std::string edit = server.encode(makeEdit(1));
+        EXPECT_NE(static_cast<uint8_t>(edit[0]), COMPRESSED_FRAME_MARKER);
+        EXPECT_EQ(std::get<EditMessage>(client.decode(edit)).operationId, "op-1");
+    }
+}
+
+TEST(WireCodecTest, CompressionNeedsBothSidesAndRejectsCorruptFrames) {
+    WireCodec client;
+    WireCodec server;
+    server.setCompression(false);
+    negotiate(client, server);
+    EXPECT_FALSE(client.compressing());
+    EXPECT_FALSE(server.compressing());
+
+    std::string corrupt(1, static_cast<char>(COMPRESSED_FRAME_MARKER));
+    corrupt += '\x10';
+    corrupt += "not deflate";
+    EXPECT_THROW(client.decode(corrupt), std::runtime_error);
+}
+
+TEST(WireCodecTest, DocumentHandlesStandInForIds) {
+    WireCodec client;
+    WireCodec server;
+    negotiate(client, server);
+
+    DocumentMessage opened(MessageType::DOC_RESPONSE);
+    opened.documentId = "9c8b7a6f-5e4d-4c3b-2a19-0f8e7d6c5b4a";
+    opened.documentHandle = 0x01000003;
+    EXPECT_EQ(std::get<DocumentMessage>(client.decode(server.encode(opened))).documentHandle, opened.documentHandle);
+
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.documentHandle = opened.documentHandle;
+    edit.operationId = "op";
+    edit.position = 1;
+    edit.text = "x";
+    int views = 0;
+    server.visit(client.encode(edit), [&](const auto& message) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(message)>, EditMessageView>) {
+            ++views;
+            EXPECT_TRUE(message.documentId.empty());
+            EXPECT_EQ(message.documentHandle, opened.documentHandle);
+        }
+    });
+    EXPECT_EQ(views, 1);
+
+    auto json = std::get<EditMessage>(Message::fromString(edit.toString()));
+    EXPECT_EQ(json.documentHandle, edit.documentHandle);
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include "common/simulation/convergence_simulator.h"
+
+using namespace collab;
+using namespace collab::simulation;
+
+namespace {
+
+// A small run with every fault the network has, often enough to hit several times
+SimulationOptions faultyOptions() {
+    SimulationOptions options;
+    options.sites = 5;
+    options.duration = std::chrono::seconds(30);
+    options.editsPerSecond = 4;
+    options.documentSize = 256;
+    options.network.disconnectsPerMinute = 4;
+    options.network.offlineTime = std::chrono::seconds(2);
+    options.network.partitionsPerMinute = 3;
+    options.network.partitionTime = std::chrono::seconds(3);
+    return options;
+}
+
+} // namespace
+
+TEST(NetworkSimulatorTest, KeepsLinkOrderAndDropsWhatABreakCatches) {
+    EventQueue events;
+    NetworkOptions options;
+    options.latency = std::chrono::milliseconds(10);
+    options.jitter = std::chrono::milliseconds(50);
+    SimulatedNetwork network(events, 3, options, 7);
+
+    std::vector<int> fromOne;
+    std::vector<int> arrivals;
+    for (int i = 0; i < 50; ++i) {
+        network.send(1, 0, [&, i] { fromOne.push_back(i); arrivals.push_back(1); });
+        network.send(2, 0, [&] { arrivals.push_back(2); });
+    }
+    while (events.step()) {
+    }
+    ASSERT_EQ(fromOne.size(), 50);
+    EXPECT_TRUE(std::is_sorted(fromOne.begin(), fromOne.end()));
+    // The two links interleave as the jitter has it, not strictly in turn
+    std::vector<int> alternating;
+    for (int i = 0; i < 50; ++i) {
+        alternating.insert(alternating.end(), {1, 2});
+    }
+    EXPECT_NE(arrivals, alternating);
+
+    // A site that goes offline loses what was in flight to it, and is reported back
+    options.disconnectsPerMinute = 600;
+    options.offlineTime = std::chrono::seconds(1);
+    SimulatedNetwork faulty(events, 2, options, 7);
+    std::vector<bool> changes;
+    faulty.setLinkCallback([&](size_t, size_t, bool up) { changes.push_back(up); });
+    faulty.startFaults(events.now() + std::chrono::seconds(10), 1);
+    while (faulty.stats().disconnects == 0 && events.step()) {
+        faulty.send(0, 1, [] {});
+    }
+    ASSERT_EQ(faulty.stats().disconnects, 1);
+    EXPECT_FALSE(faulty.connected(0, 1));
+    EXPECT_FALSE(faulty.send(0, 1, [] {}));
+    faulty.heal();
+    EXPECT_TRUE(faulty.connected(0, 1));
+    EXPECT_EQ(changes, (std::vector<bool>{false, true}));
+    while (events.step()) {
+    }
+    EXPECT_GT(faulty.stats().dropped, 1);
+    EXPECT_EQ(faulty.stats().dataInFlight, 0);
+    EXPECT_EQ(faulty.stats().delivered + faulty.stats().dropped, faulty.stats().sent);
+}
+
+TEST(ConvergenceSimulatorTest, OtConvergesThroughDisconnectsAndPartitions) {
+    SimulationOptions options = faultyOptions();
+    const SimulationReport report = OtSimulation(options).run();
+
+    EXPECT_TRUE(report.converged) << report.divergence;
+    EXPECT_GT(report.edits, 300);
+    EXPECT_GT(report.undos, 0);
+    EXPECT_GT(report.network.disconnects, 0);
+    EXPECT_GT(report.network.partitions, 0);
+    EXPECT_GT(report.network.dropped, 0);
+    EXPECT_GT(report.transforms, 0);
+    // Edits made during a round trip go out together
+    EXPECT_LT(report.operationsSent, report.edits);
+    // Acknowledgements let the server drop its history once everyone caught up
+    EXPECT_GT(report.peakRetained, 0);
+    EXPECT_LT(report.finalRetained, report.peakRetained);
+    EXPECT_FALSE(report.samples.empty());
+}
+
+TEST(ConvergenceSimulatorTest, OtConvergesForEverySeed) {
+    // Which edits meet, and how far behind each one is, comes down to the seed
+    for (bool faults : {false, true}) {
+        for (uint32_t seed = 1; seed <= 100; ++seed) {
+            SimulationOptions options = faultyOptions();
+            if (!faults) {
+                options.network = NetworkOptions{};
+            }
+            options.seed = seed;
+            const SimulationReport report = OtSimulation(options).run();
+
+            EXPECT_TRUE(report.converged) << "seed " << seed << (faults ? " with faults: " : ": ")
+                                          << report.divergence;
+            EXPECT_GT(report.transforms, 0) << "seed " << seed;
+        }
+    }
+}
+
+TEST(ConvergenceSimulatorTest, CrdtConvergesAndCollectsTombstonesForEveryStrategy) {
+    for (auto strategy : {crdt::PositionStrategy::LOGOOT, crdt::PositionStrategy::WOOT,
+                          crdt::PositionStrategy::LSEQ}) {
+        SimulationOptions options = faultyOptions();
+        options.strategy = strategy;
+        const SimulationReport report = CrdtSimulation(options).run();
+
+        SCOPED_TRACE(report.model);
+        EXPECT_TRUE(report.converged) << report.divergence;
+        EXPECT_GT(report.network.disconnects, 0);
+        EXPECT_GT(report.resyncs, 0);
+        EXPECT_GT(report.peakRetained, 0);
+        EXPECT_EQ(report.finalRetained, 0);
+        EXPECT_GT(report.averageDepth, 0);
+    }
+}
+
+TEST(ConvergenceSimulatorTest, SameSeedReplaysTheSameRun) {
+    SimulationOptions options = faultyOptions();
+    options.duration = std::chrono::seconds(10);
+    for (bool crdt : {false, true}) {
+        const auto run = [&] { return crdt ? CrdtSimulation(options).run() : OtSimulation(options).run(); };
+        const SimulationReport first = run();
+        const SimulationReport second = run();
+        SCOPED_TRACE(first.model);
+        EXPECT_EQ(first.edits, second.edits);
+        EXPECT_EQ(first.network.sent, second.network.sent);
+        EXPECT_EQ(first.network.dropped, second.network.dropped);
+        EXPECT_EQ(first.documentLength, second.documentLength);
+        EXPECT_EQ(first.peakRetained, second.peakRetained);
+        EXPECT_EQ(first.simulatedSeconds, second.simulatedSeconds);
+    }
+}
+
+TEST(ConvergenceSimulatorTest, ParsesOptions) {
+    const auto options = SimulationOptions::parse(
+        {"--sites=12", "--seconds=2.5", "--latency=5", "--partition-rate=1.5", "--strategy=lseq", "plain"});
+    EXPECT_EQ(options.sites, 12);
+    EXPECT_EQ(options.duration, std::chrono::milliseconds(2500));
+    EXPECT_EQ(options.network.latency, std::chrono::milliseconds(5));
+    EXPECT_EQ(options.network.partitionsPerMinute, 1.5);
+    EXPECT_EQ(options.strategy, crdt::PositionStrategy::LSEQ);
+
+    EXPECT_THROW(SimulationOptions::parse({"--sites=0"}), std::invalid_argument);
+    EXPECT_THROW(SimulationOptions::parse({"--strategy=rga"}), std::invalid_argument);
+    EXPECT_THROW(SimulationOptions::parse({"--delete-ratio=2"}), std::invalid_argument);
+}
@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "common/util/buffer_pool.h"
+
+using namespace collab::util;
+
+TEST(BufferPoolTest, RoundsUpToSizeClasses) {
+    EXPECT_EQ(BufferPool::classSize(1), BufferPool::MIN_CLASS_SIZE);
+    EXPECT_EQ(BufferPool::classSize(512), 512u);
+    EXPECT_EQ(BufferPool::classSize(513), 1024u);
+    EXPECT_EQ(BufferPool::classSize(8192), 8192u);
+    EXPECT_EQ(BufferPool::classSize(BufferPool::MAX_CLASS_SIZE), BufferPool::MAX_CLASS_SIZE);
+    EXPECT_EQ(BufferPool::classSize(BufferPool::MAX_CLASS_SIZE + 1), BufferPool::MAX_CLASS_SIZE + 1);
+}
+
+TEST(BufferPoolTest, ReusesReturnedBuffers) {
+    BufferPool pool(1);
+    char* first;
+    {
+        BufferPool::Buffer buffer = pool.acquire(6000);
+        ASSERT_TRUE(buffer);
+        EXPECT_EQ(buffer.size(), 8192u);
+        first = buffer.data();
+    }
+    EXPECT_EQ(pool.getStats().freeBytes, 8192u);
+
+    BufferPool::Buffer again = pool.acquire(8000);
+    EXPECT_EQ(again.data(), first);
+    BufferPool::Buffer other = pool.acquire(8000);
+    EXPECT_NE(other.data(), first);
+    EXPECT_EQ(pool.getStats().allocated, 2u);
+    EXPECT_EQ(pool.getStats().reused, 1u);
+
+    // Only one free buffer is kept per class
+    again.reset();
+    other.reset();
+    EXPECT_EQ(pool.getStats().freeBytes, 8192u);
+}
+
+TEST(BufferPoolTest, BacksStandardContainers) {
+    BufferPool pool;
+    {
+        std::vector<char, PoolAllocator<char>> bytes{PoolAllocator<char>(pool)};
+        bytes.assign(3000, 'x');
+        EXPECT_EQ(bytes.size(), 3000u);
+    }
+    EXPECT_EQ(pool.getStats().freeBytes, 4096u);
+    {
+        std::vector<char, PoolAllocator<char>> bytes{PoolAllocator<char>(pool)};
+        bytes.assign(3000, 'y');
+    }
+    EXPECT_EQ(pool.getStats().reused, 1u);
+}
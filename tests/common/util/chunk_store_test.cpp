@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "common/util/chunk_store.h"
+#include <random>
+#include <string>
+
+using namespace collab::util;
+
+namespace {
+
+// Text-like bytes from a fixed seed
+std::string generatedText(size_t size, uint32_t seed) {
+    static const char words[][8] = {"the ", "edit ", "merge ", "line\n", "of ", "text ", "cursor ", "doc "};
+    std::mt19937 rng(seed);
+    std::string text;
+    while (text.size() < size) {
+        text += words[rng() % 8];
+    }
+    text.resize(size);
+    return text;
+}
+
+} // namespace
+
+TEST(ChunkStoreTest, RoundTripsAndCutsWithinBounds) {
+    ChunkStore store;
+    const std::string text = generatedText(500 * 1024, 1);
+    auto manifest = store.put(text);
+    EXPECT_EQ(store.get(manifest), text);
+    EXPECT_GT(manifest.size(), 20u);
+    for (size_t i = 0; i + 1 < manifest.size(); ++i) {
+        EXPECT_GE(manifest[i].length, 2u * 1024);
+        EXPECT_LE(manifest[i].length, 64u * 1024);
+    }
+
+    EXPECT_TRUE(store.get(store.put("")).empty());
+    EXPECT_EQ(store.get(store.put("short")), "short");
+}
+
+TEST(ChunkStoreTest, VersionsShareTheChunksAnEditDidNotTouch) {
+    ChunkStore store;
+    const std::string original = generatedText(1024 * 1024, 2);
+    auto first = store.put(original);
+    const size_t stored = store.getStats().storedBytes;
+
+    // Insert in the middle: only the chunks around the edit are new
+    std::string edited = original;
+    edited.insert(original.size() / 2, "a freshly typed sentence\n");
+    auto second = store.put(edited);
+    EXPECT_EQ(store.get(second), edited);
+    EXPECT_LT(store.getStats().storedBytes - stored, 3u * 64 * 1024);
+    EXPECT_GT(store.getStats().dedupedBytes, original.size() * 9 / 10);
+
+    // A copy of the document shares everything
+    const size_t beforeCopy = store.getStats().storedBytes;
+    store.put(original);
+    EXPECT_EQ(store.getStats().storedBytes, beforeCopy);
+    EXPECT_EQ(store.getStats().chunks, [&] {
+        ChunkStore fresh;
+        fresh.put(original);
+        fresh.put(edited);
+        return fresh.getStats().chunks;
+    }());
+}
+
+TEST(ChunkStoreTest, ReleaseFreesChunksNoVersionUses) {
+    ChunkStore store;
+    const std::string original = generatedText(256 * 1024, 3);
+    std::string edited = original;
+    edited.replace(1000, 10, "0123456789");
+
+    auto first = store.put(original);
+    auto second = store.put(edited);
+    store.release(first);
+    EXPECT_EQ(store.get(second), edited);
+    const auto stats = store.getStats();
+    EXPECT_EQ(stats.references, second.size());
+    EXPECT_THROW(store.get(first), std::out_of_range);
+
+    store.release(second);
+    EXPECT_EQ(store.getStats().chunks, 0u);
+    EXPECT_EQ(store.getStats().storedBytes, 0u);
+    EXPECT_THROW(ChunkStore(ChunkStore::Params{1024, 3000, 8192}), std::invalid_argument);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "common/util/chunked_io.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace collab::util;
+
+namespace {
+
+std::filesystem::path ioPath(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+std::string readWhole(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+} // namespace
+
+TEST(ChunkedIoTest, WritesAndReadsAFileInBoundedChunks) {
+    auto path = ioPath("collabedit_chunked_io.txt");
+    std::string expected;
+    {
+        ChunkedFileWriter writer(path);
+        for (int i = 0; i < 1000; ++i) {
+            const std::string line = "line " + std::to_string(i) + "\n";
+            writer.write(line);
+            expected += line;
+        }
+        EXPECT_EQ(writer.written(), expected.size());
+        EXPECT_FALSE(std::filesystem::exists(path));
+        writer.commit();
+        EXPECT_THROW(writer.write("late"), std::runtime_error);
+    }
+    EXPECT_EQ(readWhole(path), expected);
+
+    ChunkedFileReader reader(path);
+    EXPECT_EQ(reader.size(), expected.size());
+    std::string read;
+    size_t largest = 0;
+    uint64_t reported = 0;
+    const uint64_t total = reader.readAll(
+        [&](std::string_view chunk) {
+            read.append(chunk);
+            largest = std::max(largest, chunk.size());
+        },
+        [&](uint64_t done, uint64_t size) {
+            EXPECT_EQ(size, expected.size());
+            reported = done;
+        },
+        1000);
+    EXPECT_EQ(total, expected.size());
+    EXPECT_EQ(reported, expected.size());
+    EXPECT_EQ(read, expected);
+    EXPECT_LE(largest, 1000u);
+    EXPECT_THROW(ChunkedFileReader(ioPath("collabedit_chunked_io_missing.txt")), std::runtime_error);
+}
+
+TEST(ChunkedIoTest, AnUncommittedWriteLeavesTheTargetAlone) {
+    auto path = ioPath("collabedit_chunked_io_keep.txt");
+    {
+        std::ofstream(path) << "original";
+    }
+    {
+        ChunkedFileWriter writer(path);
+        writer.write("half written");
+    }
+    EXPECT_EQ(readWhole(path), "original");
+    EXPECT_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+
+    // Any source can be pumped, e.g. a socket's read_some
+    std::string input(5000, 'z');
+    size_t offset = 0;
+    std::string output;
+    const uint64_t moved = pumpChunks(
+        [&](char* buffer, size_t capacity) {
+            const size_t take = std::min({capacity, size_t{700}, input.size() - offset});
+            input.copy(buffer, take, offset);
+            offset += take;
+            return take;
+        },
+        [&](std::string_view chunk) { output.append(chunk); }, {}, 0, 512);
+    EXPECT_EQ(moved, input.size());
+    EXPECT_EQ(output, input);
+}
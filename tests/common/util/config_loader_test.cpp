@@ -2,6 +2,8 @@
 #include <gtest/gtest.h>
 #include <fstream>
 #include <filesystem>
+#include <atomic>
+#include <thread>
 
 namespace {
 
@@ -117,4 +119,120 @@ TEST_F(ConfigLoaderTest, EditorModeConversion) {
     EXPECT_EQ(editorModeFromString(editorModeToString(EditorMode::CODE)), EditorMode::CODE);
 }
 
+TEST_F(ConfigLoaderTest, TypedHandlesFollowChanges) {
+    auto port = config.handle<uint16_t>("SERVER_PORT", 1);
+    auto window = config.handle<std::chrono::milliseconds>("FLUSH_WINDOW_MS", std::chrono::milliseconds(5));
+    auto poolSize = config.handle<uint32_t>("POOL_SIZE", 4);
+    auto compress = config.handle<bool>("COMPRESS", false);
+    auto mode = config.handle<EditorMode>("EDITOR_MODE", EditorMode::RICH_TEXT);
+    
+    // Values present from the start, defaults for the rest
+    EXPECT_EQ(port.get(), 8080);
+    EXPECT_EQ(*window, std::chrono::milliseconds(5));
+    EXPECT_EQ(mode.get(), EditorMode::TEXT);
+    
+    config.setValue("FLUSH_WINDOW_MS", "20");
+    config.setValue("POOL_SIZE", "-3");  // Not a uint32_t
+    config.setValue("COMPRESS", "On");
+    EXPECT_EQ(*window, std::chrono::milliseconds(20));
+    EXPECT_EQ(*poolSize, 4u);
+    EXPECT_TRUE(*compress);
+    
+    ASSERT_TRUE(config.loadFromFile(configPath));
+    EXPECT_EQ(port.get(), 9090);
+    EXPECT_EQ(mode.get(), EditorMode::CODE);
+    EXPECT_EQ(port.key(), "SERVER_PORT");
+    
+    EXPECT_EQ(parseConfigValue<int>("12x"), std::nullopt);
+    EXPECT_EQ(parseConfigValue<double>("0.25"), 0.25);
+    EXPECT_EQ(parseConfigValue<bool>("maybe"), std::nullopt);
+}
+
+TEST_F(ConfigLoaderTest, SnapshotsAreImmutable) {
+    auto before = config.snapshot();
+    config.setValue("CUSTOM_SETTING", "changed");
+    auto after = config.snapshot();
+    
+    EXPECT_EQ(before->find("CUSTOM_SETTING"), nullptr);
+    ASSERT_NE(after->find("CUSTOM_SETTING"), nullptr);
+    EXPECT_EQ(*after->find("CUSTOM_SETTING"), "changed");
+    EXPECT_GT(after->version(), before->version());
+}
+
+TEST_F(ConfigLoaderTest, ReloadsTheFileWhenItChanges) {
+    EXPECT_FALSE(config.reload());
+    ASSERT_TRUE(config.loadFromFile(configPath));
+    auto interval = config.handle<std::chrono::seconds>("AUTOSAVE_INTERVAL_SECONDS", std::chrono::seconds(1));
+    config.setValue("ONLY_SET", "x");
+    EXPECT_FALSE(config.reloadIfChanged());
+    EXPECT_EQ(config.getValue("ONLY_SET"), "x");
+    
+    auto rewrite = [this](const std::string& interval) {
+        const auto modified = std::filesystem::last_write_time(configPath);
+        std::ofstream configFile(configPath);
+        configFile << "AUTOSAVE_INTERVAL_SECONDS=" << interval << "\n";
+        configFile.close();
+        // Filesystems with coarse timestamps would not see the change otherwise
+        std::filesystem::last_write_time(configPath, modified + std::chrono::seconds(1));
+    };
+    
+    rewrite("90");
+    ASSERT_TRUE(config.reloadIfChanged());
+    EXPECT_EQ(*interval, std::chrono::seconds(90));
+    // A reload starts from the defaults and the file
+    EXPECT_EQ(config.getValue("ONLY_SET"), std::nullopt);
+    EXPECT_EQ(config.getServerPort(), 8080);
+    
+    config.startWatching(std::chrono::milliseconds(5));
+    rewrite("15");
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (*interval != std::chrono::seconds(15) && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    config.stopWatching();
+    EXPECT_EQ(*interval, std::chrono::seconds(15));
+}
+
+TEST_F(ConfigLoaderTest, ReadsWhileAnotherThreadWrites) {
+    auto counter = config.handle<int>("COUNTER", 0);
+    std::atomic<bool> done{false};
+    std::thread reader([&] {
+        int last = 0;
+        while (!done.load()) {
+            // Values only move forward, and a whole snapshot stays consistent
+            const int value = counter.get();
+            EXPECT_GE(value, last);
+            last = value;
+            auto snapshot = config.snapshot();
+            if (const std::string* text = snapshot->find("COUNTER")) {
+                EXPECT_FALSE(text->empty());
+            }
+        }
+    });
+    for (int i = 1; i <= 500; ++i) {
+        config.setValue("COUNTER", std::to_string(i));
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(counter.get(), 500);
+}
+
+TEST_F(ConfigLoaderTest, ReadsLowLatencySettings) {
+    LowLatencySettings defaults = config.getLowLatency();
+    EXPECT_FALSE(defaults.enabled);
+    EXPECT_TRUE(defaults.shardCpus.empty());
+
+    config.setValue("LOW_LATENCY_MODE", "on");
+    config.setValue("LOW_LATENCY_SPIN_POLLS", "5000");
+    config.setValue("LOW_LATENCY_PARK_MICROSECONDS", "250");
+    config.setValue("LOW_LATENCY_SOCKET_BUSY_POLL_MICROSECONDS", "not a number");
+    config.setValue("LOW_LATENCY_SHARD_CPUS", "2-3,6");
+    LowLatencySettings settings = config.getLowLatency();
+    EXPECT_TRUE(settings.enabled);
+    EXPECT_EQ(settings.spinPolls, 5000u);
+    EXPECT_EQ(settings.park, std::chrono::microseconds(250));
+    EXPECT_EQ(settings.socketBusyPoll, defaults.socketBusyPoll);
+    EXPECT_EQ(settings.shardCpus, (std::vector<unsigned>{2, 3, 6}));
+}
+
 } // namespace
\ No newline at end of file
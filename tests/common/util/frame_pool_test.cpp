@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include "common/util/frame_pool.h"
+
+using namespace collab::util;
+
+namespace {
+
+// Each thread has a pool of its own, so a fresh one starts empty
+template <typename Fn>
+void onFreshThread(Fn fn) {
+    std::thread(fn).join();
+}
+
+} // namespace
+
+TEST(FramePoolTest, ReusesReleasedFrames) {
+    onFreshThread([] {
+        std::string frame = FramePool::acquire();
+        EXPECT_TRUE(frame.empty());
+        frame.assign(4000, 'x');
+        const char* data = frame.data();
+        FramePool::release(std::move(frame));
+        EXPECT_EQ(FramePool::stats().free, 1u);
+
+        std::string again = FramePool::acquire();
+        EXPECT_TRUE(again.empty());
+        EXPECT_EQ(again.data(), data);
+        EXPECT_GE(again.capacity(), 4000u);
+
+        const FramePool::Stats stats = FramePool::stats();
+        EXPECT_EQ(stats.allocated, 1u);
+        EXPECT_EQ(stats.reused, 1u);
+        EXPECT_EQ(stats.free, 0u);
+    });
+}
+
+TEST(FramePoolTest, DropsLargeFramesAndKeepsAtMostMaxFree) {
+    onFreshThread([] {
+        FramePool::release(std::string(FramePool::MAX_KEPT_CAPACITY + 1, 'x'));
+        EXPECT_EQ(FramePool::stats().free, 0u);
+
+        for (size_t i = 0; i < FramePool::MAX_FREE + 5; ++i) {
+            FramePool::release(std::string(1000, 'x'));
+        }
+        EXPECT_EQ(FramePool::stats().free, FramePool::MAX_FREE);
+    });
+}
+
+TEST(FramePoolTest, SharedFramesComeBackWhenTheLastWriterDropsThem) {
+    onFreshThread([] {
+        std::string frame = FramePool::acquire();
+        frame.assign(1000, 'y');
+        auto first = FramePool::share(std::move(frame));
+        auto second = first;
+        EXPECT_EQ(*second, std::string(1000, 'y'));
+
+        first.reset();
+        EXPECT_EQ(FramePool::stats().free, 0u);
+        second.reset();
+        EXPECT_EQ(FramePool::stats().free, 1u);
+        EXPECT_GE(FramePool::acquire().capacity(), 1000u);
+    });
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "common/util/handle_table.h"
+#include <string>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(HandleTableTest, FindsEntriesByHandle) {
+    HandleTable<std::string> table;
+    const Handle first = table.insert("doc-a");
+    const Handle second = table.insert("doc-b");
+    EXPECT_NE(first, NO_HANDLE);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(table.size(), 2u);
+    ASSERT_NE(table.find(first), nullptr);
+    EXPECT_EQ(*table.find(first), "doc-a");
+    EXPECT_EQ(*table.find(second), "doc-b");
+    EXPECT_EQ(table.find(NO_HANDLE), nullptr);
+    EXPECT_EQ(table.find(12345), nullptr);
+}
+
+TEST(HandleTableTest, ErasedHandlesStayStaleWhenSlotsAreReused) {
+    HandleTable<std::string> table;
+    const Handle erased = table.insert("closed");
+    const Handle kept = table.insert("open");
+    EXPECT_TRUE(table.erase(erased));
+    EXPECT_FALSE(table.erase(erased));
+    EXPECT_EQ(table.find(erased), nullptr);
+
+    // The slot is reused under a new generation
+    const Handle reused = table.insert("reopened");
+    EXPECT_NE(reused, erased);
+    EXPECT_EQ(reused & HandleTable<std::string>::MAX_ENTRIES, erased & HandleTable<std::string>::MAX_ENTRIES);
+    EXPECT_EQ(table.find(erased), nullptr);
+    EXPECT_EQ(*table.find(reused), "reopened");
+
+    std::vector<std::string> entries;
+    table.forEach([&](Handle, const std::string& entry) { entries.push_back(entry); });
+    EXPECT_EQ(entries, (std::vector<std::string>{"reopened", "open"}));
+
+    table.clear();
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.find(kept), nullptr);
+    const Handle afterClear = table.insert("after clear");
+    EXPECT_NE(afterClear, kept);
+    EXPECT_NE(afterClear, reused);
+    EXPECT_EQ(*table.find(afterClear), "after clear");
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "common/util/handoff_queue.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(HandoffQueueTest, WakesTheConsumerOncePerBatch) {
+    int wakeups = 0;
+    HandoffQueue<std::unique_ptr<int>> queue(8, [&wakeups]() { ++wakeups; });
+
+    for (int i = 0; i < 5; ++i) {
+        queue.push(std::make_unique<int>(i));
+    }
+    EXPECT_EQ(wakeups, 1);
+
+    std::vector<int> taken;
+    EXPECT_EQ(queue.drain([&taken](std::unique_ptr<int> value) { taken.push_back(*value); }), 5u);
+    EXPECT_EQ(taken, (std::vector<int>{0, 1, 2, 3, 4}));
+    EXPECT_TRUE(queue.empty());
+
+    // Drained, the next item wakes it again
+    queue.push(std::make_unique<int>(5));
+    EXPECT_EQ(wakeups, 2);
+}
+
+TEST(HandoffQueueTest, KeepsWhatDoesNotFitOnTheProducersSide) {
+    int consumerWakeups = 0;
+    int producerWakeups = 0;
+    HandoffQueue<int> queue(4, [&]() { ++consumerWakeups; }, [&]() { ++producerWakeups; });
+
+    for (int i = 0; i < 10; ++i) {
+        queue.push(i);
+    }
+    EXPECT_EQ(queue.overflowed(), 6u);
+    EXPECT_EQ(consumerWakeups, 1);
+
+    // The consumer makes room and asks the producer to refill, until everything is through in order
+    std::vector<int> taken;
+    while (taken.size() < 10) {
+        const int before = producerWakeups;
+        queue.drain([&taken](int value) { taken.push_back(value); });
+        if (producerWakeups > before) {
+            queue.retry();
+        }
+    }
+    EXPECT_EQ(taken, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+    EXPECT_EQ(queue.overflowed(), 0u);
+    EXPECT_EQ(producerWakeups, 2);
+}
+
+TEST(HandoffQueueTest, PassesItemsBetweenThreadsWithoutLosingAWakeup) {
+    constexpr int ITEMS = 100000;
+    std::atomic<int> consumerWakeups{0};
+    std::atomic<int> producerWakeups{0};
+    HandoffQueue<int> queue(64, [&]() { ++consumerWakeups; }, [&]() { ++producerWakeups; });
+
+    // Each side runs only when the other woke it, as two event loops would
+    std::thread producer([&]() {
+        int retried = 0;
+        for (int i = 0; i < ITEMS; ++i) {
+            queue.push(i);
+            for (; retried < producerWakeups.load(); ++retried) {
+                queue.retry();
+            }
+        }
+        while (queue.overflowed() > 0) {
+            for (; retried < producerWakeups.load(); ++retried) {
+                queue.retry();
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    int expected = 0;
+    int handled = 0;
+    while (expected < ITEMS) {
+        if (handled == consumerWakeups.load()) {
+            std::this_thread::yield();
+            continue;
+        }
+        ++handled;
+        queue.drain([&expected](int value) {
+            EXPECT_EQ(value, expected);
+            ++expected;
+        });
+    }
+    producer.join();
+    EXPECT_EQ(expected, ITEMS);
+}
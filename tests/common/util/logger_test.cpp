@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+#include "common/util/logger.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace collab::util;
+
+namespace {
+
+std::filesystem::path freshLogDirectory(const std::string& name) {
+    auto directory = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove_all(directory);
+    return directory;
+}
+
+std::vector<std::string> readLines(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+} // namespace
+
+TEST(LoggerTest, AsyncWriterKeepsEveryThreadsLinesInOrder) {
+    const auto directory = freshLogDirectory("collab_logger_async");
+    const auto path = directory / "server.log";
+    Logger logger;
+    ASSERT_TRUE(logger.initialize(path, LogLevel::INFO, false));
+    // Small rings, so threads also wait on a full one
+    logger.startAsync(16);
+    ASSERT_TRUE(logger.isAsync());
+
+    constexpr int threads = 4;
+    constexpr int lines = 1000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&logger, t] {
+            for (int i = 0; i < lines; ++i) {
+                logger.info("worker " + std::to_string(t) + " line " + std::to_string(i));
+            }
+            logger.debug("below the level");
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    logger.flush();
+
+    std::vector<int> next(threads, 0);
+    size_t workerLines = 0;
+    for (const std::string& line : readLines(path)) {
+        ASSERT_EQ(line.find("below the level"), std::string::npos);
+        const size_t at = line.find("] worker ");
+        if (at == std::string::npos) {
+            continue;
+        }
+        EXPECT_EQ(line.substr(at - 8, 8), "[INFO   ");
+        int t = 0;
+        int i = 0;
+        ASSERT_EQ(std::sscanf(line.c_str() + at, "] worker %d line %d", &t, &i), 2);
+        EXPECT_EQ(i, next[t]++);
+        ++workerLines;
+    }
+    EXPECT_EQ(workerLines, static_cast<size_t>(threads * lines));
+
+    // Back to writing on the caller after stopping
+    logger.stopAsync();
+    EXPECT_FALSE(logger.isAsync());
+    logger.warning("after stop");
+    EXPECT_NE(readLines(path).back().find("[WARNING] after stop"), std::string::npos);
+    std::filesystem::remove_all(directory);
+}
+
+TEST(LoggerTest, RotatesOnceTheTrackedSizeIsReached) {
+    const auto directory = freshLogDirectory("collab_logger_rotation");
+    const auto path = directory / "server.log";
+    {
+        Logger logger;
+        ASSERT_TRUE(logger.initialize(path, LogLevel::INFO, false));
+        logger.startAsync();
+        const std::string filler(200, 'x');
+        for (int i = 0; i < 6000; ++i) {
+            logger.info(filler);
+        }
+        logger.flush();
+    }
+
+    // Rotated after the line that reached the limit
+    const size_t lineSize = 23 + 11 + 200 + 1;
+    ASSERT_TRUE(std::filesystem::exists(directory / "server.log.1"));
+    EXPECT_GE(std::filesystem::file_size(directory / "server.log.1"), 1024u * 1024u);
+    EXPECT_LT(std::filesystem::file_size(directory / "server.log.1"), 1024u * 1024u + lineSize);
+    EXPECT_LT(std::filesystem::file_size(path), 1024u * 1024u);
+    // No line is split across the files
+    for (const auto& file : {path, directory / "server.log.1"}) {
+        for (const std::string& line : readLines(file)) {
+            EXPECT_TRUE(line.find("Logger initialized") != std::string::npos ||
+                        line.size() + 1 == lineSize) << line;
+        }
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST(LoggerTest, StructuredLinesAreFormattedWhereTheyAreWritten) {
+    const auto directory = freshLogDirectory("collab_logger_structured");
+    const auto path = directory / "server.log";
+    Logger logger;
+    ASSERT_TRUE(logger.initialize(path, LogLevel::DEBUG, false));
+
+    enum class Kind { Insert = 2 };
+    std::string client = "alice";
+    logger.logFormatted<4>(LogLevel::DEBUG, "client {} at {} ok={} kind={}", client, int64_t{-42}, true, Kind::Insert);
+    logger.startAsync();
+    {
+        // Captured by value: the caller's string may be gone before the writer formats it
+        std::string temporary(100, 'y');
+        logger.logFormatted<2>(LogLevel::INFO, "{} then {}", std::string_view(temporary), 2.5);
+        temporary.assign(100, 'z');
+    }
+    logger.logFormatted<0>(LogLevel::WARNING, "no arguments {");
+    logger.logFormatted<1>(LogLevel::TRACE, "below the level {}", 1);
+    logger.flush();
+
+    auto lines = readLines(path);
+    ASSERT_EQ(lines.size(), 4u);
+    EXPECT_NE(lines[1].find("[DEBUG  ] client alice at -42 ok=true kind=2"), std::string::npos) << lines[1];
+    EXPECT_NE(lines[2].find("[INFO   ] " + std::string(100, 'y') + " then 2.5"), std::string::npos) << lines[2];
+    EXPECT_NE(lines[3].find("[WARNING] no arguments {"), std::string::npos) << lines[3];
+    std::filesystem::remove_all(directory);
+}
+
+TEST(LoggerTest, DeferredArgsMoveInlineAndSpilledArguments) {
+    std::string out;
+    DeferredArgs small(1, 'c', "text");
+    DeferredArgs moved(std::move(small));
+    moved.render(out, "{}-{}-{}");
+    EXPECT_EQ(out, "1-c-text");
+
+    // Too big for the inline storage: kept on the heap, moved by pointer
+    const std::string big(50, 'b');
+    DeferredArgs spilled(big, big, big);
+    DeferredArgs target;
+    target = std::move(spilled);
+    out.clear();
+    target.render(out, "{}{}{}!");
+    EXPECT_EQ(out, big + big + big + "!");
+    static_assert(countPlaceholders("a {} b {} {") == 2);
+}
+
+TEST(LoggerTest, RateLimiterKeepsABucketPerKey) {
+    // No refill to speak of, so only the burst gets through
+    LogRateLimiter limiter(0.001, 3, 2);
+    uint64_t suppressed = 0;
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(limiter.allow("10.0.0.1", suppressed));
+    }
+    EXPECT_FALSE(limiter.allow("10.0.0.1", suppressed));
+    EXPECT_FALSE(limiter.allow("10.0.0.1", suppressed));
+    EXPECT_TRUE(limiter.allow("10.0.0.2", suppressed));
+    EXPECT_EQ(suppressed, 0u);
+
+    // Past maxKeys every bucket starts over
+    EXPECT_TRUE(limiter.allow("10.0.0.3", suppressed));
+    EXPECT_TRUE(limiter.allow("10.0.0.1", suppressed));
+
+    LogRateLimiter fast(1000, 1);
+    EXPECT_TRUE(fast.allow("key", suppressed));
+    EXPECT_FALSE(fast.allow("key", suppressed));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_TRUE(fast.allow("key", suppressed));
+    EXPECT_EQ(suppressed, 1u);
+}
+
+TEST(LoggerTest, SampledAndRateLimitedMacrosDropTheRest) {
+    const auto directory = freshLogDirectory("collab_logger_sampled");
+    const auto path = directory / "server.log";
+    ASSERT_TRUE(initLogger(path, LogLevel::INFO, false));
+    for (int i = 0; i < 10; ++i) {
+        LOGF_EVERY_N(LogLevel::INFO, 4, "sampled {}", i);
+        LOGF_RATE_LIMITED(LogLevel::INFO, 2, "storm", "limited {}", i);
+        LOGF_EVERY_N(LogLevel::DEBUG, 1, "below the level {}", i);
+    }
+    getLogger().flush();
+
+    std::vector<std::string> sampled;
+    size_t limited = 0;
+    for (const std::string& line : readLines(path)) {
+        EXPECT_EQ(line.find("below the level"), std::string::npos);
+        if (const size_t at = line.find("sampled "); at != std::string::npos) {
+            sampled.push_back(line.substr(at));
+        }
+        limited += line.find("limited ") != std::string::npos ? 1 : 0;
+    }
+    EXPECT_EQ(sampled, (std::vector<std::string>{"sampled 0", "sampled 4", "sampled 8"}));
+    EXPECT_EQ(limited, 2u);
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include "common/util/mapped_snapshot.h"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace collab::util;
+
+namespace {
+
+std::filesystem::path snapshotPath(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+} // namespace
+
+TEST(MappedSnapshotTest, MapsTextLineIndexAndMetadata) {
+    auto path = snapshotPath("collabedit_mapped_snapshot.snap");
+    MappedSnapshot::write(path, "one\ntwo\n\nthree", 42, std::string("crdt\0state", 10));
+    
+    auto snapshot = MappedSnapshot::open(path);
+    EXPECT_EQ(snapshot->revision(), 42);
+    EXPECT_EQ(snapshot->text(), "one\ntwo\n\nthree");
+    EXPECT_EQ(std::vector<uint64_t>(snapshot->breaks().begin(), snapshot->breaks().end()),
+              (std::vector<uint64_t>{3, 7, 8}));
+    EXPECT_EQ(snapshot->metadata(), std::string_view("crdt\0state", 10));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(snapshot->breaks().data()) % 8, 0u);
+    
+    MappedSnapshot::write(path, "", 0);
+    auto empty = MappedSnapshot::open(path);
+    EXPECT_TRUE(empty->text().empty());
+    EXPECT_TRUE(empty->breaks().empty());
+    // The first mapping still reads the file it mapped
+    EXPECT_EQ(snapshot->text(), "one\ntwo\n\nthree");
+}
+
+TEST(MappedSnapshotTest, RejectsFilesThatAreNotWholeSnapshots) {
+    auto path = snapshotPath("collabedit_mapped_snapshot_bad.snap");
+    EXPECT_THROW(MappedSnapshot::open(path), std::runtime_error);
+    
+    MappedSnapshot::write(path, std::string(1000, 'x'), 1);
+    std::filesystem::resize_file(path, 500);
+    EXPECT_THROW(MappedSnapshot::open(path), std::runtime_error);
+    
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a snapshot at all, just some text";
+    EXPECT_THROW(MappedSnapshot::open(path), std::runtime_error);
+}
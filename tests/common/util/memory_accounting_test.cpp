@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "common/util/memory_accounting.h"
+#include "common/crdt/order_statistic_tree.h"
+#include "common/ot/operation_log.h"
+#include <memory_resource>
+#include <string>
+#include <utility>
+
+using namespace collab;
+using namespace collab::util;
+
+namespace {
+
+struct Weighted {
+    size_t value;
+    size_t weight() const { return 1; }
+};
+
+int64_t liveBytes(MemoryTag tag) {
+    return memoryResource(tag).liveBytes();
+}
+
+} // namespace
+
+TEST(MemoryAccountingTest, CountsWhatContainersAllocate) {
+    TrackingResource resource("test");
+    {
+        std::pmr::vector<uint64_t> values(&resource);
+        values.reserve(100);
+        EXPECT_EQ(resource.liveBytes(), 800);
+        EXPECT_EQ(resource.allocations(), 1u);
+
+        // Charges count alongside, and copies of a charge count again
+        MemoryCharge charge(resource);
+        charge.set(50);
+        MemoryCharge copy = charge;
+        EXPECT_EQ(resource.liveBytes(), 900);
+        MemoryCharge moved = std::move(copy);
+        charge.set(10);
+        EXPECT_EQ(resource.liveBytes(), 860);
+    }
+    EXPECT_EQ(resource.liveBytes(), 0);
+    EXPECT_EQ(resource.allocatedBytes(), 900u);
+}
+
+TEST(MemoryAccountingTest, TagsTheHotContainers) {
+    const int64_t logBefore = liveBytes(MemoryTag::OT_LOG);
+    {
+        ot::OperationLog log(16);
+        const int64_t slots = liveBytes(MemoryTag::OT_LOG) - logBefore;
+        EXPECT_GE(slots, static_cast<int64_t>(32 * sizeof(ot::OperationPtr)));
+
+        // Retained operations are charged by their accounted size
+        log.append(std::make_shared<ot::InsertOperation>(0, "hello"));
+        EXPECT_EQ(liveBytes(MemoryTag::OT_LOG) - logBefore, slots + static_cast<int64_t>(log.bytes()));
+        log.discardBefore(1);
+        EXPECT_EQ(liveBytes(MemoryTag::OT_LOG) - logBefore, slots);
+        log.append(std::make_shared<ot::InsertOperation>(0, "again"));
+    }
+    EXPECT_EQ(liveBytes(MemoryTag::OT_LOG), logBefore);
+
+    const int64_t crdtBefore = liveBytes(MemoryTag::CRDT);
+    {
+        crdt::OrderStatisticTree<Weighted> tree;
+        for (size_t i = 0; i < 10; ++i) {
+            tree.insert(i, Weighted{i});
+        }
+        EXPECT_GE(liveBytes(MemoryTag::CRDT) - crdtBefore, static_cast<int64_t>(10 * sizeof(Weighted)));
+    }
+    EXPECT_EQ(liveBytes(MemoryTag::CRDT), crdtBefore);
+
+    bool reported = false;
+    for (const MemoryUsage& usage : memoryUsage()) {
+        reported |= std::string(usage.tag) == "ot_log" && usage.allocations > 0;
+    }
+    EXPECT_TRUE(reported);
+}
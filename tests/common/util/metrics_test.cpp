@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "common/util/metrics.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(MetricsTest, CountersSumTheAddsOfEveryThread) {
+    constexpr int THREADS = 8;
+    constexpr int ADDS = 100000;
+    Counter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&counter]() {
+            for (int i = 0; i < ADDS; ++i) {
+                counter.add();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(counter.value(), static_cast<uint64_t>(THREADS) * ADDS);
+
+    Gauge gauge;
+    gauge.add(5);
+    gauge.sub(7);
+    EXPECT_EQ(gauge.value(), -2);
+    gauge.set(42);
+    EXPECT_EQ(gauge.value(), 42);
+}
+
+TEST(MetricsTest, HistogramBucketsCoverEveryValueWithinTheirPrecision) {
+    EXPECT_EQ(Histogram::bucketOf(0), 0u);
+    EXPECT_EQ(Histogram::bucketOf(31), 31u);
+    EXPECT_EQ(Histogram::bucketOf(32), 32u);
+    EXPECT_EQ(Histogram::bucketOf(uint64_t{1} << 50), Histogram::BUCKETS - 1);
+
+    // Buckets are contiguous and each is at most 1/32 of the values in it wide
+    for (size_t bucket = 1; bucket < Histogram::BUCKETS; ++bucket) {
+        const uint64_t low = Histogram::lowestEquivalent(bucket);
+        const uint64_t high = Histogram::highestEquivalent(bucket);
+        ASSERT_EQ(low, Histogram::highestEquivalent(bucket - 1) + 1);
+        ASSERT_EQ(Histogram::bucketOf(low), bucket);
+        ASSERT_EQ(Histogram::bucketOf(high), bucket);
+        ASSERT_LE(high - low, low / Histogram::SUB_BUCKETS);
+    }
+}
+
+TEST(MetricsTest, HistogramPercentilesAreWithinThePrecision) {
+    Histogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&histogram, t]() {
+            // Together, every value from 1 to 100000 once
+            for (uint64_t value = 1 + t; value <= 100000; value += 4) {
+                histogram.record(value * 1000);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const Histogram::Snapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 100000u);
+    EXPECT_EQ(snapshot.max, 100000000u);
+    EXPECT_EQ(snapshot.sum, uint64_t{100000} * 100001 / 2 * 1000);
+    for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+        const double expected = quantile * 100000000;
+        EXPECT_NEAR(static_cast<double>(snapshot.valueAt(quantile)), expected, expected / 32) << quantile;
+    }
+    EXPECT_EQ(snapshot.valueAt(1.0), snapshot.max);
+    EXPECT_EQ(Histogram().snapshot().valueAt(0.99), 0u);
+}
+
+TEST(MetricsTest, RegistryReturnsTheSameSeriesForTheSameLabels) {
+    MetricsRegistry registry;
+    Counter& first = registry.counter("ops_total", "Operations", {{"kind", "insert"}});
+    EXPECT_EQ(&registry.counter("ops_total", "Operations", {{"kind", "insert"}}), &first);
+    EXPECT_NE(&registry.counter("ops_total", "Operations", {{"kind", "delete"}}), &first);
+
+    EXPECT_THROW(registry.gauge("ops_total", "Operations"), std::invalid_argument);
+    EXPECT_THROW(registry.counter("1ops", "Bad name"), std::invalid_argument);
+    EXPECT_THROW(registry.counter("ops", "Bad label", {{"a-b", "x"}}), std::invalid_argument);
+}
+
+TEST(MetricsTest, RendersThePrometheusTextFormat) {
+    MetricsRegistry registry;
+    registry.counter("ops_total", "Operations applied", {{"kind", "in\"sert"}}).add(3);
+    registry.gauge("clients", "Connected clients").set(-1);
+    Histogram& latency = registry.histogram("apply_seconds", "Apply time", {}, NANOSECONDS_PER_SECOND);
+    latency.record(2000);
+    latency.record(2000);
+
+    const std::string text = registry.renderPrometheus();
+    EXPECT_NE(text.find("# HELP ops_total Operations applied\n# TYPE ops_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find("ops_total{kind=\"in\\\"sert\"} 3\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE clients gauge\nclients -1\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE apply_seconds summary\n"), std::string::npos);
+    EXPECT_NE(text.find("apply_seconds{quantile=\"0.99\"} 2e-06\n"), std::string::npos);
+    EXPECT_NE(text.find("apply_seconds_sum 4e-06\n"), std::string::npos);
+    EXPECT_NE(text.find("apply_seconds_count 2\n"), std::string::npos);
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include "common/util/mpsc_queue.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(MpscQueueTest, PopsInPushOrder) {
+    MpscQueue<std::unique_ptr<int>> queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.tryPop());
+
+    for (int i = 0; i < 3; ++i) {
+        queue.push(std::make_unique<int>(i));
+    }
+    EXPECT_FALSE(queue.empty());
+    for (int i = 0; i < 3; ++i) {
+        auto value = queue.tryPop();
+        ASSERT_TRUE(value);
+        EXPECT_EQ(**value, i);
+    }
+    EXPECT_TRUE(queue.empty());
+
+    // Works again after running dry, and frees what is left on destruction
+    queue.push(std::make_unique<int>(7));
+    EXPECT_EQ(**queue.tryPop(), 7);
+    queue.push(std::make_unique<int>(8));
+}
+
+TEST(MpscQueueTest, KeepsEachProducersOrder) {
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 20000;
+    MpscQueue<std::pair<int, int>> queue;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&queue, p]() {
+            for (int i = 0; i < PER_PRODUCER; ++i) {
+                queue.push({p, i});
+            }
+        });
+    }
+
+    std::vector<int> next(PRODUCERS, 0);
+    int received = 0;
+    while (received < PRODUCERS * PER_PRODUCER) {
+        auto item = queue.tryPop();
+        if (!item) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(item->second, next[item->first]);
+        ++next[item->first];
+        ++received;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "common/util/buffer_pool.h"
+#include "common/util/numa_topology.h"
+
+using namespace collab::util;
+
+TEST(NumaTopologyTest, ParsesKernelCpuLists) {
+    EXPECT_EQ(NumaTopology::parseCpuList("0-3,8,10-11\n"), (std::vector<unsigned>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(NumaTopology::parseCpuList("5"), (std::vector<unsigned>{5}));
+    EXPECT_TRUE(NumaTopology::parseCpuList("").empty());
+    // Malformed parts are skipped, the rest kept
+    EXPECT_EQ(NumaTopology::parseCpuList("x,4-2,6"), (std::vector<unsigned>{6}));
+}
+
+TEST(NumaTopologyTest, DetectsNodesFromSysfs) {
+    const std::filesystem::path root = std::filesystem::temp_directory_path() / "numa_topology_test";
+    std::filesystem::remove_all(root);
+    for (const auto& [node, cpus] : std::vector<std::pair<const char*, const char*>>{
+             {"node0", "0-1,4-5"}, {"node2", "2-3,6-7"}, {"node3", ""}}) {
+        std::filesystem::create_directories(root / node);
+        std::ofstream(root / node / "cpulist") << cpus << "\n";
+    }
+    std::filesystem::create_directories(root / "power");
+
+    // The memory-only node is dropped, and the gap in the IDs closes
+    NumaTopology topology = NumaTopology::detect(root);
+    ASSERT_EQ(topology.nodeCount(), 2u);
+    EXPECT_EQ(topology.cpusOf(0), (std::vector<unsigned>{0, 1, 4, 5}));
+    EXPECT_EQ(topology.cpusOf(1), (std::vector<unsigned>{2, 3, 6, 7}));
+    EXPECT_EQ(topology.nodeOf(6), 1u);
+    EXPECT_EQ(topology.nodeOf(9), NumaTopology::NO_NODE);
+    std::filesystem::remove_all(root);
+
+    // Without sysfs, one node with every CPU
+    NumaTopology flat = NumaTopology::detect(root);
+    EXPECT_EQ(flat.nodeCount(), 1u);
+    EXPECT_FALSE(flat.cpusOf(0).empty());
+}
+
+TEST(NumaTopologyTest, SpreadsThreadsInBlocks) {
+    NumaTopology topology({{0, 1}, {2, 3}});
+    std::vector<size_t> nodes;
+    for (size_t slot = 0; slot < 6; ++slot) {
+        nodes.push_back(topology.nodeForSlot(slot, 6));
+    }
+    EXPECT_EQ(nodes, (std::vector<size_t>{0, 0, 0, 1, 1, 1}));
+    // Fewer threads than nodes still use each node at most once
+    EXPECT_EQ(topology.nodeForSlot(0, 1), 0u);
+}
+
+TEST(NumaTopologyTest, BoundThreadsUseTheirNodesBufferPool) {
+    const NumaTopology& topology = NumaTopology::system();
+    EXPECT_EQ(NumaTopology::currentNode(), NumaTopology::NO_NODE);
+    EXPECT_EQ(&BufferPool::local(), &BufferPool::shared());
+
+    BufferPool* pool = nullptr;
+    std::thread bound([&]() {
+        topology.bindCurrentThread(0);
+        EXPECT_EQ(NumaTopology::currentNode(), 0u);
+        pool = &BufferPool::local();
+        EXPECT_EQ(pool->getNode(), 0u);
+
+        // Buffers are cut from the node's chunks and always come back to it
+        char* first = nullptr;
+        {
+            BufferPool::Buffer buffer = pool->acquire(1000);
+            first = buffer.data();
+            std::memset(buffer.data(), 'x', buffer.size());
+        }
+        EXPECT_EQ(pool->acquire(1000).data(), first);
+        EXPECT_EQ(pool->getStats().allocated, 1u);
+    });
+    bound.join();
+    EXPECT_NE(pool, &BufferPool::shared());
+}
+
+TEST(NumaTopologyTest, AllocatesNodeMemory) {
+    const NumaTopology& topology = NumaTopology::system();
+    for (bool hugePages : {false, true}) {
+        char* data = static_cast<char*>(topology.allocate(10000, 0, hugePages));
+        ASSERT_NE(data, nullptr);
+        std::memset(data, 1, 10000);
+        topology.deallocate(data, 10000, hugePages);
+    }
+}
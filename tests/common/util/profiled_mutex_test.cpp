@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "common/util/profiled_mutex.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(ProfiledMutexTest, ExcludesLikeAMutex) {
+    constexpr int THREADS = 4;
+    constexpr int INCREMENTS = 20000;
+    ProfiledMutex mutex("test_exclusion");
+    int total = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < INCREMENTS; ++i) {
+                std::lock_guard<ProfiledMutex> lock(mutex);
+                ++total;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(total, THREADS * INCREMENTS);
+
+    std::unique_lock<ProfiledMutex> held(mutex);
+    std::thread([&] { EXPECT_FALSE(mutex.try_lock()); }).join();
+}
+
+TEST(ProfiledMutexTest, RecordsWaitHoldAndContentionPerName) {
+    if (!LOCK_PROFILING) {
+        GTEST_SKIP() << "Built without ENABLE_LOCK_PROFILING";
+    }
+    // Two mutexes of one name count together
+    ProfiledMutex first("test_contended");
+    ProfiledMutex second("test_contended");
+    LockStats& stats = LockStats::named("test_contended");
+
+    {
+        std::lock_guard<ProfiledMutex> lock(second);
+    }
+    EXPECT_EQ(stats.acquisitions.value(), 1u);
+    EXPECT_EQ(stats.contentions.value(), 0u);
+
+    first.lock();
+    std::thread waiter([&] {
+        std::lock_guard<ProfiledMutex> lock(first);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    first.unlock();
+    waiter.join();
+
+    EXPECT_EQ(stats.acquisitions.value(), 3u);
+    EXPECT_EQ(stats.contentions.value(), 1u);
+    EXPECT_GE(stats.waitTime.snapshot().max, 10'000'000u);
+    EXPECT_GE(stats.holdTime.snapshot().max, 10'000'000u);
+
+    // The lock waited on longest comes first, and every name is exported
+    const auto report = LockStats::report();
+    ASSERT_FALSE(report.empty());
+    EXPECT_EQ(report.front().name, "test_contended");
+    const std::string exported = metrics().renderPrometheus();
+    EXPECT_NE(exported.find("collab_lock_contentions_total{lock=\"test_contended\"} 1"), std::string::npos);
+    EXPECT_NE(exported.find("collab_lock_wait_seconds_count{lock=\"test_contended\"} 3"), std::string::npos);
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "common/util/interned_string.h"
+#include "common/util/small_text.h"
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(SmallTextTest, KeepsShortTextInline) {
+    const SmallText empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(empty, "");
+
+    const SmallText key("a");
+    EXPECT_FALSE(key.onHeap());
+    EXPECT_EQ(key.size(), 1u);
+    EXPECT_EQ(key, "a");
+
+    const std::string fifteen(SmallText::INLINE_CAPACITY, 'x');
+    EXPECT_FALSE(SmallText(fifteen).onHeap());
+    EXPECT_EQ(SmallText(fifteen).str(), fifteen);
+
+    const std::string sixteen = fifteen + "y";
+    EXPECT_TRUE(SmallText(sixteen).onHeap());
+    EXPECT_EQ(SmallText(sixteen).view(), sixteen);
+
+    // Embedded NULs are text like any other byte
+    const std::string withNul("a\0b", 3);
+    EXPECT_EQ(SmallText(withNul).size(), 3u);
+    EXPECT_EQ(SmallText(withNul).view(), withNul);
+}
+
+TEST(SmallTextTest, CopiesAndMovesEitherForm) {
+    for (const std::string& text : {std::string("short"), std::string(100, 'z')}) {
+        SmallText original(text);
+        SmallText copy(original);
+        EXPECT_EQ(copy, original);
+        EXPECT_NE(copy.data(), original.data());
+
+        SmallText moved(std::move(original));
+        EXPECT_EQ(moved, text);
+        EXPECT_TRUE(original.empty());
+
+        SmallText assigned("other text that is long enough for the heap");
+        assigned = copy;
+        EXPECT_EQ(assigned, text);
+        assigned = std::move(moved);
+        EXPECT_EQ(assigned, text);
+        const SmallText& self = assigned;
+        assigned = self;
+        EXPECT_EQ(assigned, text);
+    }
+}
+
+TEST(InternedStringTest, SharesOneCopyPerValue) {
+    const InternedString none;
+    EXPECT_TRUE(none.empty());
+    EXPECT_EQ(none.str(), "");
+    EXPECT_EQ(InternedString(""), none);
+
+    const InternedString alice("6f1c0e2a-93b4-4d7e-8a5f-2c9d4b7e1a30");
+    const InternedString again(std::string("6f1c0e2a-93b4-4d7e-8a5f-2c9d4b7e1a30"));
+    const InternedString bob("bob");
+    EXPECT_EQ(alice, again);
+    EXPECT_NE(alice, bob);
+    EXPECT_EQ(&alice.str(), &again.str());
+    EXPECT_EQ(alice.str(), "6f1c0e2a-93b4-4d7e-8a5f-2c9d4b7e1a30");
+    EXPECT_EQ(bob.str(), "bob");
+}
+
+TEST(InternedStringTest, InternsConcurrently) {
+    // Threads racing to intern the same values agree on their handles
+    std::vector<std::vector<uint32_t>> ids(4);
+    std::vector<std::thread> threads;
+    for (auto& out : ids) {
+        threads.emplace_back([&out] {
+            for (int i = 0; i < 500; ++i) {
+                out.push_back(InternedString("user-" + std::to_string(i)).id());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& out : ids) {
+        EXPECT_EQ(out, ids[0]);
+    }
+    EXPECT_EQ(InternedString("user-7").str(), "user-7");
+}
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include "common/util/space_saving.h"
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace collab::util;
+
+TEST(SpaceSavingTest, CountsExactlyWhileThereIsRoom) {
+    SpaceSaving<std::string> sketch(4);
+    sketch.offer("a", 5);
+    sketch.offer("b");
+    sketch.offer("a");
+    sketch.offer("c", 3);
+
+    const auto top = sketch.top(2);
+    ASSERT_EQ(top.size(), 2u);
+    EXPECT_EQ(top[0].key, "a");
+    EXPECT_EQ(top[0].count, 6u);
+    EXPECT_EQ(top[0].error, 0u);
+    EXPECT_EQ(top[1].key, "c");
+    EXPECT_EQ(sketch.estimate("b"), 1u);
+    EXPECT_EQ(sketch.estimate("missing"), 0u);
+    EXPECT_EQ(sketch.total(), 10u);
+}
+
+TEST(SpaceSavingTest, KeepsTheHeavyHittersOfALongTail) {
+    constexpr size_t CAPACITY = 16;
+    SpaceSaving<int> sketch(CAPACITY);
+    std::unordered_map<int, uint64_t> exact;
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> tail(100, 100000);
+    for (int i = 0; i < 200000; ++i) {
+        // Three hot keys take a third of the stream between them
+        const int key = i % 9 < 3 ? i % 9 : tail(random);
+        sketch.offer(key);
+        ++exact[key];
+    }
+
+    const auto top = sketch.top(3);
+    ASSERT_EQ(top.size(), 3u);
+    for (const auto& entry : top) {
+        EXPECT_LT(entry.key, 3);
+        // Never below the true count, and above it by at most the error
+        EXPECT_GE(entry.count, exact[entry.key]);
+        EXPECT_LE(entry.count - entry.error, exact[entry.key]);
+    }
+    EXPECT_EQ(sketch.size(), CAPACITY);
+    // The bound on error is total / capacity
+    for (const auto& entry : sketch.top(CAPACITY)) {
+        EXPECT_LE(entry.error, sketch.total() / CAPACITY);
+    }
+}
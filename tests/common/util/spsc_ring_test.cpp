@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include "common/util/spsc_ring.h"
+#include <memory>
+#include <thread>
+
+using namespace collab::util;
+
+TEST(SpscRingTest, HoldsUpToItsCapacity) {
+    SpscRing<std::unique_ptr<int>> ring(3);
+    EXPECT_EQ(ring.capacity(), 4u);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.tryPop());
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ring.tryPush(std::make_unique<int>(i)));
+    }
+    // A rejected item stays with the caller
+    auto extra = std::make_unique<int>(4);
+    EXPECT_FALSE(ring.tryPush(extra));
+    ASSERT_TRUE(extra);
+
+    EXPECT_EQ(**ring.tryPop(), 0);
+    EXPECT_TRUE(ring.tryPush(extra));
+    for (int i = 1; i <= 4; ++i) {
+        auto value = ring.tryPop();
+        ASSERT_TRUE(value);
+        EXPECT_EQ(**value, i);
+    }
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(SpscRingTest, PassesItemsBetweenThreadsInOrder) {
+    constexpr int ITEMS = 200000;
+    SpscRing<int> ring(64);
+    std::thread producer([&ring]() {
+        for (int i = 0; i < ITEMS; ++i) {
+            while (!ring.tryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (int expected = 0; expected < ITEMS;) {
+        auto value = ring.tryPop();
+        if (!value) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(*value, expected);
+        ++expected;
+    }
+    producer.join();
+    EXPECT_TRUE(ring.empty());
+}
@@ -0,0 +1,272 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include "common/util/text_scan.h"
+
+using namespace collab::util;
+
+namespace {
+
+// Byte-at-a-time references the kernels must agree with
+
+bool referenceValid(const std::string& text) {
+    size_t i = 0;
+    while (i < text.size()) {
+        const auto lead = static_cast<unsigned char>(text[i]);
+        size_t size = 0;
+        uint32_t codePoint = 0;
+        if (lead < 0x80) {
+            size = 1;
+            codePoint = lead;
+        } else if ((lead & 0xE0) == 0xC0) {
+            size = 2;
+            codePoint = lead & 0x1F;
+        } else if ((lead & 0xF0) == 0xE0) {
+            size = 3;
+            codePoint = lead & 0x0F;
+        } else if ((lead & 0xF8) == 0xF0) {
+            size = 4;
+            codePoint = lead & 0x07;
+        } else {
+            return false;
+        }
+        if (text.size() - i < size) {
+            return false;
+        }
+        for (size_t k = 1; k < size; ++k) {
+            const auto next = static_cast<unsigned char>(text[i + k]);
+            if ((next & 0xC0) != 0x80) {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (next & 0x3F);
+        }
+        static constexpr uint32_t SMALLEST[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (codePoint < SMALLEST[size] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+            return false;
+        }
+        i += size;
+    }
+    return true;
+}
+
+std::vector<uint64_t> referenceNewlines(const std::string& text, uint64_t base) {
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            offsets.push_back(base + i);
+        }
+    }
+    return offsets;
+}
+
+std::string encode(uint32_t codePoint) {
+    std::string out;
+    if (codePoint < 0x80) {
+        out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    return out;
+}
+
+// Valid text mixing every sequence length, with newlines, and the code points it holds
+std::string randomText(std::mt19937& rng, size_t codePoints, std::vector<uint32_t>* decoded = nullptr) {
+    std::string text;
+    for (size_t i = 0; i < codePoints; ++i) {
+        uint32_t codePoint;
+        switch (rng() % 6) {
+            case 0: codePoint = '\n'; break;
+            case 1: codePoint = 0x80 + rng() % (0x800 - 0x80); break;
+            case 2: codePoint = 0x800 + rng() % (0xD800 - 0x800); break;
+            case 3: codePoint = 0x10000 + rng() % (0x110000 - 0x10000); break;
+            default: codePoint = 0x20 + rng() % 0x5F; break;
+        }
+        text += encode(codePoint);
+        if (decoded) {
+            decoded->push_back(codePoint);
+        }
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(TextScanTest, NamesAKernel) {
+    const std::string name = textScanKernel();
+    EXPECT_TRUE(name == "avx2" || name == "sse2" || name == "neon" || name == "scalar") << name;
+}
+
+TEST(TextScanTest, FindsNewlinesAtEveryLengthAndAlignment) {
+    std::mt19937 rng(7);
+    for (size_t length = 0; length < 300; ++length) {
+        std::string text(length + 3, 'a');
+        for (char& c : text) {
+            c = rng() % 5 == 0 ? '\n' : 'a';
+        }
+        // Start at each offset so blocks begin unaligned
+        for (size_t start = 0; start < 3; ++start) {
+            const std::string slice = text.substr(start, length);
+            std::vector<uint64_t> offsets = {42};
+            findNewlines(slice, 100, offsets);
+            std::vector<uint64_t> expected = referenceNewlines(slice, 100);
+            expected.insert(expected.begin(), 42);
+            ASSERT_EQ(offsets, expected) << "length " << length;
+            ASSERT_EQ(countNewlines(slice), expected.size() - 1);
+        }
+    }
+}
+
+TEST(TextScanTest, CountsNewlinesPastTheCounterWidth) {
+    // More than 255 blocks of newlines, so the byte counters must be flushed
+    const std::string text(100'000, '\n');
+    EXPECT_EQ(countNewlines(text), text.size());
+    std::vector<uint64_t> offsets;
+    findNewlines(text, 0, offsets);
+    ASSERT_EQ(offsets.size(), text.size());
+    EXPECT_EQ(offsets.back(), text.size() - 1);
+}
+
+TEST(TextScanTest, AcceptsValidUtf8) {
+    EXPECT_TRUE(validUtf8(""));
+    EXPECT_TRUE(validUtf8("plain ascii"));
+    EXPECT_TRUE(validUtf8("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+    EXPECT_TRUE(validUtf8("\xed\x9f\xbf"));          // U+D7FF, just below the surrogates
+    EXPECT_TRUE(validUtf8("\xee\x80\x80"));          // U+E000, just above them
+    EXPECT_TRUE(validUtf8("\xf4\x8f\xbf\xbf"));      // U+10FFFF
+    EXPECT_TRUE(validUtf8(std::string(1, '\0')));
+
+    std::mt19937 rng(11);
+    for (size_t codePoints = 0; codePoints < 200; ++codePoints) {
+        const std::string text = randomText(rng, codePoints);
+        ASSERT_TRUE(validUtf8(text)) << "code points " << codePoints;
+    }
+}
+
+TEST(TextScanTest, RejectsMalformedUtf8) {
+    EXPECT_FALSE(validUtf8("\x80"));                 // Lone continuation
+    EXPECT_FALSE(validUtf8("\xc3"));                 // Truncated
+    EXPECT_FALSE(validUtf8("\xe2\x82"));
+    EXPECT_FALSE(validUtf8("\xf0\x9f\x98"));
+    EXPECT_FALSE(validUtf8("\xc3\x28"));             // Lead followed by ASCII
+    EXPECT_FALSE(validUtf8("\xc0\xaf"));             // Overlong two-byte
+    EXPECT_FALSE(validUtf8("\xc1\xbf"));
+    EXPECT_FALSE(validUtf8("\xe0\x9f\xbf"));         // Overlong three-byte
+    EXPECT_FALSE(validUtf8("\xf0\x8f\xbf\xbf"));     // Overlong four-byte
+    EXPECT_FALSE(validUtf8("\xed\xa0\x80"));         // U+D800
+    EXPECT_FALSE(validUtf8("\xed\xbf\xbf"));         // U+DFFF
+    EXPECT_FALSE(validUtf8("\xf4\x90\x80\x80"));     // U+110000
+    EXPECT_FALSE(validUtf8("\xf5\x80\x80\x80"));
+    EXPECT_FALSE(validUtf8("\xff"));
+    EXPECT_FALSE(validUtf8("\xf8\x88\x80\x80\x80")); // Five-byte form
+}
+
+TEST(TextScanTest, RejectsErrorsAtEveryPosition) {
+    // An error in any block, or split across two, is caught
+    static const std::string BAD[] = {"\x80", "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xed\xa0\x80",
+                                      "\xc0\x80", "\xf4\x90\x80\x80", "\xe0\x80\x80"};
+    const std::string padding(80, 'a');
+    for (const std::string& bad : BAD) {
+        for (size_t at = 0; at <= 70; ++at) {
+            std::string text = padding.substr(0, at) + bad + padding.substr(0, 70 - at);
+            ASSERT_FALSE(validUtf8(text)) << "at " << at;
+            // And at the very end, where a truncated sequence is only too short
+            ASSERT_FALSE(validUtf8(padding.substr(0, at) + bad)) << "at end " << at;
+        }
+    }
+}
+
+TEST(TextScanTest, AgreesWithReferenceOnRandomBytes) {
+    std::mt19937 rng(23);
+    for (int round = 0; round < 3000; ++round) {
+        // Mostly valid text with a few bytes flipped, so errors land near real sequences
+        std::string text = randomText(rng, rng() % 120);
+        const int flips = static_cast<int>(rng() % 3);
+        for (int i = 0; i < flips && !text.empty(); ++i) {
+            text[rng() % text.size()] = static_cast<char>(rng());
+        }
+        ASSERT_EQ(validUtf8(text), referenceValid(text)) << "round " << round;
+    }
+}
+
+TEST(TextScanTest, MeasuresCodePointsAndUtf16) {
+    EXPECT_EQ(countCodePoints(""), 0u);
+    EXPECT_EQ(countCodePoints("caf\xc3\xa9"), 4u);
+    EXPECT_EQ(utf16Length("caf\xc3\xa9"), 4u);
+    EXPECT_EQ(countCodePoints("\xf0\x9f\x98\x80"), 1u);
+    EXPECT_EQ(utf16Length("\xf0\x9f\x98\x80"), 2u);
+
+    std::mt19937 rng(5);
+    for (size_t codePoints : {0u, 1u, 31u, 32u, 33u, 500u, 5000u}) {
+        std::vector<uint32_t> decoded;
+        const std::string text = randomText(rng, codePoints, &decoded);
+        size_t units = 0;
+        for (uint32_t codePoint : decoded) {
+            units += codePoint > 0xFFFF ? 2 : 1;
+        }
+        EXPECT_EQ(countCodePoints(text), codePoints);
+        EXPECT_EQ(utf16Length(text), units);
+    }
+}
+
+TEST(TextScanTest, ConvertsOffsets) {
+    std::mt19937 rng(3);
+    std::vector<uint32_t> decoded;
+    // Long enough that conversion skips whole chunks before the scalar finish
+    const std::string text = randomText(rng, 3000, &decoded);
+
+    size_t byte = 0;
+    size_t units = 0;
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        ASSERT_EQ(byteOffsetOfCodePoint(text, i), byte) << "code point " << i;
+        ASSERT_EQ(byteOffsetOfUtf16(text, units), byte) << "unit " << units;
+        ASSERT_EQ(codePointOffsetOfByte(text, byte), i);
+        ASSERT_EQ(utf16OffsetOfByte(text, byte), units);
+        if (decoded[i] > 0xFFFF) {
+            // Inside the surrogate pair maps to the start of the character
+            ASSERT_EQ(byteOffsetOfUtf16(text, units + 1), byte);
+            units += 2;
+        } else {
+            units += 1;
+        }
+        byte += encode(decoded[i]).size();
+    }
+    EXPECT_EQ(byteOffsetOfCodePoint(text, decoded.size()), text.size());
+    EXPECT_EQ(byteOffsetOfUtf16(text, units), text.size());
+    EXPECT_EQ(byteOffsetOfUtf16(text, units + 10), text.size());
+}
+
+TEST(TextScanTest, FindsCommonPrefixAndSuffix) {
+    EXPECT_EQ(commonPrefixLength("", "abc"), 0u);
+    EXPECT_EQ(commonPrefixLength("abc", "abd"), 2u);
+    EXPECT_EQ(commonSuffixLength("xbc", "abc"), 2u);
+    EXPECT_EQ(commonSuffixLength("abc", "bc"), 2u);
+
+    // A difference at every position of texts long enough to span several blocks
+    const std::string text(200, 'a');
+    for (size_t length : {0u, 1u, 15u, 16u, 17u, 31u, 32u, 33u, 64u, 199u}) {
+        const std::string a = text.substr(0, length);
+        ASSERT_EQ(commonPrefixLength(a, a), length);
+        ASSERT_EQ(commonSuffixLength(a, a + "b"), 0u);
+        ASSERT_EQ(commonSuffixLength(a, "b" + a), length);
+        for (size_t at = 0; at < length; ++at) {
+            std::string b = a;
+            b[at] = 'b';
+            ASSERT_EQ(commonPrefixLength(a, b), at) << "length " << length;
+            ASSERT_EQ(commonSuffixLength(a, b), length - 1 - at) << "length " << length;
+            // Offset one side so the blocks compare unaligned
+            ASSERT_EQ(commonSuffixLength("z" + a, b), length - 1 - at);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "common/util/thread_profiler.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace collab::util;
+
+namespace {
+
+std::atomic<bool> spinning{true};
+
+__attribute__((noinline)) uint64_t spinForProfile() {
+    uint64_t value = 1;
+    while (spinning.load(std::memory_order_relaxed)) {
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return value;
+}
+
+} // namespace
+
+TEST(ThreadProfilerTest, SamplesRegisteredThreadsByRole) {
+    spinning = true;
+    std::atomic<bool> named{false};
+    std::string threadName;
+    std::thread busy([&] {
+        nameCurrentThread("spin", 0);
+#ifdef __linux__
+        char name[16] = {};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        threadName = name;
+#endif
+        named = true;
+        spinForProfile();
+    });
+    while (!named) {
+        std::this_thread::yield();
+    }
+
+#ifdef __linux__
+    EXPECT_EQ(threadName, "spin-0");
+    const auto profile = profiler().capture(std::chrono::milliseconds(300), 997);
+    spinning = false;
+    busy.join();
+
+    EXPECT_GT(profile.samples, 10u);
+    EXPECT_EQ(profile.dropped, 0u);
+    const std::string spin = profile.collapsed("spin");
+    ASSERT_FALSE(spin.empty());
+    // Every line is the thread, its frames and a count
+    EXPECT_EQ(spin.rfind("spin-0;", 0), 0u);
+    EXPECT_NE(spin.find(" "), std::string::npos);
+    EXPECT_NE(profile.collapsed().find("spin;spin-0;"), std::string::npos);
+    EXPECT_TRUE(profile.collapsed("nobody").empty());
+
+    // One profile at a time, and nothing to stop once it is done
+    profiler().start();
+    EXPECT_THROW(profiler().start(), std::runtime_error);
+    profiler().stop();
+    EXPECT_THROW(profiler().stop(), std::runtime_error);
+    EXPECT_THROW(profiler().start(0), std::invalid_argument);
+#else
+    EXPECT_THROW(profiler().start(), std::runtime_error);
+    spinning = false;
+    busy.join();
+#endif
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include "common/util/timer_wheel.h"
+#include <chrono>
+#include <vector>
+
+using namespace collab::util;
+using namespace std::chrono_literals;
+
+TEST(TimerWheelTest, FiresOnTheTickOfTheDeadline) {
+    const auto start = TimerWheel::Clock::time_point{} + 1h;
+    TimerWheel wheel(1s, start);
+    std::vector<int> fired;
+    wheel.schedule(start + 3s, [&]() { fired.push_back(3); });
+    wheel.schedule(start + 1500ms, [&]() { fired.push_back(2); });
+    wheel.schedule(start + 1s, [&]() { fired.push_back(1); });
+
+    EXPECT_EQ(wheel.advance(start + 999ms), 0u);
+    EXPECT_EQ(wheel.advance(start + 1s), 1u);
+    // Rounded up to the next whole tick, never early
+    EXPECT_EQ(wheel.advance(start + 1999ms), 0u);
+    EXPECT_EQ(wheel.advance(start + 10s), 2u);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, CascadesFarDeadlinesDownTheLevels) {
+    const auto start = TimerWheel::Clock::time_point{};
+    TimerWheel wheel(1s, start);
+    // One per level, plus one past the top level's range
+    const std::vector<TimerWheel::Clock::duration> delays{
+        200s, 300s, 70000s, 20000000s, std::chrono::seconds(uint64_t{1} << 33)};
+    std::vector<TimerWheel::Clock::time_point> firedAt;
+    for (const auto& delay : delays) {
+        wheel.schedule(start + delay, [&]() { firedAt.push_back(wheel.now()); });
+    }
+
+    for (size_t i = 0; i < delays.size(); ++i) {
+        wheel.advance(start + delays[i] - 1s);
+        EXPECT_EQ(firedAt.size(), i);
+        wheel.advance(start + delays[i]);
+        ASSERT_EQ(firedAt.size(), i + 1);
+        EXPECT_EQ(firedAt[i], start + delays[i]);
+    }
+}
+
+TEST(TimerWheelTest, ReschedulesAndCancels) {
+    const auto start = TimerWheel::Clock::time_point{};
+    TimerWheel wheel(100ms, start);
+    int idle = 0;
+    int heartbeats = 0;
+    const auto idleTimer = wheel.schedule(start + 1s, [&]() { ++idle; });
+    // A heartbeat that schedules the next one from its callback
+    std::function<void()> beat = [&]() {
+        ++heartbeats;
+        wheel.scheduleAfter(300ms, beat);
+    };
+    wheel.scheduleAfter(300ms, beat);
+
+    // Activity pushes the idle deadline back
+    wheel.advance(start + 900ms);
+    EXPECT_TRUE(wheel.reschedule(idleTimer, start + 2s));
+    wheel.advance(start + 1900ms);
+    EXPECT_EQ(idle, 0);
+    EXPECT_EQ(heartbeats, 6);
+
+    EXPECT_TRUE(wheel.cancel(idleTimer));
+    EXPECT_FALSE(wheel.cancel(idleTimer));
+    EXPECT_FALSE(wheel.reschedule(idleTimer, start + 3s));
+    wheel.advance(start + 5s);
+    EXPECT_EQ(idle, 0);
+    EXPECT_EQ(wheel.size(), 1u);
+}
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include "common/util/uuid_generator.h"
+#include <cctype>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace collab::util;
+
+TEST(UuidGeneratorTest, FormatsVersion4Uuids) {
+    const std::string text = UuidGenerator::getInstance().generateUuid();
+    ASSERT_EQ(text.size(), Uuid::TEXT_SIZE);
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            EXPECT_EQ(text[i], '-');
+        } else {
+            EXPECT_TRUE(std::isxdigit(static_cast<unsigned char>(text[i]))) << text;
+        }
+    }
+    EXPECT_EQ(text[14], '4');
+    EXPECT_NE(std::string("89ab").find(text[19]), std::string::npos) << text;
+}
+
+TEST(UuidGeneratorTest, RoundTripsThroughText) {
+    const Uuid uuid{0x0123456789abcdefULL, 0xfedcba9876543210ULL};
+    EXPECT_EQ(uuid.toString(), "01234567-89ab-cdef-fedc-ba9876543210");
+    EXPECT_EQ(Uuid::fromString("01234567-89AB-CDEF-FEDC-BA9876543210"), uuid);
+
+    const Uuid generated = UuidGenerator::getInstance().generate();
+    EXPECT_EQ(Uuid::fromString(generated.toString()), generated);
+    EXPECT_FALSE(generated.isNil());
+
+    EXPECT_FALSE(Uuid::fromString("01234567-89ab-cdef-fedc-ba987654321"));
+    EXPECT_FALSE(Uuid::fromString("01234567x89ab-cdef-fedc-ba9876543210"));
+    EXPECT_FALSE(Uuid::fromString("0123456g-89ab-cdef-fedc-ba9876543210"));
+}
+
+TEST(UuidGeneratorTest, ThreadsGenerateDistinctIds) {
+    constexpr int THREADS = 4;
+    constexpr int PER_THREAD = 10000;
+    std::unordered_set<Uuid> ids;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&]() {
+            std::vector<Uuid> local;
+            for (int i = 0; i < PER_THREAD; ++i) {
+                local.push_back(UuidGenerator::getInstance().generate());
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.insert(local.begin(), local.end());
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(ids.size(), static_cast<size_t>(THREADS * PER_THREAD));
+}
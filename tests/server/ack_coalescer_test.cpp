@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include "server/session/ack_coalescer.h"
+
+using namespace collab;
+using namespace collab::server;
+
+TEST(AckCoalescerTest, FoldsEditsIntoOneAckPerDocument) {
+    AckCoalescer acks;
+    EXPECT_TRUE(acks.empty());
+
+    // Only the first acknowledgement asks for a flush
+    EXPECT_TRUE(acks.acknowledge("doc", 1, 10, 0xaa));
+    EXPECT_FALSE(acks.acknowledge("doc", 2, 11, 0xbb));
+    EXPECT_FALSE(acks.acknowledge("other", 7, 3));
+    EXPECT_FALSE(acks.acknowledge("doc", 3, 12, 0xcc));
+
+    auto sent = acks.take();
+    ASSERT_EQ(sent.size(), 2u);
+    EXPECT_EQ(sent[0].type, protocol::MessageType::EDIT_APPLY);
+    EXPECT_EQ(sent[0].documentId, "doc");
+    EXPECT_EQ(sent[0].sequenceNumber, 3u);
+    EXPECT_EQ(sent[0].documentVersion, 12u);
+    EXPECT_EQ(sent[0].contentHash, 0xccu);
+    EXPECT_EQ(sent[0].success, true);
+    EXPECT_EQ(sent[1].documentId, "other");
+    EXPECT_EQ(sent[1].sequenceNumber, 7u);
+    EXPECT_FALSE(sent[1].contentHash);
+
+    EXPECT_TRUE(acks.empty());
+    EXPECT_EQ(acks.getAcknowledged(), 4u);
+    EXPECT_EQ(acks.getSent(), 2u);
+}
+
+TEST(AckCoalescerTest, NeverMovesBackwards) {
+    AckCoalescer acks;
+    acks.acknowledge("doc", 5, 20, 0x20);
+    // Acknowledged out of order, e.g. once durable, an older edit does not take the ack back
+    acks.acknowledge("doc", 4, 19, 0x19);
+
+    auto sent = acks.take();
+    ASSERT_EQ(sent.size(), 1u);
+    EXPECT_EQ(sent[0].sequenceNumber, 5u);
+    EXPECT_EQ(sent[0].documentVersion, 20u);
+    EXPECT_EQ(sent[0].contentHash, 0x20u);
+
+    // A new flush starts over
+    EXPECT_TRUE(acks.acknowledge("doc", 6, 21));
+    EXPECT_EQ(acks.take().size(), 1u);
+}
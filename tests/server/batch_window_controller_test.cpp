@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include "server/session/batch_window_controller.h"
+#include <chrono>
+
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+BatchWindowController::Config testConfig() {
+    BatchWindowController::Config config;
+    config.slo = 100ms;
+    config.idleRate = 1.0;
+    config.busyRate = 11.0;
+    return config;
+}
+
+} // namespace
+
+TEST(BatchWindowControllerTest, GrowsTheWindowWithLoadUpToTheCap) {
+    LoadTracker load(8, std::chrono::hours(1));
+    BatchWindowController controller(load, testConfig());
+    const auto presence = controller.addWindow("presence", 50ms);
+    const auto view = controller.addWindow("view", 250ms);
+
+    // A window longer than the SLO is held to it
+    EXPECT_EQ(controller.cap(presence), 50ms);
+    EXPECT_EQ(controller.cap(view), 100ms);
+
+    EXPECT_EQ(controller.windowAt(view, 0.0), 0ms);
+    EXPECT_EQ(controller.windowAt(view, 1.0), 0ms);
+    EXPECT_EQ(controller.windowAt(view, 6.0), 50ms);
+    EXPECT_EQ(controller.windowAt(view, 11.0), 100ms);
+    EXPECT_EQ(controller.windowAt(view, 500.0), 100ms);
+
+    // Rates come from the load tracker, per document
+    const auto start = LoadTracker::Clock::now();
+    load.rollWindow(start);
+    for (int i = 0; i < 30; ++i) {
+        load.recordOperation("busy", "alice", 10);
+    }
+    load.recordOperation("quiet", "bob", 10);
+    load.rollWindow(start + 5s);
+    EXPECT_EQ(controller.window(presence, "busy"), 25ms);
+    EXPECT_EQ(controller.window(presence, "quiet"), 0ms);
+    EXPECT_EQ(controller.window(presence, "unknown"), 0ms);
+}
+
+TEST(BatchWindowControllerTest, BacksOffWhenLatencyExceedsTheSlo) {
+    LoadTracker load;
+    collab::util::Histogram latency;
+    BatchWindowController controller(load, testConfig());
+    const auto id = controller.addWindow("view", 80ms, &latency, collab::util::MICROSECONDS_PER_SECOND);
+
+    // Nothing recorded leaves the cap alone
+    controller.update();
+    EXPECT_EQ(controller.cap(id), 80ms);
+
+    // A slow p99 halves it, each update that sees one
+    for (int i = 0; i < 100; ++i) {
+        latency.record(i < 95 ? 10'000 : 400'000);
+    }
+    controller.update();
+    EXPECT_EQ(controller.cap(id), 40ms);
+    for (int i = 0; i < 100; ++i) {
+        latency.record(i < 95 ? 10'000 : 400'000);
+    }
+    controller.update();
+    EXPECT_EQ(controller.cap(id), 20ms);
+
+    // Only what was recorded since the last update counts, so fast edits grow it back in steps
+    for (int step = 0; step < 10; ++step) {
+        latency.record(5'000);
+        controller.update();
+    }
+    EXPECT_EQ(controller.cap(id), 80ms);
+
+    // Between half the SLO and the SLO it holds
+    controller.addWindow("other", 10ms);
+    latency.record(70'000);
+    controller.update();
+    EXPECT_EQ(controller.cap(id), 80ms);
+
+    const nlohmann::json report = controller.report();
+    EXPECT_DOUBLE_EQ(report["sloSeconds"].get<double>(), 0.1);
+    ASSERT_EQ(report["windows"].size(), 2u);
+    EXPECT_EQ(report["windows"][0]["name"], "view");
+    EXPECT_NEAR(report["windows"][0]["observedSeconds"].get<double>(), 0.07, 0.003);
+}
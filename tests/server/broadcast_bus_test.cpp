@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "server/session/broadcast_bus.h"
+
+using namespace collab::server;
+
+namespace {
+
+BusFrame makeFrame(const std::string& topic, const std::string& origin, const std::string& text,
+                   const std::string& key = "") {
+    return {topic, origin, key, std::make_shared<const std::string>(text)};
+}
+
+// What each node's handler received, one entry per batch
+struct Received {
+    std::map<std::string, std::vector<std::vector<std::string>>> batches;
+
+    BroadcastBus::Handler handlerFor(const std::string& node) {
+        return [this, node](const std::vector<BusFrame>& frames) {
+            std::vector<std::string> texts;
+            for (const auto& frame : frames) {
+                texts.push_back(*frame.payload);
+            }
+            batches[node].push_back(std::move(texts));
+        };
+    }
+};
+
+} // namespace
+
+TEST(BusOutboxTest, CoalescesByKeyInPlace) {
+    BusOutbox outbox;
+    EXPECT_TRUE(outbox.add("b", makeFrame("doc", "a", "cursor 1", "alice")));
+    EXPECT_TRUE(outbox.add("b", makeFrame("doc", "a", "edit")));
+    EXPECT_FALSE(outbox.add("b", makeFrame("doc", "a", "cursor 2", "alice")));
+    EXPECT_TRUE(outbox.add("c", makeFrame("doc", "a", "cursor 3", "alice")));
+
+    auto batches = outbox.take();
+    EXPECT_TRUE(outbox.empty());
+    std::map<std::string, std::vector<std::string>> byNode;
+    for (auto& [node, frames] : batches) {
+        for (const auto& frame : frames) {
+            byNode[node].push_back(*frame.payload);
+        }
+    }
+    EXPECT_EQ(byNode["b"], (std::vector<std::string>{"cursor 2", "edit"}));
+    EXPECT_EQ(byNode["c"], (std::vector<std::string>{"cursor 3"}));
+}
+
+TEST(InProcessBusTest, DeliversOneBatchPerSubscribedNode) {
+    InProcessBus bus;
+    Received received;
+    for (const std::string node : {"a", "b", "c"}) {
+        bus.attach(node, received.handlerFor(node));
+    }
+    bus.subscribe("b", "notes");
+    bus.subscribe("c", "other");
+
+    bus.publish(makeFrame("notes", "a", "first"));
+    bus.publish(makeFrame("notes", "a", "second"));
+    bus.publish(makeFrame("", "a", "everyone"));
+    bus.publish(makeFrame("notes", "b", "from b"));
+    EXPECT_TRUE(received.batches.empty());
+    bus.flush();
+
+    // The origin never hears itself; b got its document and the empty topic in one batch
+    EXPECT_TRUE(received.batches["a"].empty());
+    EXPECT_EQ(received.batches["b"], (std::vector<std::vector<std::string>>{{"first", "second", "everyone"}}));
+    EXPECT_EQ(received.batches["c"], (std::vector<std::vector<std::string>>{{"everyone"}}));
+
+    // Unsubscribed and detached nodes get nothing more
+    bus.unsubscribe("b", "notes");
+    bus.detach("c");
+    bus.publish(makeFrame("notes", "a", "third"));
+    bus.publish(makeFrame("", "a", "again"));
+    bus.flush();
+    EXPECT_EQ(received.batches["b"].back(), std::vector<std::string>{"again"});
+    EXPECT_EQ(received.batches["c"].size(), 1u);
+
+    const InProcessBus::Stats stats = bus.getStats();
+    EXPECT_EQ(stats.published, 6u);
+    EXPECT_EQ(stats.batches, 3u);
+    EXPECT_EQ(stats.delivered, 5u);
+}
+
+TEST(InProcessBusTest, KeepsOnlyTheLatestCursorPerUser) {
+    InProcessBus bus;
+    Received received;
+    bus.attach("a", received.handlerFor("a"));
+    bus.attach("b", received.handlerFor("b"));
+    bus.subscribe("b", "notes");
+
+    for (int i = 0; i < 10; ++i) {
+        bus.publish(makeFrame("notes", "a", "alice " + std::to_string(i), "cursor/notes/alice"));
+        bus.publish(makeFrame("notes", "a", "bob " + std::to_string(i), "cursor/notes/bob"));
+    }
+    bus.flush();
+    EXPECT_EQ(received.batches["b"], (std::vector<std::vector<std::string>>{{"alice 9", "bob 9"}}));
+    EXPECT_EQ(bus.getStats().coalesced, 18u);
+}
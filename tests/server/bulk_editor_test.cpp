@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "server/session/bulk_editor.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+struct Document {
+    explicit Document(const std::string& content)
+        : document(content) {}
+
+    DocumentController document;
+    OperationManager operations;
+};
+
+protocol::EditMessage makeEdit(protocol::MessageType type, const std::string& documentId, size_t position,
+                               size_t length, const std::string& text, uint64_t version = 0) {
+    protocol::EditMessage edit(type);
+    edit.documentId = documentId;
+    edit.documentVersion = version;
+    edit.position = position;
+    if (type != protocol::MessageType::EDIT_INSERT) {
+        edit.length = length;
+    }
+    if (type != protocol::MessageType::EDIT_DELETE) {
+        edit.text = text;
+    }
+    return edit;
+}
+
+// An editor over a set of documents, keeping what it broadcast
+struct Fixture {
+    std::map<std::string, std::unique_ptr<Document>> documents;
+    std::vector<std::string> broadcast;
+    BulkEditor editor{
+        [this](const std::string& documentId) -> std::optional<BulkEditor::Target> {
+            auto it = documents.find(documentId);
+            if (it == documents.end()) {
+                return std::nullopt;
+            }
+            return BulkEditor::Target{&it->second->document, &it->second->operations, 0};
+        },
+        [this](const std::string& documentId, const std::string&, const ot::OperationPtr&, uint64_t version) {
+            broadcast.push_back(documentId + "@" + std::to_string(version));
+        }};
+
+    std::vector<protocol::EditMessage> apply(const protocol::BatchMessage& request) {
+        std::vector<protocol::EditMessage> results;
+        editor.apply("bot", request, [&results](const protocol::EditMessage& result) { results.push_back(result); });
+        return results;
+    }
+};
+
+} // namespace
+
+TEST(BulkEditorTest, AppliesEachDocumentAsOneOperation) {
+    using protocol::MessageType;
+    Fixture fixture;
+    fixture.documents["a.txt"] = std::make_unique<Document>("hello world");
+    fixture.documents["b.txt"] = std::make_unique<Document>("foo bar foo");
+
+    // Someone else edited b.txt since the bot read it
+    Document& b = *fixture.documents["b.txt"];
+    ASSERT_TRUE(b.document.applyOperation(ot::ValueOperation{ot::InsertOp{0, ">"}}, "alice"));
+    b.operations.recordOperation(ot::ValueOperation{ot::InsertOp{0, ">"}});
+
+    protocol::BatchMessage request(MessageType::EDIT_BULK);
+    request.sequenceNumber = 7;
+    request.add(makeEdit(MessageType::EDIT_REPLACE, "a.txt", 0, 5, "HELLO"));
+    request.add(makeEdit(MessageType::EDIT_REPLACE, "b.txt", 0, 3, "baz"));
+    request.add(makeEdit(MessageType::EDIT_INSERT, "a.txt", 11, 0, "!"));
+    request.add(makeEdit(MessageType::EDIT_REPLACE, "b.txt", 8, 3, "baz"));
+
+    const auto results = fixture.apply(request);
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0].type, MessageType::EDIT_APPLY);
+    EXPECT_EQ(results[0].documentId, "a.txt");
+    EXPECT_EQ(results[0].documentVersion, 1u);
+    EXPECT_EQ(results[0].sequenceNumber, 7u);
+    EXPECT_EQ(results[1].documentId, "b.txt");
+    EXPECT_EQ(results[1].documentVersion, 2u);
+
+    Document& a = *fixture.documents["a.txt"];
+    EXPECT_EQ(a.document.getDocument(), "HELLO world!");
+    EXPECT_EQ(b.document.getDocument(), ">baz bar baz");
+    EXPECT_EQ(b.operations.getCurrentRevision(), 2);
+    EXPECT_EQ(fixture.broadcast, (std::vector<std::string>{"a.txt@1", "b.txt@2"}));
+
+    // One history entry: one undo takes all of a document's edits back
+    ASSERT_TRUE(a.document.undo("bot"));
+    EXPECT_EQ(a.document.getDocument(), "hello world");
+    EXPECT_FALSE(a.document.canUndo("bot"));
+
+    const BulkEditor::Stats stats = fixture.editor.getStats();
+    EXPECT_EQ(stats.documentsApplied, 2u);
+    EXPECT_EQ(stats.editsApplied, 4u);
+}
+
+TEST(BulkEditorTest, RejectsADocumentWholeAndAppliesTheRest) {
+    using protocol::MessageType;
+    Fixture fixture;
+    fixture.documents["a.txt"] = std::make_unique<Document>("hello world");
+    fixture.documents["b.txt"] = std::make_unique<Document>("header: body");
+    fixture.documents["c.txt"] = std::make_unique<Document>("text");
+    fixture.documents["b.txt"]->operations.addRegion(0, 7, ot::RegionSet::READ_ONLY, "header");
+
+    protocol::BatchMessage request(MessageType::EDIT_BULK);
+    request.add(makeEdit(MessageType::EDIT_INSERT, "a.txt", 0, 0, "x"));
+    request.add(makeEdit(MessageType::EDIT_DELETE, "a.txt", 50, 3, ""));
+    request.add(makeEdit(MessageType::EDIT_INSERT, "b.txt", 12, 0, "!"));
+    request.add(makeEdit(MessageType::EDIT_DELETE, "b.txt", 0, 2, ""));
+    request.add(makeEdit(MessageType::EDIT_INSERT, "missing.txt", 0, 0, "x"));
+    request.add(makeEdit(MessageType::EDIT_INSERT, "c.txt", 4, 0, "!"));
+
+    const auto results = fixture.apply(request);
+    ASSERT_EQ(results.size(), 4u);
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(results[i].type, MessageType::EDIT_REJECT) << results[i].documentId;
+        EXPECT_FALSE(results[i].success.value_or(true));
+    }
+    EXPECT_EQ(results[1].errorMessage, "Edits a read-only region: header");
+    EXPECT_EQ(results[3].type, MessageType::EDIT_APPLY);
+    EXPECT_EQ(fixture.documents["a.txt"]->document.getDocument(), "hello world");
+    EXPECT_EQ(fixture.documents["b.txt"]->document.getDocument(), "header: body");
+    EXPECT_EQ(fixture.documents["c.txt"]->document.getDocument(), "text!");
+    EXPECT_EQ(fixture.broadcast, (std::vector<std::string>{"c.txt@1"}));
+
+    // Anything but edits fails the request as a whole
+    protocol::BatchMessage mixed(MessageType::EDIT_BULK);
+    mixed.add(makeEdit(MessageType::EDIT_INSERT, "c.txt", 0, 0, "x"));
+    mixed.add(protocol::Message(MessageType::SYS_HEARTBEAT));
+    const auto rejected = fixture.apply(mixed);
+    ASSERT_EQ(rejected.size(), 1u);
+    EXPECT_TRUE(rejected[0].documentId.empty());
+    EXPECT_EQ(fixture.documents["c.txt"]->document.getDocument(), "text!");
+    EXPECT_EQ(fixture.editor.getStats().documentsRejected, 3u);
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "server/session/cluster_membership.h"
+
+using namespace collab::server;
+
+namespace {
+
+std::vector<std::string> makeDocuments(size_t count) {
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back("workspace/doc" + std::to_string(i) + ".txt");
+    }
+    return ids;
+}
+
+std::vector<ClusterNode> makeNodes(size_t count) {
+    std::vector<ClusterNode> nodes;
+    for (size_t i = 0; i < count; ++i) {
+        nodes.push_back({"node" + std::to_string(i), "10.0.0." + std::to_string(i) + ":12345"});
+    }
+    return nodes;
+}
+
+} // namespace
+
+TEST(HashRingTest, SpreadsDocumentsEvenlyAndTheSameEverywhere) {
+    const HashRing ring(makeNodes(4));
+    const HashRing again(makeNodes(4));
+    std::map<std::string, size_t> owned;
+    for (const auto& id : makeDocuments(20000)) {
+        const ClusterNode* owner = ring.ownerOf(id);
+        ASSERT_NE(owner, nullptr);
+        EXPECT_EQ(owner->id, again.ownerOf(id)->id);
+        owned[owner->id]++;
+    }
+    ASSERT_EQ(owned.size(), 4u);
+    for (const auto& [node, count] : owned) {
+        EXPECT_GT(count, 20000u / 4 * 7 / 10) << node;
+        EXPECT_LT(count, 20000u / 4 * 13 / 10) << node;
+    }
+
+    EXPECT_EQ(HashRing().ownerOf("doc"), nullptr);
+    EXPECT_EQ(HashRing::hash("doc"), HashRing::hash(std::string("doc")));
+}
+
+TEST(HashRingTest, JoinAndLeaveMoveOnlyTheirOwnShare) {
+    const std::vector<std::string> documents = makeDocuments(20000);
+    std::vector<ClusterNode> nodes = makeNodes(4);
+    const HashRing before(nodes);
+    nodes.push_back({"node4", "10.0.0.4:12345"});
+    const HashRing after(nodes);
+
+    // Every move goes to the node that joined, and it takes about a fifth
+    const auto joined = ClusterMembership::moves(documents, before, after);
+    for (const auto& move : joined) {
+        EXPECT_EQ(move.to.id, "node4");
+    }
+    EXPECT_GT(joined.size(), documents.size() / 5 * 7 / 10);
+    EXPECT_LT(joined.size(), documents.size() / 5 * 13 / 10);
+
+    // Leaving gives back exactly those, each to the node it came from
+    const auto left = ClusterMembership::moves(documents, after, before);
+    ASSERT_EQ(left.size(), joined.size());
+    for (size_t i = 0; i < left.size(); ++i) {
+        EXPECT_EQ(left[i].documentId, joined[i].documentId);
+        EXPECT_EQ(left[i].from.id, "node4");
+        EXPECT_EQ(left[i].to.id, joined[i].from.id);
+    }
+}
+
+TEST(ClusterMembershipTest, NewerViewsSpreadAndOldOnesAreIgnored) {
+    ClusterMembership seed({"a", "a:1"});
+    ClusterMembership joiner({"b", "b:1"});
+    EXPECT_TRUE(joiner.ownsLocally("anything"));
+
+    // b asks a to join it, then takes the view a sends back
+    EXPECT_TRUE(seed.join(joiner.self()));
+    EXPECT_FALSE(seed.join(joiner.self()));
+    EXPECT_TRUE(joiner.merge(ClusterMembership::fromJson(ClusterMembership::toJson(seed.getView()))));
+    EXPECT_FALSE(joiner.merge(seed.getView()));
+    EXPECT_EQ(joiner.getView().epoch, 1u);
+    EXPECT_EQ(joiner.ring()->size(), 2u);
+
+    for (const auto& id : makeDocuments(100)) {
+        EXPECT_EQ(seed.ownerOf(id)->id, joiner.ownerOf(id)->id);
+        EXPECT_NE(seed.ownsLocally(id), joiner.ownsLocally(id));
+    }
+
+    // Changes made at once on two nodes settle on the same view everywhere
+    ClusterMembership third({"c", "c:1"});
+    seed.join(third.self());
+    joiner.leave("a");
+    EXPECT_EQ(seed.getView().epoch, joiner.getView().epoch);
+    EXPECT_TRUE(seed.merge(joiner.getView()));
+    EXPECT_FALSE(joiner.merge(seed.getView()));
+    EXPECT_EQ(seed.getView().nodes, joiner.getView().nodes);
+    EXPECT_EQ(seed.getView().author, "b");
+
+    // A leave for a node that is not a member changes nothing
+    EXPECT_FALSE(seed.leave("z"));
+}
+
+TEST(ClusterMembershipTest, ReportsEachChangeWithTheRingsBeforeAndAfter) {
+    ClusterMembership membership({"a", "a:1"});
+    const std::vector<std::string> documents = makeDocuments(1000);
+    std::vector<size_t> moved;
+    membership.setChangeHandler([&](const HashRing& before, const HashRing& after) {
+        moved.push_back(ClusterMembership::moves(documents, before, after).size());
+        EXPECT_EQ(membership.ring()->size(), after.size());
+    });
+
+    membership.join({"b", "b:1"});
+    membership.join({"b", "b:2"});
+    membership.leave("b");
+    ASSERT_EQ(moved.size(), 3u);
+    EXPECT_GT(moved[0], 0u);
+    EXPECT_EQ(moved[1], 0u);
+    EXPECT_EQ(moved[2], moved[0]);
+    EXPECT_EQ(membership.ownerOf("doc")->address, "a:1");
+}
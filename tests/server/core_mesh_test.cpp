@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server/session/core_mesh.h"
+
+using namespace collab::server;
+using collab::network::IoEngine;
+
+TEST(CoreMeshTest, RunsTasksOnTheirCore) {
+    IoEngine engine(4);
+    CoreMesh mesh(engine);
+    engine.start();
+
+    EXPECT_EQ(mesh.currentCore(), CoreMesh::NOT_A_CORE);
+    EXPECT_LT(mesh.homeOf("document"), mesh.size());
+    EXPECT_EQ(mesh.homeOf("document"), mesh.homeOf("document"));
+
+    // From core 0 to each core, through the rings
+    std::vector<std::promise<size_t>> ran(mesh.size());
+    boost::asio::post(mesh.context(0), [&]() {
+        for (size_t core = 0; core < mesh.size(); ++core) {
+            mesh.post(core, [&mesh, &ran, core]() { ran[core].set_value(mesh.currentCore()); });
+        }
+    });
+    for (size_t core = 0; core < mesh.size(); ++core) {
+        EXPECT_EQ(ran[core].get_future().get(), core);
+    }
+    engine.stop();
+}
+
+TEST(CoreMeshTest, KeepsEachSendersOrderWhenRingsFill) {
+    constexpr int PER_CORE = 5000;
+    IoEngine engine(3);
+    // Small rings, so most tasks wait on their sender
+    CoreMesh mesh(engine, 8);
+    engine.start();
+
+    // Only core 2 touches these
+    std::vector<int> next(2, 0);
+    bool inOrder = true;
+    std::atomic<int> received{0};
+    std::promise<void> done;
+    for (size_t sender = 0; sender < 2; ++sender) {
+        boost::asio::post(mesh.context(sender), [&, sender]() {
+            for (int i = 0; i < PER_CORE; ++i) {
+                mesh.post(2, [&, sender, i]() {
+                    inOrder = inOrder && next[sender] == i;
+                    ++next[sender];
+                    if (++received == 2 * PER_CORE) {
+                        done.set_value();
+                    }
+                });
+            }
+        });
+    }
+    ASSERT_EQ(done.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    EXPECT_TRUE(inOrder);
+
+    std::promise<CoreMesh::Stats> stats;
+    boost::asio::post(mesh.context(0), [&]() { stats.set_value(mesh.getStats(0)); });
+    const CoreMesh::Stats sender = stats.get_future().get();
+    EXPECT_EQ(sender.sent, static_cast<uint64_t>(PER_CORE));
+    EXPECT_GT(sender.deferred, 0u);
+    EXPECT_GT(sender.wakeups, 0u);
+    engine.stop();
+}
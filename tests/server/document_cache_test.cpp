@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include "server/session/document_cache.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Documents "on disk", each ten characters long to begin with
+struct Storage {
+    std::map<std::string, std::string> saved;
+    int loads = 0;
+    
+    DocumentCache::Loader loader() {
+        return [this](const std::string& documentId) {
+            ++loads;
+            auto found = saved.find(documentId);
+            return std::make_shared<DocumentController>(found != saved.end() ? found->second : std::string(10, 'x'));
+        };
+    }
+    
+    DocumentCache::Saver saver() {
+        return [this](const std::string& documentId, const DocumentController& document) {
+            saved[documentId] = document.getDocument();
+        };
+    }
+};
+
+} // namespace
+
+TEST(DocumentCacheTest, LoadsOnFirstOpenAndSharesTheDocument) {
+    Storage storage;
+    DocumentCache cache(100, storage.loader(), storage.saver());
+    
+    auto first = cache.open("a");
+    auto second = cache.open("a");
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(storage.loads, 1);
+    EXPECT_EQ(cache.find("b"), nullptr);
+    
+    const DocumentCache::Stats stats = cache.getStats();
+    EXPECT_EQ(stats.resident, 1u);
+    EXPECT_EQ(stats.pinned, 1u);
+    EXPECT_EQ(stats.bytes, 10u);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 1u);
+}
+
+TEST(DocumentCacheTest, EvictsTheLeastRecentlyUsedUnpinnedDocument) {
+    Storage storage;
+    DocumentCache cache(25, storage.loader(), storage.saver());
+    
+    cache.open("a");
+    cache.close("a");
+    cache.open("b");
+    cache.close("b");
+    cache.touch("a");
+    
+    // A third document outgrows the budget: b was used least recently
+    auto pinned = cache.open("c");
+    EXPECT_EQ(cache.find("b"), nullptr);
+    EXPECT_NE(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.getStats().evictions, 1u);
+    EXPECT_EQ(storage.saved.count("b"), 1u);
+    
+    // Pinned documents stay however far over budget the cache is
+    cache.setBudget(0);
+    EXPECT_EQ(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.find("c"), pinned);
+}
+
+TEST(DocumentCacheTest, ReloadsAnEvictedDocumentFromWhatWasSaved) {
+    Storage storage;
+    DocumentCache cache(1000, storage.loader(), storage.saver());
+    
+    {
+        auto document = cache.open("a");
+        ASSERT_TRUE(document->applyOperation(std::make_shared<ot::InsertOperation>(0, "edited "), "user"));
+        cache.close("a");
+    }
+    EXPECT_EQ(cache.evictIdle(0s), 1u);
+    EXPECT_EQ(cache.getStats().resident, 0u);
+    
+    auto reloaded = cache.open("a");
+    EXPECT_EQ(reloaded->getDocument(), "edited xxxxxxxxxx");
+    EXPECT_EQ(storage.loads, 2);
+}
+
+TEST(DocumentCacheTest, KeepsDocumentsInUseOrThatFailToSave) {
+    Storage storage;
+    bool failSaves = true;
+    DocumentCache cache(0, storage.loader(), [&](const std::string&, const DocumentController&) {
+        if (failSaves) {
+            throw std::runtime_error("disk full");
+        }
+    });
+    
+    auto held = cache.open("a");
+    cache.close("a");
+    EXPECT_EQ(cache.find("a"), held);  // A queued task still holds it
+    
+    held.reset();
+    cache.evictIdle(0s);
+    EXPECT_NE(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.getStats().saveFailures, 1u);
+    
+    failSaves = false;
+    EXPECT_EQ(cache.evictIdle(0s), 1u);
+    EXPECT_EQ(cache.find("a"), nullptr);
+    
+    DocumentCache failing(0, [](const std::string&) -> DocumentCache::Controller {
+        throw std::runtime_error("missing");
+    }, storage.saver());
+    EXPECT_THROW(failing.open("gone"), std::runtime_error);
+    EXPECT_EQ(failing.getStats().resident, 0u);
+}
+
+TEST(DocumentCacheTest, HibernatesIdleDocumentsWithoutClosingThem) {
+    Storage storage;
+    storage.saved["a"] = std::string(10000, 'a');
+    DocumentCache cache(1 << 20, storage.loader(), storage.saver());
+    
+    auto pinned = cache.open("a");
+    EXPECT_EQ(cache.getStats().bytes, 10000u);
+    EXPECT_EQ(cache.hibernateIdle(1h), 0u);
+    EXPECT_EQ(cache.hibernateIdle(0s), 1u);
+    
+    // Still open, only smaller
+    EXPECT_EQ(cache.find("a"), pinned);
+    EXPECT_TRUE(pinned->isHibernating());
+    EXPECT_LT(cache.getStats().bytes, 1000u);
+    EXPECT_EQ(pinned->getDocument(), storage.saved["a"]);
+}
+
+TEST(DocumentCacheTest, PrefetchesOnlyIntoRoomAndIsEvictedFirst) {
+    Storage storage;
+    DocumentCache cache(20, storage.loader(), storage.saver());
+    
+    cache.open("a");
+    cache.close("a");
+    EXPECT_TRUE(cache.prefetch("b"));
+    EXPECT_TRUE(cache.prefetch("b"));
+    EXPECT_EQ(storage.loads, 2);
+    
+    // b is colder than a, though loaded after it
+    cache.open("c");
+    EXPECT_FALSE(cache.find("b"));
+    EXPECT_TRUE(cache.find("a"));
+    
+    // At the budget nothing is prefetched
+    EXPECT_FALSE(cache.prefetch("e"));
+    EXPECT_FALSE(cache.find("e"));
+    
+    DocumentCache::Stats stats = cache.getStats();
+    EXPECT_EQ(stats.prefetches, 1);
+    EXPECT_EQ(stats.prefetchSkips, 1);
+    EXPECT_EQ(stats.prefetchHits, 0);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server/session/document_executor.h"
+
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Wait until every task posted so far has run
+void drain(DocumentExecutor& executor) {
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t queued = 0;
+        for (const auto& shard : executor.getShardStats()) {
+            queued += shard.queued;
+        }
+        if (queued == 0) {
+            return;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    FAIL() << "tasks did not finish";
+}
+
+} // namespace
+
+TEST(DocumentExecutorTest, RunsEachDocumentInOrderOnOneThread) {
+    DocumentExecutor executor(4);
+    executor.start();
+
+    std::mutex mutex;
+    std::vector<int> order;
+    std::vector<std::thread::id> threads;
+    for (int i = 0; i < 200; ++i) {
+        executor.post("doc", [&, i]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(i);
+            threads.push_back(std::this_thread::get_id());
+        });
+    }
+    drain(executor);
+
+    ASSERT_EQ(order.size(), 200u);
+    for (int i = 0; i < 200; ++i) {
+        EXPECT_EQ(order[i], i);
+        EXPECT_EQ(threads[i], threads[0]);
+    }
+}
+
+TEST(DocumentExecutorTest, RebalanceGivesAHotDocumentItsShard) {
+    DocumentExecutor executor(2);
+    // Find a cold document that hashes to the hot document's shard
+    const size_t hotShard = executor.shardOf("hot");
+    std::string cold;
+    for (int i = 0; cold.empty(); ++i) {
+        const std::string candidate = "cold-" + std::to_string(i);
+        if (executor.shardOf(candidate) == hotShard) {
+            cold = candidate;
+        }
+    }
+    executor.start();
+
+    std::atomic<int> ran{0};
+    for (int i = 0; i < 100; ++i) {
+        executor.post("hot", [&ran]() { ++ran; });
+    }
+    executor.post(cold, [&ran]() { ++ran; });
+    drain(executor);
+    EXPECT_EQ(ran, 101);
+
+    EXPECT_EQ(executor.rebalance(), 1u);
+    EXPECT_EQ(executor.shardOf("hot"), hotShard);
+    EXPECT_NE(executor.shardOf(cold), hotShard);
+
+    // Its tasks now run on another thread than the hot document's
+    std::promise<std::thread::id> hotThread;
+    std::promise<std::thread::id> coldThread;
+    executor.post("hot", [&]() { hotThread.set_value(std::this_thread::get_id()); });
+    executor.post(cold, [&]() { coldThread.set_value(std::this_thread::get_id()); });
+    EXPECT_NE(hotThread.get_future().get(), coldThread.get_future().get());
+}
+
+TEST(DocumentExecutorTest, HomesDocumentsOnThePostersNumaNode) {
+    // Two nodes sharing CPU 0, so binding works on any machine
+    const collab::util::NumaTopology topology({{0}, {0}});
+    DocumentExecutor executor(4);
+    executor.setNumaPlacement(topology);
+    executor.start();
+
+    std::thread poster([&]() {
+        topology.bindCurrentThread(1);
+        for (int i = 0; i < 20; ++i) {
+            executor.post("doc-" + std::to_string(i), []() {});
+        }
+    });
+    poster.join();
+
+    // Shards 2 and 3 are node 1's
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_GE(executor.shardOf("doc-" + std::to_string(i)), 2u);
+    }
+    drain(executor);
+    executor.stop();
+}
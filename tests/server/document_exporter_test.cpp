@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "server/session/document_exporter.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Collects an export's chunks and waits for the last
+class Collector {
+public:
+    DocumentExporter::Sink sink() {
+        return [this](const DocumentExporter::Chunk& chunk) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            EXPECT_EQ(chunk.offset, output_.size());
+            output_ += chunk.data;
+            chunks_++;
+            done_ = chunk.last;
+            changed_.notify_all();
+        };
+    }
+
+    std::string wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        EXPECT_TRUE(changed_.wait_for(lock, 5s, [this] { return done_; }));
+        return output_;
+    }
+
+    size_t chunks() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return chunks_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::string output_;
+    size_t chunks_ = 0;
+    bool done_ = false;
+};
+
+} // namespace
+
+TEST(DocumentExporterTest, FormatsEachFormatOffTheCallersThread) {
+    ThreadPool pool(2);
+    PriorityExecutor executor(pool);
+    DocumentExporter exporter(executor);
+    DocumentController document("# Title\n1. not a list <b>&</b>\n    indented\n\nwhy (not)?");
+
+    Collector markdown;
+    EXPECT_FALSE(exporter.exportDocument("notes", document, DocumentExporter::Format::Markdown, markdown.sink()));
+    EXPECT_EQ(markdown.wait(), "\\# Title  \n1\\. not a list \\<b\\>\\&\\</b\\>  \n&nbsp;&nbsp;&nbsp;&nbsp;indented  \n"
+                               "\nwhy (not)?");
+
+    Collector html;
+    exporter.exportDocument("a&b", document, DocumentExporter::Format::Html, html.sink());
+    const std::string page = html.wait();
+    EXPECT_NE(page.find("<title>a&amp;b</title>"), std::string::npos);
+    EXPECT_NE(page.find("<pre># Title\n1. not a list &lt;b&gt;&amp;&lt;/b&gt;\n"), std::string::npos);
+    EXPECT_TRUE(page.ends_with("</pre>\n</body>\n</html>\n"));
+
+    Collector pdf;
+    exporter.exportDocument("notes", document, DocumentExporter::Format::Pdf, pdf.sink());
+    const std::string file = pdf.wait();
+    EXPECT_TRUE(file.starts_with("%PDF-1.4\n"));
+    EXPECT_TRUE(file.ends_with("%%EOF\n"));
+    EXPECT_NE(file.find("(why \\(not\\)?) '"), std::string::npos);
+    // The xref points at the catalog
+    const size_t startxref = file.rfind("startxref\n");
+    const size_t xref = std::stoul(file.substr(startxref + 10));
+    EXPECT_EQ(file.substr(xref, 4), "xref");
+    const size_t catalog = std::stoul(file.substr(xref + file.substr(xref).find("65535 f \n") + 9, 10));
+    EXPECT_EQ(file.substr(catalog, 7), "1 0 obj");
+    EXPECT_EQ(exporter.getStats().exports, 3u);
+}
+
+TEST(DocumentExporterTest, CachesByRevisionAndStreamsLargeExportsInChunks) {
+    ThreadPool pool(2);
+    PriorityExecutor executor(pool);
+    DocumentExporter exporter(executor, 400 * 1024, 1024);
+    std::string text;
+    for (int line = 0; line < 2000; ++line) {
+        text += "line " + std::to_string(line) + " of a long document, long enough to wrap on a page: " +
+                std::string(line % 120, 'x') + "\n";
+    }
+    DocumentController document(text);
+
+    Collector first;
+    exporter.exportDocument("long", document, DocumentExporter::Format::Pdf, first.sink());
+    const std::string output = first.wait();
+    EXPECT_GT(first.chunks(), 10u);
+    // Room in the cache for one such export, not two
+    ASSERT_GT(output.size(), 200u * 1024);
+    ASSERT_LT(output.size(), 400u * 1024);
+    EXPECT_GT(std::count(output.begin(), output.end(), '\n'), 2000);
+
+    // The same revision again is replayed from the cache, at once
+    Collector again;
+    EXPECT_TRUE(exporter.exportDocument("long", document, DocumentExporter::Format::Pdf, again.sink()));
+    EXPECT_EQ(again.wait(), output);
+    ASSERT_NE(exporter.getCached("long", 0, DocumentExporter::Format::Pdf), nullptr);
+    EXPECT_EQ(exporter.getCached("long", 0, DocumentExporter::Format::Pdf)->bytes, output.size());
+
+    // A new revision is formatted anew
+    ASSERT_TRUE(document.applyOperation(ot::ValueOperation{ot::InsertOp{0, "x"}}, "alice"));
+    Collector edited;
+    EXPECT_FALSE(exporter.exportDocument("long", document, DocumentExporter::Format::Pdf, edited.sink()));
+    EXPECT_NE(edited.wait(), output);
+
+    DocumentExporter::Stats stats = exporter.getStats();
+    EXPECT_EQ(stats.exports, 2u);
+    EXPECT_EQ(stats.cacheHits, 1u);
+    EXPECT_EQ(stats.cached, 1u);
+    EXPECT_EQ(stats.evictions, 1u);
+
+    exporter.forget("long");
+    EXPECT_EQ(exporter.getStats().cached, 0u);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "server/session/document_migration.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+DocumentController::Edit insertAt(size_t position, const std::string& text, int64_t baseRevision) {
+    return {std::make_shared<ot::InsertOperation>(position, text), "alice", baseRevision};
+}
+
+// Send a batch the way it goes between nodes
+MigrationBatch overTheWire(const MigrationBatch& batch) {
+    return MigrationBatch::fromJson(nlohmann::json::parse(batch.toJson().dump()));
+}
+
+} // namespace
+
+TEST(DocumentMigrationTest, MovesWhileEditedAndKeepsEveryEdit) {
+    auto document = std::make_shared<DocumentController>("hello");
+    for (int i = 0; i < 5; ++i) {
+        document->applyOperation(std::make_shared<ot::InsertOperation>(document->getDocument().size(), "!"), "bob");
+    }
+    const int64_t clientRevision = 3;  // A client that has acknowledged only up to here
+
+    MigrationSource source(document, "doc", clientRevision);
+    MigrationTarget target;
+    target.receive(overTheWire(source.start()));
+    EXPECT_EQ(target.document()->getRevision(), 5);
+    EXPECT_EQ(target.document()->getDocument(), document->getDocument());
+    EXPECT_FALSE(target.ready());
+
+    // Edits carry on at the source and catch up at the target
+    ASSERT_TRUE(source.submit(insertAt(0, "a", 5)).has_value());
+    ASSERT_TRUE(source.submit(insertAt(0, "b", 6)).has_value());
+    EXPECT_EQ(source.lag(), 2);
+    target.receive(overTheWire(source.catchUp()));
+    EXPECT_EQ(source.lag(), 0);
+
+    // Frozen: edits are held from now on, and the last batch levels the target
+    ASSERT_TRUE(source.submit(insertAt(0, "c", 7)).has_value());
+    const MigrationBatch last = source.freeze();
+    EXPECT_FALSE(source.submit(insertAt(0, "late", clientRevision)).has_value());
+    EXPECT_EQ(document->getRevision(), 8);
+    EXPECT_TRUE(target.receive(overTheWire(last)).empty());
+    EXPECT_TRUE(target.ready());
+    EXPECT_EQ(target.cutoverRevision(), 8);
+    EXPECT_EQ(target.document()->getDocument(), document->getDocument());
+
+    // The held edit is forwarded and transformed at the target from its base revision
+    const MigrationBatch held = source.forwardHeld();
+    ASSERT_EQ(held.pending.size(), 1u);
+    const std::vector<ot::OperationPtr> applied = target.receive(overTheWire(held));
+    ASSERT_EQ(applied.size(), 1u);
+    ASSERT_NE(applied[0], nullptr);
+    EXPECT_EQ(target.document()->getDocument(), "cbalatehello!!!!!");
+    EXPECT_TRUE(source.forwardHeld().pending.empty());
+    EXPECT_THROW(target.receive(last), std::runtime_error);
+
+    // Clients are told where it went and from which revision
+    const protocol::DocumentMessage redirect = source.redirect("10.0.0.2:12345");
+    EXPECT_EQ(redirect.metadata.at("redirect"), "10.0.0.2:12345");
+    EXPECT_EQ(redirect.documentVersion, 8u);
+    EXPECT_FALSE(*redirect.success);
+
+    // A client resumes from its last acknowledged revision without a snapshot
+    auto missed = target.resume(clientRevision);
+    ASSERT_TRUE(missed.has_value());
+    EXPECT_EQ(missed->size(), 6u);
+    EXPECT_FALSE(target.resume(1).has_value());
+}
+
+TEST(DocumentMigrationTest, RejectsBatchesOutOfOrder) {
+    auto document = std::make_shared<DocumentController>("text");
+    MigrationSource source(document, "doc", 0);
+    MigrationTarget target;
+
+    MigrationBatch first = source.start();
+    document->applyOperation(std::make_shared<ot::InsertOperation>(0, "x"), "bob");
+    MigrationBatch second = source.catchUp();
+    EXPECT_THROW(target.receive(second), std::runtime_error);
+    target.receive(first);
+    target.receive(second);
+    EXPECT_THROW(target.receive(second), std::runtime_error);
+    EXPECT_EQ(target.document()->getDocument(), "xtext");
+    EXPECT_THROW(source.redirect("elsewhere"), std::logic_error);
+    EXPECT_THROW(source.forwardHeld(), std::logic_error);
+}
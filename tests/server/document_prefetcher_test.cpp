@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "server/session/document_prefetcher.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Loads every document as its ID
+struct Storage {
+    std::mutex mutex;
+    std::multiset<std::string> loaded;
+
+    DocumentCache::Loader loader() {
+        return [this](const std::string& documentId) {
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.insert(documentId);
+            return std::make_shared<DocumentController>(documentId);
+        };
+    }
+
+    DocumentCache::Saver saver() {
+        return [](const std::string&, const DocumentController&) {};
+    }
+};
+
+} // namespace
+
+TEST(DocumentPrefetcherTest, PrefetchesTheLatestChangedAndMostOpenedFiles) {
+    Storage storage;
+    DocumentCache cache(1 << 20, storage.loader(), storage.saver());
+    ThreadPool pool(2);
+    PriorityExecutor executor(pool);
+    std::set<std::string> warmed;
+    std::mutex warmedMutex;
+    DocumentPrefetcher::Config config;
+    config.candidates = 2;
+    DocumentPrefetcher prefetcher(cache, executor, config, {},
+                                  [&](const std::string& documentId, const DocumentCache::Controller& document) {
+                                      ASSERT_TRUE(document);
+                                      std::lock_guard<std::mutex> lock(warmedMutex);
+                                      warmed.insert(documentId);
+                                  });
+
+    auto directory = std::make_shared<fs::Directory>("", "owner");
+    for (const char* name : {"a.txt", "b.txt", "c.txt", "d.txt"}) {
+        directory->createFile(name, "owner");
+    }
+    // b changed last; a was opened often, a while ago
+    directory->getNode("b.txt")->asFile()->setContent("edited");
+    const auto now = DocumentPrefetcher::Clock::now();
+    for (int i = 0; i < 4; ++i) {
+        prefetcher.recordOpen("a.txt", now - 1h);
+    }
+    EXPECT_GT(prefetcher.score("a.txt", now - 2h, now), prefetcher.score("c.txt", now - 2h, now));
+
+    EXPECT_EQ(prefetcher.onListing(*directory, now), (std::vector<std::string>{"a.txt", "b.txt"}));
+    prefetcher.wait();
+    EXPECT_TRUE(cache.find("a.txt"));
+    EXPECT_TRUE(cache.find("b.txt"));
+    EXPECT_FALSE(cache.find("c.txt"));
+    EXPECT_EQ(warmed, (std::set<std::string>{"a.txt", "b.txt"}));
+
+    // Resident documents are not prefetched again, so the next best are
+    EXPECT_EQ(prefetcher.onListing(*directory, now).size(), 2);
+    prefetcher.wait();
+    EXPECT_EQ(storage.loaded.size(), 4);
+    DocumentPrefetcher::Stats stats = prefetcher.getStats();
+    EXPECT_EQ(stats.listings, 2);
+    EXPECT_EQ(stats.loaded, 4);
+    EXPECT_EQ(stats.resident, 2);
+
+    // The open that follows finds the document warm
+    cache.open("a.txt");
+    EXPECT_EQ(cache.getStats().prefetchHits, 1);
+    EXPECT_EQ(cache.getStats().misses, 0);
+    cache.close("a.txt");
+}
+
+TEST(DocumentPrefetcherTest, NeverDisplacesDocumentsInUse) {
+    Storage storage;
+    // Each document is 5 bytes of text, so two fit
+    DocumentCache cache(10, storage.loader(), storage.saver());
+    ThreadPool pool(2);
+    PriorityExecutor executor(pool);
+    DocumentPrefetcher prefetcher(cache, executor);
+
+    auto directory = std::make_shared<fs::Directory>("", "owner");
+    directory->createFile("x.txt", "owner");
+
+    // Room for one more: it is loaded, but goes first when the budget needs room
+    cache.open("open1");
+    EXPECT_EQ(prefetcher.onListing(*directory).size(), 1);
+    prefetcher.wait();
+    EXPECT_TRUE(cache.find("x.txt"));
+    cache.open("open2");
+    EXPECT_FALSE(cache.find("x.txt"));
+    EXPECT_TRUE(cache.find("open1"));
+
+    // A full cache is not prefetched into at all
+    cache.close("open1");
+    EXPECT_EQ(prefetcher.onListing(*directory).size(), 1);
+    prefetcher.wait();
+    EXPECT_FALSE(cache.find("x.txt"));
+    EXPECT_TRUE(cache.find("open1"));
+    EXPECT_TRUE(cache.find("open2"));
+    EXPECT_EQ(prefetcher.getStats().skipped, 1);
+    EXPECT_EQ(cache.getStats().prefetchSkips, 1);
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "server/session/document_relay.h"
+
+using namespace collab;
+using namespace collab::server;
+using protocol::MessageType;
+
+namespace {
+
+// Records what the relay sends either way
+struct Wire {
+    std::vector<std::string> upstream;                      // "type clientId documentId"
+    std::vector<std::string> broadcasts;                    // "type documentId"
+    std::map<std::string, std::vector<int>> sent;           // Viewer -> types
+    std::map<std::string, std::vector<std::string>> audience;
+
+    DocumentRelay make() {
+        DocumentRelay::Upstream up{[this](const protocol::Message& message) {
+            const auto* document = dynamic_cast<const protocol::DocumentMessage*>(&message);
+            const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message);
+            upstream.push_back(std::to_string(static_cast<int>(message.type)) + " " + message.clientId + " " +
+                               (document ? document->documentId : edit ? edit->documentId : ""));
+            return true;
+        }};
+        DocumentRelay::Downstream down{
+            [this](const protocol::Message& message) {
+                const auto* edit = dynamic_cast<const protocol::EditMessage*>(&message);
+                broadcasts.push_back(std::to_string(static_cast<int>(message.type)) + " " + (edit ? edit->documentId : ""));
+            },
+            [this](const std::string& viewerId, const protocol::Message& message) {
+                sent[viewerId].push_back(static_cast<int>(message.type));
+                return true;
+            },
+            [this](const std::string& viewerId, const std::string& documentId) {
+                audience[documentId].push_back(viewerId);
+                return true;
+            },
+            [this](const std::string& viewerId, const std::string& documentId) {
+                auto& members = audience[documentId];
+                members.erase(std::find(members.begin(), members.end(), viewerId));
+                return true;
+            }};
+        return DocumentRelay(std::move(up), std::move(down));
+    }
+};
+
+protocol::DocumentMessage documentMessage(MessageType type, const std::string& documentId,
+                                          const std::string& clientId = "") {
+    protocol::DocumentMessage message(type);
+    message.documentId = documentId;
+    message.clientId = clientId;
+    return message;
+}
+
+} // namespace
+
+TEST(DocumentRelayTest, OpensUpstreamOnceAndFansOutToEveryViewer) {
+    Wire wire;
+    DocumentRelay relay = wire.make();
+    for (int i = 0; i < 100; ++i) {
+        relay.fromViewer("viewer" + std::to_string(i), documentMessage(MessageType::DOC_OPEN, "notes"));
+    }
+    EXPECT_EQ(relay.viewerCount("notes"), 100u);
+    EXPECT_EQ(wire.audience["notes"].size(), 100u);
+    EXPECT_EQ(wire.upstream.front(), "201 viewer0 notes");
+
+    // The owner's answer to one viewer's open goes to that viewer alone
+    relay.fromUpstream(documentMessage(MessageType::DOC_RESPONSE, "notes", "viewer7"));
+    EXPECT_EQ(wire.sent["viewer7"], std::vector<int>{static_cast<int>(MessageType::DOC_RESPONSE)});
+    EXPECT_TRUE(wire.broadcasts.empty());
+
+    // An edit the owner broadcasts goes out once through the local fan-out
+    protocol::EditMessage edit(MessageType::EDIT_INSERT);
+    edit.documentId = "notes";
+    edit.clientId = "someone-at-the-owner";
+    relay.fromUpstream(edit);
+    EXPECT_EQ(wire.broadcasts, std::vector<std::string>{"300 notes"});
+
+    // A reply naming no viewer of the relay is for everyone
+    relay.fromUpstream(documentMessage(MessageType::DOC_RESPONSE, "notes"));
+    EXPECT_EQ(wire.broadcasts.size(), 2u);
+
+    const DocumentRelay::Stats stats = relay.getStats();
+    EXPECT_EQ(stats.documents, 1u);
+    EXPECT_EQ(stats.viewers, 100u);
+    EXPECT_EQ(stats.replies, 1u);
+    EXPECT_EQ(stats.fannedOut, 2u);
+}
+
+TEST(DocumentRelayTest, ForwardsEditsWithTheViewerAndRoutesTheirAcks) {
+    Wire wire;
+    DocumentRelay relay = wire.make();
+    relay.fromViewer("alice", documentMessage(MessageType::DOC_OPEN, "notes"));
+    relay.fromViewer("bob", documentMessage(MessageType::DOC_OPEN, "notes"));
+
+    protocol::EditMessage edit(MessageType::EDIT_INSERT);
+    edit.documentId = "notes";
+    edit.text = "hi";
+    EXPECT_TRUE(relay.fromViewer("bob", edit));
+    EXPECT_EQ(wire.upstream.back(), "300 bob notes");
+
+    protocol::EditMessage ack(MessageType::EDIT_APPLY);
+    ack.documentId = "notes";
+    ack.clientId = "bob";
+    relay.fromUpstream(ack);
+    EXPECT_EQ(wire.sent["bob"], std::vector<int>{static_cast<int>(MessageType::EDIT_APPLY)});
+    EXPECT_TRUE(wire.sent["alice"].empty());
+}
+
+TEST(DocumentRelayTest, ClosesUpstreamWithTheLastViewer) {
+    Wire wire;
+    DocumentRelay relay = wire.make();
+    relay.fromViewer("alice", documentMessage(MessageType::DOC_OPEN, "notes"));
+    relay.fromViewer("bob", documentMessage(MessageType::DOC_OPEN, "notes"));
+    relay.fromViewer("bob", documentMessage(MessageType::DOC_OPEN, "incident"));
+    wire.upstream.clear();
+
+    relay.fromViewer("alice", documentMessage(MessageType::DOC_CLOSE, "notes"));
+    EXPECT_TRUE(wire.upstream.empty());
+    EXPECT_EQ(wire.audience["notes"], std::vector<std::string>{"bob"});
+
+    // A disconnect closes what only that viewer had open, on the relay's behalf
+    relay.removeViewer("bob");
+    ASSERT_EQ(wire.upstream.size(), 2u);
+    EXPECT_EQ(relay.getStats().documents, 0u);
+    EXPECT_EQ(relay.getStats().viewers, 0u);
+
+    relay.fromViewer("carol", documentMessage(MessageType::DOC_OPEN, "notes"));
+    relay.fromViewer("carol", documentMessage(MessageType::DOC_CLOSE, "notes"));
+    EXPECT_EQ(wire.upstream.back(), "202  notes");
+}
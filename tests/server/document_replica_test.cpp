@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "server/session/document_replica.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+void append(DocumentController& document, const std::string& text) {
+    document.applyOperation(std::make_shared<ot::InsertOperation>(document.getDocument().size(), text), "alice");
+}
+
+protocol::DocumentMessage request(protocol::MessageType type) {
+    protocol::DocumentMessage message(type);
+    message.documentId = "doc";
+    message.clientId = "reader";
+    return message;
+}
+
+} // namespace
+
+TEST(DocumentReplicaTest, AnswersReadsWithTheirStaleness) {
+    auto leader = std::make_shared<DocumentController>("hello");
+    DocumentReplica replica("doc", DocumentReplica::follow(leader, "doc"), {2, 0ms});
+    EXPECT_EQ(replica.answer(request(protocol::MessageType::DOC_INFO)).metadata.at("stale"), "true");
+
+    append(*leader, " world");
+    ASSERT_TRUE(replica.sync());
+    EXPECT_EQ(replica.getRevision(), 1);
+    protocol::DocumentMessage info = replica.answer(request(protocol::MessageType::DOC_INFO));
+    EXPECT_TRUE(info.success.value_or(false));
+    EXPECT_EQ(info.clientId, "reader");
+    EXPECT_EQ(info.documentVersion, 1u);
+    EXPECT_EQ(info.contentLength, 11u);
+    EXPECT_FALSE(info.documentContent.has_value());
+    EXPECT_EQ(info.metadata.at("replica"), "true");
+    EXPECT_EQ(info.metadata.at("staleRevisions"), "0");
+
+    // The leader moves on: reads say how far behind they are, until past the bound
+    for (int i = 0; i < 3; ++i) {
+        append(*leader, "!");
+        replica.notify(leader->getRevision());
+        protocol::DocumentMessage open = replica.answer(request(protocol::MessageType::DOC_OPEN));
+        EXPECT_EQ(open.metadata.at("staleRevisions"), std::to_string(i + 1));
+        EXPECT_EQ(open.success.value_or(false), i + 1 <= 2);
+        if (i + 1 <= 2) {
+            EXPECT_EQ(open.documentContent, "hello world");
+        }
+    }
+
+    // A reader that accepts more is still answered
+    protocol::DocumentMessage lenient = request(protocol::MessageType::DOC_OPEN);
+    lenient.metadata["maxStaleRevisions"] = "10";
+    EXPECT_TRUE(replica.answer(lenient).success.value_or(false));
+
+    ASSERT_TRUE(replica.sync());
+    EXPECT_EQ(replica.staleness().revisions, 0);
+    EXPECT_EQ(replica.answer(request(protocol::MessageType::DOC_OPEN)).documentContent, "hello world!!!");
+
+    // History comes from the replica's own log
+    protocol::DocumentMessage history = request(protocol::MessageType::DOC_OPEN);
+    history.documentVersion = 2;
+    EXPECT_EQ(replica.answer(history).documentContent, "hello world!");
+
+    const DocumentReplica::Stats stats = replica.getStats();
+    EXPECT_EQ(stats.replayed, 3u);
+    EXPECT_EQ(stats.reseeds, 1u);
+    EXPECT_EQ(stats.refused, 2u);
+}
+
+TEST(DocumentReplicaTest, StartsOverOnceTheLeadersLogMovedPast) {
+    auto leader = std::make_shared<DocumentController>("", 4);
+    DocumentReplica replica("doc", DocumentReplica::follow(leader, "doc"));
+    ASSERT_TRUE(replica.sync());
+    for (int i = 0; i < 10; ++i) {
+        append(*leader, std::to_string(i));
+    }
+    ASSERT_TRUE(replica.sync());
+    EXPECT_EQ(replica.getRevision(), 10);
+    EXPECT_EQ(replica.read({})->first.content.toString(), "0123456789");
+    EXPECT_EQ(replica.getStats().reseeds, 2u);
+
+    // A feed that cannot reach the leader leaves the replica as it was
+    DocumentReplica unreachable("doc", [](int64_t) { return std::optional<MigrationBatch>(); });
+    EXPECT_FALSE(unreachable.sync());
+    EXPECT_FALSE(unreachable.read({}).has_value());
+}
+
+TEST(DocumentReplicaTest, TailerSyncsInTheBackground) {
+    auto leader = std::make_shared<DocumentController>("a");
+    auto replica = std::make_shared<DocumentReplica>("doc", DocumentReplica::follow(leader, "doc"));
+    ReplicaTailer tailer(1h);
+    tailer.add(replica);
+
+    append(*leader, "b");
+    tailer.wake();
+    for (int i = 0; i < 500 && replica->getRevision() != 1; ++i) {
+        std::this_thread::sleep_for(2ms);
+    }
+    EXPECT_EQ(replica->getRevision(), 1);
+    EXPECT_EQ(replica->read({})->first.content.toString(), "ab");
+}
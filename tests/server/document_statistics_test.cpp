@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include "server/session/document_statistics.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+// Count a text the slow way
+DocumentStatistics::Counts recount(const std::string& text) {
+    DocumentStatistics statistics;
+    statistics.add("scratch", text);
+    return *statistics.get("scratch");
+}
+
+} // namespace
+
+TEST(DocumentStatisticsTest, CountsWordsLinesAndCharacters) {
+    DocumentStatistics statistics;
+    statistics.add("a", "hello  world\nsecond line\n");
+    statistics.add("b", "");
+    statistics.add("c", "caf\xC3\xA9 na\xC3\xAFve");
+
+    DocumentStatistics::Counts a = *statistics.get("a");
+    EXPECT_EQ(a.words, 4u);
+    EXPECT_EQ(a.lines, 3u);
+    EXPECT_EQ(a.characters, 25u);
+    EXPECT_EQ(statistics.get("b"), DocumentStatistics::Counts{});
+    EXPECT_EQ(statistics.get("c")->characters, 10u);
+    EXPECT_EQ(statistics.get("c")->bytes, 12u);
+    EXPECT_FALSE(statistics.get("missing"));
+}
+
+TEST(DocumentStatisticsTest, EditsAtWordEdgesJoinAndSplitWords) {
+    DocumentStatistics statistics;
+    statistics.add("doc", "one two");
+    auto words = [&] { return statistics.get("doc")->words; };
+
+    // Deleting the space joins two words; inserting one splits them again
+    ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::DeleteOp{3, 1, {}})));
+    EXPECT_EQ(words(), 1u);
+    ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::InsertOp{3, " "})));
+    EXPECT_EQ(words(), 2u);
+    // Typing at the end of a word extends it
+    ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::InsertOp{3, "s"})));
+    EXPECT_EQ(words(), 2u);
+    // A newline between letters splits a word and adds a line
+    ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::InsertOp{1, "\n"})));
+    EXPECT_EQ(words(), 3u);
+    EXPECT_EQ(statistics.get("doc")->lines, 2u);
+    EXPECT_EQ(*statistics.get("doc"), recount("o\nnes two"));
+
+    EXPECT_FALSE(statistics.apply("doc", ot::ValueOperation(ot::DeleteOp{5, 10, {}})));
+    EXPECT_FALSE(statistics.apply("missing", ot::ValueOperation(ot::InsertOp{0, "x"})));
+}
+
+TEST(DocumentStatisticsTest, MatchesARecountThroughRandomEdits) {
+    std::mt19937 random(11);
+    const std::string alphabet = "ab \n\xC3\xA9";
+    std::string text = "the quick brown fox\njumps";
+    DocumentStatistics statistics;
+    statistics.add("doc", text);
+
+    for (int i = 0; i < 2000; ++i) {
+        const size_t position = text.empty() ? 0 : random() % (text.size() + 1);
+        if (random() % 2 == 0 && position < text.size()) {
+            const size_t length = std::min<size_t>(random() % 6 + 1, text.size() - position);
+            ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::DeleteOp{position, length, {}})));
+            text.erase(position, length);
+        } else {
+            std::string inserted;
+            for (size_t n = random() % 4 + 1; n > 0; --n) {
+                inserted += alphabet[random() % alphabet.size()];
+            }
+            ASSERT_TRUE(statistics.apply("doc", ot::ValueOperation(ot::InsertOp{position, inserted})));
+            text.insert(position, inserted);
+        }
+        const DocumentStatistics::Counts counts = *statistics.get("doc");
+        const DocumentStatistics::Counts expected = recount(text);
+        // Code points are only whole when no edit split one, so only the rest is checked
+        ASSERT_EQ(counts.words, expected.words) << i;
+        ASSERT_EQ(counts.lines, expected.lines) << i;
+        ASSERT_EQ(counts.bytes, expected.bytes) << i;
+    }
+}
+
+TEST(DocumentStatisticsTest, FollowsADocumentAndAnswersDocInfo) {
+    DocumentController document("draft");
+    DocumentStatistics statistics;
+    statistics.watch("draft", document);
+    document.applyOperation(std::make_shared<ot::InsertOperation>(5, " of notes\nfor today"), "alice");
+    auto composite = std::make_shared<ot::CompositeOperation>();
+    composite->addOperation(std::make_shared<ot::DeleteOperation>(0, 5));
+    composite->addOperation(std::make_shared<ot::InsertOperation>(0, "list"));
+    document.applyOperation(composite, "alice");
+    ASSERT_EQ(document.getDocument(), "list of notes\nfor today");
+    EXPECT_EQ(*statistics.get("draft"), recount(document.getDocument()));
+
+    protocol::DocumentMessage request(protocol::MessageType::DOC_INFO);
+    request.documentId = "draft";
+    request.clientId = "client";
+    protocol::DocumentMessage response = statistics.answer(request);
+    EXPECT_EQ(response.type, protocol::MessageType::DOC_RESPONSE);
+    EXPECT_TRUE(response.success.value_or(false));
+    EXPECT_EQ(response.contentLength, 23u);
+    EXPECT_EQ(response.metadata.at(DocumentStatistics::WORDS_KEY), "5");
+    EXPECT_EQ(response.metadata.at(DocumentStatistics::LINES_KEY), "2");
+    EXPECT_EQ(response.metadata.at(DocumentStatistics::CHARACTERS_KEY), "23");
+
+    request.documentId = "missing";
+    EXPECT_FALSE(statistics.answer(request).success.value_or(true));
+}
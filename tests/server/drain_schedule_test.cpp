@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include "server/session/drain_schedule.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+TEST(DrainScheduleTest, SendsClientsInWavesSpreadOverTheInterval) {
+    DrainSchedule schedule({"", 4, 1000ms}, 10);
+    ASSERT_EQ(schedule.waveCount(), 3u);
+    EXPECT_EQ(schedule.wave(0), (std::pair<size_t, size_t>{0, 4}));
+    EXPECT_EQ(schedule.wave(2), (std::pair<size_t, size_t>{8, 10}));
+    EXPECT_EQ(schedule.wave(3), (std::pair<size_t, size_t>{10, 10}));
+    EXPECT_EQ(schedule.waveStart(2), 2000ms);
+
+    // Each wave reconnects over the interval that follows it, a quarter at a time
+    EXPECT_EQ(schedule.reconnectDelay(0), 0ms);
+    EXPECT_EQ(schedule.reconnectDelay(3), 750ms);
+    EXPECT_EQ(schedule.reconnectDelay(5), 250ms);
+
+    // A wave is at least one client
+    DrainSchedule single({"", 0, 100ms}, 2);
+    EXPECT_EQ(single.getOptions().waveSize, 1u);
+    EXPECT_EQ(single.waveCount(), 2u);
+    EXPECT_EQ(DrainSchedule({}, 0).waveCount(), 0u);
+}
+
+TEST(DrainScheduleTest, NoticeCarriesTheHintAndToken) {
+    DrainSchedule schedule({"10.0.0.2:8080", 2, 500ms}, 4);
+    const std::string sent = schedule.notice(1, "token").toString();
+    auto notice = std::get<protocol::AuthMessage>(protocol::Message::fromString(sent));
+    EXPECT_EQ(notice.type, protocol::MessageType::SYS_DISCONNECT);
+    EXPECT_EQ(notice.token, "token");
+    EXPECT_EQ(notice.metadata[DrainSchedule::RECONNECT_KEY], "10.0.0.2:8080");
+    EXPECT_EQ(notice.metadata[DrainSchedule::RECONNECT_AFTER_KEY], "250");
+
+    // Without either, the client picks where to go and logs in again
+    auto bare = DrainSchedule({}, 1).notice(0, "");
+    EXPECT_FALSE(bare.token.has_value());
+    EXPECT_EQ(bare.metadata.count(DrainSchedule::RECONNECT_KEY), 0u);
+    EXPECT_EQ(bare.metadata[DrainSchedule::RECONNECT_AFTER_KEY], "0");
+}
@@ -1,2 +1,2 @@
 #include <gtest/gtest.h>
-TEST(ServerTest, DummyTest) { EXPECT_TRUE(true); }
+TEST(DummyServerTest, VerifyTestingWorks) { EXPECT_TRUE(true); }
@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include "server/session/edit_latency_tracker.h"
+#include "common/protocol/wire_codec.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <variant>
+
+using namespace collab::server;
+using namespace collab::protocol;
+
+namespace {
+
+EditTrace makeTrace(uint64_t origin, uint64_t received, uint64_t transformed) {
+    EditTrace trace;
+    trace.originTime = origin;
+    trace.serverReceiveTime = received;
+    trace.transformTime = transformed;
+    trace.broadcastTime = transformed;
+    return trace;
+}
+
+} // namespace
+
+TEST(EditLatencyTrackerTest, TraceContextTravelsInEditMessages) {
+    EditMessage edit(MessageType::EDIT_INSERT);
+    edit.documentId = "doc";
+    edit.text = "a";
+    EditTrace trace = makeTrace(1000, 1500, 1600);
+    trace.sample();
+    ASSERT_EQ(trace.traceId.size(), 32u);
+    trace.stamp(edit);
+
+    auto decoded = std::get<EditMessage>(Message::fromString(edit.toString()));
+    EditTrace read = EditTrace::of(decoded);
+    EXPECT_EQ(read.traceId, trace.traceId);
+    EXPECT_EQ(read.originTime, 1000u);
+    EXPECT_EQ(read.serverReceiveTime, 1500u);
+    EXPECT_EQ(read.transformTime, 1600u);
+    EXPECT_EQ(read.broadcastTime, 1600u);
+
+    // The binary codec carries the fields too, and leaves them out when unset
+    WireCodec client;
+    WireCodec server;
+    AuthMessage login(MessageType::AUTH_LOGIN);
+    login.username = "alice";
+    server.decode(client.encode(login));
+    AuthMessage success(MessageType::AUTH_SUCCESS);
+    success.username = "alice";
+    client.decode(server.encode(success));
+    auto binary = std::get<EditMessage>(server.decode(client.encode(edit)));
+    EXPECT_EQ(binary.traceId, edit.traceId);
+    EXPECT_EQ(binary.originTime, edit.originTime);
+    edit = EditMessage(MessageType::EDIT_INSERT);
+    binary = std::get<EditMessage>(server.decode(client.encode(edit)));
+    EXPECT_FALSE(binary.traceId.has_value());
+    EXPECT_FALSE(binary.broadcastTime.has_value());
+
+    // Operations sent as bare JSON carry it under the same keys
+    nlohmann::json op = {{"type", "insert"}, {"position", 0}, {"text", "a"}};
+    trace.writeTo(op);
+    EXPECT_EQ(EditTrace::fromJson(op).serverReceiveTime, 1500u);
+    EXPECT_EQ(EditTrace::fromJson(nlohmann::json::object()).originTime, 0u);
+}
+
+TEST(EditLatencyTrackerTest, SplitsLatencyIntoStagesPerDocument) {
+    collab::util::MetricsRegistry registry;
+    EditLatencyTracker tracker(0, 16, registry);
+    tracker.record("slow", "alice", makeTrace(1000, 1100, 1300), 1350);
+    tracker.record("slow", "bob", makeTrace(2000, 2300, 2400), 2450);
+    tracker.record("fast", "alice", makeTrace(0, 5000, 5010), 5020);
+
+    const auto slow = tracker.breakdown("slow");
+    EXPECT_EQ(slow[EditLatencyTracker::NETWORK].count, 2u);
+    EXPECT_EQ(slow[EditLatencyTracker::NETWORK].meanMicros(), 200.0);
+    EXPECT_EQ(slow[EditLatencyTracker::NETWORK].maxMicros, 300u);
+    EXPECT_EQ(slow[EditLatencyTracker::TRANSFORM].totalMicros, 300u);
+    EXPECT_EQ(slow[EditLatencyTracker::FANOUT].totalMicros, 100u);
+
+    // Without an origin stamp there is no network stage
+    const auto fast = tracker.breakdown("fast");
+    EXPECT_EQ(fast[EditLatencyTracker::NETWORK].count, 0u);
+    EXPECT_EQ(fast[EditLatencyTracker::TRANSFORM].count, 1u);
+
+    const auto slowest = tracker.slowest(EditLatencyTracker::TRANSFORM, 1);
+    ASSERT_EQ(slowest.size(), 1u);
+    EXPECT_EQ(slowest[0].first, "slow");
+
+    const std::string text = registry.renderPrometheus();
+    EXPECT_NE(text.find("collab_edit_stage_seconds_count{stage=\"network\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("collab_edit_stage_seconds_count{stage=\"transform\"} 3\n"), std::string::npos);
+
+    tracker.forget("slow");
+    EXPECT_EQ(tracker.breakdown("slow")[EditLatencyTracker::NETWORK].count, 0u);
+}
+
+TEST(EditLatencyTrackerTest, SamplesAndExportsTracesAsOtlpJson) {
+    collab::util::MetricsRegistry registry;
+    EditLatencyTracker tracker(4, 2, registry);
+    size_t sampled = 0;
+    for (int i = 0; i < 8; ++i) {
+        EditTrace trace;
+        sampled += tracker.sample(trace) ? 1 : 0;
+        EXPECT_EQ(trace.sampled(), trace.traceId.size() == 32);
+    }
+    EXPECT_EQ(sampled, 2u);
+
+    // Client-sampled edits are always kept; beyond maxTraces the oldest go
+    for (uint64_t i = 0; i < 3; ++i) {
+        EditTrace trace = makeTrace(1000 + i, 1100 + i, 1200 + i);
+        trace.sample();
+        tracker.record("doc", "alice", trace, 1300 + i);
+    }
+    tracker.record("doc", "bob", makeTrace(1, 2, 3), 4);
+    EXPECT_EQ(tracker.droppedTraces(), 1u);
+
+    const auto request = nlohmann::json::parse(tracker.exportOtlpJson("test-service"));
+    const auto& resource = request.at("resourceSpans").at(0);
+    EXPECT_EQ(resource.at("resource").at("attributes").at(0).at("value").at("stringValue"), "test-service");
+    const auto& spans = resource.at("scopeSpans").at(0).at("spans");
+    // Two traces, each a root span and three stages
+    ASSERT_EQ(spans.size(), 8u);
+    const auto& root = spans.at(0);
+    EXPECT_EQ(root.at("name"), "edit");
+    EXPECT_EQ(root.at("traceId").get<std::string>().size(), 32u);
+    EXPECT_EQ(root.at("spanId").get<std::string>().size(), 16u);
+    EXPECT_EQ(root.at("startTimeUnixNano"), "1001000");
+    EXPECT_EQ(root.at("endTimeUnixNano"), "1301000");
+    EXPECT_EQ(spans.at(1).at("parentSpanId"), root.at("spanId"));
+    EXPECT_EQ(spans.at(1).at("name"), "network");
+    EXPECT_EQ(spans.at(2).at("name"), "transform");
+    EXPECT_EQ(spans.at(3).at("name"), "fanout");
+
+    // Exporting takes the traces
+    const auto empty = nlohmann::json::parse(tracker.exportOtlpJson());
+    EXPECT_TRUE(empty.at("resourceSpans").at(0).at("scopeSpans").at(0).at("spans").empty());
+}
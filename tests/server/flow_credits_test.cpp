@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+#include "server/session/flow_credits.h"
+
+using namespace collab::server;
+
+TEST(FlowCreditsTest, UnlimitedUntilTheClientGrants) {
+    FlowCredits credits;
+    EXPECT_FALSE(credits.limited());
+    EXPECT_TRUE(credits.canSend());
+    credits.spend(1 << 20);
+    EXPECT_TRUE(credits.canSend());
+
+    credits.grant(0, 0);
+    EXPECT_TRUE(credits.limited());
+    EXPECT_FALSE(credits.canSend());
+}
+
+TEST(FlowCreditsTest, SpendsFramesAndBytesUntilEitherRunsOut) {
+    FlowCredits credits;
+    credits.grant(3, 1000);
+    credits.spend(400);
+    credits.spend(400);
+    EXPECT_EQ(credits.frames(), 1u);
+    EXPECT_EQ(credits.bytes(), 200u);
+    EXPECT_TRUE(credits.canSend());
+
+    // A message larger than what is left still goes, and uses the rest up
+    credits.spend(5000);
+    EXPECT_EQ(credits.bytes(), 0u);
+    EXPECT_FALSE(credits.canSend());
+
+    // Frames alone are not enough
+    credits.grant(10, 0);
+    EXPECT_FALSE(credits.canSend());
+    credits.grant(0, 64);
+    EXPECT_TRUE(credits.canSend());
+    for (int i = 0; i < 10; ++i) {
+        credits.spend(1);
+    }
+    EXPECT_EQ(credits.frames(), 0u);
+    EXPECT_EQ(credits.bytes(), 54u);
+    EXPECT_FALSE(credits.canSend());
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "server/session/history_playback.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace collab::ot;
+using namespace std::chrono_literals;
+
+namespace {
+
+// A document typed one character at a time, with every tenth keystroke deleted again
+std::shared_ptr<DocumentController> makeDocument(int keystrokes, std::vector<std::string>& texts) {
+    auto document = std::make_shared<DocumentController>("");
+    texts.push_back("");
+    for (int i = 0; i < keystrokes; ++i) {
+        const size_t length = texts.back().size();
+        if (i % 10 == 9) {
+            document->applyOperation(std::make_shared<DeleteOperation>(length - 1, 1), "alice");
+        } else {
+            document->applyOperation(std::make_shared<InsertOperation>(length, std::string(1, 'a' + i % 26)), "alice");
+        }
+        texts.push_back(document->getDocument());
+    }
+    return document;
+}
+
+} // namespace
+
+TEST(HistoryPlaybackTest, PlaysFromAKeyframeInComposedRuns) {
+    std::vector<std::string> texts;
+    auto document = makeDocument(1000, texts);
+    HistoryPlayback::Config config;
+    config.runOps = 100;
+    HistoryPlayback playback(document, config);
+
+    EXPECT_FALSE(playback.next());
+    std::optional<HistoryPlayback::Seek> seek = playback.seek(300);
+    ASSERT_TRUE(seek);
+    ASSERT_TRUE(seek->keyframe);
+    std::string copy = seek->keyframe->content;
+    EXPECT_EQ(copy, texts[300]);
+
+    size_t runs = 0;
+    while (auto run = playback.next()) {
+        EXPECT_LE(run->toRevision - run->fromRevision, 100);
+        EXPECT_EQ(run->delay, HistoryPlayback::Clock::duration::zero());
+        ASSERT_TRUE(run->op.apply(copy));
+        EXPECT_EQ(copy, texts[run->toRevision]);
+        ++runs;
+    }
+    EXPECT_EQ(runs, 7);
+    EXPECT_EQ(playback.position(), 1000);
+}
+
+TEST(HistoryPlaybackTest, ScrubsForwardWithoutAKeyframeAndPacesRuns) {
+    std::vector<std::string> texts;
+    auto document = makeDocument(600, texts);
+    HistoryPlayback::Config config;
+    config.revisionsPerSecond = 50;   // Five revisions per 100 ms tick
+    HistoryPlayback playback(document, config);
+
+    std::string copy = playback.seek(100)->keyframe->content;
+    auto run = playback.next();
+    ASSERT_TRUE(run);
+    EXPECT_EQ(run->toRevision, 105);
+    EXPECT_EQ(run->delay, std::chrono::duration_cast<HistoryPlayback::Clock::duration>(100ms));
+    run->op.apply(copy);
+
+    // Forward: the client keeps its copy and fast-forwards
+    std::optional<HistoryPlayback::Seek> seek = playback.seek(400);
+    ASSERT_TRUE(seek);
+    EXPECT_FALSE(seek->keyframe);
+    while (playback.position() < 400) {
+        run = playback.next();
+        ASSERT_TRUE(run);
+        EXPECT_EQ(run->delay, HistoryPlayback::Clock::duration::zero());
+        run->op.apply(copy);
+    }
+    EXPECT_EQ(copy, texts[400]);
+    EXPECT_EQ(playback.next()->toRevision, 405);
+
+    // Back: a keyframe there, and the stream stops where asked
+    seek = playback.seek(50);
+    ASSERT_TRUE(seek && seek->keyframe);
+    EXPECT_EQ(seek->keyframe->content, texts[50]);
+    playback.setEnd(52);
+    playback.setSpeed(0);
+    run = playback.next();
+    ASSERT_TRUE(run);
+    EXPECT_EQ(run->toRevision, 52);
+    EXPECT_FALSE(playback.next());
+    EXPECT_FALSE(playback.seek(601));
+}
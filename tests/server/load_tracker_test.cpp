@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "server/session/load_tracker.h"
+#include <chrono>
+#include <string>
+
+using namespace collab::server;
+
+TEST(LoadTrackerTest, CountsPerDocumentAndTakesRatesOverAWindow) {
+    LoadTracker tracker(8, std::chrono::hours(1));
+    const auto start = LoadTracker::Clock::now();
+    tracker.rollWindow(start);
+    for (int i = 0; i < 20; ++i) {
+        tracker.recordOperation("busy", i % 2 ? "alice" : "bob", 10);
+    }
+    tracker.recordOperation("quiet", "carol", 100);
+    tracker.recordBytesOut("busy", 60);
+    tracker.setSubscribers("busy", 3);
+    tracker.updateFootprint("busy", 5000, 20, 4096);
+    tracker.rollWindow(start + std::chrono::seconds(2));
+
+    const auto busy = tracker.document("busy");
+    EXPECT_EQ(busy.operations, 20u);
+    EXPECT_DOUBLE_EQ(busy.operationsPerSecond, 10.0);
+    EXPECT_EQ(busy.bytesIn, 200u);
+    EXPECT_EQ(busy.bytesOut, 60u);
+    EXPECT_EQ(busy.subscribers, 3u);
+    EXPECT_EQ(busy.transformNanos, 5000u);
+    EXPECT_EQ(busy.historyLength, 20u);
+    EXPECT_EQ(busy.memoryBytes, 4096u);
+    EXPECT_DOUBLE_EQ(tracker.document("quiet").operationsPerSecond, 0.5);
+
+    // A window without operations brings the rate back down
+    tracker.rollWindow(start + std::chrono::seconds(4));
+    EXPECT_EQ(tracker.document("busy").operationsPerSecond, 0.0);
+    EXPECT_EQ(tracker.document("busy").operations, 20u);
+
+    tracker.forget("quiet");
+    EXPECT_EQ(tracker.document("quiet").operations, 0u);
+    ASSERT_EQ(tracker.busiestDocuments(10).size(), 1u);
+}
+
+TEST(LoadTrackerTest, FindsTheHottestDocumentsAndUsers) {
+    LoadTracker tracker(4);
+    for (int i = 0; i < 1000; ++i) {
+        tracker.recordOperation(i % 4 ? "hot" : "doc-" + std::to_string(i), i % 3 ? "heavy" : "user-" + std::to_string(i), 1);
+    }
+
+    const auto documents = tracker.hottestDocuments(1);
+    ASSERT_EQ(documents.size(), 1u);
+    EXPECT_EQ(documents[0].id, "hot");
+    EXPECT_GE(documents[0].operations, 750u);
+    const auto users = tracker.hottestUsers(1);
+    ASSERT_EQ(users.size(), 1u);
+    EXPECT_EQ(users[0].id, "heavy");
+
+    const auto report = tracker.report(2);
+    EXPECT_EQ(report.at("hottestDocuments").at(0).at("id"), "hot");
+    EXPECT_EQ(report.at("hottestUsers").at(0).at("id"), "heavy");
+    EXPECT_EQ(report.at("documents").size(), 2u);
+    EXPECT_DOUBLE_EQ(report.at("windowSeconds").get<double>(), 10.0);
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "common/ot/write_ahead_log.h"
+#include "server/session/log_recovery.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+// Replays a document by recording it, once "gate" opens; "broken" documents fail
+struct Storage {
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool gate = true;
+    std::vector<std::string> order;
+
+    DocumentCache::Loader loader() {
+        return [this](const std::string& documentId) {
+            std::unique_lock<std::mutex> lock(mutex);
+            opened.wait(lock, [this] { return gate; });
+            if (documentId.find("broken") != std::string::npos) {
+                throw std::runtime_error("Corrupt log");
+            }
+            order.push_back(documentId);
+            return std::make_shared<DocumentController>(documentId);
+        };
+    }
+
+    void setGate(bool open) {
+        std::lock_guard<std::mutex> lock(mutex);
+        gate = open;
+        opened.notify_all();
+    }
+};
+
+void noSave(const std::string&, const DocumentController&) {}
+
+} // namespace
+
+TEST(LogRecoveryTest, RecoversEveryDocumentAcrossWorkers) {
+    Storage storage;
+    DocumentCache cache(SIZE_MAX, storage.loader(), noSave);
+    ThreadPool pool(4);
+
+    std::vector<std::string> documents;
+    for (int i = 0; i < 200; ++i) {
+        documents.push_back("doc" + std::to_string(i));
+    }
+    documents.push_back("broken");
+    documents.push_back("doc7");
+
+    LogRecovery recovery(cache, pool);
+    recovery.start(documents);
+    const LogRecovery::Stats stats = recovery.wait();
+
+    EXPECT_TRUE(stats.done);
+    EXPECT_EQ(stats.documents, 201u);
+    EXPECT_EQ(stats.recovered, 200u);
+    EXPECT_EQ(stats.failed, 1u);
+    EXPECT_EQ(storage.order.size(), 200u);
+    EXPECT_EQ(cache.getStats().resident, 200u);
+    EXPECT_FALSE(recovery.isPending("doc3"));
+    EXPECT_FALSE(recovery.isPending("broken"));
+}
+
+TEST(LogRecoveryTest, PrioritizedDocumentsGoFirstAndOpensDoNotWaitForTheRest) {
+    Storage storage;
+    storage.setGate(false);
+    DocumentCache cache(SIZE_MAX, storage.loader(), noSave);
+    ThreadPool pool(2);
+
+    LogRecovery recovery(cache, pool, 1);
+    recovery.start({"a", "b", "c", "d", "e"});
+    EXPECT_TRUE(recovery.isPending("e"));
+    EXPECT_TRUE(recovery.prioritize("e"));
+    EXPECT_TRUE(recovery.prioritize("c"));
+    EXPECT_FALSE(recovery.prioritize("e"));
+    EXPECT_FALSE(recovery.prioritize("unknown"));
+    storage.setGate(true);
+    const LogRecovery::Stats stats = recovery.wait();
+
+    // "a" may have been taken before the others were prioritized
+    ASSERT_EQ(storage.order.size(), 5u);
+    const size_t first = storage.order[0] == "a" ? 1 : 0;
+    EXPECT_EQ(storage.order[first], "e");
+    EXPECT_EQ(storage.order[first + 1], "c");
+    EXPECT_EQ(stats.prioritized, 2u);
+    EXPECT_EQ(stats.recovered, 5u);
+
+    // A document outside the recovery opens on its own
+    EXPECT_FALSE(recovery.isPending("f"));
+    EXPECT_NE(cache.open("f"), nullptr);
+}
+
+TEST(LogRecoveryTest, FindsTheDocumentsOfALogDirectory) {
+    const auto directory = std::filesystem::temp_directory_path() / "collab_log_recovery_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    {
+        ot::GroupCommit commit;
+        ot::WriteAheadLog first(directory, "first", commit);
+        ot::WriteAheadLog second(directory, "second", commit);
+    }
+    std::ofstream(directory / "notes.txt") << "not a log";
+    std::ofstream(directory / "third.snapshot") << "";
+
+    EXPECT_EQ(LogRecovery::documentsIn(directory), (std::vector<std::string>{"first", "second", "third"}));
+    EXPECT_TRUE(LogRecovery::documentsIn(directory / "missing").empty());
+    std::filesystem::remove_all(directory);
+}
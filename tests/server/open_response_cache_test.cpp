@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include "common/protocol/protocol.h"
+#include "server/session/open_response_cache.h"
+
+using namespace collab::server;
+using collab::protocol::DocumentMessage;
+using collab::protocol::MessageType;
+
+namespace {
+
+OpenResponseCache::Payload payload(const std::string& text) {
+    return std::make_shared<const std::string>(text);
+}
+
+} // namespace
+
+TEST(OpenResponseCacheTest, SplitsAResponseIntoItsClientsHeadAndASharedBody) {
+    DocumentMessage full(MessageType::DOC_RESPONSE);
+    full.clientId = "first";
+    full.sequenceNumber = 7;
+    full.documentId = "doc";
+    full.success = true;
+    full.documentVersion = 12;
+    // Content that looks like the field itself, escaped, does not move the split
+    full.documentContent = "text with \"documentId\": inside";
+    auto body = OpenResponseCache::bodyOf(full.toString());
+
+    DocumentMessage mine(MessageType::DOC_RESPONSE);
+    mine.clientId = "second";
+    mine.sequenceNumber = 42;
+    mine.documentId = "doc";
+    const std::string sent = OpenResponseCache::headOf(mine.toString()) + *body;
+
+    auto parsed = std::get<DocumentMessage>(collab::protocol::Message::fromString(sent));
+    EXPECT_EQ(parsed.clientId, "second");
+    EXPECT_EQ(parsed.sequenceNumber, 42u);
+    EXPECT_EQ(parsed.documentId, "doc");
+    EXPECT_EQ(parsed.documentContent, full.documentContent);
+    EXPECT_EQ(parsed.documentVersion, 12u);
+}
+
+TEST(OpenResponseCacheTest, SendsTheBodyAndTheOperationsSinceToEditors) {
+    OpenResponseCache cache(2);
+    EXPECT_FALSE(cache.find("doc", "edit", 5, true));
+    cache.store("doc", "edit", 5, payload("body@5"));
+
+    auto exact = cache.find("doc", "edit", 5, true);
+    ASSERT_TRUE(exact);
+    EXPECT_EQ(*exact->body, "body@5");
+    EXPECT_TRUE(exact->tail.empty());
+
+    cache.append("doc", 6, payload("op6"));
+    cache.append("other", 1, payload("elsewhere"));
+    auto behind = cache.find("doc", "edit", 6, true);
+    ASSERT_TRUE(behind);
+    EXPECT_EQ(behind->revision, 5);
+    ASSERT_EQ(behind->tail.size(), 1u);
+    EXPECT_EQ(*behind->tail[0], "op6");
+    // A viewer takes no operations, and a revision the entry does not reach is a miss
+    EXPECT_FALSE(cache.find("doc", "edit", 6, false));
+    EXPECT_FALSE(cache.find("doc", "edit", 7, true));
+
+    // A full tail drops the entry, so the next open encodes the document again
+    cache.append("doc", 7, payload("op7"));
+    cache.append("doc", 8, payload("op8"));
+    EXPECT_FALSE(cache.find("doc", "edit", 8, true));
+
+    const auto stats = cache.getStats();
+    EXPECT_EQ(stats.hits, 2u);
+    EXPECT_EQ(stats.tailOps, 1u);
+    EXPECT_EQ(stats.misses, 4u);
+}
+
+TEST(OpenResponseCacheTest, DropsABodyWhenAnOperationIsMissed) {
+    OpenResponseCache cache;
+    cache.store("doc", "edit", 1, payload("body@1"));
+    cache.store("doc", "view", 1, payload("view@1"));
+    // Revision 2 never recorded
+    cache.append("doc", 3, payload("op3"));
+    EXPECT_FALSE(cache.find("doc", "edit", 3, true));
+    EXPECT_FALSE(cache.find("doc", "view", 1, false));
+
+    cache.store("doc", "edit", 3, payload("body@3"));
+    cache.invalidate("doc");
+    EXPECT_FALSE(cache.find("doc", "edit", 3, true));
+}
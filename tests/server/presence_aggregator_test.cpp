@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include "server/session/presence_aggregator.h"
+
+using namespace collab::server;
+using namespace collab::protocol;
+using namespace std::chrono_literals;
+
+namespace {
+
+PresenceMessage presence(MessageType type, const std::string& document, const std::string& client) {
+    PresenceMessage message(type);
+    message.documentId = document;
+    message.clientId = client;
+    message.username = client + "-name";
+    return message;
+}
+
+PresenceMessage cursor(const std::string& document, const std::string& client, size_t position) {
+    PresenceMessage message = presence(MessageType::PRESENCE_CURSOR, document, client);
+    message.cursorPosition = position;
+    message.metadata["editor"] = "desktop";
+    return message;
+}
+
+} // namespace
+
+TEST(PresenceAggregatorTest, KeepsOnlyTheLatestMoveAndSendsWhatChanged) {
+    PresenceAggregator aggregator(50ms);
+    const auto start = PresenceAggregator::Clock::now();
+
+    PresenceMessage join = presence(MessageType::PRESENCE_JOIN, "doc", "alice");
+    join.cursorPosition = 0;
+    join.metadata["editor"] = "desktop";
+    aggregator.update(join);
+    EXPECT_FALSE(aggregator.nextFlush().has_value());
+
+    for (size_t position = 1; position <= 10; ++position) {
+        aggregator.update(cursor("doc", "alice", position));
+    }
+    auto diffs = aggregator.flush(start);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].type, MessageType::PRESENCE_UPDATE);
+    EXPECT_EQ(diffs[0].username, "alice-name");
+    EXPECT_EQ(diffs[0].cursorPosition, 10u);
+    // Unchanged since the join, so left out
+    EXPECT_TRUE(diffs[0].metadata.empty());
+    EXPECT_FALSE(diffs[0].selectionStart.has_value());
+
+    // A move that is undone within the window is never sent
+    aggregator.update(cursor("doc", "alice", 11));
+    aggregator.update(cursor("doc", "alice", 10));
+    EXPECT_TRUE(aggregator.flush(start + 50ms).empty());
+    EXPECT_FALSE(aggregator.nextFlush().has_value());
+}
+
+TEST(PresenceAggregatorTest, FlushesEachDocumentAtMostOncePerInterval) {
+    PresenceAggregator aggregator(50ms);
+    const auto start = PresenceAggregator::Clock::now();
+
+    aggregator.update(cursor("doc", "alice", 1));
+    aggregator.update(cursor("doc", "bob", 2));
+    EXPECT_EQ(aggregator.flush(start).size(), 2u);
+
+    aggregator.update(cursor("doc", "alice", 3));
+    aggregator.update(cursor("other", "carol", 4));
+    // The quiet document goes out at once; the busy one waits for its interval
+    auto diffs = aggregator.flush(start + 10ms);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].documentId, "other");
+    EXPECT_EQ(aggregator.nextFlush(), start + 50ms);
+
+    diffs = aggregator.flush(start + 50ms);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].clientId, "alice");
+    EXPECT_EQ(diffs[0].cursorPosition, 3u);
+}
+
+TEST(PresenceAggregatorTest, LeavingDropsPendingMoves) {
+    PresenceAggregator aggregator;
+    const auto start = PresenceAggregator::Clock::now();
+
+    aggregator.update(cursor("doc", "alice", 1));
+    aggregator.update(cursor("doc", "bob", 1));
+    aggregator.update(presence(MessageType::PRESENCE_LEAVE, "doc", "alice"));
+    EXPECT_EQ(aggregator.getUserCount("doc"), 1u);
+
+    auto diffs = aggregator.flush(start);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].clientId, "bob");
+
+    aggregator.update(cursor("doc", "bob", 2));
+    aggregator.removeClient("bob");
+    EXPECT_EQ(aggregator.getUserCount("doc"), 0u);
+    EXPECT_FALSE(aggregator.nextFlush().has_value());
+    EXPECT_TRUE(aggregator.flush(start + 1s).empty());
+}
+
+TEST(PresenceAggregatorTest, EditsMoveCursorsWithoutDiffs) {
+    PresenceAggregator aggregator(50ms);
+    const auto start = PresenceAggregator::Clock::now();
+
+    aggregator.update(cursor("doc", "alice", 10));
+    PresenceMessage selection = presence(MessageType::PRESENCE_SELECTION, "doc", "bob");
+    selection.selectionStart = 2;
+    selection.selectionEnd = 8;
+    aggregator.update(selection);
+    ASSERT_EQ(aggregator.flush(start).size(), 2u);
+
+    // Every client moves what it shows through the edit, so nothing needs sending
+    aggregator.transform("doc", 0, 0, 3);
+    aggregator.update(cursor("doc", "alice", 13));
+    EXPECT_TRUE(aggregator.flush(start + 50ms).empty());
+
+    // A move not yet flushed is moved too and still goes out
+    aggregator.update(cursor("doc", "carol", 6));
+    const std::vector<collab::ot::ValueOperation> edits = {
+        collab::ot::DeleteOp{0, 3, {}},
+        collab::ot::InsertOp{3, "xy"},
+    };
+    aggregator.transform("doc", edits);
+    auto diffs = aggregator.flush(start + 100ms);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].clientId, "carol");
+    EXPECT_EQ(diffs[0].cursorPosition, 5u);
+
+    // Bob's selection moved with both edits: [5, 11) -> [2, 8) -> [2, 10)
+    selection.selectionStart = 2;
+    selection.selectionEnd = 10;
+    aggregator.update(selection);
+    EXPECT_TRUE(aggregator.flush(start + 150ms).empty());
+    aggregator.transform("missing", 0, 1, 0);
+}
+
+TEST(PresenceAggregatorTest, SnapshotsCarryEveryoneAndTheCounts) {
+    PresenceAggregator aggregator(50ms);
+    aggregator.update(cursor("doc", "alice", 4));
+    PresenceMessage selection = presence(MessageType::PRESENCE_SELECTION, "doc", "bob");
+    selection.selectionStart = 0;
+    selection.selectionEnd = 3;
+    selection.documentHandle = 7;
+    aggregator.update(selection);
+
+    DocumentStatistics statistics;
+    statistics.add("doc", "two words");
+    std::vector<PresenceMessage> snapshot = aggregator.snapshot("doc", &statistics);
+    ASSERT_EQ(snapshot.size(), 2u);
+    std::sort(snapshot.begin(), snapshot.end(), [](const auto& a, const auto& b) { return a.clientId < b.clientId; });
+    EXPECT_EQ(snapshot[0].type, MessageType::PRESENCE_UPDATE);
+    EXPECT_EQ(snapshot[0].cursorPosition, 4u);
+    EXPECT_EQ(snapshot[0].metadata.at("editor"), "desktop");
+    EXPECT_EQ(snapshot[0].metadata.at(DocumentStatistics::WORDS_KEY), "2");
+    EXPECT_EQ(snapshot[1].selectionEnd, 3u);
+    EXPECT_FALSE(snapshot[1].documentHandle);
+    EXPECT_EQ(snapshot[1].metadata.at(DocumentStatistics::CHARACTERS_KEY), "9");
+
+    EXPECT_FALSE(aggregator.snapshot("doc").front().metadata.count(DocumentStatistics::WORDS_KEY));
+    EXPECT_TRUE(aggregator.snapshot("missing").empty());
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "server/priority_executor.h"
+
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Blocks tasks until released
+class Gate {
+public:
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++waiting_;
+        changed_.notify_all();
+        changed_.wait(lock, [this] { return open_; });
+    }
+    void open() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = true;
+        changed_.notify_all();
+    }
+    // Wait until a number of tasks are blocked
+    bool waitFor(int count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return changed_.wait_for(lock, 5s, [this, count] { return waiting_ >= count; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    int waiting_ = 0;
+    bool open_ = false;
+};
+
+bool waitUntil(const std::function<bool()>& done) {
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+} // namespace
+
+TEST(PriorityExecutorTest, BulkWorkLeavesWorkersForInteractive) {
+    ThreadPool pool(4);
+    PriorityExecutor executor(pool);
+    EXPECT_EQ(executor.getLaneStats(Lane::Bulk).limit, 2u);
+
+    Gate gate;
+    for (int i = 0; i < 20; ++i) {
+        executor.post(Lane::Bulk, [&gate]() { gate.wait(); });
+    }
+    ASSERT_TRUE(gate.waitFor(2));
+    LaneStats bulk = executor.getLaneStats(Lane::Bulk);
+    EXPECT_EQ(bulk.running, 2u);
+    EXPECT_EQ(bulk.depth, 18u);
+
+    // Edits still run while the bulk lane is full
+    std::atomic<int> edits{0};
+    for (int i = 0; i < 10; ++i) {
+        executor.post(Lane::Interactive, [&edits]() { ++edits; });
+    }
+    EXPECT_TRUE(waitUntil([&] { return edits.load() == 10; }));
+    EXPECT_EQ(executor.getLaneStats(Lane::Interactive).completed, 10u);
+
+    gate.open();
+    EXPECT_TRUE(waitUntil([&] { return executor.getLaneStats(Lane::Bulk).completed == 20; }));
+    bulk = executor.getLaneStats(Lane::Bulk);
+    EXPECT_EQ(bulk.depth, 0u);
+    EXPECT_EQ(bulk.running, 0u);
+    EXPECT_GT(bulk.maxWait.count(), 0);
+    EXPECT_GE(bulk.totalWait, bulk.maxWait);
+}
+
+TEST(PriorityExecutorTest, FreedWorkersTakeTheMostUrgentLane) {
+    ThreadPool pool(1);
+    PriorityExecutor executor(pool, {1, 1, 1});
+
+    Gate gate;
+    std::mutex mutex;
+    std::vector<Lane> order;
+    auto record = [&](Lane lane) {
+        return [&, lane]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(lane);
+        };
+    };
+    executor.post(Lane::Maintenance, [&gate]() { gate.wait(); });
+    ASSERT_TRUE(gate.waitFor(1));
+    executor.post(Lane::Maintenance, record(Lane::Maintenance));
+    executor.post(Lane::Bulk, record(Lane::Bulk));
+    executor.post(Lane::Interactive, record(Lane::Interactive));
+    gate.open();
+
+    EXPECT_TRUE(waitUntil([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return order.size() == 3;
+    }));
+    EXPECT_EQ(order, (std::vector<Lane>{Lane::Interactive, Lane::Bulk, Lane::Maintenance}));
+}
+
+TEST(PriorityExecutorTest, RaisingALimitStartsWaitingTasks) {
+    ThreadPool pool(3);
+    PriorityExecutor executor(pool, {3, 1, 1});
+
+    Gate gate;
+    for (int i = 0; i < 3; ++i) {
+        executor.post(Lane::Bulk, [&gate]() { gate.wait(); });
+    }
+    ASSERT_TRUE(gate.waitFor(1));
+    EXPECT_EQ(executor.getLaneStats(Lane::Bulk).depth, 2u);
+    executor.setLimit(Lane::Bulk, 3);
+    EXPECT_TRUE(gate.waitFor(3));
+    gate.open();
+}
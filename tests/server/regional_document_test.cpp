@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "server/session/regional_document.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+// Send each region what it is missing from every other
+void exchange(const std::vector<RegionalDocument*>& regions) {
+    for (RegionalDocument* to : regions) {
+        for (RegionalDocument* from : regions) {
+            if (from != to) {
+                to->merge(from->deltaFor(to->stateVector()));
+            }
+        }
+    }
+}
+
+} // namespace
+
+TEST(RegionalDocumentTest, AcknowledgesLocallyAndConvergesOnMerge) {
+    RegionalDocument us("us", "hello world");
+    auto apac = RegionalDocument::join("apac", us.snapshot());
+    ASSERT_EQ(apac->getText(), "hello world");
+
+    // Each region sequences its own users without hearing from the other
+    auto comma = us.submit(ot::InsertOp{5, ","}, "alice", 0);
+    ASSERT_TRUE(comma.has_value());
+    EXPECT_EQ(comma->revision, 1);
+    auto bang = apac->submit(ot::InsertOp{11, "!"}, "bob", 0);
+    auto capital = apac->submit(ot::DeleteOp{0, 1, {}}, "carol", 0);
+    ASSERT_TRUE(bang && capital);
+    EXPECT_EQ(apac->getText(), "ello world!");
+
+    // The merge turns the other region's edits into local operations
+    auto merged = us.merge(apac->deltaFor(us.stateVector()));
+    EXPECT_FALSE(merged.empty());
+    EXPECT_EQ(merged.back().revision, us.getRevision());
+    apac->merge(us.deltaFor(apac->stateVector()));
+    EXPECT_EQ(us.getText(), "ello, world!");
+    EXPECT_EQ(apac->getText(), us.getText());
+    EXPECT_EQ(us.getDocument().getDocument(), us.getText());
+    EXPECT_EQ(apac->getDocument().getDocument(), apac->getText());
+
+    // A client that had not seen the merge is transformed against it
+    auto late = us.submit(ot::InsertOp{0, "Oh, h"}, "alice", comma->revision);
+    ASSERT_TRUE(late.has_value());
+    EXPECT_EQ(us.getText(), "Oh, hello, world!");
+    exchange({&us, apac.get()});
+    EXPECT_EQ(apac->getText(), "Oh, hello, world!");
+    EXPECT_TRUE(us.merge(apac->deltaFor(us.stateVector())).empty());
+}
+
+TEST(RegionalDocumentTest, ClientsReplayingMergedOperationsStayInStep) {
+    std::mt19937 random(11);
+    RegionalDocument first("eu", "the quick brown fox jumps over the lazy dog");
+    auto second = RegionalDocument::join("us", first.snapshot());
+    auto third = RegionalDocument::join("apac", first.snapshot());
+    std::vector<RegionalDocument*> regions{&first, second.get(), third.get()};
+
+    // One client per region keeps a plain copy, built only from what the region broadcasts
+    struct Client {
+        std::string text;
+        int64_t revision = 0;
+    };
+    std::vector<Client> clients(regions.size(), Client{first.getText(), 0});
+    auto replay = [](Client& client, const ot::ValueOperation& op, int64_t revision) {
+        ASSERT_TRUE(ot::applyOperation(op, client.text));
+        client.revision = revision;
+    };
+
+    for (int round = 0; round < 40; ++round) {
+        for (size_t r = 0; r < regions.size(); ++r) {
+            Client& client = clients[r];
+            const size_t size = client.text.size();
+            ot::ValueOperation op = size > 0 && random() % 3 == 0
+                ? ot::ValueOperation(ot::DeleteOp{random() % size, 1, {}})
+                : ot::ValueOperation(ot::InsertOp{random() % (size + 1), std::string(1, static_cast<char>('A' + r))});
+            auto applied = regions[r]->submit(op, "client-" + std::to_string(r), client.revision);
+            ASSERT_TRUE(applied.has_value());
+            client.text = regions[r]->getText();
+            client.revision = applied->revision;
+        }
+        // Regions sync pairwise now and then, in no particular order
+        const size_t to = random() % regions.size();
+        const size_t from = (to + 1 + random() % (regions.size() - 1)) % regions.size();
+        for (const auto& sequenced : regions[to]->merge(regions[from]->deltaFor(regions[to]->stateVector()))) {
+            replay(clients[to], sequenced.operation, sequenced.revision);
+        }
+        ASSERT_EQ(clients[to].text, regions[to]->getText());
+    }
+
+    exchange(regions);
+    for (RegionalDocument* region : regions) {
+        EXPECT_EQ(region->getText(), first.getText());
+        EXPECT_EQ(region->getDocument().getDocument(), region->getText());
+    }
+    EXPECT_EQ(first.getStats().rejected, 0u);
+}
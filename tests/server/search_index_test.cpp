@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "server/session/search_index.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+std::vector<std::string> ids(const std::vector<SearchIndex::Match>& matches) {
+    std::vector<std::string> result;
+    for (const auto& match : matches) {
+        result.push_back(match.documentId);
+    }
+    return result;
+}
+
+} // namespace
+
+TEST(SearchIndexTest, FindsDocumentsWithOffsets) {
+    SearchIndex index;
+    index.add("a", "the quick brown fox jumps over the lazy dog");
+    index.add("b", "The Quick Brown Fox");
+    index.add("c", "nothing to see");
+
+    std::vector<SearchIndex::Match> matches = index.search("the");
+    ASSERT_EQ(ids(matches), (std::vector<std::string>{"a"}));
+    EXPECT_EQ(matches[0].offsets, (std::vector<size_t>{0, 31}));
+
+    EXPECT_EQ(ids(index.search("THE QUICK", 10, true)), (std::vector<std::string>{"a", "b"}));
+    EXPECT_EQ(index.search("quick", 10, true)[1].offsets, (std::vector<size_t>{4}));
+    // Every trigram of the query is indexed but never next to each other
+    EXPECT_TRUE(index.search("own fox the").empty());
+    EXPECT_TRUE(index.search("zebra").empty());
+
+    // Shorter than a trigram: every document is scanned
+    EXPECT_EQ(ids(index.search("o")), (std::vector<std::string>{"a", "b", "c"}));
+    EXPECT_EQ(ids(index.search("o", 2)), (std::vector<std::string>{"a", "b"}));
+
+    EXPECT_TRUE(index.remove("a"));
+    EXPECT_FALSE(index.remove("a"));
+    EXPECT_EQ(ids(index.search("quick", 10, true)), (std::vector<std::string>{"b"}));
+    EXPECT_EQ(index.getStats().documents, 2u);
+}
+
+TEST(SearchIndexTest, EditsMatchAFullReindex) {
+    SearchIndex edited;
+    std::string text = "abcabcabd";
+    edited.add("doc", text);
+
+    std::mt19937 random(7);
+    const std::string alphabet = "abcd";
+    for (int i = 0; i < 500; ++i) {
+        const size_t position = random() % (text.size() + 1);
+        if (text.size() > 4 && random() % 2 == 0) {
+            const size_t length = std::min<size_t>(random() % 4 + 1, text.size() - position);
+            ASSERT_TRUE(edited.apply("doc", ot::ValueOperation(ot::DeleteOp{position, length, {}})));
+            text.erase(position, length);
+        } else {
+            std::string inserted(random() % 3 + 1, alphabet[random() % alphabet.size()]);
+            ASSERT_TRUE(edited.apply("doc", ot::ValueOperation(ot::InsertOp{position, inserted})));
+            text.insert(position, inserted);
+        }
+    }
+
+    SearchIndex rebuilt;
+    rebuilt.add("doc", text);
+    EXPECT_EQ(edited.getStats().trigrams, rebuilt.getStats().trigrams);
+    for (const std::string query : {"abc", "dab", "aaaa", "cdc", "bbd", "dddd"}) {
+        ASSERT_EQ(edited.search(query).size(), rebuilt.search(query).size()) << query;
+        if (!rebuilt.search(query).empty()) {
+            EXPECT_EQ(edited.search(query)[0].offsets, rebuilt.search(query)[0].offsets) << query;
+        }
+    }
+    EXPECT_EQ(edited.getStats().edits, 500u);
+
+    // Edits past the end are refused and change nothing
+    EXPECT_FALSE(edited.apply("doc", ot::ValueOperation(ot::DeleteOp{text.size(), 1, {}})));
+    EXPECT_FALSE(edited.apply("missing", ot::ValueOperation(ot::InsertOp{0, "x"})));
+}
+
+TEST(SearchIndexTest, FollowsADocumentAndAWorkspace) {
+    auto root = std::make_shared<fs::Directory>("", "owner");
+    root->createDirectory("docs", "owner")->createFile("notes.txt", "owner", "meeting notes");
+    root->createFile("README.md", "owner", "read the notes");
+
+    SearchIndex index;
+    EXPECT_EQ(index.addTree(*root), 2u);
+    EXPECT_EQ(ids(index.search("notes")), (std::vector<std::string>{"README.md", "docs/notes.txt"}));
+
+    DocumentController document("draft");
+    index.watch("draft", document);
+    document.applyOperation(std::make_shared<ot::InsertOperation>(5, " of the notes"), "alice");
+    document.applyOperation(std::make_shared<ot::DeleteOperation>(0, 1), "alice");
+    EXPECT_EQ(index.search("raft of the notes")[0].documentId, "draft");
+    EXPECT_EQ(index.search("notes").size(), 3u);
+    EXPECT_TRUE(index.search("draft").empty());
+}
+
+TEST(SearchIndexTest, AnswersDocSearch) {
+    SearchIndex index;
+    index.add("a", "one two one");
+    index.add("b", "One");
+
+    protocol::DocumentMessage request(protocol::MessageType::DOC_SEARCH);
+    request.clientId = "client";
+    request.metadata[SearchIndex::QUERY_KEY] = "one";
+    request.metadata[SearchIndex::IGNORE_CASE_KEY] = "true";
+    // Over the wire and back
+    request = protocol::Message::fromJson<protocol::DocumentMessage>(nlohmann::json::parse(request.toString()));
+    EXPECT_EQ(request.type, protocol::MessageType::DOC_SEARCH);
+
+    protocol::DocumentMessage response = index.answer(request);
+    EXPECT_EQ(response.type, protocol::MessageType::DOC_RESPONSE);
+    EXPECT_TRUE(response.success.value_or(false));
+    EXPECT_EQ(response.clientId, "client");
+    EXPECT_EQ(response.documentList, (std::vector<std::string>{"a", "b"}));
+    EXPECT_EQ(response.metadata.at("offsets:a"), "0,8");
+    EXPECT_EQ(response.metadata.at("offsets:b"), "0");
+
+    request.metadata[SearchIndex::LIMIT_KEY] = "1";
+    EXPECT_EQ(index.answer(request).documentList, (std::vector<std::string>{"a"}));
+
+    request.metadata.erase(SearchIndex::QUERY_KEY);
+    EXPECT_FALSE(index.answer(request).success.value_or(true));
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server/session/sectioned_document.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace collab::ot;
+
+namespace {
+
+// Lines of ten characters, "line 0000\n" and so on
+std::string makeText(int lines) {
+    std::string text;
+    for (int i = 0; i < lines; ++i) {
+        std::string number = std::to_string(i);
+        text += "line " + std::string(4 - number.size(), '0') + number + "\n";
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(SectionedDocumentTest, CutsAtLineBreaksAndLaysTheSectionsOut) {
+    const std::string text = makeText(100);
+    SectionedDocument document(text, 95);
+
+    EXPECT_EQ(document.sectionCount(), 10);
+    EXPECT_EQ(document.section(0)->getDocument(), text.substr(0, 100));
+    EXPECT_EQ(document.getDocument(), text);
+
+    std::vector<SectionedDocument::SectionInfo> layout = document.layout();
+    ASSERT_EQ(layout.size(), 10);
+    EXPECT_EQ(layout[3].offset, 300);
+    EXPECT_EQ(layout[3].length, 100);
+
+    // A boundary belongs to the section before it
+    auto at = document.locate(300);
+    ASSERT_TRUE(at);
+    EXPECT_EQ(at->section, 2);
+    EXPECT_EQ(at->offset, 100);
+    EXPECT_EQ(document.locate(301)->section, 3);
+    EXPECT_FALSE(document.locate(1001));
+}
+
+TEST(SectionedDocumentTest, SequencesEachSectionOnItsOwn) {
+    const std::string text = makeText(400);
+    SectionedDocument document(text, 1000);
+    ASSERT_EQ(document.sectionCount(), 4);
+
+    // One writer per section, each typing at the start of its section on its own revisions
+    std::vector<std::thread> writers;
+    for (size_t section = 0; section < 4; ++section) {
+        writers.emplace_back([&document, section] {
+            for (int i = 0; i < 200; ++i) {
+                SectionedDocument::SectionEdit edit{section, i, std::make_shared<InsertOperation>(0, "x")};
+                auto applied = document.submit(edit, "user" + std::to_string(section));
+                ASSERT_TRUE(applied);
+                EXPECT_EQ(applied->revision, i + 1);
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    std::string expected;
+    for (size_t section = 0; section < 4; ++section) {
+        expected += std::string(200, 'x') + text.substr(section * 1000, 1000);
+        EXPECT_EQ(document.section(section)->getRevision(), 200);
+    }
+    EXPECT_EQ(document.getDocument(), expected);
+    EXPECT_EQ(document.layout()[3].offset, 3 * 1200);
+    EXPECT_EQ(document.getStats().submitted, 800);
+}
+
+TEST(SectionedDocumentTest, AppliesAnEditAcrossABoundaryAsOne) {
+    const std::string text = makeText(20);
+    SectionedDocument document(text, 100);
+    ASSERT_EQ(document.sectionCount(), 2);
+    const std::vector<SectionedDocument::SectionInfo> seen = document.layout();
+
+    // Someone edits the second section meanwhile
+    ASSERT_TRUE(document.submit({1, 0, std::make_shared<InsertOperation>(50, "!")}, "bob"));
+
+    // Delete "0009\nline 0010" across the boundary, on the layout seen before
+    const DeleteOperation selection(95, 14);
+    std::vector<SectionedDocument::SectionEdit> parts = SectionedDocument::split(selection, seen);
+    ASSERT_EQ(parts.size(), 2);
+    EXPECT_EQ(parts[0].section, 0);
+    EXPECT_EQ(parts[1].section, 1);
+    EXPECT_EQ(parts[1].baseRevision, 0);
+
+    std::vector<SectionedDocument::Sequenced> applied = document.submit(parts, "alice");
+    ASSERT_EQ(applied.size(), 2);
+    std::string expected = text;
+    expected.insert(150, "!");
+    expected.erase(95, 14);
+    EXPECT_EQ(document.getDocument(), expected);
+    EXPECT_EQ(document.layout()[1].offset, 95);
+
+    // A part that does not fit leaves every section as it was
+    std::vector<SectionedDocument::SectionEdit> bad{
+        {0, 1, std::make_shared<InsertOperation>(0, "a")},
+        {1, 2, std::make_shared<DeleteOperation>(80, 50)}};
+    EXPECT_TRUE(document.submit(bad, "alice").empty());
+    EXPECT_EQ(document.getDocument(), expected);
+    EXPECT_EQ(document.getStats().spanning, 1);
+    EXPECT_EQ(document.getStats().rejected, 1);
+}
@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include "server/session/self_test.h"
+#include <chrono>
+#include <stdexcept>
+
+using namespace collab::server;
+
+TEST(SelfTestTest, ParsesTrafficOptions) {
+    const auto options = SelfTestOptions::parse(
+        {"--selftest", "--documents=2", "--clients=3", "--document-size=100", "--edit-rate=50",
+         "--presence-ratio=0.25", "--seconds=0.5"});
+    EXPECT_EQ(options.documents, 2u);
+    EXPECT_EQ(options.clientsPerDocument, 3u);
+    EXPECT_EQ(options.documentSize, 100u);
+    EXPECT_DOUBLE_EQ(options.editsPerSecond, 50.0);
+    EXPECT_DOUBLE_EQ(options.presenceRatio, 0.25);
+    EXPECT_EQ(options.duration, std::chrono::milliseconds(500));
+
+    EXPECT_THROW(SelfTestOptions::parse({"--clients=many"}), std::invalid_argument);
+    EXPECT_THROW(SelfTestOptions::parse({"--presence-ratio=2"}), std::invalid_argument);
+}
+
+TEST(SelfTestTest, DrivesConcurrentEditsThroughTheEditPath) {
+    SelfTestOptions options;
+    options.documents = 2;
+    options.clientsPerDocument = 4;
+    options.documentSize = 64;
+    options.presenceRatio = 0.3;
+    options.duration = std::chrono::milliseconds(200);
+    const auto report = SelfTest(options).run();
+
+    EXPECT_GT(report.edits, 0u);
+    EXPECT_GT(report.presenceUpdates, 0u);
+    // Clients edit on stale revisions, and every one of those edits still transforms and applies
+    EXPECT_EQ(report.rejected, 0u);
+    EXPECT_GT(report.deliveries, report.edits * 2);
+    EXPECT_EQ(report.editLatency.count, report.edits);
+    EXPECT_GT(report.editsPerSecond(), 0.0);
+    EXPECT_LE(report.editLatency.valueAt(0.5), report.editLatency.valueAt(0.99));
+    EXPECT_EQ(report.toJson().at("clientsPerDocument"), 4u);
+}
+
+TEST(SelfTestTest, PacesAtTheConfiguredRate) {
+    SelfTestOptions options;
+    options.documents = 1;
+    options.clientsPerDocument = 2;
+    options.editsPerSecond = 100;
+    options.presenceRatio = 0;
+    options.duration = std::chrono::milliseconds(500);
+    const auto report = SelfTest(options).run();
+
+    // Two clients at 100 edits a second each, for half a second
+    EXPECT_NEAR(static_cast<double>(report.edits), 100.0, 15.0);
+}
@@ -0,0 +1,293 @@
+#include <gtest/gtest.h>
+#include "client/network/client_manager.h"
+#include "server/session/server_manager.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace collab;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr const char* DOCUMENT_ID = "notes";
+
+// Messages one client received, to wait on from the test's thread
+template <typename T>
+class Inbox {
+public:
+    void push(const T& message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        messages_.push_back(message);
+        arrived_.notify_all();
+    }
+
+    // Wait until count messages arrived; false after the timeout
+    bool waitFor(size_t count, std::chrono::milliseconds timeout = 2s) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return arrived_.wait_for(lock, timeout, [&]() { return messages_.size() >= count; });
+    }
+
+    std::vector<T> messages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return messages_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable arrived_;
+    std::vector<T> messages_;
+};
+
+// What a client of the test receives, by struct
+struct Received {
+    Inbox<protocol::AuthMessage> auth;
+    Inbox<protocol::DocumentMessage> documents;
+    Inbox<protocol::EditMessage> edits;
+
+    template <typename Router>
+    void listen(Router& router) {
+        router.template on<protocol::AuthMessage>([this](const protocol::AuthMessage& message) { auth.push(message); })
+              .template on<protocol::DocumentMessage>([this](const protocol::DocumentMessage& message) { documents.push(message); })
+              .template on<protocol::EditMessage>([this](const protocol::EditMessage& message) { edits.push(message); });
+    }
+};
+
+// A second client; ClientManager holds one connection, so this one has a channel of its own
+class RawClient {
+public:
+    explicit RawClient(protocol::WireFormat format) : format_(format), client_(io_) {
+        received.listen(router_);
+    }
+
+    ~RawClient() {
+        io_.stop();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    bool connect(int port) {
+        client_.set_connection_handler([this](network::TcpConnection::pointer connection) {
+            // Set up as ClientManager sets up its own
+            channel_ = std::make_shared<Channel>(connection);
+            channel_->codec().setPreferredFormat(format_);
+            if (format_ == protocol::WireFormat::JSON) {
+                channel_->codec().setCompression(false);
+            } else {
+                connection->set_frame_mode(network::TcpConnection::frame_mode::length_prefixed);
+            }
+            channel_->set_frame_handler([this](auto, protocol::WireCodec& codec, std::string_view frame) {
+                router_.route(codec, frame);
+            });
+            settle(true);
+        });
+        client_.set_error_handler([this](const std::string&) { settle(false); });
+        client_.connect("127.0.0.1", std::to_string(port));
+        thread_ = std::thread([this]() { io_.run(); });
+        return connected_.get_future().get();
+    }
+
+    void send(const protocol::Message& message) {
+        channel_->send_message(message);
+    }
+
+    // The format the login settled on
+    protocol::WireFormat format() const {
+        return channel_->codec().getFormat();
+    }
+
+    Received received;
+
+private:
+    using Channel = network::MessageChannel<protocol::Message, protocol::WireCodec>;
+
+    // Only the first outcome of the attempt counts
+    void settle(bool connected) {
+        if (!settled_.exchange(true)) {
+            connected_.set_value(connected);
+        }
+    }
+
+    protocol::WireFormat format_;
+    boost::asio::io_context io_;
+    network::TcpClient client_;
+    std::shared_ptr<Channel> channel_;
+    protocol::MessageRouter<> router_;
+    std::thread thread_;
+    std::promise<bool> connected_;
+    std::atomic<bool> settled_{false};
+};
+
+protocol::AuthMessage login(const std::string& username) {
+    protocol::AuthMessage message(protocol::MessageType::AUTH_LOGIN);
+    message.username = username;
+    return message;
+}
+
+protocol::DocumentMessage open(const std::string& documentId) {
+    protocol::DocumentMessage message(protocol::MessageType::DOC_OPEN);
+    message.documentId = documentId;
+    return message;
+}
+
+protocol::EditMessage insert(size_t position, const std::string& text, uint64_t sequenceNumber, uint64_t baseVersion) {
+    protocol::EditMessage message(protocol::MessageType::EDIT_INSERT);
+    message.documentId = DOCUMENT_ID;
+    message.position = position;
+    message.text = text;
+    message.sequenceNumber = sequenceNumber;
+    message.documentVersion = baseVersion;
+    return message;
+}
+
+// The edit of a type and text a client received, if any
+std::optional<protocol::EditMessage> findEdit(const std::vector<protocol::EditMessage>& edits, protocol::MessageType type,
+                                              const std::optional<std::string>& text = std::nullopt) {
+    for (const auto& edit : edits) {
+        if (edit.type == type && (!text || edit.text == text)) {
+            return edit;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+// A ServerManager and its clients over loopback, with a minimal server of one plain-text document
+class ServerManagerLoopbackTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        server::ServerManager& server = server::ServerManager::getInstance();
+        server.router()
+            .on<protocol::AuthMessage>([&server](const std::string& clientId, const protocol::AuthMessage& auth) {
+                protocol::AuthMessage success(protocol::MessageType::AUTH_SUCCESS);
+                success.username = auth.username;
+                server.sendMessage(clientId, success);
+            })
+            .on<protocol::DocumentMessage>([this, &server](const std::string& clientId, const protocol::DocumentMessage& request) {
+                protocol::DocumentMessage response(protocol::MessageType::DOC_RESPONSE);
+                response.documentId = request.documentId;
+                response.success = server.joinDocument(clientId, request.documentId);
+                {
+                    std::lock_guard<std::mutex> lock(documentMutex_);
+                    response.documentContent = content_;
+                }
+                server.sendMessage(clientId, response);
+            })
+            .on<protocol::EditMessage>([this, &server](const std::string& clientId, const protocol::EditMessage& edit) {
+                // Every edit of the test is an insert at the current version, so nothing is transformed
+                protocol::EditMessage applied = edit;
+                {
+                    std::lock_guard<std::mutex> lock(documentMutex_);
+                    content_.insert(*edit.position, *edit.text);
+                    applied.documentVersion = ++version_;
+                }
+                applied.clientId = clientId;
+                server.acknowledgeEdit(clientId, edit.documentId, edit.sequenceNumber, applied.documentVersion);
+                server.broadcastMessage(applied);
+            });
+    }
+
+    void TearDown() override {
+        client::ClientManager::getInstance().disconnect();
+        server::ServerManager& server = server::ServerManager::getInstance();
+        server.stop();
+        server.router()
+            .on<protocol::AuthMessage>(nullptr)
+            .on<protocol::DocumentMessage>(nullptr)
+            .on<protocol::EditMessage>(nullptr);
+        client::ClientManager::getInstance().router()
+            .on<protocol::AuthMessage>(nullptr)
+            .on<protocol::DocumentMessage>(nullptr)
+            .on<protocol::EditMessage>(nullptr);
+    }
+
+    // Log in two clients, open the document on both and edit it from each
+    void loginJoinEditAndBroadcast(protocol::WireFormat format) {
+        server::ServerManager& server = server::ServerManager::getInstance();
+        server.setWireFormat(format);
+        ASSERT_TRUE(server.start(0));
+        const int port = server.getPort();
+        ASSERT_GT(port, 0);
+
+        client::ClientManager& alice = client::ClientManager::getInstance();
+        aliceReceived_.listen(alice.router());
+        alice.setWireFormat(format);
+        ASSERT_TRUE(alice.connect("127.0.0.1", port));
+        RawClient bob(format);
+        ASSERT_TRUE(bob.connect(port));
+
+        // Login
+        alice.sendMessage(login("alice"));
+        bob.send(login("bob"));
+        ASSERT_TRUE(aliceReceived_.auth.waitFor(1));
+        ASSERT_TRUE(bob.received.auth.waitFor(1));
+        const protocol::AuthMessage aliceAuth = aliceReceived_.auth.messages().front();
+        EXPECT_EQ(aliceAuth.type, protocol::MessageType::AUTH_SUCCESS);
+        EXPECT_EQ(aliceAuth.username, "alice");
+        EXPECT_TRUE(aliceAuth.sessionHandle.has_value());
+        EXPECT_EQ(bob.received.auth.messages().front().type, protocol::MessageType::AUTH_SUCCESS);
+        EXPECT_EQ(bob.format(), format);
+        EXPECT_EQ(server.getClientCount(), 2u);
+
+        // Join
+        alice.sendMessage(open(DOCUMENT_ID));
+        ASSERT_TRUE(aliceReceived_.documents.waitFor(1));
+        bob.send(open(DOCUMENT_ID));
+        ASSERT_TRUE(bob.received.documents.waitFor(1));
+        for (const auto& response : {aliceReceived_.documents.messages().front(), bob.received.documents.messages().front()}) {
+            EXPECT_EQ(response.type, protocol::MessageType::DOC_RESPONSE);
+            EXPECT_EQ(response.documentId, DOCUMENT_ID);
+            EXPECT_EQ(response.success, true);
+            EXPECT_EQ(response.documentContent, "");
+        }
+
+        // Alice edits: she is acknowledged, and both of them are sent the edit
+        alice.sendMessage(insert(0, "hello", 1, 0));
+        ASSERT_TRUE(aliceReceived_.edits.waitFor(2));
+        ASSERT_TRUE(bob.received.edits.waitFor(1));
+        const auto broadcast = findEdit(bob.received.edits.messages(), protocol::MessageType::EDIT_INSERT, "hello");
+        ASSERT_TRUE(broadcast.has_value());
+        EXPECT_EQ(broadcast->position, 0u);
+        EXPECT_EQ(broadcast->documentVersion, 1u);
+        EXPECT_FALSE(broadcast->clientId.empty());
+        EXPECT_TRUE(findEdit(aliceReceived_.edits.messages(), protocol::MessageType::EDIT_INSERT, "hello").has_value());
+        const auto ack = findEdit(aliceReceived_.edits.messages(), protocol::MessageType::EDIT_APPLY);
+        ASSERT_TRUE(ack.has_value());
+        EXPECT_EQ(ack->sequenceNumber, 1u);
+        EXPECT_EQ(ack->documentVersion, 1u);
+
+        // Bob edits on top of it, and Alice is sent his edit
+        bob.send(insert(5, " world", 1, 1));
+        ASSERT_TRUE(aliceReceived_.edits.waitFor(3));
+        ASSERT_TRUE(bob.received.edits.waitFor(3));
+        const auto reply = findEdit(aliceReceived_.edits.messages(), protocol::MessageType::EDIT_INSERT, " world");
+        ASSERT_TRUE(reply.has_value());
+        EXPECT_EQ(reply->position, 5u);
+        EXPECT_EQ(reply->documentVersion, 2u);
+        EXPECT_NE(reply->clientId, broadcast->clientId);
+
+        std::lock_guard<std::mutex> lock(documentMutex_);
+        EXPECT_EQ(content_, "hello world");
+    }
+
+    Received aliceReceived_;
+    std::mutex documentMutex_;
+    std::string content_;
+    uint64_t version_ = 0;
+};
+
+TEST_F(ServerManagerLoopbackTest, LoginJoinEditAndBroadcastOverJson) {
+    loginJoinEditAndBroadcast(protocol::WireFormat::JSON);
+}
+
+TEST_F(ServerManagerLoopbackTest, LoginJoinEditAndBroadcastOverBinary) {
+    loginJoinEditAndBroadcast(protocol::WireFormat::BINARY);
+}
@@ -103,7 +103,7 @@ TEST_F(ServerTest, HandleConnection) {
         EXPECT_TRUE(client_socket.is_open());
         
         // Send data to server
-        std::string message = "Hello, Server!";
+        std::string message = "Hello, Server!\n";
         boost::asio::write(client_socket, boost::asio::buffer(message));
         
         // Receive response from server
@@ -136,6 +136,344 @@ TEST_F(ServerTest, HandleConnection) {
     }
 }
 
+// Test that session commands are answered, in order, next to pool work
+TEST_F(ServerTest, AnswersSessionCommands) {
+    unsigned short port = 0;
+    server = std::make_unique<Server>(io_context, port, 2);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        boost::asio::ip::tcp::socket client_socket(client_io_context);
+        client_socket.connect(boost::asio::ip::tcp::endpoint(
+            boost::asio::ip::address::from_string("127.0.0.1"), port));
+        
+        auto request = [&client_socket](const std::string& message) {
+            boost::asio::write(client_socket, boost::asio::buffer(message));
+            std::vector<char> recv_buffer(1024);
+            size_t len = client_socket.read_some(boost::asio::buffer(recv_buffer));
+            return std::string(recv_buffer.begin(), recv_buffer.begin() + len);
+        };
+        
+        EXPECT_EQ(request("LOGIN:alice\n").rfind("SUCCESS: Logged in as alice. Resume token: ", 0), 0u);
+        EXPECT_EQ(request("OPEN_DOCUMENT:doc1\r\n").rfind("SUCCESS: Opened document doc1.", 0), 0u);
+        EXPECT_EQ(request("CLOSE_DOCUMENT:doc1\n"), "SUCCESS: Closed document doc1\n");
+        EXPECT_EQ(request("CLOSE_DOCUMENT:doc1\n"), "ERROR: Document not open\n");
+        
+        // Session commands ran inline; opening the document went through the bulk lane
+        auto bulkCompleted = [this]() {
+            return server->getExecutorStats()[static_cast<size_t>(Lane::Bulk)].completed;
+        };
+        for (int i = 0; i < 100 && bulkCompleted() < 1; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(bulkCompleted(), 1u);
+        EXPECT_EQ(server->getExecutorStats()[static_cast<size_t>(Lane::Interactive)].completed, 0u);
+        
+        client_socket.close();
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+// Test that a client whose connection dropped gets its session back on a new one
+TEST_F(ServerTest, ResumesDroppedSessions) {
+    unsigned short port = 0;
+    server = std::make_unique<Server>(io_context, port, 2);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        auto connect = [&]() {
+            auto socket = std::make_unique<boost::asio::ip::tcp::socket>(client_io_context);
+            socket->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+            return socket;
+        };
+        auto request = [](boost::asio::ip::tcp::socket& socket, const std::string& message) {
+            boost::asio::write(socket, boost::asio::buffer(message));
+            boost::asio::streambuf reply;
+            boost::asio::read_until(socket, reply, '\n');
+            std::istream stream(&reply);
+            std::string line;
+            std::getline(stream, line);
+            return line;
+        };
+        const std::string tokenPrefix = "Resume token: ";
+        auto tokenOf = [&](const std::string& reply) {
+            const size_t at = reply.find(tokenPrefix) + tokenPrefix.size();
+            return reply.substr(at, reply.find('.', at) - at);
+        };
+        
+        auto first = connect();
+        const std::string token = tokenOf(request(*first, "LOGIN:carol\n"));
+        ASSERT_EQ(token.size(), 32u);
+        ASSERT_EQ(request(*first, "OPEN_DOCUMENT:doc1\n").rfind("SUCCESS", 0), 0u);
+        first->close();
+        for (int i = 0; i < 100 && server->getSessionHandler().getResumption().getStats().retained == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        
+        auto second = connect();
+        const std::string resumed = request(*second, "RESUME:" + token + "\n");
+        EXPECT_EQ(resumed.rfind("SUCCESS: Resumed as carol. Resume token: ", 0), 0u) << resumed;
+        EXPECT_NE(resumed.find(". Open documents: doc1@0"), std::string::npos) << resumed;
+        EXPECT_NE(tokenOf(resumed), token);
+        EXPECT_EQ(request(*second, "CLOSE_DOCUMENT:doc1\n"), "SUCCESS: Closed document doc1");
+        
+        // The token is used up
+        auto third = connect();
+        EXPECT_EQ(request(*third, "RESUME:" + token + "\n"), "ERROR: Session cannot be resumed");
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+// Test that a drain tells connections to go in waves, after answering what they sent
+TEST_F(ServerTest, DrainsConnectionsInWaves) {
+    unsigned short port = 0;
+    server = std::make_unique<Server>(io_context, port, 2);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> sockets;
+        std::vector<std::string> tokens;
+        for (int i = 0; i < 3; ++i) {
+            auto socket = std::make_unique<boost::asio::ip::tcp::socket>(client_io_context);
+            socket->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+            boost::asio::write(*socket, boost::asio::buffer("LOGIN:user" + std::to_string(i) + "\n"));
+            boost::asio::streambuf reply;
+            boost::asio::read_until(*socket, reply, '\n');
+            std::istream stream(&reply);
+            std::string line;
+            std::getline(stream, line);
+            tokens.push_back(line.substr(line.find("Resume token: ") + 14));
+            sockets.push_back(std::move(socket));
+        }
+        
+        // Each reads the reply to a request in flight, then the notice, then the end of the stream
+        boost::asio::write(*sockets[0], boost::asio::buffer(std::string("hello\n")));
+        std::promise<void> drained;
+        server->drain({"10.0.0.2:8080", 2, std::chrono::milliseconds(100)}, [&drained]() { drained.set_value(); });
+        std::vector<std::string> notices;
+        for (int i = 0; i < 3; ++i) {
+            std::string received;
+            boost::system::error_code error;
+            boost::asio::read(*sockets[i], boost::asio::dynamic_buffer(received), error);
+            EXPECT_EQ(error, boost::asio::error::eof);
+            if (i == 0) {
+                EXPECT_EQ(received.rfind("Server received: hello", 0), 0u) << received;
+            }
+            const size_t at = received.find("DISCONNECT: ");
+            ASSERT_NE(at, std::string::npos) << received;
+            notices.push_back(received.substr(at, received.size() - at - 1));
+        }
+        ASSERT_EQ(drained.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        EXPECT_TRUE(server->isDraining());
+        
+        // Two in the first wave, spread over its interval, and one in the next
+        std::vector<std::string> expected;
+        for (int i = 0; i < 3; ++i) {
+            const bool told = std::any_of(notices.begin(), notices.end(), [&](const std::string& notice) {
+                return notice.find("Resume token: " + tokens[i]) != std::string::npos;
+            });
+            EXPECT_TRUE(told) << tokens[i];
+        }
+        EXPECT_EQ(std::count_if(notices.begin(), notices.end(), [](const std::string& notice) {
+            return notice.rfind("DISCONNECT: Reconnect to 10.0.0.2:8080 in 50 ms.", 0) == 0;
+        }), 1);
+        EXPECT_EQ(std::count_if(notices.begin(), notices.end(), [](const std::string& notice) {
+            return notice.rfind("DISCONNECT: Reconnect to 10.0.0.2:8080 in 0 ms.", 0) == 0;
+        }), 2);
+        
+        // Their sessions wait to be resumed, and nobody new gets in
+        EXPECT_EQ(server->getSessionHandler().getResumption().getStats().retained, 3u);
+        boost::asio::ip::tcp::socket late(client_io_context);
+        boost::system::error_code refused;
+        late.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port), refused);
+        EXPECT_TRUE(refused);
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+// Test that pipelined and split requests are answered in order
+TEST_F(ServerTest, PipelinesRequests) {
+    unsigned short port = 0;
+    server = std::make_unique<Server>(io_context, port, 4);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        boost::asio::ip::tcp::socket client_socket(client_io_context);
+        client_socket.connect(boost::asio::ip::tcp::endpoint(
+            boost::asio::ip::address::from_string("127.0.0.1"), port));
+        
+        // Session commands between pool work must still apply in order
+        std::string requests = "LOGIN:bob\nOPEN_DOCUMENT:doc1\nCLOSE_DOCUMENT:doc1\n";
+        for (int i = 0; i < 50; ++i) {
+            requests += "op " + std::to_string(i) + "\n";
+        }
+        // The last request arrives in two pieces
+        boost::asio::write(client_socket, boost::asio::buffer(requests + "op la"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        boost::asio::write(client_socket, boost::asio::buffer(std::string("st\n")));
+        
+        boost::asio::streambuf replies;
+        std::istream stream(&replies);
+        std::vector<std::string> lines;
+        while (lines.size() < 54) {
+            boost::asio::read_until(client_socket, replies, '\n');
+            std::string line;
+            std::getline(stream, line);
+            lines.push_back(line);
+        }
+        
+        EXPECT_EQ(lines[0].rfind("SUCCESS: Logged in as bob. Resume token: ", 0), 0u);
+        EXPECT_EQ(lines[1].rfind("SUCCESS: Opened document doc1.", 0), 0u);
+        EXPECT_EQ(lines[2], "SUCCESS: Closed document doc1");
+        for (int i = 0; i < 50; ++i) {
+            EXPECT_EQ(lines[3 + i].rfind("Server received: op " + std::to_string(i) + " ", 0), 0u) << lines[3 + i];
+        }
+        EXPECT_EQ(lines[53].rfind("Server received: op last ", 0), 0u) << lines[53];
+        
+        client_socket.close();
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+// Test that idle connections are closed while active ones stay
+TEST_F(ServerTest, ClosesIdleConnections) {
+    unsigned short port = 0;
+    // Deadlines advance every second; one second without activity is idle
+    server = std::make_unique<Server>(io_context, port, 1, 1, 1);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        boost::asio::ip::tcp::endpoint server_endpoint(
+            boost::asio::ip::address::from_string("127.0.0.1"), port);
+        boost::asio::ip::tcp::socket idle_socket(client_io_context);
+        boost::asio::ip::tcp::socket active_socket(client_io_context);
+        idle_socket.connect(server_endpoint);
+        active_socket.connect(server_endpoint);
+        
+        for (int i = 0; i < 6; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            boost::asio::write(active_socket, boost::asio::buffer(std::string("LOGIN:still-here\n")));
+            std::vector<char> recv_buffer(1024);
+            active_socket.read_some(boost::asio::buffer(recv_buffer));
+        }
+        
+        // The idle client was disconnected, the active one was not
+        std::vector<char> recv_buffer(1024);
+        boost::system::error_code error;
+        idle_socket.read_some(boost::asio::buffer(recv_buffer), error);
+        EXPECT_EQ(error, boost::asio::error::eof);
+        EXPECT_EQ(server->getSessionCount(), 1);
+        
+        active_socket.close();
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+// Test that connections get a session with their first request, and that accepts wait for pending ones
+TEST_F(ServerTest, AdmitsPendingConnectionsUpToTheLimit) {
+    unsigned short port = 0;
+    server = std::make_unique<Server>(io_context, port, 1);
+    collab::network::AdmissionControl::limits limits;
+    limits.max_pending = 1;
+    limits.handshake_timeout = std::chrono::milliseconds(300);
+    server->setAdmissionLimits(limits);
+    port = server->getEndpoint().port();
+    std::thread io_thread = runIoContextInThread();
+    
+    try {
+        boost::asio::io_context client_io_context;
+        boost::asio::ip::tcp::endpoint server_endpoint(
+            boost::asio::ip::address::from_string("127.0.0.1"), port);
+        boost::asio::ip::tcp::socket silent_socket(client_io_context);
+        boost::asio::ip::tcp::socket waiting_socket(client_io_context);
+        silent_socket.connect(server_endpoint);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        waiting_socket.connect(server_endpoint);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        
+        // The second client is left in the backlog while the first is pending
+        auto stats = server->getAdmissionStats();
+        EXPECT_EQ(stats.pending, 1u);
+        EXPECT_EQ(stats.admitted, 1u);
+        EXPECT_EQ(server->getSessionCount(), 0);
+        
+        // The silent client runs out of time, letting the second one in
+        std::vector<char> recv_buffer(1024);
+        boost::system::error_code error;
+        silent_socket.read_some(boost::asio::buffer(recv_buffer), error);
+        EXPECT_EQ(error, boost::asio::error::eof);
+        
+        boost::asio::write(waiting_socket, boost::asio::buffer(std::string("LOGIN:late\n")));
+        waiting_socket.read_some(boost::asio::buffer(recv_buffer));
+        EXPECT_EQ(server->getSessionCount(), 1);
+        stats = server->getAdmissionStats();
+        EXPECT_EQ(stats.admitted, 2u);
+        EXPECT_EQ(stats.pending, 0u);
+        EXPECT_EQ(stats.handshake_timeouts, 1u);
+        
+        waiting_socket.close();
+    }
+    catch (const std::exception& e) {
+        FAIL() << "Exception occurred: " << e.what();
+    }
+    
+    server->stop();
+    io_context.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
 // Test that multiple connections are handled by the thread pool
 TEST_F(ServerTest, MultipleConcurrentConnections) {
     // Start the server with 4 threads
@@ -150,8 +488,8 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
     // Run the io_context in a separate thread
     std::thread io_thread = runIoContextInThread();
     
-    // Set to collect thread IDs that process our requests
-    std::set<std::thread::id> threadIds;
+    // Set to collect thread IDs that process our requests, as the server prints them
+    std::set<std::string> threadIds;
     std::mutex threadIdsMutex;
     
     // Number of messages each client will send
@@ -162,9 +500,12 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
     try {
         std::vector<std::thread> clientThreads;
         std::atomic<int> clientsCompleted(0);
+        // Clients stay connected until their sessions are counted; a closed connection ends its session
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
         
         for (int i = 0; i < numClients; ++i) {
-            clientThreads.emplace_back([port, i, &threadIds, &threadIdsMutex, &clientsCompleted]() {
+            clientThreads.emplace_back([port, i, &threadIds, &threadIdsMutex, &clientsCompleted, released]() {
                 try {
                     // Create a separate io_context for each client
                     boost::asio::io_context client_io_context;
@@ -180,7 +521,7 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
                     for (int j = 0; j < messagesPerClient; ++j) {
                         // Send data to server
                         std::string message = "Client " + std::to_string(i) + 
-                                             " Message " + std::to_string(j);
+                                             " Message " + std::to_string(j) + "\n";
                         
                         boost::asio::write(client_socket, boost::asio::buffer(message));
                         
@@ -194,10 +535,7 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
                         size_t pos1 = response.find("thread ");
                         if (pos1 != std::string::npos) {
                             pos1 += 7; // Length of "thread "
-                            std::string threadIdStr = response.substr(pos1);
-                            std::thread::id threadId;
-                            std::istringstream iss(threadIdStr);
-                            iss >> threadId;
+                            std::string threadId = response.substr(pos1, response.find(' ', pos1) - pos1);
                             
                             // Add this thread ID to our set
                             std::lock_guard<std::mutex> lock(threadIdsMutex);
@@ -208,11 +546,10 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
                         std::this_thread::sleep_for(std::chrono::milliseconds(10));
                     }
                     
-                    // Close the socket
-                    client_socket.close();
-                    
-                    // Mark this client as completed
+                    // Mark this client as completed, then close the socket once told to
                     clientsCompleted++;
+                    released.wait();
+                    client_socket.close();
                 }
                 catch (const std::exception& e) {
                     std::cerr << "Client " << i << " exception: " << e.what() << std::endl;
@@ -225,7 +562,11 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
         
+        // The server should have created sessions for all clients
+        EXPECT_EQ(server->getSessionCount(), numClients);
+        
         // Join all client threads
+        release.set_value();
         for (auto& t : clientThreads) {
             if (t.joinable()) {
                 t.join();
@@ -240,8 +581,11 @@ TEST_F(ServerTest, MultipleConcurrentConnections) {
         std::cout << "Requests were processed by " << threadIds.size() 
                   << " different worker threads" << std::endl;
         
-        // The server should have created sessions for all clients
-        EXPECT_EQ(server->getSessionCount(), numClients);
+        // Anonymous sessions end with their connections; nothing is left to resume
+        for (int i = 0; i < 100 && server->getSessionCount() > 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(server->getSessionCount(), 0);
     }
     catch (const std::exception& e) {
         FAIL() << "Exception occurred: " << e.what();
@@ -289,8 +633,3 @@ TEST_F(ServerTest, GracefulShutdownOnSignal) {
         io_thread.join();
     }
 }
-
-int main(int argc, char **argv) {
-    ::testing::InitGoogleTest(&argc, argv);
-    return RUN_ALL_TESTS();
-}
\ No newline at end of file
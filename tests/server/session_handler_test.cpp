@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <set>
 #include <thread>
 #include <chrono>
+#include <vector>
 #include <boost/asio.hpp>
 #include "server/session_handler.h"
 
@@ -16,6 +19,7 @@ protected:
 
 TEST_F(SessionHandlerTest, SocketGuardRAII) {
     auto socket = createSocket();
+    socket->open(boost::asio::ip::tcp::v4());
     {
         SocketGuard guard(socket);
         EXPECT_TRUE(guard.isValid());
@@ -110,17 +114,184 @@ TEST_F(SessionHandlerTest, SessionCleanup) {
     auto [sessionId1, session1] = handler.createSession(socket1);
     auto [sessionId2, session2] = handler.createSession(socket2);
     EXPECT_EQ(handler.getSessionCount(), 2);
+    // Idle time is counted in whole seconds, so session1 has to sit for over one
     session1->setState(UserSession::State::CONNECTING);
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
     session2->setState(UserSession::State::CONNECTING);
-    int cleaned = handler.cleanupIdleSessions(5 / 1000);
+    int cleaned = handler.cleanupIdleSessions(0);
     EXPECT_EQ(cleaned, 1);
     EXPECT_EQ(handler.getSessionCount(), 1);
     EXPECT_EQ(handler.getSession(sessionId1), nullptr);
     EXPECT_NE(handler.getSession(sessionId2), nullptr);
 }
 
-int main(int argc, char **argv) {
-    ::testing::InitGoogleTest(&argc, argv);
-    return RUN_ALL_TESTS();
+TEST_F(SessionHandlerTest, HandlesFindSessionsAndOpenDocuments) {
+    SessionHandler handler;
+    auto [sessionId, session] = handler.createSession(createSocket());
+    EXPECT_NE(session->getHandle(), collab::util::NO_HANDLE);
+    EXPECT_EQ(handler.getSession(session->getHandle()), session);
+
+    EXPECT_TRUE(session->addDocument("doc1"));
+    const auto documentHandle = session->getDocumentHandle("doc1");
+    ASSERT_NE(session->getDocumentId(documentHandle), nullptr);
+    EXPECT_EQ(*session->getDocumentId(documentHandle), "doc1");
+    EXPECT_EQ(session->getDocumentHandle("doc2"), collab::util::NO_HANDLE);
+
+    EXPECT_TRUE(session->removeDocument("doc1"));
+    EXPECT_EQ(session->getDocumentId(documentHandle), nullptr);
+
+    const auto handle = session->getHandle();
+    EXPECT_TRUE(handler.closeSession(sessionId));
+    EXPECT_EQ(handler.getSession(handle), nullptr);
+}
+
+TEST_F(SessionHandlerTest, HandlesFindSessionsOnEveryShard) {
+    SessionHandler handler;
+    std::vector<std::shared_ptr<UserSession>> sessions;
+    for (int i = 0; i < 200; ++i) {
+        sessions.push_back(handler.createSession(createSocket()).second);
+    }
+    std::set<collab::util::Handle> handles;
+    std::set<collab::util::Handle> shards;
+    for (const auto& session : sessions) {
+        handles.insert(session->getHandle());
+        shards.insert(session->getHandle() & (SessionHandler::SHARDS - 1));
+        EXPECT_EQ(handler.getSession(session->getHandle()), session);
+        EXPECT_EQ(handler.getSession(session->getId()), session);
+    }
+    EXPECT_EQ(handles.size(), sessions.size());
+    EXPECT_EQ(shards.size(), SessionHandler::SHARDS);
+
+    size_t visited = 0;
+    handler.forEachSession([&visited](const std::shared_ptr<UserSession>&) { ++visited; });
+    EXPECT_EQ(visited, sessions.size());
+    EXPECT_EQ(handler.getSessions().size(), sessions.size());
+
+    const auto handle = sessions.front()->getHandle();
+    EXPECT_TRUE(handler.closeSession(sessions.front()->getId()));
+    EXPECT_EQ(handler.getSession(handle), nullptr);
+    EXPECT_EQ(handler.getSessionCount(), sessions.size() - 1);
+}
+
+TEST_F(SessionHandlerTest, DocumentMembersAreIndexed) {
+    SessionHandler handler;
+    auto [sessionId1, session1] = handler.createSession(createSocket());
+    auto [sessionId2, session2] = handler.createSession(createSocket());
+    EXPECT_TRUE(handler.authenticateSession(sessionId1, "user1"));
+    EXPECT_TRUE(handler.authenticateSession(sessionId2, "user2"));
+    session1->addDocument("doc1");
+    session2->addDocument("doc1");
+    session2->addDocument("doc2");
+    EXPECT_EQ(handler.getUsersOnDocument("doc1").size(), 2u);
+
+    // Closing a document or a session takes it out of the index
+    session2->removeDocument("doc1");
+    EXPECT_EQ(handler.getUsersOnDocument("doc1"), std::vector<std::string>{"user1"});
+    EXPECT_TRUE(handler.closeSession(sessionId2));
+    EXPECT_TRUE(handler.getUsersOnDocument("doc2").empty());
+    EXPECT_TRUE(handler.isUsernameAvailable("user2"));
+
+    // A closed session no longer reports to the index
+    session2->addDocument("doc1");
+    EXPECT_EQ(handler.getUsersOnDocument("doc1"), std::vector<std::string>{"user1"});
+}
+
+TEST_F(SessionHandlerTest, SubscriberSnapshotsStayValid) {
+    SessionHandler handler;
+    auto& membership = handler.getMembership();
+    auto watched = membership.watch("doc1");
+    EXPECT_TRUE(watched->load()->empty());
+
+    auto [sessionId1, session1] = handler.createSession(createSocket());
+    auto [sessionId2, session2] = handler.createSession(createSocket());
+    session1->addDocument("doc1");
+    auto before = membership.getSubscribers("doc1");
+    session2->addDocument("doc1");
+
+    // Joining swaps in a new list; the old snapshot is unchanged
+    ASSERT_EQ(before->size(), 1u);
+    EXPECT_EQ(before->front(), session1);
+    EXPECT_EQ(membership.getSubscribers("doc1")->size(), 2u);
+    EXPECT_EQ(watched->load()->size(), 2u);
+
+    // A snapshot keeps its sessions alive after they close
+    EXPECT_TRUE(handler.closeSession(sessionId1));
+    EXPECT_EQ(before->front()->getState(), UserSession::State::DISCONNECTED);
+    EXPECT_EQ(watched->load()->size(), 1u);
+    EXPECT_EQ(watched->load()->front(), session2);
+
+    session2->removeDocument("doc1");
+    EXPECT_TRUE(watched->load()->empty());
+    EXPECT_EQ(membership.getMemberCount("doc1"), 0u);
+}
+
+TEST_F(SessionHandlerTest, ConcurrentLookupsAndChanges) {
+    SessionHandler handler;
+    auto [readerId, reader] = handler.createSession(createSocket());
+    handler.authenticateSession(readerId, "reader");
+    reader->addDocument("shared");
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            while (!done.load()) {
+                EXPECT_EQ(handler.getSession(reader->getHandle()), reader);
+                EXPECT_FALSE(handler.getUsersOnDocument("shared").empty());
+            }
+        });
+    }
+    for (int i = 0; i < 200; ++i) {
+        auto [sessionId, session] = handler.createSession(createSocket());
+        handler.authenticateSession(sessionId, "user" + std::to_string(i));
+        session->addDocument("shared");
+        handler.closeSession(sessionId);
+    }
+    done = true;
+    for (auto& thread : readers) {
+        thread.join();
+    }
+    EXPECT_EQ(handler.getUsersOnDocument("shared"), std::vector<std::string>{"reader"});
+}
+
+TEST_F(SessionHandlerTest, DroppedSessionsResumeWithTheirDocuments) {
+    SessionHandler handler;
+    auto [sessionId, session] = handler.createSession(createSocket());
+    ASSERT_TRUE(handler.authenticateSession(sessionId, "alice"));
+    const std::string token = handler.issueResumeToken(sessionId);
+    ASSERT_EQ(token.size(), 32u);
+    session->addDocument("doc1");
+    session->addDocument("doc2");
+    session->acknowledge("doc1", 7);
+
+    // The connection drops: the session goes, the user and documents are kept
+    EXPECT_TRUE(handler.suspendSession(sessionId));
+    EXPECT_EQ(handler.getSessionCount(), 0u);
+    EXPECT_TRUE(handler.isUsernameAvailable("alice"));
+    EXPECT_EQ(handler.getMembership().getMemberCount("doc1"), 0u);
+
+    auto [resumedId, resumed] = handler.createSession(createSocket());
+    auto state = handler.resumeSession(resumedId, token);
+    ASSERT_TRUE(state.has_value());
+    EXPECT_EQ(state->username, "alice");
+    EXPECT_EQ(resumed->getState(), UserSession::State::AUTHENTICATED);
+    EXPECT_FALSE(handler.isUsernameAvailable("alice"));
+    EXPECT_TRUE(resumed->hasDocument("doc2"));
+    EXPECT_EQ(resumed->getAcknowledged("doc1"), 7);
+    EXPECT_EQ(handler.getMembership().getMemberCount("doc1"), 1u);
+    EXPECT_NE(resumed->getResumeToken(), token);
+
+    // A token resumes once, and a session closed for good cannot be resumed
+    auto [otherId, other] = handler.createSession(createSocket());
+    EXPECT_FALSE(handler.resumeSession(otherId, token).has_value());
+    const std::string next = resumed->getResumeToken();
+    EXPECT_TRUE(handler.closeSession(resumedId));
+    EXPECT_FALSE(handler.resumeSession(otherId, next).has_value());
+
+    // Without a grace period a dropped session just closes
+    handler.getResumption().setGrace(std::chrono::seconds(0));
+    ASSERT_TRUE(handler.authenticateSession(otherId, "bob"));
+    handler.issueResumeToken(otherId);
+    EXPECT_FALSE(handler.suspendSession(otherId));
+    EXPECT_EQ(handler.getSessionCount(), 0u);
 }
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include "server/session/session_resumption.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+TEST(SessionResumptionTest, KeepsSuspendedSessionsForTheGracePeriod) {
+    SessionResumption resumption(30s);
+    const std::string first = resumption.issue();
+    const std::string second = resumption.issue();
+    EXPECT_NE(first, second);
+
+    // Only suspended sessions resume, each once
+    EXPECT_FALSE(resumption.resume(first).has_value());
+    ASSERT_TRUE(resumption.suspend(first, {"alice", {{"doc", 4}}}));
+    EXPECT_FALSE(resumption.suspend(first, {"alice", {}}));
+    auto state = resumption.resume(first);
+    ASSERT_TRUE(state.has_value());
+    EXPECT_EQ(state->acknowledged.at("doc"), 4);
+    EXPECT_FALSE(resumption.resume(first).has_value());
+
+    // Past the grace period the session is dropped and handed back
+    ASSERT_TRUE(resumption.suspend(second, {"bob", {}}));
+    EXPECT_TRUE(resumption.expire(SessionResumption::Clock::now()).empty());
+    auto expired = resumption.expire(SessionResumption::Clock::now() + 31s);
+    ASSERT_EQ(expired.size(), 1u);
+    EXPECT_EQ(expired[0].username, "bob");
+    EXPECT_FALSE(resumption.resume(second).has_value());
+
+    const SessionResumption::Stats stats = resumption.getStats();
+    EXPECT_EQ(stats.issued, 2u);
+    EXPECT_EQ(stats.resumed, 1u);
+    EXPECT_EQ(stats.expired, 1u);
+    EXPECT_EQ(stats.rejected, 3u);
+    EXPECT_EQ(stats.retained, 0u);
+}
+
+TEST(SessionResumptionTest, CarriesOnFromTheLaterOfTheAckAndTheClientsClaim) {
+    const SessionResumption::Retained state{"alice", {{"doc", 5}}};
+    protocol::AuthMessage request(protocol::MessageType::AUTH_RESUME);
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "doc", request, 9), 5);
+    request.metadata["revision:doc"] = "8";
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "doc", request, 9), 8);
+    // Not past the document, not before the ack, and a number
+    request.metadata["revision:doc"] = "12";
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "doc", request, 9), 5);
+    request.metadata["revision:doc"] = "3";
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "doc", request, 9), 5);
+    request.metadata["revision:doc"] = "later";
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "doc", request, 9), 5);
+    EXPECT_EQ(SessionResumption::resumeFrom(state, "other", request, 9), 0);
+}
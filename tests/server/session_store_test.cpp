@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "server/session_handler.h"
+#include "server/session/session_store.h"
+
+using namespace collab;
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+namespace {
+
+// A store whose invalidations are lost, so caches only recover by their TTL
+class SilentStore : public InProcessSessionStore {
+public:
+    void watch(const std::string& node, Handler) override {
+        InProcessSessionStore::watch(node, [](const std::string&) {});
+    }
+};
+
+} // namespace
+
+TEST(SessionStoreTest, OneSessionHoldsAName) {
+    InProcessSessionStore store;
+    EXPECT_TRUE(store.claim("alice", {"a", "s1"}));
+    EXPECT_TRUE(store.claim("alice", {"a", "s1"}));
+    EXPECT_FALSE(store.claim("alice", {"a", "s2"}));
+    EXPECT_FALSE(store.claim("alice", {"b", "s1"}));
+
+    // Only the session that has it gives it back
+    store.release("alice", {"b", "s1"});
+    EXPECT_EQ(store.lookup("alice"), (SessionOwner{"a", "s1"}));
+    store.release("alice", {"a", "s1"});
+    EXPECT_FALSE(store.lookup("alice").has_value());
+
+    ASSERT_TRUE(store.claim("bob", {"a", "s3"}));
+    ASSERT_TRUE(store.claim("carol", {"b", "s4"}));
+    store.releaseNode("a");
+    EXPECT_FALSE(store.lookup("bob").has_value());
+    EXPECT_TRUE(store.lookup("carol").has_value());
+    EXPECT_EQ(store.getStats().conflicts, 2u);
+    EXPECT_EQ(store.getStats().usernames, 1u);
+}
+
+TEST(SessionStoreTest, DirectoryCachesUntilAnotherNodeChangesTheName) {
+    auto store = std::make_shared<InProcessSessionStore>();
+    SessionDirectory a(store, "a", {});
+    SessionDirectory b(store, "b", {});
+
+    // Answers about other nodes' names are cached, free ones included
+    EXPECT_TRUE(b.isAvailable("alice"));
+    EXPECT_TRUE(b.isAvailable("alice"));
+    EXPECT_EQ(b.getStats().misses, 1u);
+    EXPECT_EQ(b.getStats().hits, 1u);
+
+    // ...until the node that changes it tells the others
+    ASSERT_TRUE(a.claim("alice", "s1"));
+    EXPECT_EQ(b.getStats().invalidations, 1u);
+    EXPECT_EQ(b.lookup("alice"), (SessionOwner{"a", "s1"}));
+    EXPECT_FALSE(b.claim("alice", "s2"));
+    EXPECT_EQ(b.getStats().conflicts, 1u);
+
+    // A node's own names never go to the store
+    const uint64_t lookups = store->getStats().lookups;
+    EXPECT_EQ(a.lookup("alice"), (SessionOwner{"a", "s1"}));
+    EXPECT_EQ(store->getStats().lookups, lookups);
+
+    a.release("alice", "s1");
+    EXPECT_TRUE(b.isAvailable("alice"));
+    EXPECT_TRUE(a.isAvailable("alice"));
+}
+
+TEST(SessionStoreTest, LostInvalidationsLastTheTtl) {
+    auto store = std::make_shared<SilentStore>();
+    SessionDirectory a(store, "a", {});
+    SessionDirectory b(store, "b", {10s, 2});
+    const auto now = SessionDirectory::Clock::now();
+    ASSERT_TRUE(b.isAvailable("alice", now));
+    ASSERT_TRUE(a.claim("alice", "s1"));
+    EXPECT_TRUE(b.isAvailable("alice", now + 5s));
+    EXPECT_FALSE(b.isAvailable("alice", now + 11s));
+
+    // At most maxEntries answers are kept
+    b.lookup("bob", now);
+    b.lookup("carol", now);
+    EXPECT_EQ(b.getStats().entries, 2u);
+    b.lookup("dave", now + 30s);
+    EXPECT_EQ(b.getStats().entries, 1u);
+}
+
+TEST(SessionStoreTest, HandlersShareWhoIsLoggedIn) {
+    auto store = std::make_shared<InProcessSessionStore>();
+    SessionHandler a;
+    SessionHandler b;
+    a.setSessionStore(store, "a");
+    b.setSessionStore(store, "b");
+
+    auto [aliceId, alice] = a.createSession(nullptr);
+    ASSERT_TRUE(a.authenticateSession(aliceId, "alice"));
+    EXPECT_FALSE(a.isUsernameAvailable("alice"));
+    EXPECT_FALSE(b.isUsernameAvailable("alice"));
+    EXPECT_EQ(b.locateUser("alice"), (SessionOwner{"a", aliceId}));
+    EXPECT_EQ(b.getSessionByUsername("alice"), nullptr);
+
+    // The same user cannot log in on another node meanwhile
+    auto [otherId, other] = b.createSession(nullptr);
+    EXPECT_FALSE(b.authenticateSession(otherId, "alice"));
+
+    // Once alice leaves, she can
+    ASSERT_TRUE(a.closeSession(aliceId));
+    EXPECT_TRUE(b.isUsernameAvailable("alice"));
+    EXPECT_TRUE(b.authenticateSession(otherId, "alice"));
+    EXPECT_EQ(a.locateUser("alice"), (SessionOwner{"b", otherId}));
+    EXPECT_EQ(b.getSessionByUsername("alice"), other);
+}
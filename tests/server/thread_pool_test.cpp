@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include "server/thread_pool.h"
+
+using namespace collab::server;
+using namespace std::chrono_literals;
+
+TEST(TaskTest, StoresSmallCallablesInline) {
+    int calls = 0;
+    auto small = [&calls]() { ++calls; };
+    auto large = [&calls, padding = std::array<char, 128>{}]() { calls += 1 + padding[0]; };
+    EXPECT_TRUE(Task::fitsInline<decltype(small)>());
+    EXPECT_FALSE(Task::fitsInline<decltype(large)>());
+
+    Task first(small);
+    Task second(large);
+    Task moved(std::move(first));
+    EXPECT_FALSE(first);
+    moved();
+    second();
+    EXPECT_EQ(calls, 2);
+
+    // Move-only captures are fine
+    auto value = std::make_unique<int>(5);
+    Task owning([value = std::move(value), &calls]() { calls += *value; });
+    owning();
+    EXPECT_EQ(calls, 7);
+}
+
+TEST(WorkStealingDequeTest, OwnerPopsNewestAndThievesStealOldest) {
+    WorkStealingDeque<int> deque(4);
+    std::array<int, 5> items{0, 1, 2, 3, 4};
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(deque.push(&items[i]));
+    }
+    EXPECT_FALSE(deque.push(&items[4]));
+    EXPECT_EQ(deque.size(), 4u);
+
+    EXPECT_EQ(deque.steal(), &items[0]);
+    EXPECT_EQ(deque.pop(), &items[3]);
+    EXPECT_EQ(deque.steal(), &items[1]);
+    EXPECT_EQ(deque.pop(), &items[2]);
+    EXPECT_EQ(deque.pop(), nullptr);
+    EXPECT_EQ(deque.steal(), nullptr);
+}
+
+TEST(WorkStealingDequeTest, EveryItemIsTakenOnce) {
+    constexpr int ITEMS = 100000;
+    WorkStealingDeque<int> deque(256);
+    std::vector<int> values(ITEMS);
+    std::vector<std::atomic<int>> taken(ITEMS);
+    std::atomic<bool> done{false};
+
+    auto record = [&](int* item) { taken[item - values.data()].fetch_add(1); };
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.emplace_back([&]() {
+            while (!done.load()) {
+                if (int* item = deque.steal()) {
+                    record(item);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < ITEMS; ++i) {
+        while (!deque.push(&values[i])) {
+            if (int* item = deque.pop()) {
+                record(item);
+            }
+        }
+    }
+    while (int* item = deque.pop()) {
+        record(item);
+    }
+    done = true;
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    for (int i = 0; i < ITEMS; ++i) {
+        ASSERT_EQ(taken[i].load(), 1) << "item " << i;
+    }
+}
+
+TEST(ThreadPoolTest, RunsPostedAndNestedTasks) {
+    std::atomic<int> runs{0};
+    {
+        ThreadPool pool(4);
+        EXPECT_EQ(pool.size(), 4u);
+        for (int i = 0; i < 100; ++i) {
+            pool.post([&pool, &runs]() {
+                ++runs;
+                // Posted from a worker: goes on its own deque
+                for (int j = 0; j < 10; ++j) {
+                    pool.post([&runs]() { ++runs; });
+                }
+            });
+        }
+        // The destructor runs everything posted before it returns
+    }
+    EXPECT_EQ(runs.load(), 100 * 11);
+}
+
+TEST(ThreadPoolTest, EnqueueReturnsResultsAndExceptions) {
+    ThreadPool pool(2);
+    auto sum = pool.enqueue([](int a, int b) { return a + b; }, 2, 3);
+    auto failure = pool.enqueue([]() -> int { throw std::runtime_error("boom"); });
+    EXPECT_EQ(sum.get(), 5);
+    EXPECT_THROW(failure.get(), std::runtime_error);
+
+    // A throwing post() does not take its worker down
+    pool.post([]() { throw std::runtime_error("ignored"); });
+    EXPECT_EQ(pool.enqueue([]() { return 7; }).get(), 7);
+}
+
+TEST(ThreadPoolTest, IdleWorkersParkAndWake) {
+    ThreadPool pool(3);
+    // Long enough for every worker to stop spinning and park
+    std::this_thread::sleep_for(50ms);
+    EXPECT_EQ(pool.queueSize(), 0u);
+    std::promise<void> ran;
+    pool.post([&ran]() { ran.set_value(); });
+    EXPECT_EQ(ran.get_future().wait_for(1s), std::future_status::ready);
+}
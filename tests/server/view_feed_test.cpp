@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "server/session/view_feed.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+using Clock = ViewFeed::Clock;
+
+ot::OperationPtr insertAt(size_t position, const std::string& text) {
+    return std::make_shared<ot::InsertOperation>(position, text);
+}
+
+ot::OperationPtr deleteAt(size_t position, size_t length) {
+    return std::make_shared<ot::DeleteOperation>(position, length);
+}
+
+} // namespace
+
+TEST(ViewFeedTest, ComposesEditsIntoOneDiffPerInterval) {
+    ViewFeed feed(std::chrono::milliseconds(250));
+    const Clock::time_point start = Clock::now();
+    std::string viewerCopy = "hello";
+    EXPECT_FALSE(feed.subscribe("doc", "v1", viewerCopy.size(), start));
+    EXPECT_FALSE(feed.subscribe("doc", "v2", viewerCopy.size(), start));
+
+    // A quiet document sends its first diff at once, then one per interval
+    EXPECT_TRUE(feed.record("doc", *insertAt(5, " world"), 1, start));
+    ASSERT_EQ(feed.nextFlush(), start);
+    auto diffs = feed.flush(start);
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].revision, 1);
+    EXPECT_EQ(diffs[0].viewers.size(), 2u);
+    ASSERT_TRUE(diffs[0].op->apply(viewerCopy));
+    EXPECT_EQ(viewerCopy, "hello world");
+
+    // Typing, a typo fixed and more typing within the interval: one diff
+    const auto later = start + std::chrono::milliseconds(10);
+    EXPECT_TRUE(feed.record("doc", *insertAt(11, "!"), 2, later));
+    EXPECT_FALSE(feed.record("doc", *insertAt(0, "Xa"), 3, later));
+    EXPECT_FALSE(feed.record("doc", *deleteAt(0, 1), 4, later));
+    ASSERT_EQ(feed.nextFlush(), start + std::chrono::milliseconds(250));
+    EXPECT_TRUE(feed.flush(later).empty());
+    diffs = feed.flush(start + std::chrono::milliseconds(250));
+    ASSERT_EQ(diffs.size(), 1u);
+    EXPECT_EQ(diffs[0].revision, 4);
+    ASSERT_TRUE(diffs[0].op->apply(viewerCopy));
+    EXPECT_EQ(viewerCopy, "ahello world!");
+
+    // An insert deleted again composes to nothing and is not sent
+    const auto quiet = start + std::chrono::seconds(1);
+    feed.record("doc", *insertAt(0, "zz"), 5, quiet);
+    feed.record("doc", *deleteAt(0, 2), 6, quiet);
+    EXPECT_TRUE(feed.flush(quiet).empty());
+    EXPECT_FALSE(feed.nextFlush());
+
+    const auto stats = feed.getStats();
+    EXPECT_EQ(stats.viewers, 2u);
+    EXPECT_EQ(stats.documents, 1u);
+    EXPECT_EQ(stats.operations, 6u);
+    EXPECT_EQ(stats.diffs, 2u);
+    EXPECT_EQ(stats.deliveries, 4u);
+}
+
+TEST(ViewFeedTest, ViewerJoiningMidIntervalTakesThePendingDiffForTheOthers) {
+    ViewFeed feed;
+    const Clock::time_point start = Clock::now();
+    feed.subscribe("doc", "v1", 3, start);
+    feed.record("doc", *insertAt(3, "def"), 1, start);
+    feed.flush(start);
+    feed.record("doc", *insertAt(6, "ghi"), 2, start);
+
+    // The new viewer is sent "abcdefghi" whole; the pending diff is v1's alone
+    auto pending = feed.subscribe("doc", "v2", 9, start);
+    ASSERT_TRUE(pending);
+    EXPECT_EQ(pending->viewers, std::vector<std::string>{"v1"});
+    EXPECT_EQ(pending->revision, 2);
+    EXPECT_FALSE(feed.nextFlush());
+    EXPECT_FALSE(feed.subscribe("doc", "v2", 9, start));
+
+    EXPECT_TRUE(feed.isViewer("v2"));
+    EXPECT_TRUE(feed.unsubscribe("doc", "v2"));
+    EXPECT_FALSE(feed.isViewer("v2"));
+    feed.removeViewer("v1");
+    EXPECT_FALSE(feed.hasViewers("doc"));
+    EXPECT_FALSE(feed.record("doc", *insertAt(0, "x"), 3, start));
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include "server/session/workspace_preloader.h"
+
+using namespace collab;
+using namespace collab::server;
+
+namespace {
+
+// Loads every document as its ID, failing the ones named "broken"
+struct Storage {
+    std::mutex mutex;
+    std::multiset<std::string> loaded;
+
+    DocumentCache::Loader loader() {
+        return [this](const std::string& documentId) {
+            if (documentId.find("broken") != std::string::npos) {
+                throw std::runtime_error("Corrupt snapshot");
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.insert(documentId);
+            return std::make_shared<DocumentController>(documentId);
+        };
+    }
+};
+
+// Ten projects of a hundred files each, every tenth file a directory down
+std::shared_ptr<fs::Directory> makeWorkspace() {
+    auto root = std::make_shared<fs::Directory>("", "owner");
+    for (int project = 0; project < 10; ++project) {
+        auto directory = root->createDirectory("project" + std::to_string(project), "owner");
+        auto nested = directory->createDirectory("src", "owner");
+        for (int file = 0; file < 100; ++file) {
+            auto& parent = file % 10 == 0 ? nested : directory;
+            parent->createFile("file" + std::to_string(file) + ".txt", "owner");
+        }
+    }
+    root->createFile("README.md", "owner");
+    return root;
+}
+
+} // namespace
+
+TEST(WorkspacePreloaderTest, LoadsEveryDocumentOnce) {
+    Storage storage;
+    DocumentCache cache(SIZE_MAX, storage.loader(), [](const std::string&, const DocumentController&) {});
+    ThreadPool pool(4);
+
+    WorkspacePreloader preloader(cache, pool);
+    preloader.start(makeWorkspace());
+    const WorkspacePreloader::Stats stats = preloader.wait();
+
+    EXPECT_TRUE(stats.done);
+    EXPECT_EQ(stats.files, 1001u);
+    EXPECT_EQ(stats.loaded, 1001u);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(storage.loaded.size(), 1001u);
+    EXPECT_EQ(std::set<std::string>(storage.loaded.begin(), storage.loaded.end()).size(), 1001u);
+
+    // Resident and unpinned, so open() is a hit and eviction may take them
+    ASSERT_NE(cache.find("project3/src/file20.txt"), nullptr);
+    EXPECT_EQ(cache.find("project3/src/file20.txt")->getDocument(), "project3/src/file20.txt");
+    EXPECT_NE(cache.find("README.md"), nullptr);
+    EXPECT_EQ(cache.getStats().resident, 1001u);
+    EXPECT_EQ(cache.getStats().pinned, 0u);
+    cache.open("project7/file5.txt");
+    EXPECT_EQ(cache.getStats().misses, 1001u);
+}
+
+TEST(WorkspacePreloaderTest, SkipsDocumentsThatFailToLoad) {
+    Storage storage;
+    DocumentCache cache(SIZE_MAX, storage.loader(), [](const std::string&, const DocumentController&) {});
+    ThreadPool pool(2);
+
+    auto root = std::make_shared<fs::Directory>("", "owner");
+    root->createFile("good.txt", "owner");
+    root->createFile("broken.txt", "owner");
+    root->createDirectory("empty", "owner");
+
+    WorkspacePreloader preloader(cache, pool);
+    preloader.start(root);
+    const WorkspacePreloader::Stats stats = preloader.wait();
+    EXPECT_EQ(stats.files, 2u);
+    EXPECT_EQ(stats.loaded, 1u);
+    EXPECT_EQ(stats.failed, 1u);
+    EXPECT_NE(cache.find("good.txt"), nullptr);
+    EXPECT_EQ(cache.find("broken.txt"), nullptr);
+    EXPECT_THROW(cache.open("broken.txt"), std::runtime_error);
+}
+
+TEST(WorkspacePreloaderTest, NothingStartedIsDone) {
+    Storage storage;
+    DocumentCache cache(SIZE_MAX, storage.loader(), [](const std::string&, const DocumentController&) {});
+    ThreadPool pool(1);
+
+    WorkspacePreloader preloader(cache, pool);
+    EXPECT_TRUE(preloader.getStats().done);
+    EXPECT_EQ(preloader.wait().files, 0u);
+}